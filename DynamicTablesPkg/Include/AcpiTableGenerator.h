@@ -84,6 +84,8 @@ The Dynamic Tables Framework implements the following ACPI table generators:
             Configuration Manager and builds the CEDT table.
   - SLIT  : The SLIT generator collates the SLIT information from the
             Configuration Manager and builds the SLIT table.
+  - RIMT  : The RIMT generator collates the RISC-V IOMMU topology information
+            from the Configuration Manager and builds the RIMT table.
 */
 
 /** The ACPI_TABLE_GENERATOR_ID type describes ACPI table generator ID.
@@ -120,6 +122,7 @@ typedef enum StdAcpiTableId {
   EStdAcpiTableIdFacs,                          ///< FACS Generator
   EStdAcpiTableIdCedt,                          ///< CEDT Generator
   EStdAcpiTableIdSlit,                          ///< SLIT Generator
+  EStdAcpiTableIdRimt,                          ///< RIMT Generator
   EStdAcpiTableIdMax
 } ESTD_ACPI_TABLE_ID;
 
@@ -74,6 +74,11 @@ typedef enum ArchCommonObjectID {
   EArchCommonObjTpm2DeviceInfo,                 ///< 46 - TPM2 Device Info
   EArchCommonObjMcfgPciConfigSpaceInfo,         ///< 47 - MCFG PCI Configuration Space Info
   EArchCommonObjPciRootPortInfo,                ///< 48 - PCI root port configuration Info
+  EArchCommonObjRimtIommuInfo,                  ///< 49 - RIMT IOMMU Info
+  EArchCommonObjRimtInterruptWireArray,         ///< 50 - RIMT Interrupt Wire Array
+  EArchCommonObjRimtPcieRootComplexInfo,        ///< 51 - RIMT PCIe Root Complex Info
+  EArchCommonObjRimtPlatformDeviceInfo,         ///< 52 - RIMT Platform Device Info
+  EArchCommonObjRimtIdMappingArray,             ///< 53 - RIMT ID Mapping Array
   EArchCommonObjMax
 } EARCH_COMMON_OBJECT_ID;
 
@@ -1133,6 +1138,114 @@ typedef struct CmArchCommonObjSpcrInfo {
   UINT8    TerminalType;
 } CM_ARCH_COMMON_SPCR_INFO;
 
+/** A structure that describes a RISC-V IOMMU for the RIMT.
+
+    ID: EArchCommonObjRimtIommuInfo
+*/
+typedef struct CmArchCommonRimtIommuInfo {
+  /// An unique token used to identify this object
+  CM_OBJECT_TOKEN    Token;
+
+  /** ACPI _HID of a platform IOMMU, or PCIe ID of a PCIe IOMMU,
+      in the _HID format.
+  */
+  UINT64             HardwareId;
+
+  /// Base address of the registers of a platform IOMMU
+  UINT64             BaseAddress;
+
+  /// Flags, see IOMMU_NODE_FLAG_xxx in RiscVIoMappingTable.h
+  UINT32             Flags;
+
+  /// Proximity domain, if IOMMU_NODE_FLAG_PROXIMITY_DOMAIN_VALID is set
+  UINT32             ProximityDomain;
+
+  /// PCIe segment of a PCIe IOMMU
+  UINT16             PcieSegment;
+
+  /// Bus/Device/Function of a PCIe IOMMU
+  UINT16             PcieBdf;
+
+  /// Number of interrupt wires, 0 if the IOMMU only signals MSIs
+  UINT32             InterruptWireCount;
+
+  /// Reference token for the interrupt wire array
+  CM_OBJECT_TOKEN    InterruptWireToken;
+} CM_ARCH_COMMON_RIMT_IOMMU_INFO;
+
+/** A structure that describes an interrupt wire of a RISC-V IOMMU.
+
+    Interrupt   Global System Interrupt number.
+    Flags       Interrupt flags, see IOMMU_NODE_INTERRUPT_WIRE_FLAG_xxx
+                in RiscVIoMappingTable.h
+
+    ID: EArchCommonObjRimtInterruptWireArray
+*/
+typedef CM_ARCH_COMMON_GENERIC_INTERRUPT CM_ARCH_COMMON_RIMT_INTERRUPT_WIRE;
+
+/** A structure that describes a PCIe root complex for the RIMT.
+
+    ID: EArchCommonObjRimtPcieRootComplexInfo
+*/
+typedef struct CmArchCommonRimtPcieRootComplexInfo {
+  /// An unique token used to identify this object
+  CM_OBJECT_TOKEN    Token;
+
+  /// Flags, see PCIE_NODE_FLAG_xxx in RiscVIoMappingTable.h
+  UINT32             Flags;
+
+  /// PCIe segment number, as in the MCFG and _SEG
+  UINT16             PcieSegment;
+
+  /// Number of ID mappings
+  UINT32             IdMappingCount;
+
+  /// Reference token for the ID mapping array
+  CM_OBJECT_TOKEN    IdMappingToken;
+} CM_ARCH_COMMON_RIMT_PCIE_ROOT_COMPLEX_INFO;
+
+/** A structure that describes a platform device for the RIMT.
+
+    ID: EArchCommonObjRimtPlatformDeviceInfo
+*/
+typedef struct CmArchCommonRimtPlatformDeviceInfo {
+  /// An unique token used to identify this object
+  CM_OBJECT_TOKEN    Token;
+
+  /** ASCII Null terminated string with the full path to
+      the device object in the ACPI namespace.
+  */
+  CHAR8              *ObjectName;
+
+  /// Number of ID mappings
+  UINT32             IdMappingCount;
+
+  /// Reference token for the ID mapping array
+  CM_OBJECT_TOKEN    IdMappingToken;
+} CM_ARCH_COMMON_RIMT_PLATFORM_DEVICE_INFO;
+
+/** A structure that describes an ID mapping of a RIMT
+    PCIe root complex or platform device.
+
+    ID: EArchCommonObjRimtIdMappingArray
+*/
+typedef struct CmArchCommonRimtIdMapping {
+  /// Base of the source IDs
+  UINT32             SourceIdBase;
+
+  /// Number of IDs
+  UINT32             NumberOfIds;
+
+  /// Base of the IOMMU device_ids
+  UINT32             DestinationDeviceIdBase;
+
+  /// Reference token for the CM_ARCH_COMMON_RIMT_IOMMU_INFO of the IOMMU
+  CM_OBJECT_TOKEN    DestinationIommuToken;
+
+  /// Flags
+  UINT32             Flags;
+} CM_ARCH_COMMON_RIMT_ID_MAPPING;
+
 #pragma pack()
 
 #endif // ARCH_COMMON_NAMESPACE_OBJECTS_H_
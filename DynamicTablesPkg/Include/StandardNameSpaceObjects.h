@@ -64,7 +64,8 @@ typedef enum AbstractTokenID {
     types for the ETokenNameSpaceFdtHwInfo namespace.
 */
 typedef enum FdtHwInfoObjectID {
-  EFdtHwInfoIortObject = 0
+  EFdtHwInfoIortObject = 0,
+  EFdtHwInfoRimtObject
 } EFDT_HW_INFO_OBJECT_ID;
 
 /** Abstract token generated by table generators
@@ -0,0 +1,796 @@
+/** @file
+  RIMT Table Generator
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+  @par Reference(s):
+  - RISC-V IO Mapping Table (RIMT) Specification v1.0, March 2025.
+
+  @par Glossary:
+  - Cm or CM   - Configuration Manager
+  - Obj or OBJ - Object
+**/
+
+#include <IndustryStandard/RiscVIoMappingTable.h>
+#include <Library/AcpiLib.h>
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Protocol/AcpiTable.h>
+
+// Module specific include files.
+#include <AcpiTableGenerator.h>
+#include <ConfigurationManagerObject.h>
+#include <ConfigurationManagerHelper.h>
+#include <Library/TableHelperLib.h>
+#include <Protocol/ConfigurationManagerProtocol.h>
+
+/** Standard RIMT Generator
+
+Requirements:
+  The following Configuration Manager Object(s) are required by
+  this Generator:
+  - EArchCommonObjRimtIommuInfo
+  - EArchCommonObjRimtInterruptWireArray (OPTIONAL)
+  - EArchCommonObjRimtPcieRootComplexInfo (OPTIONAL)
+  - EArchCommonObjRimtPlatformDeviceInfo (OPTIONAL)
+  - EArchCommonObjRimtIdMappingArray (OPTIONAL)
+*/
+
+/** This macro expands to a function that retrieves the RISC-V
+    IOMMU information from the Configuration Manager.
+*/
+GET_OBJECT_LIST (
+  EObjNameSpaceArchCommon,
+  EArchCommonObjRimtIommuInfo,
+  CM_ARCH_COMMON_RIMT_IOMMU_INFO
+  );
+
+/** This macro expands to a function that retrieves the interrupt
+    wires of a RISC-V IOMMU from the Configuration Manager.
+*/
+GET_OBJECT_LIST (
+  EObjNameSpaceArchCommon,
+  EArchCommonObjRimtInterruptWireArray,
+  CM_ARCH_COMMON_RIMT_INTERRUPT_WIRE
+  );
+
+/** This macro expands to a function that retrieves the PCIe root
+    complex information from the Configuration Manager.
+*/
+GET_OBJECT_LIST (
+  EObjNameSpaceArchCommon,
+  EArchCommonObjRimtPcieRootComplexInfo,
+  CM_ARCH_COMMON_RIMT_PCIE_ROOT_COMPLEX_INFO
+  );
+
+/** This macro expands to a function that retrieves the platform
+    device information from the Configuration Manager.
+*/
+GET_OBJECT_LIST (
+  EObjNameSpaceArchCommon,
+  EArchCommonObjRimtPlatformDeviceInfo,
+  CM_ARCH_COMMON_RIMT_PLATFORM_DEVICE_INFO
+  );
+
+/** This macro expands to a function that retrieves the ID
+    mappings from the Configuration Manager.
+*/
+GET_OBJECT_LIST (
+  EObjNameSpaceArchCommon,
+  EArchCommonObjRimtIdMappingArray,
+  CM_ARCH_COMMON_RIMT_ID_MAPPING
+  );
+
+/** A structure that maps the token of an IOMMU to the offset
+    of its node in the RIMT, so that ID mappings can reference it.
+*/
+typedef struct RimtIommuIndexer {
+  /// Token of the CM_ARCH_COMMON_RIMT_IOMMU_INFO
+  CM_OBJECT_TOKEN    Token;
+
+  /// Offset of the IOMMU node from the start of the RIMT
+  UINT32             Offset;
+} RIMT_IOMMU_INDEXER;
+
+/** Find the offset of the node of an IOMMU in the RIMT.
+
+  @param [in]  IommuIndexer  Pointer to the IOMMU indexer array.
+  @param [in]  IommuCount    Number of entries in the indexer array.
+  @param [in]  Token         Token of the IOMMU.
+  @param [out] Offset        The offset of the IOMMU node.
+
+  @retval EFI_SUCCESS    The IOMMU was found.
+  @retval EFI_NOT_FOUND  No IOMMU has the token.
+**/
+STATIC
+EFI_STATUS
+GetIommuNodeOffset (
+  IN  CONST RIMT_IOMMU_INDEXER  *IommuIndexer,
+  IN        UINT32              IommuCount,
+  IN        CM_OBJECT_TOKEN     Token,
+  OUT       UINT32              *Offset
+  )
+{
+  UINT32  Index;
+
+  for (Index = 0; Index < IommuCount; Index++) {
+    if (IommuIndexer[Index].Token == Token) {
+      *Offset = IommuIndexer[Index].Offset;
+      return EFI_SUCCESS;
+    }
+  }
+
+  DEBUG ((
+    DEBUG_ERROR,
+    "ERROR: RIMT: No IOMMU for Token = %p\n",
+    (VOID *)Token
+    ));
+  return EFI_NOT_FOUND;
+}
+
+/** Get the size of a platform device node, including the name padding
+    and the ID mapping array.
+
+  @param [in]  PlatformDevice  The platform device.
+
+  @return The size of the node.
+**/
+STATIC
+UINT32
+GetPlatformDeviceNodeSize (
+  IN CONST CM_ARCH_COMMON_RIMT_PLATFORM_DEVICE_INFO  *PlatformDevice
+  )
+{
+  return (UINT32)(sizeof (RIMT_PLATFORM_DEVICE_NODE) +
+                  ALIGN_VALUE (AsciiStrSize (PlatformDevice->ObjectName), sizeof (UINT32)) +
+                  (PlatformDevice->IdMappingCount * sizeof (RIMT_PCIE_NODE_ID_MAPPING)));
+}
+
+/** Add the ID mappings of a PCIe root complex or platform device node.
+
+  @param [in]  CfgMgrProtocol  Pointer to the Configuration Manager
+                               Protocol Interface.
+  @param [in]  IdMapping       Pointer to the first ID mapping of the node.
+  @param [in]  IdMappingCount  Number of ID mappings.
+  @param [in]  IdMappingToken  Token of the ID mapping array.
+  @param [in]  IommuIndexer    Pointer to the IOMMU indexer array.
+  @param [in]  IommuCount      Number of entries in the indexer array.
+
+  @retval EFI_SUCCESS            The ID mappings were added.
+  @retval EFI_INVALID_PARAMETER  The Configuration Manager returned a
+                                 different number of ID mappings.
+  @retval EFI_NOT_FOUND          A mapping references an unknown IOMMU.
+**/
+STATIC
+EFI_STATUS
+AddIdMappingArray (
+  IN  CONST EDKII_CONFIGURATION_MANAGER_PROTOCOL  *CONST  CfgMgrProtocol,
+  IN        RIMT_PCIE_NODE_ID_MAPPING                     *IdMapping,
+  IN        UINT32                                        IdMappingCount,
+  IN        CM_OBJECT_TOKEN                               IdMappingToken,
+  IN  CONST RIMT_IOMMU_INDEXER                            *IommuIndexer,
+  IN        UINT32                                        IommuCount
+  )
+{
+  EFI_STATUS                      Status;
+  CM_ARCH_COMMON_RIMT_ID_MAPPING  *IdMappingInfo;
+  UINT32                          IdMappingInfoCount;
+  UINT32                          Index;
+
+  if (IdMappingCount == 0) {
+    return EFI_SUCCESS;
+  }
+
+  Status = GetEArchCommonObjRimtIdMappingArray (
+             CfgMgrProtocol,
+             IdMappingToken,
+             &IdMappingInfo,
+             &IdMappingInfoCount
+             );
+  if (EFI_ERROR (Status)) {
+    DEBUG ((
+      DEBUG_ERROR,
+      "ERROR: RIMT: Failed to get ID Mappings. Status = %r\n",
+      Status
+      ));
+    return Status;
+  }
+
+  if (IdMappingInfoCount != IdMappingCount) {
+    DEBUG ((
+      DEBUG_ERROR,
+      "ERROR: RIMT: ID Mapping Count = %d, expected %d\n",
+      IdMappingInfoCount,
+      IdMappingCount
+      ));
+    return EFI_INVALID_PARAMETER;
+  }
+
+  for (Index = 0; Index < IdMappingCount; Index++) {
+    IdMapping[Index].SourceIdBase            = IdMappingInfo[Index].SourceIdBase;
+    IdMapping[Index].NumberOfIds             = IdMappingInfo[Index].NumberOfIds;
+    IdMapping[Index].DestinationDeviceIdBase = IdMappingInfo[Index].DestinationDeviceIdBase;
+    IdMapping[Index].Flags                   = IdMappingInfo[Index].Flags;
+
+    Status = GetIommuNodeOffset (
+               IommuIndexer,
+               IommuCount,
+               IdMappingInfo[Index].DestinationIommuToken,
+               &IdMapping[Index].DestinationIoMmuOffset
+               );
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+  }
+
+  return EFI_SUCCESS;
+}
+
+/** Add the IOMMU nodes to the RIMT.
+
+  @param [in]  CfgMgrProtocol  Pointer to the Configuration Manager
+                               Protocol Interface.
+  @param [in]  Rimt            Pointer to the RIMT.
+  @param [in]  IommuInfo       Pointer to the IOMMU information.
+  @param [in]  IommuCount      Number of IOMMUs.
+  @param [in]  IommuIndexer    Pointer to the IOMMU indexer array, with the
+                               node offsets already set.
+  @param [in]  NodeId          Id of the first IOMMU node.
+
+  @retval EFI_SUCCESS            The nodes were added.
+  @retval EFI_INVALID_PARAMETER  The Configuration Manager returned a
+                                 different number of interrupt wires.
+**/
+STATIC
+EFI_STATUS
+AddIommuNodes (
+  IN  CONST EDKII_CONFIGURATION_MANAGER_PROTOCOL  *CONST  CfgMgrProtocol,
+  IN        EFI_ACPI_RIMT_HEADER                          *Rimt,
+  IN  CONST CM_ARCH_COMMON_RIMT_IOMMU_INFO                *IommuInfo,
+  IN        UINT32                                        IommuCount,
+  IN  CONST RIMT_IOMMU_INDEXER                            *IommuIndexer,
+  IN        UINT16                                        NodeId
+  )
+{
+  EFI_STATUS                          Status;
+  RIMT_IOMMU_NODE                     *IommuNode;
+  RIMT_IOMMU_NODE_INTERRUPT_WIRE      *Wire;
+  CM_ARCH_COMMON_RIMT_INTERRUPT_WIRE  *WireInfo;
+  UINT32                              WireCount;
+  UINT32                              Index;
+  UINT32                              WireIndex;
+
+  for (Index = 0; Index < IommuCount; Index++) {
+    IommuNode = (RIMT_IOMMU_NODE *)((UINT8 *)Rimt + IommuIndexer[Index].Offset);
+
+    IommuNode->Header.Type     = RISCV_IOMMU_NODE_TYPE;
+    IommuNode->Header.Revision = RIMT_NODE_REVISION;
+    IommuNode->Header.Length   = (UINT16)(sizeof (RIMT_IOMMU_NODE) +
+                                          (IommuInfo[Index].InterruptWireCount *
+                                           sizeof (RIMT_IOMMU_NODE_INTERRUPT_WIRE)));
+    IommuNode->Header.Reserved = EFI_ACPI_RESERVED_WORD;
+    IommuNode->Header.Id       = NodeId++;
+
+    IommuNode->HardwareId             = IommuInfo[Index].HardwareId;
+    IommuNode->BaseAddress            = IommuInfo[Index].BaseAddress;
+    IommuNode->Flags                  = IommuInfo[Index].Flags;
+    IommuNode->ProximityDomain        = IommuInfo[Index].ProximityDomain;
+    IommuNode->PcieSegment            = IommuInfo[Index].PcieSegment;
+    IommuNode->PcieBdf                = IommuInfo[Index].PcieBdf;
+    IommuNode->NumberOfInterruptWires = (UINT16)IommuInfo[Index].InterruptWireCount;
+    IommuNode->InterruptWireArrayOffset = (IommuInfo[Index].InterruptWireCount != 0) ?
+                                          sizeof (RIMT_IOMMU_NODE) : 0;
+
+    if (IommuInfo[Index].InterruptWireCount == 0) {
+      continue;
+    }
+
+    Status = GetEArchCommonObjRimtInterruptWireArray (
+               CfgMgrProtocol,
+               IommuInfo[Index].InterruptWireToken,
+               &WireInfo,
+               &WireCount
+               );
+    if (EFI_ERROR (Status)) {
+      DEBUG ((
+        DEBUG_ERROR,
+        "ERROR: RIMT: Failed to get Interrupt Wires. Status = %r\n",
+        Status
+        ));
+      return Status;
+    }
+
+    if (WireCount != IommuInfo[Index].InterruptWireCount) {
+      DEBUG ((
+        DEBUG_ERROR,
+        "ERROR: RIMT: Interrupt Wire Count = %d, expected %d\n",
+        WireCount,
+        IommuInfo[Index].InterruptWireCount
+        ));
+      return EFI_INVALID_PARAMETER;
+    }
+
+    // The RIMT wire flags have the opposite polarity of the generic
+    // interrupt flags: they report level triggered and active high.
+    Wire = (RIMT_IOMMU_NODE_INTERRUPT_WIRE *)((UINT8 *)IommuNode + sizeof (RIMT_IOMMU_NODE));
+    for (WireIndex = 0; WireIndex < WireCount; WireIndex++) {
+      Wire[WireIndex].InterruptNumber = WireInfo[WireIndex].Interrupt;
+      Wire[WireIndex].Flags           = 0;
+      if ((WireInfo[WireIndex].Flags & BIT0) == 0) {
+        Wire[WireIndex].Flags |= IOMMU_NODE_INTERRUPT_WIRE_FLAG_LEVEL_TRIGGERED;
+      }
+
+      if ((WireInfo[WireIndex].Flags & BIT1) == 0) {
+        Wire[WireIndex].Flags |= IOMMU_NODE_INTERRUPT_WIRE_FLAG_ACTIVE_HIGH;
+      }
+    }
+  }
+
+  return EFI_SUCCESS;
+}
+
+/** Construct the RIMT ACPI table.
+
+  This function invokes the Configuration Manager protocol interface
+  to get the required hardware information for generating the ACPI
+  table.
+
+  If this function allocates any resources then they must be freed
+  in the FreeXXXXTableResources function.
+
+  @param [in]  This           Pointer to the table generator.
+  @param [in]  AcpiTableInfo  Pointer to the ACPI Table Info.
+  @param [in]  CfgMgrProtocol Pointer to the Configuration Manager
+                              Protocol Interface.
+  @param [out] Table          Pointer to the constructed ACPI Table.
+
+  @retval EFI_SUCCESS           Table generated successfully.
+  @retval EFI_INVALID_PARAMETER A parameter is invalid.
+  @retval EFI_NOT_FOUND         The required object was not found.
+  @retval EFI_BAD_BUFFER_SIZE   The size returned by the Configuration
+                                Manager is less than the Object size for the
+                                requested object.
+  @retval EFI_OUT_OF_RESOURCES  Memory allocation failed.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+BuildRimtTable (
+  IN  CONST ACPI_TABLE_GENERATOR                  *CONST  This,
+  IN  CONST CM_STD_OBJ_ACPI_TABLE_INFO            *CONST  AcpiTableInfo,
+  IN  CONST EDKII_CONFIGURATION_MANAGER_PROTOCOL  *CONST  CfgMgrProtocol,
+  OUT       EFI_ACPI_DESCRIPTION_HEADER          **CONST  Table
+  )
+{
+  EFI_STATUS                                  Status;
+  UINT64                                      TableSize;
+  UINT64                                      NodeSize;
+  UINT32                                      Index;
+  UINT32                                      Offset;
+  UINT16                                      NodeId;
+  CM_ARCH_COMMON_RIMT_IOMMU_INFO              *IommuInfo;
+  UINT32                                      IommuCount;
+  CM_ARCH_COMMON_RIMT_PCIE_ROOT_COMPLEX_INFO  *RootComplexInfo;
+  UINT32                                      RootComplexCount;
+  CM_ARCH_COMMON_RIMT_PLATFORM_DEVICE_INFO    *PlatformDeviceInfo;
+  UINT32                                      PlatformDeviceCount;
+  RIMT_IOMMU_INDEXER                          *IommuIndexer;
+  EFI_ACPI_RIMT_HEADER                        *Rimt;
+  RIMT_PCIE_NODE                              *PcieNode;
+  RIMT_PLATFORM_DEVICE_NODE                   *PlatformDeviceNode;
+
+  ASSERT (This != NULL);
+  ASSERT (AcpiTableInfo != NULL);
+  ASSERT (CfgMgrProtocol != NULL);
+  ASSERT (Table != NULL);
+  ASSERT (AcpiTableInfo->TableGeneratorId == This->GeneratorID);
+  ASSERT (AcpiTableInfo->AcpiTableSignature == This->AcpiTableSignature);
+
+  if ((AcpiTableInfo->AcpiTableRevision < This->MinAcpiTableRevision) ||
+      (AcpiTableInfo->AcpiTableRevision > This->AcpiTableRevision))
+  {
+    DEBUG ((
+      DEBUG_ERROR,
+      "ERROR: RIMT: Requested table revision = %d, is not supported."
+      "Supported table revision: Minimum = %d, Maximum = %d\n",
+      AcpiTableInfo->AcpiTableRevision,
+      This->MinAcpiTableRevision,
+      This->AcpiTableRevision
+      ));
+    return EFI_INVALID_PARAMETER;
+  }
+
+  *Table       = NULL;
+  IommuIndexer = NULL;
+
+  Status = GetEArchCommonObjRimtIommuInfo (
+             CfgMgrProtocol,
+             CM_NULL_TOKEN,
+             &IommuInfo,
+             &IommuCount
+             );
+  if (EFI_ERROR (Status)) {
+    DEBUG ((
+      DEBUG_ERROR,
+      "ERROR: RIMT: Failed to get IOMMU Info. Status = %r\n",
+      Status
+      ));
+    goto error_handler;
+  }
+
+  if (IommuCount == 0) {
+    DEBUG ((DEBUG_ERROR, "ERROR: RIMT: IOMMU Count = 0\n"));
+    Status = EFI_INVALID_PARAMETER;
+    goto error_handler;
+  }
+
+  Status = GetEArchCommonObjRimtPcieRootComplexInfo (
+             CfgMgrProtocol,
+             CM_NULL_TOKEN,
+             &RootComplexInfo,
+             &RootComplexCount
+             );
+  if (Status == EFI_NOT_FOUND) {
+    RootComplexCount = 0;
+  } else if (EFI_ERROR (Status)) {
+    DEBUG ((
+      DEBUG_ERROR,
+      "ERROR: RIMT: Failed to get PCIe Root Complex Info. Status = %r\n",
+      Status
+      ));
+    goto error_handler;
+  }
+
+  Status = GetEArchCommonObjRimtPlatformDeviceInfo (
+             CfgMgrProtocol,
+             CM_NULL_TOKEN,
+             &PlatformDeviceInfo,
+             &PlatformDeviceCount
+             );
+  if (Status == EFI_NOT_FOUND) {
+    PlatformDeviceCount = 0;
+  } else if (EFI_ERROR (Status)) {
+    DEBUG ((
+      DEBUG_ERROR,
+      "ERROR: RIMT: Failed to get Platform Device Info. Status = %r\n",
+      Status
+      ));
+    goto error_handler;
+  }
+
+  if ((UINT64)IommuCount + RootComplexCount + PlatformDeviceCount > MAX_UINT16) {
+    DEBUG ((DEBUG_ERROR, "ERROR: RIMT: Too many nodes\n"));
+    Status = EFI_INVALID_PARAMETER;
+    goto error_handler;
+  }
+
+  IommuIndexer = AllocateZeroPool (sizeof (RIMT_IOMMU_INDEXER) * IommuCount);
+  if (IommuIndexer == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto error_handler;
+  }
+
+  // Calculate the RIMT Table Size, and the offset of every IOMMU node.
+  // The node lengths are 16-bit wide.
+  TableSize = sizeof (EFI_ACPI_RIMT_HEADER);
+  for (Index = 0; Index < IommuCount; Index++) {
+    IommuIndexer[Index].Token  = IommuInfo[Index].Token;
+    IommuIndexer[Index].Offset = (UINT32)TableSize;
+
+    NodeSize = sizeof (RIMT_IOMMU_NODE) +
+               ((UINT64)IommuInfo[Index].InterruptWireCount * sizeof (RIMT_IOMMU_NODE_INTERRUPT_WIRE));
+    if (NodeSize > MAX_UINT16) {
+      Status = EFI_INVALID_PARAMETER;
+      goto error_handler;
+    }
+
+    TableSize += NodeSize;
+  }
+
+  for (Index = 0; Index < RootComplexCount; Index++) {
+    NodeSize = sizeof (RIMT_PCIE_NODE) +
+               ((UINT64)RootComplexInfo[Index].IdMappingCount * sizeof (RIMT_PCIE_NODE_ID_MAPPING));
+    if (NodeSize > MAX_UINT16) {
+      Status = EFI_INVALID_PARAMETER;
+      goto error_handler;
+    }
+
+    TableSize += NodeSize;
+  }
+
+  for (Index = 0; Index < PlatformDeviceCount; Index++) {
+    if (PlatformDeviceInfo[Index].ObjectName == NULL) {
+      DEBUG ((DEBUG_ERROR, "ERROR: RIMT: Platform Device without an Object Name\n"));
+      Status = EFI_INVALID_PARAMETER;
+      goto error_handler;
+    }
+
+    NodeSize = GetPlatformDeviceNodeSize (&PlatformDeviceInfo[Index]);
+    if (NodeSize > MAX_UINT16) {
+      Status = EFI_INVALID_PARAMETER;
+      goto error_handler;
+    }
+
+    TableSize += NodeSize;
+  }
+
+  if (TableSize > MAX_UINT32) {
+    Status = EFI_INVALID_PARAMETER;
+    goto error_handler;
+  }
+
+  DEBUG ((
+    DEBUG_INFO,
+    "RIMT: IOMMU Count = %d, Root Complex Count = %d, Platform Device Count = %d\n",
+    IommuCount,
+    RootComplexCount,
+    PlatformDeviceCount
+    ));
+
+  *Table = (EFI_ACPI_DESCRIPTION_HEADER *)AllocateZeroPool ((UINTN)TableSize);
+  if (*Table == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    DEBUG ((
+      DEBUG_ERROR,
+      "ERROR: RIMT: Failed to allocate memory for RIMT Table, Size = %d," \
+      " Status = %r\n",
+      (UINT32)TableSize,
+      Status
+      ));
+    goto error_handler;
+  }
+
+  Rimt = (EFI_ACPI_RIMT_HEADER *)*Table;
+
+  Status = AddAcpiHeader (
+             CfgMgrProtocol,
+             This,
+             &Rimt->Header,
+             AcpiTableInfo,
+             (UINT32)TableSize
+             );
+  if (EFI_ERROR (Status)) {
+    DEBUG ((
+      DEBUG_ERROR,
+      "ERROR: RIMT: Failed to add ACPI header. Status = %r\n",
+      Status
+      ));
+    goto error_handler;
+  }
+
+  Rimt->NumberOfNodes     = IommuCount + RootComplexCount + PlatformDeviceCount;
+  Rimt->OffsetToNodeArray = sizeof (EFI_ACPI_RIMT_HEADER);
+  Rimt->Reserved          = EFI_ACPI_RESERVED_DWORD;
+
+  NodeId = 0;
+  Status = AddIommuNodes (
+             CfgMgrProtocol,
+             Rimt,
+             IommuInfo,
+             IommuCount,
+             IommuIndexer,
+             NodeId
+             );
+  if (EFI_ERROR (Status)) {
+    goto error_handler;
+  }
+
+  NodeId += (UINT16)IommuCount;
+  Offset  = IommuIndexer[IommuCount - 1].Offset +
+            ((RIMT_NODE_HEADER *)((UINT8 *)Rimt + IommuIndexer[IommuCount - 1].Offset))->Length;
+
+  for (Index = 0; Index < RootComplexCount; Index++) {
+    PcieNode = (RIMT_PCIE_NODE *)((UINT8 *)Rimt + Offset);
+
+    PcieNode->Header.Type     = PCIE_ROOT_COMPLEX_NODE_TYPE;
+    PcieNode->Header.Revision = RIMT_NODE_REVISION;
+    PcieNode->Header.Length   = (UINT16)(sizeof (RIMT_PCIE_NODE) +
+                                         (RootComplexInfo[Index].IdMappingCount *
+                                          sizeof (RIMT_PCIE_NODE_ID_MAPPING)));
+    PcieNode->Header.Reserved = EFI_ACPI_RESERVED_WORD;
+    PcieNode->Header.Id       = NodeId++;
+
+    PcieNode->Flags                = RootComplexInfo[Index].Flags;
+    PcieNode->Reserved             = EFI_ACPI_RESERVED_WORD;
+    PcieNode->PcieSegment          = RootComplexInfo[Index].PcieSegment;
+    PcieNode->IdMappingArrayOffset = (RootComplexInfo[Index].IdMappingCount != 0) ?
+                                     sizeof (RIMT_PCIE_NODE) : 0;
+    PcieNode->NumberOfIdMappings = (UINT16)RootComplexInfo[Index].IdMappingCount;
+
+    Status = AddIdMappingArray (
+               CfgMgrProtocol,
+               (RIMT_PCIE_NODE_ID_MAPPING *)((UINT8 *)PcieNode + sizeof (RIMT_PCIE_NODE)),
+               RootComplexInfo[Index].IdMappingCount,
+               RootComplexInfo[Index].IdMappingToken,
+               IommuIndexer,
+               IommuCount
+               );
+    if (EFI_ERROR (Status)) {
+      goto error_handler;
+    }
+
+    Offset += PcieNode->Header.Length;
+  }
+
+  for (Index = 0; Index < PlatformDeviceCount; Index++) {
+    PlatformDeviceNode = (RIMT_PLATFORM_DEVICE_NODE *)((UINT8 *)Rimt + Offset);
+
+    PlatformDeviceNode->Header.Type     = PLATFORM_DEVICE_NODE_TYPE;
+    PlatformDeviceNode->Header.Revision = RIMT_NODE_REVISION;
+    PlatformDeviceNode->Header.Length   = (UINT16)GetPlatformDeviceNodeSize (&PlatformDeviceInfo[Index]);
+    PlatformDeviceNode->Header.Reserved = EFI_ACPI_RESERVED_WORD;
+    PlatformDeviceNode->Header.Id       = NodeId++;
+
+    // The name is padded with zeros to align the ID mapping array.
+    PlatformDeviceNode->IdMappingArrayOffset = (UINT16)(sizeof (RIMT_PLATFORM_DEVICE_NODE) +
+                                                        ALIGN_VALUE (
+                                                          AsciiStrSize (PlatformDeviceInfo[Index].ObjectName),
+                                                          sizeof (UINT32)
+                                                          ));
+    PlatformDeviceNode->NumberOfIdMappings = (UINT16)PlatformDeviceInfo[Index].IdMappingCount;
+
+    Status = AsciiStrCpyS (
+               PlatformDeviceNode->DeviceObjectName,
+               PlatformDeviceNode->IdMappingArrayOffset - sizeof (RIMT_PLATFORM_DEVICE_NODE),
+               PlatformDeviceInfo[Index].ObjectName
+               );
+    if (EFI_ERROR (Status)) {
+      goto error_handler;
+    }
+
+    Status = AddIdMappingArray (
+               CfgMgrProtocol,
+               (RIMT_PCIE_NODE_ID_MAPPING *)((UINT8 *)PlatformDeviceNode +
+                                             PlatformDeviceNode->IdMappingArrayOffset),
+               PlatformDeviceInfo[Index].IdMappingCount,
+               PlatformDeviceInfo[Index].IdMappingToken,
+               IommuIndexer,
+               IommuCount
+               );
+    if (EFI_ERROR (Status)) {
+      goto error_handler;
+    }
+
+    Offset += PlatformDeviceNode->Header.Length;
+  }
+
+  ASSERT (Offset == TableSize);
+
+  FreePool (IommuIndexer);
+  return EFI_SUCCESS;
+
+error_handler:
+  if (IommuIndexer != NULL) {
+    FreePool (IommuIndexer);
+  }
+
+  if (*Table != NULL) {
+    FreePool (*Table);
+    *Table = NULL;
+  }
+
+  return Status;
+}
+
+/** Free any resources allocated for constructing the RIMT
+
+  @param [in]      This           Pointer to the table generator.
+  @param [in]      AcpiTableInfo  Pointer to the ACPI Table Info.
+  @param [in]      CfgMgrProtocol Pointer to the Configuration Manager
+                                  Protocol Interface.
+  @param [in, out] Table          Pointer to the ACPI Table.
+
+  @retval EFI_SUCCESS           The resources were freed successfully.
+  @retval EFI_INVALID_PARAMETER The table pointer is NULL or invalid.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+FreeRimtTableResources (
+  IN      CONST ACPI_TABLE_GENERATOR                  *CONST  This,
+  IN      CONST CM_STD_OBJ_ACPI_TABLE_INFO            *CONST  AcpiTableInfo,
+  IN      CONST EDKII_CONFIGURATION_MANAGER_PROTOCOL  *CONST  CfgMgrProtocol,
+  IN OUT        EFI_ACPI_DESCRIPTION_HEADER          **CONST  Table
+  )
+{
+  ASSERT (This != NULL);
+  ASSERT (AcpiTableInfo != NULL);
+  ASSERT (CfgMgrProtocol != NULL);
+  ASSERT (AcpiTableInfo->TableGeneratorId == This->GeneratorID);
+  ASSERT (AcpiTableInfo->AcpiTableSignature == This->AcpiTableSignature);
+
+  if ((Table == NULL) || (*Table == NULL)) {
+    DEBUG ((DEBUG_ERROR, "ERROR: RIMT: Invalid Table Pointer\n"));
+    ASSERT ((Table != NULL) && (*Table != NULL));
+    return EFI_INVALID_PARAMETER;
+  }
+
+  FreePool (*Table);
+  *Table = NULL;
+  return EFI_SUCCESS;
+}
+
+/** This macro defines the RIMT Table Generator revision.
+*/
+#define RIMT_GENERATOR_REVISION  CREATE_REVISION (1, 0)
+
+/** The interface for the RIMT Table Generator.
+*/
+STATIC
+CONST
+ACPI_TABLE_GENERATOR  RimtGenerator = {
+  // Generator ID
+  CREATE_STD_ACPI_TABLE_GEN_ID (EStdAcpiTableIdRimt),
+  // Generator Description
+  L"ACPI.STD.RIMT.GENERATOR",
+  // ACPI Table Signature
+  EFI_ACPI_RISCV_IO_MAPPING_TABLE_SIGNATURE,
+  // ACPI Table Revision supported by this Generator
+  RIMT_REVISION,
+  // Minimum supported ACPI Table Revision
+  RIMT_REVISION,
+  // Creator ID
+  TABLE_GENERATOR_CREATOR_ID,
+  // Creator Revision
+  RIMT_GENERATOR_REVISION,
+  // Build Table function
+  BuildRimtTable,
+  // Free Resource function
+  FreeRimtTableResources,
+  // Extended build function not needed
+  NULL,
+  // Extended build function not implemented by the generator.
+  // Hence extended free resource function is not required.
+  NULL
+};
+
+/** Register the Generator with the ACPI Table Factory.
+
+  @param [in]  ImageHandle  The handle to the image.
+  @param [in]  SystemTable  Pointer to the System Table.
+
+  @retval EFI_SUCCESS           The Generator is registered.
+  @retval EFI_INVALID_PARAMETER A parameter is invalid.
+  @retval EFI_ALREADY_STARTED   The Generator for the Table ID
+                                is already registered.
+**/
+EFI_STATUS
+EFIAPI
+AcpiRimtLibConstructor (
+  IN  EFI_HANDLE        ImageHandle,
+  IN  EFI_SYSTEM_TABLE  *SystemTable
+  )
+{
+  EFI_STATUS  Status;
+
+  Status = RegisterAcpiTableGenerator (&RimtGenerator);
+  DEBUG ((DEBUG_INFO, "RIMT: Register Generator. Status = %r\n", Status));
+  ASSERT_EFI_ERROR (Status);
+  return Status;
+}
+
+/** Deregister the Generator from the ACPI Table Factory.
+
+  @param [in]  ImageHandle  The handle to the image.
+  @param [in]  SystemTable  Pointer to the System Table.
+
+  @retval EFI_SUCCESS           The Generator is deregistered.
+  @retval EFI_INVALID_PARAMETER A parameter is invalid.
+  @retval EFI_NOT_FOUND         The Generator is not registered.
+**/
+EFI_STATUS
+EFIAPI
+AcpiRimtLibDestructor (
+  IN  EFI_HANDLE        ImageHandle,
+  IN  EFI_SYSTEM_TABLE  *SystemTable
+  )
+{
+  EFI_STATUS  Status;
+
+  Status = DeregisterAcpiTableGenerator (&RimtGenerator);
+  DEBUG ((DEBUG_INFO, "RIMT: Deregister Generator. Status = %r\n", Status));
+  ASSERT_EFI_ERROR (Status);
+  return Status;
+}
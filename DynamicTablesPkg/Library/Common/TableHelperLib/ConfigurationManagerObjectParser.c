@@ -898,6 +898,49 @@ STATIC CONST CM_OBJ_PARSER  CmArchCommonObjPciRootPortInfoParser[] = {
   { "Sun",              4,                        "0x%x", NULL }
 };
 
+/** A parser for EArchCommonObjRimtIommuInfo.
+*/
+STATIC CONST CM_OBJ_PARSER  CmArchCommonRimtIommuInfoParser[] = {
+  { "Token",              sizeof (CM_OBJECT_TOKEN), "0x%p",   NULL       },
+  { "HardwareId",         8,                        NULL,     PrintChars },
+  { "BaseAddress",        8,                        "0x%llx", NULL       },
+  { "Flags",              4,                        "0x%x",   NULL       },
+  { "ProximityDomain",    4,                        "0x%x",   NULL       },
+  { "PcieSegment",        2,                        "0x%x",   NULL       },
+  { "PcieBdf",            2,                        "0x%x",   NULL       },
+  { "InterruptWireCount", 4,                        "0x%x",   NULL       },
+  { "InterruptWireToken", sizeof (CM_OBJECT_TOKEN), "0x%p",   NULL       },
+};
+
+/** A parser for EArchCommonObjRimtPcieRootComplexInfo.
+*/
+STATIC CONST CM_OBJ_PARSER  CmArchCommonRimtPcieRootComplexInfoParser[] = {
+  { "Token",          sizeof (CM_OBJECT_TOKEN), "0x%p", NULL },
+  { "Flags",          4,                        "0x%x", NULL },
+  { "PcieSegment",    2,                        "0x%x", NULL },
+  { "IdMappingCount", 4,                        "0x%x", NULL },
+  { "IdMappingToken", sizeof (CM_OBJECT_TOKEN), "0x%p", NULL },
+};
+
+/** A parser for EArchCommonObjRimtPlatformDeviceInfo.
+*/
+STATIC CONST CM_OBJ_PARSER  CmArchCommonRimtPlatformDeviceInfoParser[] = {
+  { "Token",          sizeof (CM_OBJECT_TOKEN), "0x%p", NULL           },
+  { "ObjectName",     sizeof (CHAR8 *),         NULL,   PrintStringPtr },
+  { "IdMappingCount", 4,                        "0x%x", NULL           },
+  { "IdMappingToken", sizeof (CM_OBJECT_TOKEN), "0x%p", NULL           },
+};
+
+/** A parser for EArchCommonObjRimtIdMappingArray.
+*/
+STATIC CONST CM_OBJ_PARSER  CmArchCommonRimtIdMappingParser[] = {
+  { "SourceIdBase",            4,                        "0x%x", NULL },
+  { "NumberOfIds",             4,                        "0x%x", NULL },
+  { "DestinationDeviceIdBase", 4,                        "0x%x", NULL },
+  { "DestinationIommuToken",   sizeof (CM_OBJECT_TOKEN), "0x%p", NULL },
+  { "Flags",                   4,                        "0x%x", NULL },
+};
+
 /** A parser for Arch Common namespace objects.
 */
 STATIC CONST CM_OBJ_PARSER_ARRAY  ArchCommonNamespaceObjectParser[] = {
@@ -950,6 +993,11 @@ STATIC CONST CM_OBJ_PARSER_ARRAY  ArchCommonNamespaceObjectParser[] = {
   CM_PARSER_ADD_OBJECT (EArchCommonObjTpm2DeviceInfo,               CmArchCommonObjTpm2DeviceInfoParser),
   CM_PARSER_ADD_OBJECT (EArchCommonObjMcfgPciConfigSpaceInfo,       CmArchCommonPciConfigSpaceInfoParser),
   CM_PARSER_ADD_OBJECT (EArchCommonObjPciRootPortInfo,              CmArchCommonObjPciRootPortInfoParser),
+  CM_PARSER_ADD_OBJECT (EArchCommonObjRimtIommuInfo,                CmArchCommonRimtIommuInfoParser),
+  CM_PARSER_ADD_OBJECT (EArchCommonObjRimtInterruptWireArray,       CmArchCommonGenericInterruptParser),
+  CM_PARSER_ADD_OBJECT (EArchCommonObjRimtPcieRootComplexInfo,      CmArchCommonRimtPcieRootComplexInfoParser),
+  CM_PARSER_ADD_OBJECT (EArchCommonObjRimtPlatformDeviceInfo,       CmArchCommonRimtPlatformDeviceInfoParser),
+  CM_PARSER_ADD_OBJECT (EArchCommonObjRimtIdMappingArray,           CmArchCommonRimtIdMappingParser),
   CM_PARSER_ADD_OBJECT_RESERVED (EArchCommonObjMax)
 };
 
@@ -0,0 +1,624 @@
+/** @file
+  RISC-V IO Mapping Table parser.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+  @par Reference(s):
+  - linux/Documentation/devicetree/bindings/iommu/riscv,iommu.yaml
+  - linux/Documentation/devicetree/bindings/pci/host-generic-pci.yaml
+**/
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/FdtLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <IndustryStandard/RiscVIoMappingTable.h>
+#include "FdtHwInfoParser.h"
+#include "CmObjectDescUtility.h"
+#include "RiscV/Rimt/RimtParser.h"
+
+#define IOMMU_MAP_CELL_COUNT  4
+
+/// ACPI _HID of a platform RISC-V IOMMU.
+#define RISCV_IOMMU_PLATFORM_HID  SIGNATURE_64 ('R', 'S', 'C', 'V', '0', '0', '0', '4')
+
+/** List of "compatible" property values for RISC-V IOMMU nodes.
+
+  Other "compatible" values are not supported by this module.
+*/
+STATIC CONST COMPATIBILITY_STR  IommuCompatibleStr[] = {
+  { "riscv,iommu"     },
+  { "riscv,pci-iommu" }
+};
+
+/** RISC-V IOMMU compatiblity information.
+*/
+STATIC CONST COMPATIBILITY_INFO  IommuCompatibleInfo = {
+  ARRAY_SIZE (IommuCompatibleStr),
+  IommuCompatibleStr
+};
+
+/** List of "compatible" property values for PCI IOMMU nodes.
+*/
+STATIC CONST COMPATIBILITY_STR  PciIommuCompatibleStr[] = {
+  { "riscv,pci-iommu" }
+};
+
+/** PCI IOMMU compatiblity information.
+*/
+STATIC CONST COMPATIBILITY_INFO  PciIommuCompatibleInfo = {
+  ARRAY_SIZE (PciIommuCompatibleStr),
+  PciIommuCompatibleStr
+};
+
+/** List of "compatible" property values for PciRootComplex nodes.
+*/
+STATIC CONST COMPATIBILITY_STR  RootComplexCompatibleStr[] = {
+  { "pci-host-ecam-generic" }
+};
+
+/** PciRootComplex compatiblity information.
+*/
+STATIC CONST COMPATIBILITY_INFO  RootComplexCompatibleInfo = {
+  ARRAY_SIZE (RootComplexCompatibleStr),
+  RootComplexCompatibleStr
+};
+
+/** Get the PCI segment of a PCI host bridge node.
+
+  @param [in]  Fdt    Pointer to a Flattened Device Tree (Fdt).
+  @param [in]  Node   Offset of the host bridge node.
+
+  @return The segment from "linux,pci-domain", or 0 if absent.
+**/
+STATIC
+UINT16
+RimtGetPciSegment (
+  IN  CONST VOID   *Fdt,
+  IN        INT32  Node
+  )
+{
+  CONST UINT32  *Data;
+  INT32         DataSize;
+
+  Data = FdtGetProp (Fdt, Node, "linux,pci-domain", &DataSize);
+  if ((Data == NULL) || (DataSize < (INT32)sizeof (UINT32))) {
+    return 0;
+  }
+
+  return (UINT16)Fdt32ToCpu (*Data);
+}
+
+/** Parse the interrupt wires of a RISC-V IOMMU node.
+
+  An IOMMU that only signals message signaled interrupts has no
+  "interrupts" property, and no interrupt wires.
+
+  @param [in]  FdtParserHandle    A handle to the parser instance.
+  @param [in]  Fdt                Pointer to a Flattened Device Tree (Fdt).
+  @param [in]  IommuNode          Offset of a RISC-V IOMMU node.
+  @param [in]  IommuInfo          The CM_ARCH_COMMON_RIMT_IOMMU_INFO to populate.
+
+  @retval EFI_SUCCESS             The function completed successfully.
+  @retval EFI_ABORTED             An error occurred.
+  @retval EFI_INVALID_PARAMETER   Invalid parameter.
+  @retval EFI_OUT_OF_RESOURCES    An allocation has failed.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+IommuNodeGetInterruptWires (
+  IN  CONST FDT_HW_INFO_PARSER_HANDLE       FdtParserHandle,
+  IN  CONST VOID                            *Fdt,
+  IN        INT32                           IommuNode,
+  IN        CM_ARCH_COMMON_RIMT_IOMMU_INFO  *IommuInfo
+  )
+{
+  EFI_STATUS                          Status;
+  CONST UINT32                        *Data;
+  INT32                               DataSize;
+  INT32                               IntcNode;
+  INT32                               IntCells;
+  UINT32                              WireCount;
+  UINT32                              Index;
+  CM_ARCH_COMMON_RIMT_INTERRUPT_WIRE  *Wires;
+
+  Data = FdtGetProp (Fdt, IommuNode, "interrupts", &DataSize);
+  if ((Data == NULL) || (DataSize <= 0)) {
+    return EFI_SUCCESS;
+  }
+
+  // Get the associated interrupt-controller.
+  Status = FdtGetIntcParentNode (Fdt, IommuNode, &IntcNode);
+  if (EFI_ERROR (Status)) {
+    ASSERT (0);
+    if (Status == EFI_NOT_FOUND) {
+      // Should have found the node.
+      Status = EFI_ABORTED;
+    }
+
+    return Status;
+  }
+
+  // Get the number of cells used to encode an interrupt.
+  Status = FdtGetInterruptCellsInfo (Fdt, IntcNode, &IntCells);
+  if (EFI_ERROR (Status)) {
+    ASSERT (0);
+    return Status;
+  }
+
+  if ((IntCells < 1) || ((DataSize % (IntCells * sizeof (UINT32))) != 0)) {
+    // If error or invalid number of cells (not multiple of IntCells).
+    ASSERT (0);
+    return EFI_ABORTED;
+  }
+
+  WireCount = DataSize / (IntCells * sizeof (UINT32));
+
+  Wires = AllocateZeroPool (WireCount * sizeof (CM_ARCH_COMMON_RIMT_INTERRUPT_WIRE));
+  if (Wires == NULL) {
+    ASSERT (Wires != NULL);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  // A PLIC interrupt has no trigger type cell, and is level triggered and
+  // active high, which are the zero generic interrupt flags.
+  for (Index = 0; Index < WireCount; Index++) {
+    Wires[Index].Interrupt = FdtGetInterruptId (&Data[Index * IntCells]);
+    Wires[Index].Flags     = (IntCells >= 2) ? FdtGetInterruptFlags (&Data[Index * IntCells]) : 0;
+  }
+
+  // Add the CmObj to the Configuration Manager.
+  Status = AddSingleCmObjArray (
+             FdtParserHandle,
+             CREATE_CM_ARCH_COMMON_OBJECT_ID (EArchCommonObjRimtInterruptWireArray),
+             Wires,
+             WireCount * sizeof (CM_ARCH_COMMON_RIMT_INTERRUPT_WIRE),
+             WireCount,
+             &IommuInfo->InterruptWireToken
+             );
+  FreePool (Wires);
+  if (EFI_ERROR (Status)) {
+    ASSERT_EFI_ERROR (Status);
+    return Status;
+  }
+
+  IommuInfo->InterruptWireCount = WireCount;
+
+  return EFI_SUCCESS;
+}
+
+/** Parse a RISC-V IOMMU node.
+
+  @param [in]  FdtParserHandle    A handle to the parser instance.
+  @param [in]  Fdt                Pointer to a Flattened Device Tree (Fdt).
+  @param [in]  IommuNode          Offset of a RISC-V IOMMU node.
+  @param [in]  IommuInfo          The CM_ARCH_COMMON_RIMT_IOMMU_INFO to populate.
+
+  @retval EFI_SUCCESS             The function completed successfully.
+  @retval EFI_ABORTED             An error occurred.
+  @retval EFI_INVALID_PARAMETER   Invalid parameter.
+  @retval EFI_OUT_OF_RESOURCES    An allocation has failed.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+IommuNodeParser (
+  IN  CONST FDT_HW_INFO_PARSER_HANDLE       FdtParserHandle,
+  IN  CONST VOID                            *Fdt,
+  IN        INT32                           IommuNode,
+  IN        CM_ARCH_COMMON_RIMT_IOMMU_INFO  *IommuInfo
+  )
+{
+  EFI_STATUS    Status;
+  CONST UINT32  *Data;
+  INT32         DataSize;
+  INT32         AddressCells;
+
+  if ((Fdt == NULL) || (IommuInfo == NULL)) {
+    ASSERT ((Fdt != NULL) && (IommuInfo != NULL));
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Data = FdtGetProp (Fdt, IommuNode, "reg", &DataSize);
+  if ((Data == NULL) || (DataSize < (INT32)sizeof (UINT32))) {
+    ASSERT (0);
+    return EFI_ABORTED;
+  }
+
+  if (FdtNodeIsCompatible (Fdt, IommuNode, &PciIommuCompatibleInfo)) {
+    // The first cell of a PCI address holds the bus, device and
+    // function numbers in bits 23:8.
+    IommuInfo->Flags       = IOMMU_NODE_FLAG_PCIE_DEVICE;
+    IommuInfo->PcieSegment = RimtGetPciSegment (Fdt, FdtParentOffset (Fdt, IommuNode));
+    IommuInfo->PcieBdf     = (UINT16)(Fdt32ToCpu (Data[0]) >> 8);
+  } else {
+    Status = FdtGetParentAddressInfo (Fdt, IommuNode, &AddressCells, NULL);
+    if (EFI_ERROR (Status)) {
+      ASSERT_EFI_ERROR (Status);
+      return Status;
+    }
+
+    if (DataSize < (INT32)(AddressCells * sizeof (UINT32))) {
+      ASSERT (0);
+      return EFI_ABORTED;
+    }
+
+    IommuInfo->HardwareId = RISCV_IOMMU_PLATFORM_HID;
+    if (AddressCells == 2) {
+      IommuInfo->BaseAddress = Fdt64ToCpu (ReadUnaligned64 ((CONST UINT64 *)Data));
+    } else {
+      IommuInfo->BaseAddress = Fdt32ToCpu (Data[0]);
+    }
+  }
+
+  Data = FdtGetProp (Fdt, IommuNode, "numa-node-id", &DataSize);
+  if ((Data != NULL) && (DataSize >= (INT32)sizeof (UINT32))) {
+    IommuInfo->Flags          |= IOMMU_NODE_FLAG_PROXIMITY_DOMAIN_VALID;
+    IommuInfo->ProximityDomain = Fdt32ToCpu (*Data);
+  }
+
+  return IommuNodeGetInterruptWires (FdtParserHandle, Fdt, IommuNode, IommuInfo);
+}
+
+/** Parse a PCI root complex node.
+
+  Only the "iommu-map" entries that reference a RISC-V IOMMU are kept.
+
+  @param [in]  FdtParserHandle    A handle to the parser instance.
+  @param [in]  Fdt                Pointer to a Flattened Device Tree (Fdt).
+  @param [in]  RootComplexNode    Offset of a root complex node.
+  @param [in]  RootComplexInfo    The CM_ARCH_COMMON_RIMT_PCIE_ROOT_COMPLEX_INFO
+                                  to populate.
+
+  @retval EFI_SUCCESS             The function completed successfully.
+  @retval EFI_ABORTED             An error occurred.
+  @retval EFI_INVALID_PARAMETER   Invalid parameter.
+  @retval EFI_NOT_FOUND           The root complex has no RISC-V IOMMU.
+  @retval EFI_OUT_OF_RESOURCES    An allocation has failed.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+RootComplexNodeParser (
+  IN  CONST FDT_HW_INFO_PARSER_HANDLE                   FdtParserHandle,
+  IN  CONST VOID                                        *Fdt,
+  IN        INT32                                       RootComplexNode,
+  IN        CM_ARCH_COMMON_RIMT_PCIE_ROOT_COMPLEX_INFO  *RootComplexInfo
+  )
+{
+  EFI_STATUS                      Status;
+  CONST UINT32                    *Data;
+  INT32                           DataSize;
+  INT32                           IommuNode;
+  UINT32                          Phandle;
+  UINT32                          MapCount;
+  UINT32                          MapIndex;
+  UINT32                          IdMappingCount;
+  CM_ARCH_COMMON_RIMT_ID_MAPPING  *IdMappings;
+
+  if ((Fdt == NULL) || (RootComplexInfo == NULL)) {
+    ASSERT ((Fdt != NULL) && (RootComplexInfo != NULL));
+    return EFI_INVALID_PARAMETER;
+  }
+
+  // iommu-map = <rid-base iommu-phandle iommu-base length>, ...
+  Data = FdtGetProp (Fdt, RootComplexNode, "iommu-map", &DataSize);
+  if ((Data == NULL) || (DataSize <= 0)) {
+    return EFI_NOT_FOUND;
+  }
+
+  if ((DataSize % (IOMMU_MAP_CELL_COUNT * sizeof (UINT32))) != 0) {
+    // If invalid number of cells (not multiple of IOMMU_MAP_CELL_COUNT).
+    ASSERT (0);
+    return EFI_ABORTED;
+  }
+
+  MapCount = DataSize / (IOMMU_MAP_CELL_COUNT * sizeof (UINT32));
+
+  IdMappings = AllocateZeroPool (MapCount * sizeof (CM_ARCH_COMMON_RIMT_ID_MAPPING));
+  if (IdMappings == NULL) {
+    ASSERT (IdMappings != NULL);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  IdMappingCount = 0;
+  for (MapIndex = 0; MapIndex < MapCount; MapIndex++) {
+    Phandle   = Fdt32ToCpu (Data[MapIndex * IOMMU_MAP_CELL_COUNT + 1]);
+    IommuNode = FdtNodeOffsetByPhandle (Fdt, Phandle);
+    if ((IommuNode < 0) || !FdtNodeIsCompatible (Fdt, IommuNode, &IommuCompatibleInfo)) {
+      // Not a RISC-V IOMMU.
+      continue;
+    }
+
+    IdMappings[IdMappingCount].SourceIdBase            = Fdt32ToCpu (Data[MapIndex * IOMMU_MAP_CELL_COUNT]);
+    IdMappings[IdMappingCount].DestinationDeviceIdBase = Fdt32ToCpu (Data[MapIndex * IOMMU_MAP_CELL_COUNT + 2]);
+    IdMappings[IdMappingCount].NumberOfIds             = Fdt32ToCpu (Data[MapIndex * IOMMU_MAP_CELL_COUNT + 3]);
+    IdMappings[IdMappingCount].DestinationIommuToken   = CM_ABSTRACT_TOKEN_MAKE (
+                                                           ETokenNameSpaceFdtHwInfo,
+                                                           EFdtHwInfoRimtObject,
+                                                           Phandle
+                                                           );
+    IdMappingCount++;
+  }
+
+  if (IdMappingCount == 0) {
+    FreePool (IdMappings);
+    return EFI_NOT_FOUND;
+  }
+
+  // Add the CmObj to the Configuration Manager.
+  Status = AddSingleCmObjArray (
+             FdtParserHandle,
+             CREATE_CM_ARCH_COMMON_OBJECT_ID (EArchCommonObjRimtIdMappingArray),
+             IdMappings,
+             IdMappingCount * sizeof (CM_ARCH_COMMON_RIMT_ID_MAPPING),
+             IdMappingCount,
+             &RootComplexInfo->IdMappingToken
+             );
+  FreePool (IdMappings);
+  if (EFI_ERROR (Status)) {
+    ASSERT_EFI_ERROR (Status);
+    return Status;
+  }
+
+  RootComplexInfo->IdMappingCount = IdMappingCount;
+  RootComplexInfo->PcieSegment    = RimtGetPciSegment (Fdt, RootComplexNode);
+
+  /// ATS attributes
+  Data = FdtGetProp (Fdt, RootComplexNode, "ats-supported", &DataSize);
+  if ((Data != NULL) && (DataSize >= 0)) {
+    RootComplexInfo->Flags = PCIE_NODE_FLAG_ATS_SUPPORT;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/** Parse the RISC-V IOMMU nodes.
+
+  @param [in]  FdtParserHandle A handle to the parser instance.
+  @param [in]  FdtBranch       When searching for DT node name, restrict
+                               the search to this Device Tree branch.
+
+  @retval EFI_SUCCESS             The function completed successfully.
+  @retval EFI_ABORTED             An error occurred.
+  @retval EFI_INVALID_PARAMETER   Invalid parameter.
+  @retval EFI_NOT_FOUND           Not found.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+RiscVIommuParser (
+  IN  CONST FDT_HW_INFO_PARSER_HANDLE  FdtParserHandle,
+  IN        INT32                      FdtBranch
+  )
+{
+  EFI_STATUS                      Status;
+  UINT32                          Index;
+  INT32                           IommuNode;
+  UINT32                          IommuNodeCount;
+  UINT32                          Phandle;
+  CM_ARCH_COMMON_RIMT_IOMMU_INFO  IommuInfo;
+  VOID                            *Fdt;
+
+  Fdt    = FdtParserHandle->Fdt;
+  Status = FdtCountCompatNodeInBranch (
+             Fdt,
+             FdtBranch,
+             &IommuCompatibleInfo,
+             &IommuNodeCount
+             );
+  if (EFI_ERROR (Status)) {
+    ASSERT_EFI_ERROR (Status);
+    return Status;
+  }
+
+  if (IommuNodeCount == 0) {
+    return EFI_NOT_FOUND;
+  }
+
+  // Parse each IOMMU node in the branch.
+  IommuNode = FdtBranch;
+  for (Index = 0; Index < IommuNodeCount; Index++) {
+    ZeroMem (&IommuInfo, sizeof (CM_ARCH_COMMON_RIMT_IOMMU_INFO));
+
+    Status = FdtGetNextCompatNodeInBranch (
+               Fdt,
+               FdtBranch,
+               &IommuCompatibleInfo,
+               &IommuNode
+               );
+    if (EFI_ERROR (Status)) {
+      ASSERT_EFI_ERROR (Status);
+      if (Status == EFI_NOT_FOUND) {
+        // Should have found the node.
+        Status = EFI_ABORTED;
+      }
+
+      return Status;
+    }
+
+    Status = IommuNodeParser (FdtParserHandle, Fdt, IommuNode, &IommuInfo);
+    if (EFI_ERROR (Status)) {
+      ASSERT_EFI_ERROR (Status);
+      return Status;
+    }
+
+    // The ID mappings of the root complexes reference the IOMMU by its
+    // phandle. An IOMMU without a phandle cannot be referenced.
+    Phandle = FdtGetPhandle (Fdt, IommuNode);
+    if ((Phandle == 0) || (Phandle == MAX_UINT32)) {
+      Status = AddSingleCmObj (
+                 FdtParserHandle,
+                 CREATE_CM_ARCH_COMMON_OBJECT_ID (EArchCommonObjRimtIommuInfo),
+                 &IommuInfo,
+                 sizeof (CM_ARCH_COMMON_RIMT_IOMMU_INFO),
+                 NULL
+                 );
+    } else {
+      IommuInfo.Token = CM_ABSTRACT_TOKEN_MAKE (
+                          ETokenNameSpaceFdtHwInfo,
+                          EFdtHwInfoRimtObject,
+                          Phandle
+                          );
+      Status = AddSingleCmObjWithToken (
+                 FdtParserHandle,
+                 CREATE_CM_ARCH_COMMON_OBJECT_ID (EArchCommonObjRimtIommuInfo),
+                 &IommuInfo,
+                 sizeof (CM_ARCH_COMMON_RIMT_IOMMU_INFO),
+                 IommuInfo.Token
+                 );
+    }
+
+    if (EFI_ERROR (Status)) {
+      ASSERT_EFI_ERROR (Status);
+      return Status;
+    }
+  } // for
+
+  return EFI_SUCCESS;
+}
+
+/** Parse the PCI root complex nodes that are translated by a RISC-V IOMMU.
+
+  @param [in]  FdtParserHandle A handle to the parser instance.
+  @param [in]  FdtBranch       When searching for DT node name, restrict
+                               the search to this Device Tree branch.
+
+  @retval EFI_SUCCESS             The function completed successfully.
+  @retval EFI_ABORTED             An error occurred.
+  @retval EFI_INVALID_PARAMETER   Invalid parameter.
+  @retval EFI_NOT_FOUND           Not found.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+RiscVRootComplexParser (
+  IN  CONST FDT_HW_INFO_PARSER_HANDLE  FdtParserHandle,
+  IN        INT32                      FdtBranch
+  )
+{
+  EFI_STATUS                                  Status;
+  UINT32                                      Index;
+  INT32                                       RootComplexNode;
+  UINT32                                      RootComplexNodeCount;
+  CM_ARCH_COMMON_RIMT_PCIE_ROOT_COMPLEX_INFO  RootComplexInfo;
+  VOID                                        *Fdt;
+
+  Fdt    = FdtParserHandle->Fdt;
+  Status = FdtCountCompatNodeInBranch (
+             Fdt,
+             FdtBranch,
+             &RootComplexCompatibleInfo,
+             &RootComplexNodeCount
+             );
+  if (EFI_ERROR (Status)) {
+    ASSERT_EFI_ERROR (Status);
+    return Status;
+  }
+
+  if (RootComplexNodeCount == 0) {
+    return EFI_NOT_FOUND;
+  }
+
+  // Parse each root complex node in the branch.
+  RootComplexNode = FdtBranch;
+  for (Index = 0; Index < RootComplexNodeCount; Index++) {
+    ZeroMem (&RootComplexInfo, sizeof (CM_ARCH_COMMON_RIMT_PCIE_ROOT_COMPLEX_INFO));
+
+    Status = FdtGetNextCompatNodeInBranch (
+               Fdt,
+               FdtBranch,
+               &RootComplexCompatibleInfo,
+               &RootComplexNode
+               );
+    if (EFI_ERROR (Status)) {
+      ASSERT_EFI_ERROR (Status);
+      if (Status == EFI_NOT_FOUND) {
+        // Should have found the node.
+        Status = EFI_ABORTED;
+      }
+
+      return Status;
+    }
+
+    Status = RootComplexNodeParser (FdtParserHandle, Fdt, RootComplexNode, &RootComplexInfo);
+    if (Status == EFI_NOT_FOUND) {
+      // This root complex is not translated by a RISC-V IOMMU.
+      continue;
+    } else if (EFI_ERROR (Status)) {
+      ASSERT_EFI_ERROR (Status);
+      return Status;
+    }
+
+    // Add the CmObj to the Configuration Manager.
+    Status = AddSingleCmObj (
+               FdtParserHandle,
+               CREATE_CM_ARCH_COMMON_OBJECT_ID (EArchCommonObjRimtPcieRootComplexInfo),
+               &RootComplexInfo,
+               sizeof (CM_ARCH_COMMON_RIMT_PCIE_ROOT_COMPLEX_INFO),
+               NULL
+               );
+    if (EFI_ERROR (Status)) {
+      ASSERT_EFI_ERROR (Status);
+      return Status;
+    }
+  } // for
+
+  return EFI_SUCCESS;
+}
+
+/** CM_ARCH_COMMON_RIMT_IOMMU_INFO and CM_ARCH_COMMON_RIMT_PCIE_ROOT_COMPLEX_INFO
+    parser function.
+
+  Every "riscv,iommu" and "riscv,pci-iommu" node produces an IOMMU object,
+  whose token is made from the phandle of the node, and every
+  "pci-host-ecam-generic" node with an "iommu-map" property that references
+  such an IOMMU produces a PCIe root complex object.
+
+  A parser parses a Device Tree to populate a specific CmObj type. None,
+  one or many CmObj can be created by the parser.
+  The created CmObj are then handed to the parser's caller through the
+  HW_INFO_ADD_OBJECT interface.
+  This can also be a dispatcher. I.e. a function that not parsing a
+  Device Tree but calling other parsers.
+
+  @param [in]  FdtParserHandle A handle to the parser instance.
+  @param [in]  FdtBranch       When searching for DT node name, restrict
+                               the search to this Device Tree branch.
+
+  @retval EFI_SUCCESS             The function completed successfully.
+  @retval EFI_ABORTED             An error occurred.
+  @retval EFI_INVALID_PARAMETER   Invalid parameter.
+  @retval EFI_NOT_FOUND           Not found.
+  @retval EFI_UNSUPPORTED         Unsupported.
+**/
+EFI_STATUS
+EFIAPI
+RiscVRimtParser (
+  IN  CONST FDT_HW_INFO_PARSER_HANDLE  FdtParserHandle,
+  IN        INT32                      FdtBranch
+  )
+{
+  EFI_STATUS  Status;
+
+  if (FdtParserHandle == NULL) {
+    ASSERT (FdtParserHandle != NULL);
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Status = RiscVIommuParser (FdtParserHandle, FdtBranch);
+  if (EFI_ERROR (Status)) {
+    // Without an IOMMU, there is no RIMT.
+    return Status;
+  }
+
+  Status = RiscVRootComplexParser (FdtParserHandle, FdtBranch);
+  if (Status == EFI_NOT_FOUND) {
+    // The RIMT may only describe platform devices.
+    return EFI_SUCCESS;
+  }
+
+  return Status;
+}
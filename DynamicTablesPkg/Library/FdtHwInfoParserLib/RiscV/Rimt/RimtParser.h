@@ -0,0 +1,47 @@
+/** @file
+  RISC-V IO Mapping Table parser.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+  @par Reference(s):
+  - linux/Documentation/devicetree/bindings/iommu/riscv,iommu.yaml
+  - linux/Documentation/devicetree/bindings/pci/host-generic-pci.yaml
+**/
+
+#ifndef RIMT_PARSER_H_
+#define RIMT_PARSER_H_
+
+/** CM_ARCH_COMMON_RIMT_IOMMU_INFO and CM_ARCH_COMMON_RIMT_PCIE_ROOT_COMPLEX_INFO
+    parser function.
+
+  Every "riscv,iommu" and "riscv,pci-iommu" node produces an IOMMU object,
+  whose token is made from the phandle of the node, and every
+  "pci-host-ecam-generic" node with an "iommu-map" property that references
+  such an IOMMU produces a PCIe root complex object.
+
+  A parser parses a Device Tree to populate a specific CmObj type. None,
+  one or many CmObj can be created by the parser.
+  The created CmObj are then handed to the parser's caller through the
+  HW_INFO_ADD_OBJECT interface.
+  This can also be a dispatcher. I.e. a function that not parsing a
+  Device Tree but calling other parsers.
+
+  @param [in]  FdtParserHandle A handle to the parser instance.
+  @param [in]  FdtBranch       When searching for DT node name, restrict
+                               the search to this Device Tree branch.
+
+  @retval EFI_SUCCESS             The function completed successfully.
+  @retval EFI_ABORTED             An error occurred.
+  @retval EFI_INVALID_PARAMETER   Invalid parameter.
+  @retval EFI_NOT_FOUND           Not found.
+  @retval EFI_UNSUPPORTED         Unsupported.
+**/
+EFI_STATUS
+EFIAPI
+RiscVRimtParser (
+  IN  CONST FDT_HW_INFO_PARSER_HANDLE  FdtParserHandle,
+  IN        INT32                      FdtBranch
+  );
+
+#endif // RIMT_PARSER_H_
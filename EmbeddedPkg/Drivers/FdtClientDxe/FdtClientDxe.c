@@ -8,8 +8,10 @@
 **/
 
 #include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
 #include <Library/DebugLib.h>
 #include <Library/FdtLib.h>
+#include <Library/MemoryAllocationLib.h>
 #include <Library/UefiDriverEntryPoint.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/HobLib.h>
@@ -22,6 +24,26 @@
 
 STATIC VOID  *mDeviceTreeBase;
 
+//
+// Index of the 'compatible' strings of the enabled nodes, so that lookups
+// don't walk the whole tree. There is an entry per string, in tree order,
+// chained by the hash of the string. Entries point into the tree, so the
+// index is dropped whenever the tree is modified, and rebuilt on next use.
+//
+typedef struct {
+  CONST CHAR8    *Compatible;
+  UINT32         Hash;
+  INT32          Node;
+  UINT32         Next;
+} FDT_COMPATIBLE_ENTRY;
+
+#define FDT_COMPATIBLE_INDEX_END  MAX_UINT32
+
+STATIC FDT_COMPATIBLE_ENTRY  *mCompatibleEntries;
+STATIC UINT32                *mCompatibleBuckets;
+STATIC UINT32                mCompatibleBucketMask;
+STATIC BOOLEAN               mCompatibleIndexValid;
+
 STATIC
 EFI_STATUS
 EFIAPI
@@ -50,6 +72,28 @@ GetNodeProperty (
   return EFI_SUCCESS;
 }
 
+/**
+  Drop the index of 'compatible' strings, as the tree is about to change.
+**/
+STATIC
+VOID
+InvalidateCompatibleIndex (
+  VOID
+  )
+{
+  if (mCompatibleEntries != NULL) {
+    FreePool (mCompatibleEntries);
+    mCompatibleEntries = NULL;
+  }
+
+  if (mCompatibleBuckets != NULL) {
+    FreePool (mCompatibleBuckets);
+    mCompatibleBuckets = NULL;
+  }
+
+  mCompatibleIndexValid = FALSE;
+}
+
 STATIC
 EFI_STATUS
 EFIAPI
@@ -65,6 +109,12 @@ SetNodeProperty (
 
   ASSERT (mDeviceTreeBase != NULL);
 
+  //
+  // Growing a property moves the nodes after it, and the status of the
+  // node may change.
+  //
+  InvalidateCompatibleIndex ();
+
   Ret = FdtSetProp (mDeviceTreeBase, Node, PropertyName, Prop, PropSize);
   if (Ret != 0) {
     return EFI_DEVICE_ERROR;
@@ -103,6 +153,133 @@ IsNodeEnabled (
   return FALSE;
 }
 
+/**
+  Hash a 'compatible' string, with FNV-1a.
+
+  @param[in]  String  The string.
+
+  @return  The hash.
+**/
+STATIC
+UINT32
+HashCompatible (
+  IN CONST CHAR8  *String
+  )
+{
+  UINT32  Hash;
+
+  Hash = 0x811C9DC5;
+  while (*String != '\0') {
+    Hash ^= (UINT8)*String++;
+    Hash *= 0x01000193;
+  }
+
+  return Hash;
+}
+
+/**
+  Build the index of the 'compatible' strings of the enabled nodes.
+
+  @retval TRUE   The index is built.
+  @retval FALSE  The index could not be allocated.
+**/
+STATIC
+BOOLEAN
+BuildCompatibleIndex (
+  VOID
+  )
+{
+  INT32        Node;
+  CONST CHAR8  *Type, *Compatible;
+  INT32        Len;
+  UINT32       Count;
+  UINT32       BucketCount;
+  UINT32       *Tails;
+  UINT32       Index;
+  UINT32       Bucket;
+
+  Count = 0;
+  for (Node = FdtNextNode (mDeviceTreeBase, 0, NULL); Node >= 0;
+       Node = FdtNextNode (mDeviceTreeBase, Node, NULL))
+  {
+    if (!IsNodeEnabled (Node)) {
+      continue;
+    }
+
+    Type = FdtGetProp (mDeviceTreeBase, Node, "compatible", &Len);
+    if (Type == NULL) {
+      continue;
+    }
+
+    for (Compatible = Type; Compatible < Type + Len && *Compatible;
+         Compatible += 1 + AsciiStrLen (Compatible))
+    {
+      Count++;
+    }
+  }
+
+  //
+  // Keep the chains short, with at least twice as many buckets as strings.
+  //
+  BucketCount        = MAX (GetPowerOfTwo32 (Count) * 4, 16);
+  mCompatibleEntries = AllocatePool (MAX (Count, 1) * sizeof (FDT_COMPATIBLE_ENTRY));
+  mCompatibleBuckets = AllocatePool (BucketCount * sizeof (UINT32));
+  Tails              = AllocatePool (BucketCount * sizeof (UINT32));
+  if ((mCompatibleEntries == NULL) || (mCompatibleBuckets == NULL) || (Tails == NULL)) {
+    if (Tails != NULL) {
+      FreePool (Tails);
+    }
+
+    InvalidateCompatibleIndex ();
+    return FALSE;
+  }
+
+  SetMem32 (mCompatibleBuckets, BucketCount * sizeof (UINT32), FDT_COMPATIBLE_INDEX_END);
+  mCompatibleBucketMask = BucketCount - 1;
+
+  Index = 0;
+  for (Node = FdtNextNode (mDeviceTreeBase, 0, NULL); Node >= 0;
+       Node = FdtNextNode (mDeviceTreeBase, Node, NULL))
+  {
+    if (!IsNodeEnabled (Node)) {
+      continue;
+    }
+
+    Type = FdtGetProp (mDeviceTreeBase, Node, "compatible", &Len);
+    if (Type == NULL) {
+      continue;
+    }
+
+    for (Compatible = Type; Compatible < Type + Len && *Compatible;
+         Compatible += 1 + AsciiStrLen (Compatible))
+    {
+      mCompatibleEntries[Index].Compatible = Compatible;
+      mCompatibleEntries[Index].Hash       = HashCompatible (Compatible);
+      mCompatibleEntries[Index].Node       = Node;
+      mCompatibleEntries[Index].Next       = FDT_COMPATIBLE_INDEX_END;
+
+      //
+      // Append, so that each chain stays in tree order.
+      //
+      Bucket = mCompatibleEntries[Index].Hash & mCompatibleBucketMask;
+      if (mCompatibleBuckets[Bucket] == FDT_COMPATIBLE_INDEX_END) {
+        mCompatibleBuckets[Bucket] = Index;
+      } else {
+        mCompatibleEntries[Tails[Bucket]].Next = Index;
+      }
+
+      Tails[Bucket] = Index;
+      Index++;
+    }
+  }
+
+  FreePool (Tails);
+
+  DEBUG ((DEBUG_VERBOSE, "%a: %u compatible strings indexed\n", __func__, Count));
+  mCompatibleIndexValid = TRUE;
+  return TRUE;
+}
+
 STATIC
 EFI_STATUS
 EFIAPI
@@ -117,9 +294,30 @@ FindNextCompatibleNode (
   CONST CHAR8  *Type, *Compatible;
   INT32        Len;
 
+  UINT32       Hash;
+  UINT32       Index;
+
   ASSERT (mDeviceTreeBase != NULL);
   ASSERT (Node != NULL);
 
+  if (mCompatibleIndexValid || BuildCompatibleIndex ()) {
+    Hash = HashCompatible (CompatibleString);
+    for (Index = mCompatibleBuckets[Hash & mCompatibleBucketMask];
+         Index != FDT_COMPATIBLE_INDEX_END;
+         Index = mCompatibleEntries[Index].Next)
+    {
+      if ((mCompatibleEntries[Index].Node > PrevNode) &&
+          (mCompatibleEntries[Index].Hash == Hash) &&
+          (AsciiStrCmp (mCompatibleEntries[Index].Compatible, CompatibleString) == 0))
+      {
+        *Node = mCompatibleEntries[Index].Node;
+        return EFI_SUCCESS;
+      }
+    }
+
+    return EFI_NOT_FOUND;
+  }
+
   for (Prev = PrevNode; ; Prev = Next) {
     Next = FdtNextNode (mDeviceTreeBase, Prev, NULL);
     if (Next < 0) {
@@ -344,6 +542,7 @@ GetOrInsertChosenNode (
 
   NewNode = FdtPathOffset (mDeviceTreeBase, "/chosen");
   if (NewNode < 0) {
+    InvalidateCompatibleIndex ();
     NewNode = FdtAddSubnode (mDeviceTreeBase, 0, "/chosen");
   }
 
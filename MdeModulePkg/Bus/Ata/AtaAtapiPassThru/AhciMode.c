@@ -1242,7 +1242,7 @@ AhciDmaTransfer (
     // Delay 100us to simulate the blocking time out checking.
     //
     OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
-    while (!IsListEmpty (&Instance->NonBlockingTaskList)) {
+    while (!IsListEmpty (&Instance->NonBlockingTaskList) || !IsListEmpty (&Instance->NcqTaskList)) {
       AsyncNonBlockingTransferRoutine (NULL, Instance);
       //
       // Stall for 100us.
@@ -1397,6 +1397,711 @@ AhciDmaTransfer (
   return Status;
 }
 
+/**
+  Get the number of commands that the device of a non-blocking task can queue,
+  if the task can be sent as a READ or WRITE FPDMA QUEUED command.
+
+  @param[in]  Instance   The ATA_ATAPI_PASS_THRU_INSTANCE protocol instance.
+  @param[in]  Task       Pointer to the ATA_NONBLOCK_TASK.
+
+  @return  The queue depth of the device, or 0 if the task is to be sent as it is.
+
+**/
+UINT8
+AhciGetNcqDepth (
+  IN ATA_ATAPI_PASS_THRU_INSTANCE  *Instance,
+  IN ATA_NONBLOCK_TASK             *Task
+  )
+{
+  EFI_ATA_PASS_THRU_COMMAND_PACKET  *Packet;
+  EFI_ATA_DEVICE_INFO               *DeviceInfo;
+  LIST_ENTRY                        *Node;
+  UINT32                            DataCount;
+  UINT16                            Capabilities;
+  UINT8                             Depth;
+
+  if (!Instance->AhciRegisters.NcqSupport) {
+    return 0;
+  }
+
+  Packet = Task->Packet;
+  if ((Packet->Protocol == EFI_ATA_PASS_THRU_PROTOCOL_UDMA_DATA_IN) &&
+      (Packet->Acb->AtaCommand == ATA_CMD_READ_DMA_EXT))
+  {
+    DataCount = Packet->InTransferLength;
+  } else if ((Packet->Protocol == EFI_ATA_PASS_THRU_PROTOCOL_UDMA_DATA_OUT) &&
+             (Packet->Acb->AtaCommand == ATA_CMD_WRITE_DMA_EXT))
+  {
+    DataCount = Packet->OutTransferLength;
+  } else {
+    return 0;
+  }
+
+  if ((DataCount == 0) || (DataCount > EFI_AHCI_SLOT_MAX_PRDT * EFI_AHCI_MAX_DATA_PER_PRDT)) {
+    return 0;
+  }
+
+  Node = SearchDeviceInfoList (Instance, Task->Port, Task->PortMultiplier, EfiIdeHarddisk);
+  if (Node == NULL) {
+    return 0;
+  }
+
+  DeviceInfo = ATA_ATAPI_DEVICE_INFO_FROM_THIS (Node);
+  if (DeviceInfo->IdentifyData == NULL) {
+    return 0;
+  }
+
+  //
+  // Word 76 of the IDENTIFY data reports NCQ in bit 8, and word 75 the queue depth minus one.
+  //
+  Capabilities = DeviceInfo->IdentifyData->AtaData.serial_ata_capabilities;
+  if ((Capabilities == 0x0000) || (Capabilities == 0xFFFF) || ((Capabilities & BIT8) == 0)) {
+    return 0;
+  }
+
+  Depth = (UINT8)((DeviceInfo->IdentifyData->AtaData.queue_depth & 0x1F) + 1);
+  return MIN (Depth, Instance->AhciRegisters.MaxCommandSlotNumber);
+}
+
+/**
+  Map the data buffers of the tasks to be queued: in one call to the IOMMU batch
+  protocol when it is available, or else one by one through the PCI I/O protocol.
+
+  @param[in]      Instance   The ATA_ATAPI_PASS_THRU_INSTANCE protocol instance.
+  @param[in]      Read       The transfer direction of the tasks.
+  @param[in]      Tasks      The tasks.
+  @param[in, out] Entries    On input, the data buffers of the tasks. On output,
+                             their device addresses.
+  @param[in]      Count      The number of tasks.
+
+  @return  The number of tasks, from the first, whose data buffers are mapped.
+
+**/
+UINTN
+AhciNcqMapTasks (
+  IN     ATA_ATAPI_PASS_THRU_INSTANCE  *Instance,
+  IN     BOOLEAN                       Read,
+  IN     ATA_NONBLOCK_TASK             **Tasks,
+  IN OUT EDKII_IOMMU_BATCH_ENTRY       *Entries,
+  IN     UINTN                         Count
+  )
+{
+  EFI_PCI_IO_PROTOCOL            *PciIo;
+  UINTN                          Lengths[EFI_AHCI_MAX_COMMAND_SLOTS];
+  EDKII_IOMMU_OPERATION          Operation;
+  UINT64                         IoMmuAccess;
+  EFI_PCI_IO_PROTOCOL_OPERATION  Flag;
+  UINTN                          MapLength;
+  UINTN                          Index;
+  EFI_STATUS                     Status;
+
+  ASSERT (Count <= EFI_AHCI_MAX_COMMAND_SLOTS);
+
+  PciIo = Instance->PciIo;
+  for (Index = 0; Index < Count; Index++) {
+    Lengths[Index] = Entries[Index].NumberOfBytes;
+  }
+
+  if (Instance->IoMmuBatch != NULL) {
+    //
+    // Pick the operation and access the PCI I/O protocol would pass to the IOMMU.
+    // The device writes the data buffers of reads to memory.
+    //
+    if (Read) {
+      Operation   = Instance->AhciRegisters.DualAddressCycle ? EdkiiIoMmuOperationBusMasterWrite64 : EdkiiIoMmuOperationBusMasterWrite;
+      IoMmuAccess = EDKII_IOMMU_ACCESS_WRITE;
+    } else {
+      Operation   = Instance->AhciRegisters.DualAddressCycle ? EdkiiIoMmuOperationBusMasterRead64 : EdkiiIoMmuOperationBusMasterRead;
+      IoMmuAccess = EDKII_IOMMU_ACCESS_READ;
+    }
+
+    Status = Instance->IoMmuBatch->MapMultiple (
+                                     Instance->IoMmuBatch,
+                                     Instance->ControllerHandle,
+                                     Operation,
+                                     IoMmuAccess,
+                                     Count,
+                                     Entries
+                                     );
+    if (!EFI_ERROR (Status)) {
+      for (Index = 0; Index < Count; Index++) {
+        if (Entries[Index].NumberOfBytes != Lengths[Index]) {
+          break;
+        }
+      }
+
+      if (Index == Count) {
+        for (Index = 0; Index < Count; Index++) {
+          CopyMem (&Tasks[Index]->BatchEntry, &Entries[Index], sizeof (EDKII_IOMMU_BATCH_ENTRY));
+          Tasks[Index]->BatchMapped = TRUE;
+        }
+
+        return Count;
+      }
+
+      Instance->IoMmuBatch->UnmapMultiple (
+                              Instance->IoMmuBatch,
+                              Instance->ControllerHandle,
+                              Count,
+                              Entries
+                              );
+      for (Index = 0; Index < Count; Index++) {
+        Entries[Index].NumberOfBytes = Lengths[Index];
+      }
+    }
+  }
+
+  if (Read) {
+    Flag = EfiPciIoOperationBusMasterWrite;
+  } else {
+    Flag = EfiPciIoOperationBusMasterRead;
+  }
+
+  for (Index = 0; Index < Count; Index++) {
+    MapLength = Lengths[Index];
+    Status    = PciIo->Map (
+                         PciIo,
+                         Flag,
+                         Entries[Index].HostAddress,
+                         &MapLength,
+                         &Entries[Index].DeviceAddress,
+                         &Tasks[Index]->Map
+                         );
+    if (EFI_ERROR (Status) || (MapLength != Lengths[Index])) {
+      if (!EFI_ERROR (Status)) {
+        PciIo->Unmap (PciIo, Tasks[Index]->Map);
+      }
+
+      Tasks[Index]->Map = NULL;
+      break;
+    }
+  }
+
+  return Index;
+}
+
+/**
+  Unmap the data buffers of queued tasks. The buffers mapped through the IOMMU
+  batch protocol are unmapped in one call.
+
+  @param[in]  Instance   The ATA_ATAPI_PASS_THRU_INSTANCE protocol instance.
+  @param[in]  Tasks      The tasks.
+  @param[in]  Count      The number of tasks.
+
+**/
+VOID
+AhciNcqUnmapTasks (
+  IN ATA_ATAPI_PASS_THRU_INSTANCE  *Instance,
+  IN ATA_NONBLOCK_TASK             **Tasks,
+  IN UINTN                         Count
+  )
+{
+  EDKII_IOMMU_BATCH_ENTRY  Entries[EFI_AHCI_MAX_COMMAND_SLOTS];
+  UINTN                    BatchCount;
+  UINTN                    Index;
+
+  ASSERT (Count <= EFI_AHCI_MAX_COMMAND_SLOTS);
+
+  BatchCount = 0;
+  for (Index = 0; Index < Count; Index++) {
+    if (Tasks[Index]->BatchMapped) {
+      CopyMem (&Entries[BatchCount++], &Tasks[Index]->BatchEntry, sizeof (EDKII_IOMMU_BATCH_ENTRY));
+      Tasks[Index]->BatchMapped = FALSE;
+    } else if (Tasks[Index]->Map != NULL) {
+      Instance->PciIo->Unmap (Instance->PciIo, Tasks[Index]->Map);
+      Tasks[Index]->Map = NULL;
+    }
+  }
+
+  if (BatchCount != 0) {
+    Instance->IoMmuBatch->UnmapMultiple (
+                            Instance->IoMmuBatch,
+                            Instance->ControllerHandle,
+                            BatchCount,
+                            Entries
+                            );
+  }
+}
+
+/**
+  Get the queued tasks in flight.
+
+  @param[in]  Instance   The ATA_ATAPI_PASS_THRU_INSTANCE protocol instance.
+  @param[out] Tasks      The tasks, in the order they were sent.
+
+  @return  The number of tasks.
+
+**/
+UINTN
+AhciNcqGetTasks (
+  IN  ATA_ATAPI_PASS_THRU_INSTANCE  *Instance,
+  OUT ATA_NONBLOCK_TASK             **Tasks
+  )
+{
+  LIST_ENTRY  *Entry;
+  UINTN       Count;
+
+  Count = 0;
+  for (Entry = GetFirstNode (&Instance->NcqTaskList);
+       !IsNull (&Instance->NcqTaskList, Entry);
+       Entry = GetNextNode (&Instance->NcqTaskList, Entry))
+  {
+    ASSERT (Count < EFI_AHCI_MAX_COMMAND_SLOTS);
+    Tasks[Count++] = ATA_NON_BLOCK_TASK_FROM_ENTRY (Entry);
+  }
+
+  return Count;
+}
+
+/**
+  Stop the port of the queued commands, which ends the commands in flight.
+
+  @param[in]  Instance   The ATA_ATAPI_PASS_THRU_INSTANCE protocol instance.
+
+**/
+VOID
+AhciNcqStopPort (
+  IN ATA_ATAPI_PASS_THRU_INSTANCE  *Instance
+  )
+{
+  AhciStopCommand (
+    Instance->PciIo,
+    (UINT8)Instance->NcqPort,
+    ATA_ATAPI_TIMEOUT
+    );
+
+  AhciDisableFisReceive (
+    Instance->PciIo,
+    (UINT8)Instance->NcqPort,
+    ATA_ATAPI_TIMEOUT
+    );
+
+  Instance->NcqSlotMap = 0;
+}
+
+/**
+  Send the non-blocking tasks at the head of the task list as READ or WRITE FPDMA
+  QUEUED commands, each in a free command slot of the slot pool, for as long as
+  they can be queued with the commands in flight.
+
+  The tasks sent together are for one device and in one direction, so that their
+  data buffers are mapped in one call to the IOMMU batch protocol.
+
+  @param[in]  Instance   The ATA_ATAPI_PASS_THRU_INSTANCE protocol instance.
+
+  @retval EFI_SUCCESS    The tasks that can be queued are sent, if any.
+  @retval Others         The port could not be started. The tasks are not sent.
+
+**/
+EFI_STATUS
+AhciNcqIssueTasks (
+  IN ATA_ATAPI_PASS_THRU_INSTANCE  *Instance
+  )
+{
+  EFI_PCI_IO_PROTOCOL               *PciIo;
+  EFI_AHCI_REGISTERS                *AhciRegisters;
+  ATA_NONBLOCK_TASK                 *Tasks[EFI_AHCI_MAX_COMMAND_SLOTS];
+  EDKII_IOMMU_BATCH_ENTRY           Entries[EFI_AHCI_MAX_COMMAND_SLOTS];
+  LIST_ENTRY                        *Entry;
+  ATA_NONBLOCK_TASK                 *Task;
+  EFI_ATA_PASS_THRU_COMMAND_PACKET  *Packet;
+  EFI_AHCI_SLOT_COMMAND_TABLE       *SlotTable;
+  EFI_AHCI_COMMAND_LIST             *CmdList;
+  BOOLEAN                           Read;
+  UINT8                             Depth;
+  UINT8                             Port;
+  UINT8                             PortMultiplier;
+  UINT8                             Slot;
+  UINT32                            SlotMask;
+  UINT32                            InFlight;
+  UINT32                            PrdtNumber;
+  UINT32                            PrdtIndex;
+  UINTN                             RemainedData;
+  UINT64                            MemAddr;
+  DATA_64                           Data64;
+  UINT32                            Offset;
+  UINTN                             Count;
+  UINTN                             Index;
+  EFI_STATUS                        Status;
+
+  PciIo         = Instance->PciIo;
+  AhciRegisters = &Instance->AhciRegisters;
+  InFlight      = BitFieldCountOnes32 (Instance->NcqSlotMap, 0, 31);
+
+  //
+  // A task that was started as it is, by AhciDmaTransfer(), ends the tasks to queue.
+  //
+  Read  = FALSE;
+  Count = 0;
+  for (Entry = GetFirstNode (&Instance->NonBlockingTaskList);
+       !IsNull (&Instance->NonBlockingTaskList, Entry);
+       Entry = GetNextNode (&Instance->NonBlockingTaskList, Entry))
+  {
+    Task  = ATA_NON_BLOCK_TASK_FROM_ENTRY (Entry);
+    Depth = AhciGetNcqDepth (Instance, Task);
+    if ((Depth == 0) || Task->IsStart || (InFlight + Count >= Depth)) {
+      break;
+    }
+
+    if (((InFlight != 0) || (Count != 0)) &&
+        ((Task->Port != Instance->NcqPort) || (Task->PortMultiplier != Instance->NcqPortMultiplier)))
+    {
+      break;
+    }
+
+    Packet = Task->Packet;
+    if ((Count != 0) && (Read != (Packet->Protocol == EFI_ATA_PASS_THRU_PROTOCOL_UDMA_DATA_IN))) {
+      break;
+    }
+
+    Read = (BOOLEAN)(Packet->Protocol == EFI_ATA_PASS_THRU_PROTOCOL_UDMA_DATA_IN);
+    if (Read) {
+      Entries[Count].HostAddress   = Packet->InDataBuffer;
+      Entries[Count].NumberOfBytes = Packet->InTransferLength;
+    } else {
+      Entries[Count].HostAddress   = Packet->OutDataBuffer;
+      Entries[Count].NumberOfBytes = Packet->OutTransferLength;
+    }
+
+    Tasks[Count++]              = Task;
+    Instance->NcqPort           = Task->Port;
+    Instance->NcqPortMultiplier = Task->PortMultiplier;
+  }
+
+  if (Count == 0) {
+    return EFI_SUCCESS;
+  }
+
+  //
+  // A task whose data buffer can't be mapped is left to AhciDmaTransfer(), which
+  // reports the error.
+  //
+  Count = AhciNcqMapTasks (Instance, Read, Tasks, Entries, Count);
+  if (Count == 0) {
+    return EFI_SUCCESS;
+  }
+
+  Port           = (UINT8)Instance->NcqPort;
+  PortMultiplier = (UINT8)((Instance->NcqPortMultiplier == 0xFFFF) ? 0 : Instance->NcqPortMultiplier);
+  SlotMask       = 0;
+  for (Index = 0; Index < Count; Index++) {
+    Task   = Tasks[Index];
+    Packet = Task->Packet;
+    Slot   = (UINT8)LowBitSet32 (~(Instance->NcqSlotMap | SlotMask));
+    ASSERT (Slot < AhciRegisters->MaxCommandSlotNumber);
+
+    //
+    // READ and WRITE FPDMA QUEUED take the sector count in the features registers,
+    // and the tag in bits 7:3 of the sector count register.
+    //
+    SlotTable = &AhciRegisters->AhciSlotTable[Slot];
+    ZeroMem (SlotTable, sizeof (EFI_AHCI_SLOT_COMMAND_TABLE));
+    AhciBuildCommandFis (&SlotTable->CommandFis, Packet->Acb);
+    SlotTable->CommandFis.AhciCFisCmd         = Read ? ATA_CMD_READ_FPDMA_QUEUED : ATA_CMD_WRITE_FPDMA_QUEUED;
+    SlotTable->CommandFis.AhciCFisFeature     = Packet->Acb->AtaSectorCount;
+    SlotTable->CommandFis.AhciCFisFeatureExp  = Packet->Acb->AtaSectorCountExp;
+    SlotTable->CommandFis.AhciCFisSecCount    = (UINT8)(Slot << 3);
+    SlotTable->CommandFis.AhciCFisSecCountExp = 0;
+    SlotTable->CommandFis.AhciCFisDevHead     = BIT6;
+    SlotTable->CommandFis.AhciCFisPmNum       = PortMultiplier;
+
+    RemainedData = Entries[Index].NumberOfBytes;
+    MemAddr      = Entries[Index].DeviceAddress;
+    PrdtNumber   = (UINT32)DivU64x32 (((UINT64)RemainedData + EFI_AHCI_MAX_DATA_PER_PRDT - 1), EFI_AHCI_MAX_DATA_PER_PRDT);
+    ASSERT (PrdtNumber <= EFI_AHCI_SLOT_MAX_PRDT);
+
+    for (PrdtIndex = 0; PrdtIndex < PrdtNumber; PrdtIndex++) {
+      if (RemainedData < EFI_AHCI_MAX_DATA_PER_PRDT) {
+        SlotTable->PrdtTable[PrdtIndex].AhciPrdtDbc = (UINT32)RemainedData - 1;
+      } else {
+        SlotTable->PrdtTable[PrdtIndex].AhciPrdtDbc = EFI_AHCI_MAX_DATA_PER_PRDT - 1;
+      }
+
+      Data64.Uint64                                = MemAddr;
+      SlotTable->PrdtTable[PrdtIndex].AhciPrdtDba  = Data64.Uint32.Lower32;
+      SlotTable->PrdtTable[PrdtIndex].AhciPrdtDbau = Data64.Uint32.Upper32;
+      RemainedData                                -= EFI_AHCI_MAX_DATA_PER_PRDT;
+      MemAddr                                     += EFI_AHCI_MAX_DATA_PER_PRDT;
+    }
+
+    SlotTable->PrdtTable[PrdtNumber - 1].AhciPrdtIoc = 1;
+
+    CmdList = &AhciRegisters->AhciCmdList[Slot];
+    ZeroMem (CmdList, sizeof (EFI_AHCI_COMMAND_LIST));
+    CmdList->AhciCmdCfl   = EFI_AHCI_FIS_REGISTER_H2D_LENGTH / 4;
+    CmdList->AhciCmdW     = Read ? 0 : 1;
+    CmdList->AhciCmdPmp   = PortMultiplier;
+    CmdList->AhciCmdPrdtl = PrdtNumber;
+    Data64.Uint64         = (UINT64)(UINTN)&AhciRegisters->AhciSlotTablePciAddr[Slot];
+    CmdList->AhciCmdCtba  = Data64.Uint32.Lower32;
+    CmdList->AhciCmdCtbau = Data64.Uint32.Upper32;
+
+    Task->Slot    = Slot;
+    Task->IsStart = TRUE;
+    SlotMask     |= (UINT32)BIT0 << Slot;
+  }
+
+  if (Instance->NcqSlotMap == 0) {
+    ZeroMem ((UINT8 *)AhciRegisters->AhciRFis + sizeof (EFI_AHCI_RECEIVED_FIS) * Port, sizeof (EFI_AHCI_RECEIVED_FIS));
+
+    Status = AhciStartPort (PciIo, Port, ATA_ATAPI_TIMEOUT);
+    if (EFI_ERROR (Status)) {
+      AhciNcqUnmapTasks (Instance, Tasks, Count);
+      for (Index = 0; Index < Count; Index++) {
+        Tasks[Index]->IsStart = FALSE;
+      }
+
+      return Status;
+    }
+  }
+
+  //
+  // PxSACT is set before PxCI, so that the HBA expects a Set Device Bits FIS for each tag.
+  //
+  Offset = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_SACT;
+  AhciWriteReg (PciIo, Offset, SlotMask);
+  Offset = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_CI;
+  AhciWriteReg (PciIo, Offset, SlotMask);
+
+  for (Index = 0; Index < Count; Index++) {
+    RemoveEntryList (&Tasks[Index]->Link);
+    InsertTailList (&Instance->NcqTaskList, &Tasks[Index]->Link);
+  }
+
+  Instance->NcqSlotMap |= SlotMask;
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Complete the queued tasks whose commands the device completed, and handle the
+  errors and the timeouts of the others. The port is stopped once no command is
+  in flight.
+
+  @param[in]  Instance   The ATA_ATAPI_PASS_THRU_INSTANCE protocol instance.
+
+  @retval EFI_SUCCESS       No command is in flight.
+  @retval EFI_NOT_READY     Commands are in flight, or are put back at the head
+                            of the task list to be sent again.
+  @retval EFI_DEVICE_ERROR  The commands in flight failed. Their tasks are signalled.
+  @retval EFI_TIMEOUT       The commands in flight timed out. Their tasks are signalled.
+
+**/
+EFI_STATUS
+AhciNcqCheckTasks (
+  IN ATA_ATAPI_PASS_THRU_INSTANCE  *Instance
+  )
+{
+  EFI_PCI_IO_PROTOCOL  *PciIo;
+  ATA_NONBLOCK_TASK    *Tasks[EFI_AHCI_MAX_COMMAND_SLOTS];
+  ATA_NONBLOCK_TASK    *Task;
+  UINT8                Port;
+  UINT32               Offset;
+  UINT32               PortInterrupt;
+  UINT32               Active;
+  UINTN                Count;
+  UINTN                Done;
+  UINTN                Index;
+  BOOLEAN              TimedOut;
+  BOOLEAN              DoRetry;
+  EFI_STATUS           RecoveryStatus;
+
+  Count = AhciNcqGetTasks (Instance, Tasks);
+  if (Count == 0) {
+    return EFI_SUCCESS;
+  }
+
+  PciIo = Instance->PciIo;
+  Port  = (UINT8)Instance->NcqPort;
+
+  //
+  // PxIS is read first, so that the tags still active after an error are those that
+  // failed or were aborted.
+  //
+  Offset        = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_IS;
+  PortInterrupt = AhciReadReg (PciIo, Offset);
+  Offset        = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_SACT;
+  Active        = AhciReadReg (PciIo, Offset);
+  Offset        = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_CI;
+  Active       |= AhciReadReg (PciIo, Offset);
+
+  //
+  // The data buffers of the completed tasks are unmapped before they are signalled.
+  //
+  Done = 0;
+  for (Index = 0; Index < Count; Index++) {
+    if ((Active & ((UINT32)BIT0 << Tasks[Index]->Slot)) == 0) {
+      Tasks[Done++] = Tasks[Index];
+    }
+  }
+
+  AhciNcqUnmapTasks (Instance, Tasks, Done);
+  for (Index = 0; Index < Done; Index++) {
+    Task                  = Tasks[Index];
+    Instance->NcqSlotMap &= ~((UINT32)BIT0 << Task->Slot);
+    AhciDumpPortStatus (PciIo, &Instance->AhciRegisters, Port, Task->Packet->Asb);
+    RemoveEntryList (&Task->Link);
+    gBS->SignalEvent (Task->Event);
+    FreePool (Task);
+  }
+
+  if ((PortInterrupt & EFI_AHCI_PORT_IS_ERROR_MASK) != 0) {
+    DEBUG ((DEBUG_ERROR, "AHCI: Error interrupt reported PxIS: %X, queued commands: %X\n", PortInterrupt, Active));
+    DoRetry        = AhciShouldCmdBeRetried (PciIo, Port); // needs to be called before error recovery
+    RecoveryStatus = AhciRecoverPortError (PciIo, Port);
+    if (DoRetry && !EFI_ERROR (RecoveryStatus)) {
+      //
+      // The device aborted all the commands in flight. They are sent again from
+      // the head of the task list, in the order they were sent.
+      //
+      Count = AhciNcqGetTasks (Instance, Tasks);
+      AhciNcqStopPort (Instance);
+      AhciNcqUnmapTasks (Instance, Tasks, Count);
+      for (Index = Count; Index > 0; Index--) {
+        Task          = Tasks[Index - 1];
+        Task->IsStart = FALSE;
+        RemoveEntryList (&Task->Link);
+        InsertHeadList (&Instance->NonBlockingTaskList, &Task->Link);
+      }
+
+      return EFI_NOT_READY;
+    }
+
+    AhciNcqAbortTasks (Instance, TRUE);
+    return EFI_DEVICE_ERROR;
+  }
+
+  if (IsListEmpty (&Instance->NcqTaskList)) {
+    AhciNcqStopPort (Instance);
+    return EFI_SUCCESS;
+  }
+
+  TimedOut = FALSE;
+  Count    = AhciNcqGetTasks (Instance, Tasks);
+  for (Index = 0; Index < Count; Index++) {
+    Task = Tasks[Index];
+    if (!Task->InfiniteWait && (Task->RetryTimes == 0)) {
+      TimedOut = TRUE;
+    } else {
+      Task->RetryTimes--;
+    }
+  }
+
+  if (TimedOut) {
+    DEBUG ((DEBUG_ERROR, "AHCI: Queued commands %X timed out on port %d\n", Active, Port));
+    AhciNcqAbortTasks (Instance, TRUE);
+    return EFI_TIMEOUT;
+  }
+
+  return EFI_NOT_READY;
+}
+
+/**
+  Stop the queued commands in flight, and release their tasks.
+
+  @param[in]  Instance    The ATA_ATAPI_PASS_THRU_INSTANCE protocol instance.
+  @param[in]  IsSigEvent  Indicate whether signal the task event when remove the
+                          task.
+
+**/
+VOID
+EFIAPI
+AhciNcqAbortTasks (
+  IN ATA_ATAPI_PASS_THRU_INSTANCE  *Instance,
+  IN BOOLEAN                       IsSigEvent
+  )
+{
+  ATA_NONBLOCK_TASK  *Tasks[EFI_AHCI_MAX_COMMAND_SLOTS];
+  ATA_NONBLOCK_TASK  *Task;
+  UINTN              Count;
+  UINTN              Index;
+
+  Count = AhciNcqGetTasks (Instance, Tasks);
+  if (Count == 0) {
+    return;
+  }
+
+  AhciNcqStopPort (Instance);
+  AhciNcqUnmapTasks (Instance, Tasks, Count);
+  for (Index = 0; Index < Count; Index++) {
+    Task = Tasks[Index];
+    RemoveEntryList (&Task->Link);
+    if (IsSigEvent) {
+      Task->Packet->Asb->AtaStatus = 0x01;
+      gBS->SignalEvent (Task->Event);
+    }
+
+    FreePool (Task);
+  }
+}
+
+/**
+  Complete the queued commands in flight, and queue the non-blocking tasks at the
+  head of the task list that the device can queue.
+
+  @param[in]  Instance   The ATA_ATAPI_PASS_THRU_INSTANCE protocol instance.
+
+  @retval EFI_SUCCESS       No command is in flight. The task at the head of the
+                            task list, if any, is to be sent as it is.
+  @retval EFI_NOT_READY     Commands are in flight.
+  @retval Others            The commands in flight failed, or the port could not be
+                            started. The tasks in flight are signalled.
+
+**/
+EFI_STATUS
+EFIAPI
+AhciNcqTransferRoutine (
+  IN ATA_ATAPI_PASS_THRU_INSTANCE  *Instance
+  )
+{
+  EFI_STATUS  Status;
+
+  Status = AhciNcqCheckTasks (Instance);
+  if (EFI_ERROR (Status) && (Status != EFI_NOT_READY)) {
+    return Status;
+  }
+
+  Status = AhciNcqIssueTasks (Instance);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  return IsListEmpty (&Instance->NcqTaskList) ? EFI_SUCCESS : EFI_NOT_READY;
+}
+
+/**
+  Wait until the queued commands in flight complete, since a blocking command
+  shares the command list with them.
+
+  @param[in]  Instance   The ATA_ATAPI_PASS_THRU_INSTANCE protocol instance.
+
+**/
+VOID
+EFIAPI
+AhciNcqWaitIdle (
+  IN ATA_ATAPI_PASS_THRU_INSTANCE  *Instance
+  )
+{
+  EFI_STATUS  Status;
+  EFI_TPL     OldTpl;
+
+  //
+  // Delay 100us to simulate the blocking time out checking.
+  //
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  while (!IsListEmpty (&Instance->NcqTaskList)) {
+    Status = AhciNcqCheckTasks (Instance);
+    if (EFI_ERROR (Status) && (Status != EFI_NOT_READY)) {
+      DestroyAsynTaskList (Instance, TRUE);
+      break;
+    }
+
+    MicroSecondDelay (100);
+  }
+
+  gBS->RestoreTPL (OldTpl);
+}
+
 /**
   Start a non data transfer on specific port.
 
@@ -1563,28 +2268,26 @@ AhciStopCommand (
 }
 
 /**
-  Start command for give slot on specific port.
+  Start the command list processing of a port: clear its status, enable its FIS
+  receive, and set PxCMD.ST.
 
   @param  PciIo              The PCI IO protocol instance.
   @param  Port               The number of port.
-  @param  CommandSlot        The number of Command Slot.
   @param  Timeout            The timeout value of start, uses 100ns as a unit.
 
-  @retval EFI_DEVICE_ERROR   The command start unsuccessfully.
+  @retval EFI_DEVICE_ERROR   The port start unsuccessfully.
   @retval EFI_TIMEOUT        The operation is time out.
-  @retval EFI_SUCCESS        The command start successfully.
+  @retval EFI_SUCCESS        The port start successfully.
 
 **/
 EFI_STATUS
 EFIAPI
-AhciStartCommand (
+AhciStartPort (
   IN  EFI_PCI_IO_PROTOCOL  *PciIo,
   IN  UINT8                Port,
-  IN  UINT8                CommandSlot,
   IN  UINT64               Timeout
   )
 {
-  UINT32      CmdSlotBit;
   EFI_STATUS  Status;
   UINT32      PortStatus;
   UINT32      StartCmd;
@@ -1597,8 +2300,6 @@ AhciStartCommand (
   //
   Capability = AhciReadReg (PciIo, EFI_AHCI_CAPABILITY_OFFSET);
 
-  CmdSlotBit = (UINT32)(1 << CommandSlot);
-
   AhciClearPortStatus (
     PciIo,
     Port
@@ -1645,6 +2346,42 @@ AhciStartCommand (
   Offset = EFI_AHCI_PORT_START + Port * EFI_AHCI_PORT_REG_WIDTH + EFI_AHCI_PORT_CMD;
   AhciOrReg (PciIo, Offset, EFI_AHCI_PORT_CMD_ST | StartCmd);
 
+  return EFI_SUCCESS;
+}
+
+/**
+  Start command for give slot on specific port.
+
+  @param  PciIo              The PCI IO protocol instance.
+  @param  Port               The number of port.
+  @param  CommandSlot        The number of Command Slot.
+  @param  Timeout            The timeout value of start, uses 100ns as a unit.
+
+  @retval EFI_DEVICE_ERROR   The command start unsuccessfully.
+  @retval EFI_TIMEOUT        The operation is time out.
+  @retval EFI_SUCCESS        The command start successfully.
+
+**/
+EFI_STATUS
+EFIAPI
+AhciStartCommand (
+  IN  EFI_PCI_IO_PROTOCOL  *PciIo,
+  IN  UINT8                Port,
+  IN  UINT8                CommandSlot,
+  IN  UINT64               Timeout
+  )
+{
+  UINT32      CmdSlotBit;
+  EFI_STATUS  Status;
+  UINT32      Offset;
+
+  CmdSlotBit = (UINT32)(1 << CommandSlot);
+
+  Status = AhciStartPort (PciIo, Port, Timeout);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
   //
   // Setting the command
   //
@@ -2200,6 +2937,94 @@ AhciPacketCommandExecute (
   return Status;
 }
 
+/**
+  Allocate the slot pool: a command table for each command slot of a port,
+  mapped once, so that the commands queued on a port each have their own.
+
+  @param  PciIo                 The PCI IO protocol instance.
+  @param  AhciRegisters         The pointer to the EFI_AHCI_REGISTERS.
+  @param  Support64Bit          Whether the HBA supports 64-bit addressing.
+
+  @retval EFI_SUCCESS           The slot pool is allocated.
+  @retval EFI_OUT_OF_RESOURCES  The slot pool could not be allocated or mapped.
+  @retval EFI_DEVICE_ERROR      The slot pool is mapped above 4G, which the HBA can't address.
+
+**/
+EFI_STATUS
+AhciCreateSlotTablePool (
+  IN     EFI_PCI_IO_PROTOCOL  *PciIo,
+  IN OUT EFI_AHCI_REGISTERS   *AhciRegisters,
+  IN     BOOLEAN              Support64Bit
+  )
+{
+  EFI_STATUS            Status;
+  UINTN                 Bytes;
+  VOID                  *Buffer;
+  UINT64                MaxSlotTableSize;
+  EFI_PHYSICAL_ADDRESS  AhciSlotTablePciAddr;
+
+  Buffer           = NULL;
+  MaxSlotTableSize = AhciRegisters->MaxCommandSlotNumber * sizeof (EFI_AHCI_SLOT_COMMAND_TABLE);
+  Status           = PciIo->AllocateBuffer (
+                              PciIo,
+                              AllocateAnyPages,
+                              EfiBootServicesData,
+                              EFI_SIZE_TO_PAGES ((UINTN)MaxSlotTableSize),
+                              &Buffer,
+                              0
+                              );
+
+  if (EFI_ERROR (Status)) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  ZeroMem (Buffer, (UINTN)MaxSlotTableSize);
+
+  Bytes  = (UINTN)MaxSlotTableSize;
+  Status = PciIo->Map (
+                    PciIo,
+                    EfiPciIoOperationBusMasterCommonBuffer,
+                    Buffer,
+                    &Bytes,
+                    &AhciSlotTablePciAddr,
+                    &AhciRegisters->MapSlotTable
+                    );
+
+  if (EFI_ERROR (Status) || (Bytes != MaxSlotTableSize)) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto Error2;
+  }
+
+  if ((!Support64Bit) && (AhciSlotTablePciAddr > 0x100000000ULL)) {
+    //
+    // The AHCI HBA doesn't support 64bit addressing, so should not get a >4G pci bus master address.
+    //
+    Status = EFI_DEVICE_ERROR;
+    goto Error1;
+  }
+
+  AhciRegisters->AhciSlotTable        = Buffer;
+  AhciRegisters->AhciSlotTablePciAddr = (EFI_AHCI_SLOT_COMMAND_TABLE *)(UINTN)AhciSlotTablePciAddr;
+  AhciRegisters->MaxSlotTableSize     = MaxSlotTableSize;
+
+  return EFI_SUCCESS;
+
+Error1:
+  PciIo->Unmap (
+           PciIo,
+           AhciRegisters->MapSlotTable
+           );
+Error2:
+  PciIo->FreeBuffer (
+           PciIo,
+           EFI_SIZE_TO_PAGES ((UINTN)MaxSlotTableSize),
+           Buffer
+           );
+  AhciRegisters->MapSlotTable = NULL;
+
+  return Status;
+}
+
 /**
   Allocate transfer-related data struct which is used at AHCI mode.
 
@@ -2410,6 +3235,19 @@ AhciCreateTransferDescriptor (
 
   AhciRegisters->AhciCommandTablePciAddr = (EFI_AHCI_COMMAND_TABLE *)(UINTN)AhciCommandTablePciAddr;
 
+  //
+  // The slot pool is only needed for NCQ, which is not used without it.
+  //
+  AhciRegisters->MaxCommandSlotNumber = MaxCommandSlotNumber;
+  AhciRegisters->NcqSupport           = (BOOLEAN)((Capability & EFI_AHCI_CAP_SNCQ) != 0);
+  if (AhciRegisters->NcqSupport) {
+    Status = AhciCreateSlotTablePool (PciIo, AhciRegisters, Support64Bit);
+    if (EFI_ERROR (Status)) {
+      DEBUG ((DEBUG_WARN, "AhciCreateTransferDescriptor: no command slot pool, NCQ is not used (%r)\n", Status));
+      AhciRegisters->NcqSupport = FALSE;
+    }
+  }
+
   return EFI_SUCCESS;
   //
   // Map error or unable to map the whole CmdList buffer into a contiguous region.
@@ -2928,6 +3766,8 @@ AhciModeInitialization (
         "AhciModeInitialization: failed to enable 64-bit DMA on 64-bit capable controller (%r)\n",
         Status
         ));
+    } else {
+      Instance->AhciRegisters.DualAddressCycle = TRUE;
     }
   }
 
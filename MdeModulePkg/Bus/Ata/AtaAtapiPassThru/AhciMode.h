@@ -14,6 +14,7 @@
 #define EFI_AHCI_CAPABILITY_OFFSET  0x0000
 #define   EFI_AHCI_CAP_SAM          BIT18
 #define   EFI_AHCI_CAP_SSS          BIT27
+#define   EFI_AHCI_CAP_SNCQ         BIT30
 #define   EFI_AHCI_CAP_S64A         BIT31
 #define EFI_AHCI_GHC_OFFSET         0x0004
 #define   EFI_AHCI_GHC_RESET        BIT0
@@ -24,6 +25,11 @@
 
 #define EFI_AHCI_MAX_PORTS  32
 
+//
+// A port has at most 32 command slots, which are also the tags of its queued commands.
+//
+#define EFI_AHCI_MAX_COMMAND_SLOTS  32
+
 #define AHCI_CAPABILITY2_OFFSET  0x0024
 #define   AHCI_CAP2_SDS          BIT3
 #define   AHCI_CAP2_SADM         BIT4
@@ -62,6 +68,12 @@ typedef union {
 //
 #define EFI_AHCI_MAX_DATA_PER_PRDT  0x400000
 
+//
+// Each command table of the slot pool has 16 PRDT entries, which is 64M byte for
+// the contiguous device address range of a mapped buffer.
+//
+#define EFI_AHCI_SLOT_MAX_PRDT  16
+
 #define EFI_AHCI_FIS_REGISTER_H2D           0x27         // Register FIS - Host to Device
 #define   EFI_AHCI_FIS_REGISTER_H2D_LENGTH  20
 #define EFI_AHCI_FIS_REGISTER_D2H           0x34         // Register FIS - Device to Host
@@ -286,6 +298,17 @@ typedef struct {
   EFI_AHCI_COMMAND_PRDT     PrdtTable[65535];     // The scatter/gather list for data transfer
 } EFI_AHCI_COMMAND_TABLE;
 
+//
+// Command table of the slot pool, with a short PRD table. Queued commands each
+// use the one of their command slot.
+//
+typedef struct {
+  EFI_AHCI_COMMAND_FIS      CommandFis;                        // A software constructed FIS.
+  EFI_AHCI_ATAPI_COMMAND    AtapiCmd;                          // 12 or 16 bytes ATAPI cmd.
+  UINT8                     Reserved[0x30];
+  EFI_AHCI_COMMAND_PRDT     PrdtTable[EFI_AHCI_SLOT_MAX_PRDT]; // The scatter/gather list for data transfer
+} EFI_AHCI_SLOT_COMMAND_TABLE;
+
 //
 // Received FIS structure
 //
@@ -313,18 +336,29 @@ typedef struct {
 #pragma pack()
 
 typedef struct {
-  EFI_AHCI_RECEIVED_FIS     *AhciRFis;
-  EFI_AHCI_COMMAND_LIST     *AhciCmdList;
-  EFI_AHCI_COMMAND_TABLE    *AhciCommandTable;
-  EFI_AHCI_RECEIVED_FIS     *AhciRFisPciAddr;
-  EFI_AHCI_COMMAND_LIST     *AhciCmdListPciAddr;
-  EFI_AHCI_COMMAND_TABLE    *AhciCommandTablePciAddr;
-  UINT64                    MaxCommandListSize;
-  UINT64                    MaxCommandTableSize;
-  UINT64                    MaxReceiveFisSize;
-  VOID                      *MapRFis;
-  VOID                      *MapCmdList;
-  VOID                      *MapCommandTable;
+  EFI_AHCI_RECEIVED_FIS          *AhciRFis;
+  EFI_AHCI_COMMAND_LIST          *AhciCmdList;
+  EFI_AHCI_COMMAND_TABLE         *AhciCommandTable;
+  EFI_AHCI_RECEIVED_FIS          *AhciRFisPciAddr;
+  EFI_AHCI_COMMAND_LIST          *AhciCmdListPciAddr;
+  EFI_AHCI_COMMAND_TABLE         *AhciCommandTablePciAddr;
+  UINT64                         MaxCommandListSize;
+  UINT64                         MaxCommandTableSize;
+  UINT64                         MaxReceiveFisSize;
+  VOID                           *MapRFis;
+  VOID                           *MapCmdList;
+  VOID                           *MapCommandTable;
+  //
+  // The slot pool: a command table for each command slot, mapped once, which
+  // the queued commands use. NCQ is not used without it.
+  //
+  EFI_AHCI_SLOT_COMMAND_TABLE    *AhciSlotTable;
+  EFI_AHCI_SLOT_COMMAND_TABLE    *AhciSlotTablePciAddr;
+  UINT64                         MaxSlotTableSize;
+  VOID                           *MapSlotTable;
+  UINT8                          MaxCommandSlotNumber;
+  BOOLEAN                        NcqSupport;
+  BOOLEAN                        DualAddressCycle;
 } EFI_AHCI_REGISTERS;
 
 /**
@@ -352,6 +386,27 @@ AhciPacketCommandExecute (
   IN  EFI_EXT_SCSI_PASS_THRU_SCSI_REQUEST_PACKET  *Packet
   );
 
+/**
+  Start the command list processing of a port: clear its status, enable its FIS
+  receive, and set PxCMD.ST.
+
+  @param  PciIo              The PCI IO protocol instance.
+  @param  Port               The number of port.
+  @param  Timeout            The timeout value of start, uses 100ns as a unit.
+
+  @retval EFI_DEVICE_ERROR   The port start unsuccessfully.
+  @retval EFI_TIMEOUT        The operation is time out.
+  @retval EFI_SUCCESS        The port start successfully.
+
+**/
+EFI_STATUS
+EFIAPI
+AhciStartPort (
+  IN  EFI_PCI_IO_PROTOCOL  *PciIo,
+  IN  UINT8                Port,
+  IN  UINT64               Timeout
+  );
+
 /**
   Start command for give slot on specific port.
 
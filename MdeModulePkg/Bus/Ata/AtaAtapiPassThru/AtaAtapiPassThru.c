@@ -286,6 +286,13 @@ AtaPassThruPassThruExecute (
         PortMultiplierPort = 0;
       }
 
+      //
+      // A blocking command uses the command list of the queued commands in flight.
+      //
+      if (Task == NULL) {
+        AhciNcqWaitIdle (Instance);
+      }
+
       switch (Protocol) {
         case EFI_ATA_PASS_THRU_PROTOCOL_ATA_NON_DATA:
           Status = AhciNonDataTransfer (
@@ -406,6 +413,23 @@ AsyncNonBlockingTransferRoutine (
 
   Instance    = (ATA_ATAPI_PASS_THRU_INSTANCE *)Context;
   EntryHeader = &Instance->NonBlockingTaskList;
+
+  //
+  // The tasks that the device can queue are sent several at a time. The others
+  // wait until the queued commands complete.
+  //
+  if (Instance->Mode == EfiAtaAhciMode) {
+    Status = AhciNcqTransferRoutine (Instance);
+    if (Status == EFI_NOT_READY) {
+      return;
+    }
+
+    if (EFI_ERROR (Status)) {
+      DestroyAsynTaskList (Instance, TRUE);
+      return;
+    }
+  }
+
   //
   // Get the Tasks from the Tasks List and execute it, until there is
   // no task in the list or the device is busy with task (EFI_NOT_READY).
@@ -772,6 +796,15 @@ AtaAtapiPassThruStart (
   Instance->ExtScsiPassThru.Mode  = &Instance->ExtScsiPassThruMode;
   InitializeListHead (&Instance->DeviceList);
   InitializeListHead (&Instance->NonBlockingTaskList);
+  InitializeListHead (&Instance->NcqTaskList);
+
+  //
+  // The IOMMU batch protocol is optional.
+  //
+  Status = gBS->LocateProtocol (&gEdkiiIoMmuBatchProtocolGuid, NULL, (VOID **)&Instance->IoMmuBatch);
+  if (EFI_ERROR (Status)) {
+    Instance->IoMmuBatch = NULL;
+  }
 
   Instance->TimerEvent = NULL;
 
@@ -952,6 +985,18 @@ AtaAtapiPassThruStop (
   //
   if (Instance->Mode == EfiAtaAhciMode) {
     AhciRegisters = &Instance->AhciRegisters;
+    if (AhciRegisters->AhciSlotTable != NULL) {
+      PciIo->Unmap (
+               PciIo,
+               AhciRegisters->MapSlotTable
+               );
+      PciIo->FreeBuffer (
+               PciIo,
+               EFI_SIZE_TO_PAGES ((UINTN)AhciRegisters->MaxSlotTableSize),
+               AhciRegisters->AhciSlotTable
+               );
+    }
+
     PciIo->Unmap (
              PciIo,
              AhciRegisters->MapCommandTable
@@ -1153,6 +1198,10 @@ DestroyAsynTaskList (
   EFI_TPL            OldTpl;
 
   OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  if (Instance->Mode == EfiAtaAhciMode) {
+    AhciNcqAbortTasks (Instance, IsSigEvent);
+  }
+
   if (!IsListEmpty (&Instance->NonBlockingTaskList)) {
     //
     // Free the Subtask list.
@@ -2120,6 +2169,7 @@ ExtScsiPassThruPassThru (
         PortMultiplier = 0;
       }
 
+      AhciNcqWaitIdle (Instance);
       Status = AhciPacketCommandExecute (Instance->PciIo, &Instance->AhciRegisters, Port, PortMultiplier, Packet);
       break;
     default:
@@ -20,6 +20,7 @@
 #include <Protocol/AtaPassThru.h>
 #include <Protocol/ScsiPassThruExt.h>
 #include <Protocol/AtaAtapiPolicy.h>
+#include <Protocol/IoMmuBatch.h>
 
 #include <Library/DebugLib.h>
 #include <Library/BaseLib.h>
@@ -119,6 +120,16 @@ typedef struct {
   //
   EFI_EVENT                           TimerEvent;
   LIST_ENTRY                          NonBlockingTaskList;
+
+  //
+  // For NCQ at AHCI mode: the queued tasks in flight, on one device, and the
+  // command slots they use.
+  //
+  LIST_ENTRY                          NcqTaskList;
+  UINT16                              NcqPort;
+  UINT16                              NcqPortMultiplier;
+  UINT32                              NcqSlotMap;
+  EDKII_IOMMU_BATCH_PROTOCOL          *IoMmuBatch;
 } ATA_ATAPI_PASS_THRU_INSTANCE;
 
 //
@@ -139,6 +150,9 @@ struct _ATA_NONBLOCK_TASK {
   VOID                                *TableMap;       // Pointer to PRD table map.
   EFI_ATA_DMA_PRD                     *MapBaseAddress; //  Pointer to range Base address for Map.
   UINTN                               PageCount;       //  The page numbers used by PCIO freebuffer.
+  UINT8                               Slot;            // The command slot and tag of a queued task.
+  BOOLEAN                             BatchMapped;     // The data buffer is mapped by BatchEntry.
+  EDKII_IOMMU_BATCH_ENTRY             BatchEntry;      // The IOMMU batch mapping of a queued task.
 };
 
 //
@@ -1148,6 +1162,53 @@ AhciDmaTransfer (
   IN     ATA_NONBLOCK_TASK             *Task
   );
 
+/**
+  Stop the queued commands in flight, and release their tasks.
+
+  @param[in]  Instance    The ATA_ATAPI_PASS_THRU_INSTANCE protocol instance.
+  @param[in]  IsSigEvent  Indicate whether signal the task event when remove the
+                          task.
+
+**/
+VOID
+EFIAPI
+AhciNcqAbortTasks (
+  IN ATA_ATAPI_PASS_THRU_INSTANCE  *Instance,
+  IN BOOLEAN                       IsSigEvent
+  );
+
+/**
+  Complete the queued commands in flight, and queue the non-blocking tasks at the
+  head of the task list that the device can queue.
+
+  @param[in]  Instance   The ATA_ATAPI_PASS_THRU_INSTANCE protocol instance.
+
+  @retval EFI_SUCCESS       No command is in flight. The task at the head of the
+                            task list, if any, is to be sent as it is.
+  @retval EFI_NOT_READY     Commands are in flight.
+  @retval Others            The commands in flight failed, or the port could not be
+                            started. The tasks in flight are signalled.
+
+**/
+EFI_STATUS
+EFIAPI
+AhciNcqTransferRoutine (
+  IN ATA_ATAPI_PASS_THRU_INSTANCE  *Instance
+  );
+
+/**
+  Wait until the queued commands in flight complete, since a blocking command
+  shares the command list with them.
+
+  @param[in]  Instance   The ATA_ATAPI_PASS_THRU_INSTANCE protocol instance.
+
+**/
+VOID
+EFIAPI
+AhciNcqWaitIdle (
+  IN ATA_ATAPI_PASS_THRU_INSTANCE  *Instance
+  );
+
 /**
   Start a PIO data transfer on specific port.
 
@@ -9,6 +9,137 @@ SPDX-License-Identifier: BSD-2-Clause-Patent
 
 #include "Ehci.h"
 
+/**
+  Allocates pages at a specified alignment that are suitable for an EfiPciIoOperationBusMasterCommonBuffer mapping.
+
+  If Alignment is not a power of two and Alignment is not zero, then ASSERT().
+
+  @param  PciIo                 The PciIo that can be used to access the host controller.
+  @param  Pages                 The number of pages to allocate.
+  @param  Alignment             The requested alignment of the allocation.  Must be a power of two.
+  @param  HostAddress           The system memory address to map to the PCI controller.
+  @param  DeviceAddress         The resulting map address for the bus master PCI controller to
+                                use to access the hosts HostAddress.
+  @param  Mapping               A resulting value to pass to Unmap().
+
+  @retval EFI_SUCCESS           Success to allocate aligned pages.
+  @retval EFI_INVALID_PARAMETER Pages or Alignment is not valid.
+  @retval EFI_OUT_OF_RESOURCES  Do not have enough resources to allocate memory.
+
+
+**/
+EFI_STATUS
+UsbHcAllocateAlignedPages (
+  IN EFI_PCI_IO_PROTOCOL    *PciIo,
+  IN UINTN                  Pages,
+  IN UINTN                  Alignment,
+  OUT VOID                  **HostAddress,
+  OUT EFI_PHYSICAL_ADDRESS  *DeviceAddress,
+  OUT VOID                  **Mapping
+  )
+{
+  EFI_STATUS  Status;
+  VOID        *Memory;
+  UINTN       AlignedMemory;
+  UINTN       AlignmentMask;
+  UINTN       UnalignedPages;
+  UINTN       RealPages;
+  UINTN       Bytes;
+
+  //
+  // Alignment must be a power of two or zero.
+  //
+  ASSERT ((Alignment & (Alignment - 1)) == 0);
+
+  if ((Alignment & (Alignment - 1)) != 0) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (Pages == 0) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (Alignment > EFI_PAGE_SIZE) {
+    //
+    // Calculate the total number of pages since alignment is larger than page size.
+    //
+    AlignmentMask = Alignment - 1;
+    RealPages     = Pages + EFI_SIZE_TO_PAGES (Alignment);
+    //
+    // Make sure that Pages plus EFI_SIZE_TO_PAGES (Alignment) does not overflow.
+    //
+    ASSERT (RealPages > Pages);
+
+    Status = PciIo->AllocateBuffer (
+                      PciIo,
+                      AllocateAnyPages,
+                      EfiBootServicesData,
+                      RealPages,
+                      &Memory,
+                      0
+                      );
+    if (EFI_ERROR (Status)) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    AlignedMemory  = ((UINTN)Memory + AlignmentMask) & ~AlignmentMask;
+    UnalignedPages = EFI_SIZE_TO_PAGES (AlignedMemory - (UINTN)Memory);
+    if (UnalignedPages > 0) {
+      //
+      // Free first unaligned page(s).
+      //
+      Status = PciIo->FreeBuffer (PciIo, UnalignedPages, Memory);
+      ASSERT_EFI_ERROR (Status);
+    }
+
+    Memory         = (VOID *)(UINTN)(AlignedMemory + EFI_PAGES_TO_SIZE (Pages));
+    UnalignedPages = RealPages - Pages - UnalignedPages;
+    if (UnalignedPages > 0) {
+      //
+      // Free last unaligned page(s).
+      //
+      Status = PciIo->FreeBuffer (PciIo, UnalignedPages, Memory);
+      ASSERT_EFI_ERROR (Status);
+    }
+  } else {
+    //
+    // Do not over-allocate pages in this case.
+    //
+    Status = PciIo->AllocateBuffer (
+                      PciIo,
+                      AllocateAnyPages,
+                      EfiBootServicesData,
+                      Pages,
+                      &Memory,
+                      0
+                      );
+    if (EFI_ERROR (Status)) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    AlignedMemory = (UINTN)Memory;
+  }
+
+  Bytes  = EFI_PAGES_TO_SIZE (Pages);
+  Status = PciIo->Map (
+                    PciIo,
+                    EfiPciIoOperationBusMasterCommonBuffer,
+                    (VOID *)AlignedMemory,
+                    &Bytes,
+                    DeviceAddress,
+                    Mapping
+                    );
+
+  if (EFI_ERROR (Status) || (Bytes != EFI_PAGES_TO_SIZE (Pages))) {
+    Status = PciIo->FreeBuffer (PciIo, Pages, (VOID *)AlignedMemory);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  *HostAddress = (VOID *)AlignedMemory;
+
+  return EFI_SUCCESS;
+}
+
 /**
   Allocate a block of memory to be used by the buffer pool.
 
@@ -30,10 +161,21 @@ UsbHcAllocMemBlock (
   VOID                  *Mapping;
   EFI_PHYSICAL_ADDRESS  MappedAddr;
   UINTN                 Bytes;
+  UINTN                 ChunkSize;
   EFI_STATUS            Status;
 
   PciIo = Pool->PciIo;
 
+  //
+  // Grow the pool in whole chunks aligned to their size, if so configured,
+  // so that an IOMMU can map each chunk with one large page.
+  //
+  ChunkSize = PcdGet32 (PcdUsbHcMemChunkSize);
+  ASSERT ((ChunkSize & (ChunkSize - 1)) == 0);
+  if (ChunkSize > EFI_PAGE_SIZE) {
+    Pages = ALIGN_VALUE (Pages, EFI_SIZE_TO_PAGES (ChunkSize));
+  }
+
   Block = AllocateZeroPool (sizeof (USBHC_MEM_BLOCK));
   if (Block == NULL) {
     return NULL;
@@ -54,35 +196,42 @@ UsbHcAllocMemBlock (
     return NULL;
   }
 
-  //
-  // Allocate the number of Pages of memory, then map it for
-  // bus master read and write.
-  //
-  Status = PciIo->AllocateBuffer (
-                    PciIo,
-                    AllocateAnyPages,
-                    EfiBootServicesData,
-                    Pages,
-                    &BufHost,
-                    0
-                    );
-
-  if (EFI_ERROR (Status)) {
-    goto FREE_BITARRAY;
-  }
-
-  Bytes  = EFI_PAGES_TO_SIZE (Pages);
-  Status = PciIo->Map (
-                    PciIo,
-                    EfiPciIoOperationBusMasterCommonBuffer,
-                    BufHost,
-                    &Bytes,
-                    &MappedAddr,
-                    &Mapping
-                    );
+  if (ChunkSize > EFI_PAGE_SIZE) {
+    Status = UsbHcAllocateAlignedPages (PciIo, Pages, ChunkSize, &BufHost, &MappedAddr, &Mapping);
+    if (EFI_ERROR (Status)) {
+      goto FREE_BITARRAY;
+    }
+  } else {
+    //
+    // Allocate the number of Pages of memory, then map it for
+    // bus master read and write.
+    //
+    Status = PciIo->AllocateBuffer (
+                      PciIo,
+                      AllocateAnyPages,
+                      EfiBootServicesData,
+                      Pages,
+                      &BufHost,
+                      0
+                      );
+
+    if (EFI_ERROR (Status)) {
+      goto FREE_BITARRAY;
+    }
 
-  if (EFI_ERROR (Status) || (Bytes != EFI_PAGES_TO_SIZE (Pages))) {
-    goto FREE_BUFFER;
+    Bytes  = EFI_PAGES_TO_SIZE (Pages);
+    Status = PciIo->Map (
+                      PciIo,
+                      EfiPciIoOperationBusMasterCommonBuffer,
+                      BufHost,
+                      &Bytes,
+                      &MappedAddr,
+                      &Mapping
+                      );
+
+    if (EFI_ERROR (Status) || (Bytes != EFI_PAGES_TO_SIZE (Pages))) {
+      goto FREE_BUFFER;
+    }
   }
 
   //
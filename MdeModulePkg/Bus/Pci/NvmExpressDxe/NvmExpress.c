@@ -583,11 +583,8 @@ ProcessAsyncTaskList (
   BOOLEAN                       HasNewItem;
   EFI_STATUS                    Status;
 
-  Private    = (NVME_CONTROLLER_PRIVATE_DATA *)Context;
-  QueueId    = 2;
-  Cq         = Private->CqBuffer[QueueId] + Private->CqHdbl[QueueId].Cqh;
-  HasNewItem = FALSE;
-  PciIo      = Private->PciIo;
+  Private = (NVME_CONTROLLER_PRIVATE_DATA *)Context;
+  PciIo   = Private->PciIo;
 
   //
   // Submit asynchronous subtasks to the NVMe Submission Queue
@@ -663,85 +660,75 @@ ProcessAsyncTaskList (
     }
   }
 
-  while (Cq->Pt != Private->Pt[QueueId]) {
-    ASSERT (Cq->Sqid == QueueId);
+  //
+  // Reap the completions of all asynchronous I/O queue pairs in this pass.
+  //
+  for (QueueId = NVME_ASYNC_QUEUE_ID; QueueId < NVME_ASYNC_QUEUE_ID + Private->AsyncQueues; QueueId++) {
+    Cq         = Private->CqBuffer[QueueId] + Private->CqHdbl[QueueId].Cqh;
+    HasNewItem = FALSE;
 
-    HasNewItem = TRUE;
+    while (Cq->Pt != Private->Pt[QueueId]) {
+      ASSERT (Cq->Sqid == QueueId);
 
-    //
-    // Find the command with given Command Id.
-    //
-    for (Link = GetFirstNode (&Private->AsyncPassThruQueue);
-         !IsNull (&Private->AsyncPassThruQueue, Link);
-         Link = NextLink)
-    {
-      NextLink     = GetNextNode (&Private->AsyncPassThruQueue, Link);
-      AsyncRequest = NVME_PASS_THRU_ASYNC_REQ_FROM_THIS (Link);
-      if (AsyncRequest->CommandId == Cq->Cid) {
-        //
-        // Copy the Respose Queue entry for this command to the callers
-        // response buffer.
-        //
-        CopyMem (
-          AsyncRequest->Packet->NvmeCompletion,
-          Cq,
-          sizeof (EFI_NVM_EXPRESS_COMPLETION)
-          );
+      HasNewItem = TRUE;
 
-        //
-        // Free the resources allocated before cmd submission
-        //
-        if (AsyncRequest->MapData != NULL) {
-          PciIo->Unmap (PciIo, AsyncRequest->MapData);
+      //
+      // Find the command with given Command Id.
+      //
+      for (Link = GetFirstNode (&Private->AsyncPassThruQueue);
+           !IsNull (&Private->AsyncPassThruQueue, Link);
+           Link = NextLink)
+      {
+        NextLink     = GetNextNode (&Private->AsyncPassThruQueue, Link);
+        AsyncRequest = NVME_PASS_THRU_ASYNC_REQ_FROM_THIS (Link);
+        if ((AsyncRequest->QueueId == QueueId) && (AsyncRequest->CommandId == Cq->Cid)) {
+          //
+          // Copy the Respose Queue entry for this command to the callers
+          // response buffer.
+          //
+          CopyMem (
+            AsyncRequest->Packet->NvmeCompletion,
+            Cq,
+            sizeof (EFI_NVM_EXPRESS_COMPLETION)
+            );
+
+          //
+          // Free the resources allocated before cmd submission
+          //
+          NvmeReleasePassThruDma (Private, &AsyncRequest->Dma);
+
+          RemoveEntryList (Link);
+          gBS->SignalEvent (AsyncRequest->CallerEvent);
+          FreePool (AsyncRequest);
+
+          //
+          // Update submission queue head.
+          //
+          Private->AsyncSqHead[QueueId] = Cq->Sqhd;
+          break;
         }
+      }
 
-        if (AsyncRequest->MapMeta != NULL) {
-          PciIo->Unmap (PciIo, AsyncRequest->MapMeta);
-        }
+      Private->CqHdbl[QueueId].Cqh++;
+      if (Private->CqHdbl[QueueId].Cqh > Private->AsyncQueueSize) {
+        Private->CqHdbl[QueueId].Cqh = 0;
+        Private->Pt[QueueId]        ^= 1;
+      }
 
-        if (AsyncRequest->MapPrpList != NULL) {
-          PciIo->Unmap (PciIo, AsyncRequest->MapPrpList);
-        }
+      Cq = Private->CqBuffer[QueueId] + Private->CqHdbl[QueueId].Cqh;
+    }
 
-        if (AsyncRequest->PrpListHost != NULL) {
-          PciIo->FreeBuffer (
+    if (HasNewItem) {
+      Data = ReadUnaligned32 ((UINT32 *)&Private->CqHdbl[QueueId]);
+      PciIo->Mem.Write (
                    PciIo,
-                   AsyncRequest->PrpListNo,
-                   AsyncRequest->PrpListHost
+                   EfiPciIoWidthUint32,
+                   NVME_BAR,
+                   NVME_CQHDBL_OFFSET (QueueId, Private->Cap.Dstrd),
+                   1,
+                   &Data
                    );
-        }
-
-        RemoveEntryList (Link);
-        gBS->SignalEvent (AsyncRequest->CallerEvent);
-        FreePool (AsyncRequest);
-
-        //
-        // Update submission queue head.
-        //
-        Private->AsyncSqHead = Cq->Sqhd;
-        break;
-      }
-    }
-
-    Private->CqHdbl[QueueId].Cqh++;
-    if (Private->CqHdbl[QueueId].Cqh > MIN (NVME_ASYNC_CCQ_SIZE, Private->Cap.Mqes)) {
-      Private->CqHdbl[QueueId].Cqh = 0;
-      Private->Pt[QueueId]        ^= 1;
     }
-
-    Cq = Private->CqBuffer[QueueId] + Private->CqHdbl[QueueId].Cqh;
-  }
-
-  if (HasNewItem) {
-    Data = ReadUnaligned32 ((UINT32 *)&Private->CqHdbl[QueueId]);
-    PciIo->Mem.Write (
-                 PciIo,
-                 EfiPciIoWidthUint32,
-                 NVME_BAR,
-                 NVME_CQHDBL_OFFSET (QueueId, Private->Cap.Dstrd),
-                 1,
-                 &Data
-                 );
   }
 }
 
@@ -1026,24 +1013,31 @@ NvmExpressDriverBindingStart (
                       );
     if (EFI_ERROR (Status)) {
       DEBUG ((DEBUG_WARN, "NvmExpressDriverBindingStart: failed to enable 64-bit DMA (%r)\n", Status));
+    } else {
+      Private->DualAddressCycle = TRUE;
     }
 
     //
-    // 6 x 4kB aligned buffers will be carved out of this buffer.
-    // 1st 4kB boundary is the start of the admin submission queue.
-    // 2nd 4kB boundary is the start of the admin completion queue.
-    // 3rd 4kB boundary is the start of I/O submission queue #1.
-    // 4th 4kB boundary is the start of I/O completion queue #1.
-    // 5th 4kB boundary is the start of I/O submission queue #2.
-    // 6th 4kB boundary is the start of I/O completion queue #2.
+    // The queues will be carved out of this buffer, at 4kB boundaries: the
+    // admin and the blocking I/O queue pairs take a page per queue, followed
+    // by the asynchronous I/O queue pairs, as many and as deep as the
+    // platform asks. NvmeControllerInit() fits them to the controller.
     //
-    // Allocate 6 pages of memory, then map it for bus master read and write.
+    Private->MaxAsyncQueues    = (UINT16)MIN (MAX (PcdGet32 (PcdNvmeAsyncIoQueueCount), 1), NVME_MAX_ASYNC_QUEUES);
+    Private->MaxAsyncQueueSize = (UINT16)(MIN (MAX (PcdGet32 (PcdNvmeAsyncIoQueueDepth), 2), NVME_MAX_ASYNC_QUEUE_SIZE) - 1);
+    Private->BufferPages       = 4 + Private->MaxAsyncQueues *
+                                 (NVME_ASYNC_SQ_PAGES (Private->MaxAsyncQueueSize) +
+                                  NVME_ASYNC_CQ_PAGES (Private->MaxAsyncQueueSize));
+
+    //
+    // Allocate the pages, then map them for bus master read and write once,
+    // as one range that the IOMMU can map with large pages.
     //
     Status = PciIo->AllocateBuffer (
                       PciIo,
                       AllocateAnyPages,
                       EfiBootServicesData,
-                      6,
+                      Private->BufferPages,
                       (VOID **)&Private->Buffer,
                       0
                       );
@@ -1051,7 +1045,7 @@ NvmExpressDriverBindingStart (
       goto Exit;
     }
 
-    Bytes  = EFI_PAGES_TO_SIZE (6);
+    Bytes  = EFI_PAGES_TO_SIZE (Private->BufferPages);
     Status = PciIo->Map (
                       PciIo,
                       EfiPciIoOperationBusMasterCommonBuffer,
@@ -1061,12 +1055,60 @@ NvmExpressDriverBindingStart (
                       &Private->Mapping
                       );
 
-    if (EFI_ERROR (Status) || (Bytes != EFI_PAGES_TO_SIZE (6))) {
+    if (EFI_ERROR (Status) || (Bytes != EFI_PAGES_TO_SIZE (Private->BufferPages))) {
       goto Exit;
     }
 
     Private->BufferPciAddr = (UINT8 *)(UINTN)MappedAddr;
 
+    //
+    // Allocate and map the pool of PRP list pages once, so that commands that
+    // need PRP lists do not map them through the IOMMU one by one. Commands
+    // fall back to mapping their own PRP lists if the pool is missing.
+    //
+    Status = PciIo->AllocateBuffer (
+                      PciIo,
+                      AllocateAnyPages,
+                      EfiBootServicesData,
+                      NVME_PRP_LIST_POOL_PAGES,
+                      (VOID **)&Private->PrpListPool,
+                      0
+                      );
+    if (!EFI_ERROR (Status)) {
+      Bytes  = EFI_PAGES_TO_SIZE (NVME_PRP_LIST_POOL_PAGES);
+      Status = PciIo->Map (
+                        PciIo,
+                        EfiPciIoOperationBusMasterCommonBuffer,
+                        Private->PrpListPool,
+                        &Bytes,
+                        &Private->PrpListPoolPciAddr,
+                        &Private->PrpListPoolMapping
+                        );
+      if (EFI_ERROR (Status) || (Bytes != EFI_PAGES_TO_SIZE (NVME_PRP_LIST_POOL_PAGES))) {
+        if (!EFI_ERROR (Status)) {
+          PciIo->Unmap (PciIo, Private->PrpListPoolMapping);
+        }
+
+        PciIo->FreeBuffer (PciIo, NVME_PRP_LIST_POOL_PAGES, Private->PrpListPool);
+        Private->PrpListPool        = NULL;
+        Private->PrpListPoolMapping = NULL;
+      } else {
+        Private->PrpListPoolFree = MAX_UINT64;
+      }
+    }
+
+    if (Private->PrpListPool == NULL) {
+      DEBUG ((DEBUG_WARN, "NvmExpressDriverBindingStart: no pre-mapped PRP list pool\n"));
+    }
+
+    //
+    // The IOMMU batch protocol is optional.
+    //
+    Status = gBS->LocateProtocol (&gEdkiiIoMmuBatchProtocolGuid, NULL, (VOID **)&Private->IoMmuBatch);
+    if (EFI_ERROR (Status)) {
+      Private->IoMmuBatch = NULL;
+    }
+
     Private->Signature                 = NVME_CONTROLLER_PRIVATE_DATA_SIGNATURE;
     Private->ControllerHandle          = Controller;
     Private->ImageHandle               = This->DriverBindingHandle;
@@ -1166,12 +1208,24 @@ NvmExpressDriverBindingStart (
   return EFI_SUCCESS;
 
 Exit:
+  if (Private != NULL) {
+    NvmeFreeHostMemoryBuffer (Private);
+  }
+
+  if ((Private != NULL) && (Private->PrpListPoolMapping != NULL)) {
+    PciIo->Unmap (PciIo, Private->PrpListPoolMapping);
+  }
+
+  if ((Private != NULL) && (Private->PrpListPool != NULL)) {
+    PciIo->FreeBuffer (PciIo, NVME_PRP_LIST_POOL_PAGES, Private->PrpListPool);
+  }
+
   if ((Private != NULL) && (Private->Mapping != NULL)) {
     PciIo->Unmap (PciIo, Private->Mapping);
   }
 
   if ((Private != NULL) && (Private->Buffer != NULL)) {
-    PciIo->FreeBuffer (PciIo, 6, Private->Buffer);
+    PciIo->FreeBuffer (PciIo, Private->BufferPages, Private->Buffer);
   }
 
   if ((Private != NULL) && (Private->ControllerData != NULL)) {
@@ -1277,6 +1331,8 @@ NvmExpressDriverBindingStop (
         gBS->Stall (100);
       }
 
+      NvmeFreeHostMemoryBuffer (Private);
+
       gBS->UninstallMultipleProtocolInterfaces (
              Controller,
              &gEfiNvmExpressPassThruProtocolGuid,
@@ -1288,12 +1344,20 @@ NvmExpressDriverBindingStop (
         gBS->CloseEvent (Private->TimerEvent);
       }
 
+      if (Private->PrpListPoolMapping != NULL) {
+        Private->PciIo->Unmap (Private->PciIo, Private->PrpListPoolMapping);
+      }
+
+      if (Private->PrpListPool != NULL) {
+        Private->PciIo->FreeBuffer (Private->PciIo, NVME_PRP_LIST_POOL_PAGES, Private->PrpListPool);
+      }
+
       if (Private->Mapping != NULL) {
         Private->PciIo->Unmap (Private->PciIo, Private->Mapping);
       }
 
       if (Private->Buffer != NULL) {
-        Private->PciIo->FreeBuffer (Private->PciIo, 6, Private->Buffer);
+        Private->PciIo->FreeBuffer (Private->PciIo, Private->BufferPages, Private->Buffer);
       }
 
       FreePool (Private->ControllerData);
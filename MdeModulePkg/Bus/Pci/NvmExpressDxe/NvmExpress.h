@@ -31,6 +31,7 @@
 #include <Protocol/StorageSecurityCommand.h>
 #include <Protocol/ResetNotification.h>
 #include <Protocol/MediaSanitize.h>
+#include <Protocol/IoMmuBatch.h>
 
 #include <Library/BaseLib.h>
 #include <Library/BaseMemoryLib.h>
@@ -42,6 +43,7 @@
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/UefiDriverEntryPoint.h>
 #include <Library/ReportStatusCodeLib.h>
+#include <Library/PcdLib.h>
 
 #include <Guid/NVMeEventGroup.h>
 
@@ -68,17 +70,37 @@ extern EFI_DRIVER_SUPPORTED_EFI_VERSION_PROTOCOL  gNvmExpressDriverSupportedEfiV
 #define NVME_CCQ_SIZE  1                                // Number of I/O completion queue entries, which is 0-based
 
 //
-// Number of asynchronous I/O submission queue entries, which is 0-based.
-// The asynchronous I/O submission queue size is 4kB in total.
+// The asynchronous I/O queue pairs follow the admin and the blocking I/O ones.
+// PcdNvmeAsyncIoQueueCount and PcdNvmeAsyncIoQueueDepth set their number and
+// entries, within these bounds and the limits of the controller.
 //
-#define NVME_ASYNC_CSQ_SIZE  63
+#define NVME_ASYNC_QUEUE_ID        2                    // Id of the first asynchronous I/O queue pair
+#define NVME_MAX_ASYNC_QUEUES      16
+#define NVME_MAX_ASYNC_QUEUE_SIZE  4096                 // Number of asynchronous I/O queue entries, which is 1-based
+
+#define NVME_MAX_QUEUES  (NVME_ASYNC_QUEUE_ID + NVME_MAX_ASYNC_QUEUES) // Number of queues supported by the driver
+
+//
+// Number of pages of the submission and of the completion queue of an
+// asynchronous I/O queue pair, from its 0-based size.
+//
+#define NVME_ASYNC_SQ_PAGES(Size)  EFI_SIZE_TO_PAGES (((UINTN)(Size) + 1) * sizeof (NVME_SQ))
+#define NVME_ASYNC_CQ_PAGES(Size)  EFI_SIZE_TO_PAGES (((UINTN)(Size) + 1) * sizeof (NVME_CQ))
+
 //
-// Number of asynchronous I/O completion queue entries, which is 0-based.
-// The asynchronous I/O completion queue size is 4kB in total.
+// Number of pre-mapped pages kept for the PRP lists of commands. One PRP list
+// page describes up to 2MB of data, so the pool covers a full asynchronous
+// submission queue of such transfers.
 //
-#define NVME_ASYNC_CCQ_SIZE  255
+#define NVME_PRP_LIST_POOL_PAGES  64
 
-#define NVME_MAX_QUEUES  3                              // Number of queues supported by the driver
+//
+// The host memory buffer is given to the controller in chunks of 2MB or more,
+// which the IOMMU can map with one large page each. One page holds the list
+// that describes the chunks.
+//
+#define NVME_HMB_CHUNK_SIZE       SIZE_2MB
+#define NVME_HMB_MAX_DESCRIPTORS  (EFI_PAGE_SIZE / sizeof (NVME_HMB_DESCRIPTOR))
 
 //
 // FormatNVM Admin Command LBA Format (LBAF) Mask
@@ -116,6 +138,16 @@ extern EFI_DRIVER_SUPPORTED_EFI_VERSION_PROTOCOL  gNvmExpressDriverSupportedEfiV
 //
 #define NVME_HC_ASYNC_TIMER  EFI_TIMER_PERIOD_MILLISECONDS (1)
 
+//
+// A chunk of the host memory buffer.
+//
+typedef struct {
+  VOID      *Buffer;
+  UINTN     Pages;
+  UINT64    PciAddr;
+  VOID      *Mapping;
+} NVME_HMB_CHUNK;
+
 //
 // Unique signature for private data structure.
 //
@@ -145,16 +177,27 @@ struct _NVME_CONTROLLER_PRIVATE_DATA {
   NVME_ADMIN_CONTROLLER_DATA            *ControllerData;
 
   //
-  // 6 x 4kB aligned buffers will be carved out of this buffer.
+  // The queues are carved out of this buffer, mapped once as a common buffer.
   // 1st 4kB boundary is the start of the admin submission queue.
   // 2nd 4kB boundary is the start of the admin completion queue.
   // 3rd 4kB boundary is the start of I/O submission queue #1.
   // 4th 4kB boundary is the start of I/O completion queue #1.
-  // 5th 4kB boundary is the start of I/O submission queue #2.
-  // 6th 4kB boundary is the start of I/O completion queue #2.
+  // Then, for each asynchronous I/O queue pair, its submission queue and its
+  // completion queue start at the next 4kB boundaries.
   //
   UINT8          *Buffer;
   UINT8          *BufferPciAddr;
+  UINTN          BufferPages;
+
+  //
+  // The asynchronous I/O queue pairs that the buffer has room for, and the
+  // ones in use with the controller. The queue sizes are 0-based.
+  //
+  UINT16         MaxAsyncQueues;
+  UINT16         MaxAsyncQueueSize;
+  UINT16         AsyncQueues;
+  UINT16         AsyncQueueSize;
+  UINT16         NextAsyncQueue;
 
   //
   // Pointers to 4kB aligned submission & completion queues.
@@ -169,7 +212,7 @@ struct _NVME_CONTROLLER_PRIVATE_DATA {
   //
   NVME_SQTDBL    SqTdbl[NVME_MAX_QUEUES];
   NVME_CQHDBL    CqHdbl[NVME_MAX_QUEUES];
-  UINT16         AsyncSqHead;
+  UINT16         AsyncSqHead[NVME_MAX_QUEUES];
 
   //
   // Flag to indicate internal IO queue creation.
@@ -186,6 +229,35 @@ struct _NVME_CONTROLLER_PRIVATE_DATA {
 
   VOID           *Mapping;
 
+  //
+  // Pool of pre-mapped PRP list pages. A set bit in PrpListPoolFree marks
+  // a free page.
+  //
+  UINT8          *PrpListPool;
+  UINT64         PrpListPoolPciAddr;
+  VOID           *PrpListPoolMapping;
+  UINT64         PrpListPoolFree;
+
+  //
+  // The IOMMU batch protocol, if the platform has one, and whether the
+  // controller does 64-bit DMA.
+  //
+  EDKII_IOMMU_BATCH_PROTOCOL    *IoMmuBatch;
+  BOOLEAN                       DualAddressCycle;
+
+  //
+  // The host memory buffer, kept across controller resets, and the list that
+  // describes its chunks to the controller.
+  //
+  NVME_HMB_CHUNK                *HmbChunks;
+  UINT32                        HmbChunkCount;
+  UINT32                        HmbPages;
+  NVME_HMB_DESCRIPTOR           *HmbList;
+  UINT64                        HmbListPciAddr;
+  VOID                          *HmbListMapping;
+  BOOLEAN                       HmbEnabled;
+  EFI_EVENT                     HmbExitBootServicesEvent;
+
   //
   // For Non-blocking operations.
   //
@@ -319,6 +391,27 @@ typedef struct {
 #define NVME_BLKIO2_SUBTASK_FROM_LINK(a) \
   CR (a, NVME_BLKIO2_SUBTASK, Link, NVME_BLKIO2_SUBTASK_SIGNATURE)
 
+//
+// The DMA resources of a passthru command, released when it completes.
+//
+typedef struct {
+  VOID                       *MapPrpList;
+  UINTN                      PrpListNo;
+  VOID                       *PrpListHost;
+  //
+  // The pages taken from the controller's PRP list pool, if any.
+  //
+  UINT64                     PrpListPoolPages;
+  VOID                       *MapData;
+  VOID                       *MapMeta;
+  //
+  // The data and metadata buffers, if they were mapped through the IOMMU
+  // batch protocol instead.
+  //
+  UINTN                      BatchEntryNo;
+  EDKII_IOMMU_BATCH_ENTRY    BatchEntries[2];
+} NVME_PASS_THRU_DMA;
+
 //
 // Nvme asynchronous passthru request.
 //
@@ -329,12 +422,9 @@ typedef struct {
   LIST_ENTRY                                  Link;
 
   EFI_NVM_EXPRESS_PASS_THRU_COMMAND_PACKET    *Packet;
+  UINT16                                      QueueId;
   UINT16                                      CommandId;
-  VOID                                        *MapPrpList;
-  UINTN                                       PrpListNo;
-  VOID                                        *PrpListHost;
-  VOID                                        *MapData;
-  VOID                                        *MapMeta;
+  NVME_PASS_THRU_DMA                          Dma;
   EFI_EVENT                                   CallerEvent;
 } NVME_PASS_THRU_ASYNC_REQ;
 
@@ -637,6 +727,21 @@ NvmExpressPassThru (
   IN     EFI_EVENT                                 Event OPTIONAL
   );
 
+/**
+  Release the DMA resources of a passthru command: unmap its buffers, and
+  return or free its PRP lists.
+
+  @param[in]     Private        The pointer to the NVME_CONTROLLER_PRIVATE_DATA
+                                data structure.
+  @param[in,out] Dma            The DMA resources of the command.
+
+**/
+VOID
+NvmeReleasePassThruDma (
+  IN     NVME_CONTROLLER_PRIVATE_DATA  *Private,
+  IN OUT NVME_PASS_THRU_DMA            *Dma
+  );
+
 /**
   Used to retrieve the next namespace ID for this NVM Express controller.
 
@@ -564,6 +564,73 @@ NvmeIdentifyNamespace (
   return Status;
 }
 
+/**
+  Ask the controller for the I/O queue pairs that the driver uses, and fit the
+  asynchronous I/O queue pairs to the ones the controller allocates.
+
+  The controller allocates the number of queues once after each reset. If it
+  doesn't report them, a single asynchronous I/O queue pair is used.
+
+  @param  Private          The pointer to the NVME_CONTROLLER_PRIVATE_DATA data structure.
+
+  @return EFI_SUCCESS      Successfully set the number of queues.
+  @return EFI_DEVICE_ERROR Fail to set the number of queues.
+
+**/
+EFI_STATUS
+NvmeSetNumberOfQueues (
+  IN NVME_CONTROLLER_PRIVATE_DATA  *Private
+  )
+{
+  EFI_NVM_EXPRESS_PASS_THRU_COMMAND_PACKET  CommandPacket;
+  EFI_NVM_EXPRESS_COMMAND                   Command;
+  EFI_NVM_EXPRESS_COMPLETION                Completion;
+  NVME_ADMIN_SET_FEATURES                   SetFeatures;
+  EFI_STATUS                                Status;
+  UINT32                                    Allocated;
+
+  ZeroMem (&CommandPacket, sizeof (EFI_NVM_EXPRESS_PASS_THRU_COMMAND_PACKET));
+  ZeroMem (&Command, sizeof (EFI_NVM_EXPRESS_COMMAND));
+  ZeroMem (&Completion, sizeof (EFI_NVM_EXPRESS_COMPLETION));
+  ZeroMem (&SetFeatures, sizeof (NVME_ADMIN_SET_FEATURES));
+
+  CommandPacket.NvmeCmd        = &Command;
+  CommandPacket.NvmeCompletion = &Completion;
+  CommandPacket.CommandTimeout = NVME_GENERIC_TIMEOUT;
+  CommandPacket.QueueType      = NVME_ADMIN_QUEUE;
+
+  Command.Cdw0.Opcode = NVME_ADMIN_SET_FEATURES_CMD;
+  SetFeatures.Fid     = NUMBER_OF_QUEUES_FID;
+  CopyMem (&Command.Cdw10, &SetFeatures, sizeof (NVME_ADMIN_SET_FEATURES));
+
+  //
+  // The numbers of submission and completion queues requested are 0-based,
+  // and exclude the admin queues.
+  //
+  Command.Cdw11 = ((UINT32)Private->MaxAsyncQueues << 16) | Private->MaxAsyncQueues;
+  Command.Flags = CDW10_VALID | CDW11_VALID;
+
+  Private->AsyncQueues = 1;
+  Status               = Private->Passthru.PassThru (
+                                             &Private->Passthru,
+                                             0,
+                                             &CommandPacket,
+                                             NULL
+                                             );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  //
+  // The numbers allocated are 0-based too, which leaves out the blocking I/O
+  // queue pair.
+  //
+  Allocated            = MIN (Completion.DW0 & MAX_UINT16, Completion.DW0 >> 16);
+  Private->AsyncQueues = (UINT16)MAX (MIN (Allocated, Private->MaxAsyncQueues), 1);
+
+  return EFI_SUCCESS;
+}
+
 /**
   Create io completion queue.
 
@@ -589,7 +656,7 @@ NvmeCreateIoCompletionQueue (
   Status                 = EFI_SUCCESS;
   Private->CreateIoQueue = TRUE;
 
-  for (Index = 1; Index < NVME_MAX_QUEUES; Index++) {
+  for (Index = 1; Index < NVME_ASYNC_QUEUE_ID + Private->AsyncQueues; Index++) {
     ZeroMem (&CommandPacket, sizeof (EFI_NVM_EXPRESS_PASS_THRU_COMMAND_PACKET));
     ZeroMem (&Command, sizeof (EFI_NVM_EXPRESS_COMMAND));
     ZeroMem (&Completion, sizeof (EFI_NVM_EXPRESS_COMPLETION));
@@ -607,11 +674,7 @@ NvmeCreateIoCompletionQueue (
     if (Index == 1) {
       QueueSize = NVME_CCQ_SIZE;
     } else {
-      if (Private->Cap.Mqes > NVME_ASYNC_CCQ_SIZE) {
-        QueueSize = NVME_ASYNC_CCQ_SIZE;
-      } else {
-        QueueSize = Private->Cap.Mqes;
-      }
+      QueueSize = Private->AsyncQueueSize;
     }
 
     CrIoCq.Qid   = Index;
@@ -661,7 +724,7 @@ NvmeCreateIoSubmissionQueue (
   Status                 = EFI_SUCCESS;
   Private->CreateIoQueue = TRUE;
 
-  for (Index = 1; Index < NVME_MAX_QUEUES; Index++) {
+  for (Index = 1; Index < NVME_ASYNC_QUEUE_ID + Private->AsyncQueues; Index++) {
     ZeroMem (&CommandPacket, sizeof (EFI_NVM_EXPRESS_PASS_THRU_COMMAND_PACKET));
     ZeroMem (&Command, sizeof (EFI_NVM_EXPRESS_COMMAND));
     ZeroMem (&Completion, sizeof (EFI_NVM_EXPRESS_COMPLETION));
@@ -679,11 +742,7 @@ NvmeCreateIoSubmissionQueue (
     if (Index == 1) {
       QueueSize = NVME_CSQ_SIZE;
     } else {
-      if (Private->Cap.Mqes > NVME_ASYNC_CSQ_SIZE) {
-        QueueSize = NVME_ASYNC_CSQ_SIZE;
-      } else {
-        QueueSize = Private->Cap.Mqes;
-      }
+      QueueSize = Private->AsyncQueueSize;
     }
 
     CrIoSq.Qid   = Index;
@@ -710,6 +769,372 @@ NvmeCreateIoSubmissionQueue (
   return Status;
 }
 
+/**
+  Give the host memory buffer to the controller, or take it back.
+
+  @param  Private          The pointer to the NVME_CONTROLLER_PRIVATE_DATA data structure.
+  @param  Enable           TRUE to give the buffer to the controller, FALSE to take it back.
+  @param  Returned         TRUE if the buffer is given back to the controller unchanged,
+                           after a reset of the controller.
+
+  @return EFI_SUCCESS      Successfully set the host memory buffer feature.
+  @return EFI_DEVICE_ERROR Fail to set the host memory buffer feature.
+
+**/
+EFI_STATUS
+NvmeSetHostMemoryBuffer (
+  IN NVME_CONTROLLER_PRIVATE_DATA  *Private,
+  IN BOOLEAN                       Enable,
+  IN BOOLEAN                       Returned
+  )
+{
+  EFI_NVM_EXPRESS_PASS_THRU_COMMAND_PACKET  CommandPacket;
+  EFI_NVM_EXPRESS_COMMAND                   Command;
+  EFI_NVM_EXPRESS_COMPLETION                Completion;
+  NVME_ADMIN_SET_FEATURES                   SetFeatures;
+  EFI_STATUS                                Status;
+
+  ZeroMem (&CommandPacket, sizeof (EFI_NVM_EXPRESS_PASS_THRU_COMMAND_PACKET));
+  ZeroMem (&Command, sizeof (EFI_NVM_EXPRESS_COMMAND));
+  ZeroMem (&Completion, sizeof (EFI_NVM_EXPRESS_COMPLETION));
+  ZeroMem (&SetFeatures, sizeof (NVME_ADMIN_SET_FEATURES));
+
+  CommandPacket.NvmeCmd        = &Command;
+  CommandPacket.NvmeCompletion = &Completion;
+  CommandPacket.CommandTimeout = NVME_GENERIC_TIMEOUT;
+  CommandPacket.QueueType      = NVME_ADMIN_QUEUE;
+
+  Command.Cdw0.Opcode = NVME_ADMIN_SET_FEATURES_CMD;
+  SetFeatures.Fid     = HOST_MEMORY_BUFFER_FID;
+  CopyMem (&Command.Cdw10, &SetFeatures, sizeof (NVME_ADMIN_SET_FEATURES));
+  Command.Flags = CDW10_VALID | CDW11_VALID;
+
+  if (Enable) {
+    //
+    // The sizes are in units of the memory page size, which the driver sets to 4KB.
+    //
+    Command.Cdw11 = NVME_HMB_EHM;
+    if (Returned) {
+      Command.Cdw11 |= NVME_HMB_MR;
+    }
+
+    Command.Cdw12  = Private->HmbPages;
+    Command.Cdw13  = (UINT32)Private->HmbListPciAddr;
+    Command.Cdw14  = (UINT32)RShiftU64 (Private->HmbListPciAddr, 32);
+    Command.Cdw15  = Private->HmbChunkCount;
+    Command.Flags |= CDW12_VALID | CDW13_VALID | CDW14_VALID | CDW15_VALID;
+  }
+
+  Status = Private->Passthru.PassThru (
+                               &Private->Passthru,
+                               0,
+                               &CommandPacket,
+                               NULL
+                               );
+  if (!EFI_ERROR (Status)) {
+    Private->HmbEnabled = Enable;
+  }
+
+  return Status;
+}
+
+/**
+  Take the host memory buffer back from the controller when boot services end,
+  since the OS reclaims the memory of the buffer.
+
+  @param  Event            The exit boot services event.
+  @param  Context          The pointer to the NVME_CONTROLLER_PRIVATE_DATA data structure.
+
+**/
+VOID
+EFIAPI
+NvmeHostMemoryBufferExitBootServices (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  NVME_CONTROLLER_PRIVATE_DATA  *Private;
+
+  Private = (NVME_CONTROLLER_PRIVATE_DATA *)Context;
+
+  //
+  // A reset of the controller disables its host memory buffer, without
+  // depending on the state of the queues.
+  //
+  if (Private->HmbEnabled) {
+    NvmeDisableController (Private);
+    Private->HmbEnabled = FALSE;
+  }
+}
+
+/**
+  Allocate the host memory buffer of the controller, and the list that describes it.
+
+  The buffer is the preferred size of the controller, up to PcdNvmeHostMemoryBufferMaxSize,
+  in chunks of NVME_HMB_CHUNK_SIZE bytes or more. The IOMMU places buffers of this size
+  at large page boundaries, so that each chunk is mapped once as a common buffer with
+  large pages.
+
+  @param  Private               The pointer to the NVME_CONTROLLER_PRIVATE_DATA data structure.
+
+  @return EFI_SUCCESS           Successfully allocated the host memory buffer.
+  @return EFI_UNSUPPORTED       The controller doesn't use a host memory buffer, or
+                                needs a larger one than the platform allows.
+  @return EFI_OUT_OF_RESOURCES  Fail to allocate the minimum size of the controller.
+
+**/
+EFI_STATUS
+NvmeAllocateHostMemoryBuffer (
+  IN NVME_CONTROLLER_PRIVATE_DATA  *Private
+  )
+{
+  EFI_PCI_IO_PROTOCOL         *PciIo;
+  NVME_ADMIN_CONTROLLER_DATA  *ControllerData;
+  NVME_HMB_CHUNK              *Chunk;
+  UINTN                       Pages;
+  UINTN                       ChunkPages;
+  UINTN                       MaxChunks;
+  UINTN                       Index;
+  UINTN                       Bytes;
+  EFI_STATUS                  Status;
+
+  PciIo          = Private->PciIo;
+  ControllerData = Private->ControllerData;
+
+  //
+  // A chunk is no smaller than the minimum descriptor size of the controller,
+  // and stays a multiple of the large page size.
+  //
+  ChunkPages = EFI_SIZE_TO_PAGES (NVME_HMB_CHUNK_SIZE);
+  if (ControllerData->Hmminds > ChunkPages) {
+    ChunkPages = ALIGN_VALUE (ControllerData->Hmminds, ChunkPages);
+  }
+
+  MaxChunks = NVME_HMB_MAX_DESCRIPTORS;
+  if ((ControllerData->Hmmaxd != 0) && (ControllerData->Hmmaxd < MaxChunks)) {
+    MaxChunks = ControllerData->Hmmaxd;
+  }
+
+  Pages = MIN (ControllerData->Hmpre, EFI_SIZE_TO_PAGES (PcdGet32 (PcdNvmeHostMemoryBufferMaxSize)));
+  Pages = MIN (Pages, MaxChunks * ChunkPages);
+  if ((Pages == 0) || (Pages < ControllerData->Hmmin)) {
+    return EFI_UNSUPPORTED;
+  }
+
+  Private->HmbChunks = AllocateZeroPool (MaxChunks * sizeof (NVME_HMB_CHUNK));
+  if (Private->HmbChunks == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Status = PciIo->AllocateBuffer (
+                    PciIo,
+                    AllocateAnyPages,
+                    EfiBootServicesData,
+                    1,
+                    (VOID **)&Private->HmbList,
+                    0
+                    );
+  if (EFI_ERROR (Status)) {
+    Private->HmbList = NULL;
+    NvmeFreeHostMemoryBuffer (Private);
+    return Status;
+  }
+
+  Bytes  = EFI_PAGE_SIZE;
+  Status = PciIo->Map (
+                    PciIo,
+                    EfiPciIoOperationBusMasterCommonBuffer,
+                    Private->HmbList,
+                    &Bytes,
+                    &Private->HmbListPciAddr,
+                    &Private->HmbListMapping
+                    );
+  if (EFI_ERROR (Status) || (Bytes != EFI_PAGE_SIZE)) {
+    if (EFI_ERROR (Status)) {
+      Private->HmbListMapping = NULL;
+    }
+
+    NvmeFreeHostMemoryBuffer (Private);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  ZeroMem (Private->HmbList, EFI_PAGE_SIZE);
+
+  //
+  // Allocate the chunks until the buffer is complete, or memory runs out. The
+  // last chunk holds the remainder.
+  //
+  for (Index = 0; Private->HmbPages < Pages; Index++) {
+    Chunk        = &Private->HmbChunks[Index];
+    Chunk->Pages = MIN (ChunkPages, Pages - Private->HmbPages);
+    Chunk->Pages = MAX (Chunk->Pages, ControllerData->Hmminds);
+
+    Status = PciIo->AllocateBuffer (
+                      PciIo,
+                      AllocateAnyPages,
+                      EfiBootServicesData,
+                      Chunk->Pages,
+                      &Chunk->Buffer,
+                      0
+                      );
+    if (EFI_ERROR (Status)) {
+      Chunk->Buffer = NULL;
+      break;
+    }
+
+    Bytes  = EFI_PAGES_TO_SIZE (Chunk->Pages);
+    Status = PciIo->Map (
+                      PciIo,
+                      EfiPciIoOperationBusMasterCommonBuffer,
+                      Chunk->Buffer,
+                      &Bytes,
+                      &Chunk->PciAddr,
+                      &Chunk->Mapping
+                      );
+    if (EFI_ERROR (Status) || (Bytes != EFI_PAGES_TO_SIZE (Chunk->Pages))) {
+      if (!EFI_ERROR (Status)) {
+        PciIo->Unmap (PciIo, Chunk->Mapping);
+      }
+
+      PciIo->FreeBuffer (PciIo, Chunk->Pages, Chunk->Buffer);
+      Chunk->Buffer  = NULL;
+      Chunk->Mapping = NULL;
+      break;
+    }
+
+    Private->HmbList[Index].Badd  = Chunk->PciAddr;
+    Private->HmbList[Index].Bsize = (UINT32)Chunk->Pages;
+    Private->HmbChunkCount++;
+    Private->HmbPages += (UINT32)Chunk->Pages;
+  }
+
+  if ((Private->HmbPages == 0) || (Private->HmbPages < ControllerData->Hmmin)) {
+    NvmeFreeHostMemoryBuffer (Private);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Status = gBS->CreateEvent (
+                  EVT_SIGNAL_EXIT_BOOT_SERVICES,
+                  TPL_NOTIFY,
+                  NvmeHostMemoryBufferExitBootServices,
+                  Private,
+                  &Private->HmbExitBootServicesEvent
+                  );
+  if (EFI_ERROR (Status)) {
+    Private->HmbExitBootServicesEvent = NULL;
+    NvmeFreeHostMemoryBuffer (Private);
+    return Status;
+  }
+
+  DEBUG ((
+    DEBUG_INFO,
+    "NvmeAllocateHostMemoryBuffer: %d pages in %d chunks (preferred %d, minimum %d)\n",
+    Private->HmbPages,
+    Private->HmbChunkCount,
+    ControllerData->Hmpre,
+    ControllerData->Hmmin
+    ));
+  return EFI_SUCCESS;
+}
+
+/**
+  Give the controller a host memory buffer, if it uses one.
+
+  The buffer is allocated on the first call, and kept across resets of the
+  controller, which disable it. Later calls give it back unchanged.
+
+  @param  Private          The pointer to the NVME_CONTROLLER_PRIVATE_DATA data structure.
+
+  @return EFI_SUCCESS      The controller uses the host memory buffer.
+  @return Others           The controller runs without a host memory buffer.
+
+**/
+EFI_STATUS
+NvmeEnableHostMemoryBuffer (
+  IN NVME_CONTROLLER_PRIVATE_DATA  *Private
+  )
+{
+  EFI_STATUS  Status;
+  BOOLEAN     Returned;
+
+  Returned = (Private->HmbChunks != NULL);
+  if (!Returned) {
+    Status = NvmeAllocateHostMemoryBuffer (Private);
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+  }
+
+  Status = NvmeSetHostMemoryBuffer (Private, TRUE, Returned);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_WARN, "NvmeEnableHostMemoryBuffer: failed to enable the host memory buffer (%r)\n", Status));
+    NvmeFreeHostMemoryBuffer (Private);
+  }
+
+  return Status;
+}
+
+/**
+  Take the host memory buffer back from the controller, and free it.
+
+  @param[in] Private                 The pointer to the NVME_CONTROLLER_PRIVATE_DATA data structure.
+
+**/
+VOID
+NvmeFreeHostMemoryBuffer (
+  IN NVME_CONTROLLER_PRIVATE_DATA  *Private
+  )
+{
+  EFI_PCI_IO_PROTOCOL  *PciIo;
+  EFI_STATUS           Status;
+  UINTN                Index;
+
+  if ((Private->HmbChunks == NULL) && (Private->HmbList == NULL)) {
+    return;
+  }
+
+  //
+  // The controller may write the buffer until it gives it back. If it can't be
+  // asked to, a reset of the controller takes the buffer back.
+  //
+  if (Private->HmbEnabled) {
+    Status = NvmeSetHostMemoryBuffer (Private, FALSE, FALSE);
+    if (EFI_ERROR (Status)) {
+      NvmeDisableController (Private);
+      Private->HmbEnabled = FALSE;
+    }
+  }
+
+  if (Private->HmbExitBootServicesEvent != NULL) {
+    gBS->CloseEvent (Private->HmbExitBootServicesEvent);
+    Private->HmbExitBootServicesEvent = NULL;
+  }
+
+  PciIo = Private->PciIo;
+  if (Private->HmbChunks != NULL) {
+    for (Index = 0; Index < Private->HmbChunkCount; Index++) {
+      PciIo->Unmap (PciIo, Private->HmbChunks[Index].Mapping);
+      PciIo->FreeBuffer (PciIo, Private->HmbChunks[Index].Pages, Private->HmbChunks[Index].Buffer);
+    }
+
+    FreePool (Private->HmbChunks);
+    Private->HmbChunks = NULL;
+  }
+
+  if (Private->HmbListMapping != NULL) {
+    PciIo->Unmap (PciIo, Private->HmbListMapping);
+    Private->HmbListMapping = NULL;
+  }
+
+  if (Private->HmbList != NULL) {
+    PciIo->FreeBuffer (PciIo, 1, Private->HmbList);
+    Private->HmbList = NULL;
+  }
+
+  Private->HmbChunkCount = 0;
+  Private->HmbPages      = 0;
+}
+
 /**
   Initialize the Nvm Express controller.
 
@@ -732,6 +1157,8 @@ NvmeControllerInit (
   NVME_ACQ             Acq;
   UINT8                Sn[21];
   UINT8                Mn[41];
+  UINTN                Offset;
+  UINT16               Index;
 
   //
   // Enable this controller.
@@ -777,19 +1204,18 @@ NvmeControllerInit (
   //
   ASSERT ((Private->Cap.Mpsmin + 12) <= EFI_PAGE_SHIFT);
 
-  Private->Cid[0]        = 0;
-  Private->Cid[1]        = 0;
-  Private->Cid[2]        = 0;
-  Private->Pt[0]         = 0;
-  Private->Pt[1]         = 0;
-  Private->Pt[2]         = 0;
-  Private->SqTdbl[0].Sqt = 0;
-  Private->SqTdbl[1].Sqt = 0;
-  Private->SqTdbl[2].Sqt = 0;
-  Private->CqHdbl[0].Cqh = 0;
-  Private->CqHdbl[1].Cqh = 0;
-  Private->CqHdbl[2].Cqh = 0;
-  Private->AsyncSqHead   = 0;
+  ZeroMem (Private->Cid, sizeof (Private->Cid));
+  ZeroMem (Private->Pt, sizeof (Private->Pt));
+  ZeroMem (Private->SqTdbl, sizeof (Private->SqTdbl));
+  ZeroMem (Private->CqHdbl, sizeof (Private->CqHdbl));
+  ZeroMem (Private->AsyncSqHead, sizeof (Private->AsyncSqHead));
+  Private->NextAsyncQueue = 0;
+
+  //
+  // The asynchronous I/O queues are as deep as the platform asks, up to the
+  // maximum queue entries of the controller, which are 0-based.
+  //
+  Private->AsyncQueueSize = MIN (Private->MaxAsyncQueueSize, Private->Cap.Mqes);
 
   Status = NvmeDisableController (Private);
 
@@ -797,6 +1223,11 @@ NvmeControllerInit (
     return Status;
   }
 
+  //
+  // The reset also disabled the host memory buffer, if the controller had one.
+  //
+  Private->HmbEnabled = FALSE;
+
   //
   // set number of entries admin submission & completion queues.
   //
@@ -818,7 +1249,7 @@ NvmeControllerInit (
   //
   // Address of I/O submission & completion queue.
   //
-  ZeroMem (Private->Buffer, EFI_PAGES_TO_SIZE (6));
+  ZeroMem (Private->Buffer, EFI_PAGES_TO_SIZE (Private->BufferPages));
   Private->SqBuffer[0]        = (NVME_SQ *)(UINTN)(Private->Buffer);
   Private->SqBufferPciAddr[0] = (NVME_SQ *)(UINTN)(Private->BufferPciAddr);
   Private->CqBuffer[0]        = (NVME_CQ *)(UINTN)(Private->Buffer + 1 * EFI_PAGE_SIZE);
@@ -827,10 +1258,16 @@ NvmeControllerInit (
   Private->SqBufferPciAddr[1] = (NVME_SQ *)(UINTN)(Private->BufferPciAddr + 2 * EFI_PAGE_SIZE);
   Private->CqBuffer[1]        = (NVME_CQ *)(UINTN)(Private->Buffer + 3 * EFI_PAGE_SIZE);
   Private->CqBufferPciAddr[1] = (NVME_CQ *)(UINTN)(Private->BufferPciAddr + 3 * EFI_PAGE_SIZE);
-  Private->SqBuffer[2]        = (NVME_SQ *)(UINTN)(Private->Buffer + 4 * EFI_PAGE_SIZE);
-  Private->SqBufferPciAddr[2] = (NVME_SQ *)(UINTN)(Private->BufferPciAddr + 4 * EFI_PAGE_SIZE);
-  Private->CqBuffer[2]        = (NVME_CQ *)(UINTN)(Private->Buffer + 5 * EFI_PAGE_SIZE);
-  Private->CqBufferPciAddr[2] = (NVME_CQ *)(UINTN)(Private->BufferPciAddr + 5 * EFI_PAGE_SIZE);
+
+  Offset = 4 * EFI_PAGE_SIZE;
+  for (Index = NVME_ASYNC_QUEUE_ID; Index < NVME_ASYNC_QUEUE_ID + Private->MaxAsyncQueues; Index++) {
+    Private->SqBuffer[Index]        = (NVME_SQ *)(UINTN)(Private->Buffer + Offset);
+    Private->SqBufferPciAddr[Index] = (NVME_SQ *)(UINTN)(Private->BufferPciAddr + Offset);
+    Offset                         += EFI_PAGES_TO_SIZE (NVME_ASYNC_SQ_PAGES (Private->MaxAsyncQueueSize));
+    Private->CqBuffer[Index]        = (NVME_CQ *)(UINTN)(Private->Buffer + Offset);
+    Private->CqBufferPciAddr[Index] = (NVME_CQ *)(UINTN)(Private->BufferPciAddr + Offset);
+    Offset                         += EFI_PAGES_TO_SIZE (NVME_ASYNC_CQ_PAGES (Private->MaxAsyncQueueSize));
+  }
 
   DEBUG ((DEBUG_INFO, "Private->Buffer = [%016X]\n", (UINT64)(UINTN)Private->Buffer));
   DEBUG ((DEBUG_INFO, "Admin     Submission Queue size (Aqa.Asqs) = [%08X]\n", Aqa.Asqs));
@@ -839,8 +1276,7 @@ NvmeControllerInit (
   DEBUG ((DEBUG_INFO, "Admin     Completion Queue (CqBuffer[0]) = [%016X]\n", Private->CqBuffer[0]));
   DEBUG ((DEBUG_INFO, "Sync  I/O Submission Queue (SqBuffer[1]) = [%016X]\n", Private->SqBuffer[1]));
   DEBUG ((DEBUG_INFO, "Sync  I/O Completion Queue (CqBuffer[1]) = [%016X]\n", Private->CqBuffer[1]));
-  DEBUG ((DEBUG_INFO, "Async I/O Submission Queue (SqBuffer[2]) = [%016X]\n", Private->SqBuffer[2]));
-  DEBUG ((DEBUG_INFO, "Async I/O Completion Queue (CqBuffer[2]) = [%016X]\n", Private->CqBuffer[2]));
+  DEBUG ((DEBUG_INFO, "Async I/O Queue size = [%08X]\n", Private->AsyncQueueSize));
 
   //
   // Program admin queue attributes.
@@ -919,8 +1355,19 @@ NvmeControllerInit (
   DEBUG ((DEBUG_INFO, "    NN        : 0x%x\n", Private->ControllerData->Nn));
 
   //
-  // Create two I/O completion queues.
-  // One for blocking I/O, one for non-blocking I/O.
+  // Ask for the queue pairs before creating them. A controller that doesn't
+  // take the request gets a single asynchronous I/O queue pair.
+  //
+  Status = NvmeSetNumberOfQueues (Private);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_WARN, "NvmeControllerInit: failed to set the number of queues (%r)\n", Status));
+  }
+
+  DEBUG ((DEBUG_INFO, "Async I/O Queue pairs = [%d]\n", Private->AsyncQueues));
+
+  //
+  // Create the I/O completion queues.
+  // One for blocking I/O, the others for non-blocking I/O.
   //
   Status = NvmeCreateIoCompletionQueue (Private);
   if (EFI_ERROR (Status)) {
@@ -928,12 +1375,20 @@ NvmeControllerInit (
   }
 
   //
-  // Create two I/O Submission queues.
-  // One for blocking I/O, one for non-blocking I/O.
+  // Create the I/O Submission queues.
+  // One for blocking I/O, the others for non-blocking I/O.
   //
   Status = NvmeCreateIoSubmissionQueue (Private);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
 
-  return Status;
+  //
+  // The host memory buffer only speeds the controller up, which works without it.
+  //
+  NvmeEnableHostMemoryBuffer (Private);
+
+  return EFI_SUCCESS;
 }
 
 /**
@@ -195,39 +195,92 @@ NvmeDumpStatus (
   }
 }
 
+/**
+  Take a run of pages from the controller's pool of pre-mapped PRP list pages.
+
+  @param[in]     Private             The pointer to the NVME_CONTROLLER_PRIVATE_DATA data structure.
+  @param[in]     PrpListNo           The number of pages to take.
+  @param[out]    PrpListHost         The host address of the first page.
+  @param[out]    PrpListPhyAddr      The device address of the first page.
+
+  @return The bitmap of the pages taken, or 0 if no run of free pages is long enough.
+
+**/
+UINT64
+NvmeTakePoolPrpList (
+  IN     NVME_CONTROLLER_PRIVATE_DATA  *Private,
+  IN     UINTN                         PrpListNo,
+  OUT    UINT8                         **PrpListHost,
+  OUT    EFI_PHYSICAL_ADDRESS          *PrpListPhyAddr
+  )
+{
+  UINT64   Run;
+  UINT64   Pages;
+  UINTN    Index;
+  EFI_TPL  OldTpl;
+
+  if ((Private->PrpListPool == NULL) || (PrpListNo >= NVME_PRP_LIST_POOL_PAGES)) {
+    return 0;
+  }
+
+  Run    = LShiftU64 (1, PrpListNo) - 1;
+  Pages  = 0;
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  for (Index = 0; Index + PrpListNo <= NVME_PRP_LIST_POOL_PAGES; Index++) {
+    if ((Private->PrpListPoolFree & LShiftU64 (Run, Index)) == LShiftU64 (Run, Index)) {
+      Pages                     = LShiftU64 (Run, Index);
+      Private->PrpListPoolFree &= ~Pages;
+      break;
+    }
+  }
+
+  gBS->RestoreTPL (OldTpl);
+
+  if (Pages != 0) {
+    *PrpListHost    = Private->PrpListPool + EFI_PAGES_TO_SIZE (Index);
+    *PrpListPhyAddr = Private->PrpListPoolPciAddr + EFI_PAGES_TO_SIZE (Index);
+  }
+
+  return Pages;
+}
+
 /**
   Create PRP lists for data transfer which is larger than 2 memory pages.
   Note here we calcuate the number of required PRP lists and allocate them at one time.
 
-  @param[in]     PciIo               A pointer to the EFI_PCI_IO_PROTOCOL instance.
+  The lists are taken from the controller's pool of pre-mapped pages, so that a
+  command does not map them through the IOMMU. Only if the pool is exhausted are
+  they allocated and mapped for the command.
+
+  @param[in]     Private             The pointer to the NVME_CONTROLLER_PRIVATE_DATA data structure.
   @param[in]     PhysicalAddr        The physical base address of data buffer.
   @param[in]     Pages               The number of pages to be transfered.
-  @param[out]    PrpListHost         The host base address of PRP lists.
-  @param[in,out] PrpListNo           The number of PRP List.
-  @param[out]    Mapping             The mapping value returned from PciIo.Map().
+  @param[in,out] Dma                 The DMA resources of the command, which receive the PRP lists.
 
   @retval The pointer to the first PRP List of the PRP lists.
 
 **/
 VOID *
 NvmeCreatePrpList (
-  IN     EFI_PCI_IO_PROTOCOL   *PciIo,
-  IN     EFI_PHYSICAL_ADDRESS  PhysicalAddr,
-  IN     UINTN                 Pages,
-  OUT VOID                     **PrpListHost,
-  IN OUT UINTN                 *PrpListNo,
-  OUT VOID                     **Mapping
+  IN     NVME_CONTROLLER_PRIVATE_DATA  *Private,
+  IN     EFI_PHYSICAL_ADDRESS          PhysicalAddr,
+  IN     UINTN                         Pages,
+  IN OUT NVME_PASS_THRU_DMA            *Dma
   )
 {
+  EFI_PCI_IO_PROTOCOL   *PciIo;
   UINTN                 PrpEntryNo;
   UINT64                PrpListBase;
   UINTN                 PrpListIndex;
   UINTN                 PrpEntryIndex;
   UINT64                Remainder;
+  UINT8                 *PrpListHost;
   EFI_PHYSICAL_ADDRESS  PrpListPhyAddr;
   UINTN                 Bytes;
   EFI_STATUS            Status;
 
+  PciIo = Private->PciIo;
+
   //
   // The number of Prp Entry in a memory page.
   //
@@ -236,51 +289,56 @@ NvmeCreatePrpList (
   //
   // Calculate total PrpList number.
   //
-  *PrpListNo = (UINTN)DivU64x64Remainder ((UINT64)Pages, (UINT64)PrpEntryNo - 1, &Remainder);
-  if (*PrpListNo == 0) {
-    *PrpListNo = 1;
+  Dma->PrpListNo = (UINTN)DivU64x64Remainder ((UINT64)Pages, (UINT64)PrpEntryNo - 1, &Remainder);
+  if (Dma->PrpListNo == 0) {
+    Dma->PrpListNo = 1;
   } else if ((Remainder != 0) && (Remainder != 1)) {
-    *PrpListNo += 1;
+    Dma->PrpListNo += 1;
   } else if (Remainder == 1) {
     Remainder = PrpEntryNo;
   } else if (Remainder == 0) {
     Remainder = PrpEntryNo - 1;
   }
 
-  Status = PciIo->AllocateBuffer (
-                    PciIo,
-                    AllocateAnyPages,
-                    EfiBootServicesData,
-                    *PrpListNo,
-                    PrpListHost,
-                    0
-                    );
+  Bytes                 = EFI_PAGES_TO_SIZE (Dma->PrpListNo);
+  Dma->PrpListPoolPages = NvmeTakePoolPrpList (Private, Dma->PrpListNo, &PrpListHost, &PrpListPhyAddr);
+  if (Dma->PrpListPoolPages == 0) {
+    Status = PciIo->AllocateBuffer (
+                      PciIo,
+                      AllocateAnyPages,
+                      EfiBootServicesData,
+                      Dma->PrpListNo,
+                      &Dma->PrpListHost,
+                      0
+                      );
 
-  if (EFI_ERROR (Status)) {
-    return NULL;
-  }
+    if (EFI_ERROR (Status)) {
+      return NULL;
+    }
 
-  Bytes  = EFI_PAGES_TO_SIZE (*PrpListNo);
-  Status = PciIo->Map (
-                    PciIo,
-                    EfiPciIoOperationBusMasterCommonBuffer,
-                    *PrpListHost,
-                    &Bytes,
-                    &PrpListPhyAddr,
-                    Mapping
-                    );
+    Status = PciIo->Map (
+                      PciIo,
+                      EfiPciIoOperationBusMasterCommonBuffer,
+                      Dma->PrpListHost,
+                      &Bytes,
+                      &PrpListPhyAddr,
+                      &Dma->MapPrpList
+                      );
+
+    if (EFI_ERROR (Status) || (Bytes != EFI_PAGES_TO_SIZE (Dma->PrpListNo))) {
+      DEBUG ((DEBUG_ERROR, "NvmeCreatePrpList: create PrpList failure!\n"));
+      goto EXIT;
+    }
 
-  if (EFI_ERROR (Status) || (Bytes != EFI_PAGES_TO_SIZE (*PrpListNo))) {
-    DEBUG ((DEBUG_ERROR, "NvmeCreatePrpList: create PrpList failure!\n"));
-    goto EXIT;
+    PrpListHost = Dma->PrpListHost;
   }
 
   //
   // Fill all PRP lists except of last one.
   //
-  ZeroMem (*PrpListHost, Bytes);
-  for (PrpListIndex = 0; PrpListIndex < *PrpListNo - 1; ++PrpListIndex) {
-    PrpListBase = *(UINT64 *)PrpListHost + PrpListIndex * EFI_PAGE_SIZE;
+  ZeroMem (PrpListHost, Bytes);
+  for (PrpListIndex = 0; PrpListIndex < Dma->PrpListNo - 1; ++PrpListIndex) {
+    PrpListBase = (UINTN)PrpListHost + PrpListIndex * EFI_PAGE_SIZE;
 
     for (PrpEntryIndex = 0; PrpEntryIndex < PrpEntryNo; ++PrpEntryIndex) {
       if (PrpEntryIndex != PrpEntryNo - 1) {
@@ -301,7 +359,7 @@ NvmeCreatePrpList (
   //
   // Fill last PRP list.
   //
-  PrpListBase = *(UINT64 *)PrpListHost + PrpListIndex * EFI_PAGE_SIZE;
+  PrpListBase = (UINTN)PrpListHost + PrpListIndex * EFI_PAGE_SIZE;
   for (PrpEntryIndex = 0; PrpEntryIndex < Remainder; ++PrpEntryIndex) {
     *((UINT64 *)(UINTN)PrpListBase + PrpEntryIndex) = PhysicalAddr;
     PhysicalAddr                                   += EFI_PAGE_SIZE;
@@ -310,10 +368,170 @@ NvmeCreatePrpList (
   return (VOID *)(UINTN)PrpListPhyAddr;
 
 EXIT:
-  PciIo->FreeBuffer (PciIo, *PrpListNo, *PrpListHost);
+  if (Dma->MapPrpList != NULL) {
+    PciIo->Unmap (PciIo, Dma->MapPrpList);
+    Dma->MapPrpList = NULL;
+  }
+
+  PciIo->FreeBuffer (PciIo, Dma->PrpListNo, Dma->PrpListHost);
+  Dma->PrpListHost = NULL;
   return NULL;
 }
 
+/**
+  Map the data and metadata buffers of a command in one call to the IOMMU batch
+  protocol, so that the IOMMU updates its translations for both at once.
+
+  @param[in]     Private             The pointer to the NVME_CONTROLLER_PRIVATE_DATA data structure.
+  @param[in]     Packet              The NVM Express Command Packet.
+  @param[in]     Flag                The PCI I/O operation of the command.
+  @param[in,out] Sq                  The submission queue entry, which receives the device addresses.
+  @param[in,out] Dma                 The DMA resources of the command, which receive the mappings.
+
+  @retval EFI_SUCCESS                The buffers were mapped.
+  @retval EFI_UNSUPPORTED            The IOMMU does not translate the controller's DMA.
+  @retval EFI_OUT_OF_RESOURCES       The buffers could not be mapped in full.
+
+**/
+EFI_STATUS
+NvmeMapPassThruBuffers (
+  IN     NVME_CONTROLLER_PRIVATE_DATA              *Private,
+  IN     EFI_NVM_EXPRESS_PASS_THRU_COMMAND_PACKET  *Packet,
+  IN     EFI_PCI_IO_PROTOCOL_OPERATION             Flag,
+  IN OUT NVME_SQ                                   *Sq,
+  IN OUT NVME_PASS_THRU_DMA                        *Dma
+  )
+{
+  EDKII_IOMMU_BATCH_ENTRY  *Entries;
+  EDKII_IOMMU_OPERATION    Operation;
+  UINT64                   IoMmuAccess;
+  UINTN                    Lengths[2];
+  UINTN                    Count;
+  UINTN                    Index;
+  EFI_STATUS               Status;
+
+  Entries = Dma->BatchEntries;
+  Count   = 0;
+  if ((Packet->TransferLength != 0) && (Packet->TransferBuffer != NULL)) {
+    Entries[Count].HostAddress   = Packet->TransferBuffer;
+    Entries[Count].NumberOfBytes = Packet->TransferLength;
+    Lengths[Count]               = Packet->TransferLength;
+    Count++;
+  }
+
+  if ((Packet->MetadataLength != 0) && (Packet->MetadataBuffer != NULL)) {
+    Entries[Count].HostAddress   = Packet->MetadataBuffer;
+    Entries[Count].NumberOfBytes = Packet->MetadataLength;
+    Lengths[Count]               = Packet->MetadataLength;
+    Count++;
+  }
+
+  if (Count == 0) {
+    return EFI_SUCCESS;
+  }
+
+  //
+  // Pick the operation and access the PCI I/O protocol would pass to the IOMMU.
+  //
+  if (Flag == EfiPciIoOperationBusMasterRead) {
+    Operation   = Private->DualAddressCycle ? EdkiiIoMmuOperationBusMasterRead64 : EdkiiIoMmuOperationBusMasterRead;
+    IoMmuAccess = EDKII_IOMMU_ACCESS_READ;
+  } else {
+    Operation   = Private->DualAddressCycle ? EdkiiIoMmuOperationBusMasterWrite64 : EdkiiIoMmuOperationBusMasterWrite;
+    IoMmuAccess = EDKII_IOMMU_ACCESS_WRITE;
+  }
+
+  Status = Private->IoMmuBatch->MapMultiple (
+                                  Private->IoMmuBatch,
+                                  Private->ControllerHandle,
+                                  Operation,
+                                  IoMmuAccess,
+                                  Count,
+                                  Entries
+                                  );
+  if (EFI_ERROR (Status)) {
+    return (Status == EFI_UNSUPPORTED) ? EFI_UNSUPPORTED : EFI_OUT_OF_RESOURCES;
+  }
+
+  for (Index = 0; Index < Count; Index++) {
+    if (Entries[Index].NumberOfBytes != Lengths[Index]) {
+      Private->IoMmuBatch->UnmapMultiple (Private->IoMmuBatch, Private->ControllerHandle, Count, Entries);
+      return EFI_OUT_OF_RESOURCES;
+    }
+  }
+
+  Index = 0;
+  if ((Packet->TransferLength != 0) && (Packet->TransferBuffer != NULL)) {
+    Sq->Prp[0] = Entries[Index++].DeviceAddress;
+    Sq->Prp[1] = 0;
+  }
+
+  if (Index < Count) {
+    Sq->Mptr = Entries[Index].DeviceAddress;
+  }
+
+  Dma->BatchEntryNo = Count;
+  return EFI_SUCCESS;
+}
+
+/**
+  Release the DMA resources of a passthru command: unmap its buffers, and
+  return or free its PRP lists.
+
+  @param[in]     Private        The pointer to the NVME_CONTROLLER_PRIVATE_DATA
+                                data structure.
+  @param[in,out] Dma            The DMA resources of the command.
+
+**/
+VOID
+NvmeReleasePassThruDma (
+  IN     NVME_CONTROLLER_PRIVATE_DATA  *Private,
+  IN OUT NVME_PASS_THRU_DMA            *Dma
+  )
+{
+  EFI_PCI_IO_PROTOCOL  *PciIo;
+  EFI_TPL              OldTpl;
+
+  PciIo = Private->PciIo;
+
+  if (Dma->BatchEntryNo != 0) {
+    Private->IoMmuBatch->UnmapMultiple (
+                           Private->IoMmuBatch,
+                           Private->ControllerHandle,
+                           Dma->BatchEntryNo,
+                           Dma->BatchEntries
+                           );
+    Dma->BatchEntryNo = 0;
+  }
+
+  if (Dma->MapData != NULL) {
+    PciIo->Unmap (PciIo, Dma->MapData);
+    Dma->MapData = NULL;
+  }
+
+  if (Dma->MapMeta != NULL) {
+    PciIo->Unmap (PciIo, Dma->MapMeta);
+    Dma->MapMeta = NULL;
+  }
+
+  if (Dma->MapPrpList != NULL) {
+    PciIo->Unmap (PciIo, Dma->MapPrpList);
+    Dma->MapPrpList = NULL;
+  }
+
+  if (Dma->PrpListHost != NULL) {
+    PciIo->FreeBuffer (PciIo, Dma->PrpListNo, Dma->PrpListHost);
+    Dma->PrpListHost = NULL;
+  }
+
+  if (Dma->PrpListPoolPages != 0) {
+    OldTpl                    = gBS->RaiseTPL (TPL_NOTIFY);
+    Private->PrpListPoolFree |= Dma->PrpListPoolPages;
+    gBS->RestoreTPL (OldTpl);
+    Dma->PrpListPoolPages = 0;
+  }
+}
+
 /**
   Aborts the asynchronous PassThru requests.
 
@@ -329,7 +547,6 @@ AbortAsyncPassThruTasks (
   IN NVME_CONTROLLER_PRIVATE_DATA  *Private
   )
 {
-  EFI_PCI_IO_PROTOCOL       *PciIo;
   LIST_ENTRY                *Link;
   LIST_ENTRY                *NextLink;
   NVME_BLKIO2_SUBTASK       *Subtask;
@@ -339,7 +556,6 @@ AbortAsyncPassThruTasks (
   EFI_TPL                   OldTpl;
   EFI_STATUS                Status;
 
-  PciIo  = Private->PciIo;
   OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
 
   //
@@ -376,25 +592,7 @@ AbortAsyncPassThruTasks (
     NextLink     = GetNextNode (&Private->AsyncPassThruQueue, Link);
     AsyncRequest = NVME_PASS_THRU_ASYNC_REQ_FROM_THIS (Link);
 
-    if (AsyncRequest->MapData != NULL) {
-      PciIo->Unmap (PciIo, AsyncRequest->MapData);
-    }
-
-    if (AsyncRequest->MapMeta != NULL) {
-      PciIo->Unmap (PciIo, AsyncRequest->MapMeta);
-    }
-
-    if (AsyncRequest->MapPrpList != NULL) {
-      PciIo->Unmap (PciIo, AsyncRequest->MapPrpList);
-    }
-
-    if (AsyncRequest->PrpListHost != NULL) {
-      PciIo->FreeBuffer (
-               PciIo,
-               AsyncRequest->PrpListNo,
-               AsyncRequest->PrpListHost
-               );
-    }
+    NvmeReleasePassThruDma (Private, &AsyncRequest->Dma);
 
     RemoveEntryList (Link);
     gBS->SignalEvent (AsyncRequest->CallerEvent);
@@ -463,18 +661,15 @@ NvmExpressPassThru (
   volatile NVME_CQ               *Cq;
   UINT16                         QueueId;
   UINT16                         QueueSize;
+  UINT16                         Index;
   UINT32                         Bytes;
   UINT16                         Offset;
   EFI_EVENT                      TimerEvent;
   EFI_PCI_IO_PROTOCOL_OPERATION  Flag;
   EFI_PHYSICAL_ADDRESS           PhyAddr;
-  VOID                           *MapData;
-  VOID                           *MapMeta;
-  VOID                           *MapPrpList;
+  NVME_PASS_THRU_DMA             Dma;
   UINTN                          MapLength;
   UINT64                         *Prp;
-  VOID                           *PrpListHost;
-  UINTN                          PrpListNo;
   UINT32                         Attributes;
   UINT32                         IoAlign;
   UINT32                         MaxTransLen;
@@ -544,16 +739,12 @@ NvmExpressPassThru (
     }
   }
 
-  PciIo       = Private->PciIo;
-  MapData     = NULL;
-  MapMeta     = NULL;
-  MapPrpList  = NULL;
-  PrpListHost = NULL;
-  PrpListNo   = 0;
-  Prp         = NULL;
-  TimerEvent  = NULL;
-  Status      = EFI_SUCCESS;
-  QueueSize   = MIN (NVME_ASYNC_CSQ_SIZE, Private->Cap.Mqes) + 1;
+  PciIo      = Private->PciIo;
+  Prp        = NULL;
+  TimerEvent = NULL;
+  Status     = EFI_SUCCESS;
+  QueueSize  = Private->AsyncQueueSize + 1;
+  ZeroMem (&Dma, sizeof (Dma));
 
   if (Packet->QueueType == NVME_ADMIN_QUEUE) {
     QueueId = 0;
@@ -561,16 +752,25 @@ NvmExpressPassThru (
     if (Event == NULL) {
       QueueId = 1;
     } else {
-      QueueId = 2;
-
       //
-      // Submission queue full check.
+      // Spread the non-blocking commands over the asynchronous I/O queue
+      // pairs, round robin, passing over the full submission queues.
       //
-      if ((Private->SqTdbl[QueueId].Sqt + 1) % QueueSize ==
-          Private->AsyncSqHead)
-      {
+      QueueId = 0;
+      for (Index = 0; Index < Private->AsyncQueues; Index++) {
+        QueueId = (UINT16)(NVME_ASYNC_QUEUE_ID + (Private->NextAsyncQueue + Index) % Private->AsyncQueues);
+        if ((Private->SqTdbl[QueueId].Sqt + 1) % QueueSize !=
+            Private->AsyncSqHead[QueueId])
+        {
+          break;
+        }
+      }
+
+      if (Index == Private->AsyncQueues) {
         return EFI_NOT_READY;
       }
+
+      Private->NextAsyncQueue = (UINT16)((QueueId - NVME_ASYNC_QUEUE_ID + 1) % Private->AsyncQueues);
     }
   }
 
@@ -627,44 +827,58 @@ NvmExpressPassThru (
       Flag = EfiPciIoOperationBusMasterWrite;
     }
 
-    if ((Packet->TransferLength != 0) && (Packet->TransferBuffer != NULL)) {
-      MapLength = Packet->TransferLength;
-      Status    = PciIo->Map (
-                           PciIo,
-                           Flag,
-                           Packet->TransferBuffer,
-                           &MapLength,
-                           &PhyAddr,
-                           &MapData
-                           );
-      if (EFI_ERROR (Status) || (Packet->TransferLength != MapLength)) {
-        return EFI_OUT_OF_RESOURCES;
+    //
+    // Through the IOMMU batch protocol, the data and metadata buffers cost one
+    // update of the IOMMU's translations instead of one per buffer.
+    //
+    Status = EFI_UNSUPPORTED;
+    if (Private->IoMmuBatch != NULL) {
+      Status = NvmeMapPassThruBuffers (Private, Packet, Flag, Sq, &Dma);
+      if (EFI_ERROR (Status) && (Status != EFI_UNSUPPORTED)) {
+        return Status;
       }
-
-      Sq->Prp[0] = PhyAddr;
-      Sq->Prp[1] = 0;
     }
 
-    if ((Packet->MetadataLength != 0) && (Packet->MetadataBuffer != NULL)) {
-      MapLength = Packet->MetadataLength;
-      Status    = PciIo->Map (
-                           PciIo,
-                           Flag,
-                           Packet->MetadataBuffer,
-                           &MapLength,
-                           &PhyAddr,
-                           &MapMeta
-                           );
-      if (EFI_ERROR (Status) || (Packet->MetadataLength != MapLength)) {
-        PciIo->Unmap (
-                 PciIo,
-                 MapData
-                 );
+    if (Status == EFI_UNSUPPORTED) {
+      if ((Packet->TransferLength != 0) && (Packet->TransferBuffer != NULL)) {
+        MapLength = Packet->TransferLength;
+        Status    = PciIo->Map (
+                             PciIo,
+                             Flag,
+                             Packet->TransferBuffer,
+                             &MapLength,
+                             &PhyAddr,
+                             &Dma.MapData
+                             );
+        if (EFI_ERROR (Status) || (Packet->TransferLength != MapLength)) {
+          return EFI_OUT_OF_RESOURCES;
+        }
 
-        return EFI_OUT_OF_RESOURCES;
+        Sq->Prp[0] = PhyAddr;
+        Sq->Prp[1] = 0;
       }
 
-      Sq->Mptr = PhyAddr;
+      if ((Packet->MetadataLength != 0) && (Packet->MetadataBuffer != NULL)) {
+        MapLength = Packet->MetadataLength;
+        Status    = PciIo->Map (
+                             PciIo,
+                             Flag,
+                             Packet->MetadataBuffer,
+                             &MapLength,
+                             &PhyAddr,
+                             &Dma.MapMeta
+                             );
+        if (EFI_ERROR (Status) || (Packet->MetadataLength != MapLength)) {
+          PciIo->Unmap (
+                   PciIo,
+                   Dma.MapData
+                   );
+
+          return EFI_OUT_OF_RESOURCES;
+        }
+
+        Sq->Mptr = PhyAddr;
+      }
     }
   }
 
@@ -680,7 +894,7 @@ NvmExpressPassThru (
     // Create PrpList for remaining data buffer.
     //
     PhyAddr = (Sq->Prp[0] + EFI_PAGE_SIZE) & ~(EFI_PAGE_SIZE - 1);
-    Prp     = NvmeCreatePrpList (PciIo, PhyAddr, EFI_SIZE_TO_PAGES (Offset + Bytes) - 1, &PrpListHost, &PrpListNo, &MapPrpList);
+    Prp     = NvmeCreatePrpList (Private, PhyAddr, EFI_SIZE_TO_PAGES (Offset + Bytes) - 1, &Dma);
     if (Prp == NULL) {
       Status = EFI_OUT_OF_RESOURCES;
       goto EXIT;
@@ -760,13 +974,10 @@ NvmExpressPassThru (
 
     AsyncRequest->Signature   = NVME_PASS_THRU_ASYNC_REQ_SIG;
     AsyncRequest->Packet      = Packet;
+    AsyncRequest->QueueId     = QueueId;
     AsyncRequest->CommandId   = Sq->Cid;
     AsyncRequest->CallerEvent = Event;
-    AsyncRequest->MapData     = MapData;
-    AsyncRequest->MapMeta     = MapMeta;
-    AsyncRequest->MapPrpList  = MapPrpList;
-    AsyncRequest->PrpListNo   = PrpListNo;
-    AsyncRequest->PrpListHost = PrpListHost;
+    CopyMem (&AsyncRequest->Dma, &Dma, sizeof (Dma));
 
     OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
     InsertTailList (&Private->AsyncPassThruQueue, &AsyncRequest->Link);
@@ -893,30 +1104,7 @@ NvmExpressPassThru (
   }
 
 EXIT:
-  if (MapData != NULL) {
-    PciIo->Unmap (
-             PciIo,
-             MapData
-             );
-  }
-
-  if (MapMeta != NULL) {
-    PciIo->Unmap (
-             PciIo,
-             MapMeta
-             );
-  }
-
-  if (MapPrpList != NULL) {
-    PciIo->Unmap (
-             PciIo,
-             MapPrpList
-             );
-  }
-
-  if (Prp != NULL) {
-    PciIo->FreeBuffer (PciIo, PrpListNo, PrpListHost);
-  }
+  NvmeReleasePassThruDma (Private, &Dma);
 
   if (TimerEvent != NULL) {
     gBS->CloseEvent (TimerEvent);
@@ -34,10 +34,11 @@ BOOLEAN                                       gFullEnumeration               = T
 UINT64                                        gAllOne                        = 0xFFFFFFFFFFFFFFFFULL;
 UINT64                                        gAllZero                       = 0;
 
-EFI_PCI_PLATFORM_PROTOCOL       *gPciPlatformProtocol;
-EFI_PCI_OVERRIDE_PROTOCOL       *gPciOverrideProtocol;
-EDKII_IOMMU_PROTOCOL            *mIoMmuProtocol;
-EDKII_DEVICE_SECURITY_PROTOCOL  *mDeviceSecurityProtocol;
+EFI_PCI_PLATFORM_PROTOCOL         *gPciPlatformProtocol;
+EFI_PCI_OVERRIDE_PROTOCOL         *gPciOverrideProtocol;
+EDKII_IOMMU_PROTOCOL              *mIoMmuProtocol;
+EDKII_IOMMU_DEVICE_HINT_PROTOCOL  *mIoMmuDeviceHintProtocol;
+EDKII_DEVICE_SECURITY_PROTOCOL    *mDeviceSecurityProtocol;
 
 GLOBAL_REMOVE_IF_UNREFERENCED EFI_PCI_HOTPLUG_REQUEST_PROTOCOL  mPciHotPlugRequest = {
   PciHotPlugRequestNotify
@@ -294,6 +295,14 @@ PciBusDriverBindingStart (
            );
   }
 
+  if (mIoMmuDeviceHintProtocol == NULL) {
+    gBS->LocateProtocol (
+           &gEdkiiIoMmuDeviceHintProtocolGuid,
+           NULL,
+           (VOID **)&mIoMmuDeviceHintProtocol
+           );
+  }
+
   if (mDeviceSecurityProtocol == NULL) {
     gBS->LocateProtocol (
            &gEdkiiDeviceSecurityProtocolGuid,
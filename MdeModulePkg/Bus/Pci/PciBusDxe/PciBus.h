@@ -26,6 +26,8 @@ SPDX-License-Identifier: BSD-2-Clause-Patent
 #include <Protocol/PciOverride.h>
 #include <Protocol/PciEnumerationComplete.h>
 #include <Protocol/IoMmu.h>
+#include <Protocol/IoMmuDeviceHint.h>
+#include <Protocol/PciConfigCache.h>
 #include <Protocol/DeviceSecurity.h>
 
 #include <Library/DebugLib.h>
@@ -74,6 +76,7 @@ typedef enum {
 #include "PciEnumerator.h"
 #include "PciEnumeratorSupport.h"
 #include "PciDriverOverride.h"
+#include "PciConfigCache.h"
 #include "PciRomTable.h"
 #include "PciOptionRomSupport.h"
 #include "PciPowerManagement.h"
@@ -169,6 +172,7 @@ struct _PCI_IO_DEVICE {
   EFI_DEVICE_PATH_PROTOCOL                     *DevicePath;
   EFI_PCI_ROOT_BRIDGE_IO_PROTOCOL              *PciRootBridgeIo;
   EFI_LOAD_FILE2_PROTOCOL                      LoadFile2;
+  EDKII_PCI_CONFIG_CACHE_PROTOCOL              PciConfigCache;
 
   //
   // PCI configuration space header type
@@ -282,6 +286,21 @@ struct _PCI_IO_DEVICE {
   UINT16                                       BridgeIoAlignment;
   UINT32                                       ResizableBarOffset;
   UINT32                                       ResizableBarNumber;
+
+  //
+  // The highest address that the device reaches at its own address through the IOMMU,
+  // or 0 if every buffer needs mapping. It is queried on the first Map().
+  //
+  BOOLEAN                                      IoMmuHintQueried;
+  EFI_PHYSICAL_ADDRESS                         IoMmuIdentityLimit;
+
+  //
+  // The capability lists, in list order, walked on the first search of the
+  // PCI Config Cache protocol.
+  //
+  BOOLEAN                                      CapabilitiesCached;
+  UINTN                                        CapabilityCount;
+  PCI_CAPABILITY_ENTRY                         *Capabilities;
 };
 
 #define PCI_IO_DEVICE_FROM_PCI_IO_THIS(a) \
@@ -296,6 +315,9 @@ struct _PCI_IO_DEVICE {
 #define PCI_IO_DEVICE_FROM_LOAD_FILE2_THIS(a) \
   CR (a, PCI_IO_DEVICE, LoadFile2, PCI_IO_DEVICE_SIGNATURE)
 
+#define PCI_IO_DEVICE_FROM_PCI_CONFIG_CACHE_THIS(a) \
+  CR (a, PCI_IO_DEVICE, PciConfigCache, PCI_IO_DEVICE_SIGNATURE)
+
 //
 // Global Variables
 //
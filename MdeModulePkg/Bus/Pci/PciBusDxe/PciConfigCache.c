@@ -0,0 +1,245 @@
+/** @file
+  Functions implementation for the PCI Config Cache protocol.
+
+  The header of the configuration space is the one that the enumerator reads
+  into PCI_IO_DEVICE. The capability lists are walked on the first search, and
+  kept with the device, so that later searches don't read configuration space.
+
+Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include "PciBus.h"
+
+//
+// The most capabilities that fit in each list, which bounds a walk of a list that loops.
+//
+#define PCI_CAPABILITY_MAX_COUNT           ((0x100 - 0x40) / 4)
+#define PCI_EXTENDED_CAPABILITY_MAX_COUNT  ((0x1000 - EFI_PCIE_CAPABILITY_BASE_OFFSET) / 4)
+
+/**
+  Initializes a PCI Config Cache instance.
+
+  @param  PciIoDevice   PCI Device instance.
+
+**/
+VOID
+InitializePciConfigCacheInstance (
+  IN OUT PCI_IO_DEVICE  *PciIoDevice
+  )
+{
+  PciIoDevice->PciConfigCache.Revision       = EDKII_PCI_CONFIG_CACHE_PROTOCOL_REVISION;
+  PciIoDevice->PciConfigCache.GetHeader      = PciConfigCacheGetHeader;
+  PciIoDevice->PciConfigCache.FindCapability = PciConfigCacheFindCapability;
+}
+
+/**
+  Copy the header of the configuration space of a PCI function, as it was read
+  when the function was enumerated.
+
+  @param  This    The protocol instance pointer.
+  @param  Header  The header.
+
+  @retval EFI_SUCCESS            The header is copied.
+  @retval EFI_INVALID_PARAMETER  Header is NULL.
+
+**/
+EFI_STATUS
+EFIAPI
+PciConfigCacheGetHeader (
+  IN  EDKII_PCI_CONFIG_CACHE_PROTOCOL  *This,
+  OUT PCI_TYPE00                       *Header
+  )
+{
+  PCI_IO_DEVICE  *PciIoDevice;
+
+  if (Header == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  PciIoDevice = PCI_IO_DEVICE_FROM_PCI_CONFIG_CACHE_THIS (This);
+  CopyMem (Header, &PciIoDevice->Pci, sizeof (*Header));
+  return EFI_SUCCESS;
+}
+
+/**
+  Walk the capability lists of a PCI device into a table that is kept with it.
+
+  A list that can't be read is cut short, and the table holds what was read.
+
+  @param  PciIoDevice   PCI Device instance.
+
+  @retval EFI_SUCCESS           The table is built.
+  @retval EFI_OUT_OF_RESOURCES  There is no memory for the table. It is built on the next search.
+
+**/
+STATIC
+EFI_STATUS
+CachePciCapabilities (
+  IN OUT PCI_IO_DEVICE  *PciIoDevice
+  )
+{
+  PCI_CAPABILITY_ENTRY  *Entries;
+  UINTN                 Count;
+  UINTN                 Walked;
+  UINT8                 CapabilityPtr;
+  UINT16                CapabilityEntry;
+  UINT32                ExtendedPtr;
+  UINT32                ExtendedEntry;
+  EFI_STATUS            Status;
+
+  Entries = AllocatePool ((PCI_CAPABILITY_MAX_COUNT + PCI_EXTENDED_CAPABILITY_MAX_COUNT) * sizeof (*Entries));
+  if (Entries == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Count = 0;
+  if (PciCapabilitySupport (PciIoDevice)) {
+    //
+    // The pointer to the list is in the header, which is already cached.
+    //
+    if (IS_CARDBUS_BRIDGE (&PciIoDevice->Pci)) {
+      CapabilityPtr = ((UINT8 *)&PciIoDevice->Pci)[EFI_PCI_CARDBUS_BRIDGE_CAPABILITY_PTR];
+    } else {
+      CapabilityPtr = ((UINT8 *)&PciIoDevice->Pci)[PCI_CAPBILITY_POINTER_OFFSET];
+    }
+
+    for (Walked = 0; Walked < PCI_CAPABILITY_MAX_COUNT; Walked++) {
+      if ((CapabilityPtr < 0x40) || ((CapabilityPtr & 0x03) != 0x00)) {
+        break;
+      }
+
+      Status = PciIoDevice->PciIo.Pci.Read (
+                                        &PciIoDevice->PciIo,
+                                        EfiPciIoWidthUint16,
+                                        CapabilityPtr,
+                                        1,
+                                        &CapabilityEntry
+                                        );
+      if (EFI_ERROR (Status)) {
+        break;
+      }
+
+      Entries[Count].CapabilityId = (UINT8)CapabilityEntry;
+      Entries[Count].Extended     = FALSE;
+      Entries[Count].Offset       = CapabilityPtr;
+      Count++;
+
+      CapabilityPtr = (UINT8)(CapabilityEntry >> 8);
+    }
+  }
+
+  if (PciIoDevice->IsPciExp) {
+    ExtendedPtr = EFI_PCIE_CAPABILITY_BASE_OFFSET;
+    for (Walked = 0; Walked < PCI_EXTENDED_CAPABILITY_MAX_COUNT; Walked++) {
+      if (ExtendedPtr < EFI_PCIE_CAPABILITY_BASE_OFFSET) {
+        break;
+      }
+
+      ExtendedPtr &= 0xFFC;
+      Status       = PciIoDevice->PciIo.Pci.Read (
+                                              &PciIoDevice->PciIo,
+                                              EfiPciIoWidthUint32,
+                                              ExtendedPtr,
+                                              1,
+                                              &ExtendedEntry
+                                              );
+      //
+      // A function without extended capabilities has a zero header at the base.
+      //
+      if (EFI_ERROR (Status) || (ExtendedEntry == 0) || (ExtendedEntry == MAX_UINT32)) {
+        break;
+      }
+
+      Entries[Count].CapabilityId = (UINT16)ExtendedEntry;
+      Entries[Count].Extended     = TRUE;
+      Entries[Count].Offset       = (UINT16)ExtendedPtr;
+      Count++;
+
+      ExtendedPtr = (ExtendedEntry >> 20) & 0xFFF;
+    }
+  }
+
+  PciIoDevice->Capabilities = NULL;
+  if (Count != 0) {
+    PciIoDevice->Capabilities = AllocateCopyPool (Count * sizeof (*Entries), Entries);
+    if (PciIoDevice->Capabilities == NULL) {
+      FreePool (Entries);
+      return EFI_OUT_OF_RESOURCES;
+    }
+  }
+
+  FreePool (Entries);
+  PciIoDevice->CapabilityCount    = Count;
+  PciIoDevice->CapabilitiesCached = TRUE;
+  return EFI_SUCCESS;
+}
+
+/**
+  Find a capability of a PCI function, in its capability list or its PCI Express
+  extended capability list.
+
+  @param  This          The protocol instance pointer.
+  @param  Extended      TRUE for the extended capability list, FALSE for the
+                        capability list.
+  @param  CapabilityId  The ID of the capability.
+  @param  Offset        On input, 0 to find the first capability with the ID,
+                        or the offset of one to find the next. On output,
+                        the offset of the capability that is found.
+
+  @retval EFI_SUCCESS            The capability is found.
+  @retval EFI_INVALID_PARAMETER  Offset is NULL.
+  @retval EFI_NOT_FOUND          The function has no more capabilities with the ID.
+  @retval EFI_OUT_OF_RESOURCES   The lists could not be cached. The caller may read
+                                 configuration space instead.
+
+**/
+EFI_STATUS
+EFIAPI
+PciConfigCacheFindCapability (
+  IN     EDKII_PCI_CONFIG_CACHE_PROTOCOL  *This,
+  IN     BOOLEAN                          Extended,
+  IN     UINT16                           CapabilityId,
+  IN OUT UINT32                           *Offset
+  )
+{
+  PCI_IO_DEVICE  *PciIoDevice;
+  UINTN          Index;
+  BOOLEAN        Past;
+  EFI_STATUS     Status;
+
+  if (Offset == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  PciIoDevice = PCI_IO_DEVICE_FROM_PCI_CONFIG_CACHE_THIS (This);
+  if (!PciIoDevice->CapabilitiesCached) {
+    Status = CachePciCapabilities (PciIoDevice);
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+  }
+
+  //
+  // The table is in the order of the lists, so the next match follows the one at Offset.
+  //
+  Past = (*Offset == 0);
+  for (Index = 0; Index < PciIoDevice->CapabilityCount; Index++) {
+    if (PciIoDevice->Capabilities[Index].Extended != Extended) {
+      continue;
+    }
+
+    if (!Past) {
+      Past = (PciIoDevice->Capabilities[Index].Offset == *Offset);
+      continue;
+    }
+
+    if (PciIoDevice->Capabilities[Index].CapabilityId == CapabilityId) {
+      *Offset = PciIoDevice->Capabilities[Index].Offset;
+      return EFI_SUCCESS;
+    }
+  }
+
+  return EFI_NOT_FOUND;
+}
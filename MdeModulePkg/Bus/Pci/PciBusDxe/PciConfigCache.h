@@ -0,0 +1,78 @@
+/** @file
+  Functions declaration for the PCI Config Cache protocol.
+
+Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef _EFI_PCI_CONFIG_CACHE_H_
+#define _EFI_PCI_CONFIG_CACHE_H_
+
+//
+// A capability of a PCI device, in its capability list or its extended capability list
+//
+typedef struct {
+  UINT16     CapabilityId;
+  BOOLEAN    Extended;
+  UINT16     Offset;
+} PCI_CAPABILITY_ENTRY;
+
+/**
+  Initializes a PCI Config Cache instance.
+
+  @param  PciIoDevice   PCI Device instance.
+
+**/
+VOID
+InitializePciConfigCacheInstance (
+  IN OUT PCI_IO_DEVICE  *PciIoDevice
+  );
+
+/**
+  Copy the header of the configuration space of a PCI function, as it was read
+  when the function was enumerated.
+
+  @param  This    The protocol instance pointer.
+  @param  Header  The header.
+
+  @retval EFI_SUCCESS            The header is copied.
+  @retval EFI_INVALID_PARAMETER  Header is NULL.
+
+**/
+EFI_STATUS
+EFIAPI
+PciConfigCacheGetHeader (
+  IN  EDKII_PCI_CONFIG_CACHE_PROTOCOL  *This,
+  OUT PCI_TYPE00                       *Header
+  );
+
+/**
+  Find a capability of a PCI function, in its capability list or its PCI Express
+  extended capability list.
+
+  @param  This          The protocol instance pointer.
+  @param  Extended      TRUE for the extended capability list, FALSE for the
+                        capability list.
+  @param  CapabilityId  The ID of the capability.
+  @param  Offset        On input, 0 to find the first capability with the ID,
+                        or the offset of one to find the next. On output,
+                        the offset of the capability that is found.
+
+  @retval EFI_SUCCESS            The capability is found.
+  @retval EFI_INVALID_PARAMETER  Offset is NULL.
+  @retval EFI_NOT_FOUND          The function has no more capabilities with the ID.
+  @retval EFI_OUT_OF_RESOURCES   The lists could not be cached. The caller may read
+                                 configuration space instead.
+
+**/
+EFI_STATUS
+EFIAPI
+PciConfigCacheFindCapability (
+  IN     EDKII_PCI_CONFIG_CACHE_PROTOCOL  *This,
+  IN     BOOLEAN                          Extended,
+  IN     UINT16                           CapabilityId,
+  IN OUT UINT32                           *Offset
+  );
+
+#endif
@@ -104,6 +104,10 @@ FreePciDevice (
     FreePool (PciIoDevice->BusNumberRanges);
   }
 
+  if (PciIoDevice->Capabilities != NULL) {
+    FreePool (PciIoDevice->Capabilities);
+  }
+
   FreePool (PciIoDevice);
 }
 
@@ -212,7 +216,7 @@ RegisterPciDevice (
   BOOLEAN              HasEfiImage;
 
   //
-  // Install the pciio protocol, device path protocol
+  // Install the pciio protocol, device path protocol, and config cache protocol
   //
   Status = gBS->InstallMultipleProtocolInterfaces (
                   &PciIoDevice->Handle,
@@ -220,6 +224,8 @@ RegisterPciDevice (
                   PciIoDevice->DevicePath,
                   &gEfiPciIoProtocolGuid,
                   &PciIoDevice->PciIo,
+                  &gEdkiiPciConfigCacheProtocolGuid,
+                  &PciIoDevice->PciConfigCache,
                   NULL
                   );
   if (EFI_ERROR (Status)) {
@@ -314,6 +320,8 @@ RegisterPciDevice (
              PciIoDevice->DevicePath,
              &gEfiPciIoProtocolGuid,
              &PciIoDevice->PciIo,
+             &gEdkiiPciConfigCacheProtocolGuid,
+             &PciIoDevice->PciConfigCache,
              NULL
              );
       return Status;
@@ -350,6 +358,8 @@ RegisterPciDevice (
              PciIoDevice->DevicePath,
              &gEfiPciIoProtocolGuid,
              &PciIoDevice->PciIo,
+             &gEdkiiPciConfigCacheProtocolGuid,
+             &PciIoDevice->PciConfigCache,
              NULL
              );
       if (HasEfiImage) {
@@ -516,6 +526,8 @@ DeRegisterPciDevice (
                       PciIoDevice->DevicePath,
                       &gEfiPciIoProtocolGuid,
                       &PciIoDevice->PciIo,
+                      &gEdkiiPciConfigCacheProtocolGuid,
+                      &PciIoDevice->PciConfigCache,
                       &gEfiBusSpecificDriverOverrideProtocolGuid,
                       &PciIoDevice->PciDriverOverride,
                       NULL
@@ -527,6 +539,8 @@ DeRegisterPciDevice (
                       PciIoDevice->DevicePath,
                       &gEfiPciIoProtocolGuid,
                       &PciIoDevice->PciIo,
+                      &gEdkiiPciConfigCacheProtocolGuid,
+                      &PciIoDevice->PciConfigCache,
                       NULL
                       );
     }
@@ -870,6 +884,7 @@ CreateRootBridge (
   InitializePciIoInstance (Dev);
   InitializePciDriverOverrideInstance (Dev);
   InitializePciLoadFile2 (Dev);
+  InitializePciConfigCacheInstance (Dev);
 
   //
   // Initialize reserved resource list and
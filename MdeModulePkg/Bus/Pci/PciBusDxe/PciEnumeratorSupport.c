@@ -2227,6 +2227,7 @@ CreatePciIoDevice (
   InitializePciIoInstance (PciIoDevice);
   InitializePciDriverOverrideInstance (PciIoDevice);
   InitializePciLoadFile2 (PciIoDevice);
+  InitializePciConfigCacheInstance (PciIoDevice);
   PciIo = &PciIoDevice->PciIo;
 
   //
@@ -8,7 +8,13 @@ SPDX-License-Identifier: BSD-2-Clause-Patent
 
 #include "PciBus.h"
 
-extern EDKII_IOMMU_PROTOCOL  *mIoMmuProtocol;
+extern EDKII_IOMMU_PROTOCOL              *mIoMmuProtocol;
+extern EDKII_IOMMU_DEVICE_HINT_PROTOCOL  *mIoMmuDeviceHintProtocol;
+
+//
+// The mapping that PciIoMap() returns for a buffer that it hands out at its host address.
+//
+STATIC UINT8  mIdentityMapping;
 
 //
 // Pci Io Protocol Interface
@@ -940,6 +946,73 @@ PciIoCopyMem (
   return Status;
 }
 
+/**
+  Determine whether a device reaches a buffer at its host address, so that the buffer
+  needs neither the root bridge nor the IOMMU to map it.
+
+  The IOMMU is asked once per device. Above 4 GiB, both the device and its root bridge
+  must do dual address cycles, as the root bridge would otherwise bounce the buffer.
+
+  @param  PciIoDevice           The device that does the DMA.
+  @param  HostAddress           The system memory address of the buffer.
+  @param  NumberOfBytes         The number of bytes of the buffer.
+
+  @retval TRUE                  The buffer may be handed out at its host address.
+  @retval FALSE                 The buffer must be mapped.
+
+**/
+STATIC
+BOOLEAN
+PciIoIsIdentityBuffer (
+  IN PCI_IO_DEVICE  *PciIoDevice,
+  IN VOID           *HostAddress,
+  IN UINTN          NumberOfBytes
+  )
+{
+  EFI_STATUS            Status;
+  EFI_PHYSICAL_ADDRESS  Limit;
+  UINT64                Supports;
+  UINT64                Attributes;
+
+  if ((mIoMmuDeviceHintProtocol == NULL) || (NumberOfBytes == 0)) {
+    return FALSE;
+  }
+
+  if (!PciIoDevice->IoMmuHintQueried) {
+    Status = mIoMmuDeviceHintProtocol->GetIdentityLimit (
+                                         mIoMmuDeviceHintProtocol,
+                                         PciIoDevice->Handle,
+                                         &Limit
+                                         );
+    if (EFI_ERROR (Status)) {
+      Limit = 0;
+    } else {
+      Status = PciIoDevice->PciRootBridgeIo->GetAttributes (
+                                               PciIoDevice->PciRootBridgeIo,
+                                               &Supports,
+                                               &Attributes
+                                               );
+      if (EFI_ERROR (Status) || ((Supports & EFI_PCI_ATTRIBUTE_DUAL_ADDRESS_CYCLE) == 0)) {
+        Limit = MIN (Limit, SIZE_4GB - 1);
+      }
+    }
+
+    PciIoDevice->IoMmuIdentityLimit = Limit;
+    PciIoDevice->IoMmuHintQueried   = TRUE;
+  }
+
+  Limit = PciIoDevice->IoMmuIdentityLimit;
+  if ((PciIoDevice->Attributes & EFI_PCI_IO_ATTRIBUTE_DUAL_ADDRESS_CYCLE) == 0) {
+    Limit = MIN (Limit, SIZE_4GB - 1);
+  }
+
+  if ((Limit == 0) || ((UINTN)HostAddress > Limit)) {
+    return FALSE;
+  }
+
+  return (NumberOfBytes - 1 <= Limit - (UINTN)HostAddress);
+}
+
 /**
   Provides the PCI controller-specific addresses needed to access system memory.
 
@@ -985,6 +1058,15 @@ PciIoMap (
     return EFI_INVALID_PARAMETER;
   }
 
+  //
+  // A device that the IOMMU lets reach the buffer at its own address needs no mapping.
+  //
+  if (PciIoIsIdentityBuffer (PciIoDevice, HostAddress, *NumberOfBytes)) {
+    *DeviceAddress = (EFI_PHYSICAL_ADDRESS)(UINTN)HostAddress;
+    *Mapping       = &mIdentityMapping;
+    return EFI_SUCCESS;
+  }
+
   RootBridgeIoOperation = (EFI_PCI_ROOT_BRIDGE_IO_PROTOCOL_OPERATION)Operation;
   if ((PciIoDevice->Attributes & EFI_PCI_IO_ATTRIBUTE_DUAL_ADDRESS_CYCLE) != 0) {
     RootBridgeIoOperation = (EFI_PCI_ROOT_BRIDGE_IO_PROTOCOL_OPERATION)(Operation + EfiPciOperationBusMasterRead64);
@@ -1058,6 +1140,10 @@ PciIoUnmap (
 
   PciIoDevice = PCI_IO_DEVICE_FROM_PCI_IO_THIS (This);
 
+  if (Mapping == &mIdentityMapping) {
+    return EFI_SUCCESS;
+  }
+
   if (mIoMmuProtocol != NULL) {
     mIoMmuProtocol->SetAttribute (
                       mIoMmuProtocol,
@@ -723,6 +723,13 @@ SdMmcPciHcDriverBindingStart (
       continue;
     }
 
+    //
+    // The table is mapped before 64-bit DMA is enabled, so that it is below
+    // 4GB for every ADMA mode. A slot without one falls back to a table for
+    // each transfer.
+    //
+    SdMmcHcAllocateAdmaPool (Private, Slot);
+
     Private->Slot[Slot].SlotType = Private->Capability[Slot].SlotType;
     if ((Private->Slot[Slot].SlotType != RemovableSlot) && (Private->Slot[Slot].SlotType != EmbeddedSlot)) {
       DEBUG ((DEBUG_INFO, "SdMmcPciHcDxe doesn't support the slot type [%d]!!!\n", Private->Slot[Slot].SlotType));
@@ -873,6 +880,7 @@ Done:
     }
 
     if (Private != NULL) {
+      SdMmcHcFreeAdmaPools (Private);
       FreePool (Private);
     }
   }
@@ -998,6 +1006,7 @@ SdMmcPciHcDriverBindingStop (
                     );
   ASSERT_EFI_ERROR (Status);
 
+  SdMmcHcFreeAdmaPools (Private);
   FreePool (Private);
 
   DEBUG ((DEBUG_INFO, "SdMmcPciHcDriverBindingStop: End with %r\n", Status));
@@ -88,6 +88,18 @@ typedef struct {
   EDKII_SD_MMC_OPERATING_PARAMETERS    OperatingParameters;
 } SD_MMC_HC_SLOT;
 
+//
+// An ADMA descriptor table that is allocated and mapped once, and that is used
+// by one transfer at a time.
+//
+typedef struct {
+  VOID                    *Desc;
+  EFI_PHYSICAL_ADDRESS    DescPhy;
+  VOID                    *Map;
+  UINTN                   Pages;
+  BOOLEAN                 InUse;
+} SD_MMC_HC_ADMA_POOL;
+
 typedef struct {
   UINTN                            Signature;
 
@@ -121,6 +133,12 @@ typedef struct {
   // value stored in Capabilities Register 1.
   //
   UINT32                           BaseClkFreq[SD_MMC_HC_MAX_SLOT];
+
+  //
+  // The ADMA descriptor table of each slot, so that a transfer need not
+  // allocate and map one.
+  //
+  SD_MMC_HC_ADMA_POOL              AdmaPool[SD_MMC_HC_MAX_SLOT];
 } SD_MMC_HC_PRIVATE_DATA;
 
 typedef struct {
@@ -168,6 +186,7 @@ typedef struct {
   EFI_PHYSICAL_ADDRESS                   AdmaDescPhy;
   VOID                                   *AdmaMap;
   UINT32                                 AdmaPages;
+  BOOLEAN                                AdmaFromPool;
 
   SD_MMC_HC_PRIVATE_DATA                 *Private;
 } SD_MMC_HC_TRB;
@@ -678,6 +697,36 @@ SdMmcCreateTrb (
   IN EFI_EVENT                            Event
   );
 
+/**
+  Allocate and map the ADMA descriptor table of a slot.
+
+  A slot without one allocates a table for each ADMA transfer.
+
+  @param[in] Private        A pointer to the SD_MMC_HC_PRIVATE_DATA instance.
+  @param[in] Slot           The slot number.
+
+  @retval EFI_SUCCESS           The table is allocated and mapped.
+  @retval EFI_UNSUPPORTED       The slot doesn't support ADMA2.
+  @retval EFI_OUT_OF_RESOURCES  The table can't be allocated or mapped.
+
+**/
+EFI_STATUS
+SdMmcHcAllocateAdmaPool (
+  IN SD_MMC_HC_PRIVATE_DATA  *Private,
+  IN UINT8                   Slot
+  );
+
+/**
+  Unmap and free the ADMA descriptor tables of all slots.
+
+  @param[in] Private        A pointer to the SD_MMC_HC_PRIVATE_DATA instance.
+
+**/
+VOID
+SdMmcHcFreeAdmaPools (
+  IN SD_MMC_HC_PRIVATE_DATA  *Private
+  );
+
 /**
   Free the resource used by the TRB.
 
@@ -1486,6 +1486,8 @@ BuildAdmaDescTable (
   UINT32                AdmaMaxDataPerLine;
   UINT32                DescSize;
   VOID                  *AdmaDesc;
+  SD_MMC_HC_ADMA_POOL   *Pool;
+  EFI_TPL               OldTpl;
 
   AdmaMaxDataPerLine = ADMA_MAX_DATA_PER_LINE_16B;
   DescSize           = sizeof (SD_MMC_HC_ADMA_32_DESC_LINE);
@@ -1539,62 +1541,84 @@ BuildAdmaDescTable (
     AdmaMaxDataPerLine = ADMA_MAX_DATA_PER_LINE_26B;
   }
 
-  Entries        = DivU64x32 ((DataLen + AdmaMaxDataPerLine - 1), AdmaMaxDataPerLine);
-  TableSize      = (UINTN)MultU64x32 (Entries, DescSize);
-  Trb->AdmaPages = (UINT32)EFI_SIZE_TO_PAGES (TableSize);
-  Status         = PciIo->AllocateBuffer (
-                            PciIo,
-                            AllocateAnyPages,
-                            EfiBootServicesData,
-                            EFI_SIZE_TO_PAGES (TableSize),
-                            (VOID **)&AdmaDesc,
-                            0
-                            );
-  if (EFI_ERROR (Status)) {
-    return EFI_OUT_OF_RESOURCES;
+  Entries   = DivU64x32 ((DataLen + AdmaMaxDataPerLine - 1), AdmaMaxDataPerLine);
+  TableSize = (UINTN)MultU64x32 (Entries, DescSize);
+
+  //
+  // Use the table of the slot, which is already mapped, unless another transfer
+  // holds it or the transfer doesn't fit.
+  //
+  Pool   = &Trb->Private->AdmaPool[Trb->Slot];
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  if ((Pool->Desc != NULL) && !Pool->InUse &&
+      (TableSize <= EFI_PAGES_TO_SIZE (Pool->Pages)))
+  {
+    Pool->InUse       = TRUE;
+    Trb->AdmaFromPool = TRUE;
   }
 
-  ZeroMem (AdmaDesc, TableSize);
-  Bytes  = TableSize;
-  Status = PciIo->Map (
-                    PciIo,
-                    EfiPciIoOperationBusMasterCommonBuffer,
-                    AdmaDesc,
-                    &Bytes,
-                    &Trb->AdmaDescPhy,
-                    &Trb->AdmaMap
-                    );
+  gBS->RestoreTPL (OldTpl);
 
-  if (EFI_ERROR (Status) || (Bytes != TableSize)) {
-    //
-    // Map error or unable to map the whole RFis buffer into a contiguous region.
-    //
-    PciIo->FreeBuffer (
-             PciIo,
-             EFI_SIZE_TO_PAGES (TableSize),
-             AdmaDesc
-             );
-    return EFI_OUT_OF_RESOURCES;
-  }
+  if (Trb->AdmaFromPool) {
+    AdmaDesc         = Pool->Desc;
+    Trb->AdmaDescPhy = Pool->DescPhy;
+    ZeroMem (AdmaDesc, TableSize);
+  } else {
+    Trb->AdmaPages = (UINT32)EFI_SIZE_TO_PAGES (TableSize);
+    Status         = PciIo->AllocateBuffer (
+                              PciIo,
+                              AllocateAnyPages,
+                              EfiBootServicesData,
+                              EFI_SIZE_TO_PAGES (TableSize),
+                              (VOID **)&AdmaDesc,
+                              0
+                              );
+    if (EFI_ERROR (Status)) {
+      return EFI_OUT_OF_RESOURCES;
+    }
 
-  if ((Trb->Mode == SdMmcAdma32bMode) &&
-      ((UINT64)(UINTN)Trb->AdmaDescPhy > 0x100000000ul))
-  {
-    //
-    // The ADMA doesn't support 64bit addressing.
-    //
-    PciIo->Unmap (
-             PciIo,
-             Trb->AdmaMap
-             );
-    Trb->AdmaMap = NULL;
+    ZeroMem (AdmaDesc, TableSize);
+    Bytes  = TableSize;
+    Status = PciIo->Map (
+                      PciIo,
+                      EfiPciIoOperationBusMasterCommonBuffer,
+                      AdmaDesc,
+                      &Bytes,
+                      &Trb->AdmaDescPhy,
+                      &Trb->AdmaMap
+                      );
+
+    if (EFI_ERROR (Status) || (Bytes != TableSize)) {
+      //
+      // Map error or unable to map the whole RFis buffer into a contiguous region.
+      //
+      PciIo->FreeBuffer (
+               PciIo,
+               EFI_SIZE_TO_PAGES (TableSize),
+               AdmaDesc
+               );
+      return EFI_OUT_OF_RESOURCES;
+    }
 
-    PciIo->FreeBuffer (
-             PciIo,
-             EFI_SIZE_TO_PAGES (TableSize),
-             AdmaDesc
-             );
-    return EFI_DEVICE_ERROR;
+    if ((Trb->Mode == SdMmcAdma32bMode) &&
+        ((UINT64)(UINTN)Trb->AdmaDescPhy > 0x100000000ul))
+    {
+      //
+      // The ADMA doesn't support 64bit addressing.
+      //
+      PciIo->Unmap (
+               PciIo,
+               Trb->AdmaMap
+               );
+      Trb->AdmaMap = NULL;
+
+      PciIo->FreeBuffer (
+               PciIo,
+               EFI_SIZE_TO_PAGES (TableSize),
+               AdmaDesc
+               );
+      return EFI_DEVICE_ERROR;
+    }
   }
 
   Remaining = DataLen;
@@ -1774,6 +1798,7 @@ SdMmcPrintTrb (
   DEBUG ((DebugLevel, "Adma64V4Desc: %p\n", Trb->Adma64V4Desc));
   DEBUG ((DebugLevel, "AdmaMap: %p\n", Trb->AdmaMap));
   DEBUG ((DebugLevel, "AdmaPages: %X\n", Trb->AdmaPages));
+  DEBUG ((DebugLevel, "AdmaFromPool: %d\n", Trb->AdmaFromPool));
 
   SdMmcPrintPacket (DebugLevel, Trb->Packet);
 }
@@ -1953,6 +1978,109 @@ Error:
   return NULL;
 }
 
+/**
+  Allocate and map the ADMA descriptor table of a slot.
+
+  A slot without one allocates a table for each ADMA transfer.
+
+  @param[in] Private        A pointer to the SD_MMC_HC_PRIVATE_DATA instance.
+  @param[in] Slot           The slot number.
+
+  @retval EFI_SUCCESS           The table is allocated and mapped.
+  @retval EFI_UNSUPPORTED       The slot doesn't support ADMA2.
+  @retval EFI_OUT_OF_RESOURCES  The table can't be allocated or mapped.
+
+**/
+EFI_STATUS
+SdMmcHcAllocateAdmaPool (
+  IN SD_MMC_HC_PRIVATE_DATA  *Private,
+  IN UINT8                   Slot
+  )
+{
+  EFI_PCI_IO_PROTOCOL  *PciIo;
+  SD_MMC_HC_ADMA_POOL  *Pool;
+  UINTN                Bytes;
+  EFI_STATUS           Status;
+
+  if (Private->Capability[Slot].Adma2 == 0) {
+    return EFI_UNSUPPORTED;
+  }
+
+  PciIo = Private->PciIo;
+  Pool  = &Private->AdmaPool[Slot];
+
+  Status = PciIo->AllocateBuffer (
+                    PciIo,
+                    AllocateAnyPages,
+                    EfiBootServicesData,
+                    SD_MMC_HC_ADMA_POOL_PAGES,
+                    &Pool->Desc,
+                    0
+                    );
+  if (EFI_ERROR (Status)) {
+    Pool->Desc = NULL;
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Bytes  = EFI_PAGES_TO_SIZE (SD_MMC_HC_ADMA_POOL_PAGES);
+  Status = PciIo->Map (
+                    PciIo,
+                    EfiPciIoOperationBusMasterCommonBuffer,
+                    Pool->Desc,
+                    &Bytes,
+                    &Pool->DescPhy,
+                    &Pool->Map
+                    );
+  //
+  // The table is used in 32b ADMA mode too, so it must be below 4GB.
+  //
+  if (EFI_ERROR (Status) || (Bytes != EFI_PAGES_TO_SIZE (SD_MMC_HC_ADMA_POOL_PAGES)) ||
+      ((Pool->DescPhy + Bytes) > 0x100000000ul))
+  {
+    if (!EFI_ERROR (Status)) {
+      PciIo->Unmap (PciIo, Pool->Map);
+    }
+
+    PciIo->FreeBuffer (PciIo, SD_MMC_HC_ADMA_POOL_PAGES, Pool->Desc);
+    Pool->Desc = NULL;
+    Pool->Map  = NULL;
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Pool->Pages = SD_MMC_HC_ADMA_POOL_PAGES;
+  Pool->InUse = FALSE;
+  return EFI_SUCCESS;
+}
+
+/**
+  Unmap and free the ADMA descriptor tables of all slots.
+
+  @param[in] Private        A pointer to the SD_MMC_HC_PRIVATE_DATA instance.
+
+**/
+VOID
+SdMmcHcFreeAdmaPools (
+  IN SD_MMC_HC_PRIVATE_DATA  *Private
+  )
+{
+  EFI_PCI_IO_PROTOCOL  *PciIo;
+  SD_MMC_HC_ADMA_POOL  *Pool;
+  UINT8                Slot;
+
+  PciIo = Private->PciIo;
+  for (Slot = 0; Slot < SD_MMC_HC_MAX_SLOT; Slot++) {
+    Pool = &Private->AdmaPool[Slot];
+    if (Pool->Desc == NULL) {
+      continue;
+    }
+
+    PciIo->Unmap (PciIo, Pool->Map);
+    PciIo->FreeBuffer (PciIo, Pool->Pages, Pool->Desc);
+    Pool->Desc = NULL;
+    Pool->Map  = NULL;
+  }
+}
+
 /**
   Free the resource used by the TRB.
 
@@ -1965,38 +2093,48 @@ SdMmcFreeTrb (
   )
 {
   EFI_PCI_IO_PROTOCOL  *PciIo;
+  EFI_TPL              OldTpl;
 
   PciIo = Trb->Private->PciIo;
 
-  if (Trb->AdmaMap != NULL) {
-    PciIo->Unmap (
-             PciIo,
-             Trb->AdmaMap
-             );
-  }
+  if (Trb->AdmaFromPool) {
+    //
+    // The table stays mapped for the next transfer.
+    //
+    OldTpl                                  = gBS->RaiseTPL (TPL_NOTIFY);
+    Trb->Private->AdmaPool[Trb->Slot].InUse = FALSE;
+    gBS->RestoreTPL (OldTpl);
+  } else {
+    if (Trb->AdmaMap != NULL) {
+      PciIo->Unmap (
+               PciIo,
+               Trb->AdmaMap
+               );
+    }
 
-  if (Trb->Adma32Desc != NULL) {
-    PciIo->FreeBuffer (
-             PciIo,
-             Trb->AdmaPages,
-             Trb->Adma32Desc
-             );
-  }
+    if (Trb->Adma32Desc != NULL) {
+      PciIo->FreeBuffer (
+               PciIo,
+               Trb->AdmaPages,
+               Trb->Adma32Desc
+               );
+    }
 
-  if (Trb->Adma64V3Desc != NULL) {
-    PciIo->FreeBuffer (
-             PciIo,
-             Trb->AdmaPages,
-             Trb->Adma64V3Desc
-             );
-  }
+    if (Trb->Adma64V3Desc != NULL) {
+      PciIo->FreeBuffer (
+               PciIo,
+               Trb->AdmaPages,
+               Trb->Adma64V3Desc
+               );
+    }
 
-  if (Trb->Adma64V4Desc != NULL) {
-    PciIo->FreeBuffer (
-             PciIo,
-             Trb->AdmaPages,
-             Trb->Adma64V4Desc
-             );
+    if (Trb->Adma64V4Desc != NULL) {
+      PciIo->FreeBuffer (
+               PciIo,
+               Trb->AdmaPages,
+               Trb->Adma64V4Desc
+               );
+    }
   }
 
   if (Trb->DataMap != NULL) {
@@ -103,6 +103,12 @@ typedef enum {
 #define ADMA_MAX_DATA_PER_LINE_16B  SIZE_64KB
 #define ADMA_MAX_DATA_PER_LINE_26B  SIZE_64MB
 
+//
+// The size of the ADMA descriptor table that is allocated and mapped once for
+// each slot. A transfer that needs a longer table allocates its own.
+//
+#define SD_MMC_HC_ADMA_POOL_PAGES  4
+
 //
 // ADMA descriptor for 32b addressing.
 //
@@ -30,10 +30,21 @@ UsbHcAllocMemBlock (
   VOID                  *Mapping;
   EFI_PHYSICAL_ADDRESS  MappedAddr;
   UINTN                 Bytes;
+  UINTN                 ChunkSize;
   EFI_STATUS            Status;
 
   PciIo = Pool->PciIo;
 
+  //
+  // Grow the pool in whole chunks aligned to their size, if so configured,
+  // so that an IOMMU can map each chunk with one large page.
+  //
+  ChunkSize = PcdGet32 (PcdUsbHcMemChunkSize);
+  ASSERT ((ChunkSize & (ChunkSize - 1)) == 0);
+  if (ChunkSize > EFI_PAGE_SIZE) {
+    Pages = ALIGN_VALUE (Pages, EFI_SIZE_TO_PAGES (ChunkSize));
+  }
+
   Block = AllocateZeroPool (sizeof (USBHC_MEM_BLOCK));
   if (Block == NULL) {
     return NULL;
@@ -54,35 +65,42 @@ UsbHcAllocMemBlock (
     return NULL;
   }
 
-  //
-  // Allocate the number of Pages of memory, then map it for
-  // bus master read and write.
-  //
-  Status = PciIo->AllocateBuffer (
-                    PciIo,
-                    AllocateAnyPages,
-                    EfiBootServicesData,
-                    Pages,
-                    &BufHost,
-                    0
-                    );
+  if (ChunkSize > EFI_PAGE_SIZE) {
+    Status = UsbHcAllocateAlignedPages (PciIo, Pages, ChunkSize, &BufHost, &MappedAddr, &Mapping);
+    if (EFI_ERROR (Status)) {
+      goto FREE_BITARRAY;
+    }
+  } else {
+    //
+    // Allocate the number of Pages of memory, then map it for
+    // bus master read and write.
+    //
+    Status = PciIo->AllocateBuffer (
+                      PciIo,
+                      AllocateAnyPages,
+                      EfiBootServicesData,
+                      Pages,
+                      &BufHost,
+                      0
+                      );
 
-  if (EFI_ERROR (Status)) {
-    goto FREE_BITARRAY;
-  }
+    if (EFI_ERROR (Status)) {
+      goto FREE_BITARRAY;
+    }
 
-  Bytes  = EFI_PAGES_TO_SIZE (Pages);
-  Status = PciIo->Map (
-                    PciIo,
-                    EfiPciIoOperationBusMasterCommonBuffer,
-                    BufHost,
-                    &Bytes,
-                    &MappedAddr,
-                    &Mapping
-                    );
+    Bytes  = EFI_PAGES_TO_SIZE (Pages);
+    Status = PciIo->Map (
+                      PciIo,
+                      EfiPciIoOperationBusMasterCommonBuffer,
+                      BufHost,
+                      &Bytes,
+                      &MappedAddr,
+                      &Mapping
+                      );
 
-  if (EFI_ERROR (Status) || (Bytes != EFI_PAGES_TO_SIZE (Pages))) {
-    goto FREE_BUFFER;
+    if (EFI_ERROR (Status) || (Bytes != EFI_PAGES_TO_SIZE (Pages))) {
+      goto FREE_BUFFER;
+    }
   }
 
   Block->BufHost = BufHost;
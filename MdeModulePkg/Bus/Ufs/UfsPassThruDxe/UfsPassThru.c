@@ -45,6 +45,10 @@ UFS_PASS_THRU_PRIVATE_DATA  gUfsPassThruTemplate = {
   0,                                                                                                                                               // UtpTmrlBase
   0,                                                                                                                                               // Nutmrs
   0,                                                                                                                                               // TmrlMapping
+  0,                                                                                                                                               // CmdDescPool
+  0,                                                                                                                                               // CmdDescPoolPhyAddr
+  0,                                                                                                                                               // CmdDescPoolMapping
+  0,                                                                                                                                               // SlotsInUse
   {                               // Luns
     {
       UFS_LUN_0,                      // Ufs Common Lun 0
@@ -1067,6 +1071,14 @@ Error:
       UfsHc->FreeBuffer (UfsHc, EFI_SIZE_TO_PAGES (Private->Nutrs * sizeof (UTP_TMRD)), Private->UtpTrlBase);
     }
 
+    if (Private->CmdDescPoolMapping != NULL) {
+      UfsHc->Unmap (UfsHc, Private->CmdDescPoolMapping);
+    }
+
+    if (Private->CmdDescPool != NULL) {
+      UfsHc->FreeBuffer (UfsHc, EFI_SIZE_TO_PAGES (Private->Nutrs * UFS_CMD_DESC_POOL_SLOT_SIZE), Private->CmdDescPool);
+    }
+
     if (Private->TimerEvent != NULL) {
       gBS->CloseEvent (Private->TimerEvent);
     }
@@ -1200,6 +1212,14 @@ UfsPassThruDriverBindingStop (
     UfsHc->FreeBuffer (UfsHc, EFI_SIZE_TO_PAGES (Private->Nutrs * sizeof (UTP_TMRD)), Private->UtpTrlBase);
   }
 
+  if (Private->CmdDescPoolMapping != NULL) {
+    UfsHc->Unmap (UfsHc, Private->CmdDescPoolMapping);
+  }
+
+  if (Private->CmdDescPool != NULL) {
+    UfsHc->FreeBuffer (UfsHc, EFI_SIZE_TO_PAGES (Private->Nutrs * UFS_CMD_DESC_POOL_SLOT_SIZE), Private->CmdDescPool);
+  }
+
   if (Private->TimerEvent != NULL) {
     gBS->CloseEvent (Private->TimerEvent);
   }
@@ -68,6 +68,17 @@ typedef struct _UFS_PASS_THRU_PRIVATE_DATA {
   VOID                                  *UtpTmrlBase;
   UINT8                                 Nutmrs;
   VOID                                  *TmrlMapping;
+  //
+  // The command descriptors of all transfer request slots, mapped once.
+  //
+  VOID                                  *CmdDescPool;
+  EFI_PHYSICAL_ADDRESS                  CmdDescPoolPhyAddr;
+  VOID                                  *CmdDescPoolMapping;
+  //
+  // The transfer request slots that requests hold, including those whose
+  // doorbell is clear but whose completion is not processed yet.
+  //
+  UINT32                                SlotsInUse;
 
   UFS_EXPOSED_LUNS                      Luns;
 
@@ -106,6 +117,13 @@ typedef struct {
 
 #define ROUNDUP8(x)  (((x) % 8 == 0) ? (x) : ((x) / 8 + 1) * 8)
 
+//
+// The size of the command descriptor of each transfer request slot in the pool.
+// It holds the command and response UPIUs, and a PRDT for up to 62MB of data.
+// A request that needs more allocates a descriptor of its own.
+//
+#define UFS_CMD_DESC_POOL_SLOT_SIZE  SIZE_4KB
+
 #define UFS_PASS_THRU_PRIVATE_DATA_FROM_THIS(a) \
   CR (a, \
       UFS_PASS_THRU_PRIVATE_DATA, \
@@ -476,6 +476,79 @@ UfsInitQueryRequestUpiu (
   return EFI_SUCCESS;
 }
 
+/**
+  Get the command descriptor for a transfer request.
+
+  The descriptor of the slot of the request in the command descriptor pool is
+  used when it is large enough, so that it needs no mapping of its own.
+
+  @param[in]  Private           The pointer to the UFS_PASS_THRU_PRIVATE_DATA data structure.
+  @param[in]  Trd               The pointer to the UTP Transfer Request Descriptor.
+  @param[in]  Size              The length of the command descriptor.
+  @param[out] CmdDescHost       A pointer to store the base system memory address of the descriptor.
+  @param[out] CmdDescPhyAddr    The map address for the UFS bus master to use to access CmdDescHost.
+  @param[out] CmdDescMapping    A resulting value to pass to UfsFreeCmdDesc().
+
+  @retval EFI_SUCCESS           The descriptor is ready.
+  @retval EFI_DEVICE_ERROR      The allocation fails.
+  @retval EFI_OUT_OF_RESOURCES  The memory resource is insufficient.
+
+**/
+EFI_STATUS
+UfsAllocateCmdDesc (
+  IN     UFS_PASS_THRU_PRIVATE_DATA  *Private,
+  IN     UTP_TRD                     *Trd,
+  IN     UINTN                       Size,
+  OUT VOID                           **CmdDescHost,
+  OUT EFI_PHYSICAL_ADDRESS           *CmdDescPhyAddr,
+  OUT VOID                           **CmdDescMapping
+  )
+{
+  UINTN  Offset;
+
+  if ((Private->CmdDescPool != NULL) && (Size <= UFS_CMD_DESC_POOL_SLOT_SIZE)) {
+    Offset          = (UINTN)(Trd - (UTP_TRD *)Private->UtpTrlBase) * UFS_CMD_DESC_POOL_SLOT_SIZE;
+    *CmdDescHost    = (UINT8 *)Private->CmdDescPool + Offset;
+    *CmdDescPhyAddr = Private->CmdDescPoolPhyAddr + Offset;
+    *CmdDescMapping = NULL;
+    ZeroMem (*CmdDescHost, Size);
+    return EFI_SUCCESS;
+  }
+
+  return UfsAllocateAlignCommonBuffer (Private, Size, CmdDescHost, CmdDescPhyAddr, CmdDescMapping);
+}
+
+/**
+  Release the command descriptor of a transfer request.
+
+  A descriptor in the pool has no mapping of its own, and stays for the next
+  request on the slot.
+
+  @param[in]  Private           The pointer to the UFS_PASS_THRU_PRIVATE_DATA data structure.
+  @param[in]  CmdDescHost       The base system memory address of the descriptor.
+  @param[in]  Size              The length of the command descriptor.
+  @param[in]  CmdDescMapping    The value returned by UfsAllocateCmdDesc().
+
+**/
+VOID
+UfsFreeCmdDesc (
+  IN UFS_PASS_THRU_PRIVATE_DATA  *Private,
+  IN VOID                        *CmdDescHost,
+  IN UINTN                       Size,
+  IN VOID                        *CmdDescMapping
+  )
+{
+  EDKII_UFS_HOST_CONTROLLER_PROTOCOL  *UfsHc;
+
+  if ((CmdDescHost == NULL) || (CmdDescMapping == NULL)) {
+    return;
+  }
+
+  UfsHc = Private->UfsHostController;
+  UfsHc->Unmap (UfsHc, CmdDescMapping);
+  UfsHc->FreeBuffer (UfsHc, EFI_SIZE_TO_PAGES (Size), CmdDescHost);
+}
+
 /**
   Allocate COMMAND/RESPONSE UPIU for filling UTP TRD's command descriptor field.
 
@@ -527,7 +600,7 @@ UfsCreateScsiCommandDesc (
 
   TotalLen = ROUNDUP8 (sizeof (UTP_COMMAND_UPIU)) + ROUNDUP8 (sizeof (UTP_RESPONSE_UPIU)) + PrdtNumber * sizeof (UTP_TR_PRD);
 
-  Status = UfsAllocateAlignCommonBuffer (Private, TotalLen, CmdDescHost, &CmdDescPhyAddr, CmdDescMapping);
+  Status = UfsAllocateCmdDesc (Private, Trd, TotalLen, CmdDescHost, &CmdDescPhyAddr, CmdDescMapping);
   if (EFI_ERROR (Status)) {
     return Status;
   }
@@ -608,7 +681,7 @@ UfsCreateDMCommandDesc (
     TotalLen = ROUNDUP8 (sizeof (UTP_QUERY_REQ_UPIU)) + ROUNDUP8 (sizeof (UTP_QUERY_RESP_UPIU));
   }
 
-  Status = UfsAllocateAlignCommonBuffer (Private, TotalLen, CmdDescHost, &CmdDescPhyAddr, CmdDescMapping);
+  Status = UfsAllocateCmdDesc (Private, Trd, TotalLen, CmdDescHost, &CmdDescPhyAddr, CmdDescMapping);
   if (EFI_ERROR (Status)) {
     return Status;
   }
@@ -679,7 +752,7 @@ UfsCreateNopCommandDesc (
   ASSERT ((Private != NULL) && (Trd != NULL));
 
   TotalLen = ROUNDUP8 (sizeof (UTP_NOP_OUT_UPIU)) + ROUNDUP8 (sizeof (UTP_NOP_IN_UPIU));
-  Status   = UfsAllocateAlignCommonBuffer (Private, TotalLen, CmdDescHost, &CmdDescPhyAddr, CmdDescMapping);
+  Status   = UfsAllocateCmdDesc (Private, Trd, TotalLen, CmdDescHost, &CmdDescPhyAddr, CmdDescMapping);
   if (EFI_ERROR (Status)) {
     return Status;
   }
@@ -705,7 +778,11 @@ UfsCreateNopCommandDesc (
 }
 
 /**
-  Find out available slot in transfer list of a UFS device.
+  Find out available slot in transfer list of a UFS device, and hold it until
+  UfsReleaseSlotInTrl() is called.
+
+  A slot is held from before its doorbell is rung until its completion is
+  processed, so that requests that are outstanding together each own a slot.
 
   @param[in]  Private       The pointer to the UFS_PASS_THRU_PRIVATE_DATA data structure.
   @param[out] Slot          The available slot.
@@ -724,6 +801,7 @@ UfsFindAvailableSlotInTrl (
   UINT8       Index;
   UINT32      Data;
   EFI_STATUS  Status;
+  EFI_TPL     OldTpl;
 
   ASSERT ((Private != NULL) && (Slot != NULL));
 
@@ -732,16 +810,42 @@ UfsFindAvailableSlotInTrl (
     return Status;
   }
 
-  Nutrs = (UINT8)((Private->UfsHcInfo.Capabilities & UFS_HC_CAP_NUTRS) + 1);
+  Nutrs  = (UINT8)((Private->UfsHcInfo.Capabilities & UFS_HC_CAP_NUTRS) + 1);
+  Status = EFI_NOT_READY;
 
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
   for (Index = 0; Index < Nutrs; Index++) {
-    if ((Data & (BIT0 << Index)) == 0) {
-      *Slot = Index;
-      return EFI_SUCCESS;
+    if (((Data | Private->SlotsInUse) & (BIT0 << Index)) == 0) {
+      Private->SlotsInUse |= BIT0 << Index;
+      *Slot                = Index;
+      Status               = EFI_SUCCESS;
+      break;
     }
   }
 
-  return EFI_NOT_READY;
+  gBS->RestoreTPL (OldTpl);
+
+  return Status;
+}
+
+/**
+  Release a slot that UfsFindAvailableSlotInTrl() found.
+
+  @param[in]  Private       The pointer to the UFS_PASS_THRU_PRIVATE_DATA data structure.
+  @param[in]  Slot          The slot to be released.
+
+**/
+VOID
+UfsReleaseSlotInTrl (
+  IN  UFS_PASS_THRU_PRIVATE_DATA  *Private,
+  IN  UINT8                       Slot
+  )
+{
+  EFI_TPL  OldTpl;
+
+  OldTpl               = gBS->RaiseTPL (TPL_NOTIFY);
+  Private->SlotsInUse &= ~(UINT32)(BIT0 << Slot);
+  gBS->RestoreTPL (OldTpl);
 }
 
 /**
@@ -924,6 +1028,7 @@ UfsSendDmRequestRetry (
   Status = UfsCreateDMCommandDesc (Private, Packet, Trd, &CmdDescHost, &CmdDescMapping);
   if (EFI_ERROR (Status)) {
     DEBUG ((DEBUG_ERROR, "Failed to create DM command descriptor\n"));
+    UfsReleaseSlotInTrl (Private, Slot);
     return Status;
   }
 
@@ -940,7 +1045,7 @@ UfsSendDmRequestRetry (
   //
   // Wait for the completion of the transfer request.
   //
-  Status = UfsWaitMemSet (Private, UFS_HC_UTRLDBR_OFFSET, BIT0, 0, Packet->Timeout);
+  Status = UfsWaitMemSet (Private, UFS_HC_UTRLDBR_OFFSET, BIT0 << Slot, 0, Packet->Timeout);
   if (EFI_ERROR (Status)) {
     goto Exit;
   }
@@ -972,13 +1077,8 @@ Exit:
 
   UfsStopExecCmd (Private, Slot);
 
-  if (CmdDescMapping != NULL) {
-    UfsHc->Unmap (UfsHc, CmdDescMapping);
-  }
-
-  if (CmdDescHost != NULL) {
-    UfsHc->FreeBuffer (UfsHc, EFI_SIZE_TO_PAGES (CmdDescSize), CmdDescHost);
-  }
+  UfsFreeCmdDesc (Private, CmdDescHost, CmdDescSize, CmdDescMapping);
+  UfsReleaseSlotInTrl (Private, Slot);
 
   return Status;
 }
@@ -1275,6 +1375,7 @@ UfsExecNopCmds (
   Trd    = ((UTP_TRD *)Private->UtpTrlBase) + Slot;
   Status = UfsCreateNopCommandDesc (Private, Trd, &CmdDescHost, &CmdDescMapping);
   if (EFI_ERROR (Status)) {
+    UfsReleaseSlotInTrl (Private, Slot);
     return Status;
   }
 
@@ -1310,13 +1411,8 @@ Exit:
 
   UfsStopExecCmd (Private, Slot);
 
-  if (CmdDescMapping != NULL) {
-    UfsHc->Unmap (UfsHc, CmdDescMapping);
-  }
-
-  if (CmdDescHost != NULL) {
-    UfsHc->FreeBuffer (UfsHc, EFI_SIZE_TO_PAGES (CmdDescSize), CmdDescHost);
-  }
+  UfsFreeCmdDesc (Private, CmdDescHost, CmdDescSize, CmdDescMapping);
+  UfsReleaseSlotInTrl (Private, Slot);
 
   return Status;
 }
@@ -1519,6 +1615,7 @@ UfsExecScsiCmds (
   //
   Status = UfsFindAvailableSlotInTrl (Private, &TransReq->Slot);
   if (EFI_ERROR (Status)) {
+    FreePool (TransReq);
     return Status;
   }
 
@@ -1536,7 +1633,7 @@ UfsExecScsiCmds (
              &TransReq->CmdDescMapping
              );
   if (EFI_ERROR (Status)) {
-    return Status;
+    goto Exit1;
   }
 
   TransReq->CmdDescSize = TransReq->Trd->PrdtO * sizeof (UINT32) + TransReq->Trd->PrdtL * sizeof (UTP_TR_PRD);
@@ -1632,13 +1729,8 @@ Exit:
   UfsReconcileDataTransferBuffer (Private, TransReq);
 
 Exit1:
-  if (TransReq->CmdDescMapping != NULL) {
-    UfsHc->Unmap (UfsHc, TransReq->CmdDescMapping);
-  }
-
-  if (TransReq->CmdDescHost != NULL) {
-    UfsHc->FreeBuffer (UfsHc, EFI_SIZE_TO_PAGES (TransReq->CmdDescSize), TransReq->CmdDescHost);
-  }
+  UfsFreeCmdDesc (Private, TransReq->CmdDescHost, TransReq->CmdDescSize, TransReq->CmdDescMapping);
+  UfsReleaseSlotInTrl (Private, TransReq->Slot);
 
   if (TransReq != NULL) {
     FreePool (TransReq);
@@ -2105,6 +2197,21 @@ UfsInitTransferRequestList (
   Private->Nutrs      = Nutrs;
   Private->TrlMapping = CmdDescMapping;
 
+  //
+  // Map a command descriptor for each slot once. Without them, each request
+  // allocates and maps its own.
+  //
+  Status = UfsAllocateAlignCommonBuffer (Private, Nutrs * UFS_CMD_DESC_POOL_SLOT_SIZE, &CmdDescHost, &CmdDescPhyAddr, &CmdDescMapping);
+  if (!EFI_ERROR (Status)) {
+    Private->CmdDescPool        = CmdDescHost;
+    Private->CmdDescPoolPhyAddr = CmdDescPhyAddr;
+    Private->CmdDescPoolMapping = CmdDescMapping;
+  } else {
+    DEBUG ((DEBUG_WARN, "UfsInitTransferRequestList: No command descriptor pool - %r\n", Status));
+  }
+
+  Private->SlotsInUse = 0;
+
   //
   // Enable the UTP Transfer Request List by setting the UTP Transfer Request List
   // RunStop Register (UTRLRSR) to '1'.
@@ -2257,17 +2364,8 @@ SignalCallerEvent (
 
   UfsReconcileDataTransferBuffer (Private, TransReq);
 
-  if (TransReq->CmdDescMapping != NULL) {
-    UfsHc->Unmap (UfsHc, TransReq->CmdDescMapping);
-  }
-
-  if (TransReq->CmdDescHost != NULL) {
-    UfsHc->FreeBuffer (
-             UfsHc,
-             EFI_SIZE_TO_PAGES (TransReq->CmdDescSize),
-             TransReq->CmdDescHost
-             );
-  }
+  UfsFreeCmdDesc (Private, TransReq->CmdDescHost, TransReq->CmdDescSize, TransReq->CmdDescMapping);
+  UfsReleaseSlotInTrl (Private, TransReq->Slot);
 
   FreePool (TransReq);
 
@@ -45,6 +45,8 @@ SPDX-License-Identifier: BSD-2-Clause-Patent
 #include <Protocol/HiiPackageList.h>
 #include <Protocol/SmmBase2.h>
 #include <Protocol/PeCoffImageEmulator.h>
+#include <Protocol/TicklessTimer.h>
+#include <Protocol/PageTableTransaction.h>
 #include <Protocol/MemoryAttribute.h>
 #include <Guid/MemoryTypeInformation.h>
 #include <Guid/FirmwareFileSystem2.h>
@@ -242,16 +244,18 @@ extern BOOLEAN  gMemoryMapTerminated;
 
 extern EFI_DECOMPRESS_PROTOCOL  gEfiDecompress;
 
-extern EFI_RUNTIME_ARCH_PROTOCOL         *gRuntime;
-extern EFI_CPU_ARCH_PROTOCOL             *gCpu;
-extern EFI_WATCHDOG_TIMER_ARCH_PROTOCOL  *gWatchdogTimer;
-extern EFI_METRONOME_ARCH_PROTOCOL       *gMetronome;
-extern EFI_TIMER_ARCH_PROTOCOL           *gTimer;
-extern EFI_SECURITY_ARCH_PROTOCOL        *gSecurity;
-extern EFI_SECURITY2_ARCH_PROTOCOL       *gSecurity2;
-extern EFI_BDS_ARCH_PROTOCOL             *gBds;
-extern EFI_SMM_BASE2_PROTOCOL            *gSmmBase2;
-extern EFI_MEMORY_ATTRIBUTE_PROTOCOL     *gMemoryAttributeProtocol;
+extern EFI_RUNTIME_ARCH_PROTOCOL              *gRuntime;
+extern EFI_CPU_ARCH_PROTOCOL                  *gCpu;
+extern EFI_WATCHDOG_TIMER_ARCH_PROTOCOL       *gWatchdogTimer;
+extern EFI_METRONOME_ARCH_PROTOCOL            *gMetronome;
+extern EFI_TIMER_ARCH_PROTOCOL                *gTimer;
+extern EFI_SECURITY_ARCH_PROTOCOL             *gSecurity;
+extern EFI_SECURITY2_ARCH_PROTOCOL            *gSecurity2;
+extern EFI_BDS_ARCH_PROTOCOL                  *gBds;
+extern EFI_SMM_BASE2_PROTOCOL                 *gSmmBase2;
+extern EDKII_TICKLESS_TIMER_PROTOCOL          *gTicklessTimer;
+extern EDKII_PAGE_TABLE_TRANSACTION_PROTOCOL  *gPageTableTransaction;
+extern EFI_MEMORY_ATTRIBUTE_PROTOCOL          *gMemoryAttributeProtocol;
 
 extern EFI_TPL  gEfiCurrentTpl;
 
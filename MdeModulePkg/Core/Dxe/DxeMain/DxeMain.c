@@ -27,7 +27,9 @@ EFI_WATCHDOG_TIMER_ARCH_PROTOCOL  *gWatchdogTimer = NULL;
 //
 // DXE Core globals for optional protocol dependencies
 //
-EFI_SMM_BASE2_PROTOCOL  *gSmmBase2 = NULL;
+EFI_SMM_BASE2_PROTOCOL                 *gSmmBase2             = NULL;
+EDKII_TICKLESS_TIMER_PROTOCOL          *gTicklessTimer        = NULL;
+EDKII_PAGE_TABLE_TRANSACTION_PROTOCOL  *gPageTableTransaction = NULL;
 
 //
 // DXE Core Global used to update core loaded image protocol handle
@@ -64,6 +64,9 @@ CoreInsertEventTimer (
 /**
   Returns the current system time.
 
+  A tickless timer may not have interrupted for a while, so the time elapsed
+  since it last did is included.
+
   @return The current system time
 
 **/
@@ -76,11 +79,48 @@ CoreCurrentSystemTime (
 
   CoreAcquireLock (&mEfiSystemTimeLock);
   SystemTime = mEfiSystemTime;
+  if (gTicklessTimer != NULL) {
+    SystemTime += gTicklessTimer->GetElapsedTime (gTicklessTimer);
+  }
+
   CoreReleaseLock (&mEfiSystemTimeLock);
 
   return SystemTime;
 }
 
+/**
+  Tells a tickless timer when the earliest timer event is due.
+
+  @param  SystemTime             The current system time
+
+**/
+STATIC
+VOID
+CoreSetNextTimerEvent (
+  IN UINT64  SystemTime
+  )
+{
+  IEVENT  *Event;
+  UINT64  Timeout;
+
+  ASSERT_LOCKED (&mEfiTimerLock);
+
+  if (gTicklessTimer == NULL) {
+    return;
+  }
+
+  Timeout = MAX_UINT64;
+  if (!IsListEmpty (&mEfiTimerList)) {
+    Event   = CR (mEfiTimerList.ForwardLink, IEVENT, Timer.Link, EVENT_SIGNATURE);
+    Timeout = 0;
+    if (Event->Timer.TriggerTime > SystemTime) {
+      Timeout = Event->Timer.TriggerTime - SystemTime;
+    }
+  }
+
+  gTicklessTimer->SetNextEvent (gTicklessTimer, Timeout);
+}
+
 /**
   Checks the sorted timer list against the current system time.
   Signals any expired event timer.
@@ -151,6 +191,7 @@ CoreCheckTimers (
     }
   }
 
+  CoreSetNextTimerEvent (SystemTime);
   CoreReleaseLock (&mEfiTimerLock);
 }
 
@@ -240,6 +281,7 @@ CoreSetTimer (
   )
 {
   IEVENT  *Event;
+  UINT64  SystemTime;
 
   Event = UserEvent;
 
@@ -267,6 +309,7 @@ CoreSetTimer (
 
   Event->Timer.TriggerTime = 0;
   Event->Timer.Period      = 0;
+  SystemTime               = CoreCurrentSystemTime ();
 
   if (Type != TimerCancel) {
     if (Type == TimerPeriodic) {
@@ -277,7 +320,7 @@ CoreSetTimer (
       Event->Timer.Period = TriggerTime;
     }
 
-    Event->Timer.TriggerTime = CoreCurrentSystemTime () + TriggerTime;
+    Event->Timer.TriggerTime = SystemTime + TriggerTime;
     CoreInsertEventTimer (Event);
 
     if (TriggerTime == 0) {
@@ -285,6 +328,7 @@ CoreSetTimer (
     }
   }
 
+  CoreSetNextTimerEvent (SystemTime);
   CoreReleaseLock (&mEfiTimerLock);
 
   return EFI_SUCCESS;
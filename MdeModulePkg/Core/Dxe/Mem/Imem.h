@@ -17,6 +17,7 @@ SPDX-License-Identifier: BSD-2-Clause-Patent
 typedef struct {
   UINTN              Signature;
   LIST_ENTRY         Link;
+  LIST_ENTRY         FreeLink;
   BOOLEAN            FromPages;
 
   EFI_MEMORY_TYPE    Type;
@@ -45,6 +45,10 @@ UINTN       mFreeMapStack = 0;
 ///
 LIST_ENTRY  mFreeMemoryMapEntryList           = INITIALIZE_LIST_HEAD_VARIABLE (mFreeMemoryMapEntryList);
 BOOLEAN     mMemoryTypeInformationInitialized = FALSE;
+///
+/// This list indexes the descriptors that pages can be allocated from, by descending address
+///
+LIST_ENTRY  mFreePageRanges = INITIALIZE_LIST_HEAD_VARIABLE (mFreePageRanges);
 
 EFI_MEMORY_TYPE_STATISTICS  mMemoryTypeStatistics[EfiMaxMemoryType + 1] = {
   { 0, MAX_ALLOC_ADDRESS, 0, 0, EfiMaxMemoryType, TRUE,  FALSE },  // EfiReservedMemoryType
@@ -119,6 +123,60 @@ CoreReleaseMemoryLock (
   CoreReleaseLock (&gMemoryLock);
 }
 
+/**
+  Internal function.  Adds a descriptor entry to mFreePageRanges, if pages can
+  be allocated from it.
+
+  @param  Entry                  The entry to add
+
+**/
+STATIC
+VOID
+InsertFreePageRange (
+  IN OUT MEMORY_MAP  *Entry
+  )
+{
+  LIST_ENTRY  *Link;
+  MEMORY_MAP  *Entry2;
+
+  Entry->FreeLink.ForwardLink = NULL;
+
+  //
+  // Don't allocate out of Special-Purpose memory.
+  //
+  if ((Entry->Type != EfiConventionalMemory) || ((Entry->Attribute & EFI_MEMORY_SP) != 0)) {
+    return;
+  }
+
+  for (Link = mFreePageRanges.ForwardLink; Link != &mFreePageRanges; Link = Link->ForwardLink) {
+    Entry2 = CR (Link, MEMORY_MAP, FreeLink, MEMORY_MAP_SIGNATURE);
+    if (Entry2->Start < Entry->Start) {
+      break;
+    }
+  }
+
+  InsertTailList (Link, &Entry->FreeLink);
+}
+
+/**
+  Internal function.  Removes a descriptor entry from mFreePageRanges, if it is
+  in it.
+
+  @param  Entry                  The entry to remove
+
+**/
+STATIC
+VOID
+RemoveFreePageRange (
+  IN OUT MEMORY_MAP  *Entry
+  )
+{
+  if (Entry->FreeLink.ForwardLink != NULL) {
+    RemoveEntryList (&Entry->FreeLink);
+    Entry->FreeLink.ForwardLink = NULL;
+  }
+}
+
 /**
   Internal function.  Removes a descriptor entry.
 
@@ -130,6 +188,7 @@ RemoveMemoryMapEntry (
   IN OUT MEMORY_MAP  *Entry
   )
 {
+  RemoveFreePageRange (Entry);
   RemoveEntryList (&Entry->Link);
   Entry->Link.ForwardLink = NULL;
 
@@ -244,6 +303,7 @@ CoreAddRange (
   mMapStack[mMapDepth].VirtualStart = 0;
   mMapStack[mMapDepth].Attribute    = Attribute;
   InsertTailList (&gMemoryMap, &mMapStack[mMapDepth].Link);
+  InsertFreePageRange (&mMapStack[mMapDepth]);
 
   mMapDepth += 1;
   ASSERT (mMapDepth < MAX_MAP_DEPTH);
@@ -350,11 +410,13 @@ CoreFreeMemoryMapStack (
       //
       // Move this entry to general memory
       //
+      RemoveFreePageRange (&mMapStack[mMapDepth]);
       RemoveEntryList (&mMapStack[mMapDepth].Link);
       mMapStack[mMapDepth].Link.ForwardLink = NULL;
 
       CopyMem (Entry, &mMapStack[mMapDepth], sizeof (MEMORY_MAP));
       Entry->FromPages = TRUE;
+      InsertFreePageRange (Entry);
 
       //
       // Find insertion location
@@ -808,6 +870,50 @@ CoreAddMemoryDescriptor (
   mMemoryTypeInformationInitialized = TRUE;
 }
 
+/**
+  Internal function.  Finds the descriptor entry that covers an address.
+
+  @param  Address                The address
+  @param  Free                   TRUE if the address is expected to be free, so
+                                 mFreePageRanges is searched before the memory map
+
+  @return The entry that covers the address, or NULL if there is none
+
+**/
+STATIC
+MEMORY_MAP *
+FindMemoryMapEntry (
+  IN UINT64   Address,
+  IN BOOLEAN  Free
+  )
+{
+  LIST_ENTRY  *Link;
+  MEMORY_MAP  *Entry;
+
+  if (Free) {
+    for (Link = mFreePageRanges.ForwardLink; Link != &mFreePageRanges; Link = Link->ForwardLink) {
+      Entry = CR (Link, MEMORY_MAP, FreeLink, MEMORY_MAP_SIGNATURE);
+      if (Entry->Start <= Address) {
+        if (Entry->End > Address) {
+          return Entry;
+        }
+
+        break;
+      }
+    }
+  }
+
+  for (Link = gMemoryMap.ForwardLink; Link != &gMemoryMap; Link = Link->ForwardLink) {
+    Entry = CR (Link, MEMORY_MAP, Link, MEMORY_MAP_SIGNATURE);
+
+    if ((Entry->Start <= Address) && (Entry->End > Address)) {
+      return Entry;
+    }
+  }
+
+  return NULL;
+}
+
 /**
   Internal function.  Converts a memory range to the specified type or attributes.
   The range must exist in the memory map.  Either ChangingType or
@@ -843,7 +949,6 @@ CoreConvertPagesEx (
   UINT64           RangeEnd;
   UINT64           Attribute;
   EFI_MEMORY_TYPE  MemType;
-  LIST_ENTRY       *Link;
   MEMORY_MAP       *Entry;
 
   Entry         = NULL;
@@ -868,15 +973,8 @@ CoreConvertPagesEx (
     //
     // Find the entry that the covers the range
     //
-    for (Link = gMemoryMap.ForwardLink; Link != &gMemoryMap; Link = Link->ForwardLink) {
-      Entry = CR (Link, MEMORY_MAP, Link, MEMORY_MAP_SIGNATURE);
-
-      if ((Entry->Start <= Start) && (Entry->End > Start)) {
-        break;
-      }
-    }
-
-    if (Link == &gMemoryMap) {
+    Entry = FindMemoryMapEntry (Start, ChangingType && (NewType != EfiConventionalMemory));
+    if (Entry == NULL) {
       DEBUG ((DEBUG_ERROR | DEBUG_PAGE, "ConvertPages: failed to find range %lx - %lx\n", Start, End));
       return EFI_NOT_FOUND;
     }
@@ -991,6 +1089,7 @@ CoreConvertPagesEx (
 
       Entry = &mMapStack[mMapDepth];
       InsertTailList (&gMemoryMap, &Entry->Link);
+      InsertFreePageRange (Entry);
 
       mMapDepth += 1;
       ASSERT (mMapDepth < MAX_MAP_DEPTH);
@@ -1173,30 +1272,25 @@ CoreFindFreePagesI (
   NumberOfBytes = LShiftU64 (NumberOfPages, EFI_PAGE_SHIFT);
   Target        = 0;
 
-  for (Link = gMemoryMap.ForwardLink; Link != &gMemoryMap; Link = Link->ForwardLink) {
-    Entry = CR (Link, MEMORY_MAP, Link, MEMORY_MAP_SIGNATURE);
-
-    //
-    // If it's not a free entry, don't bother with it
-    //
-    if (Entry->Type != EfiConventionalMemory) {
-      continue;
-    }
-
-    //
-    // Don't allocate out of Special-Purpose memory.
-    //
-    if ((Entry->Attribute & EFI_MEMORY_SP) != 0) {
-      continue;
-    }
+  //
+  // Only the free entries are walked, from the top down, so the first match is the
+  // highest one, and the walk ends there.
+  //
+  for (Link = mFreePageRanges.ForwardLink; Link != &mFreePageRanges; Link = Link->ForwardLink) {
+    Entry = CR (Link, MEMORY_MAP, FreeLink, MEMORY_MAP_SIGNATURE);
 
     DescStart = Entry->Start;
     DescEnd   = Entry->End;
 
     //
-    // If desc is past max allowed address or below min allowed address, skip it
+    // If desc is past max allowed address, skip it. If it is below min allowed
+    // address, so are all the remaining ones.
     //
-    if ((DescStart >= MaxAddress) || (DescEnd < MinAddress)) {
+    if (DescEnd < MinAddress) {
+      break;
+    }
+
+    if (DescStart >= MaxAddress) {
       continue;
     }
 
@@ -1229,22 +1323,21 @@ CoreFindFreePagesI (
       }
 
       //
-      // If this is the best match so far remember it
+      // This is the best match
       //
-      if (DescEnd > Target) {
-        if (NeedGuard) {
-          DescEnd = AdjustMemoryS (
-                      DescEnd + 1 - DescNumberOfBytes,
-                      DescNumberOfBytes,
-                      NumberOfBytes
-                      );
-          if (DescEnd == 0) {
-            continue;
-          }
+      if (NeedGuard) {
+        DescEnd = AdjustMemoryS (
+                    DescEnd + 1 - DescNumberOfBytes,
+                    DescNumberOfBytes,
+                    NumberOfBytes
+                    );
+        if (DescEnd == 0) {
+          continue;
         }
-
-        Target = DescEnd;
       }
+
+      Target = DescEnd;
+      break;
     }
   }
 
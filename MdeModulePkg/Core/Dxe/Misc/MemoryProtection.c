@@ -328,6 +328,15 @@ SetUefiImageProtectionAttributes (
   CurrentBase = ImageRecord->ImageBase;
   ImageEnd    = ImageRecord->ImageBase + ImageRecord->ImageSize;
 
+  //
+  // The updates of the sections share one flush of the CPU translations. The
+  // image doesn't run before it is protected, so a stale translation that
+  // still gives access until the commit is harmless.
+  //
+  if (gPageTableTransaction != NULL) {
+    gPageTableTransaction->Begin (gPageTableTransaction);
+  }
+
   ImageRecordCodeSectionLink    = ImageRecordCodeSectionList->ForwardLink;
   ImageRecordCodeSectionEndLink = ImageRecordCodeSectionList;
   while (ImageRecordCodeSectionLink != ImageRecordCodeSectionEndLink) {
@@ -377,6 +386,10 @@ SetUefiImageProtectionAttributes (
       );
   }
 
+  if (gPageTableTransaction != NULL) {
+    gPageTableTransaction->Commit (gPageTableTransaction);
+  }
+
   return;
 }
 
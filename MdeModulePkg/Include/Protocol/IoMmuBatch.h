@@ -0,0 +1,290 @@
+/** @file
+  EDKII IOMMU Batch Protocol.
+
+  A companion to the IOMMU protocol, produced by the same driver, which maps
+  and unmaps a scatter-gather list of buffers for one device in one call.
+  The IOMMU's invalidations for the whole list complete together, instead of
+  once per Map(), SetAttribute() and Unmap().
+
+  A list may also be mapped at one contiguous device address, so that a
+  controller can address it with a single descriptor.
+
+  The asynchronous services return as soon as the IOMMU was told about the
+  change, and signal a token once it took effect, so that a driver can
+  prepare its next request while the IOMMU completes the previous one.
+
+Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef __IOMMU_BATCH_H__
+#define __IOMMU_BATCH_H__
+
+#include <Protocol/IoMmu.h>
+
+//
+// IOMMU Batch Protocol GUID value
+//
+#define EDKII_IOMMU_BATCH_PROTOCOL_GUID \
+    { \
+      0xf801ad92, 0xfd44, 0x4fb9, { 0xbb, 0x5b, 0x72, 0x2b, 0x89, 0x7a, 0xa5, 0xe1 } \
+    }
+
+//
+// Forward reference for pure ANSI compatability
+//
+typedef struct _EDKII_IOMMU_BATCH_PROTOCOL EDKII_IOMMU_BATCH_PROTOCOL;
+
+//
+// Revision The revision to which the IOMMU batch interface adheres.
+//          All future revisions must be backwards compatible.
+//          If a future version is not back wards compatible it is not the same GUID.
+//
+#define EDKII_IOMMU_BATCH_PROTOCOL_REVISION  0x00010002
+
+///
+/// A buffer of a scatter-gather list.
+///
+typedef struct {
+  ///
+  /// On input, the system memory address of the buffer.
+  ///
+  VOID                    *HostAddress;
+  ///
+  /// On input, the number of bytes to map. On output, the number of bytes that were mapped.
+  ///
+  UINTN                   NumberOfBytes;
+  ///
+  /// On output, the address the device uses to access the buffer.
+  ///
+  EFI_PHYSICAL_ADDRESS    DeviceAddress;
+  ///
+  /// On output, the mapping value to pass to UnmapMultiple(), or to Unmap() of the IOMMU protocol.
+  /// MapContiguous() sets it to NULL, as its buffers share one mapping.
+  ///
+  VOID                    *Mapping;
+} EDKII_IOMMU_BATCH_ENTRY;
+
+///
+/// The completion token of an asynchronous service.
+///
+typedef struct {
+  ///
+  /// Signalled once the service completed. The token must stay valid until then.
+  ///
+  EFI_EVENT     Event;
+  ///
+  /// Set before Event is signalled: EFI_SUCCESS once the change took effect, or
+  /// EFI_DEVICE_ERROR if the IOMMU reported an error while completing it.
+  ///
+  EFI_STATUS    TransactionStatus;
+} EDKII_IOMMU_BATCH_TOKEN;
+
+/**
+  Map every buffer of a scatter-gather list for a device, and grant the device access to them,
+  as Map() and SetAttribute() of the IOMMU protocol do for each.
+
+  The list is mapped as a whole: if a buffer cannot be mapped, the ones before it are
+  unmapped again, and no entry holds a mapping on return.
+
+  @param[in]      This             The protocol instance pointer.
+  @param[in]      DeviceHandle     The device that does the DMA.
+  @param[in]      Operation        Indicates if the bus master is going to read or write to system memory.
+  @param[in]      IoMmuAccess      The IOMMU access to grant to every buffer.
+  @param[in]      NumberOfEntries  The number of buffers of the list.
+  @param[in, out] Entries          The buffers of the list.
+
+  @retval EFI_SUCCESS            Every buffer was mapped for its returned NumberOfBytes.
+  @retval EFI_INVALID_PARAMETER  One or more parameters are invalid.
+  @retval EFI_UNSUPPORTED        DeviceHandle is unknown by the IOMMU, or a buffer cannot be mapped.
+  @retval EFI_OUT_OF_RESOURCES   The request could not be completed due to a lack of resources.
+  @retval EFI_DEVICE_ERROR       The IOMMU device reported an error while attempting the operation.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EDKII_IOMMU_MAP_MULTIPLE)(
+  IN     EDKII_IOMMU_BATCH_PROTOCOL  *This,
+  IN     EFI_HANDLE                  DeviceHandle,
+  IN     EDKII_IOMMU_OPERATION       Operation,
+  IN     UINT64                      IoMmuAccess,
+  IN     UINTN                       NumberOfEntries,
+  IN OUT EDKII_IOMMU_BATCH_ENTRY     *Entries
+  );
+
+/**
+  Revoke the access of a device to every buffer of a scatter-gather list, and unmap them,
+  as SetAttribute() with no access and Unmap() of the IOMMU protocol do for each.
+
+  Every entry is unmapped, even if one fails.
+
+  @param[in]  This             The protocol instance pointer.
+  @param[in]  DeviceHandle     The device that did the DMA.
+  @param[in]  NumberOfEntries  The number of buffers of the list.
+  @param[in]  Entries          The buffers of the list, as returned by MapMultiple().
+
+  @retval EFI_SUCCESS            Every buffer was unmapped.
+  @retval EFI_INVALID_PARAMETER  One or more parameters are invalid.
+  @retval EFI_DEVICE_ERROR       The IOMMU device reported an error while attempting the operation.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EDKII_IOMMU_UNMAP_MULTIPLE)(
+  IN EDKII_IOMMU_BATCH_PROTOCOL  *This,
+  IN EFI_HANDLE                  DeviceHandle,
+  IN UINTN                       NumberOfEntries,
+  IN EDKII_IOMMU_BATCH_ENTRY     *Entries
+  );
+
+/**
+  Map the buffers of a scatter-gather list for a device at one contiguous range of
+  device addresses, in the order of the list, and grant the device access to it.
+
+  The buffers are mapped in place. Since the device sees them page by page, every buffer
+  but the first must start on a page boundary, and every buffer but the last must end on one.
+  The device address of each buffer within the range is returned in its entry.
+
+  @param[in]      This             The protocol instance pointer.
+  @param[in]      DeviceHandle     The device that does the DMA.
+  @param[in]      Operation        Indicates if the bus master is going to read or write to system memory.
+  @param[in]      IoMmuAccess      The IOMMU access to grant to the range.
+  @param[in]      NumberOfEntries  The number of buffers of the list.
+  @param[in, out] Entries          The buffers of the list.
+  @param[out]     DeviceAddress    The device address of the first byte of the first buffer.
+  @param[out]     Mapping          A resulting value to pass to UnmapContiguous().
+
+  @retval EFI_SUCCESS            The list was mapped at one contiguous range.
+  @retval EFI_INVALID_PARAMETER  One or more parameters are invalid, or a buffer is not page-aligned
+                                 where the range continues.
+  @retval EFI_UNSUPPORTED        DeviceHandle is unknown by the IOMMU, or its DMA is not translated.
+  @retval EFI_OUT_OF_RESOURCES   No contiguous range of device addresses is free.
+  @retval EFI_DEVICE_ERROR       The IOMMU device reported an error while attempting the operation.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EDKII_IOMMU_MAP_CONTIGUOUS)(
+  IN     EDKII_IOMMU_BATCH_PROTOCOL  *This,
+  IN     EFI_HANDLE                  DeviceHandle,
+  IN     EDKII_IOMMU_OPERATION       Operation,
+  IN     UINT64                      IoMmuAccess,
+  IN     UINTN                       NumberOfEntries,
+  IN OUT EDKII_IOMMU_BATCH_ENTRY     *Entries,
+  OUT    EFI_PHYSICAL_ADDRESS        *DeviceAddress,
+  OUT    VOID                        **Mapping
+  );
+
+/**
+  Revoke the access of the device to a range mapped by MapContiguous(), and unmap it.
+
+  @param[in]  This     The protocol instance pointer.
+  @param[in]  Mapping  The mapping value returned from MapContiguous().
+
+  @retval EFI_SUCCESS            The range was unmapped.
+  @retval EFI_INVALID_PARAMETER  Mapping is not a value that was returned by MapContiguous().
+  @retval EFI_DEVICE_ERROR       The IOMMU device reported an error while attempting the operation.
+                                 The range is still mapped.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EDKII_IOMMU_UNMAP_CONTIGUOUS)(
+  IN EDKII_IOMMU_BATCH_PROTOCOL  *This,
+  IN VOID                        *Mapping
+  );
+
+/**
+  Map every buffer of a scatter-gather list for a device, and grant the device access to them,
+  as MapMultiple() does, but return without waiting for the IOMMU to complete the change.
+
+  The entries are filled in on return. The device must not access the buffers before
+  Token->Event is signalled. If the list can't be mapped, no entry holds a mapping on
+  return, and the token is not signalled. If the token reports an error, the entries
+  still hold their mappings, and must be unmapped.
+
+  @param[in]      This             The protocol instance pointer.
+  @param[in]      DeviceHandle     The device that does the DMA.
+  @param[in]      Operation        Indicates if the bus master is going to read or write to system memory.
+  @param[in]      IoMmuAccess      The IOMMU access to grant to every buffer.
+  @param[in]      NumberOfEntries  The number of buffers of the list.
+  @param[in, out] Entries          The buffers of the list.
+  @param[in, out] Token            The token to signal once the buffers may be accessed.
+
+  @retval EFI_SUCCESS            Every buffer was mapped for its returned NumberOfBytes, and the
+                                 token will be signalled.
+  @retval EFI_INVALID_PARAMETER  One or more parameters are invalid.
+  @retval EFI_UNSUPPORTED        DeviceHandle is unknown by the IOMMU, or a buffer cannot be mapped.
+  @retval EFI_OUT_OF_RESOURCES   The request could not be completed due to a lack of resources.
+  @retval EFI_DEVICE_ERROR       The IOMMU device reported an error while attempting the operation.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EDKII_IOMMU_MAP_MULTIPLE_ASYNC)(
+  IN     EDKII_IOMMU_BATCH_PROTOCOL  *This,
+  IN     EFI_HANDLE                  DeviceHandle,
+  IN     EDKII_IOMMU_OPERATION       Operation,
+  IN     UINT64                      IoMmuAccess,
+  IN     UINTN                       NumberOfEntries,
+  IN OUT EDKII_IOMMU_BATCH_ENTRY     *Entries,
+  IN OUT EDKII_IOMMU_BATCH_TOKEN     *Token
+  );
+
+/**
+  Revoke the access of a device to every buffer of a scatter-gather list, and unmap them,
+  as UnmapMultiple() does, but return without waiting for the IOMMU to complete the change.
+
+  The buffers are released, and bounced data is copied back, once the device can no longer
+  reach them, before Token->Event is signalled. Entries may be reused on return.
+
+  @param[in]      This             The protocol instance pointer.
+  @param[in]      DeviceHandle     The device that did the DMA.
+  @param[in]      NumberOfEntries  The number of buffers of the list.
+  @param[in]      Entries          The buffers of the list, as returned by MapMultiple() or
+                                   MapMultipleAsync().
+  @param[in, out] Token            The token to signal once the buffers are unmapped.
+
+  @retval EFI_SUCCESS            The buffers will be unmapped, and the token will be signalled.
+  @retval EFI_INVALID_PARAMETER  One or more parameters are invalid.
+  @retval EFI_OUT_OF_RESOURCES   The request could not be queued. Nothing was unmapped.
+  @retval EFI_DEVICE_ERROR       The IOMMU device reported an error while attempting the operation.
+                                 The buffers were unmapped, and the token is not signalled.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EDKII_IOMMU_UNMAP_MULTIPLE_ASYNC)(
+  IN     EDKII_IOMMU_BATCH_PROTOCOL  *This,
+  IN     EFI_HANDLE                  DeviceHandle,
+  IN     UINTN                       NumberOfEntries,
+  IN     EDKII_IOMMU_BATCH_ENTRY     *Entries,
+  IN OUT EDKII_IOMMU_BATCH_TOKEN     *Token
+  );
+
+///
+/// IOMMU Batch Protocol structure.
+///
+struct _EDKII_IOMMU_BATCH_PROTOCOL {
+  UINT64                              Revision;
+  EDKII_IOMMU_MAP_MULTIPLE            MapMultiple;
+  EDKII_IOMMU_UNMAP_MULTIPLE          UnmapMultiple;
+  ///
+  /// Since revision 0x00010001.
+  ///
+  EDKII_IOMMU_MAP_CONTIGUOUS          MapContiguous;
+  EDKII_IOMMU_UNMAP_CONTIGUOUS        UnmapContiguous;
+  ///
+  /// Since revision 0x00010002.
+  ///
+  EDKII_IOMMU_MAP_MULTIPLE_ASYNC      MapMultipleAsync;
+  EDKII_IOMMU_UNMAP_MULTIPLE_ASYNC    UnmapMultipleAsync;
+};
+
+///
+/// IOMMU Batch Protocol GUID variable.
+///
+extern EFI_GUID  gEdkiiIoMmuBatchProtocolGuid;
+
+#endif
@@ -0,0 +1,82 @@
+/** @file
+  EDKII IOMMU Device Hint Protocol.
+
+  A companion to the IOMMU protocol, produced by the same driver, which tells
+  a bus driver how the IOMMU treats the DMA of a device. A device that reaches
+  system memory at its own address, with no access control, needs none of the
+  IOMMU protocol services for its buffers, so the bus driver may hand out host
+  addresses directly and skip Map(), SetAttribute() and Unmap().
+
+Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef __IOMMU_DEVICE_HINT_H__
+#define __IOMMU_DEVICE_HINT_H__
+
+//
+// IOMMU Device Hint Protocol GUID value
+//
+#define EDKII_IOMMU_DEVICE_HINT_PROTOCOL_GUID \
+    { \
+      0x3b6b1d5e, 0x7f0c, 0x4a2d, { 0x95, 0x8e, 0x21, 0x4c, 0x0a, 0x6f, 0xd3, 0x97 } \
+    }
+
+//
+// Forward reference for pure ANSI compatability
+//
+typedef struct _EDKII_IOMMU_DEVICE_HINT_PROTOCOL EDKII_IOMMU_DEVICE_HINT_PROTOCOL;
+
+//
+// Revision The revision to which the IOMMU device hint interface adheres.
+//          All future revisions must be backwards compatible.
+//          If a future version is not back wards compatible it is not the same GUID.
+//
+#define EDKII_IOMMU_DEVICE_HINT_PROTOCOL_REVISION  0x00010000
+
+/**
+  Determine whether a device reaches system memory at its own address through the IOMMU,
+  and up to which address.
+
+  If it does, Map(), SetAttribute() and Unmap() of the IOMMU protocol are no-ops for a
+  buffer of the device that lies at or below IdentityLimit: the device address would be
+  the host address, and the device already has access. The caller may then skip them.
+  The caller must still honour the addressing limits of the device and its bus, and use
+  the IOMMU protocol for any buffer that they do not let the device reach.
+
+  The result does not change for as long as the device handle exists.
+
+  @param[in]  This           The protocol instance pointer.
+  @param[in]  DeviceHandle   The device that does the DMA.
+  @param[out] IdentityLimit  The highest system memory address that the device reaches at
+                             its own address.
+
+  @retval EFI_SUCCESS            The device reaches system memory up to IdentityLimit at its own address.
+  @retval EFI_INVALID_PARAMETER  DeviceHandle or IdentityLimit is NULL.
+  @retval EFI_UNSUPPORTED        Every DMA buffer of the device needs the IOMMU protocol services,
+                                 or DeviceHandle is unknown by the IOMMU.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EDKII_IOMMU_GET_IDENTITY_LIMIT)(
+  IN  EDKII_IOMMU_DEVICE_HINT_PROTOCOL  *This,
+  IN  EFI_HANDLE                        DeviceHandle,
+  OUT EFI_PHYSICAL_ADDRESS              *IdentityLimit
+  );
+
+///
+/// IOMMU Device Hint Protocol structure.
+///
+struct _EDKII_IOMMU_DEVICE_HINT_PROTOCOL {
+  UINT64                            Revision;
+  EDKII_IOMMU_GET_IDENTITY_LIMIT    GetIdentityLimit;
+};
+
+///
+/// IOMMU Device Hint Protocol GUID variable.
+///
+extern EFI_GUID  gEdkiiIoMmuDeviceHintProtocolGuid;
+
+#endif
@@ -0,0 +1,71 @@
+/** @file
+  EDKII Page Table Transaction Protocol.
+
+  A companion to the CPU Architectural Protocol, produced by the same driver,
+  through which the DXE Core groups the memory attribute updates of the
+  sections of an image. The updates made between Begin() and Commit() share
+  one flush of the translations of the CPU, instead of one flush each.
+
+  Until Commit(), a stale translation may still give the access that an update
+  took away. The driver flushes an update that gives access at once.
+
+Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef __PAGE_TABLE_TRANSACTION_H__
+#define __PAGE_TABLE_TRANSACTION_H__
+
+#define EDKII_PAGE_TABLE_TRANSACTION_PROTOCOL_GUID \
+    { \
+      0x216cc282, 0x0db5, 0x48c9, { 0x8d, 0x5e, 0x26, 0x34, 0x11, 0x0b, 0xd9, 0xbb } \
+    }
+
+//
+// Forward reference for pure ANSI compatability
+//
+typedef struct _EDKII_PAGE_TABLE_TRANSACTION_PROTOCOL EDKII_PAGE_TABLE_TRANSACTION_PROTOCOL;
+
+/**
+  Open a transaction, in which the memory attribute updates of the CPU
+  Architectural Protocol leave the flush of their translations to Commit().
+
+  Transactions nest, and only the Commit() of the outermost flushes.
+
+  @param[in]  This  The protocol instance pointer.
+
+**/
+typedef
+VOID
+(EFIAPI *EDKII_PAGE_TABLE_TRANSACTION_BEGIN)(
+  IN EDKII_PAGE_TABLE_TRANSACTION_PROTOCOL  *This
+  );
+
+/**
+  Commit a transaction opened by Begin(), which flushes the translations of
+  the updates made in it.
+
+  @param[in]  This  The protocol instance pointer.
+
+**/
+typedef
+VOID
+(EFIAPI *EDKII_PAGE_TABLE_TRANSACTION_COMMIT)(
+  IN EDKII_PAGE_TABLE_TRANSACTION_PROTOCOL  *This
+  );
+
+///
+/// Page Table Transaction Protocol structure.
+///
+struct _EDKII_PAGE_TABLE_TRANSACTION_PROTOCOL {
+  EDKII_PAGE_TABLE_TRANSACTION_BEGIN     Begin;
+  EDKII_PAGE_TABLE_TRANSACTION_COMMIT    Commit;
+};
+
+///
+/// Page Table Transaction Protocol GUID variable.
+///
+extern EFI_GUID  gEdkiiPageTableTransactionProtocolGuid;
+
+#endif
@@ -0,0 +1,108 @@
+/** @file
+  EDKII PCI Config Cache Protocol.
+
+  A read-only view of what the PCI bus driver learnt of a function when it
+  enumerated it: the header of its configuration space, and its capability
+  lists. It is installed on the handle of each PCI function, next to the PCI
+  I/O protocol, so that drivers that scan every function for a class or a
+  capability need not read configuration space, where every access may trap
+  to a hypervisor.
+
+Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef __PCI_CONFIG_CACHE_H__
+#define __PCI_CONFIG_CACHE_H__
+
+#include <IndustryStandard/Pci.h>
+
+//
+// PCI Config Cache Protocol GUID value
+//
+#define EDKII_PCI_CONFIG_CACHE_PROTOCOL_GUID \
+    { \
+      0x8a2e5c37, 0x41d6, 0x4f0b, { 0xa6, 0x93, 0x5e, 0x1c, 0x7d, 0x20, 0xb8, 0x4f } \
+    }
+
+//
+// Forward reference for pure ANSI compatability
+//
+typedef struct _EDKII_PCI_CONFIG_CACHE_PROTOCOL EDKII_PCI_CONFIG_CACHE_PROTOCOL;
+
+//
+// Revision The revision to which the PCI config cache interface adheres.
+//          All future revisions must be backwards compatible.
+//          If a future version is not back wards compatible it is not the same GUID.
+//
+#define EDKII_PCI_CONFIG_CACHE_PROTOCOL_REVISION  0x00010000
+
+/**
+  Copy the header of the configuration space of a PCI function, as it was read
+  when the function was enumerated.
+
+  The identifying registers, which are the vendor, device, revision, class code,
+  header type and subsystem IDs, do not change. The registers that software
+  writes, such as the command register and the BARs, may since have changed,
+  and must be read from configuration space.
+
+  @param[in]  This    The protocol instance pointer.
+  @param[out] Header  The header. The header of a bridge is to be read as PCI_TYPE01.
+
+  @retval EFI_SUCCESS            The header is copied.
+  @retval EFI_INVALID_PARAMETER  Header is NULL.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EDKII_PCI_CONFIG_CACHE_GET_HEADER)(
+  IN  EDKII_PCI_CONFIG_CACHE_PROTOCOL  *This,
+  OUT PCI_TYPE00                       *Header
+  );
+
+/**
+  Find a capability of a PCI function, in its capability list or its PCI Express
+  extended capability list.
+
+  The lists are read from configuration space once, on the first call.
+
+  @param[in]      This          The protocol instance pointer.
+  @param[in]      Extended      TRUE for the extended capability list, FALSE for the
+                                capability list.
+  @param[in]      CapabilityId  The ID of the capability.
+  @param[in, out] Offset        On input, 0 to find the first capability with the ID,
+                                or the offset of one to find the next. On output,
+                                the offset of the capability that is found.
+
+  @retval EFI_SUCCESS            The capability is found.
+  @retval EFI_INVALID_PARAMETER  Offset is NULL.
+  @retval EFI_NOT_FOUND          The function has no more capabilities with the ID.
+  @retval EFI_OUT_OF_RESOURCES   The lists could not be cached. The caller may read
+                                 configuration space instead.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EDKII_PCI_CONFIG_CACHE_FIND_CAPABILITY)(
+  IN     EDKII_PCI_CONFIG_CACHE_PROTOCOL  *This,
+  IN     BOOLEAN                          Extended,
+  IN     UINT16                           CapabilityId,
+  IN OUT UINT32                           *Offset
+  );
+
+///
+/// PCI Config Cache Protocol structure.
+///
+struct _EDKII_PCI_CONFIG_CACHE_PROTOCOL {
+  UINT64                                    Revision;
+  EDKII_PCI_CONFIG_CACHE_GET_HEADER         GetHeader;
+  EDKII_PCI_CONFIG_CACHE_FIND_CAPABILITY    FindCapability;
+};
+
+///
+/// PCI Config Cache Protocol GUID variable.
+///
+extern EFI_GUID  gEdkiiPciConfigCacheProtocolGuid;
+
+#endif
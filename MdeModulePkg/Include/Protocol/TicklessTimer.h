@@ -0,0 +1,76 @@
+/** @file
+  EDKII Tickless Timer Protocol.
+
+  A companion to the Timer Architectural Protocol, produced by the same driver,
+  through which the DXE Core tells the timer when its earliest timer event is due.
+  The driver then interrupts at that time instead of on every timer period,
+  and reports the time elapsed since its last interrupt so that timer events set
+  in between are due at the right time.
+
+Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef __TICKLESS_TIMER_H__
+#define __TICKLESS_TIMER_H__
+
+#define EDKII_TICKLESS_TIMER_PROTOCOL_GUID \
+    { \
+      0x0446a436, 0x9610, 0x44b4, { 0x9f, 0x3d, 0x0d, 0x2b, 0xd4, 0xbd, 0xbd, 0x6b } \
+    }
+
+//
+// Forward reference for pure ANSI compatability
+//
+typedef struct _EDKII_TICKLESS_TIMER_PROTOCOL EDKII_TICKLESS_TIMER_PROTOCOL;
+
+/**
+  Set when the earliest timer event of the DXE Core is due.
+
+  The timer interrupts no later than that, and may interrupt earlier. The timer
+  period set with the Timer Architectural Protocol still enables and disables the
+  timer interrupt.
+
+  @param[in]  This     The protocol instance pointer.
+  @param[in]  Timeout  The number of 100 ns units from now until the earliest timer
+                       event is due, or MAX_UINT64 if no timer event is set.
+
+**/
+typedef
+VOID
+(EFIAPI *EDKII_TICKLESS_TIMER_SET_NEXT_EVENT)(
+  IN EDKII_TICKLESS_TIMER_PROTOCOL  *This,
+  IN UINT64                         Timeout
+  );
+
+/**
+  Return the time elapsed since the timer last called the notify function that was
+  registered with the Timer Architectural Protocol.
+
+  @param[in]  This  The protocol instance pointer.
+
+  @return  The number of 100 ns units that the next call of the notify function
+           will report, if it were made now.
+
+**/
+typedef
+UINT64
+(EFIAPI *EDKII_TICKLESS_TIMER_GET_ELAPSED_TIME)(
+  IN EDKII_TICKLESS_TIMER_PROTOCOL  *This
+  );
+
+///
+/// Tickless Timer Protocol structure.
+///
+struct _EDKII_TICKLESS_TIMER_PROTOCOL {
+  EDKII_TICKLESS_TIMER_SET_NEXT_EVENT      SetNextEvent;
+  EDKII_TICKLESS_TIMER_GET_ELAPSED_TIME    GetElapsedTime;
+};
+
+///
+/// Tickless Timer Protocol GUID variable.
+///
+extern EFI_GUID  gEdkiiTicklessTimerProtocolGuid;
+
+#endif
@@ -112,6 +112,9 @@
 #define kMatchMinLen        2
 #define kMatchSpecLenStart  (kMatchMinLen + kLenNumLowSymbols * 2 + kLenNumHighSymbols)
 
+/* Matches at least this long are copied with memcpy(), which may be vectorized */
+#define kMatchBlockCopyMinLen  32
+
 /* External ASM code needs same CLzmaProb array layout. So don't change it. */
 
 /* (probs_1664) is faster and better for code size at some platforms */
@@ -522,9 +525,23 @@ LZMA_DECODE_REAL (
           ptrdiff_t   src   = (ptrdiff_t)pos - (ptrdiff_t)dicPos;
           const Byte  *lim  = dest + curLen;
           dicPos += (SizeT)curLen;
-          do {
-            *(dest) = (Byte)*(dest + src);
-          } while (++dest != lim);
+          if (curLen < kMatchBlockCopyMinLen) {
+            do {
+              *(dest) = (Byte)*(dest + src);
+            } while (++dest != lim);
+          } else if ((src > 0) || ((SizeT)-src >= curLen)) {
+            /* a forward overlap copies the same bytes as memmove() */
+            memmove (dest, dest + src, curLen);
+          } else {
+            /* the match repeats its last (-src) bytes, so copy them in doubling runs */
+            SizeT  dist = (SizeT)-src;
+            do {
+              SizeT  run = ((SizeT)(lim - dest) < dist) ? (SizeT)(lim - dest) : dist;
+              memcpy (dest, dest - dist, run);
+              dest += run;
+              dist += run;
+            } while (dest != lim);
+          }
         } else {
           do {
             dic[dicPos++] = dic[pos];
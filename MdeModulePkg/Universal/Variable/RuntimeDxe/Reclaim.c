@@ -92,6 +92,10 @@ GetLbaAndOffsetByAddress (
   volume block device. The destination is specified by parameter
   VariableBase. Fault Tolerant Write protocol is used for writing.
 
+  Only the blocks that change are written. Reclaim keeps the variables before
+  the first deleted one in place, and the erased space after the old end of the
+  store stays erased, so a reclaim usually rewrites a part of the store.
+
   @param  VariableBase   Base address of variable to write
   @param  VariableBuffer Point to the variable data buffer.
 
@@ -106,12 +110,19 @@ FtwVariableSpace (
   IN VARIABLE_STORE_HEADER  *VariableBuffer
   )
 {
-  EFI_STATUS                         Status;
-  EFI_HANDLE                         FvbHandle;
-  EFI_LBA                            VarLba;
-  UINTN                              VarOffset;
-  UINTN                              FtwBufferSize;
-  EFI_FAULT_TOLERANT_WRITE_PROTOCOL  *FtwProtocol;
+  EFI_STATUS                          Status;
+  EFI_HANDLE                          FvbHandle;
+  EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL  *Fvb;
+  EFI_LBA                             VarLba;
+  UINTN                               VarOffset;
+  UINTN                               FtwBufferSize;
+  UINTN                               BlockSize;
+  UINTN                               NumberOfBlocks;
+  UINTN                               Offset;
+  UINTN                               ChunkSize;
+  UINTN                               Start;
+  UINTN                               End;
+  EFI_FAULT_TOLERANT_WRITE_PROTOCOL   *FtwProtocol;
 
   //
   // Locate fault tolerant write protocol.
@@ -124,7 +135,7 @@ FtwVariableSpace (
   //
   // Locate Fvb handle by address.
   //
-  Status = GetFvbInfoByAddress (VariableBase, &FvbHandle, NULL);
+  Status = GetFvbInfoByAddress (VariableBase, &FvbHandle, &Fvb);
   if (EFI_ERROR (Status)) {
     return Status;
   }
@@ -140,17 +151,39 @@ FtwVariableSpace (
   FtwBufferSize = ((VARIABLE_STORE_HEADER *)((UINTN)VariableBase))->Size;
   ASSERT (FtwBufferSize == VariableBuffer->Size);
 
+  Status = Fvb->GetBlockSize (Fvb, VarLba, &BlockSize, &NumberOfBlocks);
+  if (EFI_ERROR (Status) || (BlockSize == 0)) {
+    return EFI_ABORTED;
+  }
+
+  //
+  // Find the first and the last block that change.
+  //
+  Start = FtwBufferSize;
+  End   = 0;
+  for (Offset = 0; Offset < FtwBufferSize; Offset += ChunkSize) {
+    ChunkSize = MIN (FtwBufferSize - Offset, BlockSize - ((VarOffset + Offset) % BlockSize));
+    if (CompareMem ((UINT8 *)(UINTN)VariableBase + Offset, (UINT8 *)VariableBuffer + Offset, ChunkSize) != 0) {
+      Start = MIN (Start, Offset);
+      End   = Offset + ChunkSize;
+    }
+  }
+
+  if (End == 0) {
+    return EFI_SUCCESS;
+  }
+
   //
   // FTW write record.
   //
   Status = FtwProtocol->Write (
                           FtwProtocol,
-                          VarLba,                // LBA
-                          VarOffset,             // Offset
-                          FtwBufferSize,         // NumBytes
-                          NULL,                  // PrivateData NULL
-                          FvbHandle,             // Fvb Handle
-                          (VOID *)VariableBuffer // write buffer
+                          VarLba + (VarOffset + Start) / BlockSize,  // LBA
+                          (VarOffset + Start) % BlockSize,           // Offset
+                          End - Start,                               // NumBytes
+                          NULL,                                      // PrivateData NULL
+                          FvbHandle,                                 // Fvb Handle
+                          (UINT8 *)VariableBuffer + Start            // write buffer
                           );
 
   return Status;
@@ -763,8 +763,27 @@ typedef struct {
 // Feature Identifier
 // (ref. spec. v2.1 Figure 32).
 //
+#define NUMBER_OF_QUEUES_FID             0x07  // Number of Queues
+#define HOST_MEMORY_BUFFER_FID           0x0D  // Host Memory Buffer
 #define POWER_LOSS_SIGNALING_CONFIG_FID  0x1B  // Power Loss Signaling Config
 
+//
+// Host Memory Buffer feature
+// (ref. spec. v2.1 Figure 396).
+//
+#define NVME_HMB_EHM  BIT0                    // Enable Host Memory
+#define NVME_HMB_MR   BIT1                    // Memory Return
+
+//
+// Host Memory Buffer Descriptor Entry
+// (ref. spec. v2.1 Figure 397).
+//
+typedef struct {
+  UINT64    Badd;                       /* Buffer Address */
+  UINT32    Bsize;                      /* Buffer Size, in memory page size units */
+  UINT32    Rsvd1;
+} NVME_HMB_DESCRIPTOR;
+
 //
 // NvmExpress Admin Sanitize Command
 //
@@ -20,7 +20,9 @@
 ///
 /// RISC-V IO Mapping Structure definitions from chapter 2.
 ///@{
-#define RIMT_REVISION  0x01
+#define EFI_ACPI_RISCV_IO_MAPPING_TABLE_SIGNATURE  SIGNATURE_32 ('R', 'I', 'M', 'T')
+#define RIMT_REVISION                              0x01
+#define RIMT_NODE_REVISION                         0x01
 ///@}
 
 //
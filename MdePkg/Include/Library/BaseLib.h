@@ -331,6 +331,54 @@ RiscVCpuCacheInvalCmoAsm (
   IN UINTN
   );
 
+/**
+  RISC-V flush every cache block in a range.
+
+  @param  Start      The first cache block. Must be aligned to BlockSize.
+  @param  End        The end of the last cache block. Must be aligned to BlockSize.
+  @param  BlockSize  The Zicbom cache block size, a power of two.
+
+**/
+VOID
+EFIAPI
+RiscVCpuCacheFlushRangeCmoAsm (
+  IN UINTN  Start,
+  IN UINTN  End,
+  IN UINTN  BlockSize
+  );
+
+/**
+  RISC-V clean every cache block in a range.
+
+  @param  Start      The first cache block. Must be aligned to BlockSize.
+  @param  End        The end of the last cache block. Must be aligned to BlockSize.
+  @param  BlockSize  The Zicbom cache block size, a power of two.
+
+**/
+VOID
+EFIAPI
+RiscVCpuCacheCleanRangeCmoAsm (
+  IN UINTN  Start,
+  IN UINTN  End,
+  IN UINTN  BlockSize
+  );
+
+/**
+  RISC-V invalidate every cache block in a range.
+
+  @param  Start      The first cache block. Must be aligned to BlockSize.
+  @param  End        The end of the last cache block. Must be aligned to BlockSize.
+  @param  BlockSize  The Zicbom cache block size, a power of two.
+
+**/
+VOID
+EFIAPI
+RiscVCpuCacheInvalRangeCmoAsm (
+  IN UINTN  Start,
+  IN UINTN  End,
+  IN UINTN  BlockSize
+  );
+
 #endif // defined (MDE_CPU_RISCV64)
 
 #if defined (MDE_CPU_LOONGARCH64)
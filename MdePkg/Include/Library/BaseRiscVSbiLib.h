@@ -9,7 +9,9 @@
   @par Glossary:
     - Hart - Hardware Thread, similar to a CPU core
 
-  Currently, EDK2 needs to call SBI only to set the time and to do system reset.
+  Currently, EDK2 needs to call SBI to set the time, to do system reset, to
+  start and stop harts and to fence the TLBs and instruction caches of other
+  harts.
 
 **/
 
@@ -25,6 +27,9 @@
 #define SBI_EXT_DBCN                 0x4442434E
 #define SBI_EXT_TIME                 0x54494D45
 #define SBI_EXT_SRST                 0x53525354
+#define SBI_EXT_HSM                  0x48534D
+#define SBI_EXT_RFENCE               0x52464E43
+#define SBI_EXT_PMU                  0x504D55
 
 /* SBI function IDs for base extension */
 #define SBI_EXT_BASE_SPEC_VERSION   0x0
@@ -53,6 +58,81 @@
 #define SBI_SRST_RESET_REASON_NONE     0x0
 #define SBI_SRST_RESET_REASON_SYSFAIL  0x1
 
+/* SBI function IDs for HSM extension */
+#define SBI_EXT_HSM_HART_START       0x0
+#define SBI_EXT_HSM_HART_STOP        0x1
+#define SBI_EXT_HSM_HART_GET_STATUS  0x2
+#define SBI_EXT_HSM_HART_SUSPEND     0x3
+
+#define SBI_HSM_STATE_STARTED          0x0
+#define SBI_HSM_STATE_STOPPED          0x1
+#define SBI_HSM_STATE_START_PENDING    0x2
+#define SBI_HSM_STATE_STOP_PENDING     0x3
+#define SBI_HSM_STATE_SUSPENDED        0x4
+#define SBI_HSM_STATE_SUSPEND_PENDING  0x5
+#define SBI_HSM_STATE_RESUME_PENDING   0x6
+
+/* SBI function IDs for PMU extension */
+#define SBI_EXT_PMU_NUM_COUNTERS             0x0
+#define SBI_EXT_PMU_COUNTER_GET_INFO         0x1
+#define SBI_EXT_PMU_COUNTER_CONFIG_MATCHING  0x2
+#define SBI_EXT_PMU_COUNTER_START            0x3
+#define SBI_EXT_PMU_COUNTER_STOP             0x4
+#define SBI_EXT_PMU_COUNTER_FW_READ          0x5
+
+#define SBI_PMU_CFG_FLAG_SKIP_MATCH   BIT0
+#define SBI_PMU_CFG_FLAG_CLEAR_VALUE  BIT1
+#define SBI_PMU_CFG_FLAG_AUTO_START   BIT2
+
+#define SBI_PMU_START_FLAG_SET_INIT_VALUE  BIT0
+#define SBI_PMU_STOP_FLAG_RESET            BIT0
+
+//
+// The fields of the information of a counter.
+//
+#define SBI_PMU_COUNTER_INFO_CSR(Info)    ((Info) & 0xFFF)
+#define SBI_PMU_COUNTER_INFO_WIDTH(Info)  ((((Info) >> 12) & 0x3F) + 1)
+#define SBI_PMU_COUNTER_INFO_FIRMWARE     (1ULL << 63)
+
+//
+// Hardware general events, of event type 0.
+//
+#define SBI_PMU_HW_CPU_CYCLES            0x1
+#define SBI_PMU_HW_INSTRUCTIONS          0x2
+#define SBI_PMU_HW_CACHE_REFERENCES      0x3
+#define SBI_PMU_HW_CACHE_MISSES          0x4
+#define SBI_PMU_HW_BRANCH_INSTRUCTIONS   0x5
+#define SBI_PMU_HW_BRANCH_MISSES         0x6
+
+//
+// Hardware cache events, of event type 1.
+//
+#define SBI_PMU_HW_CACHE_L1D   0
+#define SBI_PMU_HW_CACHE_L1I   1
+#define SBI_PMU_HW_CACHE_LL    2
+#define SBI_PMU_HW_CACHE_DTLB  3
+#define SBI_PMU_HW_CACHE_ITLB  4
+
+#define SBI_PMU_HW_CACHE_OP_READ      0
+#define SBI_PMU_HW_CACHE_OP_WRITE     1
+#define SBI_PMU_HW_CACHE_OP_PREFETCH  2
+
+#define SBI_PMU_HW_CACHE_RESULT_ACCESS  0
+#define SBI_PMU_HW_CACHE_RESULT_MISS    1
+
+#define SBI_PMU_HW_CACHE_EVENT(Cache, Op, Result) \
+  ((1 << 16) | ((Cache) << 3) | ((Op) << 1) | (Result))
+
+/* SBI function IDs for RFENCE extension */
+#define SBI_EXT_RFENCE_REMOTE_FENCE_I          0x0
+#define SBI_EXT_RFENCE_REMOTE_SFENCE_VMA       0x1
+#define SBI_EXT_RFENCE_REMOTE_SFENCE_VMA_ASID  0x2
+
+//
+// A hart mask base of all ones selects every hart, ignoring the hart mask.
+//
+#define SBI_HART_MASK_BASE_ALL  ((UINTN)-1)
+
 /* SBI return error codes */
 #define SBI_SUCCESS                0
 #define SBI_ERR_FAILED             -1
@@ -102,6 +182,91 @@ SbiSystemReset (
   IN  UINTN  ResetReason
   );
 
+EFI_STATUS
+EFIAPI
+SbiHartStart (
+  IN  UINTN  HartId,
+  IN  UINTN  StartAddress,
+  IN  UINTN  Opaque
+  );
+
+EFI_STATUS
+EFIAPI
+SbiHartStop (
+  VOID
+  );
+
+EFI_STATUS
+EFIAPI
+SbiHartGetStatus (
+  IN  UINTN  HartId,
+  OUT UINTN  *HartState
+  );
+
+EFI_STATUS
+EFIAPI
+SbiRemoteFenceI (
+  IN  UINTN  HartMask,
+  IN  UINTN  HartMaskBase
+  );
+
+EFI_STATUS
+EFIAPI
+SbiRemoteSfenceVma (
+  IN  UINTN  HartMask,
+  IN  UINTN  HartMaskBase,
+  IN  UINTN  StartAddress,
+  IN  UINTN  Size
+  );
+
+EFI_STATUS
+EFIAPI
+SbiPmuNumCounters (
+  OUT UINTN  *NumCounters
+  );
+
+EFI_STATUS
+EFIAPI
+SbiPmuCounterGetInfo (
+  IN  UINTN  CounterIndex,
+  OUT UINTN  *CounterInfo
+  );
+
+EFI_STATUS
+EFIAPI
+SbiPmuCounterConfigMatching (
+  IN  UINTN   CounterIndexBase,
+  IN  UINTN   CounterIndexMask,
+  IN  UINTN   ConfigFlags,
+  IN  UINTN   EventIndex,
+  IN  UINT64  EventData,
+  OUT UINTN   *CounterIndex
+  );
+
+EFI_STATUS
+EFIAPI
+SbiPmuCounterStart (
+  IN  UINTN   CounterIndexBase,
+  IN  UINTN   CounterIndexMask,
+  IN  UINTN   StartFlags,
+  IN  UINT64  InitialValue
+  );
+
+EFI_STATUS
+EFIAPI
+SbiPmuCounterStop (
+  IN  UINTN  CounterIndexBase,
+  IN  UINTN  CounterIndexMask,
+  IN  UINTN  StopFlags
+  );
+
+EFI_STATUS
+EFIAPI
+SbiPmuCounterFirmwareRead (
+  IN  UINTN   CounterIndex,
+  OUT UINT64  *Value
+  );
+
 /**
   Make ECALL in assembly
 
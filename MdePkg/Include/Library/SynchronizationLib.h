@@ -272,4 +272,188 @@ InterlockedCompareExchangePointer (
   IN      VOID                                 *ExchangeValue
   );
 
+/**
+  Performs an atomic add on a 32-bit unsigned integer, and returns its original value.
+
+  Performs an atomic add on the 32-bit unsigned integer specified by Value,
+  setting it to the sum of *Value and Addend. The operation must be performed
+  using MP safe mechanisms.
+
+  If Value is NULL, then ASSERT().
+  If Value is not aligned on a 4-byte boundary, then ASSERT().
+
+  @param  Value     A pointer to the 32-bit value to update.
+  @param  Addend    The value to add to *Value.
+
+  @return The original *Value before the operation.
+
+**/
+UINT32
+EFIAPI
+InterlockedFetchAdd32 (
+  IN OUT  volatile UINT32  *Value,
+  IN      UINT32           Addend
+  );
+
+/**
+  Performs an atomic bitwise OR on a 32-bit unsigned integer, and returns its original value.
+
+  Performs an atomic bitwise OR on the 32-bit unsigned integer specified by Value,
+  setting it to the bitwise OR of *Value and OrData. The operation must be performed
+  using MP safe mechanisms.
+
+  If Value is NULL, then ASSERT().
+  If Value is not aligned on a 4-byte boundary, then ASSERT().
+
+  @param  Value     A pointer to the 32-bit value to update.
+  @param  OrData    The value to OR with *Value.
+
+  @return The original *Value before the operation.
+
+**/
+UINT32
+EFIAPI
+InterlockedFetchOr32 (
+  IN OUT  volatile UINT32  *Value,
+  IN      UINT32           OrData
+  );
+
+/**
+  Performs an atomic bitwise AND on a 32-bit unsigned integer, and returns its original value.
+
+  Performs an atomic bitwise AND on the 32-bit unsigned integer specified by Value,
+  setting it to the bitwise AND of *Value and AndData. The operation must be performed
+  using MP safe mechanisms.
+
+  If Value is NULL, then ASSERT().
+  If Value is not aligned on a 4-byte boundary, then ASSERT().
+
+  @param  Value     A pointer to the 32-bit value to update.
+  @param  AndData   The value to AND with *Value.
+
+  @return The original *Value before the operation.
+
+**/
+UINT32
+EFIAPI
+InterlockedFetchAnd32 (
+  IN OUT  volatile UINT32  *Value,
+  IN      UINT32           AndData
+  );
+
+/**
+  Performs an atomic exchange of a 32-bit unsigned integer.
+
+  Sets the 32-bit unsigned integer specified by Value to ExchangeValue, and
+  returns its original value. The exchange must be performed using MP safe
+  mechanisms.
+
+  If Value is NULL, then ASSERT().
+  If Value is not aligned on a 4-byte boundary, then ASSERT().
+
+  @param  Value         A pointer to the 32-bit value to exchange.
+  @param  ExchangeValue 32-bit value to store.
+
+  @return The original *Value before exchange.
+
+**/
+UINT32
+EFIAPI
+InterlockedExchange32 (
+  IN OUT  volatile UINT32  *Value,
+  IN      UINT32           ExchangeValue
+  );
+
+/**
+  Performs an atomic add on a 64-bit unsigned integer, and returns its original value.
+
+  Performs an atomic add on the 64-bit unsigned integer specified by Value,
+  setting it to the sum of *Value and Addend. The operation must be performed
+  using MP safe mechanisms.
+
+  If Value is NULL, then ASSERT().
+  If Value is not aligned on an 8-byte boundary, then ASSERT().
+
+  @param  Value     A pointer to the 64-bit value to update.
+  @param  Addend    The value to add to *Value.
+
+  @return The original *Value before the operation.
+
+**/
+UINT64
+EFIAPI
+InterlockedFetchAdd64 (
+  IN OUT  volatile UINT64  *Value,
+  IN      UINT64           Addend
+  );
+
+/**
+  Performs an atomic bitwise OR on a 64-bit unsigned integer, and returns its original value.
+
+  Performs an atomic bitwise OR on the 64-bit unsigned integer specified by Value,
+  setting it to the bitwise OR of *Value and OrData. The operation must be performed
+  using MP safe mechanisms.
+
+  If Value is NULL, then ASSERT().
+  If Value is not aligned on an 8-byte boundary, then ASSERT().
+
+  @param  Value     A pointer to the 64-bit value to update.
+  @param  OrData    The value to OR with *Value.
+
+  @return The original *Value before the operation.
+
+**/
+UINT64
+EFIAPI
+InterlockedFetchOr64 (
+  IN OUT  volatile UINT64  *Value,
+  IN      UINT64           OrData
+  );
+
+/**
+  Performs an atomic bitwise AND on a 64-bit unsigned integer, and returns its original value.
+
+  Performs an atomic bitwise AND on the 64-bit unsigned integer specified by Value,
+  setting it to the bitwise AND of *Value and AndData. The operation must be performed
+  using MP safe mechanisms.
+
+  If Value is NULL, then ASSERT().
+  If Value is not aligned on an 8-byte boundary, then ASSERT().
+
+  @param  Value     A pointer to the 64-bit value to update.
+  @param  AndData   The value to AND with *Value.
+
+  @return The original *Value before the operation.
+
+**/
+UINT64
+EFIAPI
+InterlockedFetchAnd64 (
+  IN OUT  volatile UINT64  *Value,
+  IN      UINT64           AndData
+  );
+
+/**
+  Performs an atomic exchange of a 64-bit unsigned integer.
+
+  Sets the 64-bit unsigned integer specified by Value to ExchangeValue, and
+  returns its original value. The exchange must be performed using MP safe
+  mechanisms.
+
+  If Value is NULL, then ASSERT().
+  If Value is not aligned on an 8-byte boundary, then ASSERT().
+
+  @param  Value         A pointer to the 64-bit value to exchange.
+  @param  ExchangeValue 64-bit value to store.
+
+  @return The original *Value before exchange.
+
+**/
+UINT64
+EFIAPI
+InterlockedExchange64 (
+  IN OUT  volatile UINT64  *Value,
+  IN      UINT64           ExchangeValue
+  );
+
 #endif
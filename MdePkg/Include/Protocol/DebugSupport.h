@@ -634,13 +634,17 @@ typedef struct {
 ///
 #define EXCEPT_RISCV_IS_IRQ(x)     ((x & 0x8000000000000000UL) != 0)
 #define EXCEPT_RISCV_IRQ_INDEX(x)  (x & 0x7FFFFFFFFFFFFFFFUL)
-#define EXCEPT_RISCV_IRQ_0                 0x8000000000000000UL
-#define EXCEPT_RISCV_IRQ_SOFT_FROM_SMODE   0x8000000000000001UL
-#define EXCEPT_RISCV_IRQ_SOFT_FROM_VSMODE  0x8000000000000002UL
-#define EXCEPT_RISCV_IRQ_SOFT_FROM_MMODE   0x8000000000000003UL
-#define EXCEPT_RISCV_IRQ_4                 0x8000000000000004UL
-#define EXCEPT_RISCV_IRQ_TIMER_FROM_SMODE  0x8000000000000005UL
-#define EXCEPT_RISCV_MAX_IRQS              (EXCEPT_RISCV_IRQ_INDEX(EXCEPT_RISCV_IRQ_TIMER_FROM_SMODE))
+#define EXCEPT_RISCV_IRQ_0                  0x8000000000000000UL
+#define EXCEPT_RISCV_IRQ_SOFT_FROM_SMODE    0x8000000000000001UL
+#define EXCEPT_RISCV_IRQ_SOFT_FROM_VSMODE   0x8000000000000002UL
+#define EXCEPT_RISCV_IRQ_SOFT_FROM_MMODE    0x8000000000000003UL
+#define EXCEPT_RISCV_IRQ_4                  0x8000000000000004UL
+#define EXCEPT_RISCV_IRQ_TIMER_FROM_SMODE   0x8000000000000005UL
+#define EXCEPT_RISCV_IRQ_TIMER_FROM_VSMODE  0x8000000000000006UL
+#define EXCEPT_RISCV_IRQ_TIMER_FROM_MMODE   0x8000000000000007UL
+#define EXCEPT_RISCV_IRQ_8                  0x8000000000000008UL
+#define EXCEPT_RISCV_IRQ_EXT_FROM_SMODE     0x8000000000000009UL
+#define EXCEPT_RISCV_MAX_IRQS               (EXCEPT_RISCV_IRQ_INDEX(EXCEPT_RISCV_IRQ_EXT_FROM_SMODE))
 
 typedef struct {
   UINT64    X0;
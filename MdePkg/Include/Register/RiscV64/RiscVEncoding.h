@@ -21,6 +21,10 @@
 #define MSTATUS_MPP_SHIFT   11
 #define MSTATUS_MPP         (3UL << MSTATUS_MPP_SHIFT)
 #define MSTATUS_FS          0x00006000UL
+#define MSTATUS_VS          0x00000600UL
+#define MSTATUS_VS_INITIAL  0x00000200UL
+#define MSTATUS_VS_CLEAN    0x00000400UL
+#define MSTATUS_VS_DIRTY    MSTATUS_VS
 
 #define SSTATUS_SIE         MSTATUS_SIE
 #define SSTATUS_SPIE_SHIFT  MSTATUS_SPIE_SHIFT
@@ -80,6 +84,13 @@
 /* Floating-Point */
 #define CSR_FCSR  0x003
 
+/* Vector extension */
+#define CSR_VSTART  0x008
+#define CSR_VCSR    0x00f
+#define CSR_VL      0xc20
+#define CSR_VTYPE   0xc21
+#define CSR_VLENB   0xc22
+
 /* Supervisor Trap Setup */
 #define CSR_SSTATUS  0x100
 #define CSR_SEDELEG  0x102
@@ -103,6 +114,11 @@
 /* Sstc extension */
 #define CSR_STIMECMP  0x14D
 
+/* Ssaia extension */
+#define CSR_SISELECT  0x150
+#define CSR_SIREG     0x151
+#define CSR_STOPEI    0x15C
+
 /* Trap/Exception Causes */
 #define CAUSE_MISALIGNED_FETCH          0x0
 #define CAUSE_FETCH_ACCESS              0x1
@@ -95,23 +95,19 @@ CacheOpCacheRange (
      "CacheOpCacheRange: Performing Cache Management Operation %d \n", Op)
     );
 
-  do {
-    switch (Op) {
-      case CacheOpInvld:
-        RiscVCpuCacheInvalCmoAsm (Start);
-        break;
-      case CacheOpFlush:
-        RiscVCpuCacheFlushCmoAsm (Start);
-        break;
-      case CacheOpClean:
-        RiscVCpuCacheCleanCmoAsm (Start);
-        break;
-      default:
-        break;
-    }
-
-    Start = Start + CacheLineSize;
-  } while (Start != End);
+  switch (Op) {
+    case CacheOpInvld:
+      RiscVCpuCacheInvalRangeCmoAsm (Start, End, CacheLineSize);
+      break;
+    case CacheOpFlush:
+      RiscVCpuCacheFlushRangeCmoAsm (Start, End, CacheLineSize);
+      break;
+    case CacheOpClean:
+      RiscVCpuCacheCleanRangeCmoAsm (Start, End, CacheLineSize);
+      break;
+    default:
+      break;
+  }
 }
 
 /**
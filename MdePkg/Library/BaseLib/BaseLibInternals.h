@@ -850,6 +850,30 @@ InternalX86RdRand64  (
   OUT     UINT64  *Rand
   );
 
+#elif defined (MDE_CPU_RISCV64)
+
+//
+// The Zbc bit of PcdRiscVFeatureOverride.
+//
+#define RISCV_CPU_FEATURE_ZBC_BITMASK  0x80
+
+/**
+  Computes the ITU-T V.42 CRC32 of a buffer with the carry-less multiplications
+  of the Zbc extension.
+
+  @param  Buffer      The pointer to the buffer.
+  @param  Length      The size, in bytes, of Buffer.
+
+  @return The CRC32 of the buffer.
+
+**/
+UINT32
+EFIAPI
+InternalCalculateCrc32Zbc (
+  IN      CONST VOID  *Buffer,
+  IN      UINTN       Length
+  );
+
 #else
 
 #endif
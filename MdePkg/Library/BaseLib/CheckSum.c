@@ -609,6 +609,13 @@ CalculateCrc32 (
   ASSERT (Buffer != NULL);
   ASSERT (Length <= (MAX_ADDRESS - ((UINTN)Buffer) + 1));
 
+ #if defined (MDE_CPU_RISCV64)
+  if ((PcdGet64 (PcdRiscVFeatureOverride) & RISCV_CPU_FEATURE_ZBC_BITMASK) != 0) {
+    return InternalCalculateCrc32Zbc (Buffer, Length);
+  }
+
+ #endif
+
   //
   // Compute CRC
   //
@@ -0,0 +1,462 @@
+/** @file
+  RISC-V workers for the optimised Base Memory Library.
+
+  The vector and cache-block-zero variants are chosen once, by the library
+  constructor, from the CPU features enabled in PcdRiscVFeatureOverride.
+
+  Vector registers are not preserved across traps, so the vector workers run
+  with interrupts disabled, a bounded chunk at a time.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include "../MemLibInternals.h"
+
+#include <Library/PcdLib.h>
+
+#define RISCV_CPU_FEATURE_ZICBOZ_BITMASK  0x20
+#define RISCV_CPU_FEATURE_VECTOR_BITMASK  0x40
+
+//
+// Below this length the scalar loops win over the vector setup and the
+// interrupt masking.
+//
+#define VECTOR_THRESHOLD  256
+
+//
+// The most a vector worker handles with interrupts disabled.
+//
+#define VECTOR_CHUNK_SIZE  SIZE_64KB
+
+STATIC UINTN    mZeroBlockSize;
+STATIC BOOLEAN  mUseVector;
+
+VOID *
+EFIAPI
+InternalMemCopyMemScalar (
+  OUT     VOID        *DestinationBuffer,
+  IN      CONST VOID  *SourceBuffer,
+  IN      UINTN       Length
+  );
+
+VOID *
+EFIAPI
+InternalMemCopyMemVector (
+  OUT     VOID        *DestinationBuffer,
+  IN      CONST VOID  *SourceBuffer,
+  IN      UINTN       Length
+  );
+
+VOID *
+EFIAPI
+InternalMemSetMemScalar (
+  OUT     VOID   *Buffer,
+  IN      UINTN  Length,
+  IN      UINT8  Value
+  );
+
+VOID *
+EFIAPI
+InternalMemSetMemVector (
+  OUT     VOID   *Buffer,
+  IN      UINTN  Length,
+  IN      UINT8  Value
+  );
+
+VOID
+EFIAPI
+InternalMemZeroBlocks (
+  IN      UINTN  Start,
+  IN      UINTN  End,
+  IN      UINTN  BlockSize
+  );
+
+INTN
+EFIAPI
+InternalMemCompareMemVector (
+  IN      CONST VOID  *DestinationBuffer,
+  IN      CONST VOID  *SourceBuffer,
+  IN      UINTN       Length
+  );
+
+CONST VOID *
+EFIAPI
+InternalMemScanMem8Vector (
+  IN      CONST VOID  *Buffer,
+  IN      UINTN       Length,
+  IN      UINT8       Value
+  );
+
+VOID
+EFIAPI
+InternalMemEnableVector (
+  VOID
+  );
+
+/**
+  Choose the memory workers for the features of this CPU.
+
+  @retval RETURN_SUCCESS  Always.
+
+**/
+RETURN_STATUS
+EFIAPI
+BaseMemoryLibOptDxeConstructor (
+  VOID
+  )
+{
+  UINT64  Features;
+  UINTN   BlockSize;
+
+  Features = PcdGet64 (PcdRiscVFeatureOverride);
+
+  if ((Features & RISCV_CPU_FEATURE_ZICBOZ_BITMASK) != 0) {
+    BlockSize = PcdGet32 (PcdRiscVCbozBlockSize);
+    if ((BlockSize != 0) && ((BlockSize & (BlockSize - 1)) == 0) && (BlockSize <= SIZE_4KB)) {
+      mZeroBlockSize = BlockSize;
+    }
+  }
+
+  if ((Features & RISCV_CPU_FEATURE_VECTOR_BITMASK) != 0) {
+    InternalMemEnableVector ();
+    mUseVector = TRUE;
+  }
+
+  return RETURN_SUCCESS;
+}
+
+/**
+  Copy Length bytes from Source to Destination.
+
+  @param  DestinationBuffer The target of the copy request.
+  @param  SourceBuffer      The place to copy from.
+  @param  Length            The number of bytes to copy.
+
+  @return Destination.
+
+**/
+VOID *
+EFIAPI
+InternalMemCopyMem (
+  OUT     VOID        *DestinationBuffer,
+  IN      CONST VOID  *SourceBuffer,
+  IN      UINTN       Length
+  )
+{
+  UINT8        *Destination;
+  CONST UINT8  *Source;
+  UINTN        Chunk;
+  BOOLEAN      InterruptState;
+
+  //
+  // The vector loop copies upwards a chunk at a time, which is only safe if
+  // the destination does not overlap the end of the source.
+  //
+  if (!mUseVector || (Length < VECTOR_THRESHOLD) ||
+      (((UINTN)DestinationBuffer > (UINTN)SourceBuffer) &&
+       ((UINTN)DestinationBuffer < (UINTN)SourceBuffer + Length)))
+  {
+    return InternalMemCopyMemScalar (DestinationBuffer, SourceBuffer, Length);
+  }
+
+  Destination = DestinationBuffer;
+  Source      = SourceBuffer;
+  while (Length != 0) {
+    Chunk          = MIN (Length, VECTOR_CHUNK_SIZE);
+    InterruptState = SaveAndDisableInterrupts ();
+    InternalMemCopyMemVector (Destination, Source, Chunk);
+    SetInterruptState (InterruptState);
+    Destination += Chunk;
+    Source      += Chunk;
+    Length      -= Chunk;
+  }
+
+  return DestinationBuffer;
+}
+
+/**
+  Set Buffer to Value for Size bytes.
+
+  @param  Buffer   The memory to set.
+  @param  Length   The number of bytes to set.
+  @param  Value    The value of the set operation.
+
+  @return Buffer
+
+**/
+VOID *
+EFIAPI
+InternalMemSetMem (
+  OUT     VOID   *Buffer,
+  IN      UINTN  Length,
+  IN      UINT8  Value
+  )
+{
+  UINT8    *Pointer;
+  UINTN    Chunk;
+  BOOLEAN  InterruptState;
+
+  if (!mUseVector || (Length < VECTOR_THRESHOLD)) {
+    return InternalMemSetMemScalar (Buffer, Length, Value);
+  }
+
+  Pointer = Buffer;
+  while (Length != 0) {
+    Chunk          = MIN (Length, VECTOR_CHUNK_SIZE);
+    InterruptState = SaveAndDisableInterrupts ();
+    InternalMemSetMemVector (Pointer, Chunk, Value);
+    SetInterruptState (InterruptState);
+    Pointer += Chunk;
+    Length  -= Chunk;
+  }
+
+  return Buffer;
+}
+
+/**
+  Fills a target buffer with a 16-bit value, and returns the target buffer.
+
+  @param  Buffer  The pointer to the target buffer to fill.
+  @param  Length  The count of 16-bit value to fill.
+  @param  Value   The value with which to fill Length bytes of Buffer.
+
+  @return Buffer
+
+**/
+VOID *
+EFIAPI
+InternalMemSetMem16 (
+  OUT     VOID    *Buffer,
+  IN      UINTN   Length,
+  IN      UINT16  Value
+  )
+{
+  volatile UINT16  *Pointer;
+
+  for (Pointer = Buffer; Length != 0; Length--) {
+    *(Pointer++) = Value;
+  }
+
+  return Buffer;
+}
+
+/**
+  Fills a target buffer with a 32-bit value, and returns the target buffer.
+
+  @param  Buffer  The pointer to the target buffer to fill.
+  @param  Length  The count of 32-bit value to fill.
+  @param  Value   The value with which to fill Length bytes of Buffer.
+
+  @return Buffer
+
+**/
+VOID *
+EFIAPI
+InternalMemSetMem32 (
+  OUT     VOID    *Buffer,
+  IN      UINTN   Length,
+  IN      UINT32  Value
+  )
+{
+  volatile UINT32  *Pointer;
+
+  for (Pointer = Buffer; Length != 0; Length--) {
+    *(Pointer++) = Value;
+  }
+
+  return Buffer;
+}
+
+/**
+  Fills a target buffer with a 64-bit value, and returns the target buffer.
+
+  @param  Buffer  The pointer to the target buffer to fill.
+  @param  Length  The count of 64-bit value to fill.
+  @param  Value   The value with which to fill Length bytes of Buffer.
+
+  @return Buffer
+
+**/
+VOID *
+EFIAPI
+InternalMemSetMem64 (
+  OUT     VOID    *Buffer,
+  IN      UINTN   Length,
+  IN      UINT64  Value
+  )
+{
+  volatile UINT64  *Pointer;
+
+  for (Pointer = Buffer; Length != 0; Length--) {
+    *(Pointer++) = Value;
+  }
+
+  return Buffer;
+}
+
+/**
+  Set Buffer to 0 for Size bytes.
+
+  The whole Zicboz cache blocks of the buffer are zeroed a block at a time.
+
+  @param  Buffer   The memory to set.
+  @param  Length   The number of bytes to set
+
+  @return Buffer
+
+**/
+VOID *
+EFIAPI
+InternalMemZeroMem (
+  OUT     VOID   *Buffer,
+  IN      UINTN  Length
+  )
+{
+  UINTN  Start;
+  UINTN  End;
+
+  if ((mZeroBlockSize == 0) || (Length < 2 * mZeroBlockSize)) {
+    return InternalMemSetMem (Buffer, Length, 0);
+  }
+
+  Start = ALIGN_VALUE ((UINTN)Buffer, mZeroBlockSize);
+  End   = ((UINTN)Buffer + Length) & ~(mZeroBlockSize - 1);
+
+  if (Start != (UINTN)Buffer) {
+    InternalMemSetMem (Buffer, Start - (UINTN)Buffer, 0);
+  }
+
+  InternalMemZeroBlocks (Start, End, mZeroBlockSize);
+
+  if (End != (UINTN)Buffer + Length) {
+    InternalMemSetMem ((VOID *)End, (UINTN)Buffer + Length - End, 0);
+  }
+
+  return Buffer;
+}
+
+/**
+  Compares two memory buffers of a given length.
+
+  @param  DestinationBuffer The first memory buffer
+  @param  SourceBuffer      The second memory buffer
+  @param  Length            The length of DestinationBuffer and SourceBuffer memory
+                            regions to compare. Must be non-zero.
+
+  @return 0                 All Length bytes of the two buffers are identical.
+  @retval Non-zero          The first mismatched byte in SourceBuffer subtracted from the first
+                            mismatched byte in DestinationBuffer.
+
+**/
+INTN
+EFIAPI
+InternalMemCompareMem (
+  IN      CONST VOID  *DestinationBuffer,
+  IN      CONST VOID  *SourceBuffer,
+  IN      UINTN       Length
+  )
+{
+  CONST UINT8  *Destination;
+  CONST UINT8  *Source;
+  UINTN        Chunk;
+  INTN         Result;
+  BOOLEAN      InterruptState;
+
+  Destination = DestinationBuffer;
+  Source      = SourceBuffer;
+
+  if (mUseVector && (Length >= VECTOR_THRESHOLD)) {
+    while (Length != 0) {
+      Chunk          = MIN (Length, VECTOR_CHUNK_SIZE);
+      InterruptState = SaveAndDisableInterrupts ();
+      Result         = InternalMemCompareMemVector (Destination, Source, Chunk);
+      SetInterruptState (InterruptState);
+      if (Result != 0) {
+        return Result;
+      }
+
+      Destination += Chunk;
+      Source      += Chunk;
+      Length      -= Chunk;
+    }
+
+    return 0;
+  }
+
+  //
+  // Skip equal doublewords while both buffers are aligned.
+  //
+  if ((((UINTN)Destination | (UINTN)Source) & (sizeof (UINT64) - 1)) == 0) {
+    while ((Length >= sizeof (UINT64)) &&
+           (*(CONST UINT64 *)Destination == *(CONST UINT64 *)Source))
+    {
+      Destination += sizeof (UINT64);
+      Source      += sizeof (UINT64);
+      Length      -= sizeof (UINT64);
+    }
+  }
+
+  for ( ; Length != 0; Length--, Destination++, Source++) {
+    if (*Destination != *Source) {
+      return (INTN)*Destination - (INTN)*Source;
+    }
+  }
+
+  return 0;
+}
+
+/**
+  Scans a target buffer for an 8-bit value, and returns a pointer to the
+  matching 8-bit value in the target buffer.
+
+  @param  Buffer  The pointer to the target buffer to scan.
+  @param  Length  The count of 8-bit value to scan. Must be non-zero.
+  @param  Value   The value to search for in the target buffer.
+
+  @return The pointer to the first occurrence, or NULL if not found.
+
+**/
+CONST VOID *
+EFIAPI
+InternalMemScanMem8 (
+  IN      CONST VOID  *Buffer,
+  IN      UINTN       Length,
+  IN      UINT8       Value
+  )
+{
+  CONST UINT8  *Pointer;
+  CONST VOID   *Match;
+  UINTN        Chunk;
+  BOOLEAN      InterruptState;
+
+  Pointer = Buffer;
+
+  if (mUseVector && (Length >= VECTOR_THRESHOLD)) {
+    while (Length != 0) {
+      Chunk          = MIN (Length, VECTOR_CHUNK_SIZE);
+      InterruptState = SaveAndDisableInterrupts ();
+      Match          = InternalMemScanMem8Vector (Pointer, Chunk, Value);
+      SetInterruptState (InterruptState);
+      if (Match != NULL) {
+        return Match;
+      }
+
+      Pointer += Chunk;
+      Length  -= Chunk;
+    }
+
+    return NULL;
+  }
+
+  do {
+    if (*Pointer == Value) {
+      return Pointer;
+    }
+
+    ++Pointer;
+  } while (--Length != 0);
+
+  return NULL;
+}
@@ -973,6 +973,7 @@ PeCoffLoaderRelocateImage (
   UINT32                               *Fixup32;
   UINT64                               *Fixup64;
   CHAR8                                *FixupData;
+  PE_COFF_LOADER_RELOCATION_STATE      RelocationState;
   PHYSICAL_ADDRESS                     BaseAddress;
   UINT32                               NumberOfRvaAndSizes;
   UINT32                               TeStrippedOffset;
@@ -1086,6 +1087,7 @@ PeCoffLoaderRelocateImage (
     // Run the relocation information and apply the fixups
     //
     FixupData = ImageContext->FixupData;
+    ZeroMem (&RelocationState, sizeof (RelocationState));
     while ((UINTN)RelocBase < (UINTN)RelocBaseEnd) {
       Reloc = (UINT16 *)((CHAR8 *)RelocBase + sizeof (EFI_IMAGE_BASE_RELOCATION));
       //
@@ -1175,7 +1177,7 @@ PeCoffLoaderRelocateImage (
             // PeCoffLoaderRelocateImageEx () adds support for these complex fixups
             // on IPF and is a No-Op on other architectures.
             //
-            Status = PeCoffLoaderRelocateImageEx (Reloc, Fixup, &FixupData, Adjust);
+            Status = PeCoffLoaderRelocateImageEx (Reloc, Fixup, &FixupData, Adjust, &RelocationState);
             if (RETURN_ERROR (Status)) {
               ImageContext->ImageError = IMAGE_ERROR_FAILED_RELOCATION;
               return Status;
@@ -1768,6 +1770,7 @@ PeCoffLoaderRelocateImageForRuntime (
   UINT32                               *Fixup32;
   UINT64                               *Fixup64;
   CHAR8                                *FixupData;
+  PE_COFF_LOADER_RELOCATION_STATE      RelocationState;
   UINTN                                Adjust;
   RETURN_STATUS                        Status;
   PE_COFF_LOADER_IMAGE_CONTEXT         ImageContext;
@@ -1873,6 +1876,7 @@ PeCoffLoaderRelocateImageForRuntime (
     //
     FixupData     = RelocationData;
     RelocBaseOrig = RelocBase;
+    ZeroMem (&RelocationState, sizeof (RelocationState));
     while ((UINTN)RelocBase < (UINTN)RelocBaseEnd) {
       //
       // Add check for RelocBase->SizeOfBlock field.
@@ -1950,7 +1954,7 @@ PeCoffLoaderRelocateImageForRuntime (
             //
             // Only Itanium requires ConvertPeImage_Ex
             //
-            Status = PeHotRelocateImageEx (Reloc, Fixup, &FixupData, Adjust);
+            Status = PeHotRelocateImageEx (Reloc, Fixup, &FixupData, Adjust, &RelocationState);
             if (RETURN_ERROR (Status)) {
               return;
             }
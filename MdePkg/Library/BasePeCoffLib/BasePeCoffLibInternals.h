@@ -26,6 +26,23 @@
 #define RISCV_CONST_HIGH_PART(VALUE) \
   (((VALUE) + (RISCV_IMM_REACH/2)) & ~(RISCV_IMM_REACH-1))
 
+//
+// The state that a relocation pass over the relocation blocks of an image
+// carries from one relocation record to the next. The caller zeroes it before
+// the first block, and keeps it across blocks, since the records of a fixup
+// that spans several records may be in different blocks.
+//
+typedef struct {
+  //
+  // The lui instruction of the last RISC-V HI20 record, or NULL if there is
+  // none, the instruction as it read before this pass, and whether one of
+  // the LOW12 records that share it adjusted it already.
+  //
+  UINT32     *RiscVHi20Fixup;
+  UINT32     RiscVHi20Value;
+  BOOLEAN    RiscVHi20Adjusted;
+} PE_COFF_LOADER_RELOCATION_STATE;
+
 /**
   Performs an Itanium-based specific relocation fixup and is a no-op on other
   instruction sets.
@@ -34,16 +51,19 @@
   @param  Fixup       The pointer to the address to fix up.
   @param  FixupData   The pointer to a buffer to log the fixups.
   @param  Adjust      The offset to adjust the fixup.
+  @param  State       The state that the relocation pass carries from one
+                      relocation record to the next.
 
   @return Status code.
 
 **/
 RETURN_STATUS
 PeCoffLoaderRelocateImageEx (
-  IN UINT16     *Reloc,
-  IN OUT CHAR8  *Fixup,
-  IN OUT CHAR8  **FixupData,
-  IN UINT64     Adjust
+  IN UINT16                               *Reloc,
+  IN OUT CHAR8                            *Fixup,
+  IN OUT CHAR8                            **FixupData,
+  IN UINT64                               Adjust,
+  IN OUT PE_COFF_LOADER_RELOCATION_STATE  *State
   );
 
 /**
@@ -55,16 +75,19 @@ PeCoffLoaderRelocateImageEx (
   @param  Fixup       The pointer to the address to fix up.
   @param  FixupData   The pointer to a buffer to log the fixups.
   @param  Adjust      The offset to adjust the fixup.
+  @param  State       The state that the relocation pass carries from one
+                      relocation record to the next.
 
   @return Status code.
 
 **/
 RETURN_STATUS
 PeHotRelocateImageEx (
-  IN UINT16     *Reloc,
-  IN OUT CHAR8  *Fixup,
-  IN OUT CHAR8  **FixupData,
-  IN UINT64     Adjust
+  IN UINT16                               *Reloc,
+  IN OUT CHAR8                            *Fixup,
+  IN OUT CHAR8                            **FixupData,
+  IN UINT64                               Adjust,
+  IN OUT PE_COFF_LOADER_RELOCATION_STATE  *State
   );
 
 /**
@@ -17,16 +17,19 @@
   @param[in, out]  Fixup       Pointer to the address to fix up.
   @param[in, out]  FixupData   Pointer to a buffer to log the fixups.
   @param[in]       Adjust      The offset to adjust the fixup.
+  @param[in, out]  State       The state that the relocation pass carries from one
+                               relocation record to the next.
 
   @return Status code.
 
 **/
 RETURN_STATUS
 PeCoffLoaderRelocateImageEx (
-  IN UINT16     *Reloc,
-  IN OUT CHAR8  *Fixup,
-  IN OUT CHAR8  **FixupData,
-  IN UINT64     Adjust
+  IN UINT16                               *Reloc,
+  IN OUT CHAR8                            *Fixup,
+  IN OUT CHAR8                            **FixupData,
+  IN UINT64                               Adjust,
+  IN OUT PE_COFF_LOADER_RELOCATION_STATE  *State
   )
 {
   UINT8   RelocType;
@@ -128,18 +131,21 @@ PeCoffLoaderImageFormatSupported (
   @param[in, out]  Fixup       The pointer to the address to fix up.
   @param[in, out]  FixupData   The pointer to a buffer to log the fixups.
   @param[in]       Adjust      The offset to adjust the fixup.
+  @param[in, out]  State       The state that the relocation pass carries from one
+                               relocation record to the next.
 
   @return Status code.
 
 **/
 RETURN_STATUS
 PeHotRelocateImageEx (
-  IN UINT16     *Reloc,
-  IN OUT CHAR8  *Fixup,
-  IN OUT CHAR8  **FixupData,
-  IN UINT64     Adjust
+  IN UINT16                               *Reloc,
+  IN OUT CHAR8                            *Fixup,
+  IN OUT CHAR8                            **FixupData,
+  IN UINT64                               Adjust,
+  IN OUT PE_COFF_LOADER_RELOCATION_STATE  *State
   )
 {
   // To check
-  return PeCoffLoaderRelocateImageEx (Reloc, Fixup, FixupData, Adjust);
+  return PeCoffLoaderRelocateImageEx (Reloc, Fixup, FixupData, Adjust, State);
 }
@@ -16,16 +16,19 @@
   @param  Fixup       The pointer to the address to fix up.
   @param  FixupData   The pointer to a buffer to log the fixups.
   @param  Adjust      The offset to adjust the fixup.
+  @param  State       The state that the relocation pass carries from one
+                      relocation record to the next.
 
   @return Status code.
 
 **/
 RETURN_STATUS
 PeCoffLoaderRelocateImageEx (
-  IN UINT16     *Reloc,
-  IN OUT CHAR8  *Fixup,
-  IN OUT CHAR8  **FixupData,
-  IN UINT64     Adjust
+  IN UINT16                               *Reloc,
+  IN OUT CHAR8                            *Fixup,
+  IN OUT CHAR8                            **FixupData,
+  IN UINT64                               Adjust,
+  IN OUT PE_COFF_LOADER_RELOCATION_STATE  *State
   )
 {
   return RETURN_UNSUPPORTED;
@@ -67,16 +70,19 @@ PeCoffLoaderImageFormatSupported (
   @param  Fixup       The pointer to the address to fix up.
   @param  FixupData   The pointer to a buffer to log the fixups.
   @param  Adjust      The offset to adjust the fixup.
+  @param  State       The state that the relocation pass carries from one
+                      relocation record to the next.
 
   @return Status code.
 
 **/
 RETURN_STATUS
 PeHotRelocateImageEx (
-  IN UINT16     *Reloc,
-  IN OUT CHAR8  *Fixup,
-  IN OUT CHAR8  **FixupData,
-  IN UINT64     Adjust
+  IN UINT16                               *Reloc,
+  IN OUT CHAR8                            *Fixup,
+  IN OUT CHAR8                            **FixupData,
+  IN UINT64                               Adjust,
+  IN OUT PE_COFF_LOADER_RELOCATION_STATE  *State
   )
 {
   return RETURN_UNSUPPORTED;
@@ -7,76 +7,161 @@
 #include "BasePeCoffLibInternals.h"
 #include <Library/BaseLib.h>
 
+/**
+  Remembers the lui instruction of a HI20 relocation record, for the LOW12I and
+  LOW12S records that pair with it.
+
+  The tools emit the HI20 record of a lui/addi or lui/load-store pair before its
+  LOW12 records, but not necessarily right before them, nor in the same
+  relocation block, and one lui may be shared by several loads and stores. So
+  the lui is kept in the state of the relocation pass until the next HI20
+  record, and isn't adjusted until its first LOW12 record.
+
+  @param  Hi20Fixup   The pointer to the lui instruction.
+  @param  State       The state of the relocation pass.
+
+**/
+STATIC
+VOID
+RiscVSetHi20 (
+  IN UINT32                               *Hi20Fixup,
+  IN OUT PE_COFF_LOADER_RELOCATION_STATE  *State
+  )
+{
+  //
+  // A repeated record for the same lui must not have it adjusted twice.
+  //
+  if (State->RiscVHi20Fixup == Hi20Fixup) {
+    return;
+  }
+
+  State->RiscVHi20Fixup    = Hi20Fixup;
+  State->RiscVHi20Value    = *Hi20Fixup;
+  State->RiscVHi20Adjusted = FALSE;
+}
+
+/**
+  Adjusts the address that the last lui and an addi, load or store compose.
+
+  The address is composed from the lui as it read before this pass, so that
+  every LOW12 record that shares the lui sees the same address. The lui is
+  adjusted by the first of them only, and the others keep its high part and
+  only have their low 12 bits adjusted.
+
+  @param  Low12Fixup  The pointer to the addi, load or store instruction.
+  @param  Store       TRUE if the low 12 bits are split as in an S-type instruction.
+  @param  Adjust      The offset to adjust the address.
+  @param  State       The state of the relocation pass.
+
+  @retval RETURN_SUCCESS      The address was adjusted.
+  @retval RETURN_UNSUPPORTED  The adjusted address is out of the reach of the
+                              adjusted lui.
+
+**/
+STATIC
+RETURN_STATUS
+RiscVRelocateLow12 (
+  IN OUT UINT32                           *Low12Fixup,
+  IN BOOLEAN                              Store,
+  IN UINT64                               Adjust,
+  IN OUT PE_COFF_LOADER_RELOCATION_STATE  *State
+  )
+{
+  UINT32  Value;
+  UINT32  Value2;
+
+  Value = (UINT32)(RV_X (State->RiscVHi20Value, 12, 20) << 12);
+  if (Store) {
+    Value2 = (UINT32)(RV_X (*Low12Fixup, 7, 5) | (RV_X (*Low12Fixup, 25, 7) << 5));
+  } else {
+    Value2 = (UINT32)(RV_X (*Low12Fixup, 20, 12));
+  }
+
+  if (Value2 & (RISCV_IMM_REACH/2)) {
+    Value2 |= ~(RISCV_IMM_REACH-1);
+  }
+
+  Value += Value2;
+  Value += (UINT32)Adjust;
+  if (!State->RiscVHi20Adjusted) {
+    Value2                   = (UINT32)RISCV_CONST_HIGH_PART (Value);
+    *State->RiscVHi20Fixup   = (RV_X (Value2, 12, 20) << 12) | (RV_X (*State->RiscVHi20Fixup, 0, 12));
+    State->RiscVHi20Adjusted = TRUE;
+  } else {
+    Value2 = (UINT32)(RV_X (*State->RiscVHi20Fixup, 12, 20) << 12);
+  }
+
+  Value -= Value2;
+  if ((UINT32)(Value + RISCV_IMM_REACH/2) >= RISCV_IMM_REACH) {
+    return RETURN_UNSUPPORTED;
+  }
+
+  if (Store) {
+    *Low12Fixup = (*Low12Fixup & 0x01fff07f) | (UINT32)((RV_X (Value, 0, 5) << 7) | (RV_X (Value, 5, 7) << 25));
+  } else {
+    *Low12Fixup = (RV_X (Value, 0, 12) << 20) | (RV_X (*Low12Fixup, 0, 20));
+  }
+
+  return RETURN_SUCCESS;
+}
+
 /**
   Performs an RISC-V specific relocation fixup and is a no-op on
   other instruction sets.
   RISC-V splits 32-bit fixup into 20bit and 12-bit with two relocation
   types. We have to know the lower 12-bit fixup first then we can deal
-  carry over on high 20-bit fixup. So we log the high 20-bit in
-  FixupData.
+  carry over on high 20-bit fixup. So the lui of a HI20 record is kept
+  in State, and fixed up at its first LOW12 record. Each LOW12 record
+  logs the lui and its own instruction in FixupData, so that the pair
+  can be re-relocated for runtime.
 
   @param  Reloc       The pointer to the relocation record.
   @param  Fixup       The pointer to the address to fix up.
   @param  FixupData   The pointer to a buffer to log the fixups.
   @param  Adjust      The offset to adjust the fixup.
+  @param  State       The state that the relocation pass carries from one
+                      relocation record to the next.
 
   @return Status code.
 
 **/
 RETURN_STATUS
 PeCoffLoaderRelocateImageEx (
-  IN UINT16     *Reloc,
-  IN OUT CHAR8  *Fixup,
-  IN OUT CHAR8  **FixupData,
-  IN UINT64     Adjust
+  IN UINT16                               *Reloc,
+  IN OUT CHAR8                            *Fixup,
+  IN OUT CHAR8                            **FixupData,
+  IN UINT64                               Adjust,
+  IN OUT PE_COFF_LOADER_RELOCATION_STATE  *State
   )
 {
-  UINT32  Value;
-  UINT32  Value2;
-  UINT32  *RiscVHi20Fixup;
+  RETURN_STATUS  Status;
 
   switch ((*Reloc) >> 12) {
     case EFI_IMAGE_REL_BASED_RISCV_HI20:
-      *(UINT64 *)(*FixupData) = (UINT64)(UINTN)Fixup;
+      RiscVSetHi20 ((UINT32 *)Fixup, State);
       break;
 
     case EFI_IMAGE_REL_BASED_RISCV_LOW12I:
-      RiscVHi20Fixup =  (UINT32 *)(*(UINT64 *)(*FixupData));
-      if (RiscVHi20Fixup != NULL) {
-        Value  = (UINT32)(RV_X (*RiscVHi20Fixup, 12, 20) << 12);
-        Value2 = (UINT32)(RV_X (*(UINT32 *)Fixup, 20, 12));
-        if (Value2 & (RISCV_IMM_REACH/2)) {
-          Value2 |= ~(RISCV_IMM_REACH-1);
-        }
-
-        Value                    += Value2;
-        Value                    += (UINT32)Adjust;
-        Value2                    = RISCV_CONST_HIGH_PART (Value);
-        *(UINT32 *)RiscVHi20Fixup = (RV_X (Value2, 12, 20) << 12) | \
-                                    (RV_X (*(UINT32 *)RiscVHi20Fixup, 0, 12));
-        *(UINT32 *)Fixup = (RV_X (Value, 0, 12) << 20) | \
-                           (RV_X (*(UINT32 *)Fixup, 0, 20));
+    case EFI_IMAGE_REL_BASED_RISCV_LOW12S:
+      if (State->RiscVHi20Fixup == NULL) {
+        return RETURN_UNSUPPORTED;
       }
 
-      break;
+      Status = RiscVRelocateLow12 (
+                 (UINT32 *)Fixup,
+                 (BOOLEAN)(((*Reloc) >> 12) == EFI_IMAGE_REL_BASED_RISCV_LOW12S),
+                 Adjust,
+                 State
+                 );
+      if (RETURN_ERROR (Status)) {
+        return Status;
+      }
 
-    case EFI_IMAGE_REL_BASED_RISCV_LOW12S:
-      RiscVHi20Fixup =  (UINT32 *)(*(UINT64 *)(*FixupData));
-      if (RiscVHi20Fixup != NULL) {
-        Value  = (UINT32)(RV_X (*RiscVHi20Fixup, 12, 20) << 12);
-        Value2 = (UINT32)(RV_X (*(UINT32 *)Fixup, 7, 5) | (RV_X (*(UINT32 *)Fixup, 25, 7) << 5));
-        if (Value2 & (RISCV_IMM_REACH/2)) {
-          Value2 |= ~(RISCV_IMM_REACH-1);
-        }
-
-        Value                    += Value2;
-        Value                    += (UINT32)Adjust;
-        Value2                    = RISCV_CONST_HIGH_PART (Value);
-        *(UINT32 *)RiscVHi20Fixup = (RV_X (Value2, 12, 20) << 12) | \
-                                    (RV_X (*(UINT32 *)RiscVHi20Fixup, 0, 12));
-        Value2           = *(UINT32 *)Fixup & 0x01fff07f;
-        Value           &= RISCV_IMM_REACH - 1;
-        *(UINT32 *)Fixup = Value2 | (UINT32)(((RV_X (Value, 0, 5) << 7) | (RV_X (Value, 5, 7) << 25)));
+      if (*FixupData != NULL) {
+        *FixupData                  = ALIGN_POINTER (*FixupData, sizeof (UINT32));
+        *(UINT32 *)(*FixupData)     = *State->RiscVHi20Fixup;
+        *((UINT32 *)(*FixupData)+1) = *(UINT32 *)Fixup;
+        *FixupData                  = *FixupData + 2 * sizeof (UINT32);
       }
 
       break;
@@ -120,25 +205,60 @@ PeCoffLoaderImageFormatSupported (
 }
 
 /**
-  Performs an Itanium-based specific re-relocation fixup and is a no-op on other
-  instruction sets. This is used to re-relocated the image into the EFI virtual
-  space for runtime calls.
+  Performs a RISC-V specific re-relocation fixup. This is used to re-relocate
+  the image into the EFI virtual space for runtime calls. An addi, load or
+  store is re-relocated only if neither it nor its lui changed since they were
+  logged. The lui is compared as it read before this pass, since another LOW12
+  record that shares it may have re-relocated it already.
 
   @param  Reloc       The pointer to the relocation record.
   @param  Fixup       The pointer to the address to fix up.
   @param  FixupData   The pointer to a buffer to log the fixups.
   @param  Adjust      The offset to adjust the fixup.
+  @param  State       The state that the relocation pass carries from one
+                      relocation record to the next.
 
   @return Status code.
 
 **/
 RETURN_STATUS
 PeHotRelocateImageEx (
-  IN UINT16     *Reloc,
-  IN OUT CHAR8  *Fixup,
-  IN OUT CHAR8  **FixupData,
-  IN UINT64     Adjust
+  IN UINT16                               *Reloc,
+  IN OUT CHAR8                            *Fixup,
+  IN OUT CHAR8                            **FixupData,
+  IN UINT64                               Adjust,
+  IN OUT PE_COFF_LOADER_RELOCATION_STATE  *State
   )
 {
-  return RETURN_UNSUPPORTED;
+  switch ((*Reloc) >> 12) {
+    case EFI_IMAGE_REL_BASED_RISCV_HI20:
+      RiscVSetHi20 ((UINT32 *)Fixup, State);
+      break;
+
+    case EFI_IMAGE_REL_BASED_RISCV_LOW12I:
+    case EFI_IMAGE_REL_BASED_RISCV_LOW12S:
+      if (State->RiscVHi20Fixup == NULL) {
+        return RETURN_UNSUPPORTED;
+      }
+
+      *FixupData = ALIGN_POINTER (*FixupData, sizeof (UINT32));
+      if ((*(UINT32 *)(*FixupData) == State->RiscVHi20Value) &&
+          (*((UINT32 *)(*FixupData)+1) == *(UINT32 *)Fixup))
+      {
+        RiscVRelocateLow12 (
+          (UINT32 *)Fixup,
+          (BOOLEAN)(((*Reloc) >> 12) == EFI_IMAGE_REL_BASED_RISCV_LOW12S),
+          Adjust,
+          State
+          );
+      }
+
+      *FixupData = *FixupData + 2 * sizeof (UINT32);
+      break;
+
+    default:
+      return RETURN_UNSUPPORTED;
+  }
+
+  return RETURN_SUCCESS;
 }
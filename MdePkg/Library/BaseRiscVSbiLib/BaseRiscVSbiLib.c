@@ -113,8 +113,12 @@ TranslateError (
       return EFI_LOAD_ERROR;
       break;
     case SBI_ERR_ALREADY_AVAILABLE:
+    case SBI_ERR_ALREADY_STARTED:
       return EFI_ALREADY_STARTED;
       break;
+    case SBI_ERR_ALREADY_STOPPED:
+      return EFI_NOT_STARTED;
+      break;
     default:
       //
       // Reaches here only if SBI has defined a new error type
@@ -167,3 +171,317 @@ SbiSystemReset (
 
   return TranslateError (Ret.Error);
 }
+
+/**
+  Start a stopped hart using the HSM SBI extension.
+
+  The hart begins executing in S-mode at StartAddress with the MMU off, a0 set
+  to its hart ID and a1 set to Opaque.
+
+  @param[in]  HartId               The hart to start.
+  @param[in]  StartAddress         Physical address the hart starts executing at.
+  @param[in]  Opaque               Value passed to the hart in a1.
+**/
+EFI_STATUS
+EFIAPI
+SbiHartStart (
+  IN  UINTN  HartId,
+  IN  UINTN  StartAddress,
+  IN  UINTN  Opaque
+  )
+{
+  SBI_RET  Ret;
+
+  Ret = SbiCall (
+          SBI_EXT_HSM,
+          SBI_EXT_HSM_HART_START,
+          3,
+          HartId,
+          StartAddress,
+          Opaque
+          );
+
+  return TranslateError (Ret.Error);
+}
+
+/**
+  Stop the calling hart using the HSM SBI extension.
+
+  Only returns if the hart could not be stopped.
+**/
+EFI_STATUS
+EFIAPI
+SbiHartStop (
+  VOID
+  )
+{
+  SBI_RET  Ret;
+
+  Ret = SbiCall (SBI_EXT_HSM, SBI_EXT_HSM_HART_STOP, 0);
+
+  return TranslateError (Ret.Error);
+}
+
+/**
+  Get the HSM state of a hart.
+
+  @param[in]  HartId               The hart to query.
+  @param[out] HartState            One of the SBI_HSM_STATE_* values.
+**/
+EFI_STATUS
+EFIAPI
+SbiHartGetStatus (
+  IN  UINTN  HartId,
+  OUT UINTN  *HartState
+  )
+{
+  SBI_RET  Ret;
+
+  Ret = SbiCall (SBI_EXT_HSM, SBI_EXT_HSM_HART_GET_STATUS, 1, HartId);
+  if (Ret.Error != SBI_SUCCESS) {
+    return TranslateError (Ret.Error);
+  }
+
+  *HartState = Ret.Value;
+  return EFI_SUCCESS;
+}
+
+/**
+  Execute fence.i on a set of harts using the RFENCE SBI extension.
+
+  @param[in]  HartMask             The harts, as a bit mask relative to HartMaskBase.
+  @param[in]  HartMaskBase         The hart ID of bit 0 of HartMask, or
+                                   SBI_HART_MASK_BASE_ALL for every hart.
+**/
+EFI_STATUS
+EFIAPI
+SbiRemoteFenceI (
+  IN  UINTN  HartMask,
+  IN  UINTN  HartMaskBase
+  )
+{
+  SBI_RET  Ret;
+
+  Ret = SbiCall (
+          SBI_EXT_RFENCE,
+          SBI_EXT_RFENCE_REMOTE_FENCE_I,
+          2,
+          HartMask,
+          HartMaskBase
+          );
+
+  return TranslateError (Ret.Error);
+}
+
+/**
+  Execute sfence.vma for a range of addresses on a set of harts using the
+  RFENCE SBI extension.
+
+  A StartAddress and Size of 0 flush all addresses.
+
+  @param[in]  HartMask             The harts, as a bit mask relative to HartMaskBase.
+  @param[in]  HartMaskBase         The hart ID of bit 0 of HartMask, or
+                                   SBI_HART_MASK_BASE_ALL for every hart.
+  @param[in]  StartAddress         The first virtual address to flush.
+  @param[in]  Size                 The size of the range to flush.
+**/
+EFI_STATUS
+EFIAPI
+SbiRemoteSfenceVma (
+  IN  UINTN  HartMask,
+  IN  UINTN  HartMaskBase,
+  IN  UINTN  StartAddress,
+  IN  UINTN  Size
+  )
+{
+  SBI_RET  Ret;
+
+  Ret = SbiCall (
+          SBI_EXT_RFENCE,
+          SBI_EXT_RFENCE_REMOTE_SFENCE_VMA,
+          4,
+          HartMask,
+          HartMaskBase,
+          StartAddress,
+          Size
+          );
+
+  return TranslateError (Ret.Error);
+}
+
+/**
+  Get the number of counters, hardware and firmware, using the PMU SBI extension.
+
+  @param[out] NumCounters          The number of counters.
+**/
+EFI_STATUS
+EFIAPI
+SbiPmuNumCounters (
+  OUT UINTN  *NumCounters
+  )
+{
+  SBI_RET  Ret;
+
+  Ret = SbiCall (SBI_EXT_PMU, SBI_EXT_PMU_NUM_COUNTERS, 0);
+  if (Ret.Error != SBI_SUCCESS) {
+    return TranslateError (Ret.Error);
+  }
+
+  *NumCounters = Ret.Value;
+  return EFI_SUCCESS;
+}
+
+/**
+  Get the information of a counter using the PMU SBI extension.
+
+  @param[in]  CounterIndex         The counter.
+  @param[out] CounterInfo          The information, to be decoded with the
+                                   SBI_PMU_COUNTER_INFO_* macros.
+**/
+EFI_STATUS
+EFIAPI
+SbiPmuCounterGetInfo (
+  IN  UINTN  CounterIndex,
+  OUT UINTN  *CounterInfo
+  )
+{
+  SBI_RET  Ret;
+
+  Ret = SbiCall (SBI_EXT_PMU, SBI_EXT_PMU_COUNTER_GET_INFO, 1, CounterIndex);
+  if (Ret.Error != SBI_SUCCESS) {
+    return TranslateError (Ret.Error);
+  }
+
+  *CounterInfo = Ret.Value;
+  return EFI_SUCCESS;
+}
+
+/**
+  Find and configure a counter for an event using the PMU SBI extension.
+
+  @param[in]  CounterIndexBase     The first counter that may be chosen.
+  @param[in]  CounterIndexMask     The counters that may be chosen, as a bit mask
+                                   relative to CounterIndexBase.
+  @param[in]  ConfigFlags          SBI_PMU_CFG_FLAG_* values.
+  @param[in]  EventIndex           The event, such as SBI_PMU_HW_CPU_CYCLES.
+  @param[in]  EventData            The data of a raw or firmware event.
+  @param[out] CounterIndex         The counter that was configured.
+**/
+EFI_STATUS
+EFIAPI
+SbiPmuCounterConfigMatching (
+  IN  UINTN   CounterIndexBase,
+  IN  UINTN   CounterIndexMask,
+  IN  UINTN   ConfigFlags,
+  IN  UINTN   EventIndex,
+  IN  UINT64  EventData,
+  OUT UINTN   *CounterIndex
+  )
+{
+  SBI_RET  Ret;
+
+  Ret = SbiCall (
+          SBI_EXT_PMU,
+          SBI_EXT_PMU_COUNTER_CONFIG_MATCHING,
+          5,
+          CounterIndexBase,
+          CounterIndexMask,
+          ConfigFlags,
+          EventIndex,
+          (UINTN)EventData
+          );
+  if (Ret.Error != SBI_SUCCESS) {
+    return TranslateError (Ret.Error);
+  }
+
+  *CounterIndex = Ret.Value;
+  return EFI_SUCCESS;
+}
+
+/**
+  Start a set of counters using the PMU SBI extension.
+
+  @param[in]  CounterIndexBase     The first counter.
+  @param[in]  CounterIndexMask     The counters, as a bit mask relative to CounterIndexBase.
+  @param[in]  StartFlags           SBI_PMU_START_FLAG_* values.
+  @param[in]  InitialValue         The value the counters start from, with
+                                   SBI_PMU_START_FLAG_SET_INIT_VALUE.
+**/
+EFI_STATUS
+EFIAPI
+SbiPmuCounterStart (
+  IN  UINTN   CounterIndexBase,
+  IN  UINTN   CounterIndexMask,
+  IN  UINTN   StartFlags,
+  IN  UINT64  InitialValue
+  )
+{
+  SBI_RET  Ret;
+
+  Ret = SbiCall (
+          SBI_EXT_PMU,
+          SBI_EXT_PMU_COUNTER_START,
+          4,
+          CounterIndexBase,
+          CounterIndexMask,
+          StartFlags,
+          (UINTN)InitialValue
+          );
+
+  return TranslateError (Ret.Error);
+}
+
+/**
+  Stop a set of counters using the PMU SBI extension.
+
+  @param[in]  CounterIndexBase     The first counter.
+  @param[in]  CounterIndexMask     The counters, as a bit mask relative to CounterIndexBase.
+  @param[in]  StopFlags            SBI_PMU_STOP_FLAG_* values.
+**/
+EFI_STATUS
+EFIAPI
+SbiPmuCounterStop (
+  IN  UINTN  CounterIndexBase,
+  IN  UINTN  CounterIndexMask,
+  IN  UINTN  StopFlags
+  )
+{
+  SBI_RET  Ret;
+
+  Ret = SbiCall (
+          SBI_EXT_PMU,
+          SBI_EXT_PMU_COUNTER_STOP,
+          3,
+          CounterIndexBase,
+          CounterIndexMask,
+          StopFlags
+          );
+
+  return TranslateError (Ret.Error);
+}
+
+/**
+  Read a firmware counter using the PMU SBI extension.
+
+  Hardware counters are read through their CSR instead.
+
+  @param[in]  CounterIndex         The counter.
+  @param[out] Value                The value of the counter.
+**/
+EFI_STATUS
+EFIAPI
+SbiPmuCounterFirmwareRead (
+  IN  UINTN   CounterIndex,
+  OUT UINT64  *Value
+  )
+{
+  SBI_RET  Ret;
+
+  Ret = SbiCall (SBI_EXT_PMU, SBI_EXT_PMU_COUNTER_FW_READ, 1, CounterIndex);
+  if (Ret.Error != SBI_SUCCESS) {
+    return TranslateError (Ret.Error);
+  }
+
+  *Value = Ret.Value;
+  return EFI_SUCCESS;
+}
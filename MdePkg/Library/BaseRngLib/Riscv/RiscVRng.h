@@ -0,0 +1,40 @@
+/** @file
+  Entropy source of the RISC-V random number generator services, the seed
+  CSR of the Zkr extension.
+
+  Copyright (c) 2024, Rivos, Inc.
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+**/
+
+#ifndef RISCV_RNG_H_
+#define RISCV_RNG_H_
+
+/**
+  Reads the seed CSR.
+
+  @return The value of the seed CSR.
+**/
+UINT64
+ReadSeed (
+  VOID
+  );
+
+/**
+  Gets 64-bit words of entropy from the seed CSR, 16 bits at a time.
+
+  @param[out] Out      Buffer to store the words in.
+  @param[in]  Count    The number of words to get.
+
+  @retval TRUE         The buffer was filled.
+  @retval FALSE        The entropy source is not supported, failed, or kept
+                       the CPU waiting too long.
+**/
+BOOLEAN
+RiscVGetSeed (
+  OUT UINT64  *Out,
+  IN  UINTN   Count
+  );
+
+#endif // RISCV_RNG_H_
@@ -0,0 +1,287 @@
+/** @file
+   Random number generator service that stretches entropy from the SEED
+   instruction with a ChaCha20 based DRBG, so that most requests are served
+   from a pool in memory rather than by polling the seed CSR.
+
+   The DRBG erases its key as it goes: every refill of the pool generates a
+   batch of ChaCha20 blocks, one of which replaces the key, and each byte of
+   the pool is handed out once and then cleared. The key is reseeded from the
+   seed CSR every RNG_RESEED_INTERVAL bytes.
+
+   The DRBG state lives in globals, so this instance is meant for phases
+   running from RAM. See Rng.c for the variant that reads the seed CSR on
+   every request.
+
+   Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+
+   SPDX-License-Identifier: BSD-2-Clause-Patent
+ **/
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/RngLib.h>
+
+#include "BaseRngLibInternals.h"
+#include "RiscVRng.h"
+
+#define CHACHA20_BLOCK_WORDS  16
+#define CHACHA20_KEY_WORDS    8
+
+//
+// The pool holds this many ChaCha20 blocks.
+//
+#define RNG_POOL_BLOCKS  4
+#define RNG_POOL_SIZE    (RNG_POOL_BLOCKS * CHACHA20_BLOCK_WORDS * sizeof (UINT32))
+
+//
+// The seed CSR output is not full entropy, so each reseed mixes in twice as
+// many bits as the key holds.
+//
+#define RNG_SEED_WORDS  (2 * CHACHA20_KEY_WORDS * sizeof (UINT32) / sizeof (UINT64))
+
+#define RNG_RESEED_INTERVAL  SIZE_1MB
+
+#define CHACHA20_ROTATE(Value, Count)  (((Value) << (Count)) | ((Value) >> (32 - (Count))))
+
+#define CHACHA20_QUARTER_ROUND(A, B, C, D)                      \
+  do {                                                          \
+    (A) += (B); (D) ^= (A); (D) = CHACHA20_ROTATE ((D), 16);    \
+    (C) += (D); (B) ^= (C); (B) = CHACHA20_ROTATE ((B), 12);    \
+    (A) += (B); (D) ^= (A); (D) = CHACHA20_ROTATE ((D), 8);     \
+    (C) += (D); (B) ^= (C); (B) = CHACHA20_ROTATE ((B), 7);     \
+  } while (FALSE)
+
+STATIC UINT32  mRngKey[CHACHA20_KEY_WORDS];
+STATIC UINT8   mRngPool[RNG_POOL_SIZE];
+STATIC UINTN   mRngPoolOffset       = RNG_POOL_SIZE;
+STATIC UINTN   mRngBytesSinceReseed = RNG_RESEED_INTERVAL;
+
+/**
+   Computes a ChaCha20 block (RFC 8439) with a zero nonce.
+
+   @param[in]  Key      The 256-bit key.
+   @param[in]  Counter  The block counter.
+   @param[out] Block    The 512-bit block.
+ **/
+STATIC
+VOID
+ChaCha20Block (
+  IN  CONST UINT32  *Key,
+  IN  UINT32        Counter,
+  OUT UINT32        *Block
+  )
+{
+  UINT32  State[CHACHA20_BLOCK_WORDS];
+  UINTN   Index;
+
+  State[0] = 0x61707865;
+  State[1] = 0x3320646e;
+  State[2] = 0x79622d32;
+  State[3] = 0x6b206574;
+  CopyMem (&State[4], Key, CHACHA20_KEY_WORDS * sizeof (UINT32));
+  State[12] = Counter;
+  State[13] = 0;
+  State[14] = 0;
+  State[15] = 0;
+
+  CopyMem (Block, State, sizeof (State));
+  for (Index = 0; Index < 10; Index++) {
+    CHACHA20_QUARTER_ROUND (Block[0], Block[4], Block[8], Block[12]);
+    CHACHA20_QUARTER_ROUND (Block[1], Block[5], Block[9], Block[13]);
+    CHACHA20_QUARTER_ROUND (Block[2], Block[6], Block[10], Block[14]);
+    CHACHA20_QUARTER_ROUND (Block[3], Block[7], Block[11], Block[15]);
+    CHACHA20_QUARTER_ROUND (Block[0], Block[5], Block[10], Block[15]);
+    CHACHA20_QUARTER_ROUND (Block[1], Block[6], Block[11], Block[12]);
+    CHACHA20_QUARTER_ROUND (Block[2], Block[7], Block[8], Block[13]);
+    CHACHA20_QUARTER_ROUND (Block[3], Block[4], Block[9], Block[14]);
+  }
+
+  for (Index = 0; Index < CHACHA20_BLOCK_WORDS; Index++) {
+    Block[Index] += State[Index];
+  }
+
+  ZeroMem (State, sizeof (State));
+}
+
+/**
+   Mixes fresh entropy from the seed CSR into the key, and discards the pool.
+
+   @retval TRUE         The DRBG was reseeded.
+   @retval FALSE        The seed CSR did not provide enough entropy.
+ **/
+STATIC
+BOOLEAN
+RngReseed (
+  VOID
+  )
+{
+  UINT64  Seed[RNG_SEED_WORDS];
+  UINT32  Block[CHACHA20_BLOCK_WORDS];
+  UINT32  *Words;
+  UINTN   Index;
+  UINTN   Offset;
+
+  if (!RiscVGetSeed (Seed, RNG_SEED_WORDS)) {
+    return FALSE;
+  }
+
+  //
+  // Absorb the seed a key's worth at a time: XOR it into the key, and replace
+  // the key with part of a block computed from the result.
+  //
+  Words = (UINT32 *)Seed;
+  for (Offset = 0; Offset < RNG_SEED_WORDS * 2; Offset += CHACHA20_KEY_WORDS) {
+    for (Index = 0; Index < CHACHA20_KEY_WORDS; Index++) {
+      mRngKey[Index] ^= Words[Offset + Index];
+    }
+
+    ChaCha20Block (mRngKey, MAX_UINT32, Block);
+    CopyMem (mRngKey, Block, sizeof (mRngKey));
+  }
+
+  ZeroMem (Seed, sizeof (Seed));
+  ZeroMem (Block, sizeof (Block));
+  ZeroMem (mRngPool, sizeof (mRngPool));
+  mRngPoolOffset       = RNG_POOL_SIZE;
+  mRngBytesSinceReseed = 0;
+  return TRUE;
+}
+
+/**
+   Refills the pool, and replaces the key.
+ **/
+STATIC
+VOID
+RngRefill (
+  VOID
+  )
+{
+  UINT32  Block[CHACHA20_BLOCK_WORDS];
+  UINTN   Index;
+
+  for (Index = 0; Index < RNG_POOL_BLOCKS; Index++) {
+    ChaCha20Block (mRngKey, (UINT32)Index + 1, (UINT32 *)mRngPool + Index * CHACHA20_BLOCK_WORDS);
+  }
+
+  ChaCha20Block (mRngKey, 0, Block);
+  CopyMem (mRngKey, Block, sizeof (mRngKey));
+  ZeroMem (Block, sizeof (Block));
+  mRngPoolOffset = 0;
+}
+
+/**
+   Hands out bytes from the pool, refilling or reseeding as needed.
+
+   @param[out] Buffer   Buffer to store the bytes in.
+   @param[in]  Length   The number of bytes, at most 8.
+
+   @retval TRUE         Random bytes generated successfully.
+   @retval FALSE        The DRBG needed reseeding, and the seed CSR failed.
+ **/
+STATIC
+BOOLEAN
+RngGetBytes (
+  OUT VOID   *Buffer,
+  IN  UINTN  Length
+  )
+{
+  BOOLEAN  InterruptState;
+  BOOLEAN  Success;
+
+  //
+  // Keep an interrupt handler from being handed the same bytes.
+  //
+  InterruptState = SaveAndDisableInterrupts ();
+
+  Success = TRUE;
+  if (mRngBytesSinceReseed >= RNG_RESEED_INTERVAL) {
+    Success = RngReseed ();
+  }
+
+  if (Success) {
+    if (mRngPoolOffset + Length > RNG_POOL_SIZE) {
+      RngRefill ();
+    }
+
+    CopyMem (Buffer, &mRngPool[mRngPoolOffset], Length);
+    ZeroMem (&mRngPool[mRngPoolOffset], Length);
+    mRngPoolOffset       += Length;
+    mRngBytesSinceReseed += Length;
+  }
+
+  SetInterruptState (InterruptState);
+  return Success;
+}
+
+/**
+   Constructor library which initializes Seeds and mStatus array.
+
+   The DRBG is seeded on first use instead.
+
+   @retval EFI_SUCCESS  initialization was successful.
+
+ **/
+EFI_STATUS
+EFIAPI
+BaseRngLibConstructor (
+  VOID
+  )
+{
+  return EFI_SUCCESS;
+}
+
+/**
+   Generates a 16-bit random number.
+
+   @param[out] Rand     Buffer pointer to store the 16-bit random value.
+
+   @retval TRUE         Random number generated successfully.
+   @retval FALSE        Failed to generate the random number.
+
+ **/
+BOOLEAN
+EFIAPI
+ArchGetRandomNumber16 (
+  OUT UINT16  *Rand
+  )
+{
+  return RngGetBytes (Rand, sizeof (*Rand));
+}
+
+/**
+   Generates a 32-bit random number.
+
+   @param[out] Rand     Buffer pointer to store the 32-bit random value.
+
+   @retval TRUE         Random number generated successfully.
+   @retval FALSE        Failed to generate the random number.
+
+ **/
+BOOLEAN
+EFIAPI
+ArchGetRandomNumber32 (
+  OUT UINT32  *Rand
+  )
+{
+  return RngGetBytes (Rand, sizeof (*Rand));
+}
+
+/**
+   Generates a 64-bit random number.
+
+   @param[out] Rand     Buffer pointer to store the 64-bit random value.
+
+   @retval TRUE         Random number generated successfully.
+   @retval FALSE        Failed to generate the random number.
+
+ **/
+BOOLEAN
+EFIAPI
+ArchGetRandomNumber64 (
+  OUT UINT64  *Rand
+  )
+{
+  return RngGetBytes (Rand, sizeof (*Rand));
+}
@@ -0,0 +1,102 @@
+/** @file
+   Entropy source of the RISC-V random number generator services, the seed
+   CSR of the Zkr extension.
+
+   Copyright (c) 2024, Rivos, Inc.
+  Copyright (C) 2025 Advanced Micro Devices, Inc. All rights reserved.
+
+   SPDX-License-Identifier: BSD-2-Clause-Patent
+ **/
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/PcdLib.h>
+#include <Register/RiscV64/RiscVEncoding.h>
+
+#include "BaseRngLibInternals.h"
+#include "RiscVRng.h"
+
+#define RISCV_CPU_FEATURE_ZKR_BITMASK  0x8
+
+//
+// The number of times the seed CSR may report BIST or WAIT per 64-bit word.
+//
+#define SEED_RETRY_LOOPS  100
+
+/**
+   Gets 64-bit words of entropy by reading the seed CSR (CSR 0x15), 16 bits
+   at a time.
+
+   @param[out] Out      Buffer to store the words in.
+   @param[in]  Count    The number of words to get.
+
+   @retval TRUE         The buffer was filled.
+   @retval FALSE        The entropy source is not supported, failed, or kept
+                        the CPU waiting too long.
+ **/
+BOOLEAN
+RiscVGetSeed (
+  OUT UINT64  *Out,
+  IN  UINTN   Count
+  )
+{
+  UINT64  Seed;
+  UINTN   Retry;
+  UINTN   ValidSeeds;
+  UINTN   NeededSeeds;
+  UINT16  *Entropy;
+
+  Retry       = SEED_RETRY_LOOPS;
+  Entropy     = (UINT16 *)Out;
+  NeededSeeds = Count * (sizeof (UINT64) / sizeof (UINT16));
+  ValidSeeds  = 0;
+
+  if (!ArchIsRngSupported ()) {
+    DEBUG ((DEBUG_ERROR, "RiscVGetSeed: HW not supported!\n"));
+    return FALSE;
+  }
+
+  while (ValidSeeds < NeededSeeds) {
+    Seed = ReadSeed ();
+
+    switch (Seed & SEED_OPST_MASK) {
+      case SEED_OPST_ES16:
+        Entropy[ValidSeeds++] = Seed & SEED_ENTROPY_MASK;
+        if ((ValidSeeds % (sizeof (UINT64) / sizeof (UINT16))) == 0) {
+          Retry = SEED_RETRY_LOOPS;
+        }
+
+        break;
+
+      case SEED_OPST_DEAD:
+        DEBUG ((DEBUG_ERROR, "RiscVGetSeed: Unrecoverable error!\n"));
+        return FALSE;
+
+      case SEED_OPST_BIST:           // fallthrough
+      case SEED_OPST_WAIT:           // fallthrough
+      default:
+        if (--Retry == 0) {
+          return FALSE;
+        }
+
+        break;
+    }
+  }
+
+  return TRUE;
+}
+
+/**
+   Checks whether SEED is supported.
+
+   @retval TRUE         SEED is supported.
+ **/
+BOOLEAN
+EFIAPI
+ArchIsRngSupported (
+  VOID
+  )
+{
+  return ((PcdGet64 (PcdRiscVFeatureOverride) & RISCV_CPU_FEATURE_ZKR_BITMASK) != 0);
+}
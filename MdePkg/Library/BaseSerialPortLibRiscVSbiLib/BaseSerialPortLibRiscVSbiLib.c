@@ -3,6 +3,9 @@
 
   Meant for SEC and PEI (XIP) environments.
 
+  Without globals to cache the result in, the SBI console extensions are
+  probed on every write, unless PcdRiscVSbiConsoleExtensions declares them.
+
   Due to limitations of SBI console interface and XIP environments
   (on use of globals), this library instance does not implement reading
   and polling the serial port. See BaseSerialPortLibRiscVSbiLibRam.c for
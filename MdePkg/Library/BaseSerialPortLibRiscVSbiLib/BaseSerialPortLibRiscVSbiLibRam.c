@@ -11,14 +11,71 @@
 **/
 
 #include <Base.h>
+#include <Library/BaseLib.h>
 #include <Library/SerialPortLib.h>
 #include <Library/BaseRiscVSbiLib.h>
 #include "Common.h"
 
+//
+// Output through DBCN is coalesced, so that a line written piecewise costs a
+// single SBI call. Buffered output goes out at the end of a line, when the
+// buffer fills, or before the serial port is read or controlled.
+//
+#define SBI_CONSOLE_BUFFER_SIZE  256
+
 STATIC BOOLEAN  mHaveDbcn          = FALSE;
 STATIC BOOLEAN  mHaveLegacyPutchar = FALSE;
 STATIC BOOLEAN  mHaveLegacyGetchar = FALSE;
 STATIC INT64    mLastGetChar       = -1;
+STATIC UINT8    mWriteBuffer[SBI_CONSOLE_BUFFER_SIZE];
+STATIC UINTN    mWriteCount = 0;
+
+/**
+  Write out the output buffered for DBCN.
+
+  Must be called with interrupts disabled.
+
+**/
+STATIC
+VOID
+SbiConsoleFlush (
+  VOID
+  )
+{
+  UINTN  Offset;
+  UINTN  Written;
+
+  Offset = 0;
+  while (Offset < mWriteCount) {
+    Written = SbiDbcnWrite (mWriteBuffer + Offset, mWriteCount - Offset);
+    if ((Written == 0) || (Written > mWriteCount - Offset)) {
+      break;
+    }
+
+    Offset += Written;
+  }
+
+  mWriteCount = 0;
+}
+
+/**
+  Write out the output buffered for DBCN, if any.
+
+**/
+STATIC
+VOID
+SerialPortFlush (
+  VOID
+  )
+{
+  BOOLEAN  InterruptState;
+
+  if (mWriteCount != 0) {
+    InterruptState = SaveAndDisableInterrupts ();
+    SbiConsoleFlush ();
+    SetInterruptState (InterruptState);
+  }
+}
 
 /**
   Return whether the legacy console getchar extension is implemented.
@@ -103,12 +160,24 @@ SerialPortWrite (
   IN UINTN  NumberOfBytes
   )
 {
+  BOOLEAN  InterruptState;
+  UINTN    Index;
+
   if (NumberOfBytes == 0) {
     return 0;
   }
 
   if (mHaveDbcn) {
-    return SbiDbcnWrite (Buffer, NumberOfBytes);
+    InterruptState = SaveAndDisableInterrupts ();
+    for (Index = 0; Index < NumberOfBytes; Index++) {
+      mWriteBuffer[mWriteCount++] = Buffer[Index];
+      if ((Buffer[Index] == '\n') || (mWriteCount == SBI_CONSOLE_BUFFER_SIZE)) {
+        SbiConsoleFlush ();
+      }
+    }
+
+    SetInterruptState (InterruptState);
+    return NumberOfBytes;
   } else if (mHaveLegacyPutchar) {
     return SbiLegacyPutchar (Buffer, NumberOfBytes);
   }
@@ -178,6 +247,8 @@ SerialPortPoll (
     return TRUE;
   }
 
+  SerialPortFlush ();
+
   if (mHaveDbcn) {
     UINT8    Buffer;
     SBI_RET  Ret;
@@ -218,6 +289,7 @@ SerialPortSetControl (
   IN UINT32  Control
   )
 {
+  SerialPortFlush ();
   return RETURN_SUCCESS;
 }
 
@@ -237,6 +309,7 @@ SerialPortGetControl (
   OUT UINT32  *Control
   )
 {
+  SerialPortFlush ();
   *Control = 0;
   return RETURN_SUCCESS;
 }
@@ -285,5 +358,6 @@ SerialPortSetAttributes (
   IN OUT EFI_STOP_BITS_TYPE  *StopBits
   )
 {
+  SerialPortFlush ();
   return RETURN_SUCCESS;
 }
@@ -14,6 +14,8 @@
 /**
   Return whether the DBCN extension is implemented.
 
+  PcdRiscVSbiConsoleExtensions, if set, spares the SBI probe call.
+
   @retval TRUE                  Extension is implemented.
   @retval FALSE                 Extension is not implemented.
 
@@ -24,6 +26,12 @@ SbiImplementsDbcn (
   )
 {
   SBI_RET  Ret;
+  UINT32   Extensions;
+
+  Extensions = PcdGet32 (PcdRiscVSbiConsoleExtensions);
+  if (Extensions != 0) {
+    return (Extensions & SBI_CONSOLE_EXT_DBCN) != 0;
+  }
 
   Ret = SbiCall (SBI_EXT_BASE, SBI_EXT_BASE_PROBE_EXT, 1, SBI_EXT_DBCN);
   if ((TranslateError (Ret.Error) == EFI_SUCCESS) &&
@@ -38,6 +46,8 @@ SbiImplementsDbcn (
 /**
   Return whether the legacy console putchar extension is implemented.
 
+  PcdRiscVSbiConsoleExtensions, if set, spares the SBI probe call.
+
   @retval TRUE                  Extension is implemented.
   @retval FALSE                 Extension is not implemented.
 
@@ -48,6 +58,12 @@ SbiImplementsLegacyPutchar (
   )
 {
   SBI_RET  Ret;
+  UINT32   Extensions;
+
+  Extensions = PcdGet32 (PcdRiscVSbiConsoleExtensions);
+  if (Extensions != 0) {
+    return (Extensions & SBI_CONSOLE_EXT_LEGACY_PUTCHAR) != 0;
+  }
 
   Ret = SbiCall (SBI_EXT_BASE, SBI_EXT_BASE_PROBE_EXT, 1, SBI_EXT_0_1_CONSOLE_PUTCHAR);
   if ((TranslateError (Ret.Error) == EFI_SUCCESS) &&
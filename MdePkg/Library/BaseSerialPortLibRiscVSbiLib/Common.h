@@ -15,6 +15,13 @@
 #include <Base.h>
 #include <Library/SerialPortLib.h>
 #include <Library/BaseRiscVSbiLib.h>
+#include <Library/PcdLib.h>
+
+//
+// Bits of PcdRiscVSbiConsoleExtensions
+//
+#define SBI_CONSOLE_EXT_DBCN            BIT0
+#define SBI_CONSOLE_EXT_LEGACY_PUTCHAR  BIT1
 
 BOOLEAN
 SbiImplementsDbcn (
@@ -138,4 +138,132 @@ InternalGetSpinLockProperties (
   VOID
   );
 
+/**
+  Performs an atomic add on a 32-bit unsigned integer, and returns its original value.
+
+  @param  Value     A pointer to the 32-bit value to update.
+  @param  Addend    The operand.
+
+  @return The original *Value before the operation.
+
+**/
+UINT32
+EFIAPI
+InternalSyncFetchAdd32 (
+  IN OUT  volatile UINT32  *Value,
+  IN      UINT32           Addend
+  );
+
+/**
+  Performs an atomic bitwise OR on a 32-bit unsigned integer, and returns its original value.
+
+  @param  Value     A pointer to the 32-bit value to update.
+  @param  OrData    The operand.
+
+  @return The original *Value before the operation.
+
+**/
+UINT32
+EFIAPI
+InternalSyncFetchOr32 (
+  IN OUT  volatile UINT32  *Value,
+  IN      UINT32           OrData
+  );
+
+/**
+  Performs an atomic bitwise AND on a 32-bit unsigned integer, and returns its original value.
+
+  @param  Value     A pointer to the 32-bit value to update.
+  @param  AndData   The operand.
+
+  @return The original *Value before the operation.
+
+**/
+UINT32
+EFIAPI
+InternalSyncFetchAnd32 (
+  IN OUT  volatile UINT32  *Value,
+  IN      UINT32           AndData
+  );
+
+/**
+  Performs an atomic exchange of a 32-bit unsigned integer.
+
+  @param  Value         A pointer to the 32-bit value to exchange.
+  @param  ExchangeValue 32-bit value to store.
+
+  @return The original *Value before exchange.
+
+**/
+UINT32
+EFIAPI
+InternalSyncExchange32 (
+  IN OUT  volatile UINT32  *Value,
+  IN      UINT32           ExchangeValue
+  );
+
+/**
+  Performs an atomic add on a 64-bit unsigned integer, and returns its original value.
+
+  @param  Value     A pointer to the 64-bit value to update.
+  @param  Addend    The operand.
+
+  @return The original *Value before the operation.
+
+**/
+UINT64
+EFIAPI
+InternalSyncFetchAdd64 (
+  IN OUT  volatile UINT64  *Value,
+  IN      UINT64           Addend
+  );
+
+/**
+  Performs an atomic bitwise OR on a 64-bit unsigned integer, and returns its original value.
+
+  @param  Value     A pointer to the 64-bit value to update.
+  @param  OrData    The operand.
+
+  @return The original *Value before the operation.
+
+**/
+UINT64
+EFIAPI
+InternalSyncFetchOr64 (
+  IN OUT  volatile UINT64  *Value,
+  IN      UINT64           OrData
+  );
+
+/**
+  Performs an atomic bitwise AND on a 64-bit unsigned integer, and returns its original value.
+
+  @param  Value     A pointer to the 64-bit value to update.
+  @param  AndData   The operand.
+
+  @return The original *Value before the operation.
+
+**/
+UINT64
+EFIAPI
+InternalSyncFetchAnd64 (
+  IN OUT  volatile UINT64  *Value,
+  IN      UINT64           AndData
+  );
+
+/**
+  Performs an atomic exchange of a 64-bit unsigned integer.
+
+  @param  Value         A pointer to the 64-bit value to exchange.
+  @param  ExchangeValue 64-bit value to store.
+
+  @return The original *Value before exchange.
+
+**/
+UINT64
+EFIAPI
+InternalSyncExchange64 (
+  IN OUT  volatile UINT64  *Value,
+  IN      UINT64           ExchangeValue
+  );
+
 #endif
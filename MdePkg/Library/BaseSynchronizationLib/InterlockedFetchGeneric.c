@@ -0,0 +1,209 @@
+/** @file
+  Atomic fetch-and-operate and exchange functions, built on compare exchange.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include "BaseSynchronizationLibInternals.h"
+
+/**
+  Performs an atomic add on a 32-bit unsigned integer, and returns its original value.
+
+  @param  Value     A pointer to the 32-bit value to update.
+  @param  Addend    The operand.
+
+  @return The original *Value before the operation.
+
+**/
+UINT32
+EFIAPI
+InternalSyncFetchAdd32 (
+  IN OUT  volatile UINT32  *Value,
+  IN      UINT32           Addend
+  )
+{
+  UINT32  Original;
+
+  do {
+    Original = *Value;
+  } while (InternalSyncCompareExchange32 (Value, Original, Original + Addend) != Original);
+
+  return Original;
+}
+
+/**
+  Performs an atomic bitwise OR on a 32-bit unsigned integer, and returns its original value.
+
+  @param  Value     A pointer to the 32-bit value to update.
+  @param  OrData    The operand.
+
+  @return The original *Value before the operation.
+
+**/
+UINT32
+EFIAPI
+InternalSyncFetchOr32 (
+  IN OUT  volatile UINT32  *Value,
+  IN      UINT32           OrData
+  )
+{
+  UINT32  Original;
+
+  do {
+    Original = *Value;
+  } while (InternalSyncCompareExchange32 (Value, Original, Original | OrData) != Original);
+
+  return Original;
+}
+
+/**
+  Performs an atomic bitwise AND on a 32-bit unsigned integer, and returns its original value.
+
+  @param  Value     A pointer to the 32-bit value to update.
+  @param  AndData   The operand.
+
+  @return The original *Value before the operation.
+
+**/
+UINT32
+EFIAPI
+InternalSyncFetchAnd32 (
+  IN OUT  volatile UINT32  *Value,
+  IN      UINT32           AndData
+  )
+{
+  UINT32  Original;
+
+  do {
+    Original = *Value;
+  } while (InternalSyncCompareExchange32 (Value, Original, Original & AndData) != Original);
+
+  return Original;
+}
+
+/**
+  Performs an atomic exchange of a 32-bit unsigned integer.
+
+  @param  Value         A pointer to the 32-bit value to exchange.
+  @param  ExchangeValue 32-bit value to store.
+
+  @return The original *Value before exchange.
+
+**/
+UINT32
+EFIAPI
+InternalSyncExchange32 (
+  IN OUT  volatile UINT32  *Value,
+  IN      UINT32           ExchangeValue
+  )
+{
+  UINT32  Original;
+
+  do {
+    Original = *Value;
+  } while (InternalSyncCompareExchange32 (Value, Original, ExchangeValue) != Original);
+
+  return Original;
+}
+
+/**
+  Performs an atomic add on a 64-bit unsigned integer, and returns its original value.
+
+  @param  Value     A pointer to the 64-bit value to update.
+  @param  Addend    The operand.
+
+  @return The original *Value before the operation.
+
+**/
+UINT64
+EFIAPI
+InternalSyncFetchAdd64 (
+  IN OUT  volatile UINT64  *Value,
+  IN      UINT64           Addend
+  )
+{
+  UINT64  Original;
+
+  do {
+    Original = *Value;
+  } while (InternalSyncCompareExchange64 (Value, Original, Original + Addend) != Original);
+
+  return Original;
+}
+
+/**
+  Performs an atomic bitwise OR on a 64-bit unsigned integer, and returns its original value.
+
+  @param  Value     A pointer to the 64-bit value to update.
+  @param  OrData    The operand.
+
+  @return The original *Value before the operation.
+
+**/
+UINT64
+EFIAPI
+InternalSyncFetchOr64 (
+  IN OUT  volatile UINT64  *Value,
+  IN      UINT64           OrData
+  )
+{
+  UINT64  Original;
+
+  do {
+    Original = *Value;
+  } while (InternalSyncCompareExchange64 (Value, Original, Original | OrData) != Original);
+
+  return Original;
+}
+
+/**
+  Performs an atomic bitwise AND on a 64-bit unsigned integer, and returns its original value.
+
+  @param  Value     A pointer to the 64-bit value to update.
+  @param  AndData   The operand.
+
+  @return The original *Value before the operation.
+
+**/
+UINT64
+EFIAPI
+InternalSyncFetchAnd64 (
+  IN OUT  volatile UINT64  *Value,
+  IN      UINT64           AndData
+  )
+{
+  UINT64  Original;
+
+  do {
+    Original = *Value;
+  } while (InternalSyncCompareExchange64 (Value, Original, Original & AndData) != Original);
+
+  return Original;
+}
+
+/**
+  Performs an atomic exchange of a 64-bit unsigned integer.
+
+  @param  Value         A pointer to the 64-bit value to exchange.
+  @param  ExchangeValue 64-bit value to store.
+
+  @return The original *Value before exchange.
+
+**/
+UINT64
+EFIAPI
+InternalSyncExchange64 (
+  IN OUT  volatile UINT64  *Value,
+  IN      UINT64           ExchangeValue
+  )
+{
+  UINT64  Original;
+
+  do {
+    Original = *Value;
+  } while (InternalSyncCompareExchange64 (Value, Original, ExchangeValue) != Original);
+
+  return Original;
+}
@@ -545,6 +545,46 @@ DecodeC (
   return Index2;
 }
 
+/**
+  Copy a match of earlier output to the end of the output.
+
+  The source may overlap the destination, in which case the match repeats its
+  last Distance bytes. Long matches are copied in runs with CopyMem(), doubling
+  the run length each time the match repeats.
+
+  @param  Destination The end of the output.
+  @param  Distance    The distance back to the source, which is at least 1.
+  @param  Length      The length of the match.
+
+**/
+STATIC
+VOID
+CopyMatch (
+  IN OUT UINT8  *Destination,
+  IN     UINTN  Distance,
+  IN     UINTN  Length
+  )
+{
+  UINTN  Run;
+
+  if (Length < MATCH_BLOCK_COPY_MIN_LEN) {
+    while (Length-- != 0) {
+      *Destination = *(Destination - Distance);
+      Destination++;
+    }
+
+    return;
+  }
+
+  while (Length != 0) {
+    Run = MIN (Length, Distance);
+    CopyMem (Destination, Destination - Distance, Run);
+    Destination += Run;
+    Length      -= Run;
+    Distance    += Run;
+  }
+}
+
 /**
   Decode the source data and put the resulting data into the destination buffer.
 
@@ -556,14 +596,10 @@ Decode (
   SCRATCH_DATA  *Sd
   )
 {
-  UINT16  BytesRemain;
+  UINT32  BytesRemain;
   UINT32  DataIdx;
   UINT16  CharC;
 
-  BytesRemain = (UINT16)(-1);
-
-  DataIdx = 0;
-
   for ( ; ;) {
     //
     // Get one code from mBitBuf
@@ -602,25 +638,21 @@ Decode (
       DataIdx = Sd->mOutBuf - DecodeP (Sd) - 1;
 
       //
-      // Write BytesRemain of bytes into mDstBase
+      // Write BytesRemain of bytes into mDstBase, up to its end
       //
-      BytesRemain--;
-
-      while ((INT16)(BytesRemain) >= 0) {
-        if (Sd->mOutBuf >= Sd->mOrigSize) {
-          goto Done;
-        }
-
-        if (DataIdx >= Sd->mOrigSize) {
-          Sd->mBadTableFlag = (UINT16)BAD_TABLE;
-          goto Done;
-        }
-
-        Sd->mDstBase[Sd->mOutBuf++] = Sd->mDstBase[DataIdx++];
+      if (Sd->mOutBuf >= Sd->mOrigSize) {
+        goto Done;
+      }
 
-        BytesRemain--;
+      if (DataIdx >= Sd->mOutBuf) {
+        Sd->mBadTableFlag = (UINT16)BAD_TABLE;
+        goto Done;
       }
 
+      BytesRemain = MIN (BytesRemain, Sd->mOrigSize - Sd->mOutBuf);
+      CopyMatch (Sd->mDstBase + Sd->mOutBuf, Sd->mOutBuf - DataIdx, BytesRemain);
+      Sd->mOutBuf += BytesRemain;
+
       //
       // Once mOutBuf is fully filled, directly return
       //
@@ -23,6 +23,11 @@
 #define CODE_BIT   16
 #define BAD_TABLE  - 1
 
+//
+// Matches at least this long are copied with CopyMem(), which may be vectorized
+//
+#define MATCH_BLOCK_COPY_MIN_LEN  32
+
 //
 // C: Char&Len Set; P: Position Set; T: exTra Set
 //
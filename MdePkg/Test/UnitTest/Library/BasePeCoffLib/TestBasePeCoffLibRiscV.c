@@ -0,0 +1,578 @@
+/** @file
+  Host based unit tests of the RISC-V relocation fixups of BasePeCoffLib.
+
+  Each test builds an image of a few instructions that are linked to run at
+  TEST_IMAGE_LINK_BASE, with the relocation blocks the tools would emit for them,
+  relocates the image where it was allocated, and re-relocates it for runtime.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+**/
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PeCoffLib.h>
+#include <Library/UnitTestLib.h>
+#include <IndustryStandard/PeImage.h>
+
+#define UNIT_TEST_NAME     "BasePeCoffLib RISC-V Relocation Unit Test Application"
+#define UNIT_TEST_VERSION  "0.1"
+
+//
+// The layout of a test image: the PE32+ header, two pages of code and data,
+// and the relocation blocks.
+//
+#define TEST_IMAGE_LINK_BASE  0x10000000
+#define TEST_IMAGE_SIZE       SIZE_16KB
+#define TEST_IMAGE_RELOC      0x3000
+
+//
+// The address the code refers to. Its low 12 bits read as negative, so that
+// its lui carries.
+//
+#define TEST_IMAGE_TARGET  (TEST_IMAGE_LINK_BASE + 0x2800)
+
+//
+// The offset from where an image is relocated to where it is re-relocated for
+// runtime.
+//
+#define TEST_RUNTIME_OFFSET  0x40000000
+
+//
+// The registers and opcodes that the instructions use.
+//
+#define TEST_REG_A0    10
+#define TEST_REG_A1    11
+#define TEST_OP_LUI    0x37
+#define TEST_OP_ADDI   0x13
+#define TEST_OP_LOAD   0x03
+#define TEST_OP_STORE  0x23
+#define TEST_FUNCT3_W  2
+
+typedef struct {
+  UINT32    Rva;
+  UINT16    Type;
+} TEST_RELOCATION;
+
+/**
+  Returns the value of a lui that, with a signed 12-bit immediate, composes an address.
+
+  @param[in]  Address  The address.
+
+  @return The upper 20 bits of the lui.
+
+**/
+STATIC
+UINT32
+TestHighPart (
+  IN UINT32  Address
+  )
+{
+  return (Address + 0x800) & 0xFFFFF000;
+}
+
+/**
+  Encodes a lui.
+
+  @param[in]  Rd       The destination register.
+  @param[in]  Address  The address that the lui is the high part of.
+
+  @return The instruction.
+
+**/
+STATIC
+UINT32
+TestEncodeLui (
+  IN UINT32  Rd,
+  IN UINT32  Address
+  )
+{
+  return TestHighPart (Address) | (Rd << 7) | TEST_OP_LUI;
+}
+
+/**
+  Encodes an addi or a load, whose immediate is the low part of an address.
+
+  @param[in]  Opcode   The opcode.
+  @param[in]  Funct3   The funct3 field.
+  @param[in]  Rd       The destination register.
+  @param[in]  Rs1      The base register.
+  @param[in]  Address  The address that the immediate is the low part of.
+
+  @return The instruction.
+
+**/
+STATIC
+UINT32
+TestEncodeIType (
+  IN UINT32  Opcode,
+  IN UINT32  Funct3,
+  IN UINT32  Rd,
+  IN UINT32  Rs1,
+  IN UINT32  Address
+  )
+{
+  UINT32  Low;
+
+  Low = Address - TestHighPart (Address);
+  return ((Low & 0xFFF) << 20) | (Rs1 << 15) | (Funct3 << 12) | (Rd << 7) | Opcode;
+}
+
+/**
+  Encodes a store, whose immediate is the low part of an address.
+
+  @param[in]  Rs1      The base register.
+  @param[in]  Rs2      The register stored.
+  @param[in]  Address  The address that the immediate is the low part of.
+
+  @return The instruction.
+
+**/
+STATIC
+UINT32
+TestEncodeStore (
+  IN UINT32  Rs1,
+  IN UINT32  Rs2,
+  IN UINT32  Address
+  )
+{
+  UINT32  Low;
+
+  Low = Address - TestHighPart (Address);
+  return (((Low >> 5) & 0x7F) << 25) | (Rs2 << 20) | (Rs1 << 15) | (TEST_FUNCT3_W << 12) |
+         ((Low & 0x1F) << 7) | TEST_OP_STORE;
+}
+
+/**
+  Returns the address that a lui and an addi or a load compose.
+
+  @param[in]  Lui    The lui.
+  @param[in]  IType  The addi or load.
+
+  @return The address.
+
+**/
+STATIC
+UINT32
+TestComposeIType (
+  IN UINT32  Lui,
+  IN UINT32  IType
+  )
+{
+  return (Lui & 0xFFFFF000) + (UINT32)((INT32)IType >> 20);
+}
+
+/**
+  Returns the address that a lui and a store compose.
+
+  @param[in]  Lui    The lui.
+  @param[in]  Store  The store.
+
+  @return The address.
+
+**/
+STATIC
+UINT32
+TestComposeStore (
+  IN UINT32  Lui,
+  IN UINT32  Store
+  )
+{
+  return (Lui & 0xFFFFF000) + (UINT32)(((INT32)(Store & 0xFE000000) >> 20) | ((Store >> 7) & 0x1F));
+}
+
+/**
+  Closes a relocation block, padding it to a 32-bit boundary as the tools do.
+
+  @param[in]      Block  The relocation block.
+  @param[in, out] Reloc  The record after the last of the block, then after its padding.
+
+**/
+STATIC
+VOID
+TestCloseRelocationBlock (
+  IN     EFI_IMAGE_BASE_RELOCATION  *Block,
+  IN OUT UINT16                     **Reloc
+  )
+{
+  if (((UINTN)*Reloc & 0x3) != 0) {
+    **Reloc = (UINT16)(EFI_IMAGE_REL_BASED_ABSOLUTE << 12);
+    *Reloc += 1;
+  }
+
+  Block->SizeOfBlock = (UINT32)((UINTN)*Reloc - (UINTN)Block);
+}
+
+/**
+  Creates a test image, linked to run at TEST_IMAGE_LINK_BASE. Its relocation
+  records are kept in the order given, and a new block is started for each page,
+  as the tools do.
+
+  @param[in]  Relocations      The relocation records.
+  @param[in]  RelocationCount  The number of relocation records.
+
+  @return The image, or NULL if it could not be allocated.
+
+**/
+STATIC
+UINT8 *
+TestCreateImage (
+  IN CONST TEST_RELOCATION  *Relocations,
+  IN UINTN                  RelocationCount
+  )
+{
+  UINT8                      *Image;
+  EFI_IMAGE_NT_HEADERS64     *Hdr;
+  EFI_IMAGE_BASE_RELOCATION  *Block;
+  UINT16                     *Reloc;
+  UINTN                      Index;
+
+  Image = AllocateAlignedPages (EFI_SIZE_TO_PAGES (TEST_IMAGE_SIZE), EFI_PAGE_SIZE);
+  if (Image == NULL) {
+    return NULL;
+  }
+
+  ZeroMem (Image, TEST_IMAGE_SIZE);
+  Hdr                                     = (EFI_IMAGE_NT_HEADERS64 *)Image;
+  Hdr->Signature                          = EFI_IMAGE_NT_SIGNATURE;
+  Hdr->FileHeader.Machine                 = IMAGE_FILE_MACHINE_RISCV64;
+  Hdr->OptionalHeader.Magic               = EFI_IMAGE_NT_OPTIONAL_HDR64_MAGIC;
+  Hdr->OptionalHeader.ImageBase           = TEST_IMAGE_LINK_BASE;
+  Hdr->OptionalHeader.SizeOfImage         = TEST_IMAGE_SIZE;
+  Hdr->OptionalHeader.NumberOfRvaAndSizes = EFI_IMAGE_NUMBER_OF_DIRECTORY_ENTRIES;
+
+  Hdr->OptionalHeader.DataDirectory[EFI_IMAGE_DIRECTORY_ENTRY_BASERELOC].VirtualAddress = TEST_IMAGE_RELOC;
+
+  Block = NULL;
+  Reloc = (UINT16 *)(Image + TEST_IMAGE_RELOC);
+  for (Index = 0; Index < RelocationCount; Index++) {
+    if ((Block == NULL) || (Block->VirtualAddress != (Relocations[Index].Rva & ~(UINT32)0xFFF))) {
+      if (Block != NULL) {
+        TestCloseRelocationBlock (Block, &Reloc);
+      }
+
+      Block                 = (EFI_IMAGE_BASE_RELOCATION *)Reloc;
+      Block->VirtualAddress = Relocations[Index].Rva & ~(UINT32)0xFFF;
+      Reloc                 = (UINT16 *)(Block + 1);
+    }
+
+    *Reloc = (UINT16)((Relocations[Index].Type << 12) | (Relocations[Index].Rva & 0xFFF));
+    Reloc++;
+  }
+
+  if (Block != NULL) {
+    TestCloseRelocationBlock (Block, &Reloc);
+  }
+
+  Hdr->OptionalHeader.DataDirectory[EFI_IMAGE_DIRECTORY_ENTRY_BASERELOC].Size = (UINT32)((UINTN)Reloc - (UINTN)(Image + TEST_IMAGE_RELOC));
+  return Image;
+}
+
+/**
+  Relocates a test image where it was allocated.
+
+  @param[in]   Image      The image.
+  @param[out]  FixupData  The buffer the fixups are logged to.
+
+  @return The status of PeCoffLoaderRelocateImage().
+
+**/
+STATIC
+RETURN_STATUS
+TestRelocateImage (
+  IN  UINT8  *Image,
+  OUT VOID   *FixupData
+  )
+{
+  PE_COFF_LOADER_IMAGE_CONTEXT  ImageContext;
+
+  ZeroMem (&ImageContext, sizeof (ImageContext));
+  ImageContext.ImageAddress  = (PHYSICAL_ADDRESS)(UINTN)Image;
+  ImageContext.ImageSize     = TEST_IMAGE_SIZE;
+  ImageContext.FixupData     = FixupData;
+  ImageContext.FixupDataSize = TEST_IMAGE_SIZE;
+  return PeCoffLoaderRelocateImage (&ImageContext);
+}
+
+/**
+  Re-relocates a relocated test image for runtime, at TEST_RUNTIME_OFFSET from
+  where it was allocated.
+
+  @param[in]  Image      The image.
+  @param[in]  FixupData  The fixups logged when it was relocated.
+
+**/
+STATIC
+VOID
+TestRelocateImageForRuntime (
+  IN UINT8  *Image,
+  IN VOID   *FixupData
+  )
+{
+  PeCoffLoaderRelocateImageForRuntime (
+    (PHYSICAL_ADDRESS)(UINTN)Image,
+    (PHYSICAL_ADDRESS)(UINTN)Image + TEST_RUNTIME_OFFSET,
+    TEST_IMAGE_SIZE,
+    FixupData
+    );
+}
+
+/**
+  Frees a test image and its fixup log.
+
+  @param[in]  Image      The image.
+  @param[in]  FixupData  The fixup log.
+
+**/
+STATIC
+VOID
+TestFreeImage (
+  IN UINT8  *Image,
+  IN VOID   *FixupData
+  )
+{
+  FreeAlignedPages (Image, EFI_SIZE_TO_PAGES (TEST_IMAGE_SIZE));
+  FreePool (FixupData);
+}
+
+/**
+  A lui at the end of a page and its addi at the start of the next have their
+  records in different blocks, and the addi's is the first of its block.
+
+  @param[in]  Context  Unused.
+
+  @retval UNIT_TEST_PASSED             The pair was relocated.
+  @retval UNIT_TEST_ERROR_TEST_FAILED  The pair was not relocated.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+TestRelocatePairAcrossBlocks (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  STATIC CONST TEST_RELOCATION  Relocations[] = {
+    { 0x1FFC, EFI_IMAGE_REL_BASED_RISCV_HI20   },
+    { 0x2000, EFI_IMAGE_REL_BASED_RISCV_LOW12I },
+  };
+  UINT8                         *Image;
+  VOID                          *FixupData;
+  UINT32                        *Lui;
+  UINT32                        *Addi;
+  UINT32                        Adjust;
+
+  Image     = TestCreateImage (Relocations, ARRAY_SIZE (Relocations));
+  FixupData = AllocateZeroPool (TEST_IMAGE_SIZE);
+  UT_ASSERT_NOT_NULL (Image);
+  UT_ASSERT_NOT_NULL (FixupData);
+
+  Lui   = (UINT32 *)(Image + 0x1FFC);
+  Addi  = (UINT32 *)(Image + 0x2000);
+  *Lui  = TestEncodeLui (TEST_REG_A0, TEST_IMAGE_TARGET);
+  *Addi = TestEncodeIType (TEST_OP_ADDI, 0, TEST_REG_A0, TEST_REG_A0, TEST_IMAGE_TARGET);
+
+  UT_ASSERT_NOT_EFI_ERROR (TestRelocateImage (Image, FixupData));
+  Adjust = (UINT32)((UINTN)Image - TEST_IMAGE_LINK_BASE);
+  UT_ASSERT_EQUAL (TestComposeIType (*Lui, *Addi), (UINT32)(TEST_IMAGE_TARGET + Adjust));
+  UT_ASSERT_EQUAL (*Lui & 0xFFF, (TEST_REG_A0 << 7) | TEST_OP_LUI);
+  UT_ASSERT_EQUAL (*Addi & 0xFFFFF, (TEST_REG_A0 << 15) | (TEST_REG_A0 << 7) | TEST_OP_ADDI);
+
+  TestRelocateImageForRuntime (Image, FixupData);
+  UT_ASSERT_EQUAL (TestComposeIType (*Lui, *Addi), (UINT32)(TEST_IMAGE_TARGET + Adjust + TEST_RUNTIME_OFFSET));
+
+  TestFreeImage (Image, FixupData);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  A lui shared by a load and a store is adjusted once, and both compose their
+  address with it.
+
+  @param[in]  Context  Unused.
+
+  @retval UNIT_TEST_PASSED             The load and store were relocated.
+  @retval UNIT_TEST_ERROR_TEST_FAILED  The load or store was not relocated.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+TestRelocateSharedHi20 (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  STATIC CONST TEST_RELOCATION  Relocations[] = {
+    { 0x1100, EFI_IMAGE_REL_BASED_RISCV_HI20   },
+    { 0x1104, EFI_IMAGE_REL_BASED_RISCV_LOW12I },
+    { 0x1108, EFI_IMAGE_REL_BASED_RISCV_LOW12S },
+  };
+  UINT8                         *Image;
+  VOID                          *FixupData;
+  UINT32                        *Lui;
+  UINT32                        *Load;
+  UINT32                        *Store;
+  UINT32                        Adjust;
+
+  Image     = TestCreateImage (Relocations, ARRAY_SIZE (Relocations));
+  FixupData = AllocateZeroPool (TEST_IMAGE_SIZE);
+  UT_ASSERT_NOT_NULL (Image);
+  UT_ASSERT_NOT_NULL (FixupData);
+
+  Lui    = (UINT32 *)(Image + 0x1100);
+  Load   = (UINT32 *)(Image + 0x1104);
+  Store  = (UINT32 *)(Image + 0x1108);
+  *Lui   = TestEncodeLui (TEST_REG_A0, TEST_IMAGE_TARGET);
+  *Load  = TestEncodeIType (TEST_OP_LOAD, TEST_FUNCT3_W, TEST_REG_A1, TEST_REG_A0, TEST_IMAGE_TARGET);
+  *Store = TestEncodeStore (TEST_REG_A0, TEST_REG_A1, TEST_IMAGE_TARGET + 4);
+
+  UT_ASSERT_NOT_EFI_ERROR (TestRelocateImage (Image, FixupData));
+  Adjust = (UINT32)((UINTN)Image - TEST_IMAGE_LINK_BASE);
+  UT_ASSERT_EQUAL (TestComposeIType (*Lui, *Load), (UINT32)(TEST_IMAGE_TARGET + Adjust));
+  UT_ASSERT_EQUAL (TestComposeStore (*Lui, *Store), (UINT32)(TEST_IMAGE_TARGET + 4 + Adjust));
+  UT_ASSERT_EQUAL (*Store & 0x01FFF07F, (TEST_REG_A1 << 20) | (TEST_REG_A0 << 15) | (TEST_FUNCT3_W << 12) | TEST_OP_STORE);
+
+  TestRelocateImageForRuntime (Image, FixupData);
+  UT_ASSERT_EQUAL (TestComposeIType (*Lui, *Load), (UINT32)(TEST_IMAGE_TARGET + Adjust + TEST_RUNTIME_OFFSET));
+  UT_ASSERT_EQUAL (TestComposeStore (*Lui, *Store), (UINT32)(TEST_IMAGE_TARGET + 4 + Adjust + TEST_RUNTIME_OFFSET));
+
+  TestFreeImage (Image, FixupData);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  A lui and its addi pair up with the record of another fixup between theirs.
+
+  @param[in]  Context  Unused.
+
+  @retval UNIT_TEST_PASSED             The pair and the other fixup were relocated.
+  @retval UNIT_TEST_ERROR_TEST_FAILED  The pair or the other fixup was not relocated.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+TestRelocatePairAroundOtherRecord (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  STATIC CONST TEST_RELOCATION  Relocations[] = {
+    { 0x1200, EFI_IMAGE_REL_BASED_RISCV_HI20   },
+    { 0x1208, EFI_IMAGE_REL_BASED_DIR64        },
+    { 0x1210, EFI_IMAGE_REL_BASED_RISCV_LOW12I },
+  };
+  UINT8                         *Image;
+  VOID                          *FixupData;
+  UINT32                        *Lui;
+  UINT64                        *Pointer;
+  UINT32                        *Addi;
+  UINT32                        Adjust;
+
+  Image     = TestCreateImage (Relocations, ARRAY_SIZE (Relocations));
+  FixupData = AllocateZeroPool (TEST_IMAGE_SIZE);
+  UT_ASSERT_NOT_NULL (Image);
+  UT_ASSERT_NOT_NULL (FixupData);
+
+  Lui      = (UINT32 *)(Image + 0x1200);
+  Pointer  = (UINT64 *)(Image + 0x1208);
+  Addi     = (UINT32 *)(Image + 0x1210);
+  *Lui     = TestEncodeLui (TEST_REG_A0, TEST_IMAGE_TARGET);
+  *Pointer = TEST_IMAGE_TARGET;
+  *Addi    = TestEncodeIType (TEST_OP_ADDI, 0, TEST_REG_A0, TEST_REG_A0, TEST_IMAGE_TARGET);
+
+  UT_ASSERT_NOT_EFI_ERROR (TestRelocateImage (Image, FixupData));
+  Adjust = (UINT32)((UINTN)Image - TEST_IMAGE_LINK_BASE);
+  UT_ASSERT_EQUAL (TestComposeIType (*Lui, *Addi), (UINT32)(TEST_IMAGE_TARGET + Adjust));
+  UT_ASSERT_EQUAL (*Pointer, (UINT64)(UINTN)Image + (TEST_IMAGE_TARGET - TEST_IMAGE_LINK_BASE));
+
+  TestFreeImage (Image, FixupData);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  A LOW12 record that no HI20 record comes before fails the relocation.
+
+  @param[in]  Context  Unused.
+
+  @retval UNIT_TEST_PASSED             The relocation failed.
+  @retval UNIT_TEST_ERROR_TEST_FAILED  The relocation succeeded.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+TestRelocateLow12WithoutHi20 (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  STATIC CONST TEST_RELOCATION  Relocations[] = {
+    { 0x1000, EFI_IMAGE_REL_BASED_RISCV_LOW12I },
+  };
+  UINT8                         *Image;
+  VOID                          *FixupData;
+
+  Image     = TestCreateImage (Relocations, ARRAY_SIZE (Relocations));
+  FixupData = AllocateZeroPool (TEST_IMAGE_SIZE);
+  UT_ASSERT_NOT_NULL (Image);
+  UT_ASSERT_NOT_NULL (FixupData);
+
+  *(UINT32 *)(Image + 0x1000) = TestEncodeIType (TEST_OP_ADDI, 0, TEST_REG_A0, TEST_REG_A0, TEST_IMAGE_TARGET);
+  UT_ASSERT_STATUS_EQUAL (TestRelocateImage (Image, FixupData), RETURN_UNSUPPORTED);
+
+  TestFreeImage (Image, FixupData);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+
+  Main fuction sets up the unit test environment
+
+**/
+EFI_STATUS
+EFIAPI
+UefiTestMain (
+  VOID
+  )
+{
+  EFI_STATUS                  Status;
+  UNIT_TEST_FRAMEWORK_HANDLE  Framework;
+  UNIT_TEST_SUITE_HANDLE      RelocationTestSuite;
+
+  DEBUG ((DEBUG_INFO, "%a v%a\n", UNIT_TEST_NAME, UNIT_TEST_VERSION));
+
+  Framework = NULL;
+
+  Status = InitUnitTestFramework (&Framework, UNIT_TEST_NAME, gEfiCallerBaseName, UNIT_TEST_VERSION);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed in InitUnitTestFramework. Status = %r\n", Status));
+    goto EXIT;
+  }
+
+  Status = CreateUnitTestSuite (&RelocationTestSuite, Framework, "RISC-V relocation test suite", "Common.PeCoff.RiscVRelocation", NULL, NULL);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed to create RISC-V relocation test suite\n"));
+    goto EXIT;
+  }
+
+  AddTestCase (RelocationTestSuite, "Test a HI20/LOW12I pair split across two blocks", "TestRelocatePairAcrossBlocks", TestRelocatePairAcrossBlocks, NULL, NULL, NULL);
+  AddTestCase (RelocationTestSuite, "Test a HI20 shared by a LOW12I and a LOW12S", "TestRelocateSharedHi20", TestRelocateSharedHi20, NULL, NULL, NULL);
+  AddTestCase (RelocationTestSuite, "Test a HI20/LOW12I pair around a DIR64", "TestRelocatePairAroundOtherRecord", TestRelocatePairAroundOtherRecord, NULL, NULL, NULL);
+  AddTestCase (RelocationTestSuite, "Test a LOW12I without a HI20", "TestRelocateLow12WithoutHi20", TestRelocateLow12WithoutHi20, NULL, NULL, NULL);
+
+  Status = RunAllTestSuites (Framework);
+
+EXIT:
+  if (Framework != NULL) {
+    FreeUnitTestFramework (Framework);
+  }
+
+  return Status;
+}
+
+int
+main (
+  int   argc,
+  char  *argv[]
+  )
+{
+  return UefiTestMain ();
+}
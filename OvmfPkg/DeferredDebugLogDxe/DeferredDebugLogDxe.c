@@ -0,0 +1,156 @@
+/** @file
+  Installs the deferred DEBUG log, and drains it to the serial port from a
+  timer event, a bounded number of bytes at a time.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+**/
+
+#include <Uefi.h>
+#include <Guid/DeferredDebugLog.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/DeferredDebugLogLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
+#include <Library/SynchronizationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+
+//
+// How often the log is drained, in milliseconds.
+//
+#define DEFERRED_DEBUG_LOG_DRAIN_PERIOD_MS  10
+
+STATIC DEFERRED_DEBUG_LOG  *mLog;
+STATIC EFI_EVENT           mDrainEvent;
+STATIC EFI_EVENT           mExitBootServicesEvent;
+
+/**
+  Drain up to PcdDeferredDebugLogDrainSize bytes of the log.
+
+  @param  Event        Event whose notification function is being invoked.
+  @param  Context      Pointer to the notification function's context.
+
+**/
+STATIC
+VOID
+EFIAPI
+DeferredDebugLogDrainNotify (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  DeferredDebugLogDrain (PcdGet32 (PcdDeferredDebugLogDrainSize));
+}
+
+/**
+  Drain the whole log, and have later messages written to the serial port
+  directly.
+
+  @param  Event        Event whose notification function is being invoked.
+  @param  Context      Pointer to the notification function's context.
+
+**/
+STATIC
+VOID
+EFIAPI
+DeferredDebugLogExitBootServices (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  gBS->SetTimer (mDrainEvent, TimerCancel, 0);
+
+  DeferredDebugLogDrain (MAX_UINTN);
+  mLog->Active = 0;
+  DeferredDebugLogDrain (MAX_UINTN);
+}
+
+/**
+  Entry point of the deferred DEBUG log driver.
+
+  @param  ImageHandle   The firmware allocated handle for the EFI image.
+  @param  SystemTable   A pointer to the EFI System Table.
+
+  @retval EFI_SUCCESS           The log is installed.
+  @retval EFI_OUT_OF_RESOURCES  The log could not be allocated.
+  @retval Others                The events or the configuration table could not be set up.
+
+**/
+EFI_STATUS
+EFIAPI
+DeferredDebugLogDxeEntryPoint (
+  IN EFI_HANDLE        ImageHandle,
+  IN EFI_SYSTEM_TABLE  *SystemTable
+  )
+{
+  EFI_STATUS  Status;
+  UINTN       Pages;
+
+  Pages = PcdGet32 (PcdDeferredDebugLogPages);
+  mLog  = AllocatePages (Pages);
+  if (mLog == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  ZeroMem (mLog, sizeof (*mLog));
+  mLog->Signature = DEFERRED_DEBUG_LOG_SIGNATURE;
+  mLog->DataSize  = EFI_PAGES_TO_SIZE (Pages) - sizeof (*mLog);
+  mLog->Active    = 1;
+  InitializeSpinLock ((SPIN_LOCK *)&mLog->Lock);
+
+  Status = gBS->CreateEvent (
+                  EVT_TIMER | EVT_NOTIFY_SIGNAL,
+                  TPL_CALLBACK,
+                  DeferredDebugLogDrainNotify,
+                  NULL,
+                  &mDrainEvent
+                  );
+  if (EFI_ERROR (Status)) {
+    goto FreeLog;
+  }
+
+  Status = gBS->SetTimer (mDrainEvent, TimerPeriodic, EFI_TIMER_PERIOD_MILLISECONDS (DEFERRED_DEBUG_LOG_DRAIN_PERIOD_MS));
+  if (EFI_ERROR (Status)) {
+    goto CloseDrainEvent;
+  }
+
+  Status = gBS->CreateEvent (
+                  EVT_SIGNAL_EXIT_BOOT_SERVICES,
+                  TPL_NOTIFY,
+                  DeferredDebugLogExitBootServices,
+                  NULL,
+                  &mExitBootServicesEvent
+                  );
+  if (EFI_ERROR (Status)) {
+    goto CloseDrainEvent;
+  }
+
+  Status = gBS->InstallConfigurationTable (&gDeferredDebugLogGuid, mLog);
+  if (EFI_ERROR (Status)) {
+    goto CloseExitBootServicesEvent;
+  }
+
+  DEBUG ((
+    DEBUG_INFO,
+    "%a: %Lu bytes, draining %u bytes every %u ms\n",
+    __func__,
+    mLog->DataSize,
+    PcdGet32 (PcdDeferredDebugLogDrainSize),
+    DEFERRED_DEBUG_LOG_DRAIN_PERIOD_MS
+    ));
+  return EFI_SUCCESS;
+
+CloseExitBootServicesEvent:
+  gBS->CloseEvent (mExitBootServicesEvent);
+
+CloseDrainEvent:
+  gBS->CloseEvent (mDrainEvent);
+
+FreeLog:
+  FreePages (mLog, Pages);
+  return Status;
+}
@@ -0,0 +1,47 @@
+/** @file
+  The deferred DEBUG log.
+
+  DEBUG messages are appended to this log instead of being written to the
+  serial port, and drained to it later from a timer event, so that printing
+  a message does not wait for the serial port. The log is installed as a
+  configuration table.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+**/
+
+#ifndef DEFERRED_DEBUG_LOG_H_
+#define DEFERRED_DEBUG_LOG_H_
+
+#define DEFERRED_DEBUG_LOG_GUID \
+  { 0xc9aea059, 0x2561, 0x4e04, { 0xbe, 0xdc, 0x41, 0xca, 0xc0, 0x85, 0x26, 0x0a } }
+
+#define DEFERRED_DEBUG_LOG_SIGNATURE  SIGNATURE_64 ('D', 'E', 'F', 'D', 'B', 'G', 'L', 'G')
+
+//
+// The log is a ring of DataSize bytes that follows the header. WriteOffset and
+// ReadOffset count the bytes written to the log and drained from it since it
+// was created, so WriteOffset - ReadOffset bytes are pending. Pending bytes
+// overwritten before they are drained are lost, and counted in LostBytes.
+//
+typedef struct {
+  UINT64             Signature;
+  UINT64             DataSize;
+  //
+  // Protects the offsets. Used as a SPIN_LOCK, which is a UINTN.
+  //
+  volatile UINT64    Lock;
+  UINT64             WriteOffset;
+  UINT64             ReadOffset;
+  UINT64             LostBytes;
+  //
+  // Cleared at ExitBootServices(), after which messages are written to the
+  // serial port directly.
+  //
+  volatile UINT64    Active;
+} DEFERRED_DEBUG_LOG;
+
+extern EFI_GUID  gDeferredDebugLogGuid;
+
+#endif // DEFERRED_DEBUG_LOG_H_
@@ -100,7 +100,7 @@ typedef struct {
   volatile UINT16    *Idx;
 
   volatile UINT16    *Ring;      // QueueSize elements
-  volatile UINT16    *UsedEvent; // unused as per negotiation
+  volatile UINT16    *UsedEvent; // used if VIRTIO_F_RING_EVENT_IDX is negotiated
 } VRING_AVAIL;
 
 //
@@ -119,7 +119,7 @@ typedef struct {
   volatile UINT16             *Flags;
   volatile UINT16             *Idx;
   volatile VRING_USED_ELEM    *UsedElem;   // QueueSize elements
-  volatile UINT16             *AvailEvent; // unused as per negotiation
+  volatile UINT16             *AvailEvent; // used if VIRTIO_F_RING_EVENT_IDX is negotiated
 } VRING_USED;
 
 //
@@ -127,7 +127,7 @@ typedef struct {
 //
 #define VRING_DESC_F_NEXT      BIT0 // more descriptors in this request
 #define VRING_DESC_F_WRITE     BIT1 // buffer to be written *by the host*
-#define VRING_DESC_F_INDIRECT  BIT2 // unused
+#define VRING_DESC_F_INDIRECT  BIT2 // buffer holds a table of descriptors
 
 #pragma pack(1)
 typedef struct {
@@ -145,6 +145,19 @@ typedef struct {
   VRING_AVAIL            Avail;
   VRING_USED             Used;
   UINT16                 QueueSize;
+  BOOLEAN                EventIdx;    // VIRTIO_F_RING_EVENT_IDX is negotiated
+  UINT16                 LastUsedIdx; // used elements fetched
+
+  //
+  // The rest is used if VIRTIO_F_RING_INDIRECT_DESC is negotiated and
+  // VirtioRingIndirectInit() has set up a pool of indirect descriptor tables.
+  //
+  VOID                   *IndirectBase;   // deallocate only this field
+  UINTN                  IndirectNumPages;
+  UINT64                 IndirectDeviceAddress;
+  VOID                   *IndirectMapping;
+  UINT16                 IndirectNumTables;
+  UINT16                 IndirectTableSize; // descriptors per table
 } VRING;
 
 //
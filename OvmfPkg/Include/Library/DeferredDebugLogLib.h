@@ -0,0 +1,29 @@
+/** @file
+  Drains the deferred DEBUG log to the serial port.
+
+  Produced by the DebugLib instance that appends to the log.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+**/
+
+#ifndef DEFERRED_DEBUG_LOG_LIB_H_
+#define DEFERRED_DEBUG_LOG_LIB_H_
+
+#include <Uefi/UefiBaseType.h>
+
+/**
+  Write pending messages of the deferred DEBUG log to the serial port.
+
+  @param[in] MaxLength  The largest number of bytes to write.
+
+  @return The number of bytes still pending.
+**/
+UINTN
+EFIAPI
+DeferredDebugLogDrain (
+  IN UINTN  MaxLength
+  );
+
+#endif // DEFERRED_DEBUG_LOG_LIB_H_
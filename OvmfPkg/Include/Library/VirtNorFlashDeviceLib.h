@@ -110,6 +110,14 @@ NorFlashWriteFullBlock (
   IN  UINT32   BlockSizeInWords
   );
 
+BOOLEAN
+EFIAPI
+NorFlashBlockIsErased (
+  IN  UINTN   DeviceBaseAddress,
+  IN  UINTN   BlockAddress,
+  IN  UINT32  BlockSize
+  );
+
 EFI_STATUS
 EFIAPI
 NorFlashUnlockAndEraseSingleBlock (
@@ -77,6 +77,48 @@ VirtioRingMap (
   OUT VOID                    **Mapping
   );
 
+/**
+
+  Set up a pool of indirect descriptor tables for a virtio ring, for a device
+  that VIRTIO_F_RING_INDIRECT_DESC has been negotiated with.
+
+  The pool is allocated and mapped once, as a common buffer, so no request has
+  to map its table. From then on, VirtioAppendDesc() fills the table that
+  belongs to the head descriptor of the request, and the request takes a
+  single descriptor of the ring, whatever the number of its buffers.
+
+  Relevant sections from the virtio-1.0 spec:
+  - 2.4.5.3 Indirect Descriptors.
+
+  @param[in]     VirtIo     The virtio device which uses the ring.
+
+  @param[in]     NumTables  The number of tables. The head descriptor with
+                            index HeadDescIdx uses the table with index
+                            (HeadDescIdx % NumTables), so a driver with one
+                            request in flight needs one table.
+
+  @param[in]     TableSize  The number of descriptors in each table, that is,
+                            the largest number of buffers in a request.
+
+  @param[in,out] Ring       The virtio ring, set up with VirtioRingInit().
+                            VirtioRingUninit() releases the pool with it.
+
+  @retval EFI_SUCCESS  The pool is set up.
+
+  @return              Status codes propagated from
+                       VirtIo->AllocateSharedPages() and
+                       VirtioMapAllBytesInSharedBuffer().
+
+**/
+EFI_STATUS
+EFIAPI
+VirtioRingIndirectInit (
+  IN     VIRTIO_DEVICE_PROTOCOL  *VirtIo,
+  IN     UINT16                  NumTables,
+  IN     UINT16                  TableSize,
+  IN OUT VRING                   *Ring
+  );
+
 /**
 
   Tear down the internal resources of a configured virtio ring.
@@ -85,6 +127,9 @@ VirtioRingMap (
   invoking this function: the VSTAT_DRIVER_OK bit must be clear in
   VhdrDeviceStatus.
 
+  The pool of indirect descriptor tables, if any, is unmapped and released
+  too.
+
   @param[in]  VirtIo  The virtio device which was using the ring.
 
   @param[out] Ring    The virtio ring to clean up.
@@ -125,6 +170,54 @@ VirtioPrepare (
   OUT    DESC_INDICES  *Indices
   );
 
+/**
+
+  Turn off interrupt notifications from the host for the used elements that
+  it produces next.
+
+  Without VIRTIO_F_RING_EVENT_IDX, this sets VRING_AVAIL_F_NO_INTERRUPT. With
+  it, the host ignores that flag, and the used event index is set to trail the
+  used ring, so the host never crosses it. VirtioSubmit() calls this itself;
+  drivers that poll the used ring and update the available ring directly must
+  call it before every submission.
+
+  @param[in,out] Ring  The virtio ring.
+
+**/
+VOID
+EFIAPI
+VirtioRingDisableInterrupts (
+  IN OUT VRING  *Ring
+  );
+
+/**
+
+  Decide whether the host needs to be notified of new entries in the available
+  ring, after the driver has published them by updating the Index Field.
+
+  Without VIRTIO_F_RING_EVENT_IDX, the host sets VRING_USED_F_NO_NOTIFY while
+  it is still processing the available ring. With it, the host names the
+  available index that it wants to be notified at, and the notification is
+  only needed if the entries just published cross it. A notification costs an
+  exit to the hypervisor, so drivers should ask this rather than notify
+  gratuitously.
+
+  @param[in] Ring          The virtio ring.
+
+  @param[in] OldAvailIdx   The available ring index before the driver published
+                           the new entries.
+
+  @retval TRUE   The driver must call VirtIo->SetQueueNotify().
+  @retval FALSE  The host will process the new entries without a notification.
+
+**/
+BOOLEAN
+EFIAPI
+VirtioRingNeedsNotify (
+  IN VRING   *Ring,
+  IN UINT16  OldAvailIdx
+  );
+
 /**
 
   Append a contiguous buffer for transmission / reception via the virtio ring.
@@ -140,6 +233,11 @@ VirtioPrepare (
   The caller is responsible for initializing *Indices with VirtioPrepare()
   first.
 
+  If VirtioRingIndirectInit() has set up a pool of indirect descriptor tables,
+  the buffer is placed in the table of the head descriptor instead, and
+  VirtioAppendIndirectTable() or VirtioFlush() later places the table in the
+  ring.
+
   @param[in,out] Ring               The virtio ring to append the buffer to,
                                     as a descriptor.
 
@@ -156,7 +254,8 @@ VirtioPrepare (
                                     always set, but the host only interprets
                                     it dependent on VRING_DESC_F_NEXT.
 
-  @param[in,out] Indices            Indices->HeadDescIdx is not accessed.
+  @param[in,out] Indices            Indices->HeadDescIdx is only read with
+                                    indirect tables, to select the table.
                                     On input, Indices->NextDescIdx identifies
                                     the next descriptor to carry the buffer.
                                     On output, Indices->NextDescIdx is
@@ -173,6 +272,29 @@ VirtioAppendDesc (
   IN OUT DESC_INDICES  *Indices
   );
 
+/**
+
+  Place the indirect descriptor table that VirtioAppendDesc() has filled for a
+  request in the ring, as the single descriptor of the request.
+
+  VirtioFlush() calls this itself. Drivers that submit with VirtioSubmit()
+  call it instead, after the last VirtioAppendDesc().
+
+  @param[in,out] Ring     The virtio ring, with a pool of indirect descriptor
+                          tables.
+
+  @param[in] Indices      Indices->HeadDescIdx identifies the head descriptor,
+                          and the table. Indices->NextDescIdx is the number of
+                          descriptors in the table.
+
+**/
+VOID
+EFIAPI
+VirtioAppendIndirectTable (
+  IN OUT VRING         *Ring,
+  IN     DESC_INDICES  *Indices
+  );
+
 /**
 
   Notify the host about the descriptor chain just built, and wait until the
@@ -184,9 +306,10 @@ VirtioAppendDesc (
 
   @param[in,out] Ring     The virtio ring with descriptors to submit.
 
-  @param[in] Indices      Indices->NextDescIdx is not accessed.
-                          Indices->HeadDescIdx identifies the head descriptor
-                          of the descriptor chain.
+  @param[in] Indices      Indices->NextDescIdx is only read with indirect
+                          descriptor tables, as the number of descriptors in
+                          the table. Indices->HeadDescIdx identifies the head
+                          descriptor of the descriptor chain.
 
   @param[out] UsedLen     On success, the total number of bytes, consecutively
                           across the buffers linked by the descriptor chain,
@@ -210,6 +333,135 @@ VirtioFlush (
   OUT    UINT32                  *UsedLen    OPTIONAL
   );
 
+/**
+
+  Make descriptor chains available to the host, and notify the host once if it
+  asks to be, without waiting for the host to use them.
+
+  Drivers that keep several requests in flight, each in descriptors of its
+  own, submit them with this function, and collect them with VirtioReapUsed(),
+  instead of VirtioPrepare() and VirtioFlush(). The used ring is polled, so
+  interrupts are turned off with VirtioRingDisableInterrupts().
+
+  @param[in] VirtIo       The target virtio device to notify.
+
+  @param[in] VirtQueueId  Identifies the queue for the target device.
+
+  @param[in,out] Ring     The virtio ring with the descriptor chains.
+
+  @param[in] HeadDescIdx  The head descriptors of the chains, in the order in
+                          which the host is to process them. An indirect
+                          descriptor table is placed in the ring beforehand,
+                          with VirtioAppendIndirectTable().
+
+  @param[in] Count        The number of elements in HeadDescIdx.
+
+  @return              Error code from VirtIo->SetQueueNotify() if it fails.
+                       The chains stay in the available ring, and the host
+                       may still use them.
+
+  @retval EFI_SUCCESS  Otherwise.
+
+**/
+EFI_STATUS
+EFIAPI
+VirtioSubmit (
+  IN     VIRTIO_DEVICE_PROTOCOL  *VirtIo,
+  IN     UINT16                  VirtQueueId,
+  IN OUT VRING                   *Ring,
+  IN     CONST UINT16            *HeadDescIdx,
+  IN     UINT16                  Count
+  );
+
+/**
+
+  Fetch the next element that the host has placed in the used ring, if there
+  is one.
+
+  This function implements the following section from virtio-0.9.5:
+  - 2.4.2 Receiving Used Buffers From the Device
+
+  @param[in,out] Ring      The virtio ring. Ring->LastUsedIdx counts the
+                           used elements fetched so far, by this function and
+                           by VirtioFlush().
+
+  @param[out] HeadDescIdx  The head descriptor of the chain that the host has
+                           used.
+
+  @param[out] UsedLen      The number of bytes that the host wrote to the
+                           buffers of the chain. May be NULL.
+
+  @retval TRUE   An element has been fetched.
+  @retval FALSE  The host has not used another chain yet.
+
+**/
+BOOLEAN
+EFIAPI
+VirtioReapUsed (
+  IN OUT VRING   *Ring,
+  OUT    UINT16  *HeadDescIdx,
+  OUT    UINT32  *UsedLen     OPTIONAL
+  );
+
+/**
+
+  A condition that VirtioPoll() waits for.
+
+  @param[in] Context  The context passed to VirtioPoll().
+
+  @retval TRUE   The condition holds.
+  @retval FALSE  Otherwise.
+
+**/
+typedef
+BOOLEAN
+(EFIAPI *VIRTIO_POLL_CONDITION)(
+  IN VOID  *Context
+  );
+
+/**
+
+  Wait until a condition on the rings of a device holds. The condition is
+  checked again after a poll period that starts at 1 us, and doubles until it
+  is slightly above 1 ms.
+
+  The condition may reap used elements, and raise the TPL to do so. Memory is
+  fenced around each check, so that the condition sees what the host wrote.
+
+  @param[in] Condition  The condition to wait for.
+
+  @param[in] Context    The context to pass to Condition.
+
+**/
+VOID
+EFIAPI
+VirtioPoll (
+  IN VIRTIO_POLL_CONDITION  Condition,
+  IN VOID                   *Context
+  );
+
+/**
+
+  Wait until the host places an element in the used ring, and fetch it, as
+  VirtioReapUsed() does.
+
+  @param[in,out] Ring      The virtio ring.
+
+  @param[out] HeadDescIdx  The head descriptor of the chain that the host has
+                           used.
+
+  @param[out] UsedLen      The number of bytes that the host wrote to the
+                           buffers of the chain. May be NULL.
+
+**/
+VOID
+EFIAPI
+VirtioWaitUsed (
+  IN OUT VRING   *Ring,
+  OUT    UINT16  *HeadDescIdx,
+  OUT    UINT32  *UsedLen     OPTIONAL
+  );
+
 /**
 
   Report the feature bits to the VirtIo 1.0 device that the VirtIo 1.0 driver
@@ -171,28 +171,34 @@ MmioReadBytes (
 
 /**
   Transfer an array of bytes, or skip a number of bytes, using the DMA
-  interface.
+  interface, with an access structure and a buffer at addresses that the
+  device can reach.
 
-  @param[in]     Size     Size in bytes to transfer or skip.
+  @param[in]     Size                 Size in bytes to transfer or skip.
 
-  @param[in,out] Buffer   Buffer to read data into or write data from. Ignored,
-                          and may be NULL, if Size is zero, or Control is
-                          FW_CFG_DMA_CTL_SKIP.
+  @param[in]     BufferAddress        Device address of the buffer to read
+                                      data into or write data from. Ignored if
+                                      Control is FW_CFG_DMA_CTL_SKIP.
 
-  @param[in]     Control  One of the following:
-                          FW_CFG_DMA_CTL_WRITE - write to fw_cfg from Buffer.
-                          FW_CFG_DMA_CTL_READ  - read from fw_cfg into Buffer.
-                          FW_CFG_DMA_CTL_SKIP  - skip bytes in fw_cfg.
+  @param[in]     Control              One of the following:
+                                      FW_CFG_DMA_CTL_WRITE - write to fw_cfg from Buffer.
+                                      FW_CFG_DMA_CTL_READ  - read from fw_cfg into Buffer.
+                                      FW_CFG_DMA_CTL_SKIP  - skip bytes in fw_cfg.
+
+  @param[in,out] Access               The access structure.
+
+  @param[in]     AccessDeviceAddress  Device address of Access.
 **/
 VOID
-DmaTransferBytes (
-  IN     UINTN   Size,
-  IN OUT VOID    *Buffer OPTIONAL,
-  IN     UINT32  Control
+DmaTransfer (
+  IN     UINTN                       Size,
+  IN     UINT64                      BufferAddress,
+  IN     UINT32                      Control,
+  IN OUT volatile FW_CFG_DMA_ACCESS  *Access,
+  IN     UINT64                      AccessDeviceAddress
   )
 {
-  volatile FW_CFG_DMA_ACCESS  Access;
-  UINT32                      Status;
+  UINT32  Status;
 
   ASSERT (
     Control == FW_CFG_DMA_CTL_WRITE || Control == FW_CFG_DMA_CTL_READ ||
@@ -205,9 +211,9 @@ DmaTransferBytes (
 
   ASSERT (Size <= MAX_UINT32);
 
-  Access.Control = SwapBytes32 (Control);
-  Access.Length  = SwapBytes32 ((UINT32)Size);
-  Access.Address = SwapBytes64 ((UINT64)(UINTN)Buffer);
+  Access->Control = SwapBytes32 (Control);
+  Access->Length  = SwapBytes32 ((UINT32)Size);
+  Access->Address = SwapBytes64 (BufferAddress);
 
   //
   // We shouldn't start the transfer before setting up Access.
@@ -218,9 +224,9 @@ DmaTransferBytes (
   // This will fire off the transfer.
   //
  #if defined (MDE_CPU_AARCH64) || defined (MDE_CPU_RISCV64) || defined (MDE_CPU_LOONGARCH64)
-  MmioWrite64 (QemuGetFwCfgDmaAddress (), SwapBytes64 ((UINT64)&Access));
+  MmioWrite64 (QemuGetFwCfgDmaAddress (), SwapBytes64 (AccessDeviceAddress));
  #else
-  MmioWrite32 ((UINT32)(QemuGetFwCfgDmaAddress () + 4), SwapBytes32 ((UINT32)&Access));
+  MmioWrite32 ((UINT32)(QemuGetFwCfgDmaAddress () + 4), SwapBytes32 ((UINT32)AccessDeviceAddress));
  #endif
 
   //
@@ -229,7 +235,7 @@ DmaTransferBytes (
   MemoryFence ();
 
   do {
-    Status = SwapBytes32 (Access.Control);
+    Status = SwapBytes32 (Access->Control);
     ASSERT ((Status & FW_CFG_DMA_CTL_ERROR) == 0);
   } while (Status != 0);
 
@@ -239,6 +245,39 @@ DmaTransferBytes (
   MemoryFence ();
 }
 
+/**
+  Transfer an array of bytes, or skip a number of bytes, using the DMA
+  interface.
+
+  @param[in]     Size     Size in bytes to transfer or skip.
+
+  @param[in,out] Buffer   Buffer to read data into or write data from. Ignored,
+                          and may be NULL, if Size is zero, or Control is
+                          FW_CFG_DMA_CTL_SKIP.
+
+  @param[in]     Control  One of the following:
+                          FW_CFG_DMA_CTL_WRITE - write to fw_cfg from Buffer.
+                          FW_CFG_DMA_CTL_READ  - read from fw_cfg into Buffer.
+                          FW_CFG_DMA_CTL_SKIP  - skip bytes in fw_cfg.
+**/
+VOID
+DmaTransferBytes (
+  IN     UINTN   Size,
+  IN OUT VOID    *Buffer OPTIONAL,
+  IN     UINT32  Control
+  )
+{
+  volatile FW_CFG_DMA_ACCESS  Access;
+
+  DmaTransfer (
+    Size,
+    (UINT64)(UINTN)Buffer,
+    Control,
+    &Access,
+    (UINT64)(UINTN)&Access
+    );
+}
+
 /**
   Fast READ_BYTES_FUNCTION.
 **/
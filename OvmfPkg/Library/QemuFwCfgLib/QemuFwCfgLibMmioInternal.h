@@ -235,4 +235,33 @@ DmaTransferBytes (
   IN     UINT32  Control
   );
 
+/**
+  Transfer an array of bytes, or skip a number of bytes, using the DMA
+  interface, with an access structure and a buffer at addresses that the
+  device can reach.
+
+  @param[in]     Size                 Size in bytes to transfer or skip.
+
+  @param[in]     BufferAddress        Device address of the buffer to read
+                                      data into or write data from. Ignored if
+                                      Control is FW_CFG_DMA_CTL_SKIP.
+
+  @param[in]     Control              One of the following:
+                                      FW_CFG_DMA_CTL_WRITE - write to fw_cfg from Buffer.
+                                      FW_CFG_DMA_CTL_READ  - read from fw_cfg into Buffer.
+                                      FW_CFG_DMA_CTL_SKIP  - skip bytes in fw_cfg.
+
+  @param[in,out] Access               The access structure.
+
+  @param[in]     AccessDeviceAddress  Device address of Access.
+**/
+VOID
+DmaTransfer (
+  IN     UINTN                       Size,
+  IN     UINT64                      BufferAddress,
+  IN     UINT32                      Control,
+  IN OUT volatile FW_CFG_DMA_ACCESS  *Access,
+  IN     UINT64                      AccessDeviceAddress
+  );
+
 #endif
@@ -13,11 +13,13 @@
 #include <Uefi.h>
 
 #include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
 #include <Library/DebugLib.h>
 #include <Library/QemuFwCfgLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 
 #include <Protocol/FdtClient.h>
+#include <Protocol/IoMmu.h>
 
 #include "QemuFwCfgLibMmioInternal.h"
 
@@ -25,6 +27,15 @@ STATIC UINTN  mFwCfgSelectorAddress;
 STATIC UINTN  mFwCfgDataAddress;
 STATIC UINTN  mFwCfgDmaAddress;
 
+//
+// Once the IOMMU protocol is installed, DMA goes through it. The access
+// structure is allocated and mapped once, and each transfer maps its buffer
+// once, however large.
+//
+STATIC EDKII_IOMMU_PROTOCOL        *mIoMmuProtocol;
+STATIC volatile FW_CFG_DMA_ACCESS  *mIoMmuAccess;
+STATIC EFI_PHYSICAL_ADDRESS        mIoMmuAccessDeviceAddress;
+
 /**
   To get firmware configure selector address.
 
@@ -73,6 +84,190 @@ QemuGetFwCfgDmaAddress (
   return mFwCfgDmaAddress;
 }
 
+/**
+  Look for the IOMMU protocol, and once it is installed, allocate and map the
+  DMA access structure with it.
+
+  @retval TRUE   DMA goes through the IOMMU protocol.
+  @retval FALSE  The IOMMU protocol is not installed yet.
+**/
+STATIC
+BOOLEAN
+IoMmuDmaReady (
+  VOID
+  )
+{
+  EFI_STATUS            Status;
+  EDKII_IOMMU_PROTOCOL  *IoMmu;
+  VOID                  *HostAddress;
+  UINTN                 Size;
+  VOID                  *Mapping;
+
+  if (mIoMmuProtocol != NULL) {
+    return TRUE;
+  }
+
+  Status = gBS->LocateProtocol (&gEdkiiIoMmuProtocolGuid, NULL, (VOID **)&IoMmu);
+  if (EFI_ERROR (Status)) {
+    return FALSE;
+  }
+
+  //
+  // As per UEFI spec, in order to map a host address with
+  // BusMasterCommonBuffer64, the buffer must be allocated using the IOMMU
+  // AllocateBuffer()
+  //
+  Status = IoMmu->AllocateBuffer (
+                    IoMmu,
+                    AllocateAnyPages,
+                    EfiBootServicesData,
+                    EFI_SIZE_TO_PAGES (sizeof (FW_CFG_DMA_ACCESS)),
+                    &HostAddress,
+                    EDKII_IOMMU_ATTRIBUTE_DUAL_ADDRESS_CYCLE
+                    );
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "%a: failed to allocate FW_CFG_DMA_ACCESS\n", __func__));
+    ASSERT (FALSE);
+    CpuDeadLoop ();
+  }
+
+  ZeroMem (HostAddress, sizeof (FW_CFG_DMA_ACCESS));
+
+  Size   = sizeof (FW_CFG_DMA_ACCESS);
+  Status = IoMmu->Map (
+                    IoMmu,
+                    EdkiiIoMmuOperationBusMasterCommonBuffer64,
+                    HostAddress,
+                    &Size,
+                    &mIoMmuAccessDeviceAddress,
+                    &Mapping
+                    );
+  if (EFI_ERROR (Status) || (Size < sizeof (FW_CFG_DMA_ACCESS))) {
+    DEBUG ((DEBUG_ERROR, "%a: failed to Map() FW_CFG_DMA_ACCESS\n", __func__));
+    ASSERT (FALSE);
+    CpuDeadLoop ();
+  }
+
+  mIoMmuAccess   = HostAddress;
+  mIoMmuProtocol = IoMmu;
+  return TRUE;
+}
+
+/**
+  Transfer an array of bytes, or skip a number of bytes, using the DMA
+  interface, through the IOMMU protocol once it is installed.
+
+  The buffer is mapped for the whole transfer, so that the device writes
+  straight into it, or reads straight from it.
+
+  @param[in]     Size     Size in bytes to transfer or skip.
+
+  @param[in,out] Buffer   Buffer to read data into or write data from. Ignored,
+                          and may be NULL, if Size is zero, or Control is
+                          FW_CFG_DMA_CTL_SKIP.
+
+  @param[in]     Control  One of the following:
+                          FW_CFG_DMA_CTL_WRITE - write to fw_cfg from Buffer.
+                          FW_CFG_DMA_CTL_READ  - read from fw_cfg into Buffer.
+                          FW_CFG_DMA_CTL_SKIP  - skip bytes in fw_cfg.
+**/
+STATIC
+VOID
+IoMmuDmaTransferBytes (
+  IN     UINTN   Size,
+  IN OUT VOID    *Buffer OPTIONAL,
+  IN     UINT32  Control
+  )
+{
+  EFI_STATUS            Status;
+  UINTN                 NumberOfBytes;
+  EFI_PHYSICAL_ADDRESS  DeviceAddress;
+  VOID                  *Mapping;
+
+  if (Size == 0) {
+    return;
+  }
+
+  if (!IoMmuDmaReady ()) {
+    DmaTransferBytes (Size, Buffer, Control);
+    return;
+  }
+
+  if (Control == FW_CFG_DMA_CTL_SKIP) {
+    DmaTransfer (Size, 0, Control, mIoMmuAccess, mIoMmuAccessDeviceAddress);
+    return;
+  }
+
+  NumberOfBytes = Size;
+  Status        = mIoMmuProtocol->Map (
+                                    mIoMmuProtocol,
+                                    (Control == FW_CFG_DMA_CTL_WRITE ?
+                                     EdkiiIoMmuOperationBusMasterRead64 :
+                                     EdkiiIoMmuOperationBusMasterWrite64),
+                                    Buffer,
+                                    &NumberOfBytes,
+                                    &DeviceAddress,
+                                    &Mapping
+                                    );
+  if (EFI_ERROR (Status) || (NumberOfBytes < Size)) {
+    DEBUG ((
+      DEBUG_ERROR,
+      "%a: failed to Map() Address 0x%Lx Size 0x%Lx\n",
+      __func__,
+      (UINT64)(UINTN)Buffer,
+      (UINT64)Size
+      ));
+    ASSERT (FALSE);
+    CpuDeadLoop ();
+  }
+
+  DmaTransfer (Size, DeviceAddress, Control, mIoMmuAccess, mIoMmuAccessDeviceAddress);
+
+  Status = mIoMmuProtocol->Unmap (mIoMmuProtocol, Mapping);
+  ASSERT_EFI_ERROR (Status);
+}
+
+/**
+  Fast READ_BYTES_FUNCTION, through the IOMMU protocol.
+**/
+STATIC
+VOID
+EFIAPI
+IoMmuDmaReadBytes (
+  IN UINTN  Size,
+  IN VOID   *Buffer OPTIONAL
+  )
+{
+  IoMmuDmaTransferBytes (Size, Buffer, FW_CFG_DMA_CTL_READ);
+}
+
+/**
+  Fast WRITE_BYTES_FUNCTION, through the IOMMU protocol.
+**/
+STATIC
+VOID
+EFIAPI
+IoMmuDmaWriteBytes (
+  IN UINTN  Size,
+  IN VOID   *Buffer OPTIONAL
+  )
+{
+  IoMmuDmaTransferBytes (Size, Buffer, FW_CFG_DMA_CTL_WRITE);
+}
+
+/**
+  Fast SKIP_BYTES_FUNCTION, through the IOMMU protocol.
+**/
+STATIC
+VOID
+EFIAPI
+IoMmuDmaSkipBytes (
+  IN UINTN  Size
+  )
+{
+  IoMmuDmaTransferBytes (Size, NULL, FW_CFG_DMA_CTL_SKIP);
+}
+
 RETURN_STATUS
 EFIAPI
 QemuFwCfgInitialize (
@@ -103,9 +298,9 @@ QemuFwCfgInitialize (
     mFwCfgDmaAddress      = FwCfgResource->FwCfgDmaAddress;
 
     if (mFwCfgDmaAddress != 0) {
-      InternalQemuFwCfgReadBytes  = DmaReadBytes;
-      InternalQemuFwCfgWriteBytes = DmaWriteBytes;
-      InternalQemuFwCfgSkipBytes  = DmaSkipBytes;
+      InternalQemuFwCfgReadBytes  = IoMmuDmaReadBytes;
+      InternalQemuFwCfgWriteBytes = IoMmuDmaWriteBytes;
+      InternalQemuFwCfgSkipBytes  = IoMmuDmaSkipBytes;
     }
 
     return RETURN_SUCCESS;
@@ -199,9 +394,9 @@ QemuFwCfgInitialize (
         Features = QemuFwCfgRead32 ();
         if ((Features & FW_CFG_F_DMA) != 0) {
           mFwCfgDmaAddress            = FwCfgDmaAddress;
-          InternalQemuFwCfgReadBytes  = DmaReadBytes;
-          InternalQemuFwCfgWriteBytes = DmaWriteBytes;
-          InternalQemuFwCfgSkipBytes  = DmaSkipBytes;
+          InternalQemuFwCfgReadBytes  = IoMmuDmaReadBytes;
+          InternalQemuFwCfgWriteBytes = IoMmuDmaWriteBytes;
+          InternalQemuFwCfgSkipBytes  = IoMmuDmaSkipBytes;
         }
       }
     } else {
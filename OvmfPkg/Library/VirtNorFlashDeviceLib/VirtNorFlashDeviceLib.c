@@ -416,6 +416,41 @@ NorFlashWriteBuffer (
   return Status;
 }
 
+/**
+  Check whether a block is erased, that is, whether all of its bits are set.
+
+  Reading a block is much cheaper than erasing it, so erasing a block that is
+  already erased can be skipped.
+
+  @param[in]  DeviceBaseAddress  The base address of the device.
+  @param[in]  BlockAddress       The address of the block.
+  @param[in]  BlockSize          The size of the block, in bytes.
+
+  @retval TRUE   The block is erased.
+  @retval FALSE  The block holds data.
+**/
+BOOLEAN
+EFIAPI
+NorFlashBlockIsErased (
+  IN  UINTN   DeviceBaseAddress,
+  IN  UINTN   BlockAddress,
+  IN  UINT32  BlockSize
+  )
+{
+  UINTN  Offset;
+
+  // Put the device into Read Array mode
+  SEND_NOR_COMMAND (DeviceBaseAddress, 0, P30_CMD_READ_ARRAY);
+
+  for (Offset = 0; Offset < BlockSize; Offset += 4) {
+    if (MmioRead32 (BlockAddress + Offset) != MAX_UINT32) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
 /**
  * This function unlock and erase an entire NOR Flash block.
  **/
@@ -464,7 +499,9 @@ NorFlashWriteFullBlock (
   UINTN       BlockAddress;
   UINTN       BuffersInBlock;
   UINTN       RemainingWords;
-  UINTN       Cnt;
+  UINT32      OldData;
+  BOOLEAN     Unchanged;
+  BOOLEAN     NeedErase;
 
   Status = EFI_SUCCESS;
 
@@ -473,7 +510,33 @@ NorFlashWriteFullBlock (
 
   // Start writing from the first address at the start of the block
   WordAddress = BlockAddress;
-  Status      = NorFlashUnlockAndEraseSingleBlock (DeviceBaseAddress, BlockAddress);
+
+  // Compare before writing. A block that already holds the data is left alone, and
+  // data that only clears bits of the old data is programmed over it, without an erase.
+  SEND_NOR_COMMAND (DeviceBaseAddress, 0, P30_CMD_READ_ARRAY);
+  Unchanged = TRUE;
+  NeedErase = FALSE;
+  for (WordIndex = 0; WordIndex < BlockSizeInWords; WordIndex++) {
+    OldData = MmioRead32 (BlockAddress + WordIndex * 4);
+    if (OldData != DataBuffer[WordIndex]) {
+      Unchanged = FALSE;
+      if ((~OldData & DataBuffer[WordIndex]) != 0) {
+        NeedErase = TRUE;
+        break;
+      }
+    }
+  }
+
+  if (Unchanged) {
+    return EFI_SUCCESS;
+  }
+
+  if (NeedErase) {
+    Status = NorFlashUnlockAndEraseSingleBlock (DeviceBaseAddress, BlockAddress);
+  } else {
+    Status = NorFlashUnlockSingleBlockIfNecessary (DeviceBaseAddress, BlockAddress);
+  }
+
   if (EFI_ERROR (Status)) {
     DEBUG ((DEBUG_ERROR, "WriteSingleBlock: ERROR - Failed to Unlock and Erase the single block at 0x%X\n", BlockAddress));
     goto EXIT;
@@ -487,35 +550,34 @@ NorFlashWriteFullBlock (
     BuffersInBlock = (UINTN)(BlockSizeInWords * 4) / P30_MAX_BUFFER_SIZE_IN_BYTES;
 
     // Then feed each buffer chunk to the NOR Flash
-    // If a buffer does not contain any data, don't write it.
+    // If the flash already holds a buffer, which after an erase is the case for
+    // a buffer without any data (set all 1s), don't write it.
     for (BufferIndex = 0;
          BufferIndex < BuffersInBlock;
          BufferIndex++, WordAddress += P30_MAX_BUFFER_SIZE_IN_BYTES, DataBuffer += P30_MAX_BUFFER_SIZE_IN_WORDS
          )
     {
-      // Check the buffer to see if it contains any data (not set all 1s).
-      for (Cnt = 0; Cnt < P30_MAX_BUFFER_SIZE_IN_WORDS; Cnt++) {
-        if (~DataBuffer[Cnt] != 0 ) {
-          // Some data found, write the buffer.
-          Status = NorFlashWriteBuffer (
-                     DeviceBaseAddress,
-                     WordAddress,
-                     P30_MAX_BUFFER_SIZE_IN_BYTES,
-                     DataBuffer
-                     );
-          if (EFI_ERROR (Status)) {
-            goto EXIT;
-          }
-
-          break;
-        }
+      SEND_NOR_COMMAND (DeviceBaseAddress, 0, P30_CMD_READ_ARRAY);
+      if (CompareMem ((VOID *)WordAddress, DataBuffer, P30_MAX_BUFFER_SIZE_IN_BYTES) == 0) {
+        continue;
+      }
+
+      Status = NorFlashWriteBuffer (
+                 DeviceBaseAddress,
+                 WordAddress,
+                 P30_MAX_BUFFER_SIZE_IN_BYTES,
+                 DataBuffer
+                 );
+      if (EFI_ERROR (Status)) {
+        goto EXIT;
       }
     }
 
     // Finally, finish off any remaining words that are less than the maximum size of the buffer
     RemainingWords = BlockSizeInWords % P30_MAX_BUFFER_SIZE_IN_WORDS;
 
-    if (RemainingWords != 0) {
+    SEND_NOR_COMMAND (DeviceBaseAddress, 0, P30_CMD_READ_ARRAY);
+    if ((RemainingWords != 0) && (CompareMem ((VOID *)WordAddress, DataBuffer, RemainingWords * 4) != 0)) {
       Status = NorFlashWriteBuffer (DeviceBaseAddress, WordAddress, (RemainingWords * 4), DataBuffer);
       if (EFI_ERROR (Status)) {
         goto EXIT;
@@ -526,6 +588,11 @@ NorFlashWriteFullBlock (
     // It is unlikely that the NOR Flash will exist in an address which falls within a 32 word boundary range,
     // i.e. which ends in the range 0x......01 - 0x......7F.
     for (WordIndex = 0; WordIndex < BlockSizeInWords; WordIndex++, DataBuffer++, WordAddress = WordAddress + 4) {
+      SEND_NOR_COMMAND (DeviceBaseAddress, 0, P30_CMD_READ_ARRAY);
+      if (MmioRead32 (WordAddress) == *DataBuffer) {
+        continue;
+      }
+
       Status = NorFlashWriteSingleWord (DeviceBaseAddress, WordAddress, *DataBuffer);
       if (EFI_ERROR (Status)) {
         goto EXIT;
@@ -805,6 +872,7 @@ NorFlashWriteSingleBlock (
   UINT8       *OrigData;
   UINTN       Start, End;
   UINT32      Index, Count;
+  UINT32      DirtyBuffers;
 
   DEBUG ((DEBUG_BLKIO, "NorFlashWriteSingleBlock(Parameters: Lba=%ld, Offset=0x%x, *NumBytes=0x%x, Buffer @ 0x%08x)\n", Lba, Offset, *NumBytes, Buffer));
 
@@ -888,6 +956,8 @@ NorFlashWriteSingleBlock (
     // Update the buffer containing the old version of the data with the new
     // contents, while checking whether the old version had any bits cleared
     // that we want to set. In that case, we will need to erase the block first.
+    // Note which of the buffers change, so that only those are programmed.
+    DirtyBuffers = 0;
     for (CurOffset = 0; CurOffset < *NumBytes; CurOffset++) {
       if (~(UINT32)OrigData[CurOffset] & (UINT32)Buffer[CurOffset]) {
         Status = NorFlashWriteSingleBlockWithErase (
@@ -904,7 +974,14 @@ NorFlashWriteSingleBlock (
         return Status;
       }
 
-      OrigData[CurOffset] = Buffer[CurOffset];
+      if (OrigData[CurOffset] != Buffer[CurOffset]) {
+        DirtyBuffers       |= 1U << (((Offset & BOUNDARY_OF_32_WORDS) + CurOffset) / P30_MAX_BUFFER_SIZE_IN_BYTES);
+        OrigData[CurOffset] = Buffer[CurOffset];
+      }
+    }
+
+    if (DirtyBuffers == 0) {
+      return EFI_SUCCESS;
     }
 
     //
@@ -920,6 +997,10 @@ NorFlashWriteSingleBlock (
 
     Count = (End - Start) / P30_MAX_BUFFER_SIZE_IN_BYTES;
     for (Index = 0; Index < Count; Index++) {
+      if ((DirtyBuffers & (1U << Index)) == 0) {
+        continue;
+      }
+
       Status = NorFlashWriteBuffer (
                  DeviceBaseAddress,
                  BlockAddress + Start + Index * P30_MAX_BUFFER_SIZE_IN_BYTES,
@@ -122,7 +122,92 @@ VirtioRingInit (
   Ring->Used.AvailEvent = (volatile VOID *)RingPagesPtr;
   RingPagesPtr         += sizeof *Ring->Used.AvailEvent;
 
-  Ring->QueueSize = QueueSize;
+  Ring->QueueSize    = QueueSize;
+  Ring->EventIdx     = FALSE;
+  Ring->LastUsedIdx  = 0;
+  Ring->IndirectBase = NULL;
+  return EFI_SUCCESS;
+}
+
+/**
+
+  Set up a pool of indirect descriptor tables for a virtio ring, for a device
+  that VIRTIO_F_RING_INDIRECT_DESC has been negotiated with.
+
+  The pool is allocated and mapped once, as a common buffer, so no request has
+  to map its table. From then on, VirtioAppendDesc() fills the table that
+  belongs to the head descriptor of the request, and the request takes a
+  single descriptor of the ring, whatever the number of its buffers.
+
+  Relevant sections from the virtio-1.0 spec:
+  - 2.4.5.3 Indirect Descriptors.
+
+  @param[in]     VirtIo     The virtio device which uses the ring.
+
+  @param[in]     NumTables  The number of tables. The head descriptor with
+                            index HeadDescIdx uses the table with index
+                            (HeadDescIdx % NumTables), so a driver with one
+                            request in flight needs one table.
+
+  @param[in]     TableSize  The number of descriptors in each table, that is,
+                            the largest number of buffers in a request.
+
+  @param[in,out] Ring       The virtio ring, set up with VirtioRingInit().
+                            VirtioRingUninit() releases the pool with it.
+
+  @retval EFI_SUCCESS  The pool is set up.
+
+  @return              Status codes propagated from
+                       VirtIo->AllocateSharedPages() and
+                       VirtioMapAllBytesInSharedBuffer().
+
+**/
+EFI_STATUS
+EFIAPI
+VirtioRingIndirectInit (
+  IN     VIRTIO_DEVICE_PROTOCOL  *VirtIo,
+  IN     UINT16                  NumTables,
+  IN     UINT16                  TableSize,
+  IN OUT VRING                   *Ring
+  )
+{
+  EFI_STATUS            Status;
+  UINTN                 NumPages;
+  VOID                  *Base;
+  EFI_PHYSICAL_ADDRESS  DeviceAddress;
+  VOID                  *Mapping;
+
+  ASSERT (NumTables > 0);
+  ASSERT (TableSize > 0);
+  ASSERT (Ring->IndirectBase == NULL);
+
+  NumPages = EFI_SIZE_TO_PAGES (sizeof (VRING_DESC) * NumTables * TableSize);
+  Status   = VirtIo->AllocateSharedPages (VirtIo, NumPages, &Base);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  SetMem (Base, EFI_PAGES_TO_SIZE (NumPages), 0x00);
+
+  Status = VirtioMapAllBytesInSharedBuffer (
+             VirtIo,
+             VirtioOperationBusMasterCommonBuffer,
+             Base,
+             EFI_PAGES_TO_SIZE (NumPages),
+             &DeviceAddress,
+             &Mapping
+             );
+  if (EFI_ERROR (Status)) {
+    VirtIo->FreeSharedPages (VirtIo, NumPages, Base);
+    return Status;
+  }
+
+  Ring->IndirectBase          = Base;
+  Ring->IndirectNumPages      = NumPages;
+  Ring->IndirectDeviceAddress = DeviceAddress;
+  Ring->IndirectMapping       = Mapping;
+  Ring->IndirectNumTables     = NumTables;
+  Ring->IndirectTableSize     = TableSize;
   return EFI_SUCCESS;
 }
 
@@ -134,6 +219,9 @@ VirtioRingInit (
   invoking this function: the VSTAT_DRIVER_OK bit must be clear in
   VhdrDeviceStatus.
 
+  The pool of indirect descriptor tables, if any, is unmapped and released
+  too.
+
   @param[in]  VirtIo  The virtio device which was using the ring.
 
   @param[out] Ring    The virtio ring to clean up.
@@ -146,6 +234,11 @@ VirtioRingUninit (
   IN OUT VRING                   *Ring
   )
 {
+  if (Ring->IndirectBase != NULL) {
+    VirtIo->UnmapSharedBuffer (VirtIo, Ring->IndirectMapping);
+    VirtIo->FreeSharedPages (VirtIo, Ring->IndirectNumPages, Ring->IndirectBase);
+  }
+
   VirtIo->FreeSharedPages (VirtIo, Ring->NumPages, Ring->Base);
   SetMem (Ring, sizeof *Ring, 0x00);
 }
@@ -173,7 +266,7 @@ VirtioPrepare (
   // Prepare for virtio-0.9.5, 2.4.2 Receiving Used Buffers From the Device.
   // We're going to poll the answer, the host should not send an interrupt.
   //
-  *Ring->Avail.Flags = (UINT16)VRING_AVAIL_F_NO_INTERRUPT;
+  VirtioRingDisableInterrupts (Ring);
 
   //
   // Prepare for virtio-0.9.5, 2.4.1 Supplying Buffers to the Device.
@@ -185,6 +278,122 @@ VirtioPrepare (
   Indices->NextDescIdx = Indices->HeadDescIdx;
 }
 
+/**
+
+  Turn off interrupt notifications from the host for the used elements that
+  it produces next.
+
+  Without VIRTIO_F_RING_EVENT_IDX, this sets VRING_AVAIL_F_NO_INTERRUPT. With
+  it, the host ignores that flag, and the used event index is set to trail the
+  used ring, so the host never crosses it. VirtioSubmit() calls this itself;
+  drivers that poll the used ring and update the available ring directly must
+  call it before every submission.
+
+  @param[in,out] Ring  The virtio ring.
+
+**/
+VOID
+EFIAPI
+VirtioRingDisableInterrupts (
+  IN OUT VRING  *Ring
+  )
+{
+  *Ring->Avail.Flags = (UINT16)VRING_AVAIL_F_NO_INTERRUPT;
+  if (Ring->EventIdx) {
+    //
+    // virtio-1.0, 2.4.7.2 -- the host interrupts once the used index moves
+    // past UsedEvent. One behind the current used index, it would have to
+    // produce 64K used elements first.
+    //
+    *Ring->Avail.UsedEvent = (UINT16)(*Ring->Used.Idx - 1);
+  }
+}
+
+/**
+
+  Decide whether the host needs to be notified of new entries in the available
+  ring, after the driver has published them by updating the Index Field.
+
+  Without VIRTIO_F_RING_EVENT_IDX, the host sets VRING_USED_F_NO_NOTIFY while
+  it is still processing the available ring. With it, the host names the
+  available index that it wants to be notified at, and the notification is
+  only needed if the entries just published cross it. A notification costs an
+  exit to the hypervisor, so drivers should ask this rather than notify
+  gratuitously.
+
+  @param[in] Ring          The virtio ring.
+
+  @param[in] OldAvailIdx   The available ring index before the driver published
+                           the new entries.
+
+  @retval TRUE   The driver must call VirtIo->SetQueueNotify().
+  @retval FALSE  The host will process the new entries without a notification.
+
+**/
+BOOLEAN
+EFIAPI
+VirtioRingNeedsNotify (
+  IN VRING   *Ring,
+  IN UINT16  OldAvailIdx
+  )
+{
+  UINT16  NewAvailIdx;
+  UINT16  AvailEvent;
+
+  //
+  // The Index Field must be visible to the host before its own state is read,
+  // or both sides could decide that the other one is idle.
+  //
+  MemoryFence ();
+  NewAvailIdx = *Ring->Avail.Idx;
+
+  if (Ring->EventIdx) {
+    //
+    // virtio-1.0, 2.4.7.2 -- vring_need_event()
+    //
+    AvailEvent = *Ring->Used.AvailEvent;
+    return (BOOLEAN)((UINT16)(NewAvailIdx - AvailEvent - 1) <
+                     (UINT16)(NewAvailIdx - OldAvailIdx));
+  }
+
+  return (BOOLEAN)((*Ring->Used.Flags & VRING_USED_F_NO_NOTIFY) == 0);
+}
+
+/**
+
+  Place a buffer in the next descriptor of the ring itself.
+
+  @param[in,out] Ring               The virtio ring.
+
+  @param[in] BufferDeviceAddress    (Bus master device) start address of the
+                                    buffer.
+
+  @param[in] BufferSize             Number of bytes in the buffer.
+
+  @param[in] Flags                  A bitmask of VRING_DESC_F_* flags.
+
+  @param[in,out] Indices            As in VirtioAppendDesc().
+
+**/
+STATIC
+VOID
+VirtioAppendRingDesc (
+  IN OUT VRING         *Ring,
+  IN     UINT64        BufferDeviceAddress,
+  IN     UINT32        BufferSize,
+  IN     UINT16        Flags,
+  IN OUT DESC_INDICES  *Indices
+  )
+{
+  volatile VRING_DESC  *Desc;
+
+  Desc        = &Ring->Desc[Indices->NextDescIdx++ % Ring->QueueSize];
+  Desc->Addr  = BufferDeviceAddress;
+  Desc->Len   = BufferSize;
+  Desc->Flags = Flags;
+  Desc->Next  = Indices->NextDescIdx % Ring->QueueSize;
+}
+
 /**
 
   Append a contiguous buffer for transmission / reception via the virtio ring.
@@ -200,6 +409,11 @@ VirtioPrepare (
   The caller is responsible for initializing *Indices with VirtioPrepare()
   first.
 
+  If VirtioRingIndirectInit() has set up a pool of indirect descriptor tables,
+  the buffer is placed in the table of the head descriptor instead, and
+  VirtioAppendIndirectTable() or VirtioFlush() later places the table in the
+  ring.
+
   @param[in,out] Ring               The virtio ring to append the buffer to,
                                     as a descriptor.
 
@@ -216,7 +430,8 @@ VirtioPrepare (
                                     always set, but the host only interprets
                                     it dependent on VRING_DESC_F_NEXT.
 
-  @param[in,out] Indices            Indices->HeadDescIdx is not accessed.
+  @param[in,out] Indices            Indices->HeadDescIdx is only read with
+                                    indirect tables, to select the table.
                                     On input, Indices->NextDescIdx identifies
                                     the next descriptor to carry the buffer.
                                     On output, Indices->NextDescIdx is
@@ -233,56 +448,116 @@ VirtioAppendDesc (
   IN OUT DESC_INDICES  *Indices
   )
 {
+  UINTN                Index;
   volatile VRING_DESC  *Desc;
 
-  Desc        = &Ring->Desc[Indices->NextDescIdx++ % Ring->QueueSize];
+  if (Ring->IndirectBase == NULL) {
+    VirtioAppendRingDesc (Ring, BufferDeviceAddress, BufferSize, Flags, Indices);
+    return;
+  }
+
+  //
+  // virtio-1.0, 2.4.5.3.1 -- the table is filled like the ring, and its
+  // descriptors are chained with VRING_DESC_F_NEXT.
+  //
+  ASSERT (Indices->NextDescIdx < Ring->IndirectTableSize);
+  Index = (UINTN)(Indices->HeadDescIdx % Ring->IndirectNumTables) *
+          Ring->IndirectTableSize + Indices->NextDescIdx++;
+
+  Desc        = (volatile VRING_DESC *)Ring->IndirectBase + Index;
   Desc->Addr  = BufferDeviceAddress;
   Desc->Len   = BufferSize;
   Desc->Flags = Flags;
-  Desc->Next  = Indices->NextDescIdx % Ring->QueueSize;
+  Desc->Next  = Indices->NextDescIdx;
 }
 
 /**
 
-  Notify the host about the descriptor chain just built, and wait until the
-  host processes it.
+  Place the indirect descriptor table that VirtioAppendDesc() has filled for a
+  request in the ring, as the single descriptor of the request.
+
+  VirtioFlush() calls this itself. Drivers that submit with VirtioSubmit()
+  call it instead, after the last VirtioAppendDesc().
+
+  @param[in,out] Ring     The virtio ring, with a pool of indirect descriptor
+                          tables.
+
+  @param[in] Indices      Indices->HeadDescIdx identifies the head descriptor,
+                          and the table. Indices->NextDescIdx is the number of
+                          descriptors in the table.
+
+**/
+VOID
+EFIAPI
+VirtioAppendIndirectTable (
+  IN OUT VRING         *Ring,
+  IN     DESC_INDICES  *Indices
+  )
+{
+  DESC_INDICES  RingIndices;
+  UINTN         Table;
+
+  ASSERT (Ring->IndirectBase != NULL);
+  ASSERT (Indices->NextDescIdx > 0);
+
+  Table                   = Indices->HeadDescIdx % Ring->IndirectNumTables;
+  RingIndices.HeadDescIdx = Indices->HeadDescIdx;
+  RingIndices.NextDescIdx = Indices->HeadDescIdx;
+  VirtioAppendRingDesc (
+    Ring,
+    Ring->IndirectDeviceAddress +
+    Table * Ring->IndirectTableSize * sizeof (VRING_DESC),
+    (UINT32)(Indices->NextDescIdx * sizeof (VRING_DESC)),
+    VRING_DESC_F_INDIRECT,
+    &RingIndices
+    );
+}
+
+/**
+
+  Make descriptor chains available to the host, and notify the host once if it
+  asks to be, without waiting for the host to use them.
+
+  Drivers that keep several requests in flight, each in descriptors of its
+  own, submit them with this function, and collect them with VirtioReapUsed(),
+  instead of VirtioPrepare() and VirtioFlush(). The used ring is polled, so
+  interrupts are turned off with VirtioRingDisableInterrupts().
 
   @param[in] VirtIo       The target virtio device to notify.
 
   @param[in] VirtQueueId  Identifies the queue for the target device.
 
-  @param[in,out] Ring     The virtio ring with descriptors to submit.
+  @param[in,out] Ring     The virtio ring with the descriptor chains.
 
-  @param[in] Indices      Indices->NextDescIdx is not accessed.
-                          Indices->HeadDescIdx identifies the head descriptor
-                          of the descriptor chain.
+  @param[in] HeadDescIdx  The head descriptors of the chains, in the order in
+                          which the host is to process them. An indirect
+                          descriptor table is placed in the ring beforehand,
+                          with VirtioAppendIndirectTable().
 
-  @param[out] UsedLen     On success, the total number of bytes, consecutively
-                          across the buffers linked by the descriptor chain,
-                          that the host wrote. May be NULL if the caller
-                          doesn't care, or can compute the same information
-                          from device-specific request structures linked by the
-                          descriptor chain.
+  @param[in] Count        The number of elements in HeadDescIdx.
 
   @return              Error code from VirtIo->SetQueueNotify() if it fails.
+                       The chains stay in the available ring, and the host
+                       may still use them.
 
-  @retval EFI_SUCCESS  Otherwise, the host processed all descriptors.
+  @retval EFI_SUCCESS  Otherwise.
 
 **/
 EFI_STATUS
 EFIAPI
-VirtioFlush (
+VirtioSubmit (
   IN     VIRTIO_DEVICE_PROTOCOL  *VirtIo,
   IN     UINT16                  VirtQueueId,
   IN OUT VRING                   *Ring,
-  IN     DESC_INDICES            *Indices,
-  OUT    UINT32                  *UsedLen    OPTIONAL
+  IN     CONST UINT16            *HeadDescIdx,
+  IN     UINT16                  Count
   )
 {
-  UINT16      NextAvailIdx;
-  UINT16      LastUsedIdx;
-  EFI_STATUS  Status;
-  UINTN       PollPeriodUsecs;
+  UINT16  OldAvailIdx;
+  UINT16  NextAvailIdx;
+  UINT16  Index;
+
+  VirtioRingDisableInterrupts (Ring);
 
   //
   // virtio-0.9.5, 2.4.1.2 Updating the Available Ring
@@ -291,14 +566,12 @@ VirtioFlush (
   // specification, but each entry in the Available Ring references only the
   // head descriptor of any given descriptor chain.
   //
-  NextAvailIdx = *Ring->Avail.Idx;
-  //
-  // (Due to our lock-step progress, this is where the host will produce the
-  // used element with the head descriptor's index in it.)
-  //
-  LastUsedIdx                                        = NextAvailIdx;
-  Ring->Avail.Ring[NextAvailIdx++ % Ring->QueueSize] =
-    Indices->HeadDescIdx % Ring->QueueSize;
+  OldAvailIdx  = *Ring->Avail.Idx;
+  NextAvailIdx = OldAvailIdx;
+  for (Index = 0; Index < Count; Index++) {
+    Ring->Avail.Ring[NextAvailIdx++ % Ring->QueueSize] =
+      HeadDescIdx[Index] % Ring->QueueSize;
+  }
 
   //
   // virtio-0.9.5, 2.4.1.3 Updating the Index Field
@@ -307,26 +580,96 @@ VirtioFlush (
   *Ring->Avail.Idx = NextAvailIdx;
 
   //
-  // virtio-0.9.5, 2.4.1.4 Notifying the Device -- gratuitous notifications are
-  // OK.
+  // virtio-0.9.5, 2.4.1.4 Notifying the Device -- unless the host has asked
+  // not to be. While the host is still processing the available ring, it
+  // picks up the new entries on its own.
   //
+  if (VirtioRingNeedsNotify (Ring, OldAvailIdx)) {
+    return VirtIo->SetQueueNotify (VirtIo, VirtQueueId);
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+
+  Fetch the next element that the host has placed in the used ring, if there
+  is one.
+
+  This function implements the following section from virtio-0.9.5:
+  - 2.4.2 Receiving Used Buffers From the Device
+
+  @param[in,out] Ring      The virtio ring. Ring->LastUsedIdx counts the
+                           used elements fetched so far, by this function and
+                           by VirtioFlush().
+
+  @param[out] HeadDescIdx  The head descriptor of the chain that the host has
+                           used.
+
+  @param[out] UsedLen      The number of bytes that the host wrote to the
+                           buffers of the chain. May be NULL.
+
+  @retval TRUE   An element has been fetched.
+  @retval FALSE  The host has not used another chain yet.
+
+**/
+BOOLEAN
+EFIAPI
+VirtioReapUsed (
+  IN OUT VRING   *Ring,
+  OUT    UINT16  *HeadDescIdx,
+  OUT    UINT32  *UsedLen     OPTIONAL
+  )
+{
+  volatile CONST VRING_USED_ELEM  *UsedElem;
+
   MemoryFence ();
-  Status = VirtIo->SetQueueNotify (VirtIo, VirtQueueId);
-  if (EFI_ERROR (Status)) {
-    return Status;
+  if (Ring->LastUsedIdx == *Ring->Used.Idx) {
+    return FALSE;
   }
 
   //
-  // virtio-0.9.5, 2.4.2 Receiving Used Buffers From the Device
-  // Wait until the host processes and acknowledges our descriptor chain. The
-  // condition we use for polling is greatly simplified and relies on the
-  // synchronous, lock-step progress.
+  // The element must not be read before the Index Field that covers it.
+  //
+  MemoryFence ();
+  UsedElem     = &Ring->Used.UsedElem[Ring->LastUsedIdx++ % Ring->QueueSize];
+  *HeadDescIdx = (UINT16)UsedElem->Id;
+  if (UsedLen != NULL) {
+    *UsedLen = UsedElem->Len;
+  }
+
+  return TRUE;
+}
+
+/**
+
+  Wait until a condition on the rings of a device holds. The condition is
+  checked again after a poll period that starts at 1 us, and doubles until it
+  is slightly above 1 ms.
+
+  The condition may reap used elements, and raise the TPL to do so. Memory is
+  fenced around each check, so that the condition sees what the host wrote.
+
+  @param[in] Condition  The condition to wait for.
+
+  @param[in] Context    The context to pass to Condition.
+
+**/
+VOID
+EFIAPI
+VirtioPoll (
+  IN VIRTIO_POLL_CONDITION  Condition,
+  IN VOID                   *Context
+  )
+{
+  UINTN  PollPeriodUsecs;
+
   //
   // Keep slowing down until we reach a poll period of slightly above 1 ms.
   //
   PollPeriodUsecs = 1;
   MemoryFence ();
-  while (*Ring->Used.Idx != NextAvailIdx) {
+  while (!Condition (Context)) {
     gBS->Stall (PollPeriodUsecs); // calls AcpiTimerLib::MicroSecondDelay
 
     if (PollPeriodUsecs < 1024) {
@@ -337,13 +680,133 @@ VirtioFlush (
   }
 
   MemoryFence ();
+}
 
-  if (UsedLen != NULL) {
-    volatile CONST VRING_USED_ELEM  *UsedElem;
+//
+// The context of the condition that VirtioWaitUsed() polls.
+//
+typedef struct {
+  VRING     *Ring;
+  UINT16    *HeadDescIdx;
+  UINT32    *UsedLen;
+} VIRTIO_WAIT_USED_CONTEXT;
 
-    UsedElem = &Ring->Used.UsedElem[LastUsedIdx % Ring->QueueSize];
-    ASSERT (UsedElem->Id == Indices->HeadDescIdx);
-    *UsedLen = UsedElem->Len;
+/**
+
+  Fetch the next used element for VirtioWaitUsed(), if there is one.
+
+  @param[in] Context  The VIRTIO_WAIT_USED_CONTEXT of the wait.
+
+  @retval TRUE   An element has been fetched.
+  @retval FALSE  The host has not used another chain yet.
+
+**/
+STATIC
+BOOLEAN
+EFIAPI
+VirtioUsedElemFetched (
+  IN VOID  *Context
+  )
+{
+  VIRTIO_WAIT_USED_CONTEXT  *Wait;
+
+  Wait = Context;
+  return VirtioReapUsed (Wait->Ring, Wait->HeadDescIdx, Wait->UsedLen);
+}
+
+/**
+
+  Wait until the host places an element in the used ring, and fetch it, as
+  VirtioReapUsed() does.
+
+  @param[in,out] Ring      The virtio ring.
+
+  @param[out] HeadDescIdx  The head descriptor of the chain that the host has
+                           used.
+
+  @param[out] UsedLen      The number of bytes that the host wrote to the
+                           buffers of the chain. May be NULL.
+
+**/
+VOID
+EFIAPI
+VirtioWaitUsed (
+  IN OUT VRING   *Ring,
+  OUT    UINT16  *HeadDescIdx,
+  OUT    UINT32  *UsedLen     OPTIONAL
+  )
+{
+  VIRTIO_WAIT_USED_CONTEXT  Wait;
+
+  Wait.Ring        = Ring;
+  Wait.HeadDescIdx = HeadDescIdx;
+  Wait.UsedLen     = UsedLen;
+  VirtioPoll (VirtioUsedElemFetched, &Wait);
+}
+
+/**
+
+  Notify the host about the descriptor chain just built, and wait until the
+  host processes it.
+
+  @param[in] VirtIo       The target virtio device to notify.
+
+  @param[in] VirtQueueId  Identifies the queue for the target device.
+
+  @param[in,out] Ring     The virtio ring with descriptors to submit.
+
+  @param[in] Indices      Indices->NextDescIdx is only read with indirect
+                          descriptor tables, as the number of descriptors in
+                          the table. Indices->HeadDescIdx identifies the head
+                          descriptor of the descriptor chain.
+
+  @param[out] UsedLen     On success, the total number of bytes, consecutively
+                          across the buffers linked by the descriptor chain,
+                          that the host wrote. May be NULL if the caller
+                          doesn't care, or can compute the same information
+                          from device-specific request structures linked by the
+                          descriptor chain.
+
+  @return              Error code from VirtIo->SetQueueNotify() if it fails.
+
+  @retval EFI_SUCCESS  Otherwise, the host processed all descriptors.
+
+**/
+EFI_STATUS
+EFIAPI
+VirtioFlush (
+  IN     VIRTIO_DEVICE_PROTOCOL  *VirtIo,
+  IN     UINT16                  VirtQueueId,
+  IN OUT VRING                   *Ring,
+  IN     DESC_INDICES            *Indices,
+  OUT    UINT32                  *UsedLen    OPTIONAL
+  )
+{
+  UINT16      UsedDescIdx;
+  UINT32      Len;
+  EFI_STATUS  Status;
+
+  if (Ring->IndirectBase != NULL) {
+    VirtioAppendIndirectTable (Ring, Indices);
+  }
+
+  Status = VirtioSubmit (VirtIo, VirtQueueId, Ring, &Indices->HeadDescIdx, 1);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  //
+  // virtio-0.9.5, 2.4.2 Receiving Used Buffers From the Device
+  // Wait until the host processes and acknowledges our descriptor chain. Due
+  // to our lock-step progress, it is the last one in the available ring.
+  //
+  do {
+    VirtioWaitUsed (Ring, &UsedDescIdx, &Len);
+  } while (Ring->LastUsedIdx != *Ring->Avail.Idx);
+
+  ASSERT (UsedDescIdx == Indices->HeadDescIdx);
+  if (UsedLen != NULL) {
+    *UsedLen = Len;
   }
 
   return EFI_SUCCESS;
@@ -23,6 +23,7 @@
 #include <Library/DevicePathLib.h>
 #include <Library/HobLib.h>
 #include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
 #include <Library/PrintLib.h>
 #include <Library/QemuFwCfgLib.h>
 #include <Library/UefiBootServicesTableLib.h>
@@ -962,9 +963,13 @@ QemuKernelChunkedRead (
   )
 {
   UINT32  Chunk;
+  UINT32  ChunkSize;
+
+  ChunkSize = FixedPcdGet32 (PcdQemuKernelLoaderFsChunkSize);
+  ASSERT (ChunkSize > 0);
 
   while (Bytes > 0) {
-    Chunk = (Bytes < SIZE_1MB) ? Bytes : SIZE_1MB;
+    Chunk = (Bytes < ChunkSize) ? Bytes : ChunkSize;
     QemuFwCfgReadBytes (Chunk, Dest);
     Bytes -= Chunk;
     Dest  += Chunk;
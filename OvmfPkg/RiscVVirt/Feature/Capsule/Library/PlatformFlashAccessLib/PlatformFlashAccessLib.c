@@ -26,6 +26,43 @@
 #define FLASH_SIZE       SIZE_32MB
 #define BLOCK_SIZE       SIZE_256KB
 
+#define NO_PENDING_VERIFY  MAX_UINTN
+
+/**
+  Read back a block that has been programmed and compare it with the data that
+  was written to it.
+
+  @param[in] FlashBase  The base address of the flash device.
+  @param[in] Lba        The block on the flash device.
+  @param[in] Data       The data that was written to the block.
+
+  @retval EFI_SUCCESS       The block holds the data.
+  @retval EFI_DEVICE_ERROR  The block does not hold the data.
+**/
+STATIC
+EFI_STATUS
+VerifyFlashBlock (
+  IN UINTN        FlashBase,
+  IN UINTN        Lba,
+  IN CONST UINT8  *Data
+  )
+{
+  //
+  // The write leaves the device in read array mode.
+  //
+  if (CompareMem (
+        (UINT8 *)(UINTN)(GET_NOR_BLOCK_ADDRESS (FlashBase, Lba, BLOCK_SIZE)),
+        Data,
+        BLOCK_SIZE
+        ) != 0)
+  {
+    DEBUG ((DEBUG_ERROR, "Block - 0x%x - verify failed\n", Lba));
+    return EFI_DEVICE_ERROR;
+  }
+
+  return EFI_SUCCESS;
+}
+
 /**
   Perform flash write operation with progress indicator.  The start and end
   completion percentage values are passed into this function.  If the requested
@@ -36,6 +73,11 @@
   StartPercentage, and EndPercentage parameters to be ignored if the requested
   flash write operation can not be broken up
 
+  Blocks that already hold the data are skipped. The others are written as
+  full blocks, and each is read back and verified one step behind the write:
+  block N is verified after block N + 1 is written, so that verification is not
+  on the path from one write to the next and can be handed to another hart.
+
   @param[in] FirmwareType      The type of firmware.
   @param[in] FlashAddress      The address of flash device to be accessed.
   @param[in] FlashAddressType  The type of flash device address.
@@ -73,10 +115,11 @@ PerformFlashWriteWithProgress (
   UINTN       LbaNum;
   UINTN       Lba;
   UINTN       Index;
-  VOID        *ShadowBuffer;
   UINTN       LastBlock;
-  UINTN       NumByte;
   UINTN       FlashBase;
+  UINTN       PendingVerify;
+  UINTN       Percentage;
+  UINTN       LastPercentage;
 
   DEBUG ((DEBUG_INFO, "PerformFlashWrite - 0x%x(%x) - 0x%x\n", (UINTN)FlashAddress, (UINTN)FlashAddressType, Length));
 
@@ -99,8 +142,7 @@ PerformFlashWriteWithProgress (
     FlashBase = FLASH_DATA_BASE;
   }
 
-  ShadowBuffer = AllocateZeroPool (BLOCK_SIZE);
-  LastBlock    = FLASH_SIZE / BLOCK_SIZE - 1;
+  LastBlock = FLASH_SIZE / BLOCK_SIZE - 1;
   if (  (ALIGN (FlashAddress, BLOCK_SIZE) != FlashAddress)
      || (Length % BLOCK_SIZE))
   {
@@ -111,11 +153,18 @@ PerformFlashWriteWithProgress (
   //
   // Erase & Write
   //
-  LbaNum = Length / BLOCK_SIZE;
-  Lba    = (FlashAddress - FlashBase) / BLOCK_SIZE;
+  LbaNum         = Length / BLOCK_SIZE;
+  Lba            = (FlashAddress - FlashBase) / BLOCK_SIZE;
+  PendingVerify  = NO_PENDING_VERIFY;
+  LastPercentage = MAX_UINTN;
   for (Index = 0; Index < LbaNum; Index++) {
-    if (Progress != NULL) {
-      Progress (StartPercentage + ((Index * (EndPercentage - StartPercentage)) / LbaNum));
+    //
+    // The progress callback may redraw the screen, so only report new values.
+    //
+    Percentage = StartPercentage + ((Index * (EndPercentage - StartPercentage)) / LbaNum);
+    if ((Progress != NULL) && (Percentage != LastPercentage)) {
+      Progress (Percentage);
+      LastPercentage = Percentage;
     }
 
     if (CompareMem (
@@ -128,36 +177,44 @@ PerformFlashWriteWithProgress (
       continue;
     }
 
+    //
+    // The whole block is replaced, so it is written as is, without merging it
+    // with the old data in a shadow buffer first. The block is only erased if
+    // the new data sets bits that are clear.
+    //
     DEBUG ((DEBUG_INFO, "Sector - 0x%x - update...\n", Index));
-    NumByte = BLOCK_SIZE;
-    Status  = NorFlashWriteSingleBlock (
-                FlashBase,
-                FlashBase,
-                Lba + Index,
-                LastBlock,
-                BLOCK_SIZE,
-                FLASH_SIZE,
-                0,
-                &NumByte,
-                (UINT8 *)Buffer + Index * BLOCK_SIZE,
-                ShadowBuffer
-                );
-    if ((Status != EFI_SUCCESS) || (NumByte != BLOCK_SIZE)) {
-      DEBUG ((
-        DEBUG_ERROR,
-        "Sector - 0x%x - update failed (bytes written)...\n",
-        Index,
-        NumByte
-        ));
+    Status = NorFlashWriteBlocks (
+               FlashBase,
+               FlashBase,
+               Lba + Index,
+               LastBlock,
+               BLOCK_SIZE,
+               BLOCK_SIZE,
+               (UINT8 *)Buffer + Index * BLOCK_SIZE
+               );
+    if (EFI_ERROR (Status)) {
+      DEBUG ((DEBUG_ERROR, "Sector - 0x%x - update failed - %r\n", Index, Status));
       break;
     }
+
+    if (PendingVerify != NO_PENDING_VERIFY) {
+      Status = VerifyFlashBlock (FlashBase, Lba + PendingVerify, (UINT8 *)Buffer + PendingVerify * BLOCK_SIZE);
+      if (EFI_ERROR (Status)) {
+        break;
+      }
+    }
+
+    PendingVerify = Index;
+  }
+
+  if (!EFI_ERROR (Status) && (PendingVerify != NO_PENDING_VERIFY)) {
+    Status = VerifyFlashBlock (FlashBase, Lba + PendingVerify, (UINT8 *)Buffer + PendingVerify * BLOCK_SIZE);
   }
 
   if (Progress != NULL) {
     Progress (EndPercentage);
   }
 
-  FreePool (ShadowBuffer);
   return Status;
 }
 
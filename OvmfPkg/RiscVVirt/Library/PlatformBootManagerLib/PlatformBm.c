@@ -37,6 +37,12 @@
 
 #define VERSION_STRING_PREFIX  L"RISC-V EDK2 firmware version "
 
+//
+// Whether only the devices named in QEMU's boot order have been connected, so
+// that connecting the rest may still produce a bootable option.
+//
+STATIC BOOLEAN  mConnectedBootOrderOnly = FALSE;
+
 #pragma pack (1)
 typedef struct {
   VENDOR_DEVICE_PATH            SerialDxe;
@@ -946,7 +952,8 @@ PlatformBootManagerAfterConsole (
   TryRunningQemuKernel ();
 
   //
-  // Connect the purported boot devices.
+  // Connect the purported boot devices. Connecting the others, and setting up
+  // their DMA protection, is deferred until none of the boot options work.
   //
   Status = ConnectDevicesFromQemu ();
   if (RETURN_ERROR (Status)) {
@@ -954,6 +961,8 @@ PlatformBootManagerAfterConsole (
     // Connect the rest of the devices.
     //
     EfiBootManagerConnectAll ();
+  } else {
+    mConnectedBootOrderOnly = TRUE;
   }
 
   //
@@ -1032,8 +1041,34 @@ PlatformBootManagerUnableToBoot (
   EFI_STATUS                    Status;
   EFI_INPUT_KEY                 Key;
   EFI_BOOT_MANAGER_LOAD_OPTION  BootManagerMenu;
+  EFI_BOOT_MANAGER_LOAD_OPTION  *BootOptions;
+  UINTN                         BootOptionCount;
   UINTN                         Index;
 
+  //
+  // Only the devices in QEMU's boot order were connected. Connect all the
+  // others, and try the boot options that they produce before giving up.
+  //
+  if (mConnectedBootOrderOnly) {
+    mConnectedBootOrderOnly = FALSE;
+    DEBUG ((DEBUG_INFO, "%a: connecting all devices\n", __func__));
+    EfiBootManagerConnectAll ();
+    EfiBootManagerRefreshAllBootOption ();
+
+    BootOptions = EfiBootManagerGetLoadOptions (&BootOptionCount, LoadOptionTypeBoot);
+    for (Index = 0; Index < BootOptionCount; Index++) {
+      if (((BootOptions[Index].Attributes & LOAD_OPTION_ACTIVE) == 0) ||
+          ((BootOptions[Index].Attributes & LOAD_OPTION_CATEGORY) != LOAD_OPTION_CATEGORY_BOOT))
+      {
+        continue;
+      }
+
+      EfiBootManagerBoot (&BootOptions[Index]);
+    }
+
+    EfiBootManagerFreeLoadOptions (BootOptions, BootOptionCount);
+  }
+
   //
   // BootManagerMenu doesn't contain the correct information when return status
   // is EFI_NOT_FOUND.
@@ -0,0 +1,156 @@
+/** @file
+  Early identity map for RiscVVirt Machines.
+
+  The address space up to the end of the highest resource is identity-mapped
+  with Sv39, by 2 MiB superpages with every permission, before DXE. The
+  RISC-V MMU library adopts the tables in DXE and refines them, instead of
+  building its own with the MMU off.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include "PlatformSecLib.h"
+
+#define EARLY_MMU_PTE_V  BIT0
+#define EARLY_MMU_PTE_R  BIT1
+#define EARLY_MMU_PTE_W  BIT2
+#define EARLY_MMU_PTE_X  BIT3
+#define EARLY_MMU_PTE_G  BIT5
+#define EARLY_MMU_PTE_A  BIT6
+#define EARLY_MMU_PTE_D  BIT7
+
+#define EARLY_MMU_PTE_PPN_SHIFT  10
+#define EARLY_MMU_PAGE_SHIFT     12
+
+//
+// A root entry of Sv39 points to a table of 512 2 MiB leaves.
+//
+#define EARLY_MMU_ROOT_ENTRY_SHIFT  30
+#define EARLY_MMU_LEAF_SHIFT        21
+#define EARLY_MMU_ENTRIES           512
+
+#define EARLY_MMU_LEAF_ATTRIBUTES  (EARLY_MMU_PTE_V | EARLY_MMU_PTE_R | EARLY_MMU_PTE_W | \
+                                    EARLY_MMU_PTE_X | EARLY_MMU_PTE_G | EARLY_MMU_PTE_A | \
+                                    EARLY_MMU_PTE_D)
+
+/**
+  Find the end of the range to identity-map, from the resource HOBs.
+
+  @return  The end, aligned to the reach of a root entry.
+
+**/
+STATIC
+UINT64
+GetMappedEnd (
+  VOID
+  )
+{
+  EFI_PEI_HOB_POINTERS  Hob;
+  UINT64                End;
+
+  End = 0;
+  for (Hob.Raw = GetHobList (); !END_OF_HOB_LIST (Hob); Hob.Raw = GET_NEXT_HOB (Hob)) {
+    if (GET_HOB_TYPE (Hob) == EFI_HOB_TYPE_RESOURCE_DESCRIPTOR) {
+      End = MAX (End, Hob.ResourceDescriptor->PhysicalStart + Hob.ResourceDescriptor->ResourceLength);
+    }
+  }
+
+  return ALIGN_VALUE (End, LShiftU64 (1, EARLY_MMU_ROOT_ENTRY_SHIFT));
+}
+
+/**
+  Determine the number of pages the early identity map needs.
+
+  @return  The number of pages, or 0 if no early map is built, because the
+           resources don't fit in Sv39 or paging is disabled.
+
+**/
+UINTN
+EFIAPI
+MmuGetTablePages (
+  VOID
+  )
+{
+  UINT64  MappedEnd;
+
+  if (FixedPcdGet32 (PcdCpuRiscVMmuMaxSatpMode) < SATP_MODE_SV39) {
+    return 0;
+  }
+
+  //
+  // Identity-mapped addresses must not need sign-extension.
+  //
+  MappedEnd = GetMappedEnd ();
+  if ((MappedEnd == 0) || (MappedEnd > BIT38)) {
+    return 0;
+  }
+
+  return 1 + (UINTN)RShiftU64 (MappedEnd, EARLY_MMU_ROOT_ENTRY_SHIFT);
+}
+
+/**
+  Build the early identity map in pages sized by MmuGetTablePages (), enable
+  it, and record it in a HOB for the DXE MMU library to adopt.
+
+  @param  Tables          The pages for the tables.
+  @param  NumberOfPages   The number of pages, as MmuGetTablePages () returned.
+
+  @retval EFI_SUCCESS       The map is enabled.
+  @retval EFI_UNSUPPORTED   The hart doesn't implement Sv39, so the MMU is left off.
+
+**/
+EFI_STATUS
+EFIAPI
+MmuInitialization (
+  IN VOID   *Tables,
+  IN UINTN  NumberOfPages
+  )
+{
+  UINT64              *Root;
+  UINT64              *Table;
+  UINTN               RootIndex;
+  UINTN               Index;
+  UINT64              Address;
+  UINT64              Satp;
+  RISCV_MMU_HAND_OFF  HandOff;
+
+  ASSERT (NumberOfPages == MmuGetTablePages ());
+  ASSERT (((UINTN)Tables & EFI_PAGE_MASK) == 0);
+
+  Root = Tables;
+  ZeroMem (Root, EFI_PAGE_SIZE);
+  for (RootIndex = 0; RootIndex < NumberOfPages - 1; RootIndex++) {
+    Table = (UINT64 *)((UINT8 *)Tables + EFI_PAGES_TO_SIZE (RootIndex + 1));
+    for (Index = 0; Index < EARLY_MMU_ENTRIES; Index++) {
+      Address      = LShiftU64 (RootIndex, EARLY_MMU_ROOT_ENTRY_SHIFT) + LShiftU64 (Index, EARLY_MMU_LEAF_SHIFT);
+      Table[Index] = LShiftU64 (RShiftU64 (Address, EARLY_MMU_PAGE_SHIFT), EARLY_MMU_PTE_PPN_SHIFT) |
+                     EARLY_MMU_LEAF_ATTRIBUTES;
+    }
+
+    Root[RootIndex] = LShiftU64 (RShiftU64 ((UINTN)Table, EARLY_MMU_PAGE_SHIFT), EARLY_MMU_PTE_PPN_SHIFT) |
+                      EARLY_MMU_PTE_V;
+  }
+
+  //
+  // A mode the hart doesn't implement isn't written, and the MMU stays off.
+  //
+  Satp = LShiftU64 (SATP_MODE_SV39, SATP64_MODE_SHIFT) | RShiftU64 ((UINTN)Root, EARLY_MMU_PAGE_SHIFT);
+  if (SecRiscVEnableMmu (Satp) != Satp) {
+    DEBUG ((DEBUG_INFO, "%a: Sv39 not implemented, the MMU is left off\n", __func__));
+    return EFI_UNSUPPORTED;
+  }
+
+  HandOff.Signature          = RISCV_MMU_HAND_OFF_SIGNATURE;
+  HandOff.Revision           = RISCV_MMU_HAND_OFF_REVISION;
+  HandOff.Satp               = Satp;
+  HandOff.TableBase          = (UINTN)Tables;
+  HandOff.NumberOfTablePages = NumberOfPages;
+  HandOff.MappedEnd          = LShiftU64 (NumberOfPages - 1, EARLY_MMU_ROOT_ENTRY_SHIFT);
+  BuildGuidDataHob (&gRiscVMmuHandOffHobGuid, &HandOff, sizeof (HandOff));
+
+  DEBUG ((DEBUG_INFO, "%a: 0x%lx bytes identity-mapped with Sv39\n", __func__, HandOff.MappedEnd));
+
+  return EFI_SUCCESS;
+}
@@ -81,11 +81,12 @@ PlatformInitialization (
   VOID  *FdtPointer
   )
 {
-  VOID    *Base;
-  VOID    *NewBase;
-  UINTN   FdtSize;
-  UINTN   FdtPages;
-  UINT64  *FdtHobData;
+  VOID            *Base;
+  VOID            *NewBase;
+  UINTN           FdtSize;
+  UINTN           FdtPages;
+  UINT64          *FdtHobData;
+  RISCV_ISA_INFO  IsaInfo;
 
   SerialPortInitialize ();
 
@@ -114,6 +115,13 @@ PlatformInitialization (
 
   *FdtHobData = (UINTN)NewBase;
 
+  //
+  // Discover the ISA extensions once, for every later phase to read from the HOB.
+  //
+  if (!EFI_ERROR (RiscVIsaParseFdt (NewBase, &IsaInfo))) {
+    BuildGuidDataHob (&gRiscVIsaInfoHobGuid, &IsaInfo, sizeof (IsaInfo));
+  }
+
   PopulateIoResources (Base, "ns16550a");
   PopulateIoResources (Base, "qemu,fw-cfg-mmio");
   PopulateIoResources (Base, "virtio,mmio");
@@ -249,6 +249,8 @@ SecPlatformMain (
 {
   SEC_HOBLIST_DATA  *SecHobList;
   const EFI_GUID    SecHobDataGuid = RISCV_SEC_HANDOFF_HOB_GUID;
+  UINTN             TablePages;
+  VOID              *Tables;
 
   SecHobList = (SEC_HOBLIST_DATA *)GetSecHobData ();
   if (SecCoreData == NULL) {
@@ -261,6 +263,17 @@ SecPlatformMain (
     CpuInitialization (SecHobList->SecHandoffData.FdtPointer);
     PlatformInitialization (SecHobList->SecHandoffData.FdtPointer);
 
+    //
+    // Enable an identity map with superpages, for the DXE core to run with
+    //
+    TablePages = MmuGetTablePages ();
+    if (TablePages != 0) {
+      Tables = AllocatePages (TablePages);
+      if (Tables != NULL) {
+        MmuInitialization (Tables, TablePages);
+      }
+    }
+
     //
     // Pass Sec Hob data to DXE
     //
@@ -14,7 +14,9 @@ SPDX-License-Identifier: BSD-2-Clause-Patent
 #include <Ppi/SecPlatformInformation.h>
 #include <Guid/FdtHob.h>
 #include <Guid/MemoryTypeInformation.h>
+#include <Guid/RiscVMmuHandOff.h>
 #include <Guid/RiscVSecHobData.h>
+#include <Register/RiscV64/RiscVEncoding.h>
 #include <Register/RiscV64/RiscVImpl.h>
 #include <Library/CpuLib.h>
 #include <Library/CpuExceptionHandlerLib.h>
@@ -27,6 +29,7 @@ SPDX-License-Identifier: BSD-2-Clause-Patent
 #include <Library/PrePiLib.h>
 #include <Library/SerialPortLib.h>
 #include <Library/BaseRiscVSbiLib.h>
+#include <Library/RiscVIsaLib.h>
 #include <Library/BaseMemoryLib.h>
 
 //
@@ -99,4 +102,50 @@ CpuInitialization (
   VOID  *FdtPointer
   );
 
+/**
+  Determine the number of pages the early identity map needs.
+
+  @return  The number of pages, or 0 if no early map is built, because the
+           resources don't fit in Sv39 or paging is disabled.
+
+**/
+UINTN
+EFIAPI
+MmuGetTablePages (
+  VOID
+  );
+
+/**
+  Build the early identity map in pages sized by MmuGetTablePages (), enable
+  it, and record it in a HOB for the DXE MMU library to adopt.
+
+  @param  Tables          The pages for the tables.
+  @param  NumberOfPages   The number of pages, as MmuGetTablePages () returned.
+
+  @retval EFI_SUCCESS       The map is enabled.
+  @retval EFI_UNSUPPORTED   The hart doesn't implement Sv39, so the MMU is left off.
+
+**/
+EFI_STATUS
+EFIAPI
+MmuInitialization (
+  IN VOID   *Tables,
+  IN UINTN  NumberOfPages
+  );
+
+/**
+  Order the page table stores before the hart's walks, and write satp.
+
+  @param  Satp  The satp value.
+
+  @return The satp value read back, which differs from Satp if its mode
+          isn't implemented.
+
+**/
+UINT64
+EFIAPI
+SecRiscVEnableMmu (
+  IN UINT64  Satp
+  );
+
 #endif /* PLATFORM_SEC_LIB_ */
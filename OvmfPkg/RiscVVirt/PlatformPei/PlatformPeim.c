@@ -18,12 +18,14 @@
 #include <Ppi/GuidedSectionExtraction.h>
 #include <Ppi/SecHobData.h>
 #include <Guid/RiscVSecHobData.h>
+#include <Guid/RiscVIoMmuDmaPool.h>
 
 //
 // The Library classes this module consumes
 //
 #include <Library/DebugLib.h>
 #include <Library/HobLib.h>
+#include <Library/PcdLib.h>
 #include <Library/PeimEntryPoint.h>
 #include <Library/PeiServicesLib.h>
 #include "../Library/PlatformSecLib/PlatformSecLib.h"
@@ -52,12 +54,59 @@ CONST EFI_PEI_PPI_DESCRIPTOR  mTpm2DiscoveredPpi = {
   NULL
 };
 
+/**
+  Enable an identity map with superpages, once the PEI core runs from
+  permanent memory, for the tables to be allocated there.
+
+  @param  PeiServices           Pointer to the PEI Services Table.
+  @param  NotifyDescriptor      The notification descriptor.
+  @param  Ppi                   The memory discovered PPI.
+
+  @retval EFI_SUCCESS           The map is enabled, or isn't built.
+  @retval Others                The tables could not be allocated.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+OnMemoryDiscovered (
+  IN EFI_PEI_SERVICES           **PeiServices,
+  IN EFI_PEI_NOTIFY_DESCRIPTOR  *NotifyDescriptor,
+  IN VOID                       *Ppi
+  )
+{
+  UINTN                 TablePages;
+  EFI_PHYSICAL_ADDRESS  Tables;
+  EFI_STATUS            Status;
+
+  TablePages = MmuGetTablePages ();
+  if (TablePages == 0) {
+    return EFI_SUCCESS;
+  }
+
+  Status = PeiServicesAllocatePages (EfiBootServicesData, TablePages, &Tables);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  MmuInitialization ((VOID *)(UINTN)Tables, TablePages);
+  return EFI_SUCCESS;
+}
+
+CONST EFI_PEI_NOTIFY_DESCRIPTOR  mMemoryDiscoveredNotify = {
+  (EFI_PEI_PPI_DESCRIPTOR_NOTIFY_CALLBACK | EFI_PEI_PPI_DESCRIPTOR_TERMINATE_LIST),
+  &gEfiPeiMemoryDiscoveredPpiGuid,
+  OnMemoryDiscovered
+};
+
 /*
   Install PEI memory.
 
+  @return  The base of the PEI memory.
+
 */
 STATIC
-VOID
+EFI_PHYSICAL_ADDRESS
 FindInstallPeiMemory (
   VOID
   )
@@ -94,6 +143,159 @@ FindInstallPeiMemory (
 
   ASSERT (PeiMemoryBase != 0);
   ASSERT_EFI_ERROR (PeiServicesInstallPeiMemory (PeiMemoryBase, PEI_MEMORY_SIZE));
+
+  return PeiMemoryBase;
+}
+
+/**
+  Lower the lowest base of the ranges in use that overlap a candidate DMA pool,
+  if a range overlaps it.
+
+  @param[in]      Base         The base of the candidate.
+  @param[in]      Size         The size of the candidate.
+  @param[in]      RangeBase    The base of the range in use.
+  @param[in]      RangeSize    The size of the range in use.
+  @param[in, out] OverlapBase  The lowest base of the overlapping ranges so far.
+
+**/
+STATIC
+VOID
+NoteDmaPoolOverlap (
+  IN     EFI_PHYSICAL_ADDRESS  Base,
+  IN     UINT64                Size,
+  IN     EFI_PHYSICAL_ADDRESS  RangeBase,
+  IN     UINT64                RangeSize,
+  IN OUT EFI_PHYSICAL_ADDRESS  *OverlapBase
+  )
+{
+  if ((RangeSize != 0) && (RangeBase < Base + Size) && (Base < RangeBase + RangeSize)) {
+    *OverlapBase = MIN (*OverlapBase, RangeBase);
+  }
+}
+
+/**
+  Find the lowest base of the ranges in use that overlap a candidate DMA pool.
+
+  The PEI memory, the temporary memory, and every range that a memory allocation
+  or firmware volume HOB describes are in use.
+
+  @param[in]   Base           The base of the candidate.
+  @param[in]   Size           The size of the candidate.
+  @param[in]   PeiMemoryBase  The base of the PEI memory.
+  @param[out]  OverlapBase    The lowest base of the overlapping ranges.
+
+  @retval  TRUE   A range in use overlaps the candidate.
+  @retval  FALSE  The candidate is free.
+
+**/
+STATIC
+BOOLEAN
+FindDmaPoolOverlap (
+  IN  EFI_PHYSICAL_ADDRESS  Base,
+  IN  UINT64                Size,
+  IN  EFI_PHYSICAL_ADDRESS  PeiMemoryBase,
+  OUT EFI_PHYSICAL_ADDRESS  *OverlapBase
+  )
+{
+  EFI_PEI_HOB_POINTERS  Hob;
+
+  *OverlapBase = MAX_UINT64;
+  NoteDmaPoolOverlap (Base, Size, PeiMemoryBase, PEI_MEMORY_SIZE, OverlapBase);
+  NoteDmaPoolOverlap (
+    Base,
+    Size,
+    FixedPcdGet32 (PcdOvmfSecPeiTempRamBase),
+    FixedPcdGet32 (PcdOvmfSecPeiTempRamSize),
+    OverlapBase
+    );
+
+  for (Hob.Raw = GetHobList (); !END_OF_HOB_LIST (Hob); Hob.Raw = GET_NEXT_HOB (Hob)) {
+    if (GET_HOB_TYPE (Hob) == EFI_HOB_TYPE_MEMORY_ALLOCATION) {
+      NoteDmaPoolOverlap (
+        Base,
+        Size,
+        Hob.MemoryAllocation->AllocDescriptor.MemoryBaseAddress,
+        Hob.MemoryAllocation->AllocDescriptor.MemoryLength,
+        OverlapBase
+        );
+    } else if (GET_HOB_TYPE (Hob) == EFI_HOB_TYPE_FV) {
+      NoteDmaPoolOverlap (Base, Size, Hob.FirmwareVolume->BaseAddress, Hob.FirmwareVolume->Length, OverlapBase);
+    }
+  }
+
+  return (BOOLEAN)(*OverlapBase != MAX_UINT64);
+}
+
+/**
+  Reserve the DMA pool of the RISC-V IOMMU, as high below 4 GiB as it fits,
+  before DXE fragments low memory, and describe it in a GUID HOB.
+
+  @param[in]  PeiMemoryBase  The base of the PEI memory.
+
+**/
+STATIC
+VOID
+ReserveIoMmuDmaPool (
+  IN EFI_PHYSICAL_ADDRESS  PeiMemoryBase
+  )
+{
+  EFI_PEI_HOB_POINTERS  Hob;
+  RISCV_IOMMU_DMA_POOL  Pool;
+  UINT64                Size;
+  EFI_PHYSICAL_ADDRESS  PoolBase;
+  EFI_PHYSICAL_ADDRESS  Start;
+  EFI_PHYSICAL_ADDRESS  End;
+  EFI_PHYSICAL_ADDRESS  Candidate;
+  EFI_PHYSICAL_ADDRESS  OverlapBase;
+
+  Size = ALIGN_VALUE ((UINT64)PcdGet32 (PcdRiscVIoMmuDmaPoolSize), RISCV_IOMMU_DMA_POOL_ALIGNMENT);
+  if (Size == 0) {
+    return;
+  }
+
+  PoolBase = 0;
+  for (Hob.Raw = GetHobList (); !END_OF_HOB_LIST (Hob); Hob.Raw = GET_NEXT_HOB (Hob)) {
+    if (  (GET_HOB_TYPE (Hob) != EFI_HOB_TYPE_RESOURCE_DESCRIPTOR)
+       || (Hob.ResourceDescriptor->ResourceType != EFI_RESOURCE_SYSTEM_MEMORY))
+    {
+      continue;
+    }
+
+    //
+    // Walk down from the top of the range below 4 GiB, past each range in use.
+    //
+    Start = Hob.ResourceDescriptor->PhysicalStart;
+    End   = MIN (Start + Hob.ResourceDescriptor->ResourceLength, SIZE_4GB);
+    while ((End > Start) && (End - Start >= Size)) {
+      Candidate = (End - Size) & ~((UINT64)RISCV_IOMMU_DMA_POOL_ALIGNMENT - 1);
+      if (Candidate < Start) {
+        break;
+      }
+
+      if (!FindDmaPoolOverlap (Candidate, Size, PeiMemoryBase, &OverlapBase)) {
+        PoolBase = MAX (PoolBase, Candidate);
+        break;
+      }
+
+      End = OverlapBase;
+    }
+  }
+
+  if (PoolBase == 0) {
+    DEBUG ((DEBUG_WARN, "%a: no room for a 0x%lx-byte IOMMU DMA pool below 4 GiB\n", __func__, Size));
+    return;
+  }
+
+  BuildMemoryAllocationHob (PoolBase, Size, EfiBootServicesData);
+
+  Pool.Signature = RISCV_IOMMU_DMA_POOL_SIGNATURE;
+  Pool.Revision  = RISCV_IOMMU_DMA_POOL_REVISION;
+  Pool.Base      = PoolBase;
+  Pool.Size      = Size;
+  Pool.Used      = 0;
+  BuildGuidDataHob (&gRiscVIoMmuDmaPoolHobGuid, &Pool, sizeof (Pool));
+
+  DEBUG ((DEBUG_INFO, "%a: IOMMU DMA pool at 0x%lx, 0x%lx bytes\n", __func__, PoolBase, Size));
 }
 
 /**
@@ -234,6 +436,7 @@ InitializePlatformPeim (
 {
   EFI_STATUS              Status;
   VOID                    *Hob;
+  EFI_PHYSICAL_ADDRESS    PeiMemoryBase;
   RISCV_SEC_HANDOFF_DATA  *SecData;
   EFI_GUID                SecHobDataGuid = RISCV_SEC_HANDOFF_HOB_GUID;
 
@@ -257,7 +460,12 @@ InitializePlatformPeim (
   //
   // Install PEI memory
   //
-  FindInstallPeiMemory ();
+  PeiMemoryBase = FindInstallPeiMemory ();
+
+  //
+  // Reserve low memory for the IOMMU's DMA before DXE fragments it
+  //
+  ReserveIoMmuDmaPool (PeiMemoryBase);
 
   //
   // Reinstall HOB after memory initialization
@@ -271,5 +479,8 @@ InitializePlatformPeim (
   Status = PeiServicesInstallPpi (&mPpiListBootMode);
   ASSERT_EFI_ERROR (Status);
 
+  Status = PeiServicesNotifyPpi (&mMemoryDiscoveredNotify);
+  ASSERT_EFI_ERROR (Status);
+
   return Status;
 }
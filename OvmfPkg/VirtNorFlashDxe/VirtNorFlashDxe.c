@@ -16,7 +16,9 @@
 
 #include "VirtNorFlashDxe.h"
 
-STATIC EFI_EVENT  mNorFlashVirtualAddrChangeEvent;
+STATIC EFI_EVENT              mNorFlashVirtualAddrChangeEvent;
+STATIC EFI_EVENT              mNorFlashBeforeExitBootServicesEvent;
+STATIC EFI_CPU_ARCH_PROTOCOL  *mCpu;
 
 //
 // Global variable declarations
@@ -137,6 +139,170 @@ NorFlashCreateInstance (
   return Status;
 }
 
+/**
+  Return the size of the window that maps a NOR flash instance, from the base
+  of the device, where commands are written, to the end of the region.
+
+  @param[in]  Instance  The NOR flash instance.
+
+  @return The size of the window.
+**/
+STATIC
+UINTN
+NorFlashWindowSize (
+  IN NOR_FLASH_INSTANCE  *Instance
+  )
+{
+  return (Instance->RegionBaseAddress - Instance->DeviceBaseAddress) + Instance->Size;
+}
+
+/**
+  Map the window of a NOR flash instance cacheable and read-only, so that the
+  array is read at cache speed.
+
+  The device must be in read array mode, which is how every program and erase
+  sequence leaves it. The blocks that were changed since the window was last
+  cacheable must have been invalidated.
+
+  @param[in]  Instance  The NOR flash instance.
+**/
+STATIC
+VOID
+NorFlashCacheArray (
+  IN NOR_FLASH_INSTANCE  *Instance
+  )
+{
+  EFI_STATUS  Status;
+
+  if (!Instance->CachedReads || Instance->ArrayCached) {
+    return;
+  }
+
+  Status = mCpu->SetMemoryAttributes (
+                   mCpu,
+                   Instance->DeviceBaseAddress,
+                   NorFlashWindowSize (Instance),
+                   EFI_MEMORY_WB | EFI_MEMORY_RO
+                   );
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_WARN, "%a: 0x%lx - %r\n", __func__, (UINT64)Instance->DeviceBaseAddress, Status));
+    return;
+  }
+
+  Instance->ArrayCached = TRUE;
+}
+
+/**
+  Map the window of a NOR flash instance uncached and writable, as the GCD
+  describes it, so that commands can be written to the device.
+
+  @param[in]  Instance  The NOR flash instance.
+
+  @retval EFI_SUCCESS  The window is uncached.
+  @retval Others       The window could not be remapped.
+**/
+STATIC
+EFI_STATUS
+NorFlashUncacheArray (
+  IN NOR_FLASH_INSTANCE  *Instance
+  )
+{
+  EFI_STATUS  Status;
+
+  if (!Instance->ArrayCached) {
+    return EFI_SUCCESS;
+  }
+
+  Status = mCpu->SetMemoryAttributes (
+                   mCpu,
+                   Instance->DeviceBaseAddress,
+                   NorFlashWindowSize (Instance),
+                   EFI_MEMORY_UC
+                   );
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "%a: 0x%lx - %r\n", __func__, (UINT64)Instance->DeviceBaseAddress, Status));
+    return Status;
+  }
+
+  Instance->ArrayCached = FALSE;
+  return EFI_SUCCESS;
+}
+
+/**
+  Open a program or erase window on a NOR flash instance. Windows nest.
+
+  This must not be called above TPL_NOTIFY, as remapping may allocate page
+  tables.
+
+  @param[in]  Instance  The NOR flash instance.
+
+  @retval EFI_SUCCESS       Commands can be written to the device.
+  @retval EFI_DEVICE_ERROR  The window could not be remapped.
+**/
+EFI_STATUS
+NorFlashBeginWrite (
+  IN NOR_FLASH_INSTANCE  *Instance
+  )
+{
+  if (Instance->WriteDepth == 0) {
+    if (EFI_ERROR (NorFlashUncacheArray (Instance))) {
+      return EFI_DEVICE_ERROR;
+    }
+  }
+
+  Instance->WriteDepth++;
+  return EFI_SUCCESS;
+}
+
+/**
+  Close a program or erase window on a NOR flash instance.
+
+  @param[in]  Instance  The NOR flash instance.
+**/
+VOID
+NorFlashEndWrite (
+  IN NOR_FLASH_INSTANCE  *Instance
+  )
+{
+  ASSERT (Instance->WriteDepth > 0);
+  Instance->WriteDepth--;
+  if (Instance->WriteDepth == 0) {
+    NorFlashCacheArray (Instance);
+  }
+}
+
+/**
+  Map every NOR flash instance uncached for good before the OS takes over. The
+  memory map describes the windows as uncached, and the runtime services write
+  to them.
+
+  @param[in]    Event   The Event that is being processed
+  @param[in]    Context Event Context
+**/
+STATIC
+VOID
+EFIAPI
+NorFlashBeforeExitBootServices (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < mNorFlashDeviceCount; Index++) {
+    if (mNorFlashInstances[Index] == NULL) {
+      continue;
+    }
+
+    //
+    // The window was split into pages when it was first remapped, so this
+    // does not allocate, and does not change the memory map.
+    //
+    NorFlashUncacheArray (mNorFlashInstances[Index]);
+    mNorFlashInstances[Index]->CachedReads = FALSE;
+  }
+}
+
 /**
   @param[in]    Event   The Event that is being processed
   @param[in]    Context Event Context
@@ -193,7 +359,7 @@ NorFlashInitialise (
     return Status;
   }
 
-  mNorFlashInstances = AllocateRuntimePool (sizeof (NOR_FLASH_INSTANCE *) * mNorFlashDeviceCount);
+  mNorFlashInstances = AllocateRuntimeZeroPool (sizeof (NOR_FLASH_INSTANCE *) * mNorFlashDeviceCount);
 
   for (Index = 0; Index < mNorFlashDeviceCount; Index++) {
     // Check if this NOR Flash device contain the variable storage region
@@ -237,6 +403,18 @@ NorFlashInitialise (
                   );
   ASSERT_EFI_ERROR (Status);
 
+  if (FeaturePcdGet (PcdVirtNorFlashCachedReads)) {
+    Status = gBS->CreateEventEx (
+                    EVT_NOTIFY_SIGNAL,
+                    TPL_CALLBACK,
+                    NorFlashBeforeExitBootServices,
+                    NULL,
+                    &gEfiEventBeforeExitBootServicesGuid,
+                    &mNorFlashBeforeExitBootServicesEvent
+                    );
+    ASSERT_EFI_ERROR (Status);
+  }
+
   return Status;
 }
 
@@ -343,5 +521,21 @@ NorFlashFvbInitialize (
                   );
   ASSERT_EFI_ERROR (Status);
 
-  return Status;
+  //
+  // From now on, the array is only mapped uncached while it is programmed or
+  // erased, and reads of the varstore run at cache speed.
+  //
+  if (FeaturePcdGet (PcdVirtNorFlashCachedReads)) {
+    if (mCpu == NULL) {
+      Status = gBS->LocateProtocol (&gEfiCpuArchProtocolGuid, NULL, (VOID **)&mCpu);
+      ASSERT_EFI_ERROR (Status);
+    }
+
+    if (mCpu != NULL) {
+      Instance->CachedReads = TRUE;
+      NorFlashCacheArray (Instance);
+    }
+  }
+
+  return EFI_SUCCESS;
 }
@@ -15,8 +15,10 @@
 
 #include <Guid/EventGroup.h>
 
+#include <Protocol/Cpu.h>
 #include <Protocol/FirmwareVolumeBlock.h>
 
+#include <Library/CacheMaintenanceLib.h>
 #include <Library/DebugLib.h>
 #include <Library/IoLib.h>
 #include <Library/UefiLib.h>
@@ -53,6 +55,14 @@ struct _NOR_FLASH_INSTANCE {
   VOID                                   *ShadowBuffer;
 
   NOR_FLASH_DEVICE_PATH                  DevicePath;
+
+  //
+  // Outside program and erase windows, the array may be mapped cacheable and
+  // read-only, and is then read with plain loads.
+  //
+  BOOLEAN                                CachedReads;
+  BOOLEAN                                ArrayCached;
+  UINTN                                  WriteDepth;
 };
 
 //
@@ -153,4 +163,14 @@ NorFlashFvbInitialize (
   IN NOR_FLASH_INSTANCE  *Instance
   );
 
+EFI_STATUS
+NorFlashBeginWrite (
+  IN NOR_FLASH_INSTANCE  *Instance
+  );
+
+VOID
+NorFlashEndWrite (
+  IN NOR_FLASH_INSTANCE  *Instance
+  );
+
 #endif /* __VIRT_NOT_FLASH_DXE__ */
@@ -651,6 +651,16 @@ FvbRead (
     return EFI_BAD_BUFFER_SIZE;
   }
 
+  // A cached array is in read array mode, and must not be written to.
+  if (Instance->ArrayCached) {
+    CopyMem (
+      Buffer,
+      (VOID *)(GET_NOR_BLOCK_ADDRESS (Instance->RegionBaseAddress, Instance->StartLba + Lba, BlockSize) + Offset),
+      *NumBytes
+      );
+    return EFI_SUCCESS;
+  }
+
   // Decide if we are doing full block reads or not.
   if (*NumBytes % BlockSize != 0) {
     TempStatus = NorFlashRead (
@@ -756,6 +766,11 @@ FvbWrite (
 
   Instance = INSTANCE_FROM_FVB_THIS (This);
 
+  Status = NorFlashBeginWrite (Instance);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
   if (!EfiAtRuntime ()) {
     // Raise TPL to TPL_HIGH to stop anyone from interrupting us.
     OriginalTPL = gBS->RaiseTPL (TPL_HIGH_LEVEL);
@@ -783,6 +798,14 @@ FvbWrite (
     gBS->RestoreTPL (OriginalTPL);
   }
 
+  if (Instance->CachedReads) {
+    InvalidateDataCacheRange (
+      (VOID *)GET_NOR_BLOCK_ADDRESS (Instance->RegionBaseAddress, Instance->StartLba + Lba, Instance->BlockSize),
+      Instance->BlockSize
+      );
+  }
+
+  NorFlashEndWrite (Instance);
   return Status;
 }
 
@@ -887,6 +910,11 @@ FvbEraseBlocks (
   //
   // To get here, all must be ok, so start erasing
   //
+  Status = NorFlashBeginWrite (Instance);
+  if (EFI_ERROR (Status)) {
+    goto EXIT;
+  }
+
   VA_START (Args, This);
   do {
     // Get the Lba from which we start erasing
@@ -910,6 +938,14 @@ FvbEraseBlocks (
                        Instance->BlockSize
                        );
 
+      // Variable reclaim and the FTW spare erase blocks that are often still erased,
+      // and reading a block is much cheaper than erasing it.
+      if (NorFlashBlockIsErased (Instance->DeviceBaseAddress, BlockAddress, Instance->BlockSize)) {
+        StartingLba++;
+        NumOfLba--;
+        continue;
+      }
+
       // Erase it
       DEBUG ((DEBUG_BLKIO, "FvbEraseBlocks: Erasing Lba=%ld @ 0x%08x.\n", Instance->StartLba + StartingLba, BlockAddress));
       if (!EfiAtRuntime ()) {
@@ -927,8 +963,13 @@ FvbEraseBlocks (
         gBS->RestoreTPL (OriginalTPL);
       }
 
+      if (Instance->CachedReads) {
+        InvalidateDataCacheRange ((VOID *)BlockAddress, Instance->BlockSize);
+      }
+
       if (EFI_ERROR (Status)) {
         VA_END (Args);
+        NorFlashEndWrite (Instance);
         Status = EFI_DEVICE_ERROR;
         goto EXIT;
       }
@@ -940,6 +981,7 @@ FvbEraseBlocks (
   } while (TRUE);
 
   VA_END (Args);
+  NorFlashEndWrite (Instance);
 
 EXIT:
   return Status;
@@ -6,9 +6,9 @@
 
   - No attach/detach (ie. removable media).
 
-  - Although the non-blocking interfaces of EFI_BLOCK_IO2_PROTOCOL could be a
-    good match for multiple in-flight virtio-blk requests, we stick to
-    synchronous requests and EFI_BLOCK_IO_PROTOCOL for now.
+  - EFI_BLOCK_IO2_PROTOCOL requests with a token are kept in flight on the
+    ring, up to VBLK_MAX_REQUESTS, and completed by a timer polling the used
+    ring. EFI_BLOCK_IO_PROTOCOL requests are polled to completion.
 
   Copyright (C) 2012, Red Hat, Inc.
   Copyright (c) 2012 - 2018, Intel Corporation. All rights reserved.<BR>
@@ -177,92 +177,167 @@ VerifyReadWriteRequest (
 
 /**
 
-  Format a read / write / flush request as three consecutive virtio
-  descriptors, push them to the host, and poll for the response.
+  Complete the requests that the host has processed.
 
-  This is the main workhorse function. Two use cases are supported, read/write
-  and flush. The function may only be called after the request parameters have
-  been verified by
-  - specific checks in ReadBlocks() / WriteBlocks() / FlushBlocks(), and
-  - VerifyReadWriteRequest() (for read/write only).
+  A request with a token is released, and its token signaled. A request
+  without a token is marked done, for WaitRequest() to release, unless its
+  submission failed, in which case nobody waits for it.
 
-  Parameters handled commonly:
+  The caller must hold TPL_NOTIFY.
 
-    @param[in] Dev             The virtio-blk device the request is targeted
-                               at.
+  @param[in] Dev  The virtio-blk device.
 
-  Flush request:
+**/
+STATIC
+VOID
+ReapRequests (
+  IN VBLK_DEV  *Dev
+  )
+{
+  VBLK_REQUEST  *Request;
+  UINT16        HeadDescIdx;
+  UINT16        Index;
+  EFI_STATUS    Status;
+  EFI_STATUS    UnmapStatus;
+
+  while (VirtioReapUsed (&Dev->Ring, &HeadDescIdx, NULL)) {
+    Index = (UINT16)(HeadDescIdx / Dev->DescPerRequest);
+    ASSERT (HeadDescIdx % Dev->DescPerRequest == 0);
+    ASSERT (Index < Dev->NumRequests);
+
+    Request = &Dev->Requests[Index];
+    ASSERT (Request->InUse && !Request->Done);
+
+    Status = (Dev->Shared->HostStatus[Index] == VIRTIO_BLK_S_OK) ?
+             EFI_SUCCESS : EFI_DEVICE_ERROR;
+
+    if (Request->BufferSize > 0) {
+      UnmapStatus = Dev->VirtIo->UnmapSharedBuffer (
+                                   Dev->VirtIo,
+                                   Request->BufferMapping
+                                   );
+      if (EFI_ERROR (UnmapStatus) && !Request->RequestIsWrite) {
+        //
+        // Data from the bus master may not reach the caller; fail the request.
+        //
+        Status = EFI_DEVICE_ERROR;
+      }
+    }
 
-    @param[in] Lba             Must be zero.
+    Dev->InFlight--;
+
+    if (Request->Token != NULL) {
+      Request->Token->TransactionStatus = Status;
+      Request->InUse                    = FALSE;
+      gBS->SignalEvent (Request->Token->Event);
+    } else if (Request->Orphaned) {
+      Request->InUse = FALSE;
+    } else {
+      Request->Status = Status;
+      Request->Done   = TRUE;
+    }
+  }
+}
 
-    @param[in] BufferSize      Must be zero.
+/**
 
-    @param[in out] Buffer      Ignored by the function.
+  Check for a free request slot, reaping completed requests if all are in use.
 
-    @param[in] RequestIsWrite  Must be TRUE.
+  The caller must hold TPL_NOTIFY.
 
-  Read/Write request:
+  @param[in] Context  The virtio-blk device.
 
-    @param[in] Lba             Logical Block Address: number of logical blocks
-                               to skip from the beginning of the device.
+  @retval TRUE   A request slot is free.
+  @retval FALSE  All requests are in flight.
 
-    @param[in] BufferSize      Size of buffer to transfer, in bytes. The caller
-                               is responsible to ensure this parameter is
-                               positive.
+**/
+STATIC
+BOOLEAN
+EFIAPI
+IsRequestSlotFree (
+  IN VOID  *Context
+  )
+{
+  VBLK_DEV  *Dev;
+  UINT16    Index;
 
-    @param[in out] Buffer      The guest side area to read data from the device
-                               into, or write data to the device from.
+  Dev = Context;
+  ReapRequests (Dev);
+  for (Index = 0; Index < Dev->NumRequests; Index++) {
+    if (!Dev->Requests[Index].InUse) {
+      return TRUE;
+    }
+  }
 
-    @param[in] RequestIsWrite  TRUE iff data transfer goes from guest to
-                               device.
+  return FALSE;
+}
 
-  Return values are common to both use cases, and are appropriate to be
-  forwarded by the EFI_BLOCK_IO_PROTOCOL functions (ReadBlocks(),
-  WriteBlocks(), FlushBlocks()).
+/**
 
+  Format a read / write / flush request as consecutive virtio descriptors in
+  the descriptor slot of a free request, and push them to the host, without
+  waiting for the response.
 
-  @retval EFI_SUCCESS          Transfer complete.
+  The function may only be called after the request parameters have been
+  verified by
+  - specific checks in ReadBlocks() / WriteBlocks() / FlushBlocks() and their
+    EFI_BLOCK_IO2_PROTOCOL counterparts, and
+  - VerifyReadWriteRequest() (for read/write only).
 
-  @retval EFI_DEVICE_ERROR     Failed to notify host side via VirtIo write, or
-                               unable to parse host response, or host response
-                               is not VIRTIO_BLK_S_OK or failed to map Buffer
-                               for a bus master operation.
+  The caller must hold TPL_NOTIFY. If all requests are in flight, the function
+  polls for the completion of one of them.
+
+  @param[in] Dev             The virtio-blk device the request is targeted at.
+
+  @param[in] Lba             Logical Block Address: number of logical blocks to
+                             skip from the beginning of the device. Zero for
+                             flush.
+
+  @param[in] BufferSize      Size of buffer to transfer, in bytes. Zero for
+                             flush.
+
+  @param[in out] Buffer      The guest side area to read data from the device
+                             into, or write data to the device from. Ignored
+                             for flush.
+
+  @param[in] RequestIsWrite  TRUE iff data transfer goes from guest to device.
+                             Must be TRUE for flush.
+
+  @param[in] Token           The token to signal on completion, or NULL if the
+                             caller waits for the request with WaitRequest().
+
+  @param[out] Slot           The request slot the request was submitted in,
+                             on success.
+
+  @retval EFI_SUCCESS       The request was submitted.
+
+  @retval EFI_DEVICE_ERROR  Failed to map Buffer for a bus master operation, or
+                            to notify the host.
 
 **/
 STATIC
 EFI_STATUS
-EFIAPI
-SynchronousRequest (
-  IN              VBLK_DEV  *Dev,
-  IN              EFI_LBA   Lba,
-  IN              UINTN     BufferSize,
-  IN OUT volatile VOID      *Buffer,
-  IN              BOOLEAN   RequestIsWrite
+SubmitRequest (
+  IN              VBLK_DEV             *Dev,
+  IN              EFI_LBA              Lba,
+  IN              UINTN                BufferSize,
+  IN OUT volatile VOID                 *Buffer,
+  IN              BOOLEAN              RequestIsWrite,
+  IN              EFI_BLOCK_IO2_TOKEN  *Token,
+  OUT             UINT16               *Slot
   )
 {
-  UINT32                   BlockSize;
-  volatile VIRTIO_BLK_REQ  *Request;
-  volatile UINT8           *HostStatus;
-  VOID                     *HostStatusBuffer;
+  UINT32                      BlockSize;
+  VBLK_REQUEST             *Request;
+  volatile VIRTIO_BLK_REQ  *Header;
   DESC_INDICES             Indices;
-  VOID                     *RequestMapping;
-  VOID                     *StatusMapping;
-  VOID                     *BufferMapping;
   EFI_PHYSICAL_ADDRESS     BufferDeviceAddress;
-  EFI_PHYSICAL_ADDRESS     HostStatusDeviceAddress;
-  EFI_PHYSICAL_ADDRESS     RequestDeviceAddress;
+  VOID                     *BufferMapping;
+  UINT16                   Index;
   EFI_STATUS               Status;
-  EFI_STATUS               UnmapStatus;
 
   BlockSize = Dev->BlockIoMedia.BlockSize;
 
-  //
-  // Set BufferMapping and BufferDeviceAddress to suppress incorrect
-  // compiler/analyzer warnings.
-  //
-  BufferMapping       = NULL;
-  BufferDeviceAddress = 0;
-
   //
   // ensured by VirtioBlkInit()
   //
@@ -274,58 +349,31 @@ SynchronousRequest (
   //
   ASSERT (BufferSize % BlockSize == 0);
 
-  Request = AllocateZeroPool (sizeof (*Request));
-  if (Request == NULL) {
-    return EFI_DEVICE_ERROR;
-  }
-
-  //
-  // Prepare virtio-blk request header, setting zero size for flush.
-  // IO Priority is homogeneously 0.
   //
-  Request->Type = RequestIsWrite ?
-                  (BufferSize == 0 ? VIRTIO_BLK_T_FLUSH : VIRTIO_BLK_T_OUT) :
-                  VIRTIO_BLK_T_IN;
-  Request->IoPrio = 0;
-  Request->Sector = MultU64x32 (Lba, BlockSize / 512);
-
+  // From virtio-0.9.5, 2.3.2 Descriptor Table:
+  // "no descriptor chain may be more than 2^32 bytes long in total".
   //
-  // Host status is bi-directional (we preset with a value and expect the
-  // device to update it). Allocate a host status buffer which can be mapped
-  // to access equally by both processor and the device.
+  // The predicate is ensured by the call contract above (for flush), or
+  // VerifyReadWriteRequest() (for read/write). It also implies that
+  // converting BufferSize to UINT32 will not truncate it.
   //
-  Status = Dev->VirtIo->AllocateSharedPages (
-                          Dev->VirtIo,
-                          EFI_SIZE_TO_PAGES (sizeof *HostStatus),
-                          &HostStatusBuffer
-                          );
-  if (EFI_ERROR (Status)) {
-    Status = EFI_DEVICE_ERROR;
-    goto FreeBlkRequest;
-  }
-
-  HostStatus = HostStatusBuffer;
+  ASSERT (BufferSize <= SIZE_1GB);
 
   //
-  // Map virtio-blk request header (must be done after request header is
-  // populated)
+  // Find a free request slot, reaping completed requests until there is one.
   //
-  Status = VirtioMapAllBytesInSharedBuffer (
-             Dev->VirtIo,
-             VirtioOperationBusMasterRead,
-             (VOID *)Request,
-             sizeof (*Request),
-             &RequestDeviceAddress,
-             &RequestMapping
-             );
-  if (EFI_ERROR (Status)) {
-    Status = EFI_DEVICE_ERROR;
-    goto FreeHostStatusBuffer;
+  VirtioPoll (IsRequestSlotFree, Dev);
+  for (Index = 0; Dev->Requests[Index].InUse; Index++) {
   }
 
+  Request = &Dev->Requests[Index];
+  Header  = &Dev->Shared->Request[Index];
+
   //
   // Map data buffer
   //
+  BufferMapping       = NULL;
+  BufferDeviceAddress = 0;
   if (BufferSize > 0) {
     Status = VirtioMapAllBytesInSharedBuffer (
                Dev->VirtIo,
@@ -338,48 +386,46 @@ SynchronousRequest (
                &BufferMapping
                );
     if (EFI_ERROR (Status)) {
-      Status = EFI_DEVICE_ERROR;
-      goto UnmapRequestBuffer;
+      return EFI_DEVICE_ERROR;
     }
   }
 
   //
-  // preset a host status for ourselves that we do not accept as success
-  //
-  *HostStatus = VIRTIO_BLK_S_IOERR;
-
-  //
-  // Map the Status Buffer with VirtioOperationBusMasterCommonBuffer so that
-  // both processor and device can access it.
+  // Prepare virtio-blk request header, setting zero size for flush.
+  // IO Priority is homogeneously 0. Preset a host status for ourselves that we
+  // do not accept as success.
   //
-  Status = VirtioMapAllBytesInSharedBuffer (
-             Dev->VirtIo,
-             VirtioOperationBusMasterCommonBuffer,
-             HostStatusBuffer,
-             sizeof *HostStatus,
-             &HostStatusDeviceAddress,
-             &StatusMapping
-             );
-  if (EFI_ERROR (Status)) {
-    Status = EFI_DEVICE_ERROR;
-    goto UnmapDataBuffer;
-  }
+  Header->Type = RequestIsWrite ?
+                 (BufferSize == 0 ? VIRTIO_BLK_T_FLUSH : VIRTIO_BLK_T_OUT) :
+                 VIRTIO_BLK_T_IN;
+  Header->IoPrio                 = 0;
+  Header->Sector                 = MultU64x32 (Lba, BlockSize / 512);
+  Dev->Shared->HostStatus[Index] = VIRTIO_BLK_S_IOERR;
 
-  VirtioPrepare (&Dev->Ring, &Indices);
+  Request->InUse          = TRUE;
+  Request->Done           = FALSE;
+  Request->RequestIsWrite = RequestIsWrite;
+  Request->BufferSize     = BufferSize;
+  Request->BufferMapping  = BufferMapping;
+  Request->Token          = Token;
+  Request->Orphaned       = FALSE;
 
   //
-  // ensured by VirtioBlkInit() -- this predicate, in combination with the
-  // lock-step progress, ensures we don't have to track free descriptors.
+  // Each request slot owns Dev->DescPerRequest descriptors, so the chains of
+  // the requests in flight never overlap. An indirect table is filled from its
+  // start.
   //
-  ASSERT (Dev->Ring.QueueSize >= 3);
+  Indices.HeadDescIdx = (UINT16)(Index * Dev->DescPerRequest);
+  Indices.NextDescIdx = (Dev->Ring.IndirectBase != NULL) ? 0 : Indices.HeadDescIdx;
 
   //
   // virtio-blk header in first desc
   //
   VirtioAppendDesc (
     &Dev->Ring,
-    RequestDeviceAddress,
-    sizeof (*Request),
+    Dev->SharedAddress + OFFSET_OF (VBLK_SHARED, Request) +
+    Index * sizeof (VIRTIO_BLK_REQ),
+    sizeof (VIRTIO_BLK_REQ),
     VRING_DESC_F_NEXT,
     &Indices
     );
@@ -388,16 +434,6 @@ SynchronousRequest (
   // data buffer for read/write in second desc
   //
   if (BufferSize > 0) {
-    //
-    // From virtio-0.9.5, 2.3.2 Descriptor Table:
-    // "no descriptor chain may be more than 2^32 bytes long in total".
-    //
-    // The predicate is ensured by the call contract above (for flush), or
-    // VerifyReadWriteRequest() (for read/write). It also implies that
-    // converting BufferSize to UINT32 will not truncate it.
-    //
-    ASSERT (BufferSize <= SIZE_1GB);
-
     //
     // VRING_DESC_F_WRITE is interpreted from the host's point of view.
     //
@@ -415,55 +451,273 @@ SynchronousRequest (
   //
   VirtioAppendDesc (
     &Dev->Ring,
-    HostStatusDeviceAddress,
-    sizeof *HostStatus,
+    Dev->SharedAddress + OFFSET_OF (VBLK_SHARED, HostStatus) + Index,
+    sizeof (UINT8),
     VRING_DESC_F_WRITE,
     &Indices
     );
 
-  //
-  // virtio-blk's only virtqueue is #0, called "requestq" (see Appendix D).
-  //
-  if ((VirtioFlush (
-         Dev->VirtIo,
-         0,
-         &Dev->Ring,
-         &Indices,
-         NULL
-         ) == EFI_SUCCESS) &&
-      (*HostStatus == VIRTIO_BLK_S_OK))
-  {
-    Status = EFI_SUCCESS;
-  } else {
-    Status = EFI_DEVICE_ERROR;
+  if (Dev->Ring.IndirectBase != NULL) {
+    VirtioAppendIndirectTable (&Dev->Ring, &Indices);
   }
 
-  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, StatusMapping);
+  Dev->InFlight++;
+  Status = VirtioSubmit (Dev->VirtIo, 0, &Dev->Ring, &Indices.HeadDescIdx, 1);
+  if (EFI_ERROR (Status)) {
+    //
+    // The request stays on the ring, and the host may still process it, so
+    // leave its slot and mapping to ReapRequests().
+    //
+    Request->Token    = NULL;
+    Request->Orphaned = TRUE;
+    return EFI_DEVICE_ERROR;
+  }
 
-UnmapDataBuffer:
-  if (BufferSize > 0) {
-    UnmapStatus = Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, BufferMapping);
-    if (EFI_ERROR (UnmapStatus) && !RequestIsWrite && !EFI_ERROR (Status)) {
-      //
-      // Data from the bus master may not reach the caller; fail the request.
-      //
-      Status = EFI_DEVICE_ERROR;
-    }
+  *Slot = Index;
+  return EFI_SUCCESS;
+}
+
+//
+// The request that WaitRequest() waits for.
+//
+typedef struct {
+  VBLK_DEV      *Dev;
+  UINT16        Slot;
+  EFI_STATUS    Status;
+} VBLK_WAIT;
+
+/**
+
+  Reap completed requests, and release the request that WaitRequest() waits
+  for if it is done.
+
+  @param[in,out] Context  The VBLK_WAIT of the request.
+
+  @retval TRUE   The request has been released, and its status recorded.
+  @retval FALSE  The request is still in flight.
+
+**/
+STATIC
+BOOLEAN
+EFIAPI
+IsRequestDone (
+  IN VOID  *Context
+  )
+{
+  VBLK_WAIT     *Wait;
+  VBLK_REQUEST  *Request;
+  EFI_TPL       OldTpl;
+  BOOLEAN       Done;
+
+  Wait    = Context;
+  Request = &Wait->Dev->Requests[Wait->Slot];
+
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  ReapRequests (Wait->Dev);
+  Done = Request->Done;
+  if (Done) {
+    Wait->Status   = Request->Status;
+    Request->InUse = FALSE;
   }
 
-UnmapRequestBuffer:
-  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, RequestMapping);
+  gBS->RestoreTPL (OldTpl);
+  return Done;
+}
+
+/**
 
-FreeHostStatusBuffer:
-  Dev->VirtIo->FreeSharedPages (
-                 Dev->VirtIo,
-                 EFI_SIZE_TO_PAGES (sizeof *HostStatus),
-                 HostStatusBuffer
-                 );
+  Wait for a request submitted without a token, and release it.
+
+  @param[in] Dev   The virtio-blk device.
+
+  @param[in] Slot  The request slot returned by SubmitRequest().
+
+  @return  The completion status of the request.
+
+**/
+STATIC
+EFI_STATUS
+WaitRequest (
+  IN VBLK_DEV  *Dev,
+  IN UINT16    Slot
+  )
+{
+  VBLK_WAIT  Wait;
+
+  Wait.Dev  = Dev;
+  Wait.Slot = Slot;
+  VirtioPoll (IsRequestDone, &Wait);
+  return Wait.Status;
+}
+
+/**
+
+  Reap completed requests, and check whether any request is still in flight.
+
+  @param[in] Context  The virtio-blk device.
+
+  @retval TRUE   No request is in flight.
+  @retval FALSE  Otherwise.
+
+**/
+STATIC
+BOOLEAN
+EFIAPI
+IsIdle (
+  IN VOID  *Context
+  )
+{
+  VBLK_DEV  *Dev;
+  EFI_TPL   OldTpl;
+  UINT16    InFlight;
+
+  Dev    = Context;
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  ReapRequests (Dev);
+  InFlight = Dev->InFlight;
+  gBS->RestoreTPL (OldTpl);
+
+  return (BOOLEAN)(InFlight == 0);
+}
+
+/**
+
+  Wait until no request is in flight.
+
+  @param[in] Dev  The virtio-blk device.
+
+**/
+STATIC
+VOID
+DrainRequests (
+  IN VBLK_DEV  *Dev
+  )
+{
+  VirtioPoll (IsIdle, Dev);
+}
+
+/**
+
+  Timer notification function that completes the requests submitted with a
+  token, while any are in flight.
+
+  @param[in] Event    The poll timer.
+
+  @param[in] Context  Pointer to the VBLK_DEV structure.
+
+**/
+STATIC
+VOID
+EFIAPI
+VirtioBlkPoll (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  VBLK_DEV  *Dev;
+
+  Dev = Context;
+  ReapRequests (Dev);
+  if (Dev->InFlight == 0) {
+    gBS->SetTimer (Dev->PollTimer, TimerCancel, 0);
+  }
+}
+
+/**
+
+  Submit a read / write / flush request and poll for the response.
+
+  The function may only be called after the request parameters have been
+  verified by
+  - specific checks in ReadBlocks() / WriteBlocks() / FlushBlocks(), and
+  - VerifyReadWriteRequest() (for read/write only).
+
+  See SubmitRequest() for the parameters.
+
+  Return values are common to both use cases, and are appropriate to be
+  forwarded by the EFI_BLOCK_IO_PROTOCOL functions (ReadBlocks(),
+  WriteBlocks(), FlushBlocks()).
+
+
+  @retval EFI_SUCCESS          Transfer complete.
+
+  @retval EFI_DEVICE_ERROR     Failed to notify host side via VirtIo write, or
+                               unable to parse host response, or host response
+                               is not VIRTIO_BLK_S_OK or failed to map Buffer
+                               for a bus master operation.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+SynchronousRequest (
+  IN              VBLK_DEV  *Dev,
+  IN              EFI_LBA   Lba,
+  IN              UINTN     BufferSize,
+  IN OUT volatile VOID      *Buffer,
+  IN              BOOLEAN   RequestIsWrite
+  )
+{
+  EFI_TPL     OldTpl;
+  UINT16      Slot;
+  EFI_STATUS  Status;
+
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  Status = SubmitRequest (Dev, Lba, BufferSize, Buffer, RequestIsWrite, NULL, &Slot);
+  gBS->RestoreTPL (OldTpl);
+
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  return WaitRequest (Dev, Slot);
+}
+
+/**
+
+  Submit a read / write / flush request with a token, that is signaled on
+  completion.
+
+  See SubmitRequest() for the parameters.
+
+  @retval EFI_SUCCESS       The request was submitted.
 
-FreeBlkRequest:
-  FreePool ((VOID *)Request);
+  @retval EFI_DEVICE_ERROR  The request could not be submitted.
 
+**/
+STATIC
+EFI_STATUS
+AsynchronousRequest (
+  IN              VBLK_DEV             *Dev,
+  IN              EFI_LBA              Lba,
+  IN              UINTN                BufferSize,
+  IN OUT volatile VOID                 *Buffer,
+  IN              BOOLEAN              RequestIsWrite,
+  IN              EFI_BLOCK_IO2_TOKEN  *Token
+  )
+{
+  EFI_TPL     OldTpl;
+  UINT16      Slot;
+  EFI_STATUS  Status;
+
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+
+  //
+  // Complete what we can now, so that the timer only has to pick up the
+  // stragglers.
+  //
+  ReapRequests (Dev);
+
+  Status = SubmitRequest (Dev, Lba, BufferSize, Buffer, RequestIsWrite, Token, &Slot);
+  if (!EFI_ERROR (Status)) {
+    gBS->SetTimer (
+           Dev->PollTimer,
+           TimerPeriodic,
+           EFI_TIMER_PERIOD_MILLISECONDS (VBLK_POLL_PERIOD_MS)
+           );
+  }
+
+  gBS->RestoreTPL (OldTpl);
   return Status;
 }
 
@@ -611,6 +865,187 @@ VirtioBlkFlushBlocks (
          EFI_SUCCESS;
 }
 
+/**
+
+  Submit a read / write request of EFI_BLOCK_IO2_PROTOCOL.
+
+  If Token is NULL, or Token->Event is NULL, the request is blocking, as with
+  EFI_BLOCK_IO_PROTOCOL. Otherwise it is submitted to the host, and
+  Token->Event is signaled on completion.
+
+  A zero BufferSize doesn't seem to be prohibited, so complete the request
+  successfully in that case.
+
+**/
+STATIC
+EFI_STATUS
+BlockIo2Request (
+  IN     VBLK_DEV             *Dev,
+  IN     EFI_LBA              Lba,
+  IN OUT EFI_BLOCK_IO2_TOKEN  *Token,
+  IN     UINTN                BufferSize,
+  IN OUT VOID                 *Buffer,
+  IN     BOOLEAN              RequestIsWrite
+  )
+{
+  EFI_STATUS  Status;
+
+  if (BufferSize == 0) {
+    if ((Token != NULL) && (Token->Event != NULL)) {
+      Token->TransactionStatus = EFI_SUCCESS;
+      gBS->SignalEvent (Token->Event);
+    }
+
+    return EFI_SUCCESS;
+  }
+
+  Status = VerifyReadWriteRequest (
+             &Dev->BlockIoMedia,
+             Lba,
+             BufferSize,
+             RequestIsWrite
+             );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  if ((Token == NULL) || (Token->Event == NULL)) {
+    return SynchronousRequest (Dev, Lba, BufferSize, Buffer, RequestIsWrite);
+  }
+
+  return AsynchronousRequest (Dev, Lba, BufferSize, Buffer, RequestIsWrite, Token);
+}
+
+//
+// UEFI Spec 2.3.1 + Errata C, 12.9 EFI Block I/O 2 Protocol
+// Driver Writer's Guide for UEFI 2.3.1 v1.01,
+//   24.2 Block I/O Protocol Implementations
+//
+// The requests in flight are not aborted by Reset(), but waited for.
+//
+EFI_STATUS
+EFIAPI
+VirtioBlkResetEx (
+  IN EFI_BLOCK_IO2_PROTOCOL  *This,
+  IN BOOLEAN                 ExtendedVerification
+  )
+{
+  DrainRequests (VIRTIO_BLK_FROM_BLOCK_IO2 (This));
+  return EFI_SUCCESS;
+}
+
+/**
+
+  ReadBlocksEx() operation for virtio-blk.
+
+  See
+  - UEFI Spec 2.3.1 + Errata C, 12.9 EFI Block I/O 2 Protocol,
+    EFI_BLOCK_IO2_PROTOCOL.ReadBlocksEx().
+  - Driver Writer's Guide for UEFI 2.3.1 v1.01, 24.2.2. ReadBlocks() and
+    ReadBlocksEx() Implementation.
+
+  Parameter checks and conformant return values are implemented in
+  BlockIo2Request().
+
+**/
+EFI_STATUS
+EFIAPI
+VirtioBlkReadBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL  *This,
+  IN     UINT32                  MediaId,
+  IN     EFI_LBA                 Lba,
+  IN OUT EFI_BLOCK_IO2_TOKEN     *Token,
+  IN     UINTN                   BufferSize,
+  OUT    VOID                    *Buffer
+  )
+{
+  return BlockIo2Request (
+           VIRTIO_BLK_FROM_BLOCK_IO2 (This),
+           Lba,
+           Token,
+           BufferSize,
+           Buffer,
+           FALSE       // RequestIsWrite
+           );
+}
+
+/**
+
+  WriteBlocksEx() operation for virtio-blk.
+
+  See
+  - UEFI Spec 2.3.1 + Errata C, 12.9 EFI Block I/O 2 Protocol,
+    EFI_BLOCK_IO2_PROTOCOL.WriteBlocksEx().
+  - Driver Writer's Guide for UEFI 2.3.1 v1.01, 24.2.3 WriteBlocks() and
+    WriteBlockEx() Implementation.
+
+  Parameter checks and conformant return values are implemented in
+  BlockIo2Request().
+
+**/
+EFI_STATUS
+EFIAPI
+VirtioBlkWriteBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL  *This,
+  IN     UINT32                  MediaId,
+  IN     EFI_LBA                 Lba,
+  IN OUT EFI_BLOCK_IO2_TOKEN     *Token,
+  IN     UINTN                   BufferSize,
+  IN     VOID                    *Buffer
+  )
+{
+  return BlockIo2Request (
+           VIRTIO_BLK_FROM_BLOCK_IO2 (This),
+           Lba,
+           Token,
+           BufferSize,
+           Buffer,
+           TRUE        // RequestIsWrite
+           );
+}
+
+/**
+
+  FlushBlocksEx() operation for virtio-blk.
+
+  See
+  - UEFI Spec 2.3.1 + Errata C, 12.9 EFI Block I/O 2 Protocol,
+    EFI_BLOCK_IO2_PROTOCOL.FlushBlocksEx().
+  - Driver Writer's Guide for UEFI 2.3.1 v1.01, 24.2.4 FlushBlocks() and
+    FlushBlocksEx() Implementation.
+
+  A virtio-blk flush only covers the writes that the host has completed, so
+  the requests in flight are waited for before the flush is submitted.
+
+**/
+EFI_STATUS
+EFIAPI
+VirtioBlkFlushBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL  *This,
+  IN OUT EFI_BLOCK_IO2_TOKEN     *Token
+  )
+{
+  VBLK_DEV  *Dev;
+
+  Dev = VIRTIO_BLK_FROM_BLOCK_IO2 (This);
+  if (!Dev->BlockIoMedia.WriteCaching) {
+    if ((Token != NULL) && (Token->Event != NULL)) {
+      Token->TransactionStatus = EFI_SUCCESS;
+      gBS->SignalEvent (Token->Event);
+    }
+
+    return EFI_SUCCESS;
+  }
+
+  DrainRequests (Dev);
+
+  if ((Token == NULL) || (Token->Event == NULL)) {
+    return SynchronousRequest (Dev, 0, 0, NULL, TRUE);
+  }
+
+  return AsynchronousRequest (Dev, 0, 0, NULL, TRUE, Token);
+}
+
 /**
 
   Device probe function for this driver.
@@ -731,6 +1166,7 @@ VirtioBlkInit (
   UINT32  OptIoSize;
   UINT16  QueueSize;
   UINT64  RingBaseShift;
+  VOID    *SharedBuffer;
 
   PhysicalBlockExp = 0;
   AlignmentOffset  = 0;
@@ -831,7 +1267,8 @@ VirtioBlkInit (
 
   Features &= VIRTIO_BLK_F_BLK_SIZE | VIRTIO_BLK_F_TOPOLOGY | VIRTIO_BLK_F_RO |
               VIRTIO_BLK_F_FLUSH | VIRTIO_F_VERSION_1 |
-              VIRTIO_F_IOMMU_PLATFORM;
+              VIRTIO_F_IOMMU_PLATFORM | VIRTIO_F_RING_EVENT_IDX |
+              VIRTIO_F_RING_INDIRECT_DESC;
 
   //
   // In virtio-1.0, feature negotiation is expected to complete before queue
@@ -857,20 +1294,43 @@ VirtioBlkInit (
     goto Failed;
   }
 
-  if (QueueSize < 3) {
-    // SynchronousRequest() uses at most three descriptors
+  //
+  // SubmitRequest() uses at most three descriptors per request, or one that
+  // refers to an indirect table of three.
+  //
+  Dev->DescPerRequest = ((Features & VIRTIO_F_RING_INDIRECT_DESC) != 0) ?
+                        1 : VBLK_DESC_PER_REQUEST;
+  if (QueueSize < Dev->DescPerRequest) {
     Status = EFI_UNSUPPORTED;
     goto Failed;
   }
 
+  Dev->NumRequests = (UINT16)MIN (VBLK_MAX_REQUESTS, QueueSize / Dev->DescPerRequest);
+  Dev->InFlight    = 0;
+  ZeroMem (Dev->Requests, sizeof Dev->Requests);
+
   Status = VirtioRingInit (Dev->VirtIo, QueueSize, &Dev->Ring);
   if (EFI_ERROR (Status)) {
     goto Failed;
   }
 
+  Dev->Ring.EventIdx = (BOOLEAN)((Features & VIRTIO_F_RING_EVENT_IDX) != 0);
+
   //
   // If anything fails from here on, we must release the ring resources
   //
+  if ((Features & VIRTIO_F_RING_INDIRECT_DESC) != 0) {
+    Status = VirtioRingIndirectInit (
+               Dev->VirtIo,
+               Dev->NumRequests,
+               VBLK_DESC_PER_REQUEST,
+               &Dev->Ring
+               );
+    if (EFI_ERROR (Status)) {
+      goto ReleaseQueue;
+    }
+  }
+
   Status = VirtioRingMap (
              Dev->VirtIo,
              &Dev->Ring,
@@ -881,18 +1341,46 @@ VirtioBlkInit (
     goto ReleaseQueue;
   }
 
+  //
+  // Allocate and map the request headers and the host statuses once, as a
+  // common buffer, so that each request only has to map its data buffer.
+  //
+  Status = Dev->VirtIo->AllocateSharedPages (
+                          Dev->VirtIo,
+                          EFI_SIZE_TO_PAGES (sizeof *Dev->Shared),
+                          &SharedBuffer
+                          );
+  if (EFI_ERROR (Status)) {
+    goto UnmapQueue;
+  }
+
+  Status = VirtioMapAllBytesInSharedBuffer (
+             Dev->VirtIo,
+             VirtioOperationBusMasterCommonBuffer,
+             SharedBuffer,
+             sizeof *Dev->Shared,
+             &Dev->SharedAddress,
+             &Dev->SharedMap
+             );
+  if (EFI_ERROR (Status)) {
+    goto FreeSharedBuffer;
+  }
+
+  Dev->Shared = SharedBuffer;
+
   //
   // Additional steps for MMIO: align the queue appropriately, and set the
-  // size. If anything fails from here on, we must unmap the ring resources.
+  // size. If anything fails from here on, we must unmap the shared buffer and
+  // the ring resources.
   //
   Status = Dev->VirtIo->SetQueueNum (Dev->VirtIo, QueueSize);
   if (EFI_ERROR (Status)) {
-    goto UnmapQueue;
+    goto UnmapSharedBuffer;
   }
 
   Status = Dev->VirtIo->SetQueueAlign (Dev->VirtIo, EFI_PAGE_SIZE);
   if (EFI_ERROR (Status)) {
-    goto UnmapQueue;
+    goto UnmapSharedBuffer;
   }
 
   //
@@ -904,7 +1392,7 @@ VirtioBlkInit (
                           RingBaseShift
                           );
   if (EFI_ERROR (Status)) {
-    goto UnmapQueue;
+    goto UnmapSharedBuffer;
   }
 
   //
@@ -914,7 +1402,7 @@ VirtioBlkInit (
     Features &= ~(UINT64)(VIRTIO_F_VERSION_1 | VIRTIO_F_IOMMU_PLATFORM);
     Status    = Dev->VirtIo->SetGuestFeatures (Dev->VirtIo, Features);
     if (EFI_ERROR (Status)) {
-      goto UnmapQueue;
+      goto UnmapSharedBuffer;
     }
   }
 
@@ -924,7 +1412,7 @@ VirtioBlkInit (
   NextDevStat |= VSTAT_DRIVER_OK;
   Status       = Dev->VirtIo->SetDeviceStatus (Dev->VirtIo, NextDevStat);
   if (EFI_ERROR (Status)) {
-    goto UnmapQueue;
+    goto UnmapSharedBuffer;
   }
 
   //
@@ -937,6 +1425,11 @@ VirtioBlkInit (
   Dev->BlockIo.ReadBlocks            = &VirtioBlkReadBlocks;
   Dev->BlockIo.WriteBlocks           = &VirtioBlkWriteBlocks;
   Dev->BlockIo.FlushBlocks           = &VirtioBlkFlushBlocks;
+  Dev->BlockIo2.Media                = &Dev->BlockIoMedia;
+  Dev->BlockIo2.Reset                = &VirtioBlkResetEx;
+  Dev->BlockIo2.ReadBlocksEx         = &VirtioBlkReadBlocksEx;
+  Dev->BlockIo2.WriteBlocksEx        = &VirtioBlkWriteBlocksEx;
+  Dev->BlockIo2.FlushBlocksEx        = &VirtioBlkFlushBlocksEx;
   Dev->BlockIoMedia.MediaId          = 0;
   Dev->BlockIoMedia.RemovableMedia   = FALSE;
   Dev->BlockIoMedia.MediaPresent     = TRUE;
@@ -982,6 +1475,17 @@ VirtioBlkInit (
 
   return EFI_SUCCESS;
 
+UnmapSharedBuffer:
+  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->SharedMap);
+  Dev->Shared = NULL;
+
+FreeSharedBuffer:
+  Dev->VirtIo->FreeSharedPages (
+                 Dev->VirtIo,
+                 EFI_SIZE_TO_PAGES (sizeof *Dev->Shared),
+                 SharedBuffer
+                 );
+
 UnmapQueue:
   Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->RingMap);
 
@@ -1021,10 +1525,19 @@ VirtioBlkUninit (
   //
   Dev->VirtIo->SetDeviceStatus (Dev->VirtIo, 0);
 
+  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->SharedMap);
+  Dev->VirtIo->FreeSharedPages (
+                 Dev->VirtIo,
+                 EFI_SIZE_TO_PAGES (sizeof *Dev->Shared),
+                 (VOID *)Dev->Shared
+                 );
+  Dev->Shared = NULL;
+
   Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->RingMap);
   VirtioRingUninit (Dev->VirtIo, &Dev->Ring);
 
   SetMem (&Dev->BlockIo, sizeof Dev->BlockIo, 0x00);
+  SetMem (&Dev->BlockIo2, sizeof Dev->BlockIo2, 0x00);
   SetMem (&Dev->BlockIoMedia, sizeof Dev->BlockIoMedia, 0x00);
 }
 
@@ -1134,22 +1647,39 @@ VirtioBlkDriverBindingStart (
     goto UninitDev;
   }
 
+  Status = gBS->CreateEvent (
+                  EVT_TIMER | EVT_NOTIFY_SIGNAL,
+                  TPL_NOTIFY,
+                  &VirtioBlkPoll,
+                  Dev,
+                  &Dev->PollTimer
+                  );
+  if (EFI_ERROR (Status)) {
+    goto CloseExitBoot;
+  }
+
   //
-  // Setup complete, attempt to export the driver instance's BlockIo interface.
+  // Setup complete, attempt to export the driver instance's BlockIo and
+  // BlockIo2 interfaces.
   //
   Dev->Signature = VBLK_SIG;
-  Status         = gBS->InstallProtocolInterface (
+  Status         = gBS->InstallMultipleProtocolInterfaces (
                           &DeviceHandle,
                           &gEfiBlockIoProtocolGuid,
-                          EFI_NATIVE_INTERFACE,
-                          &Dev->BlockIo
+                          &Dev->BlockIo,
+                          &gEfiBlockIo2ProtocolGuid,
+                          &Dev->BlockIo2,
+                          NULL
                           );
   if (EFI_ERROR (Status)) {
-    goto CloseExitBoot;
+    goto ClosePollTimer;
   }
 
   return EFI_SUCCESS;
 
+ClosePollTimer:
+  gBS->CloseEvent (Dev->PollTimer);
+
 CloseExitBoot:
   gBS->CloseEvent (Dev->ExitBoot);
 
@@ -1222,15 +1752,20 @@ VirtioBlkDriverBindingStop (
   //
   // Handle Stop() requests for in-use driver instances gracefully.
   //
-  Status = gBS->UninstallProtocolInterface (
+  Status = gBS->UninstallMultipleProtocolInterfaces (
                   DeviceHandle,
                   &gEfiBlockIoProtocolGuid,
-                  &Dev->BlockIo
+                  &Dev->BlockIo,
+                  &gEfiBlockIo2ProtocolGuid,
+                  &Dev->BlockIo2,
+                  NULL
                   );
   if (EFI_ERROR (Status)) {
     return Status;
   }
 
+  DrainRequests (Dev);
+  gBS->CloseEvent (Dev->PollTimer);
   gBS->CloseEvent (Dev->ExitBoot);
 
   VirtioBlkUninit (Dev);
@@ -13,13 +13,54 @@
 #define _VIRTIO_BLK_DXE_H_
 
 #include <Protocol/BlockIo.h>
+#include <Protocol/BlockIo2.h>
 #include <Protocol/ComponentName.h>
 #include <Protocol/DriverBinding.h>
 
-#include <IndustryStandard/Virtio.h>
+#include <IndustryStandard/VirtioBlk.h>
 
 #define VBLK_SIG  SIGNATURE_32 ('V', 'B', 'L', 'K')
 
+//
+// At most this many requests are in flight on the ring. Each request owns
+// VBLK_DESC_PER_REQUEST descriptors: header, data and status. With indirect
+// descriptors, these are in a table of the request, and the request owns a
+// single descriptor of the ring.
+//
+#define VBLK_MAX_REQUESTS      16
+#define VBLK_DESC_PER_REQUEST  3
+
+//
+// The period of the timer completing requests submitted with a token.
+//
+#define VBLK_POLL_PERIOD_MS  1
+
+//
+// The parts of the requests that the device reads and writes besides the
+// data, kept in a common buffer that is mapped for the lifetime of the device.
+// Indexed by request slot.
+//
+typedef struct {
+  VIRTIO_BLK_REQ    Request[VBLK_MAX_REQUESTS];
+  UINT8             HostStatus[VBLK_MAX_REQUESTS];
+} VBLK_SHARED;
+
+//
+// The driver side of a request slot.
+//
+typedef struct {
+  BOOLEAN                InUse;
+  // The host has completed a request without a token; for WaitRequest().
+  BOOLEAN                Done;
+  // Nobody waits for the request, as its submission failed.
+  BOOLEAN                Orphaned;
+  BOOLEAN                RequestIsWrite;
+  UINTN                  BufferSize;
+  VOID                   *BufferMapping;
+  EFI_BLOCK_IO2_TOKEN    *Token;
+  EFI_STATUS             Status;
+} VBLK_REQUEST;
+
 typedef struct {
   //
   // Parts of this structure are initialized / torn down in various functions
@@ -35,11 +76,23 @@ typedef struct {
   EFI_BLOCK_IO_PROTOCOL     BlockIo;           // VirtioBlkInit       1
   EFI_BLOCK_IO_MEDIA        BlockIoMedia;      // VirtioBlkInit       1
   VOID                      *RingMap;          // VirtioRingMap       2
+  volatile VBLK_SHARED      *Shared;           // VirtioBlkInit       1
+  EFI_PHYSICAL_ADDRESS      SharedAddress;     // VirtioBlkInit       1
+  VOID                      *SharedMap;        // VirtioBlkInit       1
+  EFI_BLOCK_IO2_PROTOCOL    BlockIo2;          // VirtioBlkInit       1
+  EFI_EVENT                 PollTimer;         // DriverBindingStart  0
+  UINT16                    NumRequests;       // VirtioBlkInit       1
+  UINT16                    DescPerRequest;    // VirtioBlkInit       1
+  UINT16                    InFlight;          // VirtioBlkInit       1
+  VBLK_REQUEST              Requests[VBLK_MAX_REQUESTS]; // VirtioBlkInit 1
 } VBLK_DEV;
 
 #define VIRTIO_BLK_FROM_BLOCK_IO(BlockIoPointer) \
         CR (BlockIoPointer, VBLK_DEV, BlockIo, VBLK_SIG)
 
+#define VIRTIO_BLK_FROM_BLOCK_IO2(BlockIo2Pointer) \
+        CR (BlockIo2Pointer, VBLK_DEV, BlockIo2, VBLK_SIG)
+
 /**
 
   Device probe function for this driver.
@@ -244,6 +297,94 @@ VirtioBlkFlushBlocks (
   IN EFI_BLOCK_IO_PROTOCOL  *This
   );
 
+//
+// UEFI Spec 2.3.1 + Errata C, 12.9 EFI Block I/O 2 Protocol
+// Driver Writer's Guide for UEFI 2.3.1 v1.01,
+//   24.2 Block I/O Protocol Implementations
+//
+// The requests in flight are not aborted by Reset(), but waited for.
+//
+EFI_STATUS
+EFIAPI
+VirtioBlkResetEx (
+  IN EFI_BLOCK_IO2_PROTOCOL  *This,
+  IN BOOLEAN                 ExtendedVerification
+  );
+
+/**
+
+  ReadBlocksEx() operation for virtio-blk.
+
+  See
+  - UEFI Spec 2.3.1 + Errata C, 12.9 EFI Block I/O 2 Protocol,
+    EFI_BLOCK_IO2_PROTOCOL.ReadBlocksEx().
+  - Driver Writer's Guide for UEFI 2.3.1 v1.01, 24.2.2. ReadBlocks() and
+    ReadBlocksEx() Implementation.
+
+  Parameter checks and conformant return values are implemented in
+  BlockIo2Request().
+
+**/
+
+EFI_STATUS
+EFIAPI
+VirtioBlkReadBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL  *This,
+  IN     UINT32                  MediaId,
+  IN     EFI_LBA                 Lba,
+  IN OUT EFI_BLOCK_IO2_TOKEN     *Token,
+  IN     UINTN                   BufferSize,
+  OUT    VOID                    *Buffer
+  );
+
+/**
+
+  WriteBlocksEx() operation for virtio-blk.
+
+  See
+  - UEFI Spec 2.3.1 + Errata C, 12.9 EFI Block I/O 2 Protocol,
+    EFI_BLOCK_IO2_PROTOCOL.WriteBlocksEx().
+  - Driver Writer's Guide for UEFI 2.3.1 v1.01, 24.2.3 WriteBlocks() and
+    WriteBlockEx() Implementation.
+
+  Parameter checks and conformant return values are implemented in
+  BlockIo2Request().
+
+**/
+
+EFI_STATUS
+EFIAPI
+VirtioBlkWriteBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL  *This,
+  IN     UINT32                  MediaId,
+  IN     EFI_LBA                 Lba,
+  IN OUT EFI_BLOCK_IO2_TOKEN     *Token,
+  IN     UINTN                   BufferSize,
+  IN     VOID                    *Buffer
+  );
+
+/**
+
+  FlushBlocksEx() operation for virtio-blk.
+
+  See
+  - UEFI Spec 2.3.1 + Errata C, 12.9 EFI Block I/O 2 Protocol,
+    EFI_BLOCK_IO2_PROTOCOL.FlushBlocksEx().
+  - Driver Writer's Guide for UEFI 2.3.1 v1.01, 24.2.4 FlushBlocks() and
+    FlushBlocksEx() Implementation.
+
+  A virtio-blk flush only covers the writes that the host has completed, so
+  the requests in flight are waited for before the flush is submitted.
+
+**/
+
+EFI_STATUS
+EFIAPI
+VirtioBlkFlushBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL  *This,
+  IN OUT EFI_BLOCK_IO2_TOKEN     *Token
+  );
+
 //
 // The purpose of the following scaffolding (EFI_COMPONENT_NAME_PROTOCOL and
 // EFI_COMPONENT_NAME2_PROTOCOL implementation) is to format the driver's name
@@ -103,6 +103,8 @@ VirtioFsBindingStart (
     goto UninitVirtioFs;
   }
 
+  VirtioFsPoolInit (VirtioFs);
+
   Status = gBS->CreateEvent (
                   EVT_SIGNAL_EXIT_BOOT_SERVICES,
                   TPL_CALLBACK,
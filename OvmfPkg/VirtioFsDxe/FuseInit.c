@@ -24,7 +24,8 @@
                            request to. The FUSE request counter
                            "VirtioFs->RequestId" is set to 1 on output. The
                            maximum write buffer size exposed in the FUSE_INIT
-                           response is saved in "VirtioFs->MaxWrite", on
+                           response is saved in "VirtioFs->MaxWrite", and
+                           the maximum read size in "VirtioFs->MaxRead", on
                            output.
 
   @retval EFI_SUCCESS      The FUSE session has been started.
@@ -55,6 +56,7 @@ VirtioFsFuseInitSession (
   VIRTIO_FS_IO_VECTOR            RespIoVec[2];
   VIRTIO_FS_SCATTER_GATHER_LIST  RespSgList;
   EFI_STATUS                     Status;
+  UINT32                         MaxPages;
 
   //
   // Initialize the FUSE request counter.
@@ -106,7 +108,8 @@ VirtioFsFuseInitSession (
   InitReq.Major        = VIRTIO_FS_FUSE_MAJOR;
   InitReq.Minor        = VIRTIO_FS_FUSE_MINOR;
   InitReq.MaxReadahead = 0;
-  InitReq.Flags        = VIRTIO_FS_FUSE_INIT_REQ_F_DO_READDIRPLUS;
+  InitReq.Flags        = VIRTIO_FS_FUSE_INIT_REQ_F_DO_READDIRPLUS |
+                         VIRTIO_FS_FUSE_INIT_REQ_F_MAX_PAGES;
 
   //
   // Submit the request.
@@ -150,5 +153,21 @@ VirtioFsFuseInitSession (
   // Save the maximum write buffer size for FUSE_WRITE requests.
   //
   VirtioFs->MaxWrite = InitResp.MaxWrite;
+
+  //
+  // Save the maximum read size for FUSE_READ requests, which the device
+  // raises from the FUSE default with MaxPages.
+  //
+  MaxPages = VIRTIO_FS_FUSE_DEFAULT_MAX_PAGES;
+  if (((InitResp.Flags & VIRTIO_FS_FUSE_INIT_REQ_F_MAX_PAGES) != 0) &&
+      (InitResp.MaxPages > MaxPages))
+  {
+    MaxPages = InitResp.MaxPages;
+  }
+
+  VirtioFs->MaxRead = (UINT32)MIN (
+                                EFI_PAGES_TO_SIZE (MaxPages),
+                                VIRTIO_FS_MAX_READ_SIZE
+                                );
   return EFI_SUCCESS;
 }
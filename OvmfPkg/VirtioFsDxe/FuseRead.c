@@ -6,8 +6,21 @@
   SPDX-License-Identifier: BSD-2-Clause-Patent
 **/
 
+#include <Library/BaseMemoryLib.h> // CopyMem()
+#include <Library/VirtioLib.h>     // VirtioSubmit()
+
 #include "VirtioFsDxe.h"
 
+//
+// The state of a FUSE_READ request in a slot of the request pool.
+//
+typedef struct {
+  UINT64    Unique;
+  UINT32    Size;
+  BOOLEAN   Done;
+  UINT32    UsedLen;
+} VIRTIO_FS_READ_SLOT;
+
 /**
   Read a chunk from a regular file or a directory stream, by sending the
   FUSE_READ / FUSE_READDIRPLUS request to the Virtio Filesystem device.
@@ -203,3 +216,374 @@ VirtioFsFuseReadFileOrDir (
   *Size = (UINT32)TailBufferFill;
   return EFI_SUCCESS;
 }
+
+/**
+  Send a FUSE_READ request for a chunk of a regular file from a slot of the
+  request pool, without waiting for the response.
+
+  Each slot owns two descriptors of the split virtqueue, so the chains of the
+  requests in flight never overlap.
+
+  @param[in,out] VirtioFs  The Virtio Filesystem device.
+
+  @param[in] SlotIdx       The free slot to send the request from.
+
+  @param[in] NodeId        The inode number of the regular file.
+
+  @param[in] FuseHandle    The open handle to the regular file.
+
+  @param[in] Offset        The absolute file position at which to read.
+
+  @param[in,out] Slot      The state of the slot. Size is the number of bytes
+                           to read on input, at most VirtioFs->MaxRead.
+
+  @retval EFI_SUCCESS  The request is in flight.
+
+  @return              Error codes propagated from VirtioFsFuseNewRequest(),
+                       or VirtioFs->Virtio->SetQueueNotify().
+**/
+STATIC
+EFI_STATUS
+VirtioFsFuseSubmitRead (
+  IN OUT VIRTIO_FS            *VirtioFs,
+  IN     UINT16               SlotIdx,
+  IN     UINT64               NodeId,
+  IN     UINT64               FuseHandle,
+  IN     UINT64               Offset,
+  IN OUT VIRTIO_FS_READ_SLOT  *Slot
+  )
+{
+  VIRTIO_FS_FUSE_REQUEST       *CommonReq;
+  VIRTIO_FS_FUSE_READ_REQUEST  *ReadReq;
+  EFI_PHYSICAL_ADDRESS         SlotAddr;
+  DESC_INDICES                 Indices;
+  EFI_STATUS                   Status;
+
+  CommonReq = (VIRTIO_FS_FUSE_REQUEST *)((UINT8 *)VirtioFs->Pool +
+                                         SlotIdx * VirtioFs->SlotSize);
+  ReadReq  = (VIRTIO_FS_FUSE_READ_REQUEST *)(CommonReq + 1);
+  SlotAddr = VirtioFs->PoolAddr + SlotIdx * VirtioFs->SlotSize;
+
+  Status = VirtioFsFuseNewRequest (
+             VirtioFs,
+             CommonReq,
+             sizeof *CommonReq + sizeof *ReadReq,
+             VirtioFsFuseOpRead,
+             NodeId
+             );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  ReadReq->FileHandle = FuseHandle;
+  ReadReq->Offset     = Offset;
+  ReadReq->Size       = Slot->Size;
+  ReadReq->ReadFlags  = 0;
+  ReadReq->LockOwner  = 0;
+  ReadReq->Flags      = 0;
+  ReadReq->Padding    = 0;
+
+  Slot->Unique  = CommonReq->Unique;
+  Slot->Done    = FALSE;
+  Slot->UsedLen = 0;
+
+  //
+  // The request in the first descriptor, the response header and data in the
+  // second.
+  //
+  Indices.HeadDescIdx = (UINT16)(SlotIdx * 2);
+  Indices.NextDescIdx = Indices.HeadDescIdx;
+  VirtioAppendDesc (
+    &VirtioFs->Ring,
+    SlotAddr,
+    sizeof *CommonReq + sizeof *ReadReq,
+    VRING_DESC_F_NEXT,
+    &Indices
+    );
+  VirtioAppendDesc (
+    &VirtioFs->Ring,
+    SlotAddr + VIRTIO_FS_POOL_REQUEST_SIZE,
+    sizeof (VIRTIO_FS_FUSE_RESPONSE) + Slot->Size,
+    VRING_DESC_F_WRITE,
+    &Indices
+    );
+
+  return VirtioSubmit (
+           VirtioFs->Virtio,
+           VIRTIO_FS_REQUEST_QUEUE,
+           &VirtioFs->Ring,
+           &Indices.HeadDescIdx,
+           1
+           );
+}
+
+//
+// The FUSE_READ request that VirtioFsFuseReadFile() waits for.
+//
+typedef struct {
+  VIRTIO_FS              *VirtioFs;
+  VIRTIO_FS_READ_SLOT    *Slots;
+  UINT16                 SlotIdx;
+} VIRTIO_FS_READ_WAIT;
+
+/**
+  Mark the FUSE_READ requests that the device has responded to as done, and
+  check whether the request waited for is among them.
+
+  @param[in] Context  The VIRTIO_FS_READ_WAIT of the request.
+
+  @retval TRUE   The request is done.
+  @retval FALSE  The request is still in flight.
+**/
+STATIC
+BOOLEAN
+EFIAPI
+VirtioFsFuseReapReads (
+  IN VOID  *Context
+  )
+{
+  VIRTIO_FS_READ_WAIT  *Wait;
+  UINT16               HeadDescIdx;
+  UINT32               UsedLen;
+  UINT16               SlotIdx;
+
+  Wait = Context;
+  while (VirtioReapUsed (&Wait->VirtioFs->Ring, &HeadDescIdx, &UsedLen)) {
+    SlotIdx = (UINT16)(HeadDescIdx / 2);
+    ASSERT (HeadDescIdx % 2 == 0);
+    ASSERT (SlotIdx < Wait->VirtioFs->NumSlots);
+
+    Wait->Slots[SlotIdx].UsedLen = UsedLen;
+    Wait->Slots[SlotIdx].Done    = TRUE;
+  }
+
+  return Wait->Slots[Wait->SlotIdx].Done;
+}
+
+/**
+  Verify the response to a FUSE_READ request in a slot of the request pool,
+  and copy the data out of the slot.
+
+  @param[in] VirtioFs  The Virtio Filesystem device.
+
+  @param[in] SlotIdx   The slot that holds the response.
+
+  @param[in] Slot      The state of the slot, which is done.
+
+  @param[out] Data     The buffer to copy the data into, with room for
+                       Slot->Size bytes.
+
+  @param[out] Length   The number of bytes read.
+
+  @retval EFI_SUCCESS       The data has been copied.
+
+  @retval EFI_DEVICE_ERROR  The device reported more bytes than the slot
+                            offered room for.
+
+  @return                   The "errno" value mapped to an EFI_STATUS code, if
+                            the Virtio Filesystem device explicitly reported an
+                            error.
+
+  @return                   Error codes propagated from
+                            VirtioFsFuseCheckResponse().
+**/
+STATIC
+EFI_STATUS
+VirtioFsFuseCompleteRead (
+  IN  VIRTIO_FS            *VirtioFs,
+  IN  UINT16               SlotIdx,
+  IN  VIRTIO_FS_READ_SLOT  *Slot,
+  OUT VOID                 *Data,
+  OUT UINT32               *Length
+  )
+{
+  VIRTIO_FS_FUSE_RESPONSE        *CommonResp;
+  VIRTIO_FS_IO_VECTOR            RespIoVec[2];
+  VIRTIO_FS_SCATTER_GATHER_LIST  RespSgList;
+  EFI_STATUS                     Status;
+  UINTN                          TailBufferFill;
+
+  if (Slot->UsedLen > sizeof *CommonResp + Slot->Size) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  CommonResp = (VIRTIO_FS_FUSE_RESPONSE *)((UINT8 *)VirtioFs->Pool +
+                                           SlotIdx * VirtioFs->SlotSize +
+                                           VIRTIO_FS_POOL_REQUEST_SIZE);
+
+  //
+  // Describe the response the way VirtioFsSgListsSubmit() would have.
+  //
+  RespIoVec[0].Buffer      = CommonResp;
+  RespIoVec[0].Size        = sizeof *CommonResp;
+  RespIoVec[0].Transferred = MIN (Slot->UsedLen, sizeof *CommonResp);
+  RespIoVec[1].Buffer      = CommonResp + 1;
+  RespIoVec[1].Size        = Slot->Size;
+  RespIoVec[1].Transferred = Slot->UsedLen - RespIoVec[0].Transferred;
+  RespSgList.IoVec         = RespIoVec;
+  RespSgList.NumVec        = ARRAY_SIZE (RespIoVec);
+  RespSgList.TotalSize     = (UINT32)(sizeof *CommonResp + Slot->Size);
+
+  Status = VirtioFsFuseCheckResponse (&RespSgList, Slot->Unique, &TailBufferFill);
+  if (EFI_ERROR (Status)) {
+    if (Status == EFI_DEVICE_ERROR) {
+      DEBUG ((
+        DEBUG_ERROR,
+        "%a: Label=\"%s\" Size=0x%x Errno=%d\n",
+        __func__,
+        VirtioFs->Label,
+        Slot->Size,
+        CommonResp->Error
+        ));
+      Status = VirtioFsErrnoToEfiStatus (CommonResp->Error);
+    }
+
+    return Status;
+  }
+
+  CopyMem (Data, CommonResp + 1, TailBufferFill);
+  *Length = (UINT32)TailBufferFill;
+  return EFI_SUCCESS;
+}
+
+/**
+  Read from a regular file, keeping a FUSE_READ request in flight in each slot
+  of the request pool.
+
+  The file is read in chunks of VirtioFs->MaxRead bytes, which are copied out
+  of the pool in file order. A chunk that is read short ends the read, because
+  the chunks after it would leave a hole in Data.
+
+  The function may only be called after VirtioFsPoolInit() sets up more than
+  one slot, and before VirtioFsUninit() is called.
+
+  @param[in,out] VirtioFs  The Virtio Filesystem device to send the FUSE_READ
+                           requests to. On output, the FUSE request counter
+                           "VirtioFs->RequestId" will have been incremented
+                           once per request.
+
+  @param[in] NodeId        The inode number of the regular file to read from.
+
+  @param[in] FuseHandle    The open handle to the regular file to read from.
+
+  @param[in] Offset        The absolute file position at which to start
+                           reading.
+
+  @param[in,out] Size      On input, the number of bytes to read. On output,
+                           the number of bytes actually read, which is zero at
+                           EOF, and may be smaller than the value on input
+                           otherwise.
+
+  @param[out] Data         Buffer to read the bytes from the regular file into,
+                           with room for (at least) as many bytes as Size is on
+                           input.
+
+  @retval EFI_SUCCESS  Some bytes have been read, or EOF was reached.
+
+  @return              The error of the first request, if no bytes have been
+                       read. Error codes are those of
+                       VirtioFsFuseReadFileOrDir().
+**/
+EFI_STATUS
+VirtioFsFuseReadFile (
+  IN OUT VIRTIO_FS  *VirtioFs,
+  IN     UINT64     NodeId,
+  IN     UINT64     FuseHandle,
+  IN     UINT64     Offset,
+  IN OUT UINTN      *Size,
+  OUT VOID          *Data
+  )
+{
+  VIRTIO_FS_READ_SLOT  Slots[VIRTIO_FS_MAX_READS];
+  VIRTIO_FS_READ_WAIT  Wait;
+  UINT16               SlotIdx;
+  UINTN                Submitted;
+  UINTN                Completed;
+  UINTN                Requested;
+  UINTN                Transferred;
+  UINT32               Length;
+  BOOLEAN              Stop;
+  EFI_STATUS           Status;
+
+  ASSERT (VirtioFs->NumSlots > 1 && VirtioFs->NumSlots <= VIRTIO_FS_MAX_READS);
+
+  Wait.VirtioFs = VirtioFs;
+  Wait.Slots    = Slots;
+
+  Status      = EFI_SUCCESS;
+  Submitted   = 0;
+  Completed   = 0;
+  Requested   = 0;
+  Transferred = 0;
+  Stop        = FALSE;
+  for ( ; ;) {
+    //
+    // Fill the free slots with requests for the next chunks.
+    //
+    while (!Stop && (Submitted - Completed < VirtioFs->NumSlots) &&
+           (Requested < *Size))
+    {
+      SlotIdx             = (UINT16)(Submitted % VirtioFs->NumSlots);
+      Slots[SlotIdx].Size = (UINT32)MIN (
+                                      (UINTN)VirtioFs->MaxRead,
+                                      *Size - Requested
+                                      );
+      Status = VirtioFsFuseSubmitRead (
+                 VirtioFs,
+                 SlotIdx,
+                 NodeId,
+                 FuseHandle,
+                 Offset + Requested,
+                 &Slots[SlotIdx]
+                 );
+      if (EFI_ERROR (Status)) {
+        Stop = TRUE;
+        break;
+      }
+
+      Requested += Slots[SlotIdx].Size;
+      Submitted++;
+    }
+
+    if (Completed == Submitted) {
+      break;
+    }
+
+    //
+    // Wait for the oldest request.
+    //
+    SlotIdx      = (UINT16)(Completed % VirtioFs->NumSlots);
+    Wait.SlotIdx = SlotIdx;
+    VirtioPoll (VirtioFsFuseReapReads, &Wait);
+
+    Completed++;
+
+    //
+    // After a short read or a failure, the remaining requests are only
+    // drained.
+    //
+    if (Stop) {
+      continue;
+    }
+
+    Status = VirtioFsFuseCompleteRead (
+               VirtioFs,
+               SlotIdx,
+               &Slots[SlotIdx],
+               (UINT8 *)Data + Transferred,
+               &Length
+               );
+    if (EFI_ERROR (Status)) {
+      Stop = TRUE;
+      continue;
+    }
+
+    Transferred += Length;
+    if (Length < Slots[SlotIdx].Size) {
+      Stop = TRUE;
+    }
+  }
+
+  *Size = Transferred;
+  return (Transferred > 0) ? EFI_SUCCESS : Status;
+}
@@ -88,6 +88,12 @@ VirtioFsInit (
   UINTN             Idx;
   UINT64            RingBaseShift;
 
+  //
+  // VirtioFsPoolInit() sets up the request pool later, if it can.
+  //
+  VirtioFs->Pool     = NULL;
+  VirtioFs->NumSlots = 0;
+
   //
   // Execute virtio-v1.1-cs01-87fa6b5d8155, 3.1.1 Driver Requirements: Device
   // Initialization.
@@ -290,10 +296,94 @@ VirtioFsUninit (
   // configuration.
   //
   VirtioFs->Virtio->SetDeviceStatus (VirtioFs->Virtio, 0);
+  if (VirtioFs->Pool != NULL) {
+    VirtioFs->Virtio->UnmapSharedBuffer (VirtioFs->Virtio, VirtioFs->PoolMap);
+    VirtioFs->Virtio->FreeSharedPages (
+                        VirtioFs->Virtio,
+                        EFI_SIZE_TO_PAGES (VirtioFs->NumSlots * VirtioFs->SlotSize),
+                        VirtioFs->Pool
+                        );
+    VirtioFs->Pool = NULL;
+  }
+
   VirtioFs->Virtio->UnmapSharedBuffer (VirtioFs->Virtio, VirtioFs->RingMap);
   VirtioRingUninit (VirtioFs->Virtio, &VirtioFs->Ring);
 }
 
+/**
+  Set up the request pool of the Virtio Filesystem device.
+
+  The pool is allocated and mapped once, and consists of VirtioFs->NumSlots
+  slots. The requests and responses that fit in a slot are copied through it,
+  so that they need not be mapped one by one. A read from a regular file keeps
+  a FUSE_READ request in flight in each slot.
+
+  The pool is optional: if it cannot be set up, VirtioFs->Pool is NULL on
+  output, and all buffers are mapped for each request.
+
+  The function may only be called after VirtioFsFuseInitSession() returns
+  successfully and before VirtioFsUninit() is called.
+
+  @param[in,out] VirtioFs  The Virtio Filesystem device to set up the request
+                           pool for. VirtioFs->MaxRead determines the size of
+                           each slot.
+**/
+VOID
+VirtioFsPoolInit (
+  IN OUT VIRTIO_FS  *VirtioFs
+  )
+{
+  UINT16      NumSlots;
+  UINTN       Pages;
+  EFI_STATUS  Status;
+
+  //
+  // Each slot owns two descriptors, for the request and the response of its
+  // FUSE_READ.
+  //
+  NumSlots = (UINT16)MIN (VIRTIO_FS_MAX_READS, VirtioFs->QueueSize / 2);
+
+  VirtioFs->SlotSize = VIRTIO_FS_POOL_REQUEST_SIZE + EFI_PAGE_SIZE +
+                       VirtioFs->MaxRead;
+  Pages = EFI_SIZE_TO_PAGES (NumSlots * VirtioFs->SlotSize);
+
+  Status = VirtioFs->Virtio->AllocateSharedPages (
+                               VirtioFs->Virtio,
+                               Pages,
+                               &VirtioFs->Pool
+                               );
+  if (EFI_ERROR (Status)) {
+    goto Failed;
+  }
+
+  Status = VirtioMapAllBytesInSharedBuffer (
+             VirtioFs->Virtio,
+             VirtioOperationBusMasterCommonBuffer,
+             VirtioFs->Pool,
+             EFI_PAGES_TO_SIZE (Pages),
+             &VirtioFs->PoolAddr,
+             &VirtioFs->PoolMap
+             );
+  if (EFI_ERROR (Status)) {
+    VirtioFs->Virtio->FreeSharedPages (VirtioFs->Virtio, Pages, VirtioFs->Pool);
+    goto Failed;
+  }
+
+  VirtioFs->NumSlots = NumSlots;
+  return;
+
+Failed:
+  DEBUG ((
+    DEBUG_WARN,
+    "%a: Label=\"%s\": %r, requests will be mapped one by one\n",
+    __func__,
+    VirtioFs->Label,
+    Status
+    ));
+  VirtioFs->Pool     = NULL;
+  VirtioFs->NumSlots = 0;
+}
+
 /**
   ExitBootServices event notification function for a Virtio Filesystem object.
 
@@ -485,6 +575,114 @@ VirtioFsSgListsValidate (
   return EFI_SUCCESS;
 }
 
+/**
+  Submit a validated pair of (request buffer list, response buffer list) to the
+  Virtio Filesystem device, through the first slot of the request pool.
+
+  The request buffers are copied into the slot, and the response is copied
+  from the slot into the response buffers, so no buffer is mapped. The caller
+  is responsible for ensuring that both lists fit in the slot.
+
+  The parameters, return values and outputs are those of
+  VirtioFsSgListsSubmit().
+**/
+STATIC
+EFI_STATUS
+VirtioFsSgListsSubmitPooled (
+  IN OUT VIRTIO_FS                      *VirtioFs,
+  IN OUT VIRTIO_FS_SCATTER_GATHER_LIST  *RequestSgList,
+  IN OUT VIRTIO_FS_SCATTER_GATHER_LIST  *ResponseSgList OPTIONAL
+  )
+{
+  UINT8                *Slot;
+  UINTN                Offset;
+  UINTN                IoVecIdx;
+  VIRTIO_FS_IO_VECTOR  *IoVec;
+  EFI_STATUS           Status;
+  DESC_INDICES         Indices;
+  UINT32               TotalBytesWrittenByDevice;
+
+  Slot = VirtioFs->Pool;
+
+  //
+  // Gather the request into the slot.
+  //
+  Offset = 0;
+  for (IoVecIdx = 0; IoVecIdx < RequestSgList->NumVec; IoVecIdx++) {
+    IoVec = &RequestSgList->IoVec[IoVecIdx];
+    CopyMem (Slot + Offset, IoVec->Buffer, IoVec->Size);
+    Offset += IoVec->Size;
+  }
+
+  //
+  // Compose and submit the descriptor chain: one descriptor for the request,
+  // and one for the response, if any.
+  //
+  VirtioPrepare (&VirtioFs->Ring, &Indices);
+  VirtioAppendDesc (
+    &VirtioFs->Ring,
+    VirtioFs->PoolAddr,
+    RequestSgList->TotalSize,
+    (ResponseSgList == NULL) ? 0 : VRING_DESC_F_NEXT,
+    &Indices
+    );
+  if (ResponseSgList != NULL) {
+    VirtioAppendDesc (
+      &VirtioFs->Ring,
+      VirtioFs->PoolAddr + VIRTIO_FS_POOL_REQUEST_SIZE,
+      ResponseSgList->TotalSize,
+      VRING_DESC_F_WRITE,
+      &Indices
+      );
+  }
+
+  Status = VirtioFlush (
+             VirtioFs->Virtio,
+             VIRTIO_FS_REQUEST_QUEUE,
+             &VirtioFs->Ring,
+             &Indices,
+             &TotalBytesWrittenByDevice
+             );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  //
+  // Sanity-check: the Virtio Filesystem device should not have written more
+  // bytes than what we offered room for.
+  //
+  if (TotalBytesWrittenByDevice >
+      ((ResponseSgList == NULL) ? 0 : ResponseSgList->TotalSize))
+  {
+    return EFI_DEVICE_ERROR;
+  }
+
+  for (IoVecIdx = 0; IoVecIdx < RequestSgList->NumVec; IoVecIdx++) {
+    IoVec              = &RequestSgList->IoVec[IoVecIdx];
+    IoVec->Transferred = IoVec->Size;
+  }
+
+  if (ResponseSgList == NULL) {
+    return EFI_SUCCESS;
+  }
+
+  //
+  // Scatter the response from the slot, in the order the response buffers
+  // were described to the device.
+  //
+  Offset = VIRTIO_FS_POOL_REQUEST_SIZE;
+  for (IoVecIdx = 0; IoVecIdx < ResponseSgList->NumVec; IoVecIdx++) {
+    IoVec              = &ResponseSgList->IoVec[IoVecIdx];
+    IoVec->Transferred = MIN ((UINTN)TotalBytesWrittenByDevice, IoVec->Size);
+    CopyMem (IoVec->Buffer, Slot + Offset, IoVec->Transferred);
+    Offset                    += IoVec->Size;
+    TotalBytesWrittenByDevice -= (UINT32)IoVec->Transferred;
+  }
+
+  ASSERT (TotalBytesWrittenByDevice == 0);
+  return EFI_SUCCESS;
+}
+
 /**
   Submit a validated pair of (request buffer list, response buffer list) to the
   Virtio Filesystem device.
@@ -553,6 +751,19 @@ VirtioFsSgListsSubmit (
   UINT32                         TotalBytesWrittenByDevice;
   UINT32                         BytesPermittedForWrite;
 
+  //
+  // An exchange that fits in a slot of the request pool is copied through it,
+  // instead of being mapped.
+  //
+  if ((VirtioFs->Pool != NULL) &&
+      (RequestSgList->TotalSize <= VIRTIO_FS_POOL_REQUEST_SIZE) &&
+      ((ResponseSgList == NULL) ||
+       (ResponseSgList->TotalSize <=
+        VirtioFs->SlotSize - VIRTIO_FS_POOL_REQUEST_SIZE)))
+  {
+    return VirtioFsSgListsSubmitPooled (VirtioFs, RequestSgList, ResponseSgList);
+  }
+
   SgListParam[0]          = RequestSgList;
   SgListVirtioMapOp[0]    = VirtioOperationBusMasterRead;
   SgListDescriptorFlag[0] = 0;
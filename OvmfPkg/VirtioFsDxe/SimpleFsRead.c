@@ -392,21 +392,40 @@ ReadRegularFile (
   Transferred = 0;
   Left        = *BufferSize;
   while (Left > 0) {
-    UINT32  ReadSize;
+    UINTN   ReadSize;
+    UINT32  ChunkSize;
+
+    if (VirtioFs->NumSlots > 1) {
+      //
+      // Keep several FUSE_READ requests in flight. A short read ends the
+      // pipeline; the next iteration finds out if it was due to EOF.
+      //
+      ReadSize = Left;
+      Status   = VirtioFsFuseReadFile (
+                   VirtioFs,
+                   VirtioFsFile->NodeId,
+                   VirtioFsFile->FuseHandle,
+                   VirtioFsFile->FilePosition + Transferred,
+                   &ReadSize,
+                   (UINT8 *)Buffer + Transferred
+                   );
+    } else {
+      //
+      // The device accepts no more than VirtioFs->MaxRead bytes per FUSE_READ.
+      //
+      ChunkSize = (UINT32)MIN ((UINTN)VirtioFs->MaxRead, Left);
+      Status    = VirtioFsFuseReadFileOrDir (
+                    VirtioFs,
+                    VirtioFsFile->NodeId,
+                    VirtioFsFile->FuseHandle,
+                    FALSE,                               // IsDir
+                    VirtioFsFile->FilePosition + Transferred,
+                    &ChunkSize,
+                    (UINT8 *)Buffer + Transferred
+                    );
+      ReadSize = ChunkSize;
+    }
 
-    //
-    // FUSE_READ cannot express a >=4GB buffer size.
-    //
-    ReadSize = (UINT32)MIN ((UINTN)MAX_UINT32, Left);
-    Status   = VirtioFsFuseReadFileOrDir (
-                 VirtioFs,
-                 VirtioFsFile->NodeId,
-                 VirtioFsFile->FuseHandle,
-                 FALSE,                                  // IsDir
-                 VirtioFsFile->FilePosition + Transferred,
-                 &ReadSize,
-                 (UINT8 *)Buffer + Transferred
-                 );
     if (EFI_ERROR (Status) || (ReadSize == 0)) {
       break;
     }
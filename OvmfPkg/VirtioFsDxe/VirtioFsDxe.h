@@ -52,6 +52,26 @@
 //
 #define VIRTIO_FS_FILE_MAX_FILE_INFO  256
 
+//
+// Maximum number of FUSE_READ requests that a read from a regular file keeps
+// in flight. Each takes a slot of the request pool.
+//
+#define VIRTIO_FS_MAX_READS  4
+
+//
+// Upper limit for VIRTIO_FS.MaxRead, which bounds the size of the request
+// pool, whatever the device allows.
+//
+#define VIRTIO_FS_MAX_READ_SIZE  SIZE_1MB
+
+//
+// A slot of the request pool starts with room for a request of up to
+// VIRTIO_FS_POOL_REQUEST_SIZE bytes. The response is received after it, in
+// the rest of the slot, which has room for VIRTIO_FS.MaxRead bytes of data
+// and one page of headers.
+//
+#define VIRTIO_FS_POOL_REQUEST_SIZE  EFI_PAGE_SIZE
+
 //
 // Filesystem label encoded in UCS-2, transformed from the UTF-8 representation
 // in "VIRTIO_FS_CONFIG.Tag", and NUL-terminated. Only the printable ASCII code
@@ -79,6 +99,12 @@ typedef struct {
   VOID                               *RingMap;  // VirtioRingMap       2
   UINT64                             RequestId; // FuseInitSession     1
   UINT32                             MaxWrite;  // FuseInitSession     1
+  UINT32                             MaxRead;   // FuseInitSession     1
+  VOID                               *Pool;     // VirtioFsPoolInit    1
+  EFI_PHYSICAL_ADDRESS               PoolAddr;  // VirtioFsPoolInit    1
+  VOID                               *PoolMap;  // VirtioFsPoolInit    1
+  UINTN                              SlotSize;  // VirtioFsPoolInit    1
+  UINT16                             NumSlots;  // VirtioFsPoolInit    1
   EFI_EVENT                          ExitBoot;  // DriverBindingStart  0
   LIST_ENTRY                         OpenFiles; // DriverBindingStart  0
   EFI_SIMPLE_FILE_SYSTEM_PROTOCOL    SimpleFs;  // DriverBindingStart  0
@@ -204,6 +230,11 @@ VirtioFsExitBoot (
   IN VOID       *VirtioFsAsVoid
   );
 
+VOID
+VirtioFsPoolInit (
+  IN OUT VIRTIO_FS  *VirtioFs
+  );
+
 EFI_STATUS
 VirtioFsSgListsValidate (
   IN     VIRTIO_FS                      *VirtioFs,
@@ -379,6 +410,16 @@ VirtioFsFuseReadFileOrDir (
   OUT VOID          *Data
   );
 
+EFI_STATUS
+VirtioFsFuseReadFile (
+  IN OUT VIRTIO_FS  *VirtioFs,
+  IN     UINT64     NodeId,
+  IN     UINT64     FuseHandle,
+  IN     UINT64     Offset,
+  IN OUT UINTN      *Size,
+  OUT VOID          *Data
+  );
+
 EFI_STATUS
 VirtioFsFuseWrite (
   IN OUT VIRTIO_FS  *VirtioFs,
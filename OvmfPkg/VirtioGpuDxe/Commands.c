@@ -9,6 +9,8 @@
 
 **/
 
+#include <Library/BaseLib.h>
+#include <Library/UefiBootServicesTableLib.h>
 #include <Library/VirtioLib.h>
 
 #include "VirtioGpu.h"
@@ -158,17 +160,42 @@ VirtioGpuInit (
     goto UnmapQueue;
   }
 
+  //
+  // Allocate and map the request/response slots. Each slot owns two
+  // descriptors.
+  //
+  Status = VirtioGpuAllocateZeroAndMapBackingStore (
+             VgpuDev,
+             VGPU_POOL_PAGES,
+             (VOID **)&VgpuDev->Pool,
+             &VgpuDev->PoolDeviceAddress,
+             &VgpuDev->PoolMap
+             );
+  if (EFI_ERROR (Status)) {
+    goto UnmapQueue;
+  }
+
+  VgpuDev->PoolSlots = (UINT16)MIN (VGPU_POOL_SLOTS, QueueSize / 2);
+
   //
   // 8. Set the DRIVER_OK status bit.
   //
   NextDevStat |= VSTAT_DRIVER_OK;
   Status       = VgpuDev->VirtIo->SetDeviceStatus (VgpuDev->VirtIo, NextDevStat);
   if (EFI_ERROR (Status)) {
-    goto UnmapQueue;
+    goto FreePool;
   }
 
   return EFI_SUCCESS;
 
+FreePool:
+  VirtioGpuUnmapAndFreeBackingStore (
+    VgpuDev,
+    VGPU_POOL_PAGES,
+    VgpuDev->Pool,
+    VgpuDev->PoolMap
+    );
+
 UnmapQueue:
   VgpuDev->VirtIo->UnmapSharedBuffer (VgpuDev->VirtIo, VgpuDev->RingMap);
 
@@ -208,6 +235,12 @@ VirtioGpuUninit (
   // configuration.
   //
   VgpuDev->VirtIo->SetDeviceStatus (VgpuDev->VirtIo, 0);
+  VirtioGpuUnmapAndFreeBackingStore (
+    VgpuDev,
+    VGPU_POOL_PAGES,
+    VgpuDev->Pool,
+    VgpuDev->PoolMap
+    );
   VgpuDev->VirtIo->UnmapSharedBuffer (VgpuDev->VirtIo, VgpuDev->RingMap);
   VirtioRingUninit (VgpuDev->VirtIo, &VgpuDev->Ring);
 }
@@ -353,10 +386,59 @@ VirtioGpuExitBoot (
   )
 {
   VGPU_DEV  *VgpuDev;
+  EFI_TPL   OldTpl;
 
   DEBUG ((DEBUG_VERBOSE, "%a: Context=0x%p\n", __func__, Context));
   VgpuDev = Context;
+
+  //
+  // The device will not answer after the reset, so drop the damage that
+  // VirtioGpuFlushDamage() has not sent yet.
+  //
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  if (VgpuDev->Child != NULL) {
+    VgpuDev->Child->DamageCount = 0;
+  }
+
   VgpuDev->VirtIo->SetDeviceStatus (VgpuDev->VirtIo, 0);
+  gBS->RestoreTPL (OldTpl);
+}
+
+/**
+  Internal utility function that initializes the VIRTIO_GPU_CONTROL_HEADER of a
+  request.
+
+  @param[in,out] VgpuDev  The VGPU_DEV object that represents the VirtIo GPU
+                          device.
+
+  @param[in] RequestType  The type of the request.
+
+  @param[in] Fence        Whether to enable fencing for this request. If Fence
+                          is TRUE, then VgpuDev->FenceId is consumed, and
+                          incremented.
+
+  @param[out] Header      The header to initialize.
+**/
+STATIC
+VOID
+VirtioGpuInitHeader (
+  IN OUT VGPU_DEV                            *VgpuDev,
+  IN     VIRTIO_GPU_CONTROL_TYPE             RequestType,
+  IN     BOOLEAN                             Fence,
+  OUT    volatile VIRTIO_GPU_CONTROL_HEADER  *Header
+  )
+{
+  Header->Type = RequestType;
+  if (Fence) {
+    Header->Flags   = VIRTIO_GPU_FLAG_FENCE;
+    Header->FenceId = VgpuDev->FenceId++;
+  } else {
+    Header->Flags   = 0;
+    Header->FenceId = 0;
+  }
+
+  Header->CtxId   = 0;
+  Header->Padding = 0;
 }
 
 /**
@@ -406,9 +488,11 @@ VirtioGpuExitBoot (
   @retval EFI_DEVICE_ERROR       The host rejected the request. The host error
                                  code has been logged on the DEBUG_ERROR level.
 
+  @retval EFI_BAD_BUFFER_SIZE    The request or the response does not fit
+                                 into a VGPU_POOL_SLOT.
+
   @return                        Codes for unexpected errors in VirtIo
-                                 messaging, or request/response
-                                 mapping/unmapping.
+                                 messaging.
 **/
 STATIC
 EFI_STATUS
@@ -423,58 +507,34 @@ VirtioGpuSendCommandWithReply (
   IN     UINTN                               ResponseSize
   )
 {
-  DESC_INDICES          Indices;
-  EFI_STATUS            Status;
-  UINT32                ResponseSizeRet;
-  EFI_PHYSICAL_ADDRESS  RequestDeviceAddress;
-  VOID                  *RequestMap;
-  EFI_PHYSICAL_ADDRESS  ResponseDeviceAddress;
-  VOID                  *ResponseMap;
-
-  //
-  // Initialize Header.
-  //
-  Header->Type = RequestType;
-  if (Fence) {
-    Header->Flags   = VIRTIO_GPU_FLAG_FENCE;
-    Header->FenceId = VgpuDev->FenceId++;
-  } else {
-    Header->Flags   = 0;
-    Header->FenceId = 0;
-  }
-
-  Header->CtxId   = 0;
-  Header->Padding = 0;
+  DESC_INDICES    Indices;
+  EFI_STATUS      Status;
+  UINT32          ResponseSizeRet;
+  EFI_TPL         OldTpl;
+  VGPU_POOL_SLOT  *Slot;
 
   ASSERT (RequestSize >= sizeof *Header);
-  ASSERT (RequestSize <= MAX_UINT32);
+  ASSERT (RequestSize <= VGPU_POOL_REQUEST_SIZE);
+  ASSERT (ResponseSize <= VGPU_POOL_RESPONSE_SIZE);
+  if ((RequestSize > VGPU_POOL_REQUEST_SIZE) ||
+      (ResponseSize > VGPU_POOL_RESPONSE_SIZE))
+  {
+    return EFI_BAD_BUFFER_SIZE;
+  }
 
   //
-  // Map request and response to bus master device addresses.
+  // VirtioGpuFlushDamage() submits commands from a timer; keep it off the ring
+  // until the response has arrived.
   //
-  Status = VirtioMapAllBytesInSharedBuffer (
-             VgpuDev->VirtIo,
-             VirtioOperationBusMasterRead,
-             (VOID *)Header,
-             RequestSize,
-             &RequestDeviceAddress,
-             &RequestMap
-             );
-  if (EFI_ERROR (Status)) {
-    return Status;
-  }
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
 
-  Status = VirtioMapAllBytesInSharedBuffer (
-             VgpuDev->VirtIo,
-             VirtioOperationBusMasterWrite,
-             (VOID *)Response,
-             ResponseSize,
-             &ResponseDeviceAddress,
-             &ResponseMap
-             );
-  if (EFI_ERROR (Status)) {
-    goto UnmapRequest;
-  }
+  //
+  // Initialize Header, and copy the request to slot #0.
+  //
+  VirtioGpuInitHeader (VgpuDev, RequestType, Fence, Header);
+  Slot = &VgpuDev->Pool[0];
+  CopyMem (Slot->Request, (VOID *)Header, RequestSize);
+  ZeroMem (Slot->Response, ResponseSize);
 
   //
   // Compose the descriptor chain.
@@ -482,14 +542,14 @@ VirtioGpuSendCommandWithReply (
   VirtioPrepare (&VgpuDev->Ring, &Indices);
   VirtioAppendDesc (
     &VgpuDev->Ring,
-    RequestDeviceAddress,
+    VgpuDev->PoolDeviceAddress + OFFSET_OF (VGPU_POOL_SLOT, Request),
     (UINT32)RequestSize,
     VRING_DESC_F_NEXT,
     &Indices
     );
   VirtioAppendDesc (
     &VgpuDev->Ring,
-    ResponseDeviceAddress,
+    VgpuDev->PoolDeviceAddress + OFFSET_OF (VGPU_POOL_SLOT, Response),
     (UINT32)ResponseSize,
     VRING_DESC_F_WRITE,
     &Indices
@@ -506,7 +566,7 @@ VirtioGpuSendCommandWithReply (
              &ResponseSizeRet
              );
   if (EFI_ERROR (Status)) {
-    goto UnmapResponse;
+    goto RestoreTpl;
   }
 
   //
@@ -520,29 +580,16 @@ VirtioGpuSendCommandWithReply (
       (UINT32)RequestType
       ));
     Status = EFI_PROTOCOL_ERROR;
-    goto UnmapResponse;
-  }
-
-  //
-  // Unmap response and request, in reverse order of mapping. On error, the
-  // respective mapping is invalidated anyway, only the data may not have been
-  // committed to system memory (in case of VirtioOperationBusMasterWrite).
-  //
-  Status = VgpuDev->VirtIo->UnmapSharedBuffer (VgpuDev->VirtIo, ResponseMap);
-  if (EFI_ERROR (Status)) {
-    goto UnmapRequest;
-  }
-
-  Status = VgpuDev->VirtIo->UnmapSharedBuffer (VgpuDev->VirtIo, RequestMap);
-  if (EFI_ERROR (Status)) {
-    return Status;
+    goto RestoreTpl;
   }
 
   //
   // Parse the response.
   //
+  CopyMem ((VOID *)Response, Slot->Response, ResponseSize);
   if (Response->Type == (UINT32)ResponseType) {
-    return EFI_SUCCESS;
+    Status = EFI_SUCCESS;
+    goto RestoreTpl;
   }
 
   DEBUG ((
@@ -553,14 +600,10 @@ VirtioGpuSendCommandWithReply (
     Response->Type,
     ResponseType
     ));
-  return EFI_DEVICE_ERROR;
-
-UnmapResponse:
-  VgpuDev->VirtIo->UnmapSharedBuffer (VgpuDev->VirtIo, ResponseMap);
-
-UnmapRequest:
-  VgpuDev->VirtIo->UnmapSharedBuffer (VgpuDev->VirtIo, RequestMap);
+  Status = EFI_DEVICE_ERROR;
 
+RestoreTpl:
+  gBS->RestoreTPL (OldTpl);
   return Status;
 }
 
@@ -848,3 +891,238 @@ VirtioGpuGetDisplayInfo (
            sizeof *Response
            );
 }
+
+/**
+  Internal utility function that submits the transfer and the flush of each
+  rectangle in a batch, notifies the host once, and awaits all responses.
+
+  The caller is responsible for running at TPL_NOTIFY, and for RectCount not
+  exceeding VgpuDev->PoolSlots / 2.
+
+  @param[in,out] VgpuDev  The VGPU_DEV object that represents the VirtIo GPU
+                          device.
+
+  @param[in] ResourceId   The host resource to transfer to and flush.
+
+  @param[in] Stride       The number of pixels per line of the backing store.
+
+  @param[in] Rects        The rectangles to transfer and flush.
+
+  @param[in] RectCount    The number of rectangles in Rects.
+
+  @retval EFI_SUCCESS       All requests have been completed successfully.
+
+  @retval EFI_DEVICE_ERROR  The host rejected a request. The host error code has
+                            been logged on the DEBUG_ERROR level.
+
+  @return                   Error codes from VirtIo->SetQueueNotify().
+**/
+STATIC
+EFI_STATUS
+VirtioGpuSubmitRectBatch (
+  IN OUT VGPU_DEV                    *VgpuDev,
+  IN     UINT32                      ResourceId,
+  IN     UINT32                      Stride,
+  IN     CONST VIRTIO_GPU_RECTANGLE  *Rects,
+  IN     UINTN                       RectCount
+  )
+{
+  EFI_STATUS                                   Status;
+  UINT16                                       SlotCount;
+  UINT16                                       SlotIndex;
+  VGPU_POOL_SLOT                               *Slot;
+  EFI_PHYSICAL_ADDRESS                         SlotDeviceAddress;
+  CONST VIRTIO_GPU_RECTANGLE                   *Rect;
+  volatile VIRTIO_GPU_CMD_TRANSFER_TO_HOST_2D  *Transfer;
+  volatile VIRTIO_GPU_RESOURCE_FLUSH           *Flush;
+  volatile VIRTIO_GPU_CONTROL_HEADER           *Response;
+  UINT32                                       RequestSize;
+  DESC_INDICES                                 Indices;
+  UINT16                                       HeadDescIdx[VGPU_POOL_SLOTS];
+  UINT16                                       UsedDescIdx;
+
+  ASSERT (RectCount * 2 <= VgpuDev->PoolSlots);
+
+  //
+  // Even slots carry the transfers, odd slots the flushes. The host processes
+  // the control queue in order, so each flush follows its transfer.
+  //
+  SlotCount = (UINT16)(RectCount * 2);
+  for (SlotIndex = 0; SlotIndex < SlotCount; SlotIndex++) {
+    Slot = &VgpuDev->Pool[SlotIndex];
+    Rect = &Rects[SlotIndex / 2];
+    if ((SlotIndex % 2) == 0) {
+      Transfer                   = (volatile VOID *)Slot->Request;
+      Transfer->Rectangle.X      = Rect->X;
+      Transfer->Rectangle.Y      = Rect->Y;
+      Transfer->Rectangle.Width  = Rect->Width;
+      Transfer->Rectangle.Height = Rect->Height;
+      Transfer->Offset           = sizeof (UINT32) *
+                                   ((UINT64)Rect->Y * Stride + Rect->X);
+      Transfer->ResourceId = ResourceId;
+      Transfer->Padding    = 0;
+      VirtioGpuInitHeader (
+        VgpuDev,
+        VirtioGpuCmdTransferToHost2d,
+        FALSE,                        // Fence
+        &Transfer->Header
+        );
+      RequestSize = sizeof *Transfer;
+    } else {
+      Flush                   = (volatile VOID *)Slot->Request;
+      Flush->Rectangle.X      = Rect->X;
+      Flush->Rectangle.Y      = Rect->Y;
+      Flush->Rectangle.Width  = Rect->Width;
+      Flush->Rectangle.Height = Rect->Height;
+      Flush->ResourceId       = ResourceId;
+      Flush->Padding          = 0;
+      VirtioGpuInitHeader (
+        VgpuDev,
+        VirtioGpuCmdResourceFlush,
+        FALSE,                     // Fence
+        &Flush->Header
+        );
+      RequestSize = sizeof *Flush;
+    }
+
+    Response       = (volatile VOID *)Slot->Response;
+    Response->Type = 0;
+
+    //
+    // Each slot owns two descriptors, so the chains in flight never overlap.
+    //
+    SlotDeviceAddress = VgpuDev->PoolDeviceAddress +
+                        SlotIndex * sizeof (VGPU_POOL_SLOT);
+    Indices.HeadDescIdx    = (UINT16)(SlotIndex * 2);
+    Indices.NextDescIdx    = Indices.HeadDescIdx;
+    HeadDescIdx[SlotIndex] = Indices.HeadDescIdx;
+    VirtioAppendDesc (
+      &VgpuDev->Ring,
+      SlotDeviceAddress + OFFSET_OF (VGPU_POOL_SLOT, Request),
+      RequestSize,
+      VRING_DESC_F_NEXT,
+      &Indices
+      );
+    VirtioAppendDesc (
+      &VgpuDev->Ring,
+      SlotDeviceAddress + OFFSET_OF (VGPU_POOL_SLOT, Response),
+      sizeof *Response,
+      VRING_DESC_F_WRITE,
+      &Indices
+      );
+  }
+
+  //
+  // All chains are published together, and the host is notified once for
+  // the batch.
+  //
+  Status = VirtioSubmit (
+             VgpuDev->VirtIo,
+             VIRTIO_GPU_CONTROL_QUEUE,
+             &VgpuDev->Ring,
+             HeadDescIdx,
+             SlotCount
+             );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  for (SlotIndex = 0; SlotIndex < SlotCount; SlotIndex++) {
+    VirtioWaitUsed (&VgpuDev->Ring, &UsedDescIdx, NULL);
+  }
+
+  //
+  // Parse the responses.
+  //
+  Status = EFI_SUCCESS;
+  for (SlotIndex = 0; SlotIndex < SlotCount; SlotIndex++) {
+    Slot     = &VgpuDev->Pool[SlotIndex];
+    Response = (volatile VOID *)Slot->Response;
+    if (Response->Type != VirtioGpuRespOkNodata) {
+      DEBUG ((
+        DEBUG_ERROR,
+        "%a: Request=0x%x Response=0x%x (expected 0x%x)\n",
+        __func__,
+        ((VIRTIO_GPU_CONTROL_HEADER *)Slot->Request)->Type,
+        Response->Type,
+        VirtioGpuRespOkNodata
+        ));
+      Status = EFI_DEVICE_ERROR;
+    }
+  }
+
+  return Status;
+}
+
+EFI_STATUS
+VirtioGpuTransferAndFlushRects (
+  IN OUT VGPU_DEV                    *VgpuDev,
+  IN     UINT32                      ResourceId,
+  IN     UINT32                      Stride,
+  IN     CONST VIRTIO_GPU_RECTANGLE  *Rects,
+  IN     UINTN                       RectCount
+  )
+{
+  EFI_STATUS                  Status;
+  EFI_TPL                     OldTpl;
+  UINTN                       RectIndex;
+  UINTN                       BatchSize;
+  CONST VIRTIO_GPU_RECTANGLE  *Rect;
+
+  if (ResourceId == 0) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  Status = EFI_SUCCESS;
+
+  if (VgpuDev->PoolSlots < 2) {
+    //
+    // Only one command can be in flight; send them one at a time.
+    //
+    for (RectIndex = 0; RectIndex < RectCount; RectIndex++) {
+      Rect   = &Rects[RectIndex];
+      Status = VirtioGpuTransferToHost2d (
+                 VgpuDev,
+                 Rect->X,
+                 Rect->Y,
+                 Rect->Width,
+                 Rect->Height,
+                 sizeof (UINT32) * ((UINT64)Rect->Y * Stride + Rect->X),
+                 ResourceId
+                 );
+      if (EFI_ERROR (Status)) {
+        break;
+      }
+
+      Status = VirtioGpuResourceFlush (
+                 VgpuDev,
+                 Rect->X,
+                 Rect->Y,
+                 Rect->Width,
+                 Rect->Height,
+                 ResourceId
+                 );
+      if (EFI_ERROR (Status)) {
+        break;
+      }
+    }
+  } else {
+    for (RectIndex = 0; RectIndex < RectCount; RectIndex += BatchSize) {
+      BatchSize = MIN (RectCount - RectIndex, VgpuDev->PoolSlots / 2);
+      Status    = VirtioGpuSubmitRectBatch (
+                    VgpuDev,
+                    ResourceId,
+                    Stride,
+                    &Rects[RectIndex],
+                    BatchSize
+                    );
+      if (EFI_ERROR (Status)) {
+        break;
+      }
+    }
+  }
+
+  gBS->RestoreTPL (OldTpl);
+  return Status;
+}
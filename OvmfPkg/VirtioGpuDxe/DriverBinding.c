@@ -421,6 +421,20 @@ InitVgpuGop (
 
   ASSERT (ParentVirtIo == ParentBus->VirtIo);
 
+  //
+  // Create the timer that sends the areas written by Gop.Blt() to the host.
+  //
+  Status = gBS->CreateEvent (
+                  EVT_TIMER | EVT_NOTIFY_SIGNAL,
+                  TPL_NOTIFY,
+                  VirtioGpuFlushDamage,
+                  VgpuGop /* NotifyContext */,
+                  &VgpuGop->DamageTimer
+                  );
+  if (EFI_ERROR (Status)) {
+    goto CloseVirtIoByChild;
+  }
+
   //
   // Initialize our Graphics Output Protocol.
   //
@@ -430,7 +444,7 @@ InitVgpuGop (
   CopyMem (&VgpuGop->Gop, &mGopTemplate, sizeof mGopTemplate);
   Status = VgpuGop->Gop.SetMode (&VgpuGop->Gop, 0);
   if (EFI_ERROR (Status)) {
-    goto CloseVirtIoByChild;
+    goto CloseDamageTimer;
   }
 
   //
@@ -456,6 +470,9 @@ InitVgpuGop (
 UninitGop:
   ReleaseGopResources (VgpuGop, TRUE /* DisableHead */);
 
+CloseDamageTimer:
+  gBS->CloseEvent (VgpuGop->DamageTimer);
+
 CloseVirtIoByChild:
   gBS->CloseProtocol (
          ParentBusController,
@@ -528,6 +545,9 @@ UninitVgpuGop (
   //
   ReleaseGopResources (VgpuGop, TRUE /* DisableHead */);
 
+  Status = gBS->CloseEvent (VgpuGop->DamageTimer);
+  ASSERT_EFI_ERROR (Status);
+
   Status = gBS->CloseProtocol (
                   ParentBusController,
                   &gVirtioDeviceProtocolGuid,
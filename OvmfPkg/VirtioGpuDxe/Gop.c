@@ -8,8 +8,10 @@
 
 **/
 
+#include <Library/BaseLib.h>
 #include <Library/MemoryAllocationLib.h>
 #include <Library/PcdLib.h>
+#include <Library/UefiBootServicesTableLib.h>
 
 #include "VirtioGpu.h"
 
@@ -43,10 +45,22 @@ ReleaseGopResources (
   )
 {
   EFI_STATUS  Status;
+  EFI_TPL     OldTpl;
 
   ASSERT (VgpuGop->ResourceId != 0);
   ASSERT (VgpuGop->BackingStore != NULL);
 
+  //
+  // Damage that has not been sent yet refers to the resource being released.
+  //
+  OldTpl               = gBS->RaiseTPL (TPL_NOTIFY);
+  VgpuGop->DamageCount = 0;
+  if (VgpuGop->DamageTimer != NULL) {
+    gBS->SetTimer (VgpuGop->DamageTimer, TimerCancel, 0);
+  }
+
+  gBS->RestoreTPL (OldTpl);
+
   //
   // If any of the following host-side destruction steps fail, we can't get out
   // of an inconsistent state, so we'll hang. In general errors in object
@@ -139,6 +153,47 @@ ReleaseGopResources (
   VgpuGop->ResourceId = 0;
 }
 
+/**
+  Send the areas that Gop.Blt() has written to since the last call to the host,
+  and flush them to the display.
+
+  This is the notification function of VGPU_GOP.DamageTimer.
+
+  @param[in] Event    Event whose notification function is being invoked.
+
+  @param[in] Context  Pointer to the VGPU_GOP object.
+**/
+VOID
+EFIAPI
+VirtioGpuFlushDamage (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  VGPU_GOP    *VgpuGop;
+  EFI_TPL     OldTpl;
+  EFI_STATUS  Status;
+
+  VgpuGop = Context;
+  OldTpl  = gBS->RaiseTPL (TPL_NOTIFY);
+
+  if ((VgpuGop->DamageCount > 0) && (VgpuGop->ResourceId != 0)) {
+    Status = VirtioGpuTransferAndFlushRects (
+               VgpuGop->ParentBus,                        // VgpuDev
+               VgpuGop->ResourceId,                       // ResourceId
+               VgpuGop->GopModeInfo.HorizontalResolution, // Stride
+               VgpuGop->Damage,                           // Rects
+               VgpuGop->DamageCount                       // RectCount
+               );
+    if (EFI_ERROR (Status)) {
+      DEBUG ((DEBUG_ERROR, "%a: %r\n", __func__, Status));
+    }
+  }
+
+  VgpuGop->DamageCount = 0;
+  gBS->RestoreTPL (OldTpl);
+}
+
 //
 // The resolutions supported by this driver.
 //
@@ -547,6 +602,139 @@ DestroyHostResource:
   return Status;
 }
 
+/**
+  Grow a rectangle to the smallest rectangle that also covers another one.
+
+  @param[in,out] Rect   The rectangle to grow.
+
+  @param[in] Other      The rectangle to cover.
+**/
+STATIC
+VOID
+UnionGopRect (
+  IN OUT VIRTIO_GPU_RECTANGLE        *Rect,
+  IN     CONST VIRTIO_GPU_RECTANGLE  *Other
+  )
+{
+  UINT32  X2;
+  UINT32  Y2;
+
+  X2           = MAX (Rect->X + Rect->Width, Other->X + Other->Width);
+  Y2           = MAX (Rect->Y + Rect->Height, Other->Y + Other->Height);
+  Rect->X      = MIN (Rect->X, Other->X);
+  Rect->Y      = MIN (Rect->Y, Other->Y);
+  Rect->Width  = X2 - Rect->X;
+  Rect->Height = Y2 - Rect->Y;
+}
+
+/**
+  Record that Gop.Blt() has written to a rectangle of the backing store, and arm
+  VGPU_GOP.DamageTimer if nothing was pending.
+
+  @param[in,out] VgpuGop  The VGPU_GOP object whose backing store was written.
+
+  @param[in] X            The left edge of the rectangle.
+
+  @param[in] Y            The top edge of the rectangle.
+
+  @param[in] Width        The width of the rectangle.
+
+  @param[in] Height       The height of the rectangle.
+**/
+STATIC
+VOID
+AddGopDamage (
+  IN OUT VGPU_GOP  *VgpuGop,
+  IN     UINT32    X,
+  IN     UINT32    Y,
+  IN     UINT32    Width,
+  IN     UINT32    Height
+  )
+{
+  EFI_TPL               OldTpl;
+  BOOLEAN               WasIdle;
+  VIRTIO_GPU_RECTANGLE  New;
+  VIRTIO_GPU_RECTANGLE  Union;
+  VIRTIO_GPU_RECTANGLE  *Old;
+  UINTN                 Index;
+  UINTN                 Best;
+  UINT64                Growth;
+  UINT64                BestGrowth;
+  EFI_STATUS            Status;
+
+  if ((Width == 0) || (Height == 0)) {
+    return;
+  }
+
+  New.X      = X;
+  New.Y      = Y;
+  New.Width  = Width;
+  New.Height = Height;
+
+  OldTpl  = gBS->RaiseTPL (TPL_NOTIFY);
+  WasIdle = (BOOLEAN)(VgpuGop->DamageCount == 0);
+
+  //
+  // Absorb every rectangle that overlaps or touches the new one. The grown
+  // rectangle may touch one that was checked already, so start over after
+  // each merge.
+  //
+  Index = 0;
+  while (Index < VgpuGop->DamageCount) {
+    Old = &VgpuGop->Damage[Index];
+    if ((Old->X <= New.X + New.Width) && (New.X <= Old->X + Old->Width) &&
+        (Old->Y <= New.Y + New.Height) && (New.Y <= Old->Y + Old->Height))
+    {
+      UnionGopRect (&New, Old);
+      VgpuGop->DamageCount--;
+      CopyMem (Old, &VgpuGop->Damage[VgpuGop->DamageCount], sizeof *Old);
+      Index = 0;
+      continue;
+    }
+
+    Index++;
+  }
+
+  //
+  // Out of room: merge with the rectangle that grows the least. The union may
+  // overlap others, which only costs a transfer of some pixels twice.
+  //
+  if (VgpuGop->DamageCount == VGPU_DAMAGE_MAX_RECTS) {
+    Best       = 0;
+    BestGrowth = MAX_UINT64;
+    for (Index = 0; Index < VgpuGop->DamageCount; Index++) {
+      Old = &VgpuGop->Damage[Index];
+      CopyMem (&Union, &New, sizeof Union);
+      UnionGopRect (&Union, Old);
+      Growth = MultU64x32 (Union.Width, Union.Height) -
+               MultU64x32 (Old->Width, Old->Height);
+      if (Growth < BestGrowth) {
+        Best       = Index;
+        BestGrowth = Growth;
+      }
+    }
+
+    Old = &VgpuGop->Damage[Best];
+    UnionGopRect (&New, Old);
+    VgpuGop->DamageCount--;
+    CopyMem (Old, &VgpuGop->Damage[VgpuGop->DamageCount], sizeof *Old);
+  }
+
+  CopyMem (&VgpuGop->Damage[VgpuGop->DamageCount], &New, sizeof New);
+  VgpuGop->DamageCount++;
+
+  if (WasIdle) {
+    Status = gBS->SetTimer (
+                    VgpuGop->DamageTimer,
+                    TimerRelative,
+                    VGPU_DAMAGE_PERIOD
+                    );
+    ASSERT_EFI_ERROR (Status);
+  }
+
+  gBS->RestoreTPL (OldTpl);
+}
+
 STATIC
 EFI_STATUS
 EFIAPI
@@ -568,8 +756,6 @@ GopBlt (
   UINT32      CurrentVertical;
   UINTN       SegmentSize;
   UINTN       Y;
-  UINTN       ResourceOffset;
-  EFI_STATUS  Status;
 
   VgpuGop           = VGPU_GOP_FROM_GOP (This);
   CurrentHorizontal = VgpuGop->GopModeInfo.HorizontalResolution;
@@ -736,36 +922,18 @@ GopBlt (
   }
 
   //
-  // For operations that wrote to the display, submit the updated area to the
-  // host -- update the host resource from guest memory.
+  // For operations that wrote to the display, record the updated area. It is
+  // merged with the other areas updated during this frame, and the damage
+  // timer transfers it to the host resource and flushes it to the display.
   //
-  ResourceOffset = sizeof (UINT32) * (DestinationY * CurrentHorizontal +
-                                      DestinationX);
-  Status = VirtioGpuTransferToHost2d (
-             VgpuGop->ParentBus,   // VgpuDev
-             (UINT32)DestinationX, // X
-             (UINT32)DestinationY, // Y
-             (UINT32)Width,        // Width
-             (UINT32)Height,       // Height
-             ResourceOffset,       // Offset
-             VgpuGop->ResourceId   // ResourceId
-             );
-  if (EFI_ERROR (Status)) {
-    return Status;
-  }
-
-  //
-  // Flush the updated resource to the display.
-  //
-  Status = VirtioGpuResourceFlush (
-             VgpuGop->ParentBus,   // VgpuDev
-             (UINT32)DestinationX, // X
-             (UINT32)DestinationY, // Y
-             (UINT32)Width,        // Width
-             (UINT32)Height,       // Height
-             VgpuGop->ResourceId   // ResourceId
-             );
-  return Status;
+  AddGopDamage (
+    VgpuGop,
+    (UINT32)DestinationX,
+    (UINT32)DestinationY,
+    (UINT32)Width,
+    (UINT32)Height
+    );
+  return EFI_SUCCESS;
 }
 
 //
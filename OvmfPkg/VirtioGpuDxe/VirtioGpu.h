@@ -23,6 +23,30 @@
 //
 typedef struct VGPU_GOP_STRUCT VGPU_GOP;
 
+//
+// The commands are exchanged through request/response slots in a buffer that
+// is mapped once, for bus master common buffer operation. Every command that
+// the driver sends fits into a slot. On a split ring, the commands that update
+// the display are sent in batches over all slots.
+//
+#define VGPU_POOL_REQUEST_SIZE   128
+#define VGPU_POOL_RESPONSE_SIZE  512
+#define VGPU_POOL_SLOTS          16
+#define VGPU_POOL_PAGES          \
+          EFI_SIZE_TO_PAGES (sizeof (VGPU_POOL_SLOT) * VGPU_POOL_SLOTS)
+
+typedef struct {
+  UINT8    Request[VGPU_POOL_REQUEST_SIZE];
+  UINT8    Response[VGPU_POOL_RESPONSE_SIZE];
+} VGPU_POOL_SLOT;
+
+//
+// Gop.Blt() accumulates the areas that it writes to in at most this many
+// rectangles, and a timer sends them to the host once per frame.
+//
+#define VGPU_DAMAGE_MAX_RECTS  (VGPU_POOL_SLOTS / 2)
+#define VGPU_DAMAGE_PERIOD     EFI_TIMER_PERIOD_MILLISECONDS (16)
+
 //
 // The abstraction that directly corresponds to a Virtio GPU device.
 //
@@ -66,6 +90,17 @@ typedef struct {
   //
   UINT64                      FenceId;
 
+  //
+  // The request/response slots, their bus master device address, and the
+  // token of their mapping. Slot #0 carries the commands that are sent one at
+  // a time. PoolSlots is the number of slots that may be in flight together;
+  // it is 1 on a control queue with fewer than four descriptors.
+  //
+  VGPU_POOL_SLOT              *Pool;
+  EFI_PHYSICAL_ADDRESS        PoolDeviceAddress;
+  VOID                        *PoolMap;
+  UINT16                      PoolSlots;
+
   //
   // The Child field references the GOP wrapper structure. If this pointer is
   // NULL, then the hybrid driver has bound (i.e., started) the
@@ -157,6 +192,17 @@ struct VGPU_GOP_STRUCT {
   //
   UINT32                                  NativeXRes;
   UINT32                                  NativeYRes;
+
+  //
+  // The areas of BackingStore that Gop.Blt() has written to, and that have not
+  // been sent to the host resource yet. Overlapping and adjacent rectangles
+  // are merged. DamageTimer is armed when the first rectangle is added, and
+  // sends one transfer and one flush per rectangle. Both are accessed at
+  // TPL_NOTIFY.
+  //
+  VIRTIO_GPU_RECTANGLE                    Damage[VGPU_DAMAGE_MAX_RECTS];
+  UINTN                                   DamageCount;
+  EFI_EVENT                               DamageTimer;
 };
 
 //
@@ -378,6 +424,44 @@ VirtioGpuGetDisplayInfo (
   volatile VIRTIO_GPU_RESP_DISPLAY_INFO  *Response
   );
 
+/**
+  Transfer rectangles of a backing store to the host resource, and flush them
+  to the display.
+
+  On a split ring, the transfer and the flush of every rectangle are submitted
+  together, and the host is notified once per batch.
+
+  @param[in,out] VgpuDev   The VGPU_DEV object that represents the VirtIo GPU
+                           device.
+
+  @param[in] ResourceId    The host resource that the backing store is
+                           attached to.
+
+  @param[in] Stride        The number of pixels per line of the backing store.
+
+  @param[in] Rects         The rectangles to transfer and flush.
+
+  @param[in] RectCount     The number of rectangles in Rects.
+
+  @retval EFI_SUCCESS            All rectangles have been flushed.
+
+  @retval EFI_INVALID_PARAMETER  ResourceId is zero.
+
+  @retval EFI_DEVICE_ERROR       The host rejected a request. The host error
+                                 code has been logged on the DEBUG_ERROR level.
+
+  @return                        Codes for unexpected errors in VirtIo
+                                 messaging.
+**/
+EFI_STATUS
+VirtioGpuTransferAndFlushRects (
+  IN OUT VGPU_DEV                    *VgpuDev,
+  IN     UINT32                      ResourceId,
+  IN     UINT32                      Stride,
+  IN     CONST VIRTIO_GPU_RECTANGLE  *Rects,
+  IN     UINTN                       RectCount
+  );
+
 /**
   Release guest-side and host-side resources that are related to an initialized
   VGPU_GOP.Gop.
@@ -407,6 +491,23 @@ ReleaseGopResources (
   IN     BOOLEAN   DisableHead
   );
 
+/**
+  Send the areas that Gop.Blt() has written to since the last call to the host,
+  and flush them to the display.
+
+  This is the notification function of VGPU_GOP.DamageTimer.
+
+  @param[in] Event    Event whose notification function is being invoked.
+
+  @param[in] Context  Pointer to the VGPU_GOP object.
+**/
+VOID
+EFIAPI
+VirtioGpuFlushDamage (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  );
+
 //
 // Template for initializing VGPU_GOP.Gop.
 //
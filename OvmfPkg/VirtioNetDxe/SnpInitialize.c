@@ -135,14 +135,16 @@ ReleaseQueue:
   - tracking of heads of free descriptor chains from the above,
   - one common virtio-net request header (never modified by the host) for all
     pending TX packets,
+  - a bounce buffer slot for each pending TX packet, mapped once, that the
+    tail descriptor of its chain points to,
   - select polling over TX interrupt.
 
   @param[in,out] Dev       The VNET_DEV driver instance about to enter the
                            EfiSimpleNetworkInitialized state.
 
   @retval EFI_OUT_OF_RESOURCES  Failed to allocate the stack to track the heads
-                                of free descriptor chains or failed to init
-                                TxBufCollection.
+                                of free descriptor chains, or the array of
+                                caller buffers.
   @return                       Status codes from VIRTIO_DEVICE_PROTOCOL.
                                 AllocateSharedPages() or
                                 VirtioMapAllBytesInSharedBuffer()
@@ -160,6 +162,8 @@ VirtioNetInitTx (
   EFI_STATUS            Status;
   EFI_PHYSICAL_ADDRESS  DeviceAddress;
   VOID                  *TxSharedReqBuffer;
+  EFI_PHYSICAL_ADDRESS  TxBufDeviceBase;
+  VOID                  *TxBufBuffer;
 
   Dev->TxMaxPending = (UINT16)MIN (
                                 Dev->TxRing.QueueSize / 2,
@@ -174,11 +178,8 @@ VirtioNetInitTx (
     return EFI_OUT_OF_RESOURCES;
   }
 
-  Dev->TxBufCollection = OrderedCollectionInit (
-                           VirtioNetTxBufMapInfoCompare,
-                           VirtioNetTxBufDeviceAddressCompare
-                           );
-  if (Dev->TxBufCollection == NULL) {
+  Dev->TxBufOwner = AllocatePool (Dev->TxMaxPending * sizeof *Dev->TxBufOwner);
+  if (Dev->TxBufOwner == NULL) {
     Status = EFI_OUT_OF_RESOURCES;
     goto FreeTxFreeStack;
   }
@@ -193,7 +194,7 @@ VirtioNetInitTx (
                           &TxSharedReqBuffer
                           );
   if (EFI_ERROR (Status)) {
-    goto UninitTxBufCollection;
+    goto FreeTxBufOwner;
   }
 
   ZeroMem (TxSharedReqBuffer, sizeof *Dev->TxSharedReq);
@@ -212,11 +213,41 @@ VirtioNetInitTx (
 
   Dev->TxSharedReq = TxSharedReqBuffer;
 
+  //
+  // Allocate the TX bounce buffer, and map it with BusMasterCommonBuffer once,
+  // so that VirtioNetTransmit only has to copy packets, not map them.
+  //
+  ASSERT (Dev->Snm.MediaHeaderSize + Dev->Snm.MaxPacketSize <= VNET_TX_SLOT_SIZE);
+  Dev->TxBufNrPages = EFI_SIZE_TO_PAGES (Dev->TxMaxPending * VNET_TX_SLOT_SIZE);
+  Status            = Dev->VirtIo->AllocateSharedPages (
+                                     Dev->VirtIo,
+                                     Dev->TxBufNrPages,
+                                     &TxBufBuffer
+                                     );
+  if (EFI_ERROR (Status)) {
+    goto UnmapTxSharedReqBuffer;
+  }
+
+  Status = VirtioMapAllBytesInSharedBuffer (
+             Dev->VirtIo,
+             VirtioOperationBusMasterCommonBuffer,
+             TxBufBuffer,
+             EFI_PAGES_TO_SIZE (Dev->TxBufNrPages),
+             &TxBufDeviceBase,
+             &Dev->TxBufMap
+             );
+  if (EFI_ERROR (Status)) {
+    goto FreeTxBufBuffer;
+  }
+
+  Dev->TxBuf = TxBufBuffer;
+
   //
   // In VirtIo 1.0, the NumBuffers field is mandatory. In 0.9.5, it depends on
-  // VIRTIO_NET_F_MRG_RXBUF, which we never negotiate.
+  // VIRTIO_NET_F_MRG_RXBUF.
   //
-  TxSharedReqSize = (Dev->VirtIo->Revision < VIRTIO_SPEC_REVISION (1, 0, 0)) ?
+  TxSharedReqSize = ((Dev->VirtIo->Revision < VIRTIO_SPEC_REVISION (1, 0, 0)) &&
+                     !Dev->RxMergeable) ?
                     sizeof (Dev->TxSharedReq->V0_9_5) :
                     sizeof *Dev->TxSharedReq;
 
@@ -236,9 +267,11 @@ VirtioNetInitTx (
     Dev->TxRing.Desc[DescIdx].Next  = (UINT16)(DescIdx + 1);
 
     //
-    // The second descriptor of each pending TX packet is updated on the fly,
-    // but it always terminates the descriptor chain of the packet.
+    // The second descriptor of each pending TX packet points to the packet's
+    // slot of the bounce buffer. Its length is updated on the fly, but it
+    // always terminates the descriptor chain of the packet.
     //
+    Dev->TxRing.Desc[DescIdx + 1].Addr  = TxBufDeviceBase + PktIdx * VNET_TX_SLOT_SIZE;
     Dev->TxRing.Desc[DescIdx + 1].Flags = 0;
   }
 
@@ -263,10 +296,20 @@ VirtioNetInitTx (
   //
   // want no interrupt when a transmit completes
   //
-  *Dev->TxRing.Avail.Flags = (UINT16)VRING_AVAIL_F_NO_INTERRUPT;
+  VirtioRingDisableInterrupts (&Dev->TxRing);
 
   return EFI_SUCCESS;
 
+FreeTxBufBuffer:
+  Dev->VirtIo->FreeSharedPages (
+                 Dev->VirtIo,
+                 Dev->TxBufNrPages,
+                 TxBufBuffer
+                 );
+
+UnmapTxSharedReqBuffer:
+  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->TxSharedReqMap);
+
 FreeTxSharedReqBuffer:
   Dev->VirtIo->FreeSharedPages (
                  Dev->VirtIo,
@@ -274,8 +317,8 @@ FreeTxSharedReqBuffer:
                  TxSharedReqBuffer
                  );
 
-UninitTxBufCollection:
-  OrderedCollectionUninit (Dev->TxBufCollection);
+FreeTxBufOwner:
+  FreePool (Dev->TxBufOwner);
 
 FreeTxFreeStack:
   FreePool (Dev->TxFreeStack);
@@ -294,7 +337,8 @@ FreeTxFreeStack:
     packet data into,
   - select polling over RX interrupt,
   - fully populate the RX queue with a static pattern of virtio descriptor
-    chains.
+    chains, or, with VIRTIO_NET_F_MRG_RXBUF, of single descriptors, each
+    pointing to a VNET_RX_BUF_SIZE buffer.
 
   @param[in,out] Dev       The VNET_DEV driver instance about to enter the
                            EfiSimpleNetworkInitialized state.
@@ -324,26 +368,38 @@ VirtioNetInitRx (
 
   //
   // In VirtIo 1.0, the NumBuffers field is mandatory. In 0.9.5, it depends on
-  // VIRTIO_NET_F_MRG_RXBUF, which we never negotiate.
+  // VIRTIO_NET_F_MRG_RXBUF.
   //
-  VirtioNetReqSize = (Dev->VirtIo->Revision < VIRTIO_SPEC_REVISION (1, 0, 0)) ?
+  VirtioNetReqSize = ((Dev->VirtIo->Revision < VIRTIO_SPEC_REVISION (1, 0, 0)) &&
+                      !Dev->RxMergeable) ?
                      sizeof (VIRTIO_NET_REQ) :
                      sizeof (VIRTIO_1_0_NET_REQ);
 
-  //
-  // For each incoming packet we must supply two descriptors:
-  // - the recipient for the virtio-net request header, plus
-  // - the recipient for the network data (which consists of Ethernet header
-  //   and Ethernet payload).
-  //
-  RxBufSize = VirtioNetReqSize +
-              (Dev->Snm.MediaHeaderSize + Dev->Snm.MaxPacketSize);
+  if (Dev->RxMergeable) {
+    //
+    // Each buffer takes a single descriptor, and the host writes the
+    // virtio-net request header to the start of the first buffer of a packet,
+    // followed by as much of the packet as fits. Limit the number of pending
+    // buffers if the queue is big.
+    //
+    RxBufSize       = VNET_RX_BUF_SIZE;
+    RxAlwaysPending = (UINT16)MIN (Dev->RxRing.QueueSize, VNET_MAX_RX_PENDING);
+  } else {
+    //
+    // For each incoming packet we must supply two descriptors:
+    // - the recipient for the virtio-net request header, plus
+    // - the recipient for the network data (which consists of Ethernet header
+    //   and Ethernet payload).
+    //
+    RxBufSize = VirtioNetReqSize +
+                (Dev->Snm.MediaHeaderSize + Dev->Snm.MaxPacketSize);
 
-  //
-  // Limit the number of pending RX packets if the queue is big. The division
-  // by two is due to the above "two descriptors per packet" trait.
-  //
-  RxAlwaysPending = (UINT16)MIN (Dev->RxRing.QueueSize / 2, VNET_MAX_PENDING);
+    //
+    // Limit the number of pending RX packets if the queue is big. The division
+    // by two is due to the above "two descriptors per packet" trait.
+    //
+    RxAlwaysPending = (UINT16)MIN (Dev->RxRing.QueueSize / 2, VNET_MAX_PENDING);
+  }
 
   //
   // The RxBuf is shared between guest and hypervisor, use
@@ -390,15 +446,25 @@ VirtioNetInitRx (
   // the host should not send interrupts, we'll poll in VirtioNetReceive()
   // and VirtioNetIsPacketAvailable().
   //
-  *Dev->RxRing.Avail.Flags = (UINT16)VRING_AVAIL_F_NO_INTERRUPT;
+  VirtioRingDisableInterrupts (&Dev->RxRing);
 
   //
-  // now set up a separate, two-part descriptor chain for each RX packet, and
-  // link each chain into (from) the available ring as well
+  // now set up a separate, two-part descriptor chain for each RX packet, or a
+  // single descriptor for each mergeable RX buffer, and link each chain into
+  // (from) the available ring as well
   //
   DescIdx            = 0;
   RxBufDeviceAddress = Dev->RxBufDeviceBase;
   for (PktIdx = 0; PktIdx < RxAlwaysPending; ++PktIdx) {
+    if (Dev->RxMergeable) {
+      Dev->RxRing.Avail.Ring[PktIdx]  = DescIdx;
+      Dev->RxRing.Desc[DescIdx].Addr  = RxBufDeviceAddress;
+      Dev->RxRing.Desc[DescIdx].Len   = (UINT32)RxBufSize;
+      Dev->RxRing.Desc[DescIdx].Flags = VRING_DESC_F_WRITE;
+      RxBufDeviceAddress             += Dev->RxRing.Desc[DescIdx++].Len;
+      continue;
+    }
+
     //
     // virtio-0.9.5, 2.4.1.2 Updating the Available Ring
     // invisible to the host until we update the Index Field
@@ -557,8 +623,9 @@ VirtioNetInitialize (
     !!(Features & VIRTIO_NET_F_STATUS)
     );
 
-  Features &= VIRTIO_NET_F_MAC | VIRTIO_NET_F_STATUS | VIRTIO_F_VERSION_1 |
-              VIRTIO_F_IOMMU_PLATFORM;
+  Features &= VIRTIO_NET_F_MAC | VIRTIO_NET_F_STATUS | VIRTIO_NET_F_MRG_RXBUF |
+              VIRTIO_F_VERSION_1 | VIRTIO_F_IOMMU_PLATFORM |
+              VIRTIO_F_RING_EVENT_IDX;
 
   //
   // In virtio-1.0, feature negotiation is expected to complete before queue
@@ -594,6 +661,10 @@ VirtioNetInitialize (
     goto ReleaseRxRing;
   }
 
+  Dev->RxRing.EventIdx = (BOOLEAN)((Features & VIRTIO_F_RING_EVENT_IDX) != 0);
+  Dev->TxRing.EventIdx = Dev->RxRing.EventIdx;
+  Dev->RxMergeable     = (BOOLEAN)((Features & VIRTIO_NET_F_MRG_RXBUF) != 0);
+
   //
   // step 5 -- keep only the features we want
   //
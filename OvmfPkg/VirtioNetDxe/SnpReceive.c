@@ -15,6 +15,93 @@
 
 #include "VirtioNet.h"
 
+/**
+  Return the address in the receive destination area of the buffer that an RX
+  descriptor points to.
+
+  @param[in] Dev      The VNET_DEV driver instance.
+  @param[in] DescIdx  The index of the descriptor.
+
+  @return  The address of the buffer.
+*/
+STATIC
+UINT8 *
+VirtioNetRxBufPtr (
+  IN VNET_DEV  *Dev,
+  IN UINT32    DescIdx
+  )
+{
+  return Dev->RxBuf + (UINTN)(Dev->RxRing.Desc[DescIdx].Addr -
+                              Dev->RxBufDeviceBase);
+}
+
+/**
+  Find the length of the packet that the host delivered at the next Used Ring
+  Element, merged from one or more receive buffers with
+  VIRTIO_NET_F_MRG_RXBUF.
+
+  @param[in]  Dev         The VNET_DEV driver instance.
+  @param[in]  RxCurUsed   The Used Index that the host has published.
+  @param[out] NumBuffers  The number of Used Ring Elements, from the next one,
+                          that the packet takes.
+  @param[out] RxLen       The length of the packet, without the virtio-net
+                          request header.
+
+  @retval EFI_SUCCESS       The whole packet is available.
+  @retval EFI_NOT_READY     The host hasn't published all buffers of the packet
+                            yet.
+  @retval EFI_DEVICE_ERROR  The packet is malformed. NumBuffers is the number
+                            of Used Ring Elements to drop.
+*/
+STATIC
+EFI_STATUS
+VirtioNetMergedRxLen (
+  IN  VNET_DEV  *Dev,
+  IN  UINT16    RxCurUsed,
+  OUT UINT16    *NumBuffers,
+  OUT UINT32    *RxLen
+  )
+{
+  UINT16              UsedElemIdx;
+  UINT32              DescIdx;
+  UINT16              BufIdx;
+  VIRTIO_1_0_NET_REQ  *RxReq;
+
+  UsedElemIdx = Dev->RxLastUsed % Dev->RxRing.QueueSize;
+  DescIdx     = Dev->RxRing.Used.UsedElem[UsedElemIdx].Id;
+  *RxLen      = Dev->RxRing.Used.UsedElem[UsedElemIdx].Len;
+  *NumBuffers = 1;
+
+  //
+  // the virtio-net request header must be complete, in the first buffer
+  //
+  if (*RxLen < sizeof *RxReq) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  RxReq = (VIRTIO_1_0_NET_REQ *)VirtioNetRxBufPtr (Dev, DescIdx);
+  if ((RxReq->NumBuffers == 0) || (RxReq->NumBuffers > Dev->RxRing.QueueSize)) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  //
+  // The host publishes the buffers of a packet together, but don't look past
+  // the ones it has.
+  //
+  if (RxReq->NumBuffers > (UINT16)(RxCurUsed - Dev->RxLastUsed)) {
+    return EFI_NOT_READY;
+  }
+
+  *NumBuffers = RxReq->NumBuffers;
+  *RxLen     -= sizeof *RxReq;
+  for (BufIdx = 1; BufIdx < *NumBuffers; ++BufIdx) {
+    UsedElemIdx = (UINT16)(Dev->RxLastUsed + BufIdx) % Dev->RxRing.QueueSize;
+    *RxLen     += Dev->RxRing.Used.UsedElem[UsedElemIdx].Len;
+  }
+
+  return EFI_SUCCESS;
+}
+
 /**
   Receives a packet from a network interface.
 
@@ -74,8 +161,12 @@ VirtioNetReceive (
   UINTN       OrigBufferSize;
   UINT8       *RxPtr;
   UINT16      AvailIdx;
+  UINT16      OldAvailIdx;
   EFI_STATUS  NotifyStatus;
-  UINTN       RxBufOffset;
+  UINT16      NumBuffers;
+  UINT16      BufIdx;
+  UINT32      BufLen;
+  UINT8       *Dest;
 
   if ((This == NULL) || (BufferSize == NULL) || (Buffer == NULL)) {
     return EFI_INVALID_PARAMETER;
@@ -109,16 +200,28 @@ VirtioNetReceive (
   UsedElemIdx = Dev->RxLastUsed % Dev->RxRing.QueueSize;
   DescIdx     = Dev->RxRing.Used.UsedElem[UsedElemIdx].Id;
   RxLen       = Dev->RxRing.Used.UsedElem[UsedElemIdx].Len;
+  NumBuffers  = 1;
 
-  //
-  // the virtio-net request header must be complete; we skip it
-  //
-  ASSERT (RxLen >= Dev->RxRing.Desc[DescIdx].Len);
-  RxLen -= Dev->RxRing.Desc[DescIdx].Len;
-  //
-  // the host must not have filled in more data than requested
-  //
-  ASSERT (RxLen <= Dev->RxRing.Desc[DescIdx + 1].Len);
+  if (Dev->RxMergeable) {
+    Status = VirtioNetMergedRxLen (Dev, RxCurUsed, &NumBuffers, &RxLen);
+    if (Status == EFI_NOT_READY) {
+      goto Exit;
+    }
+
+    if (EFI_ERROR (Status)) {
+      goto RecycleDesc; // drop malformed packet
+    }
+  } else {
+    //
+    // the virtio-net request header must be complete; we skip it
+    //
+    ASSERT (RxLen >= Dev->RxRing.Desc[DescIdx].Len);
+    RxLen -= Dev->RxRing.Desc[DescIdx].Len;
+    //
+    // the host must not have filled in more data than requested
+    //
+    ASSERT (RxLen <= Dev->RxRing.Desc[DescIdx + 1].Len);
+  }
 
   OrigBufferSize = *BufferSize;
   *BufferSize    = RxLen;
@@ -137,10 +240,38 @@ VirtioNetReceive (
     *HeaderSize = Dev->Snm.MediaHeaderSize;
   }
 
-  RxBufOffset = (UINTN)(Dev->RxRing.Desc[DescIdx + 1].Addr -
-                        Dev->RxBufDeviceBase);
-  RxPtr = Dev->RxBuf + RxBufOffset;
-  CopyMem (Buffer, RxPtr, RxLen);
+  if (Dev->RxMergeable) {
+    //
+    // Gather the packet from its buffers; the first one starts with the
+    // virtio-net request header.
+    //
+    Dest = Buffer;
+    for (BufIdx = 0; BufIdx < NumBuffers; ++BufIdx) {
+      UsedElemIdx = (UINT16)(Dev->RxLastUsed + BufIdx) % Dev->RxRing.QueueSize;
+      DescIdx     = Dev->RxRing.Used.UsedElem[UsedElemIdx].Id;
+      BufLen      = Dev->RxRing.Used.UsedElem[UsedElemIdx].Len;
+      RxPtr       = VirtioNetRxBufPtr (Dev, DescIdx);
+      //
+      // the host must not have filled in more data than requested
+      //
+      ASSERT (BufLen <= Dev->RxRing.Desc[DescIdx].Len);
+      if (BufIdx == 0) {
+        RxPtr  += sizeof (VIRTIO_1_0_NET_REQ);
+        BufLen -= sizeof (VIRTIO_1_0_NET_REQ);
+      }
+
+      CopyMem (Dest, RxPtr, BufLen);
+      Dest += BufLen;
+    }
+  } else {
+    CopyMem (Buffer, VirtioNetRxBufPtr (Dev, DescIdx + 1), RxLen);
+  }
+
+  //
+  // The media header is in the caller's buffer now, whichever receive buffers
+  // it arrived in.
+  //
+  RxPtr = Buffer;
 
   if (DestAddr != NULL) {
     CopyMem (DestAddr, RxPtr, SIZE_OF_VNET (Mac));
@@ -163,23 +294,30 @@ VirtioNetReceive (
   Status = EFI_SUCCESS;
 
 RecycleDesc:
-  ++Dev->RxLastUsed;
-
   //
   // virtio-0.9.5, 2.4.1 Supplying Buffers to The Device
   //
-  AvailIdx                                                   = *Dev->RxRing.Avail.Idx;
-  Dev->RxRing.Avail.Ring[AvailIdx++ % Dev->RxRing.QueueSize] =
-    (UINT16)DescIdx;
+  VirtioRingDisableInterrupts (&Dev->RxRing);
+  OldAvailIdx = *Dev->RxRing.Avail.Idx;
+  AvailIdx    = OldAvailIdx;
+  for (BufIdx = 0; BufIdx < NumBuffers; ++BufIdx) {
+    UsedElemIdx                                                = Dev->RxLastUsed++ % Dev->RxRing.QueueSize;
+    Dev->RxRing.Avail.Ring[AvailIdx++ % Dev->RxRing.QueueSize] =
+      (UINT16)Dev->RxRing.Used.UsedElem[UsedElemIdx].Id;
+  }
 
   MemoryFence ();
   *Dev->RxRing.Avail.Idx = AvailIdx;
 
-  MemoryFence ();
-  NotifyStatus = Dev->VirtIo->SetQueueNotify (Dev->VirtIo, VIRTIO_NET_Q_RX);
-  if (!EFI_ERROR (Status)) {
-    // earlier error takes precedence
-    Status = NotifyStatus;
+  //
+  // The host asks to be notified once it has run out of receive buffers.
+  //
+  if (VirtioRingNeedsNotify (&Dev->RxRing, OldAvailIdx)) {
+    NotifyStatus = Dev->VirtIo->SetQueueNotify (Dev->VirtIo, VIRTIO_NET_Q_RX);
+    if (!EFI_ERROR (Status)) {
+      // earlier error takes precedence
+      Status = NotifyStatus;
+    }
   }
 
 Exit:
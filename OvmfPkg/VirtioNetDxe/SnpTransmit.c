@@ -71,7 +71,6 @@ VirtioNetTransmit (
   EFI_STATUS            Status;
   UINT16                DescIdx;
   UINT16                AvailIdx;
-  EFI_PHYSICAL_ADDRESS  DeviceAddress;
 
   if ((This == NULL) || (BufferSize == 0) || (Buffer == NULL)) {
     return EFI_INVALID_PARAMETER;
@@ -142,39 +141,33 @@ VirtioNetTransmit (
     ASSERT ((UINTN)(Ptr - (UINT8 *)Buffer) == Dev->Snm.MediaHeaderSize);
   }
 
-  //
-  // Map the transmit buffer system physical address to device address.
-  //
-  Status = VirtioNetMapTxBuf (
-             Dev,
-             Buffer,
-             BufferSize,
-             &DeviceAddress
-             );
-  if (EFI_ERROR (Status)) {
-    Status = EFI_DEVICE_ERROR;
-    goto Exit;
-  }
-
   //
   // virtio-0.9.5, 2.4.1 Supplying Buffers to The Device
   //
-  DescIdx                            = Dev->TxFreeStack[Dev->TxCurPending++];
-  Dev->TxRing.Desc[DescIdx + 1].Addr = DeviceAddress;
-  Dev->TxRing.Desc[DescIdx + 1].Len  = (UINT32)BufferSize;
+  // Copy the packet to the bounce buffer slot of the descriptor chain, which
+  // the tail descriptor points to already, and remember the caller's buffer
+  // for VirtioNetGetStatus.
+  //
+  DescIdx = Dev->TxFreeStack[Dev->TxCurPending++];
+  CopyMem (Dev->TxBuf + (DescIdx / 2) * VNET_TX_SLOT_SIZE, Buffer, BufferSize);
+  Dev->TxBufOwner[DescIdx / 2]      = Buffer;
+  Dev->TxRing.Desc[DescIdx + 1].Len = (UINT32)BufferSize;
 
   //
   // the available index is never written by the host, we can read it back
   // without a barrier
   //
+  VirtioRingDisableInterrupts (&Dev->TxRing);
   AvailIdx                                                   = *Dev->TxRing.Avail.Idx;
   Dev->TxRing.Avail.Ring[AvailIdx++ % Dev->TxRing.QueueSize] = DescIdx;
 
   MemoryFence ();
   *Dev->TxRing.Avail.Idx = AvailIdx;
 
-  MemoryFence ();
-  Status = Dev->VirtIo->SetQueueNotify (Dev->VirtIo, VIRTIO_NET_Q_TX);
+  Status = EFI_SUCCESS;
+  if (VirtioRingNeedsNotify (&Dev->TxRing, (UINT16)(AvailIdx - 1))) {
+    Status = Dev->VirtIo->SetQueueNotify (Dev->VirtIo, VIRTIO_NET_Q_TX);
+  }
 
 Exit:
   gBS->RestoreTPL (OldTpl);
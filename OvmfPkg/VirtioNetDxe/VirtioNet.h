@@ -20,7 +20,6 @@
 #include <Protocol/DevicePath.h>
 #include <Protocol/DriverBinding.h>
 #include <Protocol/SimpleNetwork.h>
-#include <Library/OrderedCollectionLib.h>
 
 #define VNET_SIG  SIGNATURE_32 ('V', 'N', 'E', 'T')
 
@@ -29,6 +28,24 @@
 //
 #define VNET_MAX_PENDING  64
 
+//
+// size of the slot that each pending TX packet is copied to, in the bounce
+// buffer mapped by VirtioNetInitTx: a maximum size Ethernet frame, rounded up
+// to a cache line
+//
+#define VNET_TX_SLOT_SIZE  ALIGN_VALUE (14 + 1500, 64)
+
+//
+// with VIRTIO_NET_F_MRG_RXBUF: the size of each receive buffer, which the host
+// fills with as much of a packet as fits and merges with as many more buffers
+// as the packet needs, and the maximum number of buffers pending. The buffers
+// subdivide pages, so that none of them crosses a page boundary. A full size
+// frame takes two of them, like the fixed size buffers of the two-descriptor
+// chains, but a small one takes only one.
+//
+#define VNET_RX_BUF_SIZE     (EFI_PAGE_SIZE / 4)
+#define VNET_MAX_RX_PENDING  (2 * VNET_MAX_PENDING)
+
 //
 // State diagram:
 //
@@ -80,6 +97,7 @@ typedef struct {
   VRING                          RxRing;          // VirtioNetInitRing
   VOID                           *RxRingMap;      // VirtioRingMap and
                                                   // VirtioNetInitRing
+  BOOLEAN                        RxMergeable;     // VirtioNetInitialize
   UINT8                          *RxBuf;          // VirtioNetInitRx
   UINT16                         RxLastUsed;      // VirtioNetInitRx
   UINTN                          RxBufNrPages;    // VirtioNetInitRx
@@ -95,7 +113,10 @@ typedef struct {
   VIRTIO_1_0_NET_REQ             *TxSharedReq;     // VirtioNetInitTx
   VOID                           *TxSharedReqMap;  // VirtioNetInitTx
   UINT16                         TxLastUsed;       // VirtioNetInitTx
-  ORDERED_COLLECTION             *TxBufCollection; // VirtioNetInitTx
+  UINT8                          *TxBuf;           // VirtioNetInitTx
+  UINTN                          TxBufNrPages;     // VirtioNetInitTx
+  VOID                           *TxBufMap;        // VirtioNetInitTx
+  VOID                           **TxBufOwner;     // VirtioNetInitTx
 } VNET_DEV;
 
 //
@@ -275,41 +296,6 @@ VirtioNetUninitRing (
   IN     VOID      *RingMap
   );
 
-//
-// utility functions to map caller-supplied Tx buffer system physical address
-// to a device address and vice versa
-//
-EFI_STATUS
-EFIAPI
-VirtioNetMapTxBuf (
-  IN  VNET_DEV              *Dev,
-  IN  VOID                  *Buffer,
-  IN  UINTN                 NumberOfBytes,
-  OUT EFI_PHYSICAL_ADDRESS  *DeviceAddress
-  );
-
-EFI_STATUS
-EFIAPI
-VirtioNetUnmapTxBuf (
-  IN  VNET_DEV              *Dev,
-  OUT VOID                  **Buffer,
-  IN  EFI_PHYSICAL_ADDRESS  DeviceAddress
-  );
-
-INTN
-EFIAPI
-VirtioNetTxBufMapInfoCompare (
-  IN CONST VOID  *UserStruct1,
-  IN CONST VOID  *UserStruct2
-  );
-
-INTN
-EFIAPI
-VirtioNetTxBufDeviceAddressCompare (
-  IN CONST VOID  *StandaloneKey,
-  IN CONST VOID  *UserStruct
-  );
-
 //
 // event callbacks
 //
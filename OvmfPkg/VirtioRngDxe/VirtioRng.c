@@ -16,6 +16,7 @@
 
 **/
 
+#include <Library/BaseLib.h>
 #include <Library/BaseMemoryLib.h>
 #include <Library/DebugLib.h>
 #include <Library/MemoryAllocationLib.h>
@@ -89,45 +90,28 @@ VirtioRngGetInfo (
 }
 
 /**
-  Produces and returns an RNG value using either the default or specified RNG
-  algorithm.
+  Read entropy from the device directly into a bounce buffer, for requests that
+  do not fit into a half of the entropy pool.
 
-  @param[in]  This                    A pointer to the EFI_RNG_PROTOCOL
-                                      instance.
-  @param[in]  RNGAlgorithm            A pointer to the EFI_RNG_ALGORITHM that
-                                      identifies the RNG algorithm to use. May
-                                      be NULL in which case the function will
-                                      use its default RNG algorithm.
-  @param[in]  RNGValueLength          The length in bytes of the memory buffer
-                                      pointed to by RNGValue. The driver shall
-                                      return exactly this numbers of bytes.
-  @param[out] RNGValue                A caller-allocated memory buffer filled
-                                      by the driver with the resulting RNG
-                                      value.
+  The caller is responsible for having reaped the refill of the pool, if any.
 
-  @retval EFI_SUCCESS                 The RNG value was returned successfully.
-  @retval EFI_UNSUPPORTED             The algorithm specified by RNGAlgorithm
-                                      is not supported by this driver.
-  @retval EFI_DEVICE_ERROR            An RNG value could not be retrieved due
-                                      to a hardware or firmware error.
-  @retval EFI_NOT_READY               There is not enough random data available
-                                      to satisfy the length requested by
-                                      RNGValueLength.
-  @retval EFI_INVALID_PARAMETER       RNGValue is NULL or RNGValueLength is
-                                      zero.
+  @param[in,out] Dev             The virtio-rng device.
+  @param[in]     RNGValueLength  The number of bytes to read.
+  @param[out]    RNGValue        The buffer to fill.
+
+  @retval EFI_SUCCESS           RNGValue has been filled.
+  @retval EFI_OUT_OF_RESOURCES  The bounce buffer could not be allocated.
+  @retval EFI_DEVICE_ERROR      The device failed the request.
 
 **/
 STATIC
 EFI_STATUS
-EFIAPI
-VirtioRngGetRNG (
-  IN EFI_RNG_PROTOCOL   *This,
-  IN EFI_RNG_ALGORITHM  *RNGAlgorithm  OPTIONAL,
-  IN UINTN              RNGValueLength,
-  OUT UINT8             *RNGValue
+VirtioRngReadDirect (
+  IN OUT VIRTIO_RNG_DEV  *Dev,
+  IN     UINTN           RNGValueLength,
+  OUT    UINT8           *RNGValue
   )
 {
-  VIRTIO_RNG_DEV        *Dev;
   DESC_INDICES          Indices;
   volatile UINT8        *Buffer;
   UINTN                 Index;
@@ -137,28 +121,11 @@ VirtioRngGetRNG (
   EFI_PHYSICAL_ADDRESS  DeviceAddress;
   VOID                  *Mapping;
 
-  if ((This == NULL) || (RNGValueLength == 0) || (RNGValue == NULL)) {
-    return EFI_INVALID_PARAMETER;
-  }
-
-  //
-  // We only support the raw algorithm, so reject requests for anything else
-  //
-  if ((RNGAlgorithm != NULL) &&
-      !CompareGuid (RNGAlgorithm, &gEfiRngAlgorithmRaw))
-  {
-    return EFI_UNSUPPORTED;
-  }
+  ASSERT (!Dev->RefillPending);
 
   Buffer = (volatile UINT8 *)AllocatePool (RNGValueLength);
   if (Buffer == NULL) {
-    return EFI_DEVICE_ERROR;
-  }
-
-  Dev = VIRTIO_ENTROPY_SOURCE_FROM_RNG (This);
-  if (!Dev->Ready) {
-    DEBUG ((DEBUG_INFO, "%a: not ready\n", __func__));
-    return EFI_DEVICE_ERROR;
+    return EFI_OUT_OF_RESOURCES;
   }
 
   //
@@ -216,6 +183,7 @@ VirtioRngGetRNG (
 
   for (Index = 0; Index < RNGValueLength; Index++) {
     RNGValue[Index] = Buffer[Index];
+    Buffer[Index]   = 0;
   }
 
   Status = EFI_SUCCESS;
@@ -234,6 +202,253 @@ FreeBuffer:
   return Status;
 }
 
+/**
+  Make the spare half of the entropy pool available to the device, without
+  waiting for it to be filled.
+
+  On a ring with a single descriptor, the spare half is only filled when it is
+  needed, by VirtioRngNextHalf().
+
+  @param[in,out] Dev  The virtio-rng device. The spare half must be empty.
+
+  @retval EFI_SUCCESS  The refill has been submitted, or is left for later.
+  @return              Error codes from VirtIo->SetQueueNotify().
+
+**/
+STATIC
+EFI_STATUS
+VirtioRngSubmitRefill (
+  IN OUT VIRTIO_RNG_DEV  *Dev
+  )
+{
+  DESC_INDICES  Indices;
+  UINT8         Spare;
+
+  Spare = (UINT8)(Dev->PoolHalf ^ 1);
+  ASSERT (!Dev->RefillPending);
+  ASSERT (Dev->PoolLength[Spare] == 0);
+
+  if (Dev->Ring.QueueSize < 2) {
+    return EFI_SUCCESS;
+  }
+
+  //
+  // VirtioPrepare() builds its chains at descriptor #0; the refill stays clear
+  // of it, at descriptor #1.
+  //
+  Indices.HeadDescIdx = 1;
+  Indices.NextDescIdx = Indices.HeadDescIdx;
+  VirtioAppendDesc (
+    &Dev->Ring,
+    Dev->PoolAddr + Spare * VIRTIO_RNG_POOL_HALF_SIZE,
+    VIRTIO_RNG_POOL_HALF_SIZE,
+    VRING_DESC_F_WRITE,
+    &Indices
+    );
+
+  Dev->RefillPending = TRUE;
+  return VirtioSubmit (Dev->VirtIo, 0, &Dev->Ring, &Indices.HeadDescIdx, 1);
+}
+
+/**
+  Wait for the refill of the spare half of the entropy pool, if one is in
+  flight, and record how many bytes the device has put into it.
+
+  @param[in,out] Dev  The virtio-rng device.
+
+**/
+STATIC
+VOID
+VirtioRngReapRefill (
+  IN OUT VIRTIO_RNG_DEV  *Dev
+  )
+{
+  UINT16  UsedDescIdx;
+  UINT32  Len;
+
+  if (!Dev->RefillPending) {
+    return;
+  }
+
+  //
+  // Requests through VirtioFlush() are only sent with no refill in flight, so
+  // the refill is the next chain that the host uses.
+  //
+  VirtioWaitUsed (&Dev->Ring, &UsedDescIdx, &Len);
+  ASSERT (UsedDescIdx == 1);
+  ASSERT (Len <= VIRTIO_RNG_POOL_HALF_SIZE);
+
+  Dev->PoolLength[Dev->PoolHalf ^ 1] = MIN (Len, VIRTIO_RNG_POOL_HALF_SIZE);
+  Dev->RefillPending                 = FALSE;
+}
+
+/**
+  Switch to serving from the spare half of the entropy pool, filling it first
+  if necessary, and submit the refill of the half that has been used up.
+
+  @param[in,out] Dev  The virtio-rng device.
+
+  @retval EFI_SUCCESS       The spare half is now served.
+  @retval EFI_DEVICE_ERROR  The device failed a request.
+
+**/
+STATIC
+EFI_STATUS
+VirtioRngNextHalf (
+  IN OUT VIRTIO_RNG_DEV  *Dev
+  )
+{
+  DESC_INDICES  Indices;
+  UINT8         Spare;
+  UINT32        Len;
+  EFI_STATUS    Status;
+
+  VirtioRngReapRefill (Dev);
+
+  Spare = (UINT8)(Dev->PoolHalf ^ 1);
+  if (Dev->PoolLength[Spare] == 0) {
+    VirtioPrepare (&Dev->Ring, &Indices);
+    VirtioAppendDesc (
+      &Dev->Ring,
+      Dev->PoolAddr + Spare * VIRTIO_RNG_POOL_HALF_SIZE,
+      VIRTIO_RNG_POOL_HALF_SIZE,
+      VRING_DESC_F_WRITE,
+      &Indices
+      );
+
+    Status = VirtioFlush (Dev->VirtIo, 0, &Dev->Ring, &Indices, &Len);
+    if (EFI_ERROR (Status)) {
+      return EFI_DEVICE_ERROR;
+    }
+
+    ASSERT (Len > 0);
+    ASSERT (Len <= VIRTIO_RNG_POOL_HALF_SIZE);
+    Dev->PoolLength[Spare] = MIN (Len, VIRTIO_RNG_POOL_HALF_SIZE);
+  }
+
+  Dev->PoolLength[Dev->PoolHalf] = 0;
+  Dev->PoolHalf                  = Spare;
+  Dev->PoolOffset                = 0;
+
+  Status = VirtioRngSubmitRefill (Dev);
+  if (EFI_ERROR (Status)) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Produces and returns an RNG value using either the default or specified RNG
+  algorithm.
+
+  @param[in]  This                    A pointer to the EFI_RNG_PROTOCOL
+                                      instance.
+  @param[in]  RNGAlgorithm            A pointer to the EFI_RNG_ALGORITHM that
+                                      identifies the RNG algorithm to use. May
+                                      be NULL in which case the function will
+                                      use its default RNG algorithm.
+  @param[in]  RNGValueLength          The length in bytes of the memory buffer
+                                      pointed to by RNGValue. The driver shall
+                                      return exactly this numbers of bytes.
+  @param[out] RNGValue                A caller-allocated memory buffer filled
+                                      by the driver with the resulting RNG
+                                      value.
+
+  @retval EFI_SUCCESS                 The RNG value was returned successfully.
+  @retval EFI_UNSUPPORTED             The algorithm specified by RNGAlgorithm
+                                      is not supported by this driver.
+  @retval EFI_DEVICE_ERROR            An RNG value could not be retrieved due
+                                      to a hardware or firmware error.
+  @retval EFI_NOT_READY               There is not enough random data available
+                                      to satisfy the length requested by
+                                      RNGValueLength.
+  @retval EFI_INVALID_PARAMETER       RNGValue is NULL or RNGValueLength is
+                                      zero.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+VirtioRngGetRNG (
+  IN EFI_RNG_PROTOCOL   *This,
+  IN EFI_RNG_ALGORITHM  *RNGAlgorithm  OPTIONAL,
+  IN UINTN              RNGValueLength,
+  OUT UINT8             *RNGValue
+  )
+{
+  VIRTIO_RNG_DEV  *Dev;
+  EFI_TPL         OldTpl;
+  UINTN           Index;
+  UINTN           Chunk;
+  UINT8           *Served;
+  EFI_STATUS      Status;
+
+  if ((This == NULL) || (RNGValueLength == 0) || (RNGValue == NULL)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  //
+  // We only support the raw algorithm, so reject requests for anything else
+  //
+  if ((RNGAlgorithm != NULL) &&
+      !CompareGuid (RNGAlgorithm, &gEfiRngAlgorithmRaw))
+  {
+    return EFI_UNSUPPORTED;
+  }
+
+  Dev = VIRTIO_ENTROPY_SOURCE_FROM_RNG (This);
+  if (!Dev->Ready) {
+    DEBUG ((DEBUG_INFO, "%a: not ready\n", __func__));
+    return EFI_DEVICE_ERROR;
+  }
+
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+
+  if (RNGValueLength > VIRTIO_RNG_POOL_HALF_SIZE) {
+    //
+    // The refill stays in the pool, for the requests to come.
+    //
+    VirtioRngReapRefill (Dev);
+    Status = VirtioRngReadDirect (Dev, RNGValueLength, RNGValue);
+    goto RestoreTpl;
+  }
+
+  //
+  // Serve the request from the pool. Every byte is served only once, and is
+  // wiped as it is served.
+  //
+  Index = 0;
+  while (Index < RNGValueLength) {
+    if (Dev->PoolOffset == Dev->PoolLength[Dev->PoolHalf]) {
+      Status = VirtioRngNextHalf (Dev);
+      if (EFI_ERROR (Status)) {
+        Dev->Ready = FALSE;
+        goto RestoreTpl;
+      }
+
+      continue;
+    }
+
+    Chunk = MIN (
+              RNGValueLength - Index,
+              Dev->PoolLength[Dev->PoolHalf] - Dev->PoolOffset
+              );
+    Served = Dev->Pool + Dev->PoolHalf * VIRTIO_RNG_POOL_HALF_SIZE +
+             Dev->PoolOffset;
+    CopyMem (RNGValue + Index, Served, Chunk);
+    ZeroMem (Served, Chunk);
+    Dev->PoolOffset += (UINT32)Chunk;
+    Index           += Chunk;
+  }
+
+  Status = EFI_SUCCESS;
+
+RestoreTpl:
+  gBS->RestoreTPL (OldTpl);
+  return Status;
+}
+
 STATIC
 EFI_STATUS
 EFIAPI
@@ -373,13 +588,53 @@ VirtioRngInit (
     }
   }
 
+  //
+  // Allocate and map the entropy pool, for bus master common buffer
+  // operation.
+  //
+  Status = Dev->VirtIo->AllocateSharedPages (
+                          Dev->VirtIo,
+                          VIRTIO_RNG_POOL_PAGES,
+                          (VOID **)&Dev->Pool
+                          );
+  if (EFI_ERROR (Status)) {
+    goto UnmapQueue;
+  }
+
+  Status = VirtioMapAllBytesInSharedBuffer (
+             Dev->VirtIo,
+             VirtioOperationBusMasterCommonBuffer,
+             Dev->Pool,
+             EFI_PAGES_TO_SIZE (VIRTIO_RNG_POOL_PAGES),
+             &Dev->PoolAddr,
+             &Dev->PoolMap
+             );
+  if (EFI_ERROR (Status)) {
+    goto FreePool;
+  }
+
+  Dev->PoolLength[0] = 0;
+  Dev->PoolLength[1] = 0;
+  Dev->PoolOffset    = 0;
+  Dev->PoolHalf      = 0;
+  Dev->RefillPending = FALSE;
+
   //
   // step 6 -- initialization complete
   //
   NextDevStat |= VSTAT_DRIVER_OK;
   Status       = Dev->VirtIo->SetDeviceStatus (Dev->VirtIo, NextDevStat);
   if (EFI_ERROR (Status)) {
-    goto UnmapQueue;
+    goto UnmapPool;
+  }
+
+  //
+  // Start filling the pool, so that the first GetRNG() call finds it ready.
+  //
+  Status = VirtioRngSubmitRefill (Dev);
+  if (EFI_ERROR (Status)) {
+    Dev->VirtIo->SetDeviceStatus (Dev->VirtIo, 0);
+    goto UnmapPool;
   }
 
   //
@@ -391,6 +646,12 @@ VirtioRngInit (
 
   return EFI_SUCCESS;
 
+UnmapPool:
+  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->PoolMap);
+
+FreePool:
+  Dev->VirtIo->FreeSharedPages (Dev->VirtIo, VIRTIO_RNG_POOL_PAGES, Dev->Pool);
+
 UnmapQueue:
   Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->RingMap);
 
@@ -422,6 +683,13 @@ VirtioRngUninit (
   //
   Dev->Ready = FALSE;
   Dev->VirtIo->SetDeviceStatus (Dev->VirtIo, 0);
+
+  //
+  // Don't leave unserved entropy behind.
+  //
+  ZeroMem (Dev->Pool, EFI_PAGES_TO_SIZE (VIRTIO_RNG_POOL_PAGES));
+  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->PoolMap);
+  Dev->VirtIo->FreeSharedPages (Dev->VirtIo, VIRTIO_RNG_POOL_PAGES, Dev->Pool);
   Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->RingMap);
 
   VirtioRingUninit (Dev->VirtIo, &Dev->Ring);
@@ -452,6 +720,12 @@ VirtioRngExitBoot (
   Dev        = Context;
   Dev->Ready = FALSE;
   Dev->VirtIo->SetDeviceStatus (Dev->VirtIo, 0);
+
+  //
+  // The entropy pool is in EfiBootServicesData type memory as well; don't
+  // hand its unserved contents over to the OS.
+  //
+  ZeroMem (Dev->Pool, EFI_PAGES_TO_SIZE (VIRTIO_RNG_POOL_PAGES));
 }
 
 //
@@ -19,6 +19,13 @@
 
 #define VIRTIO_RNG_SIG  SIGNATURE_32 ('V', 'R', 'N', 'G')
 
+//
+// The entropy pool consists of two halves. GetRNG() serves small requests from
+// one half, while the device refills the other one.
+//
+#define VIRTIO_RNG_POOL_HALF_SIZE  EFI_PAGE_SIZE
+#define VIRTIO_RNG_POOL_PAGES      2
+
 typedef struct {
   //
   // Parts of this structure are initialized / torn down in various functions
@@ -34,6 +41,13 @@ typedef struct {
   EFI_RNG_PROTOCOL          Rng;            // VirtioRngInit        1
   VOID                      *RingMap;       // VirtioRingMap        2
   BOOLEAN                   Ready;
+  UINT8                     *Pool;          // VirtioRngInit        1
+  EFI_PHYSICAL_ADDRESS      PoolAddr;       // VirtioRngInit        1
+  VOID                      *PoolMap;       // VirtioRngInit        1
+  UINT32                    PoolLength[2];  // VirtioRngInit        1
+  UINT32                    PoolOffset;     // VirtioRngInit        1
+  UINT8                     PoolHalf;       // VirtioRngInit        1
+  BOOLEAN                   RefillPending;  // VirtioRngInit        1
 } VIRTIO_RNG_DEV;
 
 #define VIRTIO_ENTROPY_SOURCE_FROM_RNG(RngPointer) \
@@ -7,16 +7,16 @@
 
   - No hotplug / hot-unplug.
 
-  - Although EFI_EXT_SCSI_PASS_THRU_PROTOCOL.PassThru() could be a good match
-    for multiple in-flight virtio-scsi requests, we stick to synchronous
-    requests for now.
+  - EFI_EXT_SCSI_PASS_THRU_PROTOCOL.PassThru() submits a request with an
+    event without waiting for it, and a timer completes it. Up to
+    VSCSI_MAX_REQUESTS requests are in flight.
 
   - Timeouts are not supported for EFI_EXT_SCSI_PASS_THRU_PROTOCOL.PassThru().
 
   - Only one channel is supported. (At the time of this writing, host-side
     virtio-scsi supports a single channel too.)
 
-  - Only one request queue is used (for the one synchronous request).
+  - Only one request queue is used.
 
   - The ResetChannel() and ResetTargetLun() functions of
     EFI_EXT_SCSI_PASS_THRU_PROTOCOL are not supported (which is allowed by the
@@ -411,83 +411,225 @@ ReportHostAdapterError (
   return EFI_DEVICE_ERROR;
 }
 
-//
-// The next seven functions implement EFI_EXT_SCSI_PASS_THRU_PROTOCOL
-// for the virtio-scsi HBA. Refer to UEFI Spec 2.3.1 + Errata C, sections
-// - 14.1 SCSI Driver Model Overview,
-// - 14.7 Extended SCSI Pass Thru Protocol.
-//
+/**
 
-EFI_STATUS
+  Release the data buffers of a request: copy the data that the host wrote
+  from the intermediate buffer to the caller, unmap both buffers, and free the
+  intermediate one.
+
+  @param[in] Dev       The virtio-scsi host device.
+
+  @param[in] Request   The request slot.
+
+  @param[in] CopyData  TRUE iff the data the host wrote is to be copied to
+                       Request->Packet.
+
+**/
+STATIC
+VOID
+ReleaseDataBuffers (
+  IN VSCSI_DEV      *Dev,
+  IN VSCSI_REQUEST  *Request,
+  IN BOOLEAN        CopyData
+  )
+{
+  //
+  // If virtio request was successful and it was a CPU read request then we
+  // have used an intermediate buffer. Copy the data from intermediate buffer
+  // to the final buffer.
+  //
+  if (CopyData && (Request->InDataBuffer != NULL)) {
+    CopyMem (
+      Request->Packet->InDataBuffer,
+      Request->InDataBuffer,
+      Request->Packet->InTransferLength
+      );
+  }
+
+  if (Request->OutDataBufferIsMapped) {
+    Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Request->OutDataMapping);
+  }
+
+  if (Request->InDataBuffer != NULL) {
+    Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Request->InDataMapping);
+    Dev->VirtIo->FreeSharedPages (
+                   Dev->VirtIo,
+                   Request->InDataNumPages,
+                   Request->InDataBuffer
+                   );
+  }
+
+  Request->OutDataBufferIsMapped = FALSE;
+  Request->InDataBuffer          = NULL;
+}
+
+/**
+
+  Complete the requests that the host has processed.
+
+  The response of each request is parsed into its packet. A request with an
+  event is released, and its event signaled. A request without an event is
+  marked done, for WaitRequest() to release, unless its submission failed, in
+  which case nobody waits for it, and its packet is not touched.
+
+  The caller must hold TPL_NOTIFY.
+
+  @param[in] Dev  The virtio-scsi host device.
+
+**/
+STATIC
+VOID
+ReapRequests (
+  IN VSCSI_DEV  *Dev
+  )
+{
+  VSCSI_REQUEST  *Request;
+  UINT16         HeadDescIdx;
+  UINT16         Index;
+
+  while (VirtioReapUsed (&Dev->Ring, &HeadDescIdx, NULL)) {
+    Index = (UINT16)(HeadDescIdx / Dev->DescPerRequest);
+    ASSERT (HeadDescIdx % Dev->DescPerRequest == 0);
+    ASSERT (Index < Dev->NumRequests);
+
+    Request = &Dev->Requests[Index];
+    ASSERT (Request->InUse && !Request->Done);
+
+    Dev->InFlight--;
+
+    if (Request->Orphaned) {
+      ReleaseDataBuffers (Dev, Request, FALSE);
+      Request->InUse = FALSE;
+      continue;
+    }
+
+    Request->Status = ParseResponse (Request->Packet, &Dev->Shared->Response[Index]);
+    ReleaseDataBuffers (Dev, Request, TRUE);
+
+    if (Request->Event != NULL) {
+      Request->InUse = FALSE;
+      gBS->SignalEvent (Request->Event);
+    } else {
+      Request->Done = TRUE;
+    }
+  }
+}
+
+/**
+
+  Check for a free request slot, reaping completed requests if all are in use.
+
+  The caller must hold TPL_NOTIFY.
+
+  @param[in] Context  The virtio-scsi host device.
+
+  @retval TRUE   A request slot is free.
+  @retval FALSE  All requests are in flight.
+
+**/
+STATIC
+BOOLEAN
 EFIAPI
-VirtioScsiPassThru (
-  IN     EFI_EXT_SCSI_PASS_THRU_PROTOCOL             *This,
-  IN     UINT8                                       *Target,
+IsRequestSlotFree (
+  IN VOID  *Context
+  )
+{
+  VSCSI_DEV  *Dev;
+  UINT16     Index;
+
+  Dev = Context;
+  ReapRequests (Dev);
+  for (Index = 0; Index < Dev->NumRequests; Index++) {
+    if (!Dev->Requests[Index].InUse) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/**
+
+  Translate an Extended SCSI Pass Thru Protocol packet to a virtio-scsi
+  request in the slot of a free request, and push it to the host, without
+  waiting for the response.
+
+  The caller must hold TPL_NOTIFY. If all requests are in flight, the function
+  polls for the completion of one of them.
+
+  @param[in] Dev          The virtio-scsi host device the packet targets.
+
+  @param[in] Target       The SCSI target controlled by the virtio-scsi host
+                          device.
+
+  @param[in] Lun          The Logical Unit Number under the SCSI target.
+
+  @param[in out] Packet   The Extended SCSI Pass Thru Protocol packet. On
+                          failure this parameter relays error contents.
+
+  @param[in] Event        The event to signal on completion, or NULL if the
+                          caller waits for the request with WaitRequest().
+
+  @param[out] Slot        The request slot the request was submitted in, on
+                          success.
+
+  @retval EFI_SUCCESS  The request was submitted.
+
+  @return              Otherwise, the request was not submitted. Status codes
+                       are meant for direct forwarding by the
+                       EFI_EXT_SCSI_PASS_THRU_PROTOCOL.PassThru()
+                       implementation.
+
+**/
+STATIC
+EFI_STATUS
+SubmitRequest (
+  IN     VSCSI_DEV                                   *Dev,
+  IN     UINT16                                      Target,
   IN     UINT64                                      Lun,
   IN OUT EFI_EXT_SCSI_PASS_THRU_SCSI_REQUEST_PACKET  *Packet,
-  IN     EFI_EVENT                                   Event   OPTIONAL
+  IN     EFI_EVENT                                   Event,
+  OUT    UINT16                                      *Slot
   )
 {
-  VSCSI_DEV                  *Dev;
-  UINT16                     TargetValue;
-  EFI_STATUS                 Status;
-  volatile VIRTIO_SCSI_REQ   *Request;
+  VSCSI_REQUEST              *Request;
+  volatile VIRTIO_SCSI_REQ   *Header;
   volatile VIRTIO_SCSI_RESP  *Response;
-  VOID                       *ResponseBuffer;
   DESC_INDICES               Indices;
-  VOID                       *RequestMapping;
-  VOID                       *ResponseMapping;
-  VOID                       *InDataMapping;
-  VOID                       *OutDataMapping;
-  EFI_PHYSICAL_ADDRESS       RequestDeviceAddress;
-  EFI_PHYSICAL_ADDRESS       ResponseDeviceAddress;
   EFI_PHYSICAL_ADDRESS       InDataDeviceAddress;
   EFI_PHYSICAL_ADDRESS       OutDataDeviceAddress;
-  VOID                       *InDataBuffer;
-  UINTN                      InDataNumPages;
-  BOOLEAN                    OutDataBufferIsMapped;
+  UINT16                     Index;
+  EFI_STATUS                 Status;
 
   //
-  // Set InDataMapping,OutDataMapping,InDataDeviceAddress and OutDataDeviceAddress to
-  // suppress incorrect compiler/analyzer warnings.
+  // Set InDataDeviceAddress and OutDataDeviceAddress to suppress incorrect
+  // compiler/analyzer warnings.
   //
-  InDataMapping        = NULL;
-  OutDataMapping       = NULL;
   InDataDeviceAddress  = 0;
   OutDataDeviceAddress = 0;
 
-  Request = AllocateZeroPool (sizeof (*Request));
-  if (Request == NULL) {
-    return EFI_OUT_OF_RESOURCES;
+  //
+  // Find a free request slot, reaping completed requests until there is one.
+  //
+  VirtioPoll (IsRequestSlotFree, Dev);
+  for (Index = 0; Dev->Requests[Index].InUse; Index++) {
   }
 
-  Dev = VIRTIO_SCSI_FROM_PASS_THRU (This);
-  CopyMem (&TargetValue, Target, sizeof TargetValue);
-
-  InDataBuffer          = NULL;
-  OutDataBufferIsMapped = FALSE;
-  InDataNumPages        = 0;
+  Request  = &Dev->Requests[Index];
+  Header   = &Dev->Shared->Request[Index];
+  Response = &Dev->Shared->Response[Index];
 
-  Status = PopulateRequest (Dev, TargetValue, Lun, Packet, Request);
+  ZeroMem ((VOID *)Header, sizeof (*Header));
+  Status = PopulateRequest (Dev, Target, Lun, Packet, Header);
   if (EFI_ERROR (Status)) {
-    goto FreeScsiRequest;
+    return Status;
   }
 
-  //
-  // Map the virtio-scsi Request header buffer
-  //
-  Status = VirtioMapAllBytesInSharedBuffer (
-             Dev->VirtIo,
-             VirtioOperationBusMasterRead,
-             (VOID *)Request,
-             sizeof (*Request),
-             &RequestDeviceAddress,
-             &RequestMapping
-             );
-  if (EFI_ERROR (Status)) {
-    Status = ReportHostAdapterError (Packet);
-    goto FreeScsiRequest;
-  }
+  Request->Packet                = Packet;
+  Request->Event                 = Event;
+  Request->InDataBuffer          = NULL;
+  Request->InDataNumPages        = 0;
+  Request->OutDataBufferIsMapped = FALSE;
 
   //
   // Map the input buffer
@@ -508,30 +650,35 @@ VirtioScsiPassThru (
     // the Virtio request is successful then we copy the data from temporary
     // buffer into Packet->InDataBuffer.
     //
-    InDataNumPages = EFI_SIZE_TO_PAGES ((UINTN)Packet->InTransferLength);
-    Status         = Dev->VirtIo->AllocateSharedPages (
-                                    Dev->VirtIo,
-                                    InDataNumPages,
-                                    &InDataBuffer
-                                    );
+    Request->InDataNumPages = EFI_SIZE_TO_PAGES ((UINTN)Packet->InTransferLength);
+    Status                  = Dev->VirtIo->AllocateSharedPages (
+                                             Dev->VirtIo,
+                                             Request->InDataNumPages,
+                                             &Request->InDataBuffer
+                                             );
     if (EFI_ERROR (Status)) {
-      Status = ReportHostAdapterError (Packet);
-      goto UnmapRequestBuffer;
+      Request->InDataBuffer = NULL;
+      return ReportHostAdapterError (Packet);
     }
 
-    ZeroMem (InDataBuffer, Packet->InTransferLength);
+    ZeroMem (Request->InDataBuffer, Packet->InTransferLength);
 
     Status = VirtioMapAllBytesInSharedBuffer (
                Dev->VirtIo,
                VirtioOperationBusMasterCommonBuffer,
-               InDataBuffer,
+               Request->InDataBuffer,
                Packet->InTransferLength,
                &InDataDeviceAddress,
-               &InDataMapping
+               &Request->InDataMapping
                );
     if (EFI_ERROR (Status)) {
-      Status = ReportHostAdapterError (Packet);
-      goto FreeInDataBuffer;
+      Dev->VirtIo->FreeSharedPages (
+                     Dev->VirtIo,
+                     Request->InDataNumPages,
+                     Request->InDataBuffer
+                     );
+      Request->InDataBuffer = NULL;
+      return ReportHostAdapterError (Packet);
     }
   }
 
@@ -545,33 +692,16 @@ VirtioScsiPassThru (
                Packet->OutDataBuffer,
                Packet->OutTransferLength,
                &OutDataDeviceAddress,
-               &OutDataMapping
+               &Request->OutDataMapping
                );
     if (EFI_ERROR (Status)) {
-      Status = ReportHostAdapterError (Packet);
-      goto UnmapInDataBuffer;
+      ReleaseDataBuffers (Dev, Request, FALSE);
+      return ReportHostAdapterError (Packet);
     }
 
-    OutDataBufferIsMapped = TRUE;
+    Request->OutDataBufferIsMapped = TRUE;
   }
 
-  //
-  // Response header is bi-direction (we preset with host status and expect
-  // the device to update it). Allocate a response buffer which can be mapped
-  // to access equally by both processor and device.
-  //
-  Status = Dev->VirtIo->AllocateSharedPages (
-                          Dev->VirtIo,
-                          EFI_SIZE_TO_PAGES (sizeof *Response),
-                          &ResponseBuffer
-                          );
-  if (EFI_ERROR (Status)) {
-    Status = ReportHostAdapterError (Packet);
-    goto UnmapOutDataBuffer;
-  }
-
-  Response = ResponseBuffer;
-
   ZeroMem ((VOID *)Response, sizeof (*Response));
 
   //
@@ -579,38 +709,26 @@ VirtioScsiPassThru (
   //
   Response->Response = VIRTIO_SCSI_S_FAILURE;
 
-  //
-  // Map the response buffer with BusMasterCommonBuffer so that response
-  // buffer can be accessed by both host and device.
-  //
-  Status = VirtioMapAllBytesInSharedBuffer (
-             Dev->VirtIo,
-             VirtioOperationBusMasterCommonBuffer,
-             ResponseBuffer,
-             sizeof (*Response),
-             &ResponseDeviceAddress,
-             &ResponseMapping
-             );
-  if (EFI_ERROR (Status)) {
-    Status = ReportHostAdapterError (Packet);
-    goto FreeResponseBuffer;
-  }
-
-  VirtioPrepare (&Dev->Ring, &Indices);
+  Request->InUse    = TRUE;
+  Request->Done     = FALSE;
+  Request->Orphaned = FALSE;
 
   //
-  // ensured by VirtioScsiInit() -- this predicate, in combination with the
-  // lock-step progress, ensures we don't have to track free descriptors.
+  // Each request slot owns Dev->DescPerRequest descriptors, so the chains of
+  // the requests in flight never overlap. An indirect table is filled from its
+  // start.
   //
-  ASSERT (Dev->Ring.QueueSize >= 4);
+  Indices.HeadDescIdx = (UINT16)(Index * Dev->DescPerRequest);
+  Indices.NextDescIdx = (Dev->Ring.IndirectBase != NULL) ? 0 : Indices.HeadDescIdx;
 
   //
   // enqueue Request
   //
   VirtioAppendDesc (
     &Dev->Ring,
-    RequestDeviceAddress,
-    sizeof (*Request),
+    Dev->SharedAddress + OFFSET_OF (VSCSI_SHARED, Request) +
+    Index * sizeof (VIRTIO_SCSI_REQ),
+    sizeof (*Header),
     VRING_DESC_F_NEXT,
     &Indices
     );
@@ -633,8 +751,9 @@ VirtioScsiPassThru (
   //
   VirtioAppendDesc (
     &Dev->Ring,
-    ResponseDeviceAddress,
-    sizeof *Response,
+    Dev->SharedAddress + OFFSET_OF (VSCSI_SHARED, Response) +
+    Index * sizeof (VIRTIO_SCSI_RESP),
+    sizeof (*Response),
     VRING_DESC_F_WRITE | (Packet->InTransferLength > 0 ? VRING_DESC_F_NEXT : 0),
     &Indices
     );
@@ -652,65 +771,232 @@ VirtioScsiPassThru (
       );
   }
 
+  if (Dev->Ring.IndirectBase != NULL) {
+    VirtioAppendIndirectTable (&Dev->Ring, &Indices);
+  }
+
+  //
   // If kicking the host fails, we must fake a host adapter error.
   // EFI_NOT_READY would save us the effort, but it would also suggest that the
   // caller retry.
   //
-  if (VirtioFlush (
-        Dev->VirtIo,
-        VIRTIO_SCSI_REQUEST_QUEUE,
-        &Dev->Ring,
-        &Indices,
-        NULL
-        ) != EFI_SUCCESS)
-  {
-    Status = ReportHostAdapterError (Packet);
-    goto UnmapResponseBuffer;
+  Dev->InFlight++;
+  Status = VirtioSubmit (
+             Dev->VirtIo,
+             VIRTIO_SCSI_REQUEST_QUEUE,
+             &Dev->Ring,
+             &Indices.HeadDescIdx,
+             1
+             );
+  if (EFI_ERROR (Status)) {
+    //
+    // The request stays on the ring, and the host may still process it, so
+    // leave its slot and mappings to ReapRequests().
+    //
+    Request->Orphaned = TRUE;
+    return ReportHostAdapterError (Packet);
   }
 
-  Status = ParseResponse (Packet, Response);
+  *Slot = Index;
+  return EFI_SUCCESS;
+}
 
-  //
-  // If virtio request was successful and it was a CPU read request then we
-  // have used an intermediate buffer. Copy the data from intermediate buffer
-  // to the final buffer.
-  //
-  if (InDataBuffer != NULL) {
-    CopyMem (Packet->InDataBuffer, InDataBuffer, Packet->InTransferLength);
-  }
+//
+// The request that WaitRequest() waits for.
+//
+typedef struct {
+  VSCSI_DEV     *Dev;
+  UINT16        Slot;
+  EFI_STATUS    Status;
+} VSCSI_WAIT;
 
-UnmapResponseBuffer:
-  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, ResponseMapping);
+/**
 
-FreeResponseBuffer:
-  Dev->VirtIo->FreeSharedPages (
-                 Dev->VirtIo,
-                 EFI_SIZE_TO_PAGES (sizeof *Response),
-                 ResponseBuffer
-                 );
+  Reap completed requests, and release the request that WaitRequest() waits
+  for if it is done.
+
+  @param[in,out] Context  The VSCSI_WAIT of the request.
 
-UnmapOutDataBuffer:
-  if (OutDataBufferIsMapped) {
-    Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, OutDataMapping);
+  @retval TRUE   The request has been released, and its status recorded.
+  @retval FALSE  The request is still in flight.
+
+**/
+STATIC
+BOOLEAN
+EFIAPI
+IsRequestDone (
+  IN VOID  *Context
+  )
+{
+  VSCSI_WAIT     *Wait;
+  VSCSI_REQUEST  *Request;
+  EFI_TPL        OldTpl;
+  BOOLEAN        Done;
+
+  Wait    = Context;
+  Request = &Wait->Dev->Requests[Wait->Slot];
+
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  ReapRequests (Wait->Dev);
+  Done = Request->Done;
+  if (Done) {
+    Wait->Status   = Request->Status;
+    Request->InUse = FALSE;
   }
 
-UnmapInDataBuffer:
-  if (InDataBuffer != NULL) {
-    Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, InDataMapping);
+  gBS->RestoreTPL (OldTpl);
+  return Done;
+}
+
+/**
+
+  Wait for a request submitted without an event, and release it.
+
+  @param[in] Dev   The virtio-scsi host device.
+
+  @param[in] Slot  The request slot returned by SubmitRequest().
+
+  @return  The completion status of the request, from ParseResponse().
+
+**/
+STATIC
+EFI_STATUS
+WaitRequest (
+  IN VSCSI_DEV  *Dev,
+  IN UINT16     Slot
+  )
+{
+  VSCSI_WAIT  Wait;
+
+  Wait.Dev  = Dev;
+  Wait.Slot = Slot;
+  VirtioPoll (IsRequestDone, &Wait);
+  return Wait.Status;
+}
+
+/**
+
+  Reap completed requests, and check whether any request is still in flight.
+
+  @param[in] Context  The virtio-scsi host device.
+
+  @retval TRUE   No request is in flight.
+  @retval FALSE  Otherwise.
+
+**/
+STATIC
+BOOLEAN
+EFIAPI
+IsIdle (
+  IN VOID  *Context
+  )
+{
+  VSCSI_DEV  *Dev;
+  EFI_TPL    OldTpl;
+  UINT16     InFlight;
+
+  Dev    = Context;
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  ReapRequests (Dev);
+  InFlight = Dev->InFlight;
+  gBS->RestoreTPL (OldTpl);
+
+  return (BOOLEAN)(InFlight == 0);
+}
+
+/**
+
+  Wait until no request is in flight.
+
+  @param[in] Dev  The virtio-scsi host device.
+
+**/
+STATIC
+VOID
+DrainRequests (
+  IN VSCSI_DEV  *Dev
+  )
+{
+  VirtioPoll (IsIdle, Dev);
+}
+
+/**
+
+  Timer notification function that completes the requests submitted with an
+  event, while any are in flight.
+
+  @param[in] Event    The poll timer.
+
+  @param[in] Context  Pointer to the VSCSI_DEV structure.
+
+**/
+STATIC
+VOID
+EFIAPI
+VirtioScsiPoll (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  VSCSI_DEV  *Dev;
+
+  Dev = Context;
+  ReapRequests (Dev);
+  if (Dev->InFlight == 0) {
+    gBS->SetTimer (Dev->PollTimer, TimerCancel, 0);
   }
+}
+
+//
+// The next seven functions implement EFI_EXT_SCSI_PASS_THRU_PROTOCOL
+// for the virtio-scsi HBA. Refer to UEFI Spec 2.3.1 + Errata C, sections
+// - 14.1 SCSI Driver Model Overview,
+// - 14.7 Extended SCSI Pass Thru Protocol.
+//
+
+EFI_STATUS
+EFIAPI
+VirtioScsiPassThru (
+  IN     EFI_EXT_SCSI_PASS_THRU_PROTOCOL             *This,
+  IN     UINT8                                       *Target,
+  IN     UINT64                                      Lun,
+  IN OUT EFI_EXT_SCSI_PASS_THRU_SCSI_REQUEST_PACKET  *Packet,
+  IN     EFI_EVENT                                   Event   OPTIONAL
+  )
+{
+  VSCSI_DEV   *Dev;
+  UINT16      TargetValue;
+  EFI_TPL     OldTpl;
+  UINT16      Slot;
+  EFI_STATUS  Status;
+
+  Dev = VIRTIO_SCSI_FROM_PASS_THRU (This);
+  CopyMem (&TargetValue, Target, sizeof TargetValue);
+
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
 
-FreeInDataBuffer:
-  if (InDataBuffer != NULL) {
-    Dev->VirtIo->FreeSharedPages (Dev->VirtIo, InDataNumPages, InDataBuffer);
+  //
+  // Complete what we can now, so that the timer only has to pick up the
+  // stragglers.
+  //
+  ReapRequests (Dev);
+
+  Status = SubmitRequest (Dev, TargetValue, Lun, Packet, Event, &Slot);
+  if (!EFI_ERROR (Status) && (Event != NULL)) {
+    gBS->SetTimer (
+           Dev->PollTimer,
+           TimerPeriodic,
+           EFI_TIMER_PERIOD_MILLISECONDS (VSCSI_POLL_PERIOD_MS)
+           );
   }
 
-UnmapRequestBuffer:
-  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, RequestMapping);
+  gBS->RestoreTPL (OldTpl);
 
-FreeScsiRequest:
-  FreePool ((VOID *)Request);
+  if (EFI_ERROR (Status) || (Event != NULL)) {
+    return Status;
+  }
 
-  return Status;
+  return WaitRequest (Dev, Slot);
 }
 
 EFI_STATUS
@@ -936,6 +1222,7 @@ VirtioScsiInit (
   UINT8       NextDevStat;
   EFI_STATUS  Status;
   UINT64      RingBaseShift;
+  VOID        *SharedBuffer;
   UINT64      Features;
   UINT16      MaxChannel; // for validation only
   UINT32      NumQueues;  // for validation only
@@ -1036,7 +1323,8 @@ VirtioScsiInit (
   }
 
   Features &= VIRTIO_SCSI_F_INOUT | VIRTIO_F_VERSION_1 |
-              VIRTIO_F_IOMMU_PLATFORM;
+              VIRTIO_F_IOMMU_PLATFORM | VIRTIO_F_RING_EVENT_IDX |
+              VIRTIO_F_RING_INDIRECT_DESC;
 
   //
   // In virtio-1.0, feature negotiation is expected to complete before queue
@@ -1063,21 +1351,42 @@ VirtioScsiInit (
   }
 
   //
-  // VirtioScsiPassThru() uses at most four descriptors
+  // SubmitRequest() uses at most four descriptors per request, or one that
+  // refers to an indirect table of four.
   //
-  if (QueueSize < 4) {
+  Dev->DescPerRequest = ((Features & VIRTIO_F_RING_INDIRECT_DESC) != 0) ?
+                        1 : VSCSI_DESC_PER_REQUEST;
+  if (QueueSize < Dev->DescPerRequest) {
     Status = EFI_UNSUPPORTED;
     goto Failed;
   }
 
+  Dev->NumRequests = (UINT16)MIN (VSCSI_MAX_REQUESTS, QueueSize / Dev->DescPerRequest);
+  Dev->InFlight    = 0;
+  ZeroMem (Dev->Requests, sizeof Dev->Requests);
+
   Status = VirtioRingInit (Dev->VirtIo, QueueSize, &Dev->Ring);
   if (EFI_ERROR (Status)) {
     goto Failed;
   }
 
+  Dev->Ring.EventIdx = (BOOLEAN)((Features & VIRTIO_F_RING_EVENT_IDX) != 0);
+
   //
   // If anything fails from here on, we must release the ring resources
   //
+  if ((Features & VIRTIO_F_RING_INDIRECT_DESC) != 0) {
+    Status = VirtioRingIndirectInit (
+               Dev->VirtIo,
+               Dev->NumRequests,
+               VSCSI_DESC_PER_REQUEST,
+               &Dev->Ring
+               );
+    if (EFI_ERROR (Status)) {
+      goto ReleaseQueue;
+    }
+  }
+
   Status = VirtioRingMap (
              Dev->VirtIo,
              &Dev->Ring,
@@ -1088,18 +1397,46 @@ VirtioScsiInit (
     goto ReleaseQueue;
   }
 
+  //
+  // Allocate and map the request and response headers once, as a common
+  // buffer, so that each request only has to map its data buffers.
+  //
+  Status = Dev->VirtIo->AllocateSharedPages (
+                          Dev->VirtIo,
+                          EFI_SIZE_TO_PAGES (sizeof *Dev->Shared),
+                          &SharedBuffer
+                          );
+  if (EFI_ERROR (Status)) {
+    goto UnmapQueue;
+  }
+
+  Status = VirtioMapAllBytesInSharedBuffer (
+             Dev->VirtIo,
+             VirtioOperationBusMasterCommonBuffer,
+             SharedBuffer,
+             sizeof *Dev->Shared,
+             &Dev->SharedAddress,
+             &Dev->SharedMap
+             );
+  if (EFI_ERROR (Status)) {
+    goto FreeSharedBuffer;
+  }
+
+  Dev->Shared = SharedBuffer;
+
   //
   // Additional steps for MMIO: align the queue appropriately, and set the
-  // size. If anything fails from here on, we must unmap the ring resources.
+  // size. If anything fails from here on, we must unmap the shared buffer and
+  // the ring resources.
   //
   Status = Dev->VirtIo->SetQueueNum (Dev->VirtIo, QueueSize);
   if (EFI_ERROR (Status)) {
-    goto UnmapQueue;
+    goto UnmapSharedBuffer;
   }
 
   Status = Dev->VirtIo->SetQueueAlign (Dev->VirtIo, EFI_PAGE_SIZE);
   if (EFI_ERROR (Status)) {
-    goto UnmapQueue;
+    goto UnmapSharedBuffer;
   }
 
   //
@@ -1111,7 +1448,7 @@ VirtioScsiInit (
                           RingBaseShift
                           );
   if (EFI_ERROR (Status)) {
-    goto UnmapQueue;
+    goto UnmapSharedBuffer;
   }
 
   //
@@ -1121,7 +1458,7 @@ VirtioScsiInit (
     Features &= ~(UINT64)(VIRTIO_F_VERSION_1 | VIRTIO_F_IOMMU_PLATFORM);
     Status    = Dev->VirtIo->SetGuestFeatures (Dev->VirtIo, Features);
     if (EFI_ERROR (Status)) {
-      goto UnmapQueue;
+      goto UnmapSharedBuffer;
     }
   }
 
@@ -1131,12 +1468,12 @@ VirtioScsiInit (
   //
   Status = VIRTIO_CFG_WRITE (Dev, CdbSize, VIRTIO_SCSI_CDB_SIZE);
   if (EFI_ERROR (Status)) {
-    goto UnmapQueue;
+    goto UnmapSharedBuffer;
   }
 
   Status = VIRTIO_CFG_WRITE (Dev, SenseSize, VIRTIO_SCSI_SENSE_SIZE);
   if (EFI_ERROR (Status)) {
-    goto UnmapQueue;
+    goto UnmapSharedBuffer;
   }
 
   //
@@ -1145,7 +1482,7 @@ VirtioScsiInit (
   NextDevStat |= VSTAT_DRIVER_OK;
   Status       = Dev->VirtIo->SetDeviceStatus (Dev->VirtIo, NextDevStat);
   if (EFI_ERROR (Status)) {
-    goto UnmapQueue;
+    goto UnmapSharedBuffer;
   }
 
   //
@@ -1172,7 +1509,8 @@ VirtioScsiInit (
   // SCSI Pass Thru Protocol.
   //
   Dev->PassThruMode.Attributes = EFI_EXT_SCSI_PASS_THRU_ATTRIBUTES_PHYSICAL |
-                                 EFI_EXT_SCSI_PASS_THRU_ATTRIBUTES_LOGICAL;
+                                 EFI_EXT_SCSI_PASS_THRU_ATTRIBUTES_LOGICAL |
+                                 EFI_EXT_SCSI_PASS_THRU_ATTRIBUTES_NONBLOCKIO;
 
   //
   // no restriction on transfer buffer alignment
@@ -1181,6 +1519,17 @@ VirtioScsiInit (
 
   return EFI_SUCCESS;
 
+UnmapSharedBuffer:
+  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->SharedMap);
+  Dev->Shared = NULL;
+
+FreeSharedBuffer:
+  Dev->VirtIo->FreeSharedPages (
+                 Dev->VirtIo,
+                 EFI_SIZE_TO_PAGES (sizeof *Dev->Shared),
+                 SharedBuffer
+                 );
+
 UnmapQueue:
   Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->RingMap);
 
@@ -1222,6 +1571,14 @@ VirtioScsiUninit (
   Dev->MaxLun         = 0;
   Dev->MaxSectors     = 0;
 
+  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->SharedMap);
+  Dev->VirtIo->FreeSharedPages (
+                 Dev->VirtIo,
+                 EFI_SIZE_TO_PAGES (sizeof *Dev->Shared),
+                 (VOID *)Dev->Shared
+                 );
+  Dev->Shared = NULL;
+
   Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->RingMap);
   VirtioRingUninit (Dev->VirtIo, &Dev->Ring);
 
@@ -1364,6 +1721,17 @@ VirtioScsiDriverBindingStart (
     goto UninitDev;
   }
 
+  Status = gBS->CreateEvent (
+                  EVT_TIMER | EVT_NOTIFY_SIGNAL,
+                  TPL_NOTIFY,
+                  &VirtioScsiPoll,
+                  Dev,
+                  &Dev->PollTimer
+                  );
+  if (EFI_ERROR (Status)) {
+    goto CloseExitBoot;
+  }
+
   //
   // Setup complete, attempt to export the driver instance's PassThru
   // interface.
@@ -1376,11 +1744,14 @@ VirtioScsiDriverBindingStart (
                           &Dev->PassThru
                           );
   if (EFI_ERROR (Status)) {
-    goto CloseExitBoot;
+    goto ClosePollTimer;
   }
 
   return EFI_SUCCESS;
 
+ClosePollTimer:
+  gBS->CloseEvent (Dev->PollTimer);
+
 CloseExitBoot:
   gBS->CloseEvent (Dev->ExitBoot);
 
@@ -1440,6 +1811,8 @@ VirtioScsiDriverBindingStop (
     return Status;
   }
 
+  DrainRequests (Dev);
+  gBS->CloseEvent (Dev->PollTimer);
   gBS->CloseEvent (Dev->ExitBoot);
 
   VirtioScsiUninit (Dev);
@@ -16,7 +16,7 @@
 #include <Protocol/DriverBinding.h>
 #include <Protocol/ScsiPassThruExt.h>
 
-#include <IndustryStandard/Virtio.h>
+#include <IndustryStandard/VirtioScsi.h>
 
 //
 // This driver supports 2-byte target identifiers and 4-byte LUN identifiers.
@@ -34,6 +34,49 @@
 
 #define VSCSI_SIG  SIGNATURE_32 ('V', 'S', 'C', 'S')
 
+//
+// At most this many requests are in flight on the request queue. Each request
+// owns VSCSI_DESC_PER_REQUEST descriptors: request, data-out, response and
+// data-in. With indirect descriptors, these are in a table of the request,
+// and the request owns a single descriptor of the ring.
+//
+#define VSCSI_MAX_REQUESTS      16
+#define VSCSI_DESC_PER_REQUEST  4
+
+//
+// The period of the timer completing requests submitted with an event.
+//
+#define VSCSI_POLL_PERIOD_MS  1
+
+//
+// The parts of the requests that the device reads and writes besides the
+// data, kept in a common buffer that is mapped for the lifetime of the device.
+// Indexed by request slot.
+//
+typedef struct {
+  VIRTIO_SCSI_REQ     Request[VSCSI_MAX_REQUESTS];
+  VIRTIO_SCSI_RESP    Response[VSCSI_MAX_REQUESTS];
+} VSCSI_SHARED;
+
+//
+// The driver side of a request slot.
+//
+typedef struct {
+  BOOLEAN                                       InUse;
+  // The host has completed a request without an event; for WaitRequest().
+  BOOLEAN                                       Done;
+  // Nobody waits for the request, as its submission failed.
+  BOOLEAN                                       Orphaned;
+  BOOLEAN                                       OutDataBufferIsMapped;
+  EFI_EXT_SCSI_PASS_THRU_SCSI_REQUEST_PACKET    *Packet;
+  EFI_EVENT                                     Event;
+  VOID                                          *InDataBuffer;
+  UINTN                                         InDataNumPages;
+  VOID                                          *InDataMapping;
+  VOID                                          *OutDataMapping;
+  EFI_STATUS                                    Status;
+} VSCSI_REQUEST;
+
 typedef struct {
   //
   // Parts of this structure are initialized / torn down in various functions
@@ -53,6 +96,14 @@ typedef struct {
   EFI_EXT_SCSI_PASS_THRU_PROTOCOL    PassThru;       // VirtioScsiInit      1
   EFI_EXT_SCSI_PASS_THRU_MODE        PassThruMode;   // VirtioScsiInit      1
   VOID                               *RingMap;       // VirtioRingMap       2
+  volatile VSCSI_SHARED              *Shared;        // VirtioScsiInit      1
+  EFI_PHYSICAL_ADDRESS               SharedAddress;  // VirtioScsiInit      1
+  VOID                               *SharedMap;     // VirtioScsiInit      1
+  EFI_EVENT                          PollTimer;      // DriverBindingStart  0
+  UINT16                             NumRequests;    // VirtioScsiInit      1
+  UINT16                             DescPerRequest; // VirtioScsiInit      1
+  UINT16                             InFlight;       // VirtioScsiInit      1
+  VSCSI_REQUEST                      Requests[VSCSI_MAX_REQUESTS]; // VirtioScsiInit 1
 } VSCSI_DEV;
 
 #define VIRTIO_SCSI_FROM_PASS_THRU(PassThruPointer) \
@@ -36,6 +36,15 @@ UINT8  *mImageBase = NULL;
 UINT8  mImageDigest[MAX_DIGEST_SIZE];
 UINTN  mImageDigestSize;
 
+//
+// Signed images that were allowed during this boot, and the digest of db, dbx and
+// dbt that they were allowed under.
+//
+UINT8  mVerdictCache[IMAGE_VERDICT_CACHE_SIZE][SHA256_DIGEST_SIZE];
+UINTN  mVerdictCacheCount;
+UINTN  mVerdictCacheNext;
+UINT8  mVerdictCacheGeneration[SHA256_DIGEST_SIZE];
+
 //
 // Notify string for authorization UI.
 //
@@ -1607,6 +1616,169 @@ Done:
   return VerifyStatus;
 }
 
+/**
+  Add the contents of a security database variable to a SHA-256 digest.
+
+  A variable that does not exist is added as an empty one.
+
+  @param[in, out] HashCtx       The SHA-256 context.
+  @param[in]      VariableName  Name of the database variable.
+
+  @retval TRUE   The variable has been added.
+  @retval FALSE  The variable could not be read, or hashing failed.
+
+**/
+STATIC
+BOOLEAN
+HashSecurityDatabase (
+  IN OUT VOID    *HashCtx,
+  IN     CHAR16  *VariableName
+  )
+{
+  EFI_STATUS  Status;
+  UINTN       DataSize;
+  UINT8       *Data;
+  UINT64      Size;
+  BOOLEAN     Hashed;
+
+  Data     = NULL;
+  DataSize = 0;
+  Status   = gRT->GetVariable (VariableName, &gEfiImageSecurityDatabaseGuid, NULL, &DataSize, NULL);
+  if (Status == EFI_BUFFER_TOO_SMALL) {
+    Data = AllocatePool (DataSize);
+    if (Data == NULL) {
+      return FALSE;
+    }
+
+    Status = gRT->GetVariable (VariableName, &gEfiImageSecurityDatabaseGuid, NULL, &DataSize, Data);
+  }
+
+  if (Status == EFI_NOT_FOUND) {
+    DataSize = 0;
+  } else if (EFI_ERROR (Status)) {
+    Hashed = FALSE;
+    goto Done;
+  }
+
+  //
+  // The size keeps the end of one database from passing for the start of the next.
+  //
+  Size   = DataSize;
+  Hashed = Sha256Update (HashCtx, &Size, sizeof (Size));
+  if (Hashed && (DataSize != 0)) {
+    Hashed = Sha256Update (HashCtx, Data, DataSize);
+  }
+
+Done:
+  if (Data != NULL) {
+    FreePool (Data);
+  }
+
+  return Hashed;
+}
+
+/**
+  Look up a signed image in the verdict cache.
+
+  The cache remembers, for the rest of the boot, the signed images that were allowed.
+  An entry is the SHA-256 digest of the Authenticode digest of the image and of its
+  attribute certificate table, so an image only hits if it carries the very same
+  signatures. The cache is flushed whenever db, dbx or dbt have changed. The db
+  entries that allowed an image have been measured when it was first verified.
+
+  @param[in]  SecDataDir   The security data directory of the image.
+  @param[out] VerdictKey   The key of the image in the cache.
+  @param[out] IsCacheable  Whether VerdictKey is valid, and may be added to the cache.
+
+  @retval TRUE   The image was allowed before, under the current db, dbx and dbt.
+  @retval FALSE  The image is not in the cache.
+
+**/
+STATIC
+BOOLEAN
+LookupVerdictCache (
+  IN  EFI_IMAGE_DATA_DIRECTORY  *SecDataDir,
+  OUT UINT8                     *VerdictKey,
+  OUT BOOLEAN                   *IsCacheable
+  )
+{
+  VOID     *HashCtx;
+  UINT8    Generation[SHA256_DIGEST_SIZE];
+  UINTN    Index;
+  BOOLEAN  Hashed;
+
+  *IsCacheable = FALSE;
+
+  if ((SecDataDir->VirtualAddress > mImageSize) ||
+      (SecDataDir->Size > mImageSize - SecDataDir->VirtualAddress))
+  {
+    return FALSE;
+  }
+
+  if (!HashPeImage (HASHALG_SHA256)) {
+    return FALSE;
+  }
+
+  HashCtx = AllocatePool (Sha256GetContextSize ());
+  if (HashCtx == NULL) {
+    return FALSE;
+  }
+
+  Hashed = Sha256Init (HashCtx) &&
+           Sha256Update (HashCtx, mImageDigest, SHA256_DIGEST_SIZE) &&
+           Sha256Update (HashCtx, mImageBase + SecDataDir->VirtualAddress, SecDataDir->Size) &&
+           Sha256Final (HashCtx, VerdictKey);
+  if (Hashed) {
+    Hashed = Sha256Init (HashCtx) &&
+             HashSecurityDatabase (HashCtx, EFI_IMAGE_SECURITY_DATABASE) &&
+             HashSecurityDatabase (HashCtx, EFI_IMAGE_SECURITY_DATABASE1) &&
+             HashSecurityDatabase (HashCtx, EFI_IMAGE_SECURITY_DATABASE2) &&
+             Sha256Final (HashCtx, Generation);
+  }
+
+  FreePool (HashCtx);
+  if (!Hashed) {
+    return FALSE;
+  }
+
+  *IsCacheable = TRUE;
+
+  if (CompareMem (Generation, mVerdictCacheGeneration, SHA256_DIGEST_SIZE) != 0) {
+    CopyMem (mVerdictCacheGeneration, Generation, SHA256_DIGEST_SIZE);
+    mVerdictCacheCount = 0;
+    mVerdictCacheNext  = 0;
+    return FALSE;
+  }
+
+  for (Index = 0; Index < mVerdictCacheCount; Index++) {
+    if (CompareMem (mVerdictCache[Index], VerdictKey, SHA256_DIGEST_SIZE) == 0) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/**
+  Add a signed image that has been allowed to the verdict cache. The oldest entry
+  makes room when the cache is full.
+
+  @param[in]  VerdictKey   The key of the image, from LookupVerdictCache().
+
+**/
+STATIC
+VOID
+AddToVerdictCache (
+  IN UINT8  *VerdictKey
+  )
+{
+  CopyMem (mVerdictCache[mVerdictCacheNext], VerdictKey, SHA256_DIGEST_SIZE);
+  mVerdictCacheNext = (mVerdictCacheNext + 1) % IMAGE_VERDICT_CACHE_SIZE;
+  if (mVerdictCacheCount < IMAGE_VERDICT_CACHE_SIZE) {
+    mVerdictCacheCount++;
+  }
+}
+
 /**
   Provide verification service for signed images, which include both signature validation
   and platform policy control. For signature types, both UEFI WIN_CERTIFICATE_UEFI_GUID and
@@ -1693,6 +1865,8 @@ DxeImageVerificationHandler (
   BOOLEAN                       IsFound;
   UINT8                         HashAlg;
   BOOLEAN                       IsFoundInDatabase;
+  UINT8                         VerdictKey[SHA256_DIGEST_SIZE];
+  BOOLEAN                       IsCacheable;
 
   SignatureList     = NULL;
   SignatureListSize = 0;
@@ -1903,6 +2077,15 @@ DxeImageVerificationHandler (
     goto Failed;
   }
 
+  //
+  // An image that was allowed before, with the same signatures and under the same
+  // db, dbx and dbt, is allowed again without verifying its signatures.
+  //
+  if (LookupVerdictCache (SecDataDir, VerdictKey, &IsCacheable)) {
+    DEBUG ((DEBUG_INFO, "DxeImageVerificationLib: Image is signed and was allowed before.\n"));
+    return EFI_SUCCESS;
+  }
+
   //
   // Verify the signature of the image, multiple signatures are allowed as per PE/COFF Section 4.7
   // "Attribute Certificate Table".
@@ -2029,6 +2212,10 @@ DxeImageVerificationHandler (
   }
 
   if (IsVerified) {
+    if (IsCacheable) {
+      AddToVerdictCache (VerdictKey);
+    }
+
     return EFI_SUCCESS;
   }
 
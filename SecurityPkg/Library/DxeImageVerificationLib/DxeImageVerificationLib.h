@@ -73,6 +73,12 @@ SPDX-License-Identifier: BSD-2-Clause-Patent
 // Set max digest size as SHA512 Output (64 bytes) by far
 //
 #define MAX_DIGEST_SIZE  SHA512_DIGEST_SIZE
+
+//
+// Number of allowed signed images that are remembered during a boot.
+//
+#define IMAGE_VERDICT_CACHE_SIZE  32
+
 //
 //
 // PKCS7 Certificate definition
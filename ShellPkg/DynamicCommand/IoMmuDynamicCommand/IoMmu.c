@@ -0,0 +1,1037 @@
+/** @file
+  Main file for the "iommu" dynamic UEFI shell command and application.
+
+  This command displays the state of the RISC-V IOMMU driver and of its
+  IOMMUs: the mappings and pools, the queues and fault counts of each
+  IOMMU, the device contexts and IO page tables of its devices, how their
+  buffers were mapped, the events its performance monitor counts, and the
+  calls the driver traced, which it may also save to a file for the host
+  benchmark of the driver to replay.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include "IoMmu.h"
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/HiiLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/ShellLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiHiiServicesLib.h>
+#include <Library/UefiLib.h>
+
+#include <Guid/RiscVIoMmuTrace.h>
+
+#include <Protocol/HiiPackageList.h>
+#include <Protocol/RiscVIoMmuDiagnostics.h>
+#include <Protocol/RiscVIoMmuHpm.h>
+
+#define IOMMU_FLAG_INDEX_STR        L"-i"
+#define IOMMU_FLAG_DEVICE_STR       L"-d"
+#define IOMMU_FLAG_ADDRESS_STR      L"-a"
+#define IOMMU_FLAG_PERFORMANCE_STR  L"-p"
+#define IOMMU_FLAG_SOURCE_STR       L"-s"
+#define IOMMU_FLAG_TIME_STR         L"-t"
+#define IOMMU_FLAG_TRACE_STR        L"-r"
+#define IOMMU_FLAG_MAPPINGS_STR     L"-m"
+#define IOMMU_FLAG_FILE_STR         L"-f"
+
+#define IOMMU_DEFAULT_MEASURE_MS  1000
+
+//
+// The largest device context, the extended format.
+//
+#define IOMMU_DC_MAX_WORDS  8
+
+EFI_HII_HANDLE  mIoMmuShellCommandHiiHandle = NULL;
+
+STATIC CONST SHELL_PARAM_ITEM  ParamList[] = {
+  { IOMMU_FLAG_INDEX_STR,       TypeValue },
+  { IOMMU_FLAG_DEVICE_STR,      TypeValue },
+  { IOMMU_FLAG_ADDRESS_STR,     TypeValue },
+  { IOMMU_FLAG_PERFORMANCE_STR, TypeFlag  },
+  { IOMMU_FLAG_SOURCE_STR,      TypeValue },
+  { IOMMU_FLAG_TIME_STR,        TypeValue },
+  { IOMMU_FLAG_TRACE_STR,       TypeFlag  },
+  { IOMMU_FLAG_MAPPINGS_STR,    TypeFlag  },
+  { IOMMU_FLAG_FILE_STR,        TypeValue },
+  { NULL,                       TypeMax   }
+};
+
+STATIC CONST CHAR16  *mDeviceContextWordNames[IOMMU_DC_MAX_WORDS] = {
+  L"tc",
+  L"iohgatp",
+  L"ta",
+  L"fsc",
+  L"msiptp",
+  L"msi_addr_mask",
+  L"msi_addr_pattern",
+  L"reserved"
+};
+
+STATIC CONST CHAR16  *mHpmEventNames[RiscVIoMmuHpmEventMax] = {
+  L"Cycles",
+  L"Untranslated requests",
+  L"Translated requests",
+  L"ATS translation requests",
+  L"IOTLB misses",
+  L"Device directory walks",
+  L"Process directory walks",
+  L"First-stage walks",
+  L"Second-stage walks"
+};
+
+STATIC CONST CHAR16  *mTraceEventNames[RiscVIoMmuTraceMax] = {
+  L"?",
+  L"SetAttribute",
+  L"Map",
+  L"Unmap",
+  L"AllocateBuffer",
+  L"FreeBuffer"
+};
+
+//
+// The flag characters of a page-table entry, from bit 0.
+//
+STATIC CONST CHAR16  mPteFlagNames[] = L"VRWXUGAD";
+
+/**
+  Read the number given to a flag.
+
+  @param[in]   Package      The parsed command line.
+  @param[in]   Flag         The flag.
+  @param[in]   Hexadecimal  Whether the number is hexadecimal, rather than decimal.
+  @param[out]  Present      Whether the flag is given.
+  @param[out]  Value        The number, if Present.
+
+  @retval  SHELL_SUCCESS            Present and Value are set.
+  @retval  SHELL_INVALID_PARAMETER  The flag has no number, or an invalid one.
+
+**/
+STATIC
+SHELL_STATUS
+GetFlagNumber (
+  IN  LIST_ENTRY    *Package,
+  IN  CHAR16        *Flag,
+  IN  BOOLEAN       Hexadecimal,
+  OUT BOOLEAN       *Present,
+  OUT UINT64        *Value
+  )
+{
+  CONST CHAR16  *String;
+
+  *Present = ShellCommandLineGetFlag (Package, Flag);
+  if (!*Present) {
+    return SHELL_SUCCESS;
+  }
+
+  String = ShellCommandLineGetValue (Package, Flag);
+  if (String == NULL) {
+    ShellPrintHiiDefaultEx (STRING_TOKEN (STR_GEN_NO_VALUE), mIoMmuShellCommandHiiHandle, IOMMU_COMMAND_NAME, Flag);
+    return SHELL_INVALID_PARAMETER;
+  }
+
+  if (EFI_ERROR (ShellConvertStringToUint64 (String, Value, Hexadecimal, TRUE))) {
+    ShellPrintHiiDefaultEx (STRING_TOKEN (STR_GEN_PARAM_INV), mIoMmuShellCommandHiiHandle, IOMMU_COMMAND_NAME, String);
+    return SHELL_INVALID_PARAMETER;
+  }
+
+  return SHELL_SUCCESS;
+}
+
+/**
+  Print the state of a queue.
+
+  @param[in]  Name   The name of the queue.
+  @param[in]  Queue  The state of the queue.
+
+**/
+STATIC
+VOID
+PrintQueue (
+  IN CONST CHAR16                        *Name,
+  IN CONST RISCV_IOMMU_QUEUE_STATISTICS  *Queue
+  )
+{
+  if (Queue->NumberOfEntries == 0) {
+    ShellPrintHiiDefaultEx (STRING_TOKEN (STR_IOMMU_INSTANCE_NO_QUEUE), mIoMmuShellCommandHiiHandle, Name);
+    return;
+  }
+
+  ShellPrintHiiDefaultEx (
+    STRING_TOKEN (STR_IOMMU_INSTANCE_QUEUE),
+    mIoMmuShellCommandHiiHandle,
+    Name,
+    Queue->NumberOfEntries,
+    Queue->Head,
+    Queue->Tail
+    );
+}
+
+/**
+  Print the state shared by all IOMMUs.
+
+  @param[in]  Diagnostics  The diagnostics protocol.
+
+  @retval  SHELL_SUCCESS        The state is printed.
+  @retval  SHELL_DEVICE_ERROR   The state couldn't be read.
+
+**/
+STATIC
+SHELL_STATUS
+PrintDriverStatistics (
+  IN RISCV_IOMMU_DIAGNOSTICS_PROTOCOL  *Diagnostics
+  )
+{
+  EFI_STATUS                     Status;
+  RISCV_IOMMU_DRIVER_STATISTICS  Statistics;
+
+  Status = Diagnostics->GetDriverStatistics (Diagnostics, &Statistics);
+  if (EFI_ERROR (Status)) {
+    ShellPrintHiiDefaultEx (STRING_TOKEN (STR_IOMMU_ERROR), mIoMmuShellCommandHiiHandle, IOMMU_COMMAND_NAME, L"GetDriverStatistics", Status);
+    return SHELL_DEVICE_ERROR;
+  }
+
+  ShellPrintHiiDefaultEx (STRING_TOKEN (STR_IOMMU_DRIVER_HEADER), mIoMmuShellCommandHiiHandle);
+  ShellPrintHiiDefaultEx (STRING_TOKEN (STR_IOMMU_DRIVER_IOMMUS), mIoMmuShellCommandHiiHandle, Statistics.NumberOfIoMmus);
+  ShellPrintHiiDefaultEx (STRING_TOKEN (STR_IOMMU_DRIVER_MAPPINGS), mIoMmuShellCommandHiiHandle, Statistics.LiveMappings);
+  ShellPrintHiiDefaultEx (
+    STRING_TOKEN (STR_IOMMU_DRIVER_BOUNCE),
+    mIoMmuShellCommandHiiHandle,
+    Statistics.BouncePoolPages,
+    Statistics.BouncePoolFreePages
+    );
+  ShellPrintHiiDefaultEx (
+    STRING_TOKEN (STR_IOMMU_DRIVER_TABLES),
+    mIoMmuShellCommandHiiHandle,
+    Statistics.TablePoolPages,
+    Statistics.TablePoolPagesInUse,
+    Statistics.TablePoolHighWater
+    );
+
+  return SHELL_SUCCESS;
+}
+
+/**
+  Print the state of an IOMMU.
+
+  @param[in]  IoMmuIndex  The index of the IOMMU.
+  @param[in]  Statistics  The state of the IOMMU.
+
+**/
+STATIC
+VOID
+PrintInstanceStatistics (
+  IN UINTN                                  IoMmuIndex,
+  IN CONST RISCV_IOMMU_INSTANCE_STATISTICS  *Statistics
+  )
+{
+  ShellPrintHiiDefaultEx (STRING_TOKEN (STR_GEN_LINE_BREAK), mIoMmuShellCommandHiiHandle);
+  ShellPrintHiiDefaultEx (
+    STRING_TOKEN (STR_IOMMU_INSTANCE_HEADER),
+    mIoMmuShellCommandHiiHandle,
+    IoMmuIndex,
+    Statistics->Address,
+    Statistics->IsPciDevice ? L"PCI" : L"platform"
+    );
+  ShellPrintHiiDefaultEx (
+    STRING_TOKEN (STR_IOMMU_INSTANCE_DDT),
+    mIoMmuShellCommandHiiHandle,
+    Statistics->DeviceDirectoryLevels,
+    Statistics->DeviceDirectoryPages
+    );
+  ShellPrintHiiDefaultEx (STRING_TOKEN (STR_IOMMU_INSTANCE_PT), mIoMmuShellCommandHiiHandle, Statistics->PageTableLevels);
+  ShellPrintHiiDefaultEx (STRING_TOKEN (STR_IOMMU_INSTANCE_DOMAINS), mIoMmuShellCommandHiiHandle, Statistics->NumberOfDomains);
+  PrintQueue (L"Command queue:", &Statistics->CommandQueue);
+  PrintQueue (L"Fault queue:", &Statistics->FaultQueue);
+  PrintQueue (L"Page-request queue:", &Statistics->PageRequestQueue);
+  ShellPrintHiiDefaultEx (
+    STRING_TOKEN (STR_IOMMU_INSTANCE_FAULTS),
+    mIoMmuShellCommandHiiHandle,
+    Statistics->Faults,
+    Statistics->UnknownDeviceFaults
+    );
+}
+
+/**
+  Print the device context of a device_id.
+
+  @param[in]  Diagnostics  The diagnostics protocol.
+  @param[in]  IoMmuIndex   The index of the IOMMU.
+  @param[in]  DeviceId     The device_id.
+
+  @retval  SHELL_SUCCESS        The device context is printed.
+  @retval  SHELL_NOT_FOUND      The device directory has no entry for the device_id.
+  @retval  SHELL_DEVICE_ERROR   The device context couldn't be read.
+
+**/
+STATIC
+SHELL_STATUS
+PrintDeviceContext (
+  IN RISCV_IOMMU_DIAGNOSTICS_PROTOCOL  *Diagnostics,
+  IN UINTN                             IoMmuIndex,
+  IN UINT32                            DeviceId
+  )
+{
+  EFI_STATUS  Status;
+  UINT64      Context[IOMMU_DC_MAX_WORDS];
+  UINTN       ContextSize;
+  UINTN       Word;
+
+  ContextSize = sizeof (Context);
+  Status      = Diagnostics->GetDeviceContext (Diagnostics, IoMmuIndex, DeviceId, Context, &ContextSize);
+  if (Status == EFI_NOT_FOUND) {
+    ShellPrintHiiDefaultEx (STRING_TOKEN (STR_IOMMU_DC_NO_ENTRY), mIoMmuShellCommandHiiHandle, DeviceId);
+    return SHELL_NOT_FOUND;
+  }
+
+  if (EFI_ERROR (Status)) {
+    ShellPrintHiiDefaultEx (STRING_TOKEN (STR_IOMMU_ERROR), mIoMmuShellCommandHiiHandle, IOMMU_COMMAND_NAME, L"GetDeviceContext", Status);
+    return SHELL_DEVICE_ERROR;
+  }
+
+  ShellPrintHiiDefaultEx (STRING_TOKEN (STR_IOMMU_DC_HEADER), mIoMmuShellCommandHiiHandle, IoMmuIndex, DeviceId);
+  for (Word = 0; Word < ContextSize / sizeof (UINT64); Word++) {
+    ShellPrintHiiDefaultEx (
+      STRING_TOKEN (STR_IOMMU_DC_WORD),
+      mIoMmuShellCommandHiiHandle,
+      mDeviceContextWordNames[Word],
+      Context[Word]
+      );
+  }
+
+  return SHELL_SUCCESS;
+}
+
+/**
+  Print the page-table entries that translate an IO virtual address.
+
+  @param[in]  Diagnostics       The diagnostics protocol.
+  @param[in]  IoMmuIndex        The index of the IOMMU.
+  @param[in]  PageTableLevels   The levels of the IOMMU's page tables.
+  @param[in]  DeviceId          The device_id.
+  @param[in]  IoVirtualAddress  The IO virtual address.
+
+  @retval  SHELL_SUCCESS        The entries are printed.
+  @retval  SHELL_NOT_FOUND      The device_id has no domain.
+  @retval  SHELL_UNSUPPORTED    The domain bypasses translation.
+  @retval  SHELL_DEVICE_ERROR   The page table couldn't be walked.
+
+**/
+STATIC
+SHELL_STATUS
+PrintPageTableWalk (
+  IN RISCV_IOMMU_DIAGNOSTICS_PROTOCOL  *Diagnostics,
+  IN UINTN                             IoMmuIndex,
+  IN UINTN                             PageTableLevels,
+  IN UINT32                            DeviceId,
+  IN UINT64                            IoVirtualAddress
+  )
+{
+  EFI_STATUS  Status;
+  UINT64      Entries[RISCV_IOMMU_DIAGNOSTICS_MAX_LEVELS];
+  UINTN       NumberOfEntries;
+  UINTN       Entry;
+  UINTN       Bit;
+  CHAR16      Flags[ARRAY_SIZE (mPteFlagNames)];
+
+  Status = Diagnostics->WalkPageTable (Diagnostics, IoMmuIndex, DeviceId, IoVirtualAddress, Entries, &NumberOfEntries);
+  if (Status == EFI_NOT_FOUND) {
+    ShellPrintHiiDefaultEx (STRING_TOKEN (STR_IOMMU_WALK_NO_DOMAIN), mIoMmuShellCommandHiiHandle, DeviceId);
+    return SHELL_NOT_FOUND;
+  }
+
+  if (Status == EFI_UNSUPPORTED) {
+    ShellPrintHiiDefaultEx (STRING_TOKEN (STR_IOMMU_WALK_IDENTITY), mIoMmuShellCommandHiiHandle, DeviceId);
+    return SHELL_UNSUPPORTED;
+  }
+
+  if (EFI_ERROR (Status)) {
+    ShellPrintHiiDefaultEx (STRING_TOKEN (STR_IOMMU_ERROR), mIoMmuShellCommandHiiHandle, IOMMU_COMMAND_NAME, L"WalkPageTable", Status);
+    return SHELL_DEVICE_ERROR;
+  }
+
+  ShellPrintHiiDefaultEx (STRING_TOKEN (STR_IOMMU_WALK_HEADER), mIoMmuShellCommandHiiHandle, IoMmuIndex, IoVirtualAddress, DeviceId);
+
+  //
+  // The walk starts at the root, the highest level, and descends towards 0.
+  //
+  for (Entry = 0; Entry < NumberOfEntries; Entry++) {
+    for (Bit = 0; Bit < ARRAY_SIZE (mPteFlagNames) - 1; Bit++) {
+      Flags[Bit] = ((Entries[Entry] & LShiftU64 (1, Bit)) != 0) ? mPteFlagNames[Bit] : L'-';
+    }
+
+    Flags[Bit] = L'\0';
+    ShellPrintHiiDefaultEx (
+      STRING_TOKEN (STR_IOMMU_WALK_ENTRY),
+      mIoMmuShellCommandHiiHandle,
+      PageTableLevels - 1 - Entry,
+      Entries[Entry],
+      BitFieldRead64 (Entries[Entry], 10, 53),
+      Flags
+      );
+  }
+
+  return SHELL_SUCCESS;
+}
+
+/**
+  Print how the buffers of the devices behind an IOMMU were mapped.
+
+  @param[in]  Diagnostics  The diagnostics protocol.
+  @param[in]  IoMmuIndex   The index of the IOMMU.
+  @param[in]  HasDevice    Whether only the device of DeviceId is printed.
+  @param[in]  DeviceId     The device_id, if HasDevice.
+
+  @retval  SHELL_SUCCESS        The statistics are printed.
+  @retval  SHELL_NOT_FOUND      The IOMMU has no domain for the device_id.
+  @retval  SHELL_DEVICE_ERROR   The statistics couldn't be read.
+
+**/
+STATIC
+SHELL_STATUS
+PrintDeviceStatistics (
+  IN RISCV_IOMMU_DIAGNOSTICS_PROTOCOL  *Diagnostics,
+  IN UINTN                             IoMmuIndex,
+  IN BOOLEAN                           HasDevice,
+  IN UINT32                            DeviceId
+  )
+{
+  EFI_STATUS                     Status;
+  SHELL_STATUS                   ShellStatus;
+  RISCV_IOMMU_DEVICE_STATISTICS  Statistics;
+  UINTN                          DomainIndex;
+
+  ShellStatus = HasDevice ? SHELL_NOT_FOUND : SHELL_SUCCESS;
+  ShellPrintHiiDefaultEx (STRING_TOKEN (STR_IOMMU_STATS_HEADER), mIoMmuShellCommandHiiHandle, IoMmuIndex);
+  for (DomainIndex = 0; ; DomainIndex++) {
+    Status = Diagnostics->GetDeviceStatistics (Diagnostics, IoMmuIndex, DomainIndex, &Statistics);
+    if (Status == EFI_NOT_FOUND) {
+      break;
+    }
+
+    if (EFI_ERROR (Status)) {
+      ShellPrintHiiDefaultEx (STRING_TOKEN (STR_IOMMU_ERROR), mIoMmuShellCommandHiiHandle, IOMMU_COMMAND_NAME, L"GetDeviceStatistics", Status);
+      return SHELL_DEVICE_ERROR;
+    }
+
+    if (HasDevice && (Statistics.DeviceId != DeviceId)) {
+      continue;
+    }
+
+    ShellStatus = SHELL_SUCCESS;
+    ShellPrintHiiDefaultEx (
+      STRING_TOKEN (STR_IOMMU_STATS_DEVICE),
+      mIoMmuShellCommandHiiHandle,
+      Statistics.DeviceId,
+      Statistics.Maps,
+      Statistics.BytesMapped
+      );
+    ShellPrintHiiDefaultEx (
+      STRING_TOKEN (STR_IOMMU_STATS_BOUNCED),
+      mIoMmuShellCommandHiiHandle,
+      Statistics.BytesBounced[RiscVIoMmuBounceAboveDmaTop],
+      Statistics.BytesBounced[RiscVIoMmuBounceAbove4GB],
+      Statistics.BytesBounced[RiscVIoMmuBounceUnaligned]
+      );
+    ShellPrintHiiDefaultEx (
+      STRING_TOKEN (STR_IOMMU_STATS_SIZES),
+      mIoMmuShellCommandHiiHandle,
+      Statistics.SizeHistogram[0],
+      Statistics.SizeHistogram[1],
+      Statistics.SizeHistogram[2],
+      Statistics.SizeHistogram[3],
+      Statistics.SizeHistogram[4],
+      Statistics.SizeHistogram[5],
+      Statistics.SizeHistogram[6],
+      Statistics.SizeHistogram[7]
+      );
+    ShellPrintHiiDefaultEx (
+      STRING_TOKEN (STR_IOMMU_STATS_MAP_TIME),
+      mIoMmuShellCommandHiiHandle,
+      (Statistics.Maps != 0) ? DivU64x64Remainder (Statistics.TotalMapTime, Statistics.Maps, NULL) : 0,
+      Statistics.MaxMapTime
+      );
+    ShellPrintHiiDefaultEx (
+      STRING_TOKEN (STR_IOMMU_STATS_UNMAP_TIME),
+      mIoMmuShellCommandHiiHandle,
+      (Statistics.Unmaps != 0) ? DivU64x64Remainder (Statistics.TotalUnmapTime, Statistics.Unmaps, NULL) : 0,
+      Statistics.MaxUnmapTime,
+      Statistics.Unmaps
+      );
+  }
+
+  return ShellStatus;
+}
+
+/**
+  Count the performance monitor events of an IOMMU for a while, and print them.
+
+  Each counter is read before and after the interval, so a cycle counter
+  that is already counting is reported as well as one started here.
+
+  @param[in]  Hpm           The performance monitor protocol.
+  @param[in]  IoMmuIndex    The index of the IOMMU.
+  @param[in]  Filter        The requests to count, or NULL to count all of them.
+  @param[in]  Milliseconds  How long to count for.
+
+  @retval  SHELL_SUCCESS        The events are printed.
+  @retval  SHELL_UNSUPPORTED    The IOMMU has no performance monitor.
+  @retval  SHELL_DEVICE_ERROR   The performance monitor couldn't be read.
+
+**/
+STATIC
+SHELL_STATUS
+MeasurePerformance (
+  IN RISCV_IOMMU_HPM_PROTOCOL      *Hpm,
+  IN UINTN                         IoMmuIndex,
+  IN CONST RISCV_IOMMU_HPM_FILTER  *Filter OPTIONAL,
+  IN UINTN                         Milliseconds
+  )
+{
+  EFI_STATUS            Status;
+  RISCV_IOMMU_HPM_INFO  Info;
+  UINT32                Counters[RiscVIoMmuHpmEventMax];
+  BOOLEAN               Counting[RiscVIoMmuHpmEventMax];
+  BOOLEAN               Started[RiscVIoMmuHpmEventMax];
+  UINT64                Before[RiscVIoMmuHpmEventMax];
+  UINT64                After;
+  UINTN                 Event;
+
+  Status = Hpm->GetInfo (Hpm, IoMmuIndex, &Info);
+  if (Status == EFI_UNSUPPORTED) {
+    ShellPrintHiiDefaultEx (STRING_TOKEN (STR_IOMMU_HPM_NONE), mIoMmuShellCommandHiiHandle, IoMmuIndex);
+    return SHELL_UNSUPPORTED;
+  }
+
+  if (EFI_ERROR (Status)) {
+    ShellPrintHiiDefaultEx (STRING_TOKEN (STR_IOMMU_ERROR), mIoMmuShellCommandHiiHandle, IOMMU_COMMAND_NAME, L"GetInfo", Status);
+    return SHELL_DEVICE_ERROR;
+  }
+
+  //
+  // Count as many of the events as there are free counters. The cycle
+  // counter can't be filtered, and may already count for someone else.
+  //
+  for (Event = 0; Event < RiscVIoMmuHpmEventMax; Event++) {
+    Counting[Event] = FALSE;
+    Started[Event]  = FALSE;
+    if ((Event != RiscVIoMmuHpmEventCycles) && (Event > Info.NumberOfCounters)) {
+      continue;
+    }
+
+    Status = Hpm->StartCounter (
+                    Hpm,
+                    IoMmuIndex,
+                    (RISCV_IOMMU_HPM_EVENT)Event,
+                    (Event == RiscVIoMmuHpmEventCycles) ? NULL : Filter,
+                    &Counters[Event]
+                    );
+    if (Status == EFI_ALREADY_STARTED) {
+      Counters[Event] = 0;
+    } else if (EFI_ERROR (Status)) {
+      continue;
+    } else {
+      Started[Event] = TRUE;
+    }
+
+    Counting[Event] = !EFI_ERROR (Hpm->ReadCounter (Hpm, IoMmuIndex, Counters[Event], &Before[Event]));
+  }
+
+  gBS->Stall (Milliseconds * 1000);
+
+  ShellPrintHiiDefaultEx (STRING_TOKEN (STR_IOMMU_HPM_HEADER), mIoMmuShellCommandHiiHandle, IoMmuIndex, Milliseconds);
+  for (Event = 0; Event < RiscVIoMmuHpmEventMax; Event++) {
+    if (Counting[Event] &&
+        !EFI_ERROR (Hpm->ReadCounter (Hpm, IoMmuIndex, Counters[Event], &After)))
+    {
+      ShellPrintHiiDefaultEx (
+        STRING_TOKEN (STR_IOMMU_HPM_COUNT),
+        mIoMmuShellCommandHiiHandle,
+        mHpmEventNames[Event],
+        After - Before[Event]
+        );
+    }
+
+    if (Started[Event]) {
+      Hpm->StopCounter (Hpm, IoMmuIndex, Counters[Event]);
+    }
+  }
+
+  return SHELL_SUCCESS;
+}
+
+/**
+  Print the calls in the trace ring of the RISC-V IOMMU driver, from the oldest.
+
+  @retval  SHELL_SUCCESS    The calls are printed.
+  @retval  SHELL_NOT_FOUND  The driver isn't tracing.
+
+**/
+STATIC
+SHELL_STATUS
+PrintTrace (
+  VOID
+  )
+{
+  RISCV_IOMMU_TRACE_TABLE        *Table;
+  CONST RISCV_IOMMU_TRACE_ENTRY  *Ring;
+  CONST RISCV_IOMMU_TRACE_ENTRY  *Entry;
+  UINT64                         NextEntry;
+  UINT64                         Oldest;
+  UINT64                         Index;
+  UINT64                         StartTime;
+  UINT64                         Timestamp;
+  UINT64                         Latency;
+  CONST CHAR16                   *Name;
+
+  if (EFI_ERROR (EfiGetSystemConfigurationTable (&gRiscVIoMmuTraceTableGuid, (VOID **)&Table)) ||
+      (Table->Signature != RISCV_IOMMU_TRACE_TABLE_SIGNATURE) ||
+      (Table->EntrySize < RISCV_IOMMU_TRACE_ENTRY_V1_SIZE) ||
+      (Table->NumberOfEntries == 0) ||
+      (Table->TimerFrequency == 0))
+  {
+    ShellPrintHiiDefaultEx (STRING_TOKEN (STR_IOMMU_TRACE_NONE), mIoMmuShellCommandHiiHandle);
+    return SHELL_NOT_FOUND;
+  }
+
+  //
+  // The driver keeps recording while the ring is printed, so only the
+  // entries that were valid when the printing started are printed.
+  //
+  Ring      = (CONST RISCV_IOMMU_TRACE_ENTRY *)((UINT8 *)Table + Table->HeaderSize);
+  NextEntry = Table->NextEntry;
+  Oldest    = (NextEntry > Table->NumberOfEntries) ? NextEntry - Table->NumberOfEntries : 0;
+  StartTime = 0;
+
+  ShellPrintHiiDefaultEx (
+    STRING_TOKEN (STR_IOMMU_TRACE_HEADER),
+    mIoMmuShellCommandHiiHandle,
+    (UINTN)(NextEntry - Oldest),
+    NextEntry,
+    Table->TimerFrequency
+    );
+  ShellPrintHiiDefaultEx (STRING_TOKEN (STR_IOMMU_TRACE_COLUMNS), mIoMmuShellCommandHiiHandle);
+  for (Index = Oldest; Index < NextEntry; Index++) {
+    if (ShellGetExecutionBreakFlag ()) {
+      break;
+    }
+
+    Entry = (CONST RISCV_IOMMU_TRACE_ENTRY *)((UINT8 *)Ring + (Index & (Table->NumberOfEntries - 1)) * Table->EntrySize);
+    if (Index == Oldest) {
+      StartTime = Entry->Timestamp;
+    }
+
+    Name      = (Entry->Event < RiscVIoMmuTraceMax) ? mTraceEventNames[Entry->Event] : mTraceEventNames[0];
+    Timestamp = DivU64x64Remainder (MultU64x32 (Entry->Timestamp - StartTime, 1000000), Table->TimerFrequency, NULL);
+    Latency   = DivU64x64Remainder (MultU64x32 (Entry->Latency, 1000000000), Table->TimerFrequency, NULL);
+    if (Entry->DeviceId == RISCV_IOMMU_TRACE_NO_DEVICE_ID) {
+      ShellPrintHiiDefaultEx (
+        STRING_TOKEN (STR_IOMMU_TRACE_ENTRY_NO_ID),
+        mIoMmuShellCommandHiiHandle,
+        Timestamp,
+        Name,
+        Entry->DeviceAddress,
+        Entry->Length,
+        Latency,
+        (EFI_STATUS)Entry->Status
+        );
+    } else {
+      ShellPrintHiiDefaultEx (
+        STRING_TOKEN (STR_IOMMU_TRACE_ENTRY),
+        mIoMmuShellCommandHiiHandle,
+        Timestamp,
+        Name,
+        Entry->DeviceId,
+        Entry->DeviceAddress,
+        Entry->Length,
+        Latency,
+        (EFI_STATUS)Entry->Status
+        );
+    }
+  }
+
+  return SHELL_SUCCESS;
+}
+
+/**
+  Save the calls in the trace ring of the RISC-V IOMMU driver to a file, from the oldest,
+  for the host benchmark of the driver to replay.
+
+  The file is the header of the ring, with NextEntry the number of entries saved,
+  followed by the entries.
+
+  @param[in]  FileName  The file, which is replaced.
+
+  @retval  SHELL_SUCCESS            The calls are saved.
+  @retval  SHELL_NOT_FOUND          The driver isn't tracing.
+  @retval  SHELL_UNSUPPORTED        The driver doesn't trace the arguments that a replay needs.
+  @retval  SHELL_OUT_OF_RESOURCES   The calls could not be copied.
+  @retval  SHELL_DEVICE_ERROR       The file could not be written.
+
+**/
+STATIC
+SHELL_STATUS
+SaveTrace (
+  IN CONST CHAR16  *FileName
+  )
+{
+  RISCV_IOMMU_TRACE_TABLE  *Table;
+  RISCV_IOMMU_TRACE_TABLE  *Copy;
+  CONST UINT8              *Ring;
+  UINT8                    *Entries;
+  UINT64                   NextEntry;
+  UINT64                   Oldest;
+  UINT64                   Index;
+  UINTN                    Size;
+  SHELL_FILE_HANDLE        FileHandle;
+  EFI_STATUS               Status;
+
+  if (EFI_ERROR (EfiGetSystemConfigurationTable (&gRiscVIoMmuTraceTableGuid, (VOID **)&Table)) ||
+      (Table->Signature != RISCV_IOMMU_TRACE_TABLE_SIGNATURE) ||
+      (Table->EntrySize < RISCV_IOMMU_TRACE_ENTRY_V1_SIZE) ||
+      (Table->NumberOfEntries == 0) ||
+      (Table->TimerFrequency == 0))
+  {
+    ShellPrintHiiDefaultEx (STRING_TOKEN (STR_IOMMU_TRACE_NONE), mIoMmuShellCommandHiiHandle);
+    return SHELL_NOT_FOUND;
+  }
+
+  if ((Table->Revision < 0x00010001) || (Table->EntrySize < sizeof (RISCV_IOMMU_TRACE_ENTRY))) {
+    ShellPrintHiiDefaultEx (STRING_TOKEN (STR_IOMMU_TRACE_NO_REPLAY), mIoMmuShellCommandHiiHandle);
+    return SHELL_UNSUPPORTED;
+  }
+
+  //
+  // As when printing, only the entries that were valid at the start are saved.
+  //
+  Ring      = (CONST UINT8 *)Table + Table->HeaderSize;
+  NextEntry = Table->NextEntry;
+  Oldest    = (NextEntry > Table->NumberOfEntries) ? NextEntry - Table->NumberOfEntries : 0;
+  Size      = Table->HeaderSize + (UINTN)(NextEntry - Oldest) * Table->EntrySize;
+
+  Copy = AllocatePool (Size);
+  if (Copy == NULL) {
+    return SHELL_OUT_OF_RESOURCES;
+  }
+
+  CopyMem (Copy, Table, Table->HeaderSize);
+  Copy->NextEntry = NextEntry - Oldest;
+  Entries         = (UINT8 *)Copy + Table->HeaderSize;
+  for (Index = Oldest; Index < NextEntry; Index++) {
+    CopyMem (
+      Entries + (UINTN)(Index - Oldest) * Table->EntrySize,
+      Ring + (UINTN)(Index & (Table->NumberOfEntries - 1)) * Table->EntrySize,
+      Table->EntrySize
+      );
+  }
+
+  //
+  // A longer file of an earlier trace would otherwise keep its tail.
+  //
+  Status = ShellOpenFileByName (FileName, &FileHandle, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE, 0);
+  if (!EFI_ERROR (Status)) {
+    ShellDeleteFile (&FileHandle);
+  }
+
+  Status = ShellOpenFileByName (FileName, &FileHandle, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE, 0);
+  if (EFI_ERROR (Status)) {
+    ShellPrintHiiDefaultEx (STRING_TOKEN (STR_GEN_FILE_OPEN_FAIL), mIoMmuShellCommandHiiHandle, IOMMU_COMMAND_NAME, FileName);
+    FreePool (Copy);
+    return SHELL_DEVICE_ERROR;
+  }
+
+  Status = ShellWriteFile (FileHandle, &Size, Copy);
+  ShellCloseFile (&FileHandle);
+  FreePool (Copy);
+  if (EFI_ERROR (Status)) {
+    ShellPrintHiiDefaultEx (STRING_TOKEN (STR_IOMMU_ERROR), mIoMmuShellCommandHiiHandle, IOMMU_COMMAND_NAME, FileName, Status);
+    return SHELL_DEVICE_ERROR;
+  }
+
+  ShellPrintHiiDefaultEx (STRING_TOKEN (STR_IOMMU_TRACE_SAVED), mIoMmuShellCommandHiiHandle, (UINTN)(NextEntry - Oldest), FileName);
+  return SHELL_SUCCESS;
+}
+
+/**
+  Main entry function for the "iommu" command/app.
+
+  @param[in] ImageHandle  Handle to the Image (NULL if Internal).
+  @param[in] SystemTable  Pointer to the System Table (NULL if Internal).
+
+  @retval   SHELL_SUCCESS               The "iommu" shell command executed successfully.
+  @retval   SHELL_ABORTED               Failed to initialize the shell library.
+  @retval   SHELL_INVALID_PARAMETER     An argument passed to the shell command is invalid.
+  @retval   SHELL_NOT_FOUND             The RISC-V IOMMU driver, or the requested state, was not found.
+  @retval   Others                      A different error occurred.
+
+**/
+SHELL_STATUS
+EFIAPI
+RunIoMmu (
+  IN EFI_HANDLE        ImageHandle,
+  IN EFI_SYSTEM_TABLE  *SystemTable
+  )
+{
+  EFI_STATUS                        Status;
+  SHELL_STATUS                      ShellStatus;
+  SHELL_STATUS                      IoMmuStatus;
+  LIST_ENTRY                        *Package;
+  CHAR16                            *ProblemParam;
+  RISCV_IOMMU_DIAGNOSTICS_PROTOCOL  *Diagnostics;
+  RISCV_IOMMU_HPM_PROTOCOL          *Hpm;
+  RISCV_IOMMU_INSTANCE_STATISTICS   Statistics;
+  RISCV_IOMMU_HPM_FILTER            Filter;
+  BOOLEAN                           HasIndex;
+  BOOLEAN                           HasDevice;
+  BOOLEAN                           HasAddress;
+  BOOLEAN                           HasSource;
+  BOOLEAN                           HasTime;
+  BOOLEAN                           Performance;
+  BOOLEAN                           Trace;
+  BOOLEAN                           Mappings;
+  CONST CHAR16                      *FileName;
+  UINT64                            IoMmuIndex;
+  UINT64                            DeviceId;
+  UINT64                            IoVirtualAddress;
+  UINT64                            SourceId;
+  UINT64                            Milliseconds;
+  UINTN                             Index;
+
+  Package      = NULL;
+  ShellStatus  = SHELL_INVALID_PARAMETER;
+  Hpm          = NULL;
+  IoMmuIndex   = 0;
+  Milliseconds = IOMMU_DEFAULT_MEASURE_MS;
+
+  Status = ShellInitialize ();
+  if (EFI_ERROR (Status)) {
+    ASSERT_EFI_ERROR (Status);
+    return SHELL_ABORTED;
+  }
+
+  Status = ShellCommandLineParse (ParamList, &Package, &ProblemParam, TRUE);
+  if (EFI_ERROR (Status)) {
+    if ((Status == EFI_VOLUME_CORRUPTED) && (ProblemParam != NULL)) {
+      ShellPrintHiiDefaultEx (STRING_TOKEN (STR_GEN_PROBLEM), mIoMmuShellCommandHiiHandle, IOMMU_COMMAND_NAME, ProblemParam);
+      FreePool (ProblemParam);
+    } else {
+      ASSERT (FALSE);
+    }
+
+    goto Done;
+  }
+
+  if (ShellCommandLineGetCount (Package) > 1) {
+    ShellPrintHiiDefaultEx (STRING_TOKEN (STR_GEN_TOO_MANY), mIoMmuShellCommandHiiHandle, IOMMU_COMMAND_NAME);
+    goto Done;
+  }
+
+  Performance = ShellCommandLineGetFlag (Package, IOMMU_FLAG_PERFORMANCE_STR);
+  Trace       = ShellCommandLineGetFlag (Package, IOMMU_FLAG_TRACE_STR);
+  Mappings    = ShellCommandLineGetFlag (Package, IOMMU_FLAG_MAPPINGS_STR);
+  FileName    = ShellCommandLineGetValue (Package, IOMMU_FLAG_FILE_STR);
+  if (ShellCommandLineGetFlag (Package, IOMMU_FLAG_FILE_STR) && (FileName == NULL)) {
+    ShellPrintHiiDefaultEx (STRING_TOKEN (STR_GEN_NO_VALUE), mIoMmuShellCommandHiiHandle, IOMMU_COMMAND_NAME, IOMMU_FLAG_FILE_STR);
+    goto Done;
+  }
+
+  if ((GetFlagNumber (Package, IOMMU_FLAG_INDEX_STR, FALSE, &HasIndex, &IoMmuIndex) != SHELL_SUCCESS) ||
+      (GetFlagNumber (Package, IOMMU_FLAG_DEVICE_STR, TRUE, &HasDevice, &DeviceId) != SHELL_SUCCESS) ||
+      (GetFlagNumber (Package, IOMMU_FLAG_ADDRESS_STR, TRUE, &HasAddress, &IoVirtualAddress) != SHELL_SUCCESS) ||
+      (GetFlagNumber (Package, IOMMU_FLAG_SOURCE_STR, TRUE, &HasSource, &SourceId) != SHELL_SUCCESS) ||
+      (GetFlagNumber (Package, IOMMU_FLAG_TIME_STR, FALSE, &HasTime, &Milliseconds) != SHELL_SUCCESS))
+  {
+    goto Done;
+  }
+
+  //
+  // -a walks the device of -d, -s and -t qualify -p, and -p counts the
+  // events of the whole IOMMU rather than displaying a device.
+  //
+  if ((HasAddress && !HasDevice) || (Performance && HasDevice)) {
+    ShellPrintHiiDefaultEx (STRING_TOKEN (STR_GEN_PARAM_INV), mIoMmuShellCommandHiiHandle, IOMMU_COMMAND_NAME, HasAddress ? IOMMU_FLAG_ADDRESS_STR : IOMMU_FLAG_DEVICE_STR);
+    goto Done;
+  }
+
+  //
+  // -m prints the mapping statistics of every device, or of the device of -d.
+  //
+  if (Mappings && (HasAddress || Performance)) {
+    ShellPrintHiiDefaultEx (STRING_TOKEN (STR_GEN_PARAM_INV), mIoMmuShellCommandHiiHandle, IOMMU_COMMAND_NAME, IOMMU_FLAG_MAPPINGS_STR);
+    goto Done;
+  }
+
+  //
+  // -f saves the trace ring of -r rather than printing it.
+  //
+  if ((FileName != NULL) && !Trace) {
+    ShellPrintHiiDefaultEx (STRING_TOKEN (STR_GEN_PARAM_INV), mIoMmuShellCommandHiiHandle, IOMMU_COMMAND_NAME, IOMMU_FLAG_FILE_STR);
+    goto Done;
+  }
+
+  if ((HasSource || HasTime) && !Performance) {
+    ShellPrintHiiDefaultEx (STRING_TOKEN (STR_GEN_PARAM_INV), mIoMmuShellCommandHiiHandle, IOMMU_COMMAND_NAME, HasSource ? IOMMU_FLAG_SOURCE_STR : IOMMU_FLAG_TIME_STR);
+    goto Done;
+  }
+
+  if ((HasDevice && (DeviceId > MAX_UINT32)) || (HasSource && (SourceId > MAX_UINT32)) || (Milliseconds > MAX_UINTN / 1000)) {
+    ShellPrintHiiDefaultEx (STRING_TOKEN (STR_GEN_PARAM_INV), mIoMmuShellCommandHiiHandle, IOMMU_COMMAND_NAME, ShellCommandLineGetValue (Package, HasSource ? IOMMU_FLAG_SOURCE_STR : IOMMU_FLAG_DEVICE_STR));
+    goto Done;
+  }
+
+  //
+  // The trace ring is the driver's, rather than an IOMMU's.
+  //
+  if (Trace) {
+    if (HasIndex || HasDevice || Performance || Mappings) {
+      ShellPrintHiiDefaultEx (STRING_TOKEN (STR_GEN_PARAM_INV), mIoMmuShellCommandHiiHandle, IOMMU_COMMAND_NAME, IOMMU_FLAG_TRACE_STR);
+    } else if (FileName != NULL) {
+      ShellStatus = SaveTrace (FileName);
+    } else {
+      ShellStatus = PrintTrace ();
+    }
+
+    goto Done;
+  }
+
+  ShellStatus = SHELL_NOT_FOUND;
+  Status      = gBS->LocateProtocol (&gRiscVIoMmuDiagnosticsProtocolGuid, NULL, (VOID **)&Diagnostics);
+  if (EFI_ERROR (Status)) {
+    ShellPrintHiiDefaultEx (STRING_TOKEN (STR_IOMMU_NO_PROTOCOL), mIoMmuShellCommandHiiHandle, L"Diagnostics");
+    goto Done;
+  }
+
+  if (Mappings && (Diagnostics->Revision < 0x00010002)) {
+    ShellPrintHiiDefaultEx (STRING_TOKEN (STR_IOMMU_STATS_NONE), mIoMmuShellCommandHiiHandle);
+    goto Done;
+  }
+
+  if (Performance) {
+    Status = gBS->LocateProtocol (&gRiscVIoMmuHpmProtocolGuid, NULL, (VOID **)&Hpm);
+    if (EFI_ERROR (Status)) {
+      ShellPrintHiiDefaultEx (STRING_TOKEN (STR_IOMMU_NO_PROTOCOL), mIoMmuShellCommandHiiHandle, L"Performance Monitor");
+      goto Done;
+    }
+
+    if (HasSource) {
+      Filter.Type = RiscVIoMmuHpmFilterDeviceId;
+      Filter.Id   = (UINT32)SourceId;
+    }
+  }
+
+  if (!HasDevice && !Performance && !Mappings) {
+    ShellStatus = PrintDriverStatistics (Diagnostics);
+    if (ShellStatus != SHELL_SUCCESS) {
+      goto Done;
+    }
+  }
+
+  //
+  // Visit the IOMMU of -i, or every IOMMU until the first index that
+  // isn't found.
+  //
+  for (Index = HasIndex ? (UINTN)IoMmuIndex : 0; ; Index++) {
+    Status = Diagnostics->GetInstanceStatistics (Diagnostics, Index, &Statistics);
+    if (Status == EFI_NOT_FOUND) {
+      if (HasIndex) {
+        ShellPrintHiiDefaultEx (STRING_TOKEN (STR_IOMMU_NOT_FOUND), mIoMmuShellCommandHiiHandle, Index);
+        ShellStatus = SHELL_NOT_FOUND;
+      }
+
+      break;
+    }
+
+    if (EFI_ERROR (Status)) {
+      ShellPrintHiiDefaultEx (STRING_TOKEN (STR_IOMMU_ERROR), mIoMmuShellCommandHiiHandle, IOMMU_COMMAND_NAME, L"GetInstanceStatistics", Status);
+      ShellStatus = SHELL_DEVICE_ERROR;
+      break;
+    }
+
+    if (Mappings) {
+      IoMmuStatus = PrintDeviceStatistics (Diagnostics, Index, HasDevice, (UINT32)DeviceId);
+    } else if (Performance) {
+      IoMmuStatus = MeasurePerformance (Hpm, Index, HasSource ? &Filter : NULL, (UINTN)Milliseconds);
+    } else if (HasAddress) {
+      IoMmuStatus = PrintPageTableWalk (Diagnostics, Index, Statistics.PageTableLevels, (UINT32)DeviceId, IoVirtualAddress);
+    } else if (HasDevice) {
+      IoMmuStatus = PrintDeviceContext (Diagnostics, Index, (UINT32)DeviceId);
+    } else {
+      PrintInstanceStatistics (Index, &Statistics);
+      IoMmuStatus = SHELL_SUCCESS;
+    }
+
+    //
+    // A device may be behind any one IOMMU, so it is found if any knows it.
+    //
+    if ((ShellStatus != SHELL_SUCCESS) || (IoMmuStatus == SHELL_SUCCESS)) {
+      ShellStatus = IoMmuStatus;
+    }
+
+    if (HasIndex) {
+      break;
+    }
+  }
+
+Done:
+  if (Package != NULL) {
+    ShellCommandLineFreeVarList (Package);
+  }
+
+  return ShellStatus;
+}
+
+/**
+  Retrieve HII package list from ImageHandle and publish to HII database.
+
+  @param[in] ImageHandle    The image handle of the process.
+
+  @return HII handle.
+
+**/
+EFI_HII_HANDLE
+InitializeHiiPackage (
+  IN  EFI_HANDLE  ImageHandle
+  )
+{
+  EFI_STATUS                   Status;
+  EFI_HII_PACKAGE_LIST_HEADER  *PackageList;
+  EFI_HII_HANDLE               HiiHandle;
+
+  //
+  // Retrieve HII package list from ImageHandle
+  //
+  Status = gBS->OpenProtocol (
+                  ImageHandle,
+                  &gEfiHiiPackageListProtocolGuid,
+                  (VOID **)&PackageList,
+                  ImageHandle,
+                  NULL,
+                  EFI_OPEN_PROTOCOL_GET_PROTOCOL
+                  );
+  ASSERT_EFI_ERROR (Status);
+  if (EFI_ERROR (Status)) {
+    return NULL;
+  }
+
+  //
+  // Publish HII package list to HII Database.
+  //
+  Status = gHiiDatabase->NewPackageList (
+                           gHiiDatabase,
+                           PackageList,
+                           NULL,
+                           &HiiHandle
+                           );
+  ASSERT_EFI_ERROR (Status);
+  if (EFI_ERROR (Status)) {
+    return NULL;
+  }
+
+  return HiiHandle;
+}
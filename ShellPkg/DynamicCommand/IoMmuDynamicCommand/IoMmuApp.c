@@ -0,0 +1,57 @@
+/** @file
+  Functionality specific for standalone UEFI application support.
+
+  This application reports the state of the RISC-V IOMMU driver and of
+  its IOMMUs in the UEFI shell.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include "IoMmu.h"
+
+#include <Library/BaseLib.h>
+#include <Library/HiiLib.h>
+
+//
+// String token ID of help message text.
+// Shell supports finding the help message in the resource section of an
+// application image if a .MAN file is not found. This global variable is added
+// to make the build tool recognize that the help string is consumed by the user and
+// then the build tool will add the string into the resource section. Thus the
+// application can use '-?' option to show help message in Shell.
+//
+GLOBAL_REMOVE_IF_UNREFERENCED EFI_STRING_ID  mStringHelpTokenId = STRING_TOKEN (STR_GET_HELP_IOMMU);
+
+/**
+  Entry of the "iommu" application.
+
+  @param ImageHandle            The image handle of the process.
+  @param SystemTable            The EFI System Table pointer.
+
+  @retval EFI_SUCCESS           The application successfully initialized.
+  @retval EFI_ABORTED           The application failed to initialize.
+  @retval Others                A different error occurred.
+
+**/
+EFI_STATUS
+EFIAPI
+IoMmuAppInitialize (
+  IN EFI_HANDLE        ImageHandle,
+  IN EFI_SYSTEM_TABLE  *SystemTable
+  )
+{
+  EFI_STATUS  Status;
+
+  mIoMmuShellCommandHiiHandle = InitializeHiiPackage (ImageHandle);
+  if (mIoMmuShellCommandHiiHandle == NULL) {
+    return EFI_ABORTED;
+  }
+
+  Status = (EFI_STATUS)RunIoMmu (ImageHandle, SystemTable);
+
+  HiiRemovePackages (mIoMmuShellCommandHiiHandle);
+
+  return Status;
+}
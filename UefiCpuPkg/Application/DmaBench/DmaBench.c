@@ -0,0 +1,729 @@
+/** @file
+  UEFI Application to measure the DMA throughput of boot devices, and the cost of
+  the IOMMU to it.
+
+  Reads disks through EFI_BLOCK_IO2_PROTOCOL, sends frames through
+  EFI_SIMPLE_NETWORK_PROTOCOL, and times Map() and Unmap() of each PCI root bridge,
+  which is where the IOMMU driver translates every buffer of those devices. The
+  configuration of the IOMMU is fixed when the firmware is built, so it is only
+  reported, and the application is run once on a build of each configuration.
+
+  Usage: DmaBench [-t <milliseconds>] [-q <depth>] [-n <iterations>]
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/TimerLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+#include <Protocol/BlockIo2.h>
+#include <Protocol/IoMmu.h>
+#include <Protocol/PciRootBridgeIo.h>
+#include <Protocol/RiscVIoMmuDiagnostics.h>
+#include <Protocol/ShellParameters.h>
+#include <Protocol/SimpleNetwork.h>
+
+#define DMA_BENCH_DEFAULT_TIME_MS     2000
+#define DMA_BENCH_DEFAULT_DEPTH       8
+#define DMA_BENCH_DEFAULT_ITERATIONS  1024
+#define DMA_BENCH_MAX_DEPTH           64
+
+//
+// The EtherType of the frames sent, the one IEEE 802 reserves for local experiments.
+//
+#define DMA_BENCH_ETHER_TYPE  0x88B5
+
+typedef struct {
+  UINTN    TimeMs;
+  UINTN    Depth;
+  UINTN    Iterations;
+} DMA_BENCH_OPTIONS;
+
+typedef struct {
+  CONST CHAR16    *Name;
+  UINT32          TransferSize;
+  BOOLEAN         Random;
+} DMA_BENCH_DISK_WORKLOAD;
+
+typedef struct {
+  EFI_BLOCK_IO2_TOKEN    Token;
+  VOID                   *Buffer;
+  BOOLEAN                Busy;
+} DMA_BENCH_REQUEST;
+
+STATIC CONST DMA_BENCH_DISK_WORKLOAD  mDiskWorkloads[] = {
+  { L"4K random read",     SIZE_4KB, TRUE  },
+  { L"1M sequential read", SIZE_1MB, FALSE },
+};
+
+STATIC CONST UINTN  mMapSizes[] = { SIZE_4KB, SIZE_64KB, SIZE_1MB };
+
+//
+// The names of the PcdRiscVIoMmuDefaultDeviceMode values.
+//
+STATIC CONST CHAR16  *mDeviceModeNames[] = {
+  L"strict",
+  L"identity",
+  L"bypass",
+  L"permissive"
+};
+
+STATIC UINT32  mRandomState = 1;
+
+/**
+  Get the next number of a fixed pseudo-random sequence, so that every run reads the same blocks.
+
+  @return  The number.
+
+**/
+STATIC
+UINT32
+GetRandom (
+  VOID
+  )
+{
+  mRandomState = mRandomState * 1103515245 + 12345;
+  return mRandomState >> 8;
+}
+
+/**
+  Convert the ticks between two reads of the time CSR to microseconds.
+
+  @param[in]  Start  The earlier read.
+  @param[in]  End    The later read.
+
+  @return  The microseconds, at least 1.
+
+**/
+STATIC
+UINT64
+TicksToMicroseconds (
+  IN UINT64  Start,
+  IN UINT64  End
+  )
+{
+  return MAX (DivU64x32 (GetTimeInNanoSecond (End - Start), 1000), 1);
+}
+
+/**
+  Print the throughput of a workload.
+
+  @param[in]  Name          The name of the workload.
+  @param[in]  Bytes         The bytes transferred.
+  @param[in]  Operations    The requests or frames completed.
+  @param[in]  Microseconds  The time the workload ran.
+  @param[in]  Unit          The name of an operation per second.
+
+**/
+STATIC
+VOID
+PrintThroughput (
+  IN CONST CHAR16  *Name,
+  IN UINT64        Bytes,
+  IN UINT64        Operations,
+  IN UINT64        Microseconds,
+  IN CONST CHAR16  *Unit
+  )
+{
+  Print (
+    L"  %-20s %6lu MB/s %8lu %s\n",
+    Name,
+    RShiftU64 (DivU64x64Remainder (MultU64x32 (Bytes, 1000000), Microseconds, NULL), 20),
+    DivU64x64Remainder (MultU64x32 (Operations, 1000000), Microseconds, NULL),
+    Unit
+    );
+}
+
+/**
+  Read the options of the command line.
+
+  @param[in]   ImageHandle  The image handle of the application.
+  @param[out]  Options      The options, defaulted where they aren't given.
+
+  @retval  EFI_SUCCESS            Options is filled in.
+  @retval  EFI_INVALID_PARAMETER  An option is unknown, or has no or an invalid value.
+
+**/
+STATIC
+EFI_STATUS
+ParseOptions (
+  IN  EFI_HANDLE         ImageHandle,
+  OUT DMA_BENCH_OPTIONS  *Options
+  )
+{
+  EFI_SHELL_PARAMETERS_PROTOCOL  *ShellParameters;
+  EFI_STATUS                     Status;
+  UINTN                          Index;
+  UINTN                          *Value;
+
+  Options->TimeMs     = DMA_BENCH_DEFAULT_TIME_MS;
+  Options->Depth      = DMA_BENCH_DEFAULT_DEPTH;
+  Options->Iterations = DMA_BENCH_DEFAULT_ITERATIONS;
+
+  //
+  // Without the shell, there are no options.
+  //
+  Status = gBS->HandleProtocol (ImageHandle, &gEfiShellParametersProtocolGuid, (VOID **)&ShellParameters);
+  if (EFI_ERROR (Status)) {
+    return EFI_SUCCESS;
+  }
+
+  for (Index = 1; Index < ShellParameters->Argc; Index += 2) {
+    if (StrCmp (ShellParameters->Argv[Index], L"-t") == 0) {
+      Value = &Options->TimeMs;
+    } else if (StrCmp (ShellParameters->Argv[Index], L"-q") == 0) {
+      Value = &Options->Depth;
+    } else if (StrCmp (ShellParameters->Argv[Index], L"-n") == 0) {
+      Value = &Options->Iterations;
+    } else {
+      Print (L"DmaBench: unknown option %s\n", ShellParameters->Argv[Index]);
+      return EFI_INVALID_PARAMETER;
+    }
+
+    if ((Index + 1 >= ShellParameters->Argc) ||
+        EFI_ERROR (StrDecimalToUintnS (ShellParameters->Argv[Index + 1], NULL, Value)) ||
+        (*Value == 0))
+    {
+      Print (L"DmaBench: %s needs a number above 0\n", ShellParameters->Argv[Index]);
+      return EFI_INVALID_PARAMETER;
+    }
+  }
+
+  Options->Depth = MIN (Options->Depth, DMA_BENCH_MAX_DEPTH);
+  return EFI_SUCCESS;
+}
+
+/**
+  Print the configuration of the IOMMU that the results are of.
+
+**/
+STATIC
+VOID
+PrintConfiguration (
+  VOID
+  )
+{
+  EDKII_IOMMU_PROTOCOL              *IoMmu;
+  RISCV_IOMMU_DIAGNOSTICS_PROTOCOL  *Diagnostics;
+  RISCV_IOMMU_DRIVER_STATISTICS     Statistics;
+  EFI_STATUS                        Status;
+
+  Status = gBS->LocateProtocol (&gEdkiiIoMmuProtocolGuid, NULL, (VOID **)&IoMmu);
+  if (EFI_ERROR (Status)) {
+    Print (L"IOMMU: absent\n");
+    return;
+  }
+
+  Status = gBS->LocateProtocol (&gRiscVIoMmuDiagnosticsProtocolGuid, NULL, (VOID **)&Diagnostics);
+  if (EFI_ERROR (Status) || (Diagnostics->Revision < 0x00010001)) {
+    Print (L"IOMMU: present, configuration unknown\n");
+    return;
+  }
+
+  ZeroMem (&Statistics, sizeof (Statistics));
+  Status = Diagnostics->GetDriverStatistics (Diagnostics, &Statistics);
+  if (EFI_ERROR (Status)) {
+    Print (L"IOMMU: present, configuration unknown\n");
+    return;
+  }
+
+  if (Statistics.NumberOfIoMmus == 0) {
+    Print (L"IOMMU: absent, the driver found none\n");
+    return;
+  }
+
+  Print (
+    L"IOMMU: %lu, %s",
+    (UINT64)Statistics.NumberOfIoMmus,
+    (Statistics.DefaultDeviceMode < ARRAY_SIZE (mDeviceModeNames)) ? mDeviceModeNames[Statistics.DefaultDeviceMode] : L"?"
+    );
+  if (Statistics.DefaultDeviceMode == 0) {
+    Print (L", %s invalidation", Statistics.LazyInvalidation ? L"lazy" : L"strict");
+  }
+
+  Print (L"\n");
+}
+
+/**
+  Time Map() and Unmap() of a root bridge, for buffers of each size.
+
+  @param[in]  RootBridgeIo  The root bridge.
+  @param[in]  Options       The options.
+
+**/
+STATIC
+VOID
+BenchmarkRootBridge (
+  IN EFI_PCI_ROOT_BRIDGE_IO_PROTOCOL  *RootBridgeIo,
+  IN DMA_BENCH_OPTIONS                *Options
+  )
+{
+  VOID                  *Buffer;
+  UINTN                 SizeIndex;
+  UINTN                 Index;
+  UINTN                 NumberOfBytes;
+  EFI_PHYSICAL_ADDRESS  DeviceAddress;
+  VOID                  *Mapping;
+  UINT64                Start;
+  UINT64                Ticks;
+  UINT64                MapTicks;
+  UINT64                MapMaxTicks;
+  UINT64                UnmapTicks;
+  UINTN                 Bounced;
+  EFI_STATUS            Status;
+
+  Print (L"Root bridge %d\n", RootBridgeIo->SegmentNumber);
+
+  Buffer = AllocatePages (EFI_SIZE_TO_PAGES (SIZE_1MB));
+  if (Buffer == NULL) {
+    Print (L"  Out of memory\n");
+    return;
+  }
+
+  for (SizeIndex = 0; SizeIndex < ARRAY_SIZE (mMapSizes); SizeIndex++) {
+    MapTicks    = 0;
+    MapMaxTicks = 0;
+    UnmapTicks  = 0;
+    Bounced     = 0;
+
+    for (Index = 0; Index < Options->Iterations; Index++) {
+      NumberOfBytes = mMapSizes[SizeIndex];
+      Start         = RiscVReadTimer ();
+      Status        = RootBridgeIo->Map (
+                                      RootBridgeIo,
+                                      EfiPciOperationBusMasterWrite64,
+                                      Buffer,
+                                      &NumberOfBytes,
+                                      &DeviceAddress,
+                                      &Mapping
+                                      );
+      Ticks = RiscVReadTimer () - Start;
+      if (EFI_ERROR (Status)) {
+        Print (L"  Map of %lu bytes failed: %r\n", (UINT64)mMapSizes[SizeIndex], Status);
+        break;
+      }
+
+      MapTicks   += Ticks;
+      MapMaxTicks = MAX (MapMaxTicks, Ticks);
+      if (DeviceAddress != (UINTN)Buffer) {
+        Bounced++;
+      }
+
+      Start       = RiscVReadTimer ();
+      RootBridgeIo->Unmap (RootBridgeIo, Mapping);
+      UnmapTicks += RiscVReadTimer () - Start;
+    }
+
+    if (Index == 0) {
+      continue;
+    }
+
+    Print (
+      L"  Map %7lu bytes: %6lu ticks, max %6lu, Unmap %6lu ticks, %lu ns/op, %lu%% remapped\n",
+      (UINT64)mMapSizes[SizeIndex],
+      DivU64x32 (MapTicks, (UINT32)Index),
+      MapMaxTicks,
+      DivU64x32 (UnmapTicks, (UINT32)Index),
+      DivU64x32 (GetTimeInNanoSecond (MapTicks + UnmapTicks), (UINT32)Index),
+      (UINT64)(Bounced * 100 / Index)
+      );
+  }
+
+  FreePages (Buffer, EFI_SIZE_TO_PAGES (SIZE_1MB));
+}
+
+/**
+  Read a disk for a while, with requests of a size kept in flight at a depth.
+
+  @param[in]  BlockIo2  The disk.
+  @param[in]  Workload  The size and pattern of the requests.
+  @param[in]  Options   The options.
+
+**/
+STATIC
+VOID
+BenchmarkDiskWorkload (
+  IN EFI_BLOCK_IO2_PROTOCOL         *BlockIo2,
+  IN CONST DMA_BENCH_DISK_WORKLOAD  *Workload,
+  IN DMA_BENCH_OPTIONS              *Options
+  )
+{
+  DMA_BENCH_REQUEST   Requests[DMA_BENCH_MAX_DEPTH];
+  EFI_BLOCK_IO_MEDIA  *Media;
+  UINTN               Alignment;
+  UINTN               Pages;
+  UINT64              BlocksPerRequest;
+  UINT64              Slots;
+  UINT64              NextSlot;
+  UINT64              Start;
+  UINT64              Deadline;
+  UINT64              Completed;
+  UINTN               InFlight;
+  UINTN               Index;
+  BOOLEAN             Stopping;
+  EFI_STATUS          Status;
+
+  Media            = BlockIo2->Media;
+  BlocksPerRequest = Workload->TransferSize / Media->BlockSize;
+  Slots            = DivU64x64Remainder (Media->LastBlock + 1, BlocksPerRequest, NULL);
+  if ((BlocksPerRequest == 0) || (Slots == 0)) {
+    return;
+  }
+
+  Alignment = MAX (Media->IoAlign, EFI_PAGE_SIZE);
+  Pages     = EFI_SIZE_TO_PAGES (Workload->TransferSize);
+  ZeroMem (Requests, sizeof (Requests));
+  for (Index = 0; Index < Options->Depth; Index++) {
+    Requests[Index].Buffer = AllocateAlignedPages (Pages, Alignment);
+    Status                 = gBS->CreateEvent (0, TPL_APPLICATION, NULL, NULL, &Requests[Index].Token.Event);
+    if ((Requests[Index].Buffer == NULL) || EFI_ERROR (Status)) {
+      Print (L"  %-20s out of resources\n", Workload->Name);
+      goto Done;
+    }
+  }
+
+  NextSlot  = 0;
+  Completed = 0;
+  InFlight  = 0;
+  Stopping  = FALSE;
+  Start     = RiscVReadTimer ();
+  Deadline  = Start + DivU64x64Remainder (
+                        MultU64x32 (GetPerformanceCounterProperties (NULL, NULL), (UINT32)Options->TimeMs),
+                        1000,
+                        NULL
+                        );
+
+  do {
+    Stopping = Stopping || (RiscVReadTimer () >= Deadline);
+
+    for (Index = 0; Index < Options->Depth; Index++) {
+      if (Requests[Index].Busy) {
+        if (gBS->CheckEvent (Requests[Index].Token.Event) == EFI_NOT_READY) {
+          continue;
+        }
+
+        Requests[Index].Busy = FALSE;
+        InFlight--;
+        if (EFI_ERROR (Requests[Index].Token.TransactionStatus)) {
+          Print (L"  %-20s read failed: %r\n", Workload->Name, Requests[Index].Token.TransactionStatus);
+          Stopping = TRUE;
+        } else {
+          Completed++;
+        }
+      }
+
+      if (Stopping) {
+        continue;
+      }
+
+      Status = BlockIo2->ReadBlocksEx (
+                           BlockIo2,
+                           Media->MediaId,
+                           MultU64x64 (Workload->Random ? (GetRandom () % Slots) : NextSlot, BlocksPerRequest),
+                           &Requests[Index].Token,
+                           Workload->TransferSize,
+                           Requests[Index].Buffer
+                           );
+      if (EFI_ERROR (Status)) {
+        Print (L"  %-20s read failed: %r\n", Workload->Name, Status);
+        Stopping = TRUE;
+        continue;
+      }
+
+      NextSlot             = (NextSlot + 1 < Slots) ? NextSlot + 1 : 0;
+      Requests[Index].Busy = TRUE;
+      InFlight++;
+    }
+  } while (!Stopping || (InFlight != 0));
+
+  PrintThroughput (
+    Workload->Name,
+    MultU64x32 (Completed, Workload->TransferSize),
+    Completed,
+    TicksToMicroseconds (Start, RiscVReadTimer ()),
+    L"IOPS"
+    );
+
+Done:
+  for (Index = 0; Index < Options->Depth; Index++) {
+    if (Requests[Index].Token.Event != NULL) {
+      gBS->CloseEvent (Requests[Index].Token.Event);
+    }
+
+    if (Requests[Index].Buffer != NULL) {
+      FreeAlignedPages (Requests[Index].Buffer, Pages);
+    }
+  }
+}
+
+/**
+  Run the read workloads on a disk. Partitions are skipped, as their disk is read.
+
+  @param[in]  Handle   The handle of the disk.
+  @param[in]  Options  The options.
+
+**/
+STATIC
+VOID
+BenchmarkDisk (
+  IN EFI_HANDLE         Handle,
+  IN DMA_BENCH_OPTIONS  *Options
+  )
+{
+  EFI_BLOCK_IO2_PROTOCOL  *BlockIo2;
+  UINTN                   Index;
+  EFI_STATUS              Status;
+
+  Status = gBS->HandleProtocol (Handle, &gEfiBlockIo2ProtocolGuid, (VOID **)&BlockIo2);
+  if (EFI_ERROR (Status) || !BlockIo2->Media->MediaPresent || BlockIo2->Media->LogicalPartition) {
+    return;
+  }
+
+  Print (
+    L"Disk %p: %lu blocks of %d bytes\n",
+    Handle,
+    BlockIo2->Media->LastBlock + 1,
+    BlockIo2->Media->BlockSize
+    );
+
+  for (Index = 0; Index < ARRAY_SIZE (mDiskWorkloads); Index++) {
+    BenchmarkDiskWorkload (BlockIo2, &mDiskWorkloads[Index], Options);
+  }
+}
+
+/**
+  Send full-sized frames on a network interface for a while, addressed to itself,
+  recycling them as the interface completes them.
+
+  @param[in]  Snp      The network interface.
+  @param[in]  Options  The options.
+
+**/
+STATIC
+VOID
+BenchmarkNetwork (
+  IN EFI_SIMPLE_NETWORK_PROTOCOL  *Snp,
+  IN DMA_BENCH_OPTIONS            *Options
+  )
+{
+  EFI_SIMPLE_NETWORK_MODE  *Mode;
+  UINT32                   OriginalState;
+  UINT8                    *Frame;
+  UINTN                    FrameSize;
+  UINT16                   EtherType;
+  VOID                     *Completed;
+  UINT64                   Sent;
+  UINT64                   Start;
+  UINT64                   Deadline;
+  UINTN                    InFlight;
+  EFI_STATUS               Status;
+
+  Mode          = Snp->Mode;
+  OriginalState = Mode->State;
+  Print (
+    L"Network %02x:%02x:%02x:%02x:%02x:%02x\n",
+    Mode->CurrentAddress.Addr[0],
+    Mode->CurrentAddress.Addr[1],
+    Mode->CurrentAddress.Addr[2],
+    Mode->CurrentAddress.Addr[3],
+    Mode->CurrentAddress.Addr[4],
+    Mode->CurrentAddress.Addr[5]
+    );
+
+  Status = EFI_SUCCESS;
+  if (Mode->State == EfiSimpleNetworkStopped) {
+    Status = Snp->Start (Snp);
+  }
+
+  if (!EFI_ERROR (Status) && (Mode->State == EfiSimpleNetworkStarted)) {
+    Status = Snp->Initialize (Snp, 0, 0);
+  }
+
+  if (EFI_ERROR (Status) || (Mode->State != EfiSimpleNetworkInitialized)) {
+    Print (L"  Could not be initialised: %r\n", Status);
+    goto Done;
+  }
+
+  FrameSize = Mode->MediaHeaderSize + Mode->MaxPacketSize;
+  Frame     = AllocateZeroPool (FrameSize);
+  if (Frame == NULL) {
+    Print (L"  Out of memory\n");
+    goto Done;
+  }
+
+  EtherType = DMA_BENCH_ETHER_TYPE;
+  Sent      = 0;
+  InFlight  = 0;
+  Start     = RiscVReadTimer ();
+  Deadline  = Start + DivU64x64Remainder (
+                        MultU64x32 (GetPerformanceCounterProperties (NULL, NULL), (UINT32)Options->TimeMs),
+                        1000,
+                        NULL
+                        );
+
+  //
+  // Each frame is sent from the same buffer, as only its DMA is measured.
+  //
+  while (RiscVReadTimer () < Deadline) {
+    Status = Snp->Transmit (
+                    Snp,
+                    Mode->MediaHeaderSize,
+                    FrameSize,
+                    Frame,
+                    &Mode->CurrentAddress,
+                    &Mode->CurrentAddress,
+                    &EtherType
+                    );
+    if (Status == EFI_SUCCESS) {
+      InFlight++;
+    } else if (Status != EFI_NOT_READY) {
+      Print (L"  Transmit failed: %r\n", Status);
+      break;
+    }
+
+    do {
+      Completed = NULL;
+      if (EFI_ERROR (Snp->GetStatus (Snp, NULL, &Completed)) || (Completed == NULL)) {
+        break;
+      }
+
+      InFlight--;
+      Sent++;
+    } while (InFlight != 0);
+  }
+
+  //
+  // Wait for the frames in flight, so that the buffer isn't freed under the interface.
+  //
+  while (InFlight != 0) {
+    Completed = NULL;
+    if (EFI_ERROR (Snp->GetStatus (Snp, NULL, &Completed)) ||
+        ((Completed == NULL) && (RiscVReadTimer () >= Deadline + (Deadline - Start))))
+    {
+      break;
+    }
+
+    if (Completed != NULL) {
+      InFlight--;
+      Sent++;
+    }
+  }
+
+  PrintThroughput (
+    L"Transmit",
+    MultU64x32 (Sent, (UINT32)FrameSize),
+    Sent,
+    TicksToMicroseconds (Start, RiscVReadTimer ()),
+    L"frames/s"
+    );
+  //
+  // Frames the interface never completed may still be read from the buffer, which is leaked.
+  //
+  if (InFlight == 0) {
+    FreePool (Frame);
+  }
+
+Done:
+  if ((OriginalState != EfiSimpleNetworkInitialized) && (Mode->State == EfiSimpleNetworkInitialized)) {
+    Snp->Shutdown (Snp);
+  }
+
+  if ((OriginalState == EfiSimpleNetworkStopped) && (Mode->State == EfiSimpleNetworkStarted)) {
+    Snp->Stop (Snp);
+  }
+}
+
+/**
+  Run the benchmark on every handle of a protocol.
+
+  @param[in]  Protocol  The protocol, of root bridges, disks or network interfaces.
+  @param[in]  Options   The options.
+
+**/
+STATIC
+VOID
+BenchmarkHandles (
+  IN EFI_GUID           *Protocol,
+  IN DMA_BENCH_OPTIONS  *Options
+  )
+{
+  EFI_HANDLE  *Handles;
+  UINTN       NumberOfHandles;
+  UINTN       Index;
+  VOID        *Interface;
+  EFI_STATUS  Status;
+
+  Status = gBS->LocateHandleBuffer (ByProtocol, Protocol, NULL, &NumberOfHandles, &Handles);
+  if (EFI_ERROR (Status)) {
+    return;
+  }
+
+  for (Index = 0; Index < NumberOfHandles; Index++) {
+    if (Protocol == &gEfiBlockIo2ProtocolGuid) {
+      BenchmarkDisk (Handles[Index], Options);
+      continue;
+    }
+
+    Status = gBS->HandleProtocol (Handles[Index], Protocol, &Interface);
+    if (EFI_ERROR (Status)) {
+      continue;
+    }
+
+    if (Protocol == &gEfiPciRootBridgeIoProtocolGuid) {
+      BenchmarkRootBridge (Interface, Options);
+    } else {
+      BenchmarkNetwork (Interface, Options);
+    }
+  }
+
+  FreePool (Handles);
+}
+
+/**
+  The user Entry Point for Application. The user code starts with this function
+  as the real entry point for the application.
+
+  @param[in] ImageHandle    The firmware allocated handle for the EFI image.
+  @param[in] SystemTable    A pointer to the EFI System Table.
+
+  @retval EFI_SUCCESS            The benchmark ran.
+  @retval EFI_INVALID_PARAMETER  The command line is invalid.
+
+**/
+EFI_STATUS
+EFIAPI
+UefiMain (
+  IN EFI_HANDLE        ImageHandle,
+  IN EFI_SYSTEM_TABLE  *SystemTable
+  )
+{
+  DMA_BENCH_OPTIONS  Options;
+  EFI_STATUS         Status;
+
+  Status = ParseOptions (ImageHandle, &Options);
+  if (EFI_ERROR (Status)) {
+    Print (L"Usage: DmaBench [-t <milliseconds>] [-q <depth>] [-n <iterations>]\n");
+    return Status;
+  }
+
+  PrintConfiguration ();
+  Print (
+    L"%lu ms per workload, queue depth %lu, %lu Map/Unmap iterations, %lu timer ticks/s\n",
+    (UINT64)Options.TimeMs,
+    (UINT64)Options.Depth,
+    (UINT64)Options.Iterations,
+    GetPerformanceCounterProperties (NULL, NULL)
+    );
+
+  BenchmarkHandles (&gEfiPciRootBridgeIoProtocolGuid, &Options);
+  BenchmarkHandles (&gEfiBlockIo2ProtocolGuid, &Options);
+  BenchmarkHandles (&gEfiSimpleNetworkProtocolGuid, &Options);
+
+  return EFI_SUCCESS;
+}
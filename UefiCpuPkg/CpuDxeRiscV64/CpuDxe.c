@@ -16,8 +16,13 @@
 STATIC BOOLEAN           mInterruptState = FALSE;
 STATIC EFI_HANDLE        mCpuHandle      = NULL;
 STATIC UINTN             mBootHartId;
+STATIC VOID              *mMpServiceRegistration;
+STATIC UINTN             mCbomBlockSize;
+STATIC EFI_EVENT         mReadyToBootEvent;
 RISCV_EFI_BOOT_PROTOCOL  gRiscvBootProtocol;
 
+STATIC RISCV_TLB_SHOOTDOWN_PROTOCOL  *mTlbShootdown;
+
 /**
   Get the boot hartid
 
@@ -90,6 +95,38 @@ CpuFlushCpuDataCache (
   IN EFI_CPU_FLUSH_TYPE     FlushType
   )
 {
+  UINTN  First;
+  UINTN  End;
+
+  //
+  // With Zicbom on every hart, operate on exactly the blocks of the range.
+  // A bounded range is never widened to the whole cache.
+  //
+  if (mCbomBlockSize != 0) {
+    if (Length == 0) {
+      return EFI_SUCCESS;
+    }
+
+    First = (UINTN)Start & ~(mCbomBlockSize - 1);
+    End   = ALIGN_VALUE ((UINTN)(Start + Length), mCbomBlockSize);
+    switch (FlushType) {
+      case EfiCpuFlushTypeWriteBack:
+        RiscVCpuCacheCleanRangeCmoAsm (First, End, mCbomBlockSize);
+        break;
+      case EfiCpuFlushTypeInvalidate:
+        RiscVCpuCacheInvalRangeCmoAsm (First, End, mCbomBlockSize);
+        break;
+      case EfiCpuFlushTypeWriteBackInvalidate:
+        RiscVCpuCacheFlushRangeCmoAsm (First, End, mCbomBlockSize);
+        break;
+      default:
+        return EFI_INVALID_PARAMETER;
+    }
+
+    MemoryFence ();
+    return EFI_SUCCESS;
+  }
+
   switch (FlushType) {
     case EfiCpuFlushTypeWriteBack:
       WriteBackDataCacheRange ((VOID *)(UINTN)Start, (UINTN)Length);
@@ -313,6 +350,240 @@ CpuSetMemoryAttributes (
   return RiscVSetMemoryAttributes (BaseAddress, Length, Attributes);
 }
 
+/**
+  Flush the translations of the other harts through the TLB shootdown protocol.
+
+  @param  StartAddress           The start of the range.
+  @param  Size                   The size of the range, or 0 with a
+                                 StartAddress of 0 for all addresses.
+
+**/
+STATIC
+VOID
+EFIAPI
+CpuTlbShootdown (
+  IN UINT64  StartAddress,
+  IN UINT64  Size
+  )
+{
+  EFI_STATUS  Status;
+
+  Status = mTlbShootdown->Shootdown (mTlbShootdown, StartAddress, Size);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "%a: TLB shootdown failed: %r\n", __func__, Status));
+    ASSERT_EFI_ERROR (Status);
+  }
+}
+
+/**
+  Once the MP services protocol can run firmware code on the other harts, have
+  the MMU library shoot down their TLBs after each page table update.
+
+  The MP services driver may also produce the TLB shootdown protocol, which
+  reaches parked harts with an MSI rather than an SBI IPI, and is used instead.
+
+  @param  Event                  The protocol notify event.
+  @param  Context                Unused.
+
+**/
+STATIC
+VOID
+EFIAPI
+OnMpServicesInstalled (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  EFI_STATUS                 Status;
+  EFI_MP_SERVICES_PROTOCOL   *MpServices;
+  EFI_PROCESSOR_INFORMATION  ProcessorInfo;
+  UINTN                      NumberOfProcessors;
+  UINTN                      NumberOfEnabledProcessors;
+  UINTN                      Index;
+  UINTN                      HartMask;
+  UINTN                      HartMaskBase;
+
+  Status = gBS->LocateProtocol (&gEfiMpServiceProtocolGuid, NULL, (VOID **)&MpServices);
+  if (EFI_ERROR (Status)) {
+    return;
+  }
+
+  gBS->CloseEvent (Event);
+
+  Status = MpServices->GetNumberOfProcessors (
+                         MpServices,
+                         &NumberOfProcessors,
+                         &NumberOfEnabledProcessors
+                         );
+  if (EFI_ERROR (Status)) {
+    return;
+  }
+
+  //
+  // The mask is relative to the lowest hart ID; fall back to every hart if
+  // the hart IDs span more than a mask can hold.
+  //
+  HartMask     = 0;
+  HartMaskBase = MAX_UINTN;
+  for (Index = 0; Index < NumberOfProcessors; Index++) {
+    Status = MpServices->GetProcessorInfo (MpServices, Index, &ProcessorInfo);
+    if (!EFI_ERROR (Status) && (ProcessorInfo.ProcessorId != mBootHartId)) {
+      HartMaskBase = MIN (HartMaskBase, (UINTN)ProcessorInfo.ProcessorId);
+    }
+  }
+
+  for (Index = 0; Index < NumberOfProcessors; Index++) {
+    Status = MpServices->GetProcessorInfo (MpServices, Index, &ProcessorInfo);
+    if (EFI_ERROR (Status) || (ProcessorInfo.ProcessorId == mBootHartId)) {
+      continue;
+    }
+
+    if (ProcessorInfo.ProcessorId - HartMaskBase >= sizeof (UINTN) * 8) {
+      HartMask     = 0;
+      HartMaskBase = SBI_HART_MASK_BASE_ALL;
+      break;
+    }
+
+    HartMask |= LShiftU64 (1, (UINTN)(ProcessorInfo.ProcessorId - HartMaskBase));
+  }
+
+  DEBUG ((DEBUG_INFO, "%a: HartMask 0x%lx HartMaskBase 0x%lx\n", __func__, HartMask, HartMaskBase));
+  RiscVMmuSetRemoteHarts (HartMask, HartMaskBase);
+
+  Status = gBS->LocateProtocol (&gRiscVTlbShootdownProtocolGuid, NULL, (VOID **)&mTlbShootdown);
+  if (!EFI_ERROR (Status)) {
+    RiscVMmuSetRemoteFlush (CpuTlbShootdown);
+  }
+}
+
+/**
+  Report the statistics of the CPU page tables.
+
+  @param[in]   This        The protocol instance.
+  @param[out]  Statistics  The statistics.
+
+  @retval  EFI_SUCCESS            Statistics is filled in.
+  @retval  EFI_INVALID_PARAMETER  Statistics is NULL.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+CpuGetMmuStatistics (
+  IN  RISCV_MMU_STATISTICS_PROTOCOL  *This,
+  OUT RISCV_MMU_STATISTICS           *Statistics
+  )
+{
+  if (Statistics == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  RiscVMmuGetStatistics (Statistics);
+  return EFI_SUCCESS;
+}
+
+STATIC RISCV_MMU_STATISTICS_PROTOCOL  mMmuStatistics = {
+  RISCV_MMU_STATISTICS_PROTOCOL_REVISION,
+  CpuGetMmuStatistics
+};
+
+/**
+  Open a transaction, in which the updates of the CPU page tables leave the
+  flush of their translations to the commit.
+
+  @param[in]  This  The protocol instance.
+
+**/
+STATIC
+VOID
+EFIAPI
+CpuBeginPageTableTransaction (
+  IN EDKII_PAGE_TABLE_TRANSACTION_PROTOCOL  *This
+  )
+{
+  RiscVMmuBeginTransaction ();
+}
+
+/**
+  Commit a transaction, which flushes the translations of its updates.
+
+  @param[in]  This  The protocol instance.
+
+**/
+STATIC
+VOID
+EFIAPI
+CpuCommitPageTableTransaction (
+  IN EDKII_PAGE_TABLE_TRANSACTION_PROTOCOL  *This
+  )
+{
+  RiscVMmuCommitTransaction ();
+}
+
+STATIC EDKII_PAGE_TABLE_TRANSACTION_PROTOCOL  mPageTableTransaction = {
+  CpuBeginPageTableTransaction,
+  CpuCommitPageTableTransaction
+};
+
+/**
+  Print the statistics of the CPU page tables at ReadyToBoot, by when the
+  images loaded so far have been protected.
+
+  @param  Event                  The ReadyToBoot event.
+  @param  Context                Unused.
+
+**/
+STATIC
+VOID
+EFIAPI
+OnReadyToBoot (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  RISCV_MMU_STATISTICS  Statistics;
+
+  gBS->CloseEvent (Event);
+
+  //
+  // Walking the page tables is only worth it if the result is printed.
+  //
+  if (!DebugPrintLevelEnabled (DEBUG_INFO)) {
+    return;
+  }
+
+  RiscVMmuGetStatistics (&Statistics);
+  DEBUG ((
+    DEBUG_INFO,
+    "%a: SATP mode %u, %lu live tables, %lu allocated, %lu freed, %lu splits, %lu folds\n",
+    __func__,
+    Statistics.SatpMode,
+    Statistics.LiveTables,
+    Statistics.TablesAllocated,
+    Statistics.TablesFreed,
+    Statistics.Splits,
+    Statistics.Folds
+    ));
+  DEBUG ((
+    DEBUG_INFO,
+    "%a: leaves 4K %lu, 64K %lu, 2M %lu, 1G %lu, 512G %lu\n",
+    __func__,
+    Statistics.Leaves4K,
+    Statistics.Leaves64K,
+    Statistics.Leaves2M,
+    Statistics.Leaves1G,
+    Statistics.Leaves512G
+    ));
+  DEBUG ((
+    DEBUG_INFO,
+    "%a: sfence.vma %lu at an address, %lu for all, %lu remote flushes\n",
+    __func__,
+    Statistics.LocalFlushes,
+    Statistics.LocalFlushAlls,
+    Statistics.RemoteFlushes
+    ));
+}
+
 /**
   Initialize the state information for the CPU Architectural Protocol.
 
@@ -334,6 +605,7 @@ InitializeCpu (
   EFI_STATUS              Status;
   VOID                    *Hob;
   RISCV_SEC_HANDOFF_DATA  *SecData;
+  RISCV_HART_LOCAL        *HartLocal;
   const EFI_GUID          SecHobDataGuid = RISCV_SEC_HANDOFF_HOB_GUID;
 
   Hob = GetFirstGuidHob (&SecHobDataGuid);
@@ -344,6 +616,15 @@ InitializeCpu (
 
   DEBUG ((DEBUG_INFO, " %a: mBootHartId = 0x%x.\n", __func__, mBootHartId));
 
+  //
+  // Every later DXE module runs on the boot hart, so it is given its hart-local storage first.
+  //
+  HartLocal = AllocateZeroPool (sizeof (RISCV_HART_LOCAL));
+  if (HartLocal != NULL) {
+    RiscVHartLocalInitialize (HartLocal, mBootHartId, 0);
+    RiscVHartLocalAttach (HartLocal);
+  }
+
   InitializeCpuExceptionHandlers (NULL);
 
   //
@@ -362,6 +643,9 @@ InitializeCpu (
   //
   InitializeFloatingPointUnits ();
 
+  mCbomBlockSize = RiscVIsaGetCbomBlockSize ();
+  DEBUG ((DEBUG_INFO, "%a: Zicbom block size %u\n", __func__, mCbomBlockSize));
+
   //
   // Install Boot protocol
   //
@@ -374,14 +658,32 @@ InitializeCpu (
   ASSERT_EFI_ERROR (Status);
 
   //
-  // Install CPU Architectural Protocol
+  // Install CPU Architectural Protocol, the Memory Attribute Protocol, the
+  // MMU Statistics Protocol and the Page Table Transaction Protocol
   //
   Status = gBS->InstallMultipleProtocolInterfaces (
                   &mCpuHandle,
                   &gEfiCpuArchProtocolGuid,
                   &gCpu,
+                  &gEfiMemoryAttributeProtocolGuid,
+                  &mMemoryAttribute,
+                  &gRiscVMmuStatisticsProtocolGuid,
+                  &mMmuStatistics,
+                  &gEdkiiPageTableTransactionProtocolGuid,
+                  &mPageTableTransaction,
                   NULL
                   );
   ASSERT_EFI_ERROR (Status);
+
+  EfiCreateEventReadyToBootEx (TPL_CALLBACK, OnReadyToBoot, NULL, &mReadyToBootEvent);
+
+  EfiCreateProtocolNotifyEvent (
+    &gEfiMpServiceProtocolGuid,
+    TPL_CALLBACK,
+    OnMpServicesInstalled,
+    NULL,
+    &mMpServiceRegistration
+    );
+
   return Status;
 }
@@ -14,7 +14,12 @@
 
 #include <Guid/RiscVSecHobData.h>
 #include <Protocol/Cpu.h>
+#include <Protocol/MemoryAttribute.h>
+#include <Protocol/MpService.h>
+#include <Protocol/PageTableTransaction.h>
 #include <Protocol/RiscVBootProtocol.h>
+#include <Protocol/RiscVMmuStatistics.h>
+#include <Protocol/RiscVTlbShootdown.h>
 #include <Library/BaseRiscVSbiLib.h>
 #include <Library/BaseRiscVMmuLib.h>
 #include <Library/TimerLib.h>
@@ -23,11 +28,18 @@
 #include <Library/CpuExceptionHandlerLib.h>
 #include <Library/CpuLib.h>
 #include <Library/DebugLib.h>
+#include <Library/DxeServicesTableLib.h>
 #include <Library/HobLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/RiscVHartLocalLib.h>
+#include <Library/RiscVIsaLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/UefiDriverEntryPoint.h>
+#include <Library/UefiLib.h>
 #include <Register/RiscV64/RiscVEncoding.h>
 
+extern EFI_MEMORY_ATTRIBUTE_PROTOCOL  mMemoryAttribute;
+
 /**
   Flush CPU data cache. If the instruction cache is fully coherent
   with all DMA operations then function can just return EFI_SUCCESS.
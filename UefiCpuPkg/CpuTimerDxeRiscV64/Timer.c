@@ -9,6 +9,7 @@
 
 #include <Library/BaseLib.h>
 #include <Library/BaseRiscVSbiLib.h>
+#include <Library/RiscVIsaLib.h>
 #include <Library/UefiLib.h>
 #include <Library/TimerLib.h>
 #include "Timer.h"
@@ -28,6 +29,14 @@ EFI_TIMER_ARCH_PROTOCOL  mTimer = {
   TimerDriverGenerateSoftInterrupt
 };
 
+//
+// The Tickless Timer Protocol that this driver produces if PcdRiscVTimerMaxIdle is set
+//
+EDKII_TICKLESS_TIMER_PROTOCOL  mTicklessTimer = {
+  TimerDriverSetNextEvent,
+  TimerDriverGetElapsedTime
+};
+
 //
 // Pointer to the CPU Architectural Protocol instance
 //
@@ -50,6 +59,16 @@ STATIC UINT64  mLastPeriodStart = 0;
 //
 STATIC BOOLEAN  mSstcEnabled = FALSE;
 
+//
+// Tickless mode, entered once the DXE Core reports its first timer event: the
+// counter value at which the earliest timer event is due, the value the timer
+// is programmed for, and the longest wait between interrupts.
+//
+STATIC BOOLEAN  mTickless        = FALSE;
+STATIC UINT64   mNextEventTick   = MAX_UINT64;
+STATIC UINT64   mProgrammedTick  = MAX_UINT64;
+STATIC UINT64   mMaxIdleTicks    = 0;
+
 /**
   Program the timer.
 
@@ -64,6 +83,7 @@ RiscVProgramTimer (
   UINT64  NextValue
   )
 {
+  mProgrammedTick = NextValue;
   if (mSstcEnabled) {
     RiscVSetSupervisorTimeCompareRegister (NextValue);
   } else {
@@ -72,7 +92,30 @@ RiscVProgramTimer (
 }
 
 /**
-  Check whether Sstc is enabled in PCD.
+  Convert a number of 100 ns units to timer ticks, rounding up.
+
+  @param Period                The number of 100 ns units, less than 2^32 seconds.
+
+  @return The number of timer ticks.
+**/
+STATIC
+UINT64
+RiscVPeriodToTicks (
+  UINT64  Period
+  )
+{
+  UINT64  Frequency;
+  UINT32  Remainder;
+  UINT64  Seconds;
+
+  Frequency = GetPerformanceCounterProperties (NULL, NULL);
+  Seconds   = DivU64x32Remainder (Period, EFI_TIMER_PERIOD_SECONDS (1), &Remainder);
+  return MultU64x64 (Seconds, Frequency) +
+         DivU64x32 (MultU64x64 (Remainder, Frequency) + EFI_TIMER_PERIOD_SECONDS (1) - 1, EFI_TIMER_PERIOD_SECONDS (1));
+}
+
+/**
+  Check whether every hart implements Sstc, and PcdRiscVFeatureOverride leaves it enabled.
 
 **/
 STATIC
@@ -81,7 +124,7 @@ RiscVIsSstcEnabled (
   VOID
   )
 {
-  return ((PcdGet64 (PcdRiscVFeatureOverride) & RISCV_CPU_FEATURE_SSTC_BITMASK) != 0);
+  return ((RiscVIsaGetFeatures () & RISCV_ISA_FEATURE_SSTC) != 0);
 }
 
 /**
@@ -127,18 +170,86 @@ TimerInterruptHandler (
   }
 
   mLastPeriodStart = PeriodStart;
-  PeriodStart     += DivU64x32 (
-                       MultU64x32 (
-                         mTimerPeriod,
-                         GetPerformanceCounterProperties (NULL, NULL)
-                         ),
-                       1000000u
-                       );  // convert to tick
+
+  //
+  // In tickless mode, wait for the earliest timer event. Once it is due, the
+  // DXE Core reports the next one after signalling it; until then, and in case
+  // it found the event not quite due yet, interrupt again after a period.
+  //
+  if (mTickless && (mNextEventTick > PeriodStart)) {
+    PeriodStart += MIN (mNextEventTick - PeriodStart, mMaxIdleTicks);
+  } else {
+    PeriodStart += DivU64x32 (
+                     MultU64x32 (
+                       mTimerPeriod,
+                       GetPerformanceCounterProperties (NULL, NULL)
+                       ),
+                     1000000u
+                     );  // convert to tick
+  }
+
   RiscVProgramTimer (PeriodStart);
   RiscVEnableTimerInterrupt (); // enable SMode timer int
   gBS->RestoreTPL (OriginalTPL);
 }
 
+/**
+  Set when the earliest timer event of the DXE Core is due.
+
+  The timer is only reprogrammed if the event is due before the next interrupt,
+  so that a later event costs no SBI call.
+
+  @param This             The EDKII_TICKLESS_TIMER_PROTOCOL instance.
+  @param Timeout          The number of 100 ns units from now until the earliest timer
+                          event is due, or MAX_UINT64 if no timer event is set.
+
+**/
+VOID
+EFIAPI
+TimerDriverSetNextEvent (
+  IN EDKII_TICKLESS_TIMER_PROTOCOL  *This,
+  IN UINT64                         Timeout
+  )
+{
+  EFI_TPL  OriginalTPL;
+  UINT64   NextTick;
+
+  OriginalTPL = gBS->RaiseTPL (TPL_HIGH_LEVEL);
+  mTickless   = TRUE;
+
+  NextTick = MAX_UINT64;
+  if (Timeout < EFI_TIMER_PERIOD_SECONDS (MAX_UINT32)) {
+    NextTick = RiscVReadTimer () + RiscVPeriodToTicks (Timeout);
+  }
+
+  mNextEventTick = NextTick;
+  if ((mTimerPeriod != 0) && (NextTick < mProgrammedTick)) {
+    RiscVProgramTimer (NextTick);
+  }
+
+  gBS->RestoreTPL (OriginalTPL);
+}
+
+/**
+  Return the time elapsed since the timer last called the notify function.
+
+  @param This             The EDKII_TICKLESS_TIMER_PROTOCOL instance.
+
+  @return The number of 100 ns units elapsed.
+
+**/
+UINT64
+EFIAPI
+TimerDriverGetElapsedTime (
+  IN EDKII_TICKLESS_TIMER_PROTOCOL  *This
+  )
+{
+  return DivU64x32 (
+           EFI_TIMER_PERIOD_SECONDS (RiscVReadTimer () - mLastPeriodStart),
+           GetPerformanceCounterProperties (NULL, NULL)
+           );
+}
+
 /**
 
   This function registers the handler NotifyFunction so it is called every time
@@ -221,7 +332,8 @@ TimerDriverSetTimerPeriod (
   DEBUG ((DEBUG_INFO, "TimerDriverSetTimerPeriod(0x%lx)\n", TimerPeriod));
 
   if (TimerPeriod == 0) {
-    mTimerPeriod = 0;
+    mTimerPeriod    = 0;
+    mProgrammedTick = MAX_UINT64;
     RiscVDisableTimerInterrupt (); // Disable SMode timer int
     return EFI_SUCCESS;
   }
@@ -326,6 +438,14 @@ TimerDriverInitialize (
     DEBUG ((DEBUG_INFO, "TimerDriverInitialize: Timer interrupt is via Sstc extension\n"));
   }
 
+  mMaxIdleTicks = DivU64x32 (
+                    MultU64x32 (
+                      PcdGet32 (PcdRiscVTimerMaxIdle),
+                      GetPerformanceCounterProperties (NULL, NULL)
+                      ),
+                    1000000u
+                    );
+
   //
   // Make sure the Timer Architectural Protocol is not already installed in the system
   //
@@ -369,5 +489,21 @@ TimerDriverInitialize (
                   NULL
                   );
   ASSERT_EFI_ERROR (Status);
+
+  //
+  // Let the DXE Core report its timer events, so that the timer only
+  // interrupts when one is due.
+  //
+  if (mMaxIdleTicks != 0) {
+    DEBUG ((DEBUG_INFO, "TimerDriverInitialize: Tickless, idle for up to %u us\n", PcdGet32 (PcdRiscVTimerMaxIdle)));
+    Status = gBS->InstallMultipleProtocolInterfaces (
+                    &mTimerHandle,
+                    &gEdkiiTicklessTimerProtocolGuid,
+                    &mTicklessTimer,
+                    NULL
+                    );
+    ASSERT_EFI_ERROR (Status);
+  }
+
   return Status;
 }
@@ -14,6 +14,7 @@
 
 #include <Protocol/Cpu.h>
 #include <Protocol/Timer.h>
+#include <Protocol/TicklessTimer.h>
 
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/BaseLib.h>
@@ -26,8 +27,6 @@
 //
 #define DEFAULT_TIMER_TICK_DURATION  100000
 
-#define RISCV_CPU_FEATURE_SSTC_BITMASK  BIT1
-
 extern VOID
 RiscvSetTimerPeriod (
   UINT32  TimerPeriod
@@ -176,4 +175,33 @@ TimerDriverGenerateSoftInterrupt (
   )
 ;
 
+/**
+  Set when the earliest timer event of the DXE Core is due.
+
+  @param This             The EDKII_TICKLESS_TIMER_PROTOCOL instance.
+  @param Timeout          The number of 100 ns units from now until the earliest timer
+                          event is due, or MAX_UINT64 if no timer event is set.
+
+**/
+VOID
+EFIAPI
+TimerDriverSetNextEvent (
+  IN EDKII_TICKLESS_TIMER_PROTOCOL  *This,
+  IN UINT64                         Timeout
+  );
+
+/**
+  Return the time elapsed since the timer last called the notify function.
+
+  @param This             The EDKII_TICKLESS_TIMER_PROTOCOL instance.
+
+  @return The number of 100 ns units elapsed.
+
+**/
+UINT64
+EFIAPI
+TimerDriverGetElapsedTime (
+  IN EDKII_TICKLESS_TIMER_PROTOCOL  *This
+  );
+
 #endif
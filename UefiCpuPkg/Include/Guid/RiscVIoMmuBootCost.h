@@ -0,0 +1,69 @@
+/** @file
+  RISC-V IOMMU boot cost summary.
+
+  At ReadyToBoot, the RISC-V IOMMU driver publishes a configuration table under
+  this GUID, which sums up what DMA protection cost during boot: the time spent
+  in its IOMMU protocol services, the time it was blocked on the IOMMUs, the
+  bytes it bounced, the commands it issued and the page-table pages in use. It
+  is counted without tracing, for boot telemetry to track per board and
+  firmware version.
+
+  The table is ACPI reclaim memory, and is refreshed each time ReadyToBoot is
+  signalled, so it describes the boot up to the last boot option started.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef RISCV_IOMMU_BOOT_COST_H_
+#define RISCV_IOMMU_BOOT_COST_H_
+
+#define RISCV_IOMMU_BOOT_COST_TABLE_GUID \
+  { \
+    0xf0ced8f0, 0x634a, 0x4c36, { 0xa3, 0x60, 0x25, 0x8a, 0xc4, 0x4f, 0x02, 0x07 } \
+  }
+
+#define RISCV_IOMMU_BOOT_COST_TABLE_SIGNATURE  SIGNATURE_32 ('R', 'V', 'I', 'C')
+#define RISCV_IOMMU_BOOT_COST_TABLE_REVISION   0x00010000
+
+//
+// The IOMMU protocol services that are timed. The batch services are timed as the
+// services they call.
+//
+typedef enum {
+  RiscVIoMmuBootCostSetAttribute,
+  RiscVIoMmuBootCostMap,
+  RiscVIoMmuBootCostUnmap,
+  RiscVIoMmuBootCostAllocateBuffer,
+  RiscVIoMmuBootCostFreeBuffer,
+  RiscVIoMmuBootCostServiceMax
+} RISCV_IOMMU_BOOT_COST_SERVICE;
+
+typedef struct {
+  UINT64    Calls;
+  // The time spent in the calls, in nanoseconds.
+  UINT64    Time;
+} RISCV_IOMMU_BOOT_COST_SERVICE_TIME;
+
+typedef struct {
+  UINT32                                Signature;
+  UINT32                                Revision;
+  UINT32                                Size;
+  UINT32                                NumberOfIoMmus;
+  RISCV_IOMMU_BOOT_COST_SERVICE_TIME    Services[RiscVIoMmuBootCostServiceMax];
+  // The time that waits for the IOMMUs were blocked, in nanoseconds: for registers,
+  // for command-queue space and for fences. Mostly within the services' time.
+  UINT64                                WaitTime;
+  // The bytes that Map() bounced, of the mappings that devices were granted access to.
+  UINT64                                BytesBounced;
+  // The IOTINVAL, IODIR and ATS.INVAL commands, and the IOFENCE.C commands, issued.
+  UINT64                                InvalidationCommands;
+  UINT64                                Fences;
+  // The IO page-table pages in use.
+  UINT64                                PageTablePages;
+} RISCV_IOMMU_BOOT_COST_TABLE;
+
+extern EFI_GUID  gRiscVIoMmuBootCostTableGuid;
+
+#endif
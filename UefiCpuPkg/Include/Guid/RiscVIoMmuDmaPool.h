@@ -0,0 +1,42 @@
+/** @file
+  RISC-V IOMMU DMA pool.
+
+  The platform PEIM reserves a region of memory below 4 GiB, aligned to 2 MiB,
+  before DXE fragments low memory, and describes it in a GUID HOB of this type.
+  A memory allocation HOB of boot-services data covers the whole region, so the
+  DXE core never hands it out. The RISC-V IOMMU PEIM and DXE driver take their
+  DMA windows, bounce buffers, tables and queues from the front of it, so that
+  they are physically contiguous and mappable by superpages.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef RISCV_IOMMU_DMA_POOL_H_
+#define RISCV_IOMMU_DMA_POOL_H_
+
+#define RISCV_IOMMU_DMA_POOL_GUID \
+  { \
+    0x5d8e1b47, 0x2c3a, 0x4e96, { 0xa1, 0x7f, 0x0b, 0x64, 0xd9, 0x3e, 0x85, 0x2c } \
+  }
+
+#define RISCV_IOMMU_DMA_POOL_SIGNATURE  SIGNATURE_32 ('R', 'V', 'D', 'P')
+#define RISCV_IOMMU_DMA_POOL_REVISION   0x00010000
+
+#define RISCV_IOMMU_DMA_POOL_ALIGNMENT  SIZE_2MB
+
+typedef struct {
+  UINT32    Signature;
+  UINT32    Revision;
+  // The region, below 4 GiB, with both its base and size aligned to 2 MiB.
+  UINT64    Base;
+  UINT64    Size;
+  // The bytes at the front of the region already taken. PEI consumers advance
+  // it in place, and the DXE driver starts past it.
+  UINT64    Used;
+} RISCV_IOMMU_DMA_POOL;
+
+extern EFI_GUID  gRiscVIoMmuDmaPoolHobGuid;
+
+#endif
@@ -0,0 +1,109 @@
+/** @file
+  RISC-V IOMMU hand-off to the OS.
+
+  The RISC-V IOMMU driver publishes a configuration table under this GUID,
+  which describes the IOMMUs it leaves running at ExitBootServices(): their
+  device directories and queues, and the domain of each device. An OS driver
+  may adopt the live tables, rather than quiescing the IOMMUs before it
+  rebuilds them, so that DMA stays translated across the transition.
+
+  The table itself is ACPI reclaim memory, and is refreshed as boot services
+  exit. The directories, page tables and queues it points to are boot-services
+  data: an OS that adopts them must reserve the table-page region, the queues,
+  and every page reachable from a directory, before it reclaims boot-services
+  memory.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef RISCV_IOMMU_HAND_OFF_H_
+#define RISCV_IOMMU_HAND_OFF_H_
+
+#define RISCV_IOMMU_HAND_OFF_TABLE_GUID \
+  { \
+    0x0e2432a7, 0xa08c, 0x40e9, { 0xb0, 0x5f, 0xed, 0x28, 0xe1, 0x97, 0x25, 0x8c } \
+  }
+
+#define RISCV_IOMMU_HAND_OFF_TABLE_SIGNATURE  SIGNATURE_32 ('R', 'V', 'I', 'H')
+#define RISCV_IOMMU_HAND_OFF_TABLE_REVISION   0x00010000
+
+//
+// The table's flags. An incomplete table lacks domains that didn't fit, and must not be
+// adopted. A table without the exit flag was never refreshed, and is stale.
+//
+#define RISCV_IOMMU_HAND_OFF_INCOMPLETE          BIT0
+#define RISCV_IOMMU_HAND_OFF_EXIT_BOOT_SERVICES  BIT1
+
+//
+// An IOMMU's flags.
+//
+#define RISCV_IOMMU_HAND_OFF_IOMMU_PCI               BIT0
+#define RISCV_IOMMU_HAND_OFF_IOMMU_EXTENDED_CONTEXT  BIT1
+
+typedef struct {
+  // The register base of the IOMMU.
+  UINT64    Address;
+  // The location of a PCI IOMMU's function.
+  UINT16    PciSegment;
+  UINT16    PciBdf;
+  UINT32    Flags;
+  // The capabilities and feature control registers.
+  UINT64    Capabilities;
+  UINT32    FeatureControl;
+  // The first-stage mode of the domains' page tables, as encoded in iosatp.MODE.
+  UINT8     IoSatpMode;
+  UINT8     Reserved[3];
+  // The DDTP, CQB, FQB and PQB registers, read as boot services exit.
+  UINT64    DeviceDirectoryPointer;
+  UINT64    CommandQueueBase;
+  UINT64    FaultQueueBase;
+  UINT64    PageRequestQueueBase;
+  // The IOMMU's domains, as indices of the domain entries.
+  UINT32    FirstDomain;
+  UINT32    NumberOfDomains;
+} RISCV_IOMMU_HAND_OFF_IOMMU;
+
+//
+// How a domain's device is translated.
+//
+#define RISCV_IOMMU_HAND_OFF_DOMAIN_STRICT      0
+#define RISCV_IOMMU_HAND_OFF_DOMAIN_IDENTITY    1
+#define RISCV_IOMMU_HAND_OFF_DOMAIN_BYPASS      2
+#define RISCV_IOMMU_HAND_OFF_DOMAIN_PERMISSIVE  3
+
+typedef struct {
+  // The device_id of the device context.
+  UINT32    DeviceId;
+  UINT8     Mode;
+  UINT8     Reserved0[3];
+  // The PSCID that tags the translations, and the root of the page table. Both are 0 in bypass.
+  UINT32    Pscid;
+  UINT32    Reserved1;
+  UINT64    RootPageTable;
+} RISCV_IOMMU_HAND_OFF_DOMAIN;
+
+//
+// The table starts with this header, and the IOMMU and domain entries follow at their offsets.
+//
+typedef struct {
+  UINT32    Signature;
+  UINT32    Revision;
+  UINT32    HeaderSize;
+  UINT32    Flags;
+  UINT32    IoMmuOffset;
+  UINT32    IoMmuEntrySize;
+  UINT32    NumberOfIoMmus;
+  UINT32    DomainOffset;
+  UINT32    DomainEntrySize;
+  UINT32    NumberOfDomains;
+  // The region that directory and page-table pages are allocated from first, or 0.
+  // Pages beyond it are allocated individually.
+  UINT64    TablePageRegionBase;
+  UINT64    TablePageRegionSize;
+} RISCV_IOMMU_HAND_OFF_TABLE;
+
+extern EFI_GUID  gRiscVIoMmuHandOffTableGuid;
+
+#endif
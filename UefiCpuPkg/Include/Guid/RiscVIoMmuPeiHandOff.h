@@ -0,0 +1,49 @@
+/** @file
+  RISC-V IOMMU hand-off from PEI.
+
+  The RISC-V IOMMU PEIM translates every device_id of a system IOMMU through
+  one device context, which identity-maps a window of memory reserved for
+  early DMA, and records it in a GUID HOB of this type, one per IOMMU. The
+  DXE driver adopts the running IOMMU's queues, and replaces the directory
+  with one of its own.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef RISCV_IOMMU_PEI_HAND_OFF_H_
+#define RISCV_IOMMU_PEI_HAND_OFF_H_
+
+#define RISCV_IOMMU_PEI_HAND_OFF_GUID \
+  { \
+    0x7a0f5c6c, 0xbdfa, 0x40d4, { 0x8c, 0xd4, 0xab, 0x7e, 0x61, 0x35, 0xe3, 0x77 } \
+  }
+
+#define RISCV_IOMMU_PEI_HAND_OFF_SIGNATURE  SIGNATURE_32 ('R', 'V', 'I', 'P')
+#define RISCV_IOMMU_PEI_HAND_OFF_REVISION   0x00010000
+
+typedef struct {
+  UINT32    Signature;
+  UINT32    Revision;
+  // The register base of the IOMMU.
+  UINT64    IoMmuAddress;
+  // The DDTP, CQB and FQB registers as programmed. A DDTP that reads otherwise
+  // was changed since, and the directory isn't this HOB's.
+  UINT64    DeviceDirectoryPointer;
+  UINT64    CommandQueueBase;
+  UINT64    FaultQueueBase;
+  // The window that devices reach, at its own address. Its memory, and that of
+  // the tables and queues, is boot-services data.
+  UINT64    DmaWindowBase;
+  UINT64    DmaWindowSize;
+  // The first-stage page table of the shared device context, and the PSCID
+  // that tags its translations.
+  UINT64    WindowPageTable;
+  UINT32    WindowPscid;
+  UINT32    Reserved;
+} RISCV_IOMMU_PEI_HAND_OFF;
+
+extern EFI_GUID  gRiscVIoMmuPeiHandOffGuid;
+
+#endif
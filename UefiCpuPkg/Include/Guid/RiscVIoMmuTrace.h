@@ -0,0 +1,93 @@
+/** @file
+  RISC-V IOMMU trace table.
+
+  With PcdRiscVIoMmuTraceEntries, the RISC-V IOMMU driver records each call
+  of its IOMMU protocol services into a ring in memory, instead of logging
+  it, and publishes the ring as a configuration table under this GUID.
+
+  Since revision 0x00010001, the entries carry enough of the arguments for the
+  calls to be replayed against the driver, as the host benchmark of the driver
+  does with a ring saved by "iommu -r -f". A saved ring is the header, with
+  NextEntry the number of entries saved, followed by those entries from the
+  oldest.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef RISCV_IOMMU_TRACE_H_
+#define RISCV_IOMMU_TRACE_H_
+
+#define RISCV_IOMMU_TRACE_TABLE_GUID \
+  { \
+    0x2061246d, 0xd81c, 0x45e0, { 0x8b, 0x03, 0x62, 0xe8, 0x74, 0x51, 0x53, 0x39 } \
+  }
+
+#define RISCV_IOMMU_TRACE_TABLE_SIGNATURE  SIGNATURE_32 ('R', 'V', 'I', 'T')
+#define RISCV_IOMMU_TRACE_TABLE_REVISION   0x00010001
+
+//
+// The service that an entry records.
+//
+typedef enum {
+  RiscVIoMmuTraceSetAttribute = 1,
+  RiscVIoMmuTraceMap,
+  RiscVIoMmuTraceUnmap,
+  RiscVIoMmuTraceAllocateBuffer,
+  RiscVIoMmuTraceFreeBuffer,
+  RiscVIoMmuTraceMax
+} RISCV_IOMMU_TRACE_EVENT;
+
+//
+// The DeviceId of an entry whose device isn't known, as of Map().
+//
+#define RISCV_IOMMU_TRACE_NO_DEVICE_ID  MAX_UINT32
+
+typedef struct {
+  // The time of the call, and how long it took, in ticks of the time CSR.
+  UINT64    Timestamp;
+  UINT64    Latency;
+  // The IO virtual address and length of the buffer, or 0 if the call failed before it was known.
+  UINT64    DeviceAddress;
+  UINT64    Length;
+  // The EFI_STATUS it returned.
+  UINT64    Status;
+  UINT32    DeviceId;
+  UINT32    Event;
+  // Since revision 0x00010001: what relates the calls of a buffer, the Mapping of Map(),
+  // SetAttribute() and Unmap(), or the host address of AllocateBuffer() and FreeBuffer().
+  UINT64    Key;
+  // The host address of the buffer of Map(), or 0.
+  UINT64    HostAddress;
+  // The EDKII_IOMMU_OPERATION of Map(), the IoMmuAccess of SetAttribute(), or the
+  // Attributes of AllocateBuffer().
+  UINT64    Argument;
+} RISCV_IOMMU_TRACE_ENTRY;
+
+//
+// The size of an entry of revision 0x00010000.
+//
+#define RISCV_IOMMU_TRACE_ENTRY_V1_SIZE  OFFSET_OF (RISCV_IOMMU_TRACE_ENTRY, Key)
+
+//
+// The table starts with this header, and the entries follow it.
+//
+typedef struct {
+  UINT32    Signature;
+  UINT32    Revision;
+  UINT32    HeaderSize;
+  UINT32    EntrySize;
+  // A power of two.
+  UINT32    NumberOfEntries;
+  UINT32    Reserved;
+  // The frequency of the time CSR, in Hz.
+  UINT64    TimerFrequency;
+  // The number of entries ever recorded. The next is recorded at this index
+  // modulo NumberOfEntries, over the oldest.
+  UINT64    NextEntry;
+} RISCV_IOMMU_TRACE_TABLE;
+
+extern EFI_GUID  gRiscVIoMmuTraceTableGuid;
+
+#endif
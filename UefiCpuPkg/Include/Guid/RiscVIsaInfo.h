@@ -0,0 +1,56 @@
+/** @file
+  RISC-V ISA extensions common to all harts.
+
+  The extensions are discovered once, by RiscVIsaLib, from the riscv,isa-extensions
+  (or riscv,isa) properties of the CPU nodes of the devicetree, together with the
+  Zicbom and Zicboz block sizes. A phase that discovered them may publish them in a
+  GUID HOB of this type, so that later phases consume it instead of parsing the
+  devicetree again.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef RISCV_ISA_INFO_H_
+#define RISCV_ISA_INFO_H_
+
+#define RISCV_ISA_INFO_HOB_GUID \
+  { \
+    0x9b6d3f24, 0x71c8, 0x4e0a, { 0xa5, 0x3e, 0x2f, 0x98, 0x0d, 0x6b, 0xc1, 0x47 } \
+  }
+
+#define RISCV_ISA_INFO_SIGNATURE  SIGNATURE_32 ('R', 'V', 'I', 'S')
+#define RISCV_ISA_INFO_REVISION   0x00010000
+
+//
+// The extensions, by their bits in PcdRiscVFeatureOverride.
+//
+#define RISCV_ISA_FEATURE_ZICBOM   BIT0
+#define RISCV_ISA_FEATURE_SSTC     BIT1
+#define RISCV_ISA_FEATURE_SVPBMT   BIT2
+#define RISCV_ISA_FEATURE_ZKR      BIT3
+#define RISCV_ISA_FEATURE_SVNAPOT  BIT4
+#define RISCV_ISA_FEATURE_ZICBOZ   BIT5
+#define RISCV_ISA_FEATURE_V        BIT6
+#define RISCV_ISA_FEATURE_ZBC      BIT7
+#define RISCV_ISA_FEATURE_ZVKB     BIT8
+#define RISCV_ISA_FEATURE_ZVKNHA   BIT9
+#define RISCV_ISA_FEATURE_ZVKNHB   BIT10
+#define RISCV_ISA_FEATURE_ZBB      BIT11
+#define RISCV_ISA_FEATURE_ZKN      BIT12
+#define RISCV_ISA_FEATURE_ZAWRS    BIT13
+
+typedef struct {
+  UINT32    Signature;
+  UINT32    Revision;
+  // The RISCV_ISA_FEATURE_* that every hart implements.
+  UINT64    Features;
+  // The block sizes of Zicbom and Zicboz, which every hart shares, or 0 without the extension.
+  UINT32    CbomBlockSize;
+  UINT32    CbozBlockSize;
+} RISCV_ISA_INFO;
+
+extern EFI_GUID  gRiscVIsaInfoHobGuid;
+
+#endif
@@ -0,0 +1,40 @@
+/** @file
+  RISC-V MMU hand-off from SEC or PEI.
+
+  The platform builds an identity map of the address space with superpages
+  before DXE, enables it, and records it in a GUID HOB of this type. The
+  RISC-V MMU library adopts the live tables in DXE, and refines them with the
+  memory types of the GCD memory space map, rather than building its own.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef RISCV_MMU_HAND_OFF_H_
+#define RISCV_MMU_HAND_OFF_H_
+
+#define RISCV_MMU_HAND_OFF_GUID \
+  { \
+    0x8e41c7d2, 0x5f3b, 0x4a06, { 0xb2, 0x9d, 0x61, 0x0c, 0xe8, 0x4f, 0x17, 0xa3 } \
+  }
+
+#define RISCV_MMU_HAND_OFF_SIGNATURE  SIGNATURE_32 ('R', 'V', 'M', 'H')
+#define RISCV_MMU_HAND_OFF_REVISION   0x00010000
+
+typedef struct {
+  UINT32    Signature;
+  UINT32    Revision;
+  // The satp value that enabled the map. A satp that reads otherwise was
+  // changed since, and the tables aren't this HOB's.
+  UINT64    Satp;
+  // The pages that hold the tables, the root first, all boot-services data.
+  UINT64    TableBase;
+  UINT64    NumberOfTablePages;
+  // The end of the range identity-mapped from 0, with every permission.
+  UINT64    MappedEnd;
+} RISCV_MMU_HAND_OFF;
+
+extern EFI_GUID  gRiscVMmuHandOffHobGuid;
+
+#endif
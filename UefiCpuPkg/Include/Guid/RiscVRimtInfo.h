@@ -0,0 +1,92 @@
+/** @file
+  RISC-V IO Mapping Table model.
+
+  The RIMT is validated once, by RiscVRimtLib, and reduced to the IOMMUs it
+  describes and the intervals of source IDs that the PCIe root complexes and
+  platform devices map to their device_ids. A phase that parsed the RIMT may
+  publish the model in a GUID HOB of this type, so that later phases consume
+  it instead of parsing ACPI again.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef RISCV_RIMT_INFO_H_
+#define RISCV_RIMT_INFO_H_
+
+#define RISCV_RIMT_INFO_HOB_GUID \
+  { \
+    0x3c2a9e51, 0x6b0d, 0x4f7e, { 0x9a, 0x15, 0xd4, 0x82, 0x7c, 0x3e, 0x60, 0xb9 } \
+  }
+
+#define RISCV_RIMT_INFO_SIGNATURE  SIGNATURE_32 ('R', 'V', 'R', 'I')
+#define RISCV_RIMT_INFO_REVISION   0x00010000
+
+//
+// The kinds of node whose source IDs an interval maps.
+//
+#define RISCV_RIMT_SOURCE_PCIE_ROOT_COMPLEX  0
+#define RISCV_RIMT_SOURCE_PLATFORM_DEVICE    1
+
+typedef struct {
+  // The register base of a platform IOMMU, or 0 for a PCIe IOMMU.
+  UINT64    BaseAddress;
+  // The offset of the IOMMU's node in the RIMT.
+  UINT32    NodeOffset;
+  // The IOMMU_NODE_FLAG_* of the node. ProximityDomain is only valid with
+  // IOMMU_NODE_FLAG_PROXIMITY_DOMAIN_VALID.
+  UINT32    Flags;
+  UINT32    ProximityDomain;
+  // The location of a PCIe IOMMU.
+  UINT16    PcieSegment;
+  UINT16    PcieBdf;
+  UINT16    NumberOfInterruptWires;
+  UINT16    Reserved[3];
+} RISCV_RIMT_IOMMU;
+
+typedef struct {
+  // The index of the destination IOMMU in the model.
+  UINT32    IoMmuIndex;
+  // The offset of the root complex or platform device node in the RIMT. The
+  // source IDs of a platform device are only unique within its node.
+  UINT32    SourceNodeOffset;
+  UINT32    SourceIdBase;
+  // Never 0.
+  UINT32    NumberOfIds;
+  UINT32    DeviceIdBase;
+  // The PCIE_NODE_FLAG_* of a root complex, and its segment.
+  UINT32    SourceFlags;
+  UINT16    PcieSegment;
+  // RISCV_RIMT_SOURCE_*.
+  UINT8     SourceType;
+  UINT8     Reserved;
+  // The flags of the RIMT's ID mapping.
+  UINT32    MappingFlags;
+} RISCV_RIMT_ID_MAPPING;
+
+//
+// The model is followed by NumberOfIoMmus RISCV_RIMT_IOMMU and NumberOfIdMappings
+// RISCV_RIMT_ID_MAPPING, and has no pointers, so that it can be copied into a HOB.
+//
+typedef struct {
+  UINT32    Signature;
+  UINT32    Revision;
+  UINT32    NumberOfIoMmus;
+  UINT32    NumberOfIdMappings;
+} RISCV_RIMT_INFO;
+
+#define RISCV_RIMT_INFO_IOMMUS(Info) \
+  ((RISCV_RIMT_IOMMU *)((RISCV_RIMT_INFO *)(Info) + 1))
+
+#define RISCV_RIMT_INFO_ID_MAPPINGS(Info) \
+  ((RISCV_RIMT_ID_MAPPING *)(RISCV_RIMT_INFO_IOMMUS (Info) + (Info)->NumberOfIoMmus))
+
+#define RISCV_RIMT_INFO_SIZE(Info)                                  \
+  (sizeof (RISCV_RIMT_INFO) +                                       \
+   (UINTN)(Info)->NumberOfIoMmus * sizeof (RISCV_RIMT_IOMMU) +      \
+   (UINTN)(Info)->NumberOfIdMappings * sizeof (RISCV_RIMT_ID_MAPPING))
+
+extern EFI_GUID  gRiscVRimtInfoHobGuid;
+
+#endif
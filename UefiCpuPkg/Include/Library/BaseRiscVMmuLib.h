@@ -10,6 +10,8 @@
 #ifndef BASE_RISCV_MMU_LIB_H_
 #define BASE_RISCV_MMU_LIB_H_
 
+#include <Protocol/RiscVMmuStatistics.h>
+
 /**
   The API to flush all local TLBs.
 
@@ -53,7 +55,131 @@ RiscVSetMemoryAttributes (
   );
 
 /**
-  The API to configure and enable RISC-V MMU with the highest mode supported.
+  The API to get the memory attributes of a region from the live page tables.
+
+  @param  BaseAddress             The base address of the region.
+  @param  Length                  The length of the region.
+  @param  Attributes              The EFI_MEMORY_RO and EFI_MEMORY_XP attributes
+                                  of the region.
+
+  @retval EFI_INVALID_PARAMETER   Length is zero, or the region wraps around.
+  @retval EFI_UNSUPPORTED         The MMU is not enabled.
+  @retval EFI_NO_MAPPING          Part of the region is not mapped, or the
+                                  attributes differ across the region.
+  @retval EFI_SUCCESS             The operation succesfully.
+
+**/
+EFI_STATUS
+EFIAPI
+RiscVGetMemoryAttributes (
+  IN  EFI_PHYSICAL_ADDRESS  BaseAddress,
+  IN  UINT64                Length,
+  OUT UINT64                *Attributes
+  );
+
+/**
+  The API to set some of the EFI_MEMORY_RO and EFI_MEMORY_XP attributes of a
+  mapped region, leaving its other attributes as they are.
+
+  @param  BaseAddress             The base address of the region.
+  @param  Length                  The length of the region.
+  @param  Attributes              The attributes to set.
+  @param  AttributeMask           The attributes to update: EFI_MEMORY_RO,
+                                  EFI_MEMORY_XP or both.
+
+  @retval EFI_INVALID_PARAMETER   The region or AttributeMask was not valid.
+  @retval EFI_UNSUPPORTED         The MMU is not enabled.
+  @retval EFI_NO_MAPPING          Part of the region is not mapped.
+  @retval EFI_OUT_OF_RESOURCES    Not enough resource.
+  @retval EFI_SUCCESS             The operation succesfully.
+
+**/
+EFI_STATUS
+EFIAPI
+RiscVSetMemoryPermissions (
+  IN EFI_PHYSICAL_ADDRESS  BaseAddress,
+  IN UINT64                Length,
+  IN UINT64                Attributes,
+  IN UINT64                AttributeMask
+  );
+
+/**
+  The API to set the other harts that may run with the page tables, whose
+  translations are flushed with an SBI remote sfence.vma after each update.
+
+  @param  HartMask                The harts, as a bit mask relative to
+                                  HartMaskBase. 0 stops the remote flushes.
+  @param  HartMaskBase            The hart ID of bit 0 of HartMask, or
+                                  SBI_HART_MASK_BASE_ALL for every hart.
+
+**/
+VOID
+EFIAPI
+RiscVMmuSetRemoteHarts (
+  IN UINTN  HartMask,
+  IN UINTN  HartMaskBase
+  );
+
+/**
+  Flush the translations of a range on the other harts.
+
+  @param  StartAddress            The start of the range.
+  @param  Size                    The size of the range, or 0 with a
+                                  StartAddress of 0 for all addresses.
+
+**/
+typedef
+VOID
+(EFIAPI *RISCV_MMU_REMOTE_FLUSH)(
+  IN UINT64  StartAddress,
+  IN UINT64  Size
+  );
+
+/**
+  The API to flush the translations of the other harts after each update with
+  a function of the caller, in place of the SBI remote sfence.vma to the harts
+  set by RiscVMmuSetRemoteHarts ().
+
+  @param  RemoteFlush             The function, or NULL to return to the SBI
+                                  remote sfence.vma.
+
+**/
+VOID
+EFIAPI
+RiscVMmuSetRemoteFlush (
+  IN RISCV_MMU_REMOTE_FLUSH  RemoteFlush
+  );
+
+/**
+  The API to open a transaction, in which the updates of the live page tables
+  leave the flush of their translations to the commit of the transaction.
+
+  Until the commit, stale translations may still give the access that an
+  update took away. An update that gives access is flushed at once.
+  Transactions nest, and only the commit of the outermost flushes.
+
+**/
+VOID
+EFIAPI
+RiscVMmuBeginTransaction (
+  VOID
+  );
+
+/**
+  The API to commit a transaction opened by RiscVMmuBeginTransaction (), which
+  flushes the translations of the entries that its updates replaced.
+
+**/
+VOID
+EFIAPI
+RiscVMmuCommitTransaction (
+  VOID
+  );
+
+/**
+  The API to configure and enable RISC-V MMU, with the shallowest SATP mode
+  that reaches every address, or the highest mode supported, and adopting
+  the identity map that SEC or PEI enabled, if any.
 
   @retval EFI_OUT_OF_RESOURCES    Not enough resource.
   @retval EFI_SUCCESS             The operation succesfully.
@@ -65,4 +191,17 @@ RiscVConfigureMmu (
   VOID
   );
 
+/**
+  The API to report how the page tables were built and maintained, with the
+  tables and leaf entries of the live page tables counted by a walk.
+
+  @param  Statistics              The statistics.
+
+**/
+VOID
+EFIAPI
+RiscVMmuGetStatistics (
+  OUT RISCV_MMU_STATISTICS  *Statistics
+  );
+
 #endif /* BASE_RISCV_MMU_LIB_H_ */
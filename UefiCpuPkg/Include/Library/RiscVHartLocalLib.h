@@ -0,0 +1,174 @@
+/** @file
+  Library to find the data that belongs to the hart it runs on.
+
+  Each hart that firmware runs on has a block of hart-local storage, which the
+  tp register points to. tp is free for this, as firmware has no thread-local
+  storage of the C runtime. The block holds the hart ID, a scratch arena, and
+  a data pointer and a free list for each of the users in RISCV_HART_LOCAL_SLOT,
+  so that per-hart caches and queues need no locks.
+
+  CpuDxeRiscV64 attaches the block of the boot hart, and RiscVSbiMpServicesDxe
+  those of the APs. SEC clears tp, so that RiscVHartLocalGet() returns NULL until
+  then. tp belongs to the OS after ExitBootServices(), so runtime code must not
+  use this library.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef RISCV_HART_LOCAL_LIB_H_
+#define RISCV_HART_LOCAL_LIB_H_
+
+#define RISCV_HART_LOCAL_SIGNATURE  SIGNATURE_32 ('R', 'V', 'H', 'L')
+
+//
+// The size of the scratch arena of a hart.
+//
+#define RISCV_HART_LOCAL_SCRATCH_SIZE  SIZE_4KB
+
+//
+// The users of hart-local storage, each with a data pointer and a free list.
+//
+typedef enum {
+  RiscVHartLocalSlotIoMmuSlab,
+  RiscVHartLocalSlotIoMmuTrace,
+  RiscVHartLocalSlotIoMmuCommands,
+  RiscVHartLocalSlotMmuShootdown,
+  RiscVHartLocalSlotMax
+} RISCV_HART_LOCAL_SLOT;
+
+typedef struct {
+  UINT32    Signature;
+  //
+  // The bytes of Scratch in use.
+  //
+  UINT32    ScratchUsed;
+  UINTN     HartId;
+  //
+  // The index of the hart in the MP services protocol, or 0 before it is installed.
+  //
+  UINTN     ProcessorIndex;
+  VOID      *Data[RiscVHartLocalSlotMax];
+  VOID      *FreeList[RiscVHartLocalSlotMax];
+  UINT64    Scratch[RISCV_HART_LOCAL_SCRATCH_SIZE / sizeof (UINT64)];
+} RISCV_HART_LOCAL;
+
+/**
+  Get the hart-local storage of the hart this runs on.
+
+  @return  The hart-local storage, or NULL if none is attached to the hart.
+
+**/
+RISCV_HART_LOCAL *
+EFIAPI
+RiscVHartLocalGet (
+  VOID
+  );
+
+/**
+  Initialize a block of hart-local storage, without attaching it.
+
+  @param[out]  HartLocal       The block.
+  @param[in]   HartId          The hart that the block belongs to.
+  @param[in]   ProcessorIndex  The index of the hart in the MP services protocol.
+
+**/
+VOID
+EFIAPI
+RiscVHartLocalInitialize (
+  OUT RISCV_HART_LOCAL  *HartLocal,
+  IN  UINTN             HartId,
+  IN  UINTN             ProcessorIndex
+  );
+
+/**
+  Attach a block of hart-local storage to the hart this runs on.
+
+  @param[in]  HartLocal  The block, initialized by RiscVHartLocalInitialize().
+
+**/
+VOID
+EFIAPI
+RiscVHartLocalAttach (
+  IN RISCV_HART_LOCAL  *HartLocal
+  );
+
+/**
+  Push an entry onto a free list of the hart this runs on.
+
+  The first pointer of the entry links the list. Interrupts are masked for the
+  few instructions of the push, so handlers on the same hart may use the list.
+
+  @param[in]  Slot   The user of the list.
+  @param[in]  Entry  The entry.
+
+  @retval  TRUE   The entry was pushed.
+  @retval  FALSE  No hart-local storage is attached. The entry wasn't pushed.
+
+**/
+BOOLEAN
+EFIAPI
+RiscVHartLocalPush (
+  IN RISCV_HART_LOCAL_SLOT  Slot,
+  IN VOID                   *Entry
+  );
+
+/**
+  Pop an entry from a free list of the hart this runs on.
+
+  @param[in]  Slot  The user of the list.
+
+  @return  The entry, or NULL if the list is empty or no hart-local storage is attached.
+
+**/
+VOID *
+EFIAPI
+RiscVHartLocalPop (
+  IN RISCV_HART_LOCAL_SLOT  Slot
+  );
+
+/**
+  Allocate from the scratch arena of the hart this runs on.
+
+  The arena is a stack: memory is released by returning to a mark, which
+  releases everything allocated since. A handler that interrupts an allocation
+  releases its own memory before it returns, so the arena needs no masking.
+
+  @param[in]  Size  The size, rounded up to 8 bytes.
+
+  @return  The memory, 8-byte aligned, or NULL if the arena is exhausted or no
+           hart-local storage is attached.
+
+**/
+VOID *
+EFIAPI
+RiscVHartLocalScratchAllocate (
+  IN UINTN  Size
+  );
+
+/**
+  Get a mark of the scratch arena, to release what is allocated after it.
+
+  @return  The mark.
+
+**/
+UINTN
+EFIAPI
+RiscVHartLocalScratchMark (
+  VOID
+  );
+
+/**
+  Release the scratch memory allocated since a mark.
+
+  @param[in]  Mark  The mark, from RiscVHartLocalScratchMark().
+
+**/
+VOID
+EFIAPI
+RiscVHartLocalScratchRelease (
+  IN UINTN  Mark
+  );
+
+#endif /* RISCV_HART_LOCAL_LIB_H_ */
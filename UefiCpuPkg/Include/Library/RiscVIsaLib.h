@@ -0,0 +1,75 @@
+/** @file
+  Library to discover the RISC-V ISA extensions that all harts implement.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef RISCV_ISA_LIB_H_
+#define RISCV_ISA_LIB_H_
+
+#include <Guid/RiscVIsaInfo.h>
+
+/**
+  Discover the ISA extensions that every hart of a devicetree implements.
+
+  Each CPU node is read from riscv,isa-extensions, or from riscv,isa if it has
+  none. Zicbom and Zicboz are only reported if every hart has the same valid
+  block size for them.
+
+  @param[in]   Fdt   The devicetree.
+  @param[out]  Info  The extensions.
+
+  @retval  EFI_SUCCESS            The extensions were discovered.
+  @retval  EFI_INVALID_PARAMETER  Fdt or Info is NULL.
+  @retval  EFI_NOT_FOUND          The devicetree has no CPU nodes.
+
+**/
+EFI_STATUS
+EFIAPI
+RiscVIsaParseFdt (
+  IN  CONST VOID      *Fdt,
+  OUT RISCV_ISA_INFO  *Info
+  );
+
+/**
+  Get the ISA extensions that every hart implements, and PcdRiscVFeatureOverride leaves enabled.
+
+  The extensions are taken from the RISC-V ISA HOB, or else discovered from the
+  devicetree in the FDT HOB. Without either, none are reported.
+
+  @return  The RISCV_ISA_FEATURE_* bits.
+
+**/
+UINT64
+EFIAPI
+RiscVIsaGetFeatures (
+  VOID
+  );
+
+/**
+  Get the block size of the Zicbom cache-block management operations.
+
+  @return  The block size, or 0 if Zicbom may not be used.
+
+**/
+UINT32
+EFIAPI
+RiscVIsaGetCbomBlockSize (
+  VOID
+  );
+
+/**
+  Get the block size of the Zicboz cbo.zero operation.
+
+  @return  The block size, or 0 if Zicboz may not be used.
+
+**/
+UINT32
+EFIAPI
+RiscVIsaGetCbozBlockSize (
+  VOID
+  );
+
+#endif
@@ -0,0 +1,66 @@
+/** @file
+  Library to walk the page tables of the RISC-V paging modes.
+
+  The walkers are shared by the MMU library and the IOMMU driver, whose entries
+  differ in their permission bits, and so are described by a PTE policy.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef RISCV_PAGE_TABLE_LIB_H_
+#define RISCV_PAGE_TABLE_LIB_H_
+
+//
+// The deepest hierarchy of tables, with Sv57.
+//
+#define RISCV_PAGE_TABLE_MAX_LEVELS  5
+
+#define RISCV_PAGE_TABLE_PAGE_SHIFT      12
+#define RISCV_PAGE_TABLE_BITS_PER_LEVEL  9
+#define RISCV_PAGE_TABLE_ENTRY_COUNT     512
+
+//
+// The shift of the address bits that index a level, from 0 at the root, of a mode with Levels levels.
+//
+#define RISCV_PAGE_TABLE_LEVEL_SHIFT(Levels, Level) \
+  (((Levels) - (Level) - 1) * RISCV_PAGE_TABLE_BITS_PER_LEVEL + RISCV_PAGE_TABLE_PAGE_SHIFT)
+
+//
+// The format of the entries of a page table.
+//
+typedef struct {
+  // An entry is valid if all of these bits are set.
+  UINT64    ValidMask;
+  // A valid entry with none of these bits set points to the next-level table.
+  UINT64    LeafMask;
+  // The bits of the PPN, and their shift in the entry.
+  UINT64    PpnMask;
+  UINT8     PpnShift;
+} RISCV_PTE_POLICY;
+
+/**
+  Walk a page table for an address, without changing it.
+
+  @param[in]   Policy     The format of the entries.
+  @param[in]   Levels     The levels of the paging mode: 3 for Sv39, 4 for Sv48, or 5 for Sv57.
+  @param[in]   RootTable  The root of the page table.
+  @param[in]   Address    The address, within the reach of the mode.
+  @param[out]  Entries    The entries walked, from the root, until a leaf or an invalid
+                          entry. RISCV_PAGE_TABLE_MAX_LEVELS of them.
+
+  @return  The number of entries walked, or 0 if Levels isn't of a paging mode.
+
+**/
+UINTN
+EFIAPI
+RiscVPageTableWalk (
+  IN  CONST RISCV_PTE_POLICY  *Policy,
+  IN  UINTN                   Levels,
+  IN  CONST UINT64            *RootTable,
+  IN  UINT64                  Address,
+  OUT UINT64                  *Entries
+  );
+
+#endif
@@ -0,0 +1,54 @@
+/** @file
+  Library to attribute hardware events to regions of firmware code on RISC-V.
+
+  A region is named by a string, and is measured between RiscVPmuProfileBegin()
+  and RiscVPmuProfileEnd(). The cycles, instructions, data cache misses and
+  data TLB misses counted by the PMU while in the region are accumulated, and
+  are reported by RiscVPmuProfileDump(). The regions are also recorded through
+  PerformanceLib, so that their durations appear in FPDT.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef RISCV_PMU_PROFILE_LIB_H_
+#define RISCV_PMU_PROFILE_LIB_H_
+
+/**
+  Start measuring a region.
+
+  Regions may nest, and the outermost call of a recursive region is the one measured.
+
+  @param[in]  Region  The name of the region, which must remain valid.
+
+**/
+VOID
+EFIAPI
+RiscVPmuProfileBegin (
+  IN CONST CHAR8  *Region
+  );
+
+/**
+  Stop measuring a region, and accumulate its events.
+
+  @param[in]  Region  The name of the region, as passed to RiscVPmuProfileBegin().
+
+**/
+VOID
+EFIAPI
+RiscVPmuProfileEnd (
+  IN CONST CHAR8  *Region
+  );
+
+/**
+  Report the events accumulated for each region, with DEBUG_INFO.
+
+**/
+VOID
+EFIAPI
+RiscVPmuProfileDump (
+  VOID
+  );
+
+#endif
@@ -0,0 +1,54 @@
+/** @file
+  Library to validate the RISC-V IO Mapping Table and build its model.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef RISCV_RIMT_LIB_H_
+#define RISCV_RIMT_LIB_H_
+
+#include <Guid/RiscVRimtInfo.h>
+
+/**
+  Validate a RIMT, and build its model.
+
+  Every node must lie within the table, and every interrupt wire and ID mapping
+  array within its node. Nodes of unknown types are skipped. ID mappings of no
+  IDs, or to an offset that isn't an IOMMU node, are dropped.
+
+  @param[in]   Table  The RIMT.
+  @param[out]  Info   The model, in pool memory that the caller frees.
+
+  @retval  EFI_SUCCESS            The model was built.
+  @retval  EFI_INVALID_PARAMETER  Table or Info is NULL.
+  @retval  EFI_VOLUME_CORRUPTED   The table is malformed.
+  @retval  EFI_OUT_OF_RESOURCES   The model couldn't be allocated.
+
+**/
+EFI_STATUS
+EFIAPI
+RiscVRimtParse (
+  IN  CONST VOID       *Table,
+  OUT RISCV_RIMT_INFO  **Info
+  );
+
+/**
+  Validate a model of the RIMT, such as one found in a HOB.
+
+  @param[in]  Info      The model.
+  @param[in]  InfoSize  The size of the buffer holding the model.
+
+  @retval  TRUE   The model is consistent, and its ID mappings reference its IOMMUs.
+  @retval  FALSE  The model is malformed, or of another revision.
+
+**/
+BOOLEAN
+EFIAPI
+RiscVRimtIsValidInfo (
+  IN CONST RISCV_RIMT_INFO  *Info,
+  IN UINTN                  InfoSize
+  );
+
+#endif
@@ -0,0 +1,58 @@
+/** @file
+  Library to spread independent boot work over all harts.
+
+  The work is split by the caller into a number of tasks, which are numbered
+  from 0. The tasks are dealt out to one deque per hart, and a hart that runs
+  out of tasks steals half of the tasks left on another. The caller returns
+  once every task has run, so the tasks may fill memory that it uses next.
+
+  Tasks run on the APs as well as on the boot hart, so they must only touch
+  memory and MMIO, and must not call boot services or print. Without APs,
+  every task runs on the boot hart, in order.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef RISCV_TASK_POOL_LIB_H_
+#define RISCV_TASK_POOL_LIB_H_
+
+/**
+  A task.
+
+  @param[in]  Context  The context passed to RiscVTaskPoolRun().
+  @param[in]  Index    The number of the task.
+
+**/
+typedef
+VOID
+(EFIAPI *RISCV_TASK_PROCEDURE)(
+  IN VOID   *Context,
+  IN UINTN  Index
+  );
+
+/**
+  Run a number of tasks over all harts, and wait for every one of them.
+
+  Only the boot hart may call this. A call that is made while another is
+  running, from an event, runs its tasks on the boot hart alone.
+
+  @param[in]  Procedure      The task.
+  @param[in]  Context        The context passed to each task.
+  @param[in]  NumberOfTasks  The number of tasks.
+
+  @retval  EFI_SUCCESS            Every task has run.
+  @retval  EFI_INVALID_PARAMETER  Procedure is NULL, or NumberOfTasks exceeds MAX_UINT32.
+                                  No task has run.
+
+**/
+EFI_STATUS
+EFIAPI
+RiscVTaskPoolRun (
+  IN RISCV_TASK_PROCEDURE  Procedure,
+  IN VOID                  *Context,
+  IN UINTN                 NumberOfTasks
+  );
+
+#endif /* RISCV_TASK_POOL_LIB_H_ */
@@ -0,0 +1,290 @@
+/** @file
+  RISC-V IOMMU Diagnostics Protocol.
+
+  Reports the state of the RISC-V IOMMU driver and of each IOMMU it
+  initialised, for shell tools: the queues, mappings and pools, the fault
+  counters, the device contexts and IO page tables of its devices, how
+  each device's buffers were mapped, and the register accesses of the
+  driver's operations.
+  Nothing is changed, and no translation is affected.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef RISCV_IOMMU_DIAGNOSTICS_PROTOCOL_H_
+#define RISCV_IOMMU_DIAGNOSTICS_PROTOCOL_H_
+
+#define RISCV_IOMMU_DIAGNOSTICS_PROTOCOL_GUID \
+  { \
+    0xbb00bbd8, 0x8c27, 0x45ca, { 0x99, 0x5e, 0x4c, 0x95, 0x60, 0x27, 0xfa, 0xfe } \
+  }
+
+typedef struct _RISCV_IOMMU_DIAGNOSTICS_PROTOCOL RISCV_IOMMU_DIAGNOSTICS_PROTOCOL;
+
+#define RISCV_IOMMU_DIAGNOSTICS_PROTOCOL_REVISION  0x00010003
+
+//
+// The most page-table levels of a walk, those of Sv57.
+//
+#define RISCV_IOMMU_DIAGNOSTICS_MAX_LEVELS  5
+
+//
+// The buckets of the mapping sizes: up to 4 KiB, 16 KiB, 64 KiB, 256 KiB, 1 MiB, 4 MiB,
+// 16 MiB, and larger.
+//
+#define RISCV_IOMMU_DIAGNOSTICS_SIZE_BUCKETS  8
+
+//
+// Why Map() bounced a buffer, or the part of it that it bounced.
+//
+typedef enum {
+  // The buffer is above the memory that the IOMMUs, or the devices without them, reach.
+  RiscVIoMmuBounceAboveDmaTop,
+  // A 32-bit operation's buffer is above 4 GiB, and no IOVA below was available.
+  RiscVIoMmuBounceAbove4GB,
+  // A dedicated buffer doesn't cover whole pages.
+  RiscVIoMmuBounceUnaligned,
+  RiscVIoMmuBounceReasonMax
+} RISCV_IOMMU_BOUNCE_REASON;
+
+//
+// The operations of the driver that its register accesses are attributed to.
+//
+typedef enum {
+  // Initialising the IOMMUs.
+  RiscVIoMmuMmioInitialise,
+  // Map(), AllocateBuffer(), the batch maps, and SetAttribute() granting access.
+  RiscVIoMmuMmioMap,
+  // Unmap(), FreeBuffer(), the batch unmaps, and SetAttribute() revoking access.
+  RiscVIoMmuMmioUnmap,
+  // Servicing the interrupts of the IOMMUs, and draining their fault and page-request queues.
+  RiscVIoMmuMmioFaultDrain,
+  // Everything else, such as timers, the performance monitor and these diagnostics.
+  RiscVIoMmuMmioOther,
+  RiscVIoMmuMmioOperationMax
+} RISCV_IOMMU_MMIO_OPERATION;
+
+typedef struct {
+  // The number of entries, or 0 if the queue isn't enabled.
+  UINT32    NumberOfEntries;
+  UINT32    Head;
+  UINT32    Tail;
+} RISCV_IOMMU_QUEUE_STATISTICS;
+
+//
+// The state shared by all IOMMUs.
+//
+typedef struct {
+  UINTN    NumberOfIoMmus;
+  UINTN    LiveMappings;
+  UINTN    BouncePoolPages;
+  UINTN    BouncePoolFreePages;
+  // The pooled table pages, those in use, and the most ever in use.
+  UINTN    TablePoolPages;
+  UINTN    TablePoolPagesInUse;
+  UINTN    TablePoolHighWater;
+  // Since revision 0x00010001: how unmapped buffers are invalidated, and the mode of devices
+  // that no entry of PcdRiscVIoMmuDeviceModes lists, as in PcdRiscVIoMmuDefaultDeviceMode.
+  BOOLEAN  LazyInvalidation;
+  UINT8    DefaultDeviceMode;
+} RISCV_IOMMU_DRIVER_STATISTICS;
+
+//
+// The state of a single IOMMU.
+//
+typedef struct {
+  UINT64                          Address;
+  BOOLEAN                         IsPciDevice;
+  UINT8                           DeviceDirectoryLevels;
+  UINT8                           PageTableLevels;
+  UINTN                           DeviceDirectoryPages;
+  UINTN                           NumberOfDomains;
+  RISCV_IOMMU_QUEUE_STATISTICS    CommandQueue;
+  RISCV_IOMMU_QUEUE_STATISTICS    FaultQueue;
+  RISCV_IOMMU_QUEUE_STATISTICS    PageRequestQueue;
+  // The faults reported, and which of them were of device_ids without a domain.
+  UINT64                          Faults;
+  UINT64                          UnknownDeviceFaults;
+} RISCV_IOMMU_INSTANCE_STATISTICS;
+
+//
+// How the buffers of a device were mapped, since its domain was created. Only mappings that
+// the device was granted access to are counted, when their first grant is made. Times are in
+// nanoseconds.
+//
+typedef struct {
+  UINT32    DeviceId;
+  UINT64    Maps;
+  UINT64    BytesMapped;
+  UINT64    BytesBounced[RiscVIoMmuBounceReasonMax];
+  UINT64    SizeHistogram[RISCV_IOMMU_DIAGNOSTICS_SIZE_BUCKETS];
+  UINT64    TotalMapTime;
+  UINT64    MaxMapTime;
+  UINT64    Unmaps;
+  UINT64    TotalUnmapTime;
+  UINT64    MaxUnmapTime;
+} RISCV_IOMMU_DEVICE_STATISTICS;
+
+//
+// The register accesses of an operation, over all IOMMUs. Calls counts the outermost calls
+// of the operation, and is 0 for RiscVIoMmuMmioOther. PollIterations counts the reads that
+// found a register not yet in the state waited for, and WaitTime is in nanoseconds.
+//
+typedef struct {
+  UINT64    Calls;
+  UINT64    Reads;
+  UINT64    Writes;
+  UINT64    PollIterations;
+  UINT64    WaitTime;
+} RISCV_IOMMU_MMIO_STATISTICS;
+
+/**
+  Report the state shared by all IOMMUs.
+
+  @param[in]   This        The protocol instance.
+  @param[out]  Statistics  The state.
+
+  @retval  EFI_SUCCESS            Statistics is filled in.
+  @retval  EFI_INVALID_PARAMETER  Statistics is NULL.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *RISCV_IOMMU_DIAGNOSTICS_GET_DRIVER_STATISTICS)(
+  IN  RISCV_IOMMU_DIAGNOSTICS_PROTOCOL  *This,
+  OUT RISCV_IOMMU_DRIVER_STATISTICS     *Statistics
+  );
+
+/**
+  Report the state of an IOMMU.
+
+  @param[in]   This        The protocol instance.
+  @param[in]   IoMmuIndex  The index of the IOMMU, from 0.
+  @param[out]  Statistics  The state.
+
+  @retval  EFI_SUCCESS            Statistics is filled in.
+  @retval  EFI_INVALID_PARAMETER  Statistics is NULL.
+  @retval  EFI_NOT_FOUND          There are no more IOMMUs.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *RISCV_IOMMU_DIAGNOSTICS_GET_INSTANCE_STATISTICS)(
+  IN  RISCV_IOMMU_DIAGNOSTICS_PROTOCOL  *This,
+  IN  UINTN                             IoMmuIndex,
+  OUT RISCV_IOMMU_INSTANCE_STATISTICS   *Statistics
+  );
+
+/**
+  Copy the device context of a device_id from the device-directory table.
+
+  @param[in]      This        The protocol instance.
+  @param[in]      IoMmuIndex  The index of the IOMMU, from 0.
+  @param[in]      DeviceId    The device_id.
+  @param[out]     Buffer      The device context, in its in-memory format.
+  @param[in,out]  BufferSize  On input, the size of Buffer. On output, the size of the context.
+
+  @retval  EFI_SUCCESS            The device context is copied.
+  @retval  EFI_INVALID_PARAMETER  BufferSize is NULL, or Buffer is NULL while BufferSize isn't 0.
+  @retval  EFI_NOT_FOUND          There is no such IOMMU, or the directory has no entry for the device_id.
+  @retval  EFI_BUFFER_TOO_SMALL   Buffer is too small. BufferSize is updated.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *RISCV_IOMMU_DIAGNOSTICS_GET_DEVICE_CONTEXT)(
+  IN     RISCV_IOMMU_DIAGNOSTICS_PROTOCOL  *This,
+  IN     UINTN                             IoMmuIndex,
+  IN     UINT32                            DeviceId,
+  OUT    VOID                              *Buffer,
+  IN OUT UINTN                             *BufferSize
+  );
+
+/**
+  Walk the IO page table of a device_id's domain for an IO virtual address.
+
+  @param[in]   This              The protocol instance.
+  @param[in]   IoMmuIndex        The index of the IOMMU, from 0.
+  @param[in]   DeviceId          The device_id.
+  @param[in]   IoVirtualAddress  The IO virtual address.
+  @param[out]  Entries           The entries walked, from the root, until a leaf or an invalid entry.
+  @param[out]  NumberOfEntries   The number of entries walked.
+
+  @retval  EFI_SUCCESS            The page table is walked.
+  @retval  EFI_INVALID_PARAMETER  Entries or NumberOfEntries is NULL.
+  @retval  EFI_NOT_FOUND          There is no such IOMMU, or the device_id has no domain.
+  @retval  EFI_UNSUPPORTED        The domain bypasses translation.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *RISCV_IOMMU_DIAGNOSTICS_WALK_PAGE_TABLE)(
+  IN  RISCV_IOMMU_DIAGNOSTICS_PROTOCOL  *This,
+  IN  UINTN                             IoMmuIndex,
+  IN  UINT32                            DeviceId,
+  IN  UINT64                            IoVirtualAddress,
+  OUT UINT64                            Entries[RISCV_IOMMU_DIAGNOSTICS_MAX_LEVELS],
+  OUT UINTN                             *NumberOfEntries
+  );
+
+/**
+  Report how the buffers of a device were mapped.
+
+  Since revision 0x00010002.
+
+  @param[in]   This         The protocol instance.
+  @param[in]   IoMmuIndex   The index of the IOMMU, from 0.
+  @param[in]   DomainIndex  The index of the device among those of the IOMMU, from 0.
+  @param[out]  Statistics   The statistics, and the device_id of the device.
+
+  @retval  EFI_SUCCESS            Statistics is filled in.
+  @retval  EFI_INVALID_PARAMETER  Statistics is NULL.
+  @retval  EFI_NOT_FOUND          There is no such IOMMU, or it has no more devices.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *RISCV_IOMMU_DIAGNOSTICS_GET_DEVICE_STATISTICS)(
+  IN  RISCV_IOMMU_DIAGNOSTICS_PROTOCOL  *This,
+  IN  UINTN                             IoMmuIndex,
+  IN  UINTN                             DomainIndex,
+  OUT RISCV_IOMMU_DEVICE_STATISTICS     *Statistics
+  );
+
+/**
+  Report the register accesses of an operation of the driver.
+
+  Since revision 0x00010003.
+
+  @param[in]   This        The protocol instance.
+  @param[in]   Operation   The operation.
+  @param[out]  Statistics  The accesses.
+
+  @retval  EFI_SUCCESS            Statistics is filled in.
+  @retval  EFI_INVALID_PARAMETER  Statistics is NULL, or Operation is unknown.
+  @retval  EFI_UNSUPPORTED        The driver doesn't count its register accesses.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *RISCV_IOMMU_DIAGNOSTICS_GET_MMIO_STATISTICS)(
+  IN  RISCV_IOMMU_DIAGNOSTICS_PROTOCOL  *This,
+  IN  RISCV_IOMMU_MMIO_OPERATION        Operation,
+  OUT RISCV_IOMMU_MMIO_STATISTICS       *Statistics
+  );
+
+struct _RISCV_IOMMU_DIAGNOSTICS_PROTOCOL {
+  UINT64                                             Revision;
+  RISCV_IOMMU_DIAGNOSTICS_GET_DRIVER_STATISTICS      GetDriverStatistics;
+  RISCV_IOMMU_DIAGNOSTICS_GET_INSTANCE_STATISTICS    GetInstanceStatistics;
+  RISCV_IOMMU_DIAGNOSTICS_GET_DEVICE_CONTEXT         GetDeviceContext;
+  RISCV_IOMMU_DIAGNOSTICS_WALK_PAGE_TABLE            WalkPageTable;
+  RISCV_IOMMU_DIAGNOSTICS_GET_DEVICE_STATISTICS      GetDeviceStatistics;
+  RISCV_IOMMU_DIAGNOSTICS_GET_MMIO_STATISTICS        GetMmioStatistics;
+};
+
+extern EFI_GUID  gRiscVIoMmuDiagnosticsProtocolGuid;
+
+#endif
@@ -0,0 +1,171 @@
+/** @file
+  RISC-V IOMMU Hardware Performance Monitor Protocol.
+
+  Programs the counters of the IOMMU hardware performance monitor (IOHPM),
+  which count the translation events of the IOMMU, optionally only those of
+  a single device_id or PSCID. Counters are extended to 64 bits in software,
+  so their wrap-arounds are not lost.
+
+  @par Revision Reference:
+  The IOHPM is specified in Chapter 5 of the RISC-V IOMMU Architecture
+  Specification, version 1.0.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef RISCV_IOMMU_HPM_PROTOCOL_H_
+#define RISCV_IOMMU_HPM_PROTOCOL_H_
+
+#define RISCV_IOMMU_HPM_PROTOCOL_GUID \
+  { \
+    0x78eb5d94, 0xf4f8, 0x4385, { 0xbf, 0x3a, 0x70, 0x6e, 0x2a, 0xf9, 0x15, 0x3c } \
+  }
+
+typedef struct _RISCV_IOMMU_HPM_PROTOCOL RISCV_IOMMU_HPM_PROTOCOL;
+
+#define RISCV_IOMMU_HPM_PROTOCOL_REVISION  0x00010000
+
+//
+// The events a counter can count. The cycle counter is counter 0.
+//
+typedef enum {
+  RiscVIoMmuHpmEventCycles                 = 0,
+  RiscVIoMmuHpmEventUntranslatedRequests   = 1,
+  RiscVIoMmuHpmEventTranslatedRequests     = 2,
+  RiscVIoMmuHpmEventAtsTranslationRequests = 3,
+  RiscVIoMmuHpmEventIoTlbMisses            = 4,
+  RiscVIoMmuHpmEventDdtWalks               = 5,
+  RiscVIoMmuHpmEventPdtWalks               = 6,
+  RiscVIoMmuHpmEventFirstStageWalks        = 7,
+  RiscVIoMmuHpmEventSecondStageWalks       = 8,
+  RiscVIoMmuHpmEventMax
+} RISCV_IOMMU_HPM_EVENT;
+
+//
+// Which requests an event counter counts. The cycle counter can't be filtered.
+//
+typedef enum {
+  RiscVIoMmuHpmFilterNone,
+  RiscVIoMmuHpmFilterDeviceId,
+  RiscVIoMmuHpmFilterPscid,
+  RiscVIoMmuHpmFilterMax
+} RISCV_IOMMU_HPM_FILTER_TYPE;
+
+typedef struct {
+  RISCV_IOMMU_HPM_FILTER_TYPE    Type;
+  // The device_id (24 bits) or PSCID (20 bits) to count.
+  UINT32                         Id;
+} RISCV_IOMMU_HPM_FILTER;
+
+typedef struct {
+  // The base address of the IOMMU's registers.
+  UINT64    Address;
+  // The event counters, numbered from 1, and the implemented width of each.
+  UINT8     NumberOfCounters;
+  UINT8     CounterWidth;
+} RISCV_IOMMU_HPM_INFO;
+
+/**
+  Describe the performance monitor of an IOMMU.
+
+  @param[in]   This        The protocol instance.
+  @param[in]   IoMmuIndex  The index of the IOMMU, from 0.
+  @param[out]  Info        The description of its performance monitor.
+
+  @retval  EFI_SUCCESS            Info is filled in.
+  @retval  EFI_INVALID_PARAMETER  Info is NULL.
+  @retval  EFI_NOT_FOUND          There are no more IOMMUs.
+  @retval  EFI_UNSUPPORTED        The IOMMU has no performance monitor.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *RISCV_IOMMU_HPM_GET_INFO)(
+  IN  RISCV_IOMMU_HPM_PROTOCOL  *This,
+  IN  UINTN                     IoMmuIndex,
+  OUT RISCV_IOMMU_HPM_INFO      *Info
+  );
+
+/**
+  Start counting an event, from 0.
+
+  @param[in]   This        The protocol instance.
+  @param[in]   IoMmuIndex  The index of the IOMMU, from 0.
+  @param[in]   Event       The event to count.
+  @param[in]   Filter      The requests to count, or NULL to count all of them.
+  @param[out]  Counter     The counter that counts the event: 0 for cycles, from 1 otherwise.
+
+  @retval  EFI_SUCCESS            The counter is counting.
+  @retval  EFI_INVALID_PARAMETER  Counter is NULL, or Event or Filter are invalid.
+  @retval  EFI_NOT_FOUND          There is no such IOMMU.
+  @retval  EFI_UNSUPPORTED        The IOMMU has no performance monitor.
+  @retval  EFI_OUT_OF_RESOURCES   Every event counter is in use.
+  @retval  EFI_ALREADY_STARTED    The cycle counter is already counting.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *RISCV_IOMMU_HPM_START_COUNTER)(
+  IN  RISCV_IOMMU_HPM_PROTOCOL      *This,
+  IN  UINTN                         IoMmuIndex,
+  IN  RISCV_IOMMU_HPM_EVENT         Event,
+  IN  CONST RISCV_IOMMU_HPM_FILTER  *Filter OPTIONAL,
+  OUT UINT32                        *Counter
+  );
+
+/**
+  Read a counter, including the wrap-arounds since it was started.
+
+  @param[in]   This        The protocol instance.
+  @param[in]   IoMmuIndex  The index of the IOMMU, from 0.
+  @param[in]   Counter     The counter.
+  @param[out]  Value       The events counted.
+
+  @retval  EFI_SUCCESS            Value is read.
+  @retval  EFI_INVALID_PARAMETER  Value is NULL.
+  @retval  EFI_NOT_FOUND          There is no such IOMMU, or the counter isn't started.
+  @retval  EFI_UNSUPPORTED        The IOMMU has no performance monitor.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *RISCV_IOMMU_HPM_READ_COUNTER)(
+  IN  RISCV_IOMMU_HPM_PROTOCOL  *This,
+  IN  UINTN                     IoMmuIndex,
+  IN  UINT32                    Counter,
+  OUT UINT64                    *Value
+  );
+
+/**
+  Stop a counter, and release it.
+
+  @param[in]  This        The protocol instance.
+  @param[in]  IoMmuIndex  The index of the IOMMU, from 0.
+  @param[in]  Counter     The counter.
+
+  @retval  EFI_SUCCESS      The counter is stopped.
+  @retval  EFI_NOT_FOUND    There is no such IOMMU, or the counter isn't started.
+  @retval  EFI_UNSUPPORTED  The IOMMU has no performance monitor.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *RISCV_IOMMU_HPM_STOP_COUNTER)(
+  IN  RISCV_IOMMU_HPM_PROTOCOL  *This,
+  IN  UINTN                     IoMmuIndex,
+  IN  UINT32                    Counter
+  );
+
+struct _RISCV_IOMMU_HPM_PROTOCOL {
+  UINT64                           Revision;
+  RISCV_IOMMU_HPM_GET_INFO         GetInfo;
+  RISCV_IOMMU_HPM_START_COUNTER    StartCounter;
+  RISCV_IOMMU_HPM_READ_COUNTER     ReadCounter;
+  RISCV_IOMMU_HPM_STOP_COUNTER     StopCounter;
+};
+
+extern EFI_GUID  gRiscVIoMmuHpmProtocolGuid;
+
+#endif
@@ -0,0 +1,73 @@
+/** @file
+  RISC-V MMU Statistics Protocol.
+
+  Reports how the CPU page tables were built and maintained: the table pages
+  taken and given back, the block entries split and the tables folded, the
+  leaf entries of the live page tables by size, and the TLB flushes issued.
+  It is produced by the CPU driver, and lets the fragmentation that memory
+  protection causes be measured. Nothing is changed.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef RISCV_MMU_STATISTICS_PROTOCOL_H_
+#define RISCV_MMU_STATISTICS_PROTOCOL_H_
+
+#define RISCV_MMU_STATISTICS_PROTOCOL_GUID \
+  { \
+    0x5f0d1c4e, 0x8b27, 0x4a63, { 0x9e, 0x41, 0x2d, 0xc8, 0x7a, 0x06, 0xb3, 0x95 } \
+  }
+
+typedef struct _RISCV_MMU_STATISTICS_PROTOCOL RISCV_MMU_STATISTICS_PROTOCOL;
+
+#define RISCV_MMU_STATISTICS_PROTOCOL_REVISION  0x00010000
+
+typedef struct {
+  // The SATP mode, or SATP_MODE_OFF if the MMU isn't enabled.
+  UINTN     SatpMode;
+  // The table pages taken for new tables and given back, and the blocks split and tables folded.
+  UINT64    TablesAllocated;
+  UINT64    TablesFreed;
+  UINT64    Splits;
+  UINT64    Folds;
+  // The tables of the live page tables, with the root, and their leaf entries by size. A 64 KiB
+  // NAPOT group counts once.
+  UINT64    LiveTables;
+  UINT64    Leaves4K;
+  UINT64    Leaves64K;
+  UINT64    Leaves2M;
+  UINT64    Leaves1G;
+  UINT64    Leaves512G;
+  // The sfence.vma issued at an address and for all addresses, and the flushes of other harts.
+  UINT64    LocalFlushes;
+  UINT64    LocalFlushAlls;
+  UINT64    RemoteFlushes;
+} RISCV_MMU_STATISTICS;
+
+/**
+  Report the statistics of the CPU page tables.
+
+  @param[in]   This        The protocol instance.
+  @param[out]  Statistics  The statistics.
+
+  @retval  EFI_SUCCESS            Statistics is filled in.
+  @retval  EFI_INVALID_PARAMETER  Statistics is NULL.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *RISCV_MMU_STATISTICS_GET_STATISTICS)(
+  IN  RISCV_MMU_STATISTICS_PROTOCOL  *This,
+  OUT RISCV_MMU_STATISTICS           *Statistics
+  );
+
+struct _RISCV_MMU_STATISTICS_PROTOCOL {
+  UINT64                                 Revision;
+  RISCV_MMU_STATISTICS_GET_STATISTICS    GetStatistics;
+};
+
+extern EFI_GUID  gRiscVMmuStatisticsProtocolGuid;
+
+#endif
@@ -0,0 +1,97 @@
+/** @file
+  RISC-V MSI Protocol.
+
+  Allocates message-signaled interrupts of the S-level interrupt file of the
+  boot hart's IMSIC, and calls a handler when they arrive. Devices, and the
+  IOMMU, are programmed with the address and data of an MSI, so that they
+  interrupt instead of being polled.
+
+  Handlers are called in interrupt context at TPL_HIGH_LEVEL, and are expected
+  to do little more than acknowledge the device and signal an event.
+
+  @par Revision Reference:
+  The IMSIC is specified in Chapter 3 of the RISC-V Advanced Interrupt
+  Architecture, version 1.0.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef RISCV_MSI_PROTOCOL_H_
+#define RISCV_MSI_PROTOCOL_H_
+
+#define RISCV_MSI_PROTOCOL_GUID \
+  { \
+    0xa0d057a2, 0x33ce, 0x4e1d, { 0x97, 0x7b, 0xe7, 0x34, 0xd6, 0xef, 0xfc, 0xb2 } \
+  }
+
+typedef struct _RISCV_MSI_PROTOCOL RISCV_MSI_PROTOCOL;
+
+#define RISCV_MSI_PROTOCOL_REVISION  0x00010000
+
+/**
+  Handle an MSI.
+
+  @param[in]  Context  The context the MSI was allocated with.
+
+**/
+typedef
+VOID
+(EFIAPI *RISCV_MSI_HANDLER)(
+  IN VOID  *Context
+  );
+
+/**
+  Allocate an MSI, and enable it.
+
+  @param[in]   This     The protocol instance.
+  @param[in]   Handler  The handler to call when the MSI arrives.
+  @param[in]   Context  The context to pass to Handler.
+  @param[out]  Address  The address the device writes the MSI to.
+  @param[out]  Data     The 32-bit data the device writes, which is also the
+                        interrupt identity of the MSI.
+
+  @retval  EFI_SUCCESS            The MSI is allocated.
+  @retval  EFI_INVALID_PARAMETER  Handler, Address or Data is NULL.
+  @retval  EFI_OUT_OF_RESOURCES   All interrupt identities are in use.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *RISCV_MSI_ALLOCATE)(
+  IN  RISCV_MSI_PROTOCOL  *This,
+  IN  RISCV_MSI_HANDLER   Handler,
+  IN  VOID                *Context OPTIONAL,
+  OUT UINT64              *Address,
+  OUT UINT32              *Data
+  );
+
+/**
+  Disable an MSI, and free it.
+
+  The device must have stopped signalling it.
+
+  @param[in]  This  The protocol instance.
+  @param[in]  Data  The data of the MSI, as returned by Allocate().
+
+  @retval  EFI_SUCCESS    The MSI is freed.
+  @retval  EFI_NOT_FOUND  The MSI isn't allocated.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *RISCV_MSI_FREE)(
+  IN  RISCV_MSI_PROTOCOL  *This,
+  IN  UINT32              Data
+  );
+
+struct _RISCV_MSI_PROTOCOL {
+  UINT64                Revision;
+  RISCV_MSI_ALLOCATE    Allocate;
+  RISCV_MSI_FREE        Free;
+};
+
+extern EFI_GUID  gRiscVMsiProtocolGuid;
+
+#endif
@@ -0,0 +1,57 @@
+/** @file
+  RISC-V TLB Shootdown Protocol.
+
+  Flushes the translations of the other harts after the boot hart has changed
+  the page tables that they run with. It is produced by the MP services driver,
+  which knows which harts are running firmware code, and which are parked and
+  can be reached with an MSI to their own S-level interrupt file instead of an
+  SBI IPI, which traps through M-mode on both ends.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef RISCV_TLB_SHOOTDOWN_PROTOCOL_H_
+#define RISCV_TLB_SHOOTDOWN_PROTOCOL_H_
+
+#define RISCV_TLB_SHOOTDOWN_PROTOCOL_GUID \
+  { \
+    0x065bbc61, 0x521d, 0x486f, { 0xba, 0x19, 0x7a, 0xd3, 0xe9, 0xe5, 0xe1, 0xbc } \
+  }
+
+typedef struct _RISCV_TLB_SHOOTDOWN_PROTOCOL RISCV_TLB_SHOOTDOWN_PROTOCOL;
+
+#define RISCV_TLB_SHOOTDOWN_PROTOCOL_REVISION  0x00010000
+
+/**
+  Flush the translations of a range on every hart but the boot hart, and
+  return once they are flushed.
+
+  Only the boot hart may call this.
+
+  @param[in]  This          The protocol instance.
+  @param[in]  StartAddress  The start of the range.
+  @param[in]  Size          The size of the range, or 0 with a StartAddress of 0
+                            for all addresses.
+
+  @retval  EFI_SUCCESS       The translations are flushed.
+  @retval  EFI_DEVICE_ERROR  The SBI implementation failed to flush some harts.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *RISCV_TLB_SHOOTDOWN)(
+  IN RISCV_TLB_SHOOTDOWN_PROTOCOL  *This,
+  IN UINT64                        StartAddress,
+  IN UINT64                        Size
+  );
+
+struct _RISCV_TLB_SHOOTDOWN_PROTOCOL {
+  UINT64                 Revision;
+  RISCV_TLB_SHOOTDOWN    Shootdown;
+};
+
+extern EFI_GUID  gRiscVTlbShootdownProtocolGuid;
+
+#endif
@@ -18,10 +18,30 @@
 #include <Library/HobLib.h>
 #include <Library/FdtLib.h>
 #include <Library/TimerLib.h>
+#include "CpuTimerLibInternal.h"
 
 STATIC UINT64  mTimeBase;
 
-#define GET_TIME_BASE()  (mTimeBase ?: GetPerformanceCounterProperties(NULL, NULL))
+#define GET_TIME_BASE()  (mTimeBase ?: InternalRiscVGetTimeBase ())
+
+#define RISCV_CPU_FEATURE_SSTC_BITMASK  0x2
+
+//
+// Delays shorter than this are spun, as waking from WFI costs a few microseconds.
+//
+#define TIMER_WFI_MIN_DELAY_US  10
+
+/**
+  Sleep in WFI until the timer reaches a deadline, or an interrupt is pending.
+  Requires Sstc.
+
+  @param  Deadline  The deadline, as a TIME CSR value.
+
+**/
+VOID
+InternalRiscVTimerWait (
+  IN UINT64  Deadline
+  );
 
 /**
   Stalls the CPU for at least the given number of ticks.
@@ -39,9 +59,22 @@ InternalRiscVTimerDelay (
   )
 {
   UINT64  Ticks;
+  UINT64  WfiTicks;
 
   Ticks = RiscVReadTimer () + Delay;
 
+  //
+  // With Sstc, the hart sleeps through most of a long delay instead of spinning,
+  // which also releases the host CPU under a hypervisor. Any interrupt wakes it
+  // early, so the remaining delay is checked again after each wake-up.
+  //
+  if ((PcdGet64 (PcdRiscVFeatureOverride) & RISCV_CPU_FEATURE_SSTC_BITMASK) != 0) {
+    WfiTicks = DivU64x32 (MultU64x32 (GET_TIME_BASE (), TIMER_WFI_MIN_DELAY_US), 1000000u);
+    while (RiscVReadTimer () + WfiTicks <= Ticks) {
+      InternalRiscVTimerWait (Ticks + 1);
+    }
+  }
+
   while (RiscVReadTimer () <= Ticks) {
     CpuPause ();
   }
@@ -104,54 +137,14 @@ NanoSecondDelay (
 }
 
 /**
-  Retrieves the current value of a 64-bit free running performance counter.
-
-  Retrieves the current value of a 64-bit free running performance counter. The
-  counter can either count up by 1 or count down by 1. If the physical
-  performance counter counts by a larger increment, then the counter values
-  must be translated. The properties of the counter can be retrieved from
-  GetPerformanceCounterProperties().
-
-  @return The current value of the free running performance counter.
-
-**/
-UINT64
-EFIAPI
-GetPerformanceCounter (
-  VOID
-  )
-{
-  return (UINT64)RiscVReadTimer ();
-}
-
-/**return
-  Retrieves the 64-bit frequency in Hz and the range of performance counter
-  values.
-
-  If StartValue is not NULL, then the value that the performance counter starts
-  with immediately after is it rolls over is returned in StartValue. If
-  EndValue is not NULL, then the value that the performance counter end with
-  immediately before it rolls over is returned in EndValue. The 64-bit
-  frequency of the performance counter in Hz is always returned. If StartValue
-  is less than EndValue, then the performance counter counts up. If StartValue
-  is greater than EndValue, then the performance counter counts down. For
-  example, a 64-bit free running counter that counts up would have a StartValue
-  of 0 and an EndValue of 0xFFFFFFFFFFFFFFFF. A 24-bit free running counter
-  that counts down would have a StartValue of 0xFFFFFF and an EndValue of 0.
-
-  @param  StartValue  The value the performance counter starts with when it
-                      rolls over.
-  @param  EndValue    The value that the performance counter ends with before
-                      it rolls over.
+  Retrieves the frequency of the TIME CSR in Hz, from the devicetree.
 
   @return The frequency in Hz.
 
 **/
 UINT64
-EFIAPI
-GetPerformanceCounterProperties (
-  OUT      UINT64 *StartValue, OPTIONAL
-  OUT      UINT64                    *EndValue     OPTIONAL
+InternalRiscVGetTimeBase (
+  VOID
   )
 {
   VOID                    *Hob;
@@ -160,14 +153,6 @@ GetPerformanceCounterProperties (
   UINT64                  TimeBase;
   CONST VOID              *FdtBase;
 
-  if (StartValue != NULL) {
-    *StartValue = 0;
-  }
-
-  if (EndValue != NULL) {
-    *EndValue = 32 - 1;
-  }
-
   if (mTimeBase != 0) {
     return mTimeBase;
   }
@@ -226,39 +211,3 @@ GetPerformanceCounterProperties (
 
   return TimeBase;
 }
-
-/**
-  Converts elapsed ticks of performance counter to time in nanoseconds.
-
-  This function converts the elapsed ticks of running performance counter to
-  time value in unit of nanoseconds.
-
-  @param  Ticks     The number of elapsed ticks of running performance counter.
-
-  @return The elapsed time in nanoseconds.
-
-**/
-UINT64
-EFIAPI
-GetTimeInNanoSecond (
-  IN      UINT64  Ticks
-  )
-{
-  UINT64  NanoSeconds;
-  UINT32  Remainder;
-
-  //
-  //          Ticks
-  // Time = --------- x 1,000,000,000
-  //        Frequency
-  //
-  NanoSeconds = MultU64x32 (DivU64x32Remainder (Ticks, GET_TIME_BASE (), &Remainder), 1000000000u);
-
-  //
-  // Frequency < 0x100000000, so Remainder < 0x100000000, then (Remainder * 1,000,000,000)
-  // will not overflow 64-bit.
-  //
-  NanoSeconds += DivU64x32 (MultU64x32 ((UINT64)Remainder, 1000000000u), GET_TIME_BASE ());
-
-  return NanoSeconds;
-}
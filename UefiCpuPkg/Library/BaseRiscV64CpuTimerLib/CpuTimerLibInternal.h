@@ -0,0 +1,23 @@
+/** @file
+  Internal definitions of the RISC-V CPU timer libraries.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef CPU_TIMER_LIB_INTERNAL_H_
+#define CPU_TIMER_LIB_INTERNAL_H_
+
+/**
+  Retrieves the frequency of the TIME CSR in Hz, from the devicetree.
+
+  @return The frequency in Hz.
+
+**/
+UINT64
+InternalRiscVGetTimeBase (
+  VOID
+  );
+
+#endif
@@ -0,0 +1,237 @@
+/** @file
+  RISC-V performance counter, from the CYCLE CSR, for profiling.
+
+  The TIME CSR often counts at only a few MHz, which is too coarse to time
+  short operations. This instance counts hart cycles instead, at a frequency
+  calibrated against the TIME CSR on first use. Where SBI implements the PMU
+  extension, it is asked to start the cycle counter. S-mode must be allowed to
+  read the counter (mcounteren.CY), as OpenSBI does. If the counter does not
+  advance, the TIME CSR is used instead.
+
+  The cycle counters of different harts are not synchronised, and their rate
+  follows the hart's clock, so this instance is meant for profiling on the boot
+  hart, in modules that run from RAM. Delays are still timed with the TIME CSR,
+  and CpuTimerDxeRiscV64 must keep BaseRiscV64CpuTimerLib.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseRiscVSbiLib.h>
+#include <Library/TimerLib.h>
+#include "CpuTimerLibInternal.h"
+
+//
+// The TIME CSR interval over which the cycle counter is calibrated.
+//
+#define CYCLE_CALIBRATION_US  1000
+
+STATIC BOOLEAN  mCycleCalibrated = FALSE;
+STATIC UINT64   mCycleFrequency  = 0;
+
+/**
+  Reads the CYCLE CSR.
+
+  @return The number of cycles the hart has run.
+
+**/
+UINT64
+InternalRiscVReadCycle (
+  VOID
+  );
+
+/**
+  Start the cycle counter through the SBI PMU extension, if it is implemented.
+
+  The counter is left as it was if SBI refuses, as it may already be running.
+
+**/
+STATIC
+VOID
+StartCycleCounter (
+  VOID
+  )
+{
+  SBI_RET  Ret;
+  UINTN    CounterIndex;
+
+  Ret = SbiCall (SBI_EXT_BASE, SBI_EXT_BASE_PROBE_EXT, 1, SBI_EXT_PMU);
+  if ((Ret.Error != SBI_SUCCESS) || (Ret.Value == 0)) {
+    return;
+  }
+
+  //
+  // Counter 0 is the cycle counter.
+  //
+  SbiPmuCounterConfigMatching (0, 1, SBI_PMU_CFG_FLAG_AUTO_START, SBI_PMU_HW_CPU_CYCLES, 0, &CounterIndex);
+}
+
+/**
+  Measure the cycle frequency against the TIME CSR.
+
+  @return The frequency in Hz, or 0 if the cycle counter does not advance.
+
+**/
+STATIC
+UINT64
+CalibrateCycleFrequency (
+  VOID
+  )
+{
+  UINT64  TimeBase;
+  UINT64  Window;
+  UINT64  TimeStart;
+  UINT64  TimeEnd;
+  UINT64  CycleStart;
+  UINT64  CycleEnd;
+
+  StartCycleCounter ();
+
+  TimeBase = InternalRiscVGetTimeBase ();
+  Window   = MAX (DivU64x32 (MultU64x32 (TimeBase, CYCLE_CALIBRATION_US), 1000000u), 1);
+
+  //
+  // Start on a tick of the TIME CSR, so that the window is not a tick short.
+  //
+  TimeStart = RiscVReadTimer ();
+  while (RiscVReadTimer () == TimeStart) {
+  }
+
+  TimeStart  = RiscVReadTimer ();
+  CycleStart = InternalRiscVReadCycle ();
+  do {
+    TimeEnd = RiscVReadTimer ();
+  } while (TimeEnd - TimeStart < Window);
+
+  CycleEnd = InternalRiscVReadCycle ();
+
+  if (CycleEnd == CycleStart) {
+    return 0;
+  }
+
+  return DivU64x64Remainder (MultU64x64 (CycleEnd - CycleStart, TimeBase), TimeEnd - TimeStart, NULL);
+}
+
+/**
+  Retrieves the frequency of the cycle counter, calibrating it on the first call.
+
+  @return The frequency in Hz, or 0 if the TIME CSR is used instead.
+
+**/
+STATIC
+UINT64
+GetCycleFrequency (
+  VOID
+  )
+{
+  if (!mCycleCalibrated) {
+    mCycleFrequency  = CalibrateCycleFrequency ();
+    mCycleCalibrated = TRUE;
+  }
+
+  return mCycleFrequency;
+}
+
+/**
+  Retrieves the current value of a 64-bit free running performance counter.
+
+  Retrieves the current value of a 64-bit free running performance counter. The
+  counter can either count up by 1 or count down by 1. If the physical
+  performance counter counts by a larger increment, then the counter values
+  must be translated. The properties of the counter can be retrieved from
+  GetPerformanceCounterProperties().
+
+  @return The current value of the free running performance counter.
+
+**/
+UINT64
+EFIAPI
+GetPerformanceCounter (
+  VOID
+  )
+{
+  if (GetCycleFrequency () == 0) {
+    return RiscVReadTimer ();
+  }
+
+  return InternalRiscVReadCycle ();
+}
+
+/**
+  Retrieves the 64-bit frequency in Hz and the range of performance counter
+  values.
+
+  If StartValue is not NULL, then the value that the performance counter starts
+  with immediately after is it rolls over is returned in StartValue. If
+  EndValue is not NULL, then the value that the performance counter end with
+  immediately before it rolls over is returned in EndValue. The 64-bit
+  frequency of the performance counter in Hz is always returned.
+
+  @param  StartValue  The value the performance counter starts with when it
+                      rolls over.
+  @param  EndValue    The value that the performance counter ends with before
+                      it rolls over.
+
+  @return The frequency in Hz.
+
+**/
+UINT64
+EFIAPI
+GetPerformanceCounterProperties (
+  OUT      UINT64  *StartValue   OPTIONAL,
+  OUT      UINT64  *EndValue     OPTIONAL
+  )
+{
+  UINT64  Frequency;
+
+  if (StartValue != NULL) {
+    *StartValue = 0;
+  }
+
+  if (EndValue != NULL) {
+    *EndValue = MAX_UINT64;
+  }
+
+  Frequency = GetCycleFrequency ();
+  if (Frequency == 0) {
+    return InternalRiscVGetTimeBase ();
+  }
+
+  return Frequency;
+}
+
+/**
+  Converts elapsed ticks of performance counter to time in nanoseconds.
+
+  This function converts the elapsed ticks of running performance counter to
+  time value in unit of nanoseconds.
+
+  @param  Ticks     The number of elapsed ticks of running performance counter.
+
+  @return The elapsed time in nanoseconds.
+
+**/
+UINT64
+EFIAPI
+GetTimeInNanoSecond (
+  IN      UINT64  Ticks
+  )
+{
+  UINT64  Frequency;
+  UINT64  NanoSeconds;
+  UINT64  Remainder;
+
+  Frequency = GetPerformanceCounterProperties (NULL, NULL);
+
+  //
+  // A cycle frequency may not fit in 32 bits, but stays below 2^33, so
+  // (Remainder * 1,000,000,000) does not overflow 64-bit.
+  //
+  NanoSeconds  = MultU64x32 (DivU64x64Remainder (Ticks, Frequency, &Remainder), 1000000000u);
+  NanoSeconds += DivU64x64Remainder (MultU64x32 (Remainder, 1000000000u), Frequency, NULL);
+
+  return NanoSeconds;
+}
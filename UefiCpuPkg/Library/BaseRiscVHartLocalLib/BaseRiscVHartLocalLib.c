@@ -0,0 +1,233 @@
+/** @file
+  Library to find the data that belongs to the hart it runs on.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Base.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/RiscVHartLocalLib.h>
+
+UINTN
+InternalRiscVGetThreadPointer (
+  VOID
+  );
+
+VOID
+InternalRiscVSetThreadPointer (
+  IN UINTN  Value
+  );
+
+/**
+  Get the hart-local storage of the hart this runs on.
+
+  @return  The hart-local storage, or NULL if none is attached to the hart.
+
+**/
+RISCV_HART_LOCAL *
+EFIAPI
+RiscVHartLocalGet (
+  VOID
+  )
+{
+  RISCV_HART_LOCAL  *HartLocal;
+
+  HartLocal = (RISCV_HART_LOCAL *)InternalRiscVGetThreadPointer ();
+  ASSERT ((HartLocal == NULL) || (HartLocal->Signature == RISCV_HART_LOCAL_SIGNATURE));
+  return HartLocal;
+}
+
+/**
+  Initialize a block of hart-local storage, without attaching it.
+
+  @param[out]  HartLocal       The block.
+  @param[in]   HartId          The hart that the block belongs to.
+  @param[in]   ProcessorIndex  The index of the hart in the MP services protocol.
+
+**/
+VOID
+EFIAPI
+RiscVHartLocalInitialize (
+  OUT RISCV_HART_LOCAL  *HartLocal,
+  IN  UINTN             HartId,
+  IN  UINTN             ProcessorIndex
+  )
+{
+  ASSERT (HartLocal != NULL);
+
+  ZeroMem (HartLocal, OFFSET_OF (RISCV_HART_LOCAL, Scratch));
+  HartLocal->Signature      = RISCV_HART_LOCAL_SIGNATURE;
+  HartLocal->HartId         = HartId;
+  HartLocal->ProcessorIndex = ProcessorIndex;
+}
+
+/**
+  Attach a block of hart-local storage to the hart this runs on.
+
+  @param[in]  HartLocal  The block, initialized by RiscVHartLocalInitialize().
+
+**/
+VOID
+EFIAPI
+RiscVHartLocalAttach (
+  IN RISCV_HART_LOCAL  *HartLocal
+  )
+{
+  ASSERT ((HartLocal != NULL) && (HartLocal->Signature == RISCV_HART_LOCAL_SIGNATURE));
+  InternalRiscVSetThreadPointer ((UINTN)HartLocal);
+}
+
+/**
+  Push an entry onto a free list of the hart this runs on.
+
+  The first pointer of the entry links the list. Interrupts are masked for the
+  few instructions of the push, so handlers on the same hart may use the list.
+
+  @param[in]  Slot   The user of the list.
+  @param[in]  Entry  The entry.
+
+  @retval  TRUE   The entry was pushed.
+  @retval  FALSE  No hart-local storage is attached. The entry wasn't pushed.
+
+**/
+BOOLEAN
+EFIAPI
+RiscVHartLocalPush (
+  IN RISCV_HART_LOCAL_SLOT  Slot,
+  IN VOID                   *Entry
+  )
+{
+  RISCV_HART_LOCAL  *HartLocal;
+  BOOLEAN           InterruptState;
+
+  ASSERT (Slot < RiscVHartLocalSlotMax);
+  ASSERT (Entry != NULL);
+
+  HartLocal = RiscVHartLocalGet ();
+  if (HartLocal == NULL) {
+    return FALSE;
+  }
+
+  InterruptState            = SaveAndDisableInterrupts ();
+  *(VOID **)Entry           = HartLocal->FreeList[Slot];
+  HartLocal->FreeList[Slot] = Entry;
+  SetInterruptState (InterruptState);
+  return TRUE;
+}
+
+/**
+  Pop an entry from a free list of the hart this runs on.
+
+  @param[in]  Slot  The user of the list.
+
+  @return  The entry, or NULL if the list is empty or no hart-local storage is attached.
+
+**/
+VOID *
+EFIAPI
+RiscVHartLocalPop (
+  IN RISCV_HART_LOCAL_SLOT  Slot
+  )
+{
+  RISCV_HART_LOCAL  *HartLocal;
+  VOID              *Entry;
+  BOOLEAN           InterruptState;
+
+  ASSERT (Slot < RiscVHartLocalSlotMax);
+
+  HartLocal = RiscVHartLocalGet ();
+  if (HartLocal == NULL) {
+    return NULL;
+  }
+
+  InterruptState = SaveAndDisableInterrupts ();
+  Entry          = HartLocal->FreeList[Slot];
+  if (Entry != NULL) {
+    HartLocal->FreeList[Slot] = *(VOID **)Entry;
+  }
+
+  SetInterruptState (InterruptState);
+  return Entry;
+}
+
+/**
+  Allocate from the scratch arena of the hart this runs on.
+
+  The arena is a stack: memory is released by returning to a mark, which
+  releases everything allocated since. A handler that interrupts an allocation
+  releases its own memory before it returns, so the arena needs no masking.
+
+  @param[in]  Size  The size, rounded up to 8 bytes.
+
+  @return  The memory, 8-byte aligned, or NULL if the arena is exhausted or no
+           hart-local storage is attached.
+
+**/
+VOID *
+EFIAPI
+RiscVHartLocalScratchAllocate (
+  IN UINTN  Size
+  )
+{
+  RISCV_HART_LOCAL  *HartLocal;
+  UINT32            Used;
+
+  HartLocal = RiscVHartLocalGet ();
+  if ((HartLocal == NULL) || (Size > RISCV_HART_LOCAL_SCRATCH_SIZE)) {
+    return NULL;
+  }
+
+  Used = HartLocal->ScratchUsed;
+  Size = ALIGN_VALUE (Size, sizeof (UINT64));
+  if (Size > RISCV_HART_LOCAL_SCRATCH_SIZE - Used) {
+    return NULL;
+  }
+
+  HartLocal->ScratchUsed = Used + (UINT32)Size;
+  return (UINT8 *)HartLocal->Scratch + Used;
+}
+
+/**
+  Get a mark of the scratch arena, to release what is allocated after it.
+
+  @return  The mark.
+
+**/
+UINTN
+EFIAPI
+RiscVHartLocalScratchMark (
+  VOID
+  )
+{
+  RISCV_HART_LOCAL  *HartLocal;
+
+  HartLocal = RiscVHartLocalGet ();
+  return (HartLocal != NULL) ? HartLocal->ScratchUsed : 0;
+}
+
+/**
+  Release the scratch memory allocated since a mark.
+
+  @param[in]  Mark  The mark, from RiscVHartLocalScratchMark().
+
+**/
+VOID
+EFIAPI
+RiscVHartLocalScratchRelease (
+  IN UINTN  Mark
+  )
+{
+  RISCV_HART_LOCAL  *HartLocal;
+
+  HartLocal = RiscVHartLocalGet ();
+  if (HartLocal == NULL) {
+    return;
+  }
+
+  ASSERT (Mark <= HartLocal->ScratchUsed);
+  HartLocal->ScratchUsed = (UINT32)Mark;
+}
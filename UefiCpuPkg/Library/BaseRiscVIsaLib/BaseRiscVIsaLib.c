@@ -0,0 +1,401 @@
+/** @file
+  Library to discover the RISC-V ISA extensions that all harts implement.
+
+  The devicetree lists the extensions of each hart, and a feature may only be
+  used if every hart implements it, as any hart may run the code. The result
+  is reduced to the bits of PcdRiscVFeatureOverride, so that a platform can
+  still turn discovered extensions off.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiPei.h>
+#include <Guid/FdtHob.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/FdtLib.h>
+#include <Library/HobLib.h>
+#include <Library/PcdLib.h>
+#include <Library/RiscVIsaLib.h>
+
+//
+// Zkn is only reported with both of its AES halves, which are tracked apart until then.
+//
+#define ISA_ZKND  BIT62
+#define ISA_ZKNE  BIT63
+
+typedef struct {
+  CONST CHAR8    *Name;
+  UINT64         Features;
+} ISA_EXTENSION;
+
+STATIC CONST ISA_EXTENSION  mIsaExtensions[] = {
+  { "zicbom",  RISCV_ISA_FEATURE_ZICBOM  },
+  { "sstc",    RISCV_ISA_FEATURE_SSTC    },
+  { "svpbmt",  RISCV_ISA_FEATURE_SVPBMT  },
+  { "zkr",     RISCV_ISA_FEATURE_ZKR     },
+  { "svnapot", RISCV_ISA_FEATURE_SVNAPOT },
+  { "zicboz",  RISCV_ISA_FEATURE_ZICBOZ  },
+  { "v",       RISCV_ISA_FEATURE_V       },
+  { "zbc",     RISCV_ISA_FEATURE_ZBC     },
+  { "zvkb",    RISCV_ISA_FEATURE_ZVKB    },
+  { "zvknha",  RISCV_ISA_FEATURE_ZVKNHA  },
+  { "zvknhb",  RISCV_ISA_FEATURE_ZVKNHB  },
+  { "zbb",     RISCV_ISA_FEATURE_ZBB     },
+  { "zknd",    ISA_ZKND                  },
+  { "zkne",    ISA_ZKNE                  },
+  { "zkn",     ISA_ZKND | ISA_ZKNE       },
+  { "zk",      ISA_ZKND | ISA_ZKNE       },
+  { "zawrs",   RISCV_ISA_FEATURE_ZAWRS   },
+};
+
+/**
+  Look up the features of an extension.
+
+  @param[in]  Name    The name of the extension, in lower case.
+  @param[in]  Length  The length of the name.
+
+  @return  The features, or 0 if the extension is of no interest.
+
+**/
+STATIC
+UINT64
+GetExtensionFeatures (
+  IN CONST CHAR8  *Name,
+  IN UINTN        Length
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < ARRAY_SIZE (mIsaExtensions); Index++) {
+    if ((AsciiStrLen (mIsaExtensions[Index].Name) == Length) &&
+        (CompareMem (mIsaExtensions[Index].Name, Name, Length) == 0))
+    {
+      return mIsaExtensions[Index].Features;
+    }
+  }
+
+  return 0;
+}
+
+/**
+  Read the features of a hart from its riscv,isa-extensions string list.
+
+  @param[in]  Extensions  The string list.
+  @param[in]  Length      The length of the property.
+
+  @return  The features.
+
+**/
+STATIC
+UINT64
+ParseIsaExtensions (
+  IN CONST CHAR8  *Extensions,
+  IN UINTN        Length
+  )
+{
+  UINT64  Features;
+  UINTN   Offset;
+  UINTN   NameLength;
+
+  Features = 0;
+  for (Offset = 0; Offset < Length; Offset += NameLength + 1) {
+    NameLength = AsciiStrnLenS (&Extensions[Offset], Length - Offset);
+    Features  |= GetExtensionFeatures (&Extensions[Offset], NameLength);
+  }
+
+  return Features;
+}
+
+/**
+  Read the features of a hart from its riscv,isa string, such as "rv64imafdcv_zicbom_sstc".
+
+  The single-letter extensions follow the base, and the multi-letter ones are
+  separated by underscores.
+
+  @param[in]  Isa     The string.
+  @param[in]  Length  The length of the property.
+
+  @return  The features.
+
+**/
+STATIC
+UINT64
+ParseIsaString (
+  IN CONST CHAR8  *Isa,
+  IN UINTN        Length
+  )
+{
+  UINT64  Features;
+  UINTN   Index;
+  UINTN   Start;
+
+  Length = AsciiStrnLenS (Isa, Length);
+  if ((Length < 4) || (AsciiStrnCmp (Isa, "rv", 2) != 0)) {
+    return 0;
+  }
+
+  Features = 0;
+  for (Index = 4; (Index < Length) && (Isa[Index] != '_'); Index++) {
+    if ((Isa[Index] == 'z') || (Isa[Index] == 's') || (Isa[Index] == 'x')) {
+      break;
+    }
+
+    Features |= GetExtensionFeatures (&Isa[Index], 1);
+  }
+
+  while (Index < Length) {
+    if (Isa[Index] == '_') {
+      Index++;
+      continue;
+    }
+
+    for (Start = Index; (Index < Length) && (Isa[Index] != '_'); Index++) {
+    }
+
+    Features |= GetExtensionFeatures (&Isa[Start], Index - Start);
+  }
+
+  return Features;
+}
+
+/**
+  Merge the block size of a hart into the common one.
+
+  @param[in]      Fdt        The devicetree.
+  @param[in]      Node       The CPU node of the hart.
+  @param[in]      Property   The name of the block-size property.
+  @param[in, out] BlockSize  The common block size, or 0 before the first hart.
+
+  @retval  TRUE   The hart has a valid block size, which is the common one.
+  @retval  FALSE  The block size is missing, invalid, or differs from another hart's.
+
+**/
+STATIC
+BOOLEAN
+MergeBlockSize (
+  IN     CONST VOID   *Fdt,
+  IN     INT32        Node,
+  IN     CONST CHAR8  *Property,
+  IN OUT UINT32       *BlockSize
+  )
+{
+  CONST UINT32  *Data32;
+  INT32         Length;
+  UINT32        Size;
+
+  Data32 = FdtGetProp (Fdt, Node, Property, &Length);
+  if ((Data32 == NULL) || (Length != sizeof (UINT32))) {
+    return FALSE;
+  }
+
+  Size = Fdt32ToCpu (ReadUnaligned32 (Data32));
+  if ((Size == 0) || ((Size & (Size - 1)) != 0) || (Size > SIZE_4KB) ||
+      ((*BlockSize != 0) && (*BlockSize != Size)))
+  {
+    return FALSE;
+  }
+
+  *BlockSize = Size;
+  return TRUE;
+}
+
+/**
+  Discover the ISA extensions that every hart of a devicetree implements.
+
+  Each CPU node is read from riscv,isa-extensions, or from riscv,isa if it has
+  none. Zicbom and Zicboz are only reported if every hart has the same valid
+  block size for them.
+
+  @param[in]   Fdt   The devicetree.
+  @param[out]  Info  The extensions.
+
+  @retval  EFI_SUCCESS            The extensions were discovered.
+  @retval  EFI_INVALID_PARAMETER  Fdt or Info is NULL.
+  @retval  EFI_NOT_FOUND          The devicetree has no CPU nodes.
+
+**/
+EFI_STATUS
+EFIAPI
+RiscVIsaParseFdt (
+  IN  CONST VOID      *Fdt,
+  OUT RISCV_ISA_INFO  *Info
+  )
+{
+  INT32        Node;
+  INT32        Length;
+  CONST CHAR8  *Property;
+  UINT64       Features;
+  UINT64       HartFeatures;
+  UINT32       CbomBlockSize;
+  UINT32       CbozBlockSize;
+  BOOLEAN      Found;
+
+  if ((Fdt == NULL) || (Info == NULL)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Features      = MAX_UINT64;
+  CbomBlockSize = 0;
+  CbozBlockSize = 0;
+  Found         = FALSE;
+  for (Node = FdtNodeOffsetByPropValue (Fdt, -1, "device_type", "cpu", sizeof ("cpu"))
+       ; Node >= 0
+       ; Node = FdtNodeOffsetByPropValue (Fdt, Node, "device_type", "cpu", sizeof ("cpu"))
+       ) {
+    Property = FdtGetProp (Fdt, Node, "riscv,isa-extensions", &Length);
+    if (Property != NULL) {
+      HartFeatures = ParseIsaExtensions (Property, Length);
+    } else {
+      Property     = FdtGetProp (Fdt, Node, "riscv,isa", &Length);
+      HartFeatures = (Property != NULL) ? ParseIsaString (Property, Length) : 0;
+    }
+
+    if (((HartFeatures & RISCV_ISA_FEATURE_ZICBOM) != 0) &&
+        !MergeBlockSize (Fdt, Node, "riscv,cbom-block-size", &CbomBlockSize))
+    {
+      HartFeatures &= ~(UINT64)RISCV_ISA_FEATURE_ZICBOM;
+    }
+
+    if (((HartFeatures & RISCV_ISA_FEATURE_ZICBOZ) != 0) &&
+        !MergeBlockSize (Fdt, Node, "riscv,cboz-block-size", &CbozBlockSize))
+    {
+      HartFeatures &= ~(UINT64)RISCV_ISA_FEATURE_ZICBOZ;
+    }
+
+    if ((HartFeatures & (ISA_ZKND | ISA_ZKNE)) == (ISA_ZKND | ISA_ZKNE)) {
+      HartFeatures |= RISCV_ISA_FEATURE_ZKN;
+    }
+
+    Features &= HartFeatures;
+    Found     = TRUE;
+  }
+
+  if (!Found) {
+    return EFI_NOT_FOUND;
+  }
+
+  Info->Signature     = RISCV_ISA_INFO_SIGNATURE;
+  Info->Revision      = RISCV_ISA_INFO_REVISION;
+  Info->Features      = Features & ~(UINT64)(ISA_ZKND | ISA_ZKNE);
+  Info->CbomBlockSize = ((Features & RISCV_ISA_FEATURE_ZICBOM) != 0) ? CbomBlockSize : 0;
+  Info->CbozBlockSize = ((Features & RISCV_ISA_FEATURE_ZICBOZ) != 0) ? CbozBlockSize : 0;
+
+  DEBUG ((
+    DEBUG_INFO,
+    "%a: Features 0x%lx, Zicbom block 0x%x, Zicboz block 0x%x\n",
+    __func__,
+    Info->Features,
+    Info->CbomBlockSize,
+    Info->CbozBlockSize
+    ));
+  return EFI_SUCCESS;
+}
+
+/**
+  Find the ISA extensions that all harts implement, in the RISC-V ISA HOB or in the devicetree.
+
+  @param[out]  Info  The extensions.
+
+  @retval  TRUE   The extensions were found.
+  @retval  FALSE  There is neither a RISC-V ISA HOB nor a devicetree.
+
+**/
+STATIC
+BOOLEAN
+GetIsaInfo (
+  OUT RISCV_ISA_INFO  *Info
+  )
+{
+  VOID  *Hob;
+  VOID  *Fdt;
+
+  Hob = GetFirstGuidHob (&gRiscVIsaInfoHobGuid);
+  if ((Hob != NULL) && (GET_GUID_HOB_DATA_SIZE (Hob) >= sizeof (RISCV_ISA_INFO))) {
+    CopyMem (Info, GET_GUID_HOB_DATA (Hob), sizeof (RISCV_ISA_INFO));
+    if ((Info->Signature == RISCV_ISA_INFO_SIGNATURE) && (Info->Revision == RISCV_ISA_INFO_REVISION)) {
+      return TRUE;
+    }
+  }
+
+  Hob = GetFirstGuidHob (&gFdtHobGuid);
+  if (Hob == NULL) {
+    return FALSE;
+  }
+
+  Fdt = (VOID *)(UINTN)*(UINT64 *)GET_GUID_HOB_DATA (Hob);
+  if ((Fdt == NULL) || (FdtCheckHeader (Fdt) != 0)) {
+    return FALSE;
+  }
+
+  return !EFI_ERROR (RiscVIsaParseFdt (Fdt, Info));
+}
+
+/**
+  Get the ISA extensions that every hart implements, and PcdRiscVFeatureOverride leaves enabled.
+
+  The extensions are taken from the RISC-V ISA HOB, or else discovered from the
+  devicetree in the FDT HOB. Without either, none are reported.
+
+  @return  The RISCV_ISA_FEATURE_* bits.
+
+**/
+UINT64
+EFIAPI
+RiscVIsaGetFeatures (
+  VOID
+  )
+{
+  RISCV_ISA_INFO  Info;
+
+  if (!GetIsaInfo (&Info)) {
+    return 0;
+  }
+
+  return Info.Features & PcdGet64 (PcdRiscVFeatureOverride);
+}
+
+/**
+  Get the block size of the Zicbom cache-block management operations.
+
+  @return  The block size, or 0 if Zicbom may not be used.
+
+**/
+UINT32
+EFIAPI
+RiscVIsaGetCbomBlockSize (
+  VOID
+  )
+{
+  RISCV_ISA_INFO  Info;
+
+  if (!GetIsaInfo (&Info) || ((Info.Features & PcdGet64 (PcdRiscVFeatureOverride) & RISCV_ISA_FEATURE_ZICBOM) == 0)) {
+    return 0;
+  }
+
+  return Info.CbomBlockSize;
+}
+
+/**
+  Get the block size of the Zicboz cbo.zero operation.
+
+  @return  The block size, or 0 if Zicboz may not be used.
+
+**/
+UINT32
+EFIAPI
+RiscVIsaGetCbozBlockSize (
+  VOID
+  )
+{
+  RISCV_ISA_INFO  Info;
+
+  if (!GetIsaInfo (&Info) || ((Info.Features & PcdGet64 (PcdRiscVFeatureOverride) & RISCV_ISA_FEATURE_ZICBOZ) == 0)) {
+    return 0;
+  }
+
+  return Info.CbozBlockSize;
+}
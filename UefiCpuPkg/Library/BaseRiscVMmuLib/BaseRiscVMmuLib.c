@@ -15,13 +15,35 @@
 #include <Library/BaseLib.h>
 #include <Library/BaseMemoryLib.h>
 #include <Library/BaseRiscVMmuLib.h>
+#include <Library/BaseRiscVSbiLib.h>
 #include <Library/CacheMaintenanceLib.h>
 #include <Library/DebugLib.h>
 #include <Library/DxeServicesTableLib.h>
+#include <Library/HobLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/MemoryAllocationLib.h>
 #include <Library/PcdLib.h>
+#include <Library/RiscVPageTableLib.h>
+#include <Library/RiscVPmuProfileLib.h>
 #include <Register/RiscV64/RiscVEncoding.h>
+#include <Guid/RiscVMmuHandOff.h>
+
+#if !defined (MDE_CPU_RISCV64)
+
+//
+// BaseLib only declares the hart routines for RISC-V. Host-based tests provide them.
+//
+VOID
+RiscVSetSupervisorAddressTranslationRegister (
+  IN UINT64
+  );
+
+UINT64
+RiscVGetSupervisorAddressTranslationRegister (
+  VOID
+  );
+
+#endif
 
 #define RISCV_PG_V           BIT0
 #define RISCV_PG_R           BIT1
@@ -41,11 +63,190 @@
 #define PTE_PBMT_IO                     BIT62
 #define PTE_PBMT_MASK                   (PTE_PBMT_NC | PTE_PBMT_IO)
 
+#define RISCV_CPU_FEATURE_SVNAPOT_BITMASK  BIT4
+#define PTE_N                              BIT63
+#define RISCV_MMU_NAPOT_64K_ENTRIES        16
+
+//
+// The number of live entries an update may replace before their translations are
+// flushed all at once, rather than with an sfence.vma at each entry's address.
+//
+#define RISCV_MMU_MAX_FLUSH_ENTRIES  32
+
+//
+// The number of tables an update may fold back into block entries. Tables beyond
+// that are left in place, to be folded by a later update.
+//
+#define RISCV_MMU_MAX_FREE_TABLES  64
+
+//
+// The live entries that an update replaced, whose translations are flushed once it
+// completes, and the tables it folded into block entries, which are freed after that.
+// Granted is set when an entry gave access that its old translation didn't.
+//
+typedef struct {
+  UINTN      NumberOfEntries;
+  UINT64     Addresses[RISCV_MMU_MAX_FLUSH_ENTRIES];
+  BOOLEAN    FlushAll;
+  BOOLEAN    Granted;
+  UINTN      NumberOfFreeTables;
+  UINT64     *FreeTables[RISCV_MMU_MAX_FREE_TABLES];
+} RISCV_MMU_FLUSH_CONTEXT;
+
+//
+// The deepest hierarchy of tables, with Sv57.
+//
+#define RISCV_MMU_MAX_LEVELS  5
+
+//
+// Page table pages are taken from a pool, refilled this many pages at a time
+// before an update that might run short, and freed pages are kept in it up to
+// a limit.
+//
+#define RISCV_MMU_POOL_REFILL_PAGES  64
+#define RISCV_MMU_POOL_MAX_PAGES     128
+
 STATIC UINTN  mModeSupport[] = { SATP_MODE_SV57, SATP_MODE_SV48, SATP_MODE_SV39, SATP_MODE_OFF };
+
+//
+// The format of the entries, for the shared walkers.
+//
+STATIC CONST RISCV_PTE_POLICY  mCpuPtePolicy = {
+  RISCV_PG_V,
+  RISCV_PG_R | RISCV_PG_W | RISCV_PG_X,
+  PTE_PPN_MASK,
+  PTE_PPN_SHIFT
+};
 STATIC UINTN  mMaxRootTableLevel;
 STATIC UINTN  mBitPerLevel;
 STATIC UINTN  mTableEntryCount;
 
+//
+// The free pages of the pool, linked through their first word.
+//
+STATIC VOID     *mTablePool;
+STATIC UINTN    mTablePoolPages;
+STATIC BOOLEAN  mTablePoolRefilling;
+
+//
+// The other harts that may run with these page tables, set by
+// RiscVMmuSetRemoteHarts ().
+//
+STATIC BOOLEAN  mRemoteFlush;
+STATIC UINTN    mRemoteHartMask;
+STATIC UINTN    mRemoteHartMaskBase;
+
+//
+// Flushes the other harts in place of the SBI remote sfence.vma, if set by
+// RiscVMmuSetRemoteFlush ().
+//
+STATIC RISCV_MMU_REMOTE_FLUSH  mRemoteFlushFunction;
+
+//
+// The counters reported by RiscVMmuGetStatistics (). The rest is counted when
+// it is reported.
+//
+STATIC RISCV_MMU_STATISTICS  mStatistics;
+
+//
+// The transactions opened by RiscVMmuBeginTransaction () and not committed yet, and
+// the entries and tables of the updates made since the outermost was opened.
+//
+STATIC UINTN                    mTransactionDepth;
+STATIC RISCV_MMU_FLUSH_CONTEXT  mTransactionFlush;
+
+/**
+  Return a page table page to the pool, or free it if the pool is full.
+
+  @param  Page  The page.
+
+**/
+STATIC
+VOID
+FreeTablePage (
+  IN  VOID  *Page
+  )
+{
+  mStatistics.TablesFreed++;
+  if (mTablePoolPages >= RISCV_MMU_POOL_MAX_PAGES) {
+    FreePages (Page, 1);
+    return;
+  }
+
+  *(VOID **)Page = mTablePool;
+  mTablePool     = Page;
+  mTablePoolPages++;
+}
+
+/**
+  Take a page table page from the pool, or allocate one if the pool is empty.
+  The page isn't zeroed.
+
+  @return The page, or NULL if none could be allocated.
+
+**/
+STATIC
+VOID *
+AllocateTablePage (
+  VOID
+  )
+{
+  VOID  *Page;
+
+  if (mTablePool == NULL) {
+    Page = AllocatePages (1);
+    if (Page != NULL) {
+      mStatistics.TablesAllocated++;
+    }
+
+    return Page;
+  }
+
+  mStatistics.TablesAllocated++;
+  Page       = mTablePool;
+  mTablePool = *(VOID **)Page;
+  mTablePoolPages--;
+
+  return Page;
+}
+
+/**
+  Refill the pool in bulk if it holds fewer pages than an update might need.
+
+  The allocation may itself update memory attributes, whose nested update then
+  takes pages from what is left of the pool, without refilling it again.
+
+  @param  MinimumPages  The pages the update might need.
+
+**/
+STATIC
+VOID
+RefillTablePool (
+  IN  UINTN  MinimumPages
+  )
+{
+  UINT8  *Pages;
+  UINTN  Index;
+
+  if ((mTablePoolPages >= MinimumPages) || mTablePoolRefilling) {
+    return;
+  }
+
+  mTablePoolRefilling = TRUE;
+  Pages               = AllocatePages (RISCV_MMU_POOL_REFILL_PAGES);
+  mTablePoolRefilling = FALSE;
+  if (Pages == NULL) {
+    return;
+  }
+
+  for (Index = 0; Index < RISCV_MMU_POOL_REFILL_PAGES; Index++) {
+    *(VOID **)(Pages + EFI_PAGES_TO_SIZE (Index)) = mTablePool;
+    mTablePool                                     = Pages + EFI_PAGES_TO_SIZE (Index);
+  }
+
+  mTablePoolPages += RISCV_MMU_POOL_REFILL_PAGES;
+}
+
 /**
   Determine if the MMU enabled or not.
 
@@ -182,28 +383,172 @@ SetTableEntry (
 /**
   Replace an existing entry with new value.
 
+  The translations of a live entry aren't flushed here, but once the whole
+  update is done, by FlushReplacedEntries ().
+
   @param  Entry               The entry pointer.
   @param  Value               The new entry value.
   @param  RegionStart         The start of region that new value affects.
   @param  IsLiveBlockMapping  TRUE if this is live update, FALSE otherwise.
+  @param  Flush               The entries replaced so far by the update.
 
 **/
 STATIC
 VOID
 ReplaceTableEntry (
-  IN  UINT64   *Entry,
-  IN  UINT64   Value,
-  IN  UINT64   RegionStart,
-  IN  BOOLEAN  IsLiveBlockMapping
+  IN      UINT64                   *Entry,
+  IN      UINT64                   Value,
+  IN      UINT64                   RegionStart,
+  IN      BOOLEAN                  IsLiveBlockMapping,
+  IN OUT  RISCV_MMU_FLUSH_CONTEXT  *Flush
   )
 {
+  //
+  // A stale translation of an entry that gave less access than the new one
+  // faults, so a transaction can't leave it for its commit. Splitting a block
+  // into a table, or folding a table back, gives the same access.
+  //
+  if (IsLiveBlockMapping && !IsTableEntry (*Entry) && !IsTableEntry (Value) &&
+      ((Value & ~*Entry & (RISCV_PG_V | RISCV_PG_R | RISCV_PG_W | RISCV_PG_X)) != 0))
+  {
+    Flush->Granted = TRUE;
+  }
+
   *Entry = Value;
 
-  if (IsLiveBlockMapping && RiscVMmuEnabled ()) {
-    RiscVLocalTlbFlush (RegionStart);
+  if (IsLiveBlockMapping) {
+    if (Flush->NumberOfEntries < RISCV_MMU_MAX_FLUSH_ENTRIES) {
+      Flush->Addresses[Flush->NumberOfEntries] = RegionStart;
+    }
+
+    Flush->NumberOfEntries++;
   }
 }
 
+/**
+  Flush the translations of a range on the other harts, with the function set
+  by RiscVMmuSetRemoteFlush (), or else on the harts set by
+  RiscVMmuSetRemoteHarts (), with one SBI remote sfence.vma.
+
+  @param  StartAddress  The start of the range.
+  @param  Size          The size of the range, or 0 with a StartAddress of 0
+                        for all addresses.
+
+**/
+STATIC
+VOID
+FlushRemoteHarts (
+  IN  UINT64  StartAddress,
+  IN  UINT64  Size
+  )
+{
+  EFI_STATUS  Status;
+
+  if (mRemoteFlushFunction != NULL) {
+    mStatistics.RemoteFlushes++;
+    mRemoteFlushFunction (StartAddress, Size);
+    return;
+  }
+
+  if (!mRemoteFlush) {
+    return;
+  }
+
+  mStatistics.RemoteFlushes++;
+  Status = SbiRemoteSfenceVma (mRemoteHartMask, mRemoteHartMaskBase, StartAddress, Size);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "%a: remote sfence.vma failed: %r\n", __func__, Status));
+    ASSERT_EFI_ERROR (Status);
+  }
+}
+
+/**
+  Flush the translations of the live entries that an update replaced: with
+  an sfence.vma at each entry's address when there are few, otherwise with
+  one sfence.vma for all addresses.
+
+  Folding a live table into a block entry always takes the latter, as an
+  sfence.vma at an address isn't required to drop the cached non-leaf
+  entries that still point to the table.
+
+  The other harts that may use the page tables get a single remote
+  sfence.vma for the whole update, over the range spanning the entries.
+
+  @param  Flush  The entries replaced by the update.
+
+**/
+STATIC
+VOID
+FlushReplacedEntries (
+  IN  RISCV_MMU_FLUSH_CONTEXT  *Flush
+  )
+{
+  UINTN   Index;
+  UINT64  Start;
+  UINT64  End;
+
+  if ((Flush->NumberOfEntries == 0) || !RiscVMmuEnabled ()) {
+    return;
+  }
+
+  if (Flush->FlushAll || (Flush->NumberOfEntries > RISCV_MMU_MAX_FLUSH_ENTRIES)) {
+    mStatistics.LocalFlushAlls++;
+    RiscVLocalTlbFlushAll ();
+    FlushRemoteHarts (0, 0);
+    return;
+  }
+
+  Start = MAX_UINT64;
+  End   = 0;
+  mStatistics.LocalFlushes += Flush->NumberOfEntries;
+  for (Index = 0; Index < Flush->NumberOfEntries; Index++) {
+    RiscVLocalTlbFlush (Flush->Addresses[Index]);
+    Start = MIN (Start, Flush->Addresses[Index]);
+    End   = MAX (End, Flush->Addresses[Index] + EFI_PAGE_SIZE);
+  }
+
+  FlushRemoteHarts (Start, End - Start);
+}
+
+/**
+  Free the tables that an update folded into block entries. This is done once
+  their translations are flushed, and the page table walk is over, as freeing
+  pages past what the pool keeps may itself update the memory attributes.
+
+  @param  Flush  The tables folded by the update.
+
+**/
+STATIC
+VOID
+FreeMergedTables (
+  IN  RISCV_MMU_FLUSH_CONTEXT  *Flush
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < Flush->NumberOfFreeTables; Index++) {
+    FreeTablePage (Flush->FreeTables[Index]);
+  }
+}
+
+/**
+  Empty a flush context, for the updates that follow.
+
+  @param  Flush  The flush context.
+
+**/
+STATIC
+VOID
+ResetFlushContext (
+  OUT RISCV_MMU_FLUSH_CONTEXT  *Flush
+  )
+{
+  Flush->NumberOfEntries    = 0;
+  Flush->FlushAll           = FALSE;
+  Flush->Granted            = FALSE;
+  Flush->NumberOfFreeTables = 0;
+}
+
 /**
   Get an ppn value from an entry.
 
@@ -246,7 +591,37 @@ SetPpnToPte (
 }
 
 /**
-  Free resources of translation table recursively.
+  Convert a NAPOT page entry to the page entry mapping the same page alone.
+
+  @param  Entry   The entry value.
+  @param  Address The address the entry maps.
+
+  @return The page entry, or Entry if it isn't a NAPOT entry.
+
+**/
+STATIC
+UINT64
+GetPageEntryFromNapot (
+  IN  UINT64  Entry,
+  IN  UINT64  Address
+  )
+{
+  UINT64  GroupAddress;
+
+  if (!IsValidPte (Entry) || ((Entry & PTE_N) == 0)) {
+    return Entry;
+  }
+
+  GroupAddress = (GetPpnfromPte (Entry) << RISCV_MMU_PAGE_SHIFT) & ~(UINT64)(SIZE_64KB - 1);
+  return SetPpnToPte (
+           Entry & ~PTE_N,
+           GroupAddress | (Address & (SIZE_64KB - 1) & ~(UINT64)EFI_PAGE_MASK)
+           );
+}
+
+/**
+  Free resources of translation table and of the tables below it, walking
+  them depth first with an explicit stack.
 
   @param  TranslationTable  The pointer of table.
   @param  Level             The current level.
@@ -254,31 +629,261 @@ SetPpnToPte (
 **/
 STATIC
 VOID
-FreePageTablesRecursive (
+FreePageTables (
   IN  UINT64  *TranslationTable,
   IN  UINTN   Level
   )
 {
-  UINTN  Index;
+  UINT64  *Tables[RISCV_MMU_MAX_LEVELS];
+  UINTN   Indices[RISCV_MMU_MAX_LEVELS];
+  UINT64  *Table;
+  UINTN   Depth;
+
+  ASSERT (mMaxRootTableLevel <= RISCV_MMU_MAX_LEVELS);
+
+  Depth      = 0;
+  Tables[0]  = TranslationTable;
+  Indices[0] = 0;
+  while (TRUE) {
+    Table = Tables[Depth];
+    if (Level + Depth < mMaxRootTableLevel - 1) {
+      while ((Indices[Depth] < mTableEntryCount) && !IsTableEntry (Table[Indices[Depth]])) {
+        Indices[Depth]++;
+      }
 
-  if (Level < mMaxRootTableLevel - 1) {
-    for (Index = 0; Index < mTableEntryCount; Index++) {
-      if (IsTableEntry (TranslationTable[Index])) {
-        FreePageTablesRecursive (
-          (UINT64 *)(GetPpnfromPte ((TranslationTable[Index])) <<
-                     RISCV_MMU_PAGE_SHIFT),
-          Level + 1
-          );
+      if (Indices[Depth] < mTableEntryCount) {
+        Tables[Depth + 1] = (UINT64 *)(GetPpnfromPte (Table[Indices[Depth]]) <<
+                                       RISCV_MMU_PAGE_SHIFT);
+        Indices[Depth]++;
+        Depth++;
+        Indices[Depth] = 0;
+        continue;
       }
     }
+
+    FreeTablePage (Table);
+    if (Depth == 0) {
+      break;
+    }
+
+    Depth--;
+  }
+}
+
+/**
+  Compute the value of a block entry with attributes updated.
+
+  @param  Entry                 The current entry value.
+  @param  Address               The address the block entry maps.
+  @param  AttributeSetMask      The attribute mask to be set.
+  @param  AttributeClearMask    The attribute mask to be clear.
+
+  @return The new entry value, or 0 if it is left without permissions.
+
+**/
+STATIC
+UINT64
+GetBlockEntryValue (
+  IN  UINT64  Entry,
+  IN  UINT64  Address,
+  IN  UINT64  AttributeSetMask,
+  IN  UINT64  AttributeClearMask
+  )
+{
+  UINT64  EntryValue;
+
+  EntryValue = (Entry & ~AttributeClearMask) | AttributeSetMask;
+  if ((EntryValue & (RISCV_PG_R | RISCV_PG_W | RISCV_PG_X)) == 0) {
+    //
+    // An entry without permissions would be a table entry: the region is unmapped.
+    //
+    return 0;
+  }
+
+  //
+  // We don't have page fault exception handler when a virtual page is accessed and
+  // the A bit is clear, or is written and the D bit is clear.
+  // So just set A for read and D for write permission.
+  //
+  if ((AttributeSetMask & RISCV_PG_R) != 0) {
+    EntryValue |= RISCV_PG_A;
+  }
+
+  if ((AttributeSetMask & RISCV_PG_W) != 0) {
+    EntryValue |= RISCV_PG_D;
+  }
+
+  EntryValue = SetPpnToPte (EntryValue, Address);
+  return SetValidPte (EntryValue);
+}
+
+/**
+  Determine if a table can be folded into a single block entry: all of its
+  entries are block entries with the same attributes, mapping a contiguous
+  region aligned to the size of the block that replaces the table.
+
+  @param  TranslationTable  The pointer of table.
+  @param  Level             The level of the table.
+  @param  BlockEntry        The block entry to replace the table with.
+
+  @retval TRUE    The table can be folded into BlockEntry.
+  @retval FALSE   The table can't be folded.
+
+**/
+STATIC
+BOOLEAN
+GetMergedBlockEntry (
+  IN  UINT64  *TranslationTable,
+  IN  UINTN   Level,
+  OUT UINT64  *BlockEntry
+  )
+{
+  UINT64  BlockShift;
+  UINT64  FirstEntry;
+  UINT64  Address;
+  UINTN   Index;
+
+  if (!IsBlockEntry (TranslationTable[0])) {
+    return FALSE;
+  }
+
+  //
+  // NAPOT entries only exist at the last level, where BlockShift is the page
+  // shift, and are compared as the page entries they stand for.
+  //
+  BlockShift = (mMaxRootTableLevel - Level - 1) * mBitPerLevel + RISCV_MMU_PAGE_SHIFT;
+  FirstEntry = GetPageEntryFromNapot (TranslationTable[0], 0);
+  Address    = GetPpnfromPte (FirstEntry) << RISCV_MMU_PAGE_SHIFT;
+  if ((Address & (LShiftU64 (mTableEntryCount, BlockShift) - 1)) != 0) {
+    return FALSE;
+  }
+
+  for (Index = 1; Index < mTableEntryCount; Index++) {
+    if (GetPageEntryFromNapot (TranslationTable[Index], LShiftU64 (Index, BlockShift)) !=
+        SetPpnToPte (FirstEntry, Address + LShiftU64 (Index, BlockShift)))
+    {
+      return FALSE;
+    }
+  }
+
+  *BlockEntry = FirstEntry;
+  return TRUE;
+}
+
+/**
+  Update the page entries of a region within a 64 KiB group at the last level,
+  and fold the group into NAPOT entries if all 16 pages end up with the same
+  attributes.
+
+  @param  RegionStart           The start address of the region.
+  @param  RegionEnd             The end address of the region.
+  @param  AttributeSetMask      The attribute mask to be set.
+  @param  AttributeClearMask    The attribute mask to be clear.
+  @param  PageTable             The pointer of the last level page table.
+  @param  TableIsLive           TRUE if this is live update, FALSE otherwise.
+  @param  Flush                 The live entries replaced so far.
+
+  @return The end of the part of the region within the group.
+
+**/
+STATIC
+UINT64
+UpdateNapotGroup (
+  IN      UINT64                   RegionStart,
+  IN      UINT64                   RegionEnd,
+  IN      UINT64                   AttributeSetMask,
+  IN      UINT64                   AttributeClearMask,
+  IN      UINT64                   *PageTable,
+  IN      BOOLEAN                  TableIsLive,
+  IN OUT  RISCV_MMU_FLUSH_CONTEXT  *Flush
+  )
+{
+  UINT64   GroupStart;
+  UINT64   GroupEnd;
+  UINT64   *Group;
+  UINT64   Address;
+  UINT64   EntryValue;
+  BOOLEAN  WasNapot;
+  BOOLEAN  Replaced;
+  UINTN    Index;
+
+  GroupStart = RegionStart & ~(UINT64)(SIZE_64KB - 1);
+  GroupEnd   = MIN (RegionEnd, GroupStart + SIZE_64KB);
+  Group      = &PageTable[(GroupStart >> RISCV_MMU_PAGE_SHIFT) & (mTableEntryCount - 1)];
+
+  //
+  // Expand a NAPOT group into the page entries it stands for. They map the
+  // same pages with the same attributes, so this doesn't need a flush.
+  //
+  WasNapot = IsValidPte (Group[0]) && ((Group[0] & PTE_N) != 0);
+  if (WasNapot) {
+    for (Index = 0; Index < RISCV_MMU_NAPOT_64K_ENTRIES; Index++) {
+      Group[Index] = GetPageEntryFromNapot (Group[Index], Index << RISCV_MMU_PAGE_SHIFT);
+    }
+  }
+
+  Replaced = FALSE;
+  for (Address = RegionStart; Address < GroupEnd; Address += EFI_PAGE_SIZE) {
+    Index      = (UINTN)((Address - GroupStart) >> RISCV_MMU_PAGE_SHIFT);
+    EntryValue = GetBlockEntryValue (
+                   Group[Index],
+                   Address,
+                   AttributeSetMask,
+                   AttributeClearMask
+                   );
+    if (EntryValue == Group[Index]) {
+      continue;
+    }
+
+    //
+    // The pages of a NAPOT group share one translation, which a single
+    // sfence.vma at any of their addresses flushes.
+    //
+    ReplaceTableEntry (
+      &Group[Index],
+      EntryValue,
+      Address,
+      TableIsLive && !(WasNapot && Replaced),
+      Flush
+      );
+    Replaced = TRUE;
+  }
+
+  if (!IsBlockEntry (Group[0])) {
+    return GroupEnd;
+  }
+
+  Address = GetPpnfromPte (Group[0]) << RISCV_MMU_PAGE_SHIFT;
+  if ((Address & (SIZE_64KB - 1)) != 0) {
+    return GroupEnd;
+  }
+
+  for (Index = 1; Index < RISCV_MMU_NAPOT_64K_ENTRIES; Index++) {
+    if (Group[Index] != SetPpnToPte (Group[0], Address + (Index << RISCV_MMU_PAGE_SHIFT))) {
+      return GroupEnd;
+    }
+  }
+
+  //
+  // A NAPOT entry encodes the 64 KiB size as 0b1000 in PPN[3:0]. This maps the
+  // same pages with the same attributes, so doesn't need a flush either.
+  //
+  EntryValue = SetPpnToPte (Group[0], Address | SIZE_32KB) | PTE_N;
+  for (Index = 0; Index < RISCV_MMU_NAPOT_64K_ENTRIES; Index++) {
+    Group[Index] = EntryValue;
   }
 
-  FreePages (TranslationTable, 1);
+  return GroupEnd;
 }
 
 /**
   Update region mapping recursively.
 
+  Block entries and page entries that already have the requested attributes
+  are left untouched, rather than rewritten or split. Tables left with uniform
+  entries by the update are folded back into block entries. With Svnapot, page
+  entries are kept as NAPOT entries for each 64 KiB group they fully cover.
+
   @param  RegionStart           The start address of the region.
   @param  RegionEnd             The end address of the region.
   @param  AttributeSetMask      The attribute mask to be set.
@@ -286,6 +891,8 @@ FreePageTablesRecursive (
   @param  PageTable             The pointer of current page table.
   @param  Level                 The current level.
   @param  TableIsLive           TRUE if this is live update, FALSE otherwise.
+  @param  Flush                 The live entries replaced, and the tables
+                                folded, so far.
 
   @retval EFI_OUT_OF_RESOURCES  Not enough resource.
   @retval EFI_SUCCESS           The operation succesfully.
@@ -294,13 +901,14 @@ FreePageTablesRecursive (
 STATIC
 EFI_STATUS
 UpdateRegionMappingRecursive (
-  IN  UINT64   RegionStart,
-  IN  UINT64   RegionEnd,
-  IN  UINT64   AttributeSetMask,
-  IN  UINT64   AttributeClearMask,
-  IN  UINT64   *PageTable,
-  IN  UINTN    Level,
-  IN  BOOLEAN  TableIsLive
+  IN      UINT64                   RegionStart,
+  IN      UINT64                   RegionEnd,
+  IN      UINT64                   AttributeSetMask,
+  IN      UINT64                   AttributeClearMask,
+  IN      UINT64                   *PageTable,
+  IN      UINTN                    Level,
+  IN      BOOLEAN                  TableIsLive,
+  IN OUT  RISCV_MMU_FLUSH_CONTEXT  *Flush
   )
 {
   EFI_STATUS  Status;
@@ -330,9 +938,31 @@ UpdateRegionMappingRecursive (
     ));
 
   for ( ; RegionStart < RegionEnd; RegionStart = BlockEnd) {
+    if ((Level == mMaxRootTableLevel - 1) &&
+        ((PcdGet64 (PcdRiscVFeatureOverride) & RISCV_CPU_FEATURE_SVNAPOT_BITMASK) != 0))
+    {
+      BlockEnd = UpdateNapotGroup (
+                   RegionStart,
+                   RegionEnd,
+                   AttributeSetMask,
+                   AttributeClearMask,
+                   PageTable,
+                   TableIsLive,
+                   Flush
+                   );
+      continue;
+    }
+
     BlockEnd = MIN (RegionEnd, (RegionStart | BlockMask) + 1);
     Entry    = &PageTable[(RegionStart >> BlockShift) & (mTableEntryCount - 1)];
 
+    //
+    // Unmapping what isn't mapped needs no table.
+    //
+    if (!IsValidPte (*Entry) && ((AttributeSetMask & (RISCV_PG_R | RISCV_PG_W | RISCV_PG_X)) == 0)) {
+      continue;
+    }
+
     //
     // If RegionStart or BlockEnd is not aligned to the block size at this
     // level, we will have to create a table mapping in order to map less
@@ -344,12 +974,27 @@ UpdateRegionMappingRecursive (
         (((RegionStart | BlockEnd) & BlockMask) != 0) || IsTableEntry (*Entry))
     {
       ASSERT (Level < mMaxRootTableLevel - 1);
+      if (IsBlockEntry (*Entry) &&
+          (GetBlockEntryValue (
+             *Entry,
+             RegionStart & ~BlockMask,
+             AttributeSetMask,
+             AttributeClearMask
+             ) == *Entry))
+      {
+        //
+        // The block entry already has the attributes requested, so there is
+        // no need to split it.
+        //
+        continue;
+      }
+
       if (!IsTableEntry (*Entry)) {
         //
         // No table entry exists yet, so we need to allocate a page table
         // for the next level.
         //
-        TranslationTable = AllocatePages (1);
+        TranslationTable = AllocateTablePage ();
         if (TranslationTable == NULL) {
           return EFI_OUT_OF_RESOURCES;
         }
@@ -364,11 +1009,12 @@ UpdateRegionMappingRecursive (
           Status = UpdateRegionMappingRecursive (
                      RegionStart & ~BlockMask,
                      (RegionStart | BlockMask) + 1,
-                     *Entry & PTE_ATTRIBUTES_MASK,
-                     PTE_ATTRIBUTES_MASK,
+                     *Entry & (PTE_ATTRIBUTES_MASK | PTE_PBMT_MASK),
+                     PTE_ATTRIBUTES_MASK | PTE_PBMT_MASK,
                      TranslationTable,
                      Level + 1,
-                     FALSE
+                     FALSE,
+                     Flush
                      );
           if (EFI_ERROR (Status)) {
             //
@@ -376,9 +1022,11 @@ UpdateRegionMappingRecursive (
             // aligned, so it is guaranteed that no further pages were allocated
             // by it, and so we only have to free the page we allocated here.
             //
-            FreePages (TranslationTable, 1);
+            FreeTablePage (TranslationTable);
             return Status;
           }
+
+          mStatistics.Splits++;
         }
 
         NextTableIsLive = FALSE;
@@ -397,7 +1045,8 @@ UpdateRegionMappingRecursive (
                  AttributeClearMask,
                  TranslationTable,
                  Level + 1,
-                 NextTableIsLive
+                 NextTableIsLive,
+                 Flush
                  );
       if (EFI_ERROR (Status)) {
         if (!IsTableEntry (*Entry)) {
@@ -408,7 +1057,7 @@ UpdateRegionMappingRecursive (
           // possible for existing table entries, since we cannot revert the
           // modifications we made to the subhierarchy it represents.)
           //
-          FreePageTablesRecursive (TranslationTable, Level + 1);
+          FreePageTables (TranslationTable, Level + 1);
         }
 
         return Status;
@@ -421,27 +1070,39 @@ UpdateRegionMappingRecursive (
           Entry,
           EntryValue,
           RegionStart,
-          TableIsLive
+          TableIsLive,
+          Flush
           );
       }
-    } else {
-      EntryValue = (*Entry & ~AttributeClearMask) | AttributeSetMask;
+
       //
-      // We don't have page fault exception handler when a virtual page is accessed and
-      // the A bit is clear, or is written and the D bit is clear.
-      // So just set A for read and D for write permission.
+      // If the update left the entries of the table uniform, fold the table
+      // back into a block entry. The table is freed once the update is done.
       //
-      if ((AttributeSetMask & RISCV_PG_R) != 0) {
-        EntryValue |= RISCV_PG_A;
-      }
+      if ((Level > 0) &&
+          (Flush->NumberOfFreeTables < RISCV_MMU_MAX_FREE_TABLES) &&
+          GetMergedBlockEntry (TranslationTable, Level + 1, &EntryValue))
+      {
+        ReplaceTableEntry (Entry, EntryValue, RegionStart, TableIsLive, Flush);
+        if (TableIsLive) {
+          Flush->FlushAll = TRUE;
+        }
 
-      if ((AttributeSetMask & RISCV_PG_W) != 0) {
-        EntryValue |= RISCV_PG_D;
+        Flush->FreeTables[Flush->NumberOfFreeTables++] = TranslationTable;
+        mStatistics.Folds++;
+      }
+    } else {
+      EntryValue = GetBlockEntryValue (
+                     *Entry,
+                     RegionStart,
+                     AttributeSetMask,
+                     AttributeClearMask
+                     );
+      if (EntryValue == *Entry) {
+        continue;
       }
 
-      EntryValue = SetPpnToPte (EntryValue, RegionStart);
-      EntryValue = SetValidPte (EntryValue);
-      ReplaceTableEntry (Entry, EntryValue, RegionStart, TableIsLive);
+      ReplaceTableEntry (Entry, EntryValue, RegionStart, TableIsLive, Flush);
     }
   }
 
@@ -458,6 +1119,12 @@ UpdateRegionMappingRecursive (
   @param  RootTable             The pointer of root table.
   @param  TableIsLive           TRUE if this is live update, FALSE otherwise.
 
+  The translations of the live entries replaced are flushed once, at the end,
+  even if the update fails part way, and the tables folded into block entries
+  are freed after that. Inside a transaction, both are left for the commit,
+  with those of the other updates of the transaction, unless the update gave
+  access that a stale translation would deny.
+
   @retval EFI_INVALID_PARAMETER The RegionStart or RegionLength was not valid.
   @retval EFI_OUT_OF_RESOURCES  Not enough resource.
   @retval EFI_SUCCESS           The operation succesfully.
@@ -474,19 +1141,52 @@ UpdateRegionMapping (
   IN  BOOLEAN  TableIsLive
   )
 {
+  RISCV_MMU_FLUSH_CONTEXT  Flush;
+  EFI_STATUS               Status;
+
   if (((RegionStart | RegionLength) & EFI_PAGE_MASK) != 0) {
     return EFI_INVALID_PARAMETER;
   }
 
-  return UpdateRegionMappingRecursive (
-           RegionStart,
-           RegionStart + RegionLength,
-           AttributeSetMask,
-           AttributeClearMask,
-           RootTable,
-           0,
-           TableIsLive
-           );
+  //
+  // Splitting the blocks at either end of the region takes at most a table
+  // per level each. Take them from the pool, rather than have the allocator
+  // update memory attributes in the middle of the walk.
+  //
+  RefillTablePool (2 * mMaxRootTableLevel);
+
+  RiscVPmuProfileBegin ("UpdateRegionMappingRecursive");
+  if (mTransactionDepth > 0) {
+    CopyMem (&Flush, &mTransactionFlush, sizeof (Flush));
+  } else {
+    ResetFlushContext (&Flush);
+  }
+
+  Status = UpdateRegionMappingRecursive (
+             RegionStart,
+             RegionStart + RegionLength,
+             AttributeSetMask,
+             AttributeClearMask,
+             RootTable,
+             0,
+             TableIsLive,
+             &Flush
+             );
+  if ((mTransactionDepth > 0) && !Flush.Granted) {
+    CopyMem (&mTransactionFlush, &Flush, sizeof (Flush));
+  } else {
+    //
+    // The transaction, if any, starts over before the tables are freed, as
+    // freeing them may itself update the memory attributes.
+    //
+    ResetFlushContext (&mTransactionFlush);
+    FlushReplacedEntries (&Flush);
+    FreeMergedTables (&Flush);
+  }
+
+  RiscVPmuProfileEnd ("UpdateRegionMappingRecursive");
+
+  return Status;
 }
 
 /**
@@ -545,8 +1245,15 @@ GcdAttributeToPageAttribute (
 
   switch (CacheTypeMask) {
     case EFI_MEMORY_UC:
+    case EFI_MEMORY_UCE:
       if (PmbtExtEnabled) {
         *RiscVAttributes |= PTE_PBMT_IO;
+      } else {
+        DEBUG ((
+          DEBUG_VERBOSE,
+          "%a: EFI_MEMORY_UC set but Pmbt extension not available\n",
+          __func__
+          ));
       }
 
       break;
@@ -627,6 +1334,251 @@ RiscVSetMemoryAttributes (
            );
 }
 
+/**
+  Look up the entry that maps an address in the live page tables.
+
+  @param  Address     The address.
+  @param  BlockSize   The size of the region mapped by the entry, or of the
+                      region left unmapped.
+
+  @return The block or page entry, or 0 if the address isn't mapped.
+
+**/
+STATIC
+UINT64
+LookupEntry (
+  IN  UINT64  Address,
+  OUT UINT64  *BlockSize
+  )
+{
+  UINT64  Entries[RISCV_PAGE_TABLE_MAX_LEVELS];
+  UINT64  Entry;
+  UINTN   NumberOfEntries;
+
+  *BlockSize = EFI_PAGE_SIZE;
+  if (RShiftU64 (Address, mMaxRootTableLevel * mBitPerLevel + RISCV_MMU_PAGE_SHIFT) != 0) {
+    return 0;
+  }
+
+  NumberOfEntries = RiscVPageTableWalk (
+                      &mCpuPtePolicy,
+                      mMaxRootTableLevel,
+                      (UINT64 *)RiscVGetRootTranslateTable (),
+                      Address,
+                      Entries
+                      );
+  if (NumberOfEntries == 0) {
+    return 0;
+  }
+
+  Entry      = Entries[NumberOfEntries - 1];
+  *BlockSize = LShiftU64 (1, RISCV_PAGE_TABLE_LEVEL_SHIFT (mMaxRootTableLevel, NumberOfEntries - 1));
+  if (!IsBlockEntry (Entry)) {
+    return 0;
+  }
+
+  if ((Entry & PTE_N) != 0) {
+    *BlockSize = SIZE_64KB;
+  }
+
+  return Entry;
+}
+
+/**
+  The API to get the memory attributes of a region from the live page tables.
+
+  Each entry is looked up with a single walk, and the whole region it maps is
+  skipped at once.
+
+  @param  BaseAddress             The base address of the region.
+  @param  Length                  The length of the region.
+  @param  Attributes              The EFI_MEMORY_RO and EFI_MEMORY_XP attributes
+                                  of the region.
+
+  @retval EFI_INVALID_PARAMETER   Length is zero, or the region wraps around.
+  @retval EFI_UNSUPPORTED         The MMU is not enabled.
+  @retval EFI_NO_MAPPING          Part of the region is not mapped, or the
+                                  attributes differ across the region.
+  @retval EFI_SUCCESS             The operation succesfully.
+
+**/
+EFI_STATUS
+EFIAPI
+RiscVGetMemoryAttributes (
+  IN  EFI_PHYSICAL_ADDRESS  BaseAddress,
+  IN  UINT64                Length,
+  OUT UINT64                *Attributes
+  )
+{
+  UINT64  Address;
+  UINT64  Entry;
+  UINT64  BlockSize;
+  UINT64  RegionAttributes;
+  UINT64  FirstAttributes;
+
+  if ((Length == 0) || (BaseAddress > MAX_UINT64 - Length)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (!RiscVMmuEnabled ()) {
+    return EFI_UNSUPPORTED;
+  }
+
+  FirstAttributes = 0;
+  for (Address = BaseAddress;
+       Address < BaseAddress + Length;
+       Address = (Address | (BlockSize - 1)) + 1)
+  {
+    Entry = LookupEntry (Address, &BlockSize);
+    if (Entry == 0) {
+      return EFI_NO_MAPPING;
+    }
+
+    RegionAttributes = 0;
+    if ((Entry & RISCV_PG_W) == 0) {
+      RegionAttributes |= EFI_MEMORY_RO;
+    }
+
+    if ((Entry & RISCV_PG_X) == 0) {
+      RegionAttributes |= EFI_MEMORY_XP;
+    }
+
+    if (Address == BaseAddress) {
+      FirstAttributes = RegionAttributes;
+    } else if (RegionAttributes != FirstAttributes) {
+      return EFI_NO_MAPPING;
+    }
+  }
+
+  *Attributes = FirstAttributes;
+  return EFI_SUCCESS;
+}
+
+/**
+  The API to set some of the EFI_MEMORY_RO and EFI_MEMORY_XP attributes of a
+  mapped region, leaving its other attributes as they are.
+
+  @param  BaseAddress             The base address of the region.
+  @param  Length                  The length of the region.
+  @param  Attributes              The attributes to set.
+  @param  AttributeMask           The attributes to update: EFI_MEMORY_RO,
+                                  EFI_MEMORY_XP or both.
+
+  @retval EFI_INVALID_PARAMETER   The region or AttributeMask was not valid.
+  @retval EFI_UNSUPPORTED         The MMU is not enabled.
+  @retval EFI_NO_MAPPING          Part of the region is not mapped.
+  @retval EFI_OUT_OF_RESOURCES    Not enough resource.
+  @retval EFI_SUCCESS             The operation succesfully.
+
+**/
+EFI_STATUS
+EFIAPI
+RiscVSetMemoryPermissions (
+  IN EFI_PHYSICAL_ADDRESS  BaseAddress,
+  IN UINT64                Length,
+  IN UINT64                Attributes,
+  IN UINT64                AttributeMask
+  )
+{
+  UINT64  Address;
+  UINT64  BlockSize;
+  UINT64  PageAttributesSet;
+  UINT64  PageAttributesClear;
+
+  if ((Length == 0) || (BaseAddress > MAX_UINT64 - Length) ||
+      ((AttributeMask & ~(UINT64)(EFI_MEMORY_RO | EFI_MEMORY_XP)) != 0))
+  {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (!RiscVMmuEnabled ()) {
+    return EFI_UNSUPPORTED;
+  }
+
+  //
+  // Only mapped entries may be updated, as a page entry with W but not R set
+  // is reserved.
+  //
+  for (Address = BaseAddress;
+       Address < BaseAddress + Length;
+       Address = (Address | (BlockSize - 1)) + 1)
+  {
+    if (LookupEntry (Address, &BlockSize) == 0) {
+      return EFI_NO_MAPPING;
+    }
+  }
+
+  PageAttributesSet   = 0;
+  PageAttributesClear = 0;
+  if ((AttributeMask & EFI_MEMORY_RO) != 0) {
+    if ((Attributes & EFI_MEMORY_RO) != 0) {
+      PageAttributesClear |= RISCV_PG_W;
+    } else {
+      PageAttributesSet |= RISCV_PG_W;
+    }
+  }
+
+  if ((AttributeMask & EFI_MEMORY_XP) != 0) {
+    if ((Attributes & EFI_MEMORY_XP) != 0) {
+      PageAttributesClear |= RISCV_PG_X;
+    } else {
+      PageAttributesSet |= RISCV_PG_X;
+    }
+  }
+
+  DEBUG ((
+    DEBUG_VERBOSE,
+    "%a: %LX: set attributes 0x%LX, clear attributes 0x%LX\n",
+    __func__,
+    BaseAddress,
+    PageAttributesSet,
+    PageAttributesClear
+    ));
+
+  return UpdateRegionMapping (
+           BaseAddress,
+           Length,
+           PageAttributesSet,
+           PageAttributesClear,
+           (UINT64 *)RiscVGetRootTranslateTable (),
+           TRUE
+           );
+}
+
+/**
+  Set up the geometry of the page tables of a SATP mode.
+
+  @param  SatpMode  The SATP mode, other than bare.
+
+  @retval EFI_INVALID_PARAMETER   The SATP mode was not valid.
+  @retval EFI_SUCCESS             The operation succesfully.
+
+**/
+STATIC
+EFI_STATUS
+SetTableGeometry (
+  IN UINTN  SatpMode
+  )
+{
+  switch (SatpMode) {
+    case SATP_MODE_SV39:
+      mMaxRootTableLevel = 3;
+      break;
+    case SATP_MODE_SV48:
+      mMaxRootTableLevel = 4;
+      break;
+    case SATP_MODE_SV57:
+      mMaxRootTableLevel = 5;
+      break;
+    default:
+      return EFI_INVALID_PARAMETER;
+  }
+
+  mBitPerLevel     = 9;
+  mTableEntryCount = 512;
+  return EFI_SUCCESS;
+}
+
 /**
   Set SATP mode.
 
@@ -657,30 +1609,17 @@ RiscVMmuSetSatpMode  (
     return EFI_DEVICE_ERROR;
   }
 
-  switch (SatpMode) {
-    case SATP_MODE_OFF:
-      return EFI_SUCCESS;
-    case SATP_MODE_SV39:
-      mMaxRootTableLevel = 3;
-      mBitPerLevel       = 9;
-      mTableEntryCount   = 512;
-      break;
-    case SATP_MODE_SV48:
-      mMaxRootTableLevel = 4;
-      mBitPerLevel       = 9;
-      mTableEntryCount   = 512;
-      break;
-    case SATP_MODE_SV57:
-      mMaxRootTableLevel = 5;
-      mBitPerLevel       = 9;
-      mTableEntryCount   = 512;
-      break;
-    default:
-      return EFI_INVALID_PARAMETER;
+  if (SatpMode == SATP_MODE_OFF) {
+    return EFI_SUCCESS;
+  }
+
+  Status = SetTableGeometry (SatpMode);
+  if (EFI_ERROR (Status)) {
+    return Status;
   }
 
   // Allocate pages for translation table
-  TranslationTable = AllocatePages (1);
+  TranslationTable = AllocateTablePage ();
   if (TranslationTable == NULL) {
     return EFI_OUT_OF_RESOURCES;
   }
@@ -738,10 +1677,11 @@ RiscVMmuSetSatpMode  (
       __func__,
       SatpMode
       ));
-    FreePageTablesRecursive (TranslationTable, 0);
+    FreePageTables (TranslationTable, 0);
     return EFI_DEVICE_ERROR;
   }
 
+  mStatistics.LocalFlushAlls++;
   RiscVLocalTlbFlushAll ();
 
   SetInterruptState (InterruptState);
@@ -750,7 +1690,289 @@ RiscVMmuSetSatpMode  (
 }
 
 /**
-  The API to configure and enable RISC-V MMU with the highest mode supported.
+  The API to set the other harts that may run with the page tables, whose
+  translations are flushed with an SBI remote sfence.vma after each update.
+
+  @param  HartMask                The harts, as a bit mask relative to
+                                  HartMaskBase. 0 stops the remote flushes.
+  @param  HartMaskBase            The hart ID of bit 0 of HartMask, or
+                                  SBI_HART_MASK_BASE_ALL for every hart.
+
+**/
+VOID
+EFIAPI
+RiscVMmuSetRemoteHarts (
+  IN UINTN  HartMask,
+  IN UINTN  HartMaskBase
+  )
+{
+  mRemoteHartMask     = HartMask;
+  mRemoteHartMaskBase = HartMaskBase;
+  mRemoteFlush        = (HartMask != 0) || (HartMaskBase == SBI_HART_MASK_BASE_ALL);
+}
+
+/**
+  The API to flush the translations of the other harts after each update with
+  a function of the caller, in place of the SBI remote sfence.vma to the harts
+  set by RiscVMmuSetRemoteHarts ().
+
+  @param  RemoteFlush             The function, or NULL to return to the SBI
+                                  remote sfence.vma.
+
+**/
+VOID
+EFIAPI
+RiscVMmuSetRemoteFlush (
+  IN RISCV_MMU_REMOTE_FLUSH  RemoteFlush
+  )
+{
+  mRemoteFlushFunction = RemoteFlush;
+}
+
+/**
+  The API to open a transaction, in which the updates of the live page tables
+  leave the flush of their translations, and the freeing of the tables they
+  folded, to the commit of the transaction. The updates of the sections of an
+  image then share one sfence.vma, and one remote flush of the other harts.
+
+  Until the commit, stale translations may still give the access that an
+  update took away. An update that gives access is flushed at once, with the
+  updates of the transaction before it. Transactions nest, and only the commit
+  of the outermost flushes.
+
+**/
+VOID
+EFIAPI
+RiscVMmuBeginTransaction (
+  VOID
+  )
+{
+  if (mTransactionDepth == 0) {
+    ResetFlushContext (&mTransactionFlush);
+  }
+
+  mTransactionDepth++;
+}
+
+/**
+  The API to commit a transaction opened by RiscVMmuBeginTransaction ().
+
+  The commit of the outermost transaction flushes the translations of the
+  entries that its updates replaced, and frees the tables that they folded.
+
+**/
+VOID
+EFIAPI
+RiscVMmuCommitTransaction (
+  VOID
+  )
+{
+  RISCV_MMU_FLUSH_CONTEXT  Flush;
+
+  ASSERT (mTransactionDepth > 0);
+  if (mTransactionDepth == 0) {
+    return;
+  }
+
+  mTransactionDepth--;
+  if (mTransactionDepth > 0) {
+    return;
+  }
+
+  CopyMem (&Flush, &mTransactionFlush, sizeof (Flush));
+  ResetFlushContext (&mTransactionFlush);
+  FlushReplacedEntries (&Flush);
+  FreeMergedTables (&Flush);
+}
+
+/**
+  Find the shallowest SATP mode whose identity map reaches the highest address
+  of the GCD memory space map.
+
+  @return The SATP mode.
+
+**/
+STATIC
+UINTN
+GetShallowestSatpMode (
+  VOID
+  )
+{
+  EFI_GCD_MEMORY_SPACE_DESCRIPTOR  *MemoryMap;
+  UINTN                            NumberOfDescriptors;
+  UINTN                            Index;
+  UINT64                           End;
+  EFI_STATUS                       Status;
+
+  Status = gDS->GetMemorySpaceMap (&NumberOfDescriptors, &MemoryMap);
+  if (EFI_ERROR (Status)) {
+    return SATP_MODE_SV57;
+  }
+
+  End = 0;
+  for (Index = 0; Index < NumberOfDescriptors; Index++) {
+    if (MemoryMap[Index].GcdMemoryType != EfiGcdMemoryTypeNonExistent) {
+      End = MAX (End, MemoryMap[Index].BaseAddress + MemoryMap[Index].Length);
+    }
+  }
+
+  FreePool ((VOID *)MemoryMap);
+
+  //
+  // Identity-mapped addresses must not need sign-extension, so a mode with
+  // N-bit virtual addresses reaches 2^(N-1).
+  //
+  if (End <= BIT38) {
+    return SATP_MODE_SV39;
+  } else if (End <= BIT47) {
+    return SATP_MODE_SV48;
+  }
+
+  return SATP_MODE_SV57;
+}
+
+/**
+  Try to configure and enable RISC-V MMU with a SATP mode.
+
+  @param  SatpMode                The SATP mode.
+
+  @retval EFI_DEVICE_ERROR        The SATP mode is not supported.
+  @retval EFI_OUT_OF_RESOURCES    Not enough resource.
+  @retval EFI_SUCCESS             The operation succesfully.
+
+**/
+STATIC
+EFI_STATUS
+RiscVMmuTrySatpMode (
+  IN UINTN  SatpMode
+  )
+{
+  EFI_STATUS  Status;
+
+  Status = RiscVMmuSetSatpMode (SatpMode);
+  if (!EFI_ERROR (Status)) {
+    DEBUG ((
+      DEBUG_INFO,
+      "%a: SATP mode %d successfully configured\n",
+      __func__,
+      SatpMode
+      ));
+  }
+
+  return Status;
+}
+
+/**
+  Adopt the live identity map that SEC or PEI built, if its mode reaches the
+  highest address, and refine it with the memory types of the GCD memory
+  space map, as RiscVMmuSetSatpMode () would have built it: MMIO read-write,
+  system memory read-write-execute, and the rest unmapped.
+
+  @param  MinimumMode             The shallowest mode that reaches the highest address.
+
+  @retval EFI_NOT_FOUND           There is no map to adopt.
+  @retval EFI_OUT_OF_RESOURCES    Not enough resource.
+  @retval EFI_SUCCESS             The operation succesfully.
+
+**/
+STATIC
+EFI_STATUS
+RiscVMmuAdoptHandOff (
+  IN UINTN  MinimumMode
+  )
+{
+  VOID                             *Hob;
+  RISCV_MMU_HAND_OFF               *HandOff;
+  UINTN                            SatpMode;
+  UINT64                           *RootTable;
+  EFI_GCD_MEMORY_SPACE_DESCRIPTOR  *MemoryMap;
+  UINTN                            NumberOfDescriptors;
+  UINTN                            Index;
+  UINT64                           End;
+  EFI_STATUS                       Status;
+
+  Hob = GetFirstGuidHob (&gRiscVMmuHandOffHobGuid);
+  if (Hob == NULL) {
+    return EFI_NOT_FOUND;
+  }
+
+  HandOff  = GET_GUID_HOB_DATA (Hob);
+  SatpMode = (UINTN)RShiftU64 (HandOff->Satp & SATP64_MODE, SATP64_MODE_SHIFT);
+  if ((HandOff->Signature != RISCV_MMU_HAND_OFF_SIGNATURE) ||
+      (HandOff->Satp != RiscVGetSupervisorAddressTranslationRegister ()) ||
+      (SatpMode < MinimumMode) ||
+      (SatpMode > PcdGet32 (PcdCpuRiscVMmuMaxSatpMode)) ||
+      EFI_ERROR (SetTableGeometry (SatpMode)))
+  {
+    return EFI_NOT_FOUND;
+  }
+
+  Status = gDS->GetMemorySpaceMap (&NumberOfDescriptors, &MemoryMap);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  RootTable = (UINT64 *)RiscVGetRootTranslateTable ();
+  for (Index = 0; Index < NumberOfDescriptors && !EFI_ERROR (Status); Index++) {
+    if (MemoryMap[Index].GcdMemoryType == EfiGcdMemoryTypeMemoryMappedIo) {
+      Status = UpdateRegionMapping (
+                 MemoryMap[Index].BaseAddress,
+                 MemoryMap[Index].Length,
+                 RISCV_PG_R | RISCV_PG_W,
+                 PTE_ATTRIBUTES_MASK,
+                 RootTable,
+                 TRUE
+                 );
+    } else if (MemoryMap[Index].GcdMemoryType == EfiGcdMemoryTypeSystemMemory) {
+      Status = UpdateRegionMapping (
+                 MemoryMap[Index].BaseAddress,
+                 MemoryMap[Index].Length,
+                 RISCV_PG_R | RISCV_PG_W | RISCV_PG_X,
+                 PTE_ATTRIBUTES_MASK,
+                 RootTable,
+                 TRUE
+                 );
+    } else if (MemoryMap[Index].BaseAddress < HandOff->MappedEnd) {
+      //
+      // Nothing beyond the early map's end is mapped yet.
+      //
+      End    = MIN (MemoryMap[Index].BaseAddress + MemoryMap[Index].Length, HandOff->MappedEnd);
+      Status = UpdateRegionMapping (
+                 MemoryMap[Index].BaseAddress,
+                 End - MemoryMap[Index].BaseAddress,
+                 0,
+                 PTE_ATTRIBUTES_MASK,
+                 RootTable,
+                 TRUE
+                 );
+    }
+  }
+
+  FreePool ((VOID *)MemoryMap);
+
+  if (!EFI_ERROR (Status)) {
+    DEBUG ((
+      DEBUG_INFO,
+      "%a: SATP mode %d adopted, with %lu table pages\n",
+      __func__,
+      SatpMode,
+      HandOff->NumberOfTablePages
+      ));
+  }
+
+  return Status;
+}
+
+/**
+  The API to configure and enable RISC-V MMU.
+
+  With PcdCpuRiscVMmuShallowestSatpMode, the shallowest supported mode that
+  reaches the highest address of the GCD memory space map is configured, so
+  that page walks, of the harts and of IOMMUs that mirror their mode, have
+  the fewest levels. Otherwise, the highest mode supported is configured.
+
+  An identity map that SEC or PEI enabled in a mode that qualifies is
+  adopted and refined, rather than rebuilt with the MMU off.
 
   @retval EFI_OUT_OF_RESOURCES    Not enough resource.
   @retval EFI_SUCCESS             The operation succesfully.
@@ -763,27 +1985,129 @@ RiscVConfigureMmu (
   )
 {
   EFI_STATUS  Status;
+  UINTN       MinimumMode;
   UINTN       Idx;
 
-  Status = EFI_SUCCESS;
+  MinimumMode = SATP_MODE_SV57;
+  if (PcdGetBool (PcdCpuRiscVMmuShallowestSatpMode)) {
+    MinimumMode = GetShallowestSatpMode ();
+  }
 
-  /* Try to setup MMU with highest mode as possible */
-  for (Idx = 0; Idx < ARRAY_SIZE (mModeSupport); Idx++) {
-    Status = RiscVMmuSetSatpMode (mModeSupport[Idx]);
-    if (Status == EFI_DEVICE_ERROR) {
+  Status = RiscVMmuAdoptHandOff (MinimumMode);
+  if (Status != EFI_NOT_FOUND) {
+    return Status;
+  }
+
+  //
+  // Try the modes that reach every address from the shallowest up, then the
+  // shallower ones from the highest down, as without the mode selection.
+  //
+  for (Idx = ARRAY_SIZE (mModeSupport); Idx > 0; Idx--) {
+    if ((mModeSupport[Idx - 1] == SATP_MODE_OFF) || (mModeSupport[Idx - 1] < MinimumMode)) {
       continue;
-    } else if (EFI_ERROR (Status)) {
+    }
+
+    Status = RiscVMmuTrySatpMode (mModeSupport[Idx - 1]);
+    if (Status != EFI_DEVICE_ERROR) {
       return Status;
     }
+  }
 
-    DEBUG ((
-      DEBUG_INFO,
-      "%a: SATP mode %d successfully configured\n",
-      __func__,
-      mModeSupport[Idx]
-      ));
-    break;
+  Status = EFI_SUCCESS;
+  for (Idx = 0; Idx < ARRAY_SIZE (mModeSupport); Idx++) {
+    if ((mModeSupport[Idx] != SATP_MODE_OFF) && (mModeSupport[Idx] >= MinimumMode)) {
+      continue;
+    }
+
+    Status = RiscVMmuTrySatpMode (mModeSupport[Idx]);
+    if (Status != EFI_DEVICE_ERROR) {
+      return Status;
+    }
   }
 
   return Status;
 }
+
+/**
+  Count a table of the live page tables and the tables below it, and their
+  leaf entries by size.
+
+  @param  Table       The table.
+  @param  Level       The level of the table.
+  @param  Statistics  The statistics to add the counts to.
+
+**/
+STATIC
+VOID
+CountPageTables (
+  IN      UINT64                *Table,
+  IN      UINTN                 Level,
+  IN OUT  RISCV_MMU_STATISTICS  *Statistics
+  )
+{
+  UINTN  LevelsBelow;
+  UINTN  Index;
+
+  Statistics->LiveTables++;
+  LevelsBelow = mMaxRootTableLevel - Level - 1;
+  for (Index = 0; Index < mTableEntryCount; Index++) {
+    if ((LevelsBelow > 0) && IsTableEntry (Table[Index])) {
+      CountPageTables (
+        (UINT64 *)(GetPpnfromPte (Table[Index]) << RISCV_MMU_PAGE_SHIFT),
+        Level + 1,
+        Statistics
+        );
+      continue;
+    }
+
+    if (!IsBlockEntry (Table[Index])) {
+      continue;
+    }
+
+    switch (LevelsBelow) {
+      case 0:
+        if ((Table[Index] & PTE_N) == 0) {
+          Statistics->Leaves4K++;
+        } else if ((Index % RISCV_MMU_NAPOT_64K_ENTRIES) == 0) {
+          Statistics->Leaves64K++;
+        }
+
+        break;
+      case 1:
+        Statistics->Leaves2M++;
+        break;
+      case 2:
+        Statistics->Leaves1G++;
+        break;
+      default:
+        Statistics->Leaves512G++;
+        break;
+    }
+  }
+}
+
+/**
+  The API to report how the page tables were built and maintained, with the
+  tables and leaf entries of the live page tables counted by a walk.
+
+  @param  Statistics              The statistics.
+
+**/
+VOID
+EFIAPI
+RiscVMmuGetStatistics (
+  OUT RISCV_MMU_STATISTICS  *Statistics
+  )
+{
+  CopyMem (Statistics, &mStatistics, sizeof (*Statistics));
+  Statistics->SatpMode = SATP_MODE_OFF;
+  if (!RiscVMmuEnabled ()) {
+    return;
+  }
+
+  Statistics->SatpMode = (UINTN)RShiftU64 (
+                                  RiscVGetSupervisorAddressTranslationRegister () & SATP64_MODE,
+                                  SATP64_MODE_SHIFT
+                                  );
+  CountPageTables ((UINT64 *)RiscVGetRootTranslateTable (), 0, Statistics);
+}
@@ -0,0 +1,260 @@
+/** @file
+  The hart and firmware that BaseRiscVMmuLib runs on in host-based tests.
+
+  SATP is a variable, which a write with a mode that the hart doesn't support
+  leaves as it was, and the sfence.vma, local and remote, are counted. There is
+  no SEC or PEI map to adopt. The DXE services describe the platform of
+  RiscVMmuLibUnitTest.h.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <time.h>
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/BaseRiscVMmuLib.h>
+#include <Library/BaseRiscVSbiLib.h>
+#include <Library/DebugLib.h>
+#include <Library/DxeServicesTableLib.h>
+#include <Library/HobLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Register/RiscV64/RiscVEncoding.h>
+#include "RiscVMmuLibUnitTest.h"
+
+typedef struct {
+  EFI_PHYSICAL_ADDRESS    BaseAddress;
+  UINT64                  Length;
+  EFI_GCD_MEMORY_TYPE     GcdMemoryType;
+} HOST_MEMORY_SPACE;
+
+STATIC CONST HOST_MEMORY_SPACE  mMemorySpaces[] = {
+  { HOST_PLIC_BASE,     HOST_PLIC_SIZE,     EfiGcdMemoryTypeMemoryMappedIo },
+  { HOST_UART_BASE,     HOST_UART_SIZE,     EfiGcdMemoryTypeMemoryMappedIo },
+  { HOST_ECAM_BASE,     HOST_ECAM_SIZE,     EfiGcdMemoryTypeMemoryMappedIo },
+  { HOST_PCI_MMIO_BASE, HOST_PCI_MMIO_SIZE, EfiGcdMemoryTypeMemoryMappedIo },
+  { HOST_DRAM_BASE,     HOST_DRAM_SIZE,     EfiGcdMemoryTypeSystemMemory   },
+};
+
+STATIC UINT64              mSatp;
+STATIC UINTN               mSupportedSatpMode;
+STATIC HOST_HART_COUNTERS  mCounters;
+
+STATIC EFI_DXE_SERVICES  mDxeServices;
+
+EFI_DXE_SERVICES  *gDS = &mDxeServices;
+
+/**
+  Write the SATP of the hart. A mode that the hart doesn't support leaves it as it was.
+
+  @param[in]  Value  The SATP.
+
+**/
+VOID
+RiscVSetSupervisorAddressTranslationRegister (
+  IN UINT64  Value
+  )
+{
+  UINTN  SatpMode;
+
+  SatpMode = (UINTN)RShiftU64 (Value & SATP64_MODE, SATP64_MODE_SHIFT);
+  if ((SatpMode != SATP_MODE_OFF) && (SatpMode > mSupportedSatpMode)) {
+    return;
+  }
+
+  mSatp = Value;
+}
+
+/**
+  Read the SATP of the hart.
+
+  @return  The SATP.
+
+**/
+UINT64
+RiscVGetSupervisorAddressTranslationRegister (
+  VOID
+  )
+{
+  return mSatp;
+}
+
+/**
+  Count an sfence.vma for all addresses.
+
+**/
+VOID
+EFIAPI
+RiscVLocalTlbFlushAll (
+  VOID
+  )
+{
+  mCounters.LocalFlushAlls++;
+}
+
+/**
+  Count an sfence.vma at an address.
+
+  @param  VirtAddr  The virtual address.
+
+**/
+VOID
+EFIAPI
+RiscVLocalTlbFlush (
+  UINTN  VirtAddr
+  )
+{
+  mCounters.LocalFlushes++;
+}
+
+/**
+  Count an SBI remote sfence.vma to the other harts.
+
+  @param[in]  HartMask      The harts, relative to HartMaskBase.
+  @param[in]  HartMaskBase  The hart ID of bit 0 of HartMask.
+  @param[in]  StartAddress  The start of the range.
+  @param[in]  Size          The size of the range.
+
+  @retval  EFI_SUCCESS  Always.
+
+**/
+EFI_STATUS
+EFIAPI
+SbiRemoteSfenceVma (
+  IN  UINTN  HartMask,
+  IN  UINTN  HartMaskBase,
+  IN  UINTN  StartAddress,
+  IN  UINTN  Size
+  )
+{
+  mCounters.RemoteFlushes++;
+  return EFI_SUCCESS;
+}
+
+/**
+  Find a GUID HOB. SEC and PEI built none, so there is no map to adopt.
+
+  @param[in]  Guid  The GUID of the HOB.
+
+  @return  NULL.
+
+**/
+VOID *
+EFIAPI
+GetFirstGuidHob (
+  IN CONST EFI_GUID  *Guid
+  )
+{
+  return NULL;
+}
+
+/**
+  Get the memory space map of the platform.
+
+  @param[out]  NumberOfDescriptors  The number of descriptors.
+  @param[out]  MemorySpaceMap       The map, which the caller frees.
+
+  @retval  EFI_SUCCESS           The map is returned.
+  @retval  EFI_OUT_OF_RESOURCES  The map could not be allocated.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+HostGetMemorySpaceMap (
+  OUT UINTN                            *NumberOfDescriptors,
+  OUT EFI_GCD_MEMORY_SPACE_DESCRIPTOR  **MemorySpaceMap
+  )
+{
+  UINTN  Index;
+
+  *MemorySpaceMap = AllocateZeroPool (sizeof (EFI_GCD_MEMORY_SPACE_DESCRIPTOR) * ARRAY_SIZE (mMemorySpaces));
+  if (*MemorySpaceMap == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  for (Index = 0; Index < ARRAY_SIZE (mMemorySpaces); Index++) {
+    (*MemorySpaceMap)[Index].BaseAddress   = mMemorySpaces[Index].BaseAddress;
+    (*MemorySpaceMap)[Index].Length        = mMemorySpaces[Index].Length;
+    (*MemorySpaceMap)[Index].GcdMemoryType = mMemorySpaces[Index].GcdMemoryType;
+    if (mMemorySpaces[Index].GcdMemoryType == EfiGcdMemoryTypeSystemMemory) {
+      (*MemorySpaceMap)[Index].Capabilities = EFI_MEMORY_WB | EFI_MEMORY_RO | EFI_MEMORY_XP;
+      (*MemorySpaceMap)[Index].Attributes   = EFI_MEMORY_WB;
+    } else {
+      (*MemorySpaceMap)[Index].Capabilities = EFI_MEMORY_UC | EFI_MEMORY_XP;
+      (*MemorySpaceMap)[Index].Attributes   = EFI_MEMORY_UC;
+    }
+  }
+
+  *NumberOfDescriptors = ARRAY_SIZE (mMemorySpaces);
+  return EFI_SUCCESS;
+}
+
+/**
+  Install the DXE services that the library runs on, which describe the memory
+  space of the platform.
+
+**/
+VOID
+HostPlatformInitialise (
+  VOID
+  )
+{
+  mDxeServices.Hdr.Signature     = DXE_SERVICES_SIGNATURE;
+  mDxeServices.GetMemorySpaceMap = HostGetMemorySpaceMap;
+}
+
+/**
+  Reset the hart, with the MMU off, to a hart that supports the SATP modes up to
+  a mode. Writes of SATP with a deeper mode have no effect, as on hardware.
+
+  The tables that the library built for the previous mode stay allocated.
+
+  @param[in]  SupportedSatpMode  The deepest SATP mode that the hart supports.
+
+**/
+VOID
+HostHartReset (
+  IN UINTN  SupportedSatpMode
+  )
+{
+  mSatp              = 0;
+  mSupportedSatpMode = SupportedSatpMode;
+}
+
+/**
+  Get the TLB maintenance that the hart was asked to do since the start.
+
+  @param[out]  Counters  The counters.
+
+**/
+VOID
+HostHartGetCounters (
+  OUT HOST_HART_COUNTERS  *Counters
+  )
+{
+  CopyMem (Counters, &mCounters, sizeof (*Counters));
+}
+
+/**
+  Get the time of the host.
+
+  @return  The time, in nanoseconds.
+
+**/
+UINT64
+HostGetTime (
+  VOID
+  )
+{
+  struct timespec  Time;
+
+  if (timespec_get (&Time, TIME_UTC) == 0) {
+    return 0;
+  }
+
+  return MultU64x32 ((UINT64)Time.tv_sec, 1000000000) + (UINT64)Time.tv_nsec;
+}
@@ -0,0 +1,802 @@
+/** @file
+  Host-based unit tests and benchmarks of BaseRiscVMmuLib.
+
+  The library builds and updates the page tables of a host hart in Sv39, Sv48
+  and Sv57 in turn. Each mode is checked with updates that split and fold
+  tables, then benchmarked with the updates that DXE makes: the protection of
+  the sections of images as they are loaded and unloaded, alone and in a
+  transaction per image, the guard pages of stacks, and the mapping of PCI BARs and the ECAM as uncached. Each benchmark
+  reports the time per call, the table pages and the sfence.vma, local and
+  remote, that the updates took.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/BaseRiscVMmuLib.h>
+#include <Library/DebugLib.h>
+#include <Library/UnitTestLib.h>
+#include <Register/RiscV64/RiscVEncoding.h>
+
+#include "RiscVMmuLibUnitTest.h"
+
+#define UNIT_TEST_NAME     "RISC-V MMU Library Unit Tests and Benchmarks"
+#define UNIT_TEST_VERSION  "1.0"
+
+//
+// The other harts of the platform, which take an SBI remote sfence.vma after each update.
+//
+#define TEST_REMOTE_HART_MASK  (BIT1 | BIT2 | BIT3)
+
+//
+// Images of 256 KiB, a header, code and data, loaded 320 KiB apart into the first GiB of DRAM.
+//
+#define TEST_IMAGE_COUNT        64
+#define TEST_IMAGE_REGION_BASE  (HOST_DRAM_BASE + SIZE_512MB)
+#define TEST_IMAGE_STRIDE       (SIZE_256KB + SIZE_64KB)
+#define TEST_IMAGE_SIZE         SIZE_256KB
+#define TEST_IMAGE_HEADER_SIZE  SIZE_4KB
+#define TEST_IMAGE_CODE_SIZE    SIZE_128KB
+
+//
+// Stacks of 64 KiB, a guard page and the stack, allocated 128 KiB apart into the second GiB of DRAM.
+//
+#define TEST_STACK_COUNT        128
+#define TEST_STACK_REGION_BASE  (HOST_DRAM_BASE + SIZE_1GB)
+#define TEST_STACK_STRIDE       SIZE_128KB
+#define TEST_STACK_SIZE         SIZE_64KB
+
+//
+// BARs that are mapped into the PCI MMIO window, each aligned to its size.
+//
+#define TEST_BAR_COUNT  96
+
+STATIC CONST UINT64  mBarSizes[] = { SIZE_16KB, SIZE_4KB, SIZE_1MB, SIZE_64KB, SIZE_8KB, SIZE_32MB };
+
+//
+// The updates are made in the third GiB of DRAM.
+//
+#define TEST_UPDATE_BASE  (HOST_DRAM_BASE + SIZE_2GB)
+
+typedef struct {
+  CHAR8    *Name;
+  CHAR8    *Package;
+  UINTN    SatpMode;
+  // The map that RiscVConfigureMmu () builds for the platform. Sv39 has no block
+  // entries in its root table, so every GiB that is mapped takes a table.
+  UINT64    Tables;
+  UINT64    Leaves2M;
+  UINT64    Leaves1G;
+} MMU_TEST_MODE;
+
+STATIC MMU_TEST_MODE  mModes[] = {
+  { "Sv39", "RiscVMmuLib.Sv39", SATP_MODE_SV39, 8, 2720, 0 },
+  { "Sv48", "RiscVMmuLib.Sv48", SATP_MODE_SV48, 4, 160,  5 },
+  { "Sv57", "RiscVMmuLib.Sv57", SATP_MODE_SV57, 5, 160,  5 },
+};
+
+//
+// The state of the page tables and of the hart when a benchmark starts.
+//
+typedef struct {
+  RISCV_MMU_STATISTICS    Statistics;
+  HOST_HART_COUNTERS      Counters;
+  UINT64                  StartTime;
+} BENCHMARK_SNAPSHOT;
+
+/**
+  Take the state of the page tables and of the hart, and start the clock.
+
+  @param[out]  Snapshot  The state.
+
+**/
+STATIC
+VOID
+BenchmarkStart (
+  OUT BENCHMARK_SNAPSHOT  *Snapshot
+  )
+{
+  RiscVMmuGetStatistics (&Snapshot->Statistics);
+  HostHartGetCounters (&Snapshot->Counters);
+  Snapshot->StartTime = HostGetTime ();
+}
+
+/**
+  Print a count per call, with two decimals.
+
+  @param[in]  Name   The name of the count.
+  @param[in]  Count  The count.
+  @param[in]  Calls  The number of calls.
+
+**/
+STATIC
+VOID
+PrintPerCall (
+  IN CONST CHAR8  *Name,
+  IN UINT64       Count,
+  IN UINT64       Calls
+  )
+{
+  UINT64  Hundredths;
+
+  Hundredths = DivU64x64Remainder (MultU64x32 (Count, 100), Calls, NULL);
+  DEBUG ((
+    DEBUG_INFO,
+    "  %-22a %lu.%02lu\n",
+    Name,
+    DivU64x32 (Hundredths, 100),
+    ModU64x32 (Hundredths, 100)
+    ));
+}
+
+/**
+  Stop the clock, and report the time per call, the table pages and the sfence.vma
+  of the calls since BenchmarkStart ().
+
+  @param[in]  Name      The name of the benchmark.
+  @param[in]  Mode      The SATP mode.
+  @param[in]  Calls     The number of calls.
+  @param[in]  Snapshot  The state when the benchmark started.
+
+**/
+STATIC
+VOID
+BenchmarkReport (
+  IN CONST CHAR8         *Name,
+  IN MMU_TEST_MODE       *Mode,
+  IN UINT64              Calls,
+  IN BENCHMARK_SNAPSHOT  *Snapshot
+  )
+{
+  UINT64                Elapsed;
+  RISCV_MMU_STATISTICS  Statistics;
+  HOST_HART_COUNTERS    Counters;
+
+  Elapsed = HostGetTime () - Snapshot->StartTime;
+  RiscVMmuGetStatistics (&Statistics);
+  HostHartGetCounters (&Counters);
+
+  DEBUG ((DEBUG_INFO, "%a, %a: %lu calls in %lu us\n", Name, Mode->Name, Calls, DivU64x32 (Elapsed, 1000)));
+  DEBUG ((DEBUG_INFO, "  %-22a %lu\n", "ns/call", DivU64x64Remainder (Elapsed, MAX (Calls, 1), NULL)));
+  PrintPerCall ("sfence.vma/call", Counters.LocalFlushes - Snapshot->Counters.LocalFlushes, Calls);
+  PrintPerCall ("sfence.vma all/call", Counters.LocalFlushAlls - Snapshot->Counters.LocalFlushAlls, Calls);
+  PrintPerCall ("Remote sfence/call", Counters.RemoteFlushes - Snapshot->Counters.RemoteFlushes, Calls);
+  DEBUG ((
+    DEBUG_INFO,
+    "  %-22a %lu allocated, %lu freed, %lu splits, %lu folds\n",
+    "Table pages",
+    Statistics.TablesAllocated - Snapshot->Statistics.TablesAllocated,
+    Statistics.TablesFreed - Snapshot->Statistics.TablesFreed,
+    Statistics.Splits - Snapshot->Statistics.Splits,
+    Statistics.Folds - Snapshot->Statistics.Folds
+    ));
+  DEBUG ((
+    DEBUG_INFO,
+    "  %-22a %lu (%ld during the run)\n",
+    "Live tables",
+    Statistics.LiveTables,
+    (INT64)(Statistics.LiveTables - Snapshot->Statistics.LiveTables)
+    ));
+  DEBUG ((
+    DEBUG_INFO,
+    "  %-22a %lu 4K, %lu 64K, %lu 2M, %lu 1G\n",
+    "Leaves",
+    Statistics.Leaves4K,
+    Statistics.Leaves64K,
+    Statistics.Leaves2M,
+    Statistics.Leaves1G
+    ));
+}
+
+/**
+  Check the EFI_MEMORY_RO and EFI_MEMORY_XP attributes of a region, which must
+  be mapped with the same attributes throughout.
+
+  @param[in]  BaseAddress  The base of the region.
+  @param[in]  Length       The length of the region.
+  @param[in]  Expected     The attributes.
+
+  @retval  TRUE   The region has the attributes.
+  @retval  FALSE  The region is not mapped, or has other attributes.
+
+**/
+STATIC
+BOOLEAN
+HasAttributes (
+  IN EFI_PHYSICAL_ADDRESS  BaseAddress,
+  IN UINT64                Length,
+  IN UINT64                Expected
+  )
+{
+  UINT64      Attributes;
+  EFI_STATUS  Status;
+
+  Status = RiscVGetMemoryAttributes (BaseAddress, Length, &Attributes);
+  return !EFI_ERROR (Status) && (Attributes == Expected);
+}
+
+/**
+  Check that the MMU runs in the mode of the suite.
+
+  @param[in]  Context  The MMU_TEST_MODE.
+
+  @retval  UNIT_TEST_PASSED                    The MMU runs in the mode.
+  @retval  UNIT_TEST_ERROR_PREREQUISITE_NOT_MET  The MMU is off, or runs in another mode.
+
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+MmuConfigured (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  MMU_TEST_MODE         *Mode;
+  RISCV_MMU_STATISTICS  Statistics;
+
+  Mode = Context;
+  RiscVMmuGetStatistics (&Statistics);
+  if (Statistics.SatpMode != Mode->SatpMode) {
+    return UNIT_TEST_ERROR_PREREQUISITE_NOT_MET;
+  }
+
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Reset the hart to one whose deepest mode is the mode of the suite, configure the
+  MMU, and check the map that it builds for the platform.
+
+  The deeper modes that RiscVConfigureMmu () tries first don't take, as on hardware.
+
+  @param[in]  Context  The MMU_TEST_MODE.
+
+  @retval  UNIT_TEST_PASSED             The MMU runs in the mode, with the map of the platform.
+  @retval  UNIT_TEST_ERROR_TEST_FAILED  The MMU could not be configured, or the map is wrong.
+
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+ConfigureMmu (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  MMU_TEST_MODE         *Mode;
+  RISCV_MMU_STATISTICS  Statistics;
+  UINT64                Attributes;
+  EFI_STATUS            Status;
+
+  Mode = Context;
+  HostHartReset (Mode->SatpMode);
+
+  Status = RiscVGetMemoryAttributes (HOST_DRAM_BASE, SIZE_4KB, &Attributes);
+  UT_ASSERT_STATUS_EQUAL (Status, EFI_UNSUPPORTED);
+
+  Status = RiscVConfigureMmu ();
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  RiscVMmuSetRemoteHarts (TEST_REMOTE_HART_MASK, 0);
+
+  RiscVMmuGetStatistics (&Statistics);
+  UT_ASSERT_EQUAL (Statistics.SatpMode, Mode->SatpMode);
+  UT_ASSERT_EQUAL (Statistics.LiveTables, Mode->Tables);
+  UT_ASSERT_EQUAL (Statistics.Leaves4K, 1);
+  UT_ASSERT_EQUAL (Statistics.Leaves64K, 0);
+  UT_ASSERT_EQUAL (Statistics.Leaves2M, Mode->Leaves2M);
+  UT_ASSERT_EQUAL (Statistics.Leaves1G, Mode->Leaves1G);
+
+  //
+  // System memory is read-write-execute, MMIO read-write, and the rest unmapped.
+  //
+  UT_ASSERT_TRUE (HasAttributes (HOST_DRAM_BASE, HOST_DRAM_SIZE, 0));
+  UT_ASSERT_TRUE (HasAttributes (HOST_PCI_MMIO_BASE, HOST_PCI_MMIO_SIZE, EFI_MEMORY_XP));
+  UT_ASSERT_TRUE (HasAttributes (HOST_UART_BASE, HOST_UART_SIZE, EFI_MEMORY_XP));
+  UT_ASSERT_TRUE (HasAttributes (HOST_PLIC_BASE, HOST_PLIC_SIZE, EFI_MEMORY_XP));
+
+  Status = RiscVGetMemoryAttributes (HOST_UART_BASE + HOST_UART_SIZE, SIZE_4KB, &Attributes);
+  UT_ASSERT_STATUS_EQUAL (Status, EFI_NO_MAPPING);
+
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Update the attributes of a page and of a 64 KiB group, which splits block entries
+  down to page entries, and restore them, which folds the tables back. Check that
+  the sfence.vma that the library counts are the ones that the hart was asked for.
+
+  @param[in]  Context  The MMU_TEST_MODE.
+
+  @retval  UNIT_TEST_PASSED             The updates took, and the tables were folded.
+  @retval  UNIT_TEST_ERROR_TEST_FAILED  An update failed, or left the tables wrong.
+
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+UpdateAttributes (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  EFI_PHYSICAL_ADDRESS  Page;
+  EFI_PHYSICAL_ADDRESS  Group;
+  RISCV_MMU_STATISTICS  Before;
+  RISCV_MMU_STATISTICS  Statistics;
+  HOST_HART_COUNTERS    CountersBefore;
+  HOST_HART_COUNTERS    Counters;
+  UINT64                Attributes;
+  EFI_STATUS            Status;
+
+  Page  = TEST_UPDATE_BASE + SIZE_1MB + 3 * SIZE_4KB;
+  Group = TEST_UPDATE_BASE + SIZE_16MB + SIZE_64KB;
+  RiscVMmuGetStatistics (&Before);
+  HostHartGetCounters (&CountersBefore);
+
+  //
+  // A page in the middle of a block splits it down to a table of pages, with a
+  // NAPOT entry for each 64 KiB group but the page's.
+  //
+  Status = RiscVSetMemoryAttributes (Page, SIZE_4KB, EFI_MEMORY_WB | EFI_MEMORY_RO | EFI_MEMORY_XP);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  UT_ASSERT_TRUE (HasAttributes (Page, SIZE_4KB, EFI_MEMORY_RO | EFI_MEMORY_XP));
+  UT_ASSERT_TRUE (HasAttributes (Page - SIZE_4KB, SIZE_4KB, 0));
+  UT_ASSERT_TRUE (HasAttributes (Page + SIZE_4KB, SIZE_4KB, 0));
+
+  Status = RiscVGetMemoryAttributes (Page - SIZE_4KB, 3 * SIZE_4KB, &Attributes);
+  UT_ASSERT_STATUS_EQUAL (Status, EFI_NO_MAPPING);
+
+  RiscVMmuGetStatistics (&Statistics);
+  UT_ASSERT_TRUE (Statistics.Splits > Before.Splits);
+  UT_ASSERT_EQUAL (Statistics.LiveTables - Before.LiveTables, Statistics.Splits - Before.Splits);
+  UT_ASSERT_EQUAL (Statistics.Leaves4K - Before.Leaves4K, 16);
+  UT_ASSERT_EQUAL (Statistics.Leaves64K - Before.Leaves64K, 31);
+
+  //
+  // Only the permission that is asked for changes.
+  //
+  Status = RiscVSetMemoryPermissions (Page, SIZE_4KB, 0, EFI_MEMORY_RO);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  UT_ASSERT_TRUE (HasAttributes (Page, SIZE_4KB, EFI_MEMORY_XP));
+
+  //
+  // Restoring the page leaves the tables uniform, and folds them back.
+  //
+  Status = RiscVSetMemoryAttributes (Page, SIZE_4KB, EFI_MEMORY_WB);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  UT_ASSERT_TRUE (HasAttributes (TEST_UPDATE_BASE, SIZE_1GB, 0));
+
+  RiscVMmuGetStatistics (&Statistics);
+  UT_ASSERT_EQUAL (Statistics.LiveTables, Before.LiveTables);
+  UT_ASSERT_EQUAL (Statistics.Folds - Before.Folds, Statistics.Splits - Before.Splits);
+  UT_ASSERT_EQUAL (Statistics.Leaves4K, Before.Leaves4K);
+  UT_ASSERT_TRUE (Statistics.LocalFlushAlls > Before.LocalFlushAlls);
+
+  //
+  // A whole 64 KiB group stays a NAPOT entry.
+  //
+  Status = RiscVSetMemoryAttributes (Group, SIZE_64KB, EFI_MEMORY_WB | EFI_MEMORY_XP);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  UT_ASSERT_TRUE (HasAttributes (Group, SIZE_64KB, EFI_MEMORY_XP));
+  UT_ASSERT_TRUE (HasAttributes (Group + SIZE_64KB, SIZE_64KB, 0));
+
+  RiscVMmuGetStatistics (&Statistics);
+  UT_ASSERT_EQUAL (Statistics.Leaves4K, Before.Leaves4K);
+  UT_ASSERT_EQUAL (Statistics.Leaves64K - Before.Leaves64K, 32);
+
+  Status = RiscVSetMemoryAttributes (Group, SIZE_64KB, EFI_MEMORY_WB);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+
+  Status = RiscVSetMemoryAttributes (Page + 1, SIZE_4KB, EFI_MEMORY_WB);
+  UT_ASSERT_STATUS_EQUAL (Status, EFI_INVALID_PARAMETER);
+
+  //
+  // Every sfence.vma that the library counted was issued, and nothing else.
+  //
+  RiscVMmuGetStatistics (&Statistics);
+  HostHartGetCounters (&Counters);
+  UT_ASSERT_EQUAL (Statistics.LiveTables, Before.LiveTables);
+  UT_ASSERT_EQUAL (Statistics.LocalFlushes - Before.LocalFlushes, Counters.LocalFlushes - CountersBefore.LocalFlushes);
+  UT_ASSERT_EQUAL (Statistics.LocalFlushAlls - Before.LocalFlushAlls, Counters.LocalFlushAlls - CountersBefore.LocalFlushAlls);
+  UT_ASSERT_EQUAL (Statistics.RemoteFlushes - Before.RemoteFlushes, Counters.RemoteFlushes - CountersBefore.RemoteFlushes);
+  UT_ASSERT_TRUE (Counters.RemoteFlushes > CountersBefore.RemoteFlushes);
+
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Protect the sections of an image, the header and code read-only and the header
+  and data non-executable.
+
+  @param[in]  Image  The base of the image.
+
+  @retval  EFI_SUCCESS  The sections are protected.
+  @retval  Others       An update failed.
+
+**/
+STATIC
+EFI_STATUS
+ProtectImage (
+  IN EFI_PHYSICAL_ADDRESS  Image
+  )
+{
+  EFI_STATUS  Status;
+
+  Status = RiscVSetMemoryAttributes (
+             Image,
+             TEST_IMAGE_HEADER_SIZE,
+             EFI_MEMORY_WB | EFI_MEMORY_RO | EFI_MEMORY_XP
+             );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Status = RiscVSetMemoryAttributes (
+             Image + TEST_IMAGE_HEADER_SIZE,
+             TEST_IMAGE_CODE_SIZE,
+             EFI_MEMORY_WB | EFI_MEMORY_RO
+             );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  return RiscVSetMemoryAttributes (
+           Image + TEST_IMAGE_HEADER_SIZE + TEST_IMAGE_CODE_SIZE,
+           TEST_IMAGE_SIZE - TEST_IMAGE_HEADER_SIZE - TEST_IMAGE_CODE_SIZE,
+           EFI_MEMORY_WB | EFI_MEMORY_XP
+           );
+}
+
+/**
+  Protect the sections of images as they are loaded, the header and code read-only
+  and the header and data non-executable, then unload them.
+
+  @param[in]  Context  The MMU_TEST_MODE.
+
+  @retval  UNIT_TEST_PASSED             The sections were protected, and the tables folded back on unload.
+  @retval  UNIT_TEST_ERROR_TEST_FAILED  An update failed, or left the tables wrong.
+
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+ProtectImageSections (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  EFI_PHYSICAL_ADDRESS  Image;
+  UINTN                 Index;
+  BENCHMARK_SNAPSHOT    Snapshot;
+  RISCV_MMU_STATISTICS  Statistics;
+  UINT64                LiveTables;
+  EFI_STATUS            Status;
+
+  BenchmarkStart (&Snapshot);
+  LiveTables = Snapshot.Statistics.LiveTables;
+  for (Index = 0; Index < TEST_IMAGE_COUNT; Index++) {
+    Status = ProtectImage (TEST_IMAGE_REGION_BASE + Index * TEST_IMAGE_STRIDE);
+    UT_ASSERT_NOT_EFI_ERROR (Status);
+  }
+
+  BenchmarkReport ("Image section protection", Context, 3 * TEST_IMAGE_COUNT, &Snapshot);
+
+  for (Index = 0; Index < TEST_IMAGE_COUNT; Index++) {
+    Image = TEST_IMAGE_REGION_BASE + Index * TEST_IMAGE_STRIDE;
+    UT_ASSERT_TRUE (HasAttributes (Image, TEST_IMAGE_HEADER_SIZE, EFI_MEMORY_RO | EFI_MEMORY_XP));
+    UT_ASSERT_TRUE (HasAttributes (Image + TEST_IMAGE_HEADER_SIZE, TEST_IMAGE_CODE_SIZE, EFI_MEMORY_RO));
+    UT_ASSERT_TRUE (
+      HasAttributes (
+        Image + TEST_IMAGE_HEADER_SIZE + TEST_IMAGE_CODE_SIZE,
+        TEST_IMAGE_SIZE - TEST_IMAGE_HEADER_SIZE - TEST_IMAGE_CODE_SIZE,
+        EFI_MEMORY_XP
+        )
+      );
+    UT_ASSERT_TRUE (HasAttributes (Image + TEST_IMAGE_SIZE, TEST_IMAGE_STRIDE - TEST_IMAGE_SIZE, 0));
+  }
+
+  BenchmarkStart (&Snapshot);
+  for (Index = 0; Index < TEST_IMAGE_COUNT; Index++) {
+    Status = RiscVSetMemoryAttributes (
+               TEST_IMAGE_REGION_BASE + Index * TEST_IMAGE_STRIDE,
+               TEST_IMAGE_SIZE,
+               EFI_MEMORY_WB
+               );
+    UT_ASSERT_NOT_EFI_ERROR (Status);
+  }
+
+  BenchmarkReport ("Image unload", Context, TEST_IMAGE_COUNT, &Snapshot);
+
+  UT_ASSERT_TRUE (HasAttributes (TEST_IMAGE_REGION_BASE, TEST_IMAGE_COUNT * TEST_IMAGE_STRIDE, 0));
+  RiscVMmuGetStatistics (&Statistics);
+  UT_ASSERT_EQUAL (Statistics.LiveTables, LiveTables);
+
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Protect the sections of each image in a transaction, as the DXE Core does, then
+  unload them. The sections of an image share one flush, local and remote, at the
+  commit, and an update that gives access is flushed at once.
+
+  @param[in]  Context  The MMU_TEST_MODE.
+
+  @retval  UNIT_TEST_PASSED             The sections were protected, with a flush per image.
+  @retval  UNIT_TEST_ERROR_TEST_FAILED  An update failed, or was flushed before the commit.
+
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+ProtectImageSectionsInTransaction (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  EFI_PHYSICAL_ADDRESS  Image;
+  UINTN                 Index;
+  BENCHMARK_SNAPSHOT    Snapshot;
+  RISCV_MMU_STATISTICS  Statistics;
+  HOST_HART_COUNTERS    Counters;
+  HOST_HART_COUNTERS    CountersBefore;
+  EFI_STATUS            Status;
+
+  BenchmarkStart (&Snapshot);
+  for (Index = 0; Index < TEST_IMAGE_COUNT; Index++) {
+    Image = TEST_IMAGE_REGION_BASE + Index * TEST_IMAGE_STRIDE;
+    HostHartGetCounters (&CountersBefore);
+    RiscVMmuBeginTransaction ();
+    Status = ProtectImage (Image);
+    UT_ASSERT_NOT_EFI_ERROR (Status);
+
+    HostHartGetCounters (&Counters);
+    UT_ASSERT_EQUAL (Counters.LocalFlushes, CountersBefore.LocalFlushes);
+    UT_ASSERT_EQUAL (Counters.LocalFlushAlls, CountersBefore.LocalFlushAlls);
+    UT_ASSERT_EQUAL (Counters.RemoteFlushes, CountersBefore.RemoteFlushes);
+
+    RiscVMmuCommitTransaction ();
+    HostHartGetCounters (&Counters);
+    UT_ASSERT_EQUAL (Counters.RemoteFlushes - CountersBefore.RemoteFlushes, 1);
+  }
+
+  BenchmarkReport ("Image section protection in transactions", Context, 3 * TEST_IMAGE_COUNT, &Snapshot);
+
+  for (Index = 0; Index < TEST_IMAGE_COUNT; Index++) {
+    Image = TEST_IMAGE_REGION_BASE + Index * TEST_IMAGE_STRIDE;
+    UT_ASSERT_TRUE (HasAttributes (Image, TEST_IMAGE_HEADER_SIZE, EFI_MEMORY_RO | EFI_MEMORY_XP));
+    UT_ASSERT_TRUE (HasAttributes (Image + TEST_IMAGE_HEADER_SIZE, TEST_IMAGE_CODE_SIZE, EFI_MEMORY_RO));
+  }
+
+  //
+  // Making the data executable again gives access, which can't wait for the commit.
+  //
+  Image = TEST_IMAGE_REGION_BASE;
+  HostHartGetCounters (&CountersBefore);
+  RiscVMmuBeginTransaction ();
+  Status = RiscVSetMemoryAttributes (
+             Image + TEST_IMAGE_HEADER_SIZE + TEST_IMAGE_CODE_SIZE,
+             TEST_IMAGE_SIZE - TEST_IMAGE_HEADER_SIZE - TEST_IMAGE_CODE_SIZE,
+             EFI_MEMORY_WB
+             );
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+
+  HostHartGetCounters (&Counters);
+  UT_ASSERT_EQUAL (Counters.RemoteFlushes - CountersBefore.RemoteFlushes, 1);
+  RiscVMmuCommitTransaction ();
+
+  for (Index = 0; Index < TEST_IMAGE_COUNT; Index++) {
+    Status = RiscVSetMemoryAttributes (
+               TEST_IMAGE_REGION_BASE + Index * TEST_IMAGE_STRIDE,
+               TEST_IMAGE_SIZE,
+               EFI_MEMORY_WB
+               );
+    UT_ASSERT_NOT_EFI_ERROR (Status);
+  }
+
+  UT_ASSERT_TRUE (HasAttributes (TEST_IMAGE_REGION_BASE, TEST_IMAGE_COUNT * TEST_IMAGE_STRIDE, 0));
+  RiscVMmuGetStatistics (&Statistics);
+  UT_ASSERT_EQUAL (Statistics.LiveTables, Snapshot.Statistics.LiveTables);
+
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Make stacks non-executable as they are allocated, with a guard page below each
+  that an overflow can't write, then free them all at once.
+
+  The library has no attribute to leave a page unmapped, so the guard pages are
+  read-only, which is what catches the writes of a stack that overflows.
+
+  @param[in]  Context  The MMU_TEST_MODE.
+
+  @retval  UNIT_TEST_PASSED             The stacks were guarded, and the tables folded back when freed.
+  @retval  UNIT_TEST_ERROR_TEST_FAILED  An update failed, or left the tables wrong.
+
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+GuardStacks (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  EFI_PHYSICAL_ADDRESS  Stack;
+  UINTN                 Index;
+  BENCHMARK_SNAPSHOT    Snapshot;
+  RISCV_MMU_STATISTICS  Statistics;
+  UINT64                LiveTables;
+  EFI_STATUS            Status;
+
+  BenchmarkStart (&Snapshot);
+  LiveTables = Snapshot.Statistics.LiveTables;
+  for (Index = 0; Index < TEST_STACK_COUNT; Index++) {
+    Stack  = TEST_STACK_REGION_BASE + Index * TEST_STACK_STRIDE;
+    Status = RiscVSetMemoryAttributes (
+               Stack + SIZE_4KB,
+               TEST_STACK_SIZE - SIZE_4KB,
+               EFI_MEMORY_WB | EFI_MEMORY_XP
+               );
+    UT_ASSERT_NOT_EFI_ERROR (Status);
+
+    Status = RiscVSetMemoryAttributes (Stack, SIZE_4KB, EFI_MEMORY_WB | EFI_MEMORY_RO | EFI_MEMORY_XP);
+    UT_ASSERT_NOT_EFI_ERROR (Status);
+  }
+
+  BenchmarkReport ("Stack guards", Context, 2 * TEST_STACK_COUNT, &Snapshot);
+
+  for (Index = 0; Index < TEST_STACK_COUNT; Index++) {
+    Stack = TEST_STACK_REGION_BASE + Index * TEST_STACK_STRIDE;
+    UT_ASSERT_TRUE (HasAttributes (Stack, SIZE_4KB, EFI_MEMORY_RO | EFI_MEMORY_XP));
+    UT_ASSERT_TRUE (HasAttributes (Stack + SIZE_4KB, TEST_STACK_SIZE - SIZE_4KB, EFI_MEMORY_XP));
+    UT_ASSERT_TRUE (HasAttributes (Stack + TEST_STACK_SIZE, TEST_STACK_STRIDE - TEST_STACK_SIZE, 0));
+  }
+
+  BenchmarkStart (&Snapshot);
+  Status = RiscVSetMemoryAttributes (TEST_STACK_REGION_BASE, TEST_STACK_COUNT * TEST_STACK_STRIDE, EFI_MEMORY_WB);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  BenchmarkReport ("Stack release", Context, 1, &Snapshot);
+
+  UT_ASSERT_TRUE (HasAttributes (TEST_STACK_REGION_BASE, TEST_STACK_COUNT * TEST_STACK_STRIDE, 0));
+  RiscVMmuGetStatistics (&Statistics);
+  UT_ASSERT_EQUAL (Statistics.LiveTables, LiveTables);
+
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Map the ECAM and the BARs of PCI devices uncached and non-executable, as PCI
+  enumeration does, then restore the default attributes of MMIO.
+
+  @param[in]  Context  The MMU_TEST_MODE.
+
+  @retval  UNIT_TEST_PASSED             The BARs were mapped, and the tables folded back when restored.
+  @retval  UNIT_TEST_ERROR_TEST_FAILED  An update failed, or left the tables wrong.
+
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+MapMmio (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  EFI_PHYSICAL_ADDRESS  Bars[TEST_BAR_COUNT];
+  EFI_PHYSICAL_ADDRESS  Address;
+  UINT64                Size;
+  UINTN                 Index;
+  BENCHMARK_SNAPSHOT    Snapshot;
+  RISCV_MMU_STATISTICS  Statistics;
+  UINT64                LiveTables;
+  EFI_STATUS            Status;
+
+  BenchmarkStart (&Snapshot);
+  LiveTables = Snapshot.Statistics.LiveTables;
+
+  Status = RiscVSetMemoryAttributes (HOST_ECAM_BASE, HOST_ECAM_SIZE, EFI_MEMORY_UC | EFI_MEMORY_XP);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+
+  Address = HOST_PCI_MMIO_BASE;
+  for (Index = 0; Index < TEST_BAR_COUNT; Index++) {
+    Size        = mBarSizes[Index % ARRAY_SIZE (mBarSizes)];
+    Address     = ALIGN_VALUE (Address, Size);
+    Bars[Index] = Address;
+    Status      = RiscVSetMemoryAttributes (Address, Size, EFI_MEMORY_UC | EFI_MEMORY_XP);
+    UT_ASSERT_NOT_EFI_ERROR (Status);
+    Address += Size;
+  }
+
+  UT_ASSERT_TRUE (Address <= HOST_PCI_MMIO_BASE + HOST_PCI_MMIO_SIZE);
+  BenchmarkReport ("MMIO mapping", Context, TEST_BAR_COUNT + 1, &Snapshot);
+
+  for (Index = 0; Index < TEST_BAR_COUNT; Index++) {
+    UT_ASSERT_TRUE (HasAttributes (Bars[Index], mBarSizes[Index % ARRAY_SIZE (mBarSizes)], EFI_MEMORY_XP));
+  }
+
+  Status = RiscVSetMemoryAttributes (HOST_ECAM_BASE, HOST_ECAM_SIZE, EFI_MEMORY_XP);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  Status = RiscVSetMemoryAttributes (HOST_PCI_MMIO_BASE, HOST_PCI_MMIO_SIZE, EFI_MEMORY_XP);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+
+  RiscVMmuGetStatistics (&Statistics);
+  UT_ASSERT_EQUAL (Statistics.LiveTables, LiveTables);
+
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Run the tests and benchmarks of the library in each SATP mode.
+
+  @retval  EFI_SUCCESS  The tests ran.
+  @retval  Others       The framework could not be initialised.
+
+**/
+EFI_STATUS
+EFIAPI
+RiscVMmuLibUnitTestEntry (
+  VOID
+  )
+{
+  EFI_STATUS                  Status;
+  UNIT_TEST_FRAMEWORK_HANDLE  Framework;
+  UNIT_TEST_SUITE_HANDLE      ModeSuite;
+  UINTN                       Index;
+
+  Framework = NULL;
+
+  DEBUG ((DEBUG_INFO, "%a v%a\n", UNIT_TEST_NAME, UNIT_TEST_VERSION));
+
+  HostPlatformInitialise ();
+
+  Status = InitUnitTestFramework (&Framework, UNIT_TEST_NAME, gEfiCallerBaseName, UNIT_TEST_VERSION);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed in InitUnitTestFramework. Status = %r\n", Status));
+    goto EXIT;
+  }
+
+  for (Index = 0; Index < ARRAY_SIZE (mModes); Index++) {
+    Status = CreateUnitTestSuite (&ModeSuite, Framework, mModes[Index].Name, mModes[Index].Package, NULL, NULL);
+    if (EFI_ERROR (Status)) {
+      DEBUG ((DEBUG_ERROR, "Failed in CreateUnitTestSuite for %a. Status = %r\n", mModes[Index].Name, Status));
+      goto EXIT;
+    }
+
+    AddTestCase (ModeSuite, "Configure the MMU", "Configure", ConfigureMmu, NULL, NULL, &mModes[Index]);
+    AddTestCase (ModeSuite, "Split and fold tables", "Update", UpdateAttributes, MmuConfigured, NULL, &mModes[Index]);
+    AddTestCase (ModeSuite, "Image section protection", "Benchmark", ProtectImageSections, MmuConfigured, NULL, &mModes[Index]);
+    AddTestCase (ModeSuite, "Image section protection in transactions", "Benchmark", ProtectImageSectionsInTransaction, MmuConfigured, NULL, &mModes[Index]);
+    AddTestCase (ModeSuite, "Stack guards", "Benchmark", GuardStacks, MmuConfigured, NULL, &mModes[Index]);
+    AddTestCase (ModeSuite, "MMIO mapping", "Benchmark", MapMmio, MmuConfigured, NULL, &mModes[Index]);
+  }
+
+  Status = RunAllTestSuites (Framework);
+
+EXIT:
+  if (Framework != NULL) {
+    FreeUnitTestFramework (Framework);
+  }
+
+  return Status;
+}
+
+///
+/// Avoid ECC error for function name that starts with lower case letter
+///
+#define RiscVMmuLibUnitTestMain  main
+
+/**
+  Standard POSIX C entry point for host based unit test execution.
+
+  @param[in] Argc  Number of arguments
+  @param[in] Argv  Array of pointers to arguments
+
+  @retval 0      Success
+  @retval other  Error
+**/
+INT32
+RiscVMmuLibUnitTestMain (
+  IN INT32  Argc,
+  IN CHAR8  *Argv[]
+  )
+{
+  return RiscVMmuLibUnitTestEntry ();
+}
@@ -0,0 +1,88 @@
+/** @file
+  Definitions shared by the host-based tests of BaseRiscVMmuLib and the hart and
+  firmware that they run the library on.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef RISCV_MMU_LIB_UNIT_TEST_H_
+#define RISCV_MMU_LIB_UNIT_TEST_H_
+
+#include <Uefi.h>
+
+//
+// The memory space of the platform: the interrupt controller, a UART and the PCI
+// Express ECAM, then a 1 GiB PCI MMIO window, and 4 GiB of DRAM at 2 GiB. The
+// space between them doesn't exist.
+//
+#define HOST_PLIC_BASE      0x0C000000ULL
+#define HOST_PLIC_SIZE      SIZE_64MB
+#define HOST_UART_BASE      0x10000000ULL
+#define HOST_UART_SIZE      SIZE_4KB
+#define HOST_ECAM_BASE      0x30000000ULL
+#define HOST_ECAM_SIZE      SIZE_256MB
+#define HOST_PCI_MMIO_BASE  0x40000000ULL
+#define HOST_PCI_MMIO_SIZE  SIZE_1GB
+#define HOST_DRAM_BASE      0x80000000ULL
+#define HOST_DRAM_SIZE      SIZE_4GB
+
+//
+// The TLB maintenance that the hart was asked to do.
+//
+typedef struct {
+  // The sfence.vma at an address, and for all addresses.
+  UINT64    LocalFlushes;
+  UINT64    LocalFlushAlls;
+  // The SBI remote sfence.vma to the other harts.
+  UINT64    RemoteFlushes;
+} HOST_HART_COUNTERS;
+
+/**
+  Install the DXE services that the library runs on, which describe the memory
+  space of the platform.
+
+**/
+VOID
+HostPlatformInitialise (
+  VOID
+  );
+
+/**
+  Reset the hart, with the MMU off, to a hart that supports the SATP modes up to
+  a mode. Writes of SATP with a deeper mode have no effect, as on hardware.
+
+  The tables that the library built for the previous mode stay allocated.
+
+  @param[in]  SupportedSatpMode  The deepest SATP mode that the hart supports.
+
+**/
+VOID
+HostHartReset (
+  IN UINTN  SupportedSatpMode
+  );
+
+/**
+  Get the TLB maintenance that the hart was asked to do since the start.
+
+  @param[out]  Counters  The counters.
+
+**/
+VOID
+HostHartGetCounters (
+  OUT HOST_HART_COUNTERS  *Counters
+  );
+
+/**
+  Get the time of the host.
+
+  @return  The time, in nanoseconds.
+
+**/
+UINT64
+HostGetTime (
+  VOID
+  );
+
+#endif
@@ -0,0 +1,97 @@
+/** @file
+  Library to walk the page tables of the RISC-V paging modes.
+
+  A walker is stamped out for each paging mode, so that the level count and
+  the shift of each level are constants, and each walk is unrolled.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Base.h>
+#include <Library/BaseLib.h>
+#include <Library/RiscVPageTableLib.h>
+
+//
+// Take one level of a walk. A table entry at the last level is returned as is,
+// for the caller to find that it isn't a leaf.
+//
+#define RISCV_PAGE_TABLE_WALK_LEVEL(Levels, Level)                                          \
+  if ((Level) < (Levels)) {                                                                 \
+    Entry          = Table[RShiftU64 (Address, RISCV_PAGE_TABLE_LEVEL_SHIFT (Levels, Level)) \
+                           & (RISCV_PAGE_TABLE_ENTRY_COUNT - 1)];                            \
+    Entries[Level] = Entry;                                                                  \
+    if (((Level) == (Levels) - 1) || ((Entry & Policy->ValidMask) != Policy->ValidMask) ||   \
+        ((Entry & Policy->LeafMask) != 0))                                                   \
+    {                                                                                        \
+      return (Level) + 1;                                                                    \
+    }                                                                                        \
+                                                                                             \
+    Table = (CONST UINT64 *)(UINTN)LShiftU64 (                                               \
+                                     RShiftU64 (Entry & Policy->PpnMask, Policy->PpnShift),  \
+                                     RISCV_PAGE_TABLE_PAGE_SHIFT                             \
+                                     );                                                      \
+  }
+
+//
+// Stamp out the walker of a paging mode.
+//
+#define RISCV_PAGE_TABLE_WALKER(Name, Levels)     \
+  STATIC                                          \
+  UINTN                                           \
+  Name (                                          \
+    IN  CONST RISCV_PTE_POLICY  *Policy,          \
+    IN  CONST UINT64            *Table,           \
+    IN  UINT64                  Address,          \
+    OUT UINT64                  *Entries          \
+    )                                             \
+  {                                               \
+    UINT64  Entry;                                \
+                                                  \
+    RISCV_PAGE_TABLE_WALK_LEVEL (Levels, 0)       \
+    RISCV_PAGE_TABLE_WALK_LEVEL (Levels, 1)       \
+    RISCV_PAGE_TABLE_WALK_LEVEL (Levels, 2)       \
+    RISCV_PAGE_TABLE_WALK_LEVEL (Levels, 3)       \
+    RISCV_PAGE_TABLE_WALK_LEVEL (Levels, 4)       \
+    return (Levels);                              \
+  }
+
+RISCV_PAGE_TABLE_WALKER (WalkSv39, 3)
+RISCV_PAGE_TABLE_WALKER (WalkSv48, 4)
+RISCV_PAGE_TABLE_WALKER (WalkSv57, 5)
+
+/**
+  Walk a page table for an address, without changing it.
+
+  @param[in]   Policy     The format of the entries.
+  @param[in]   Levels     The levels of the paging mode: 3 for Sv39, 4 for Sv48, or 5 for Sv57.
+  @param[in]   RootTable  The root of the page table.
+  @param[in]   Address    The address, within the reach of the mode.
+  @param[out]  Entries    The entries walked, from the root, until a leaf or an invalid
+                          entry. RISCV_PAGE_TABLE_MAX_LEVELS of them.
+
+  @return  The number of entries walked, or 0 if Levels isn't of a paging mode.
+
+**/
+UINTN
+EFIAPI
+RiscVPageTableWalk (
+  IN  CONST RISCV_PTE_POLICY  *Policy,
+  IN  UINTN                   Levels,
+  IN  CONST UINT64            *RootTable,
+  IN  UINT64                  Address,
+  OUT UINT64                  *Entries
+  )
+{
+  switch (Levels) {
+    case 3:
+      return WalkSv39 (Policy, RootTable, Address, Entries);
+    case 4:
+      return WalkSv48 (Policy, RootTable, Address, Entries);
+    case 5:
+      return WalkSv57 (Policy, RootTable, Address, Entries);
+    default:
+      return 0;
+  }
+}
@@ -0,0 +1,324 @@
+/** @file
+  RISC-V PMU region profiling, through the SBI PMU extension.
+
+  On first use, a counter is configured with SBI for each event and started.
+  Hardware counters are then read directly from their CSRs, which S-mode must
+  be allowed to read (mcounteren), as OpenSBI does. Firmware counters are read
+  through SBI. An event that SBI cannot count is reported as unavailable.
+
+  The counters of different harts are not synchronised, and the regions are
+  kept in a single table without locking, so this instance is meant for
+  profiling on the boot hart, in modules that run from RAM.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseRiscVSbiLib.h>
+#include <Library/DebugLib.h>
+#include <Library/PerformanceLib.h>
+#include <Library/RiscVPmuProfileLib.h>
+
+#define PMU_PROFILE_EVENT_COUNT   4
+#define PMU_PROFILE_REGION_COUNT  32
+
+//
+// The CSR of the first hardware counter, CYCLE, which is also the counter of index 0.
+//
+#define PMU_PROFILE_COUNTER_CSR_BASE   0xC00
+#define PMU_PROFILE_COUNTER_CSR_COUNT  32
+
+typedef struct {
+  CONST CHAR8    *Name;
+  UINTN          EventIndex;
+  // Whether SBI configured a counter for the event.
+  BOOLEAN        Available;
+  BOOLEAN        Firmware;
+  UINTN          CounterIndex;
+  UINTN          CsrIndex;
+  UINT64         WidthMask;
+} PMU_PROFILE_EVENT;
+
+typedef struct {
+  CONST CHAR8    *Name;
+  UINTN          Depth;
+  UINT64         Calls;
+  UINT64         Start[PMU_PROFILE_EVENT_COUNT];
+  UINT64         Total[PMU_PROFILE_EVENT_COUNT];
+} PMU_PROFILE_REGION;
+
+STATIC PMU_PROFILE_EVENT  mEvents[PMU_PROFILE_EVENT_COUNT] = {
+  { "cycles",       SBI_PMU_HW_CPU_CYCLES   },
+  { "instructions", SBI_PMU_HW_INSTRUCTIONS },
+  {
+    "l1d-read-misses",
+    SBI_PMU_HW_CACHE_EVENT (SBI_PMU_HW_CACHE_L1D, SBI_PMU_HW_CACHE_OP_READ, SBI_PMU_HW_CACHE_RESULT_MISS)
+  },
+  {
+    "dtlb-read-misses",
+    SBI_PMU_HW_CACHE_EVENT (SBI_PMU_HW_CACHE_DTLB, SBI_PMU_HW_CACHE_OP_READ, SBI_PMU_HW_CACHE_RESULT_MISS)
+  },
+};
+
+STATIC BOOLEAN             mPmuProbed = FALSE;
+STATIC BOOLEAN             mPmuUsable = FALSE;
+STATIC PMU_PROFILE_REGION  mRegions[PMU_PROFILE_REGION_COUNT];
+STATIC UINTN               mRegionCount = 0;
+
+/**
+  Read a hardware performance counter.
+
+  @param[in]  CsrIndex  The index of the counter's CSR from CYCLE, below 32.
+
+  @return The value of the counter.
+
+**/
+UINT64
+InternalRiscVReadHpmCounter (
+  IN UINTN  CsrIndex
+  );
+
+/**
+  Configure and start a counter for each event, on first use.
+
+  @retval TRUE   At least one event is counted.
+  @retval FALSE  SBI does not implement the PMU extension, or counts none of the events.
+
+**/
+STATIC
+BOOLEAN
+PmuProfileSetup (
+  VOID
+  )
+{
+  SBI_RET     Ret;
+  UINTN       NumCounters;
+  UINTN       CounterMask;
+  UINTN       CounterInfo;
+  UINTN       Csr;
+  UINTN       Index;
+  EFI_STATUS  Status;
+
+  if (mPmuProbed) {
+    return mPmuUsable;
+  }
+
+  mPmuProbed = TRUE;
+
+  Ret = SbiCall (SBI_EXT_BASE, SBI_EXT_BASE_PROBE_EXT, 1, SBI_EXT_PMU);
+  if ((Ret.Error != SBI_SUCCESS) || (Ret.Value == 0)) {
+    DEBUG ((DEBUG_INFO, "%a: SBI does not implement the PMU extension\n", __func__));
+    return FALSE;
+  }
+
+  Status = SbiPmuNumCounters (&NumCounters);
+  if (EFI_ERROR (Status) || (NumCounters == 0)) {
+    return FALSE;
+  }
+
+  CounterMask = (NumCounters >= sizeof (UINTN) * 8) ? MAX_UINTN : (((UINTN)1 << NumCounters) - 1);
+
+  for (Index = 0; Index < PMU_PROFILE_EVENT_COUNT; Index++) {
+    Status = SbiPmuCounterConfigMatching (
+               0,
+               CounterMask,
+               SBI_PMU_CFG_FLAG_CLEAR_VALUE | SBI_PMU_CFG_FLAG_AUTO_START,
+               mEvents[Index].EventIndex,
+               0,
+               &mEvents[Index].CounterIndex
+               );
+    if (EFI_ERROR (Status)) {
+      //
+      // The cycle counter may already have been claimed, for instance by a TimerLib
+      // counting cycles, and is then running already.
+      //
+      if (mEvents[Index].EventIndex != SBI_PMU_HW_CPU_CYCLES) {
+        DEBUG ((DEBUG_INFO, "%a: %a is not counted: %r\n", __func__, mEvents[Index].Name, Status));
+        continue;
+      }
+
+      mEvents[Index].CounterIndex = 0;
+    }
+
+    Status = SbiPmuCounterGetInfo (mEvents[Index].CounterIndex, &CounterInfo);
+    if (EFI_ERROR (Status)) {
+      continue;
+    }
+
+    if ((CounterInfo & SBI_PMU_COUNTER_INFO_FIRMWARE) != 0) {
+      mEvents[Index].Firmware  = TRUE;
+      mEvents[Index].WidthMask = MAX_UINT64;
+    } else {
+      Csr = SBI_PMU_COUNTER_INFO_CSR (CounterInfo);
+      if ((Csr < PMU_PROFILE_COUNTER_CSR_BASE) ||
+          (Csr >= PMU_PROFILE_COUNTER_CSR_BASE + PMU_PROFILE_COUNTER_CSR_COUNT))
+      {
+        continue;
+      }
+
+      mEvents[Index].CsrIndex  = Csr - PMU_PROFILE_COUNTER_CSR_BASE;
+      mEvents[Index].WidthMask = (SBI_PMU_COUNTER_INFO_WIDTH (CounterInfo) >= 64) ?
+                                 MAX_UINT64 : (LShiftU64 (1, SBI_PMU_COUNTER_INFO_WIDTH (CounterInfo)) - 1);
+    }
+
+    mEvents[Index].Available = TRUE;
+    mPmuUsable               = TRUE;
+  }
+
+  return mPmuUsable;
+}
+
+/**
+  Read the counter of each available event.
+
+  @param[out]  Values  The value of each event's counter.
+
+**/
+STATIC
+VOID
+PmuProfileReadCounters (
+  OUT UINT64  *Values
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < PMU_PROFILE_EVENT_COUNT; Index++) {
+    Values[Index] = 0;
+    if (!mEvents[Index].Available) {
+      continue;
+    }
+
+    if (mEvents[Index].Firmware) {
+      SbiPmuCounterFirmwareRead (mEvents[Index].CounterIndex, &Values[Index]);
+    } else {
+      Values[Index] = InternalRiscVReadHpmCounter (mEvents[Index].CsrIndex);
+    }
+  }
+}
+
+/**
+  Find the region of a name, optionally adding it.
+
+  @param[in]  Name  The name of the region.
+  @param[in]  Add   Whether to add the region if it is not known.
+
+  @return The region, or NULL if it is not known and cannot be added.
+
+**/
+STATIC
+PMU_PROFILE_REGION *
+PmuProfileFindRegion (
+  IN CONST CHAR8  *Name,
+  IN BOOLEAN      Add
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < mRegionCount; Index++) {
+    if ((mRegions[Index].Name == Name) || (AsciiStrCmp (mRegions[Index].Name, Name) == 0)) {
+      return &mRegions[Index];
+    }
+  }
+
+  if (!Add || (mRegionCount == PMU_PROFILE_REGION_COUNT)) {
+    return NULL;
+  }
+
+  mRegions[mRegionCount].Name = Name;
+  return &mRegions[mRegionCount++];
+}
+
+/**
+  Start measuring a region.
+
+  Regions may nest, and the outermost call of a recursive region is the one measured.
+
+  @param[in]  Region  The name of the region, which must remain valid.
+
+**/
+VOID
+EFIAPI
+RiscVPmuProfileBegin (
+  IN CONST CHAR8  *Region
+  )
+{
+  PMU_PROFILE_REGION  *Entry;
+
+  PERF_START (NULL, Region, NULL, 0);
+
+  if (!PmuProfileSetup ()) {
+    return;
+  }
+
+  Entry = PmuProfileFindRegion (Region, TRUE);
+  if (Entry == NULL) {
+    return;
+  }
+
+  if (Entry->Depth++ == 0) {
+    PmuProfileReadCounters (Entry->Start);
+  }
+}
+
+/**
+  Stop measuring a region, and accumulate its events.
+
+  @param[in]  Region  The name of the region, as passed to RiscVPmuProfileBegin().
+
+**/
+VOID
+EFIAPI
+RiscVPmuProfileEnd (
+  IN CONST CHAR8  *Region
+  )
+{
+  PMU_PROFILE_REGION  *Entry;
+  UINT64              Values[PMU_PROFILE_EVENT_COUNT];
+  UINTN               Index;
+
+  if (mPmuUsable) {
+    Entry = PmuProfileFindRegion (Region, FALSE);
+    if ((Entry != NULL) && (Entry->Depth > 0) && (--Entry->Depth == 0)) {
+      PmuProfileReadCounters (Values);
+      for (Index = 0; Index < PMU_PROFILE_EVENT_COUNT; Index++) {
+        Entry->Total[Index] += (Values[Index] - Entry->Start[Index]) & mEvents[Index].WidthMask;
+      }
+
+      Entry->Calls++;
+    }
+  }
+
+  PERF_END (NULL, Region, NULL, 0);
+}
+
+/**
+  Report the events accumulated for each region, with DEBUG_INFO.
+
+**/
+VOID
+EFIAPI
+RiscVPmuProfileDump (
+  VOID
+  )
+{
+  UINTN  RegionIndex;
+  UINTN  Index;
+
+  if (!mPmuUsable) {
+    return;
+  }
+
+  for (RegionIndex = 0; RegionIndex < mRegionCount; RegionIndex++) {
+    DEBUG ((DEBUG_INFO, "PMU profile: %a, %ld calls\n", mRegions[RegionIndex].Name, mRegions[RegionIndex].Calls));
+    for (Index = 0; Index < PMU_PROFILE_EVENT_COUNT; Index++) {
+      if (mEvents[Index].Available) {
+        DEBUG ((DEBUG_INFO, "  %-18a %ld\n", mEvents[Index].Name, mRegions[RegionIndex].Total[Index]));
+      } else {
+        DEBUG ((DEBUG_INFO, "  %-18a unavailable\n", mEvents[Index].Name));
+      }
+    }
+  }
+}
@@ -0,0 +1,50 @@
+/** @file
+  Null RISC-V PMU region profiling library, which measures nothing.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Base.h>
+#include <Library/RiscVPmuProfileLib.h>
+
+/**
+  Start measuring a region.
+
+  @param[in]  Region  The name of the region.
+
+**/
+VOID
+EFIAPI
+RiscVPmuProfileBegin (
+  IN CONST CHAR8  *Region
+  )
+{
+}
+
+/**
+  Stop measuring a region.
+
+  @param[in]  Region  The name of the region.
+
+**/
+VOID
+EFIAPI
+RiscVPmuProfileEnd (
+  IN CONST CHAR8  *Region
+  )
+{
+}
+
+/**
+  Report the events accumulated for each region.
+
+**/
+VOID
+EFIAPI
+RiscVPmuProfileDump (
+  VOID
+  )
+{
+}
@@ -0,0 +1,364 @@
+/** @file
+  Library to validate the RISC-V IO Mapping Table and build its model.
+
+  The node walk trusts no length of the table: every node header, node, and
+  array in a node is checked against the bounds that contain it, before it's
+  read.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Uefi.h>
+#include <IndustryStandard/RiscVIoMappingTable.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/RiscVRimtLib.h>
+
+/**
+  Check that an array lies within its node.
+
+  @param[in]  Node         The node.
+  @param[in]  ArrayOffset  The offset of the array from the node.
+  @param[in]  Count        The number of elements.
+  @param[in]  ElementSize  The size of an element.
+
+  @retval  TRUE   The array lies within the node, or is empty.
+  @retval  FALSE  The array extends past the node.
+
+**/
+STATIC
+BOOLEAN
+IsArrayInNode (
+  IN CONST RIMT_NODE_HEADER  *Node,
+  IN UINT32                  ArrayOffset,
+  IN UINT32                  Count,
+  IN UINT32                  ElementSize
+  )
+{
+  if (Count == 0) {
+    return TRUE;
+  }
+
+  return (ArrayOffset <= Node->Length) &&
+         ((UINT64)Count * ElementSize <= (UINT64)(Node->Length - ArrayOffset));
+}
+
+/**
+  Get the ID mapping array of a root complex or platform device node.
+
+  @param[in]   Node       The node.
+  @param[out]  Mappings   The ID mapping array.
+  @param[out]  Count      The number of ID mappings, 0 for other nodes.
+
+  @retval  TRUE   The node is well-formed.
+  @retval  FALSE  The node is too short, or its array extends past it.
+
+**/
+STATIC
+BOOLEAN
+GetIdMappings (
+  IN  CONST RIMT_NODE_HEADER           *Node,
+  OUT CONST RIMT_PCIE_NODE_ID_MAPPING  **Mappings,
+  OUT UINT32                           *Count
+  )
+{
+  UINT16  ArrayOffset;
+
+  *Count = 0;
+  switch (Node->Type) {
+    case PCIE_ROOT_COMPLEX_NODE_TYPE:
+      if (Node->Length < sizeof (RIMT_PCIE_NODE)) {
+        return FALSE;
+      }
+
+      ArrayOffset = ((CONST RIMT_PCIE_NODE *)Node)->IdMappingArrayOffset;
+      *Count      = ((CONST RIMT_PCIE_NODE *)Node)->NumberOfIdMappings;
+      break;
+
+    case PLATFORM_DEVICE_NODE_TYPE:
+      if (Node->Length < sizeof (RIMT_PLATFORM_DEVICE_NODE)) {
+        return FALSE;
+      }
+
+      ArrayOffset = ((CONST RIMT_PLATFORM_DEVICE_NODE *)Node)->IdMappingArrayOffset;
+      *Count      = ((CONST RIMT_PLATFORM_DEVICE_NODE *)Node)->NumberOfIdMappings;
+      break;
+
+    default:
+      return TRUE;
+  }
+
+  *Mappings = (CONST RIMT_PCIE_NODE_ID_MAPPING *)((CONST UINT8 *)Node + ArrayOffset);
+  return IsArrayInNode (Node, ArrayOffset, *Count, sizeof (RIMT_PCIE_NODE_ID_MAPPING));
+}
+
+/**
+  Walk the nodes of a RIMT, checking every node, and count the IOMMUs and ID mappings.
+
+  @param[in]   Rimt                The RIMT.
+  @param[out]  NumberOfIoMmus      The number of IOMMU nodes.
+  @param[out]  NumberOfIdMappings  The number of ID mappings, including those that will be dropped.
+
+  @retval  TRUE   Every node is well-formed.
+  @retval  FALSE  A node is malformed.
+
+**/
+STATIC
+BOOLEAN
+CheckNodes (
+  IN  CONST EFI_ACPI_RIMT_HEADER  *Rimt,
+  OUT UINT32                      *NumberOfIoMmus,
+  OUT UINT32                      *NumberOfIdMappings
+  )
+{
+  CONST RIMT_NODE_HEADER           *Node;
+  CONST RIMT_IOMMU_NODE            *IoMmuNode;
+  CONST RIMT_PCIE_NODE_ID_MAPPING  *Mappings;
+  UINT32                           Offset;
+  UINT32                           Index;
+  UINT32                           Count;
+
+  *NumberOfIoMmus     = 0;
+  *NumberOfIdMappings = 0;
+
+  Offset = Rimt->OffsetToNodeArray;
+  for (Index = 0; Index < Rimt->NumberOfNodes; Index++) {
+    if ((Offset > Rimt->Header.Length) || (Rimt->Header.Length - Offset < sizeof (RIMT_NODE_HEADER))) {
+      DEBUG ((DEBUG_ERROR, "%a: Node %u at 0x%x is past the table\n", __func__, Index, Offset));
+      return FALSE;
+    }
+
+    Node = (CONST RIMT_NODE_HEADER *)((CONST UINT8 *)Rimt + Offset);
+    if ((Node->Length < sizeof (RIMT_NODE_HEADER)) || (Node->Length > Rimt->Header.Length - Offset)) {
+      DEBUG ((DEBUG_ERROR, "%a: Node %u at 0x%x has a bad length 0x%x\n", __func__, Index, Offset, Node->Length));
+      return FALSE;
+    }
+
+    if (Node->Type == RISCV_IOMMU_NODE_TYPE) {
+      IoMmuNode = (CONST RIMT_IOMMU_NODE *)Node;
+      if ((Node->Length < sizeof (RIMT_IOMMU_NODE)) ||
+          !IsArrayInNode (
+             Node,
+             IoMmuNode->InterruptWireArrayOffset,
+             IoMmuNode->NumberOfInterruptWires,
+             sizeof (RIMT_IOMMU_NODE_INTERRUPT_WIRE)
+             ))
+      {
+        DEBUG ((DEBUG_ERROR, "%a: IOMMU node at 0x%x is malformed\n", __func__, Offset));
+        return FALSE;
+      }
+
+      (*NumberOfIoMmus)++;
+    } else {
+      if (!GetIdMappings (Node, &Mappings, &Count)) {
+        DEBUG ((DEBUG_ERROR, "%a: Node at 0x%x has a malformed ID mapping array\n", __func__, Offset));
+        return FALSE;
+      }
+
+      *NumberOfIdMappings += Count;
+    }
+
+    Offset += Node->Length;
+  }
+
+  return TRUE;
+}
+
+/**
+  Validate a RIMT, and build its model.
+
+  Every node must lie within the table, and every interrupt wire and ID mapping
+  array within its node. Nodes of unknown types are skipped. ID mappings of no
+  IDs, or to an offset that isn't an IOMMU node, are dropped.
+
+  @param[in]   Table  The RIMT.
+  @param[out]  Info   The model, in pool memory that the caller frees.
+
+  @retval  EFI_SUCCESS            The model was built.
+  @retval  EFI_INVALID_PARAMETER  Table or Info is NULL.
+  @retval  EFI_VOLUME_CORRUPTED   The table is malformed.
+  @retval  EFI_OUT_OF_RESOURCES   The model couldn't be allocated.
+
+**/
+EFI_STATUS
+EFIAPI
+RiscVRimtParse (
+  IN  CONST VOID       *Table,
+  OUT RISCV_RIMT_INFO  **Info
+  )
+{
+  CONST EFI_ACPI_RIMT_HEADER       *Rimt;
+  CONST RIMT_NODE_HEADER           *Node;
+  CONST RIMT_IOMMU_NODE            *IoMmuNode;
+  CONST RIMT_PCIE_NODE_ID_MAPPING  *Mappings;
+  RISCV_RIMT_INFO                  *Model;
+  RISCV_RIMT_IOMMU                 *IoMmus;
+  RISCV_RIMT_ID_MAPPING            *IdMapping;
+  UINT32                           NumberOfIoMmus;
+  UINT32                           NumberOfIdMappings;
+  UINT32                           Offset;
+  UINT32                           Index;
+  UINT32                           MappingIndex;
+  UINT32                           IoMmuIndex;
+  UINT32                           Count;
+
+  if ((Table == NULL) || (Info == NULL)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Rimt = Table;
+  if ((Rimt->Header.Signature != EFI_ACPI_RISCV_IO_MAPPING_TABLE_SIGNATURE) ||
+      (Rimt->Header.Length < sizeof (EFI_ACPI_RIMT_HEADER)) ||
+      (Rimt->OffsetToNodeArray < sizeof (EFI_ACPI_RIMT_HEADER)) ||
+      (Rimt->OffsetToNodeArray > Rimt->Header.Length))
+  {
+    DEBUG ((DEBUG_ERROR, "%a: Malformed table header\n", __func__));
+    return EFI_VOLUME_CORRUPTED;
+  }
+
+  if (CalculateSum8 ((CONST UINT8 *)Rimt, Rimt->Header.Length) != 0) {
+    DEBUG ((DEBUG_WARN, "%a: Bad checksum\n", __func__));
+  }
+
+  if (!CheckNodes (Rimt, &NumberOfIoMmus, &NumberOfIdMappings)) {
+    return EFI_VOLUME_CORRUPTED;
+  }
+
+  Model = AllocateZeroPool (
+            sizeof (RISCV_RIMT_INFO) +
+            (UINTN)NumberOfIoMmus * sizeof (RISCV_RIMT_IOMMU) +
+            (UINTN)NumberOfIdMappings * sizeof (RISCV_RIMT_ID_MAPPING)
+            );
+  if (Model == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Model->Signature      = RISCV_RIMT_INFO_SIGNATURE;
+  Model->Revision       = RISCV_RIMT_INFO_REVISION;
+  Model->NumberOfIoMmus = NumberOfIoMmus;
+
+  //
+  // The IOMMUs first, so that the ID mappings can be resolved to them.
+  //
+  IoMmus = RISCV_RIMT_INFO_IOMMUS (Model);
+  Offset = Rimt->OffsetToNodeArray;
+  for (Index = 0, IoMmuIndex = 0; Index < Rimt->NumberOfNodes; Index++) {
+    Node = (CONST RIMT_NODE_HEADER *)((CONST UINT8 *)Rimt + Offset);
+    if (Node->Type == RISCV_IOMMU_NODE_TYPE) {
+      IoMmuNode                                 = (CONST RIMT_IOMMU_NODE *)Node;
+      IoMmus[IoMmuIndex].NodeOffset             = Offset;
+      IoMmus[IoMmuIndex].Flags                  = IoMmuNode->Flags;
+      IoMmus[IoMmuIndex].NumberOfInterruptWires = IoMmuNode->NumberOfInterruptWires;
+      if ((IoMmuNode->Flags & IOMMU_NODE_FLAG_PCIE_DEVICE) != 0) {
+        IoMmus[IoMmuIndex].PcieSegment = IoMmuNode->PcieSegment;
+        IoMmus[IoMmuIndex].PcieBdf     = IoMmuNode->PcieBdf;
+      } else {
+        IoMmus[IoMmuIndex].BaseAddress = IoMmuNode->BaseAddress;
+      }
+
+      if ((IoMmuNode->Flags & IOMMU_NODE_FLAG_PROXIMITY_DOMAIN_VALID) != 0) {
+        IoMmus[IoMmuIndex].ProximityDomain = IoMmuNode->ProximityDomain;
+      }
+
+      IoMmuIndex++;
+    }
+
+    Offset += Node->Length;
+  }
+
+  //
+  // Then the intervals of the root complexes and platform devices.
+  //
+  IdMapping = RISCV_RIMT_INFO_ID_MAPPINGS (Model);
+  Offset    = Rimt->OffsetToNodeArray;
+  for (Index = 0; Index < Rimt->NumberOfNodes; Index++) {
+    Node = (CONST RIMT_NODE_HEADER *)((CONST UINT8 *)Rimt + Offset);
+    GetIdMappings (Node, &Mappings, &Count);
+    for (MappingIndex = 0; MappingIndex < Count; MappingIndex++) {
+      if (Mappings[MappingIndex].NumberOfIds == 0) {
+        continue;
+      }
+
+      for (IoMmuIndex = 0; IoMmuIndex < NumberOfIoMmus; IoMmuIndex++) {
+        if (IoMmus[IoMmuIndex].NodeOffset == Mappings[MappingIndex].DestinationIoMmuOffset) {
+          break;
+        }
+      }
+
+      if (IoMmuIndex == NumberOfIoMmus) {
+        DEBUG ((
+          DEBUG_WARN,
+          "%a: Dropping an ID mapping of node 0x%x to 0x%x, which isn't an IOMMU\n",
+          __func__,
+          Offset,
+          Mappings[MappingIndex].DestinationIoMmuOffset
+          ));
+        continue;
+      }
+
+      IdMapping->IoMmuIndex       = IoMmuIndex;
+      IdMapping->SourceNodeOffset = Offset;
+      IdMapping->SourceIdBase     = Mappings[MappingIndex].SourceIdBase;
+      IdMapping->NumberOfIds      = Mappings[MappingIndex].NumberOfIds;
+      IdMapping->DeviceIdBase     = Mappings[MappingIndex].DestinationDeviceIdBase;
+      IdMapping->MappingFlags     = Mappings[MappingIndex].Flags;
+      if (Node->Type == PCIE_ROOT_COMPLEX_NODE_TYPE) {
+        IdMapping->SourceType  = RISCV_RIMT_SOURCE_PCIE_ROOT_COMPLEX;
+        IdMapping->SourceFlags = ((CONST RIMT_PCIE_NODE *)Node)->Flags;
+        IdMapping->PcieSegment = ((CONST RIMT_PCIE_NODE *)Node)->PcieSegment;
+      } else {
+        IdMapping->SourceType = RISCV_RIMT_SOURCE_PLATFORM_DEVICE;
+      }
+
+      IdMapping++;
+      Model->NumberOfIdMappings++;
+    }
+
+    Offset += Node->Length;
+  }
+
+  *Info = Model;
+  return EFI_SUCCESS;
+}
+
+/**
+  Validate a model of the RIMT, such as one found in a HOB.
+
+  @param[in]  Info      The model.
+  @param[in]  InfoSize  The size of the buffer holding the model.
+
+  @retval  TRUE   The model is consistent, and its ID mappings reference its IOMMUs.
+  @retval  FALSE  The model is malformed, or of another revision.
+
+**/
+BOOLEAN
+EFIAPI
+RiscVRimtIsValidInfo (
+  IN CONST RISCV_RIMT_INFO  *Info,
+  IN UINTN                  InfoSize
+  )
+{
+  CONST RISCV_RIMT_ID_MAPPING  *IdMappings;
+  UINT32                       Index;
+
+  if ((Info == NULL) || (InfoSize < sizeof (RISCV_RIMT_INFO)) ||
+      (Info->Signature != RISCV_RIMT_INFO_SIGNATURE) ||
+      (Info->Revision != RISCV_RIMT_INFO_REVISION) ||
+      (RISCV_RIMT_INFO_SIZE (Info) > InfoSize))
+  {
+    return FALSE;
+  }
+
+  IdMappings = RISCV_RIMT_INFO_ID_MAPPINGS (Info);
+  for (Index = 0; Index < Info->NumberOfIdMappings; Index++) {
+    if ((IdMappings[Index].IoMmuIndex >= Info->NumberOfIoMmus) || (IdMappings[Index].NumberOfIds == 0)) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
@@ -22,6 +22,35 @@ SupervisorModeTrap (
   VOID
   );
 
+/**
+  Vector table for stvec vectored mode, of SMODE_TRAP_VECTORS entries
+**/
+VOID
+EFIAPI
+SupervisorModeTrapVectors (
+  VOID
+  );
+
+//
+// Number of entries of the vector table, covering the local interrupts
+// 1 to 63 after the entry for exceptions.
+//
+#define SMODE_TRAP_VECTORS  64
+
+#define STVEC_MODE_VECTORED  1
+
+/**
+  Turn the vector unit on in the initial state, if the hart has one.
+
+  @retval  TRUE   The hart implements V, and sstatus.VS is no longer Off.
+  @retval  FALSE  The hart lacks V.
+**/
+BOOLEAN
+EFIAPI
+RiscVEnableVectorUnit (
+  VOID
+  );
+
 //
 // Index of SMode trap register
 //
@@ -65,6 +94,19 @@ SupervisorModeTrap (
 #define SMODE_TRAP_REGS_OFFSET(x)  ((SMODE_TRAP_REGS_##x) * __SIZEOF_POINTER__)
 #define SMODE_TRAP_REGS_SIZE  SMODE_TRAP_REGS_OFFSET(last)
 
+//
+// Index of the vector CSRs saved below the trap registers when sstatus.VS
+// is Dirty at the trap. The 32 vector registers follow, of vlenb bytes each.
+//
+#define SMODE_VECTOR_REGS_vstart  0
+#define SMODE_VECTOR_REGS_vl      1
+#define SMODE_VECTOR_REGS_vtype   2
+#define SMODE_VECTOR_REGS_vcsr    3
+#define SMODE_VECTOR_REGS_last    4
+
+#define SMODE_VECTOR_REGS_OFFSET(x)  ((SMODE_VECTOR_REGS_##x) * __SIZEOF_POINTER__)
+#define SMODE_VECTOR_CSRS_SIZE  SMODE_VECTOR_REGS_OFFSET(last)
+
 #pragma pack(1)
 typedef struct {
   //
@@ -16,6 +16,7 @@
 #include <Library/BaseLib.h>
 #include <Library/SerialPortLib.h>
 #include <Library/PrintLib.h>
+#include <Library/PcdLib.h>
 #include <Register/RiscV64/RiscVEncoding.h>
 #include "Backtrace.h"
 #include "ExceptionHandler.h"
@@ -63,6 +64,10 @@ STATIC CONST CHAR8  *mIrqNameStr[EXCEPT_RISCV_MAX_IRQS + 1] = {
   "EXCEPT_RISCV_IRQ_SOFT_FROM_MMODE",
   "EXCEPT_RISCV_IRQ_4",
   "EXCEPT_RISCV_IRQ_TIMER_FROM_SMODE",
+  "EXCEPT_RISCV_IRQ_TIMER_FROM_VSMODE",
+  "EXCEPT_RISCV_IRQ_TIMER_FROM_MMODE",
+  "EXCEPT_RISCV_IRQ_8",
+  "EXCEPT_RISCV_IRQ_EXT_FROM_SMODE",
 };
 
 /**
@@ -212,7 +217,12 @@ InitializeCpuExceptionHandlers (
   IN EFI_VECTOR_HANDOFF_INFO  *VectorInfo OPTIONAL
   )
 {
-  RiscVSetSupervisorStvec ((UINT64)SupervisorModeTrap);
+  if (FixedPcdGetBool (PcdRiscVVectoredInterrupts)) {
+    RiscVSetSupervisorStvec ((UINT64)SupervisorModeTrapVectors | STVEC_MODE_VECTORED);
+  } else {
+    RiscVSetSupervisorStvec ((UINT64)SupervisorModeTrap);
+  }
+
   return EFI_SUCCESS;
 }
 
@@ -300,6 +310,42 @@ InitializeSeparateExceptionStacks (
   return EFI_SUCCESS;
 }
 
+/**
+  Turn the vector unit on at its first use.
+
+  The unit is Off until code uses it, so that traps never save the state of
+  code that doesn't. The first vector instruction then raises an illegal
+  instruction exception, and is retried with the unit in the initial state.
+  An instruction that is illegal for another reason traps again with the unit
+  on, and is reported as usual.
+
+  @param[in, out]  SmodeTrapReg  Registers before the exception occurred.
+
+  @retval  TRUE   The unit was turned on, and the instruction is retried.
+  @retval  FALSE  The unit was already on, or the hart lacks V.
+
+**/
+STATIC
+BOOLEAN
+EnableVectorOnFirstUse (
+  IN OUT SMODE_TRAP_REGISTERS  *SmodeTrapReg
+  )
+{
+  if ((SmodeTrapReg->sstatus & MSTATUS_VS) != 0) {
+    return FALSE;
+  }
+
+  if (!RiscVEnableVectorUnit ()) {
+    return FALSE;
+  }
+
+  //
+  // sstatus is restored from the context on return.
+  //
+  SmodeTrapReg->sstatus |= MSTATUS_VS_INITIAL;
+  return TRUE;
+}
+
 /**
   Supervisor mode trap handler.
 
@@ -328,6 +374,10 @@ RiscVSupervisorModeTrapHandler (
       return;
     }
   } else {
+    if ((ExceptionType == EXCEPT_RISCV_ILLEGAL_INST) && EnableVectorOnFirstUse (SmodeTrapReg)) {
+      return;
+    }
+
     if ((ExceptionType <= EXCEPT_RISCV_MAX_EXCEPTIONS) &&
         (mExceptionHandlers[ExceptionType] != 0))
     {
@@ -339,3 +389,34 @@ RiscVSupervisorModeTrapHandler (
   DumpCpuContext (ExceptionType, RiscVSystemContext);
   CpuDeadLoop ();
 }
+
+/**
+  Supervisor mode interrupt handler, entered through the vector table.
+
+  @param[in]  SmodeTrapReg     Caller-saved registers before the interrupt
+                               occurred. s1-s11 are not saved.
+
+**/
+VOID
+RiscVSupervisorModeInterruptHandler (
+  SMODE_TRAP_REGISTERS  *SmodeTrapReg
+  )
+{
+  EFI_EXCEPTION_TYPE  ExceptionType;
+  EFI_SYSTEM_CONTEXT  RiscVSystemContext;
+  UINTN               IrqIndex;
+
+  RiscVSystemContext.SystemContextRiscV64 = (EFI_SYSTEM_CONTEXT_RISCV64 *)SmodeTrapReg;
+  ExceptionType                           = (UINTN)RiscVGetSupervisorTrapCause ();
+  IrqIndex                                = EXCEPT_RISCV_IRQ_INDEX (ExceptionType);
+
+  if ((IrqIndex <= EXCEPT_RISCV_MAX_IRQS) &&
+      (mIrqHandlers[IrqIndex] != NULL))
+  {
+    mIrqHandlers[IrqIndex](ExceptionType, RiscVSystemContext);
+    return;
+  }
+
+  DumpCpuContext (ExceptionType, RiscVSystemContext);
+  CpuDeadLoop ();
+}
@@ -0,0 +1,375 @@
+/** @file
+  Library to spread independent boot work over all harts, on the MP services protocol.
+
+  Each processor owns a deque, which is a range of task numbers packed into one
+  64-bit word, so that every operation on it is a single compare-and-swap. The
+  owner takes tasks from the bottom of its range, and a thief takes the top half
+  of another's, and then works from its own deque. The boot hart starts the APs
+  in non-blocking mode, works alongside them, and waits for the count of tasks
+  left to reach zero, and then for every AP to leave the pool.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/RiscVHartLocalLib.h>
+#include <Library/RiscVTaskPoolLib.h>
+#include <Library/SynchronizationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Protocol/MpService.h>
+
+#define TASK_RANGE(Begin, End)  (LShiftU64 ((End), 32) | (Begin))
+#define TASK_RANGE_BEGIN(Range)  ((UINT32)(Range))
+#define TASK_RANGE_END(Range)    ((UINT32)RShiftU64 ((Range), 32))
+
+//
+// Each deque has a cache block to itself, so that harts that work from their own
+// don't contend.
+//
+typedef struct {
+  volatile UINT64    Range;
+  UINT64             Reserved[7];
+} TASK_DEQUE;
+
+typedef struct {
+  RISCV_TASK_PROCEDURE        Procedure;
+  VOID                        *Context;
+  TASK_DEQUE                  *Deques;
+  UINTN                       NumberOfDeques;
+  //
+  // The tasks that haven't finished.
+  //
+  volatile UINT32             Remaining;
+  //
+  // The APs inside the pool, and whether they may take tasks, so that an AP that
+  // starts late finds no tasks that belong to a later run.
+  //
+  volatile UINT32             ActiveWorkers;
+  volatile UINT32             Ready;
+  volatile UINT32             Busy;
+  EFI_MP_SERVICES_PROTOCOL    *Mp;
+  //
+  // Signalled once the MP services protocol has seen every AP of the last run return.
+  //
+  EFI_EVENT                   WaitEvent;
+  BOOLEAN                     Dispatched;
+} TASK_POOL;
+
+STATIC TASK_POOL  mTaskPool;
+
+/**
+  Find the deque of the hart this runs on.
+
+  Processors beyond the deques share them, which costs contention, but as every
+  operation on a deque is atomic, no correctness.
+
+  @param[in]  Pool  The pool.
+
+  @return  The index of the deque.
+
+**/
+STATIC
+UINTN
+CurrentDeque (
+  IN TASK_POOL  *Pool
+  )
+{
+  RISCV_HART_LOCAL  *HartLocal;
+  UINTN             ProcessorIndex;
+
+  HartLocal = RiscVHartLocalGet ();
+  if (HartLocal != NULL) {
+    ProcessorIndex = HartLocal->ProcessorIndex;
+  } else if (EFI_ERROR (Pool->Mp->WhoAmI (Pool->Mp, &ProcessorIndex))) {
+    ProcessorIndex = 0;
+  }
+
+  return ProcessorIndex % Pool->NumberOfDeques;
+}
+
+/**
+  Take the lowest task of a deque.
+
+  @param[in]   Deque  The deque.
+  @param[out]  Index  The number of the task.
+
+  @retval  TRUE   A task was taken.
+  @retval  FALSE  The deque is empty.
+
+**/
+STATIC
+BOOLEAN
+PopTask (
+  IN  TASK_DEQUE  *Deque,
+  OUT UINTN       *Index
+  )
+{
+  UINT64  Range;
+  UINT32  Begin;
+  UINT32  End;
+
+  do {
+    Range = Deque->Range;
+    Begin = TASK_RANGE_BEGIN (Range);
+    End   = TASK_RANGE_END (Range);
+    if (Begin >= End) {
+      return FALSE;
+    }
+  } while (InterlockedCompareExchange64 (&Deque->Range, Range, TASK_RANGE (Begin + 1, End)) != Range);
+
+  *Index = Begin;
+  return TRUE;
+}
+
+/**
+  Steal the top half of the tasks of another deque, into the empty deque of the hart.
+
+  @param[in]  Pool  The pool.
+  @param[in]  Self  The index of the deque of the hart.
+
+  @retval  TRUE   Tasks were stolen.
+  @retval  FALSE  Every other deque is empty.
+
+**/
+STATIC
+BOOLEAN
+StealTasks (
+  IN TASK_POOL  *Pool,
+  IN UINTN      Self
+  )
+{
+  TASK_DEQUE  *Victim;
+  UINTN       Offset;
+  UINT64      Range;
+  UINT32      Begin;
+  UINT32      End;
+  UINT32      Split;
+
+  for (Offset = 1; Offset < Pool->NumberOfDeques; Offset++) {
+    Victim = &Pool->Deques[(Self + Offset) % Pool->NumberOfDeques];
+    do {
+      Range = Victim->Range;
+      Begin = TASK_RANGE_BEGIN (Range);
+      End   = TASK_RANGE_END (Range);
+      if (Begin >= End) {
+        break;
+      }
+
+      Split = End - (End - Begin + 1) / 2;
+    } while (InterlockedCompareExchange64 (&Victim->Range, Range, TASK_RANGE (Begin, Split)) != Range);
+
+    if (Begin < End) {
+      //
+      // Thieves never take from an empty deque, so the hart's own can be overwritten.
+      //
+      InterlockedExchange64 (&Pool->Deques[Self].Range, TASK_RANGE (Split, End));
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/**
+  Run tasks of the pool until none are left to take.
+
+  @param[in]  Pool  The pool.
+
+**/
+STATIC
+VOID
+RunWorker (
+  IN TASK_POOL  *Pool
+  )
+{
+  UINTN  Self;
+  UINTN  Index;
+
+  Self = CurrentDeque (Pool);
+  do {
+    while (PopTask (&Pool->Deques[Self], &Index)) {
+      Pool->Procedure (Pool->Context, Index);
+      InterlockedDecrement (&Pool->Remaining);
+    }
+  } while (StealTasks (Pool, Self));
+}
+
+/**
+  The procedure of the APs.
+
+  @param[in]  Buffer  The pool.
+
+**/
+STATIC
+VOID
+EFIAPI
+ApWorker (
+  IN VOID  *Buffer
+  )
+{
+  TASK_POOL  *Pool;
+
+  Pool = Buffer;
+  InterlockedIncrement (&Pool->ActiveWorkers);
+  if (Pool->Ready != 0) {
+    RunWorker (Pool);
+  }
+
+  InterlockedDecrement (&Pool->ActiveWorkers);
+}
+
+/**
+  Find the MP services protocol and set up a deque for each processor, on first use.
+
+  @param[in]  Pool  The pool.
+
+  @retval  TRUE   The pool can start the APs.
+  @retval  FALSE  There are no APs, or the pool could not be set up.
+
+**/
+STATIC
+BOOLEAN
+SetUpPool (
+  IN TASK_POOL  *Pool
+  )
+{
+  EFI_MP_SERVICES_PROTOCOL  *Mp;
+  UINTN                     NumberOfProcessors;
+  UINTN                     NumberOfEnabledProcessors;
+  EFI_STATUS                Status;
+
+  if (Pool->Deques != NULL) {
+    return TRUE;
+  }
+
+  //
+  // The protocol may be installed later, so its absence isn't remembered.
+  //
+  Status = gBS->LocateProtocol (&gEfiMpServiceProtocolGuid, NULL, (VOID **)&Mp);
+  if (EFI_ERROR (Status)) {
+    return FALSE;
+  }
+
+  Status = Mp->GetNumberOfProcessors (Mp, &NumberOfProcessors, &NumberOfEnabledProcessors);
+  if (EFI_ERROR (Status) || (NumberOfEnabledProcessors < 2)) {
+    return FALSE;
+  }
+
+  Status = gBS->CreateEvent (0, TPL_CALLBACK, NULL, NULL, &Pool->WaitEvent);
+  if (EFI_ERROR (Status)) {
+    return FALSE;
+  }
+
+  Pool->Deques = AllocatePages (EFI_SIZE_TO_PAGES (NumberOfProcessors * sizeof (TASK_DEQUE)));
+  if (Pool->Deques == NULL) {
+    gBS->CloseEvent (Pool->WaitEvent);
+    Pool->WaitEvent = NULL;
+    return FALSE;
+  }
+
+  Pool->Mp             = Mp;
+  Pool->NumberOfDeques = NumberOfProcessors;
+  DEBUG ((DEBUG_INFO, "%a: %u deques for %u enabled processors\n", __func__, NumberOfProcessors, NumberOfEnabledProcessors));
+  return TRUE;
+}
+
+/**
+  Run a number of tasks over all harts, and wait for every one of them.
+
+  Only the boot hart may call this. A call that is made while another is
+  running, from an event, runs its tasks on the boot hart alone.
+
+  @param[in]  Procedure      The task.
+  @param[in]  Context        The context passed to each task.
+  @param[in]  NumberOfTasks  The number of tasks.
+
+  @retval  EFI_SUCCESS            Every task has run.
+  @retval  EFI_INVALID_PARAMETER  Procedure is NULL, or NumberOfTasks exceeds MAX_UINT32.
+                                  No task has run.
+
+**/
+EFI_STATUS
+EFIAPI
+RiscVTaskPoolRun (
+  IN RISCV_TASK_PROCEDURE  Procedure,
+  IN VOID                  *Context,
+  IN UINTN                 NumberOfTasks
+  )
+{
+  TASK_POOL   *Pool;
+  UINTN       Index;
+  EFI_STATUS  Status;
+
+  if ((Procedure == NULL) || (NumberOfTasks > MAX_UINT32)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Pool = &mTaskPool;
+  if ((NumberOfTasks < 2) || (InterlockedCompareExchange32 (&Pool->Busy, 0, 1) != 0)) {
+    for (Index = 0; Index < NumberOfTasks; Index++) {
+      Procedure (Context, Index);
+    }
+
+    return EFI_SUCCESS;
+  }
+
+  //
+  // The APs of the last run have left the pool, but can't be started again until
+  // the MP services protocol has seen them return, which takes a timer tick.
+  //
+  if (Pool->Dispatched && (gBS->CheckEvent (Pool->WaitEvent) == EFI_SUCCESS)) {
+    Pool->Dispatched = FALSE;
+  }
+
+  if (!SetUpPool (Pool) || Pool->Dispatched) {
+    for (Index = 0; Index < NumberOfTasks; Index++) {
+      Procedure (Context, Index);
+    }
+
+    InterlockedExchange32 (&Pool->Busy, 0);
+    return EFI_SUCCESS;
+  }
+
+  //
+  // Deal the tasks out evenly. Those of disabled processors are stolen.
+  //
+  for (Index = 0; Index < Pool->NumberOfDeques; Index++) {
+    Pool->Deques[Index].Range = TASK_RANGE (
+                                  (UINT32)(NumberOfTasks * Index / Pool->NumberOfDeques),
+                                  (UINT32)(NumberOfTasks * (Index + 1) / Pool->NumberOfDeques)
+                                  );
+  }
+
+  Pool->Procedure = Procedure;
+  Pool->Context   = Context;
+  Pool->Remaining = (UINT32)NumberOfTasks;
+  MemoryFence ();
+  InterlockedExchange32 (&Pool->Ready, 1);
+
+  //
+  // If the APs can't be started, the boot hart steals every task.
+  //
+  Status = Pool->Mp->StartupAllAPs (Pool->Mp, ApWorker, FALSE, Pool->WaitEvent, 0, Pool, NULL);
+  if (!EFI_ERROR (Status)) {
+    Pool->Dispatched = TRUE;
+  }
+
+  RunWorker (Pool);
+  while (Pool->Remaining != 0) {
+    CpuPause ();
+  }
+
+  InterlockedExchange32 (&Pool->Ready, 0);
+  while (Pool->ActiveWorkers != 0) {
+    CpuPause ();
+  }
+
+  InterlockedExchange32 (&Pool->Busy, 0);
+  return EFI_SUCCESS;
+}
@@ -0,0 +1,224 @@
+/** @file
+  RISC-V APLIC, the S-level interrupt domain of wired interrupts.
+
+  In MSI delivery mode, each enabled source is forwarded to an interrupt
+  identity of the boot hart's IMSIC. In direct delivery mode, the sources
+  are delivered to the boot hart's interrupt delivery control (IDC), and
+  claimed there.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/IoLib.h>
+#include "RiscVAia.h"
+
+/**
+  Return the source mode of a trigger type.
+
+  @param[in]  TriggerType  The trigger type.
+
+  @return  The source mode.
+
+**/
+STATIC
+UINT32
+AplicSourceMode (
+  IN EFI_HARDWARE_INTERRUPT2_TRIGGER_TYPE  TriggerType
+  )
+{
+  switch (TriggerType) {
+    case EFI_HARDWARE_INTERRUPT2_TRIGGER_LEVEL_LOW:
+      return APLIC_SOURCECFG_SM_LEVEL_LOW;
+    case EFI_HARDWARE_INTERRUPT2_TRIGGER_EDGE_FALLING:
+      return APLIC_SOURCECFG_SM_EDGE_FALLING;
+    case EFI_HARDWARE_INTERRUPT2_TRIGGER_EDGE_RISING:
+      return APLIC_SOURCECFG_SM_EDGE_RISING;
+    default:
+      return APLIC_SOURCECFG_SM_LEVEL_HIGH;
+  }
+}
+
+/**
+  Enable the APLIC domain, with all sources inactive.
+**/
+VOID
+AplicInitialize (
+  VOID
+  )
+{
+  UINT32  Source;
+  UINTN   Idc;
+
+  MmioWrite32 (mAia.AplicBase + APLIC_DOMAINCFG, 0);
+  for (Source = 1; Source <= mAia.NumberOfSources; Source++) {
+    MmioWrite32 (mAia.AplicBase + APLIC_CLRIENUM, Source);
+    MmioWrite32 (mAia.AplicBase + APLIC_SOURCECFG (Source), APLIC_SOURCECFG_SM_INACTIVE);
+  }
+
+  if (mAia.AplicMsiMode) {
+    MmioWrite32 (mAia.AplicBase + APLIC_DOMAINCFG, APLIC_DOMAINCFG_IE | APLIC_DOMAINCFG_DM);
+  } else {
+    Idc = (UINTN)mAia.AplicBase + APLIC_IDC (mAia.AplicIdcIndex);
+    MmioWrite32 (Idc + APLIC_IDC_ITHRESHOLD, 0);
+    MmioWrite32 (Idc + APLIC_IDC_IDELIVERY, 1);
+    MmioWrite32 (mAia.AplicBase + APLIC_DOMAINCFG, APLIC_DOMAINCFG_IE);
+  }
+}
+
+/**
+  Enable an APLIC source, configured with its trigger type.
+
+  @param[in]  Source  The source.
+
+  @retval  EFI_SUCCESS           The source is enabled.
+  @retval  EFI_OUT_OF_RESOURCES  No IMSIC identity is left to forward it to.
+
+**/
+EFI_STATUS
+AplicEnableSource (
+  IN UINT32  Source
+  )
+{
+  APLIC_SOURCE  *Entry;
+  UINT32        Target;
+  EFI_STATUS    Status;
+
+  Entry = &mAia.Sources[Source];
+  if (Entry->Enabled) {
+    return EFI_SUCCESS;
+  }
+
+  if (mAia.AplicMsiMode) {
+    Status = ImsicAllocateId (ImsicIdWired, Source, NULL, NULL, &Entry->Id);
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+
+    Target = (mAia.ImsicHartIndex << APLIC_TARGET_HART_SHIFT) | Entry->Id;
+  } else {
+    Target = (mAia.AplicIdcIndex << APLIC_TARGET_HART_SHIFT) | APLIC_TARGET_IPRIO_DEFAULT;
+  }
+
+  MmioWrite32 (mAia.AplicBase + APLIC_SOURCECFG (Source), AplicSourceMode (Entry->TriggerType));
+  MmioWrite32 (mAia.AplicBase + APLIC_TARGET (Source), Target);
+  MmioWrite32 (mAia.AplicBase + APLIC_SETIENUM, Source);
+  Entry->Enabled = TRUE;
+  return EFI_SUCCESS;
+}
+
+/**
+  Disable an APLIC source.
+
+  @param[in]  Source  The source.
+
+**/
+VOID
+AplicDisableSource (
+  IN UINT32  Source
+  )
+{
+  APLIC_SOURCE  *Entry;
+
+  Entry = &mAia.Sources[Source];
+  if (!Entry->Enabled) {
+    return;
+  }
+
+  MmioWrite32 (mAia.AplicBase + APLIC_CLRIENUM, Source);
+  MmioWrite32 (mAia.AplicBase + APLIC_SOURCECFG (Source), APLIC_SOURCECFG_SM_INACTIVE);
+  if (mAia.AplicMsiMode) {
+    ImsicFreeId (Entry->Id);
+    Entry->Id = 0;
+  }
+
+  Entry->Enabled = FALSE;
+}
+
+/**
+  Complete the handling of an APLIC source.
+
+  In MSI delivery mode, a level-sensitive source that is still asserted
+  isn't forwarded again on its own, so it is made pending again.
+
+  @param[in]  Source  The source.
+
+**/
+VOID
+AplicEndOfInterrupt (
+  IN UINT32  Source
+  )
+{
+  EFI_HARDWARE_INTERRUPT2_TRIGGER_TYPE  TriggerType;
+
+  if (!mAia.AplicMsiMode || !mAia.Sources[Source].Enabled) {
+    return;
+  }
+
+  //
+  // For a level-sensitive source, setipnum only sets the pending bit if the
+  // rectified input is high.
+  //
+  TriggerType = mAia.Sources[Source].TriggerType;
+  if ((TriggerType == EFI_HARDWARE_INTERRUPT2_TRIGGER_LEVEL_LOW) ||
+      (TriggerType == EFI_HARDWARE_INTERRUPT2_TRIGGER_LEVEL_HIGH))
+  {
+    MmioWrite32 (mAia.AplicBase + APLIC_SETIPNUM_LE, Source);
+  }
+}
+
+/**
+  Claim and dispatch the pending sources of the boot hart's IDC, in direct
+  delivery mode.
+
+  @param[in]  SystemContext  The context of the interrupted code.
+
+**/
+VOID
+AplicDispatch (
+  IN EFI_SYSTEM_CONTEXT  SystemContext
+  )
+{
+  UINTN   Idc;
+  UINT32  Claim;
+  UINT32  Source;
+
+  Idc = (UINTN)mAia.AplicBase + APLIC_IDC (mAia.AplicIdcIndex);
+  while ((Claim = MmioRead32 (Idc + APLIC_IDC_CLAIMI)) != 0) {
+    Source = (Claim >> APLIC_CLAIMI_SOURCE_SHIFT) & APLIC_CLAIMI_SOURCE_MASK;
+    if ((Source == 0) || (Source > mAia.NumberOfSources) ||
+        (mAia.Sources[Source].Handler == NULL))
+    {
+      DEBUG ((DEBUG_WARN, "%a: spurious interrupt source %u\n", __func__, Source));
+      continue;
+    }
+
+    mAia.Sources[Source].Handler (Source, SystemContext);
+  }
+}
+
+/**
+  Disable all sources and the APLIC domain.
+**/
+VOID
+AplicShutdown (
+  VOID
+  )
+{
+  UINT32  Source;
+
+  MmioWrite32 (mAia.AplicBase + APLIC_DOMAINCFG, 0);
+  for (Source = 1; Source <= mAia.NumberOfSources; Source++) {
+    if (mAia.Sources[Source].Enabled) {
+      MmioWrite32 (mAia.AplicBase + APLIC_CLRIENUM, Source);
+      MmioWrite32 (mAia.AplicBase + APLIC_SOURCECFG (Source), APLIC_SOURCECFG_SM_INACTIVE);
+    }
+  }
+
+  if (!mAia.AplicMsiMode) {
+    MmioWrite32 ((UINTN)mAia.AplicBase + APLIC_IDC (mAia.AplicIdcIndex) + APLIC_IDC_IDELIVERY, 0);
+  }
+}
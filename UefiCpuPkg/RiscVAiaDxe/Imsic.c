@@ -0,0 +1,186 @@
+/** @file
+  RISC-V IMSIC, the S-level interrupt file of the boot hart.
+
+  Interrupt identities are allocated to MSIs of devices, and to the APLIC
+  sources that are forwarded as MSIs. All of them target the boot hart, which
+  is the only one taking interrupts during boot.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include "RiscVAia.h"
+
+/**
+  Enable or disable an interrupt identity.
+
+  @param[in]  Id      The identity.
+  @param[in]  Enable  Whether to enable it.
+
+**/
+STATIC
+VOID
+ImsicSetIdEnable (
+  IN UINT32   Id,
+  IN BOOLEAN  Enable
+  )
+{
+  UINTN    Select;
+  UINT64   Bit;
+  BOOLEAN  InterruptState;
+
+  Select = IMSIC_EIE0 + (Id / 64) * 2;
+  Bit    = LShiftU64 (1, Id % 64);
+
+  InterruptState = SaveAndDisableInterrupts ();
+  if (Enable) {
+    ImsicCsrSet (Select, Bit);
+  } else {
+    ImsicCsrClear (Select, Bit);
+  }
+
+  SetInterruptState (InterruptState);
+}
+
+/**
+  Enable the boot hart's S-level interrupt file, with all identities disabled.
+**/
+VOID
+ImsicInitialize (
+  VOID
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index <= mAia.NumberOfIds / 64; Index++) {
+    ImsicCsrWrite (IMSIC_EIE0 + Index * 2, 0);
+    ImsicCsrWrite (IMSIC_EIP0 + Index * 2, 0);
+  }
+
+  ImsicCsrWrite (IMSIC_EITHRESHOLD, 0);
+  ImsicCsrWrite (IMSIC_EIDELIVERY, IMSIC_EIDELIVERY_ENABLE);
+}
+
+/**
+  Allocate an interrupt identity of the IMSIC, and enable it.
+
+  @param[in]   Type     What the identity is used for.
+  @param[in]   Source   The APLIC source forwarded to it, for ImsicIdWired.
+  @param[in]   Handler  The MSI handler, for ImsicIdMsi.
+  @param[in]   Context  The context of Handler.
+  @param[out]  Id       The identity.
+
+  @retval  EFI_SUCCESS           The identity is allocated.
+  @retval  EFI_OUT_OF_RESOURCES  All identities are in use.
+
+**/
+EFI_STATUS
+ImsicAllocateId (
+  IN  IMSIC_ID_TYPE      Type,
+  IN  UINT32             Source,
+  IN  RISCV_MSI_HANDLER  Handler,
+  IN  VOID               *Context,
+  OUT UINT32             *Id
+  )
+{
+  UINT32  Index;
+
+  //
+  // Identity 0 is reserved.
+  //
+  for (Index = 1; Index <= mAia.NumberOfIds; Index++) {
+    if (mAia.Ids[Index].Type == ImsicIdFree) {
+      break;
+    }
+  }
+
+  if (Index > mAia.NumberOfIds) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  mAia.Ids[Index].Type    = Type;
+  mAia.Ids[Index].Source  = Source;
+  mAia.Ids[Index].Handler = Handler;
+  mAia.Ids[Index].Context = Context;
+  ImsicSetIdEnable (Index, TRUE);
+
+  *Id = Index;
+  return EFI_SUCCESS;
+}
+
+/**
+  Disable an interrupt identity of the IMSIC, and free it.
+
+  @param[in]  Id  The identity.
+
+**/
+VOID
+ImsicFreeId (
+  IN UINT32  Id
+  )
+{
+  ImsicSetIdEnable (Id, FALSE);
+  mAia.Ids[Id].Type    = ImsicIdFree;
+  mAia.Ids[Id].Handler = NULL;
+  mAia.Ids[Id].Context = NULL;
+}
+
+/**
+  Claim and dispatch the pending interrupts of the IMSIC.
+
+  @param[in]  SystemContext  The context of the interrupted code.
+
+**/
+VOID
+ImsicDispatch (
+  IN EFI_SYSTEM_CONTEXT  SystemContext
+  )
+{
+  UINT64    TopEi;
+  UINT32    Id;
+  IMSIC_ID  *Entry;
+
+  while ((TopEi = ImsicClaim ()) != 0) {
+    Id = (UINT32)(TopEi >> IMSIC_TOPEI_ID_SHIFT) & IMSIC_TOPEI_ID_MASK;
+    if (Id > mAia.NumberOfIds) {
+      continue;
+    }
+
+    Entry = &mAia.Ids[Id];
+    switch (Entry->Type) {
+      case ImsicIdMsi:
+        Entry->Handler (Entry->Context);
+        break;
+
+      case ImsicIdWired:
+        if (mAia.Sources[Entry->Source].Handler != NULL) {
+          mAia.Sources[Entry->Source].Handler (Entry->Source, SystemContext);
+        }
+
+        break;
+
+      default:
+        DEBUG ((DEBUG_WARN, "%a: spurious interrupt identity %u\n", __func__, Id));
+        break;
+    }
+  }
+}
+
+/**
+  Disable all identities and the delivery of the IMSIC.
+**/
+VOID
+ImsicShutdown (
+  VOID
+  )
+{
+  UINTN  Index;
+
+  ImsicCsrWrite (IMSIC_EIDELIVERY, 0);
+  for (Index = 0; Index <= mAia.NumberOfIds / 64; Index++) {
+    ImsicCsrWrite (IMSIC_EIE0 + Index * 2, 0);
+  }
+}
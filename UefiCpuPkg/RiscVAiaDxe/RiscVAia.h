@@ -0,0 +1,331 @@
+/** @file
+  RISC-V Advanced Interrupt Architecture (AIA) driver.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef RISCV_AIA_H_
+#define RISCV_AIA_H_
+
+#include <PiDxe.h>
+#include <Protocol/HardwareInterrupt.h>
+#include <Protocol/HardwareInterrupt2.h>
+#include <Protocol/RiscVMsi.h>
+
+#define RISCV_AIA_DEBUG_LEVEL  DEBUG_INFO
+
+//
+// IMSIC registers, accessed indirectly through siselect and sireg. On RV64,
+// only the even-numbered eip and eie registers exist, each of 64 bits.
+//
+#define IMSIC_EIDELIVERY   0x70
+#define IMSIC_EITHRESHOLD  0x72
+#define IMSIC_EIP0         0x80
+#define IMSIC_EIE0         0xC0
+
+#define IMSIC_EIDELIVERY_ENABLE  1
+
+//
+// The identity of the interrupt claimed through stopei.
+//
+#define IMSIC_TOPEI_ID_SHIFT  16
+#define IMSIC_TOPEI_ID_MASK   0x7FF
+
+#define IMSIC_MAX_IDS  2047
+
+//
+// APLIC registers.
+//
+#define APLIC_DOMAINCFG     0x0000
+#define APLIC_SOURCECFG(n)  (0x0004 + ((n) - 1) * 4)
+#define APLIC_SETIPNUM_LE   0x2000
+#define APLIC_SETIENUM      0x1EDC
+#define APLIC_CLRIENUM      0x1FDC
+#define APLIC_TARGET(n)     (0x3004 + ((n) - 1) * 4)
+#define APLIC_IDC(n)        (0x4000 + (n) * 32)
+
+#define APLIC_DOMAINCFG_IE  BIT8
+#define APLIC_DOMAINCFG_DM  BIT2
+
+#define APLIC_SOURCECFG_SM_INACTIVE      0
+#define APLIC_SOURCECFG_SM_EDGE_RISING   4
+#define APLIC_SOURCECFG_SM_EDGE_FALLING  5
+#define APLIC_SOURCECFG_SM_LEVEL_HIGH    6
+#define APLIC_SOURCECFG_SM_LEVEL_LOW     7
+
+#define APLIC_TARGET_HART_SHIFT     18
+#define APLIC_TARGET_IPRIO_DEFAULT  1
+
+//
+// Interrupt delivery control registers, one per hart, in direct delivery mode.
+//
+#define APLIC_IDC_IDELIVERY   0x00
+#define APLIC_IDC_ITHRESHOLD  0x08
+#define APLIC_IDC_CLAIMI      0x1C
+
+#define APLIC_CLAIMI_SOURCE_SHIFT  16
+#define APLIC_CLAIMI_SOURCE_MASK   0x3FF
+
+#define APLIC_MAX_SOURCES  1023
+
+//
+// What an interrupt identity of the IMSIC is used for.
+//
+typedef enum {
+  ImsicIdFree,
+  ImsicIdMsi,
+  ImsicIdWired,
+} IMSIC_ID_TYPE;
+
+typedef struct {
+  IMSIC_ID_TYPE        Type;
+  // The APLIC source forwarded to this identity, if Type is ImsicIdWired.
+  UINT32               Source;
+  // The handler of an MSI, if Type is ImsicIdMsi.
+  RISCV_MSI_HANDLER    Handler;
+  VOID                 *Context;
+} IMSIC_ID;
+
+typedef struct {
+  HARDWARE_INTERRUPT_HANDLER              Handler;
+  EFI_HARDWARE_INTERRUPT2_TRIGGER_TYPE    TriggerType;
+  BOOLEAN                                 Enabled;
+  // The IMSIC identity the source is forwarded to, in MSI delivery mode.
+  UINT32                                  Id;
+} APLIC_SOURCE;
+
+typedef struct {
+  //
+  // The S-level interrupt file of the boot hart, if there is an IMSIC.
+  //
+  BOOLEAN                 HasImsic;
+  EFI_PHYSICAL_ADDRESS    ImsicFile;
+  UINT32                  ImsicHartIndex;
+  UINT32                  NumberOfIds;
+  IMSIC_ID                *Ids;
+
+  //
+  // The S-level APLIC domain, if there is one. In MSI delivery mode, its
+  // sources are forwarded to the IMSIC, and otherwise to the boot hart's IDC.
+  //
+  BOOLEAN                 HasAplic;
+  BOOLEAN                 AplicMsiMode;
+  EFI_PHYSICAL_ADDRESS    AplicBase;
+  UINT32                  AplicIdcIndex;
+  UINT32                  NumberOfSources;
+  APLIC_SOURCE            *Sources;
+} RISCV_AIA;
+
+extern RISCV_AIA  mAia;
+
+/**
+  Read an IMSIC register of the current hart's S-level interrupt file.
+
+  @param[in]  Select  The register number.
+
+  @return  The value of the register.
+
+**/
+UINT64
+EFIAPI
+ImsicCsrRead (
+  IN UINTN  Select
+  );
+
+/**
+  Write an IMSIC register of the current hart's S-level interrupt file.
+
+  @param[in]  Select  The register number.
+  @param[in]  Value   The value to write.
+
+**/
+VOID
+EFIAPI
+ImsicCsrWrite (
+  IN UINTN   Select,
+  IN UINT64  Value
+  );
+
+/**
+  Set bits of an IMSIC register of the current hart's S-level interrupt file.
+
+  @param[in]  Select  The register number.
+  @param[in]  Bits    The bits to set.
+
+**/
+VOID
+EFIAPI
+ImsicCsrSet (
+  IN UINTN   Select,
+  IN UINT64  Bits
+  );
+
+/**
+  Clear bits of an IMSIC register of the current hart's S-level interrupt file.
+
+  @param[in]  Select  The register number.
+  @param[in]  Bits    The bits to clear.
+
+**/
+VOID
+EFIAPI
+ImsicCsrClear (
+  IN UINTN   Select,
+  IN UINT64  Bits
+  );
+
+/**
+  Claim the highest-priority pending and enabled interrupt of the current
+  hart's S-level interrupt file.
+
+  @return  The value of stopei before the claim, 0 if nothing was pending.
+
+**/
+UINT64
+EFIAPI
+ImsicClaim (
+  VOID
+  );
+
+/**
+  Enable or disable supervisor external interrupts in sie.
+
+  @param[in]  Enable  Whether to enable them.
+
+**/
+VOID
+EFIAPI
+AiaSetExternalInterruptEnable (
+  IN BOOLEAN  Enable
+  );
+
+/**
+  Enable the boot hart's S-level interrupt file, with all identities disabled.
+**/
+VOID
+ImsicInitialize (
+  VOID
+  );
+
+/**
+  Allocate an interrupt identity of the IMSIC, and enable it.
+
+  @param[in]   Type     What the identity is used for.
+  @param[in]   Source   The APLIC source forwarded to it, for ImsicIdWired.
+  @param[in]   Handler  The MSI handler, for ImsicIdMsi.
+  @param[in]   Context  The context of Handler.
+  @param[out]  Id       The identity.
+
+  @retval  EFI_SUCCESS           The identity is allocated.
+  @retval  EFI_OUT_OF_RESOURCES  All identities are in use.
+
+**/
+EFI_STATUS
+ImsicAllocateId (
+  IN  IMSIC_ID_TYPE      Type,
+  IN  UINT32             Source,
+  IN  RISCV_MSI_HANDLER  Handler,
+  IN  VOID               *Context,
+  OUT UINT32             *Id
+  );
+
+/**
+  Disable an interrupt identity of the IMSIC, and free it.
+
+  @param[in]  Id  The identity.
+
+**/
+VOID
+ImsicFreeId (
+  IN UINT32  Id
+  );
+
+/**
+  Claim and dispatch the pending interrupts of the IMSIC.
+
+  @param[in]  SystemContext  The context of the interrupted code.
+
+**/
+VOID
+ImsicDispatch (
+  IN EFI_SYSTEM_CONTEXT  SystemContext
+  );
+
+/**
+  Disable all identities and the delivery of the IMSIC.
+**/
+VOID
+ImsicShutdown (
+  VOID
+  );
+
+/**
+  Enable the APLIC domain, with all sources inactive.
+**/
+VOID
+AplicInitialize (
+  VOID
+  );
+
+/**
+  Enable an APLIC source, configured with its trigger type.
+
+  @param[in]  Source  The source.
+
+  @retval  EFI_SUCCESS           The source is enabled.
+  @retval  EFI_OUT_OF_RESOURCES  No IMSIC identity is left to forward it to.
+
+**/
+EFI_STATUS
+AplicEnableSource (
+  IN UINT32  Source
+  );
+
+/**
+  Disable an APLIC source.
+
+  @param[in]  Source  The source.
+
+**/
+VOID
+AplicDisableSource (
+  IN UINT32  Source
+  );
+
+/**
+  Complete the handling of an APLIC source.
+
+  In MSI delivery mode, a level-sensitive source that is still asserted
+  isn't forwarded again on its own, so it is made pending again.
+
+  @param[in]  Source  The source.
+
+**/
+VOID
+AplicEndOfInterrupt (
+  IN UINT32  Source
+  );
+
+/**
+  Claim and dispatch the pending sources of the boot hart's IDC, in direct
+  delivery mode.
+
+  @param[in]  SystemContext  The context of the interrupted code.
+
+**/
+VOID
+AplicDispatch (
+  IN EFI_SYSTEM_CONTEXT  SystemContext
+  );
+
+/**
+  Disable all sources and the APLIC domain.
+**/
+VOID
+AplicShutdown (
+  VOID
+  );
+
+#endif
@@ -0,0 +1,771 @@
+/** @file
+  RISC-V Advanced Interrupt Architecture (AIA) driver.
+
+  Takes the supervisor external interrupt of the boot hart, and dispatches
+  it to the handlers of MSIs, through the RISC-V MSI protocol, and of wired
+  sources of the APLIC, through the hardware interrupt protocols.
+
+  The S-level IMSIC and APLIC are taken from the devicetree. Platforms with
+  a PLIC instead aren't supported.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/FdtLib.h>
+#include <Library/HobLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Protocol/Cpu.h>
+#include <Protocol/RiscVBootProtocol.h>
+#include <Guid/FdtHob.h>
+#include <Register/RiscV64/RiscVEncoding.h>
+#include "RiscVAia.h"
+
+RISCV_AIA  mAia;
+
+STATIC EFI_CPU_ARCH_PROTOCOL  *mCpu;
+STATIC EFI_EVENT              mExitBootServicesEvent;
+
+/**
+  Read an optional single-cell property of a devicetree node.
+
+  @param[in]  Fdt      The devicetree.
+  @param[in]  Node     The node.
+  @param[in]  Name     The name of the property.
+  @param[in]  Default  The value of an absent property.
+
+  @return  The value of the property.
+
+**/
+STATIC
+UINT32
+GetCellProperty (
+  IN CONST VOID   *Fdt,
+  IN INT32        Node,
+  IN CONST CHAR8  *Name,
+  IN UINT32       Default
+  )
+{
+  CONST UINT32  *Data32;
+  INT32         TempLen;
+
+  Data32 = (CONST UINT32 *)FdtGetProp (Fdt, Node, Name, &TempLen);
+  if ((Data32 == NULL) || (TempLen < (INT32)sizeof (UINT32))) {
+    return Default;
+  }
+
+  return Fdt32ToCpu (ReadUnaligned32 (Data32));
+}
+
+/**
+  Read the address of the first register region of a devicetree node.
+
+  @param[in]   Fdt      The devicetree.
+  @param[in]   Node     The node.
+  @param[out]  Address  The address.
+
+  @retval  TRUE   Address is read.
+  @retval  FALSE  The node has no register region.
+
+**/
+STATIC
+BOOLEAN
+GetRegAddress (
+  IN  CONST VOID            *Fdt,
+  IN  INT32                 Node,
+  OUT EFI_PHYSICAL_ADDRESS  *Address
+  )
+{
+  CONST UINT32  *Data32;
+  INT32         TempLen;
+  INT32         AddressCells;
+
+  AddressCells = FdtAddressCells (Fdt, FdtParentOffset (Fdt, Node));
+  Data32       = (CONST UINT32 *)FdtGetProp (Fdt, Node, "reg", &TempLen);
+  if ((Data32 == NULL) || (AddressCells < 1) || (AddressCells > 2) ||
+      (TempLen < AddressCells * (INT32)sizeof (UINT32)))
+  {
+    return FALSE;
+  }
+
+  if (AddressCells == 2) {
+    *Address = Fdt64ToCpu (ReadUnaligned64 ((CONST UINT64 *)Data32));
+  } else {
+    *Address = Fdt32ToCpu (ReadUnaligned32 (Data32));
+  }
+
+  return TRUE;
+}
+
+/**
+  Find the position of the boot hart's supervisor external interrupt in the
+  interrupts-extended property of an interrupt controller, which is the
+  hart index of the boot hart in its IMSIC or APLIC.
+
+  @param[in]   Fdt         The devicetree.
+  @param[in]   Node        The node of the interrupt controller.
+  @param[in]   BootHartId  The hart ID of the boot hart.
+  @param[out]  Index       The position.
+
+  @retval  TRUE   Index is found.
+  @retval  FALSE  The controller doesn't target the supervisor external
+                  interrupt of the boot hart.
+
+**/
+STATIC
+BOOLEAN
+FindBootHartIndex (
+  IN  CONST VOID  *Fdt,
+  IN  INT32       Node,
+  IN  UINTN       BootHartId,
+  OUT UINT32      *Index
+  )
+{
+  CONST UINT32  *Data32;
+  INT32         TempLen;
+  UINT32        Entry;
+  INT32         IntcNode;
+  INT32         CpuNode;
+  CONST UINT32  *Reg;
+  INT32         RegLen;
+  UINT64        HartId;
+
+  Data32 = (CONST UINT32 *)FdtGetProp (Fdt, Node, "interrupts-extended", &TempLen);
+  if (Data32 == NULL) {
+    return FALSE;
+  }
+
+  for (Entry = 0; Entry < (UINT32)TempLen / (2 * sizeof (UINT32)); Entry++) {
+    if (Fdt32ToCpu (ReadUnaligned32 (Data32 + 2 * Entry + 1)) != IRQ_S_EXT) {
+      continue;
+    }
+
+    IntcNode = FdtNodeOffsetByPhandle (Fdt, Fdt32ToCpu (ReadUnaligned32 (Data32 + 2 * Entry)));
+    if (IntcNode < 0) {
+      continue;
+    }
+
+    CpuNode = FdtParentOffset (Fdt, IntcNode);
+    Reg     = (CONST UINT32 *)FdtGetProp (Fdt, CpuNode, "reg", &RegLen);
+    if ((Reg != NULL) && (RegLen == sizeof (UINT32))) {
+      HartId = Fdt32ToCpu (ReadUnaligned32 (Reg));
+    } else if ((Reg != NULL) && (RegLen == sizeof (UINT64))) {
+      HartId = Fdt64ToCpu (ReadUnaligned64 ((CONST UINT64 *)Reg));
+    } else {
+      continue;
+    }
+
+    if (HartId == BootHartId) {
+      *Index = Entry;
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/**
+  Find the S-level IMSIC and APLIC of the boot hart in the devicetree.
+
+  Only IMSICs of one group are supported, where the interrupt files of hart
+  index N are at page N << guest-index-bits of the first register region.
+
+  @param[in]  BootHartId  The hart ID of the boot hart.
+
+  @retval  EFI_SUCCESS    mAia describes the IMSIC, APLIC, or both.
+  @retval  EFI_NOT_FOUND  There is neither.
+
+**/
+STATIC
+EFI_STATUS
+AiaDetect (
+  IN UINTN  BootHartId
+  )
+{
+  VOID                  *Hob;
+  VOID                  *Fdt;
+  INT32                 Node;
+  UINT32                ImsicPhandle;
+  EFI_PHYSICAL_ADDRESS  Base;
+  UINT32                GuestIndexBits;
+
+  Hob = GetFirstGuidHob (&gFdtHobGuid);
+  if (Hob == NULL) {
+    return EFI_NOT_FOUND;
+  }
+
+  Fdt = (VOID *)(UINTN)*(UINT64 *)GET_GUID_HOB_DATA (Hob);
+  if ((Fdt == NULL) || (FdtCheckHeader (Fdt) != 0)) {
+    return EFI_NOT_FOUND;
+  }
+
+  ImsicPhandle = 0;
+  for (Node = FdtNodeOffsetByCompatible (Fdt, -1, "riscv,imsics")
+       ; Node >= 0
+       ; Node = FdtNodeOffsetByCompatible (Fdt, Node, "riscv,imsics")
+       ) {
+    if (FindBootHartIndex (Fdt, Node, BootHartId, &mAia.ImsicHartIndex) &&
+        GetRegAddress (Fdt, Node, &Base))
+    {
+      GuestIndexBits   = GetCellProperty (Fdt, Node, "riscv,guest-index-bits", 0);
+      mAia.HasImsic    = TRUE;
+      mAia.ImsicFile   = Base + LShiftU64 (mAia.ImsicHartIndex, GuestIndexBits + EFI_PAGE_SHIFT);
+      mAia.NumberOfIds = MIN (GetCellProperty (Fdt, Node, "riscv,num-ids", 0), IMSIC_MAX_IDS);
+      ImsicPhandle     = FdtGetPhandle (Fdt, Node);
+      break;
+    }
+  }
+
+  for (Node = FdtNodeOffsetByCompatible (Fdt, -1, "riscv,aplic")
+       ; Node >= 0
+       ; Node = FdtNodeOffsetByCompatible (Fdt, Node, "riscv,aplic")
+       ) {
+    if (mAia.HasImsic && (ImsicPhandle != 0) &&
+        (GetCellProperty (Fdt, Node, "msi-parent", 0) == ImsicPhandle))
+    {
+      mAia.AplicMsiMode = TRUE;
+    } else if (!FindBootHartIndex (Fdt, Node, BootHartId, &mAia.AplicIdcIndex)) {
+      continue;
+    }
+
+    if (GetRegAddress (Fdt, Node, &mAia.AplicBase)) {
+      mAia.HasAplic        = TRUE;
+      mAia.NumberOfSources = MIN (GetCellProperty (Fdt, Node, "riscv,num-sources", 0), APLIC_MAX_SOURCES);
+      break;
+    }
+
+    mAia.AplicMsiMode = FALSE;
+  }
+
+  if (!mAia.HasImsic && !mAia.HasAplic) {
+    return EFI_NOT_FOUND;
+  }
+
+  DEBUG ((
+    RISCV_AIA_DEBUG_LEVEL,
+    "%a: IMSIC file 0x%lx with %u identities, APLIC 0x%lx with %u sources in %a mode\n",
+    __func__,
+    mAia.ImsicFile,
+    mAia.NumberOfIds,
+    mAia.AplicBase,
+    mAia.NumberOfSources,
+    mAia.AplicMsiMode ? "MSI" : "direct"
+    ));
+  return EFI_SUCCESS;
+}
+
+/**
+  Handle the supervisor external interrupt.
+
+  @param[in]  InterruptType  The interrupt type.
+  @param[in]  SystemContext  The context of the interrupted code.
+
+**/
+STATIC
+VOID
+EFIAPI
+AiaInterruptHandler (
+  IN EFI_EXCEPTION_TYPE  InterruptType,
+  IN EFI_SYSTEM_CONTEXT  SystemContext
+  )
+{
+  if (mAia.HasImsic) {
+    ImsicDispatch (SystemContext);
+  } else {
+    AplicDispatch (SystemContext);
+  }
+}
+
+/**
+  Check that a wired source exists.
+
+  @param[in]  Source  The source.
+
+  @retval  EFI_SUCCESS      The source exists.
+  @retval  EFI_UNSUPPORTED  There is no APLIC, or it has no such source.
+
+**/
+STATIC
+EFI_STATUS
+AiaCheckSource (
+  IN HARDWARE_INTERRUPT_SOURCE  Source
+  )
+{
+  if (!mAia.HasAplic || (Source == 0) || (Source > mAia.NumberOfSources)) {
+    return EFI_UNSUPPORTED;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Enable interrupt source Source.
+
+  @param This     Instance pointer for this protocol
+  @param Source   Hardware source of the interrupt
+
+  @retval EFI_SUCCESS       Source interrupt enabled.
+  @retval EFI_DEVICE_ERROR  Hardware could not be programmed.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+AiaEnableInterruptSource (
+  IN EFI_HARDWARE_INTERRUPT_PROTOCOL  *This,
+  IN HARDWARE_INTERRUPT_SOURCE        Source
+  )
+{
+  EFI_STATUS  Status;
+
+  Status = AiaCheckSource (Source);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  return AplicEnableSource ((UINT32)Source);
+}
+
+/**
+  Disable interrupt source Source.
+
+  @param This     Instance pointer for this protocol
+  @param Source   Hardware source of the interrupt
+
+  @retval EFI_SUCCESS       Source interrupt disabled.
+  @retval EFI_DEVICE_ERROR  Hardware could not be programmed.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+AiaDisableInterruptSource (
+  IN EFI_HARDWARE_INTERRUPT_PROTOCOL  *This,
+  IN HARDWARE_INTERRUPT_SOURCE        Source
+  )
+{
+  EFI_STATUS  Status;
+
+  Status = AiaCheckSource (Source);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  AplicDisableSource ((UINT32)Source);
+  return EFI_SUCCESS;
+}
+
+/**
+  Register Handler for the specified interrupt source.
+
+  @param This     Instance pointer for this protocol
+  @param Source   Hardware source of the interrupt
+  @param Handler  Callback for interrupt. NULL to unregister
+
+  @retval EFI_SUCCESS Source was updated to support Handler.
+  @retval EFI_DEVICE_ERROR  Hardware could not be programmed.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+AiaRegisterInterruptSource (
+  IN EFI_HARDWARE_INTERRUPT_PROTOCOL  *This,
+  IN HARDWARE_INTERRUPT_SOURCE        Source,
+  IN HARDWARE_INTERRUPT_HANDLER       Handler
+  )
+{
+  EFI_STATUS  Status;
+
+  Status = AiaCheckSource (Source);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  if ((Handler == NULL) && (mAia.Sources[Source].Handler == NULL)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if ((Handler != NULL) && (mAia.Sources[Source].Handler != NULL)) {
+    return EFI_ALREADY_STARTED;
+  }
+
+  if (Handler == NULL) {
+    // Removing the handler - disable the interrupt first.
+    Status                       = This->DisableInterruptSource (This, Source);
+    mAia.Sources[Source].Handler = NULL;
+    return Status;
+  }
+
+  // Registering a handler - set up the handler before enabling.
+  mAia.Sources[Source].Handler = Handler;
+  return This->EnableInterruptSource (This, Source);
+}
+
+/**
+  Return current state of interrupt source Source.
+
+  @param This     Instance pointer for this protocol
+  @param Source   Hardware source of the interrupt
+  @param InterruptState  TRUE: source enabled, FALSE: source disabled.
+
+  @retval EFI_SUCCESS       InterruptState is valid
+  @retval EFI_DEVICE_ERROR  InterruptState is not valid
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+AiaGetInterruptSourceState (
+  IN EFI_HARDWARE_INTERRUPT_PROTOCOL  *This,
+  IN HARDWARE_INTERRUPT_SOURCE        Source,
+  IN BOOLEAN                          *InterruptState
+  )
+{
+  EFI_STATUS  Status;
+
+  Status = AiaCheckSource (Source);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  *InterruptState = mAia.Sources[Source].Enabled;
+  return EFI_SUCCESS;
+}
+
+/**
+  Signal to the hardware that the End Of Interrupt state
+  has been reached.
+
+  @param This     Instance pointer for this protocol
+  @param Source   Hardware source of the interrupt
+
+  @retval EFI_SUCCESS       Source interrupt EOI'ed.
+  @retval EFI_DEVICE_ERROR  Hardware could not be programmed.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+AiaEndOfInterrupt (
+  IN EFI_HARDWARE_INTERRUPT_PROTOCOL  *This,
+  IN HARDWARE_INTERRUPT_SOURCE        Source
+  )
+{
+  EFI_STATUS  Status;
+
+  Status = AiaCheckSource (Source);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  AplicEndOfInterrupt ((UINT32)Source);
+  return EFI_SUCCESS;
+}
+
+/**
+  Return the configured trigger type for an interrupt source
+
+  @param This         Instance pointer for this protocol
+  @param Source       Hardware source of the interrupt
+  @param TriggerType  The configured trigger type
+
+  @retval EFI_SUCCESS       Operation successful
+  @retval EFI_DEVICE_ERROR  Information could not be returned
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+AiaGetTriggerType (
+  IN  EFI_HARDWARE_INTERRUPT2_PROTOCOL      *This,
+  IN  HARDWARE_INTERRUPT_SOURCE             Source,
+  OUT EFI_HARDWARE_INTERRUPT2_TRIGGER_TYPE  *TriggerType
+  )
+{
+  EFI_STATUS  Status;
+
+  Status = AiaCheckSource (Source);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  *TriggerType = mAia.Sources[Source].TriggerType;
+  return EFI_SUCCESS;
+}
+
+/**
+ Configure the trigger type for an interrupt source
+
+  @param This         Instance pointer for this protocol
+  @param Source       Hardware source of the interrupt
+  @param TriggerType  The trigger type to configure
+
+  @retval EFI_SUCCESS       Operation successful
+  @retval EFI_DEVICE_ERROR  Hardware could not be programmed.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+AiaSetTriggerType (
+  IN  EFI_HARDWARE_INTERRUPT2_PROTOCOL      *This,
+  IN  HARDWARE_INTERRUPT_SOURCE             Source,
+  IN  EFI_HARDWARE_INTERRUPT2_TRIGGER_TYPE  TriggerType
+  )
+{
+  EFI_STATUS  Status;
+  BOOLEAN     Enabled;
+
+  Status = AiaCheckSource (Source);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  //
+  // The source mode is programmed when the source is enabled.
+  //
+  Enabled = mAia.Sources[Source].Enabled;
+  if (Enabled) {
+    AplicDisableSource ((UINT32)Source);
+  }
+
+  mAia.Sources[Source].TriggerType = TriggerType;
+  if (Enabled) {
+    return AplicEnableSource ((UINT32)Source);
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Allocate an MSI, and enable it.
+
+  @param[in]   This     The protocol instance.
+  @param[in]   Handler  The handler to call when the MSI arrives.
+  @param[in]   Context  The context to pass to Handler.
+  @param[out]  Address  The address the device writes the MSI to.
+  @param[out]  Data     The 32-bit data the device writes, which is also the
+                        interrupt identity of the MSI.
+
+  @retval  EFI_SUCCESS            The MSI is allocated.
+  @retval  EFI_INVALID_PARAMETER  Handler, Address or Data is NULL.
+  @retval  EFI_OUT_OF_RESOURCES   All interrupt identities are in use.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+AiaAllocateMsi (
+  IN  RISCV_MSI_PROTOCOL  *This,
+  IN  RISCV_MSI_HANDLER   Handler,
+  IN  VOID                *Context OPTIONAL,
+  OUT UINT64              *Address,
+  OUT UINT32              *Data
+  )
+{
+  EFI_STATUS  Status;
+
+  if ((Handler == NULL) || (Address == NULL) || (Data == NULL)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Status = ImsicAllocateId (ImsicIdMsi, 0, Handler, Context, Data);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  //
+  // MSIs are written to the seteipnum_le register at the start of the file.
+  //
+  *Address = mAia.ImsicFile;
+  return EFI_SUCCESS;
+}
+
+/**
+  Disable an MSI, and free it.
+
+  The device must have stopped signalling it.
+
+  @param[in]  This  The protocol instance.
+  @param[in]  Data  The data of the MSI, as returned by Allocate().
+
+  @retval  EFI_SUCCESS    The MSI is freed.
+  @retval  EFI_NOT_FOUND  The MSI isn't allocated.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+AiaFreeMsi (
+  IN  RISCV_MSI_PROTOCOL  *This,
+  IN  UINT32              Data
+  )
+{
+  if ((Data == 0) || (Data > mAia.NumberOfIds) || (mAia.Ids[Data].Type != ImsicIdMsi)) {
+    return EFI_NOT_FOUND;
+  }
+
+  ImsicFreeId (Data);
+  return EFI_SUCCESS;
+}
+
+STATIC EFI_HARDWARE_INTERRUPT_PROTOCOL  mHardwareInterruptProtocol = {
+  AiaRegisterInterruptSource,
+  AiaEnableInterruptSource,
+  AiaDisableInterruptSource,
+  AiaGetInterruptSourceState,
+  AiaEndOfInterrupt
+};
+
+STATIC EFI_HARDWARE_INTERRUPT2_PROTOCOL  mHardwareInterrupt2Protocol = {
+  (HARDWARE_INTERRUPT2_REGISTER)AiaRegisterInterruptSource,
+  (HARDWARE_INTERRUPT2_ENABLE)AiaEnableInterruptSource,
+  (HARDWARE_INTERRUPT2_DISABLE)AiaDisableInterruptSource,
+  (HARDWARE_INTERRUPT2_INTERRUPT_STATE)AiaGetInterruptSourceState,
+  (HARDWARE_INTERRUPT2_END_OF_INTERRUPT)AiaEndOfInterrupt,
+  AiaGetTriggerType,
+  AiaSetTriggerType
+};
+
+STATIC RISCV_MSI_PROTOCOL  mMsiProtocol = {
+  RISCV_MSI_PROTOCOL_REVISION,
+  AiaAllocateMsi,
+  AiaFreeMsi
+};
+
+/**
+  Quiesce the interrupt controllers, so the OS finds them disabled.
+
+  @param[in]  Event    The ExitBootServices event.
+  @param[in]  Context  Unused.
+
+**/
+STATIC
+VOID
+EFIAPI
+AiaExitBootServices (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  AiaSetExternalInterruptEnable (FALSE);
+  if (mAia.HasAplic) {
+    AplicShutdown ();
+  }
+
+  if (mAia.HasImsic) {
+    ImsicShutdown ();
+  }
+}
+
+/**
+  Entry point of the RISC-V AIA driver.
+
+  @param[in]  ImageHandle  The image handle.
+  @param[in]  SystemTable  The system table.
+
+  @retval  EFI_SUCCESS      The protocols are installed.
+  @retval  EFI_UNSUPPORTED  The platform has no IMSIC or APLIC for the boot hart.
+  @return  Other            An error from boot services.
+
+**/
+EFI_STATUS
+EFIAPI
+RiscVAiaDxeEntryPoint (
+  IN EFI_HANDLE        ImageHandle,
+  IN EFI_SYSTEM_TABLE  *SystemTable
+  )
+{
+  EFI_STATUS               Status;
+  RISCV_EFI_BOOT_PROTOCOL  *RiscVBootProtocol;
+  UINTN                    BootHartId;
+  UINT32                   Source;
+  EFI_HANDLE               Handle;
+
+  Status = gBS->LocateProtocol (&gRiscVEfiBootProtocolGuid, NULL, (VOID **)&RiscVBootProtocol);
+  ASSERT_EFI_ERROR (Status);
+
+  Status = RiscVBootProtocol->GetBootHartId (RiscVBootProtocol, &BootHartId);
+  ASSERT_EFI_ERROR (Status);
+
+  Status = AiaDetect (BootHartId);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_INFO, "%a: No S-level IMSIC or APLIC\n", __func__));
+    return EFI_UNSUPPORTED;
+  }
+
+  if (mAia.HasImsic) {
+    mAia.Ids = AllocateZeroPool ((mAia.NumberOfIds + 1) * sizeof (IMSIC_ID));
+    if (mAia.Ids == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    ImsicInitialize ();
+  }
+
+  if (mAia.HasAplic) {
+    mAia.Sources = AllocateZeroPool ((mAia.NumberOfSources + 1) * sizeof (APLIC_SOURCE));
+    if (mAia.Sources == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    //
+    // Wired interrupts of devices, such as virtio-mmio and PCI INTx, are
+    // mostly level-sensitive and active high.
+    //
+    for (Source = 1; Source <= mAia.NumberOfSources; Source++) {
+      mAia.Sources[Source].TriggerType = EFI_HARDWARE_INTERRUPT2_TRIGGER_LEVEL_HIGH;
+    }
+
+    AplicInitialize ();
+  }
+
+  Status = gBS->LocateProtocol (&gEfiCpuArchProtocolGuid, NULL, (VOID **)&mCpu);
+  ASSERT_EFI_ERROR (Status);
+
+  Status = mCpu->RegisterInterruptHandler (mCpu, EXCEPT_RISCV_IRQ_EXT_FROM_SMODE, AiaInterruptHandler);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "%a: failed to register the interrupt handler: %r\n", __func__, Status));
+    return Status;
+  }
+
+  Status = gBS->CreateEvent (
+                  EVT_SIGNAL_EXIT_BOOT_SERVICES,
+                  TPL_NOTIFY,
+                  AiaExitBootServices,
+                  NULL,
+                  &mExitBootServicesEvent
+                  );
+  ASSERT_EFI_ERROR (Status);
+
+  Handle = NULL;
+  if (mAia.HasAplic) {
+    Status = gBS->InstallMultipleProtocolInterfaces (
+                    &Handle,
+                    &gHardwareInterruptProtocolGuid,
+                    &mHardwareInterruptProtocol,
+                    &gHardwareInterrupt2ProtocolGuid,
+                    &mHardwareInterrupt2Protocol,
+                    NULL
+                    );
+    ASSERT_EFI_ERROR (Status);
+  }
+
+  if (mAia.HasImsic) {
+    Status = gBS->InstallMultipleProtocolInterfaces (
+                    &Handle,
+                    &gRiscVMsiProtocolGuid,
+                    &mMsiProtocol,
+                    NULL
+                    );
+    ASSERT_EFI_ERROR (Status);
+  }
+
+  AiaSetExternalInterruptEnable (TRUE);
+  return Status;
+}
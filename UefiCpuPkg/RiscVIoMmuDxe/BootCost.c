@@ -0,0 +1,436 @@
+/** @file
+  RISC-V IOMMU boot cost summary.
+
+  What DMA protection cost during boot is counted without tracing: the calls of
+  the IOMMU protocol services and the time spent in them, the time that waits
+  for the IOMMUs were blocked, and the invalidation and fence commands issued.
+  At ReadyToBoot, these are logged along with the bytes bounced and the page-table
+  pages in use, and published as the configuration table gRiscVIoMmuBootCostTableGuid,
+  for boot telemetry to track per board and firmware version.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Guid/RiscVIoMmuBootCost.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/TimerLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+#include "RiscVIoMmu.h"
+
+//
+// The calls of each service, and the time spent in them, in ticks of the performance counter.
+//
+STATIC UINT64  mServiceCalls[RiscVIoMmuBootCostServiceMax];
+STATIC UINT64  mServiceTicks[RiscVIoMmuBootCostServiceMax];
+
+//
+// Waits and commands are counted on any hart.
+//
+STATIC UINT64  mWaitTicks;
+STATIC UINT64  mInvalidationCommands;
+STATIC UINT64  mFences;
+
+STATIC RISCV_IOMMU_BOOT_COST_TABLE  *mBootCostTable = NULL;
+
+//
+// The services that the timed services call, which may themselves be traced or accounted.
+//
+STATIC EDKII_IOMMU_PROTOCOL  mTimedServices;
+
+STATIC CONST CHAR8  *mServiceNames[RiscVIoMmuBootCostServiceMax] = {
+  "SetAttribute",
+  "Map",
+  "Unmap",
+  "AllocateBuffer",
+  "FreeBuffer"
+};
+
+/**
+  Account the time that a wait for the IOMMUs was blocked.
+
+  @param[in]  Ticks  The time, in ticks of the performance counter.
+
+**/
+VOID
+IoMmuCountWaitTime (
+  IN UINT64  Ticks
+  )
+{
+  IoMmuAddToCount (&mWaitTicks, Ticks);
+}
+
+/**
+  Account the invalidation and fence commands among commands issued to an IOMMU.
+
+  @param[in]  Commands          The commands.
+  @param[in]  NumberOfCommands  The number of commands.
+
+**/
+VOID
+IoMmuCountCommands (
+  IN CONST RISCV_IOMMU_COMMAND  *Commands,
+  IN UINTN                      NumberOfCommands
+  )
+{
+  UINTN  Index;
+  UINTN  Invalidations;
+  UINTN  Fences;
+
+  Invalidations = 0;
+  Fences        = 0;
+  for (Index = 0; Index < NumberOfCommands; Index++) {
+    switch (Commands[Index].Common.Opcode) {
+      case V_RISCV_IOMMU_COMMAND_OPCODE_IOFENCE:
+        Fences++;
+        break;
+      case V_RISCV_IOMMU_COMMAND_OPCODE_IOTINVAL:
+      case V_RISCV_IOMMU_COMMAND_OPCODE_IODIR:
+        Invalidations++;
+        break;
+      case V_RISCV_IOMMU_COMMAND_OPCODE_ATS:
+        if (Commands[Index].Common.Func3 == V_RISCV_IOMMU_COMMAND_FUNC3_ATS_INVAL) {
+          Invalidations++;
+        }
+
+        break;
+      default:
+        break;
+    }
+  }
+
+  if (Invalidations != 0) {
+    IoMmuAddToCount (&mInvalidationCommands, Invalidations);
+  }
+
+  if (Fences != 0) {
+    IoMmuAddToCount (&mFences, Fences);
+  }
+}
+
+/**
+  Account a call of a service.
+
+  @param[in]  Service    The service.
+  @param[in]  StartTime  The performance counter when it was called.
+
+**/
+STATIC
+VOID
+CountServiceCall (
+  IN RISCV_IOMMU_BOOT_COST_SERVICE  Service,
+  IN UINT64                         StartTime
+  )
+{
+  //
+  // A call at a higher TPL may interrupt the accounting of another.
+  //
+  IoMmuAddToCount (&mServiceTicks[Service], GetPerformanceCounter () - StartTime);
+  IoMmuAddToCount (&mServiceCalls[Service], 1);
+}
+
+/**
+  Time SetAttribute().
+
+  @param[in]  This          The protocol instance pointer.
+  @param[in]  DeviceHandle  The device that is doing the DMA.
+  @param[in]  Mapping       The mapping value returned from Map().
+  @param[in]  IoMmuAccess   The IOMMU access.
+
+  @return  What the wrapped SetAttribute() returned.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+TimedSetAttribute (
+  IN EDKII_IOMMU_PROTOCOL  *This,
+  IN EFI_HANDLE            DeviceHandle,
+  IN VOID                  *Mapping,
+  IN UINT64                IoMmuAccess
+  )
+{
+  UINT64      StartTime;
+  EFI_STATUS  Status;
+
+  StartTime = GetPerformanceCounter ();
+  Status    = mTimedServices.SetAttribute (This, DeviceHandle, Mapping, IoMmuAccess);
+  CountServiceCall (RiscVIoMmuBootCostSetAttribute, StartTime);
+
+  return Status;
+}
+
+/**
+  Time Map().
+
+  @param[in]      This           The protocol instance pointer.
+  @param[in]      Operation      The type of the bus master operation.
+  @param[in]      HostAddress    The system memory address to map.
+  @param[in, out] NumberOfBytes  The number of bytes to map, and the number mapped.
+  @param[out]     DeviceAddress  The address the device uses for the buffer.
+  @param[out]     Mapping        The mapping value to pass to Unmap().
+
+  @return  What the wrapped Map() returned.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+TimedMap (
+  IN     EDKII_IOMMU_PROTOCOL   *This,
+  IN     EDKII_IOMMU_OPERATION  Operation,
+  IN     VOID                   *HostAddress,
+  IN OUT UINTN                  *NumberOfBytes,
+  OUT    EFI_PHYSICAL_ADDRESS   *DeviceAddress,
+  OUT    VOID                   **Mapping
+  )
+{
+  UINT64      StartTime;
+  EFI_STATUS  Status;
+
+  StartTime = GetPerformanceCounter ();
+  Status    = mTimedServices.Map (This, Operation, HostAddress, NumberOfBytes, DeviceAddress, Mapping);
+  CountServiceCall (RiscVIoMmuBootCostMap, StartTime);
+
+  return Status;
+}
+
+/**
+  Time Unmap().
+
+  @param[in]  This     The protocol instance pointer.
+  @param[in]  Mapping  The mapping value returned from Map().
+
+  @return  What the wrapped Unmap() returned.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+TimedUnmap (
+  IN  EDKII_IOMMU_PROTOCOL  *This,
+  IN  VOID                  *Mapping
+  )
+{
+  UINT64      StartTime;
+  EFI_STATUS  Status;
+
+  StartTime = GetPerformanceCounter ();
+  Status    = mTimedServices.Unmap (This, Mapping);
+  CountServiceCall (RiscVIoMmuBootCostUnmap, StartTime);
+
+  return Status;
+}
+
+/**
+  Time AllocateBuffer().
+
+  @param[in]       This        The protocol instance pointer.
+  @param[in]       Type        The type of allocation to perform.
+  @param[in]       MemoryType  The type of memory to allocate.
+  @param[in]       Pages       The number of pages to allocate.
+  @param[in, out]  HostAddress  The address of the allocated range.
+  @param[in]       Attributes  The requested bit mask of attributes.
+
+  @return  What the wrapped AllocateBuffer() returned.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+TimedAllocateBuffer (
+  IN     EDKII_IOMMU_PROTOCOL  *This,
+  IN     EFI_ALLOCATE_TYPE     Type,
+  IN     EFI_MEMORY_TYPE       MemoryType,
+  IN     UINTN                 Pages,
+  IN OUT VOID                  **HostAddress,
+  IN     UINT64                Attributes
+  )
+{
+  UINT64      StartTime;
+  EFI_STATUS  Status;
+
+  StartTime = GetPerformanceCounter ();
+  Status    = mTimedServices.AllocateBuffer (This, Type, MemoryType, Pages, HostAddress, Attributes);
+  CountServiceCall (RiscVIoMmuBootCostAllocateBuffer, StartTime);
+
+  return Status;
+}
+
+/**
+  Time FreeBuffer().
+
+  @param[in]  This         The protocol instance pointer.
+  @param[in]  Pages        The number of pages to free.
+  @param[in]  HostAddress  The base system memory address of the allocated range.
+
+  @return  What the wrapped FreeBuffer() returned.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+TimedFreeBuffer (
+  IN  EDKII_IOMMU_PROTOCOL  *This,
+  IN  UINTN                 Pages,
+  IN  VOID                  *HostAddress
+  )
+{
+  UINT64      StartTime;
+  EFI_STATUS  Status;
+
+  StartTime = GetPerformanceCounter ();
+  Status    = mTimedServices.FreeBuffer (This, Pages, HostAddress);
+  CountServiceCall (RiscVIoMmuBootCostFreeBuffer, StartTime);
+
+  return Status;
+}
+
+/**
+  Fill in the boot cost summary.
+
+  @param[out]  Table  The summary.
+
+**/
+STATIC
+VOID
+FillBootCostTable (
+  OUT RISCV_IOMMU_BOOT_COST_TABLE  *Table
+  )
+{
+  RISCV_IOMMU_INSTANCE       *IoMmu;
+  RISCV_IOMMU_DEVICE_DOMAIN  *Domain;
+  LIST_ENTRY                 *Link;
+  UINTN                      IoMmuIndex;
+  UINTN                      Index;
+  EFI_TPL                    OriginalTpl;
+
+  ZeroMem (Table, sizeof (*Table));
+  Table->Signature = RISCV_IOMMU_BOOT_COST_TABLE_SIGNATURE;
+  Table->Revision  = RISCV_IOMMU_BOOT_COST_TABLE_REVISION;
+  Table->Size      = sizeof (*Table);
+
+  for (Index = 0; Index < RiscVIoMmuBootCostServiceMax; Index++) {
+    Table->Services[Index].Calls = mServiceCalls[Index];
+    Table->Services[Index].Time  = GetTimeInNanoSecond (mServiceTicks[Index]);
+  }
+
+  Table->WaitTime             = GetTimeInNanoSecond (mWaitTicks);
+  Table->InvalidationCommands = mInvalidationCommands;
+  Table->Fences               = mFences;
+  Table->PageTablePages       = EFI_SIZE_TO_PAGES ((UINTN)IoMmuGetFootprint (RiscVIoMmuFootprintPageTable));
+
+  //
+  // The bytes bounced are already counted for each device.
+  //
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  for (IoMmuIndex = 0; (IoMmu = IoMmuGetInstance (IoMmuIndex)) != NULL; IoMmuIndex++) {
+    Table->NumberOfIoMmus++;
+    for (Link = GetFirstNode (&IoMmu->DomainList)
+         ; !IsNull (&IoMmu->DomainList, Link)
+         ; Link = GetNextNode (&IoMmu->DomainList, Link)
+         ) {
+      Domain = RISCV_IOMMU_DEVICE_DOMAIN_FROM_LINK (Link);
+      for (Index = 0; Index < RiscVIoMmuBounceReasonMax; Index++) {
+        Table->BytesBounced += Domain->Statistics.BytesBounced[Index];
+      }
+    }
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+}
+
+/**
+  Log the cost of DMA protection so far, and publish it.
+
+  ReadyToBoot is signalled again by each boot option that returns, so the table is
+  refreshed each time.
+
+  @param[in]  Event    The ReadyToBoot event.
+  @param[in]  Context  Unused.
+
+**/
+STATIC
+VOID
+EFIAPI
+OnReadyToBoot (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  RISCV_IOMMU_BOOT_COST_TABLE  Table;
+  UINTN                        Index;
+  EFI_STATUS                   Status;
+
+  FillBootCostTable (&Table);
+
+  DEBUG ((RISCV_IOMMU_DEBUG_LEVEL, "%a: DMA protection cost of %u IOMMUs during boot:\n", __func__, Table.NumberOfIoMmus));
+  for (Index = 0; Index < RiscVIoMmuBootCostServiceMax; Index++) {
+    DEBUG ((
+      RISCV_IOMMU_DEBUG_LEVEL,
+      "  %-22a %8lu calls %10lu us\n",
+      mServiceNames[Index],
+      Table.Services[Index].Calls,
+      DivU64x32 (Table.Services[Index].Time, 1000)
+      ));
+  }
+
+  DEBUG ((RISCV_IOMMU_DEBUG_LEVEL, "  %-22a %25lu us\n", "Blocked on the IOMMUs", DivU64x32 (Table.WaitTime, 1000)));
+  DEBUG ((RISCV_IOMMU_DEBUG_LEVEL, "  %-22a %10lu KiB\n", "Bounced", DivU64x32 (Table.BytesBounced, SIZE_1KB)));
+  DEBUG ((RISCV_IOMMU_DEBUG_LEVEL, "  %-22a %10lu\n", "Invalidation commands", Table.InvalidationCommands));
+  DEBUG ((RISCV_IOMMU_DEBUG_LEVEL, "  %-22a %10lu\n", "Fences", Table.Fences));
+  DEBUG ((RISCV_IOMMU_DEBUG_LEVEL, "  %-22a %10lu\n", "Page-table pages", Table.PageTablePages));
+
+  if (mBootCostTable == NULL) {
+    Status = gBS->AllocatePool (EfiACPIReclaimMemory, sizeof (Table), (VOID **)&mBootCostTable);
+    if (EFI_ERROR (Status)) {
+      DEBUG ((DEBUG_WARN, "%a: Failed to allocate the boot cost table: %r\n", __func__, Status));
+      mBootCostTable = NULL;
+      return;
+    }
+
+    CopyMem (mBootCostTable, &Table, sizeof (Table));
+    Status = gBS->InstallConfigurationTable (&gRiscVIoMmuBootCostTableGuid, mBootCostTable);
+    if (EFI_ERROR (Status)) {
+      DEBUG ((DEBUG_WARN, "%a: Failed to publish the boot cost table: %r\n", __func__, Status));
+      gBS->FreePool (mBootCostTable);
+      mBootCostTable = NULL;
+    }
+
+    return;
+  }
+
+  CopyMem (mBootCostTable, &Table, sizeof (Table));
+}
+
+/**
+  Time the IOMMU protocol services, and print and publish the cost of DMA protection
+  during boot at ReadyToBoot.
+
+  Must be called before the protocol is installed, after its services are wrapped otherwise.
+
+  @retval  EFI_SUCCESS  The event is registered.
+  @retval  Others       The event could not be created. The services are timed, but nothing is reported.
+
+**/
+EFI_STATUS
+IoMmuInitialiseBootCost (
+  VOID
+  )
+{
+  EFI_EVENT  ReadyToBootEvent;
+
+  mTimedServices                     = mRiscVIoMmuProtocol;
+  mRiscVIoMmuProtocol.SetAttribute   = TimedSetAttribute;
+  mRiscVIoMmuProtocol.Map            = TimedMap;
+  mRiscVIoMmuProtocol.Unmap          = TimedUnmap;
+  mRiscVIoMmuProtocol.AllocateBuffer = TimedAllocateBuffer;
+  mRiscVIoMmuProtocol.FreeBuffer     = TimedFreeBuffer;
+
+  return EfiCreateEventReadyToBootEx (TPL_CALLBACK, OnReadyToBoot, NULL, &ReadyToBootEvent);
+}
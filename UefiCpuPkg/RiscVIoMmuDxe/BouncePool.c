@@ -0,0 +1,243 @@
+/** @file
+  RISC-V IOMMU bounce-buffer pool.
+
+  The pool is reserved below 4 GiB when the driver initialises, and is split
+  into size classes of power-of-two pages. Each class keeps a free list that
+  is linked through the free buffers themselves, so bounced transfers are
+  served without calling into the DXE core.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/PcdLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include "RiscVIoMmu.h"
+
+//
+// Classes of 1, 2, 4, 8 and 16 pages. Larger transfers are bounced through AllocatePages().
+//
+#define BOUNCE_POOL_NUMBER_OF_CLASSES  5
+
+typedef struct _BOUNCE_BUFFER BOUNCE_BUFFER;
+struct _BOUNCE_BUFFER {
+  BOUNCE_BUFFER  *NextFree;
+};
+
+typedef struct {
+  EFI_PHYSICAL_ADDRESS  Base;
+  UINTN                 NumberOfPages;
+  BOUNCE_BUFFER         *FreeList[BOUNCE_POOL_NUMBER_OF_CLASSES];
+  EFI_PHYSICAL_ADDRESS  ClassBase[BOUNCE_POOL_NUMBER_OF_CLASSES + 1];
+} BOUNCE_POOL;
+
+STATIC BOUNCE_POOL  mBouncePool;
+
+/**
+  Reserve the bounce-buffer pool, below the top of IOMMU-addressable memory and 4 GiB.
+
+  The pool is sized by PcdRiscVIoMmuBouncePoolSize, and split evenly between the classes.
+
+  @retval  EFI_SUCCESS           The pool is reserved, or is disabled.
+  @retval  EFI_OUT_OF_RESOURCES  The pool could not be reserved.
+
+**/
+EFI_STATUS
+IoMmuInitialiseBouncePool (
+  VOID
+  )
+{
+  UINTN                 ClassPages;
+  UINTN                 BuffersPerClass;
+  UINTN                 Class;
+  UINTN                 Index;
+  EFI_PHYSICAL_ADDRESS  Buffer;
+  BOUNCE_BUFFER         *Entry;
+  EFI_STATUS            Status;
+
+  BuffersPerClass = EFI_SIZE_TO_PAGES (PcdGet32 (PcdRiscVIoMmuBouncePoolSize)) /
+                    ((1 << BOUNCE_POOL_NUMBER_OF_CLASSES) - 1);
+  if (BuffersPerClass == 0) {
+    return EFI_SUCCESS;
+  }
+
+  mBouncePool.NumberOfPages = BuffersPerClass * ((1 << BOUNCE_POOL_NUMBER_OF_CLASSES) - 1);
+  mBouncePool.Base          = MIN (RiscVGetIoMmuMemoryTop (), SIZE_4GB - 1);
+
+  //
+  // The pool comes from the platform's DMA pool, or else is local to the IOMMUs,
+  // if they share a proximity domain.
+  //
+  Buffer = (EFI_PHYSICAL_ADDRESS)(UINTN)IoMmuAllocateDmaPoolPages (mBouncePool.NumberOfPages, EFI_PAGE_SIZE, mBouncePool.Base);
+  if (Buffer == 0) {
+    Buffer = (EFI_PHYSICAL_ADDRESS)(UINTN)IoMmuAllocateLocalPages (NULL, mBouncePool.NumberOfPages, EFI_PAGE_SIZE, mBouncePool.Base);
+  }
+
+  if (Buffer != 0) {
+    mBouncePool.Base = Buffer;
+    Status           = EFI_SUCCESS;
+  } else {
+    Status = gBS->AllocatePages (
+                    AllocateMaxAddress,
+                    EfiBootServicesData,
+                    mBouncePool.NumberOfPages,
+                    &mBouncePool.Base
+                    );
+  }
+
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "%a: Failed to reserve 0x%x pages\n", __func__, mBouncePool.NumberOfPages));
+    mBouncePool.NumberOfPages = 0;
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Buffer = mBouncePool.Base;
+  for (Class = 0; Class < BOUNCE_POOL_NUMBER_OF_CLASSES; Class++) {
+    ClassPages                   = (UINTN)1 << Class;
+    mBouncePool.ClassBase[Class] = Buffer;
+    mBouncePool.FreeList[Class]  = NULL;
+    for (Index = 0; Index < BuffersPerClass; Index++) {
+      Entry                       = (BOUNCE_BUFFER *)(UINTN)Buffer;
+      Entry->NextFree             = mBouncePool.FreeList[Class];
+      mBouncePool.FreeList[Class] = Entry;
+      Buffer                     += EFI_PAGES_TO_SIZE (ClassPages);
+    }
+  }
+
+  mBouncePool.ClassBase[BOUNCE_POOL_NUMBER_OF_CLASSES] = Buffer;
+  IoMmuChargeFootprint (RiscVIoMmuFootprintBouncePool, EFI_PAGES_TO_SIZE (mBouncePool.NumberOfPages));
+
+  DEBUG ((
+    RISCV_IOMMU_DEBUG_LEVEL,
+    "%a: Reserved 0x%x pages at 0x%lx, with 0x%x buffers per class\n",
+    __func__,
+    mBouncePool.NumberOfPages,
+    mBouncePool.Base,
+    BuffersPerClass
+    ));
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Take a bounce buffer from the pool.
+
+  @param[in]  NumberOfPages  The number of pages needed.
+  @param[in]  MaxAddress     The highest address the buffer may end at.
+
+  @return  The address of the buffer, or 0 if the pool cannot serve the request.
+
+**/
+EFI_PHYSICAL_ADDRESS
+IoMmuAllocateBounceBuffer (
+  IN UINTN                 NumberOfPages,
+  IN EFI_PHYSICAL_ADDRESS  MaxAddress
+  )
+{
+  UINTN          Class;
+  BOUNCE_BUFFER  *Entry;
+  EFI_TPL        OriginalTpl;
+
+  if ((mBouncePool.NumberOfPages == 0) ||
+      (NumberOfPages == 0) ||
+      (mBouncePool.ClassBase[BOUNCE_POOL_NUMBER_OF_CLASSES] - 1 > MaxAddress))
+  {
+    return 0;
+  }
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+
+  //
+  // Take the smallest class that fits, falling back to the larger ones.
+  //
+  Entry = NULL;
+  for (Class = HighBitSet64 (NumberOfPages); Class < BOUNCE_POOL_NUMBER_OF_CLASSES; Class++) {
+    if (((UINTN)1 << Class) < NumberOfPages) {
+      continue;
+    }
+
+    Entry = mBouncePool.FreeList[Class];
+    if (Entry != NULL) {
+      mBouncePool.FreeList[Class] = Entry->NextFree;
+      break;
+    }
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+  return (EFI_PHYSICAL_ADDRESS)(UINTN)Entry;
+}
+
+/**
+  Return a bounce buffer to the pool.
+
+  @param[in]  Address  The address of the buffer.
+
+  @retval  TRUE   The buffer was returned to the pool.
+  @retval  FALSE  The buffer is not part of the pool.
+
+**/
+BOOLEAN
+IoMmuFreeBounceBuffer (
+  IN EFI_PHYSICAL_ADDRESS  Address
+  )
+{
+  UINTN          Class;
+  BOUNCE_BUFFER  *Entry;
+  EFI_TPL        OriginalTpl;
+
+  if ((mBouncePool.NumberOfPages == 0) ||
+      (Address < mBouncePool.Base) ||
+      (Address >= mBouncePool.ClassBase[BOUNCE_POOL_NUMBER_OF_CLASSES]))
+  {
+    return FALSE;
+  }
+
+  Class = 0;
+  while (Address >= mBouncePool.ClassBase[Class + 1]) {
+    Class++;
+  }
+
+  ASSERT (((Address - mBouncePool.ClassBase[Class]) & (EFI_PAGES_TO_SIZE ((UINTN)1 << Class) - 1)) == 0);
+
+  OriginalTpl                 = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  Entry                       = (BOUNCE_BUFFER *)(UINTN)Address;
+  Entry->NextFree             = mBouncePool.FreeList[Class];
+  mBouncePool.FreeList[Class] = Entry;
+  gBS->RestoreTPL (OriginalTpl);
+
+  return TRUE;
+}
+
+/**
+  Report the size of the bounce-buffer pool, and how much of it is free.
+
+  @param[out]  NumberOfPages  The pages of the pool.
+  @param[out]  FreePages      The pages of the free buffers.
+
+**/
+VOID
+IoMmuGetBouncePoolUsage (
+  OUT UINTN  *NumberOfPages,
+  OUT UINTN  *FreePages
+  )
+{
+  UINTN          Class;
+  BOUNCE_BUFFER  *Entry;
+  EFI_TPL        OriginalTpl;
+
+  *NumberOfPages = mBouncePool.NumberOfPages;
+  *FreePages     = 0;
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  for (Class = 0; Class < BOUNCE_POOL_NUMBER_OF_CLASSES; Class++) {
+    for (Entry = mBouncePool.FreeList[Class]; Entry != NULL; Entry = Entry->NextFree) {
+      *FreePages += (UINTN)1 << Class;
+    }
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+}
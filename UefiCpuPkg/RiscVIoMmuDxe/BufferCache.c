@@ -0,0 +1,216 @@
+/** @file
+  RISC-V IOMMU cache of freed common buffers.
+
+  Drivers that repeatedly allocate and free DMA buffers, such as USB
+  enumeration or network stacks, would otherwise pay an allocation, a
+  mapping and an invalidation every time. Small buffers freed with
+  FreeBuffer() are instead kept here, with their persistent mapping and the
+  translation of the device that used them, in classes by memory type and
+  page count. AllocateBuffer() serves a matching request from its class.
+
+  The cache is bounded by PcdRiscVIoMmuBufferCacheSize, and is flushed
+  by the teardown before boot services exit.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/PcdLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include "RiscVIoMmu.h"
+
+//
+// Buffers of 1 to 16 pages are cached. Larger ones are freed at once.
+//
+#define BUFFER_CACHE_MAX_PAGES  16
+
+//
+// EfiBootServicesData and EfiRuntimeServicesData.
+//
+#define BUFFER_CACHE_NUMBER_OF_TYPES  2
+
+typedef struct {
+  // Linked through MAP_INFO.NextFree.
+  MAP_INFO    *Buffers[BUFFER_CACHE_NUMBER_OF_TYPES][BUFFER_CACHE_MAX_PAGES];
+  UINTN       NumberOfPages;
+  UINTN       MaxPages;
+} BUFFER_CACHE;
+
+STATIC BUFFER_CACHE  mBufferCache;
+
+/**
+  Return the type index of a memory type.
+
+  @param[in]  MemoryType  EfiBootServicesData or EfiRuntimeServicesData.
+
+  @return  The index into BUFFER_CACHE.Buffers.
+
+**/
+STATIC
+UINTN
+GetTypeIndex (
+  IN EFI_MEMORY_TYPE  MemoryType
+  )
+{
+  return (MemoryType == EfiRuntimeServicesData) ? 1 : 0;
+}
+
+/**
+  Free every cached buffer, and revoke the translations that kept them warm.
+
+  The buffers that cannot be unmapped are leaked.
+
+**/
+VOID
+IoMmuFlushBufferCache (
+  VOID
+  )
+{
+  UINTN                 Type;
+  UINTN                 Class;
+  MAP_INFO              *MapInfo;
+  EFI_PHYSICAL_ADDRESS  HostAddress;
+  UINTN                 Pages;
+  EFI_TPL               OriginalTpl;
+  EFI_STATUS            Status;
+
+  for (Type = 0; Type < BUFFER_CACHE_NUMBER_OF_TYPES; Type++) {
+    for (Class = 0; Class < BUFFER_CACHE_MAX_PAGES; Class++) {
+      while (TRUE) {
+        OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+        MapInfo     = mBufferCache.Buffers[Type][Class];
+        if (MapInfo != NULL) {
+          mBufferCache.Buffers[Type][Class] = MapInfo->NextFree;
+          mBufferCache.NumberOfPages       -= Class + 1;
+        }
+
+        gBS->RestoreTPL (OriginalTpl);
+        if (MapInfo == NULL) {
+          break;
+        }
+
+        MapInfo->Cached = FALSE;
+        HostAddress     = MapInfo->HostAddress;
+        Pages           = EFI_SIZE_TO_PAGES (MapInfo->NumberOfBytes);
+        Status          = IoMmuDestroyPersistentMapping (MapInfo);
+        if (!EFI_ERROR (Status)) {
+          gBS->FreePages (HostAddress, Pages);
+        }
+      }
+    }
+  }
+}
+
+/**
+  Start caching freed buffers, if PcdRiscVIoMmuBufferCacheSize enables the cache.
+
+  The cache is flushed by the teardown at ExitBootServices(), so it needs that to be registered.
+
+  @retval  EFI_SUCCESS      The cache is ready, or is disabled.
+  @retval  EFI_UNSUPPORTED  The teardown isn't registered. Nothing is cached.
+
+**/
+EFI_STATUS
+IoMmuInitialiseBufferCache (
+  VOID
+  )
+{
+  if (PcdGet32 (PcdRiscVIoMmuBufferCacheSize) < EFI_PAGE_SIZE) {
+    return EFI_SUCCESS;
+  }
+
+  if (!mRiscVIoMmuGlobalDriverContext.TeardownAtExit) {
+    return EFI_UNSUPPORTED;
+  }
+
+  mBufferCache.MaxPages = EFI_SIZE_TO_PAGES (PcdGet32 (PcdRiscVIoMmuBufferCacheSize));
+  return EFI_SUCCESS;
+}
+
+/**
+  Keep a buffer that is being freed, with its persistent mapping and translation.
+
+  @param[in]  MapInfo     The persistent mapping of the buffer.
+  @param[in]  MemoryType  The memory type the buffer was allocated as.
+
+  @retval  TRUE   The buffer is cached, so the caller must not free it.
+  @retval  FALSE  The buffer isn't cacheable, or the cache is full.
+
+**/
+BOOLEAN
+IoMmuCacheBuffer (
+  IN MAP_INFO         *MapInfo,
+  IN EFI_MEMORY_TYPE  MemoryType
+  )
+{
+  UINTN    Pages;
+  UINTN    Type;
+  EFI_TPL  OriginalTpl;
+  BOOLEAN  Cached;
+
+  ASSERT (MapInfo->Persistent);
+
+  Pages = EFI_SIZE_TO_PAGES (MapInfo->NumberOfBytes);
+  if ((Pages > BUFFER_CACHE_MAX_PAGES) || MapInfo->InvalidationPending) {
+    return FALSE;
+  }
+
+  Type        = GetTypeIndex (MemoryType);
+  Cached      = FALSE;
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  if (mBufferCache.NumberOfPages + Pages <= mBufferCache.MaxPages) {
+    MapInfo->Cached                       = TRUE;
+    MapInfo->NextFree                     = mBufferCache.Buffers[Type][Pages - 1];
+    mBufferCache.Buffers[Type][Pages - 1] = MapInfo;
+    mBufferCache.NumberOfPages           += Pages;
+    Cached                                = TRUE;
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+  return Cached;
+}
+
+/**
+  Take a cached buffer for an allocation.
+
+  @param[in]  MemoryType  The memory type of the allocation.
+  @param[in]  Pages       The number of pages of the allocation.
+  @param[in]  Limit       The highest address the buffer may reach.
+
+  @return  The persistent mapping of the buffer, or NULL if none matches.
+
+**/
+MAP_INFO *
+IoMmuTakeCachedBuffer (
+  IN EFI_MEMORY_TYPE       MemoryType,
+  IN UINTN                 Pages,
+  IN EFI_PHYSICAL_ADDRESS  Limit
+  )
+{
+  MAP_INFO  **Link;
+  MAP_INFO  *MapInfo;
+  EFI_TPL   OriginalTpl;
+
+  if ((Pages == 0) || (Pages > BUFFER_CACHE_MAX_PAGES)) {
+    return NULL;
+  }
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  for (Link = &mBufferCache.Buffers[GetTypeIndex (MemoryType)][Pages - 1]; *Link != NULL; Link = &(*Link)->NextFree) {
+    MapInfo = *Link;
+    if (MapInfo->HostAddress + MapInfo->NumberOfBytes - 1 <= Limit) {
+      *Link                       = MapInfo->NextFree;
+      mBufferCache.NumberOfPages -= Pages;
+      MapInfo->Cached             = FALSE;
+      gBS->RestoreTPL (OriginalTpl);
+      return MapInfo;
+    }
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+  return NULL;
+}
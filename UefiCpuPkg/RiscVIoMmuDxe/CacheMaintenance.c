@@ -0,0 +1,492 @@
+/** @file
+  RISC-V IOMMU cache maintenance for non-coherent table walks.
+
+  An IOMMU whose memory accesses don't snoop the harts' caches only sees
+  the device-directory table, the IO page tables and the command queue once
+  they are cleaned to memory, and the hart only sees the fault and page-request
+  records and fence completions once its stale copies are invalidated. This is
+  done with Zicbom, over the exact cache blocks written: cleans are batched
+  per IOMMU, and issued together before the fence that publishes the writes.
+
+  The streaming buffers of devices behind such an IOMMU are maintained the
+  same way around their transfers, by direction.
+
+  Where every hart implements Svpbmt, the queues are mapped non-cacheable
+  instead, so that the IOMMU and the hart meet in memory, and producing
+  commands or consuming records needs no maintenance per entry.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/DxeServicesTableLib.h>
+#include <Library/RiscVIsaLib.h>
+#include <Library/SynchronizationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include "RiscVIoMmu.h"
+
+//
+// The Zicbom block size, once an IOMMU or a write-combining buffer needs cache maintenance,
+// and whether an IOMMU does.
+//
+STATIC UINTN    mCleanBlockSize;
+STATIC BOOLEAN  mNonCoherentTables;
+
+//
+// Whether queues can be mapped non-cacheable, once it is determined.
+//
+STATIC BOOLEAN  mSvpbmtChecked;
+STATIC BOOLEAN  mSvpbmt;
+
+/**
+  Clean the cache blocks of a range to memory.
+
+  @param[in]  Start  The first block.
+  @param[in]  End    The end of the last block.
+
+**/
+STATIC
+VOID
+CleanBlocks (
+  IN UINTN  Start,
+  IN UINTN  End
+  )
+{
+  for ( ; Start < End; Start += mCleanBlockSize) {
+    RiscVCpuCacheCleanCmoAsm (Start);
+  }
+}
+
+/**
+  Take the lock of a batch of cleans, which a hart other than the boot hart may clean.
+
+  @param[in]  Batch  The batch.
+
+**/
+STATIC
+VOID
+AcquireBatch (
+  IN CLEAN_BATCH  *Batch
+  )
+{
+  while (InterlockedCompareExchange32 (&Batch->Lock, 0, 1) != 0) {
+    CpuPause ();
+  }
+}
+
+/**
+  Clean the ranges of a batch, whose lock is held, and empty it.
+
+  @param[in]  Batch  The batch.
+
+**/
+STATIC
+VOID
+CleanBatch (
+  IN CLEAN_BATCH  *Batch
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < Batch->NumberOfRanges; Index++) {
+    CleanBlocks (Batch->Ranges[Index].Start, Batch->Ranges[Index].End);
+  }
+
+  Batch->NumberOfRanges = 0;
+}
+
+/**
+  Prepare the cache maintenance of an IOMMU, if its memory accesses are not coherent.
+
+  @param[in]  IoMmu  The IOMMU, before any of its tables are written.
+
+  @retval  EFI_SUCCESS      The IOMMU is coherent, or its tables can be cleaned.
+  @retval  EFI_UNSUPPORTED  The IOMMU is not coherent, and not every hart implements Zicbom.
+
+**/
+EFI_STATUS
+IoMmuInitialiseCacheMaintenance (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  IoMmu->PendingCleans.NumberOfRanges = 0;
+  IoMmu->PendingCleans.Lock           = 0;
+  if (!IoMmu->NonCoherent) {
+    return EFI_SUCCESS;
+  }
+
+  if (mCleanBlockSize == 0) {
+    mCleanBlockSize = RiscVIsaGetCbomBlockSize ();
+    if (mCleanBlockSize == 0) {
+      DEBUG ((DEBUG_ERROR, "%a: IOMMU at 0x%lx is not coherent, and the harts lack Zicbom\n", __func__, IoMmu->Address));
+      return EFI_UNSUPPORTED;
+    }
+  }
+
+  DEBUG ((RISCV_IOMMU_DEBUG_LEVEL, "%a: IOMMU at 0x%lx is not coherent, cleaning %u-byte blocks\n", __func__, IoMmu->Address, mCleanBlockSize));
+  mNonCoherentTables = TRUE;
+  return EFI_SUCCESS;
+}
+
+/**
+  Record that a range of a table or queue was written, for the IOMMU to read once it
+  is cleaned by IoMmuFlushCacheCleans(). Adjacent ranges coalesce, and a full batch
+  is cleaned early.
+
+  @param[in]  IoMmu    The IOMMU that reads the range.
+  @param[in]  Address  The first byte written.
+  @param[in]  Length   The number of bytes written.
+
+**/
+VOID
+IoMmuQueueCacheClean (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN CONST VOID            *Address,
+  IN UINTN                 Length
+  )
+{
+  CLEAN_BATCH        *Batch;
+  CACHE_CLEAN_RANGE  *Range;
+  UINTN              Start;
+  UINTN              End;
+  EFI_TPL            OriginalTpl;
+
+  if (!IoMmu->NonCoherent || (Length == 0)) {
+    return;
+  }
+
+  Start = (UINTN)Address & ~(mCleanBlockSize - 1);
+  End   = ALIGN_VALUE ((UINTN)Address + Length, mCleanBlockSize);
+
+  //
+  // Page-table updates walk the entries of a table in order, so the last range usually grows.
+  // Page requests are serviced from a timer, and add to the same batch.
+  //
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  Batch       = &IoMmu->PendingCleans;
+  AcquireBatch (Batch);
+  if (Batch->NumberOfRanges != 0) {
+    Range = &Batch->Ranges[Batch->NumberOfRanges - 1];
+    if ((Start <= Range->End) && (End >= Range->Start)) {
+      Range->Start = MIN (Range->Start, Start);
+      Range->End   = MAX (Range->End, End);
+      InterlockedExchange32 (&Batch->Lock, 0);
+      gBS->RestoreTPL (OriginalTpl);
+      return;
+    }
+  }
+
+  if (Batch->NumberOfRanges == RISCV_IOMMU_PENDING_CLEANS) {
+    CleanBatch (Batch);
+  }
+
+  Range        = &Batch->Ranges[Batch->NumberOfRanges++];
+  Range->Start = Start;
+  Range->End   = End;
+  InterlockedExchange32 (&Batch->Lock, 0);
+  gBS->RestoreTPL (OriginalTpl);
+}
+
+/**
+  Clean the ranges recorded by IoMmuQueueCacheClean(). The caller's fence orders
+  the cleans before the IOMMU is told to read the ranges.
+
+  @param[in]  IoMmu  The IOMMU.
+
+**/
+VOID
+IoMmuFlushCacheCleans (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  EFI_TPL  OriginalTpl;
+
+  if (!IoMmu->NonCoherent) {
+    return;
+  }
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  IoMmuFlushCacheCleansFromAp (IoMmu);
+  gBS->RestoreTPL (OriginalTpl);
+}
+
+/**
+  Clean the ranges recorded by IoMmuQueueCacheClean() on a hart other than the boot
+  hart, which can't raise the TPL. The caller's fence orders the cleans before the
+  IOMMU is told to read the ranges.
+
+  The boot hart holds the lock at the raised TPL only, so the lock alone keeps the
+  batch consistent here. Zicbom cleans reach the blocks the boot hart wrote too.
+
+  @param[in]  IoMmu  The IOMMU.
+
+**/
+VOID
+IoMmuFlushCacheCleansFromAp (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  CLEAN_BATCH  *Batch;
+
+  if (!IoMmu->NonCoherent) {
+    return;
+  }
+
+  Batch = &IoMmu->PendingCleans;
+  AcquireBatch (Batch);
+  CleanBatch (Batch);
+  InterlockedExchange32 (&Batch->Lock, 0);
+}
+
+/**
+  Clean a newly zeroed table page, if any IOMMU walks tables without snooping.
+  A table is linked in by a later write, so its zeroes must reach memory first.
+
+  @param[in]  Page  The page.
+
+**/
+VOID
+IoMmuCleanTablePage (
+  IN VOID  *Page
+  )
+{
+  if (!mNonCoherentTables) {
+    return;
+  }
+
+  CleanBlocks ((UINTN)Page, (UINTN)Page + EFI_PAGE_SIZE);
+  MemoryFence ();
+}
+
+/**
+  Discard the hart's copies of a range that the IOMMU wrote, before it is read.
+  The range must not share a cache block with memory the hart writes.
+
+  @param[in]  IoMmu    The IOMMU that wrote the range.
+  @param[in]  Address  The first byte.
+  @param[in]  Length   The number of bytes.
+
+**/
+VOID
+IoMmuInvalidateCacheRange (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN CONST VOID            *Address,
+  IN UINTN                 Length
+  )
+{
+  UINTN  Start;
+  UINTN  End;
+
+  if (!IoMmu->NonCoherent || (Length == 0)) {
+    return;
+  }
+
+  End = ALIGN_VALUE ((UINTN)Address + Length, mCleanBlockSize);
+  for (Start = (UINTN)Address & ~(mCleanBlockSize - 1); Start < End; Start += mCleanBlockSize) {
+    RiscVCpuCacheInvalCmoAsm (Start);
+  }
+
+  MemoryFence ();
+}
+
+/**
+  Prepare the cache for a device without coherent DMA to transfer a buffer.
+
+  The data a device reads is cleaned to memory. The blocks a device writes are also
+  invalidated, so that no dirty copy can be evicted over the data it wrote.
+
+  @param[in]  Operation  The operation the buffer was mapped for.
+  @param[in]  Address    The buffer the device accesses.
+  @param[in]  Length     The length of the buffer.
+
+**/
+VOID
+IoMmuPrepareDmaBuffer (
+  IN EDKII_IOMMU_OPERATION  Operation,
+  IN EFI_PHYSICAL_ADDRESS   Address,
+  IN UINTN                  Length
+  )
+{
+  UINTN  Start;
+  UINTN  End;
+
+  if (Length == 0) {
+    return;
+  }
+
+  End = ALIGN_VALUE ((UINTN)Address + Length, mCleanBlockSize);
+  if ((Operation == EdkiiIoMmuOperationBusMasterRead) || (Operation == EdkiiIoMmuOperationBusMasterRead64)) {
+    CleanBlocks ((UINTN)Address & ~(mCleanBlockSize - 1), End);
+  } else {
+    for (Start = (UINTN)Address & ~(mCleanBlockSize - 1); Start < End; Start += mCleanBlockSize) {
+      RiscVCpuCacheFlushCmoAsm (Start);
+    }
+  }
+
+  MemoryFence ();
+}
+
+/**
+  Write back and discard the hart's copies of a range, before it is mapped with another
+  memory type.
+
+  @param[in]  Address  The first byte.
+  @param[in]  Length   The number of bytes.
+
+  @retval  TRUE   The range was flushed.
+  @retval  FALSE  Not every hart implements Zicbom, so the range could not be flushed.
+
+**/
+BOOLEAN
+IoMmuFlushCacheRange (
+  IN EFI_PHYSICAL_ADDRESS  Address,
+  IN UINTN                 Length
+  )
+{
+  UINTN  Start;
+  UINTN  End;
+
+  if (mCleanBlockSize == 0) {
+    mCleanBlockSize = RiscVIsaGetCbomBlockSize ();
+    if (mCleanBlockSize == 0) {
+      return FALSE;
+    }
+  }
+
+  End = ALIGN_VALUE ((UINTN)Address + Length, mCleanBlockSize);
+  for (Start = (UINTN)Address & ~(mCleanBlockSize - 1); Start < End; Start += mCleanBlockSize) {
+    RiscVCpuCacheFlushCmoAsm (Start);
+  }
+
+  MemoryFence ();
+  return TRUE;
+}
+
+/**
+  Map the newly allocated buffer of a queue of an IOMMU without coherence non-cacheable,
+  with Svpbmt, if every hart implements it. Otherwise, the queue stays write-back, and
+  its entries are cleaned and invalidated one by one.
+
+  @param[in]  IoMmu        The IOMMU.
+  @param[in]  QueueStruct  The queue, whose buffer the IOMMU doesn't use yet.
+
+**/
+VOID
+IoMmuMapQueueUncached (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN QUEUE_WRAPPER         *QueueStruct
+  )
+{
+  EFI_GCD_MEMORY_SPACE_DESCRIPTOR  Descriptor;
+  EFI_PHYSICAL_ADDRESS             Address;
+  UINTN                            Size;
+  EFI_STATUS                       Status;
+
+  QueueStruct->Uncached = FALSE;
+  if (!IoMmu->NonCoherent || !QueueStruct->Allocated) {
+    return;
+  }
+
+  if (!mSvpbmtChecked) {
+    mSvpbmt        = (RiscVIsaGetFeatures () & RISCV_ISA_FEATURE_SVPBMT) != 0;
+    mSvpbmtChecked = TRUE;
+  }
+
+  if (!mSvpbmt) {
+    return;
+  }
+
+  Address = (EFI_PHYSICAL_ADDRESS)(UINTN)QueueStruct->Buffer;
+  Size    = EFI_PAGES_TO_SIZE (EFI_SIZE_TO_PAGES ((QueueStruct->Mask + 1) * QueueStruct->EntrySize));
+  Status  = gDS->GetMemorySpaceDescriptor (Address, &Descriptor);
+  if (EFI_ERROR (Status) || ((Descriptor.Capabilities & EFI_MEMORY_WC) == 0)) {
+    return;
+  }
+
+  //
+  // No dirty block of the cached mapping may be written back over the IOMMU's records.
+  //
+  if (!IoMmuFlushCacheRange (Address, Size)) {
+    return;
+  }
+
+  Status = gDS->SetMemorySpaceAttributes (Address, Size, (Descriptor.Attributes & ~EFI_CACHE_ATTRIBUTE_MASK) | EFI_MEMORY_WC);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_WARN, "%a: Queue %u of the IOMMU at 0x%lx stays write-back - %r\n", __func__, QueueStruct->Type, IoMmu->Address, Status));
+    return;
+  }
+
+  QueueStruct->Uncached = TRUE;
+  DEBUG ((RISCV_IOMMU_DEBUG_LEVEL, "%a: Queue %u of the IOMMU at 0x%lx is non-cacheable\n", __func__, QueueStruct->Type, IoMmu->Address));
+}
+
+/**
+  Map the buffer of a queue write-back again, before it is freed.
+
+  @param[in]  Buffer  The buffer, which IoMmuMapQueueUncached() mapped non-cacheable.
+  @param[in]  Size    The size of the buffer.
+
+**/
+VOID
+IoMmuMapQueueCached (
+  IN VOID   *Buffer,
+  IN UINTN  Size
+  )
+{
+  EFI_GCD_MEMORY_SPACE_DESCRIPTOR  Descriptor;
+  EFI_PHYSICAL_ADDRESS             Address;
+  EFI_STATUS                       Status;
+
+  Address = (EFI_PHYSICAL_ADDRESS)(UINTN)Buffer;
+  Status  = gDS->GetMemorySpaceDescriptor (Address, &Descriptor);
+  if (!EFI_ERROR (Status)) {
+    Status = gDS->SetMemorySpaceAttributes (Address, Size, (Descriptor.Attributes & ~EFI_CACHE_ATTRIBUTE_MASK) | EFI_MEMORY_WB);
+  }
+
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_WARN, "%a: 0x%lx stays non-cacheable - %r\n", __func__, Address, Status));
+  }
+}
+
+/**
+  Discard the hart's stale copies of a buffer that a device without coherent DMA wrote,
+  before it is read. A partial block at either end may hold the hart's own writes, so it
+  is written back first rather than discarded.
+
+  @param[in]  Operation  The operation the buffer was mapped for.
+  @param[in]  Address    The buffer the device accessed.
+  @param[in]  Length     The length of the buffer.
+
+**/
+VOID
+IoMmuCompleteDmaBuffer (
+  IN EDKII_IOMMU_OPERATION  Operation,
+  IN EFI_PHYSICAL_ADDRESS   Address,
+  IN UINTN                  Length
+  )
+{
+  UINTN  Start;
+  UINTN  End;
+
+  if ((Length == 0) ||
+      ((Operation != EdkiiIoMmuOperationBusMasterWrite) && (Operation != EdkiiIoMmuOperationBusMasterWrite64)))
+  {
+    return;
+  }
+
+  MemoryFence ();
+  End = ALIGN_VALUE ((UINTN)Address + Length, mCleanBlockSize);
+  for (Start = (UINTN)Address & ~(mCleanBlockSize - 1); Start < End; Start += mCleanBlockSize) {
+    if ((Start < (UINTN)Address) || (Start + mCleanBlockSize > (UINTN)Address + Length)) {
+      RiscVCpuCacheFlushCmoAsm (Start);
+    } else {
+      RiscVCpuCacheInvalCmoAsm (Start);
+    }
+  }
+
+  MemoryFence ();
+}
@@ -0,0 +1,1783 @@
+/** @file
+  RISC-V IOMMU command-queue submission.
+
+  Commands are written into the queue in memory, and the IOMMU is only
+  notified when they are submitted. A submission appends a single IOFENCE.C,
+  so any number of invalidations share one doorbell write and one wait.
+  Address invalidations are held back until then, so that the adjacent
+  ranges of a batch are coalesced, and large ranges are traded for one
+  invalidation of their whole PSCID.
+  The fence signals its completion by writing a sequence number to memory,
+  so the wait doesn't read IOMMU registers on every iteration, and where
+  every hart implements Zawrs, a coherent IOMMU's wait stalls on a
+  reservation on that word instead of spinning.
+  Every wait is bounded, and a command the IOMMU stops at is replaced,
+  retried or skipped, so that one bad command doesn't stop the queue.
+  A queue that fills is doubled once it is empty again, up to
+  PcdRiscVIoMmuMaxCommandQueueEntries.
+  An asynchronous batch only writes its fence, and a timer polls the
+  completion word for the callers that wait for it.
+  Harts other than the boot hart stage their commands in a buffer found
+  through their hart-local storage, and publish each batch with a single
+  compare-and-swap that reserves its entries, so that they never wait on
+  each other while writing. Batches are published in the order of their
+  reservations, and only the write of CQT is serialised.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
+#include <Library/RiscVHartLocalLib.h>
+#include <Library/RiscVIsaLib.h>
+#include <Library/SynchronizationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include "RiscVIoMmu.h"
+
+//
+// Whether the fence waits may use wrs.sto, once the harts' extensions have been checked.
+//
+STATIC BOOLEAN  mZawrsChecked = FALSE;
+STATIC BOOLEAN  mZawrs        = FALSE;
+
+//
+// The commands a hart other than the boot hart staged for one IOMMU, and the
+// nesting of its own command batches. A hart claims a buffer with its first
+// command, and keeps it in its hart-local storage.
+//
+typedef struct {
+  volatile UINT32         Claimed;
+  UINTN                   BatchDepth;
+  RISCV_IOMMU_INSTANCE    *IoMmu;
+  UINT32                  NumberOfCommands;
+  RISCV_IOMMU_COMMAND     Commands[RISCV_IOMMU_STAGED_COMMANDS];
+} COMMAND_STAGING;
+
+STATIC COMMAND_STAGING   mCommandStaging[RISCV_IOMMU_STAGING_HARTS];
+STATIC RISCV_HART_LOCAL  *mBootHartLocal = NULL;
+
+//
+// Whether other harts wrote commands, so that the tail may be ahead of the boot hart's commands.
+//
+STATIC BOOLEAN  mSharedCommandQueue = FALSE;
+
+/**
+  Remember the hart-local storage of the boot hart, so that the commands of other
+  harts are staged. Called on the boot hart.
+
+**/
+VOID
+IoMmuInitialiseCommandStaging (
+  VOID
+  )
+{
+  mBootHartLocal = RiscVHartLocalGet ();
+}
+
+/**
+  Determine whether this runs on the boot hart, and otherwise find the staging buffer of the hart.
+
+  A hart without hart-local storage is taken for the boot hart, as it was before
+  other harts ran firmware.
+
+  @param[out]  Staging  The staging buffer of the hart, or NULL on the boot hart, or
+                        when every buffer is claimed. Optional.
+
+  @retval  TRUE   This runs on the boot hart, which writes its commands under the TPL.
+  @retval  FALSE  This runs on another hart, which must not use boot services.
+
+**/
+STATIC
+BOOLEAN
+IsBootHart (
+  OUT COMMAND_STAGING  **Staging OPTIONAL
+  )
+{
+  RISCV_HART_LOCAL  *HartLocal;
+  COMMAND_STAGING   *Claimed;
+  UINTN             Index;
+
+  HartLocal = RiscVHartLocalGet ();
+  if ((HartLocal == NULL) || (HartLocal == mBootHartLocal)) {
+    if (Staging != NULL) {
+      *Staging = NULL;
+    }
+
+    return TRUE;
+  }
+
+  mSharedCommandQueue = TRUE;
+  Claimed             = HartLocal->Data[RiscVHartLocalSlotIoMmuCommands];
+  for (Index = 0; (Claimed == NULL) && (Index < RISCV_IOMMU_STAGING_HARTS); Index++) {
+    if (InterlockedCompareExchange32 (&mCommandStaging[Index].Claimed, 0, 1) == 0) {
+      Claimed                                          = &mCommandStaging[Index];
+      HartLocal->Data[RiscVHartLocalSlotIoMmuCommands] = Claimed;
+    }
+  }
+
+  if (Staging != NULL) {
+    *Staging = Claimed;
+  }
+
+  return FALSE;
+}
+
+/**
+  Replace a command by the broadest form of its kind, which an IOMMU must
+  accept, and which does at least as much.
+
+  @param[in,out]  Command  The command.
+
+  @retval  TRUE   The command was replaced.
+  @retval  FALSE  The command already was in that form.
+
+**/
+STATIC
+BOOLEAN
+BroadenCommand (
+  IN OUT RISCV_IOMMU_COMMAND  *Command
+  )
+{
+  RISCV_IOMMU_COMMAND  Replacement;
+
+  ZeroMem (&Replacement, sizeof (Replacement));
+  switch (Command->Common.Opcode) {
+    case V_RISCV_IOMMU_COMMAND_OPCODE_IOFENCE:
+      //
+      // The completion write is kept, as the submitter waits for it.
+      //
+      Replacement.IoFence.Opcode = V_RISCV_IOMMU_COMMAND_OPCODE_IOFENCE;
+      Replacement.IoFence.Func3  = V_RISCV_IOMMU_COMMAND_FUNC3_IOFENCE_C;
+      Replacement.IoFence.AV     = Command->IoFence.AV;
+      Replacement.IoFence.DATA   = Command->IoFence.DATA;
+      Replacement.IoFence.ADDR   = Command->IoFence.ADDR;
+      break;
+    case V_RISCV_IOMMU_COMMAND_OPCODE_IODIR:
+      Replacement.IoDir.Opcode = V_RISCV_IOMMU_COMMAND_OPCODE_IODIR;
+      Replacement.IoDir.Func3  = V_RISCV_IOMMU_COMMAND_FUNC3_IODIR_INVAL_DDT;
+      break;
+    default:
+      //
+      // Without an equivalent, a command is replaced by the invalidation of all first-stage translations.
+      //
+      Replacement.IoTinval.Opcode = V_RISCV_IOMMU_COMMAND_OPCODE_IOTINVAL;
+      Replacement.IoTinval.Func3  = V_RISCV_IOMMU_COMMAND_FUNC3_IOTINVAL_VMA;
+      break;
+  }
+
+  if (CompareMem (Command, &Replacement, sizeof (Replacement)) == 0) {
+    return FALSE;
+  }
+
+  CopyMem (Command, &Replacement, sizeof (Replacement));
+  return TRUE;
+}
+
+/**
+  Turn the command queue off and on again, discarding its commands.
+
+  The commands the IOMMU may not have executed are replaced by the
+  invalidation of all device contexts and first-stage translations,
+  which the next submission completes.
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @retval  EFI_SUCCESS  The command queue is operational again.
+  @retval  EFI_TIMEOUT  The command queue did not turn off or on in time.
+
+**/
+STATIC
+EFI_STATUS
+ResetCommandQueue (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  QUEUE_WRAPPER                           *Queue;
+  RISCV_IOMMU_SOFTWARE_REQUEST_QUEUE_CSR  SoftwareReqQueueCsr;
+  RISCV_IOMMU_COMMAND                     *Command;
+  EFI_STATUS                              Status;
+
+  Queue = &IoMmu->CommandQueue;
+
+  //
+  // The error flags are cleared with the queue off, so that nothing is executed before the tail is reset.
+  //
+  SoftwareReqQueueCsr.Uint32       = 0;
+  SoftwareReqQueueCsr.Bits.qmf     = 1;
+  SoftwareReqQueueCsr.Bits.cmd_to  = 1;
+  SoftwareReqQueueCsr.Bits.cmd_ill = 1;
+  Status                           = IoMmuWriteAndWait32 (IoMmu, R_RISCV_IOMMU_CQCSR, SoftwareReqQueueCsr.Uint32, 1 << N_RISCV_IOMMU_QUEUE_CSR_QON, FALSE);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  //
+  // The IOMMU resets the head when the queue turns on.
+  //
+  IoMmuWrite32 (IoMmu, R_RISCV_IOMMU_CQT, 0);
+  SoftwareReqQueueCsr.Uint32   = 0;
+  SoftwareReqQueueCsr.Bits.qen = 1;
+  SoftwareReqQueueCsr.Bits.ie  = 1;
+  Status                       = IoMmuWriteAndWait32 (IoMmu, R_RISCV_IOMMU_CQCSR, SoftwareReqQueueCsr.Uint32, 1 << N_RISCV_IOMMU_QUEUE_CSR_QON, TRUE);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Command = (RISCV_IOMMU_COMMAND *)Queue->Buffer;
+  ZeroMem (Command, 2 * Queue->EntrySize);
+  Command[0].IoDir.Opcode    = V_RISCV_IOMMU_COMMAND_OPCODE_IODIR;
+  Command[0].IoDir.Func3     = V_RISCV_IOMMU_COMMAND_FUNC3_IODIR_INVAL_DDT;
+  Command[1].IoTinval.Opcode = V_RISCV_IOMMU_COMMAND_OPCODE_IOTINVAL;
+  Command[1].IoTinval.Func3  = V_RISCV_IOMMU_COMMAND_FUNC3_IOTINVAL_VMA;
+  if (!Queue->Uncached) {
+    IoMmuQueueCacheClean (IoMmu, Command, 2 * Queue->EntrySize);
+  }
+
+  Queue->Head              = 0;
+  Queue->Tail              = 2;
+  Queue->Reserved          = 2;
+  IoMmu->CommandsPending   = 2;
+  IoMmu->CommandRecoveries = 0;
+  return EFI_SUCCESS;
+}
+
+/**
+  Check the command queue for errors, and recover from them.
+
+  The IOMMU stops at the command that failed, and resumes there once its
+  error flag is cleared. An illegal command is replaced by a broader one
+  first, and other failures are retried, as they may be transient. An
+  ATS.INVAL that keeps timing out is skipped. When nothing else helps,
+  the queue is reset: the caller's commands are then lost, but the queue
+  stays usable for the next submission.
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @retval  EFI_SUCCESS       The command queue is operational, or was made to resume.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error, and was reset.
+
+**/
+EFI_STATUS
+IoMmuCheckCommandQueue (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  RISCV_IOMMU_SOFTWARE_REQUEST_QUEUE_CSR  SoftwareReqQueueCsr;
+  QUEUE_WRAPPER                           *Queue;
+  RISCV_IOMMU_COMMAND                     *Command;
+  UINT32                                  Head;
+  EFI_STATUS                              Status;
+
+  SoftwareReqQueueCsr.Uint32 = IoMmuRead32 (IoMmu, R_RISCV_IOMMU_CQCSR);
+  if (!SoftwareReqQueueCsr.Bits.cmd_ill && !SoftwareReqQueueCsr.Bits.cmd_to && !SoftwareReqQueueCsr.Bits.qmf) {
+    return EFI_SUCCESS;
+  }
+
+  Queue   = &IoMmu->CommandQueue;
+  Head    = IoMmuRead32 (IoMmu, R_RISCV_IOMMU_CQH) & Queue->Mask;
+  Command = (RISCV_IOMMU_COMMAND *)((UINT8 *)Queue->Buffer + Head * Queue->EntrySize);
+  DEBUG ((
+    DEBUG_ERROR,
+    "%a: Command queue error (CQCSR: 0x%x, CQH: 0x%x, command: 0x%lx 0x%lx)\n",
+    __func__,
+    SoftwareReqQueueCsr.Uint32,
+    Head,
+    Command->Uint64[0],
+    Command->Uint64[1]
+    ));
+
+  //
+  // A timed-out fence may have faulted on its completion write.
+  //
+  IoMmuDrainFaultQueue (IoMmu);
+
+  //
+  // Retries are counted per command, until a submission completes.
+  //
+  if (Head != IoMmu->CommandRecoveryHead) {
+    IoMmu->CommandRecoveryHead = Head;
+    IoMmu->CommandRecoveries   = 0;
+  }
+
+  if (SoftwareReqQueueCsr.Bits.cmd_ill) {
+    if (!BroadenCommand (Command)) {
+      IoMmu->CommandRecoveries = RISCV_IOMMU_COMMAND_RETRIES;
+    }
+  } else if ((IoMmu->CommandRecoveries >= RISCV_IOMMU_COMMAND_RETRIES) &&
+             SoftwareReqQueueCsr.Bits.cmd_to && (Command->Common.Opcode == V_RISCV_IOMMU_COMMAND_OPCODE_ATS))
+  {
+    DEBUG ((DEBUG_WARN, "%a: Skipping ATS command to RID 0x%x, whose device may keep stale translations\n", __func__, Command->Ats.RID));
+    BroadenCommand (Command);
+    IoMmu->CommandRecoveries = 0;
+  }
+
+  if (IoMmu->CommandRecoveries >= RISCV_IOMMU_COMMAND_RETRIES) {
+    Status = ResetCommandQueue (IoMmu);
+    DEBUG ((DEBUG_ERROR, "%a: Reset the command queue - %r\n", __func__, Status));
+    return EFI_DEVICE_ERROR;
+  }
+
+  IoMmu->CommandRecoveries++;
+
+  //
+  // A replaced command must be observable before the IOMMU resumes. The error flags are write-1-to-clear.
+  //
+  IoMmuQueueCacheClean (IoMmu, Command, sizeof (*Command));
+  IoMmuFlushCacheCleans (IoMmu);
+  MemoryFence ();
+  IoMmuWrite32 (IoMmu, R_RISCV_IOMMU_CQCSR, SoftwareReqQueueCsr.Uint32);
+  return EFI_SUCCESS;
+}
+
+/**
+  Notify the IOMMU of the published commands.
+
+  Harts write CQT one at a time, each with the tail as it is then, so that CQT
+  never moves back. Only the register write is serialised, not the entries.
+
+  @param[in]  IoMmu     The IOMMU.
+  @param[in]  BootHart  Whether this runs on the boot hart.
+
+**/
+STATIC
+VOID
+RingDoorbell (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN BOOLEAN               BootHart
+  )
+{
+  //
+  // The entries, and without coherence the tables they invalidate, must be observable before the doorbell.
+  // The tail may cover commands the boot hart published, so its cleans are flushed whichever hart rings.
+  //
+  if (BootHart) {
+    IoMmuFlushCacheCleans (IoMmu);
+  } else {
+    IoMmuFlushCacheCleansFromAp (IoMmu);
+  }
+
+  while (InterlockedCompareExchange32 (&IoMmu->CommandDoorbellLock, 0, 1) != 0) {
+    CpuPause ();
+  }
+
+  IoMmuWriteRelease32 (IoMmu, R_RISCV_IOMMU_CQT, *(volatile UINT32 *)&IoMmu->CommandQueue.Tail);
+  InterlockedExchange32 (&IoMmu->CommandDoorbellLock, 0);
+}
+
+/**
+  Reserve consecutive entries of the command queue, with a single compare-and-swap.
+
+  One entry always stays empty, so that a full queue is distinguishable from an
+  empty one. Without room, the IOMMU is notified of the published commands, and
+  this waits until it has fetched enough of them. The commands stay pending until
+  the next fence.
+
+  @param[in]   IoMmu             The IOMMU.
+  @param[in]   NumberOfEntries   The number of entries, fewer than the queue has.
+  @param[in]   BootHart          Whether this runs on the boot hart, which recovers from errors.
+  @param[out]  Start             The index of the first entry.
+
+  @retval  EFI_SUCCESS       The entries were reserved.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error, or had no room in time.
+
+**/
+STATIC
+EFI_STATUS
+ReserveCommandEntries (
+  IN  RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN  UINT32                NumberOfEntries,
+  IN  BOOLEAN               BootHart,
+  OUT UINT32                *Start
+  )
+{
+  QUEUE_WRAPPER     *Queue;
+  RISCV_IOMMU_WAIT  Wait;
+  UINT32            Reserved;
+  EFI_STATUS        Status;
+
+  Queue = &IoMmu->CommandQueue;
+  ASSERT (NumberOfEntries <= Queue->Mask);
+
+  IoMmuStartWait (&Wait);
+  for ( ; ; ) {
+    Reserved = Queue->Reserved;
+    if (((Queue->Head - Reserved - 1) & Queue->Mask) < NumberOfEntries) {
+      Queue->Head = IoMmuReadAcquire32 (IoMmu, R_RISCV_IOMMU_CQH) & Queue->Mask;
+    }
+
+    if (((Queue->Head - Reserved - 1) & Queue->Mask) >= NumberOfEntries) {
+      if (InterlockedCompareExchange32 (&Queue->Reserved, Reserved, (Reserved + NumberOfEntries) & Queue->Mask) == Reserved) {
+        IoMmuEndWait (&Wait);
+        *Start = Reserved;
+        return EFI_SUCCESS;
+      }
+
+      continue;
+    }
+
+    IoMmu->CommandQueueFilled = TRUE;
+    RingDoorbell (IoMmu, BootHart);
+    if (BootHart) {
+      Status = IoMmuCheckCommandQueue (IoMmu);
+      if (EFI_ERROR (Status)) {
+        IoMmuEndWait (&Wait);
+        return Status;
+      }
+    }
+
+    if (EFI_ERROR (IoMmuContinueWait (&Wait))) {
+      DEBUG ((DEBUG_ERROR, "%a: Timed out with CQH 0x%x, waiting for 0x%x entries\n", __func__, Queue->Head, NumberOfEntries));
+      IoMmuEndWait (&Wait);
+      return EFI_DEVICE_ERROR;
+    }
+  }
+}
+
+/**
+  Wait until the IOFENCE.C with a sequence number has completed.
+
+  The completion word is polled, and the registers are only read when
+  the wait starts delaying, to check for command-queue errors. The fences
+  complete in the order of their sequence numbers, so a later one also
+  completes the wait.
+
+  @param[in]  IoMmu     The IOMMU.
+  @param[in]  Sequence  The sequence number the fence writes on completion.
+  @param[in]  BootHart  Whether this runs on the boot hart, which recovers from errors.
+
+  @retval  EFI_SUCCESS       The fence completed.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error, or the fence timed out.
+
+**/
+STATIC
+EFI_STATUS
+IoMmuWaitForFence (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT32                Sequence,
+  IN BOOLEAN               BootHart
+  )
+{
+  RISCV_IOMMU_WAIT  Wait;
+  EFI_STATUS        Status;
+
+  if (!mZawrsChecked) {
+    mZawrs        = (RiscVIsaGetFeatures () & RISCV_ISA_FEATURE_ZAWRS) != 0;
+    mZawrsChecked = TRUE;
+  }
+
+  IoMmuStartWait (&Wait);
+  for (IoMmuInvalidateCacheRange (IoMmu, (VOID *)IoMmu->FenceCompletion, sizeof (UINT32))
+       ; (INT32)(*IoMmu->FenceCompletion - Sequence) < 0
+       ; IoMmuInvalidateCacheRange (IoMmu, (VOID *)IoMmu->FenceCompletion, sizeof (UINT32))
+       ) {
+    //
+    // The completion write of a coherent IOMMU breaks the reservation, and otherwise
+    // wrs.sto times out after a short while, as a pause would.
+    //
+    if (mZawrs && !IoMmu->NonCoherent && (Wait.Spins < RISCV_IOMMU_WAIT_SPIN_COUNT)) {
+      RiscVWaitOnWord (IoMmu->FenceCompletion, *IoMmu->FenceCompletion);
+    }
+
+    if (BootHart && (Wait.Spins >= RISCV_IOMMU_WAIT_SPIN_COUNT)) {
+      Status = IoMmuCheckCommandQueue (IoMmu);
+      if (EFI_ERROR (Status)) {
+        IoMmuEndWait (&Wait);
+        return Status;
+      }
+    }
+
+    if (EFI_ERROR (IoMmuContinueWait (&Wait))) {
+      DEBUG ((DEBUG_ERROR, "%a: Timed out waiting for fence 0x%x\n", __func__, Sequence));
+      IoMmuEndWait (&Wait);
+      return EFI_DEVICE_ERROR;
+    }
+  }
+
+  IoMmuEndWait (&Wait);
+
+  //
+  // Command memory isn't reused before the IOMMU is done with it.
+  //
+  MemoryFence ();
+  return EFI_SUCCESS;
+}
+
+/**
+  Write a command into an entry of the command queue.
+
+  @param[in]  IoMmu     The IOMMU.
+  @param[in]  Index     The entry.
+  @param[in]  Command   The command.
+  @param[in]  BootHart  Whether this runs on the boot hart.
+
+**/
+STATIC
+VOID
+WriteCommandEntry (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT32                Index,
+  IN RISCV_IOMMU_COMMAND   *Command,
+  IN BOOLEAN               BootHart
+  )
+{
+  QUEUE_WRAPPER  *Queue;
+  UINT8          *Entry;
+
+  Queue = &IoMmu->CommandQueue;
+  Entry = (UINT8 *)Queue->Buffer + Index * Queue->EntrySize;
+  CopyMem (Entry, Command, sizeof (RISCV_IOMMU_COMMAND));
+  if (Queue->Uncached) {
+    return;
+  }
+
+  //
+  // The batch of cleans belongs to the boot hart, so other harts clean their entries at once.
+  //
+  if (BootHart) {
+    IoMmuQueueCacheClean (IoMmu, Entry, sizeof (RISCV_IOMMU_COMMAND));
+  } else if (IoMmu->NonCoherent) {
+    IoMmuFlushCacheRange ((EFI_PHYSICAL_ADDRESS)(UINTN)Entry, sizeof (RISCV_IOMMU_COMMAND));
+  }
+}
+
+/**
+  Publish commands into the command queue, without notifying the IOMMU.
+
+  Their entries are reserved at once, and written without a lock. Producers then
+  advance the tail in the order of their reservations, so that the tail never
+  covers an entry that is still being written. A fence takes its sequence number
+  in that order too, so that the completion word only grows.
+
+  @param[in]       IoMmu             The IOMMU.
+  @param[in, out]  Commands          The commands.
+  @param[in]       NumberOfCommands  The number of commands.
+  @param[in]       BootHart          Whether this runs on the boot hart.
+  @param[out]      Sequence          If not NULL, the last command is an IOFENCE.C,
+                                     whose sequence number is assigned and returned.
+
+  @retval  EFI_SUCCESS       The commands were published.
+  @retval  EFI_NOT_READY     The command queue is not enabled.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error.
+
+**/
+STATIC
+EFI_STATUS
+PublishCommands (
+  IN     RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN OUT RISCV_IOMMU_COMMAND   *Commands,
+  IN     UINT32                NumberOfCommands,
+  IN     BOOLEAN               BootHart,
+  OUT    UINT32                *Sequence OPTIONAL
+  )
+{
+  QUEUE_WRAPPER  *Queue;
+  UINT32         Start;
+  UINT32         Written;
+  UINT32         Index;
+  EFI_STATUS     Status;
+
+  Queue = &IoMmu->CommandQueue;
+  if (Queue->Buffer == NULL) {
+    return EFI_NOT_READY;
+  }
+
+  Status = ReserveCommandEntries (IoMmu, NumberOfCommands, BootHart, &Start);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Written = NumberOfCommands - ((Sequence != NULL) ? 1 : 0);
+  for (Index = 0; Index < Written; Index++) {
+    WriteCommandEntry (IoMmu, (Start + Index) & Queue->Mask, &Commands[Index], BootHart);
+  }
+
+  while (*(volatile UINT32 *)&Queue->Tail != Start) {
+    CpuPause ();
+  }
+
+  if (Sequence != NULL) {
+    *Sequence                      = ++IoMmu->FenceSequence;
+    Commands[Written].IoFence.DATA = *Sequence;
+    WriteCommandEntry (IoMmu, (Start + Written) & Queue->Mask, &Commands[Written], BootHart);
+  }
+
+  MemoryFence ();
+  *(volatile UINT32 *)&Queue->Tail = (Start + NumberOfCommands) & Queue->Mask;
+
+  IoMmuCountCommands (Commands, NumberOfCommands);
+  return EFI_SUCCESS;
+}
+
+/**
+  Write a command into the command queue, without notifying the IOMMU.
+  Called on the boot hart.
+
+  If the queue is full, the IOMMU is notified of the queued commands and
+  this waits until there is space.
+
+  @param[in]  IoMmu    The IOMMU.
+  @param[in]  Command  The command to write.
+
+  @retval  EFI_SUCCESS       The command was queued.
+  @retval  EFI_NOT_READY     The command queue is not enabled.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error.
+
+**/
+STATIC
+EFI_STATUS
+WriteCommand (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN RISCV_IOMMU_COMMAND   *Command
+  )
+{
+  EFI_TPL     OriginalTpl;
+  EFI_STATUS  Status;
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  Status      = PublishCommands (IoMmu, Command, 1, TRUE, NULL);
+  if (!EFI_ERROR (Status)) {
+    IoMmu->CommandsPending++;
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+  return Status;
+}
+
+/**
+  Publish the commands a hart staged, without notifying the IOMMU.
+
+  @param[in]  Staging  The staging buffer of the hart.
+
+  @retval  EFI_SUCCESS       The commands were published, or none were staged.
+  @retval  EFI_NOT_READY     The command queue is not enabled.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error.
+
+**/
+STATIC
+EFI_STATUS
+PublishStagedCommands (
+  IN COMMAND_STAGING  *Staging
+  )
+{
+  EFI_STATUS  Status;
+
+  if (Staging->NumberOfCommands == 0) {
+    return EFI_SUCCESS;
+  }
+
+  Status                    = PublishCommands (Staging->IoMmu, Staging->Commands, Staging->NumberOfCommands, FALSE, NULL);
+  Staging->NumberOfCommands = 0;
+  return Status;
+}
+
+/**
+  Point a staging buffer at an IOMMU. The commands staged for another IOMMU are
+  published first, and that IOMMU is notified of them.
+
+  @param[in]  Staging  The staging buffer of the hart.
+  @param[in]  IoMmu    The IOMMU.
+
+  @retval  EFI_SUCCESS       The staging buffer holds commands for the IOMMU, if any.
+  @retval  EFI_NOT_READY     The command queue of the other IOMMU is not enabled.
+  @retval  EFI_DEVICE_ERROR  The command queue of the other IOMMU reported an error.
+
+**/
+STATIC
+EFI_STATUS
+RetargetStaging (
+  IN COMMAND_STAGING       *Staging,
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  RISCV_IOMMU_INSTANCE  *Previous;
+  EFI_STATUS            Status;
+
+  Previous       = Staging->IoMmu;
+  Staging->IoMmu = IoMmu;
+  if ((Previous == IoMmu) || (Staging->NumberOfCommands == 0)) {
+    return EFI_SUCCESS;
+  }
+
+  Staging->IoMmu = Previous;
+  Status         = PublishStagedCommands (Staging);
+  Staging->IoMmu = IoMmu;
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  RingDoorbell (Previous, FALSE);
+  return EFI_SUCCESS;
+}
+
+/**
+  Stage a command on a hart other than the boot hart, without notifying the IOMMU.
+  A full buffer is published at once.
+
+  @param[in]  IoMmu    The IOMMU.
+  @param[in]  Staging  The staging buffer of the hart, or NULL if it has none,
+                       so that the command is published by itself.
+  @param[in]  Command  The command.
+
+  @retval  EFI_SUCCESS       The command was staged or published.
+  @retval  EFI_NOT_READY     The command queue is not enabled.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error.
+
+**/
+STATIC
+EFI_STATUS
+StageCommand (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN COMMAND_STAGING       *Staging OPTIONAL,
+  IN RISCV_IOMMU_COMMAND   *Command
+  )
+{
+  EFI_STATUS  Status;
+
+  if (IoMmu->CommandQueue.Buffer == NULL) {
+    return EFI_NOT_READY;
+  }
+
+  if (Staging == NULL) {
+    return PublishCommands (IoMmu, Command, 1, FALSE, NULL);
+  }
+
+  Status = RetargetStaging (Staging, IoMmu);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  CopyMem (&Staging->Commands[Staging->NumberOfCommands++], Command, sizeof (RISCV_IOMMU_COMMAND));
+  if (Staging->NumberOfCommands == RISCV_IOMMU_STAGED_COMMANDS) {
+    return PublishStagedCommands (Staging);
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Complete the commands of a hart other than the boot hart, with an IOFENCE.C
+  that is published with its staged commands.
+
+  The pending invalidations and the retired table pages belong to the boot hart,
+  and are left to its fences.
+
+  @param[in]  IoMmu    The IOMMU.
+  @param[in]  Staging  The staging buffer of the hart, or NULL if it has none.
+
+  @retval  EFI_SUCCESS       The commands completed.
+  @retval  EFI_NOT_READY     The command queue is not enabled.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error, or the fence timed out.
+
+**/
+STATIC
+EFI_STATUS
+FenceStagedCommands (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN COMMAND_STAGING       *Staging OPTIONAL
+  )
+{
+  RISCV_IOMMU_COMMAND  Fence;
+  UINT32               Sequence;
+  EFI_STATUS           Status;
+
+  ZeroMem (&Fence, sizeof (Fence));
+  Fence.IoFence.Opcode = V_RISCV_IOMMU_COMMAND_OPCODE_IOFENCE;
+  Fence.IoFence.Func3  = V_RISCV_IOMMU_COMMAND_FUNC3_IOFENCE_C;
+  Fence.IoFence.AV     = 1;
+  Fence.IoFence.PR     = 1;
+  Fence.IoFence.PW     = 1;
+  Fence.IoFence.ADDR   = ((UINT64)IoMmu->FenceCompletion) >> 2;
+
+  if (IoMmu->CommandQueue.Buffer == NULL) {
+    return EFI_NOT_READY;
+  }
+
+  //
+  // A staging buffer is never left full, so the fence joins its batch.
+  //
+  if (Staging != NULL) {
+    Status = RetargetStaging (Staging, IoMmu);
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+  }
+
+  if ((Staging == NULL) || (Staging->NumberOfCommands == 0)) {
+    Status = PublishCommands (IoMmu, &Fence, 1, FALSE, &Sequence);
+  } else {
+    CopyMem (&Staging->Commands[Staging->NumberOfCommands++], &Fence, sizeof (Fence));
+    Status                    = PublishCommands (IoMmu, Staging->Commands, Staging->NumberOfCommands, FALSE, &Sequence);
+    Staging->NumberOfCommands = 0;
+  }
+
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  RingDoorbell (IoMmu, FALSE);
+  return IoMmuWaitForFence (IoMmu, Sequence, FALSE);
+}
+
+/**
+  Write the pending device context invalidations as IODIR.INVAL_DDT commands.
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @retval  EFI_SUCCESS       The commands were queued.
+  @retval  EFI_NOT_READY     The command queue is not enabled.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error.
+
+**/
+STATIC
+EFI_STATUS
+WritePendingDeviceContextInvalidations (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  DDT_BATCH            *Batch;
+  RISCV_IOMMU_COMMAND  Command;
+  UINTN                Index;
+  EFI_STATUS           Status;
+
+  Batch = &IoMmu->PendingDeviceContexts;
+  ZeroMem (&Command, sizeof (Command));
+  Command.IoDir.Opcode = V_RISCV_IOMMU_COMMAND_OPCODE_IODIR;
+  Command.IoDir.Func3  = V_RISCV_IOMMU_COMMAND_FUNC3_IODIR_INVAL_DDT;
+
+  Status = EFI_SUCCESS;
+  if (Batch->AllDevices) {
+    Status = WriteCommand (IoMmu, &Command);
+  } else {
+    Command.IoDir.DV = 1;
+    for (Index = 0; (Index < Batch->NumberOfDeviceIds) && !EFI_ERROR (Status); Index++) {
+      Command.IoDir.DID = Batch->DeviceIds[Index].Uint32;
+      Status            = WriteCommand (IoMmu, &Command);
+    }
+  }
+
+  Batch->NumberOfDeviceIds = 0;
+  Batch->AllDevices        = FALSE;
+  return Status;
+}
+
+/**
+  Write a command into the command queue, without notifying the IOMMU.
+
+  Pending device context invalidations are written first, so that the
+  command is ordered after them. Other harts than the boot hart stage the
+  command instead.
+
+  @param[in]  IoMmu    The IOMMU.
+  @param[in]  Command  The command to write.
+
+  @retval  EFI_SUCCESS       The command was queued.
+  @retval  EFI_NOT_READY     The command queue is not enabled.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error.
+
+**/
+EFI_STATUS
+IoMmuQueueCommand (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN RISCV_IOMMU_COMMAND   *Command
+  )
+{
+  COMMAND_STAGING  *Staging;
+  EFI_TPL          OriginalTpl;
+  EFI_STATUS       Status;
+
+  if (!IsBootHart (&Staging)) {
+    return StageCommand (IoMmu, Staging, Command);
+  }
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  Status      = WritePendingDeviceContextInvalidations (IoMmu);
+  if (!EFI_ERROR (Status)) {
+    Status = WriteCommand (IoMmu, Command);
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+  return Status;
+}
+
+/**
+  Queue an IOTINVAL.VMA command.
+
+  @param[in]  IoMmu         The IOMMU.
+  @param[in]  PscidValid    Whether to only invalidate the translations tagged with Pscid.
+  @param[in]  Pscid         The process soft-context ID of a domain.
+  @param[in]  AddressValid  Whether to only invalidate the translations of Address.
+  @param[in]  Address       The IO virtual address to invalidate.
+
+  @retval  EFI_SUCCESS       The command was queued.
+  @retval  EFI_NOT_READY     The command queue is not enabled.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error.
+
+**/
+EFI_STATUS
+IoMmuQueueIoTlbInvalidation (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN BOOLEAN               PscidValid,
+  IN UINT32                Pscid,
+  IN BOOLEAN               AddressValid,
+  IN UINT64                Address
+  )
+{
+  RISCV_IOMMU_COMMAND  Command;
+
+  ZeroMem (&Command, sizeof (Command));
+  Command.IoTinval.Opcode = V_RISCV_IOMMU_COMMAND_OPCODE_IOTINVAL;
+  Command.IoTinval.Func3  = V_RISCV_IOMMU_COMMAND_FUNC3_IOTINVAL_VMA;
+  Command.IoTinval.PSCV   = PscidValid;
+  Command.IoTinval.PSCID  = Pscid;
+  Command.IoTinval.AV     = AddressValid;
+  Command.IoTinval.ADDR   = Address >> RISCV_MMU_PAGE_SHIFT;
+
+  return IoMmuQueueCommand (IoMmu, &Command);
+}
+
+/**
+  Write the pending address invalidations as IOTINVAL.VMA commands.
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @retval  EFI_SUCCESS       The commands were queued.
+  @retval  EFI_NOT_READY     The command queue is not enabled.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error.
+
+**/
+STATIC
+EFI_STATUS
+WritePendingInvalidations (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  IOTLB_BATCH                     *Batch;
+  RISCV_IOMMU_INVALIDATION_RANGE  *Range;
+  UINT64                          Address;
+  UINTN                           Index;
+  EFI_STATUS                      Status;
+
+  Batch  = &IoMmu->PendingInvalidations;
+  Status = EFI_SUCCESS;
+  for (Index = 0; (Index < Batch->NumberOfRanges) && !EFI_ERROR (Status); Index++) {
+    Range = &Batch->Ranges[Index];
+    if (Range->LeafShift == RISCV_IOMMU_INVALIDATE_WHOLE_PSCID) {
+      Status = IoMmuQueueIoTlbInvalidation (IoMmu, TRUE, Range->Pscid, FALSE, 0);
+      continue;
+    }
+
+    for (Address = Range->Start
+         ; (Address < Range->End) && !EFI_ERROR (Status)
+         ; Address += LShiftU64 (1, Range->LeafShift)
+         ) {
+      Status = IoMmuQueueIoTlbInvalidation (IoMmu, TRUE, Range->Pscid, TRUE, Address);
+    }
+  }
+
+  Batch->NumberOfRanges = 0;
+  return Status;
+}
+
+/**
+  Queue the invalidation of the translations of a range of IO virtual addresses.
+
+  The range is only written as IOTINVAL.VMA commands once the commands are submitted,
+  coalesced with the adjacent ranges of the same PSCID and leaf size. Once more leaves
+  of a PSCID than PcdRiscVIoMmuInvalidationThreshold are pending, its ranges are traded
+  for a single command that invalidates the whole PSCID.
+
+  @param[in]  IoMmu      The IOMMU.
+  @param[in]  Pscid      The PSCID that the translations are tagged with.
+  @param[in]  Start      The first IO virtual address of the range, aligned to the leaf size.
+  @param[in]  End        The IO virtual address after the range, aligned to the leaf size.
+  @param[in]  LeafShift  The log2 of the size of the leaves that mapped the range.
+
+  @retval  EFI_SUCCESS       The invalidation was queued.
+  @retval  EFI_NOT_READY     The command queue is not enabled.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error.
+
+**/
+EFI_STATUS
+IoMmuQueueIoTlbRangeInvalidation (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT32                Pscid,
+  IN UINT64                Start,
+  IN UINT64                End,
+  IN UINT8                 LeafShift
+  )
+{
+  IOTLB_BATCH                     *Batch;
+  RISCV_IOMMU_INVALIDATION_RANGE  *Range;
+  RISCV_IOMMU_INVALIDATION_RANGE  *Adjacent;
+  UINT64                          Leaves;
+  UINT64                          Address;
+  UINTN                           Index;
+  UINTN                           Kept;
+  EFI_TPL                         OriginalTpl;
+  EFI_STATUS                      Status;
+
+  if (IoMmu->CommandQueue.Buffer == NULL) {
+    return EFI_NOT_READY;
+  }
+
+  Leaves = RShiftU64 (End - Start, LeafShift);
+
+  //
+  // The batch belongs to the boot hart, so other harts stage the commands of the range at once.
+  //
+  if (!IsBootHart (NULL)) {
+    if (Leaves > PcdGet32 (PcdRiscVIoMmuInvalidationThreshold)) {
+      return IoMmuQueueIoTlbInvalidation (IoMmu, TRUE, Pscid, FALSE, 0);
+    }
+
+    Status = EFI_SUCCESS;
+    for (Address = Start; (Address < End) && !EFI_ERROR (Status); Address += LShiftU64 (1, LeafShift)) {
+      Status = IoMmuQueueIoTlbInvalidation (IoMmu, TRUE, Pscid, TRUE, Address);
+    }
+
+    return Status;
+  }
+
+  Batch       = &IoMmu->PendingInvalidations;
+  Adjacent    = NULL;
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+
+  for (Index = 0; Index < Batch->NumberOfRanges; Index++) {
+    Range = &Batch->Ranges[Index];
+    if (Range->Pscid != Pscid) {
+      continue;
+    }
+
+    if (Range->LeafShift == RISCV_IOMMU_INVALIDATE_WHOLE_PSCID) {
+      gBS->RestoreTPL (OriginalTpl);
+      return EFI_SUCCESS;
+    }
+
+    Leaves += RShiftU64 (Range->End - Range->Start, Range->LeafShift);
+    if ((Range->LeafShift == LeafShift) && ((Range->End == Start) || (Range->Start == End))) {
+      Adjacent = Range;
+    }
+  }
+
+  if (Leaves > PcdGet32 (PcdRiscVIoMmuInvalidationThreshold)) {
+    //
+    // Scattered pages cost one command each, however few of them are adjacent.
+    //
+    for (Index = 0, Kept = 0; Index < Batch->NumberOfRanges; Index++) {
+      if (Batch->Ranges[Index].Pscid != Pscid) {
+        Batch->Ranges[Kept++] = Batch->Ranges[Index];
+      }
+    }
+
+    Batch->NumberOfRanges = Kept;
+    Start                 = 0;
+    End                   = 0;
+    LeafShift             = RISCV_IOMMU_INVALIDATE_WHOLE_PSCID;
+  } else if (Adjacent != NULL) {
+    Adjacent->Start = MIN (Adjacent->Start, Start);
+    Adjacent->End   = MAX (Adjacent->End, End);
+    gBS->RestoreTPL (OriginalTpl);
+    return EFI_SUCCESS;
+  }
+
+  //
+  // When full, the ranges are written out early. Their commands still wait for the next fence.
+  //
+  if (Batch->NumberOfRanges == RISCV_IOMMU_PENDING_INVALIDATIONS) {
+    Status = WritePendingInvalidations (IoMmu);
+    if (EFI_ERROR (Status)) {
+      gBS->RestoreTPL (OriginalTpl);
+      return Status;
+    }
+  }
+
+  Range            = &Batch->Ranges[Batch->NumberOfRanges++];
+  Range->Pscid     = Pscid;
+  Range->LeafShift = LeafShift;
+  Range->Start     = Start;
+  Range->End       = End;
+
+  gBS->RestoreTPL (OriginalTpl);
+  return EFI_SUCCESS;
+}
+
+/**
+  Queue the invalidation of cached device contexts, as IODIR.INVAL_DDT.
+
+  The invalidation is only written as a command before the next other command or
+  fence, so that a batch of context updates invalidates each device_id once. The
+  whole directory is only invalidated when asked to, as its non-leaf entries changed,
+  and then supersedes the device_ids pending.
+
+  @param[in]  IoMmu          The IOMMU.
+  @param[in]  DeviceIdValid  Whether to only invalidate the context of DeviceId.
+  @param[in]  DeviceId       The device_id to invalidate.
+
+  @retval  EFI_SUCCESS       The invalidation was queued.
+  @retval  EFI_NOT_READY     The command queue is not enabled.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error.
+
+**/
+EFI_STATUS
+IoMmuQueueDeviceContextInvalidation (
+  IN RISCV_IOMMU_INSTANCE   *IoMmu,
+  IN BOOLEAN                DeviceIdValid,
+  IN RISCV_IOMMU_DEVICE_ID  DeviceId
+  )
+{
+  DDT_BATCH            *Batch;
+  RISCV_IOMMU_COMMAND  Command;
+  UINTN                Index;
+  EFI_TPL              OriginalTpl;
+  EFI_STATUS           Status;
+
+  if (IoMmu->CommandQueue.Buffer == NULL) {
+    return EFI_NOT_READY;
+  }
+
+  //
+  // The batch belongs to the boot hart, so other harts stage the command at once.
+  //
+  if (!IsBootHart (NULL)) {
+    ZeroMem (&Command, sizeof (Command));
+    Command.IoDir.Opcode = V_RISCV_IOMMU_COMMAND_OPCODE_IODIR;
+    Command.IoDir.Func3  = V_RISCV_IOMMU_COMMAND_FUNC3_IODIR_INVAL_DDT;
+    Command.IoDir.DV     = DeviceIdValid;
+    Command.IoDir.DID    = DeviceIdValid ? DeviceId.Uint32 : 0;
+    return IoMmuQueueCommand (IoMmu, &Command);
+  }
+
+  Batch       = &IoMmu->PendingDeviceContexts;
+  Status      = EFI_SUCCESS;
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  if (!DeviceIdValid) {
+    Batch->AllDevices        = TRUE;
+    Batch->NumberOfDeviceIds = 0;
+  } else if (!Batch->AllDevices) {
+    for (Index = 0; Index < Batch->NumberOfDeviceIds; Index++) {
+      if (Batch->DeviceIds[Index].Uint32 == DeviceId.Uint32) {
+        break;
+      }
+    }
+
+    if (Index == Batch->NumberOfDeviceIds) {
+      if (Batch->NumberOfDeviceIds == RISCV_IOMMU_PENDING_DEVICE_CONTEXTS) {
+        Status = WritePendingDeviceContextInvalidations (IoMmu);
+      }
+
+      Batch->DeviceIds[Batch->NumberOfDeviceIds++] = DeviceId;
+    }
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+  return Status;
+}
+
+/**
+  Queue an ATS.INVAL command, invalidating a range in the ATC of a PCI function.
+
+  The range is widened to the naturally aligned power of two that covers it,
+  which is what an Invalidation Request message can encode.
+
+  @param[in]  IoMmu        The IOMMU.
+  @param[in]  Segment      The PCI segment of the function.
+  @param[in]  RequesterId  The RID of the function.
+  @param[in]  Address      The first IO virtual address to invalidate.
+  @param[in]  Length       The length of the range, or 0 to invalidate every translation.
+
+  @retval  EFI_SUCCESS       The command was queued.
+  @retval  EFI_NOT_READY     The command queue is not enabled.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error.
+
+**/
+EFI_STATUS
+IoMmuQueueAtsInvalidation (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT16                Segment,
+  IN UINT16                RequesterId,
+  IN UINT64                Address,
+  IN UINT64                Length
+  )
+{
+  RISCV_IOMMU_COMMAND  Command;
+  UINT64               Start;
+  UINT64               Size;
+
+  //
+  // With the S bit set, the lowest clear address bit above bit 11 encodes the size.
+  // Setting all of bits 62:12 invalidates the whole address space.
+  //
+  Start = Address & ~(UINT64)EFI_PAGE_MASK;
+  Size  = SIZE_4KB;
+  while ((Length != 0) && (Size < BIT62) && ((Start & ~(Size - 1)) + Size < Address + Length)) {
+    Size <<= 1;
+  }
+
+  Start &= ~(Size - 1);
+
+  ZeroMem (&Command, sizeof (Command));
+  Command.Ats.Opcode = V_RISCV_IOMMU_COMMAND_OPCODE_ATS;
+  Command.Ats.Func3  = V_RISCV_IOMMU_COMMAND_FUNC3_ATS_INVAL;
+  Command.Ats.DSV    = Segment != 0;
+  Command.Ats.DSEG   = (UINT8)Segment;
+  Command.Ats.RID    = RequesterId;
+  if ((Length == 0) || (Size >= BIT62)) {
+    Command.Ats.PAYLOAD = ((MAX_UINT64 >> 1) & ~(UINT64)EFI_PAGE_MASK) | BIT11;
+  } else if (Size == SIZE_4KB) {
+    Command.Ats.PAYLOAD = Start;
+  } else {
+    Command.Ats.PAYLOAD = Start | (((Size >> 1) - 1) & ~(UINT64)EFI_PAGE_MASK) | BIT11;
+  }
+
+  return IoMmuQueueCommand (IoMmu, &Command);
+}
+
+/**
+  Queue an ATS.PRGR command, answering a page request group of a PCI function.
+
+  @param[in]  IoMmu         The IOMMU.
+  @param[in]  Segment       The PCI segment of the function.
+  @param[in]  RequesterId   The RID of the function.
+  @param[in]  PrgIndex      The index of the page request group.
+  @param[in]  ResponseCode  The V_RISCV_IOMMU_PRGR_* response code.
+
+  @retval  EFI_SUCCESS       The command was queued.
+  @retval  EFI_NOT_READY     The command queue is not enabled.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error.
+
+**/
+EFI_STATUS
+IoMmuQueuePageRequestResponse (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT16                Segment,
+  IN UINT16                RequesterId,
+  IN UINT16                PrgIndex,
+  IN UINT8                 ResponseCode
+  )
+{
+  RISCV_IOMMU_COMMAND  Command;
+
+  //
+  // The response is routed back to the function by its RID.
+  //
+  ZeroMem (&Command, sizeof (Command));
+  Command.Ats.Opcode  = V_RISCV_IOMMU_COMMAND_OPCODE_ATS;
+  Command.Ats.Func3   = V_RISCV_IOMMU_COMMAND_FUNC3_ATS_PRGR;
+  Command.Ats.DSV     = Segment != 0;
+  Command.Ats.DSEG    = (UINT8)Segment;
+  Command.Ats.RID     = RequesterId;
+  Command.Ats.PAYLOAD = LShiftU64 (PrgIndex & 0x1FF, N_RISCV_IOMMU_PRGR_PRG_INDEX) |
+                        LShiftU64 (ResponseCode & 0xF, N_RISCV_IOMMU_PRGR_RESPONSE_CODE) |
+                        LShiftU64 (RequesterId, N_RISCV_IOMMU_PRGR_DESTINATION);
+
+  return IoMmuQueueCommand (IoMmu, &Command);
+}
+
+/**
+  Double the command queue of an IOMMU, once the queue filled and is empty again.
+
+  The queue is turned off while CQB is reprogrammed. A queue that can't grow
+  keeps its buffer, and isn't grown again.
+
+  @param[in]  IoMmu  The IOMMU, whose commands have all completed.
+
+**/
+STATIC
+VOID
+GrowCommandQueue (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  QUEUE_WRAPPER  *Queue;
+  VOID           *OldBuffer;
+  UINT32         OldNumberOfEntries;
+  BOOLEAN        OldAllocated;
+  BOOLEAN        OldUncached;
+  EFI_STATUS     Status;
+
+  Queue                     = &IoMmu->CommandQueue;
+  IoMmu->CommandQueueFilled = FALSE;
+
+  //
+  // The holes of a permissive table are a snapshot, so a new buffer would be reachable by devices.
+  // Once other harts write commands, they may be reserving entries of the buffer.
+  //
+  OldNumberOfEntries = Queue->Mask + 1;
+  if ((OldNumberOfEntries >= IoMmu->CommandQueueLimit) || (IoMmu->PermissiveRootPageTable != NULL) || mSharedCommandQueue) {
+    return;
+  }
+
+  Status = IoMmuWriteAndWait32 (IoMmu, R_RISCV_IOMMU_CQCSR, 0, 1 << N_RISCV_IOMMU_QUEUE_CSR_QON, FALSE);
+  if (EFI_ERROR (Status)) {
+    return;
+  }
+
+  OldBuffer    = Queue->Buffer;
+  OldAllocated = Queue->Allocated;
+  OldUncached  = Queue->Uncached;
+  Status       = IoMmuAllocateQueue (IoMmu, Queue, OldNumberOfEntries * 2);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "%a: The command queue failed to turn on again - %r\n", __func__, Status));
+    return;
+  }
+
+  if (Queue->Buffer == OldBuffer) {
+    IoMmu->CommandQueueLimit = OldNumberOfEntries;
+    return;
+  }
+
+  if (OldAllocated) {
+    if (OldUncached) {
+      IoMmuMapQueueCached (OldBuffer, EFI_PAGES_TO_SIZE (EFI_SIZE_TO_PAGES (OldNumberOfEntries * Queue->EntrySize)));
+    }
+
+    FreeAlignedPages (OldBuffer, EFI_SIZE_TO_PAGES (OldNumberOfEntries * Queue->EntrySize));
+    IoMmuReleaseFootprint (RiscVIoMmuFootprintQueue, EFI_PAGES_TO_SIZE (EFI_SIZE_TO_PAGES (OldNumberOfEntries * Queue->EntrySize)));
+  }
+
+  DEBUG ((RISCV_IOMMU_DEBUG_LEVEL, "%a: IOMMU at 0x%lx has 0x%x command-queue entries\n", __func__, IoMmu->Address, Queue->Mask + 1));
+}
+
+/**
+  Determine whether commands or invalidations are waiting for an IOFENCE.C.
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @retval  TRUE   A fence is needed.
+  @retval  FALSE  Every command was fenced.
+
+**/
+STATIC
+BOOLEAN
+HasPendingCommands (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  return (IoMmu->CommandsPending != 0) ||
+         (IoMmu->PendingInvalidations.NumberOfRanges != 0) ||
+         (IoMmu->PendingDeviceContexts.NumberOfDeviceIds != 0) ||
+         IoMmu->PendingDeviceContexts.AllDevices;
+}
+
+/**
+  Write the pending invalidations and an IOFENCE.C, and notify the IOMMU,
+  without waiting for the fence. Called on the boot hart, which raised the TPL.
+
+  @param[in]   IoMmu     The IOMMU.
+  @param[out]  Sequence  The sequence number of the fence.
+
+  @retval  EFI_SUCCESS       The fence was submitted.
+  @retval  EFI_NOT_READY     The command queue is not enabled.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error.
+
+**/
+STATIC
+EFI_STATUS
+WriteFence (
+  IN  RISCV_IOMMU_INSTANCE  *IoMmu,
+  OUT UINT32                *Sequence
+  )
+{
+  RISCV_IOMMU_COMMAND  Command;
+  UINTN                Index;
+  EFI_STATUS           Status;
+
+  //
+  // The fence completes once all previous commands have, and once device
+  // accesses that used the invalidated translations are done. It then writes
+  // a new sequence number, so a stale completion is never mistaken for this one.
+  //
+  Status = WritePendingDeviceContextInvalidations (IoMmu);
+  if (!EFI_ERROR (Status)) {
+    Status = WritePendingInvalidations (IoMmu);
+  }
+
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  ZeroMem (&Command, sizeof (Command));
+  Command.IoFence.Opcode = V_RISCV_IOMMU_COMMAND_OPCODE_IOFENCE;
+  Command.IoFence.Func3  = V_RISCV_IOMMU_COMMAND_FUNC3_IOFENCE_C;
+  Command.IoFence.AV     = 1;
+  Command.IoFence.PR     = 1;
+  Command.IoFence.PW     = 1;
+  Command.IoFence.ADDR   = ((UINT64)IoMmu->FenceCompletion) >> 2;
+
+  Status = PublishCommands (IoMmu, &Command, 1, TRUE, Sequence);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  IoMmu->CommandsPending++;
+  IoMmu->BootFenceSequence = *Sequence;
+
+  //
+  // The asynchronous fences of nested batches complete with this one.
+  //
+  for (Index = 0; Index < IoMmu->NumberOfAsyncFences; Index++) {
+    if (!IoMmu->AsyncFences[Index].Written) {
+      IoMmu->AsyncFences[Index].Sequence = *Sequence;
+      IoMmu->AsyncFences[Index].Written  = TRUE;
+    }
+  }
+
+  RingDoorbell (IoMmu, TRUE);
+  return EFI_SUCCESS;
+}
+
+/**
+  Complete all queued commands now, even inside a command batch.
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @retval  EFI_SUCCESS       The commands completed.
+  @retval  EFI_NOT_READY     The command queue is not enabled.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error.
+
+**/
+EFI_STATUS
+IoMmuFenceCommands (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  COMMAND_STAGING  *Staging;
+  UINT32           Sequence;
+  EFI_TPL          OriginalTpl;
+  EFI_STATUS       Status;
+
+  if (!IsBootHart (&Staging)) {
+    return FenceStagedCommands (IoMmu, Staging);
+  }
+
+  if (!HasPendingCommands (IoMmu)) {
+    return EFI_SUCCESS;
+  }
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  Status      = WriteFence (IoMmu, &Sequence);
+  if (!EFI_ERROR (Status)) {
+    Status = IoMmuWaitForFence (IoMmu, Sequence, TRUE);
+  }
+
+  if (!EFI_ERROR (Status)) {
+    //
+    // The fence was the last command, so the IOMMU has consumed the whole queue,
+    // unless other harts published commands after it.
+    //
+    if (!mSharedCommandQueue) {
+      IoMmu->CommandQueue.Head = IoMmu->CommandQueue.Tail;
+    }
+
+    IoMmu->CommandsPending   = 0;
+    IoMmu->CommandRecoveries = 0;
+
+    if (IoMmu->NumberOfRetiredTablePages != 0) {
+      IoMmuReclaimTablePages (IoMmu, Sequence);
+    }
+
+    if (IoMmu->CommandQueueFilled) {
+      GrowCommandQueue (IoMmu);
+    }
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+  return Status;
+}
+
+/**
+  Call back the asynchronous callers whose fences completed.
+
+  A fence that doesn't complete while the command queue reports an error, or
+  for RISCV_IOMMU_ASYNC_FENCE_MAX_TICKS ticks, fails with the fences before it.
+
+  @param[in]  IoMmu  The IOMMU.
+
+**/
+STATIC
+VOID
+PollAsyncFences (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  ASYNC_FENCE  Completed[RISCV_IOMMU_ASYNC_FENCES];
+  UINTN        NumberOfCompleted;
+  UINTN        Index;
+  UINTN        Kept;
+  UINT32       Sequence;
+  UINT32       Failed;
+
+  IoMmuInvalidateCacheRange (IoMmu, (VOID *)IoMmu->FenceCompletion, sizeof (UINT32));
+  Sequence = *IoMmu->FenceCompletion;
+  MemoryFence ();
+
+  //
+  // Fences not yet written, as their batch is nested in an open one, don't time out.
+  //
+  Failed = Sequence;
+  if ((INT32)(Sequence - IoMmu->FenceSequence) < 0) {
+    if (EFI_ERROR (IoMmuCheckCommandQueue (IoMmu)) ||
+        (++IoMmu->AsyncFenceTicks >= RISCV_IOMMU_ASYNC_FENCE_MAX_TICKS))
+    {
+      DEBUG ((DEBUG_ERROR, "%a: Fences 0x%x-0x%x failed\n", __func__, Sequence + 1, IoMmu->FenceSequence));
+      Failed = IoMmu->FenceSequence;
+    }
+  }
+
+  NumberOfCompleted = 0;
+  for (Index = 0, Kept = 0; Index < IoMmu->NumberOfAsyncFences; Index++) {
+    if (IoMmu->AsyncFences[Index].Written && ((INT32)(Failed - IoMmu->AsyncFences[Index].Sequence) >= 0)) {
+      Completed[NumberOfCompleted++] = IoMmu->AsyncFences[Index];
+    } else {
+      IoMmu->AsyncFences[Kept++] = IoMmu->AsyncFences[Index];
+    }
+  }
+
+  IoMmu->NumberOfAsyncFences = Kept;
+  if (NumberOfCompleted != 0) {
+    IoMmu->AsyncFenceTicks = 0;
+  }
+
+  //
+  // Only the fences of the boot hart follow its pending invalidations.
+  //
+  if (IoMmu->NumberOfRetiredTablePages != 0) {
+    IoMmuReclaimTablePages (IoMmu, ((INT32)(Sequence - IoMmu->BootFenceSequence) > 0) ? IoMmu->BootFenceSequence : Sequence);
+  }
+
+  //
+  // The callbacks may queue commands, and fences, of their own.
+  //
+  for (Index = 0; Index < NumberOfCompleted; Index++) {
+    Completed[Index].Callback (
+                       Completed[Index].Context,
+                       ((INT32)(Sequence - Completed[Index].Sequence) >= 0) ? EFI_SUCCESS : EFI_DEVICE_ERROR
+                       );
+  }
+}
+
+/**
+  Poll the fences of every IOMMU that has any, and stop polling once none has.
+
+**/
+STATIC
+VOID
+OnAsyncFencePoll (
+  VOID
+  )
+{
+  LIST_ENTRY            *Link;
+  RISCV_IOMMU_INSTANCE  *IoMmu;
+  BOOLEAN               Pending;
+
+  for (Link = GetFirstNode (&mRiscVIoMmuGlobalDriverContext.InstanceList)
+       ; !IsNull (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ; Link = GetNextNode (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ) {
+    IoMmu = RISCV_IOMMU_INSTANCE_FROM_LINK (Link);
+    if (IoMmu->NumberOfAsyncFences != 0) {
+      PollAsyncFences (IoMmu);
+    }
+  }
+
+  //
+  // The callbacks may have queued fences on any IOMMU.
+  //
+  Pending = FALSE;
+  for (Link = GetFirstNode (&mRiscVIoMmuGlobalDriverContext.InstanceList)
+       ; !IsNull (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link) && !Pending
+       ; Link = GetNextNode (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ) {
+    IoMmu   = RISCV_IOMMU_INSTANCE_FROM_LINK (Link);
+    Pending = (BOOLEAN)(IoMmu->NumberOfAsyncFences != 0);
+  }
+
+  if (!Pending) {
+    IoMmuSchedulePoll (RiscVIoMmuPollAsyncFences, OnAsyncFencePoll, 0);
+  }
+}
+
+/**
+  Complete all queued commands, with a single IOFENCE.C and doorbell write.
+
+  Inside a command batch, the commands are completed when the outermost
+  batch ends instead.
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @retval  EFI_SUCCESS       The commands completed, or were deferred to the end of the batch.
+  @retval  EFI_NOT_READY     The command queue is not enabled.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error.
+
+**/
+EFI_STATUS
+IoMmuSubmitCommands (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  COMMAND_STAGING  *Staging;
+
+  //
+  // Other harts nest their own batches.
+  //
+  if (!IsBootHart (&Staging)) {
+    if ((Staging != NULL) && (Staging->BatchDepth != 0)) {
+      return EFI_SUCCESS;
+    }
+  } else if (IoMmu->CommandBatchDepth != 0) {
+    return EFI_SUCCESS;
+  }
+
+  return IoMmuFenceCommands (IoMmu);
+}
+
+/**
+  Begin a batch of commands, so that they share one IOFENCE.C.
+
+  @param[in]  IoMmu  The IOMMU.
+
+**/
+VOID
+IoMmuBeginCommandBatch (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  COMMAND_STAGING  *Staging;
+
+  if (IsBootHart (&Staging)) {
+    IoMmu->CommandBatchDepth++;
+  } else if (Staging != NULL) {
+    Staging->BatchDepth++;
+  }
+}
+
+/**
+  End a batch of commands. The outermost batch submits the queued commands.
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @retval  EFI_SUCCESS       The commands completed.
+  @retval  EFI_NOT_READY     The command queue is not enabled.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error.
+
+**/
+EFI_STATUS
+IoMmuEndCommandBatch (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  COMMAND_STAGING  *Staging;
+
+  if (IsBootHart (&Staging)) {
+    ASSERT (IoMmu->CommandBatchDepth != 0);
+    IoMmu->CommandBatchDepth--;
+  } else if (Staging != NULL) {
+    ASSERT (Staging->BatchDepth != 0);
+    Staging->BatchDepth--;
+  }
+
+  return IoMmuSubmitCommands (IoMmu);
+}
+
+/**
+  End a batch of commands without waiting for them. The outermost batch writes
+  the IOFENCE.C and notifies the IOMMU, and the callback is called once it completes.
+
+  @param[in]  IoMmu     The IOMMU.
+  @param[in]  Callback  Called once the commands completed, at RISCV_IOMMU_TPL_LEVEL,
+                        or before this returns, if none were queued.
+  @param[in]  Context   Passed to the callback.
+
+  @retval  EFI_SUCCESS       The callback will be called.
+  @retval  EFI_NOT_READY     The command queue is not enabled. The callback won't be called.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error. The callback won't be called.
+
+**/
+EFI_STATUS
+IoMmuEndCommandBatchAsync (
+  IN RISCV_IOMMU_INSTANCE        *IoMmu,
+  IN RISCV_IOMMU_FENCE_CALLBACK  Callback,
+  IN VOID                        *Context
+  )
+{
+  ASYNC_FENCE  *Fence;
+  UINT32       Sequence;
+  EFI_TPL      OriginalTpl;
+  EFI_STATUS   Status;
+
+  //
+  // Other harts have no timer, so they wait for their fence here.
+  //
+  if (!IsBootHart (NULL)) {
+    Status = IoMmuEndCommandBatch (IoMmu);
+    if (!EFI_ERROR (Status)) {
+      Callback (Context, EFI_SUCCESS);
+    }
+
+    return Status;
+  }
+
+  ASSERT (IoMmu->CommandBatchDepth != 0);
+  IoMmu->CommandBatchDepth--;
+
+  if (!HasPendingCommands (IoMmu)) {
+    Callback (Context, EFI_SUCCESS);
+    return EFI_SUCCESS;
+  }
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+
+  //
+  // The fences are polled before the first is recorded, so that one is never left unpolled.
+  //
+  Status = EFI_SUCCESS;
+  if (IoMmu->NumberOfAsyncFences == 0) {
+    IoMmu->AsyncFenceTicks = 0;
+    Status                 = IoMmuSchedulePoll (RiscVIoMmuPollAsyncFences, OnAsyncFencePoll, RISCV_IOMMU_ASYNC_FENCE_PERIOD);
+  }
+
+  //
+  // Without a timer, or room to record the fence, the fence is waited for here.
+  //
+  if (EFI_ERROR (Status) || (IoMmu->NumberOfAsyncFences == RISCV_IOMMU_ASYNC_FENCES)) {
+    gBS->RestoreTPL (OriginalTpl);
+    Status = IoMmuFenceCommands (IoMmu);
+    if (!EFI_ERROR (Status)) {
+      Callback (Context, EFI_SUCCESS);
+    }
+
+    return Status;
+  }
+
+  //
+  // The fence is recorded first, so that writing it assigns its sequence number.
+  //
+  Fence           = &IoMmu->AsyncFences[IoMmu->NumberOfAsyncFences++];
+  Fence->Sequence = 0;
+  Fence->Written  = FALSE;
+  Fence->Callback = Callback;
+  Fence->Context  = Context;
+
+  //
+  // Inside an outer batch, the fence is written when that batch ends.
+  //
+  if (IoMmu->CommandBatchDepth == 0) {
+    Status = WriteFence (IoMmu, &Sequence);
+    if (EFI_ERROR (Status)) {
+      IoMmu->NumberOfAsyncFences--;
+      gBS->RestoreTPL (OriginalTpl);
+      return Status;
+    }
+
+    IoMmu->CommandsPending = 0;
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+  return EFI_SUCCESS;
+}
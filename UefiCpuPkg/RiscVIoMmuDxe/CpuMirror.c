@@ -0,0 +1,253 @@
+/** @file
+  RISC-V IOMMU CPU mirror domains, for trusted devices.
+
+  A CPU mirror domain reaches exactly the memory that the hart maps, with the
+  same permissions, at its own address. Its first-stage table is taken from the
+  hart's page table when the domain is created, so Map() does no work for it.
+  The hart's page table is changed through the CPU architectural protocol and
+  the memory attribute protocol, which are wrapped here, so that each change
+  is mirrored into every CPU mirror domain with one invalidation batch per IOMMU.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Protocol/Cpu.h>
+#include <Protocol/MemoryAttribute.h>
+#include "RiscVIoMmu.h"
+
+STATIC BOOLEAN                        mCpuPageTableTracked = FALSE;
+STATIC EFI_CPU_SET_MEMORY_ATTRIBUTES  mCpuSetMemoryAttributes;
+STATIC EFI_SET_MEMORY_ATTRIBUTES      mSetMemoryAttributes;
+STATIC EFI_CLEAR_MEMORY_ATTRIBUTES    mClearMemoryAttributes;
+
+//
+// Table pages allocated by a refresh may change the hart's page table again,
+// so nested changes are only accumulated, for the outermost refresh to mirror.
+//
+STATIC BOOLEAN  mRefreshing   = FALSE;
+STATIC UINT64   mPendingStart = MAX_UINT64;
+STATIC UINT64   mPendingEnd   = 0;
+
+/**
+  Mirror a change of the hart's page table into every CPU mirror domain.
+
+  @param[in]  BaseAddress  The base of the changed range.
+  @param[in]  Length       The length of the changed range.
+
+**/
+STATIC
+VOID
+RefreshCpuMirrors (
+  IN EFI_PHYSICAL_ADDRESS  BaseAddress,
+  IN UINT64                Length
+  )
+{
+  LIST_ENTRY                 *InstanceLink;
+  LIST_ENTRY                 *Link;
+  RISCV_IOMMU_INSTANCE       *IoMmu;
+  RISCV_IOMMU_DEVICE_DOMAIN  *Domain;
+  UINT64                     Start;
+  UINT64                     End;
+  EFI_STATUS                 Status;
+
+  if (Length == 0) {
+    return;
+  }
+
+  mPendingStart = MIN (mPendingStart, BaseAddress & ~(UINT64)EFI_PAGE_MASK);
+  mPendingEnd   = MAX (mPendingEnd, ALIGN_VALUE (BaseAddress + Length, EFI_PAGE_SIZE));
+  if (mRefreshing) {
+    return;
+  }
+
+  mRefreshing = TRUE;
+  while (mPendingStart < mPendingEnd) {
+    Start         = mPendingStart;
+    End           = mPendingEnd;
+    mPendingStart = MAX_UINT64;
+    mPendingEnd   = 0;
+
+    for (InstanceLink = GetFirstNode (&mRiscVIoMmuGlobalDriverContext.InstanceList)
+         ; !IsNull (&mRiscVIoMmuGlobalDriverContext.InstanceList, InstanceLink)
+         ; InstanceLink = GetNextNode (&mRiscVIoMmuGlobalDriverContext.InstanceList, InstanceLink)
+         ) {
+      IoMmu = RISCV_IOMMU_INSTANCE_FROM_LINK (InstanceLink);
+      if (IoMmu->State != STATE_INITIALISED) {
+        continue;
+      }
+
+      IoMmuBeginCommandBatch (IoMmu);
+      for (Link = GetFirstNode (&IoMmu->DomainList)
+           ; !IsNull (&IoMmu->DomainList, Link)
+           ; Link = GetNextNode (&IoMmu->DomainList, Link)
+           ) {
+        Domain = RISCV_IOMMU_DEVICE_DOMAIN_FROM_LINK (Link);
+        if ((Domain->Mode != RISCV_IOMMU_DEVICE_MODE_CPU_MIRROR) || Domain->Detached) {
+          continue;
+        }
+
+        Status = IoMmuMirrorCpuPageTable (IoMmu, Domain->RootPageTable, Domain->Pscid, Start, End, TRUE);
+        if (EFI_ERROR (Status)) {
+          DEBUG ((
+            DEBUG_ERROR,
+            "%a: device_id 0x%x failed to mirror 0x%lx-0x%lx: %r\n",
+            __func__,
+            Domain->DeviceId.Uint32,
+            Start,
+            End - 1,
+            Status
+            ));
+        }
+      }
+
+      if (EFI_ERROR (IoMmuEndCommandBatch (IoMmu))) {
+        DEBUG ((DEBUG_ERROR, "%a: The IOMMU at 0x%lx failed to invalidate 0x%lx-0x%lx\n", __func__, IoMmu->Address, Start, End - 1));
+      }
+    }
+  }
+
+  mRefreshing = FALSE;
+}
+
+/**
+  Wrap SetMemoryAttributes() of the CPU architectural protocol.
+
+  @param[in]  This         The CPU architectural protocol.
+  @param[in]  BaseAddress  The base of the range.
+  @param[in]  Length       The length of the range.
+  @param[in]  Attributes   The attributes.
+
+  @return  The status of the wrapped service.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+CpuMirrorSetCpuMemoryAttributes (
+  IN EFI_CPU_ARCH_PROTOCOL  *This,
+  IN EFI_PHYSICAL_ADDRESS   BaseAddress,
+  IN UINT64                 Length,
+  IN UINT64                 Attributes
+  )
+{
+  EFI_STATUS  Status;
+
+  Status = mCpuSetMemoryAttributes (This, BaseAddress, Length, Attributes);
+  if (!EFI_ERROR (Status)) {
+    RefreshCpuMirrors (BaseAddress, Length);
+  }
+
+  return Status;
+}
+
+/**
+  Wrap SetMemoryAttributes() of the memory attribute protocol.
+
+  @param[in]  This         The memory attribute protocol.
+  @param[in]  BaseAddress  The base of the range.
+  @param[in]  Length       The length of the range.
+  @param[in]  Attributes   The attributes to set.
+
+  @return  The status of the wrapped service.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+CpuMirrorSetMemoryAttributes (
+  IN EFI_MEMORY_ATTRIBUTE_PROTOCOL  *This,
+  IN EFI_PHYSICAL_ADDRESS           BaseAddress,
+  IN UINT64                         Length,
+  IN UINT64                         Attributes
+  )
+{
+  EFI_STATUS  Status;
+
+  Status = mSetMemoryAttributes (This, BaseAddress, Length, Attributes);
+  if (!EFI_ERROR (Status)) {
+    RefreshCpuMirrors (BaseAddress, Length);
+  }
+
+  return Status;
+}
+
+/**
+  Wrap ClearMemoryAttributes() of the memory attribute protocol.
+
+  @param[in]  This         The memory attribute protocol.
+  @param[in]  BaseAddress  The base of the range.
+  @param[in]  Length       The length of the range.
+  @param[in]  Attributes   The attributes to clear.
+
+  @return  The status of the wrapped service.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+CpuMirrorClearMemoryAttributes (
+  IN EFI_MEMORY_ATTRIBUTE_PROTOCOL  *This,
+  IN EFI_PHYSICAL_ADDRESS           BaseAddress,
+  IN UINT64                         Length,
+  IN UINT64                         Attributes
+  )
+{
+  EFI_STATUS  Status;
+
+  Status = mClearMemoryAttributes (This, BaseAddress, Length, Attributes);
+  if (!EFI_ERROR (Status)) {
+    RefreshCpuMirrors (BaseAddress, Length);
+  }
+
+  return Status;
+}
+
+/**
+  Refresh the CPU mirror domains whenever the hart's page table changes, from the first call on.
+
+  The CPU architectural protocol and the memory attribute protocol are wrapped, as both
+  update the hart's page table.
+
+**/
+VOID
+IoMmuTrackCpuPageTable (
+  VOID
+  )
+{
+  EFI_CPU_ARCH_PROTOCOL          *CpuArch;
+  EFI_MEMORY_ATTRIBUTE_PROTOCOL  *MemoryAttribute;
+  EFI_TPL                        OriginalTpl;
+  EFI_STATUS                     Status;
+
+  if (mCpuPageTableTracked) {
+    return;
+  }
+
+  mCpuPageTableTracked = TRUE;
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  Status      = gBS->LocateProtocol (&gEfiCpuArchProtocolGuid, NULL, (VOID **)&CpuArch);
+  if (!EFI_ERROR (Status)) {
+    mCpuSetMemoryAttributes      = CpuArch->SetMemoryAttributes;
+    CpuArch->SetMemoryAttributes = CpuMirrorSetCpuMemoryAttributes;
+  }
+
+  //
+  // The memory attribute protocol is optional, and without it, the CPU architectural protocol is the only updater.
+  //
+  Status = gBS->LocateProtocol (&gEfiMemoryAttributeProtocolGuid, NULL, (VOID **)&MemoryAttribute);
+  if (!EFI_ERROR (Status)) {
+    mSetMemoryAttributes                   = MemoryAttribute->SetMemoryAttributes;
+    mClearMemoryAttributes                 = MemoryAttribute->ClearMemoryAttributes;
+    MemoryAttribute->SetMemoryAttributes   = CpuMirrorSetMemoryAttributes;
+    MemoryAttribute->ClearMemoryAttributes = CpuMirrorClearMemoryAttributes;
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+}
@@ -0,0 +1,397 @@
+/** @file
+  RISC-V IOMMU deferred initialisation.
+
+  Bringing an IOMMU up waits for it to turn its queues on and to accept its
+  device directory, and a PCI IOMMU only once PCI enumeration found it. With
+  PcdRiscVIoMmuDeferredInitialisation, EDKII_IOMMU_PROTOCOL is installed at
+  the driver's entry instead, so that the drivers which depend on it start
+  without waiting, and the IOMMUs are only started. A timer polls for them,
+  and completes their initialisation once they are ready.
+
+  Until then, Map() serves buffers at their own address, below the limit of
+  the harts, and SetAttribute() records the access it grants. The IOMMUs come
+  up with the devices blocked, so once one is initialised, the recorded grants
+  are applied in one command batch per IOMMU. A buffer that the IOMMUs then
+  can't reach at its own address stays unreachable, as after any other failed
+  SetAttribute().
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+#include "RiscVIoMmu.h"
+
+#define DEFERRED_GRANT_TABLE_INITIAL_SIZE  32
+
+//
+// In units of 100 ns, so 1 ms.
+//
+#define DEFERRED_COMPLETION_PERIOD  10000
+
+//
+// The ticks after which initialisation is completed anyway, and times out as it would have at entry.
+//
+#define DEFERRED_COMPLETION_MAX_TICKS  (RISCV_IOMMU_WAIT_TIMEOUT_US / 1000)
+
+//
+// The access that SetAttribute() granted a device to a mapping, before any IOMMU was initialised.
+//
+typedef struct {
+  MAP_INFO      *MapInfo;
+  EFI_HANDLE    DeviceHandle;
+  UINT64        IoMmuAccess;
+} DEFERRED_GRANT;
+
+STATIC DEFERRED_GRANT  *mDeferredGrants        = NULL;
+STATIC UINTN           mNumberOfDeferredGrants = 0;
+STATIC UINTN           mDeferredGrantTableSize = 0;
+
+STATIC EFI_EVENT  mCompletionTimer   = NULL;
+STATIC UINTN      mCompletionTicks   = 0;
+STATIC BOOLEAN    mCompletionPending = FALSE;
+
+/**
+  Apply the recorded grants, now that an IOMMU is initialised.
+
+  Their commands are batched on every IOMMU, so each waits for one IOFENCE.C.
+
+**/
+STATIC
+VOID
+ApplyDeferredGrants (
+  VOID
+  )
+{
+  DEFERRED_GRANT        *Grants;
+  UINTN                 NumberOfGrants;
+  UINTN                 Index;
+  RISCV_IOMMU_INSTANCE  *IoMmu;
+  EFI_TPL               OriginalTpl;
+  EFI_STATUS            Status;
+
+  //
+  // From here on, SetAttribute() applies its grants itself.
+  //
+  OriginalTpl                             = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  mRiscVIoMmuGlobalDriverContext.Deferred = FALSE;
+  Grants                                  = mDeferredGrants;
+  NumberOfGrants                          = mNumberOfDeferredGrants;
+  mDeferredGrants                         = NULL;
+  mNumberOfDeferredGrants                 = 0;
+  mDeferredGrantTableSize                 = 0;
+  gBS->RestoreTPL (OriginalTpl);
+
+  for (Index = 0; (IoMmu = IoMmuGetInstance (Index)) != NULL; Index++) {
+    IoMmuBeginCommandBatch (IoMmu);
+  }
+
+  for (Index = 0; Index < NumberOfGrants; Index++) {
+    Status = IoMmuSetAttribute (&mRiscVIoMmuProtocol, Grants[Index].DeviceHandle, Grants[Index].MapInfo, Grants[Index].IoMmuAccess);
+    if (EFI_ERROR (Status)) {
+      DEBUG ((
+        DEBUG_WARN,
+        "%a: Failed to grant 0x%lx access to 0x%lx - %r\n",
+        __func__,
+        Grants[Index].IoMmuAccess,
+        Grants[Index].MapInfo->DeviceAddress,
+        Status
+        ));
+    }
+  }
+
+  for (Index = 0; (IoMmu = IoMmuGetInstance (Index)) != NULL; Index++) {
+    Status = IoMmuEndCommandBatch (IoMmu);
+    if (EFI_ERROR (Status)) {
+      DEBUG ((DEBUG_ERROR, "%a: The IOMMU at 0x%lx failed the grants - %r\n", __func__, IoMmu->Address, Status));
+    }
+  }
+
+  DEBUG ((RISCV_IOMMU_DEBUG_LEVEL, "%a: Applied %lu grants recorded before initialisation\n", __func__, (UINT64)NumberOfGrants));
+
+  if (Grants != NULL) {
+    FreePool (Grants);
+  }
+}
+
+/**
+  Complete the initialisation of the started IOMMUs, and if any is initialised,
+  prepare the PCI functions and apply the recorded grants.
+
+  Without an initialised IOMMU, the buffers stay at their own address, and the
+  grants are recorded until an IOMMU that is found later is initialised.
+
+**/
+STATIC
+VOID
+CompleteDeferredInitialisation (
+  VOID
+  )
+{
+  gBS->SetTimer (mCompletionTimer, TimerCancel, 0);
+  mCompletionPending = FALSE;
+
+  if (EFI_ERROR (IoMmuCompleteInitialisation ())) {
+    return;
+  }
+
+  if (mRiscVIoMmuGlobalDriverContext.Deferred) {
+    IoMmuPreparePciDevices ();
+    ApplyDeferredGrants ();
+  }
+}
+
+/**
+  Complete initialisation once the started IOMMUs accepted their registers, or once
+  they had as long as initialisation waits for them.
+
+  @param[in]  Event    The timer event.
+  @param[in]  Context  Unused.
+
+**/
+STATIC
+VOID
+EFIAPI
+OnCompletionTimer (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  BOOLEAN                     Ready;
+  RISCV_IOMMU_MMIO_OPERATION  Previous;
+
+  Previous = IoMmuBeginMmioOperation (RiscVIoMmuMmioInitialise);
+  Ready    = IoMmuStartedInstancesReady ();
+  IoMmuEndMmioOperation (Previous);
+
+  if (Ready || (++mCompletionTicks >= DEFERRED_COMPLETION_MAX_TICKS)) {
+    CompleteDeferredInitialisation ();
+  }
+}
+
+/**
+  Complete initialisation before a boot option starts, if the timer didn't yet.
+
+  @param[in]  Event    The ReadyToBoot event.
+  @param[in]  Context  Unused.
+
+**/
+STATIC
+VOID
+EFIAPI
+OnReadyToBoot (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  if (mCompletionPending) {
+    CompleteDeferredInitialisation ();
+  }
+}
+
+/**
+  Install EDKII_IOMMU_PROTOCOL before any IOMMU is initialised, if
+  PcdRiscVIoMmuDeferredInitialisation selects it.
+
+  Until an IOMMU is, Map() serves buffers at their own address, and SetAttribute()
+  records its grants, for IoMmuCompleteInitialisation() to apply.
+
+  @retval  EFI_SUCCESS      The protocol is installed.
+  @retval  EFI_UNSUPPORTED  Initialisation isn't deferred.
+  @retval  Others           The protocol could not be installed.
+
+**/
+EFI_STATUS
+IoMmuInstallDeferredProtocol (
+  VOID
+  )
+{
+  EFI_EVENT   ReadyToBootEvent;
+  EFI_HANDLE  Handle;
+  EFI_STATUS  Status;
+
+  if (!PcdGetBool (PcdRiscVIoMmuDeferredInitialisation)) {
+    return EFI_UNSUPPORTED;
+  }
+
+  Status = gBS->CreateEvent (
+                  EVT_TIMER | EVT_NOTIFY_SIGNAL,
+                  TPL_CALLBACK,
+                  OnCompletionTimer,
+                  NULL,
+                  &mCompletionTimer
+                  );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Status = EfiCreateEventReadyToBootEx (TPL_CALLBACK, OnReadyToBoot, NULL, &ReadyToBootEvent);
+  if (EFI_ERROR (Status)) {
+    gBS->CloseEvent (mCompletionTimer);
+    mCompletionTimer = NULL;
+    return Status;
+  }
+
+  //
+  // Buffers are reached at their own address, so the harts' limit applies, and no IOVAs are handed out.
+  //
+  mRiscVIoMmuGlobalDriverContext.Deferred           = TRUE;
+  mRiscVIoMmuGlobalDriverContext.TranslationEnabled = FALSE;
+  IoMmuUpdateDmaMemoryTop ();
+
+  Handle = NULL;
+  Status = gBS->InstallMultipleProtocolInterfaces (
+                  &Handle,
+                  &gEdkiiIoMmuProtocolGuid,
+                  &mRiscVIoMmuProtocol,
+                  NULL
+                  );
+  if (EFI_ERROR (Status)) {
+    mRiscVIoMmuGlobalDriverContext.Deferred           = FALSE;
+    mRiscVIoMmuGlobalDriverContext.TranslationEnabled = TRUE;
+    gBS->CloseEvent (ReadyToBootEvent);
+    gBS->CloseEvent (mCompletionTimer);
+    mCompletionTimer = NULL;
+    return Status;
+  }
+
+  DEBUG ((DEBUG_INFO, "%a: Installed the IOMMU protocol ahead of the hardware\n", __func__));
+  return EFI_SUCCESS;
+}
+
+/**
+  Poll the IOMMUs that IoMmuCommonInitialise() started from a timer, and
+  complete their initialisation once they are ready.
+
+**/
+VOID
+IoMmuScheduleDeferredCompletion (
+  VOID
+  )
+{
+  EFI_STATUS  Status;
+
+  mCompletionTicks   = 0;
+  mCompletionPending = TRUE;
+  Status             = gBS->SetTimer (mCompletionTimer, TimerPeriodic, DEFERRED_COMPLETION_PERIOD);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_WARN, "%a: Completing initialisation at once - %r\n", __func__, Status));
+    CompleteDeferredInitialisation ();
+  }
+}
+
+/**
+  Record the access that SetAttribute() grants a device to a mapping, while
+  initialisation is deferred.
+
+  @param[in]   MapInfo       The mapping.
+  @param[in]   DeviceHandle  The device.
+  @param[in]   IoMmuAccess   The access, or 0 to revoke it.
+  @param[out]  Status        The status for SetAttribute() to return, if it was recorded.
+
+  @retval  TRUE   The grant was recorded, and applies once an IOMMU is initialised.
+  @retval  FALSE  Initialisation isn't deferred, so the grant is to be applied now.
+
+**/
+BOOLEAN
+IoMmuRecordDeferredGrant (
+  IN  MAP_INFO    *MapInfo,
+  IN  EFI_HANDLE  DeviceHandle,
+  IN  UINT64      IoMmuAccess,
+  OUT EFI_STATUS  *Status
+  )
+{
+  DEFERRED_GRANT  *NewGrants;
+  UINTN           NewSize;
+  UINTN           Index;
+  EFI_TPL         OriginalTpl;
+
+  //
+  // The IOMMUs may complete at any time up to the check, but not between it and the record.
+  //
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  if (!mRiscVIoMmuGlobalDriverContext.Deferred) {
+    gBS->RestoreTPL (OriginalTpl);
+    return FALSE;
+  }
+
+  *Status = EFI_SUCCESS;
+  for (Index = 0; Index < mNumberOfDeferredGrants; Index++) {
+    if ((mDeferredGrants[Index].MapInfo == MapInfo) && (mDeferredGrants[Index].DeviceHandle == DeviceHandle)) {
+      break;
+    }
+  }
+
+  if (Index < mNumberOfDeferredGrants) {
+    //
+    // Revoking a grant that was never applied only forgets it.
+    //
+    if (IoMmuAccess == 0) {
+      mDeferredGrants[Index] = mDeferredGrants[--mNumberOfDeferredGrants];
+    } else {
+      mDeferredGrants[Index].IoMmuAccess = IoMmuAccess;
+    }
+  } else if (IoMmuAccess != 0) {
+    if (mNumberOfDeferredGrants == mDeferredGrantTableSize) {
+      NewSize   = MAX (DEFERRED_GRANT_TABLE_INITIAL_SIZE, mDeferredGrantTableSize * 2);
+      NewGrants = ReallocatePool (
+                    mDeferredGrantTableSize * sizeof (DEFERRED_GRANT),
+                    NewSize * sizeof (DEFERRED_GRANT),
+                    mDeferredGrants
+                    );
+      if (NewGrants == NULL) {
+        *Status = EFI_OUT_OF_RESOURCES;
+        gBS->RestoreTPL (OriginalTpl);
+        return TRUE;
+      }
+
+      mDeferredGrants         = NewGrants;
+      mDeferredGrantTableSize = NewSize;
+    }
+
+    mDeferredGrants[mNumberOfDeferredGrants].MapInfo      = MapInfo;
+    mDeferredGrants[mNumberOfDeferredGrants].DeviceHandle = DeviceHandle;
+    mDeferredGrants[mNumberOfDeferredGrants].IoMmuAccess  = IoMmuAccess;
+    mNumberOfDeferredGrants++;
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+  return TRUE;
+}
+
+/**
+  Forget the grants recorded for a mapping that is released.
+
+  @param[in]  MapInfo  The mapping.
+
+**/
+VOID
+IoMmuForgetDeferredGrants (
+  IN MAP_INFO  *MapInfo
+  )
+{
+  UINTN    Index;
+  EFI_TPL  OriginalTpl;
+
+  if (mNumberOfDeferredGrants == 0) {
+    return;
+  }
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  for (Index = 0; Index < mNumberOfDeferredGrants;) {
+    if (mDeferredGrants[Index].MapInfo == MapInfo) {
+      mDeferredGrants[Index] = mDeferredGrants[--mNumberOfDeferredGrants];
+    } else {
+      Index++;
+    }
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+}
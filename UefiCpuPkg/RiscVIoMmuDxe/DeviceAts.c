@@ -0,0 +1,501 @@
+/** @file
+  RISC-V IOMMU support for PCIe Address Translation Services.
+
+  A function with an Address Translation Cache requests its translations
+  from the IOMMU once and keeps them, so its DMA no longer walks the IO page
+  tables of its domain. ATS is enabled when the IOMMU, the root complex and
+  the function all support it. Every translation that is removed from the
+  IOTLB is then also invalidated in the ATC with ATS.INVAL, and ATS is
+  disabled again before boot services exit.
+
+  Where demand mapping is enabled, a function that also implements the Page
+  Request Interface reports its translation misses as page requests, which
+  PageRequest.c services.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/PcdLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <IndustryStandard/PciExpress40.h>
+#include "RiscVIoMmu.h"
+
+//
+// The ATS Control register, at offset 6 of the capability. The bitfields of
+// PCI_EXPRESS_EXTENDED_CAPABILITIES_ATS_CONTROL don't match the specification.
+//
+#define ATS_CONTROL_OFFSET  6
+#define ATS_CONTROL_STU     0x1F
+#define ATS_CONTROL_ENABLE  BIT15
+
+//
+// The registers of the PRI capability.
+//
+#define PRI_CONTROL_OFFSET     4
+#define PRI_CONTROL_ENABLE     BIT0
+#define PRI_CAPACITY_OFFSET    8
+#define PRI_ALLOCATION_OFFSET  12
+
+//
+// At most this many capabilities fit into the extended configuration space.
+//
+#define MAX_EXTENDED_CAPABILITIES  ((SIZE_4KB - EFI_PCIE_CAPABILITY_BASE_OFFSET) / sizeof (UINT32))
+
+//
+// ATS is only enabled once it can be disabled again at exit.
+//
+STATIC BOOLEAN  mDeviceAtsAllowed = FALSE;
+
+/**
+  Find an extended capability of a PCI function.
+
+  @param[in]  PciIo         The PCI I/O instance of the function.
+  @param[in]  CapabilityId  The ID of the capability.
+
+  @return  The offset of the capability, or 0 if the function has none.
+
+**/
+UINT16
+IoMmuFindExtendedCapability (
+  IN EFI_PCI_IO_PROTOCOL  *PciIo,
+  IN UINT16               CapabilityId
+  )
+{
+  UINT32      Header;
+  UINT32      Offset;
+  UINTN       Index;
+  EFI_STATUS  Status;
+
+  //
+  // Each header holds the capability ID in bits 15:0, and the next offset in bits 31:20.
+  //
+  Offset = EFI_PCIE_CAPABILITY_BASE_OFFSET;
+  for (Index = 0; (Index < MAX_EXTENDED_CAPABILITIES) && (Offset >= EFI_PCIE_CAPABILITY_BASE_OFFSET); Index++) {
+    Status = PciIo->Pci.Read (PciIo, EfiPciIoWidthUint32, Offset, 1, &Header);
+    if (EFI_ERROR (Status) || (Header == 0) || (Header == MAX_UINT32)) {
+      return 0;
+    }
+
+    if ((Header & MAX_UINT16) == CapabilityId) {
+      return (UINT16)Offset;
+    }
+
+    Offset = (Header >> 20) & ~(UINT32)0x3;
+  }
+
+  return 0;
+}
+
+/**
+  Enable or disable ATS in the ATS Control register of a function.
+
+  @param[in]  PciIo             The PCI I/O instance of the function.
+  @param[in]  CapabilityOffset  The offset of its ATS capability.
+  @param[in]  Enable            Whether to enable ATS.
+
+  @retval  EFI_SUCCESS  The register was written.
+  @retval  Others       The configuration space could not be accessed.
+
+**/
+STATIC
+EFI_STATUS
+SetAtsControl (
+  IN EFI_PCI_IO_PROTOCOL  *PciIo,
+  IN UINT16               CapabilityOffset,
+  IN BOOLEAN              Enable
+  )
+{
+  UINT16      Control;
+  EFI_STATUS  Status;
+
+  Status = PciIo->Pci.Read (PciIo, EfiPciIoWidthUint16, CapabilityOffset + ATS_CONTROL_OFFSET, 1, &Control);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  //
+  // Translations are requested for 4 KiB pages, the granule of the IO page tables.
+  //
+  Control &= ~(UINT16)(ATS_CONTROL_STU | ATS_CONTROL_ENABLE);
+  Control |= Enable ? ATS_CONTROL_ENABLE : 0;
+  return PciIo->Pci.Write (PciIo, EfiPciIoWidthUint16, CapabilityOffset + ATS_CONTROL_OFFSET, 1, &Control);
+}
+
+/**
+  Enable or disable page requests in the PRI Control register of a function.
+
+  @param[in]  PciIo             The PCI I/O instance of the function.
+  @param[in]  CapabilityOffset  The offset of its PRI capability.
+  @param[in]  Enable            Whether to enable page requests.
+
+  @retval  EFI_SUCCESS  The register was written.
+  @retval  Others       The configuration space could not be accessed.
+
+**/
+STATIC
+EFI_STATUS
+SetPriControl (
+  IN EFI_PCI_IO_PROTOCOL  *PciIo,
+  IN UINT16               CapabilityOffset,
+  IN BOOLEAN              Enable
+  )
+{
+  UINT16  Control;
+
+  Control = Enable ? PRI_CONTROL_ENABLE : 0;
+  return PciIo->Pci.Write (PciIo, EfiPciIoWidthUint16, CapabilityOffset + PRI_CONTROL_OFFSET, 1, &Control);
+}
+
+/**
+  Enable page requests for a function with ATS, if demand mapping is enabled and the path supports them.
+
+  @param[in]  IoMmu       The IOMMU.
+  @param[in]  Domain      The domain of the function, whose ATS is enabled.
+  @param[in]  PciIo       The PCI I/O instance of the function.
+  @param[in]  RouteFlags  The RISCV_IOMMU_ROUTE_* attributes of the function's route.
+
+**/
+STATIC
+VOID
+EnableDevicePri (
+  IN RISCV_IOMMU_INSTANCE       *IoMmu,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain,
+  IN EFI_PCI_IO_PROTOCOL        *PciIo,
+  IN UINT32                     RouteFlags
+  )
+{
+  RISCV_IOMMU_BASE_DEVICE_CONTEXT     *DeviceContext;
+  RISCV_IOMMU_DC_TRANSLATION_CONTROL  TranslationControl;
+  UINT16                              CapabilityOffset;
+  UINT32                              Capacity;
+  EFI_STATUS                          Status;
+
+  //
+  // Identity domains are complete, so nothing is mapped on demand, and a quarantined device is blocked.
+  //
+  if ((PcdGet32 (PcdRiscVIoMmuDemandMapThreshold) == 0) || (IoMmu->PageRequestQueue.Buffer == NULL) ||
+      ((RouteFlags & RISCV_IOMMU_ROUTE_PRI_SUPPORTED) == 0) || (Domain->Mode != RISCV_IOMMU_DEVICE_MODE_STRICT) ||
+      Domain->Quarantined)
+  {
+    return;
+  }
+
+  CapabilityOffset = IoMmuFindExtendedCapability (PciIo, PCI_EXPRESS_EXTENDED_CAPABILITY_PRI_ID);
+  if (CapabilityOffset == 0) {
+    return;
+  }
+
+  //
+  // The function may have as many requests outstanding as it can.
+  //
+  Status = PciIo->Pci.Read (PciIo, EfiPciIoWidthUint32, CapabilityOffset + PRI_CAPACITY_OFFSET, 1, &Capacity);
+  if (!EFI_ERROR (Status)) {
+    Status = PciIo->Pci.Write (PciIo, EfiPciIoWidthUint32, CapabilityOffset + PRI_ALLOCATION_OFFSET, 1, &Capacity);
+  }
+
+  if (EFI_ERROR (Status) || (Capacity == 0)) {
+    return;
+  }
+
+  DeviceContext                  = Domain->DeviceContext;
+  TranslationControl.Uint64      = DeviceContext->TranslationControl.Uint64;
+  TranslationControl.Bits.EN_PRI = 1;
+
+  DeviceContext->TranslationControl.Uint64 = TranslationControl.Uint64;
+  MemoryFence ();
+
+  IoMmuQueueDeviceContextInvalidation (IoMmu, TRUE, Domain->DeviceId);
+  Status = IoMmuSubmitCommands (IoMmu);
+  if (!EFI_ERROR (Status)) {
+    Status = SetPriControl (PciIo, CapabilityOffset, TRUE);
+  }
+
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_WARN, "%a: Failed to enable PRI for device_id 0x%x: %r\n", __func__, Domain->DeviceId.Uint32, Status));
+    return;
+  }
+
+  Domain->PriCapabilityOffset = CapabilityOffset;
+  Domain->PriEnabled          = TRUE;
+
+  //
+  // A page request stalls the function's DMA until it is answered.
+  //
+  IoMmuPollInterruptsFrequently ();
+
+  DEBUG ((RISCV_IOMMU_DEBUG_LEVEL, "%a: device_id 0x%x maps on demand, with %u requests outstanding\n", __func__, Domain->DeviceId.Uint32, Capacity));
+}
+
+/**
+  Enable ATS for a PCI function, if the IOMMU, its root complex and the function support it.
+
+  This is only attempted once per domain.
+
+  @param[in]  IoMmu        The IOMMU.
+  @param[in]  Domain       The domain of the function.
+  @param[in]  PciIo        The PCI I/O instance of the function.
+  @param[in]  Segment      The PCI segment of the function.
+  @param[in]  RequesterId  The RID of the function.
+  @param[in]  RouteFlags   The RISCV_IOMMU_ROUTE_* attributes of the function's route.
+
+**/
+VOID
+IoMmuEnableDeviceAts (
+  IN RISCV_IOMMU_INSTANCE       *IoMmu,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain,
+  IN EFI_PCI_IO_PROTOCOL        *PciIo,
+  IN UINT16                     Segment,
+  IN UINT16                     RequesterId,
+  IN UINT32                     RouteFlags
+  )
+{
+  RISCV_IOMMU_CAPABILITIES            Capabilities;
+  RISCV_IOMMU_BASE_DEVICE_CONTEXT     *DeviceContext;
+  RISCV_IOMMU_DC_TRANSLATION_CONTROL  TranslationControl;
+  UINT16                              CapabilityOffset;
+  EFI_STATUS                          Status;
+
+  if (Domain->AtsChecked || !mDeviceAtsAllowed || Domain->Quarantined) {
+    return;
+  }
+
+  Domain->AtsChecked = TRUE;
+
+  //
+  // A bypassed function gains nothing from caching translations. A permissive function shares
+  // its table, whose changes only invalidate the ATC of the function that made them. A CPU
+  // mirror changes with the hart's page table, and only invalidates the IOTLB.
+  //
+  Capabilities.Uint64 = IoMmu->Capabilities;
+  if (!Capabilities.Bits.ATS || ((RouteFlags & RISCV_IOMMU_ROUTE_ATS_SUPPORTED) == 0) ||
+      (Domain->Mode == RISCV_IOMMU_DEVICE_MODE_BYPASS) || (Domain->Mode == RISCV_IOMMU_DEVICE_MODE_PERMISSIVE) ||
+      (Domain->Mode == RISCV_IOMMU_DEVICE_MODE_CPU_MIRROR))
+  {
+    return;
+  }
+
+  CapabilityOffset = IoMmuFindExtendedCapability (PciIo, PCI_EXPRESS_EXTENDED_CAPABILITY_ATS_ID);
+  if (CapabilityOffset == 0) {
+    return;
+  }
+
+  //
+  // The IOMMU must answer translation requests before the function may send them.
+  //
+  DeviceContext                  = Domain->DeviceContext;
+  TranslationControl.Uint64      = DeviceContext->TranslationControl.Uint64;
+  TranslationControl.Bits.EN_ATS = 1;
+
+  DeviceContext->TranslationControl.Uint64 = TranslationControl.Uint64;
+  MemoryFence ();
+
+  IoMmuQueueDeviceContextInvalidation (IoMmu, TRUE, Domain->DeviceId);
+  Status = IoMmuSubmitCommands (IoMmu);
+  if (!EFI_ERROR (Status)) {
+    Status = SetAtsControl (PciIo, CapabilityOffset, TRUE);
+  }
+
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_WARN, "%a: Failed to enable ATS for device_id 0x%x: %r\n", __func__, Domain->DeviceId.Uint32, Status));
+    return;
+  }
+
+  Domain->AtsPciIo            = PciIo;
+  Domain->AtsCapabilityOffset = CapabilityOffset;
+  Domain->PciSegment          = Segment;
+  Domain->PciRequesterId      = RequesterId;
+  Domain->AtsEnabled          = TRUE;
+
+  EnableDevicePri (IoMmu, Domain, PciIo, RouteFlags);
+
+  DEBUG ((
+    RISCV_IOMMU_DEBUG_LEVEL,
+    "%a: %04x:%02x:%02x.%x caches its translations (device_id 0x%x)\n",
+    __func__,
+    Segment,
+    RequesterId >> 8,
+    (RequesterId >> 3) & 0x1F,
+    RequesterId & 0x7,
+    Domain->DeviceId.Uint32
+    ));
+}
+
+/**
+  Invalidate a range in the ATC of a domain's function, after its IOTLB entries were invalidated.
+
+  The ATCs of the other functions of a group are invalidated as well.
+
+  @param[in]  IoMmu    The IOMMU.
+  @param[in]  Domain   The domain.
+  @param[in]  Address  The first IO virtual address to invalidate.
+  @param[in]  Length   The length of the range.
+
+  @retval  EFI_SUCCESS       The range is invalidated, or the function has no ATC.
+  @retval  EFI_DEVICE_ERROR  The IOMMU failed to invalidate the range.
+
+**/
+EFI_STATUS
+IoMmuInvalidateDeviceAts (
+  IN RISCV_IOMMU_INSTANCE       *IoMmu,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain,
+  IN UINT64                     Address,
+  IN UINT64                     Length
+  )
+{
+  LIST_ENTRY                 *Link;
+  RISCV_IOMMU_DEVICE_DOMAIN  *Member;
+  BOOLEAN                    Queued;
+  EFI_STATUS                 Status;
+
+  if (Length == 0) {
+    return EFI_SUCCESS;
+  }
+
+  //
+  // The IOTLB was fenced first, so the function cannot refetch a stale translation.
+  // The fence of this invalidation completes once the function has acknowledged it.
+  //
+  Status = EFI_SUCCESS;
+  Queued = FALSE;
+  if (Domain->Group == NULL) {
+    if (Domain->AtsEnabled) {
+      Status = IoMmuQueueAtsInvalidation (IoMmu, Domain->PciSegment, Domain->PciRequesterId, Address, Length);
+      Queued = TRUE;
+    }
+  } else {
+    //
+    // Every function of a group may cache the translations of the table that they share.
+    //
+    for (Link = GetFirstNode (&IoMmu->DomainList)
+         ; !IsNull (&IoMmu->DomainList, Link) && !EFI_ERROR (Status)
+         ; Link = GetNextNode (&IoMmu->DomainList, Link)
+         ) {
+      Member = RISCV_IOMMU_DEVICE_DOMAIN_FROM_LINK (Link);
+      if ((Member->Group == Domain->Group) && Member->AtsEnabled) {
+        Status = IoMmuQueueAtsInvalidation (IoMmu, Member->PciSegment, Member->PciRequesterId, Address, Length);
+        Queued = TRUE;
+      }
+    }
+  }
+
+  if (!Queued) {
+    return EFI_SUCCESS;
+  }
+
+  if (!EFI_ERROR (Status)) {
+    Status = IoMmuSubmitCommands (IoMmu);
+  }
+
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "%a: Failed to invalidate the ATC of device_id 0x%x: %r\n", __func__, Domain->DeviceId.Uint32, Status));
+    return EFI_DEVICE_ERROR;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Queue the invalidation of every translation in the ATCs of an IOMMU's functions.
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @retval  EFI_SUCCESS       The invalidations were queued.
+  @retval  EFI_NOT_READY     The command queue is not enabled.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error.
+
+**/
+EFI_STATUS
+IoMmuQueueAllDeviceAtsInvalidations (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  LIST_ENTRY                 *Link;
+  RISCV_IOMMU_DEVICE_DOMAIN  *Domain;
+  EFI_STATUS                 Status;
+
+  for (Link = GetFirstNode (&IoMmu->DomainList)
+       ; !IsNull (&IoMmu->DomainList, Link)
+       ; Link = GetNextNode (&IoMmu->DomainList, Link)
+       ) {
+    Domain = RISCV_IOMMU_DEVICE_DOMAIN_FROM_LINK (Link);
+    if (!Domain->AtsEnabled) {
+      continue;
+    }
+
+    Status = IoMmuQueueAtsInvalidation (IoMmu, Domain->PciSegment, Domain->PciRequesterId, 0, 0);
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Flush the ATCs and disable PRI and ATS, before boot services exit.
+
+  Within a command batch, the ATC invalidations complete with the batch.
+
+**/
+VOID
+IoMmuDisableDeviceAts (
+  VOID
+  )
+{
+  LIST_ENTRY                 *InstanceLink;
+  LIST_ENTRY                 *Link;
+  RISCV_IOMMU_INSTANCE       *IoMmu;
+  RISCV_IOMMU_DEVICE_DOMAIN  *Domain;
+
+  for (InstanceLink = GetFirstNode (&mRiscVIoMmuGlobalDriverContext.InstanceList)
+       ; !IsNull (&mRiscVIoMmuGlobalDriverContext.InstanceList, InstanceLink)
+       ; InstanceLink = GetNextNode (&mRiscVIoMmuGlobalDriverContext.InstanceList, InstanceLink)
+       ) {
+    IoMmu = RISCV_IOMMU_INSTANCE_FROM_LINK (InstanceLink);
+    if (IoMmu->State != STATE_INITIALISED) {
+      continue;
+    }
+
+    if (!EFI_ERROR (IoMmuQueueAllDeviceAtsInvalidations (IoMmu))) {
+      IoMmuSubmitCommands (IoMmu);
+    }
+
+    for (Link = GetFirstNode (&IoMmu->DomainList)
+         ; !IsNull (&IoMmu->DomainList, Link)
+         ; Link = GetNextNode (&IoMmu->DomainList, Link)
+         ) {
+      Domain = RISCV_IOMMU_DEVICE_DOMAIN_FROM_LINK (Link);
+      if (Domain->PriEnabled) {
+        SetPriControl (Domain->AtsPciIo, Domain->PriCapabilityOffset, FALSE);
+        Domain->PriEnabled = FALSE;
+      }
+
+      if (Domain->AtsEnabled) {
+        SetAtsControl (Domain->AtsPciIo, Domain->AtsCapabilityOffset, FALSE);
+        Domain->AtsEnabled = FALSE;
+      }
+    }
+  }
+}
+
+/**
+  Allow ATS in functions that support it. The teardown at ExitBootServices() disables it again,
+  so no ATC outlives the firmware's translations.
+
+  @retval  EFI_SUCCESS      ATS is allowed.
+  @retval  EFI_UNSUPPORTED  The teardown isn't registered. ATS stays disabled.
+
+**/
+EFI_STATUS
+IoMmuInitialiseDeviceAts (
+  VOID
+  )
+{
+  mDeviceAtsAllowed = mRiscVIoMmuGlobalDriverContext.TeardownAtExit;
+  return mDeviceAtsAllowed ? EFI_SUCCESS : EFI_UNSUPPORTED;
+}
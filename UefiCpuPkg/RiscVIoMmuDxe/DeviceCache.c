@@ -0,0 +1,190 @@
+/** @file
+  RISC-V IOMMU per-device translation cache.
+
+  SetAttribute() resolves a device handle to its IOMMU and domain through the
+  device path, PCI I/O and routing lookups. The result is remembered here, in
+  a direct-mapped table keyed by the handle, so later requests of the device
+  skip all of them. Domains are never freed, so cached entries stay valid
+  until their handle is reused.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+#include <Protocol/PciIo.h>
+#include "RiscVIoMmu.h"
+
+#define DEVICE_CACHE_SIZE_SHIFT  5
+#define DEVICE_CACHE_SIZE        (1 << DEVICE_CACHE_SIZE_SHIFT)
+
+//
+// The multiplier of Fibonacci hashing, 2^64 divided by the golden ratio.
+//
+#define DEVICE_CACHE_HASH_MULTIPLIER  0x9E3779B97F4A7C15ULL
+
+typedef struct {
+  EFI_HANDLE                   DeviceHandle;
+  RISCV_IOMMU_INSTANCE         *IoMmu;
+  RISCV_IOMMU_DEVICE_DOMAIN    *Domain;
+} DEVICE_CACHE_ENTRY;
+
+STATIC DEVICE_CACHE_ENTRY  mDeviceCache[DEVICE_CACHE_SIZE];
+STATIC VOID                *mPciIoRegistration;
+
+/**
+  Return the slot of a device handle.
+
+  @param[in]  DeviceHandle  The device handle.
+
+  @return  The slot.
+
+**/
+STATIC
+DEVICE_CACHE_ENTRY *
+GetDeviceCacheSlot (
+  IN EFI_HANDLE  DeviceHandle
+  )
+{
+  UINT64  Hash;
+
+  Hash = MultU64x64 ((UINT64)(UINTN)DeviceHandle, DEVICE_CACHE_HASH_MULTIPLIER);
+  return &mDeviceCache[RShiftU64 (Hash, 64 - DEVICE_CACHE_SIZE_SHIFT)];
+}
+
+/**
+  Forget the handles that gain a PCI I/O instance.
+
+  Boot services cannot notify of uninstallation. But a freed handle can only
+  be resolved again once it is reused for a new function, whose PCI I/O
+  installation lands here before it can request DMA.
+
+  @param[in]  Event    The protocol notify event.
+  @param[in]  Context  Unused.
+
+**/
+STATIC
+VOID
+EFIAPI
+OnPciIoInstalled (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  EFI_HANDLE          Handle;
+  UINTN               BufferSize;
+  DEVICE_CACHE_ENTRY  *Entry;
+  EFI_TPL             OriginalTpl;
+
+  while (TRUE) {
+    BufferSize = sizeof (Handle);
+    if (EFI_ERROR (gBS->LocateHandle (ByRegisterNotify, NULL, mPciIoRegistration, &BufferSize, &Handle))) {
+      break;
+    }
+
+    OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+    Entry       = GetDeviceCacheSlot (Handle);
+    if (Entry->DeviceHandle == Handle) {
+      Entry->DeviceHandle = NULL;
+    }
+
+    gBS->RestoreTPL (OriginalTpl);
+  }
+}
+
+/**
+  Start tracking PCI I/O installations, which invalidate cached devices.
+
+  @retval  EFI_SUCCESS           The cache is ready.
+  @retval  EFI_OUT_OF_RESOURCES  The notify event could not be created. Nothing is cached.
+
+**/
+EFI_STATUS
+IoMmuInitialiseDeviceCache (
+  VOID
+  )
+{
+  EFI_EVENT  Event;
+
+  Event = EfiCreateProtocolNotifyEvent (
+            &gEfiPciIoProtocolGuid,
+            TPL_CALLBACK,
+            OnPciIoInstalled,
+            NULL,
+            &mPciIoRegistration
+            );
+  if (Event == NULL) {
+    mPciIoRegistration = NULL;
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Look up the IOMMU and domain that a device handle was resolved to.
+
+  @param[in]   DeviceHandle  The device handle.
+  @param[out]  IoMmu         The IOMMU that translates the device.
+
+  @return  The domain of the device, or NULL if the handle isn't cached.
+
+**/
+RISCV_IOMMU_DEVICE_DOMAIN *
+IoMmuLookupDeviceCache (
+  IN  EFI_HANDLE            DeviceHandle,
+  OUT RISCV_IOMMU_INSTANCE  **IoMmu
+  )
+{
+  DEVICE_CACHE_ENTRY         *Entry;
+  RISCV_IOMMU_DEVICE_DOMAIN  *Domain;
+  EFI_TPL                    OriginalTpl;
+
+  Domain      = NULL;
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  Entry       = GetDeviceCacheSlot (DeviceHandle);
+  if ((DeviceHandle != NULL) && (Entry->DeviceHandle == DeviceHandle)) {
+    *IoMmu = Entry->IoMmu;
+    Domain = Entry->Domain;
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+  return Domain;
+}
+
+/**
+  Remember the IOMMU and domain that a device handle was resolved to.
+
+  The entry replaces any other handle cached in its slot.
+
+  @param[in]  DeviceHandle  The device handle.
+  @param[in]  IoMmu         The IOMMU that translates the device.
+  @param[in]  Domain        The domain of the device.
+
+**/
+VOID
+IoMmuInsertDeviceCache (
+  IN EFI_HANDLE                 DeviceHandle,
+  IN RISCV_IOMMU_INSTANCE       *IoMmu,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain
+  )
+{
+  DEVICE_CACHE_ENTRY  *Entry;
+  EFI_TPL             OriginalTpl;
+
+  if (mPciIoRegistration == NULL) {
+    return;
+  }
+
+  OriginalTpl         = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  Entry               = GetDeviceCacheSlot (DeviceHandle);
+  Entry->DeviceHandle = DeviceHandle;
+  Entry->IoMmu        = IoMmu;
+  Entry->Domain       = Domain;
+  gBS->RestoreTPL (OriginalTpl);
+}
@@ -0,0 +1,1079 @@
+/** @file
+  RISC-V IOMMU device-directory table and device context management.
+
+  The functions of a multi-function device without ACS isolation can reach each
+  other's memory through the device anyway, so their strict domains form a group
+  that shares one page table and PSCID. A buffer that the functions share is then
+  mapped once, and invalidated once, for all of them.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include "RiscVIoMmu.h"
+
+/**
+  Determine the widest device_id that a number of device-directory levels can index.
+
+  @param[in]  IoMmu   The IOMMU.
+  @param[in]  Levels  The number of levels.
+
+  @return  The width of the device_id in bits.
+
+**/
+STATIC
+UINT8
+IoMmuGetDeviceDirectoryWidth (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT8                 Levels
+  )
+{
+  BOOLEAN  Extended;
+
+  //
+  // Each level indexes the device_id bits below the next DDI, so a base-format
+  // directory of two levels covers the 16-bit RID of a single segment.
+  //
+  Extended = IoMmu->DeviceContext.ContextStructIsExtended;
+  switch (Levels) {
+    case 0:
+      return 0;
+    case 1:
+      return Extended ? N_RISCV_IOMMU_DEVICE_ID_EXTENDED_I1 : N_RISCV_IOMMU_DEVICE_ID_BASE_I1;
+    case 2:
+      return Extended ? N_RISCV_IOMMU_DEVICE_ID_EXTENDED_I2 : N_RISCV_IOMMU_DEVICE_ID_BASE_I2;
+    default:
+      return N_RISCV_IOMMU_DEVICE_ID_MAX;
+  }
+}
+
+/**
+  Determine the number of device-directory levels needed to index a device_id.
+
+  @param[in]  IoMmu          The IOMMU.
+  @param[in]  DeviceIdWidth  The width of the device_id in bits.
+
+  @return  The number of levels, from 1 to 3.
+
+**/
+UINT8
+IoMmuGetDeviceDirectoryLevels (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT8                 DeviceIdWidth
+  )
+{
+  UINT8  Levels;
+
+  for (Levels = 1; Levels < 3; Levels++) {
+    if (DeviceIdWidth <= IoMmuGetDeviceDirectoryWidth (IoMmu, Levels)) {
+      break;
+    }
+  }
+
+  return Levels;
+}
+
+/**
+  Add levels above the root of the device-directory table.
+
+  The previous root becomes the first entry of the new root, so that
+  all existing device contexts keep their device_id.
+
+  @param[in]  IoMmu   The IOMMU.
+  @param[in]  Levels  The number of levels needed.
+
+  @retval  TRUE   The directory has the needed number of levels.
+  @retval  FALSE  The directory could not be grown.
+
+**/
+STATIC
+BOOLEAN
+IoMmuGrowDeviceDirectory (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT8                 Levels
+  )
+{
+  CONTEXT_WRAPPER                 *ContextStruct;
+  RISCV_IOMMU_DDT_NON_LEAF_ENTRY  *NewRoot;
+  RISCV_IOMMU_DDTP                Ddtp;
+  RISCV_IOMMU_DDTP                OldDdtp;
+  RISCV_IOMMU_DEVICE_ID           AllDevices;
+  EFI_STATUS                      Status;
+
+  ContextStruct = &IoMmu->DeviceContext;
+  while (ContextStruct->Levels < Levels) {
+    NewRoot = IoMmuAllocateTablePage (IoMmu, RiscVIoMmuFootprintDirectory);
+    if (NewRoot == NULL) {
+      return FALSE;
+    }
+
+    NewRoot[0].Bits.PPN = ((UINT64)ContextStruct->Buffer) >> RISCV_MMU_PAGE_SHIFT;
+    NewRoot[0].Bits.V   = 1;
+    IoMmuQueueCacheClean (IoMmu, &NewRoot[0], sizeof (NewRoot[0]));
+    IoMmuFlushCacheCleans (IoMmu);
+    MemoryFence ();
+
+    OldDdtp.Uint64       = IoMmuRead64 (IoMmu, R_RISCV_IOMMU_DDTP);
+    Ddtp.Uint64          = 0;
+    Ddtp.Bits.iommu_mode = V_RISCV_IOMMU_DDTP_IOMMU_MODE_BARE + ContextStruct->Levels + 1;
+    Ddtp.Bits.PPN        = ((UINT64)NewRoot) >> RISCV_MMU_PAGE_SHIFT;
+    Status               = IoMmuWriteAndWait64 (IoMmu, R_RISCV_IOMMU_DDTP, Ddtp.Uint64, 1 << N_RISCV_IOMMU_DDTP_BUSY, FALSE);
+
+    if (EFI_ERROR (Status) || (IoMmuRead64 (IoMmu, R_RISCV_IOMMU_DDTP) != Ddtp.Uint64)) {
+      DEBUG ((DEBUG_ERROR, "%a: IOMMU mode 0x%x is not supported!\n", __func__, Ddtp.Bits.iommu_mode));
+      IoMmuWriteAndWait64 (IoMmu, R_RISCV_IOMMU_DDTP, OldDdtp.Uint64, 1 << N_RISCV_IOMMU_DDTP_BUSY, FALSE);
+      IoMmuFreeTablePage (NewRoot, RiscVIoMmuFootprintDirectory);
+      return FALSE;
+    }
+
+    ContextStruct->Buffer = NewRoot;
+    ContextStruct->Levels++;
+    ContextStruct->NumberOfPages++;
+
+    DEBUG ((
+      RISCV_IOMMU_DEBUG_LEVEL,
+      "%a: Grew the device table to %d levels at 0x%x\n",
+      __func__,
+      ContextStruct->Levels,
+      ContextStruct->Buffer
+      ));
+  }
+
+  //
+  // Cached non-leaf entries refer to the previous root.
+  //
+  AllDevices.Uint32 = 0;
+  IoMmuQueueDeviceContextInvalidation (IoMmu, FALSE, AllDevices);
+  return !EFI_ERROR (IoMmuSubmitCommands (IoMmu));
+}
+
+/**
+  Locate the device context of a device_id in the device-directory table.
+
+  Non-leaf and leaf DDT pages are only allocated when a device_id first needs them,
+  so a sparse set of device_ids costs a few pages.
+
+  @param[in]  IoMmu     The IOMMU.
+  @param[in]  DeviceId  The device_id to locate.
+  @param[in]  Allocate  Whether missing DDT pages and levels may be allocated.
+
+  @return  The device context, or NULL if it could not be located.
+
+**/
+STATIC
+VOID *
+IoMmuLocateDeviceContext (
+  IN RISCV_IOMMU_INSTANCE   *IoMmu,
+  IN RISCV_IOMMU_DEVICE_ID  DeviceId,
+  IN BOOLEAN                Allocate
+  )
+{
+  CONTEXT_WRAPPER                 *ContextStruct;
+  UINT8                           LeafIndexWidth;
+  UINTN                           ContextSize;
+  UINT8                           Level;
+  UINTN                           Index;
+  RISCV_IOMMU_DDT_NON_LEAF_ENTRY  *Table;
+  VOID                            *NextTable;
+
+  ContextStruct = &IoMmu->DeviceContext;
+  if ((ContextStruct->Buffer == NULL) || (ContextStruct->Levels == 0)) {
+    return NULL;
+  }
+
+  if (ContextStruct->ContextStructIsExtended) {
+    LeafIndexWidth = N_RISCV_IOMMU_DEVICE_ID_EXTENDED_I1;
+    ContextSize    = sizeof (RISCV_IOMMU_EXTENDED_DEVICE_CONTEXT);
+  } else {
+    LeafIndexWidth = N_RISCV_IOMMU_DEVICE_ID_BASE_I1;
+    ContextSize    = sizeof (RISCV_IOMMU_BASE_DEVICE_CONTEXT);
+  }
+
+  //
+  // A device_id that doesn't fit into the directory needs more levels.
+  //
+  if ((DeviceId.Uint32 >> IoMmuGetDeviceDirectoryWidth (IoMmu, ContextStruct->Levels)) != 0) {
+    if ((DeviceId.Uint32 >> N_RISCV_IOMMU_DEVICE_ID_MAX) != 0) {
+      return NULL;
+    }
+
+    if (!Allocate ||
+        !IoMmuGrowDeviceDirectory (
+           IoMmu,
+           IoMmuGetDeviceDirectoryLevels (IoMmu, (UINT8)HighBitSet32 (DeviceId.Uint32) + 1)
+           ))
+    {
+      return NULL;
+    }
+  }
+
+  //
+  // Walk the non-leaf levels, from the root down.
+  //
+  Table = ContextStruct->Buffer;
+  for (Level = ContextStruct->Levels - 1; Level > 0; Level--) {
+    Index = (DeviceId.Uint32 >> (LeafIndexWidth + (Level - 1) * RISCV_IOMMU_DDT_NON_LEAF_INDEX_WIDTH)) &
+            ((1U << RISCV_IOMMU_DDT_NON_LEAF_INDEX_WIDTH) - 1);
+
+    if (!Table[Index].Bits.V) {
+      if (!Allocate) {
+        return NULL;
+      }
+
+      NextTable = IoMmuAllocateTablePage (IoMmu, RiscVIoMmuFootprintDirectory);
+      if (NextTable == NULL) {
+        return NULL;
+      }
+
+      ContextStruct->NumberOfPages++;
+
+      //
+      // The new page must be observable as empty before it is linked in.
+      //
+      MemoryFence ();
+      Table[Index].Uint64   = 0;
+      Table[Index].Bits.PPN = ((UINT64)NextTable) >> RISCV_MMU_PAGE_SHIFT;
+      Table[Index].Bits.V   = 1;
+      IoMmuQueueCacheClean (IoMmu, &Table[Index], sizeof (Table[Index]));
+    }
+
+    Table = (VOID *)(UINTN)(Table[Index].Bits.PPN << RISCV_MMU_PAGE_SHIFT);
+  }
+
+  Index = DeviceId.Uint32 & ((1U << LeafIndexWidth) - 1);
+  return (UINT8 *)Table + Index * ContextSize;
+}
+
+/**
+  Program a device context to translate through a domain's first-stage page table,
+  or to bypass translation.
+
+  @param[in]  IoMmu   The IOMMU.
+  @param[in]  Domain  The domain to program the context of.
+
+  @retval  EFI_SUCCESS       The context was programmed.
+  @retval  EFI_DEVICE_ERROR  The IOMMU failed to invalidate the context.
+
+**/
+STATIC
+EFI_STATUS
+IoMmuProgramDeviceContext (
+  IN RISCV_IOMMU_INSTANCE       *IoMmu,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain
+  )
+{
+  RISCV_IOMMU_BASE_DEVICE_CONTEXT     *DeviceContext;
+  RISCV_IOMMU_DC_TRANSLATION_CONTROL  TranslationControl;
+  RISCV_IOMMU_FCTL                    FeatureControl;
+  RISCV_IOMMU_CAPABILITIES            Capabilities;
+  RISCV_IOMMU_QOSID                   QosId;
+
+  //
+  // The base format is a prefix of the extended format, whose MSI fields point at the IOMMU's
+  // MSI page table, if it has one, and otherwise stay zero (MSI translation off).
+  //
+  DeviceContext = Domain->DeviceContext;
+
+  //
+  // A context that an adopted configuration left valid is taken over, after the IOMMU
+  // has dropped it, so that it never walks a mix of both. That can't wait for the end
+  // of a command batch.
+  //
+  if (DeviceContext->TranslationControl.Bits.V) {
+    DeviceContext->TranslationControl.Uint64 = 0;
+    IoMmuQueueCacheClean (IoMmu, &DeviceContext->TranslationControl, sizeof (DeviceContext->TranslationControl));
+    MemoryFence ();
+    IoMmuQueueDeviceContextInvalidation (IoMmu, TRUE, Domain->DeviceId);
+    if (EFI_ERROR (IoMmuFenceCommands (IoMmu))) {
+      return EFI_DEVICE_ERROR;
+    }
+  }
+
+  DeviceContext->IoHgatp.Uint64               = 0;
+  DeviceContext->IoHgatp.Bits.MODE            = V_RISCV_IOMMU_IOHGATP_MODE_BARE;
+  DeviceContext->TranslationAttributes.Uint64 = 0;
+  DeviceContext->FirstStageContext.Uint64     = 0;
+  if (Domain->RootPageTable != NULL) {
+    DeviceContext->TranslationAttributes.Bits.PSCID = Domain->Pscid;
+    DeviceContext->FirstStageContext.Bits.PPN       = ((UINT64)Domain->RootPageTable) >> RISCV_MMU_PAGE_SHIFT;
+    DeviceContext->FirstStageContext.Bits.MODE      = IoMmu->IoSatpMode;
+  } else {
+    DeviceContext->FirstStageContext.Bits.MODE = V_RISCV_IOMMU_IOSATP_MODE_BARE;
+  }
+
+  //
+  // IDs the IOMMU doesn't implement would make the context misconfigured, so they fall back to 0.
+  //
+  QosId.Uint32 = Domain->QosId;
+  if ((QosId.Uint32 & ~IoMmu->QosIdMask) != 0) {
+    DEBUG ((DEBUG_WARN, "%a: QoS IDs 0x%x of device_id 0x%x aren't implemented\n", __func__, QosId.Uint32, Domain->DeviceId.Uint32));
+    QosId.Uint32 = 0;
+  }
+
+  DeviceContext->TranslationAttributes.Bits.RCID = QosId.Bits.RCID;
+  DeviceContext->TranslationAttributes.Bits.MCID = QosId.Bits.MCID;
+
+  //
+  // Implicit accesses to the page table use the same endianness and XLEN as the IOMMU was configured with.
+  //
+  FeatureControl.Uint32       = IoMmu->FeatureControl;
+  TranslationControl.Uint64   = 0;
+  TranslationControl.Bits.SBE = FeatureControl.Bits.BE;
+  TranslationControl.Bits.SXL = FeatureControl.Bits.GXL;
+  TranslationControl.Bits.V   = 1;
+
+  //
+  // Leaves are created with A and D set, unless their writes are tracked. Those have D
+  // set by the IOMMU, rather than faulting. Without coherence, a clean of a neighbouring
+  // entry could overwrite the IOMMU's update, so writes aren't tracked.
+  //
+  Capabilities.Uint64          = IoMmu->Capabilities;
+  TranslationControl.Bits.SADE = Capabilities.Bits.AMO_HWAD && !IoMmu->NonCoherent;
+
+  if (IoMmu->DeviceContext.ContextStructIsExtended) {
+    IoMmuSetDeviceContextMsiTranslation (IoMmu, (RISCV_IOMMU_EXTENDED_DEVICE_CONTEXT *)DeviceContext);
+  }
+
+  //
+  // The remaining fields must be observable before the context becomes valid.
+  //
+  IoMmuQueueCacheClean (IoMmu, DeviceContext, sizeof (*DeviceContext));
+  IoMmuFlushCacheCleans (IoMmu);
+  MemoryFence ();
+  DeviceContext->TranslationControl.Uint64 = TranslationControl.Uint64;
+  IoMmuQueueCacheClean (IoMmu, &DeviceContext->TranslationControl, sizeof (DeviceContext->TranslationControl));
+  MemoryFence ();
+
+  IoMmuQueueDeviceContextInvalidation (IoMmu, TRUE, Domain->DeviceId);
+  return IoMmuSubmitCommands (IoMmu);
+}
+
+/**
+  Point the device context of an unused device_id at a page table, or invalidate it again.
+
+  The context serves translation requests through the debug interface. Its device_id is
+  the last one the device directory indexes already, so the directory doesn't grow, and
+  its faults are only reported in the responses. Its translations are tagged with
+  RISCV_IOMMU_SCRATCH_PSCID, which are invalidated either way.
+
+  @param[in]   IoMmu          The IOMMU.
+  @param[in]   IoSatpMode     The mode the page table is walked in.
+  @param[in]   RootPageTable  The root of the page table, or NULL to invalidate the context.
+  @param[out]  DeviceId       The device_id of the context.
+
+  @retval  EFI_SUCCESS       The context was programmed or invalidated.
+  @retval  EFI_NOT_FOUND     A domain uses the device_id.
+  @retval  EFI_UNSUPPORTED   There is no device context for the device_id.
+  @retval  EFI_DEVICE_ERROR  The IOMMU failed to invalidate its caches.
+
+**/
+EFI_STATUS
+IoMmuSetScratchDeviceContext (
+  IN  RISCV_IOMMU_INSTANCE   *IoMmu,
+  IN  UINT8                  IoSatpMode,
+  IN  UINT64                 *RootPageTable OPTIONAL,
+  OUT RISCV_IOMMU_DEVICE_ID  *DeviceId
+  )
+{
+  RISCV_IOMMU_BASE_DEVICE_CONTEXT     *DeviceContext;
+  RISCV_IOMMU_DC_TRANSLATION_CONTROL  TranslationControl;
+  RISCV_IOMMU_FCTL                    FeatureControl;
+
+  DeviceId->Uint32 = (1U << IoMmuGetDeviceDirectoryWidth (IoMmu, IoMmu->DeviceContext.Levels)) - 1;
+  if (IoMmuFindDeviceDomain (IoMmu, DeviceId->Uint32) != NULL) {
+    return EFI_NOT_FOUND;
+  }
+
+  DeviceContext = IoMmuLocateDeviceContext (IoMmu, *DeviceId, TRUE);
+  if (DeviceContext == NULL) {
+    return EFI_UNSUPPORTED;
+  }
+
+  DeviceContext->TranslationControl.Uint64 = 0;
+  MemoryFence ();
+  if (RootPageTable != NULL) {
+    DeviceContext->IoHgatp.Uint64                   = 0;
+    DeviceContext->IoHgatp.Bits.MODE                = V_RISCV_IOMMU_IOHGATP_MODE_BARE;
+    DeviceContext->TranslationAttributes.Uint64     = 0;
+    DeviceContext->TranslationAttributes.Bits.PSCID = RISCV_IOMMU_SCRATCH_PSCID;
+    DeviceContext->FirstStageContext.Uint64         = 0;
+    DeviceContext->FirstStageContext.Bits.PPN       = ((UINT64)RootPageTable) >> RISCV_MMU_PAGE_SHIFT;
+    DeviceContext->FirstStageContext.Bits.MODE      = IoSatpMode;
+
+    FeatureControl.Uint32       = IoMmu->FeatureControl;
+    TranslationControl.Uint64   = 0;
+    TranslationControl.Bits.DTF = 1;
+    TranslationControl.Bits.SBE = FeatureControl.Bits.BE;
+    TranslationControl.Bits.SXL = FeatureControl.Bits.GXL;
+    TranslationControl.Bits.V   = 1;
+
+    IoMmuQueueCacheClean (IoMmu, DeviceContext, sizeof (*DeviceContext));
+    IoMmuFlushCacheCleans (IoMmu);
+    MemoryFence ();
+    DeviceContext->TranslationControl.Uint64 = TranslationControl.Uint64;
+    MemoryFence ();
+  }
+
+  IoMmuQueueCacheClean (IoMmu, &DeviceContext->TranslationControl, sizeof (DeviceContext->TranslationControl));
+
+  IoMmuQueueDeviceContextInvalidation (IoMmu, TRUE, *DeviceId);
+  IoMmuQueueIoTlbInvalidation (IoMmu, TRUE, RISCV_IOMMU_SCRATCH_PSCID, FALSE, 0);
+  return IoMmuSubmitCommands (IoMmu);
+}
+
+/**
+  Find the domain of a device_id, without creating it.
+
+  @param[in]  IoMmu     The IOMMU.
+  @param[in]  DeviceId  The device_id.
+
+  @return  The domain, or NULL if the device has none.
+
+**/
+RISCV_IOMMU_DEVICE_DOMAIN *
+IoMmuFindDeviceDomain (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT32                DeviceId
+  )
+{
+  LIST_ENTRY                 *Link;
+  RISCV_IOMMU_DEVICE_DOMAIN  *Domain;
+
+  for (Link = GetFirstNode (&IoMmu->DomainList)
+       ; !IsNull (&IoMmu->DomainList, Link)
+       ; Link = GetNextNode (&IoMmu->DomainList, Link)
+       ) {
+    Domain = RISCV_IOMMU_DEVICE_DOMAIN_FROM_LINK (Link);
+    if (Domain->DeviceId.Uint32 == DeviceId) {
+      return Domain;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+  Return whether two domains translate through the same page table, as one domain or one group.
+
+  @param[in]  Domain  A domain, or NULL.
+  @param[in]  Other   Another domain, or NULL.
+
+  @retval  TRUE   A mapping in the page table of one is also a mapping of the other.
+  @retval  FALSE  The domains have page tables of their own, or one is NULL.
+
+**/
+BOOLEAN
+IoMmuSharesTranslation (
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain OPTIONAL,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Other OPTIONAL
+  )
+{
+  if ((Domain == NULL) || (Other == NULL)) {
+    return FALSE;
+  }
+
+  return (Domain == Other) || ((Domain->Group != NULL) && (Domain->Group == Other->Group));
+}
+
+/**
+  Find the group that a strict domain joins: the first domain of another strict domain
+  with the same group key.
+
+  @param[in]  IoMmu     The IOMMU.
+  @param[in]  GroupKey  The group key of the new domain.
+
+  @return  The first domain of the group, or NULL if the new domain starts its own.
+
+**/
+STATIC
+RISCV_IOMMU_DEVICE_DOMAIN *
+FindDomainGroup (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT64                GroupKey
+  )
+{
+  LIST_ENTRY                 *Link;
+  RISCV_IOMMU_DEVICE_DOMAIN  *Domain;
+
+  if (GroupKey == 0) {
+    return NULL;
+  }
+
+  for (Link = GetFirstNode (&IoMmu->DomainList)
+       ; !IsNull (&IoMmu->DomainList, Link)
+       ; Link = GetNextNode (&IoMmu->DomainList, Link)
+       ) {
+    Domain = RISCV_IOMMU_DEVICE_DOMAIN_FROM_LINK (Link);
+    if ((Domain->GroupKey == GroupKey) && (Domain->Mode == RISCV_IOMMU_DEVICE_MODE_STRICT)) {
+      return (Domain->Group != NULL) ? Domain->Group : Domain;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+  Return whether another function of a domain's group is attached, and translates through the table.
+
+  @param[in]  IoMmu   The IOMMU.
+  @param[in]  Domain  The domain.
+
+  @retval  TRUE   The table is still in use.
+  @retval  FALSE  The domain isn't grouped, or is the last attached function of its group.
+
+**/
+STATIC
+BOOLEAN
+IsGroupTableInUse (
+  IN RISCV_IOMMU_INSTANCE       *IoMmu,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain
+  )
+{
+  LIST_ENTRY                 *Link;
+  RISCV_IOMMU_DEVICE_DOMAIN  *Member;
+
+  if (Domain->Group == NULL) {
+    return FALSE;
+  }
+
+  for (Link = GetFirstNode (&IoMmu->DomainList)
+       ; !IsNull (&IoMmu->DomainList, Link)
+       ; Link = GetNextNode (&IoMmu->DomainList, Link)
+       ) {
+    Member = RISCV_IOMMU_DEVICE_DOMAIN_FROM_LINK (Link);
+    if ((Member != Domain) && (Member->Group == Domain->Group) && !Member->Detached) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/**
+  Fill a domain's page table for its mode, and program its device context.
+
+  @param[in]  IoMmu   The IOMMU.
+  @param[in]  Domain  The domain, whose page table is empty.
+
+  @retval  EFI_SUCCESS  The device context translates through the domain.
+  @retval  Others       The page table could not be filled, or the context programmed.
+
+**/
+STATIC
+EFI_STATUS
+AttachDeviceDomain (
+  IN RISCV_IOMMU_INSTANCE       *IoMmu,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain
+  )
+{
+  EFI_STATUS  Status;
+
+  //
+  // An identity domain is complete before its device context becomes valid, and never changes.
+  // A CPU mirror domain is too, and is then refreshed with each change of the hart's page table,
+  // which is tracked before the mirror is taken.
+  //
+  Status = EFI_SUCCESS;
+  if (Domain->Mode == RISCV_IOMMU_DEVICE_MODE_IDENTITY) {
+    Status = IoMmuIdentityMapSystemMemory (IoMmu, Domain->RootPageTable);
+  } else if (Domain->Mode == RISCV_IOMMU_DEVICE_MODE_CPU_MIRROR) {
+    IoMmuTrackCpuPageTable ();
+    Status = IoMmuMirrorCpuPageTable (IoMmu, Domain->RootPageTable, Domain->Pscid, 0, MAX_UINT64, FALSE);
+  }
+
+  //
+  // MSIs are checked against the MSI page table after first-stage translation, which must pass them at their own address.
+  //
+  if (!EFI_ERROR (Status)) {
+    Status = IoMmuMapMsiWindow (IoMmu, Domain);
+  }
+
+  //
+  // A device that an earlier stage left DMAing reaches its regions from the first cycle.
+  //
+  if (!EFI_ERROR (Status)) {
+    Status = IoMmuMapReservedRegions (IoMmu, Domain);
+  }
+
+  if (!EFI_ERROR (Status)) {
+    Status = IoMmuProgramDeviceContext (IoMmu, Domain);
+  }
+
+  return Status;
+}
+
+/**
+  Detach a domain from its hot-removed function.
+
+  Only the function's device context is invalidated, and only the translations of
+  the domain's PSCID, so the other devices keep their cached state. The page table
+  is then released in bulk. The domain itself is kept, as mappings and the device
+  cache may still refer to it, and a function hot-added at the same device_id
+  attaches to it again.
+
+  @param[in]  IoMmu   The IOMMU.
+  @param[in]  Domain  The domain of the function.
+
+  @retval  EFI_SUCCESS       The domain is detached.
+  @retval  EFI_DEVICE_ERROR  The IOMMU failed to invalidate the device context. The page table is kept.
+
+**/
+EFI_STATUS
+IoMmuDetachDeviceDomain (
+  IN RISCV_IOMMU_INSTANCE       *IoMmu,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain
+  )
+{
+  RISCV_IOMMU_BASE_DEVICE_CONTEXT  *DeviceContext;
+  BOOLEAN                          ClearTable;
+  EFI_TPL                          OriginalTpl;
+  EFI_STATUS                       Status;
+
+  if (Domain->Detached) {
+    return EFI_SUCCESS;
+  }
+
+  OriginalTpl   = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  DeviceContext = Domain->DeviceContext;
+  DeviceContext->TranslationControl.Uint64 = 0;
+  IoMmuQueueCacheClean (IoMmu, &DeviceContext->TranslationControl, sizeof (DeviceContext->TranslationControl));
+  MemoryFence ();
+
+  //
+  // The table of a group stays while another of its functions is attached.
+  //
+  ClearTable = (Domain->RootPageTable != NULL) && (Domain->Mode != RISCV_IOMMU_DEVICE_MODE_PERMISSIVE) &&
+               !IsGroupTableInUse (IoMmu, Domain);
+
+  IoMmuQueueDeviceContextInvalidation (IoMmu, TRUE, Domain->DeviceId);
+  if (ClearTable) {
+    IoMmuQueueIoTlbInvalidation (IoMmu, TRUE, Domain->Pscid, FALSE, 0);
+  }
+
+  Status = IoMmuSubmitCommands (IoMmu);
+  if (EFI_ERROR (Status)) {
+    gBS->RestoreTPL (OriginalTpl);
+    DEBUG ((DEBUG_ERROR, "%a: device_id 0x%x failed to detach: %r\n", __func__, Domain->DeviceId.Uint32, Status));
+    return EFI_DEVICE_ERROR;
+  }
+
+  //
+  // The shared table of permissive domains stays.
+  //
+  if (ClearTable) {
+    IoMmuClearPageTable (IoMmu, Domain->RootPageTable);
+    IoMmuFlushCacheCleans (IoMmu);
+    if (Domain->Group != NULL) {
+      Domain->Group->TablePages = 0;
+    }
+
+    Domain->TablePages = 0;
+  }
+
+  Domain->Detached       = TRUE;
+  Domain->Quarantined    = FALSE;
+  Domain->FaultsInWindow = 0;
+  Domain->AtsChecked     = FALSE;
+  Domain->AtsEnabled   = FALSE;
+  Domain->AtsPciIo     = NULL;
+  Domain->PriEnabled   = FALSE;
+  Domain->ExposedBytes = 0;
+  gBS->RestoreTPL (OriginalTpl);
+
+  DEBUG ((RISCV_IOMMU_DEBUG_LEVEL, "%a: device_id 0x%x is detached\n", __func__, Domain->DeviceId.Uint32));
+  return EFI_SUCCESS;
+}
+
+/**
+  Let a strict domain whose page table outgrew its budget translate as an identity domain.
+
+  All system memory is mapped at its own address around the buffers already mapped,
+  mostly by gigapages, so that its later buffers need no more table pages. Buffers at
+  IOVAs or with bounce pages keep their leaves until they are unmapped. The tables
+  already allocated are kept, as the device may be reaching through them.
+
+  @param[in]  IoMmu   The IOMMU.
+  @param[in]  Domain  The domain.
+
+  @retval  EFI_SUCCESS  The domain reaches all system memory at its own address.
+  @retval  Others       The identity leaves could not be built, or invalidated. The domain stays strict.
+
+**/
+EFI_STATUS
+IoMmuFallBackToIdentity (
+  IN RISCV_IOMMU_INSTANCE       *IoMmu,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain
+  )
+{
+  LIST_ENTRY                 *Link;
+  RISCV_IOMMU_DEVICE_DOMAIN  *Member;
+  EFI_TPL                    OriginalTpl;
+  EFI_STATUS                 Status;
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  if (Domain->Mode != RISCV_IOMMU_DEVICE_MODE_STRICT) {
+    gBS->RestoreTPL (OriginalTpl);
+    return EFI_SUCCESS;
+  }
+
+  //
+  // Leaves mapped in place may have been read-only, and are widened.
+  //
+  Status = IoMmuIdentityMapSystemMemory (IoMmu, Domain->RootPageTable);
+  if (!EFI_ERROR (Status)) {
+    IoMmuQueueIoTlbInvalidation (IoMmu, TRUE, Domain->Pscid, FALSE, 0);
+    Status = IoMmuSubmitCommands (IoMmu);
+  }
+
+  if (!EFI_ERROR (Status)) {
+    Status = IoMmuInvalidateDeviceAts (IoMmu, Domain, 0, IoMmuGetIoVirtualAddressLimit (IoMmu));
+  }
+
+  //
+  // The other functions of a group reach the same identity leaves.
+  //
+  if (!EFI_ERROR (Status)) {
+    Domain->Mode = RISCV_IOMMU_DEVICE_MODE_IDENTITY;
+    for (Link = GetFirstNode (&IoMmu->DomainList)
+         ; (Domain->Group != NULL) && !IsNull (&IoMmu->DomainList, Link)
+         ; Link = GetNextNode (&IoMmu->DomainList, Link)
+         ) {
+      Member = RISCV_IOMMU_DEVICE_DOMAIN_FROM_LINK (Link);
+      if (Member->Group == Domain->Group) {
+        Member->Mode = RISCV_IOMMU_DEVICE_MODE_IDENTITY;
+      }
+    }
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+
+  DEBUG ((
+    EFI_ERROR (Status) ? DEBUG_ERROR : DEBUG_WARN,
+    "%a: device_id 0x%x outgrew its budget with %u table pages, and falls back to identity translation: %r\n",
+    __func__,
+    Domain->DeviceId.Uint32,
+    Domain->TablePages,
+    Status
+    ));
+  return Status;
+}
+
+/**
+  Block all DMA of a device that faults in a storm, without reporting its faults.
+
+  The device context stays valid, with DTF set, and translates through an empty table
+  whose PSCID no other context uses, so that every request of the device faults silently,
+  however many it sends. The context is made invalid while it is rewritten, so a walk in
+  between faults rather than reading a mix, and the IOMMU keeps using its cached copy
+  until the single invalidation of the device_id. Extended contexts lose their MSI
+  translation too.
+
+  @param[in]  IoMmu   The IOMMU.
+  @param[in]  Domain  The domain of the device.
+
+  @retval  EFI_SUCCESS           The device context blocks the device.
+  @retval  EFI_OUT_OF_RESOURCES  There is no PSCID or page for the blocking table.
+  @retval  EFI_DEVICE_ERROR      The IOMMU failed to invalidate the device context.
+
+**/
+EFI_STATUS
+IoMmuQuarantineDeviceDomain (
+  IN RISCV_IOMMU_INSTANCE       *IoMmu,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain
+  )
+{
+  RISCV_IOMMU_BASE_DEVICE_CONTEXT      *DeviceContext;
+  RISCV_IOMMU_EXTENDED_DEVICE_CONTEXT  *ExtendedContext;
+  RISCV_IOMMU_DC_TRANSLATION_CONTROL   TranslationControl;
+  RISCV_IOMMU_FCTL                     FeatureControl;
+  EFI_TPL                              OriginalTpl;
+  EFI_STATUS                           Status;
+
+  if (Domain->Quarantined || Domain->Detached) {
+    return EFI_SUCCESS;
+  }
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  if (IoMmu->BlockingRootPageTable == NULL) {
+    if (IoMmu->NextPscid > RISCV_IOMMU_MAX_PSCID) {
+      gBS->RestoreTPL (OriginalTpl);
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    IoMmu->BlockingRootPageTable = IoMmuAllocatePageTable (IoMmu);
+    if (IoMmu->BlockingRootPageTable == NULL) {
+      gBS->RestoreTPL (OriginalTpl);
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    IoMmu->BlockingPscid = IoMmu->NextPscid++;
+  }
+
+  DeviceContext                            = Domain->DeviceContext;
+  DeviceContext->TranslationControl.Uint64 = 0;
+  MemoryFence ();
+  DeviceContext->IoHgatp.Uint64                   = 0;
+  DeviceContext->IoHgatp.Bits.MODE                = V_RISCV_IOMMU_IOHGATP_MODE_BARE;
+  DeviceContext->TranslationAttributes.Uint64     = 0;
+  DeviceContext->TranslationAttributes.Bits.PSCID = IoMmu->BlockingPscid;
+  DeviceContext->FirstStageContext.Uint64         = 0;
+  DeviceContext->FirstStageContext.Bits.PPN       = ((UINT64)IoMmu->BlockingRootPageTable) >> RISCV_MMU_PAGE_SHIFT;
+  DeviceContext->FirstStageContext.Bits.MODE      = IoMmu->IoSatpMode;
+  if (IoMmu->DeviceContext.ContextStructIsExtended) {
+    ExtendedContext         = (RISCV_IOMMU_EXTENDED_DEVICE_CONTEXT *)DeviceContext;
+    ExtendedContext->MsiPtp = 0;
+  }
+
+  FeatureControl.Uint32       = IoMmu->FeatureControl;
+  TranslationControl.Uint64   = 0;
+  TranslationControl.Bits.DTF = 1;
+  TranslationControl.Bits.SBE = FeatureControl.Bits.BE;
+  TranslationControl.Bits.SXL = FeatureControl.Bits.GXL;
+  TranslationControl.Bits.V   = 1;
+
+  IoMmuQueueCacheClean (
+    IoMmu,
+    DeviceContext,
+    IoMmu->DeviceContext.ContextStructIsExtended ? sizeof (RISCV_IOMMU_EXTENDED_DEVICE_CONTEXT) : sizeof (*DeviceContext)
+    );
+  IoMmuFlushCacheCleans (IoMmu);
+  MemoryFence ();
+  DeviceContext->TranslationControl.Uint64 = TranslationControl.Uint64;
+  IoMmuQueueCacheClean (IoMmu, &DeviceContext->TranslationControl, sizeof (DeviceContext->TranslationControl));
+  MemoryFence ();
+
+  IoMmuQueueDeviceContextInvalidation (IoMmu, TRUE, Domain->DeviceId);
+  Status = IoMmuSubmitCommands (IoMmu);
+  if (!EFI_ERROR (Status)) {
+    Domain->Quarantined = TRUE;
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+  return Status;
+}
+
+/**
+  Copy the device context of a device_id, if the device directory has an entry for it.
+
+  @param[in]      IoMmu       The IOMMU.
+  @param[in]      DeviceId    The device_id.
+  @param[out]     Buffer      The device context.
+  @param[in,out]  BufferSize  On input, the size of Buffer. On output, the size of the context.
+
+  @retval  EFI_SUCCESS           The context is copied.
+  @retval  EFI_NOT_FOUND         The directory has no entry for the device_id.
+  @retval  EFI_BUFFER_TOO_SMALL  Buffer is too small. BufferSize is updated.
+
+**/
+EFI_STATUS
+IoMmuReadDeviceContext (
+  IN     RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN     UINT32                DeviceId,
+  OUT    VOID                  *Buffer,
+  IN OUT UINTN                 *BufferSize
+  )
+{
+  RISCV_IOMMU_DEVICE_ID  Id;
+  VOID                   *DeviceContext;
+  UINTN                  ContextSize;
+
+  Id.Uint32     = DeviceId;
+  DeviceContext = IoMmuLocateDeviceContext (IoMmu, Id, FALSE);
+  if (DeviceContext == NULL) {
+    return EFI_NOT_FOUND;
+  }
+
+  ContextSize = IoMmu->DeviceContext.ContextStructIsExtended ?
+                sizeof (RISCV_IOMMU_EXTENDED_DEVICE_CONTEXT) : sizeof (RISCV_IOMMU_BASE_DEVICE_CONTEXT);
+  if (*BufferSize < ContextSize) {
+    *BufferSize = ContextSize;
+    return EFI_BUFFER_TOO_SMALL;
+  }
+
+  *BufferSize = ContextSize;
+  CopyMem (Buffer, DeviceContext, ContextSize);
+  return EFI_SUCCESS;
+}
+
+/**
+  Find the translation domain of a device, or create it, at RISCV_IOMMU_TPL_LEVEL.
+
+  @param[in]   IoMmu     The IOMMU.
+  @param[in]   DeviceId  The device_id to find the domain of.
+  @param[in]   Mode      The RISCV_IOMMU_DEVICE_MODE_* of a created domain.
+  @param[in]   QosId     The QoS IDs of a created domain, as RISCV_IOMMU_QOSID.
+  @param[in]   GroupKey  The group of a created domain, as returned by IoMmuGetDeviceGroup().
+  @param[out]  Domain    The domain of the device.
+
+  @retval  EFI_SUCCESS           The domain was found or created.
+  @retval  EFI_UNSUPPORTED       The device_id cannot be translated by the IOMMU.
+  @retval  EFI_OUT_OF_RESOURCES  There were not enough resources to create the domain.
+
+**/
+STATIC
+EFI_STATUS
+FindOrCreateDeviceDomain (
+  IN  RISCV_IOMMU_INSTANCE       *IoMmu,
+  IN  RISCV_IOMMU_DEVICE_ID      DeviceId,
+  IN  UINT8                      Mode,
+  IN  UINT32                     QosId,
+  IN  UINT64                     GroupKey,
+  OUT RISCV_IOMMU_DEVICE_DOMAIN  **Domain
+  )
+{
+  RISCV_IOMMU_DEVICE_DOMAIN  *NewDomain;
+  RISCV_IOMMU_DEVICE_DOMAIN  *Group;
+  EFI_STATUS                 Status;
+
+  *Domain = IoMmuFindDeviceDomain (IoMmu, DeviceId.Uint32);
+  if ((*Domain != NULL) && (*Domain)->Detached) {
+    Status = AttachDeviceDomain (IoMmu, *Domain);
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+
+    (*Domain)->Detached = FALSE;
+  }
+
+  if (*Domain != NULL) {
+    return EFI_SUCCESS;
+  }
+
+  //
+  // This driver only builds first-stage tables with 64-bit PTEs.
+  //
+  if ((IoMmu->IoPageTableLevels == 0) && (Mode != RISCV_IOMMU_DEVICE_MODE_BYPASS)) {
+    return EFI_UNSUPPORTED;
+  }
+
+  NewDomain = AllocateZeroPool (sizeof (RISCV_IOMMU_DEVICE_DOMAIN));
+  if (NewDomain == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  NewDomain->Signature = RISCV_IOMMU_DEVICE_DOMAIN_SIGNATURE;
+  NewDomain->DeviceId  = DeviceId;
+  NewDomain->Mode      = Mode;
+  NewDomain->QosId     = QosId;
+  NewDomain->GroupKey  = GroupKey;
+  InitializeListHead (&NewDomain->DemandRanges);
+
+  NewDomain->DeviceContext = IoMmuLocateDeviceContext (IoMmu, DeviceId, TRUE);
+  if (NewDomain->DeviceContext == NULL) {
+    DEBUG ((DEBUG_ERROR, "%a: No device context for device_id 0x%x\n", __func__, DeviceId.Uint32));
+    FreePool (NewDomain);
+    return EFI_UNSUPPORTED;
+  }
+
+  if (Mode == RISCV_IOMMU_DEVICE_MODE_PERMISSIVE) {
+    Status = IoMmuGetPermissivePageTable (IoMmu, &NewDomain->RootPageTable, &NewDomain->Pscid);
+    if (EFI_ERROR (Status)) {
+      FreePool (NewDomain);
+      return Status;
+    }
+  } else if ((Mode == RISCV_IOMMU_DEVICE_MODE_STRICT) && ((Group = FindDomainGroup (IoMmu, GroupKey)) != NULL)) {
+    NewDomain->RootPageTable = Group->RootPageTable;
+    NewDomain->Pscid         = Group->Pscid;
+    NewDomain->Group         = Group;
+  } else if (Mode != RISCV_IOMMU_DEVICE_MODE_BYPASS) {
+    //
+    // A PSCID is not returned if the domain fails to be created, as the 20-bit space outlasts any topology.
+    //
+    if (IoMmu->NextPscid > RISCV_IOMMU_MAX_PSCID) {
+      DEBUG ((DEBUG_ERROR, "%a: No PSCID left for device_id 0x%x\n", __func__, DeviceId.Uint32));
+      FreePool (NewDomain);
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    NewDomain->RootPageTable = IoMmuAllocatePageTable (IoMmu);
+    if (NewDomain->RootPageTable == NULL) {
+      FreePool (NewDomain);
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    NewDomain->Pscid = IoMmu->NextPscid++;
+  }
+
+  Status = AttachDeviceDomain (IoMmu, NewDomain);
+  if (EFI_ERROR (Status)) {
+    if ((NewDomain->RootPageTable != NULL) && (Mode != RISCV_IOMMU_DEVICE_MODE_PERMISSIVE) && (NewDomain->Group == NULL)) {
+      IoMmuFreePageTable (IoMmu, NewDomain->RootPageTable);
+    }
+
+    FreePool (NewDomain);
+    return Status;
+  }
+
+  if (NewDomain->Group != NULL) {
+    NewDomain->Group->Group = NewDomain->Group;
+    DEBUG ((
+      RISCV_IOMMU_DEBUG_LEVEL,
+      "%a: device_id 0x%x shares the page table of device_id 0x%x\n",
+      __func__,
+      DeviceId.Uint32,
+      NewDomain->Group->DeviceId.Uint32
+      ));
+  }
+
+  InsertTailList (&IoMmu->DomainList, &NewDomain->Link);
+  IoMmuChargeFootprint (RiscVIoMmuFootprintDomain, sizeof (RISCV_IOMMU_DEVICE_DOMAIN));
+
+  DEBUG ((
+    RISCV_IOMMU_DEBUG_LEVEL,
+    "%a: device_id 0x%x translates in mode %u through the page table at 0x%lx\n",
+    __func__,
+    DeviceId.Uint32,
+    Mode,
+    NewDomain->RootPageTable
+    ));
+
+  *Domain = NewDomain;
+  return EFI_SUCCESS;
+}
+
+/**
+  Find the translation domain of a device, creating it and programming
+  its device context on first use, or once it is attached again after a hot-removal.
+
+  @param[in]   IoMmu     The IOMMU.
+  @param[in]   DeviceId  The device_id to find the domain of.
+  @param[in]   Mode      The RISCV_IOMMU_DEVICE_MODE_* of a created domain.
+  @param[in]   QosId     The QoS IDs of a created domain, as RISCV_IOMMU_QOSID.
+  @param[in]   GroupKey  The group of a created domain, as returned by IoMmuGetDeviceGroup().
+  @param[out]  Domain    The domain of the device.
+
+  @retval  EFI_SUCCESS           The domain was found or created.
+  @retval  EFI_UNSUPPORTED       The device_id cannot be translated by the IOMMU.
+  @retval  EFI_OUT_OF_RESOURCES  There were not enough resources to create the domain.
+
+**/
+EFI_STATUS
+IoMmuGetDeviceDomain (
+  IN  RISCV_IOMMU_INSTANCE       *IoMmu,
+  IN  RISCV_IOMMU_DEVICE_ID      DeviceId,
+  IN  UINT8                      Mode,
+  IN  UINT32                     QosId,
+  IN  UINT64                     GroupKey,
+  OUT RISCV_IOMMU_DEVICE_DOMAIN  **Domain
+  )
+{
+  EFI_TPL     OriginalTpl;
+  EFI_STATUS  Status;
+
+  //
+  // A completion at a higher TPL may resolve the same device while a domain is being
+  // created for it, and the fault timer walks the list. Creation only happens once per
+  // device, mostly when enumeration completes, so it is serialised whole.
+  //
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  Status      = FindOrCreateDeviceDomain (IoMmu, DeviceId, Mode, QosId, GroupKey, Domain);
+  gBS->RestoreTPL (OriginalTpl);
+  return Status;
+}
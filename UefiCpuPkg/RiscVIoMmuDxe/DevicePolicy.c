@@ -0,0 +1,249 @@
+/** @file
+  RISC-V IOMMU per-device translation policy.
+
+  Trusted devices, such as the boot disk, may be identity-mapped or bypass
+  translation, so their DMA costs no page-table updates or invalidations.
+  Every other device stays in strict translation.
+
+  With QoS IDs, the DMA of each device class can also be tagged with the
+  RCID and MCID that the platform's bandwidth and cache controllers
+  partition resources by.
+
+  Functions that can reach each other's memory without the IOMMU seeing it
+  are grouped, so that their strict domains share one page table: the
+  functions of a multi-function device without ACS isolation, and the ranges
+  of RIDs that the platform lists, such as the VFs of an SR-IOV device.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/PcdLib.h>
+#include <IndustryStandard/Pci.h>
+#include <IndustryStandard/PciExpress21.h>
+#include "RiscVIoMmu.h"
+
+#define DEVICE_POLICY_ANY_DEVICE_ID  0xFFFF
+#define DEVICE_POLICY_ANY_SUB_CLASS  0xFF
+
+//
+// The ACS Control register, at offset 6 of the capability, and the controls that isolate the
+// functions of a multi-function device from each other: source validation, P2P request and
+// completion redirect, and upstream forwarding.
+//
+#define ACS_CONTROL_OFFSET     6
+#define ACS_CONTROL_ISOLATION  (BIT0 | BIT2 | BIT3 | BIT4)
+
+//
+// Group keys of the ranges of PcdRiscVIoMmuDeviceGroups, and of multi-function devices.
+//
+#define DEVICE_GROUP_PLATFORM  BIT33
+#define DEVICE_GROUP_TOPOLOGY  BIT32
+
+//
+// The layout of an entry of PcdRiscVIoMmuDeviceModes.
+//
+#pragma pack(1)
+typedef struct {
+  UINT16    VendorId;
+  UINT16    DeviceId;
+  UINT8     Mode;
+  UINT8     Reserved[3];
+} DEVICE_POLICY_ENTRY;
+
+//
+// The layout of an entry of PcdRiscVIoMmuDeviceQosIds.
+//
+typedef struct {
+  UINT8     BaseClass;
+  UINT8     SubClass;
+  UINT16    Rcid;
+  UINT16    Mcid;
+  UINT8     Reserved[2];
+} DEVICE_QOS_ENTRY;
+
+//
+// The layout of an entry of PcdRiscVIoMmuDeviceGroups.
+//
+typedef struct {
+  UINT16    PciSegment;
+  UINT16    RequesterIdBase;
+  UINT16    NumberOfIds;
+  UINT8     Reserved[2];
+} DEVICE_GROUP_ENTRY;
+#pragma pack()
+
+/**
+  Determine the translation mode of a PCI function, from PcdRiscVIoMmuDeviceModes
+  and PcdRiscVIoMmuDefaultDeviceMode.
+
+  A platform device, without a PCI I/O instance, takes the default mode.
+
+  @param[in]  PciIo  The PCI I/O instance of the function, or NULL for a platform device.
+
+  @return  The RISCV_IOMMU_DEVICE_MODE_* of the function.
+
+**/
+UINT8
+IoMmuGetDeviceMode (
+  IN EFI_PCI_IO_PROTOCOL  *PciIo OPTIONAL
+  )
+{
+  CONST DEVICE_POLICY_ENTRY  *Policy;
+  UINTN                      NumberOfEntries;
+  UINTN                      Index;
+  UINT16                     Ids[2];
+  UINT8                      Mode;
+  EFI_STATUS                 Status;
+
+  Mode            = PcdGet8 (PcdRiscVIoMmuDefaultDeviceMode);
+  Policy          = PcdGetPtr (PcdRiscVIoMmuDeviceModes);
+  NumberOfEntries = PcdGetSize (PcdRiscVIoMmuDeviceModes) / sizeof (DEVICE_POLICY_ENTRY);
+  if ((NumberOfEntries != 0) && (PciIo != NULL)) {
+    Status = PciIo->Pci.Read (PciIo, EfiPciIoWidthUint16, PCI_VENDOR_ID_OFFSET, ARRAY_SIZE (Ids), Ids);
+    if (EFI_ERROR (Status)) {
+      return RISCV_IOMMU_DEVICE_MODE_STRICT;
+    }
+
+    for (Index = 0; Index < NumberOfEntries; Index++) {
+      if ((ReadUnaligned16 (&Policy[Index].VendorId) == Ids[0]) &&
+          ((ReadUnaligned16 (&Policy[Index].DeviceId) == Ids[1]) ||
+           (ReadUnaligned16 (&Policy[Index].DeviceId) == DEVICE_POLICY_ANY_DEVICE_ID)))
+      {
+        Mode = Policy[Index].Mode;
+        break;
+      }
+    }
+  }
+
+  if (Mode > RISCV_IOMMU_DEVICE_MODE_CPU_MIRROR) {
+    DEBUG ((DEBUG_WARN, "%a: Unknown device mode %u, translating strictly\n", __func__, Mode));
+    return RISCV_IOMMU_DEVICE_MODE_STRICT;
+  }
+
+  return Mode;
+}
+
+/**
+  Determine the QoS IDs that tag the DMA of a PCI function, from the class code
+  entries of PcdRiscVIoMmuDeviceQosIds.
+
+  @param[in]  PciIo  The PCI I/O instance of the function, or NULL for a platform device.
+
+  @return  The RCID and MCID of the function, as RISCV_IOMMU_QOSID. 0 if no entry matches,
+           or for a platform device.
+
+**/
+UINT32
+IoMmuGetDeviceQosId (
+  IN EFI_PCI_IO_PROTOCOL  *PciIo OPTIONAL
+  )
+{
+  CONST DEVICE_QOS_ENTRY  *Policy;
+  UINTN                   NumberOfEntries;
+  UINTN                   Index;
+  UINT8                   ClassCode[3];
+  RISCV_IOMMU_QOSID       QosId;
+  EFI_STATUS              Status;
+
+  Policy          = PcdGetPtr (PcdRiscVIoMmuDeviceQosIds);
+  NumberOfEntries = PcdGetSize (PcdRiscVIoMmuDeviceQosIds) / sizeof (DEVICE_QOS_ENTRY);
+  if ((NumberOfEntries == 0) || (PciIo == NULL)) {
+    return 0;
+  }
+
+  Status = PciIo->Pci.Read (PciIo, EfiPciIoWidthUint8, PCI_CLASSCODE_OFFSET, ARRAY_SIZE (ClassCode), ClassCode);
+  if (EFI_ERROR (Status)) {
+    return 0;
+  }
+
+  QosId.Uint32 = 0;
+  for (Index = 0; Index < NumberOfEntries; Index++) {
+    if ((Policy[Index].BaseClass == ClassCode[2]) &&
+        ((Policy[Index].SubClass == ClassCode[1]) || (Policy[Index].SubClass == DEVICE_POLICY_ANY_SUB_CLASS)))
+    {
+      QosId.Bits.RCID = ReadUnaligned16 (&Policy[Index].Rcid);
+      QosId.Bits.MCID = ReadUnaligned16 (&Policy[Index].Mcid);
+      break;
+    }
+  }
+
+  return QosId.Uint32;
+}
+
+/**
+  Determine the group of PCI functions that a function's domain shares its page table with,
+  from PcdRiscVIoMmuDeviceGroups, or else, with PcdRiscVIoMmuGroupByTopology, from
+  whether the functions of its multi-function device are isolated by ACS.
+
+  @param[in]  PciIo     The PCI I/O instance of the function, or NULL for a platform device.
+  @param[in]  Segment   The PCI segment of the function.
+  @param[in]  Bus       The bus number of the function.
+  @param[in]  Device    The device number of the function.
+  @param[in]  Function  The function number of the function.
+
+  @return  A key that is equal for the functions of a group, or 0 if the function isn't grouped.
+
+**/
+UINT64
+IoMmuGetDeviceGroup (
+  IN EFI_PCI_IO_PROTOCOL  *PciIo OPTIONAL,
+  IN UINTN                Segment,
+  IN UINTN                Bus,
+  IN UINTN                Device,
+  IN UINTN                Function
+  )
+{
+  CONST DEVICE_GROUP_ENTRY  *Policy;
+  UINTN                     NumberOfEntries;
+  UINTN                     Index;
+  UINT16                    RequesterId;
+  UINT16                    Base;
+  UINT8                     HeaderType;
+  UINT16                    CapabilityOffset;
+  UINT16                    AcsControl;
+  EFI_STATUS                Status;
+
+  if (PciIo == NULL) {
+    return 0;
+  }
+
+  RequesterId     = (UINT16)((Bus << 8) | (Device << 3) | Function);
+  Policy          = PcdGetPtr (PcdRiscVIoMmuDeviceGroups);
+  NumberOfEntries = PcdGetSize (PcdRiscVIoMmuDeviceGroups) / sizeof (DEVICE_GROUP_ENTRY);
+  for (Index = 0; Index < NumberOfEntries; Index++) {
+    Base = ReadUnaligned16 (&Policy[Index].RequesterIdBase);
+    if ((ReadUnaligned16 (&Policy[Index].PciSegment) == Segment) &&
+        (RequesterId >= Base) && (RequesterId - Base < ReadUnaligned16 (&Policy[Index].NumberOfIds)))
+    {
+      return DEVICE_GROUP_PLATFORM | LShiftU64 (Segment, 16) | Base;
+    }
+  }
+
+  if (!PcdGetBool (PcdRiscVIoMmuGroupByTopology)) {
+    return 0;
+  }
+
+  Status = PciIo->Pci.Read (PciIo, EfiPciIoWidthUint8, PCI_HEADER_TYPE_OFFSET, 1, &HeaderType);
+  if (EFI_ERROR (Status) || ((HeaderType & HEADER_TYPE_MULTI_FUNCTION) == 0)) {
+    return 0;
+  }
+
+  //
+  // Functions that all redirect their peer requests upstream can only reach each other through
+  // the IOMMU. A function without ACS is grouped with the whole device.
+  //
+  CapabilityOffset = IoMmuFindExtendedCapability (PciIo, PCI_EXPRESS_EXTENDED_CAPABILITY_ACS_EXTENDED_ID);
+  if (CapabilityOffset != 0) {
+    Status = PciIo->Pci.Read (PciIo, EfiPciIoWidthUint16, CapabilityOffset + ACS_CONTROL_OFFSET, 1, &AcsControl);
+    if (!EFI_ERROR (Status) && ((AcsControl & ACS_CONTROL_ISOLATION) == ACS_CONTROL_ISOLATION)) {
+      return 0;
+    }
+  }
+
+  return DEVICE_GROUP_TOPOLOGY | LShiftU64 (Segment, 16) | (RequesterId & ~(UINT16)0x7);
+}
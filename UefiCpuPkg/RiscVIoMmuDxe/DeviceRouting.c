@@ -0,0 +1,376 @@
+/** @file
+  RISC-V IOMMU device routing.
+
+  Each IOMMU translates the DMA of the devices routed to it, such as those
+  of one PCIe root complex. Discovery records the ranges of source IDs that
+  the firmware tables map to each IOMMU; once discovery completes, they are
+  sorted into an interval index. A device request is then dispatched with a
+  binary search to the owning IOMMU, and its source ID is translated into
+  the device_id the IOMMU knows it by.
+
+  Platform devices carry no location of their own, so discovery also records
+  the MMIO base of each devicetree node that names an IOMMU. The base is what
+  their device paths identify them by, and resolves to the node's routing domain.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include "RiscVIoMmu.h"
+
+#define ROUTE_TABLE_INITIAL_SIZE  8
+
+//
+// A range of source IDs in a routing domain, and the IOMMU and device_ids they map to.
+//
+typedef struct {
+  UINT32                  Domain;
+  UINT32                  SourceIdBase;
+  UINT32                  NumberOfIds;
+  UINT32                  DeviceIdBase;
+  // Applied to a source ID before the lookup. The same for every route of a domain.
+  UINT32                  SourceIdMask;
+  // The RISCV_IOMMU_ROUTE_* attributes of the devices' path to the IOMMU.
+  UINT32                  Flags;
+  RISCV_IOMMU_INSTANCE    *IoMmu;
+} DEVICE_ROUTE;
+
+STATIC DEVICE_ROUTE  *mRoutes        = NULL;
+STATIC UINTN         mNumberOfRoutes = 0;
+STATIC UINTN         mRouteTableSize = 0;
+STATIC BOOLEAN       mRoutesSorted   = TRUE;
+
+//
+// A platform device, by the MMIO base its device path identifies it by.
+//
+typedef struct {
+  UINT64    BaseAddress;
+  UINT32    Domain;
+} PLATFORM_DEVICE;
+
+STATIC PLATFORM_DEVICE  *mPlatformDevices        = NULL;
+STATIC UINTN            mNumberOfPlatformDevices = 0;
+STATIC UINTN            mPlatformDeviceTableSize = 0;
+
+/**
+  Record that a range of source IDs is mapped to an IOMMU.
+
+  @param[in]  IoMmu         The IOMMU.
+  @param[in]  Domain        The routing domain of the source IDs, from RISCV_IOMMU_PCI_ROUTING_DOMAIN()
+                            or RISCV_IOMMU_PLATFORM_ROUTING_DOMAIN().
+  @param[in]  SourceIdBase  The first source ID of the range.
+  @param[in]  NumberOfIds   The number of source IDs in the range.
+  @param[in]  DeviceIdBase  The device_id that SourceIdBase maps to.
+  @param[in]  SourceIdMask  The mask applied to source IDs of the domain before they are
+                            looked up, such as from `iommu-map-mask`, or MAX_UINT32.
+  @param[in]  Flags         The RISCV_IOMMU_ROUTE_* attributes of the range.
+
+  @retval  EFI_SUCCESS           The range was recorded.
+  @retval  EFI_OUT_OF_RESOURCES  The route table could not be grown.
+
+**/
+EFI_STATUS
+IoMmuAddRoute (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT32                Domain,
+  IN UINT32                SourceIdBase,
+  IN UINT32                NumberOfIds,
+  IN UINT32                DeviceIdBase,
+  IN UINT32                SourceIdMask,
+  IN UINT32                Flags
+  )
+{
+  DEVICE_ROUTE  *NewRoutes;
+  UINTN         NewSize;
+
+  if (NumberOfIds == 0) {
+    return EFI_SUCCESS;
+  }
+
+  if (mNumberOfRoutes == mRouteTableSize) {
+    NewSize   = MAX (ROUTE_TABLE_INITIAL_SIZE, mRouteTableSize * 2);
+    NewRoutes = ReallocatePool (
+                  mRouteTableSize * sizeof (DEVICE_ROUTE),
+                  NewSize * sizeof (DEVICE_ROUTE),
+                  mRoutes
+                  );
+    if (NewRoutes == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    mRoutes         = NewRoutes;
+    mRouteTableSize = NewSize;
+  }
+
+  mRoutes[mNumberOfRoutes].Domain       = Domain;
+  mRoutes[mNumberOfRoutes].SourceIdBase = SourceIdBase;
+  mRoutes[mNumberOfRoutes].NumberOfIds  = NumberOfIds;
+  mRoutes[mNumberOfRoutes].DeviceIdBase = DeviceIdBase;
+  mRoutes[mNumberOfRoutes].SourceIdMask = SourceIdMask;
+  mRoutes[mNumberOfRoutes].Flags        = Flags;
+  mRoutes[mNumberOfRoutes].IoMmu        = IoMmu;
+  mNumberOfRoutes++;
+  mRoutesSorted = FALSE;
+
+  DEBUG ((
+    RISCV_IOMMU_DEBUG_LEVEL,
+    "%a: IDs 0x%x-0x%x of domain 0x%x map to device_id 0x%x of the IOMMU at 0x%lx\n",
+    __func__,
+    SourceIdBase,
+    SourceIdBase + NumberOfIds - 1,
+    Domain,
+    DeviceIdBase,
+    IoMmu->Address
+    ));
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Order two routes by their routing domain, then their first source ID.
+
+  @param[in]  Buffer1  The first route.
+  @param[in]  Buffer2  The second route.
+
+  @retval  0   The routes start at the same source ID.
+  @return  <0  The first route starts before the second.
+  @return  >0  The first route starts after the second.
+
+**/
+STATIC
+INTN
+EFIAPI
+CompareRoutes (
+  IN CONST VOID  *Buffer1,
+  IN CONST VOID  *Buffer2
+  )
+{
+  CONST DEVICE_ROUTE  *Route1;
+  CONST DEVICE_ROUTE  *Route2;
+
+  Route1 = Buffer1;
+  Route2 = Buffer2;
+  if (Route1->Domain != Route2->Domain) {
+    return (Route1->Domain < Route2->Domain) ? -1 : 1;
+  }
+
+  if (Route1->SourceIdBase != Route2->SourceIdBase) {
+    return (Route1->SourceIdBase < Route2->SourceIdBase) ? -1 : 1;
+  }
+
+  return 0;
+}
+
+/**
+  Sort the recorded routes into the interval index, once discovery completes.
+
+  Overlapping ranges are reported, and the later-starting range takes precedence.
+
+**/
+VOID
+IoMmuBuildRouteIndex (
+  VOID
+  )
+{
+  DEVICE_ROUTE  Scratch;
+  UINTN         Index;
+
+  if (mRoutesSorted) {
+    return;
+  }
+
+  QuickSort (mRoutes, mNumberOfRoutes, sizeof (DEVICE_ROUTE), CompareRoutes, &Scratch);
+  mRoutesSorted = TRUE;
+
+  for (Index = 1; Index < mNumberOfRoutes; Index++) {
+    if ((mRoutes[Index].Domain == mRoutes[Index - 1].Domain) &&
+        (mRoutes[Index].SourceIdBase - mRoutes[Index - 1].SourceIdBase < mRoutes[Index - 1].NumberOfIds))
+    {
+      DEBUG ((
+        DEBUG_WARN,
+        "%a: IDs from 0x%x of domain 0x%x are mapped more than once\n",
+        __func__,
+        mRoutes[Index].SourceIdBase,
+        mRoutes[Index].Domain
+        ));
+    }
+  }
+}
+
+/**
+  Find the IOMMU that a device is routed to, and the device_id it is known by.
+
+  Without any routes, as on platforms with a single IOMMU, that IOMMU owns
+  every PCI function, by the device_id formed from its segment and RID.
+
+  @param[in]   Domain    The routing domain of the device.
+  @param[in]   SourceId  The source ID of the device, such as a PCI RID.
+  @param[out]  DeviceId  The device_id of the device at the IOMMU.
+  @param[out]  Flags     The RISCV_IOMMU_ROUTE_* attributes of the route, if not NULL.
+
+  @return  The IOMMU, or NULL if the device isn't routed to any IOMMU.
+
+**/
+RISCV_IOMMU_INSTANCE *
+IoMmuRouteDevice (
+  IN  UINT32                 Domain,
+  IN  UINT32                 SourceId,
+  OUT RISCV_IOMMU_DEVICE_ID  *DeviceId,
+  OUT UINT32                 *Flags OPTIONAL
+  )
+{
+  UINTN         Low;
+  UINTN         High;
+  UINTN         Middle;
+  UINTN         First;
+  DEVICE_ROUTE  *Route;
+
+  if (mNumberOfRoutes == 0) {
+    if ((mRiscVIoMmuGlobalDriverContext.NumberOfInstances != 1) ||
+        (Domain > RISCV_IOMMU_PCI_ROUTING_DOMAIN (MAX_UINT8)) ||
+        (SourceId > MAX_UINT16))
+    {
+      return NULL;
+    }
+
+    //
+    // Without firmware tables, nothing is known about the root complex.
+    //
+    if (Flags != NULL) {
+      *Flags = 0;
+    }
+
+    DeviceId->Uint32 = (Domain << 16) | SourceId;
+    return RISCV_IOMMU_INSTANCE_FROM_LINK (GetFirstNode (&mRiscVIoMmuGlobalDriverContext.InstanceList));
+  }
+
+  ASSERT (mRoutesSorted);
+
+  //
+  // Find the first route of the domain, whose mask applies to the source ID.
+  //
+  Low  = 0;
+  High = mNumberOfRoutes;
+  while (Low < High) {
+    Middle = Low + (High - Low) / 2;
+    if (mRoutes[Middle].Domain < Domain) {
+      Low = Middle + 1;
+    } else {
+      High = Middle;
+    }
+  }
+
+  if ((Low == mNumberOfRoutes) || (mRoutes[Low].Domain != Domain)) {
+    return NULL;
+  }
+
+  SourceId &= mRoutes[Low].SourceIdMask;
+
+  //
+  // Find the last route of the domain that starts at or before the source ID.
+  //
+  First = Low;
+  High  = mNumberOfRoutes;
+  while (Low < High) {
+    Middle = Low + (High - Low) / 2;
+    if ((mRoutes[Middle].Domain == Domain) && (mRoutes[Middle].SourceIdBase <= SourceId)) {
+      Low = Middle + 1;
+    } else {
+      High = Middle;
+    }
+  }
+
+  if (Low == First) {
+    return NULL;
+  }
+
+  Route = &mRoutes[Low - 1];
+  if (SourceId - Route->SourceIdBase >= Route->NumberOfIds) {
+    return NULL;
+  }
+
+  if (Flags != NULL) {
+    *Flags = Route->Flags;
+  }
+
+  DeviceId->Uint32 = Route->DeviceIdBase + (SourceId - Route->SourceIdBase);
+  return Route->IoMmu;
+}
+
+/**
+  Record the routing domain of a platform device, by its MMIO base.
+
+  @param[in]  BaseAddress  The base of the first MMIO region of the device.
+  @param[in]  Domain       The routing domain of the device, from RISCV_IOMMU_PLATFORM_ROUTING_DOMAIN().
+
+  @retval  EFI_SUCCESS           The device was recorded.
+  @retval  EFI_OUT_OF_RESOURCES  The platform device table could not be grown.
+
+**/
+EFI_STATUS
+IoMmuAddPlatformDevice (
+  IN UINT64  BaseAddress,
+  IN UINT32  Domain
+  )
+{
+  PLATFORM_DEVICE  *NewDevices;
+  UINTN            NewSize;
+
+  if (mNumberOfPlatformDevices == mPlatformDeviceTableSize) {
+    NewSize    = MAX (ROUTE_TABLE_INITIAL_SIZE, mPlatformDeviceTableSize * 2);
+    NewDevices = ReallocatePool (
+                   mPlatformDeviceTableSize * sizeof (PLATFORM_DEVICE),
+                   NewSize * sizeof (PLATFORM_DEVICE),
+                   mPlatformDevices
+                   );
+    if (NewDevices == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    mPlatformDevices         = NewDevices;
+    mPlatformDeviceTableSize = NewSize;
+  }
+
+  mPlatformDevices[mNumberOfPlatformDevices].BaseAddress = BaseAddress;
+  mPlatformDevices[mNumberOfPlatformDevices].Domain      = Domain;
+  mNumberOfPlatformDevices++;
+
+  DEBUG ((RISCV_IOMMU_DEBUG_LEVEL, "%a: The platform device at 0x%lx is in domain 0x%x\n", __func__, BaseAddress, Domain));
+  return EFI_SUCCESS;
+}
+
+/**
+  Find the routing domain of a platform device, by its MMIO base.
+
+  Platform devices are few, and are resolved once each, so the table is searched linearly.
+
+  @param[in]   BaseAddress  The base of the first MMIO region of the device.
+  @param[out]  Domain       The routing domain of the device.
+
+  @retval  TRUE   The device is known, and Domain is set.
+  @retval  FALSE  No devicetree node with an IOMMU has this base.
+
+**/
+BOOLEAN
+IoMmuFindPlatformDevice (
+  IN  UINT64  BaseAddress,
+  OUT UINT32  *Domain
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < mNumberOfPlatformDevices; Index++) {
+    if (mPlatformDevices[Index].BaseAddress == BaseAddress) {
+      *Domain = mPlatformDevices[Index].Domain;
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
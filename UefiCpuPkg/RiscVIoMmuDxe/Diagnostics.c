@@ -0,0 +1,489 @@
+/** @file
+  RISC-V IOMMU diagnostics.
+
+  RISCV_IOMMU_DIAGNOSTICS_PROTOCOL reports the state of the driver and its
+  IOMMUs to shell tools, such as the `iommu` command, so that it needn't be
+  traced with DEBUG messages. Every service only reads state.
+
+  How each device's buffers were mapped is counted here too: the maps, the bytes
+  bounced for each reason, the sizes, and the latencies of Map() and Unmap().
+  The register accesses of each operation are counted by MmioAccounting.c.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/PcdLib.h>
+#include <Library/TimerLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Protocol/RiscVIoMmuDiagnostics.h>
+#include "RiscVIoMmu.h"
+
+STATIC
+EFI_STATUS
+EFIAPI
+DiagnosticsGetDriverStatistics (
+  IN  RISCV_IOMMU_DIAGNOSTICS_PROTOCOL  *This,
+  OUT RISCV_IOMMU_DRIVER_STATISTICS     *Statistics
+  );
+
+STATIC
+EFI_STATUS
+EFIAPI
+DiagnosticsGetInstanceStatistics (
+  IN  RISCV_IOMMU_DIAGNOSTICS_PROTOCOL  *This,
+  IN  UINTN                             IoMmuIndex,
+  OUT RISCV_IOMMU_INSTANCE_STATISTICS   *Statistics
+  );
+
+STATIC
+EFI_STATUS
+EFIAPI
+DiagnosticsGetDeviceContext (
+  IN     RISCV_IOMMU_DIAGNOSTICS_PROTOCOL  *This,
+  IN     UINTN                             IoMmuIndex,
+  IN     UINT32                            DeviceId,
+  OUT    VOID                              *Buffer,
+  IN OUT UINTN                             *BufferSize
+  );
+
+STATIC
+EFI_STATUS
+EFIAPI
+DiagnosticsWalkPageTable (
+  IN  RISCV_IOMMU_DIAGNOSTICS_PROTOCOL  *This,
+  IN  UINTN                             IoMmuIndex,
+  IN  UINT32                            DeviceId,
+  IN  UINT64                            IoVirtualAddress,
+  OUT UINT64                            Entries[RISCV_IOMMU_DIAGNOSTICS_MAX_LEVELS],
+  OUT UINTN                             *NumberOfEntries
+  );
+
+STATIC
+EFI_STATUS
+EFIAPI
+DiagnosticsGetDeviceStatistics (
+  IN  RISCV_IOMMU_DIAGNOSTICS_PROTOCOL  *This,
+  IN  UINTN                             IoMmuIndex,
+  IN  UINTN                             DomainIndex,
+  OUT RISCV_IOMMU_DEVICE_STATISTICS     *Statistics
+  );
+
+STATIC
+EFI_STATUS
+EFIAPI
+DiagnosticsGetMmioStatistics (
+  IN  RISCV_IOMMU_DIAGNOSTICS_PROTOCOL  *This,
+  IN  RISCV_IOMMU_MMIO_OPERATION        Operation,
+  OUT RISCV_IOMMU_MMIO_STATISTICS       *Statistics
+  );
+
+RISCV_IOMMU_DIAGNOSTICS_PROTOCOL  mRiscVIoMmuDiagnosticsProtocol = {
+  RISCV_IOMMU_DIAGNOSTICS_PROTOCOL_REVISION,
+  DiagnosticsGetDriverStatistics,
+  DiagnosticsGetInstanceStatistics,
+  DiagnosticsGetDeviceContext,
+  DiagnosticsWalkPageTable,
+  DiagnosticsGetDeviceStatistics,
+  DiagnosticsGetMmioStatistics,
+};
+
+/**
+  Report the depth of a queue, from its head and tail registers.
+
+  @param[in]   IoMmu       The IOMMU.
+  @param[in]   Queue       The queue.
+  @param[in]   HeadOffset  The offset of its head register.
+  @param[in]   TailOffset  The offset of its tail register.
+  @param[out]  Statistics  The state of the queue.
+
+**/
+STATIC
+VOID
+GetQueueStatistics (
+  IN  RISCV_IOMMU_INSTANCE          *IoMmu,
+  IN  QUEUE_WRAPPER                 *Queue,
+  IN  UINTN                         HeadOffset,
+  IN  UINTN                         TailOffset,
+  OUT RISCV_IOMMU_QUEUE_STATISTICS  *Statistics
+  )
+{
+  if (Queue->Buffer == NULL) {
+    Statistics->NumberOfEntries = 0;
+    Statistics->Head            = 0;
+    Statistics->Tail            = 0;
+    return;
+  }
+
+  Statistics->NumberOfEntries = Queue->Mask + 1;
+  Statistics->Head            = IoMmuRead32 (IoMmu, HeadOffset) & Queue->Mask;
+  Statistics->Tail            = IoMmuRead32 (IoMmu, TailOffset) & Queue->Mask;
+}
+
+/**
+  Report the state shared by all IOMMUs.
+
+  @param[in]   This        The protocol instance.
+  @param[out]  Statistics  The state.
+
+  @retval  EFI_SUCCESS            Statistics is filled in.
+  @retval  EFI_INVALID_PARAMETER  Statistics is NULL.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+DiagnosticsGetDriverStatistics (
+  IN  RISCV_IOMMU_DIAGNOSTICS_PROTOCOL  *This,
+  OUT RISCV_IOMMU_DRIVER_STATISTICS     *Statistics
+  )
+{
+  if (Statistics == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Statistics->NumberOfIoMmus = 0;
+  while (IoMmuGetInstance (Statistics->NumberOfIoMmus) != NULL) {
+    Statistics->NumberOfIoMmus++;
+  }
+
+  Statistics->LiveMappings = IoMmuGetNumberOfMappings ();
+  IoMmuGetBouncePoolUsage (&Statistics->BouncePoolPages, &Statistics->BouncePoolFreePages);
+  IoMmuGetTablePagePoolUsage (
+    &Statistics->TablePoolPages,
+    &Statistics->TablePoolPagesInUse,
+    &Statistics->TablePoolHighWater
+    );
+
+  Statistics->LazyInvalidation  = PcdGetBool (PcdRiscVIoMmuLazyInvalidation);
+  Statistics->DefaultDeviceMode = PcdGet8 (PcdRiscVIoMmuDefaultDeviceMode);
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Report the state of an IOMMU.
+
+  @param[in]   This        The protocol instance.
+  @param[in]   IoMmuIndex  The index of the IOMMU, from 0.
+  @param[out]  Statistics  The state.
+
+  @retval  EFI_SUCCESS            Statistics is filled in.
+  @retval  EFI_INVALID_PARAMETER  Statistics is NULL.
+  @retval  EFI_NOT_FOUND          There are no more IOMMUs.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+DiagnosticsGetInstanceStatistics (
+  IN  RISCV_IOMMU_DIAGNOSTICS_PROTOCOL  *This,
+  IN  UINTN                             IoMmuIndex,
+  OUT RISCV_IOMMU_INSTANCE_STATISTICS   *Statistics
+  )
+{
+  RISCV_IOMMU_INSTANCE  *IoMmu;
+  LIST_ENTRY            *Link;
+  UINTN                 Cause;
+  EFI_TPL               OriginalTpl;
+
+  if (Statistics == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  IoMmu = IoMmuGetInstance (IoMmuIndex);
+  if (IoMmu == NULL) {
+    return EFI_NOT_FOUND;
+  }
+
+  Statistics->Address               = IoMmu->Address;
+  Statistics->IsPciDevice           = IoMmu->IoMmuIsPciDevice;
+  Statistics->DeviceDirectoryLevels = IoMmu->DeviceContext.Levels;
+  Statistics->PageTableLevels       = IoMmu->IoPageTableLevels;
+  Statistics->DeviceDirectoryPages  = IoMmu->DeviceContext.NumberOfPages;
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+
+  Statistics->NumberOfDomains = 0;
+  for (Link = GetFirstNode (&IoMmu->DomainList)
+       ; !IsNull (&IoMmu->DomainList, Link)
+       ; Link = GetNextNode (&IoMmu->DomainList, Link)
+       ) {
+    Statistics->NumberOfDomains++;
+  }
+
+  GetQueueStatistics (IoMmu, &IoMmu->CommandQueue, R_RISCV_IOMMU_CQH, R_RISCV_IOMMU_CQT, &Statistics->CommandQueue);
+  GetQueueStatistics (IoMmu, &IoMmu->FaultQueue, R_RISCV_IOMMU_FQH, R_RISCV_IOMMU_FQT, &Statistics->FaultQueue);
+  GetQueueStatistics (IoMmu, &IoMmu->PageRequestQueue, R_RISCV_IOMMU_PQH, R_RISCV_IOMMU_PQT, &Statistics->PageRequestQueue);
+
+  Statistics->Faults = 0;
+  for (Cause = 0; Cause < RISCV_IOMMU_FAULT_CAUSE_SLOTS; Cause++) {
+    Statistics->Faults += IoMmu->FaultCounts[Cause];
+  }
+
+  Statistics->UnknownDeviceFaults = IoMmu->UnknownDeviceFaults;
+
+  gBS->RestoreTPL (OriginalTpl);
+  return EFI_SUCCESS;
+}
+
+/**
+  Copy the device context of a device_id from the device-directory table.
+
+  @param[in]      This        The protocol instance.
+  @param[in]      IoMmuIndex  The index of the IOMMU, from 0.
+  @param[in]      DeviceId    The device_id.
+  @param[out]     Buffer      The device context, in its in-memory format.
+  @param[in,out]  BufferSize  On input, the size of Buffer. On output, the size of the context.
+
+  @retval  EFI_SUCCESS            The device context is copied.
+  @retval  EFI_INVALID_PARAMETER  BufferSize is NULL, or Buffer is NULL while BufferSize isn't 0.
+  @retval  EFI_NOT_FOUND          There is no such IOMMU, or the directory has no entry for the device_id.
+  @retval  EFI_BUFFER_TOO_SMALL   Buffer is too small. BufferSize is updated.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+DiagnosticsGetDeviceContext (
+  IN     RISCV_IOMMU_DIAGNOSTICS_PROTOCOL  *This,
+  IN     UINTN                             IoMmuIndex,
+  IN     UINT32                            DeviceId,
+  OUT    VOID                              *Buffer,
+  IN OUT UINTN                             *BufferSize
+  )
+{
+  RISCV_IOMMU_INSTANCE  *IoMmu;
+  EFI_TPL               OriginalTpl;
+  EFI_STATUS            Status;
+
+  if ((BufferSize == NULL) || ((Buffer == NULL) && (*BufferSize != 0))) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  IoMmu = IoMmuGetInstance (IoMmuIndex);
+  if (IoMmu == NULL) {
+    return EFI_NOT_FOUND;
+  }
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  Status      = IoMmuReadDeviceContext (IoMmu, DeviceId, Buffer, BufferSize);
+  gBS->RestoreTPL (OriginalTpl);
+
+  return Status;
+}
+
+/**
+  Walk the IO page table of a device_id's domain for an IO virtual address.
+
+  @param[in]   This              The protocol instance.
+  @param[in]   IoMmuIndex        The index of the IOMMU, from 0.
+  @param[in]   DeviceId          The device_id.
+  @param[in]   IoVirtualAddress  The IO virtual address.
+  @param[out]  Entries           The entries walked, from the root, until a leaf or an invalid entry.
+  @param[out]  NumberOfEntries   The number of entries walked.
+
+  @retval  EFI_SUCCESS            The page table is walked.
+  @retval  EFI_INVALID_PARAMETER  Entries or NumberOfEntries is NULL.
+  @retval  EFI_NOT_FOUND          There is no such IOMMU, or the device_id has no domain.
+  @retval  EFI_UNSUPPORTED        The domain bypasses translation.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+DiagnosticsWalkPageTable (
+  IN  RISCV_IOMMU_DIAGNOSTICS_PROTOCOL  *This,
+  IN  UINTN                             IoMmuIndex,
+  IN  UINT32                            DeviceId,
+  IN  UINT64                            IoVirtualAddress,
+  OUT UINT64                            Entries[RISCV_IOMMU_DIAGNOSTICS_MAX_LEVELS],
+  OUT UINTN                             *NumberOfEntries
+  )
+{
+  RISCV_IOMMU_INSTANCE       *IoMmu;
+  RISCV_IOMMU_DEVICE_DOMAIN  *Domain;
+  EFI_TPL                    OriginalTpl;
+  EFI_STATUS                 Status;
+
+  if ((Entries == NULL) || (NumberOfEntries == NULL)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  IoMmu = IoMmuGetInstance (IoMmuIndex);
+  if (IoMmu == NULL) {
+    return EFI_NOT_FOUND;
+  }
+
+  ASSERT (IoMmu->IoPageTableLevels <= RISCV_IOMMU_DIAGNOSTICS_MAX_LEVELS);
+
+  //
+  // The walk must not race a page-table update that frees a table.
+  //
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  Domain      = IoMmuFindDeviceDomain (IoMmu, DeviceId);
+  if (Domain == NULL) {
+    Status = EFI_NOT_FOUND;
+  } else if (Domain->RootPageTable == NULL) {
+    Status = EFI_UNSUPPORTED;
+  } else {
+    *NumberOfEntries = IoMmuWalkPageTable (IoMmu, Domain->RootPageTable, IoVirtualAddress, Entries);
+    Status           = EFI_SUCCESS;
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+  return Status;
+}
+
+/**
+  Report how the buffers of a device were mapped.
+
+  @param[in]   This         The protocol instance.
+  @param[in]   IoMmuIndex   The index of the IOMMU, from 0.
+  @param[in]   DomainIndex  The index of the device among those of the IOMMU, from 0.
+  @param[out]  Statistics   The statistics, and the device_id of the device.
+
+  @retval  EFI_SUCCESS            Statistics is filled in.
+  @retval  EFI_INVALID_PARAMETER  Statistics is NULL.
+  @retval  EFI_NOT_FOUND          There is no such IOMMU, or it has no more devices.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+DiagnosticsGetDeviceStatistics (
+  IN  RISCV_IOMMU_DIAGNOSTICS_PROTOCOL  *This,
+  IN  UINTN                             IoMmuIndex,
+  IN  UINTN                             DomainIndex,
+  OUT RISCV_IOMMU_DEVICE_STATISTICS     *Statistics
+  )
+{
+  RISCV_IOMMU_INSTANCE       *IoMmu;
+  RISCV_IOMMU_DEVICE_DOMAIN  *Domain;
+  LIST_ENTRY                 *Link;
+  EFI_TPL                    OriginalTpl;
+  EFI_STATUS                 Status;
+
+  if (Statistics == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  IoMmu = IoMmuGetInstance (IoMmuIndex);
+  if (IoMmu == NULL) {
+    return EFI_NOT_FOUND;
+  }
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  Status      = EFI_NOT_FOUND;
+  for (Link = GetFirstNode (&IoMmu->DomainList)
+       ; !IsNull (&IoMmu->DomainList, Link)
+       ; Link = GetNextNode (&IoMmu->DomainList, Link)
+       ) {
+    if (DomainIndex-- == 0) {
+      Domain               = RISCV_IOMMU_DEVICE_DOMAIN_FROM_LINK (Link);
+      *Statistics          = Domain->Statistics;
+      Statistics->DeviceId = Domain->DeviceId.Uint32;
+      Status               = EFI_SUCCESS;
+      break;
+    }
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+  return Status;
+}
+
+/**
+  Count a mapping in the statistics of the device it is first granted to.
+
+  Called at RISCV_IOMMU_TPL_LEVEL.
+
+  @param[in]  Domain   The domain of the device.
+  @param[in]  MapInfo  The mapping.
+
+**/
+VOID
+IoMmuCountMapping (
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain,
+  IN CONST MAP_INFO             *MapInfo
+  )
+{
+  RISCV_IOMMU_DEVICE_STATISTICS  *Statistics;
+  UINTN                          Log2Size;
+  UINTN                          Bucket;
+
+  Statistics = &Domain->Statistics;
+  Statistics->Maps++;
+  Statistics->BytesMapped += MapInfo->NumberOfBytes;
+  if (MapInfo->BounceReason < RiscVIoMmuBounceReasonMax) {
+    Statistics->BytesBounced[MapInfo->BounceReason] += MapInfo->BouncedBytes;
+  }
+
+  //
+  // The buckets are powers of four, from 4 KiB.
+  //
+  Bucket = 0;
+  if (MapInfo->NumberOfBytes > SIZE_4KB) {
+    Log2Size = (UINTN)HighBitSet64 (MapInfo->NumberOfBytes - 1) + 1;
+    Bucket   = MIN ((Log2Size - 11) / 2, RISCV_IOMMU_DIAGNOSTICS_SIZE_BUCKETS - 1);
+  }
+
+  Statistics->SizeHistogram[Bucket]++;
+  Statistics->TotalMapTime += MapInfo->MapTime;
+  Statistics->MaxMapTime    = MAX (Statistics->MaxMapTime, MapInfo->MapTime);
+}
+
+/**
+  Count an Unmap() in the statistics of the device that owned the mapping.
+
+  @param[in]  Domain     The domain of the device.
+  @param[in]  StartTime  The performance counter when Unmap() was called.
+
+**/
+VOID
+IoMmuCountUnmapping (
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain,
+  IN UINT64                     StartTime
+  )
+{
+  UINT64   Time;
+  EFI_TPL  OriginalTpl;
+
+  Time        = GetTimeInNanoSecond (GetPerformanceCounter () - StartTime);
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  Domain->Statistics.Unmaps++;
+  Domain->Statistics.TotalUnmapTime += Time;
+  Domain->Statistics.MaxUnmapTime    = MAX (Domain->Statistics.MaxUnmapTime, Time);
+  gBS->RestoreTPL (OriginalTpl);
+}
+
+/**
+  Report the register accesses of an operation of the driver, over all IOMMUs.
+
+  @param[in]   This        The protocol instance.
+  @param[in]   Operation   The operation.
+  @param[out]  Statistics  The accesses.
+
+  @retval  EFI_SUCCESS            Statistics is filled in.
+  @retval  EFI_INVALID_PARAMETER  Statistics is NULL, or Operation is unknown.
+  @retval  EFI_UNSUPPORTED        PcdRiscVIoMmuMmioAccounting doesn't enable the accounting.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+DiagnosticsGetMmioStatistics (
+  IN  RISCV_IOMMU_DIAGNOSTICS_PROTOCOL  *This,
+  IN  RISCV_IOMMU_MMIO_OPERATION        Operation,
+  OUT RISCV_IOMMU_MMIO_STATISTICS       *Statistics
+  )
+{
+  if (Statistics == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  return IoMmuGetMmioStatistics (Operation, Statistics);
+}
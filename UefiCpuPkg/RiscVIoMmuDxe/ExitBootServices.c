@@ -0,0 +1,167 @@
+/** @file
+  RISC-V IOMMU teardown at ExitBootServices().
+
+  Before boot services exit, every IOMMU is left in the state that
+  PcdRiscVIoMmuExitBootServicesState selects: translating as it is, with its
+  state handed off to the OS, blocking all DMA, or passing it through. The
+  teardown costs the same however many mappings are live: each IOMMU gets
+  one batch of commands, which ends with a single IODIR.INVAL_DDT and
+  IOTINVAL.VMA of everything, and one IOFENCE.C.
+
+  The MAP_INFO slabs, the bounce and table-page pools and the page tables
+  are boot-services data, which the OS reclaims in bulk, so they are not
+  freed one by one. Only the cached buffers are, since they may be runtime
+  services data. Freeing the rest would also leave the Unmap() calls of
+  later ExitBootServices() handlers working on freed pages.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/PcdLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include "RiscVIoMmu.h"
+
+/**
+  Switch an IOMMU to a directory mode with no tables, so that it stops walking them.
+
+  Leaving a mode with tables for Off or Bare is always allowed.
+
+  @param[in]  IoMmu  The IOMMU.
+  @param[in]  Mode   V_RISCV_IOMMU_DDTP_IOMMU_MODE_OFF or V_RISCV_IOMMU_DDTP_IOMMU_MODE_BARE.
+
+  @retval  EFI_SUCCESS  The IOMMU is in the mode.
+  @retval  EFI_TIMEOUT  The IOMMU did not complete the switch in time.
+
+**/
+STATIC
+EFI_STATUS
+SwitchDirectoryMode (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT8                 Mode
+  )
+{
+  RISCV_IOMMU_DDTP  Ddtp;
+
+  Ddtp.Uint64          = 0;
+  Ddtp.Bits.iommu_mode = Mode;
+
+  return IoMmuWriteAndWait64 (IoMmu, R_RISCV_IOMMU_DDTP, Ddtp.Uint64, 1 << N_RISCV_IOMMU_DDTP_BUSY, FALSE);
+}
+
+/**
+  Leave the IOMMUs in their final state, before boot services exit.
+
+  @param[in]  Event    The event.
+  @param[in]  Context  Unused.
+
+**/
+STATIC
+VOID
+EFIAPI
+OnBeforeExitBootServices (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  LIST_ENTRY             *Link;
+  RISCV_IOMMU_INSTANCE   *IoMmu;
+  RISCV_IOMMU_DEVICE_ID  AllDevices;
+  UINT8                  ExitState;
+  EFI_TPL                OriginalTpl;
+  EFI_STATUS             Status;
+
+  ExitState         = FixedPcdGet8 (PcdRiscVIoMmuExitBootServicesState);
+  AllDevices.Uint32 = 0;
+
+  //
+  // The cached buffers and the ATCs are released into open batches, so their
+  // invalidations only complete with the final fence of each IOMMU.
+  //
+  for (Link = GetFirstNode (&mRiscVIoMmuGlobalDriverContext.InstanceList)
+       ; !IsNull (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ; Link = GetNextNode (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ) {
+    IoMmu = RISCV_IOMMU_INSTANCE_FROM_LINK (Link);
+    if (IoMmu->State == STATE_INITIALISED) {
+      IoMmuBeginCommandBatch (IoMmu);
+    }
+  }
+
+  IoMmuFlushBufferCache ();
+  IoMmuDisableDeviceAts ();
+
+  for (Link = GetFirstNode (&mRiscVIoMmuGlobalDriverContext.InstanceList)
+       ; !IsNull (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ; Link = GetNextNode (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ) {
+    IoMmu = RISCV_IOMMU_INSTANCE_FROM_LINK (Link);
+    if (IoMmu->State != STATE_INITIALISED) {
+      continue;
+    }
+
+    Status = EFI_SUCCESS;
+    if (ExitState == RISCV_IOMMU_EXIT_STATE_BLOCK) {
+      Status = SwitchDirectoryMode (IoMmu, V_RISCV_IOMMU_DDTP_IOMMU_MODE_OFF);
+    } else if (ExitState == RISCV_IOMMU_EXIT_STATE_IDENTITY) {
+      Status = SwitchDirectoryMode (IoMmu, V_RISCV_IOMMU_DDTP_IOMMU_MODE_BARE);
+    }
+
+    if (EFI_ERROR (Status)) {
+      DEBUG ((DEBUG_ERROR, "%a: IOMMU at 0x%lx kept translating: %r\n", __func__, IoMmu->Address, Status));
+    }
+
+    //
+    // One invalidation of everything supersedes the ranges still pending, and leaves
+    // nothing stale cached, whether the OS adopts the tables or the IOMMU stopped using them.
+    //
+    OriginalTpl                                = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+    IoMmu->PendingInvalidations.NumberOfRanges = 0;
+    IoMmuQueueDeviceContextInvalidation (IoMmu, FALSE, AllDevices);
+    IoMmuQueueIoTlbInvalidation (IoMmu, FALSE, 0, FALSE, 0);
+    gBS->RestoreTPL (OriginalTpl);
+
+    Status = IoMmuEndCommandBatch (IoMmu);
+    if (EFI_ERROR (Status)) {
+      DEBUG ((DEBUG_ERROR, "%a: IOMMU at 0x%lx not invalidated: %r\n", __func__, IoMmu->Address, Status));
+    }
+  }
+
+  if (ExitState == RISCV_IOMMU_EXIT_STATE_KEEP) {
+    IoMmuRefreshOsHandOff ();
+  }
+}
+
+/**
+  Register the teardown that runs before boot services exit. It leaves every IOMMU in
+  the state that PcdRiscVIoMmuExitBootServicesState selects, in one step per IOMMU.
+
+  Must be called before the subsystems whose state it tears down are initialised.
+
+  @retval  EFI_SUCCESS  The exit event is registered.
+  @retval  Others       The exit event could not be created. The IOMMUs are left as they are.
+
+**/
+EFI_STATUS
+IoMmuInitialiseExitBootServices (
+  VOID
+  )
+{
+  EFI_EVENT   Event;
+  EFI_STATUS  Status;
+
+  Status = gBS->CreateEventEx (
+                  EVT_NOTIFY_SIGNAL,
+                  TPL_CALLBACK,
+                  OnBeforeExitBootServices,
+                  NULL,
+                  &gEfiEventBeforeExitBootServicesGuid,
+                  &Event
+                  );
+  mRiscVIoMmuGlobalDriverContext.TeardownAtExit = !EFI_ERROR (Status);
+  return Status;
+}
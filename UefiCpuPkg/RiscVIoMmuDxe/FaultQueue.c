@@ -0,0 +1,550 @@
+/** @file
+  RISC-V IOMMU fault reporting.
+
+  The IOMMUs write a record to their fault queue for every DMA they reject.
+  The queues are drained when the IOMMU raises its fault interrupt, which the
+  poll scheduler services by polling the pending bits, and on demand: each record
+  is decoded and counted against its cause and its device. Logging is rate
+  limited, so that a device retrying a faulting DMA cannot flood the console
+  and stall boot, while the counters keep the full picture.
+
+  A device that faults more than PcdRiscVIoMmuFaultStormThreshold times within
+  FAULT_STORM_WINDOW is quarantined once the drain is done: its device context
+  then blocks all of its DMA without reporting the faults, so that it can't
+  keep the boot hart draining, nor fill the queue that the faults of the other
+  devices are reported through.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/PcdLib.h>
+#include <Library/TimerLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include "RiscVIoMmu.h"
+
+//
+// In units of 100 ns, so 100 ms while no records arrive, and 10 ms after a poll that drained any.
+//
+#define FAULT_QUEUE_TIMER_PERIOD         1000000
+#define FAULT_QUEUE_ACTIVE_TIMER_PERIOD  100000
+
+//
+// In units of 100 ns, so 1 ms. A function's DMA stalls until its page requests are answered.
+//
+#define PAGE_REQUEST_TIMER_PERIOD  10000
+
+//
+// The records one drain logs. The others are only counted.
+//
+#define FAULT_QUEUE_LOG_BUDGET  8
+
+//
+// In nanoseconds, so 100 ms, the period of the fault timer.
+//
+#define FAULT_STORM_WINDOW  100000000ULL
+
+typedef struct {
+  UINT16         Cause;
+  CONST CHAR8    *Name;
+} FAULT_CAUSE_NAME;
+
+STATIC CONST FAULT_CAUSE_NAME  mFaultCauseNames[] = {
+  { 1,   "instruction access fault"            },
+  { 4,   "read address misaligned"             },
+  { 5,   "read access fault"                   },
+  { 6,   "write/AMO address misaligned"        },
+  { 7,   "write/AMO access fault"              },
+  { 12,  "instruction page fault"              },
+  { 13,  "read page fault"                     },
+  { 15,  "write/AMO page fault"                },
+  { 20,  "instruction guest page fault"        },
+  { 21,  "read guest page fault"               },
+  { 23,  "write/AMO guest page fault"          },
+  { 256, "all inbound transactions disallowed" },
+  { 257, "DDT entry load access fault"         },
+  { 258, "DDT entry not valid"                 },
+  { 259, "DDT entry misconfigured"             },
+  { 260, "transaction type disallowed"         },
+  { 261, "MSI PTE load access fault"           },
+  { 262, "MSI PTE not valid"                   },
+  { 263, "MSI PTE misconfigured"               },
+  { 264, "MRIF access fault"                   },
+  { 265, "PDT entry load access fault"         },
+  { 266, "PDT entry not valid"                 },
+  { 267, "PDT entry misconfigured"             },
+  { 268, "DDT data corruption"                 },
+  { 269, "PDT data corruption"                 },
+  { 270, "MSI PT data corruption"              },
+  { 271, "MSI MRIF data corruption"            },
+  { 272, "internal datapath error"             },
+  { 273, "IOMMU MSI write access fault"        },
+  { 274, "page table data corruption"          },
+};
+
+STATIC CONST CHAR8  *mFaultTransactionNames[] = {
+  "none",
+  "untranslated execute",
+  "untranslated read",
+  "untranslated write/AMO",
+  "reserved",
+  "translated execute",
+  "translated read",
+  "translated write/AMO",
+  "reserved",
+  "ATS translation request",
+  "message request",
+};
+
+STATIC BOOLEAN  mFaultReporting     = FALSE;
+STATIC BOOLEAN  mPageRequestsWaited = FALSE;
+
+/**
+  Return the name of a fault cause.
+
+  @param[in]  Cause  The cause.
+
+  @return  The name.
+
+**/
+STATIC
+CONST CHAR8 *
+GetFaultCauseName (
+  IN UINTN  Cause
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < ARRAY_SIZE (mFaultCauseNames); Index++) {
+    if (mFaultCauseNames[Index].Cause == Cause) {
+      return mFaultCauseNames[Index].Name;
+    }
+  }
+
+  return "unknown cause";
+}
+
+/**
+  Return the counter of a fault cause.
+
+  @param[in]  Cause  The cause.
+
+  @return  The index into RISCV_IOMMU_INSTANCE.FaultCounts.
+
+**/
+STATIC
+UINTN
+GetFaultCauseSlot (
+  IN UINTN  Cause
+  )
+{
+  if (Cause < RISCV_IOMMU_FAULT_CAUSE_STANDARD_SLOTS) {
+    return Cause;
+  }
+
+  if ((Cause >= V_RISCV_IOMMU_FAULT_CAUSE_IOMMU_BASE) &&
+      (Cause < V_RISCV_IOMMU_FAULT_CAUSE_IOMMU_BASE + RISCV_IOMMU_FAULT_CAUSE_STANDARD_SLOTS))
+  {
+    return RISCV_IOMMU_FAULT_CAUSE_STANDARD_SLOTS + Cause - V_RISCV_IOMMU_FAULT_CAUSE_IOMMU_BASE;
+  }
+
+  return RISCV_IOMMU_FAULT_CAUSE_SLOTS - 1;
+}
+
+/**
+  Count a fault against the rate of its device, and note a storm once the device passes
+  PcdRiscVIoMmuFaultStormThreshold.
+
+  @param[in]  IoMmu   The IOMMU.
+  @param[in]  Domain  The domain of the device.
+  @param[in]  Now     The time of the drain, in nanoseconds.
+
+**/
+STATIC
+VOID
+CountFaultRate (
+  IN RISCV_IOMMU_INSTANCE       *IoMmu,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain,
+  IN UINT64                     Now
+  )
+{
+  if ((PcdGet32 (PcdRiscVIoMmuFaultStormThreshold) == 0) || Domain->Quarantined) {
+    return;
+  }
+
+  if ((Domain->FaultsInWindow == 0) || (Now - Domain->FaultWindowStart >= FAULT_STORM_WINDOW)) {
+    Domain->FaultWindowStart = Now;
+    Domain->FaultsInWindow   = 0;
+  }
+
+  Domain->FaultsInWindow++;
+  if (Domain->FaultsInWindow > PcdGet32 (PcdRiscVIoMmuFaultStormThreshold)) {
+    IoMmu->FaultStormPending = TRUE;
+  }
+}
+
+/**
+  Count a fault record, and log it unless its device already reported many.
+
+  A device's faults are logged while its count is a power of two, so a
+  storm of them decays to a handful of lines.
+
+  @param[in]      IoMmu   The IOMMU.
+  @param[in]      Record  The fault record.
+  @param[in]      Now     The time of the drain, in nanoseconds.
+  @param[in,out]  Budget  The records this drain may still log.
+
+**/
+STATIC
+VOID
+HandleFaultRecord (
+  IN     RISCV_IOMMU_INSTANCE            *IoMmu,
+  IN     CONST RISCV_IOMMU_FAULT_RECORD  *Record,
+  IN     UINT64                          Now,
+  IN OUT UINTN                           *Budget
+  )
+{
+  RISCV_IOMMU_DEVICE_DOMAIN  *Domain;
+  UINT32                     *DeviceCount;
+  UINTN                      Cause;
+  UINTN                      Ttyp;
+
+  Cause = (UINTN)Record->Bits.CAUSE;
+  Ttyp  = (UINTN)Record->Bits.TTYP;
+
+  IoMmu->FaultCounts[GetFaultCauseSlot (Cause)]++;
+
+  Domain      = IoMmuFindDeviceDomain (IoMmu, (UINT32)Record->Bits.DID);
+  DeviceCount = (Domain != NULL) ? &Domain->FaultCount : &IoMmu->UnknownDeviceFaults;
+  *DeviceCount += (*DeviceCount != MAX_UINT32) ? 1 : 0;
+  if (Domain != NULL) {
+    CountFaultRate (IoMmu, Domain, Now);
+  }
+
+  if ((*Budget == 0) || ((*DeviceCount & (*DeviceCount - 1)) != 0)) {
+    return;
+  }
+
+  (*Budget)--;
+  DEBUG ((
+    DEBUG_ERROR,
+    "RISC-V IOMMU 0x%lx: %a (%u) on %a by device_id 0x%x%a, IOVA 0x%lx (fault #%u of the device)\n",
+    IoMmu->Address,
+    GetFaultCauseName (Cause),
+    Cause,
+    (Ttyp < ARRAY_SIZE (mFaultTransactionNames)) ? mFaultTransactionNames[Ttyp] : "reserved",
+    (UINT32)Record->Bits.DID,
+    (Domain != NULL) ? "" : " (no domain)",
+    Record->Bits.iotval,
+    *DeviceCount
+    ));
+}
+
+/**
+  Consume every record in the fault queue of an IOMMU.
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @return  The number of records consumed.
+
+**/
+UINTN
+IoMmuDrainFaultQueue (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  QUEUE_WRAPPER                           *Queue;
+  RISCV_IOMMU_HARDWARE_REQUEST_QUEUE_CSR  FaultQueueCsr;
+  RISCV_IOMMU_FAULT_RECORD                *Records;
+  UINT32                                  Tail;
+  UINTN                                   Consumed;
+  UINTN                                   Budget;
+  UINT64                                  Now;
+  EFI_TPL                                 OriginalTpl;
+  RISCV_IOMMU_MMIO_OPERATION              Previous;
+
+  Queue = &IoMmu->FaultQueue;
+  if ((IoMmu->State != STATE_INITIALISED) || (Queue->Buffer == NULL)) {
+    return 0;
+  }
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  Previous    = IoMmuBeginMmioOperation (RiscVIoMmuMmioFaultDrain);
+
+  //
+  // Records are complete once the tail covers them.
+  //
+  Tail = IoMmuReadAcquire32 (IoMmu, R_RISCV_IOMMU_FQT) & Queue->Mask;
+
+  Records  = Queue->Buffer;
+  Budget   = FAULT_QUEUE_LOG_BUDGET;
+  Consumed = 0;
+  Now      = GetTimeInNanoSecond (GetPerformanceCounter ());
+  while (Queue->Head != Tail) {
+    if (!Queue->Uncached) {
+      IoMmuInvalidateCacheRange (IoMmu, &Records[Queue->Head], sizeof (*Records));
+    }
+
+    HandleFaultRecord (IoMmu, &Records[Queue->Head], Now, &Budget);
+    Queue->Head = (Queue->Head + 1) & Queue->Mask;
+    Consumed++;
+  }
+
+  if (Consumed != 0) {
+    //
+    // The records must be read before their slots are handed back.
+    //
+    IoMmuWriteRelease32 (IoMmu, R_RISCV_IOMMU_FQH, Queue->Head);
+  }
+
+  //
+  // Recording stops on an overflow or memory fault, until the flag is cleared.
+  //
+  FaultQueueCsr.Uint32 = IoMmuRead32 (IoMmu, R_RISCV_IOMMU_FQCSR);
+  if (FaultQueueCsr.Bits.qof || FaultQueueCsr.Bits.qmf) {
+    IoMmuWrite32 (IoMmu, R_RISCV_IOMMU_FQCSR, FaultQueueCsr.Uint32);
+  }
+
+  IoMmuEndMmioOperation (Previous);
+  gBS->RestoreTPL (OriginalTpl);
+
+  if (FaultQueueCsr.Bits.qof || FaultQueueCsr.Bits.qmf) {
+    DEBUG ((
+      DEBUG_WARN,
+      "RISC-V IOMMU 0x%lx: Fault queue %a, so faults were lost\n",
+      IoMmu->Address,
+      FaultQueueCsr.Bits.qof ? "overflowed" : "access failed"
+      ));
+  }
+
+  if (Consumed > FAULT_QUEUE_LOG_BUDGET - Budget) {
+    DEBUG ((
+      DEBUG_WARN,
+      "RISC-V IOMMU 0x%lx: %u more faults were only counted\n",
+      IoMmu->Address,
+      Consumed - (FAULT_QUEUE_LOG_BUDGET - Budget)
+      ));
+  }
+
+  return Consumed;
+}
+
+/**
+  Consume every record in the fault queues of all initialised IOMMUs.
+
+  @return  The number of records consumed.
+
+**/
+UINTN
+IoMmuDrainFaultQueues (
+  VOID
+  )
+{
+  LIST_ENTRY  *Link;
+  UINTN       Consumed;
+
+  Consumed = 0;
+  for (Link = GetFirstNode (&mRiscVIoMmuGlobalDriverContext.InstanceList)
+       ; !IsNull (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ; Link = GetNextNode (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ) {
+    Consumed += IoMmuDrainFaultQueue (RISCV_IOMMU_INSTANCE_FROM_LINK (Link));
+  }
+
+  return Consumed;
+}
+
+/**
+  Quarantine the devices of an IOMMU that passed the fault storm threshold, and report each once.
+
+  It runs apart from the drain, which the recovery of the command queue may call, as the
+  quarantine submits commands.
+
+  @param[in]  IoMmu  The IOMMU.
+
+**/
+STATIC
+VOID
+ContainFaultStorms (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  LIST_ENTRY                 *Link;
+  RISCV_IOMMU_DEVICE_DOMAIN  *Domain;
+  EFI_STATUS                 Status;
+
+  IoMmu->FaultStormPending = FALSE;
+  for (Link = GetFirstNode (&IoMmu->DomainList)
+       ; !IsNull (&IoMmu->DomainList, Link)
+       ; Link = GetNextNode (&IoMmu->DomainList, Link)
+       ) {
+    Domain = RISCV_IOMMU_DEVICE_DOMAIN_FROM_LINK (Link);
+    if (Domain->Quarantined || (Domain->FaultsInWindow <= PcdGet32 (PcdRiscVIoMmuFaultStormThreshold))) {
+      continue;
+    }
+
+    Status = IoMmuQuarantineDeviceDomain (IoMmu, Domain);
+    DEBUG ((
+      DEBUG_ERROR,
+      "RISC-V IOMMU 0x%lx: device_id 0x%x faulted %u times within %u ms, and is quarantined: %r\n",
+      IoMmu->Address,
+      Domain->DeviceId.Uint32,
+      Domain->FaultsInWindow,
+      (UINT32)(FAULT_STORM_WINDOW / 1000000),
+      Status
+      ));
+
+    //
+    // A failed quarantine is retried once the device faults past the threshold again.
+    //
+    Domain->FaultsInWindow = 0;
+  }
+}
+
+/**
+  Service the pending interrupts of an IOMMU, draining its fault queue if it has records,
+  and its page-request queue.
+
+  The pending bits are cleared before their causes are handled, so that a
+  record written meanwhile raises the interrupt again.
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @return  The number of fault records consumed.
+
+**/
+UINTN
+IoMmuServiceInterrupts (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  RISCV_IOMMU_IPSR  InterruptPending;
+  UINTN             Consumed;
+
+  if (IoMmu->State != STATE_INITIALISED) {
+    return 0;
+  }
+
+  InterruptPending.Uint32 = IoMmuRead32 (IoMmu, R_RISCV_IOMMU_IPSR);
+  if (InterruptPending.Uint32 == 0) {
+    return 0;
+  }
+
+  IoMmuWrite32 (IoMmu, R_RISCV_IOMMU_IPSR, InterruptPending.Uint32);
+
+  Consumed = 0;
+  if (InterruptPending.Bits.fip) {
+    Consumed = IoMmuDrainFaultQueue (IoMmu);
+  }
+
+  if (InterruptPending.Bits.pip) {
+    IoMmuDrainPageRequestQueue (IoMmu);
+  }
+
+  if (InterruptPending.Bits.pmip) {
+    IoMmuAccumulateHpmOverflows (IoMmu);
+  }
+
+  //
+  // Command errors are usually recovered from by the submitter, which sees them while it waits, but
+  // an error of commands nobody waits for is recovered from here.
+  //
+  if (InterruptPending.Bits.cip) {
+    IoMmuCheckCommandQueue (IoMmu);
+  }
+
+  if (IoMmu->FaultStormPending) {
+    ContainFaultStorms (IoMmu);
+  }
+
+  return Consumed;
+}
+
+/**
+  Service the interrupts of the IOMMUs periodically, before their fault queues can overflow.
+
+  The IOMMUs are polled faster while faults arrive, and slowly once they're idle.
+
+**/
+STATIC
+VOID
+OnFaultPoll (
+  VOID
+  )
+{
+  LIST_ENTRY                  *Link;
+  RISCV_IOMMU_MMIO_OPERATION  Previous;
+  UINTN                       Consumed;
+  UINT64                      Period;
+
+  Previous = IoMmuBeginMmioOperation (RiscVIoMmuMmioFaultDrain);
+
+  //
+  // An idle IOMMU costs a single read of its pending bits.
+  //
+  Consumed = 0;
+  for (Link = GetFirstNode (&mRiscVIoMmuGlobalDriverContext.InstanceList)
+       ; !IsNull (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ; Link = GetNextNode (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ) {
+    Consumed += IoMmuServiceInterrupts (RISCV_IOMMU_INSTANCE_FROM_LINK (Link));
+  }
+
+  IoMmuEndMmioOperation (Previous);
+
+  if (mPageRequestsWaited) {
+    Period = PAGE_REQUEST_TIMER_PERIOD;
+  } else if (Consumed != 0) {
+    Period = FAULT_QUEUE_ACTIVE_TIMER_PERIOD;
+  } else {
+    Period = FAULT_QUEUE_TIMER_PERIOD;
+  }
+
+  IoMmuSchedulePoll (RiscVIoMmuPollInterrupts, OnFaultPoll, Period);
+}
+
+/**
+  Start servicing the interrupts of the IOMMUs periodically.
+
+  @retval  EFI_SUCCESS  The interrupts are polled.
+  @retval  Others       The poll timer could not be created. Faults are only drained on demand.
+
+**/
+EFI_STATUS
+IoMmuInitialiseFaultReporting (
+  VOID
+  )
+{
+  EFI_STATUS  Status;
+
+  Status = IoMmuSchedulePoll (
+             RiscVIoMmuPollInterrupts,
+             OnFaultPoll,
+             mPageRequestsWaited ? PAGE_REQUEST_TIMER_PERIOD : FAULT_QUEUE_TIMER_PERIOD
+             );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  mFaultReporting = TRUE;
+  return EFI_SUCCESS;
+}
+
+/**
+  Service the interrupts of the IOMMUs more often, once a function waits on page requests.
+
+**/
+VOID
+IoMmuPollInterruptsFrequently (
+  VOID
+  )
+{
+  mPageRequestsWaited = TRUE;
+  if (mFaultReporting) {
+    IoMmuSchedulePoll (RiscVIoMmuPollInterrupts, OnFaultPoll, PAGE_REQUEST_TIMER_PERIOD);
+  }
+}
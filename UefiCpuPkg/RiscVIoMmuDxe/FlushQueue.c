@@ -0,0 +1,300 @@
+/** @file
+  RISC-V IOMMU flush queue, for lazy invalidation of unmapped translations.
+
+  With lazy invalidation, SetAttribute() clears the leaves of an unmapped range
+  without invalidating them, and parks the mapping here. Its IOVA and bounce
+  buffer are only released once one IOTINVAL.VMA and IOFENCE.C have flushed
+  the whole queue: when it fills, when the poll scheduler polls it, which it
+  only does while mappings are parked, or before reuse.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/PcdLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include "RiscVIoMmu.h"
+
+#define FLUSH_QUEUE_SIZE  64
+
+//
+// In units of 100 ns, so 10 ms.
+//
+#define FLUSH_QUEUE_TIMER_PERIOD  100000
+
+STATIC BOOLEAN   mLazyInvalidation = FALSE;
+STATIC MAP_INFO  *mFlushQueue[FLUSH_QUEUE_SIZE];
+STATIC UINTN     mFlushQueueCount = 0;
+
+/**
+  Flush the queue periodically while mappings are parked, so they don't hold their IOVAs for long.
+
+**/
+STATIC
+VOID
+OnFlushPoll (
+  VOID
+  )
+{
+  //
+  // An open command batch is flushed by the next tick.
+  //
+  IoMmuFlushDeferredInvalidations ();
+}
+
+/**
+  Start the flush queue, if PcdRiscVIoMmuLazyInvalidation selects lazy invalidation.
+
+  @retval  EFI_SUCCESS  The flush queue is started, or invalidation is strict.
+  @retval  Others       The poll timer could not be created. Invalidation is strict.
+
+**/
+EFI_STATUS
+IoMmuInitialiseFlushQueue (
+  VOID
+  )
+{
+  EFI_STATUS  Status;
+
+  if (!PcdGetBool (PcdRiscVIoMmuLazyInvalidation)) {
+    return EFI_SUCCESS;
+  }
+
+  //
+  // The queue is polled once a mapping is parked, so the poll timer must exist by then.
+  //
+  Status = IoMmuSchedulePoll (RiscVIoMmuPollFlushQueue, OnFlushPoll, 0);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  mLazyInvalidation = TRUE;
+  DEBUG ((RISCV_IOMMU_DEBUG_LEVEL, "%a: Invalidating unmapped translations lazily\n", __func__));
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Return whether unmapped translations are invalidated lazily.
+
+  @retval  TRUE   Invalidations are deferred to the flush queue.
+  @retval  FALSE  Invalidations complete before SetAttribute() returns.
+
+**/
+BOOLEAN
+IoMmuInvalidatesLazily (
+  VOID
+  )
+{
+  return mLazyInvalidation;
+}
+
+/**
+  Invalidate the translations of all parked mappings, and release those that were unmapped.
+
+  @retval  EFI_SUCCESS       The queue is empty.
+  @retval  EFI_NOT_READY     A command batch is open, so the queue was not flushed.
+  @retval  EFI_DEVICE_ERROR  The IOMMU failed to invalidate the translations.
+
+**/
+EFI_STATUS
+IoMmuFlushDeferredInvalidations (
+  VOID
+  )
+{
+  EFI_TPL               OriginalTpl;
+  UINTN                 Index;
+  MAP_INFO              *MapInfo;
+  LIST_ENTRY            *Link;
+  RISCV_IOMMU_INSTANCE  *IoMmu;
+  EFI_STATUS            Status;
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+
+  if (mFlushQueueCount == 0) {
+    gBS->RestoreTPL (OriginalTpl);
+    return EFI_SUCCESS;
+  }
+
+  //
+  // The fence of an open batch would be deferred, and nothing could be released.
+  //
+  for (Link = GetFirstNode (&mRiscVIoMmuGlobalDriverContext.InstanceList)
+       ; !IsNull (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ; Link = GetNextNode (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ) {
+    IoMmu = RISCV_IOMMU_INSTANCE_FROM_LINK (Link);
+    if (IoMmu->CommandBatchDepth != 0) {
+      gBS->RestoreTPL (OriginalTpl);
+      return EFI_NOT_READY;
+    }
+  }
+
+  //
+  // A mapping isn't bound to a device, so its translations may be cached by any IOMMU.
+  // One invalidation of everything costs less than one per parked page.
+  //
+  Status = EFI_SUCCESS;
+  for (Link = GetFirstNode (&mRiscVIoMmuGlobalDriverContext.InstanceList)
+       ; !IsNull (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link) && !EFI_ERROR (Status)
+       ; Link = GetNextNode (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ) {
+    IoMmu = RISCV_IOMMU_INSTANCE_FROM_LINK (Link);
+    if ((IoMmu->State != STATE_INITIALISED) || (IoMmu->IoPageTableLevels == 0)) {
+      continue;
+    }
+
+    Status = IoMmuQueueIoTlbInvalidation (IoMmu, FALSE, 0, FALSE, 0);
+    if (!EFI_ERROR (Status)) {
+      Status = IoMmuSubmitCommands (IoMmu);
+    }
+
+    //
+    // The ATCs are flushed once the IOTLB is, so they cannot refetch stale translations.
+    //
+    if (!EFI_ERROR (Status)) {
+      Status = IoMmuQueueAllDeviceAtsInvalidations (IoMmu);
+    }
+
+    if (!EFI_ERROR (Status)) {
+      Status = IoMmuSubmitCommands (IoMmu);
+    }
+  }
+
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "%a: Failed to flush 0x%x mappings: %r\n", __func__, mFlushQueueCount, Status));
+    gBS->RestoreTPL (OriginalTpl);
+    return EFI_DEVICE_ERROR;
+  }
+
+  for (Index = 0; Index < mFlushQueueCount; Index++) {
+    MapInfo                      = mFlushQueue[Index];
+    MapInfo->InvalidationPending = FALSE;
+    if (MapInfo->ReleasePending) {
+      IoMmuReleaseMapping (MapInfo);
+    }
+  }
+
+  mFlushQueueCount = 0;
+  IoMmuSchedulePoll (RiscVIoMmuPollFlushQueue, OnFlushPoll, 0);
+
+  gBS->RestoreTPL (OriginalTpl);
+  return EFI_SUCCESS;
+}
+
+/**
+  Park an unmapped mapping in the flush queue, until its translations are invalidated.
+
+  @param[in]  MapInfo  The mapping, whose leaves were cleared without invalidation.
+
+  @retval  EFI_SUCCESS       The mapping is parked, or the queue was flushed.
+  @retval  EFI_DEVICE_ERROR  A full queue could not be flushed.
+
+**/
+EFI_STATUS
+IoMmuDeferInvalidation (
+  IN MAP_INFO  *MapInfo
+  )
+{
+  EFI_TPL     OriginalTpl;
+  EFI_STATUS  Status;
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+
+  Status = EFI_SUCCESS;
+  if (!MapInfo->InvalidationPending) {
+    if (mFlushQueueCount == FLUSH_QUEUE_SIZE) {
+      Status = IoMmuFlushDeferredInvalidations ();
+    }
+
+    if (mFlushQueueCount == 0) {
+      IoMmuSchedulePoll (RiscVIoMmuPollFlushQueue, OnFlushPoll, FLUSH_QUEUE_TIMER_PERIOD);
+    }
+
+    if (mFlushQueueCount < FLUSH_QUEUE_SIZE) {
+      mFlushQueue[mFlushQueueCount++] = MapInfo;
+      MapInfo->InvalidationPending    = TRUE;
+      MapInfo->ReleasePending         = FALSE;
+      Status                          = EFI_SUCCESS;
+    }
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+  return Status;
+}
+
+/**
+  Defer releasing a mapping until its translations are invalidated.
+
+  @param[in]  MapInfo  The mapping, which was removed from the database.
+
+  @retval  TRUE   The flush queue releases the mapping.
+  @retval  FALSE  The mapping isn't parked, so the caller releases it.
+
+**/
+BOOLEAN
+IoMmuDeferRelease (
+  IN MAP_INFO  *MapInfo
+  )
+{
+  EFI_TPL  OriginalTpl;
+  BOOLEAN  Deferred;
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+
+  Deferred = MapInfo->InvalidationPending;
+  if (Deferred) {
+    MapInfo->ReleasePending = TRUE;
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+  return Deferred;
+}
+
+/**
+  Flush the parked mappings, if one overlaps a range that gains access.
+
+  A stale translation that already allows the new access is harmless.
+
+  @param[in]  DeviceAddress  The first device address of the range.
+  @param[in]  Length         The length of the range.
+  @param[in]  IoMmuAccess    The new access.
+
+  @retval  EFI_SUCCESS       No stale translation conflicts with the new access.
+  @retval  EFI_NOT_READY     A command batch is open, so the queue could not be flushed.
+  @retval  EFI_DEVICE_ERROR  The queue could not be flushed.
+
+**/
+EFI_STATUS
+IoMmuFlushOverlappingInvalidations (
+  IN EFI_PHYSICAL_ADDRESS  DeviceAddress,
+  IN UINT64                Length,
+  IN UINT64                IoMmuAccess
+  )
+{
+  EFI_TPL     OriginalTpl;
+  UINTN       Index;
+  MAP_INFO    *MapInfo;
+  EFI_STATUS  Status;
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+
+  Status = EFI_SUCCESS;
+  for (Index = 0; Index < mFlushQueueCount; Index++) {
+    MapInfo = mFlushQueue[Index];
+    if ((DeviceAddress < ALIGN_VALUE (MapInfo->DeviceAddress + MapInfo->NumberOfBytes, EFI_PAGE_SIZE)) &&
+        ((MapInfo->DeviceAddress & ~(EFI_PHYSICAL_ADDRESS)EFI_PAGE_MASK) < DeviceAddress + Length) &&
+        ((IoMmuAccess & ~MapInfo->IoMmuAccess) != 0))
+    {
+      Status = IoMmuFlushDeferredInvalidations ();
+      break;
+    }
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+  return Status;
+}
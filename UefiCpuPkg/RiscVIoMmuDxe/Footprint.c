@@ -0,0 +1,227 @@
+/** @file
+  RISC-V IOMMU memory footprint.
+
+  The memory that the driver allocates for its own metadata is accounted by kind:
+  the device directories, the IO page tables, the queues, the mapping records, the
+  bounce buffers and the domains. The current and peak bytes of each are logged at
+  ReadyToBoot.
+
+  IO page tables, mapping records and bounce buffers beyond the pool grow with the
+  mappings of device drivers, and together are capped by PcdRiscVIoMmuMetadataLimit,
+  so that a driver that maps thousands of scattered pages can't exhaust the memory
+  of a small platform. An allocation past the cap fails as if memory had run out.
+  The rest only grows with the topology, and is not capped.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/PcdLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+#include "RiscVIoMmu.h"
+
+typedef struct {
+  UINT64    Current;
+  UINT64    Peak;
+} FOOTPRINT_COUNTER;
+
+STATIC FOOTPRINT_COUNTER  mFootprint[RiscVIoMmuFootprintMax];
+
+//
+// The bytes of the kinds that PcdRiscVIoMmuMetadataLimit caps.
+//
+STATIC UINT64   mCappedBytes  = 0;
+STATIC BOOLEAN  mLimitReached = FALSE;
+
+STATIC CONST CHAR8  *mFootprintNames[RiscVIoMmuFootprintMax] = {
+  "Device directories",
+  "IO page tables",
+  "Queues",
+  "Mapping records",
+  "Bounce pool",
+  "Bounce buffers",
+  "Domains"
+};
+
+/**
+  Return whether PcdRiscVIoMmuMetadataLimit caps a kind of memory.
+
+  @param[in]  Footprint  The kind.
+
+  @retval  TRUE   The kind grows with the mappings of device drivers.
+  @retval  FALSE  The kind only grows with the topology.
+
+**/
+STATIC
+BOOLEAN
+IsCapped (
+  IN RISCV_IOMMU_FOOTPRINT  Footprint
+  )
+{
+  return (Footprint == RiscVIoMmuFootprintPageTable) ||
+         (Footprint == RiscVIoMmuFootprintMapInfo) ||
+         (Footprint == RiscVIoMmuFootprintBounce);
+}
+
+/**
+  Account memory allocated for the driver's metadata.
+
+  @param[in]  Footprint  What the memory is accounted as.
+  @param[in]  Bytes      The size of the memory.
+
+  @retval  TRUE   The memory is accounted.
+  @retval  FALSE  The memory would exceed PcdRiscVIoMmuMetadataLimit, and must not be allocated.
+
+**/
+BOOLEAN
+IoMmuChargeFootprint (
+  IN RISCV_IOMMU_FOOTPRINT  Footprint,
+  IN UINTN                  Bytes
+  )
+{
+  UINT64   Limit;
+  BOOLEAN  Report;
+  EFI_TPL  OriginalTpl;
+
+  ASSERT (Footprint < RiscVIoMmuFootprintMax);
+
+  Limit       = PcdGet32 (PcdRiscVIoMmuMetadataLimit);
+  Report      = FALSE;
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  if (IsCapped (Footprint)) {
+    if ((Limit != 0) && (mCappedBytes + Bytes > Limit)) {
+      Report        = !mLimitReached;
+      mLimitReached = TRUE;
+      gBS->RestoreTPL (OriginalTpl);
+
+      if (Report) {
+        DEBUG ((DEBUG_WARN, "%a: The metadata reached its limit of 0x%lx bytes, at %a\n", __func__, Limit, mFootprintNames[Footprint]));
+      }
+
+      return FALSE;
+    }
+
+    mCappedBytes += Bytes;
+  }
+
+  mFootprint[Footprint].Current += Bytes;
+  mFootprint[Footprint].Peak     = MAX (mFootprint[Footprint].Peak, mFootprint[Footprint].Current);
+  gBS->RestoreTPL (OriginalTpl);
+  return TRUE;
+}
+
+/**
+  Account memory of the driver's metadata that is freed.
+
+  @param[in]  Footprint  What the memory was accounted as.
+  @param[in]  Bytes      The size of the memory.
+
+**/
+VOID
+IoMmuReleaseFootprint (
+  IN RISCV_IOMMU_FOOTPRINT  Footprint,
+  IN UINTN                  Bytes
+  )
+{
+  EFI_TPL  OriginalTpl;
+
+  ASSERT (Footprint < RiscVIoMmuFootprintMax);
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  ASSERT (mFootprint[Footprint].Current >= Bytes);
+  mFootprint[Footprint].Current -= Bytes;
+  if (IsCapped (Footprint)) {
+    mCappedBytes -= Bytes;
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+}
+
+/**
+  Report the memory of the driver's metadata that is accounted as one kind.
+
+  @param[in]  Footprint  The kind.
+
+  @return  The bytes currently accounted.
+
+**/
+UINT64
+IoMmuGetFootprint (
+  IN RISCV_IOMMU_FOOTPRINT  Footprint
+  )
+{
+  ASSERT (Footprint < RiscVIoMmuFootprintMax);
+  return mFootprint[Footprint].Current;
+}
+
+/**
+  Log the footprint of the driver's metadata.
+
+  @param[in]  Event    The ReadyToBoot event.
+  @param[in]  Context  Unused.
+
+**/
+STATIC
+VOID
+EFIAPI
+OnReadyToBoot (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  FOOTPRINT_COUNTER  Footprint[RiscVIoMmuFootprintMax];
+  UINT64             Current;
+  UINT64             Peak;
+  UINTN              Index;
+  EFI_TPL            OriginalTpl;
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  CopyMem (Footprint, mFootprint, sizeof (Footprint));
+  gBS->RestoreTPL (OriginalTpl);
+
+  //
+  // The peaks of different kinds needn't coincide, so their sum is only a bound.
+  //
+  Current = 0;
+  Peak    = 0;
+  DEBUG ((RISCV_IOMMU_DEBUG_LEVEL, "%a: Metadata footprint in KiB, current and peak:\n", __func__));
+  for (Index = 0; Index < RiscVIoMmuFootprintMax; Index++) {
+    DEBUG ((
+      RISCV_IOMMU_DEBUG_LEVEL,
+      "  %-20a %8lu %8lu\n",
+      mFootprintNames[Index],
+      DivU64x32 (Footprint[Index].Current, SIZE_1KB),
+      DivU64x32 (Footprint[Index].Peak, SIZE_1KB)
+      ));
+    Current += Footprint[Index].Current;
+    Peak    += Footprint[Index].Peak;
+  }
+
+  DEBUG ((RISCV_IOMMU_DEBUG_LEVEL, "  %-20a %8lu %8lu\n", "Total", DivU64x32 (Current, SIZE_1KB), DivU64x32 (Peak, SIZE_1KB)));
+  if (mLimitReached) {
+    DEBUG ((DEBUG_WARN, "%a: Allocations were refused at the limit of 0x%x bytes\n", __func__, PcdGet32 (PcdRiscVIoMmuMetadataLimit)));
+  }
+}
+
+/**
+  Log the current and peak footprint of the driver's metadata at ReadyToBoot.
+
+  @retval  EFI_SUCCESS  The event is registered.
+  @retval  Others       The event could not be created. Nothing is logged.
+
+**/
+EFI_STATUS
+IoMmuInitialiseFootprint (
+  VOID
+  )
+{
+  EFI_EVENT  ReadyToBootEvent;
+
+  return EfiCreateEventReadyToBootEx (TPL_CALLBACK, OnReadyToBoot, NULL, &ReadyToBootEvent);
+}
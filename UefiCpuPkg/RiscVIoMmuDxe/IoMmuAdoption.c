@@ -0,0 +1,458 @@
+/** @file
+  RISC-V IOMMU adoption of a configuration left by an earlier boot stage.
+
+  An IOMMU that is found running, with its queues enabled and a device
+  directory in place, keeps them: the driver rebinds its queue and directory
+  bookkeeping to the live structures, and carries on from there. Device
+  contexts that the earlier stage left valid keep translating until the
+  driver programs a domain for them. Beyond a PSCID that any of them uses,
+  the driver's own PSCIDs are allocated.
+
+  A configuration that can't be adopted is quiesced instead: the queues are
+  disabled and the IOMMU is turned off, after which it is initialised as if
+  it came out of reset.
+
+  An IOMMU that the PEIM handed off translates every device through one
+  shared context, so only its queues are adopted: the driver installs a
+  directory of its own, whose contexts block DMA until they are programmed.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/DxeServicesTableLib.h>
+#include <Library/HobLib.h>
+#include <Guid/RiscVIoMmuPeiHandOff.h>
+#include "RiscVIoMmu.h"
+
+//
+// The queues an earlier stage set up.
+//
+typedef struct {
+  VOID    *Buffer;
+  UINT32  Mask;
+  UINT32  Head;
+  UINT32  Tail;
+} ADOPTED_QUEUE;
+
+/**
+  Determine whether an earlier stage's structure lies in system memory.
+
+  @param[in]  Address  The address of the structure.
+
+  @retval  TRUE   The structure is in system memory.
+  @retval  FALSE  The structure is elsewhere, or not page-aligned.
+
+**/
+STATIC
+BOOLEAN
+IsSystemMemory (
+  IN UINT64  Address
+  )
+{
+  EFI_GCD_MEMORY_SPACE_DESCRIPTOR  Descriptor;
+
+  if ((Address == 0) || ((Address & EFI_PAGE_MASK) != 0)) {
+    return FALSE;
+  }
+
+  if (EFI_ERROR (gDS->GetMemorySpaceDescriptor (Address, &Descriptor))) {
+    return FALSE;
+  }
+
+  return Descriptor.GcdMemoryType == EfiGcdMemoryTypeSystemMemory;
+}
+
+/**
+  Find the hand-off of the PEIM for an IOMMU, if its directory is still the PEIM's.
+
+  @param[in]  IoMmu  The IOMMU.
+  @param[in]  Ddtp   The device-directory table pointer, as read.
+
+  @return  The hand-off, or NULL if the PEIM didn't program the IOMMU's directory.
+
+**/
+STATIC
+CONST RISCV_IOMMU_PEI_HAND_OFF *
+GetPeiHandOff (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN RISCV_IOMMU_DDTP      Ddtp
+  )
+{
+  EFI_HOB_GUID_TYPE               *GuidHob;
+  CONST RISCV_IOMMU_PEI_HAND_OFF  *HandOff;
+
+  for (GuidHob = GetFirstGuidHob (&gRiscVIoMmuPeiHandOffGuid)
+       ; GuidHob != NULL
+       ; GuidHob = GetNextGuidHob (&gRiscVIoMmuPeiHandOffGuid, GET_NEXT_HOB (GuidHob))
+       ) {
+    HandOff = GET_GUID_HOB_DATA (GuidHob);
+    if ((GET_GUID_HOB_DATA_SIZE (GuidHob) >= sizeof (*HandOff)) &&
+        (HandOff->Signature == RISCV_IOMMU_PEI_HAND_OFF_SIGNATURE) &&
+        (HandOff->IoMmuAddress == IoMmu->Address) &&
+        (HandOff->DeviceDirectoryPointer == Ddtp.Uint64))
+    {
+      return HandOff;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+  Validate an enabled queue of an earlier stage.
+
+  @param[in]   IoMmu         The IOMMU.
+  @param[in]   BaseRegister  The offset of the queue's base register.
+  @param[in]   HeadRegister  The offset of the queue's head register; the tail follows it.
+  @param[in]   EntrySize     The size of an entry.
+  @param[out]  Queue         The queue.
+
+  @retval  TRUE   The queue can be adopted.
+  @retval  FALSE  The queue's configuration is not usable.
+
+**/
+STATIC
+BOOLEAN
+AdoptQueue (
+  IN  RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN  UINTN                 BaseRegister,
+  IN  UINTN                 HeadRegister,
+  IN  UINTN                 EntrySize,
+  OUT ADOPTED_QUEUE         *Queue
+  )
+{
+  RISCV_IOMMU_QUEUE_BASE  QueueBase;
+  UINT32                  NumberOfEntries;
+
+  QueueBase.Uint64 = IoMmuRead64 (IoMmu, BaseRegister);
+  if (QueueBase.Bits.LOG2SZ_1 + 1 > 31) {
+    return FALSE;
+  }
+
+  NumberOfEntries = 1U << (QueueBase.Bits.LOG2SZ_1 + 1);
+  Queue->Buffer   = (VOID *)(UINTN)(QueueBase.Bits.PPN << RISCV_MMU_PAGE_SHIFT);
+  Queue->Mask     = NumberOfEntries - 1;
+  Queue->Head     = IoMmuRead32 (IoMmu, HeadRegister) & Queue->Mask;
+  Queue->Tail     = IoMmuRead32 (IoMmu, HeadRegister + sizeof (UINT32)) & Queue->Mask;
+
+  //
+  // The buffer is naturally aligned, so its first and last pages bound it.
+  //
+  return IsSystemMemory ((UINT64)(UINTN)Queue->Buffer) &&
+         IsSystemMemory ((UINT64)(UINTN)Queue->Buffer + ALIGN_VALUE (NumberOfEntries * EntrySize, EFI_PAGE_SIZE) - EFI_PAGE_SIZE);
+}
+
+/**
+  Walk a level of an earlier stage's device directory, validating its pages.
+
+  @param[in]      Table          The page of the level.
+  @param[in]      Level          The level, where 0 holds the device contexts.
+  @param[in]      ContextSize    The size of a device context.
+  @param[in,out]  NumberOfPages  The pages walked so far.
+  @param[in,out]  MaxPscid       The highest PSCID that a valid, translating context uses.
+
+  @retval  TRUE   The level may be adopted.
+  @retval  FALSE  An entry points outside system memory.
+
+**/
+STATIC
+BOOLEAN
+WalkDeviceDirectory (
+  IN     VOID    *Table,
+  IN     UINT8   Level,
+  IN     UINTN   ContextSize,
+  IN OUT UINTN   *NumberOfPages,
+  IN OUT UINT32  *MaxPscid
+  )
+{
+  RISCV_IOMMU_DDT_NON_LEAF_ENTRY   *Entries;
+  RISCV_IOMMU_BASE_DEVICE_CONTEXT  *DeviceContext;
+  UINTN                            Index;
+  UINT64                           NextTable;
+
+  (*NumberOfPages)++;
+  if (Level == 0) {
+    for (Index = 0; Index < EFI_PAGE_SIZE / ContextSize; Index++) {
+      DeviceContext = (VOID *)((UINT8 *)Table + Index * ContextSize);
+      if (DeviceContext->TranslationControl.Bits.V &&
+          (DeviceContext->FirstStageContext.Bits.MODE != V_RISCV_IOMMU_IOSATP_MODE_BARE))
+      {
+        *MaxPscid = MAX (*MaxPscid, (UINT32)DeviceContext->TranslationAttributes.Bits.PSCID);
+      }
+    }
+
+    return TRUE;
+  }
+
+  Entries = Table;
+  for (Index = 0; Index < EFI_PAGE_SIZE / sizeof (*Entries); Index++) {
+    if (!Entries[Index].Bits.V) {
+      continue;
+    }
+
+    NextTable = Entries[Index].Bits.PPN << RISCV_MMU_PAGE_SHIFT;
+    if (!IsSystemMemory (NextTable) ||
+        !WalkDeviceDirectory ((VOID *)(UINTN)NextTable, Level - 1, ContextSize, NumberOfPages, MaxPscid))
+    {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+/**
+  Adopt the queues and device directory of an IOMMU that an earlier boot stage left running.
+
+  Nothing is changed unless the whole configuration is adopted.
+  The directory that the PEIM hands off is not adopted, and leaves DeviceContext.Buffer NULL.
+
+  @param[in]  IoMmu          The IOMMU, whose capabilities are known.
+  @param[in]  NeedBigEndian  Whether implicit accesses must be big-endian, as the harts are.
+  @param[in]  NeedGxl        Whether the IOMMU must be in the 32-bit group of paging modes.
+
+  @retval  TRUE   The configuration is adopted.
+  @retval  FALSE  The configuration is not usable, and must be quiesced.
+
+**/
+BOOLEAN
+IoMmuAdoptConfiguration (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN BOOLEAN               NeedBigEndian,
+  IN BOOLEAN               NeedGxl
+  )
+{
+  RISCV_IOMMU_CAPABILITIES                Capabilities;
+  RISCV_IOMMU_FCTL                        FeatureControl;
+  RISCV_IOMMU_DDTP                        Ddtp;
+  RISCV_IOMMU_SOFTWARE_REQUEST_QUEUE_CSR  CommandQueueCsr;
+  RISCV_IOMMU_HARDWARE_REQUEST_QUEUE_CSR  FaultQueueCsr;
+  RISCV_IOMMU_HARDWARE_REQUEST_QUEUE_CSR  PageRequestQueueCsr;
+  ADOPTED_QUEUE                           CommandQueue;
+  ADOPTED_QUEUE                           FaultQueue;
+  ADOPTED_QUEUE                           PageRequestQueue;
+  CONST RISCV_IOMMU_PEI_HAND_OFF          *HandOff;
+  VOID                                    *Root;
+  UINT8                                   Levels;
+  UINTN                                   ContextSize;
+  UINTN                                   NumberOfPages;
+  UINT32                                  MaxPscid;
+
+  Capabilities.Uint64 = IoMmu->Capabilities;
+
+  //
+  // The implicit accesses must already be of the harts' endianness and XLEN.
+  // The feature control register isn't changed while the IOMMU is running.
+  //
+  FeatureControl.Uint32 = IoMmuRead32 (IoMmu, R_RISCV_IOMMU_FCTL);
+  if ((FeatureControl.Bits.BE != NeedBigEndian) || (FeatureControl.Bits.GXL != NeedGxl)) {
+    return FALSE;
+  }
+
+  //
+  // The device directory must be walked, rather than being off or bypassed.
+  //
+  Ddtp.Uint64 = IoMmuRead64 (IoMmu, R_RISCV_IOMMU_DDTP);
+  if (Ddtp.Bits.busy ||
+      (Ddtp.Bits.iommu_mode < V_RISCV_IOMMU_DDTP_IOMMU_MODE_1LVL) ||
+      (Ddtp.Bits.iommu_mode > V_RISCV_IOMMU_DDTP_IOMMU_MODE_3LVL))
+  {
+    return FALSE;
+  }
+
+  //
+  // The command queue must be idle and error-free, and the fault queue recording.
+  //
+  CommandQueueCsr.Uint32 = IoMmuRead32 (IoMmu, R_RISCV_IOMMU_CQCSR);
+  if (!CommandQueueCsr.Bits.qen || !CommandQueueCsr.Bits.qon || CommandQueueCsr.Bits.busy ||
+      CommandQueueCsr.Bits.qmf || CommandQueueCsr.Bits.cmd_to || CommandQueueCsr.Bits.cmd_ill ||
+      !AdoptQueue (IoMmu, R_RISCV_IOMMU_CQB, R_RISCV_IOMMU_CQH, COMMAND_QUEUE_ENTRY_SIZE, &CommandQueue) ||
+      (CommandQueue.Head != CommandQueue.Tail))
+  {
+    return FALSE;
+  }
+
+  FaultQueueCsr.Uint32 = IoMmuRead32 (IoMmu, R_RISCV_IOMMU_FQCSR);
+  if (!FaultQueueCsr.Bits.qen || !FaultQueueCsr.Bits.qon || FaultQueueCsr.Bits.busy ||
+      FaultQueueCsr.Bits.qmf || FaultQueueCsr.Bits.qof ||
+      !AdoptQueue (IoMmu, R_RISCV_IOMMU_FQB, R_RISCV_IOMMU_FQH, FAULT_QUEUE_ENTRY_SIZE, &FaultQueue))
+  {
+    return FALSE;
+  }
+
+  //
+  // A disabled page-request queue is set up as usual.
+  //
+  PageRequestQueue.Buffer    = NULL;
+  PageRequestQueueCsr.Uint32 = IoMmuRead32 (IoMmu, R_RISCV_IOMMU_PQCSR);
+  if (PageRequestQueueCsr.Bits.qon) {
+    if (!Capabilities.Bits.ATS || !PageRequestQueueCsr.Bits.qen || PageRequestQueueCsr.Bits.busy ||
+        PageRequestQueueCsr.Bits.qmf || PageRequestQueueCsr.Bits.qof ||
+        !AdoptQueue (IoMmu, R_RISCV_IOMMU_PQB, R_RISCV_IOMMU_PQH, PAGE_REQUEST_QUEUE_ENTRY_SIZE, &PageRequestQueue))
+    {
+      return FALSE;
+    }
+  }
+
+  //
+  // The directory's pages must be system memory, and are walked to find the PSCIDs in use.
+  // The PEIM's directory shares its pages between all device_ids, so it is replaced instead,
+  // once the caller programs a root of its own.
+  //
+  Root        = (VOID *)(UINTN)(Ddtp.Bits.PPN << RISCV_MMU_PAGE_SHIFT);
+  Levels      = (UINT8)(Ddtp.Bits.iommu_mode - V_RISCV_IOMMU_DDTP_IOMMU_MODE_BARE);
+  ContextSize = Capabilities.Bits.MSI_FLAT ? sizeof (RISCV_IOMMU_EXTENDED_DEVICE_CONTEXT) : sizeof (RISCV_IOMMU_BASE_DEVICE_CONTEXT);
+
+  NumberOfPages = 0;
+  MaxPscid      = RISCV_IOMMU_SCRATCH_PSCID;
+  HandOff       = GetPeiHandOff (IoMmu, Ddtp);
+  if (HandOff != NULL) {
+    Root     = NULL;
+    Levels   = 0;
+    MaxPscid = HandOff->WindowPscid;
+  } else if (!IsSystemMemory ((UINT64)(UINTN)Root) ||
+             !WalkDeviceDirectory (Root, Levels - 1, ContextSize, &NumberOfPages, &MaxPscid))
+  {
+    return FALSE;
+  }
+
+  if (MaxPscid >= RISCV_IOMMU_MAX_PSCID) {
+    return FALSE;
+  }
+
+  //
+  // Rebind the bookkeeping. The queues continue from where the earlier stage left them.
+  //
+  IoMmu->DeviceContext.ContextStructIsExtended = Capabilities.Bits.MSI_FLAT;
+  IoMmu->DeviceContext.Buffer                  = Root;
+  IoMmu->DeviceContext.Levels                  = Levels;
+  IoMmu->DeviceContext.NumberOfPages           = NumberOfPages;
+
+  IoMmu->CommandQueue.Buffer   = CommandQueue.Buffer;
+  IoMmu->CommandQueue.Mask     = CommandQueue.Mask;
+  IoMmu->CommandQueue.Head     = CommandQueue.Head;
+  IoMmu->CommandQueue.Tail     = CommandQueue.Tail;
+  IoMmu->CommandQueue.Reserved = CommandQueue.Tail;
+
+  IoMmu->FaultQueue.Buffer = FaultQueue.Buffer;
+  IoMmu->FaultQueue.Mask   = FaultQueue.Mask;
+  IoMmu->FaultQueue.Head   = FaultQueue.Head;
+  IoMmu->FaultQueue.Tail   = FaultQueue.Tail;
+
+  if (PageRequestQueue.Buffer != NULL) {
+    IoMmu->PageRequestQueue.Buffer = PageRequestQueue.Buffer;
+    IoMmu->PageRequestQueue.Mask   = PageRequestQueue.Mask;
+    IoMmu->PageRequestQueue.Head   = PageRequestQueue.Head;
+    IoMmu->PageRequestQueue.Tail   = PageRequestQueue.Tail;
+  }
+
+  IoMmu->NextPscid          = MAX (IoMmu->NextPscid, MaxPscid + 1);
+  IoMmu->InterruptsAreWired = FeatureControl.Bits.WSI;
+
+  //
+  // Interrupts the earlier stage left pending are of its own making.
+  //
+  IoMmuWrite32 (IoMmu, R_RISCV_IOMMU_IPSR, IoMmuRead32 (IoMmu, R_RISCV_IOMMU_IPSR));
+
+  if (HandOff != NULL) {
+    DEBUG ((
+      DEBUG_INFO,
+      "%a: Adopted the queues of the IOMMU at 0x%lx from PEI, with its window at 0x%lx\n",
+      __func__,
+      IoMmu->Address,
+      HandOff->DmaWindowBase
+      ));
+  } else {
+    DEBUG ((
+      DEBUG_INFO,
+      "%a: Adopted the running IOMMU at 0x%lx: %d level device table at 0x%p in %u pages\n",
+      __func__,
+      IoMmu->Address,
+      Levels,
+      Root,
+      NumberOfPages
+      ));
+  }
+
+  return TRUE;
+}
+
+/**
+  Disable a queue, and wait until it is off. Its error flags are cleared by writing them back.
+
+  @param[in]  IoMmu        The IOMMU.
+  @param[in]  CsrRegister  The offset of the queue's control and status register.
+
+  @retval  EFI_SUCCESS  The queue is off.
+  @retval  EFI_TIMEOUT  The queue did not turn off in time.
+
+**/
+STATIC
+EFI_STATUS
+DisableQueue (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINTN                 CsrRegister
+  )
+{
+  RISCV_IOMMU_HARDWARE_REQUEST_QUEUE_CSR  QueueCsr;
+
+  //
+  // The command queue's enable bits are at the same positions.
+  //
+  QueueCsr.Uint32   = IoMmuRead32 (IoMmu, CsrRegister);
+  QueueCsr.Bits.qen = 0;
+  QueueCsr.Bits.ie  = 0;
+  return IoMmuWriteAndWait32 (IoMmu, CsrRegister, QueueCsr.Uint32, 1 << N_RISCV_IOMMU_QUEUE_CSR_QON, FALSE);
+}
+
+/**
+  Stop an IOMMU that an earlier boot stage left running, so that it is initialised from reset.
+
+  The queues are disabled and the IOMMU is turned off, which blocks all DMA through it
+  until the driver has initialised it again.
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @retval  EFI_SUCCESS      The IOMMU is in its reset state.
+  @retval  EFI_UNSUPPORTED  The IOMMU could not be quiesced.
+
+**/
+EFI_STATUS
+IoMmuQuiesce (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  RISCV_IOMMU_DDTP  Ddtp;
+  EFI_STATUS        Status;
+
+  DEBUG ((DEBUG_WARN, "%a: Quiescing the running IOMMU at 0x%lx\n", __func__, IoMmu->Address));
+
+  Status = DisableQueue (IoMmu, R_RISCV_IOMMU_CQCSR);
+  if (!EFI_ERROR (Status)) {
+    Status = DisableQueue (IoMmu, R_RISCV_IOMMU_FQCSR);
+  }
+
+  if (!EFI_ERROR (Status)) {
+    Status = DisableQueue (IoMmu, R_RISCV_IOMMU_PQCSR);
+  }
+
+  if (!EFI_ERROR (Status)) {
+    Ddtp.Uint64          = 0;
+    Ddtp.Bits.iommu_mode = V_RISCV_IOMMU_DDTP_IOMMU_MODE_OFF;
+    Status               = IoMmuWriteAndWait64 (IoMmu, R_RISCV_IOMMU_DDTP, Ddtp.Uint64, 1 << N_RISCV_IOMMU_DDTP_BUSY, FALSE);
+  }
+
+  IoMmuWrite32 (IoMmu, R_RISCV_IOMMU_IPSR, IoMmuRead32 (IoMmu, R_RISCV_IOMMU_IPSR));
+
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "%a: The IOMMU at 0x%lx could not be quiesced\n", __func__, IoMmu->Address));
+    return EFI_UNSUPPORTED;
+  }
+
+  return EFI_SUCCESS;
+}
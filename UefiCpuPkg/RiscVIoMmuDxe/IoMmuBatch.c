@@ -0,0 +1,872 @@
+/** @file
+  RISC-V IOMMU batch protocol.
+
+  Drivers that build PRP or SGL lists, or transfer rings, map many buffers
+  for one request, and each Map(), SetAttribute() and Unmap() would end with
+  its own IOFENCE.C. MapMultiple() and UnmapMultiple() instead run the IOMMU
+  protocol services for a whole list inside one command batch, so that the
+  list's invalidations complete with one fence.
+
+  MapContiguous() maps a list in place at one range of the IOVA window, so
+  that a controller which takes a single descriptor, as AHCI PRDs and SD ADMA
+  do, sees the scattered pages as one buffer.
+
+  MapMultipleAsync() and UnmapMultipleAsync() end their batch without waiting
+  for the fence, and signal the caller's token once it completed. Unmapped
+  buffers, and their IOVAs, are only released then.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include "RiscVIoMmu.h"
+
+#define CONTIGUOUS_MAPPING_SIGNATURE  SIGNATURE_32 ('R', 'V', 'C', 'M')
+
+typedef struct {
+  // The pages of the buffer.
+  EFI_PHYSICAL_ADDRESS    HostAddress;
+  UINTN                   NumberOfBytes;
+} CONTIGUOUS_RANGE;
+
+typedef struct {
+  UINT32                       Signature;
+  LIST_ENTRY                   Link;
+  RISCV_IOMMU_INSTANCE         *IoMmu;
+  RISCV_IOMMU_DEVICE_DOMAIN    *Domain;
+  EDKII_IOMMU_OPERATION        Operation;
+  // The IOVA pages of the mapping, of which the ranges map the first ones.
+  EFI_PHYSICAL_ADDRESS         Iova;
+  UINTN                        NumberOfPages;
+  BOOLEAN                      NonCoherent;
+  UINTN                        NumberOfRanges;
+  CONTIGUOUS_RANGE             Ranges[1];
+} CONTIGUOUS_MAPPING;
+
+#define CONTIGUOUS_MAPPING_FROM_LINK(a)  CR (a, CONTIGUOUS_MAPPING, Link, CONTIGUOUS_MAPPING_SIGNATURE)
+
+//
+// The mappings of an UnmapMultipleAsync() call, released once their fence completed.
+//
+typedef struct {
+  EDKII_IOMMU_BATCH_TOKEN    *Token;
+  // The first error of revoking the access.
+  EFI_STATUS                 Status;
+  UINTN                      NumberOfMappings;
+  VOID                       *Mappings[1];
+} ASYNC_UNMAP;
+
+STATIC LIST_ENTRY  mContiguousMappings = INITIALIZE_LIST_HEAD_VARIABLE (mContiguousMappings);
+
+EDKII_IOMMU_BATCH_PROTOCOL  mRiscVIoMmuBatchProtocol = {
+  EDKII_IOMMU_BATCH_PROTOCOL_REVISION,
+  IoMmuMapMultiple,
+  IoMmuUnmapMultiple,
+  IoMmuMapContiguous,
+  IoMmuUnmapContiguous,
+  IoMmuMapMultipleAsync,
+  IoMmuUnmapMultipleAsync,
+};
+
+/**
+  Revoke the access of a device to the mapped entries of a list, then unmap them.
+
+  The access is revoked in one batch, which completes before any buffer is released.
+
+  @param[in]      IoMmu            The IOMMU that translates the device.
+  @param[in]      DeviceHandle     The device.
+  @param[in]      NumberOfEntries  The number of entries.
+  @param[in, out] Entries          The entries. Their mappings are cleared.
+
+  @retval  EFI_SUCCESS  Every entry was unmapped.
+  @retval  Others       What the first failing service returned.
+
+**/
+STATIC
+EFI_STATUS
+UnmapEntries (
+  IN     RISCV_IOMMU_INSTANCE     *IoMmu,
+  IN     EFI_HANDLE               DeviceHandle,
+  IN     UINTN                    NumberOfEntries,
+  IN OUT EDKII_IOMMU_BATCH_ENTRY  *Entries
+  )
+{
+  UINTN       Index;
+  EFI_STATUS  Status;
+  EFI_STATUS  FirstError;
+
+  FirstError = EFI_SUCCESS;
+
+  IoMmuBeginCommandBatch (IoMmu);
+  for (Index = 0; Index < NumberOfEntries; Index++) {
+    if (Entries[Index].Mapping == NULL) {
+      continue;
+    }
+
+    Status = mRiscVIoMmuProtocol.SetAttribute (&mRiscVIoMmuProtocol, DeviceHandle, Entries[Index].Mapping, 0);
+    if (EFI_ERROR (Status) && !EFI_ERROR (FirstError)) {
+      FirstError = Status;
+    }
+  }
+
+  Status = IoMmuEndCommandBatch (IoMmu);
+  if (EFI_ERROR (Status) && !EFI_ERROR (FirstError)) {
+    FirstError = EFI_DEVICE_ERROR;
+  }
+
+  for (Index = 0; Index < NumberOfEntries; Index++) {
+    if (Entries[Index].Mapping == NULL) {
+      continue;
+    }
+
+    Status = mRiscVIoMmuProtocol.Unmap (&mRiscVIoMmuProtocol, Entries[Index].Mapping);
+    if (EFI_ERROR (Status) && !EFI_ERROR (FirstError)) {
+      FirstError = Status;
+    }
+
+    Entries[Index].Mapping = NULL;
+  }
+
+  return FirstError;
+}
+
+/**
+  Find the 64-bit variant of a bus master operation.
+
+  @param[in]  Operation  The bus master operation.
+
+  @return  The operation that may use a buffer anywhere in memory.
+
+**/
+STATIC
+EDKII_IOMMU_OPERATION
+GetOperation64 (
+  IN EDKII_IOMMU_OPERATION  Operation
+  )
+{
+  switch (Operation) {
+    case EdkiiIoMmuOperationBusMasterRead:
+      return EdkiiIoMmuOperationBusMasterRead64;
+    case EdkiiIoMmuOperationBusMasterWrite:
+      return EdkiiIoMmuOperationBusMasterWrite64;
+    case EdkiiIoMmuOperationBusMasterCommonBuffer:
+      return EdkiiIoMmuOperationBusMasterCommonBuffer64;
+    default:
+      return Operation;
+  }
+}
+
+/**
+  Map the entries of a list for a device, and grant the device access to them, inside
+  the caller's command batch.
+
+  @param[in]      DeviceHandle     The device.
+  @param[in]      Domain           The domain of the device.
+  @param[in]      Operation        The bus master operation.
+  @param[in]      IoMmuAccess      The IOMMU access to grant.
+  @param[in]      NumberOfEntries  The number of entries.
+  @param[in, out] Entries          The entries. The mappings of those that were mapped are set,
+                                   and the others are cleared.
+
+  @retval  EFI_SUCCESS  Every entry was mapped.
+  @retval  Others       What the first failing service returned.
+
+**/
+STATIC
+EFI_STATUS
+MapEntries (
+  IN     EFI_HANDLE                 DeviceHandle,
+  IN     RISCV_IOMMU_DEVICE_DOMAIN  *Domain,
+  IN     EDKII_IOMMU_OPERATION      Operation,
+  IN     UINT64                     IoMmuAccess,
+  IN     UINTN                      NumberOfEntries,
+  IN OUT EDKII_IOMMU_BATCH_ENTRY    *Entries
+  )
+{
+  UINTN       Index;
+  EFI_STATUS  Status;
+
+  for (Index = 0; Index < NumberOfEntries; Index++) {
+    Entries[Index].Mapping = NULL;
+  }
+
+  //
+  // Map() can't tell which device a buffer is for, so it keeps a 32-bit operation below 4 GiB.
+  // A device that reaches beyond that needn't have its buffers bounced or remapped there.
+  //
+  if (IoMmuGetDeviceDmaLimit (DeviceHandle, Domain) >= SIZE_4GB) {
+    Operation = GetOperation64 (Operation);
+  }
+
+  Status = EFI_SUCCESS;
+  for (Index = 0; Index < NumberOfEntries; Index++) {
+    Status = mRiscVIoMmuProtocol.Map (
+                                   &mRiscVIoMmuProtocol,
+                                   Operation,
+                                   Entries[Index].HostAddress,
+                                   &Entries[Index].NumberOfBytes,
+                                   &Entries[Index].DeviceAddress,
+                                   &Entries[Index].Mapping
+                                   );
+    if (EFI_ERROR (Status)) {
+      Entries[Index].Mapping = NULL;
+      break;
+    }
+
+    Status = mRiscVIoMmuProtocol.SetAttribute (&mRiscVIoMmuProtocol, DeviceHandle, Entries[Index].Mapping, IoMmuAccess);
+    if (EFI_ERROR (Status)) {
+      break;
+    }
+  }
+
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "%a: Entry 0x%lx of 0x%lx failed: %r\n", __func__, (UINT64)Index, (UINT64)NumberOfEntries, Status));
+  }
+
+  return Status;
+}
+
+/**
+  Map every buffer of a scatter-gather list for a device, and grant the device access to them,
+  as Map() and SetAttribute() of the IOMMU protocol do for each.
+
+  The list is mapped as a whole: if a buffer cannot be mapped, the ones before it are
+  unmapped again, and no entry holds a mapping on return.
+
+  @param[in]      This             The protocol instance pointer.
+  @param[in]      DeviceHandle     The device that does the DMA.
+  @param[in]      Operation        Indicates if the bus master is going to read or write to system memory.
+  @param[in]      IoMmuAccess      The IOMMU access to grant to every buffer.
+  @param[in]      NumberOfEntries  The number of buffers of the list.
+  @param[in, out] Entries          The buffers of the list.
+
+  @retval EFI_SUCCESS            Every buffer was mapped for its returned NumberOfBytes.
+  @retval EFI_INVALID_PARAMETER  One or more parameters are invalid.
+  @retval EFI_UNSUPPORTED        DeviceHandle is unknown by the IOMMU, or a buffer cannot be mapped.
+  @retval EFI_OUT_OF_RESOURCES   The request could not be completed due to a lack of resources.
+  @retval EFI_DEVICE_ERROR       The IOMMU device reported an error while attempting the operation.
+
+**/
+EFI_STATUS
+EFIAPI
+IoMmuMapMultiple (
+  IN     EDKII_IOMMU_BATCH_PROTOCOL  *This,
+  IN     EFI_HANDLE                  DeviceHandle,
+  IN     EDKII_IOMMU_OPERATION       Operation,
+  IN     UINT64                      IoMmuAccess,
+  IN     UINTN                       NumberOfEntries,
+  IN OUT EDKII_IOMMU_BATCH_ENTRY     *Entries
+  )
+{
+  RISCV_IOMMU_INSTANCE       *IoMmu;
+  RISCV_IOMMU_DEVICE_DOMAIN  *Domain;
+  EFI_STATUS                 Status;
+
+  if ((DeviceHandle == NULL) || (NumberOfEntries == 0) || (Entries == NULL)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Status = IoMmuResolveDevice (DeviceHandle, &IoMmu, &Domain);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  IoMmuBeginCommandBatch (IoMmu);
+  Status = MapEntries (DeviceHandle, Domain, Operation, IoMmuAccess, NumberOfEntries, Entries);
+
+  //
+  // The grants must be complete before the device is started.
+  //
+  if (EFI_ERROR (IoMmuEndCommandBatch (IoMmu)) && !EFI_ERROR (Status)) {
+    Status = EFI_DEVICE_ERROR;
+  }
+
+  if (EFI_ERROR (Status)) {
+    UnmapEntries (IoMmu, DeviceHandle, NumberOfEntries, Entries);
+  }
+
+  return Status;
+}
+
+/**
+  Revoke the access of a device to every buffer of a scatter-gather list, and unmap them,
+  as SetAttribute() with no access and Unmap() of the IOMMU protocol do for each.
+
+  Every entry is unmapped, even if one fails.
+
+  @param[in]  This             The protocol instance pointer.
+  @param[in]  DeviceHandle     The device that did the DMA.
+  @param[in]  NumberOfEntries  The number of buffers of the list.
+  @param[in]  Entries          The buffers of the list, as returned by MapMultiple().
+
+  @retval EFI_SUCCESS            Every buffer was unmapped.
+  @retval EFI_INVALID_PARAMETER  One or more parameters are invalid.
+  @retval EFI_DEVICE_ERROR       The IOMMU device reported an error while attempting the operation.
+
+**/
+EFI_STATUS
+EFIAPI
+IoMmuUnmapMultiple (
+  IN EDKII_IOMMU_BATCH_PROTOCOL  *This,
+  IN EFI_HANDLE                  DeviceHandle,
+  IN UINTN                       NumberOfEntries,
+  IN EDKII_IOMMU_BATCH_ENTRY     *Entries
+  )
+{
+  RISCV_IOMMU_INSTANCE       *IoMmu;
+  RISCV_IOMMU_DEVICE_DOMAIN  *Domain;
+  EFI_STATUS                 Status;
+
+  if ((DeviceHandle == NULL) || (NumberOfEntries == 0) || (Entries == NULL)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Status = IoMmuResolveDevice (DeviceHandle, &IoMmu, &Domain);
+  if (EFI_ERROR (Status)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  return UnmapEntries (IoMmu, DeviceHandle, NumberOfEntries, Entries);
+}
+
+/**
+  Signal the token of an asynchronous service.
+
+  @param[in]  Context  The token.
+  @param[in]  Status   The status of the fence.
+
+**/
+STATIC
+VOID
+SignalToken (
+  IN VOID        *Context,
+  IN EFI_STATUS  Status
+  )
+{
+  EDKII_IOMMU_BATCH_TOKEN  *Token;
+
+  Token                    = (EDKII_IOMMU_BATCH_TOKEN *)Context;
+  Token->TransactionStatus = Status;
+  gBS->SignalEvent (Token->Event);
+}
+
+/**
+  Map every buffer of a scatter-gather list for a device, and grant the device access to them,
+  as MapMultiple() does, but return without waiting for the IOMMU to complete the change.
+
+  @param[in]      This             The protocol instance pointer.
+  @param[in]      DeviceHandle     The device that does the DMA.
+  @param[in]      Operation        Indicates if the bus master is going to read or write to system memory.
+  @param[in]      IoMmuAccess      The IOMMU access to grant to every buffer.
+  @param[in]      NumberOfEntries  The number of buffers of the list.
+  @param[in, out] Entries          The buffers of the list.
+  @param[in, out] Token            The token to signal once the buffers may be accessed.
+
+  @retval EFI_SUCCESS            Every buffer was mapped, and the token will be signalled.
+  @retval EFI_INVALID_PARAMETER  One or more parameters are invalid.
+  @retval EFI_UNSUPPORTED        DeviceHandle is unknown by the IOMMU, or a buffer cannot be mapped.
+  @retval EFI_OUT_OF_RESOURCES   The request could not be completed due to a lack of resources.
+  @retval EFI_DEVICE_ERROR       The IOMMU device reported an error while attempting the operation.
+
+**/
+EFI_STATUS
+EFIAPI
+IoMmuMapMultipleAsync (
+  IN     EDKII_IOMMU_BATCH_PROTOCOL  *This,
+  IN     EFI_HANDLE                  DeviceHandle,
+  IN     EDKII_IOMMU_OPERATION       Operation,
+  IN     UINT64                      IoMmuAccess,
+  IN     UINTN                       NumberOfEntries,
+  IN OUT EDKII_IOMMU_BATCH_ENTRY     *Entries,
+  IN OUT EDKII_IOMMU_BATCH_TOKEN     *Token
+  )
+{
+  RISCV_IOMMU_INSTANCE       *IoMmu;
+  RISCV_IOMMU_DEVICE_DOMAIN  *Domain;
+  EFI_STATUS                 Status;
+
+  if ((DeviceHandle == NULL) || (NumberOfEntries == 0) || (Entries == NULL) ||
+      (Token == NULL) || (Token->Event == NULL))
+  {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Status = IoMmuResolveDevice (DeviceHandle, &IoMmu, &Domain);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  IoMmuBeginCommandBatch (IoMmu);
+  Status = MapEntries (DeviceHandle, Domain, Operation, IoMmuAccess, NumberOfEntries, Entries);
+  if (EFI_ERROR (Status)) {
+    IoMmuEndCommandBatch (IoMmu);
+    UnmapEntries (IoMmu, DeviceHandle, NumberOfEntries, Entries);
+    return Status;
+  }
+
+  Status = IoMmuEndCommandBatchAsync (IoMmu, SignalToken, Token);
+  if (EFI_ERROR (Status)) {
+    UnmapEntries (IoMmu, DeviceHandle, NumberOfEntries, Entries);
+    return EFI_DEVICE_ERROR;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Unmap the mappings of an UnmapMultipleAsync() call, whose access was revoked.
+
+  @param[in]  Pending  The call.
+
+  @retval  EFI_SUCCESS  Every mapping was unmapped, and access was revoked from all.
+  @retval  Others       The first error.
+
+**/
+STATIC
+EFI_STATUS
+ReleaseAsyncUnmap (
+  IN ASYNC_UNMAP  *Pending
+  )
+{
+  UINTN       Index;
+  EFI_STATUS  Status;
+  EFI_STATUS  FirstError;
+
+  FirstError = Pending->Status;
+  for (Index = 0; Index < Pending->NumberOfMappings; Index++) {
+    Status = mRiscVIoMmuProtocol.Unmap (&mRiscVIoMmuProtocol, Pending->Mappings[Index]);
+    if (EFI_ERROR (Status) && !EFI_ERROR (FirstError)) {
+      FirstError = Status;
+    }
+  }
+
+  return FirstError;
+}
+
+/**
+  Release the mappings of an UnmapMultipleAsync() call once its fence completed,
+  and signal its token.
+
+  As UnmapMultiple() does, the mappings are released even if the fence failed.
+
+  @param[in]  Context  The call.
+  @param[in]  Status   The status of the fence.
+
+**/
+STATIC
+VOID
+CompleteAsyncUnmap (
+  IN VOID        *Context,
+  IN EFI_STATUS  Status
+  )
+{
+  ASYNC_UNMAP  *Pending;
+  EFI_STATUS   ReleaseStatus;
+
+  Pending       = (ASYNC_UNMAP *)Context;
+  ReleaseStatus = ReleaseAsyncUnmap (Pending);
+  if (!EFI_ERROR (Status)) {
+    Status = ReleaseStatus;
+  }
+
+  SignalToken (Pending->Token, Status);
+  FreePool (Pending);
+}
+
+/**
+  Revoke the access of a device to every buffer of a scatter-gather list, and unmap them,
+  as UnmapMultiple() does, but return without waiting for the IOMMU to complete the change.
+
+  @param[in]      This             The protocol instance pointer.
+  @param[in]      DeviceHandle     The device that did the DMA.
+  @param[in]      NumberOfEntries  The number of buffers of the list.
+  @param[in]      Entries          The buffers of the list.
+  @param[in, out] Token            The token to signal once the buffers are unmapped.
+
+  @retval EFI_SUCCESS            The buffers will be unmapped, and the token will be signalled.
+  @retval EFI_INVALID_PARAMETER  One or more parameters are invalid.
+  @retval EFI_OUT_OF_RESOURCES   The request could not be queued. Nothing was unmapped.
+  @retval EFI_DEVICE_ERROR       The IOMMU device reported an error while attempting the operation.
+                                 The buffers were unmapped, and the token is not signalled.
+
+**/
+EFI_STATUS
+EFIAPI
+IoMmuUnmapMultipleAsync (
+  IN     EDKII_IOMMU_BATCH_PROTOCOL  *This,
+  IN     EFI_HANDLE                  DeviceHandle,
+  IN     UINTN                       NumberOfEntries,
+  IN     EDKII_IOMMU_BATCH_ENTRY     *Entries,
+  IN OUT EDKII_IOMMU_BATCH_TOKEN     *Token
+  )
+{
+  RISCV_IOMMU_INSTANCE       *IoMmu;
+  RISCV_IOMMU_DEVICE_DOMAIN  *Domain;
+  ASYNC_UNMAP                *Pending;
+  UINTN                      Index;
+  EFI_STATUS                 Status;
+
+  if ((DeviceHandle == NULL) || (NumberOfEntries == 0) || (Entries == NULL) ||
+      (Token == NULL) || (Token->Event == NULL))
+  {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Status = IoMmuResolveDevice (DeviceHandle, &IoMmu, &Domain);
+  if (EFI_ERROR (Status)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  //
+  // The entries may be reused on return, so the mappings are kept until the fence completes.
+  //
+  Pending = AllocatePool (OFFSET_OF (ASYNC_UNMAP, Mappings) + NumberOfEntries * sizeof (VOID *));
+  if (Pending == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Pending->Token            = Token;
+  Pending->Status           = EFI_SUCCESS;
+  Pending->NumberOfMappings = 0;
+
+  IoMmuBeginCommandBatch (IoMmu);
+  for (Index = 0; Index < NumberOfEntries; Index++) {
+    if (Entries[Index].Mapping == NULL) {
+      continue;
+    }
+
+    Status = mRiscVIoMmuProtocol.SetAttribute (&mRiscVIoMmuProtocol, DeviceHandle, Entries[Index].Mapping, 0);
+    if (EFI_ERROR (Status) && !EFI_ERROR (Pending->Status)) {
+      Pending->Status = Status;
+    }
+
+    Pending->Mappings[Pending->NumberOfMappings++] = Entries[Index].Mapping;
+  }
+
+  Status = IoMmuEndCommandBatchAsync (IoMmu, CompleteAsyncUnmap, Pending);
+  if (EFI_ERROR (Status)) {
+    ReleaseAsyncUnmap (Pending);
+    FreePool (Pending);
+    return EFI_DEVICE_ERROR;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Unmap the ranges of a contiguous mapping, and invalidate the device's translations of them.
+
+  @param[in]  Mapping  The contiguous mapping.
+
+  @retval  EFI_SUCCESS  The device can no longer reach the ranges, and the IOVA pages may be reused.
+  @retval  Others       The page tables could not be updated, or the invalidations did not complete.
+
+**/
+STATIC
+EFI_STATUS
+RevokeContiguousMapping (
+  IN CONTIGUOUS_MAPPING  *Mapping
+  )
+{
+  EFI_PHYSICAL_ADDRESS  Iova;
+  EFI_PHYSICAL_ADDRESS  Start;
+  UINT64                Length;
+  UINTN                 Index;
+  EFI_STATUS            Status;
+
+  Status = EFI_SUCCESS;
+  Iova   = Mapping->Iova;
+
+  IoMmuBeginCommandBatch (Mapping->IoMmu);
+  for (Index = 0; Index < Mapping->NumberOfRanges; Index++) {
+    Start  = Mapping->Ranges[Index].HostAddress & ~(EFI_PHYSICAL_ADDRESS)EFI_PAGE_MASK;
+    Length = ALIGN_VALUE (Mapping->Ranges[Index].HostAddress + Mapping->Ranges[Index].NumberOfBytes, EFI_PAGE_SIZE) - Start;
+    Status = IoMmuUpdateDomainPageTable (
+               Mapping->IoMmu,
+               Mapping->Domain,
+               Iova,
+               Start,
+               Length,
+               0,
+               FALSE
+               );
+    if (EFI_ERROR (Status)) {
+      break;
+    }
+
+    Iova += Length;
+  }
+
+  if (!EFI_ERROR (Status)) {
+    Status = IoMmuInvalidateDeviceAts (Mapping->IoMmu, Mapping->Domain, Mapping->Iova, Iova - Mapping->Iova);
+  }
+
+  if (EFI_ERROR (IoMmuEndCommandBatch (Mapping->IoMmu)) && !EFI_ERROR (Status)) {
+    Status = EFI_DEVICE_ERROR;
+  }
+
+  return Status;
+}
+
+/**
+  Map the buffers of a scatter-gather list for a device at one contiguous range of
+  device addresses, in the order of the list, and grant the device access to it.
+
+  The buffers are mapped in place. Since the device sees them page by page, every buffer
+  but the first must start on a page boundary, and every buffer but the last must end on one.
+  The device address of each buffer within the range is returned in its entry.
+
+  @param[in]      This             The protocol instance pointer.
+  @param[in]      DeviceHandle     The device that does the DMA.
+  @param[in]      Operation        Indicates if the bus master is going to read or write to system memory.
+  @param[in]      IoMmuAccess      The IOMMU access to grant to the range.
+  @param[in]      NumberOfEntries  The number of buffers of the list.
+  @param[in, out] Entries          The buffers of the list.
+  @param[out]     DeviceAddress    The device address of the first byte of the first buffer.
+  @param[out]     Mapping          A resulting value to pass to UnmapContiguous().
+
+  @retval EFI_SUCCESS            The list was mapped at one contiguous range.
+  @retval EFI_INVALID_PARAMETER  One or more parameters are invalid, or a buffer is not page-aligned
+                                 where the range continues.
+  @retval EFI_UNSUPPORTED        DeviceHandle is unknown by the IOMMU, or its DMA is not translated.
+  @retval EFI_OUT_OF_RESOURCES   No contiguous range of device addresses is free.
+  @retval EFI_DEVICE_ERROR       The IOMMU device reported an error while attempting the operation.
+
+**/
+EFI_STATUS
+EFIAPI
+IoMmuMapContiguous (
+  IN     EDKII_IOMMU_BATCH_PROTOCOL  *This,
+  IN     EFI_HANDLE                  DeviceHandle,
+  IN     EDKII_IOMMU_OPERATION       Operation,
+  IN     UINT64                      IoMmuAccess,
+  IN     UINTN                       NumberOfEntries,
+  IN OUT EDKII_IOMMU_BATCH_ENTRY     *Entries,
+  OUT    EFI_PHYSICAL_ADDRESS        *DeviceAddress,
+  OUT    VOID                        **Mapping
+  )
+{
+  RISCV_IOMMU_INSTANCE       *IoMmu;
+  RISCV_IOMMU_DEVICE_DOMAIN  *Domain;
+  CONTIGUOUS_MAPPING         *Contiguous;
+  EFI_PHYSICAL_ADDRESS       HostAddress;
+  EFI_PHYSICAL_ADDRESS       Iova;
+  UINT64                     Length;
+  UINTN                      NumberOfPages;
+  UINTN                      LargestLength;
+  EFI_PHYSICAL_ADDRESS       CongruentStart;
+  UINTN                      Index;
+  EFI_TPL                    OriginalTpl;
+  EFI_STATUS                 Status;
+
+  if ((DeviceHandle == NULL) || (NumberOfEntries == 0) || (Entries == NULL) ||
+      (DeviceAddress == NULL) || (Mapping == NULL) || (Operation >= EdkiiIoMmuOperationMaximum) ||
+      (IoMmuAccess == 0) || ((IoMmuAccess & ~(UINT64)(EDKII_IOMMU_ACCESS_READ | EDKII_IOMMU_ACCESS_WRITE)) != 0))
+  {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  //
+  // Only the ends of the range may be partial pages. The IOVA is placed congruently
+  // to the largest entry, which is the one that can gain superpage leaves.
+  //
+  NumberOfPages  = 0;
+  LargestLength  = 0;
+  CongruentStart = 0;
+  for (Index = 0; Index < NumberOfEntries; Index++) {
+    HostAddress = (EFI_PHYSICAL_ADDRESS)(UINTN)Entries[Index].HostAddress;
+    if ((HostAddress == 0) || (Entries[Index].NumberOfBytes == 0) ||
+        ((Index != 0) && ((HostAddress & EFI_PAGE_MASK) != 0)) ||
+        ((Index != NumberOfEntries - 1) && (((HostAddress + Entries[Index].NumberOfBytes) & EFI_PAGE_MASK) != 0)))
+    {
+      return EFI_INVALID_PARAMETER;
+    }
+
+    if (Entries[Index].NumberOfBytes > LargestLength) {
+      LargestLength  = Entries[Index].NumberOfBytes;
+      CongruentStart = (HostAddress & ~(EFI_PHYSICAL_ADDRESS)EFI_PAGE_MASK) - EFI_PAGES_TO_SIZE (NumberOfPages);
+    }
+
+    NumberOfPages += EFI_SIZE_TO_PAGES ((HostAddress & EFI_PAGE_MASK) + Entries[Index].NumberOfBytes);
+  }
+
+  Status = IoMmuResolveDevice (DeviceHandle, &IoMmu, &Domain);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  if ((Domain->Mode == RISCV_IOMMU_DEVICE_MODE_BYPASS) || (Domain->RootPageTable == NULL)) {
+    DEBUG ((DEBUG_ERROR, "%a: device_id 0x%x doesn't translate IOVAs\n", __func__, Domain->DeviceId.Uint32));
+    return EFI_UNSUPPORTED;
+  }
+
+  Contiguous = AllocatePool (OFFSET_OF (CONTIGUOUS_MAPPING, Ranges) + NumberOfEntries * sizeof (CONTIGUOUS_RANGE));
+  if (Contiguous == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Iova = IoMmuAllocateIova (NumberOfPages, CongruentStart);
+  if ((Iova == 0) && !EFI_ERROR (IoMmuFlushDeferredInvalidations ())) {
+    //
+    // Parked mappings may hold the IOVAs.
+    //
+    Iova = IoMmuAllocateIova (NumberOfPages, CongruentStart);
+  }
+
+  if (Iova == 0) {
+    DEBUG ((DEBUG_ERROR, "%a: No 0x%lx IOVA pages are free\n", __func__, (UINT64)NumberOfPages));
+    FreePool (Contiguous);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Contiguous->Signature      = CONTIGUOUS_MAPPING_SIGNATURE;
+  Contiguous->IoMmu          = IoMmu;
+  Contiguous->Domain         = Domain;
+  Contiguous->Operation      = Operation;
+  Contiguous->Iova           = Iova;
+  Contiguous->NumberOfPages  = NumberOfPages;
+  Contiguous->NonCoherent    = IoMmu->NonCoherent &&
+                               (Operation != EdkiiIoMmuOperationBusMasterCommonBuffer) &&
+                               (Operation != EdkiiIoMmuOperationBusMasterCommonBuffer64);
+  Contiguous->NumberOfRanges = 0;
+
+  //
+  // The fresh IOVAs have no stale translations, so the grants complete with the batch.
+  //
+  IoMmuBeginCommandBatch (IoMmu);
+  for (Index = 0; Index < NumberOfEntries; Index++) {
+    HostAddress = (EFI_PHYSICAL_ADDRESS)(UINTN)Entries[Index].HostAddress;
+    Length      = ALIGN_VALUE (HostAddress + Entries[Index].NumberOfBytes, EFI_PAGE_SIZE) -
+                  (HostAddress & ~(EFI_PHYSICAL_ADDRESS)EFI_PAGE_MASK);
+
+    if (Contiguous->NonCoherent) {
+      IoMmuPrepareDmaBuffer (Operation, HostAddress, Entries[Index].NumberOfBytes);
+    }
+
+    Status = IoMmuUpdateDomainPageTable (
+               IoMmu,
+               Domain,
+               Iova,
+               HostAddress & ~(EFI_PHYSICAL_ADDRESS)EFI_PAGE_MASK,
+               Length,
+               IoMmuAccess,
+               FALSE
+               );
+    if (EFI_ERROR (Status)) {
+      break;
+    }
+
+    Contiguous->Ranges[Index].HostAddress   = HostAddress;
+    Contiguous->Ranges[Index].NumberOfBytes = Entries[Index].NumberOfBytes;
+    Contiguous->NumberOfRanges++;
+
+    Entries[Index].DeviceAddress = Iova + (HostAddress & EFI_PAGE_MASK);
+    Entries[Index].Mapping       = NULL;
+    Iova                        += Length;
+  }
+
+  if (EFI_ERROR (IoMmuEndCommandBatch (IoMmu)) && !EFI_ERROR (Status)) {
+    Status = EFI_DEVICE_ERROR;
+  }
+
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "%a: Entry 0x%lx of 0x%lx failed: %r\n", __func__, (UINT64)Index, (UINT64)NumberOfEntries, Status));
+
+    //
+    // IOVAs the device may still reach are leaked rather than reused.
+    //
+    if (!EFI_ERROR (RevokeContiguousMapping (Contiguous))) {
+      IoMmuFreeIova (Contiguous->Iova, NumberOfPages);
+    }
+
+    FreePool (Contiguous);
+    return Status;
+  }
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  InsertTailList (&mContiguousMappings, &Contiguous->Link);
+  gBS->RestoreTPL (OriginalTpl);
+
+  *DeviceAddress = Entries[0].DeviceAddress;
+  *Mapping       = Contiguous;
+  return EFI_SUCCESS;
+}
+
+/**
+  Revoke the access of the device to a range mapped by MapContiguous(), and unmap it.
+
+  @param[in]  This     The protocol instance pointer.
+  @param[in]  Mapping  The mapping value returned from MapContiguous().
+
+  @retval EFI_SUCCESS            The range was unmapped.
+  @retval EFI_INVALID_PARAMETER  Mapping is not a value that was returned by MapContiguous().
+  @retval EFI_DEVICE_ERROR       The IOMMU device reported an error while attempting the operation.
+                                 The range is still mapped.
+
+**/
+EFI_STATUS
+EFIAPI
+IoMmuUnmapContiguous (
+  IN EDKII_IOMMU_BATCH_PROTOCOL  *This,
+  IN VOID                        *Mapping
+  )
+{
+  LIST_ENTRY          *Link;
+  CONTIGUOUS_MAPPING  *Contiguous;
+  UINTN               Index;
+  EFI_TPL             OriginalTpl;
+  EFI_STATUS          Status;
+
+  if (Mapping == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  //
+  // Mapping is only dereferenced once it is known to be live.
+  //
+  Contiguous  = NULL;
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  for (Link = GetFirstNode (&mContiguousMappings)
+       ; !IsNull (&mContiguousMappings, Link)
+       ; Link = GetNextNode (&mContiguousMappings, Link)
+       ) {
+    Contiguous = CONTIGUOUS_MAPPING_FROM_LINK (Link);
+    if (Contiguous == Mapping) {
+      RemoveEntryList (Link);
+      break;
+    }
+
+    Contiguous = NULL;
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+  if (Contiguous == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Status = RevokeContiguousMapping (Contiguous);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "%a: Failed to unmap IOVA 0x%lx: %r\n", __func__, Contiguous->Iova, Status));
+    OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+    InsertTailList (&mContiguousMappings, &Contiguous->Link);
+    gBS->RestoreTPL (OriginalTpl);
+    return EFI_DEVICE_ERROR;
+  }
+
+  if (Contiguous->NonCoherent) {
+    for (Index = 0; Index < Contiguous->NumberOfRanges; Index++) {
+      IoMmuCompleteDmaBuffer (Contiguous->Operation, Contiguous->Ranges[Index].HostAddress, Contiguous->Ranges[Index].NumberOfBytes);
+    }
+  }
+
+  IoMmuFreeIova (Contiguous->Iova, Contiguous->NumberOfPages);
+  Contiguous->Signature = 0;
+  FreePool (Contiguous);
+  return EFI_SUCCESS;
+}
@@ -10,10 +10,16 @@
 #include <Library/BaseLib.h>
 #include <Library/DebugLib.h>
 #include <Library/FdtLib.h>
+#include <Library/HobLib.h>
 #include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
+#include <Library/PerformanceLib.h>
+#include <Library/RiscVRimtLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/UefiLib.h>
+#include <Protocol/PciConfigCache.h>
 #include <Protocol/PciEnumerationComplete.h>
+#include <Protocol/PciHotPlugRequest.h>
 #include <Protocol/PciIo.h>
 #include <Guid/Fdt.h>
 #include <Guid/PlatformHasAcpi.h>
@@ -22,88 +28,1085 @@
 #include <IndustryStandard/RiscVIoMappingTable.h>
 #include "RiscVIoMmu.h"
 
-#define EFI_ACPI_RISCV_IO_MAPPING_TABLE_SIGNATURE  SIGNATURE_32('R', 'I', 'M', 'T')
+STATIC EFI_EVENT  mPciIoNotifyEvent;
+STATIC VOID       *mPciIoNotifyRegistration;
+
+STATIC EFI_PCI_HOTPLUG_REQUEST_NOTIFY  mPciHotPlugRequestNotify = NULL;
+
+#define FIXED_IOMMU_NON_COHERENT            BIT0
+#define FIXED_IOMMU_MSI_PARENT              BIT1
+#define FIXED_IOMMU_PROXIMITY_DOMAIN_VALID  BIT2
+
+//
+// The layout of an entry of PcdRiscVIoMmuFixedInstances.
+//
+#pragma pack(1)
+typedef struct {
+  UINT64    BaseAddress;
+  UINT32    ProximityDomain;
+  UINT8     NumberOfInterruptWires;
+  UINT8     Flags;
+  UINT8     Reserved[2];
+} FIXED_IOMMU_ENTRY;
+
+//
+// The layout of an entry of PcdRiscVIoMmuFixedRoutes.
+//
+typedef struct {
+  UINT16    PciSegment;
+  UINT8     IoMmuIndex;
+  UINT8     Flags;
+  UINT32    RequesterIdBase;
+  UINT32    NumberOfIds;
+  UINT32    DeviceIdBase;
+} FIXED_ROUTE_ENTRY;
+#pragma pack()
+
+/**
+  Find the instance of a PCI IOMMU that the firmware tables describe, but whose
+  function wasn't enumerated yet. IOMMUs that failed to initialise aren't found.
+
+  @param[in]  Segment  The PCI segment of the function.
+  @param[in]  Bdf      The bus, device and function numbers of the function, or
+                       MAX_UINT16 for the first such IOMMU of the segment.
+
+  @return  The instance, or NULL if no such PCI IOMMU is described at the location.
+
+**/
+STATIC
+RISCV_IOMMU_INSTANCE *
+IoMmuFindPciInstance (
+  IN UINT16  Segment,
+  IN UINT16  Bdf
+  )
+{
+  LIST_ENTRY            *Link;
+  RISCV_IOMMU_INSTANCE  *IoMmu;
+
+  for (Link = GetFirstNode (&mRiscVIoMmuGlobalDriverContext.InstanceList)
+       ; !IsNull (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ; Link = GetNextNode (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ) {
+    IoMmu = RISCV_IOMMU_INSTANCE_FROM_LINK (Link);
+    if (IoMmu->IoMmuIsPciDevice && (IoMmu->State == STATE_DETECTED) && (IoMmu->Address == 0) &&
+        (IoMmu->PciSegment == Segment) && ((Bdf == MAX_UINT16) || (IoMmu->PciBdf == Bdf)))
+    {
+      return IoMmu;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+  Determine whether a PCI function is one of the IOMMUs, whatever their state.
+
+  @param[in]  Segment  The PCI segment of the function.
+  @param[in]  Bdf      The bus, device and function numbers of the function.
+
+  @retval  TRUE   The function is an IOMMU.
+  @retval  FALSE  The function is an ordinary device.
+
+**/
+STATIC
+BOOLEAN
+IoMmuIsPciInstance (
+  IN UINT16  Segment,
+  IN UINT16  Bdf
+  )
+{
+  LIST_ENTRY            *Link;
+  RISCV_IOMMU_INSTANCE  *IoMmu;
+
+  for (Link = GetFirstNode (&mRiscVIoMmuGlobalDriverContext.InstanceList)
+       ; !IsNull (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ; Link = GetNextNode (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ) {
+    IoMmu = RISCV_IOMMU_INSTANCE_FROM_LINK (Link);
+    if (IoMmu->IoMmuIsPciDevice && (IoMmu->PciSegment == Segment) && (IoMmu->PciBdf == Bdf)) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/**
+  Determine whether a PCI function is of the RISC-V IOMMU class, from its config space.
+
+  The header that the PCI bus driver cached at enumeration is used if it is
+  installed, so that scanning every function doesn't read config space.
+
+  @param[in]  Handle  The handle of the function.
+  @param[in]  PciIo   The PCI I/O protocol of the function.
+
+  @retval  TRUE   The function is an IOMMU.
+  @retval  FALSE  The function is of another class, or its config space can't be read.
+
+**/
+STATIC
+BOOLEAN
+IoMmuIsPciIoMmuClass (
+  IN EFI_HANDLE           Handle,
+  IN EFI_PCI_IO_PROTOCOL  *PciIo
+  )
+{
+  EDKII_PCI_CONFIG_CACHE_PROTOCOL  *ConfigCache;
+  PCI_TYPE00                       Pci;
+  EFI_STATUS                       Status;
+
+  Status = gBS->HandleProtocol (Handle, &gEdkiiPciConfigCacheProtocolGuid, (VOID **)&ConfigCache);
+  if (!EFI_ERROR (Status)) {
+    Status = ConfigCache->GetHeader (ConfigCache, &Pci);
+  }
+
+  if (EFI_ERROR (Status)) {
+    Status = PciIo->Pci.Read (PciIo, EfiPciIoWidthUint32, 0, sizeof (Pci) / sizeof (UINT32), &Pci);
+  }
+
+  return !EFI_ERROR (Status) && IS_CLASS3 (&Pci, PCI_CLASS_SYSTEM_PERIPHERAL, 0x06, 0x00);
+}
+
+/**
+  Make the registers of an enumerated PCI IOMMU accessible.
+
+  @param[in]  IoMmu  The IOMMU.
+  @param[in]  PciIo  The PCI I/O protocol of the IOMMU's function.
+
+**/
+STATIC
+VOID
+IoMmuEnablePciInstance (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN EFI_PCI_IO_PROTOCOL   *PciIo
+  )
+{
+  EFI_STATUS                         Status;
+  UINT16                             Data;
+  EFI_ACPI_ADDRESS_SPACE_DESCRIPTOR  *Descriptor;
+
+  // Also enable DMA to satisfy MSIs, etc.
+  Data   = EFI_PCI_COMMAND_BUS_MASTER | EFI_PCI_COMMAND_MEMORY_SPACE;
+  Status = PciIo->Pci.Write (PciIo, EfiPciIoWidthUint16, PCI_COMMAND_OFFSET, 1, (VOID *)&Data);
+  ASSERT_EFI_ERROR (Status);
+
+  Status = PciIo->GetBarAttributes (PciIo, 0, NULL, (VOID **)&Descriptor);
+  ASSERT ((Status == EFI_SUCCESS) && (Descriptor->ResType == ACPI_ADDRESS_SPACE_TYPE_MEM));
+
+  IoMmu->Address = Descriptor->AddrRangeMin;
+  ASSERT (Descriptor->AddrLen == SIZE_4KB);
+  FreePool (Descriptor);
+
+  IoMmu->State = STATE_AVAILABLE;
+}
+
+/**
+  Create the domains and program the device contexts of all PCI functions, once
+  enumeration completes, so their first DMA request doesn't pay for it.
+
+  The device contexts of each IOMMU are invalidated under a single fence.
+
+  @param[in]  HandleCount   The number of PCI I/O handles.
+  @param[in]  HandleBuffer  The PCI I/O handles.
+
+**/
+STATIC
+VOID
+IoMmuPrepareDeviceContexts (
+  IN UINTN       HandleCount,
+  IN EFI_HANDLE  *HandleBuffer
+  )
+{
+  LIST_ENTRY                 *Link;
+  UINTN                      Index;
+  EFI_PCI_IO_PROTOCOL        *PciIo;
+  UINTN                      Seg;
+  UINTN                      Bus;
+  UINTN                      Dev;
+  UINTN                      Func;
+  UINT16                     Rid;
+  RISCV_IOMMU_DEVICE_ID      DeviceId;
+  RISCV_IOMMU_INSTANCE       *IoMmu;
+  RISCV_IOMMU_DEVICE_DOMAIN  *Domain;
+  UINTN                      NumberOfDomains;
+  EFI_STATUS                 Status;
+
+  for (Link = GetFirstNode (&mRiscVIoMmuGlobalDriverContext.InstanceList)
+       ; !IsNull (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ; Link = GetNextNode (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ) {
+    IoMmuBeginCommandBatch (RISCV_IOMMU_INSTANCE_FROM_LINK (Link));
+  }
+
+  NumberOfDomains = 0;
+  for (Index = 0; Index < HandleCount; Index++) {
+    Status = gBS->HandleProtocol (HandleBuffer[Index], &gEfiPciIoProtocolGuid, (VOID **)&PciIo);
+    if (EFI_ERROR (Status)) {
+      continue;
+    }
+
+    Status = PciIo->GetLocation (PciIo, &Seg, &Bus, &Dev, &Func);
+    if (EFI_ERROR (Status)) {
+      continue;
+    }
+
+    //
+    // An IOMMU's own accesses aren't translated. The IOMMUs are known by their location,
+    // so no config space is read.
+    //
+    Rid = (UINT16)((Bus << 8) | (Dev << 3) | Func);
+    if (IoMmuIsPciInstance ((UINT16)Seg, Rid)) {
+      continue;
+    }
+
+    IoMmu = IoMmuRouteDevice (RISCV_IOMMU_PCI_ROUTING_DOMAIN (Seg), Rid, &DeviceId, NULL);
+    if ((IoMmu == NULL) || (IoMmu->State != STATE_INITIALISED)) {
+      continue;
+    }
+
+    Status = IoMmuGetDeviceDomain (
+               IoMmu,
+               DeviceId,
+               IoMmuGetDeviceMode (PciIo),
+               IoMmuGetDeviceQosId (PciIo),
+               IoMmuGetDeviceGroup (PciIo, Seg, Bus, Dev, Func),
+               &Domain
+               );
+    if (EFI_ERROR (Status)) {
+      continue;
+    }
+
+    IoMmuInsertDeviceCache (HandleBuffer[Index], IoMmu, Domain);
+    NumberOfDomains++;
+  }
+
+  for (Link = GetFirstNode (&mRiscVIoMmuGlobalDriverContext.InstanceList)
+       ; !IsNull (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ; Link = GetNextNode (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ) {
+    IoMmu = RISCV_IOMMU_INSTANCE_FROM_LINK (Link);
+    if (EFI_ERROR (IoMmuEndCommandBatch (IoMmu))) {
+      DEBUG ((DEBUG_ERROR, "%a: The IOMMU at 0x%lx failed to invalidate its device contexts\n", __func__, IoMmu->Address));
+    }
+  }
+
+  DEBUG ((RISCV_IOMMU_DEBUG_LEVEL, "%a: Prepared 0x%x device contexts\n", __func__, NumberOfDomains));
+}
+
+/**
+  Enable the function of a described PCI IOMMU, once its config space confirms the class.
+
+  @param[in]  IoMmu   The IOMMU that the firmware tables describe at the function's location.
+  @param[in]  Handle  The handle of the function.
+  @param[in]  PciIo   The PCI I/O protocol of the function.
+
+  @retval  TRUE   The IOMMU is available.
+  @retval  FALSE  The function isn't an IOMMU, and the description is left for the fallback scan.
+
+**/
+STATIC
+BOOLEAN
+IoMmuProbePciInstance (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN EFI_HANDLE            Handle,
+  IN EFI_PCI_IO_PROTOCOL   *PciIo
+  )
+{
+  if (!IoMmuIsPciIoMmuClass (Handle, PciIo)) {
+    DEBUG ((
+      DEBUG_WARN,
+      "%a: The function at %04x:%04x, described as an IOMMU, isn't one\n",
+      __func__,
+      IoMmu->PciSegment,
+      IoMmu->PciBdf
+      ));
+    return FALSE;
+  }
+
+  IoMmuEnablePciInstance (IoMmu, PciIo);
+  return TRUE;
+}
+
+/**
+  Find the described PCI IOMMUs that weren't at their location, by class, in every
+  enumerated function. Each IOMMU-class function is matched to the first such IOMMU
+  of its segment, whose location is corrected.
+
+  @param[in]  HandleCount   The number of PCI I/O handles.
+  @param[in]  HandleBuffer  The PCI I/O handles.
+
+  @retval  TRUE   An IOMMU was enabled.
+  @retval  FALSE  No IOMMU was found.
+
+**/
+STATIC
+BOOLEAN
+IoMmuScanPciInstances (
+  IN UINTN       HandleCount,
+  IN EFI_HANDLE  *HandleBuffer
+  )
+{
+  UINTN                 Index;
+  EFI_PCI_IO_PROTOCOL   *PciIo;
+  UINTN                 Seg;
+  UINTN                 Bus;
+  UINTN                 Dev;
+  UINTN                 Func;
+  UINT16                Rid;
+  RISCV_IOMMU_INSTANCE  *IoMmu;
+  BOOLEAN               Enabled;
+  EFI_STATUS            Status;
+
+  Enabled = FALSE;
+  for (Index = 0; Index < HandleCount; Index++) {
+    Status = gBS->HandleProtocol (HandleBuffer[Index], &gEfiPciIoProtocolGuid, (VOID **)&PciIo);
+    if (EFI_ERROR (Status)) {
+      continue;
+    }
+
+    Status = PciIo->GetLocation (PciIo, &Seg, &Bus, &Dev, &Func);
+    if (EFI_ERROR (Status)) {
+      continue;
+    }
+
+    Rid = (UINT16)((Bus << 8) | (Dev << 3) | Func);
+    if (IoMmuIsPciInstance ((UINT16)Seg, Rid) || !IoMmuIsPciIoMmuClass (HandleBuffer[Index], PciIo)) {
+      continue;
+    }
+
+    IoMmu = IoMmuFindPciInstance ((UINT16)Seg, MAX_UINT16);
+    if (IoMmu == NULL) {
+      DEBUG ((DEBUG_WARN, "%a: Ignoring undescribed IOMMU at %04x:%02x:%02x.%x\n", __func__, Seg, Bus, Dev, Func));
+      continue;
+    }
+
+    DEBUG ((DEBUG_WARN, "%a: The IOMMU described at %04x:%04x is at %04x:%04x\n", __func__, Seg, IoMmu->PciBdf, Seg, Rid));
+    IoMmu->PciBdf = Rid;
+    IoMmuEnablePciInstance (IoMmu, PciIo);
+    Enabled = TRUE;
+  }
+
+  return Enabled;
+}
+
+/**
+  PCI I/O Protocol notification event handler, for functions added after enumeration.
+
+  A hot-added IOMMU that the firmware tables describe is initialised, and the device
+  contexts of other functions are prepared.
+
+  @param[in] Event    Event whose notification function is being invoked.
+  @param[in] Context  Pointer to the notification function's context.
+**/
+STATIC
+VOID
+EFIAPI
+OnPciIoInstalled (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  EFI_HANDLE            Handle;
+  UINTN                 BufferSize;
+  EFI_PCI_IO_PROTOCOL   *PciIo;
+  UINTN                 Seg;
+  UINTN                 Bus;
+  UINTN                 Dev;
+  UINTN                 Func;
+  RISCV_IOMMU_INSTANCE  *IoMmu;
+  EFI_STATUS            Status;
+
+  while (TRUE) {
+    BufferSize = sizeof (Handle);
+    Status     = gBS->LocateHandle (ByRegisterNotify, NULL, mPciIoNotifyRegistration, &BufferSize, &Handle);
+    if (EFI_ERROR (Status)) {
+      return;
+    }
+
+    Status = gBS->HandleProtocol (Handle, &gEfiPciIoProtocolGuid, (VOID **)&PciIo);
+    if (EFI_ERROR (Status)) {
+      continue;
+    }
+
+    Status = PciIo->GetLocation (PciIo, &Seg, &Bus, &Dev, &Func);
+    if (EFI_ERROR (Status)) {
+      continue;
+    }
+
+    IoMmu = IoMmuFindPciInstance ((UINT16)Seg, (UINT16)((Bus << 8) | (Dev << 3) | Func));
+    if ((IoMmu != NULL) && IoMmuProbePciInstance (IoMmu, Handle, PciIo)) {
+      IoMmuCommonInitialise ();
+      continue;
+    }
+
+    if (mRiscVIoMmuGlobalDriverContext.DriverState >= STATE_INITIALISED) {
+      IoMmuPrepareDeviceContexts (1, &Handle);
+    }
+  }
+}
+
+/**
+  Find the IOMMU and domain of a PCI function, without creating the domain.
+
+  @param[in]   Handle  The PCI I/O handle of the function.
+  @param[out]  IoMmu   The IOMMU that the function is routed to.
+
+  @return  The domain of the function, or NULL if it has none.
+
+**/
+STATIC
+RISCV_IOMMU_DEVICE_DOMAIN *
+IoMmuFindPciDeviceDomain (
+  IN  EFI_HANDLE            Handle,
+  OUT RISCV_IOMMU_INSTANCE  **IoMmu
+  )
+{
+  RISCV_IOMMU_DEVICE_DOMAIN  *Domain;
+  EFI_PCI_IO_PROTOCOL        *PciIo;
+  UINTN                      Seg;
+  UINTN                      Bus;
+  UINTN                      Dev;
+  UINTN                      Func;
+  RISCV_IOMMU_DEVICE_ID      DeviceId;
+
+  Domain = IoMmuLookupDeviceCache (Handle, IoMmu);
+  if (Domain != NULL) {
+    return Domain;
+  }
+
+  if (EFI_ERROR (gBS->HandleProtocol (Handle, &gEfiPciIoProtocolGuid, (VOID **)&PciIo)) ||
+      EFI_ERROR (PciIo->GetLocation (PciIo, &Seg, &Bus, &Dev, &Func)))
+  {
+    return NULL;
+  }
+
+  *IoMmu = IoMmuRouteDevice (RISCV_IOMMU_PCI_ROUTING_DOMAIN (Seg), (UINT32)((Bus << 8) | (Dev << 3) | Func), &DeviceId, NULL);
+  if ((*IoMmu == NULL) || ((*IoMmu)->State != STATE_INITIALISED)) {
+    return NULL;
+  }
+
+  return IoMmuFindDeviceDomain (*IoMmu, DeviceId.Uint32);
+}
+
+/**
+  Wrap Notify() of the PCI hot-plug request protocol, to detach the domains of removed functions.
+
+  Added functions need nothing here, as their PCI I/O installation prepares their
+  device contexts one by one.
+
+  @param[in]      This                 The PCI hot-plug request protocol.
+  @param[in]      Operation            The operation the PCI bus driver is requested to make.
+  @param[in]      Controller           The handle of the hot-plug controller.
+  @param[in]      RemainingDevicePath  The remaining device path of the PCI devices.
+  @param[in, out] NumberOfChildren     The number of child handles.
+  @param[in, out] ChildHandleBuffer    The child handles.
+
+  @return  The status of the wrapped service.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+IoMmuPciHotPlugRequestNotify (
+  IN     EFI_PCI_HOTPLUG_REQUEST_PROTOCOL  *This,
+  IN     EFI_PCI_HOTPLUG_OPERATION         Operation,
+  IN     EFI_HANDLE                        Controller,
+  IN     EFI_DEVICE_PATH_PROTOCOL          *RemainingDevicePath OPTIONAL,
+  IN OUT UINT8                             *NumberOfChildren,
+  IN OUT EFI_HANDLE                        *ChildHandleBuffer
+  )
+{
+  RISCV_IOMMU_INSTANCE       **IoMmus;
+  RISCV_IOMMU_DEVICE_DOMAIN  **Domains;
+  UINTN                      Count;
+  UINTN                      Index;
+  EFI_STATUS                 Status;
+
+  if ((Operation != EfiPciHotplugRequestRemove) || (NumberOfChildren == NULL) ||
+      (*NumberOfChildren == 0) || (ChildHandleBuffer == NULL))
+  {
+    return mPciHotPlugRequestNotify (This, Operation, Controller, RemainingDevicePath, NumberOfChildren, ChildHandleBuffer);
+  }
+
+  //
+  // The functions can only be found before the PCI bus driver uninstalls their PCI I/O.
+  // Without the memory to remember them, their domains just stay attached.
+  //
+  Count   = *NumberOfChildren;
+  IoMmus  = AllocatePool (Count * sizeof (*IoMmus));
+  Domains = AllocatePool (Count * sizeof (*Domains));
+  if ((IoMmus != NULL) && (Domains != NULL)) {
+    for (Index = 0; Index < Count; Index++) {
+      Domains[Index] = IoMmuFindPciDeviceDomain (ChildHandleBuffer[Index], &IoMmus[Index]);
+    }
+  } else {
+    Count = 0;
+  }
+
+  Status = mPciHotPlugRequestNotify (This, Operation, Controller, RemainingDevicePath, NumberOfChildren, ChildHandleBuffer);
+  if (!EFI_ERROR (Status)) {
+    for (Index = 0; Index < Count; Index++) {
+      if (Domains[Index] != NULL) {
+        IoMmuDetachDeviceDomain (IoMmus[Index], Domains[Index]);
+      }
+    }
+  }
+
+  if (IoMmus != NULL) {
+    FreePool (IoMmus);
+  }
+
+  if (Domains != NULL) {
+    FreePool (Domains);
+  }
+
+  return Status;
+}
+
+/**
+  PCI hot-plug request Protocol notification event handler, which wraps its Notify().
+
+  The PCI bus driver produces the protocol once, if the platform supports hot-plug.
+
+  @param[in] Event    Event whose notification function is being invoked.
+  @param[in] Context  Pointer to the notification function's context.
+**/
+STATIC
+VOID
+EFIAPI
+OnPciHotPlugRequestInstalled (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  EFI_PCI_HOTPLUG_REQUEST_PROTOCOL  *HotPlugRequest;
+
+  if (EFI_ERROR (gBS->LocateProtocol (&gEfiPciHotPlugRequestProtocolGuid, NULL, (VOID **)&HotPlugRequest))) {
+    return;
+  }
+
+  mPciHotPlugRequestNotify = HotPlugRequest->Notify;
+  HotPlugRequest->Notify   = IoMmuPciHotPlugRequestNotify;
+  gBS->CloseEvent (Event);
+}
+
+/**
+  Prepare the device contexts of PCI functions, and handle the removal of functions,
+  once an IOMMU is initialised after PCI enumeration.
+
+  @param[in]  HandleCount   The number of PCI I/O handles.
+  @param[in]  HandleBuffer  The PCI I/O handles.
+
+**/
+STATIC
+VOID
+PreparePciDevices (
+  IN UINTN       HandleCount,
+  IN EFI_HANDLE  *HandleBuffer
+  )
+{
+  VOID  *Registration;
+
+  PERF_INMODULE_BEGIN ("RiscVIoMmuPrepareDevices");
+  IoMmuPrepareDeviceContexts (HandleCount, HandleBuffer);
+  PERF_INMODULE_END ("RiscVIoMmuPrepareDevices");
+
+  //
+  // Removed functions release their domains' page tables.
+  //
+  EfiCreateProtocolNotifyEvent (
+    &gEfiPciHotPlugRequestProtocolGuid,
+    TPL_CALLBACK,
+    OnPciHotPlugRequestInstalled,
+    NULL,
+    &Registration
+    );
+}
+
+/**
+  Prepare the device contexts of all PCI functions, and handle their removal,
+  if PCI enumeration already completed.
+
+  Called once an IOMMU is initialised after enumeration.
+
+**/
+VOID
+IoMmuPreparePciDevices (
+  VOID
+  )
+{
+  UINTN       HandleCount;
+  EFI_HANDLE  *HandleBuffer;
+
+  //
+  // Otherwise, the end of enumeration prepares them.
+  //
+  if (mPciIoNotifyEvent == NULL) {
+    return;
+  }
+
+  if (EFI_ERROR (gBS->LocateHandleBuffer (ByProtocol, &gEfiPciIoProtocolGuid, NULL, &HandleCount, &HandleBuffer))) {
+    return;
+  }
+
+  PreparePciDevices (HandleCount, HandleBuffer);
+  FreePool (HandleBuffer);
+}
+
+/**
+  PciEnumerationComplete Protocol notification event handler.
+
+  The PCI IOMMUs are located at the BDFs that the firmware tables give, so only
+  their config space is read. Only if one isn't there are all functions scanned
+  for the IOMMU class.
+
+  @param[in] Event    Event whose notification function is being invoked.
+  @param[in] Context  Pointer to the notification function's context.
+**/
+STATIC
+VOID
+EFIAPI
+OnPciEnumerationComplete (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  VOID                   *Interface;
+  EFI_STATUS             Status;
+  UINTN                  HandleCount;
+  EFI_HANDLE             *HandleBuffer;
+  UINTN                  Index;
+  EFI_PCI_IO_PROTOCOL    *PciIo;
+  UINTN                  Seg;
+  UINTN                  Bus;
+  UINTN                  Dev;
+  UINTN                  Func;
+  UINT16                 Rid;
+  RISCV_IOMMU_DEVICE_ID  DeviceId;
+  RISCV_IOMMU_INSTANCE   *IoMmu;
+  BOOLEAN                Enabled;
+  BOOLEAN                Missing;
+  LIST_ENTRY             *Link;
+
+  //
+  // Try to locate it because gEfiPciEnumerationCompleteProtocolGuid will trigger it once when registration.
+  // Just return if it is not found.
+  //
+  Status = gBS->LocateProtocol (&gEfiPciEnumerationCompleteProtocolGuid, NULL, &Interface);
+  if (EFI_ERROR (Status)) {
+    return;
+  }
+
+  PERF_INMODULE_BEGIN ("RiscVIoMmuPciDiscovery");
+  Status = gBS->LocateHandleBuffer (ByProtocol, &gEfiPciIoProtocolGuid, NULL, &HandleCount, &HandleBuffer);
+  ASSERT_EFI_ERROR (Status);
+
+  Enabled = FALSE;
+  for (Index = 0; Index < HandleCount; Index++) {
+    Status = gBS->HandleProtocol (HandleBuffer[Index], &gEfiPciIoProtocolGuid, (VOID **)&PciIo);
+    ASSERT_EFI_ERROR (Status);
+
+    Status = PciIo->GetLocation (PciIo, &Seg, &Bus, &Dev, &Func);
+    if (EFI_ERROR (Status)) {
+      continue;
+    }
+
+    Rid = (UINT16)((Bus << 8) | (Dev << 3) | Func);
+
+    //
+    // Enumeration is complete, so size the device directory of the owning IOMMU for the functions that are present.
+    //
+    IoMmu = IoMmuRouteDevice (RISCV_IOMMU_PCI_ROUTING_DOMAIN (Seg), Rid, &DeviceId, NULL);
+    if ((IoMmu != NULL) && (DeviceId.Uint32 > IoMmu->DeviceContext.MaxDeviceId)) {
+      IoMmu->DeviceContext.MaxDeviceId = DeviceId.Uint32;
+    }
+
+    IoMmu = IoMmuFindPciInstance ((UINT16)Seg, Rid);
+    if ((IoMmu != NULL) && IoMmuProbePciInstance (IoMmu, HandleBuffer[Index], PciIo)) {
+      Enabled = TRUE;
+    }
+  }
+
+  //
+  // Bus numbers may be assigned differently than the firmware tables expected.
+  //
+  Missing = FALSE;
+  for (Link = GetFirstNode (&mRiscVIoMmuGlobalDriverContext.InstanceList)
+       ; !IsNull (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ; Link = GetNextNode (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ) {
+    IoMmu   = RISCV_IOMMU_INSTANCE_FROM_LINK (Link);
+    Missing = Missing || (IoMmu->IoMmuIsPciDevice && (IoMmu->State == STATE_DETECTED) && (IoMmu->Address == 0));
+  }
+
+  if (Missing && IoMmuScanPciInstances (HandleCount, HandleBuffer)) {
+    Enabled = TRUE;
+  }
+
+  PERF_INMODULE_END ("RiscVIoMmuPciDiscovery");
+
+  //
+  // With deferred initialisation, the IOMMUs are only started, and prepare the functions once complete.
+  //
+  if (Enabled) {
+    IoMmuCommonInitialise ();
+  }
+
+  if (mRiscVIoMmuGlobalDriverContext.DriverState >= STATE_INITIALISED) {
+    PreparePciDevices (HandleCount, HandleBuffer);
+  }
+
+  FreePool (HandleBuffer);
+  gBS->CloseEvent (Event);
+
+  //
+  // Functions added from here on, such as hot-plugged IOMMUs, are handled one by one.
+  //
+  mPciIoNotifyEvent = EfiCreateProtocolNotifyEvent (
+                        &gEfiPciIoProtocolGuid,
+                        TPL_CALLBACK,
+                        OnPciIoInstalled,
+                        NULL,
+                        &mPciIoNotifyRegistration
+                        );
+  ASSERT (mPciIoNotifyEvent != NULL);
+}
+
+/**
+  Determine the PCI segment of a PCI host bridge node.
+
+  @param[in]  Fdt   The devicetree.
+  @param[in]  Node  The node of the host bridge.
+
+  @return  The segment from `linux,pci-domain`, or 0 if absent.
+
+**/
+STATIC
+UINT16
+IoMmuDeviceTreeGetPciSegment (
+  IN VOID   *Fdt,
+  IN INT32  Node
+  )
+{
+  INT32   TempLen;
+  UINT32  *Data32;
+
+  Data32 = (UINT32 *)FdtGetProp (Fdt, Node, "linux,pci-domain", &TempLen);
+  if ((Data32 == NULL) || (TempLen < 0) || ((UINT32)TempLen < sizeof (UINT32))) {
+    return 0;
+  }
+
+  return (UINT16)Fdt32ToCpu (ReadUnaligned32 (Data32));
+}
 
 /**
-  PciEnumerationComplete Protocol notification event handler.
+  Determine whether an IOMMU's memory accesses are not coherent with the harts' caches.
+
+  As on RISC-V operating systems, DMA is coherent unless `dma-noncoherent` says otherwise.
+  The nearest node of the IOMMU and its ancestors with either property decides.
+
+  @param[in]  Fdt   The devicetree.
+  @param[in]  Node  The node of the IOMMU.
+
+  @retval  TRUE   The IOMMU doesn't snoop the caches.
+  @retval  FALSE  The IOMMU is coherent.
+
+**/
+STATIC
+BOOLEAN
+IoMmuDeviceTreeIsNonCoherent (
+  IN VOID   *Fdt,
+  IN INT32  Node
+  )
+{
+  for ( ; Node >= 0; Node = FdtParentOffset (Fdt, Node)) {
+    if (FdtGetProp (Fdt, Node, "dma-noncoherent", NULL) != NULL) {
+      return TRUE;
+    }
+
+    if (FdtGetProp (Fdt, Node, "dma-coherent", NULL) != NULL) {
+      return FALSE;
+    }
+  }
+
+  return FALSE;
+}
+
+/**
+  Record the proximity domain of an IOMMU, from the numa-node-id of its node or of
+  the nearest bus above it.
+
+  @param[in]  Fdt    The devicetree.
+  @param[in]  Node   The node of the IOMMU.
+  @param[in]  IoMmu  The IOMMU.
 
-  @param[in] Event    Event whose notification function is being invoked.
-  @param[in] Context  Pointer to the notification function's context.
 **/
 STATIC
 VOID
-EFIAPI
-OnPciEnumerationComplete (
-  IN EFI_EVENT  Event,
-  IN VOID       *Context
+IoMmuDeviceTreeGetProximityDomain (
+  IN VOID                  *Fdt,
+  IN INT32                 Node,
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
   )
 {
-  VOID                               *Interface;
-  EFI_STATUS                         Status;
-  UINTN                              HandleCount;
-  EFI_HANDLE                         *HandleBuffer;
-  UINTN                              Index;
-  EFI_PCI_IO_PROTOCOL                *PciIo;
-  PCI_TYPE00                         Pci;
-  UINT16                             Data;
-  EFI_ACPI_ADDRESS_SPACE_DESCRIPTOR  *Descriptor;
+  CONST UINT32  *Data32;
+  INT32         TempLen;
+
+  for ( ; Node >= 0; Node = FdtParentOffset (Fdt, Node)) {
+    Data32 = (CONST UINT32 *)FdtGetProp (Fdt, Node, "numa-node-id", &TempLen);
+    if ((Data32 != NULL) && (TempLen == sizeof (UINT32))) {
+      IoMmu->HasProximityDomain = TRUE;
+      IoMmu->ProximityDomain    = Fdt32ToCpu (ReadUnaligned32 (Data32));
+      return;
+    }
+  }
+}
+
+/**
+  Record how an IOMMU's interrupts are connected, from its devicetree node.
+
+  Only `interrupts` is decoded, with the `#interrupt-cells` of the nearest
+  `interrupt-parent`. `interrupts-extended` is counted as one wire per phandle
+  and two cells, which is the common layout for APLIC and PLIC parents.
+
+  @param[in]  Fdt    The devicetree.
+  @param[in]  Node   The node of the IOMMU.
+  @param[in]  IoMmu  The IOMMU.
+
+**/
+STATIC
+VOID
+IoMmuDeviceTreeGetInterrupts (
+  IN VOID                  *Fdt,
+  IN INT32                 Node,
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  INT32   TempLen;
+  INT32   ParentNode;
+  UINT32  *Data32;
+  UINT32  InterruptCells;
+
+  IoMmu->HasMsiParent = FdtGetProp (Fdt, Node, "msi-parent", &TempLen) != NULL;
+
+  Data32 = (UINT32 *)FdtGetProp (Fdt, Node, "interrupts-extended", &TempLen);
+  if (Data32 != NULL) {
+    IoMmu->NumberOfInterruptWires = (UINT8)MIN (TempLen / (3 * sizeof (UINT32)), RISCV_IOMMU_MSI_CFG_TBL_ENTRIES);
+    return;
+  }
+
+  if (FdtGetProp (Fdt, Node, "interrupts", &TempLen) == NULL) {
+    return;
+  }
 
   //
-  // Try to locate it because gEfiPciEnumerationCompleteProtocolGuid will trigger it once when registration.
-  // Just return if it is not found.
+  // The interrupt parent may be inherited from an ancestor.
   //
-  Status = gBS->LocateProtocol (&gEfiPciEnumerationCompleteProtocolGuid, NULL, &Interface);
-  if (EFI_ERROR (Status)) {
-    return;
+  for (ParentNode = Node; ParentNode >= 0; ParentNode = FdtParentOffset (Fdt, ParentNode)) {
+    Data32 = (UINT32 *)FdtGetProp (Fdt, ParentNode, "interrupt-parent", NULL);
+    if (Data32 != NULL) {
+      break;
+    }
+  }
+
+  InterruptCells = 1;
+  if (Data32 != NULL) {
+    ParentNode = FdtNodeOffsetByPhandle (Fdt, Fdt32ToCpu (ReadUnaligned32 (Data32)));
+    Data32     = (ParentNode >= 0) ? (UINT32 *)FdtGetProp (Fdt, ParentNode, "#interrupt-cells", NULL) : NULL;
+    if ((Data32 != NULL) && (Fdt32ToCpu (ReadUnaligned32 (Data32)) != 0)) {
+      InterruptCells = Fdt32ToCpu (ReadUnaligned32 (Data32));
+    }
+  }
+
+  IoMmu->NumberOfInterruptWires = (UINT8)MIN (TempLen / (InterruptCells * sizeof (UINT32)), RISCV_IOMMU_MSI_CFG_TBL_ENTRIES);
+}
+
+/**
+  Find the IOMMU that devicetree nodes reference by a phandle.
+
+  @param[in]  Phandle  The phandle.
+
+  @return  The IOMMU, or NULL if no IOMMU has the phandle.
+
+**/
+STATIC
+RISCV_IOMMU_INSTANCE *
+IoMmuFindDeviceTreeInstance (
+  IN UINT32  Phandle
+  )
+{
+  LIST_ENTRY            *Link;
+  RISCV_IOMMU_INSTANCE  *IoMmu;
+
+  for (Link = GetFirstNode (&mRiscVIoMmuGlobalDriverContext.InstanceList)
+       ; !IsNull (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link) && (Phandle != 0)
+       ; Link = GetNextNode (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ) {
+    IoMmu = RISCV_IOMMU_INSTANCE_FROM_LINK (Link);
+    if (IoMmu->DeviceTreePhandle == Phandle) {
+      return IoMmu;
+    }
   }
 
+  return NULL;
+}
+
+/**
+  Record the regions of `/reserved-memory` that a devicetree node references by its
+  `memory-region`, for a device_id of the node.
+
+  @param[in]  Fdt       The devicetree.
+  @param[in]  Node      The node.
+  @param[in]  IoMmu     The IOMMU that translates the node's device.
+  @param[in]  DeviceId  The device_id.
+
+**/
+STATIC
+VOID
+IoMmuDeviceTreeScanReservedRegions (
+  IN VOID                  *Fdt,
+  IN INT32                 Node,
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT32                DeviceId
+  )
+{
+  INT32   TempLen;
+  INT32   RegLen;
+  INT32   RegionNode;
+  UINT32  *Phandles;
+  UINT64  *Reg;
+  UINTN   Index;
+  UINTN   RegIndex;
+
   //
-  // Iterate all PCI devices, looking for one with base class
-  // PCI_CLASS_SYSTEM_PERIPHERAL; sub-class 06h; programming interface 00h.
+  // memory-region = <region-phandle>, ...
+  // Each region's `reg` is <base size>, ..., with two cells each.
   //
-  Status = gBS->LocateHandleBuffer (ByProtocol, &gEfiPciIoProtocolGuid, NULL, &HandleCount, &HandleBuffer);
-  ASSERT_EFI_ERROR (Status);
+  Phandles = (UINT32 *)FdtGetProp (Fdt, Node, "memory-region", &TempLen);
+  for (Index = 0; (Phandles != NULL) && (Index < TempLen / sizeof (UINT32)); Index++) {
+    RegionNode = FdtNodeOffsetByPhandle (Fdt, Fdt32ToCpu (ReadUnaligned32 (&Phandles[Index])));
+    if (RegionNode < 0) {
+      continue;
+    }
 
-  for (Index = 0; Index < HandleCount; Index++) {
-    Status = gBS->HandleProtocol (HandleBuffer[Index], &gEfiPciIoProtocolGuid, (VOID **)&PciIo);
-    ASSERT_EFI_ERROR (Status);
+    Reg = (UINT64 *)FdtGetProp (Fdt, RegionNode, "reg", &RegLen);
+    for (RegIndex = 0; (Reg != NULL) && (RegIndex + 2 <= RegLen / sizeof (UINT64)); RegIndex += 2) {
+      IoMmuAddReservedRegion (
+        IoMmu,
+        DeviceId,
+        Fdt64ToCpu (ReadUnaligned64 (&Reg[RegIndex])),
+        Fdt64ToCpu (ReadUnaligned64 (&Reg[RegIndex + 1]))
+        );
+    }
+  }
+}
+
+/**
+  Route the device_ids to the IOMMUs of the devicetree, from every `iommu-map`,
+  `iommu-map-mask` and `iommus` property that references one, and record the reserved
+  regions of the nodes with `iommus`.
+
+  The tree is walked once, after all IOMMUs are found, so no device lookup walks it again.
+
+  @param[in]  Fdt  The devicetree.
+
+**/
+STATIC
+VOID
+IoMmuDeviceTreeScanDeviceIds (
+  IN VOID  *Fdt
+  )
+{
+  INT32                 Node;
+  INT32                 TempLen;
+  INT32                 RegLen;
+  UINT32                *Data32;
+  UINT64                *Reg;
+  UINTN                 Index;
+  UINT32                Domain;
+  UINT32                Mask;
+  UINT32                Flags;
+  UINT32                DeviceIdBase;
+  UINT32                NumberOfIds;
+  RISCV_IOMMU_INSTANCE  *IoMmu;
 
+  for (Node = FdtNextNode (Fdt, 0, NULL); Node >= 0; Node = FdtNextNode (Fdt, Node, NULL)) {
     //
-    // Read the basics of the PCI config space.
+    // iommu-map = <rid-base iommu-phandle iommu-base length>, ...
+    // The mask of a host bridge applies to its RIDs before they are mapped,
+    // and `ats-supported` marks a host bridge that forwards ATS requests.
     //
-    Status = PciIo->Pci.Read (PciIo, EfiPciIoWidthUint32, 0, sizeof (Pci) / sizeof (UINT32), &Pci);
-    ASSERT_EFI_ERROR (Status);
+    Mask   = MAX_UINT32;
+    Data32 = (UINT32 *)FdtGetProp (Fdt, Node, "iommu-map-mask", &TempLen);
+    if ((Data32 != NULL) && (TempLen >= 0) && ((UINT32)TempLen >= sizeof (UINT32))) {
+      Mask = Fdt32ToCpu (ReadUnaligned32 (Data32));
+    }
 
-    if (IS_CLASS3 (&Pci, PCI_CLASS_SYSTEM_PERIPHERAL, 0x06, 0x00)) {
-      mRiscVIoMmuGlobalDriverContext.DriverState  = STATE_AVAILABLE;
+    Data32 = (UINT32 *)FdtGetProp (Fdt, Node, "iommu-map", &TempLen);
+    if (Data32 != NULL) {
+      Domain = RISCV_IOMMU_PCI_ROUTING_DOMAIN (IoMmuDeviceTreeGetPciSegment (Fdt, Node));
+      Flags  = (FdtGetProp (Fdt, Node, "ats-supported", NULL) != NULL) ? RISCV_IOMMU_ROUTE_ATS_SUPPORTED : 0;
+      for (Index = 0; Index + 4 <= TempLen / sizeof (UINT32); Index += 4) {
+        IoMmu        = IoMmuFindDeviceTreeInstance (Fdt32ToCpu (ReadUnaligned32 (&Data32[Index + 1])));
+        DeviceIdBase = Fdt32ToCpu (ReadUnaligned32 (&Data32[Index + 2]));
+        NumberOfIds  = Fdt32ToCpu (ReadUnaligned32 (&Data32[Index + 3]));
+        if ((IoMmu == NULL) || (NumberOfIds == 0)) {
+          continue;
+        }
 
-      // Also enable DMA to satisfy MSIs, etc.
-      Data   = EFI_PCI_COMMAND_BUS_MASTER | EFI_PCI_COMMAND_MEMORY_SPACE;
-      Status = PciIo->Pci.Write (PciIo, EfiPciIoWidthUint16, PCI_COMMAND_OFFSET, 1, (VOID *)&Data);
-      ASSERT_EFI_ERROR (Status);
+        IoMmu->DeviceContext.MaxDeviceId = MAX (IoMmu->DeviceContext.MaxDeviceId, DeviceIdBase + NumberOfIds - 1);
+        IoMmuAddRoute (
+          IoMmu,
+          Domain,
+          Fdt32ToCpu (ReadUnaligned32 (&Data32[Index])),
+          NumberOfIds,
+          DeviceIdBase,
+          Mask,
+          Flags
+          );
+      }
+    }
 
-      Status = PciIo->GetBarAttributes (PciIo, 0, NULL, (VOID **)&Descriptor);
-      ASSERT ((Status == EFI_SUCCESS) && (Descriptor->ResType == ACPI_ADDRESS_SPACE_TYPE_MEM));
+    //
+    // iommus = <iommu-phandle device-id>, ... (#iommu-cells is 1)
+    // Each entry of a platform device is a source ID within its node, and
+    // the device is identified by the base of its first register region.
+    //
+    Data32 = (UINT32 *)FdtGetProp (Fdt, Node, "iommus", &TempLen);
+    if (Data32 != NULL) {
+      Reg = (UINT64 *)FdtGetProp (Fdt, Node, "reg", &RegLen);
+      if ((Reg != NULL) && (RegLen >= 0) && ((UINT32)RegLen >= sizeof (UINT64))) {
+        IoMmuAddPlatformDevice (Fdt64ToCpu (ReadUnaligned64 (Reg)), RISCV_IOMMU_PLATFORM_ROUTING_DOMAIN (Node));
+      }
 
-      mRiscVIoMmuGlobalDriverContext.Address = Descriptor->AddrRangeMin;
-      ASSERT (Descriptor->AddrLen == SIZE_4KB);
-      FreePool (Descriptor);
+      for (Index = 0; Index + 2 <= TempLen / sizeof (UINT32); Index += 2) {
+        IoMmu = IoMmuFindDeviceTreeInstance (Fdt32ToCpu (ReadUnaligned32 (&Data32[Index])));
+        if (IoMmu == NULL) {
+          continue;
+        }
 
-      IoMmuCommonInitialise ();
-      break;
+        DeviceIdBase                     = Fdt32ToCpu (ReadUnaligned32 (&Data32[Index + 1]));
+        IoMmu->DeviceContext.MaxDeviceId = MAX (IoMmu->DeviceContext.MaxDeviceId, DeviceIdBase);
+        IoMmuAddRoute (
+          IoMmu,
+          RISCV_IOMMU_PLATFORM_ROUTING_DOMAIN (Node),
+          (UINT32)(Index / 2),
+          1,
+          DeviceIdBase,
+          MAX_UINT32,
+          0
+          );
+        IoMmuDeviceTreeScanReservedRegions (Fdt, Node, IoMmu, DeviceIdBase);
+      }
     }
   }
-
-  FreePool (HandleBuffer);
-
-  gBS->CloseEvent (Event);
 }
 
 /**
-  Search the devicetree for an IOMMU.
+  Search the devicetree for IOMMUs.
 
-  @retval  EFI_SUCCESS    A system IOMMU was detected.
-  @retval  EFI_NOT_FOUND  No system IOMMUs were detected.
+  @retval  EFI_SUCCESS    At least one IOMMU was detected.
+  @retval  EFI_NOT_FOUND  No IOMMUs were detected.
 
 **/
 STATIC
@@ -112,75 +1115,204 @@ IoMmuDeviceTreeDiscovery (
   VOID
   )
 {
-  VOID        *Fdt;
-  EFI_STATUS  Status;
-  INT32       IoMmuNode;
-  INT32       TempLen;
-  UINT64      *Data64;
-  UINT64      StartAddress;
-  UINT64      NumberOfBytes;
-  VOID        *Registration;
-  EFI_EVENT   ProtocolNotifyEvent;
+  VOID                  *Fdt;
+  EFI_STATUS            Status;
+  INT32                 IoMmuNode;
+  INT32                 TempLen;
+  UINT64                *Data64;
+  UINT64                StartAddress;
+  UINT64                NumberOfBytes;
+  RISCV_IOMMU_INSTANCE  *IoMmu;
+  BOOLEAN               Found;
 
   Status = EfiGetSystemConfigurationTable (&gFdtTableGuid, &Fdt);
   ASSERT_EFI_ERROR (Status);
 
   //
-  // Search for a system IOMMU-compatible node and get its address.
+  // Search for every system IOMMU-compatible node and get its address.
   //
-  IoMmuNode = FdtNodeOffsetByCompatible (Fdt, -1, "riscv,iommu");
-  if (IoMmuNode != -FDT_ERR_NOTFOUND) {
+  Found = FALSE;
+  for (IoMmuNode = FdtNodeOffsetByCompatible (Fdt, -1, "riscv,iommu")
+       ; IoMmuNode >= 0
+       ; IoMmuNode = FdtNodeOffsetByCompatible (Fdt, IoMmuNode, "riscv,iommu")
+       ) {
     // TODO: `TempLen` is great enough. Effectively, an #address-cells and #size-cells check.
     Data64 = (UINT64 *)FdtGetProp (Fdt, IoMmuNode, "reg", &TempLen);
     ASSERT (Data64 != NULL);
 
     StartAddress  = Fdt64ToCpu (ReadUnaligned64 (Data64));
     NumberOfBytes = Fdt64ToCpu (ReadUnaligned64 (Data64 + 1));
-
-    mRiscVIoMmuGlobalDriverContext.DriverState      = STATE_AVAILABLE;
-    mRiscVIoMmuGlobalDriverContext.IoMmuIsPciDevice = FALSE;
-    mRiscVIoMmuGlobalDriverContext.Address          = StartAddress;
     ASSERT (NumberOfBytes == SIZE_4KB);
 
-    return EFI_SUCCESS;
+    IoMmu = IoMmuCreateInstance (FALSE, StartAddress, STATE_AVAILABLE);
+    if (IoMmu == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    IoMmu->DeviceTreePhandle = FdtGetPhandle (Fdt, IoMmuNode);
+    IoMmu->NonCoherent       = IoMmuDeviceTreeIsNonCoherent (Fdt, IoMmuNode);
+    Found                    = TRUE;
+    IoMmuDeviceTreeGetInterrupts (Fdt, IoMmuNode, IoMmu);
+    IoMmuDeviceTreeGetProximityDomain (Fdt, IoMmuNode, IoMmu);
   }
 
   //
-  // Search for a PCI IOMMU-compatible node and get its BDF, then register a callback for enumeration.
+  // Search for every PCI IOMMU-compatible node and get its BDF, to be found after enumeration.
   //
-  IoMmuNode = FdtNodeOffsetByCompatible (Fdt, -1, "riscv,pci-iommu");
-  if (IoMmuNode != -FDT_ERR_NOTFOUND) {
+  for (IoMmuNode = FdtNodeOffsetByCompatible (Fdt, -1, "riscv,pci-iommu")
+       ; IoMmuNode >= 0
+       ; IoMmuNode = FdtNodeOffsetByCompatible (Fdt, IoMmuNode, "riscv,pci-iommu")
+       ) {
     // TODO: `TempLen` is great enough. Effectively, an #address-cells and #size-cells check.
     Data64 = (UINT64 *)FdtGetProp (Fdt, IoMmuNode, "reg", &TempLen);
     ASSERT (Data64 != NULL);
 
-    mRiscVIoMmuGlobalDriverContext.DriverState      = STATE_DETECTED;
-    mRiscVIoMmuGlobalDriverContext.IoMmuIsPciDevice = TRUE;
-    mRiscVIoMmuGlobalDriverContext.Address          = Fdt32ToCpu (ReadUnaligned32 ((UINT32 *)Data64));
+    IoMmu = IoMmuCreateInstance (TRUE, 0, STATE_DETECTED);
+    if (IoMmu == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    //
+    // The first cell of a PCI address holds the bus, device and function numbers in bits 23:8.
+    //
+    IoMmu->PciSegment        = IoMmuDeviceTreeGetPciSegment (Fdt, FdtParentOffset (Fdt, IoMmuNode));
+    IoMmu->PciBdf            = (UINT16)(Fdt32ToCpu (ReadUnaligned32 ((UINT32 *)Data64)) >> 8);
+    IoMmu->DeviceTreePhandle = FdtGetPhandle (Fdt, IoMmuNode);
+    IoMmu->NonCoherent       = IoMmuDeviceTreeIsNonCoherent (Fdt, IoMmuNode);
+    Found                    = TRUE;
+    IoMmuDeviceTreeGetInterrupts (Fdt, IoMmuNode, IoMmu);
+    IoMmuDeviceTreeGetProximityDomain (Fdt, IoMmuNode, IoMmu);
+  }
+
+  if (!Found) {
+    return EFI_NOT_FOUND;
+  }
+
+  IoMmuDeviceTreeScanDeviceIds (Fdt);
+  return EFI_SUCCESS;
+}
+
+/**
+  Record the device_ids and PCI requester IDs that the RIMT routes to an IOMMU,
+  from the ID mapping intervals of the RIMT's model.
+
+  @param[in]  RimtInfo    The model of the RIMT.
+  @param[in]  IoMmuIndex  The index of the IOMMU in the model.
+  @param[in]  IoMmu       The IOMMU.
+
+**/
+STATIC
+VOID
+IoMmuAcpiRimtScanDeviceIds (
+  IN CONST RISCV_RIMT_INFO  *RimtInfo,
+  IN UINT32                 IoMmuIndex,
+  IN RISCV_IOMMU_INSTANCE   *IoMmu
+  )
+{
+  CONST RISCV_RIMT_ID_MAPPING  *IdMapping;
+  UINT32                       Index;
+  UINT32                       MaxDeviceId;
+  UINT32                       Domain;
+  UINT32                       Flags;
+
+  MaxDeviceId = IoMmu->DeviceContext.MaxDeviceId;
+  IdMapping   = RISCV_RIMT_INFO_ID_MAPPINGS (RimtInfo);
+  for (Index = 0; Index < RimtInfo->NumberOfIdMappings; Index++, IdMapping++) {
+    if (IdMapping->IoMmuIndex != IoMmuIndex) {
+      continue;
+    }
+
+    MaxDeviceId = MAX (MaxDeviceId, IdMapping->DeviceIdBase + IdMapping->NumberOfIds - 1);
 
     //
-    // The FDT merely provides the BDF (and device references to the IOMMU), now scan for the device.
+    // The source IDs of a root complex are PCI requester IDs. Those of a platform
+    // device are only unique within its node.
     //
-    ProtocolNotifyEvent = EfiCreateProtocolNotifyEvent (
-                            &gEfiPciEnumerationCompleteProtocolGuid,
-                            TPL_CALLBACK,
-                            OnPciEnumerationComplete,
-                            NULL,
-                            &Registration
-                            );
-    ASSERT (ProtocolNotifyEvent != NULL);
+    Flags = 0;
+    if (IdMapping->SourceType == RISCV_RIMT_SOURCE_PCIE_ROOT_COMPLEX) {
+      Domain = RISCV_IOMMU_PCI_ROUTING_DOMAIN (IdMapping->PcieSegment);
+      if ((IdMapping->SourceFlags & PCIE_NODE_FLAG_ATS_SUPPORT) != 0) {
+        Flags |= RISCV_IOMMU_ROUTE_ATS_SUPPORTED;
+      }
+
+      if ((IdMapping->SourceFlags & PCIE_NODE_FLAG_PRI_SUPPORT) != 0) {
+        Flags |= RISCV_IOMMU_ROUTE_PRI_SUPPORTED;
+      }
+    } else {
+      Domain = RISCV_IOMMU_PLATFORM_ROUTING_DOMAIN (IdMapping->SourceNodeOffset);
+    }
+
+    IoMmuAddRoute (
+      IoMmu,
+      Domain,
+      IdMapping->SourceIdBase,
+      IdMapping->NumberOfIds,
+      IdMapping->DeviceIdBase,
+      MAX_UINT32,
+      Flags
+      );
+  }
+
+  IoMmu->DeviceContext.MaxDeviceId = MaxDeviceId;
+}
+
+/**
+  Get the model of the RIMT: from the HOB of an earlier phase that parsed it, or
+  by validating ACPI's RIMT.
+
+  @param[out]  RimtInfo   The model.
+  @param[out]  Allocated  Whether the model was allocated, and must be freed.
+
+  @retval  EFI_SUCCESS    The model was found.
+  @retval  EFI_NOT_FOUND  There is no RIMT, or it is malformed.
+
+**/
+STATIC
+EFI_STATUS
+IoMmuGetRimtInfo (
+  OUT CONST RISCV_RIMT_INFO  **RimtInfo,
+  OUT BOOLEAN                *Allocated
+  )
+{
+  EFI_HOB_GUID_TYPE  *GuidHob;
+  VOID               *AcpiRimtTable;
+  RISCV_RIMT_INFO    *Info;
+  EFI_STATUS         Status;
+
+  *Allocated = FALSE;
+
+  GuidHob = GetFirstGuidHob (&gRiscVRimtInfoHobGuid);
+  if (GuidHob != NULL) {
+    if (RiscVRimtIsValidInfo (GET_GUID_HOB_DATA (GuidHob), GET_GUID_HOB_DATA_SIZE (GuidHob))) {
+      *RimtInfo = GET_GUID_HOB_DATA (GuidHob);
+      return EFI_SUCCESS;
+    }
 
-    return EFI_SUCCESS;
+    DEBUG ((DEBUG_ERROR, "%a: Ignoring the malformed RIMT HOB\n", __func__));
   }
 
-  return EFI_NOT_FOUND;
+  AcpiRimtTable = EfiLocateFirstAcpiTable (EFI_ACPI_RISCV_IO_MAPPING_TABLE_SIGNATURE);
+  if (AcpiRimtTable == NULL) {
+    return EFI_NOT_FOUND;
+  }
+
+  Status = RiscVRimtParse (AcpiRimtTable, &Info);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "%a: Ignoring the RIMT: %r\n", __func__, Status));
+    return EFI_NOT_FOUND;
+  }
+
+  *RimtInfo  = Info;
+  *Allocated = TRUE;
+  return EFI_SUCCESS;
 }
 
 /**
-  Search ACPI's RIMT for an IOMMU.
+  Search ACPI's RIMT for IOMMUs.
 
-  @retval  EFI_SUCCESS    A system IOMMU was detected.
-  @retval  EFI_NOT_FOUND  No system IOMMUs were detected.
+  @retval  EFI_SUCCESS           At least one IOMMU was detected.
+  @retval  EFI_NOT_FOUND         No IOMMUs were detected.
+  @retval  EFI_OUT_OF_RESOURCES  An instance couldn't be allocated.
 
 **/
 STATIC
@@ -189,42 +1321,179 @@ IoMmuAcpiRimtDiscovery (
   VOID
   )
 {
-  EFI_ACPI_RIMT_HEADER  *AcpiRimtTable;
-  RIMT_NODE_HEADER      *RimtNodeHeader;
-  UINTN                 Index;
-  RIMT_IOMMU_NODE       *RimtIoMmuNode;
+  CONST RISCV_RIMT_INFO   *RimtInfo;
+  CONST RISCV_RIMT_IOMMU  *RimtIoMmu;
+  RISCV_IOMMU_INSTANCE    *IoMmu;
+  BOOLEAN                 Allocated;
+  UINT32                  Index;
+  EFI_STATUS              Status;
 
-  AcpiRimtTable = (VOID *)EfiLocateFirstAcpiTable (EFI_ACPI_RISCV_IO_MAPPING_TABLE_SIGNATURE);
-  if (AcpiRimtTable == NULL) {
-    return EFI_NOT_FOUND;
+  Status = IoMmuGetRimtInfo (&RimtInfo, &Allocated);
+  if (EFI_ERROR (Status)) {
+    return Status;
   }
 
-  RimtNodeHeader = (VOID *)((UINT8 *)AcpiRimtTable + AcpiRimtTable->OffsetToNodeArray);
-  for (Index = 0; Index < AcpiRimtTable->NumberOfNodes; Index++) {
-    if (RimtNodeHeader->Type == RISCV_IOMMU_NODE_TYPE) {
-      RimtIoMmuNode = (VOID *)RimtNodeHeader;
-      if (RimtIoMmuNode->Flags & IOMMU_NODE_FLAG_PCIE_DEVICE) {
-        mRiscVIoMmuGlobalDriverContext.DriverState      = STATE_DETECTED;
-        mRiscVIoMmuGlobalDriverContext.IoMmuIsPciDevice = TRUE;
-        mRiscVIoMmuGlobalDriverContext.Address          = RimtIoMmuNode->PcieBdf;
-      } else {
-        mRiscVIoMmuGlobalDriverContext.DriverState      = STATE_AVAILABLE;
-        mRiscVIoMmuGlobalDriverContext.IoMmuIsPciDevice = FALSE;
-        mRiscVIoMmuGlobalDriverContext.Address          = RimtIoMmuNode->BaseAddress;
+  Status    = (RimtInfo->NumberOfIoMmus != 0) ? EFI_SUCCESS : EFI_NOT_FOUND;
+  RimtIoMmu = RISCV_RIMT_INFO_IOMMUS (RimtInfo);
+  for (Index = 0; Index < RimtInfo->NumberOfIoMmus; Index++, RimtIoMmu++) {
+    if ((RimtIoMmu->Flags & IOMMU_NODE_FLAG_PCIE_DEVICE) != 0) {
+      IoMmu = IoMmuCreateInstance (TRUE, 0, STATE_DETECTED);
+      if (IoMmu != NULL) {
+        IoMmu->PciSegment = RimtIoMmu->PcieSegment;
+        IoMmu->PciBdf     = RimtIoMmu->PcieBdf;
       }
+    } else {
+      IoMmu = IoMmuCreateInstance (FALSE, RimtIoMmu->BaseAddress, STATE_AVAILABLE);
+    }
+
+    if (IoMmu == NULL) {
+      Status = EFI_OUT_OF_RESOURCES;
+      break;
+    }
+
+    //
+    // Without wires, the IOMMU signals by MSI, through the ACPI-described controller.
+    //
+    IoMmu->NumberOfInterruptWires = (UINT8)MIN (RimtIoMmu->NumberOfInterruptWires, RISCV_IOMMU_MSI_CFG_TBL_ENTRIES);
+    IoMmu->HasMsiParent           = RimtIoMmu->NumberOfInterruptWires == 0;
+
+    //
+    // The RIMT has no coherence flag, and ACPI platforms are expected to have coherent IOMMUs.
+    //
+    IoMmu->NonCoherent = FALSE;
+
+    if ((RimtIoMmu->Flags & IOMMU_NODE_FLAG_PROXIMITY_DOMAIN_VALID) != 0) {
+      IoMmu->HasProximityDomain = TRUE;
+      IoMmu->ProximityDomain    = RimtIoMmu->ProximityDomain;
+    }
+
+    IoMmuAcpiRimtScanDeviceIds (RimtInfo, Index, IoMmu);
+  }
+
+  if (Allocated) {
+    FreePool ((VOID *)RimtInfo);
+  }
+
+  return Status;
+}
+
+/**
+  Take the system IOMMUs and their routes from PcdRiscVIoMmuFixedInstances and
+  PcdRiscVIoMmuFixedRoutes, for platforms whose IOMMUs are known at build time.
+
+  @retval  EFI_SUCCESS           At least one IOMMU was configured.
+  @retval  EFI_NOT_FOUND         No IOMMUs are configured.
+  @retval  EFI_OUT_OF_RESOURCES  An instance couldn't be allocated.
+
+**/
+STATIC
+EFI_STATUS
+IoMmuFixedDiscovery (
+  VOID
+  )
+{
+  CONST FIXED_IOMMU_ENTRY  *Fixed;
+  CONST FIXED_ROUTE_ENTRY  *Route;
+  RISCV_IOMMU_INSTANCE     **Instances;
+  UINTN                    NumberOfInstances;
+  UINTN                    NumberOfRoutes;
+  UINTN                    Index;
+  UINT32                   NumberOfIds;
+  UINT32                   DeviceIdBase;
+  RISCV_IOMMU_INSTANCE     *IoMmu;
+
+  Fixed             = PcdGetPtr (PcdRiscVIoMmuFixedInstances);
+  NumberOfInstances = PcdGetSize (PcdRiscVIoMmuFixedInstances) / sizeof (FIXED_IOMMU_ENTRY);
+  if ((Fixed == NULL) || (NumberOfInstances == 0) || (ReadUnaligned64 (&Fixed[0].BaseAddress) == 0)) {
+    return EFI_NOT_FOUND;
+  }
+
+  Instances = AllocatePool (NumberOfInstances * sizeof (*Instances));
+  if (Instances == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  for (Index = 0; Index < NumberOfInstances; Index++) {
+    IoMmu = IoMmuCreateInstance (FALSE, ReadUnaligned64 (&Fixed[Index].BaseAddress), STATE_AVAILABLE);
+    if (IoMmu == NULL) {
+      FreePool (Instances);
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    IoMmu->NumberOfInterruptWires = (UINT8)MIN (Fixed[Index].NumberOfInterruptWires, RISCV_IOMMU_MSI_CFG_TBL_ENTRIES);
+    IoMmu->HasMsiParent           = (Fixed[Index].Flags & FIXED_IOMMU_MSI_PARENT) != 0;
+    IoMmu->NonCoherent            = (Fixed[Index].Flags & FIXED_IOMMU_NON_COHERENT) != 0;
+    if ((Fixed[Index].Flags & FIXED_IOMMU_PROXIMITY_DOMAIN_VALID) != 0) {
+      IoMmu->HasProximityDomain = TRUE;
+      IoMmu->ProximityDomain    = ReadUnaligned32 (&Fixed[Index].ProximityDomain);
     }
 
-    RimtNodeHeader = (VOID *)((UINT8 *)RimtNodeHeader + RimtNodeHeader->Length);
+    Instances[Index] = IoMmu;
   }
 
-  return EFI_NOT_FOUND;
+  Route          = PcdGetPtr (PcdRiscVIoMmuFixedRoutes);
+  NumberOfRoutes = PcdGetSize (PcdRiscVIoMmuFixedRoutes) / sizeof (FIXED_ROUTE_ENTRY);
+  for (Index = 0; Index < NumberOfRoutes; Index++, Route++) {
+    NumberOfIds  = ReadUnaligned32 (&Route->NumberOfIds);
+    DeviceIdBase = ReadUnaligned32 (&Route->DeviceIdBase);
+    if ((Route->IoMmuIndex >= NumberOfInstances) || (NumberOfIds == 0)) {
+      DEBUG ((DEBUG_ERROR, "%a: Ignoring route %u\n", __func__, Index));
+      continue;
+    }
+
+    IoMmu                            = Instances[Route->IoMmuIndex];
+    IoMmu->DeviceContext.MaxDeviceId = MAX (IoMmu->DeviceContext.MaxDeviceId, DeviceIdBase + NumberOfIds - 1);
+    IoMmuAddRoute (
+      IoMmu,
+      RISCV_IOMMU_PCI_ROUTING_DOMAIN (ReadUnaligned16 (&Route->PciSegment)),
+      ReadUnaligned32 (&Route->RequesterIdBase),
+      NumberOfIds,
+      DeviceIdBase,
+      MAX_UINT32,
+      Route->Flags & (RISCV_IOMMU_ROUTE_ATS_SUPPORTED | RISCV_IOMMU_ROUTE_PRI_SUPPORTED)
+      );
+  }
+
+  FreePool (Instances);
+  return EFI_SUCCESS;
+}
+
+/**
+  Register for the end of PCI enumeration, if any IOMMU was detected.
+
+  PCI IOMMUs are found and enabled then, and the device contexts of all functions prepared.
+
+**/
+STATIC
+VOID
+IoMmuWaitForPciEnumeration (
+  VOID
+  )
+{
+  VOID       *Registration;
+  EFI_EVENT  ProtocolNotifyEvent;
+
+  if (mRiscVIoMmuGlobalDriverContext.NumberOfInstances == 0) {
+    return;
+  }
+
+  //
+  // The firmware tables merely provide the BDF of a PCI IOMMU (and device references to the IOMMU), so wait for its PCI I/O.
+  //
+  ProtocolNotifyEvent = EfiCreateProtocolNotifyEvent (
+                          &gEfiPciEnumerationCompleteProtocolGuid,
+                          TPL_CALLBACK,
+                          OnPciEnumerationComplete,
+                          NULL,
+                          &Registration
+                          );
+  ASSERT (ProtocolNotifyEvent != NULL);
 }
 
 /**
-  Detect a RISC-V IOMMU device.
+  Detect the RISC-V IOMMU devices.
 
-  @retval  EFI_SUCCESS    An IOMMU was detected.
-  @retval  EFI_NOT_FOUND  No IOMMU could be detected.
+  Every IOMMU that the firmware tables, or the fixed configuration, describe gets its own instance.
 
 **/
 VOID
@@ -236,24 +1505,33 @@ DetectRiscVIoMmus (
   VOID        *Registration;
 
   //
-  // Search the devicetree for an IOMMU.
+  // The IOMMUs of a fixed platform are configured at build time, and nothing is searched.
+  //
+  Status = IoMmuFixedDiscovery ();
+  if (Status != EFI_NOT_FOUND) {
+    IoMmuBuildRouteIndex ();
+    IoMmuWaitForPciEnumeration ();
+    return;
+  }
+
+  //
+  // Search the devicetree for IOMMUs.
   //
   Status = gBS->LocateProtocol (&gEdkiiPlatformHasDeviceTreeGuid, NULL, (VOID **)&Registration);
   if (!EFI_ERROR (Status)) {
     Status = IoMmuDeviceTreeDiscovery ();
-    if (!EFI_ERROR (Status)) {
-      return;
-    }
   }
 
   //
-  // Search ACPI's RIMT for an IOMMU.
+  // Search ACPI's RIMT for IOMMUs, or its model from an earlier phase.
   //
-  Status = gBS->LocateProtocol (&gEdkiiPlatformHasAcpiGuid, NULL, (VOID **)&Registration);
-  if (!EFI_ERROR (Status)) {
-    Status = IoMmuAcpiRimtDiscovery ();
-    if (!EFI_ERROR (Status)) {
-      return;
+  if (EFI_ERROR (Status)) {
+    Status = gBS->LocateProtocol (&gEdkiiPlatformHasAcpiGuid, NULL, (VOID **)&Registration);
+    if (!EFI_ERROR (Status) || (GetFirstGuidHob (&gRiscVRimtInfoHobGuid) != NULL)) {
+      IoMmuAcpiRimtDiscovery ();
     }
   }
+
+  IoMmuBuildRouteIndex ();
+  IoMmuWaitForPciEnumeration ();
 }
@@ -1,8 +1,6 @@
 /** @file
   RISC-V IOMMU driver.
 
-  Global TODO: First, determine if endpoint is behind (this) IOMMU.
-
   Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
   SPDX-License-Identifier: BSD-2-Clause-Patent
 
@@ -13,7 +11,10 @@
 #include <Library/BaseMemoryLib.h>
 #include <Library/DebugLib.h>
 #include <Library/DevicePathLib.h>
+#include <Library/DxeServicesTableLib.h>
 #include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
+#include <Library/TimerLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Protocol/DevicePath.h>
 #include <Protocol/IoMmu.h>
@@ -21,20 +22,24 @@
 #include <Register/RiscV64/RiscVImpl.h>
 #include "RiscVIoMmu.h"
 
-#define MAP_INFO_SIGNATURE  SIGNATURE_32 ('D', 'M', 'A', 'P')
-typedef struct {
-  UINT32                                    Signature;
-#if 0
-  LIST_ENTRY                                Link;
-#endif
-  EDKII_IOMMU_OPERATION                     Operation;
-  EFI_PHYSICAL_ADDRESS                      HostAddress;
-  UINTN                                     NumberOfBytes;
-  EFI_PHYSICAL_ADDRESS                      DeviceAddress;
-#if 0
-  LIST_ENTRY                                HandleList;
-#endif
-} MAP_INFO;
+//
+// MAP_INFO records are carved from whole pages, and are never returned to the
+// DXE core. In steady state, Map() and Unmap() don't allocate.
+//
+#define MAP_INFO_SLAB_PAGES  1
+
+//
+// The services log their calls at this level, which is quieter while the trace ring records them.
+//
+#define SERVICE_DEBUG_LEVEL  ((FixedPcdGet32 (PcdRiscVIoMmuTraceEntries) != 0) ? DEBUG_VERBOSE : RISCV_IOMMU_DEBUG_LEVEL)
+
+STATIC MAP_INFO  *mMapInfoFreeList = NULL;
+
+//
+// The GCD descriptor of the last range that Map() looked up. Nearly all buffers are in
+// one large system memory descriptor, so most lookups don't walk the GCD map.
+//
+STATIC EFI_GCD_MEMORY_SPACE_DESCRIPTOR  mLastMemorySpace;
 
 EDKII_IOMMU_PROTOCOL  mRiscVIoMmuProtocol = {
   EDKII_IOMMU_PROTOCOL_REVISION,
@@ -46,36 +51,992 @@ EDKII_IOMMU_PROTOCOL  mRiscVIoMmuProtocol = {
 };
 
 /**
-  Returns the top of IOMMU addressable memory based on
-  the HART's operating SATP mode and the IOMMU's GXL bit.
+  Take a MAP_INFO record from the slab, growing it when the free list is empty.
+
+  @return  The record, or NULL if the slab could not be grown.
+
+**/
+STATIC
+MAP_INFO *
+AllocateMapInfo (
+  VOID
+  )
+{
+  MAP_INFO  *MapInfo;
+  UINTN     Index;
+  EFI_TPL   OriginalTpl;
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+
+  if (mMapInfoFreeList == NULL) {
+    if (!IoMmuChargeFootprint (RiscVIoMmuFootprintMapInfo, EFI_PAGES_TO_SIZE (MAP_INFO_SLAB_PAGES))) {
+      gBS->RestoreTPL (OriginalTpl);
+      return NULL;
+    }
+
+    MapInfo = AllocatePages (MAP_INFO_SLAB_PAGES);
+    if (MapInfo == NULL) {
+      IoMmuReleaseFootprint (RiscVIoMmuFootprintMapInfo, EFI_PAGES_TO_SIZE (MAP_INFO_SLAB_PAGES));
+      gBS->RestoreTPL (OriginalTpl);
+      return NULL;
+    }
+
+    for (Index = 0; Index < EFI_PAGES_TO_SIZE (MAP_INFO_SLAB_PAGES) / sizeof (MAP_INFO); Index++) {
+      MapInfo[Index].Signature = 0;
+      MapInfo[Index].NextFree  = mMapInfoFreeList;
+      mMapInfoFreeList         = &MapInfo[Index];
+    }
+  }
+
+  MapInfo          = mMapInfoFreeList;
+  mMapInfoFreeList = MapInfo->NextFree;
+
+  gBS->RestoreTPL (OriginalTpl);
+  return MapInfo;
+}
+
+/**
+  Return a MAP_INFO record to the slab.
+
+  @param[in]  MapInfo  The record to return.
+
+**/
+STATIC
+VOID
+FreeMapInfo (
+  IN MAP_INFO  *MapInfo
+  )
+{
+  EFI_TPL  OriginalTpl;
+
+  IoMmuForgetDeferredGrants (MapInfo);
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+
+  //
+  // Clearing the signature rejects a stale mapping that is passed in again.
+  //
+  MapInfo->Signature = 0;
+  MapInfo->NextFree  = mMapInfoFreeList;
+  mMapInfoFreeList   = MapInfo;
+
+  gBS->RestoreTPL (OriginalTpl);
+}
+
+/**
+  Release the buffers of a mapping, and return its MAP_INFO record to the slab.
+
+  @param[in]  MapInfo  The mapping.
+
+**/
+VOID
+IoMmuReleaseMapping (
+  IN MAP_INFO  *MapInfo
+  )
+{
+  IoMmuForgetDemandMapping (MapInfo);
+
+  if (MapInfo->DirtyPages != NULL) {
+    FreePool (MapInfo->DirtyPages);
+    MapInfo->DirtyPages = NULL;
+  }
+
+  if (MapInfo->HeadBounce != 0) {
+    IoMmuFreeBounceBuffer (MapInfo->HeadBounce);
+    MapInfo->HeadBounce = 0;
+  }
+
+  if (MapInfo->TailBounce != 0) {
+    IoMmuFreeBounceBuffer (MapInfo->TailBounce);
+    MapInfo->TailBounce = 0;
+  }
+
+  if (MapInfo->BufferAddress != MapInfo->HostAddress) {
+    if (!IoMmuFreeBounceBuffer (MapInfo->BufferAddress)) {
+      gBS->FreePages (MapInfo->BufferAddress, EFI_SIZE_TO_PAGES (MapInfo->NumberOfBytes));
+      IoMmuReleaseFootprint (RiscVIoMmuFootprintBounce, EFI_PAGES_TO_SIZE (EFI_SIZE_TO_PAGES (MapInfo->NumberOfBytes)));
+    }
+  } else if (MapInfo->DeviceAddress != MapInfo->HostAddress) {
+    IoMmuFreeIova (
+      MapInfo->DeviceAddress & ~(EFI_PHYSICAL_ADDRESS)EFI_PAGE_MASK,
+      EFI_SIZE_TO_PAGES ((MapInfo->DeviceAddress & EFI_PAGE_MASK) + MapInfo->NumberOfBytes)
+      );
+  }
+
+  FreeMapInfo (MapInfo);
+}
+
+/**
+  Track a buffer from AllocateBuffer() as a persistent common-buffer mapping.
+
+  Without the record, common-buffer Map()s of the buffer are mapped as usual.
+
+  @param[in]  HostAddress  The address of the buffer.
+  @param[in]  Pages        The number of pages of the buffer.
+  @param[in]  MemoryType   The memory type the buffer was allocated as.
+  @param[in]  Attributes   The attributes the buffer was allocated with.
+
+  @return  The persistent mapping, or NULL if it could not be recorded.
+
+**/
+STATIC
+MAP_INFO *
+CreatePersistentMapping (
+  IN EFI_PHYSICAL_ADDRESS  HostAddress,
+  IN UINTN                 Pages,
+  IN EFI_MEMORY_TYPE       MemoryType,
+  IN UINT64                Attributes
+  )
+{
+  MAP_INFO  *MapInfo;
+
+  MapInfo = AllocateMapInfo ();
+  if (MapInfo == NULL) {
+    return NULL;
+  }
+
+  MapInfo->Signature           = MAP_INFO_SIGNATURE;
+  MapInfo->Operation           = ((Attributes & EDKII_IOMMU_ATTRIBUTE_DUAL_ADDRESS_CYCLE) != 0) ?
+                                 EdkiiIoMmuOperationBusMasterCommonBuffer64 :
+                                 EdkiiIoMmuOperationBusMasterCommonBuffer;
+  MapInfo->HostAddress         = HostAddress;
+  MapInfo->NumberOfBytes       = EFI_PAGES_TO_SIZE (Pages);
+  MapInfo->DeviceAddress       = HostAddress;
+  MapInfo->BufferAddress       = HostAddress;
+  MapInfo->HeadBounce          = 0;
+  MapInfo->TailBounce          = 0;
+  MapInfo->IoMmuAccess         = 0;
+  MapInfo->InvalidationPending = FALSE;
+  MapInfo->ReleasePending      = FALSE;
+  MapInfo->Persistent          = TRUE;
+  MapInfo->MemoryType          = MemoryType;
+  MapInfo->Cached              = FALSE;
+  MapInfo->Recycled            = FALSE;
+  MapInfo->ReferenceCount      = 1;
+  MapInfo->OwnerIoMmu          = NULL;
+  MapInfo->OwnerDomain         = NULL;
+  MapInfo->OwnerAccess         = 0;
+  MapInfo->OwnerGrants         = 0;
+  MapInfo->DemandMapped        = FALSE;
+  MapInfo->DirtyPages          = NULL;
+  MapInfo->NonCoherent         = FALSE;
+  MapInfo->PeerToPeer          = FALSE;
+  MapInfo->WriteCombining      = FALSE;
+  MapInfo->OriginalAttributes  = 0;
+  MapInfo->BounceReason        = RiscVIoMmuBounceReasonMax;
+  MapInfo->BouncedBytes        = 0;
+  MapInfo->MapTime             = 0;
+
+  if (EFI_ERROR (IoMmuInsertMapping (MapInfo))) {
+    FreeMapInfo (MapInfo);
+    return NULL;
+  }
+
+  return MapInfo;
+}
+
+/**
+  Map the buffer of a persistent mapping as write-combining, if its memory space allows it.
+  Otherwise, the buffer stays write-back, which is always a valid substitute.
+
+  @param[in]  MapInfo  The persistent mapping.
+
+**/
+STATIC
+VOID
+SetWriteCombining (
+  IN MAP_INFO  *MapInfo
+  )
+{
+  EFI_GCD_MEMORY_SPACE_DESCRIPTOR  Descriptor;
+  EFI_STATUS                       Status;
+
+  Status = gDS->GetMemorySpaceDescriptor (MapInfo->HostAddress, &Descriptor);
+  if (EFI_ERROR (Status) || ((Descriptor.Capabilities & EFI_MEMORY_WC) == 0)) {
+    DEBUG ((SERVICE_DEBUG_LEVEL, "%a: 0x%lx can't be write-combining\n", __func__, MapInfo->HostAddress));
+    return;
+  }
+
+  //
+  // No dirty block of the cached mapping may be written back over the data written
+  // through the write-combining one.
+  //
+  if (!IoMmuFlushCacheRange (MapInfo->HostAddress, MapInfo->NumberOfBytes)) {
+    DEBUG ((SERVICE_DEBUG_LEVEL, "%a: 0x%lx can't be flushed for write-combining\n", __func__, MapInfo->HostAddress));
+    return;
+  }
+
+  Status = gDS->SetMemorySpaceAttributes (
+                  MapInfo->HostAddress,
+                  MapInfo->NumberOfBytes,
+                  (Descriptor.Attributes & ~EFI_CACHE_ATTRIBUTE_MASK) | EFI_MEMORY_WC
+                  );
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_WARN, "%a: 0x%lx stays write-back - %r\n", __func__, MapInfo->HostAddress, Status));
+    return;
+  }
+
+  MapInfo->WriteCombining     = TRUE;
+  MapInfo->OriginalAttributes = Descriptor.Attributes;
+}
+
+/**
+  Map the buffer of a persistent mapping with the attributes it had before SetWriteCombining().
+
+  @param[in]  MapInfo  The persistent mapping.
+
+**/
+STATIC
+VOID
+RestoreWriteBack (
+  IN MAP_INFO  *MapInfo
+  )
+{
+  EFI_STATUS  Status;
+
+  if (!MapInfo->WriteCombining) {
+    return;
+  }
+
+  Status = gDS->SetMemorySpaceAttributes (
+                  MapInfo->HostAddress,
+                  MapInfo->NumberOfBytes,
+                  MapInfo->OriginalAttributes
+                  );
+  ASSERT_EFI_ERROR (Status);
+  MapInfo->WriteCombining = FALSE;
+}
+
+/**
+  Find the persistent mapping that a common-buffer Map() of an allocated buffer can return.
+
+  @param[in]  Operation      The common-buffer operation.
+  @param[in]  HostAddress    The address to map.
+  @param[in]  NumberOfBytes  The number of bytes to map.
+
+  @return  The persistent mapping, or NULL if the range isn't the start of an allocated buffer.
+
+**/
+STATIC
+MAP_INFO *
+FindPersistentMapping (
+  IN EDKII_IOMMU_OPERATION  Operation,
+  IN EFI_PHYSICAL_ADDRESS   HostAddress,
+  IN UINTN                  NumberOfBytes
+  )
+{
+  MAP_INFO  *MapInfo;
+
+  MapInfo = IoMmuFindMappingByDeviceAddress (HostAddress);
+  if ((MapInfo == NULL) || !MapInfo->Persistent || MapInfo->Cached ||
+      (MapInfo->HostAddress != HostAddress) || (NumberOfBytes > MapInfo->NumberOfBytes))
+  {
+    return NULL;
+  }
+
+  //
+  // A 32-bit operation needs a buffer below 4 GiB.
+  //
+  if ((Operation != EdkiiIoMmuOperationBusMasterCommonBuffer64) && (HostAddress + NumberOfBytes > SIZE_4GB)) {
+    return NULL;
+  }
+
+  return MapInfo;
+}
+
+/**
+  Revoke the translation of the domain that owns a mapping.
+
+  @param[in]  MapInfo  The mapping.
+
+  @retval  EFI_SUCCESS  The owner can no longer reach the mapping, or there is no owner.
+  @retval  Others       The page tables of the owner could not be updated.
 
 **/
 STATIC
+EFI_STATUS
+RevokeOwnerTranslation (
+  IN MAP_INFO  *MapInfo
+  )
+{
+  EFI_STATUS  Status;
+
+  if (MapInfo->OwnerDomain == NULL) {
+    return EFI_SUCCESS;
+  }
+
+  IoMmuForgetDemandMapping (MapInfo);
+
+  Status = IoMmuUpdatePageTable (
+             MapInfo->OwnerIoMmu,
+             MapInfo->OwnerDomain->RootPageTable,
+             MapInfo->OwnerDomain->Pscid,
+             MapInfo->DeviceAddress,
+             MapInfo->HostAddress,
+             MapInfo->NumberOfBytes,
+             0,
+             FALSE
+             );
+  if (!EFI_ERROR (Status)) {
+    Status = IoMmuInvalidateDeviceAts (
+               MapInfo->OwnerIoMmu,
+               MapInfo->OwnerDomain,
+               MapInfo->DeviceAddress,
+               MapInfo->NumberOfBytes
+               );
+  }
+
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  MapInfo->OwnerIoMmu  = NULL;
+  MapInfo->OwnerDomain = NULL;
+  MapInfo->OwnerAccess = 0;
+  MapInfo->OwnerGrants = 0;
+  return EFI_SUCCESS;
+}
+
+/**
+  Unmap a persistent mapping from its owner, remove it, and release it.
+
+  @param[in]  MapInfo  The persistent mapping.
+
+  @retval  EFI_SUCCESS       The mapping is released, so no device can reach its buffer.
+  @retval  EFI_DEVICE_ERROR  The owner's translation could not be revoked. The mapping is kept.
+
+**/
+EFI_STATUS
+IoMmuDestroyPersistentMapping (
+  IN MAP_INFO  *MapInfo
+  )
+{
+  EFI_STATUS  Status;
+
+  Status = RevokeOwnerTranslation (MapInfo);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "%a: Failed to unmap 0x%lx: %r\n", __func__, MapInfo->HostAddress, Status));
+    return EFI_DEVICE_ERROR;
+  }
+
+  //
+  // Other devices may have unmapped it lazily.
+  //
+  if (MapInfo->InvalidationPending) {
+    IoMmuFlushDeferredInvalidations ();
+  }
+
+  IoMmuRemoveMapping (MapInfo);
+  if (!IoMmuDeferRelease (MapInfo)) {
+    IoMmuReleaseMapping (MapInfo);
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Recompute the top of IOMMU addressable memory based on
+  the IOMMUs' IO paging modes and GXL bits, once IOMMUs are initialised.
+
+  Buffers may be used by devices behind any IOMMU, so one initialised
+  IOMMU with GXL set limits all of them to 4 GiB.
+
+**/
+VOID
+IoMmuUpdateDmaMemoryTop (
+  VOID
+  )
+{
+  LIST_ENTRY            *Link;
+  RISCV_IOMMU_INSTANCE  *IoMmu;
+  RISCV_IOMMU_FCTL      FeatureControl;
+  UINT64                MemoryTop;
+  UINTN                 HartSatpMode;
+
+  MemoryTop = MAX_UINT64;
+  for (Link = GetFirstNode (&mRiscVIoMmuGlobalDriverContext.InstanceList)
+       ; !IsNull (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ; Link = GetNextNode (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ) {
+    IoMmu = RISCV_IOMMU_INSTANCE_FROM_LINK (Link);
+    if (IoMmu->State != STATE_INITIALISED) {
+      continue;
+    }
+
+    FeatureControl.Uint32 = IoMmu->FeatureControl;
+    if (FeatureControl.Bits.GXL) {
+      DEBUG ((RISCV_IOMMU_DEBUG_LEVEL, "GXL bit is set, so buffer must be below 4G\n"));
+      mRiscVIoMmuGlobalDriverContext.DmaMemoryTop = (1ULL << 32) - 1;
+      return;
+    }
+
+    if (IoMmu->IoPageTableLevels != 0) {
+      MemoryTop = MIN (MemoryTop, IoMmuGetIoVirtualAddressLimit (IoMmu) - 1);
+    }
+  }
+
+  //
+  // Without IO page tables, devices are only limited by the physical address space.
+  //
+  if (MemoryTop == MAX_UINT64) {
+    HartSatpMode = (RiscVGetSupervisorAddressTranslationRegister () & SATP64_MODE) >> SATP64_MODE_SHIFT;
+    if (HartSatpMode == SATP_MODE_SV39) {
+      MemoryTop = (1ULL << 39) - 1;
+    } else if (HartSatpMode == SATP_MODE_SV48) {
+      MemoryTop = (1ULL << 48) - 1;
+    } else if (HartSatpMode == SATP_MODE_SV57) {
+      MemoryTop = (1ULL << 57) - 1;
+    } else {
+      ASSERT (FALSE);
+      MemoryTop = 0;
+    }
+  }
+
+  mRiscVIoMmuGlobalDriverContext.DmaMemoryTop = MemoryTop;
+}
+
+/**
+  Returns the top of IOMMU addressable memory, as last computed
+  by IoMmuUpdateDmaMemoryTop().
+
+**/
 UINT64
 RiscVGetIoMmuMemoryTop (
   VOID
   )
+{
+  return mRiscVIoMmuGlobalDriverContext.DmaMemoryTop;
+}
+
+/**
+  Determine the highest device address that an IOMMU lets a domain reach.
+
+  @param[in]  IoMmu   The IOMMU of the domain.
+  @param[in]  Domain  The domain.
+
+  @return  The highest device address of the domain's window.
+
+**/
+STATIC
+UINT64
+GetDomainAddressLimit (
+  IN RISCV_IOMMU_INSTANCE       *IoMmu,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain
+  )
 {
   RISCV_IOMMU_FCTL  FeatureControl;
-  UINTN             HartSatpMode;
 
-  FeatureControl.Uint32 = IoMmuRead32 (R_RISCV_IOMMU_FCTL);
+  FeatureControl.Uint32 = IoMmu->FeatureControl;
   if (FeatureControl.Bits.GXL) {
-    DEBUG ((RISCV_IOMMU_DEBUG_LEVEL, "GXL bit is set, so buffer must be below 4G\n"));
-    return (1ULL << 32) - 1;
+    return SIZE_4GB - 1;
+  }
+
+  //
+  // A bypassed device reaches memory at its physical address, so only its own addressing limits it.
+  //
+  if ((Domain->Mode == RISCV_IOMMU_DEVICE_MODE_BYPASS) || (IoMmu->IoPageTableLevels == 0)) {
+    return MAX_UINT64;
+  }
+
+  return IoMmuGetIoVirtualAddressLimit (IoMmu) - 1;
+}
+
+/**
+  Read the MMIO base that the device path of a platform device identifies it by.
+
+  Platform devices, such as virtio-mmio transports and non-discoverable
+  devices, are a vendor-defined hardware node that carries the 64-bit base
+  of their registers after the GUID.
+
+  @param[in]   DevicePath   The device path of the device.
+  @param[out]  BaseAddress  The MMIO base of the device.
+
+  @retval  TRUE   The device path is that of a platform device.
+  @retval  FALSE  The device path is anything else, such as that of a PCI function.
+
+**/
+STATIC
+BOOLEAN
+GetPlatformDeviceBase (
+  IN  EFI_DEVICE_PATH_PROTOCOL  *DevicePath,
+  OUT UINT64                    *BaseAddress
+  )
+{
+  if ((DevicePathType (DevicePath) != HARDWARE_DEVICE_PATH) ||
+      (DevicePathSubType (DevicePath) != HW_VENDOR_DP) ||
+      (DevicePathNodeLength (DevicePath) < sizeof (VENDOR_DEVICE_PATH) + sizeof (UINT64)))
+  {
+    return FALSE;
+  }
+
+  *BaseAddress = ReadUnaligned64 ((UINT64 *)((UINT8 *)DevicePath + sizeof (VENDOR_DEVICE_PATH)));
+  return TRUE;
+}
+
+/**
+  Resolve a device handle to the IOMMU that translates it, and its domain.
+
+  A platform device is resolved by its MMIO base to the devicetree node that
+  names its IOMMU, and takes the default mode. Anything else must be a PCI function.
+
+  @param[in]   DeviceHandle  The device handle.
+  @param[out]  IoMmu         The IOMMU that the device is routed to.
+  @param[out]  Domain        The domain of the device.
+
+  @retval  EFI_SUCCESS            The device is translated by the IOMMU.
+  @retval  EFI_INVALID_PARAMETER  DeviceHandle has no device path.
+  @retval  EFI_UNSUPPORTED        The device isn't a platform device or PCI function routed to an initialised IOMMU.
+  @retval  Others                 The device context could not be created.
+
+**/
+STATIC
+EFI_STATUS
+ResolveDeviceDomain (
+  IN  EFI_HANDLE                 DeviceHandle,
+  OUT RISCV_IOMMU_INSTANCE       **IoMmu,
+  OUT RISCV_IOMMU_DEVICE_DOMAIN  **Domain
+  )
+{
+  EFI_DEVICE_PATH_PROTOCOL  *DevicePath;
+  EFI_PCI_IO_PROTOCOL       *PciIo;
+  EFI_STATUS                Status;
+  UINTN                     Seg;
+  UINTN                     Bus;
+  UINTN                     Dev;
+  UINTN                     Func;
+  UINT64                    BaseAddress;
+  UINT32                    RoutingDomain;
+  RISCV_IOMMU_DEVICE_ID     IoMmuDeviceId;
+  UINT32                    RouteFlags;
+
+  DevicePath = DevicePathFromHandle (DeviceHandle);
+  if (DevicePath == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  //
+  // A platform device is checked first, as a non-discoverable one also has an emulated PCI I/O
+  // instance, whose location means nothing to the IOMMU. Its only source ID is the first entry
+  // of its `iommus` property.
+  //
+  if (GetPlatformDeviceBase (DevicePath, &BaseAddress) &&
+      IoMmuFindPlatformDevice (BaseAddress, &RoutingDomain))
+  {
+    *IoMmu = IoMmuRouteDevice (RoutingDomain, 0, &IoMmuDeviceId, NULL);
+    if ((*IoMmu == NULL) || ((*IoMmu)->State != STATE_INITIALISED)) {
+      DEBUG ((DEBUG_ERROR, "%a: The platform device at 0x%lx isn't routed to an IOMMU\n", __func__, BaseAddress));
+      return EFI_UNSUPPORTED;
+    }
+
+    Status = IoMmuGetDeviceDomain (*IoMmu, IoMmuDeviceId, IoMmuGetDeviceMode (NULL), IoMmuGetDeviceQosId (NULL), 0, Domain);
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+
+    (*Domain)->DmaAddressLimit = GetDomainAddressLimit (*IoMmu, *Domain);
+    return EFI_SUCCESS;
+  }
+
+  //
+  // Get device_id for this request.
+  //
+  Status = gBS->HandleProtocol (DeviceHandle, &gEfiPciIoProtocolGuid, (VOID **)&PciIo);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "%a: The device is neither a PCI function nor a platform device with an IOMMU\n", __func__));
+    return EFI_UNSUPPORTED;
+  }
+
+  Status = PciIo->GetLocation (PciIo, &Seg, &Bus, &Dev, &Func);
+  if (EFI_ERROR (Status)) {
+    return EFI_UNSUPPORTED;
+  }
+
+  //
+  // Only the IOMMU that the function is routed to translates its DMA, by the device_id it maps the RID to.
+  //
+  *IoMmu = IoMmuRouteDevice (
+             RISCV_IOMMU_PCI_ROUTING_DOMAIN (Seg),
+             (UINT32)((Bus << 8) | (Dev << 3) | Func),
+             &IoMmuDeviceId,
+             &RouteFlags
+             );
+  if ((*IoMmu == NULL) || ((*IoMmu)->State != STATE_INITIALISED)) {
+    DEBUG ((DEBUG_ERROR, "%a: %04x:%02x:%02x.%x isn't routed to an IOMMU\n", __func__, Seg, Bus, Dev, Func));
+    return EFI_UNSUPPORTED;
+  }
+
+  Status = IoMmuGetDeviceDomain (
+             *IoMmu,
+             IoMmuDeviceId,
+             IoMmuGetDeviceMode (PciIo),
+             IoMmuGetDeviceQosId (PciIo),
+             IoMmuGetDeviceGroup (PciIo, Seg, Bus, Dev, Func),
+             Domain
+             );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  (*Domain)->DmaAddressLimit = GetDomainAddressLimit (*IoMmu, *Domain);
+
+  IoMmuEnableDeviceAts (*IoMmu, *Domain, PciIo, (UINT16)Seg, (UINT16)((Bus << 8) | (Dev << 3) | Func), RouteFlags);
+  return EFI_SUCCESS;
+}
+
+/**
+  Find the IOMMU that translates a device, and its domain, resolving and caching them on first use.
+
+  @param[in]   DeviceHandle  The device handle.
+  @param[out]  IoMmu         The IOMMU that translates the device.
+  @param[out]  Domain        The domain of the device.
+
+  @retval  EFI_SUCCESS            The device is translated by the IOMMU.
+  @retval  EFI_INVALID_PARAMETER  DeviceHandle has no device path.
+  @retval  EFI_UNSUPPORTED        The device isn't a platform device or PCI function routed to an initialised IOMMU.
+  @retval  Others                 The device context could not be created.
+
+**/
+EFI_STATUS
+IoMmuResolveDevice (
+  IN  EFI_HANDLE                 DeviceHandle,
+  OUT RISCV_IOMMU_INSTANCE       **IoMmu,
+  OUT RISCV_IOMMU_DEVICE_DOMAIN  **Domain
+  )
+{
+  EFI_STATUS  Status;
+
+  //
+  // Devices that were resolved before skip the protocol database.
+  //
+  *Domain = IoMmuLookupDeviceCache (DeviceHandle, IoMmu);
+  if (*Domain != NULL) {
+    return EFI_SUCCESS;
+  }
+
+  Status = ResolveDeviceDomain (DeviceHandle, IoMmu, Domain);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  IoMmuInsertDeviceCache (DeviceHandle, *IoMmu, *Domain);
+  return EFI_SUCCESS;
+}
+
+/**
+  Determine the highest device address that a device can reach, from the window of its
+  domain and from whether its driver enabled dual address cycles.
+
+  The attributes are read on every call, as a driver may enable dual address cycles
+  only after the device was first resolved.
+
+  @param[in]  DeviceHandle  The device handle.
+  @param[in]  Domain        The domain of the device.
+
+  @return  The highest device address that the device can reach.
+
+**/
+UINT64
+IoMmuGetDeviceDmaLimit (
+  IN EFI_HANDLE                 DeviceHandle,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain
+  )
+{
+  EFI_PCI_IO_PROTOCOL  *PciIo;
+  UINT64               Attributes;
+  EFI_STATUS           Status;
+
+  Status = gBS->HandleProtocol (DeviceHandle, &gEfiPciIoProtocolGuid, (VOID **)&PciIo);
+  if (!EFI_ERROR (Status)) {
+    Status = PciIo->Attributes (PciIo, EfiPciIoAttributeOperationGet, 0, &Attributes);
+  }
+
+  if (EFI_ERROR (Status) || ((Attributes & EFI_PCI_IO_ATTRIBUTE_DUAL_ADDRESS_CYCLE) == 0)) {
+    return MIN (Domain->DmaAddressLimit, SIZE_4GB - 1);
+  }
+
+  return Domain->DmaAddressLimit;
+}
+
+/**
+  Start tracking the bounce pages that the owner of a bounced BusMasterWrite mapping writes to,
+  if its IOMMU updates D bits in hardware.
+
+  @param[in]  MapInfo  The mapping, about to be translated for the first time.
+  @param[in]  IoMmu    The IOMMU of the owner.
+  @param[in]  Domain   The owner, which translates strictly.
+
+  @retval  TRUE   The writes are tracked, and the leaves must be created clean.
+  @retval  FALSE  The whole buffer is copied back.
+
+**/
+STATIC
+BOOLEAN
+StartDirtyTracking (
+  IN MAP_INFO                   *MapInfo,
+  IN RISCV_IOMMU_INSTANCE       *IoMmu,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain
+  )
+{
+  RISCV_IOMMU_CAPABILITIES  Capabilities;
+
+  Capabilities.Uint64 = IoMmu->Capabilities;
+  if (!Capabilities.Bits.AMO_HWAD || IoMmu->NonCoherent || (Domain->Mode != RISCV_IOMMU_DEVICE_MODE_STRICT) ||
+      (MapInfo->BufferAddress == MapInfo->HostAddress) ||
+      ((MapInfo->Operation != EdkiiIoMmuOperationBusMasterWrite) &&
+       (MapInfo->Operation != EdkiiIoMmuOperationBusMasterWrite64)))
+  {
+    return FALSE;
+  }
+
+  //
+  // A single page is always copied whole.
+  //
+  if (MapInfo->NumberOfBytes <= EFI_PAGE_SIZE) {
+    return FALSE;
+  }
+
+  MapInfo->DirtyPages = AllocateZeroPool (ALIGN_VALUE (EFI_SIZE_TO_PAGES (MapInfo->NumberOfBytes), 64) / 8);
+  return MapInfo->DirtyPages != NULL;
+}
+
+/**
+  Record which bounce pages the owner of a tracked mapping has written to, while its
+  translation is still in place.
+
+  @param[in]  MapInfo  The mapping.
+
+**/
+STATIC
+VOID
+SampleDirtyPages (
+  IN MAP_INFO  *MapInfo
+  )
+{
+  UINTN  Page;
+
+  if ((MapInfo->DirtyPages == NULL) || (MapInfo->OwnerDomain == NULL)) {
+    return;
+  }
+
+  for (Page = 0; Page < EFI_SIZE_TO_PAGES (MapInfo->NumberOfBytes); Page++) {
+    if (IoMmuIsPageDirty (
+          MapInfo->OwnerIoMmu,
+          MapInfo->OwnerDomain->RootPageTable,
+          MapInfo->DeviceAddress + EFI_PAGES_TO_SIZE (Page)
+          ))
+    {
+      MapInfo->DirtyPages[Page / 64] |= LShiftU64 (1, Page % 64);
+    }
+  }
+}
+
+/**
+  Copy the bounce pages of a BusMasterWrite mapping back into the real buffer,
+  only those the device wrote to if they were tracked.
+
+  @param[in]  MapInfo  The bounced mapping.
+
+**/
+STATIC
+VOID
+CopyBackBounceBuffer (
+  IN MAP_INFO  *MapInfo
+  )
+{
+  UINTN  Page;
+  UINTN  Offset;
+
+  if (MapInfo->DirtyPages == NULL) {
+    CopyMem ((VOID *)MapInfo->HostAddress, (VOID *)MapInfo->BufferAddress, MapInfo->NumberOfBytes);
+    return;
+  }
+
+  SampleDirtyPages (MapInfo);
+  for (Page = 0; Page < EFI_SIZE_TO_PAGES (MapInfo->NumberOfBytes); Page++) {
+    if ((MapInfo->DirtyPages[Page / 64] & LShiftU64 (1, Page % 64)) != 0) {
+      Offset = EFI_PAGES_TO_SIZE (Page);
+      CopyMem (
+        (VOID *)(UINTN)(MapInfo->HostAddress + Offset),
+        (VOID *)(UINTN)(MapInfo->BufferAddress + Offset),
+        MIN (EFI_PAGE_SIZE, MapInfo->NumberOfBytes - Offset)
+        );
+    }
+  }
+}
+
+/**
+  Give a split mapping bounce pages for the partial first and last pages of its buffer.
+
+  The rest of each bounce page is zeroed, so the device never reaches the bytes that
+  share those pages with the buffer. The buffer's own bytes are copied in for a BusMasterRead.
+
+  @param[in]  MapInfo     The mapping, whose buffer covers at least one whole page.
+  @param[in]  MaxAddress  The highest address the bounce pages may end at.
+
+  @retval  TRUE   The bounce pages are allocated.
+  @retval  FALSE  The bounce pool is exhausted.
+
+**/
+STATIC
+BOOLEAN
+AllocateSplitBounce (
+  IN MAP_INFO              *MapInfo,
+  IN EFI_PHYSICAL_ADDRESS  MaxAddress
+  )
+{
+  EFI_PHYSICAL_ADDRESS  End;
+  BOOLEAN               Read;
+
+  End  = MapInfo->HostAddress + MapInfo->NumberOfBytes;
+  Read = (MapInfo->Operation == EdkiiIoMmuOperationBusMasterRead) ||
+         (MapInfo->Operation == EdkiiIoMmuOperationBusMasterRead64);
+
+  if ((MapInfo->HostAddress & EFI_PAGE_MASK) != 0) {
+    MapInfo->HeadBounce = IoMmuAllocateBounceBuffer (1, MaxAddress);
+    if (MapInfo->HeadBounce == 0) {
+      return FALSE;
+    }
+
+    ZeroMem ((VOID *)(UINTN)MapInfo->HeadBounce, EFI_PAGE_SIZE);
+    if (Read) {
+      CopyMem (
+        (VOID *)(UINTN)(MapInfo->HeadBounce + (MapInfo->HostAddress & EFI_PAGE_MASK)),
+        (VOID *)(UINTN)MapInfo->HostAddress,
+        EFI_PAGE_SIZE - (MapInfo->HostAddress & EFI_PAGE_MASK)
+        );
+    }
+  }
+
+  if ((End & EFI_PAGE_MASK) != 0) {
+    MapInfo->TailBounce = IoMmuAllocateBounceBuffer (1, MaxAddress);
+    if (MapInfo->TailBounce == 0) {
+      if (MapInfo->HeadBounce != 0) {
+        IoMmuFreeBounceBuffer (MapInfo->HeadBounce);
+        MapInfo->HeadBounce = 0;
+      }
+
+      return FALSE;
+    }
+
+    ZeroMem ((VOID *)(UINTN)MapInfo->TailBounce, EFI_PAGE_SIZE);
+    if (Read) {
+      CopyMem (
+        (VOID *)(UINTN)MapInfo->TailBounce,
+        (VOID *)(UINTN)(End & ~(EFI_PHYSICAL_ADDRESS)EFI_PAGE_MASK),
+        End & EFI_PAGE_MASK
+        );
+    }
+  }
+
+  return TRUE;
+}
+
+/**
+  Copy what the device wrote to the bounce pages of a split BusMasterWrite mapping
+  back into the partial first and last pages of its buffer.
+
+  @param[in]  MapInfo  The split mapping.
+
+**/
+STATIC
+VOID
+CopyBackSplitBounce (
+  IN MAP_INFO  *MapInfo
+  )
+{
+  EFI_PHYSICAL_ADDRESS  End;
+
+  End = MapInfo->HostAddress + MapInfo->NumberOfBytes;
+  if (MapInfo->HeadBounce != 0) {
+    CopyMem (
+      (VOID *)(UINTN)MapInfo->HostAddress,
+      (VOID *)(UINTN)(MapInfo->HeadBounce + (MapInfo->HostAddress & EFI_PAGE_MASK)),
+      EFI_PAGE_SIZE - (MapInfo->HostAddress & EFI_PAGE_MASK)
+      );
+  }
+
+  if (MapInfo->TailBounce != 0) {
+    CopyMem (
+      (VOID *)(UINTN)(End & ~(EFI_PHYSICAL_ADDRESS)EFI_PAGE_MASK),
+      (VOID *)(UINTN)MapInfo->TailBounce,
+      End & EFI_PAGE_MASK
+      );
+  }
+}
+
+/**
+  Map or unmap the pages of a mapping at its device address.
+
+  The pages of a split mapping come from three places: its first and last at
+  their bounce pages, and those between in place.
+
+  @param[in]  IoMmu        The IOMMU.
+  @param[in]  Domain       The domain.
+  @param[in]  MapInfo      The mapping.
+  @param[in]  RegionStart  The first page of the device-visible buffer.
+  @param[in]  RegionEnd    The end of the last page of the device-visible buffer.
+  @param[in]  PteAccess    The access, or 0 to unmap.
+  @param[in]  Lazy         Whether invalidating replaced translations is left to the caller.
+
+  @return  The status of the page table update.
+
+**/
+STATIC
+EFI_STATUS
+UpdateMappingPageTable (
+  IN RISCV_IOMMU_INSTANCE       *IoMmu,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain,
+  IN MAP_INFO                   *MapInfo,
+  IN EFI_PHYSICAL_ADDRESS       RegionStart,
+  IN EFI_PHYSICAL_ADDRESS       RegionEnd,
+  IN UINT64                     PteAccess,
+  IN BOOLEAN                    Lazy
+  )
+{
+  EFI_PHYSICAL_ADDRESS  BodyStart;
+  EFI_PHYSICAL_ADDRESS  BodyEnd;
+  EFI_STATUS            Status;
+  EFI_STATUS            BatchStatus;
+
+  if ((MapInfo->HeadBounce == 0) && (MapInfo->TailBounce == 0)) {
+    return IoMmuUpdateDomainPageTable (
+             IoMmu,
+             Domain,
+             RegionStart,
+             MapInfo->BufferAddress & ~(EFI_PHYSICAL_ADDRESS)EFI_PAGE_MASK,
+             RegionEnd - RegionStart,
+             PteAccess,
+             Lazy
+             );
+  }
+
+  BodyStart = RegionStart + ((MapInfo->HeadBounce != 0) ? EFI_PAGE_SIZE : 0);
+  BodyEnd   = RegionEnd - ((MapInfo->TailBounce != 0) ? EFI_PAGE_SIZE : 0);
+
+  IoMmuBeginCommandBatch (IoMmu);
+  Status = IoMmuUpdateDomainPageTable (
+             IoMmu,
+             Domain,
+             BodyStart,
+             (MapInfo->HostAddress & ~(EFI_PHYSICAL_ADDRESS)EFI_PAGE_MASK) + (BodyStart - RegionStart),
+             BodyEnd - BodyStart,
+             PteAccess,
+             Lazy
+             );
+  if (!EFI_ERROR (Status) && (MapInfo->HeadBounce != 0)) {
+    Status = IoMmuUpdateDomainPageTable (IoMmu, Domain, RegionStart, MapInfo->HeadBounce, EFI_PAGE_SIZE, PteAccess, Lazy);
+  }
+
+  if (!EFI_ERROR (Status) && (MapInfo->TailBounce != 0)) {
+    Status = IoMmuUpdateDomainPageTable (IoMmu, Domain, BodyEnd, MapInfo->TailBounce, EFI_PAGE_SIZE, PteAccess, Lazy);
   }
 
-  HartSatpMode = (RiscVGetSupervisorAddressTranslationRegister () & SATP64_MODE) >> SATP64_MODE_SHIFT;
-  if (HartSatpMode == SATP_MODE_SV39) {
-    return (1ULL << 39) - 1;
-  } else if (HartSatpMode == SATP_MODE_SV48) {
-    return (1ULL << 48) - 1;
-  } else if (HartSatpMode == SATP_MODE_SV57) {
-    return (1ULL << 57) - 1;
+  BatchStatus = IoMmuEndCommandBatch (IoMmu);
+  if (EFI_ERROR (BatchStatus) && !EFI_ERROR (Status)) {
+    Status = EFI_DEVICE_ERROR;
   }
 
-  ASSERT (FALSE);
-  return 0;
+  return Status;
 }
 
 /**
@@ -124,18 +1085,22 @@ IoMmuSetAttribute (
   IN UINT64                IoMmuAccess
   )
 {
-  EFI_DEVICE_PATH_PROTOCOL         *DevicePath;
-  MAP_INFO                         *MapInfo;
-  EFI_PCI_IO_PROTOCOL              *PciIo;
-  EFI_STATUS                       Status;
-  UINTN                            Seg;
-  UINTN                            Bus;
-  UINTN                            Dev;
-  UINTN                            Func;
-  RISCV_IOMMU_DEVICE_ID            IoMmuDeviceId;
-  
+  MAP_INFO                   *MapInfo;
+  EFI_STATUS                 Status;
+  RISCV_IOMMU_INSTANCE       *IoMmu;
+  RISCV_IOMMU_DEVICE_DOMAIN  *Domain;
+  EFI_PHYSICAL_ADDRESS       RegionStart;
+  EFI_PHYSICAL_ADDRESS       RegionEnd;
+  UINT64                     PteAccess;
+  UINT64                     HoleBytes;
+  RISCV_IOMMU_CAPABILITIES   Capabilities;
+  BOOLEAN                    Lazy;
+  BOOLEAN                    Owner;
+  BOOLEAN                    FirstGrant;
+  EFI_TPL                    OriginalTpl;
+
   DEBUG ((
-    RISCV_IOMMU_DEBUG_LEVEL,
+    SERVICE_DEBUG_LEVEL,
     "%a: DeviceHandle=0x%lx, Mapping=0x%lx, IoMmuAccess=0x%lx\n",
     __func__,
     DeviceHandle,
@@ -144,60 +1109,343 @@ IoMmuSetAttribute (
     ));
 
   //
-  // Validate input arguments 
+  // Validate input arguments 
+  //
+  if ((DeviceHandle == NULL) || (Mapping == NULL)) {
+    return EFI_INVALID_PARAMETER;
+  }
+  
+  MapInfo = IoMmuFindMapping (Mapping);
+  if ((MapInfo == NULL) || (MapInfo->Signature != MAP_INFO_SIGNATURE)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if ((IoMmuAccess & ~(UINT64)(EDKII_IOMMU_ACCESS_READ | EDKII_IOMMU_ACCESS_WRITE)) != 0) {
+    return EFI_UNSUPPORTED;
+  }
+
+  //
+  // Until an IOMMU is initialised, the device reaches the buffer at its own address,
+  // and the grant is applied once it is.
+  //
+  if (IoMmuRecordDeferredGrant (MapInfo, DeviceHandle, IoMmuAccess, &Status)) {
+    return Status;
+  }
+
+  Status = IoMmuResolveDevice (DeviceHandle, &IoMmu, &Domain);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  //
+  // A buffer beyond the device's window would only fault once the device is started.
+  //
+  if ((IoMmuAccess != 0) &&
+      (MapInfo->DeviceAddress + MapInfo->NumberOfBytes - 1 > IoMmuGetDeviceDmaLimit (DeviceHandle, Domain)))
+  {
+    DEBUG ((DEBUG_ERROR, "%a: 0x%lx is beyond the DMA window of the device\n", __func__, MapInfo->DeviceAddress));
+    return EFI_UNSUPPORTED;
+  }
+
+  //
+  // Only writes through the owner's table are tracked, so any other device's access needs the whole
+  // buffer copied back.
+  //
+  if ((MapInfo->DirtyPages != NULL) && (IoMmuAccess != 0) && !IoMmuSharesTranslation (MapInfo->OwnerDomain, Domain)) {
+    FreePool (MapInfo->DirtyPages);
+    MapInfo->DirtyPages = NULL;
+  }
+
+  //
+  // A device behind a non-coherent IOMMU is assumed to be on the same non-coherent path.
+  // A streaming buffer is cleaned or flushed for it before its transfer can start,
+  // and common buffers are left to the memory attributes of their allocation.
+  //
+  if (IoMmu->NonCoherent && (IoMmuAccess != 0) && !MapInfo->PeerToPeer &&
+      (MapInfo->Operation != EdkiiIoMmuOperationBusMasterCommonBuffer) &&
+      (MapInfo->Operation != EdkiiIoMmuOperationBusMasterCommonBuffer64))
+  {
+    IoMmuPrepareDmaBuffer (MapInfo->Operation, MapInfo->BufferAddress, MapInfo->NumberOfBytes);
+    if (MapInfo->HeadBounce != 0) {
+      IoMmuPrepareDmaBuffer (MapInfo->Operation, MapInfo->HeadBounce, EFI_PAGE_SIZE);
+    }
+
+    if (MapInfo->TailBounce != 0) {
+      IoMmuPrepareDmaBuffer (MapInfo->Operation, MapInfo->TailBounce, EFI_PAGE_SIZE);
+    }
+
+    MapInfo->NonCoherent = TRUE;
+  }
+
+  //
+  // Trusted devices reach all system memory at its own address, so only an IOVA needs a mapping.
+  // Permissive devices reach the same, but for the holes of their shared table. A buffer wholly
+  // in holes is mapped into the table like a strict one, but one that straddles a hole's edge
+  // isn't: revoking it would unmap the identity pages around it.
+  //
+  if ((Domain->Mode == RISCV_IOMMU_DEVICE_MODE_PERMISSIVE) && !IoMmuIsIova (MapInfo->DeviceAddress)) {
+    RegionStart = MapInfo->DeviceAddress & ~(EFI_PHYSICAL_ADDRESS)EFI_PAGE_MASK;
+    RegionEnd   = ALIGN_VALUE (MapInfo->DeviceAddress + MapInfo->NumberOfBytes, EFI_PAGE_SIZE);
+    HoleBytes   = IoMmuGetPermissiveHoleOverlap (RegionStart, RegionEnd);
+    if (HoleBytes == 0) {
+      return EFI_SUCCESS;
+    }
+
+    if (HoleBytes != RegionEnd - RegionStart) {
+      DEBUG ((DEBUG_ERROR, "%a: 0x%lx straddles a protected region\n", __func__, MapInfo->DeviceAddress));
+      return EFI_UNSUPPORTED;
+    }
+  } else if ((Domain->Mode != RISCV_IOMMU_DEVICE_MODE_STRICT) && !IoMmuIsIova (MapInfo->DeviceAddress)) {
+    return EFI_SUCCESS;
+  }
+
+  if (Domain->Mode == RISCV_IOMMU_DEVICE_MODE_BYPASS) {
+    DEBUG ((DEBUG_ERROR, "%a: IOVA 0x%lx is unreachable without translation\n", __func__, MapInfo->DeviceAddress));
+    return EFI_UNSUPPORTED;
+  }
+
+  //
+  // A recycled buffer is only kept warm for the device that used it before.
   //
-  if ((DeviceHandle == NULL) || (Mapping == NULL)) {
-    return EFI_INVALID_PARAMETER;
+  if (MapInfo->Recycled && (IoMmuAccess != 0)) {
+    if (!IoMmuSharesTranslation (MapInfo->OwnerDomain, Domain)) {
+      Status = RevokeOwnerTranslation (MapInfo);
+      if (EFI_ERROR (Status)) {
+        return EFI_DEVICE_ERROR;
+      }
+    }
+
+    MapInfo->Recycled = FALSE;
   }
-  
-  DevicePath = DevicePathFromHandle (DeviceHandle);
-  if (DevicePath == NULL) {
-    return EFI_INVALID_PARAMETER;
+
+  //
+  // The first device to grant access to a shared or persistent mapping owns its translation.
+  // The owner only ever gains access, and keeps the translation until its last grant is
+  // revoked, or, for an allocated buffer, until FreeBuffer(). Its other calls write no page tables.
+  // The functions of the owner's group translate through its table, so their grants count as its own.
+  //
+  // A completion at a higher TPL may grant access to the same shared mapping meanwhile, so
+  // ownership is decided, and a first grant claimed, in one short section. Only the page
+  // table update runs outside it.
+  //
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  Owner       = IoMmuSharesTranslation (MapInfo->OwnerDomain, Domain) || ((MapInfo->OwnerDomain == NULL) && (IoMmuAccess != 0));
+  FirstGrant  = Owner && (MapInfo->OwnerDomain == NULL);
+  if (Owner && (MapInfo->Persistent || (MapInfo->ReferenceCount > 1))) {
+    if (IoMmuAccess == 0) {
+      if (MapInfo->Persistent || (MapInfo->OwnerGrants > 1)) {
+        MapInfo->OwnerGrants -= MapInfo->Persistent ? 0 : 1;
+        gBS->RestoreTPL (OriginalTpl);
+        return EFI_SUCCESS;
+      }
+    } else if (IoMmuSharesTranslation (MapInfo->OwnerDomain, Domain) && ((IoMmuAccess & ~MapInfo->OwnerAccess) == 0)) {
+      MapInfo->OwnerGrants = MIN (MapInfo->OwnerGrants + 1, MapInfo->ReferenceCount);
+      gBS->RestoreTPL (OriginalTpl);
+      return EFI_SUCCESS;
+    } else {
+      IoMmuAccess |= MapInfo->OwnerAccess;
+    }
   }
 
-  MapInfo = Mapping;
-  if (MapInfo->Signature != MAP_INFO_SIGNATURE) {
-    return EFI_INVALID_PARAMETER;
+  if (FirstGrant) {
+    MapInfo->OwnerIoMmu  = IoMmu;
+    MapInfo->OwnerDomain = Domain;
   }
 
+  gBS->RestoreTPL (OriginalTpl);
+
   //
-  // FIXME: Implement this for MMIO devices against FDT/ACPI.
-  // - So, the remaining is PCI-specific.
+  // Map the pages of the device-visible buffer at its device address.
   //
-  if ((DevicePath->Type != HARDWARE_DEVICE_PATH) && (DevicePath->SubType != HW_PCI_DP)) {
-    DEBUG ((DEBUG_ERROR, "%a: At this time, only PCI devices are supported by the IOMMU driver!\n", __func__));
-    return EFI_UNSUPPORTED;
+  RegionStart = MapInfo->DeviceAddress & ~(EFI_PHYSICAL_ADDRESS)EFI_PAGE_MASK;
+  RegionEnd   = ALIGN_VALUE (MapInfo->DeviceAddress + MapInfo->NumberOfBytes, EFI_PAGE_SIZE);
+
+  //
+  // With lazy invalidation, an unmapped range is parked until the next flush.
+  // Granting access that a stale translation of the range lacks needs that flush first.
+  //
+  Lazy = IoMmuInvalidatesLazily ();
+  if (Lazy && (IoMmuAccess != 0)) {
+    Status = IoMmuFlushOverlappingInvalidations (RegionStart, RegionEnd - RegionStart, IoMmuAccess);
+    if (EFI_ERROR (Status)) {
+      if (FirstGrant) {
+        MapInfo->OwnerIoMmu  = NULL;
+        MapInfo->OwnerDomain = NULL;
+      }
+
+      return EFI_DEVICE_ERROR;
+    }
   }
 
-  if (IoMmuAccess != (EDKII_IOMMU_ACCESS_READ | EDKII_IOMMU_ACCESS_WRITE)) {
-    return EFI_INVALID_PARAMETER;
+  //
+  // A large range first granted to a function with PRI is only mapped as the function
+  // requests its pages. Revoking or widening the grant unmaps or maps all of it.
+  //
+  if (Owner) {
+    IoMmuForgetDemandMapping (MapInfo);
   }
 
   //
-  // Get device_id for this request.
+  // Replaced leaves lose their D bits, so they are sampled first.
   //
-  Status = gBS->HandleProtocol (DeviceHandle, &gEfiPciIoProtocolGuid, (VOID **)&PciIo);
-  if (EFI_ERROR (Status)) {
-    return EFI_UNSUPPORTED;
+  PteAccess = IoMmuAccess;
+  if (Owner) {
+    SampleDirtyPages (MapInfo);
+    if (FirstGrant && (MapInfo->DirtyPages == NULL)) {
+      StartDirtyTracking (MapInfo, IoMmu, Domain);
+    }
+
+    if ((MapInfo->DirtyPages != NULL) && (IoMmuAccess != 0)) {
+      PteAccess |= RISCV_IOMMU_ACCESS_TRACK_DIRTY;
+    }
   }
 
-  Status = PciIo->GetLocation (PciIo, &Seg, &Bus, &Dev, &Func);
+  //
+  // Without Svpbmt, the IOMMU leaves the memory type of a peer's BAR to the PMAs.
+  //
+  Capabilities.Uint64 = IoMmu->Capabilities;
+  if (MapInfo->PeerToPeer && Capabilities.Bits.Svpbmt && (PteAccess != 0)) {
+    PteAccess |= RISCV_IOMMU_ACCESS_DEVICE_MEMORY;
+  }
+
+  if (FirstGrant &&
+      (MapInfo->HeadBounce == 0) && (MapInfo->TailBounce == 0) &&
+      IoMmuDeferDemandMapping (
+        MapInfo,
+        Domain,
+        RegionStart,
+        MapInfo->BufferAddress & ~(EFI_PHYSICAL_ADDRESS)EFI_PAGE_MASK,
+        RegionEnd - RegionStart,
+        PteAccess
+        ))
+  {
+    Status = EFI_SUCCESS;
+  } else {
+    Status = UpdateMappingPageTable (
+               IoMmu,
+               Domain,
+               MapInfo,
+               RegionStart,
+               RegionEnd,
+               PteAccess,
+               Lazy && (IoMmuAccess == 0)
+               );
+    if (!EFI_ERROR (Status) && (IoMmuAccess == 0) && !Lazy) {
+      Status = IoMmuInvalidateDeviceAts (IoMmu, Domain, RegionStart, RegionEnd - RegionStart);
+    }
+  }
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
   if (EFI_ERROR (Status)) {
-    return EFI_UNSUPPORTED;
+    if (FirstGrant) {
+      MapInfo->OwnerIoMmu  = NULL;
+      MapInfo->OwnerDomain = NULL;
+    }
+
+    gBS->RestoreTPL (OriginalTpl);
+    return Status;
   }
 
-  IoMmuDeviceId.PciBdf.Segment  = (UINT8)Seg;
-  IoMmuDeviceId.PciBdf.Bus      = (UINT8)Bus;
-  IoMmuDeviceId.PciBdf.Device   = (UINT8)Dev;
-  IoMmuDeviceId.PciBdf.Function = (UINT8)Func;
+  //
+  // Every Map() of the range may hold a grant, and revoking the last one unmaps it.
+  //
+  if (Owner && (IoMmuAccess != 0)) {
+    if (FirstGrant) {
+      IoMmuCountMapping (Domain, MapInfo);
+    }
+
+    MapInfo->OwnerIoMmu  = IoMmu;
+    MapInfo->OwnerDomain = Domain;
+    MapInfo->OwnerAccess = IoMmuAccess;
+    MapInfo->OwnerGrants = MIN (MapInfo->OwnerGrants + 1, MapInfo->ReferenceCount);
+  } else if (Owner) {
+    MapInfo->OwnerIoMmu  = NULL;
+    MapInfo->OwnerDomain = NULL;
+    MapInfo->OwnerAccess = 0;
+    MapInfo->OwnerGrants = 0;
+  }
 
   //
-  // TODO: Make this handle a specific IOMMU, while we perform preparation and discovery.
+  // A buffer mapped in place over part of its pages exposes their other bytes to the device,
+  // unless those pages are bounced.
   //
-  Status = EFI_DEVICE_ERROR;
-  ASSERT_EFI_ERROR (Status);
+  if ((IoMmuAccess != 0) && (MapInfo->IoMmuAccess == 0) && (MapInfo->BufferAddress == MapInfo->HostAddress) &&
+      (MapInfo->HeadBounce == 0) && (MapInfo->TailBounce == 0))
+  {
+    Domain->ExposedBytes += (RegionEnd - RegionStart) - MapInfo->NumberOfBytes;
+    DEBUG ((
+      DEBUG_VERBOSE,
+      "%a: device_id 0x%x can reach 0x%lx bytes beside its buffers\n",
+      __func__,
+      Domain->DeviceId.Uint32,
+      Domain->ExposedBytes
+      ));
+  }
 
-  return Status;
+  if (IoMmuAccess != 0) {
+    MapInfo->IoMmuAccess = IoMmuAccess;
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+
+  if ((IoMmuAccess == 0) && Lazy) {
+    return IoMmuDeferInvalidation (MapInfo);
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Return whether a range is the MMIO of a device, which another device can target with
+  peer-to-peer DMA, as the GCD map describes it.
+
+  @param[in]  Address  The start of the range.
+  @param[in]  Length   The length of the range.
+
+  @retval  TRUE   The whole range is MMIO.
+  @retval  FALSE  The range isn't MMIO, or only partly.
+
+**/
+STATIC
+BOOLEAN
+IsPeerToPeerTarget (
+  IN EFI_PHYSICAL_ADDRESS  Address,
+  IN UINTN                 Length
+  )
+{
+  EFI_PHYSICAL_ADDRESS  End;
+  EFI_TPL               OriginalTpl;
+  BOOLEAN               MemoryMappedIo;
+
+  if ((Length == 0) || (Address + Length < Address)) {
+    return FALSE;
+  }
+
+  OriginalTpl    = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  MemoryMappedIo = TRUE;
+  End            = Address + Length;
+  while (Address < End) {
+    if ((mLastMemorySpace.Length == 0) ||
+        (Address < mLastMemorySpace.BaseAddress) ||
+        (Address - mLastMemorySpace.BaseAddress >= mLastMemorySpace.Length))
+    {
+      if (EFI_ERROR (gDS->GetMemorySpaceDescriptor (Address, &mLastMemorySpace))) {
+        mLastMemorySpace.Length = 0;
+        MemoryMappedIo          = FALSE;
+        break;
+      }
+    }
+
+    if (mLastMemorySpace.GcdMemoryType != EfiGcdMemoryTypeMemoryMappedIo) {
+      MemoryMappedIo = FALSE;
+      break;
+    }
+
+    Address = mLastMemorySpace.BaseAddress + mLastMemorySpace.Length;
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+  return MemoryMappedIo;
 }
 
 /**
@@ -232,18 +1480,25 @@ IoMmuMap (
   )
 {
   BOOLEAN               NeedRemap;
+  BOOLEAN               NeedIova;
+  BOOLEAN               NeedSplit;
+  BOOLEAN               PeerToPeer;
   EFI_PHYSICAL_ADDRESS  PhysicalAddress;
   EFI_PHYSICAL_ADDRESS  DmaMemoryTop;
   MAP_INFO              *MapInfo;
   EFI_STATUS            Status;
-#if 0
   EFI_TPL               OriginalTpl;
-#endif
+  UINT64                StartTime;
+  UINT8                 BounceReason;
 
-  NeedRemap = FALSE;
+  StartTime    = GetPerformanceCounter ();
+  NeedRemap    = FALSE;
+  NeedIova     = FALSE;
+  NeedSplit    = FALSE;
+  BounceReason = RiscVIoMmuBounceReasonMax;
 
   DEBUG ((
-    RISCV_IOMMU_DEBUG_LEVEL,
+    SERVICE_DEBUG_LEVEL,
     "%a: Operation=0x%lx, HostAddress=0x%lx, *NumberOfBytes=0x%lx\n",
     __func__,
     Operation,
@@ -262,42 +1517,123 @@ IoMmuMap (
     return EFI_INVALID_PARAMETER;
   }
 
+  //
+  // A common buffer from IoMmuAllocateBuffer() is already tracked, so mapping it is a lookup.
+  //
+  PhysicalAddress = (EFI_PHYSICAL_ADDRESS)HostAddress;
+  if ((Operation == EdkiiIoMmuOperationBusMasterCommonBuffer) ||
+      (Operation == EdkiiIoMmuOperationBusMasterCommonBuffer64))
+  {
+    MapInfo = FindPersistentMapping (Operation, PhysicalAddress, *NumberOfBytes);
+    if (MapInfo != NULL) {
+      *DeviceAddress = MapInfo->DeviceAddress;
+      *Mapping       = MapInfo;
+      return EFI_SUCCESS;
+    }
+  }
+
+  //
+  // A range that is already mapped in place for the same operation, as when a driver
+  // maps one buffer for several requests, shares that mapping and its translation.
+  //
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  MapInfo     = IoMmuFindMappingByHostRange (Operation, PhysicalAddress, *NumberOfBytes);
+  if ((MapInfo != NULL) && !MapInfo->Persistent && (MapInfo->BufferAddress == MapInfo->HostAddress) &&
+      (MapInfo->HeadBounce == 0) && (MapInfo->TailBounce == 0))
+  {
+    MapInfo->ReferenceCount++;
+    gBS->RestoreTPL (OriginalTpl);
+
+    *DeviceAddress = MapInfo->DeviceAddress;
+    *Mapping       = MapInfo;
+    return EFI_SUCCESS;
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+
   //
   // If the caller goes through IoMmuAllocateBuffer first, then the host buffer
   // already satisfies the IOMMU's requirement. But that isn't guaranteed, so we check here too.
   //
-  PhysicalAddress = (EFI_PHYSICAL_ADDRESS)HostAddress;
   DmaMemoryTop = RiscVGetIoMmuMemoryTop ();
 
   if ((PhysicalAddress + *NumberOfBytes) >= DmaMemoryTop) {
-    NeedRemap = TRUE;
+    NeedRemap    = TRUE;
+    BounceReason = RiscVIoMmuBounceAboveDmaTop;
   }
 
   //
   // If this is a 32-bit request (if the root bridge or device cannot handle 64-bit access)
-  // and any part of the DMA transfer being mapped is above 4GB, then remap the DMA transfer.
+  // and any part of the DMA transfer being mapped is above 4GB, then give the transfer
+  // an IOVA below 4GB. Without translation, remap the DMA transfer instead.
   //
   if (((Operation != EdkiiIoMmuOperationBusMasterRead64) &&
        (Operation != EdkiiIoMmuOperationBusMasterWrite64) &&
        (Operation != EdkiiIoMmuOperationBusMasterCommonBuffer64)) &&
       ((PhysicalAddress + *NumberOfBytes) > SIZE_4GB)) {
-    NeedRemap = TRUE;
+    if (mRiscVIoMmuGlobalDriverContext.TranslationEnabled) {
+      NeedIova = TRUE;
+    } else {
+      NeedRemap = TRUE;
+    }
+
+    if (BounceReason == RiscVIoMmuBounceReasonMax) {
+      BounceReason = RiscVIoMmuBounceAbove4GB;
+    }
+
     DmaMemoryTop = MIN (DmaMemoryTop, SIZE_4GB - 1);
   }
 
   //
   // If this is a dedicated buffer, check that it can fit on a page table.
+  // Optionally, its enclosing pages are mapped instead, at their own IOVAs,
+  // so that unmapping a neighbouring buffer in the same pages doesn't revoke them.
+  // Otherwise, with translation, a buffer that covers whole pages is split: those pages
+  // are mapped in place at an IOVA, and only its partial first and last pages are bounced.
   //
   if (((Operation != EdkiiIoMmuOperationBusMasterCommonBuffer) &&
        (Operation != EdkiiIoMmuOperationBusMasterCommonBuffer64)) && 
       ((PhysicalAddress != ALIGN_VALUE(PhysicalAddress, SIZE_4KB)) ||
        (*NumberOfBytes != ALIGN_VALUE(*NumberOfBytes, SIZE_4KB)))) {
-    NeedRemap = TRUE;
+    if (PcdGetBool (PcdRiscVIoMmuMapUnalignedInPlace) && mRiscVIoMmuGlobalDriverContext.TranslationEnabled) {
+      NeedIova = TRUE;
+    } else if (mRiscVIoMmuGlobalDriverContext.TranslationEnabled &&
+               (ALIGN_VALUE (PhysicalAddress, EFI_PAGE_SIZE) < ((PhysicalAddress + *NumberOfBytes) & ~(EFI_PHYSICAL_ADDRESS)EFI_PAGE_MASK)))
+    {
+      NeedIova  = TRUE;
+      NeedSplit = TRUE;
+    } else {
+      NeedRemap = TRUE;
+    }
+
+    if (BounceReason == RiscVIoMmuBounceReasonMax) {
+      BounceReason = RiscVIoMmuBounceUnaligned;
+    }
+  }
+
+  //
+  // The BAR of another device can't be copied through a bounce buffer. It is mapped in place,
+  // at an IOVA when the device can't reach it at its own address.
+  //
+  PeerToPeer = IsPeerToPeerTarget (PhysicalAddress, *NumberOfBytes);
+  if (PeerToPeer) {
+    NeedSplit = FALSE;
+  }
+
+  if (PeerToPeer && NeedRemap) {
+    if (mRiscVIoMmuGlobalDriverContext.TranslationEnabled) {
+      NeedIova = TRUE;
+    } else if ((PhysicalAddress + *NumberOfBytes) > DmaMemoryTop) {
+      DEBUG ((DEBUG_ERROR, "%a: MMIO at 0x%lx is out of reach of the device\n", __func__, PhysicalAddress));
+      return EFI_UNSUPPORTED;
+    }
+
+    NeedRemap = FALSE;
   }
 
   //
   // Common Buffer operations can not be remapped. If the common buffer is above 4GB
-  // then it is not possible to generate a mapping, so return an error.
+  // without translation, then it is not possible to generate a mapping, so return an error.
   //
   if ((Operation == EdkiiIoMmuOperationBusMasterCommonBuffer) ||
       (Operation == EdkiiIoMmuOperationBusMasterCommonBuffer64)) {
@@ -310,37 +1646,114 @@ IoMmuMap (
   //
   // Allocate a MAP_INFO structure to remember the mapping for later steps.
   //
-  MapInfo = AllocatePool (sizeof (MAP_INFO));
+  MapInfo = AllocateMapInfo ();
   if (MapInfo == NULL) {
     *NumberOfBytes = 0;
     return EFI_OUT_OF_RESOURCES;
   }
 
-  MapInfo->Signature         = MAP_INFO_SIGNATURE;
-  MapInfo->Operation         = Operation;
-  MapInfo->HostAddress       = PhysicalAddress;
-  MapInfo->NumberOfBytes     = *NumberOfBytes;
-  MapInfo->DeviceAddress     = DmaMemoryTop;
+  MapInfo->Signature           = MAP_INFO_SIGNATURE;
+  MapInfo->Operation           = Operation;
+  MapInfo->HostAddress         = PhysicalAddress;
+  MapInfo->NumberOfBytes       = *NumberOfBytes;
+  MapInfo->DeviceAddress       = PhysicalAddress;
+  MapInfo->BufferAddress       = PhysicalAddress;
+  MapInfo->HeadBounce          = 0;
+  MapInfo->TailBounce          = 0;
+  MapInfo->IoMmuAccess         = 0;
+  MapInfo->InvalidationPending = FALSE;
+  MapInfo->ReleasePending      = FALSE;
+  MapInfo->Persistent          = FALSE;
+  MapInfo->MemoryType          = EfiBootServicesData;
+  MapInfo->Cached              = FALSE;
+  MapInfo->Recycled            = FALSE;
+  MapInfo->ReferenceCount      = 1;
+  MapInfo->OwnerIoMmu          = NULL;
+  MapInfo->OwnerDomain         = NULL;
+  MapInfo->OwnerAccess         = 0;
+  MapInfo->OwnerGrants         = 0;
+  MapInfo->DemandMapped        = FALSE;
+  MapInfo->DirtyPages          = NULL;
+  MapInfo->NonCoherent         = FALSE;
+  MapInfo->PeerToPeer          = PeerToPeer;
+  MapInfo->WriteCombining      = FALSE;
+  MapInfo->OriginalAttributes  = 0;
+  MapInfo->BounceReason        = BounceReason;
+  MapInfo->BouncedBytes        = 0;
+  MapInfo->MapTime             = 0;
 #if 0
   InitializeListHead(&MapInfo->HandleList);
 #endif
 
+  //
+  // Map the buffer in place at a low IOVA, and only bounce it when the window is exhausted.
+  //
+  if (NeedIova && !NeedRemap) {
+    MapInfo->DeviceAddress = IoMmuAllocateIova (EFI_SIZE_TO_PAGES ((PhysicalAddress & EFI_PAGE_MASK) + MapInfo->NumberOfBytes), PhysicalAddress);
+    if ((MapInfo->DeviceAddress == 0) && !EFI_ERROR (IoMmuFlushDeferredInvalidations ())) {
+      //
+      // Parked mappings may hold the IOVAs.
+      //
+      MapInfo->DeviceAddress = IoMmuAllocateIova (EFI_SIZE_TO_PAGES ((PhysicalAddress & EFI_PAGE_MASK) + MapInfo->NumberOfBytes), PhysicalAddress);
+    }
+
+    //
+    // Without bounce pages for its partial pages, a split buffer is bounced whole.
+    //
+    if ((MapInfo->DeviceAddress != 0) && NeedSplit && !AllocateSplitBounce (MapInfo, RiscVGetIoMmuMemoryTop ())) {
+      IoMmuFreeIova (MapInfo->DeviceAddress, EFI_SIZE_TO_PAGES ((PhysicalAddress & EFI_PAGE_MASK) + MapInfo->NumberOfBytes));
+      MapInfo->DeviceAddress = 0;
+    }
+
+    if (MapInfo->DeviceAddress != 0) {
+      MapInfo->DeviceAddress += PhysicalAddress & EFI_PAGE_MASK;
+    } else if (PeerToPeer ||
+               (Operation == EdkiiIoMmuOperationBusMasterCommonBuffer) ||
+               (Operation == EdkiiIoMmuOperationBusMasterCommonBuffer64)) {
+      *NumberOfBytes = 0;
+      FreeMapInfo (MapInfo);
+      return EFI_OUT_OF_RESOURCES;
+    } else {
+      NeedRemap = TRUE;
+    }
+  }
+
   //
   // Allocate a buffer that fulfils the device's requirements.
   //
   if (NeedRemap) {
-    Status = gBS->AllocatePages (
-                    AllocateMaxAddress,
-                    EfiBootServicesData,
-                    EFI_SIZE_TO_PAGES (MapInfo->NumberOfBytes),
-                    &MapInfo->DeviceAddress
-                    );
-    if (EFI_ERROR (Status)) {
-      *NumberOfBytes = 0;
-      FreePool (MapInfo);
-      return Status;
+    //
+    // Serve the buffer from the bounce pool, and only fall back to the DXE core when it is exhausted.
+    //
+    MapInfo->BufferAddress = IoMmuAllocateBounceBuffer (EFI_SIZE_TO_PAGES (MapInfo->NumberOfBytes), DmaMemoryTop);
+    if ((MapInfo->BufferAddress == 0) && !EFI_ERROR (IoMmuFlushDeferredInvalidations ())) {
+      MapInfo->BufferAddress = IoMmuAllocateBounceBuffer (EFI_SIZE_TO_PAGES (MapInfo->NumberOfBytes), DmaMemoryTop);
     }
 
+    if (MapInfo->BufferAddress == 0) {
+      if (!IoMmuChargeFootprint (RiscVIoMmuFootprintBounce, EFI_PAGES_TO_SIZE (EFI_SIZE_TO_PAGES (MapInfo->NumberOfBytes)))) {
+        *NumberOfBytes = 0;
+        FreeMapInfo (MapInfo);
+        return EFI_OUT_OF_RESOURCES;
+      }
+
+      MapInfo->BufferAddress = DmaMemoryTop;
+      Status                 = gBS->AllocatePages (
+                                      AllocateMaxAddress,
+                                      EfiBootServicesData,
+                                      EFI_SIZE_TO_PAGES (MapInfo->NumberOfBytes),
+                                      &MapInfo->BufferAddress
+                                      );
+      if (EFI_ERROR (Status)) {
+        IoMmuReleaseFootprint (RiscVIoMmuFootprintBounce, EFI_PAGES_TO_SIZE (EFI_SIZE_TO_PAGES (MapInfo->NumberOfBytes)));
+        *NumberOfBytes = 0;
+        FreeMapInfo (MapInfo);
+        return Status;
+      }
+    }
+
+    MapInfo->DeviceAddress = MapInfo->BufferAddress;
+
     //
     // If this is a read operation from the Bus Master's point of view,
     // then copy the contents of the real buffer into the mapped buffer
@@ -349,25 +1762,40 @@ IoMmuMap (
     if ((Operation == EdkiiIoMmuOperationBusMasterRead) ||
         (Operation == EdkiiIoMmuOperationBusMasterRead64)) {
       CopyMem (
-        (VOID *)MapInfo->DeviceAddress,
+        (VOID *)MapInfo->BufferAddress,
         (VOID *)MapInfo->HostAddress,
         MapInfo->NumberOfBytes
         );
     }
+  }
+
+  //
+  // What was bounced, and why, is counted for the device that is granted access.
+  //
+  if (NeedRemap) {
+    MapInfo->BouncedBytes = MapInfo->NumberOfBytes;
   } else {
-    MapInfo->DeviceAddress = MapInfo->HostAddress;
+    if (MapInfo->HeadBounce != 0) {
+      MapInfo->BouncedBytes += ALIGN_VALUE (PhysicalAddress, EFI_PAGE_SIZE) - PhysicalAddress;
+    }
+
+    if (MapInfo->TailBounce != 0) {
+      MapInfo->BouncedBytes += (PhysicalAddress + MapInfo->NumberOfBytes) & EFI_PAGE_MASK;
+    }
   }
 
-#if 0
-  OriginalTpl = gBS->RaiseTPL (VTD_TPL_LEVEL);
-  InsertTailList (&gMaps, &MapInfo->Link);
-  gBS->RestoreTPL (OriginalTpl);
-#endif
+  Status = IoMmuInsertMapping (MapInfo);
+  if (EFI_ERROR (Status)) {
+    IoMmuReleaseMapping (MapInfo);
+    *NumberOfBytes = 0;
+    return Status;
+  }
 
-  *DeviceAddress = MapInfo->DeviceAddress;
-  *Mapping       = MapInfo;
+  MapInfo->MapTime = GetTimeInNanoSecond (GetPerformanceCounter () - StartTime);
+  *DeviceAddress   = MapInfo->DeviceAddress;
+  *Mapping         = MapInfo;
 
-  DEBUG ((RISCV_IOMMU_DEBUG_LEVEL, "%a: *DeviceAddress=0x%lx *Mapping=0x%x\n", __func__, *DeviceAddress, *Mapping));
+  DEBUG ((SERVICE_DEBUG_LEVEL, "%a: *DeviceAddress=0x%lx *Mapping=0x%x\n", __func__, *DeviceAddress, *Mapping));
   return EFI_SUCCESS;
 }
 
@@ -389,16 +1817,16 @@ IoMmuUnmap (
   IN  VOID                  *Mapping
   )
 {
+  MAP_INFO                   *MapInfo;
+  RISCV_IOMMU_DEVICE_DOMAIN  *Domain;
+  EFI_TPL                    OriginalTpl;
+  UINT64                     StartTime;
 #if 0
-  EFI_TPL          OriginalTpl;
-#endif
-  MAP_INFO         *MapInfo;
-#if 0
-  LIST_ENTRY       *Link;
-  MAP_HANDLE_INFO  *MapHandleInfo;
+  MAP_HANDLE_INFO            *MapHandleInfo;
 #endif
 
-  DEBUG ((RISCV_IOMMU_DEBUG_LEVEL, "%a: Mapping=0x%lx\n", __func__, Mapping));
+  StartTime = GetPerformanceCounter ();
+  DEBUG ((SERVICE_DEBUG_LEVEL, "%a: Mapping=0x%lx\n", __func__, Mapping));
 
   //
   // Validate input arguments
@@ -408,37 +1836,35 @@ IoMmuUnmap (
   }
 
   //
-  // Find the MAP_INFO structure.
+  // A persistent mapping outlives its Map()s, until FreeBuffer().
   //
-#if 0
-  OriginalTpl = gBS->RaiseTPL (VTD_TPL_LEVEL);
-  MapInfo     = NULL;
-  for (Link = GetFirstNode (&gMaps)
-       ; !IsNull (&gMaps, Link)
-       ; Link = GetNextNode (&gMaps, Link)
-       ) {
-    MapInfo = MAP_INFO_FROM_LINK (Link);
-    if (Mapping == MapInfo) {
-      break;
-    }
+  MapInfo = IoMmuFindMapping (Mapping);
+  if ((MapInfo != NULL) && (MapInfo->Signature == MAP_INFO_SIGNATURE) && MapInfo->Persistent) {
+    return EFI_SUCCESS;
   }
 
   //
-  // Mapping is not a valid value returned by Map().
+  // A shared mapping outlives all but the last of its Map()s.
+  // Each of them may hold at most one grant of the translation.
   //
-  if (Mapping != MapInfo) {
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  if ((MapInfo != NULL) && (MapInfo->Signature == MAP_INFO_SIGNATURE) && (MapInfo->ReferenceCount > 1)) {
+    MapInfo->ReferenceCount--;
+    MapInfo->OwnerGrants = MIN (MapInfo->OwnerGrants, MapInfo->ReferenceCount);
     gBS->RestoreTPL (OriginalTpl);
-    return EFI_INVALID_PARAMETER;
+    return EFI_SUCCESS;
   }
 
-  RemoveEntryList (&MapInfo->Link);
+  //
+  // Find and remove the MAP_INFO structure. Mapping is not a valid value returned by Map() otherwise.
+  //
+  MapInfo = IoMmuRemoveMapping (Mapping);
   gBS->RestoreTPL (OriginalTpl);
-#else
-  MapInfo = Mapping;
-  if (MapInfo->Signature != MAP_INFO_SIGNATURE) {
+  if ((MapInfo == NULL) || (MapInfo->Signature != MAP_INFO_SIGNATURE)) {
     return EFI_INVALID_PARAMETER;
   }
-#endif
+
+  Domain = MapInfo->OwnerDomain;
 
 #if 0
   //
@@ -451,31 +1877,101 @@ IoMmuUnmap (
   }
 #endif
 
-  if (MapInfo->DeviceAddress != MapInfo->HostAddress) {
-    //
-    // If this is a write operation from the Bus Master's point of view,
-    // then copy the contents of the mapped buffer into the real buffer
-    // so that the processor can read the contents of the real buffer.
-    //
-    if ((MapInfo->Operation == EdkiiIoMmuOperationBusMasterWrite) ||
-        (MapInfo->Operation == EdkiiIoMmuOperationBusMasterWrite64)) {
-      CopyMem (
-        (VOID *)MapInfo->HostAddress,
-        (VOID *)MapInfo->DeviceAddress,
-        MapInfo->NumberOfBytes
-        );
+  if (MapInfo->NonCoherent) {
+    IoMmuCompleteDmaBuffer (MapInfo->Operation, MapInfo->BufferAddress, MapInfo->NumberOfBytes);
+    if (MapInfo->HeadBounce != 0) {
+      IoMmuCompleteDmaBuffer (MapInfo->Operation, MapInfo->HeadBounce, EFI_PAGE_SIZE);
     }
 
-    //
-    // Free the mapped buffer and the MAP_INFO structure.
-    //
-    gBS->FreePages (MapInfo->DeviceAddress, EFI_SIZE_TO_PAGES (MapInfo->NumberOfBytes));
+    if (MapInfo->TailBounce != 0) {
+      IoMmuCompleteDmaBuffer (MapInfo->Operation, MapInfo->TailBounce, EFI_PAGE_SIZE);
+    }
+  }
+
+  //
+  // If this is a write operation from the Bus Master's point of view,
+  // then copy the contents of the mapped buffer into the real buffer
+  // so that the processor can read the contents of the real buffer.
+  //
+  if ((MapInfo->BufferAddress != MapInfo->HostAddress) &&
+      ((MapInfo->Operation == EdkiiIoMmuOperationBusMasterWrite) ||
+       (MapInfo->Operation == EdkiiIoMmuOperationBusMasterWrite64))) {
+    CopyBackBounceBuffer (MapInfo);
+  } else if ((MapInfo->Operation == EdkiiIoMmuOperationBusMasterWrite) ||
+             (MapInfo->Operation == EdkiiIoMmuOperationBusMasterWrite64)) {
+    CopyBackSplitBounce (MapInfo);
+  }
+
+  //
+  // Free the mapped buffer or IOVA, and the MAP_INFO structure.
+  // Translations the IOMMU may still cache keep them until the flush queue releases them.
+  //
+  if (!IoMmuDeferRelease (MapInfo)) {
+    IoMmuReleaseMapping (MapInfo);
+  }
+
+  if (Domain != NULL) {
+    IoMmuCountUnmapping (Domain, StartTime);
   }
 
-  FreePool (Mapping);
   return EFI_SUCCESS;
 }
 
+/**
+  Allocate the pages of a common buffer below a limit.
+
+  A buffer of PcdRiscVIoMmuSuperpageBufferThreshold or more is placed at a 2 MiB
+  boundary, by allocating the pages that alignment may skip as well and freeing
+  them after, so that its mapping takes 2 MiB leaves and IOTLB entries instead of
+  one per page. Without memory for those, it is placed wherever it fits.
+
+  @param[in]      MemoryType       The type of memory to allocate.
+  @param[in]      Pages            The number of pages.
+  @param[in,out]  PhysicalAddress  On input, the highest address the buffer may reach.
+                                   On output, the address of the buffer.
+
+  @return  The status of the allocation, as for AllocatePages().
+
+**/
+STATIC
+EFI_STATUS
+AllocateCommonBufferPages (
+  IN     EFI_MEMORY_TYPE       MemoryType,
+  IN     UINTN                 Pages,
+  IN OUT EFI_PHYSICAL_ADDRESS  *PhysicalAddress
+  )
+{
+  EFI_PHYSICAL_ADDRESS  Address;
+  EFI_PHYSICAL_ADDRESS  Aligned;
+  UINTN                 SlackPages;
+  UINTN                 HeadPages;
+  UINT32                Threshold;
+  EFI_STATUS            Status;
+
+  Threshold  = PcdGet32 (PcdRiscVIoMmuSuperpageBufferThreshold);
+  SlackPages = EFI_SIZE_TO_PAGES (SIZE_2MB) - 1;
+  if ((Threshold != 0) && (Pages >= EFI_SIZE_TO_PAGES (Threshold)) && (Pages <= MAX_UINTN - SlackPages)) {
+    Address = *PhysicalAddress;
+    Status  = gBS->AllocatePages (AllocateMaxAddress, MemoryType, Pages + SlackPages, &Address);
+    if (!EFI_ERROR (Status)) {
+      Aligned   = ALIGN_VALUE (Address, SIZE_2MB);
+      HeadPages = EFI_SIZE_TO_PAGES ((UINTN)(Aligned - Address));
+      if (HeadPages != 0) {
+        gBS->FreePages (Address, HeadPages);
+      }
+
+      if (HeadPages != SlackPages) {
+        gBS->FreePages (Aligned + EFI_PAGES_TO_SIZE (Pages), SlackPages - HeadPages);
+      }
+
+      *PhysicalAddress = Aligned;
+      return EFI_SUCCESS;
+    }
+  }
+
+  return gBS->AllocatePages (AllocateMaxAddress, MemoryType, Pages, PhysicalAddress);
+}
+
 /**
   Allocates pages that are suitable for an OperationBusMasterCommonBuffer or
   OperationBusMasterCommonBuffer64 mapping.
@@ -508,10 +2004,11 @@ IoMmuAllocateBuffer (
   )
 {
   EFI_PHYSICAL_ADDRESS  PhysicalAddress;
+  MAP_INFO              *MapInfo;
   EFI_STATUS            Status;
 
   DEBUG ((
-    RISCV_IOMMU_DEBUG_LEVEL,
+    SERVICE_DEBUG_LEVEL,
     "%a: MemoryType=0x%lx, Pages=0x%lx, Attributes=0x%lx\n",
     __func__,
     MemoryType,
@@ -540,10 +2037,9 @@ IoMmuAllocateBuffer (
 
   //
   // Determine the highest available address usable by the IOMMU for this mapping.
-  // - This should probably be IOSATP's MODE, but we're at an earlier step in EDK2's IOMMU protocol flow,
+  // - This can't be the IOSATP MODE of the device, as we're at an earlier step in EDK2's IOMMU protocol flow,
   //   which means that the device context is unfindable because we aren't provided a device_id yet.
-  //   Since we set the IOMMU to the same mode as the HART, and use GXL as an override (which forces SXL and SV32),
-  //   this is fine.
+  //   Every IOMMU's mode maps all system memory though, and GXL overrides it (forcing SXL and SV32).
   //
   PhysicalAddress = RiscVGetIoMmuMemoryTop ();
   if ((Attributes & EDKII_IOMMU_ATTRIBUTE_DUAL_ADDRESS_CYCLE) == 0) {
@@ -553,19 +2049,36 @@ IoMmuAllocateBuffer (
     PhysicalAddress = MIN (PhysicalAddress, SIZE_4GB - 1);
   }
 
-  Status = gBS->AllocatePages (
-                  AllocateMaxAddress,
-                  MemoryType,
-                  Pages,
-                  &PhysicalAddress
-                  );
+  //
+  // A recently freed buffer of the same size comes with its mapping.
+  //
+  MapInfo = IoMmuTakeCachedBuffer (MemoryType, Pages, PhysicalAddress);
+  if (MapInfo != NULL) {
+    MapInfo->Operation = ((Attributes & EDKII_IOMMU_ATTRIBUTE_DUAL_ADDRESS_CYCLE) != 0) ?
+                         EdkiiIoMmuOperationBusMasterCommonBuffer64 :
+                         EdkiiIoMmuOperationBusMasterCommonBuffer;
+    MapInfo->Recycled  = TRUE;
+    if ((Attributes & EDKII_IOMMU_ATTRIBUTE_MEMORY_WRITE_COMBINE) != 0) {
+      SetWriteCombining (MapInfo);
+    }
+
+    *HostAddress = (VOID *)(UINTN)MapInfo->HostAddress;
+    return EFI_SUCCESS;
+  }
+
+  Status = AllocateCommonBufferPages (MemoryType, Pages, &PhysicalAddress);
   if (EFI_ERROR (Status)) {
     return Status;
   }
 
+  MapInfo = CreatePersistentMapping (PhysicalAddress, Pages, MemoryType, Attributes);
+  if ((MapInfo != NULL) && ((Attributes & EDKII_IOMMU_ATTRIBUTE_MEMORY_WRITE_COMBINE) != 0)) {
+    SetWriteCombining (MapInfo);
+  }
+
   *HostAddress = (VOID *)PhysicalAddress;
 
-  DEBUG ((RISCV_IOMMU_DEBUG_LEVEL, "%a: *HostAddress=0x%x\n", __func__, *HostAddress));
+  DEBUG ((SERVICE_DEBUG_LEVEL, "%a: *HostAddress=0x%x\n", __func__, *HostAddress));
   return EFI_SUCCESS;
 }
 
@@ -589,6 +2102,90 @@ IoMmuFreeBuffer (
   IN  VOID                  *HostAddress
   )
 {
-  DEBUG ((RISCV_IOMMU_DEBUG_LEVEL, "%a: HostAddress=0x%lx, Pages=0x%lx\n", __func__, HostAddress, Pages));
+  MAP_INFO    *MapInfo;
+  EFI_STATUS  Status;
+
+  DEBUG ((SERVICE_DEBUG_LEVEL, "%a: HostAddress=0x%lx, Pages=0x%lx\n", __func__, HostAddress, Pages));
+
+  //
+  // No device may reach the pages of a persistent mapping once they are freed.
+  // Small buffers are kept instead, still reachable by the device that used them.
+  //
+  MapInfo = IoMmuFindMappingByDeviceAddress ((EFI_PHYSICAL_ADDRESS)HostAddress);
+  if ((MapInfo != NULL) && MapInfo->Persistent && (MapInfo->HostAddress == (EFI_PHYSICAL_ADDRESS)HostAddress)) {
+    if (MapInfo->Cached) {
+      return EFI_INVALID_PARAMETER;
+    }
+
+    //
+    // Neither the buffer cache nor the pool may hand out write-combining memory.
+    //
+    RestoreWriteBack (MapInfo);
+
+    if ((EFI_PAGES_TO_SIZE (Pages) == MapInfo->NumberOfBytes) && IoMmuCacheBuffer (MapInfo, MapInfo->MemoryType)) {
+      return EFI_SUCCESS;
+    }
+
+    Status = IoMmuDestroyPersistentMapping (MapInfo);
+    if (EFI_ERROR (Status)) {
+      DEBUG ((DEBUG_ERROR, "%a: 0x%lx is leaked\n", __func__, HostAddress));
+      return Status;
+    }
+  }
+
   return gBS->FreePages ((EFI_PHYSICAL_ADDRESS)HostAddress, Pages);
 }
+
+/**
+  Determine whether a device reaches system memory at its own address, and up to which address.
+
+  Identity and bypass devices do, unless their IOMMU is non-coherent: then SetAttribute()
+  still prepares their streaming buffers. Map() bounces any buffer that reaches DmaMemoryTop.
+
+  @param[in]  This           The protocol instance pointer.
+  @param[in]  DeviceHandle   The device that does the DMA.
+  @param[out] IdentityLimit  The highest system memory address that the device reaches at
+                             its own address.
+
+  @retval EFI_SUCCESS            The device reaches system memory up to IdentityLimit at its own address.
+  @retval EFI_INVALID_PARAMETER  DeviceHandle or IdentityLimit is NULL.
+  @retval EFI_UNSUPPORTED        Every DMA buffer of the device needs the IOMMU protocol services,
+                                 or DeviceHandle is unknown by the IOMMU.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+IoMmuGetIdentityLimit (
+  IN  EDKII_IOMMU_DEVICE_HINT_PROTOCOL  *This,
+  IN  EFI_HANDLE                        DeviceHandle,
+  OUT EFI_PHYSICAL_ADDRESS              *IdentityLimit
+  )
+{
+  RISCV_IOMMU_INSTANCE       *IoMmu;
+  RISCV_IOMMU_DEVICE_DOMAIN  *Domain;
+  EFI_STATUS                 Status;
+
+  if ((DeviceHandle == NULL) || (IdentityLimit == NULL)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Status = IoMmuResolveDevice (DeviceHandle, &IoMmu, &Domain);
+  if (EFI_ERROR (Status)) {
+    return EFI_UNSUPPORTED;
+  }
+
+  if (((Domain->Mode != RISCV_IOMMU_DEVICE_MODE_IDENTITY) && (Domain->Mode != RISCV_IOMMU_DEVICE_MODE_BYPASS)) ||
+      IoMmu->NonCoherent || (mRiscVIoMmuGlobalDriverContext.DmaMemoryTop == 0))
+  {
+    return EFI_UNSUPPORTED;
+  }
+
+  *IdentityLimit = MIN (Domain->DmaAddressLimit, mRiscVIoMmuGlobalDriverContext.DmaMemoryTop - 1);
+  return EFI_SUCCESS;
+}
+
+EDKII_IOMMU_DEVICE_HINT_PROTOCOL  mRiscVIoMmuDeviceHintProtocol = {
+  EDKII_IOMMU_DEVICE_HINT_PROTOCOL_REVISION,
+  IoMmuGetIdentityLimit
+};
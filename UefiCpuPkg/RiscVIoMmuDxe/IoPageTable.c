@@ -0,0 +1,1121 @@
+/** @file
+  RISC-V IOMMU first-stage IO page tables.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/DxeServicesTableLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
+#include <Library/RiscVPageTableLib.h>
+#include <Library/RiscVPmuProfileLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Register/RiscV64/RiscVImpl.h>
+#include "RiscVIoMmu.h"
+
+#define RISCV_IOMMU_PTE_V  BIT0
+#define RISCV_IOMMU_PTE_R  BIT1
+#define RISCV_IOMMU_PTE_W  BIT2
+#define RISCV_IOMMU_PTE_X  BIT3
+#define RISCV_IOMMU_PTE_U  BIT4
+#define RISCV_IOMMU_PTE_A  BIT6
+#define RISCV_IOMMU_PTE_D  BIT7
+
+#define RISCV_IOMMU_PTE_PPN_MASK   0x3FFFFFFFFFFC00ULL
+#define RISCV_IOMMU_PTE_PPN_SHIFT  10
+
+#define RISCV_IOMMU_PTE_PBMT_MASK  (3ULL << 61)
+#define RISCV_IOMMU_PTE_PBMT_IO    (2ULL << 61)
+
+#define RISCV_IOMMU_PTE_BITS_PER_LEVEL  9
+#define RISCV_IOMMU_PTE_ENTRY_COUNT     512
+
+//
+// Leaf PTEs are only created for 4 KiB pages, 2 MiB megapages and 1 GiB gigapages.
+//
+#define RISCV_IOMMU_MAX_LEAF_SHIFT  30
+
+//
+// The format of the entries, for the shared walkers.
+//
+STATIC CONST RISCV_PTE_POLICY  mIoPtePolicy = {
+  RISCV_IOMMU_PTE_V,
+  RISCV_IOMMU_PTE_R | RISCV_IOMMU_PTE_W | RISCV_IOMMU_PTE_X,
+  RISCV_IOMMU_PTE_PPN_MASK,
+  RISCV_IOMMU_PTE_PPN_SHIFT
+};
+
+/**
+  Determine if an entry is a leaf PTE.
+
+  @param[in]  Entry  The entry value.
+
+  @retval  TRUE   The entry is a valid leaf PTE.
+  @retval  FALSE  The entry is not a valid leaf PTE.
+
+**/
+STATIC
+BOOLEAN
+IsLeafEntry (
+  IN UINT64  Entry
+  )
+{
+  return ((Entry & RISCV_IOMMU_PTE_V) != 0) &&
+         ((Entry & (RISCV_IOMMU_PTE_R | RISCV_IOMMU_PTE_X)) != 0);
+}
+
+/**
+  Determine if an entry points to a next-level page table.
+
+  @param[in]  Entry  The entry value.
+
+  @retval  TRUE   The entry is a valid non-leaf PTE.
+  @retval  FALSE  The entry is not a valid non-leaf PTE.
+
+**/
+STATIC
+BOOLEAN
+IsTableEntry (
+  IN UINT64  Entry
+  )
+{
+  return ((Entry & RISCV_IOMMU_PTE_V) != 0) &&
+         ((Entry & (RISCV_IOMMU_PTE_R | RISCV_IOMMU_PTE_W | RISCV_IOMMU_PTE_X)) == 0);
+}
+
+/**
+  Get the address an entry points to.
+
+  @param[in]  Entry  The entry value.
+
+  @return  The address the entry points to.
+
+**/
+STATIC
+UINT64
+GetAddressFromPte (
+  IN UINT64  Entry
+  )
+{
+  return ((Entry & RISCV_IOMMU_PTE_PPN_MASK) >> RISCV_IOMMU_PTE_PPN_SHIFT) << RISCV_MMU_PAGE_SHIFT;
+}
+
+/**
+  Build a PTE that points to an address.
+
+  @param[in]  Address     The address for the entry to point to.
+  @param[in]  Attributes  The attribute bits of the entry.
+
+  @return  The entry value.
+
+**/
+STATIC
+UINT64
+BuildPte (
+  IN UINT64  Address,
+  IN UINT64  Attributes
+  )
+{
+  return (((Address >> RISCV_MMU_PAGE_SHIFT) << RISCV_IOMMU_PTE_PPN_SHIFT) & RISCV_IOMMU_PTE_PPN_MASK) |
+         Attributes;
+}
+
+/**
+  Convert an IOMMU access to the attributes of a leaf PTE.
+
+  @param[in]  IoMmuAccess  The IOMMU access, or 0 to unmap.
+
+  @return  The attribute bits of a leaf PTE, or 0 for an invalid PTE.
+
+**/
+STATIC
+UINT64
+IoMmuAccessToPteAttributes (
+  IN UINT64  IoMmuAccess
+  )
+{
+  UINT64  Attributes;
+
+  if ((IoMmuAccess & (EDKII_IOMMU_ACCESS_READ | EDKII_IOMMU_ACCESS_WRITE)) == 0) {
+    return 0;
+  }
+
+  //
+  // Requests without a process_id are treated as U-mode by the IOMMU. Set A and D up front,
+  // as implicit updates of them are optional.
+  //
+  Attributes = RISCV_IOMMU_PTE_V | RISCV_IOMMU_PTE_U | RISCV_IOMMU_PTE_A;
+  if ((IoMmuAccess & EDKII_IOMMU_ACCESS_READ) != 0) {
+    Attributes |= RISCV_IOMMU_PTE_R;
+  }
+
+  //
+  // Write-only encodings are reserved, so writable pages are readable too.
+  // Tracked pages are left clean, for the IOMMU to mark the ones written to.
+  //
+  if ((IoMmuAccess & EDKII_IOMMU_ACCESS_WRITE) != 0) {
+    Attributes |= RISCV_IOMMU_PTE_R | RISCV_IOMMU_PTE_W;
+    if ((IoMmuAccess & RISCV_IOMMU_ACCESS_TRACK_DIRTY) == 0) {
+      Attributes |= RISCV_IOMMU_PTE_D;
+    }
+  }
+
+  //
+  // Device memory is accessed non-cacheable and strongly ordered, as the harts access it.
+  //
+  if ((IoMmuAccess & RISCV_IOMMU_ACCESS_DEVICE_MEMORY) != 0) {
+    Attributes |= RISCV_IOMMU_PTE_PBMT_IO;
+  }
+
+  return Attributes;
+}
+
+/**
+  Allocate an empty IO page table.
+
+  @param[in]  IoMmu  The IOMMU that walks the table.
+
+  @return  The page table, or NULL if it could not be allocated.
+
+**/
+UINT64 *
+IoMmuAllocatePageTable (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  return IoMmuAllocateTablePage (IoMmu, RiscVIoMmuFootprintPageTable);
+}
+
+/**
+  Free the resources of a page table recursively.
+
+  @param[in]  IoMmu      The IOMMU.
+  @param[in]  PageTable  The page table.
+  @param[in]  Level      The level of the page table, where 0 is the root.
+
+**/
+STATIC
+VOID
+FreePageTablesRecursive (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT64                *PageTable,
+  IN UINTN                 Level
+  )
+{
+  UINTN  Index;
+
+  if (Level < (UINTN)IoMmu->IoPageTableLevels - 1) {
+    for (Index = 0; Index < RISCV_IOMMU_PTE_ENTRY_COUNT; Index++) {
+      if (IsTableEntry (PageTable[Index])) {
+        FreePageTablesRecursive (IoMmu, (UINT64 *)(UINTN)GetAddressFromPte (PageTable[Index]), Level + 1);
+      }
+    }
+  }
+
+  IoMmuFreeTablePage (PageTable, RiscVIoMmuFootprintPageTable);
+}
+
+/**
+  Free a page table that no device context references, with all its levels.
+
+  @param[in]  IoMmu          The IOMMU.
+  @param[in]  RootPageTable  The root of the page table.
+
+**/
+VOID
+IoMmuFreePageTable (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT64                *RootPageTable
+  )
+{
+  FreePageTablesRecursive (IoMmu, RootPageTable, 0);
+}
+
+/**
+  Release every level of a page table that no device context references, in bulk,
+  and leave its root empty.
+
+  @param[in]  IoMmu          The IOMMU.
+  @param[in]  RootPageTable  The root of the page table.
+
+**/
+VOID
+IoMmuClearPageTable (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT64                *RootPageTable
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < RISCV_IOMMU_PTE_ENTRY_COUNT; Index++) {
+    if ((IoMmu->IoPageTableLevels > 1) && IsTableEntry (RootPageTable[Index])) {
+      FreePageTablesRecursive (IoMmu, (UINT64 *)(UINTN)GetAddressFromPte (RootPageTable[Index]), 1);
+    }
+
+    RootPageTable[Index] = 0;
+  }
+
+  IoMmuQueueCacheClean (IoMmu, RootPageTable, EFI_PAGE_SIZE);
+}
+
+/**
+  Return whether a page table maps nothing.
+
+  @param[in]  PageTable  The page table.
+
+  @retval  TRUE   Every entry of the table is invalid.
+  @retval  FALSE  Some entry is a leaf or a next-level table.
+
+**/
+STATIC
+BOOLEAN
+IsPageTableEmpty (
+  IN UINT64  *PageTable
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < RISCV_IOMMU_PTE_ENTRY_COUNT; Index++) {
+    if ((PageTable[Index] & RISCV_IOMMU_PTE_V) != 0) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+/**
+  Update a range of a page table recursively.
+
+  Ranges that are aligned to a megapage or gigapage (both by IO virtual and
+  physical address) are mapped with a single leaf PTE. A next-level table
+  that an unmap empties is unhooked and retired, for the caller to invalidate.
+
+  @param[in]  IoMmu            The IOMMU.
+  @param[in]  Pscid            The PSCID that the translations of the page table are tagged with.
+  @param[in]  RegionStart      The first IO virtual address of the range.
+  @param[in]  RegionEnd        The IO virtual address after the range.
+  @param[in]  PhysicalAddress  The physical address that RegionStart maps to.
+  @param[in]  Attributes       The attributes of the leaf PTEs, or 0 to unmap.
+  @param[in]  PageTable        The page table of this level.
+  @param[in]  Level            The level of the page table, where 0 is the root.
+  @param[in]  Lazy             Whether invalidating replaced leaves is left to the caller.
+
+  @retval  EFI_SUCCESS           The range was updated.
+  @retval  EFI_OUT_OF_RESOURCES  There were not enough resources to update the range.
+  @retval  EFI_DEVICE_ERROR      The IOMMU failed to queue an invalidation.
+
+**/
+STATIC
+EFI_STATUS
+UpdatePageTableRecursive (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT32                Pscid,
+  IN UINT64                RegionStart,
+  IN UINT64                RegionEnd,
+  IN UINT64                PhysicalAddress,
+  IN UINT64                Attributes,
+  IN UINT64                *PageTable,
+  IN UINTN                 Level,
+  IN BOOLEAN               Lazy
+  )
+{
+  EFI_STATUS  Status;
+  UINTN       Levels;
+  UINTN       BlockShift;
+  UINT64      BlockMask;
+  UINT64      BlockEnd;
+  UINT64      *Entry;
+  UINT64      *NextPageTable;
+  BOOLEAN     NewPageTable;
+
+  Levels = IoMmu->IoPageTableLevels;
+  ASSERT (Level < Levels);
+
+  BlockShift = (Levels - Level - 1) * RISCV_IOMMU_PTE_BITS_PER_LEVEL + RISCV_MMU_PAGE_SHIFT;
+  BlockMask  = LShiftU64 (1, BlockShift) - 1;
+
+  for ( ; RegionStart < RegionEnd; PhysicalAddress += BlockEnd - RegionStart, RegionStart = BlockEnd) {
+    BlockEnd = MIN (RegionEnd, (RegionStart | BlockMask) + 1);
+    Entry    = &PageTable[RShiftU64 (RegionStart, BlockShift) & (RISCV_IOMMU_PTE_ENTRY_COUNT - 1)];
+
+    //
+    // A whole, congruently aligned block is described by one leaf, unless a next-level table is
+    // already in place. A partial block needs a next-level table, splitting a leaf if present.
+    //
+    if ((BlockShift <= RISCV_IOMMU_MAX_LEAF_SHIFT) &&
+        (((RegionStart | BlockEnd | PhysicalAddress) & BlockMask) == 0) &&
+        !IsTableEntry (*Entry))
+    {
+      //
+      // Only valid leaves can be cached, so only replacing one needs an invalidation.
+      //
+      if (IsLeafEntry (*Entry) && !Lazy) {
+        Status = IoMmuQueueIoTlbRangeInvalidation (IoMmu, Pscid, RegionStart, BlockEnd, (UINT8)BlockShift);
+        if (EFI_ERROR (Status)) {
+          return Status;
+        }
+      }
+
+      *Entry = (Attributes == 0) ? 0 : BuildPte (PhysicalAddress, Attributes);
+      IoMmuQueueCacheClean (IoMmu, Entry, sizeof (*Entry));
+      continue;
+    }
+
+    ASSERT (Level < Levels - 1);
+    NewPageTable = !IsTableEntry (*Entry);
+    if (NewPageTable) {
+      if ((Attributes == 0) && !IsLeafEntry (*Entry)) {
+        //
+        // Nothing is mapped here, so there's nothing to unmap.
+        //
+        continue;
+      }
+
+      NextPageTable = IoMmuAllocatePageTable (IoMmu);
+      if (NextPageTable == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+      }
+
+      if (IsLeafEntry (*Entry)) {
+        //
+        // Split the existing leaf, by mapping its whole block in the new table.
+        //
+        Status = UpdatePageTableRecursive (
+                   IoMmu,
+                   Pscid,
+                   RegionStart & ~BlockMask,
+                   (RegionStart | BlockMask) + 1,
+                   GetAddressFromPte (*Entry),
+                   *Entry & ~RISCV_IOMMU_PTE_PPN_MASK,
+                   NextPageTable,
+                   Level + 1,
+                   Lazy
+                   );
+        if (EFI_ERROR (Status)) {
+          FreePageTablesRecursive (IoMmu, NextPageTable, Level + 1);
+          return Status;
+        }
+      }
+    } else {
+      NextPageTable = (UINT64 *)(UINTN)GetAddressFromPte (*Entry);
+    }
+
+    Status = UpdatePageTableRecursive (
+               IoMmu,
+               Pscid,
+               RegionStart,
+               BlockEnd,
+               PhysicalAddress,
+               Attributes,
+               NextPageTable,
+               Level + 1,
+               Lazy
+               );
+    if (EFI_ERROR (Status)) {
+      if (NewPageTable) {
+        //
+        // The new table is not wired in yet, so the whole subhierarchy can be released.
+        //
+        FreePageTablesRecursive (IoMmu, NextPageTable, Level + 1);
+      }
+
+      return Status;
+    }
+
+    if (!NewPageTable && (Attributes == 0) && IsPageTableEmpty (NextPageTable) &&
+        IoMmuRetireTablePage (IoMmu, NextPageTable))
+    {
+      *Entry = 0;
+      IoMmuQueueCacheClean (IoMmu, Entry, sizeof (*Entry));
+      continue;
+    }
+
+    if (NewPageTable) {
+      //
+      // The new table must be observable before it replaces the entry,
+      // and a split leaf may still be cached.
+      //
+      if (IsLeafEntry (*Entry) && !Lazy) {
+        Status = IoMmuQueueIoTlbRangeInvalidation (
+                   IoMmu,
+                   Pscid,
+                   RegionStart & ~BlockMask,
+                   (RegionStart | BlockMask) + 1,
+                   (UINT8)BlockShift
+                   );
+        if (EFI_ERROR (Status)) {
+          return Status;
+        }
+      }
+
+      //
+      // Without coherence, the split leaf stays in place until the new table reached memory.
+      //
+      if (IsLeafEntry (*Entry)) {
+        IoMmuFlushCacheCleans (IoMmu);
+      }
+
+      MemoryFence ();
+      *Entry = BuildPte ((UINT64)(UINTN)NextPageTable, RISCV_IOMMU_PTE_V);
+      IoMmuQueueCacheClean (IoMmu, Entry, sizeof (*Entry));
+    }
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Map or unmap a range of IO virtual addresses in a first-stage page table, and count the
+  table pages that it allocated, less those that it emptied.
+
+  @param[in]      IoMmu             The IOMMU.
+  @param[in]      RootPageTable     The root of the page table.
+  @param[in]      Pscid             The PSCID that the translations of the page table are tagged with.
+  @param[in]      IoVirtualAddress  The first IO virtual address of the range.
+  @param[in]      PhysicalAddress   The physical address that IoVirtualAddress maps to.
+  @param[in]      Length            The length of the range.
+  @param[in]      IoMmuAccess       The IOMMU access, or 0 to unmap.
+  @param[in]      Lazy              Whether invalidating replaced translations is left to the caller.
+  @param[in,out]  TablePages        Updated by the table pages allocated and emptied, if not NULL.
+
+  @return  The status of the update, as for IoMmuUpdatePageTable().
+
+**/
+STATIC
+EFI_STATUS
+UpdatePageTable (
+  IN     RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN     UINT64                *RootPageTable,
+  IN     UINT32                Pscid,
+  IN     UINT64                IoVirtualAddress,
+  IN     UINT64                PhysicalAddress,
+  IN     UINT64                Length,
+  IN     UINT64                IoMmuAccess,
+  IN     BOOLEAN               Lazy,
+  IN OUT UINTN                 *TablePages  OPTIONAL
+  )
+{
+  EFI_TPL     OriginalTpl;
+  EFI_STATUS  Status;
+  UINT64      TableBytes;
+  UINTN       Retired;
+
+  if (((IoVirtualAddress | PhysicalAddress | Length) & EFI_PAGE_MASK) != 0) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  DEBUG ((
+    DEBUG_VERBOSE,
+    "%a: IOVA 0x%lx -> PA 0x%lx, Length=0x%lx, IoMmuAccess=0x%lx\n",
+    __func__,
+    IoVirtualAddress,
+    PhysicalAddress,
+    Length,
+    IoMmuAccess
+    ));
+
+  //
+  // Page requests are serviced from a timer, and map into the same tables.
+  //
+  //
+  // Nothing else allocates table pages while the TPL is raised, so those the update
+  // allocated are told by the footprint it leaves.
+  //
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  TableBytes  = IoMmuGetFootprint (RiscVIoMmuFootprintPageTable);
+  Retired     = IoMmu->TablePagesRetired;
+  RiscVPmuProfileBegin ("IoMmuUpdatePageTable");
+  Status = UpdatePageTableRecursive (
+             IoMmu,
+             Pscid,
+             IoVirtualAddress,
+             IoVirtualAddress + Length,
+             PhysicalAddress,
+             IoMmuAccessToPteAttributes (IoMmuAccess),
+             RootPageTable,
+             0,
+             Lazy
+             );
+
+  //
+  // Only an invalidation without an address is certain to drop the non-leaf entries of
+  // retired tables. The next fence follows it, and the retired tables are freed after it.
+  //
+  Retired = IoMmu->TablePagesRetired - Retired;
+  if ((Retired != 0) && EFI_ERROR (IoMmuQueueIoTlbInvalidation (IoMmu, TRUE, Pscid, FALSE, 0)) && !EFI_ERROR (Status)) {
+    Status = EFI_DEVICE_ERROR;
+  }
+
+  IoMmuFlushCacheCleans (IoMmu);
+  RiscVPmuProfileEnd ("IoMmuUpdatePageTable");
+  if (TablePages != NULL) {
+    *TablePages += EFI_SIZE_TO_PAGES ((UINTN)(IoMmuGetFootprint (RiscVIoMmuFootprintPageTable) - TableBytes));
+    *TablePages -= MIN (*TablePages, Retired);
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+
+  //
+  // Leaf updates must be observable by the IOMMU before the caller starts DMA,
+  // and stale translations must be gone before the caller reuses the memory.
+  //
+  MemoryFence ();
+  if (Lazy) {
+    return Status;
+  }
+
+  if (EFI_ERROR (IoMmuSubmitCommands (IoMmu))) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  return Status;
+}
+
+/**
+  Map or unmap a range of IO virtual addresses in a first-stage page table.
+
+  @param[in]  IoMmu             The IOMMU.
+  @param[in]  RootPageTable     The root of the page table.
+  @param[in]  Pscid             The PSCID that the translations of the page table are tagged with.
+  @param[in]  IoVirtualAddress  The first IO virtual address of the range.
+  @param[in]  PhysicalAddress   The physical address that IoVirtualAddress maps to.
+  @param[in]  Length            The length of the range.
+  @param[in]  IoMmuAccess       The IOMMU access, or 0 to unmap.
+  @param[in]  Lazy              Whether invalidating replaced translations is left to the caller,
+                                which must flush the IOTLB before the range is reused.
+
+  @retval  EFI_SUCCESS            The range was updated.
+  @retval  EFI_INVALID_PARAMETER  The addresses or length are not page-aligned.
+  @retval  EFI_OUT_OF_RESOURCES   There were not enough resources to update the range.
+  @retval  EFI_DEVICE_ERROR       The IOMMU failed to invalidate replaced translations.
+
+**/
+EFI_STATUS
+IoMmuUpdatePageTable (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT64                *RootPageTable,
+  IN UINT32                Pscid,
+  IN UINT64                IoVirtualAddress,
+  IN UINT64                PhysicalAddress,
+  IN UINT64                Length,
+  IN UINT64                IoMmuAccess,
+  IN BOOLEAN               Lazy
+  )
+{
+  return UpdatePageTable (IoMmu, RootPageTable, Pscid, IoVirtualAddress, PhysicalAddress, Length, IoMmuAccess, Lazy, NULL);
+}
+
+/**
+  Map or unmap a range of IO virtual addresses in the page table of a domain, whose new
+  table pages are counted against PcdRiscVIoMmuDomainTablePageLimit.
+
+  A strict domain that maps thousands of scattered pages would need a table page for
+  each, so once its tables outgrow the limit, or can't grow under PcdRiscVIoMmuMetadataLimit,
+  it falls back to identity translation through gigapage leaves, and needs no more
+  tables for buffers mapped in place. A buffer in place that failed to map is then
+  reachable after all.
+
+  @param[in]  IoMmu             The IOMMU.
+  @param[in]  Domain            The domain.
+  @param[in]  IoVirtualAddress  The first IO virtual address of the range.
+  @param[in]  PhysicalAddress   The physical address that IoVirtualAddress maps to.
+  @param[in]  Length            The length of the range.
+  @param[in]  IoMmuAccess       The IOMMU access, or 0 to unmap.
+  @param[in]  Lazy              Whether invalidating replaced translations is left to the caller.
+
+  @return  The status of the update, as for IoMmuUpdatePageTable().
+
+**/
+EFI_STATUS
+IoMmuUpdateDomainPageTable (
+  IN RISCV_IOMMU_INSTANCE       *IoMmu,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain,
+  IN UINT64                     IoVirtualAddress,
+  IN UINT64                     PhysicalAddress,
+  IN UINT64                     Length,
+  IN UINT64                     IoMmuAccess,
+  IN BOOLEAN                    Lazy
+  )
+{
+  RISCV_IOMMU_DEVICE_DOMAIN  *TableDomain;
+  EFI_STATUS                 Status;
+  UINT32                     Limit;
+
+  //
+  // The table pages of a group are counted for its first domain.
+  //
+  TableDomain = (Domain->Group != NULL) ? Domain->Group : Domain;
+  Status      = UpdatePageTable (
+                  IoMmu,
+                  Domain->RootPageTable,
+                  Domain->Pscid,
+                  IoVirtualAddress,
+                  PhysicalAddress,
+                  Length,
+                  IoMmuAccess,
+                  Lazy,
+                  &TableDomain->TablePages
+                  );
+
+  Limit = PcdGet32 (PcdRiscVIoMmuDomainTablePageLimit);
+  if ((Domain->Mode != RISCV_IOMMU_DEVICE_MODE_STRICT) || (IoMmuAccess == 0) ||
+      ((Status != EFI_OUT_OF_RESOURCES) && ((Limit == 0) || (TableDomain->TablePages <= Limit))))
+  {
+    return Status;
+  }
+
+  if (!EFI_ERROR (IoMmuFallBackToIdentity (IoMmu, TableDomain)) &&
+      (IoVirtualAddress == PhysicalAddress) && !IoMmuIsIova (IoVirtualAddress))
+  {
+    return EFI_SUCCESS;
+  }
+
+  return Status;
+}
+
+/**
+  Determine the IO virtual addresses that the first-stage page tables of an IOMMU can map.
+
+  IOVAs are sign-extended from the top bit of the virtual address, so only the lower half
+  of the mode maps physical memory.
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @return  The IO virtual address after the mappable ones, or 0 without IO page tables.
+
+**/
+UINT64
+IoMmuGetIoVirtualAddressLimit (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  if (IoMmu->IoPageTableLevels == 0) {
+    return 0;
+  }
+
+  return LShiftU64 (1, IoMmu->IoPageTableLevels * RISCV_IOMMU_PTE_BITS_PER_LEVEL + RISCV_MMU_PAGE_SHIFT - 1);
+}
+
+/**
+  Select the shallowest first-stage mode of an IOMMU that maps all system memory.
+
+  Devices are given their buffers' own addresses, and IOVAs below 4 GiB, so the
+  mode need not match the HART's. Each level saved is one access less per walk.
+
+  @param[in]  IoMmu         The IOMMU.
+  @param[in]  Capabilities  The capabilities of the IOMMU.
+
+**/
+VOID
+IoMmuSelectIoPagingMode (
+  IN RISCV_IOMMU_INSTANCE      *IoMmu,
+  IN RISCV_IOMMU_CAPABILITIES  Capabilities
+  )
+{
+  EFI_GCD_MEMORY_SPACE_DESCRIPTOR  *MemorySpaceMap;
+  UINTN                            NumberOfDescriptors;
+  UINTN                            Index;
+  UINT64                           MemoryTop;
+  UINT8                            Levels;
+  BOOLEAN                          Supported;
+
+  MemoryTop = SIZE_4GB;
+  if (!EFI_ERROR (gDS->GetMemorySpaceMap (&NumberOfDescriptors, &MemorySpaceMap))) {
+    for (Index = 0; Index < NumberOfDescriptors; Index++) {
+      if ((MemorySpaceMap[Index].GcdMemoryType == EfiGcdMemoryTypeSystemMemory) ||
+          (MemorySpaceMap[Index].GcdMemoryType == EfiGcdMemoryTypePersistent))
+      {
+        MemoryTop = MAX (MemoryTop, MemorySpaceMap[Index].BaseAddress + MemorySpaceMap[Index].Length);
+      }
+    }
+
+    FreePool (MemorySpaceMap);
+  }
+
+  for (Levels = 3; Levels <= 5; Levels++) {
+    Supported = ((Levels == 3) && Capabilities.Bits.Sv39) ||
+                ((Levels == 4) && Capabilities.Bits.Sv48) ||
+                ((Levels == 5) && Capabilities.Bits.Sv57);
+
+    IoMmu->IoSatpMode        = V_RISCV_IOMMU_IOSATP_MODE_SV39 + Levels - 3;
+    IoMmu->IoPageTableLevels = Levels;
+    if (Supported && (MemoryTop <= IoMmuGetIoVirtualAddressLimit (IoMmu))) {
+      DEBUG ((
+        RISCV_IOMMU_DEBUG_LEVEL,
+        "%a: Memory ends at 0x%lx, so devices translate in Sv%u\n",
+        __func__,
+        MemoryTop,
+        Levels * RISCV_IOMMU_PTE_BITS_PER_LEVEL + RISCV_MMU_PAGE_SHIFT
+        ));
+      return;
+    }
+  }
+
+  IoMmu->IoSatpMode        = V_RISCV_IOMMU_IOSATP_MODE_BARE;
+  IoMmu->IoPageTableLevels = 0;
+  DEBUG ((DEBUG_WARN, "%a: No IO paging mode maps memory up to 0x%lx\n", __func__, MemoryTop));
+}
+
+/**
+  Map a range at its own address, read-write, where a page table maps nothing else.
+
+  Leaves that already map their block at its own address are widened to read-write,
+  and leaves that map it elsewhere, such as those of IOVAs and bounce pages, are kept.
+
+  @param[in]  IoMmu        The IOMMU.
+  @param[in]  RegionStart  The first address of the range, aligned to a gigapage.
+  @param[in]  RegionEnd    The address after the range, aligned to a gigapage.
+  @param[in]  Attributes   The attributes of the leaf PTEs.
+  @param[in]  PageTable    The page table of this level.
+  @param[in]  Level        The level of the page table, where 0 is the root.
+
+  @retval  EFI_SUCCESS           The range was mapped.
+  @retval  EFI_OUT_OF_RESOURCES  There were not enough resources to map the range.
+
+**/
+STATIC
+EFI_STATUS
+IdentityMapRecursive (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT64                RegionStart,
+  IN UINT64                RegionEnd,
+  IN UINT64                Attributes,
+  IN UINT64                *PageTable,
+  IN UINTN                 Level
+  )
+{
+  EFI_STATUS  Status;
+  UINTN       Levels;
+  UINTN       BlockShift;
+  UINT64      BlockMask;
+  UINT64      BlockEnd;
+  UINT64      *Entry;
+  UINT64      *NextPageTable;
+
+  Levels     = IoMmu->IoPageTableLevels;
+  BlockShift = (Levels - Level - 1) * RISCV_IOMMU_PTE_BITS_PER_LEVEL + RISCV_MMU_PAGE_SHIFT;
+  BlockMask  = LShiftU64 (1, BlockShift) - 1;
+
+  for ( ; RegionStart < RegionEnd; RegionStart = BlockEnd) {
+    BlockEnd = MIN (RegionEnd, (RegionStart | BlockMask) + 1);
+    Entry    = &PageTable[RShiftU64 (RegionStart, BlockShift) & (RISCV_IOMMU_PTE_ENTRY_COUNT - 1)];
+
+    if (IsLeafEntry (*Entry) && (GetAddressFromPte (*Entry) != RegionStart)) {
+      continue;
+    }
+
+    if (!IsTableEntry (*Entry) && (BlockShift <= RISCV_IOMMU_MAX_LEAF_SHIFT) && (((RegionStart | BlockEnd) & BlockMask) == 0)) {
+      *Entry = BuildPte (RegionStart, Attributes);
+      IoMmuQueueCacheClean (IoMmu, Entry, sizeof (*Entry));
+      continue;
+    }
+
+    if (IsTableEntry (*Entry)) {
+      Status = IdentityMapRecursive (IoMmu, RegionStart, BlockEnd, Attributes, (UINT64 *)(UINTN)GetAddressFromPte (*Entry), Level + 1);
+      if (EFI_ERROR (Status)) {
+        return Status;
+      }
+
+      continue;
+    }
+
+    //
+    // Only a block larger than a gigapage is partly mapped, and nothing of it is yet.
+    //
+    ASSERT (!IsLeafEntry (*Entry));
+    NextPageTable = IoMmuAllocatePageTable (IoMmu);
+    if (NextPageTable == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    Status = IdentityMapRecursive (IoMmu, RegionStart, BlockEnd, Attributes, NextPageTable, Level + 1);
+    if (EFI_ERROR (Status)) {
+      FreePageTablesRecursive (IoMmu, NextPageTable, Level + 1);
+      return Status;
+    }
+
+    MemoryFence ();
+    *Entry = BuildPte ((UINT64)(UINTN)NextPageTable, RISCV_IOMMU_PTE_V);
+    IoMmuQueueCacheClean (IoMmu, Entry, sizeof (*Entry));
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Map all system memory at its own address in a first-stage page table.
+
+  Each 1 GiB block that holds system memory is mapped by one leaf, where the table is empty.
+  Where it already maps pages, the other pages of their block are mapped around them.
+
+  @param[in]  IoMmu          The IOMMU.
+  @param[in]  RootPageTable  The root of the page table.
+
+  @retval  EFI_SUCCESS           The memory was mapped.
+  @retval  EFI_OUT_OF_RESOURCES  There were not enough resources to map the memory.
+
+**/
+EFI_STATUS
+IoMmuIdentityMapSystemMemory (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT64                *RootPageTable
+  )
+{
+  EFI_GCD_MEMORY_SPACE_DESCRIPTOR  *MemorySpaceMap;
+  UINTN                            NumberOfDescriptors;
+  UINTN                            Index;
+  UINT64                           AddressLimit;
+  UINT64                           RegionStart;
+  UINT64                           RegionEnd;
+  UINT64                           MappedEnd;
+  EFI_STATUS                       Status;
+
+  Status = gDS->GetMemorySpaceMap (&NumberOfDescriptors, &MemorySpaceMap);
+  if (EFI_ERROR (Status)) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  AddressLimit = IoMmuGetIoVirtualAddressLimit (IoMmu);
+  MappedEnd    = 0;
+
+  //
+  // The map is sorted by address, so the blocks of adjacent descriptors are only mapped once.
+  //
+  for (Index = 0; Index < NumberOfDescriptors && !EFI_ERROR (Status); Index++) {
+    if (MemorySpaceMap[Index].GcdMemoryType != EfiGcdMemoryTypeSystemMemory) {
+      continue;
+    }
+
+    RegionStart = MAX (MappedEnd, MemorySpaceMap[Index].BaseAddress & ~(UINT64)(SIZE_1GB - 1));
+    RegionEnd   = MIN (AddressLimit, ALIGN_VALUE (MemorySpaceMap[Index].BaseAddress + MemorySpaceMap[Index].Length, SIZE_1GB));
+    if (RegionStart >= RegionEnd) {
+      continue;
+    }
+
+    //
+    // Only leaves are added or widened, so the caller invalidates the PSCID of a table in use.
+    //
+    Status = IdentityMapRecursive (
+               IoMmu,
+               RegionStart,
+               RegionEnd,
+               IoMmuAccessToPteAttributes (EDKII_IOMMU_ACCESS_READ | EDKII_IOMMU_ACCESS_WRITE),
+               RootPageTable,
+               0
+               );
+    MappedEnd = RegionEnd;
+  }
+
+  FreePool (MemorySpaceMap);
+  IoMmuFlushCacheCleans (IoMmu);
+  MemoryFence ();
+
+  return EFI_ERROR (Status) ? EFI_OUT_OF_RESOURCES : EFI_SUCCESS;
+}
+
+/**
+  Map or unmap a run of the hart's mapping in a first-stage page table.
+
+  @param[in]  IoMmu          The IOMMU.
+  @param[in]  RootPageTable  The root of the page table.
+  @param[in]  Pscid          The PSCID that the translations of the page table are tagged with.
+  @param[in]  Start          The first address of the run.
+  @param[in]  End            The address after the run.
+  @param[in]  IoMmuAccess    The IOMMU access of the run, or 0 if the hart doesn't map it.
+  @param[in]  Refresh        Whether the page table already mirrors the hart's.
+
+  @retval  EFI_SUCCESS  The run is mirrored.
+  @retval  Others       The page table could not be updated.
+
+**/
+STATIC
+EFI_STATUS
+MirrorCpuRun (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT64                *RootPageTable,
+  IN UINT32                Pscid,
+  IN UINT64                Start,
+  IN UINT64                End,
+  IN UINT64                IoMmuAccess,
+  IN BOOLEAN               Refresh
+  )
+{
+  //
+  // Nothing of an empty table is mapped or cached, so only a refresh unmaps or invalidates.
+  //
+  if ((Start >= End) || ((IoMmuAccess == 0) && !Refresh)) {
+    return EFI_SUCCESS;
+  }
+
+  return IoMmuUpdatePageTable (IoMmu, RootPageTable, Pscid, Start, Start, End - Start, IoMmuAccess, !Refresh);
+}
+
+/**
+  Mirror the hart's page table into a first-stage page table, over a range of addresses.
+
+  The formats of the tables match, but requests without a process_id are U-mode, which
+  the hart's supervisor leaves deny, so iosatp can't point to the hart's table itself.
+  Readable and writable leaves of the hart are mapped readable and writable at their own
+  address instead, and the IOVA window is left to Map().
+
+  @param[in]  IoMmu          The IOMMU.
+  @param[in]  RootPageTable  The root of the page table.
+  @param[in]  Pscid          The PSCID that the translations of the page table are tagged with.
+  @param[in]  Start          The first address of the range, page-aligned.
+  @param[in]  End            The address after the range, page-aligned.
+  @param[in]  Refresh        Whether the page table already mirrors the hart's, so that the
+                             addresses it no longer maps are unmapped, and replaced translations
+                             are invalidated. The invalidations are submitted with the current
+                             command batch.
+
+  @retval  EFI_SUCCESS      The range is mirrored.
+  @retval  EFI_UNSUPPORTED  The hart doesn't translate with Sv39, Sv48 or Sv57.
+  @retval  Others           The page table could not be updated.
+
+**/
+EFI_STATUS
+IoMmuMirrorCpuPageTable (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT64                *RootPageTable,
+  IN UINT32                Pscid,
+  IN UINT64                Start,
+  IN UINT64                End,
+  IN BOOLEAN               Refresh
+  )
+{
+  UINT64      Satp;
+  UINT64      *CpuRootTable;
+  UINTN       CpuLevels;
+  UINT64      Entries[RISCV_PAGE_TABLE_MAX_LEVELS];
+  UINTN       NumberOfEntries;
+  UINT64      Entry;
+  UINT64      Address;
+  UINT64      Next;
+  UINT64      RunStart;
+  UINT64      RunAccess;
+  UINT64      IoMmuAccess;
+  EFI_STATUS  Status;
+
+  Satp = RiscVGetSupervisorAddressTranslationRegister ();
+  switch ((Satp & SATP64_MODE) >> SATP64_MODE_SHIFT) {
+    case SATP_MODE_SV39:
+      CpuLevels = 3;
+      break;
+    case SATP_MODE_SV48:
+      CpuLevels = 4;
+      break;
+    case SATP_MODE_SV57:
+      CpuLevels = 5;
+      break;
+    default:
+      return EFI_UNSUPPORTED;
+  }
+
+  CpuRootTable = (UINT64 *)(UINTN)LShiftU64 (Satp & SATP64_PPN, EFI_PAGE_SHIFT);
+  End          = MIN (End, IoMmuGetIoVirtualAddressLimit (IoMmu));
+
+  //
+  // Hart leaves of the same access are coalesced into runs, for the IO table to pick its own leaf sizes.
+  //
+  RunStart  = Start;
+  RunAccess = 0;
+  Status    = EFI_SUCCESS;
+  for (Address = Start; (Address < End) && !EFI_ERROR (Status); Address = Next) {
+    NumberOfEntries = RiscVPageTableWalk (&mIoPtePolicy, CpuLevels, CpuRootTable, Address, Entries);
+    Entry           = Entries[NumberOfEntries - 1];
+    Next            = MIN (End, (Address | (LShiftU64 (1, RISCV_PAGE_TABLE_LEVEL_SHIFT (CpuLevels, NumberOfEntries - 1)) - 1)) + 1);
+
+    if (IoMmuIsIova (Address)) {
+      Status    = MirrorCpuRun (IoMmu, RootPageTable, Pscid, RunStart, Address, RunAccess, Refresh);
+      Next      = Address + EFI_PAGE_SIZE;
+      RunStart  = Next;
+      RunAccess = 0;
+      continue;
+    }
+
+    IoMmuAccess = 0;
+    if (IsLeafEntry (Entry)) {
+      if ((Entry & RISCV_IOMMU_PTE_R) != 0) {
+        IoMmuAccess |= EDKII_IOMMU_ACCESS_READ;
+      }
+
+      if ((Entry & RISCV_IOMMU_PTE_W) != 0) {
+        IoMmuAccess |= EDKII_IOMMU_ACCESS_WRITE;
+      }
+
+      if ((IoMmuAccess != 0) && ((Entry & RISCV_IOMMU_PTE_PBMT_MASK) == RISCV_IOMMU_PTE_PBMT_IO)) {
+        IoMmuAccess |= RISCV_IOMMU_ACCESS_DEVICE_MEMORY;
+      }
+    }
+
+    if (IoMmuAccess != RunAccess) {
+      Status    = MirrorCpuRun (IoMmu, RootPageTable, Pscid, RunStart, Address, RunAccess, Refresh);
+      RunStart  = Address;
+      RunAccess = IoMmuAccess;
+    }
+  }
+
+  if (!EFI_ERROR (Status)) {
+    Status = MirrorCpuRun (IoMmu, RootPageTable, Pscid, RunStart, MIN (Address, End), RunAccess, Refresh);
+  }
+
+  return Status;
+}
+
+/**
+  Walk a first-stage page table for an IO virtual address, without changing it.
+
+  @param[in]   IoMmu             The IOMMU.
+  @param[in]   RootPageTable     The root of the page table.
+  @param[in]   IoVirtualAddress  The IO virtual address.
+  @param[out]  Entries           The entries walked, from the root, until a leaf or an invalid entry.
+
+  @return  The number of entries walked.
+
+**/
+UINTN
+IoMmuWalkPageTable (
+  IN  RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN  UINT64                *RootPageTable,
+  IN  UINT64                IoVirtualAddress,
+  OUT UINT64                *Entries
+  )
+{
+  return RiscVPageTableWalk (&mIoPtePolicy, IoMmu->IoPageTableLevels, RootPageTable, IoVirtualAddress, Entries);
+}
+
+/**
+  Determine whether the IOMMU marked the leaf that maps an IO virtual address as dirty.
+
+  @param[in]  IoMmu             The IOMMU.
+  @param[in]  RootPageTable     The root of the page table.
+  @param[in]  IoVirtualAddress  The IO virtual address.
+
+  @retval  TRUE   The leaf is dirty.
+  @retval  FALSE  The leaf is clean, or the address isn't mapped.
+
+**/
+BOOLEAN
+IoMmuIsPageDirty (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT64                *RootPageTable,
+  IN UINT64                IoVirtualAddress
+  )
+{
+  UINT64  Entries[RISCV_IOMMU_DIAGNOSTICS_MAX_LEVELS];
+  UINTN   NumberOfEntries;
+
+  NumberOfEntries = IoMmuWalkPageTable (IoMmu, RootPageTable, IoVirtualAddress, Entries);
+  if ((NumberOfEntries == 0) || !IsLeafEntry (Entries[NumberOfEntries - 1])) {
+    return FALSE;
+  }
+
+  return (Entries[NumberOfEntries - 1] & RISCV_IOMMU_PTE_D) != 0;
+}
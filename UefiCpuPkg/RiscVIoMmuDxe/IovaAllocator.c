@@ -0,0 +1,432 @@
+/** @file
+  RISC-V IOMMU IO virtual address allocator.
+
+  Buffers that a device cannot address directly are mapped at an IOVA from
+  a window below 4 GiB, instead of being bounced. The window is claimed from
+  non-existent GCD address space, so it never aliases memory that other
+  mappings identity-map. Its pages are tracked in a bitmap.
+
+  Drivers map the same few sizes again and again, so freed ranges of a power
+  of two of pages, up to 128 KiB, are kept in a LIFO magazine per size, and
+  handed out again first. The same IOVAs and page-table leaves are then reused,
+  which keeps the IO page tables and the IOTLB footprint small, and allocation
+  takes no search. Magazines return their ranges to the bitmap when it has no
+  free run left.
+
+  A range of a superpage or more is placed at an IOVA that is congruent to its
+  physical address modulo the largest superpage it spans, so that the IO page
+  table maps it with 2 MiB or 1 GiB leaves wherever its physical pages allow.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/DxeServicesTableLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include "RiscVIoMmu.h"
+
+//
+// Align the window for 2 MiB leaves.
+//
+#define IOVA_WINDOW_ALIGNMENT_SHIFT  21
+
+//
+// The largest leaf of the IO page tables, that IOVAs are placed congruently for,
+// and the bits that each level of the tables resolves.
+//
+#define IOVA_CONGRUENCE_MAX_SHIFT  30
+#define IOVA_LEVEL_SHIFT           9
+
+//
+// Magazines hold ranges of 1 to 32 pages, by the log2 of their size, and each holds
+// at most as many ranges as a burst of storage requests keeps in flight.
+//
+#define IOVA_MAGAZINES      6
+#define IOVA_MAGAZINE_SIZE  16
+
+typedef struct {
+  EFI_PHYSICAL_ADDRESS  Iovas[IOVA_MAGAZINE_SIZE];
+  UINTN                 NumberOfIovas;
+} IOVA_MAGAZINE;
+
+typedef struct {
+  EFI_PHYSICAL_ADDRESS  Base;
+  UINTN                 NumberOfPages;
+  UINT64                *Bitmap;
+  // Searches start after the last allocation, so freed IOVAs are reused late.
+  UINTN                 NextPage;
+  // Freed ranges that stay allocated in the bitmap, for reuse at their size.
+  IOVA_MAGAZINE         Magazines[IOVA_MAGAZINES];
+} IOVA_SPACE;
+
+STATIC IOVA_SPACE  mIovaSpace;
+
+/**
+  Return whether an IOVA page is allocated.
+
+  @param[in]  Page  The index of the page in the window.
+
+  @retval  TRUE   The page is allocated.
+  @retval  FALSE  The page is free.
+
+**/
+STATIC
+BOOLEAN
+IsIovaPageAllocated (
+  IN UINTN  Page
+  )
+{
+  return (mIovaSpace.Bitmap[Page / 64] & LShiftU64 (1, Page % 64)) != 0;
+}
+
+/**
+  Mark a range of IOVA pages as allocated or free.
+
+  @param[in]  Page           The index of the first page in the window.
+  @param[in]  NumberOfPages  The number of pages.
+  @param[in]  Allocated      Whether the pages become allocated.
+
+**/
+STATIC
+VOID
+SetIovaPages (
+  IN UINTN    Page,
+  IN UINTN    NumberOfPages,
+  IN BOOLEAN  Allocated
+  )
+{
+  for ( ; NumberOfPages != 0; Page++, NumberOfPages--) {
+    if (Allocated) {
+      mIovaSpace.Bitmap[Page / 64] |= LShiftU64 (1, Page % 64);
+    } else {
+      mIovaSpace.Bitmap[Page / 64] &= ~LShiftU64 (1, Page % 64);
+    }
+  }
+}
+
+/**
+  Return the magazine that holds ranges of a number of pages.
+
+  @param[in]  NumberOfPages  The number of pages.
+
+  @return  The magazine, or NULL if ranges of this size aren't kept.
+
+**/
+STATIC
+IOVA_MAGAZINE *
+GetIovaMagazine (
+  IN UINTN  NumberOfPages
+  )
+{
+  UINTN  Index;
+
+  if ((NumberOfPages == 0) || ((NumberOfPages & (NumberOfPages - 1)) != 0)) {
+    return NULL;
+  }
+
+  Index = (UINTN)HighBitSet64 (NumberOfPages);
+  return (Index < IOVA_MAGAZINES) ? &mIovaSpace.Magazines[Index] : NULL;
+}
+
+/**
+  Return the ranges of all magazines to the bitmap.
+
+  @retval  TRUE   Some range was returned.
+  @retval  FALSE  The magazines were empty.
+
+**/
+STATIC
+BOOLEAN
+DrainIovaMagazines (
+  VOID
+  )
+{
+  IOVA_MAGAZINE  *Magazine;
+  UINTN          Index;
+  BOOLEAN        Drained;
+
+  Drained = FALSE;
+  for (Index = 0; Index < IOVA_MAGAZINES; Index++) {
+    Magazine = &mIovaSpace.Magazines[Index];
+    while (Magazine->NumberOfIovas != 0) {
+      Magazine->NumberOfIovas--;
+      SetIovaPages (
+        (UINTN)RShiftU64 (Magazine->Iovas[Magazine->NumberOfIovas] - mIovaSpace.Base, EFI_PAGE_SHIFT),
+        (UINTN)1 << Index,
+        FALSE
+        );
+      Drained = TRUE;
+    }
+  }
+
+  return Drained;
+}
+
+/**
+  Return the first page at or after a page that a run may start at.
+
+  @param[in]  Page       The index of the page in the window.
+  @param[in]  Alignment  The number of pages, a power of two, that runs are placed modulo.
+  @param[in]  Offset     The index modulo Alignment that runs start at.
+
+  @return  The index of the page.
+
+**/
+STATIC
+UINTN
+AlignIovaPage (
+  IN UINTN  Page,
+  IN UINTN  Alignment,
+  IN UINTN  Offset
+  )
+{
+  return Page + ((Offset - Page) & (Alignment - 1));
+}
+
+/**
+  Find and allocate a free run of IOVA pages in the bitmap.
+
+  @param[in]  NumberOfPages  The number of pages.
+  @param[in]  Alignment      The number of pages, a power of two, that the run is placed modulo.
+  @param[in]  Offset         The index modulo Alignment that the run starts at.
+
+  @return  The IOVA of the run, or 0 if no run is free.
+
+**/
+STATIC
+EFI_PHYSICAL_ADDRESS
+AllocateIovaPages (
+  IN UINTN  NumberOfPages,
+  IN UINTN  Alignment,
+  IN UINTN  Offset
+  )
+{
+  UINTN  Start;
+  UINTN  Page;
+  UINTN  Limit;
+  UINTN  Pass;
+
+  //
+  // Next fit: search from the last allocation to the end of the window, and then
+  // the runs that start before it.
+  //
+  for (Pass = 0; Pass < 2; Pass++) {
+    if (Pass == 0) {
+      Start = mIovaSpace.NextPage;
+      Limit = mIovaSpace.NumberOfPages;
+    } else {
+      Start = 0;
+      Limit = MIN (mIovaSpace.NumberOfPages, mIovaSpace.NextPage + NumberOfPages - 1);
+    }
+
+    Start = AlignIovaPage (Start, Alignment, Offset);
+    Page  = Start;
+    while (Start + NumberOfPages <= Limit) {
+      if (IsIovaPageAllocated (Page)) {
+        Start = AlignIovaPage (Page + 1, Alignment, Offset);
+        Page  = Start;
+        continue;
+      }
+
+      Page++;
+      if (Page - Start == NumberOfPages) {
+        SetIovaPages (Start, NumberOfPages, TRUE);
+        mIovaSpace.NextPage = Page % mIovaSpace.NumberOfPages;
+        return mIovaSpace.Base + EFI_PAGES_TO_SIZE (Start);
+      }
+    }
+  }
+
+  return 0;
+}
+
+/**
+  Find and allocate a free run of IOVA pages in the bitmap, congruent to its physical
+  address modulo the largest superpage that it spans, if there is such a run.
+
+  @param[in]  NumberOfPages    The number of pages.
+  @param[in]  PhysicalAddress  The physical address that the run maps to.
+
+  @return  The IOVA of the run, or 0 if no run is free.
+
+**/
+STATIC
+EFI_PHYSICAL_ADDRESS
+AllocateCongruentIovaPages (
+  IN UINTN                 NumberOfPages,
+  IN EFI_PHYSICAL_ADDRESS  PhysicalAddress
+  )
+{
+  EFI_PHYSICAL_ADDRESS  Iova;
+  UINTN                 Shift;
+  UINTN                 Alignment;
+
+  for (Shift = IOVA_CONGRUENCE_MAX_SHIFT; Shift >= IOVA_WINDOW_ALIGNMENT_SHIFT; Shift -= IOVA_LEVEL_SHIFT) {
+    Alignment = (UINTN)1 << (Shift - EFI_PAGE_SHIFT);
+    if ((NumberOfPages < Alignment) || (mIovaSpace.NumberOfPages < Alignment)) {
+      continue;
+    }
+
+    //
+    // Without a congruent run for the larger superpage, the smaller one still saves leaves.
+    //
+    Iova = AllocateIovaPages (
+             NumberOfPages,
+             Alignment,
+             (UINTN)RShiftU64 (PhysicalAddress - mIovaSpace.Base, EFI_PAGE_SHIFT) & (Alignment - 1)
+             );
+    if (Iova != 0) {
+      return Iova;
+    }
+  }
+
+  return AllocateIovaPages (NumberOfPages, 1, 0);
+}
+
+/**
+  Claim the IOVA window, below 4 GiB and sized by PcdRiscVIoMmuIovaWindowSize.
+
+  @retval  EFI_SUCCESS           The window is claimed, or is disabled.
+  @retval  EFI_OUT_OF_RESOURCES  The window could not be claimed.
+
+**/
+EFI_STATUS
+IoMmuInitialiseIovaSpace (
+  VOID
+  )
+{
+  UINTN       Length;
+  EFI_STATUS  Status;
+
+  Length = ALIGN_VALUE (PcdGet32 (PcdRiscVIoMmuIovaWindowSize), SIZE_2MB);
+  if (Length == 0) {
+    return EFI_SUCCESS;
+  }
+
+  mIovaSpace.Bitmap = AllocateZeroPool (ALIGN_VALUE (EFI_SIZE_TO_PAGES (Length), 64) / 8);
+  if (mIovaSpace.Bitmap == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  mIovaSpace.Base = MIN (RiscVGetIoMmuMemoryTop (), SIZE_4GB - 1);
+  Status          = gDS->AllocateMemorySpace (
+                           EfiGcdAllocateMaxAddressSearchTopDown,
+                           EfiGcdMemoryTypeNonExistent,
+                           IOVA_WINDOW_ALIGNMENT_SHIFT,
+                           Length,
+                           &mIovaSpace.Base,
+                           gImageHandle,
+                           NULL
+                           );
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "%a: Failed to claim 0x%x bytes of address space: %r\n", __func__, Length, Status));
+    FreePool (mIovaSpace.Bitmap);
+    mIovaSpace.Bitmap = NULL;
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  mIovaSpace.NumberOfPages = EFI_SIZE_TO_PAGES (Length);
+  mIovaSpace.NextPage      = 0;
+
+  DEBUG ((RISCV_IOMMU_DEBUG_LEVEL, "%a: IOVA window at 0x%lx-0x%lx\n", __func__, mIovaSpace.Base, mIovaSpace.Base + Length - 1));
+  return EFI_SUCCESS;
+}
+
+/**
+  Allocate a range of IOVA pages below 4 GiB.
+
+  A range of a superpage or more is placed congruently to its physical address
+  where the window allows, so that it can be mapped with superpage leaves.
+
+  @param[in]  NumberOfPages    The number of pages.
+  @param[in]  PhysicalAddress  The physical address that the range maps to.
+
+  @return  The IOVA of the range, or 0 if no range is free.
+
+**/
+EFI_PHYSICAL_ADDRESS
+IoMmuAllocateIova (
+  IN UINTN                 NumberOfPages,
+  IN EFI_PHYSICAL_ADDRESS  PhysicalAddress
+  )
+{
+  EFI_PHYSICAL_ADDRESS  Iova;
+  IOVA_MAGAZINE         *Magazine;
+  EFI_TPL               OriginalTpl;
+
+  if ((mIovaSpace.NumberOfPages == 0) || (NumberOfPages == 0) || (NumberOfPages > mIovaSpace.NumberOfPages)) {
+    return 0;
+  }
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  Magazine    = GetIovaMagazine (NumberOfPages);
+  if ((Magazine != NULL) && (Magazine->NumberOfIovas != 0)) {
+    Iova = Magazine->Iovas[--Magazine->NumberOfIovas];
+  } else {
+    Iova = AllocateCongruentIovaPages (NumberOfPages, PhysicalAddress);
+    if ((Iova == 0) && DrainIovaMagazines ()) {
+      Iova = AllocateCongruentIovaPages (NumberOfPages, PhysicalAddress);
+    }
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+  return Iova;
+}
+
+/**
+  Free a range of IOVA pages.
+
+  The device's translations of the range must be invalidated before it is freed,
+  as a range kept in a magazine may be handed out again by the next allocation.
+
+  @param[in]  Iova           The IOVA of the range, as returned by IoMmuAllocateIova().
+  @param[in]  NumberOfPages  The number of pages.
+
+**/
+VOID
+IoMmuFreeIova (
+  IN EFI_PHYSICAL_ADDRESS  Iova,
+  IN UINTN                 NumberOfPages
+  )
+{
+  IOVA_MAGAZINE  *Magazine;
+  EFI_TPL        OriginalTpl;
+
+  ASSERT (IoMmuIsIova (Iova));
+  ASSERT (Iova + EFI_PAGES_TO_SIZE (NumberOfPages) <= mIovaSpace.Base + EFI_PAGES_TO_SIZE (mIovaSpace.NumberOfPages));
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  Magazine    = GetIovaMagazine (NumberOfPages);
+  if ((Magazine != NULL) && (Magazine->NumberOfIovas < IOVA_MAGAZINE_SIZE)) {
+    Magazine->Iovas[Magazine->NumberOfIovas++] = Iova;
+  } else {
+    SetIovaPages ((UINTN)RShiftU64 (Iova - mIovaSpace.Base, EFI_PAGE_SHIFT), NumberOfPages, FALSE);
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+}
+
+/**
+  Return whether an address is in the IOVA window.
+
+  @param[in]  Address  The device address.
+
+  @retval  TRUE   The address is an IOVA.
+  @retval  FALSE  The address is not an IOVA.
+
+**/
+BOOLEAN
+IoMmuIsIova (
+  IN EFI_PHYSICAL_ADDRESS  Address
+  )
+{
+  return (mIovaSpace.NumberOfPages != 0) &&
+         (Address >= mIovaSpace.Base) &&
+         (Address < mIovaSpace.Base + EFI_PAGES_TO_SIZE (mIovaSpace.NumberOfPages));
+}
@@ -0,0 +1,488 @@
+/** @file
+  RISC-V IOMMU mapping database.
+
+  Live mappings are indexed three times, by their Mapping cookie, their device
+  address and their host address, in hash tables with open addressing and
+  linear probing.
+  Removal shifts the following entries back instead of leaving tombstones,
+  so lookups stay O(1) however many mappings were created before.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include "RiscVIoMmu.h"
+
+#define MAP_DATABASE_INITIAL_SIZE  256
+
+//
+// The multiplier of Fibonacci hashing, 2^64 divided by the golden ratio.
+//
+#define MAP_DATABASE_HASH_MULTIPLIER  0x9E3779B97F4A7C15ULL
+
+typedef
+UINT64
+(*MAP_DATABASE_GET_KEY) (
+  IN MAP_INFO  *MapInfo
+  );
+
+typedef struct {
+  MAP_INFO                **Slots;
+  UINTN                   Size;
+  UINTN                   Count;
+  MAP_DATABASE_GET_KEY    GetKey;
+} MAP_HASH_TABLE;
+
+/**
+  Return the cookie key of a mapping.
+
+  @param[in]  MapInfo  The mapping.
+
+  @return  The key.
+
+**/
+STATIC
+UINT64
+GetCookieKey (
+  IN MAP_INFO  *MapInfo
+  )
+{
+  return (UINT64)(UINTN)MapInfo;
+}
+
+/**
+  Return the device-address key of a mapping.
+
+  @param[in]  MapInfo  The mapping.
+
+  @return  The key.
+
+**/
+STATIC
+UINT64
+GetDeviceAddressKey (
+  IN MAP_INFO  *MapInfo
+  )
+{
+  return MapInfo->DeviceAddress;
+}
+
+/**
+  Return the host-address key of a mapping.
+
+  @param[in]  MapInfo  The mapping.
+
+  @return  The key.
+
+**/
+STATIC
+UINT64
+GetHostAddressKey (
+  IN MAP_INFO  *MapInfo
+  )
+{
+  return MapInfo->HostAddress;
+}
+
+STATIC MAP_HASH_TABLE  mMapsByCookie        = { NULL, 0, 0, GetCookieKey };
+STATIC MAP_HASH_TABLE  mMapsByDeviceAddress = { NULL, 0, 0, GetDeviceAddressKey };
+STATIC MAP_HASH_TABLE  mMapsByHostAddress   = { NULL, 0, 0, GetHostAddressKey };
+
+/**
+  Return the home slot of a key.
+
+  @param[in]  Table  The hash table.
+  @param[in]  Key    The key.
+
+  @return  The index of the home slot.
+
+**/
+STATIC
+UINTN
+GetHomeSlot (
+  IN MAP_HASH_TABLE  *Table,
+  IN UINT64          Key
+  )
+{
+  return (UINTN)(MultU64x64 (Key, MAP_DATABASE_HASH_MULTIPLIER) >> (64 - HighBitSet64 (Table->Size)));
+}
+
+/**
+  Insert a mapping into a hash table that has space for it.
+
+  @param[in]  Table    The hash table.
+  @param[in]  MapInfo  The mapping to insert.
+
+**/
+STATIC
+VOID
+InsertIntoSlots (
+  IN MAP_HASH_TABLE  *Table,
+  IN MAP_INFO        *MapInfo
+  )
+{
+  UINTN  Index;
+
+  Index = GetHomeSlot (Table, Table->GetKey (MapInfo));
+  while (Table->Slots[Index] != NULL) {
+    Index = (Index + 1) & (Table->Size - 1);
+  }
+
+  Table->Slots[Index] = MapInfo;
+  Table->Count++;
+}
+
+/**
+  Resize a hash table, keeping it at most three quarters full.
+
+  @param[in]  Table    The hash table.
+  @param[in]  NewSize  The new number of slots, a power of two.
+
+  @retval  EFI_SUCCESS           The table was resized.
+  @retval  EFI_OUT_OF_RESOURCES  The new slots could not be allocated.
+
+**/
+STATIC
+EFI_STATUS
+ResizeTable (
+  IN MAP_HASH_TABLE  *Table,
+  IN UINTN           NewSize
+  )
+{
+  MAP_INFO  **OldSlots;
+  UINTN     OldSize;
+  UINTN     Index;
+
+  if (!IoMmuChargeFootprint (RiscVIoMmuFootprintMapInfo, NewSize * sizeof (MAP_INFO *))) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  OldSlots     = Table->Slots;
+  OldSize      = Table->Size;
+  Table->Slots = AllocateZeroPool (NewSize * sizeof (MAP_INFO *));
+  if (Table->Slots == NULL) {
+    IoMmuReleaseFootprint (RiscVIoMmuFootprintMapInfo, NewSize * sizeof (MAP_INFO *));
+    Table->Slots = OldSlots;
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Table->Size  = NewSize;
+  Table->Count = 0;
+  for (Index = 0; Index < OldSize; Index++) {
+    if (OldSlots[Index] != NULL) {
+      InsertIntoSlots (Table, OldSlots[Index]);
+    }
+  }
+
+  if (OldSlots != NULL) {
+    FreePool (OldSlots);
+    IoMmuReleaseFootprint (RiscVIoMmuFootprintMapInfo, OldSize * sizeof (MAP_INFO *));
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Ensure a hash table has space for one more mapping.
+
+  @param[in]  Table  The hash table.
+
+  @retval  EFI_SUCCESS           The table has space.
+  @retval  EFI_OUT_OF_RESOURCES  The table could not be grown.
+
+**/
+STATIC
+EFI_STATUS
+ReserveSlot (
+  IN MAP_HASH_TABLE  *Table
+  )
+{
+  if (Table->Size == 0) {
+    return ResizeTable (Table, MAP_DATABASE_INITIAL_SIZE);
+  }
+
+  if ((Table->Count + 1) * 4 > Table->Size * 3) {
+    return ResizeTable (Table, Table->Size * 2);
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Find the slot of a mapping in a hash table.
+
+  With Key, the first mapping with the key is found; otherwise, MapInfo itself.
+
+  @param[in]  Table    The hash table.
+  @param[in]  Key      The key of the mapping.
+  @param[in]  MapInfo  The mapping, or NULL to match any mapping with the key.
+
+  @return  The index of the slot, or Table->Size if not found.
+
+**/
+STATIC
+UINTN
+FindSlot (
+  IN MAP_HASH_TABLE  *Table,
+  IN UINT64          Key,
+  IN MAP_INFO        *MapInfo OPTIONAL
+  )
+{
+  UINTN  Index;
+
+  if (Table->Size == 0) {
+    return 0;
+  }
+
+  for (Index = GetHomeSlot (Table, Key)
+       ; Table->Slots[Index] != NULL
+       ; Index = (Index + 1) & (Table->Size - 1)
+       ) {
+    if (MapInfo != NULL) {
+      if (Table->Slots[Index] == MapInfo) {
+        return Index;
+      }
+    } else if (Table->GetKey (Table->Slots[Index]) == Key) {
+      return Index;
+    }
+  }
+
+  return Table->Size;
+}
+
+/**
+  Remove the mapping in a slot of a hash table.
+
+  The following entries of the cluster are shifted back to keep probing intact.
+
+  @param[in]  Table  The hash table.
+  @param[in]  Index  The index of the slot.
+
+**/
+STATIC
+VOID
+RemoveSlot (
+  IN MAP_HASH_TABLE  *Table,
+  IN UINTN           Index
+  )
+{
+  UINTN  Mask;
+  UINTN  Next;
+  UINTN  Home;
+
+  Mask = Table->Size - 1;
+  for (Next = (Index + 1) & Mask; Table->Slots[Next] != NULL; Next = (Next + 1) & Mask) {
+    //
+    // An entry may only move back if its home isn't cyclically within (Index, Next].
+    //
+    Home = GetHomeSlot (Table, Table->GetKey (Table->Slots[Next]));
+    if (((Next - Home) & Mask) >= ((Next - Index) & Mask)) {
+      Table->Slots[Index] = Table->Slots[Next];
+      Index               = Next;
+    }
+  }
+
+  Table->Slots[Index] = NULL;
+  Table->Count--;
+}
+
+/**
+  Record a live mapping.
+
+  @param[in]  MapInfo  The mapping.
+
+  @retval  EFI_SUCCESS           The mapping was recorded.
+  @retval  EFI_OUT_OF_RESOURCES  The database could not be grown.
+
+**/
+EFI_STATUS
+IoMmuInsertMapping (
+  IN MAP_INFO  *MapInfo
+  )
+{
+  EFI_TPL     OriginalTpl;
+  EFI_STATUS  Status;
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+
+  Status = ReserveSlot (&mMapsByCookie);
+  if (!EFI_ERROR (Status)) {
+    Status = ReserveSlot (&mMapsByDeviceAddress);
+  }
+
+  if (!EFI_ERROR (Status)) {
+    Status = ReserveSlot (&mMapsByHostAddress);
+  }
+
+  if (!EFI_ERROR (Status)) {
+    InsertIntoSlots (&mMapsByCookie, MapInfo);
+    InsertIntoSlots (&mMapsByDeviceAddress, MapInfo);
+    InsertIntoSlots (&mMapsByHostAddress, MapInfo);
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+  return Status;
+}
+
+/**
+  Look up a live mapping by its cookie.
+
+  @param[in]  Mapping  The mapping value returned from Map().
+
+  @return  The mapping, or NULL if Mapping is not a live mapping.
+
+**/
+MAP_INFO *
+IoMmuFindMapping (
+  IN VOID  *Mapping
+  )
+{
+  EFI_TPL   OriginalTpl;
+  UINTN     Index;
+  MAP_INFO  *MapInfo;
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+
+  MapInfo = NULL;
+  Index   = FindSlot (&mMapsByCookie, (UINT64)(UINTN)Mapping, Mapping);
+  if (Index < mMapsByCookie.Size) {
+    MapInfo = mMapsByCookie.Slots[Index];
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+  return MapInfo;
+}
+
+/**
+  Look up a live mapping by its device address.
+
+  If several mappings share the device address, any of them is returned.
+
+  @param[in]  DeviceAddress  The device address of the mapping.
+
+  @return  The mapping, or NULL if no live mapping has the device address.
+
+**/
+MAP_INFO *
+IoMmuFindMappingByDeviceAddress (
+  IN EFI_PHYSICAL_ADDRESS  DeviceAddress
+  )
+{
+  EFI_TPL   OriginalTpl;
+  UINTN     Index;
+  MAP_INFO  *MapInfo;
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+
+  MapInfo = NULL;
+  Index   = FindSlot (&mMapsByDeviceAddress, DeviceAddress, NULL);
+  if (Index < mMapsByDeviceAddress.Size) {
+    MapInfo = mMapsByDeviceAddress.Slots[Index];
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+  return MapInfo;
+}
+
+/**
+  Look up a live mapping of exactly a host range, for the same operation.
+
+  @param[in]  Operation      The operation of the mapping.
+  @param[in]  HostAddress    The host address of the mapping.
+  @param[in]  NumberOfBytes  The number of bytes of the mapping.
+
+  @return  The mapping, or NULL if no live mapping matches.
+
+**/
+MAP_INFO *
+IoMmuFindMappingByHostRange (
+  IN EDKII_IOMMU_OPERATION  Operation,
+  IN EFI_PHYSICAL_ADDRESS   HostAddress,
+  IN UINTN                  NumberOfBytes
+  )
+{
+  EFI_TPL   OriginalTpl;
+  UINTN     Index;
+  MAP_INFO  *MapInfo;
+  MAP_INFO  *Candidate;
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+
+  MapInfo = NULL;
+  if (mMapsByHostAddress.Size != 0) {
+    for (Index = GetHomeSlot (&mMapsByHostAddress, HostAddress)
+         ; mMapsByHostAddress.Slots[Index] != NULL
+         ; Index = (Index + 1) & (mMapsByHostAddress.Size - 1)
+         ) {
+      Candidate = mMapsByHostAddress.Slots[Index];
+      if ((Candidate->HostAddress == HostAddress) &&
+          (Candidate->NumberOfBytes == NumberOfBytes) &&
+          (Candidate->Operation == Operation))
+      {
+        MapInfo = Candidate;
+        break;
+      }
+    }
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+  return MapInfo;
+}
+
+/**
+  Remove a live mapping from the database.
+
+  @param[in]  Mapping  The mapping value returned from Map().
+
+  @return  The removed mapping, or NULL if Mapping is not a live mapping.
+
+**/
+MAP_INFO *
+IoMmuRemoveMapping (
+  IN VOID  *Mapping
+  )
+{
+  EFI_TPL   OriginalTpl;
+  UINTN     Index;
+  MAP_INFO  *MapInfo;
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+
+  MapInfo = NULL;
+  Index   = FindSlot (&mMapsByCookie, (UINT64)(UINTN)Mapping, Mapping);
+  if (Index < mMapsByCookie.Size) {
+    MapInfo = mMapsByCookie.Slots[Index];
+    RemoveSlot (&mMapsByCookie, Index);
+
+    Index = FindSlot (&mMapsByDeviceAddress, MapInfo->DeviceAddress, MapInfo);
+    ASSERT (Index < mMapsByDeviceAddress.Size);
+    RemoveSlot (&mMapsByDeviceAddress, Index);
+
+    Index = FindSlot (&mMapsByHostAddress, MapInfo->HostAddress, MapInfo);
+    ASSERT (Index < mMapsByHostAddress.Size);
+    RemoveSlot (&mMapsByHostAddress, Index);
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+  return MapInfo;
+}
+
+/**
+  Return the number of live mappings.
+
+  @return  The number of mappings in the database.
+
+**/
+UINTN
+IoMmuGetNumberOfMappings (
+  VOID
+  )
+{
+  return mMapsByCookie.Count;
+}
@@ -0,0 +1,494 @@
+/** @file
+  RISC-V IOMMU placement of memory by proximity domain.
+
+  The memory an IOMMU walks and writes is allocated from the proximity
+  domain of the IOMMU, where the platform describes both: the IOMMU's
+  domain by the RIMT or a devicetree numa-node-id, and the memory's by the
+  SRAT or the numa-node-ids of devicetree memory nodes. Pages are claimed at
+  the highest free address of the local memory, and otherwise come from
+  wherever the DXE core places them. The DMA pool that the platform reserves
+  below 4 GiB in PEI, if any, is taken from ahead of both.
+
+  The pools the driver shares across IOMMUs are local to their domain if all
+  IOMMUs with a domain share one. An IOMMU elsewhere takes its table pages
+  from chunks of its local memory instead.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <IndustryStandard/Acpi65.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/FdtLib.h>
+#include <Library/HobLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+#include <Guid/Fdt.h>
+#include <Guid/PlatformHasDeviceTree.h>
+#include <Guid/RiscVIoMmuDmaPool.h>
+#include "RiscVIoMmu.h"
+
+//
+// Table pages of IOMMUs outside the pools' domain are claimed in chunks, to avoid reading the memory map for each.
+//
+#define LOCAL_TABLE_PAGE_CHUNK_PAGES  64
+
+typedef struct {
+  EFI_PHYSICAL_ADDRESS  Start;
+  EFI_PHYSICAL_ADDRESS  End;
+  UINT32                ProximityDomain;
+} MEMORY_AFFINITY_RANGE;
+
+STATIC BOOLEAN                mAffinitySearched       = FALSE;
+STATIC MEMORY_AFFINITY_RANGE  *mAffinityRanges        = NULL;
+STATIC UINTN                  mNumberOfAffinityRanges = 0;
+STATIC UINTN                  mAffinityRangeCapacity  = 0;
+
+//
+// The unused part of the platform's DMA pool.
+//
+STATIC BOOLEAN               mDmaPoolSearched = FALSE;
+STATIC EFI_PHYSICAL_ADDRESS  mDmaPoolNext     = 0;
+STATIC EFI_PHYSICAL_ADDRESS  mDmaPoolEnd      = 0;
+
+/**
+  Record a range of memory and its proximity domain.
+
+  @param[in]  Start            The first address of the range.
+  @param[in]  Length           The length of the range, in bytes.
+  @param[in]  ProximityDomain  The proximity domain of the range.
+
+**/
+STATIC
+VOID
+AddAffinityRange (
+  IN EFI_PHYSICAL_ADDRESS  Start,
+  IN UINT64                Length,
+  IN UINT32                ProximityDomain
+  )
+{
+  MEMORY_AFFINITY_RANGE  *NewRanges;
+
+  if (Length == 0) {
+    return;
+  }
+
+  if (mNumberOfAffinityRanges == mAffinityRangeCapacity) {
+    NewRanges = ReallocatePool (
+                  mAffinityRangeCapacity * sizeof (*mAffinityRanges),
+                  (mAffinityRangeCapacity + 8) * sizeof (*mAffinityRanges),
+                  mAffinityRanges
+                  );
+    if (NewRanges == NULL) {
+      return;
+    }
+
+    mAffinityRanges         = NewRanges;
+    mAffinityRangeCapacity += 8;
+  }
+
+  mAffinityRanges[mNumberOfAffinityRanges].Start           = Start;
+  mAffinityRanges[mNumberOfAffinityRanges].End             = Start + Length;
+  mAffinityRanges[mNumberOfAffinityRanges].ProximityDomain = ProximityDomain;
+  mNumberOfAffinityRanges++;
+}
+
+/**
+  Record the memory affinity of the SRAT, if there is one.
+
+**/
+STATIC
+VOID
+FindAcpiMemoryAffinity (
+  VOID
+  )
+{
+  EFI_ACPI_DESCRIPTION_HEADER             *Srat;
+  UINT8                                   *Entry;
+  UINT8                                   *End;
+  EFI_ACPI_6_5_MEMORY_AFFINITY_STRUCTURE  *MemoryAffinity;
+
+  Srat = (VOID *)EfiLocateFirstAcpiTable (EFI_ACPI_6_5_SYSTEM_RESOURCE_AFFINITY_TABLE_SIGNATURE);
+  if (Srat == NULL) {
+    return;
+  }
+
+  End = (UINT8 *)Srat + Srat->Length;
+  for (Entry = (UINT8 *)Srat + sizeof (EFI_ACPI_6_5_SYSTEM_RESOURCE_AFFINITY_TABLE_HEADER)
+       ; (Entry + 2 <= End) && (Entry[1] >= 2) && (Entry + Entry[1] <= End)
+       ; Entry += Entry[1]
+       ) {
+    MemoryAffinity = (EFI_ACPI_6_5_MEMORY_AFFINITY_STRUCTURE *)Entry;
+    if ((MemoryAffinity->Type != EFI_ACPI_6_5_MEMORY_AFFINITY) ||
+        (MemoryAffinity->Length < sizeof (*MemoryAffinity)) ||
+        ((MemoryAffinity->Flags & EFI_ACPI_6_5_MEMORY_ENABLED) == 0))
+    {
+      continue;
+    }
+
+    AddAffinityRange (
+      LShiftU64 (MemoryAffinity->AddressBaseHigh, 32) | MemoryAffinity->AddressBaseLow,
+      LShiftU64 (MemoryAffinity->LengthHigh, 32) | MemoryAffinity->LengthLow,
+      MemoryAffinity->ProximityDomain
+      );
+  }
+}
+
+/**
+  Read a number of one or two cells of a devicetree property.
+
+  @param[in]  Cells      The cells.
+  @param[in]  CellCount  The number of cells.
+
+  @return  The number.
+
+**/
+STATIC
+UINT64
+ReadCells (
+  IN CONST UINT32  *Cells,
+  IN INT32         CellCount
+  )
+{
+  UINT64  Value;
+  INT32   Index;
+
+  Value = 0;
+  for (Index = 0; Index < CellCount; Index++) {
+    Value = LShiftU64 (Value, 32) | Fdt32ToCpu (ReadUnaligned32 (Cells + Index));
+  }
+
+  return Value;
+}
+
+/**
+  Record the memory affinity of the devicetree's memory nodes, if there is a devicetree.
+
+**/
+STATIC
+VOID
+FindDeviceTreeMemoryAffinity (
+  VOID
+  )
+{
+  VOID          *Fdt;
+  VOID          *Registration;
+  INT32         Node;
+  INT32         TempLen;
+  CONST UINT32  *Data32;
+  UINT32        ProximityDomain;
+  INT32         Parent;
+  INT32         AddressCells;
+  INT32         SizeCells;
+  INT32         Index;
+  EFI_STATUS    Status;
+
+  Status = gBS->LocateProtocol (&gEdkiiPlatformHasDeviceTreeGuid, NULL, (VOID **)&Registration);
+  if (!EFI_ERROR (Status)) {
+    Status = EfiGetSystemConfigurationTable (&gFdtTableGuid, &Fdt);
+  }
+
+  if (EFI_ERROR (Status)) {
+    return;
+  }
+
+  for (Node = FdtNodeOffsetByPropValue (Fdt, -1, "device_type", "memory", sizeof ("memory"))
+       ; Node >= 0
+       ; Node = FdtNodeOffsetByPropValue (Fdt, Node, "device_type", "memory", sizeof ("memory"))
+       ) {
+    Data32 = (CONST UINT32 *)FdtGetProp (Fdt, Node, "numa-node-id", &TempLen);
+    if ((Data32 == NULL) || (TempLen != sizeof (UINT32))) {
+      continue;
+    }
+
+    ProximityDomain = Fdt32ToCpu (ReadUnaligned32 (Data32));
+
+    //
+    // Each region of `reg` is an address and a size, of the cells the parent bus declares.
+    //
+    Parent       = FdtParentOffset (Fdt, Node);
+    AddressCells = FdtAddressCells (Fdt, Parent);
+    SizeCells    = FdtSizeCells (Fdt, Parent);
+    if ((AddressCells < 1) || (AddressCells > 2) || (SizeCells < 1) || (SizeCells > 2)) {
+      DEBUG ((DEBUG_WARN, "%a: Memory node with %d address and %d size cells is ignored\n", __func__, AddressCells, SizeCells));
+      continue;
+    }
+
+    Data32 = (CONST UINT32 *)FdtGetProp (Fdt, Node, "reg", &TempLen);
+    if ((Data32 == NULL) || (TempLen < 0) || ((TempLen % ((AddressCells + SizeCells) * (INT32)sizeof (UINT32))) != 0)) {
+      continue;
+    }
+
+    for (Index = 0; Index < TempLen / (INT32)sizeof (UINT32); Index += AddressCells + SizeCells) {
+      AddAffinityRange (
+        ReadCells (Data32 + Index, AddressCells),
+        ReadCells (Data32 + Index + AddressCells, SizeCells),
+        ProximityDomain
+        );
+    }
+  }
+}
+
+/**
+  Find the proximity domain that memory is allocated from, for an IOMMU or for the shared pools.
+
+  @param[in]   IoMmu            The IOMMU, or NULL for the pools shared by all IOMMUs.
+  @param[out]  ProximityDomain  The proximity domain.
+
+  @retval  TRUE   Memory is allocated from the proximity domain.
+  @retval  FALSE  The platform describes no domain to allocate from.
+
+**/
+STATIC
+BOOLEAN
+GetLocalDomain (
+  IN  RISCV_IOMMU_INSTANCE  *IoMmu  OPTIONAL,
+  OUT UINT32                *ProximityDomain
+  )
+{
+  LIST_ENTRY            *Link;
+  RISCV_IOMMU_INSTANCE  *Instance;
+  BOOLEAN               Found;
+
+  if (!mAffinitySearched) {
+    mAffinitySearched = TRUE;
+    FindAcpiMemoryAffinity ();
+    if (mNumberOfAffinityRanges == 0) {
+      FindDeviceTreeMemoryAffinity ();
+    }
+
+    DEBUG ((RISCV_IOMMU_DEBUG_LEVEL, "%a: %u memory ranges have a proximity domain\n", __func__, mNumberOfAffinityRanges));
+  }
+
+  if (mNumberOfAffinityRanges == 0) {
+    return FALSE;
+  }
+
+  if (IoMmu != NULL) {
+    *ProximityDomain = IoMmu->ProximityDomain;
+    return IoMmu->HasProximityDomain;
+  }
+
+  Found = FALSE;
+  for (Link = GetFirstNode (&mRiscVIoMmuGlobalDriverContext.InstanceList)
+       ; !IsNull (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ; Link = GetNextNode (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ) {
+    Instance = RISCV_IOMMU_INSTANCE_FROM_LINK (Link);
+    if (!Instance->HasProximityDomain) {
+      continue;
+    }
+
+    if (Found && (Instance->ProximityDomain != *ProximityDomain)) {
+      return FALSE;
+    }
+
+    *ProximityDomain = Instance->ProximityDomain;
+    Found            = TRUE;
+  }
+
+  return Found;
+}
+
+/**
+  Allocate pages from the memory local to an IOMMU, or to the IOMMUs that share the pools.
+
+  @param[in]  IoMmu          The IOMMU, or NULL for the pools shared by all IOMMUs.
+  @param[in]  NumberOfPages  The number of pages.
+  @param[in]  Alignment      The alignment of the pages, a power of two of at least a page.
+  @param[in]  MaxAddress     The highest address the pages may end at.
+
+  @return  The pages, to be freed with FreePages(), or NULL if there is no free local memory to allocate
+           them from. The caller then allocates them elsewhere.
+
+**/
+VOID *
+IoMmuAllocateLocalPages (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu  OPTIONAL,
+  IN UINTN                 NumberOfPages,
+  IN UINTN                 Alignment,
+  IN EFI_PHYSICAL_ADDRESS  MaxAddress
+  )
+{
+  UINT32                 ProximityDomain;
+  EFI_MEMORY_DESCRIPTOR  *MemoryMap;
+  EFI_MEMORY_DESCRIPTOR  *Descriptor;
+  UINTN                  MemoryMapSize;
+  UINTN                  DescriptorSize;
+  UINTN                  Index;
+  EFI_PHYSICAL_ADDRESS   Start;
+  EFI_PHYSICAL_ADDRESS   End;
+  EFI_PHYSICAL_ADDRESS   Candidate;
+  EFI_PHYSICAL_ADDRESS   Best;
+  EFI_STATUS             Status;
+
+  if ((NumberOfPages == 0) || !GetLocalDomain (IoMmu, &ProximityDomain)) {
+    return NULL;
+  }
+
+  MemoryMap = IoMmuReadMemoryMap (&MemoryMapSize, &DescriptorSize);
+  if (MemoryMap == NULL) {
+    return NULL;
+  }
+
+  //
+  // The highest fit is taken, to leave low memory for devices that need it.
+  //
+  Best = 0;
+  for (Descriptor = MemoryMap
+       ; (UINT8 *)Descriptor < (UINT8 *)MemoryMap + MemoryMapSize
+       ; Descriptor = NEXT_MEMORY_DESCRIPTOR (Descriptor, DescriptorSize)
+       ) {
+    if (Descriptor->Type != EfiConventionalMemory) {
+      continue;
+    }
+
+    for (Index = 0; Index < mNumberOfAffinityRanges; Index++) {
+      if (mAffinityRanges[Index].ProximityDomain != ProximityDomain) {
+        continue;
+      }
+
+      Start = MAX (Descriptor->PhysicalStart, mAffinityRanges[Index].Start);
+      End   = MIN (Descriptor->PhysicalStart + EFI_PAGES_TO_SIZE (Descriptor->NumberOfPages), mAffinityRanges[Index].End);
+      End   = MIN (End, MaxAddress + 1);
+      if ((End <= Start) || (End - Start < EFI_PAGES_TO_SIZE (NumberOfPages))) {
+        continue;
+      }
+
+      Candidate = (End - EFI_PAGES_TO_SIZE (NumberOfPages)) & ~((UINT64)Alignment - 1);
+      if ((Candidate >= Start) && (Candidate > Best)) {
+        Best = Candidate;
+      }
+    }
+  }
+
+  FreePool (MemoryMap);
+  if (Best == 0) {
+    return NULL;
+  }
+
+  Status = gBS->AllocatePages (AllocateAddress, EfiBootServicesData, NumberOfPages, &Best);
+  if (EFI_ERROR (Status)) {
+    return NULL;
+  }
+
+  return (VOID *)(UINTN)Best;
+}
+
+/**
+  Take pages from the DMA pool that the platform reserved below 4 GiB, past
+  what the PEIM took. The pool is reserved before DXE fragments low memory, so
+  it is contiguous and mappable by superpages, and is preferred over local memory.
+
+  @param[in]  NumberOfPages  The number of pages.
+  @param[in]  Alignment      The alignment of the pages, a power of two of at least a page.
+  @param[in]  MaxAddress     The highest address the pages may end at.
+
+  @return  The pages, to be freed with FreePages(), or NULL if there is no pool or it has no room.
+           The caller then allocates them elsewhere.
+
+**/
+VOID *
+IoMmuAllocateDmaPoolPages (
+  IN UINTN                 NumberOfPages,
+  IN UINTN                 Alignment,
+  IN EFI_PHYSICAL_ADDRESS  MaxAddress
+  )
+{
+  VOID                  *Hob;
+  RISCV_IOMMU_DMA_POOL  *Pool;
+  EFI_PHYSICAL_ADDRESS  Address;
+
+  if (!mDmaPoolSearched) {
+    mDmaPoolSearched = TRUE;
+    Hob              = GetFirstGuidHob (&gRiscVIoMmuDmaPoolHobGuid);
+    if (Hob != NULL) {
+      Pool = GET_GUID_HOB_DATA (Hob);
+      if (  (GET_GUID_HOB_DATA_SIZE (Hob) >= sizeof (*Pool))
+         && (Pool->Signature == RISCV_IOMMU_DMA_POOL_SIGNATURE)
+         && (Pool->Used <= Pool->Size))
+      {
+        mDmaPoolNext = Pool->Base + Pool->Used;
+        mDmaPoolEnd  = Pool->Base + Pool->Size;
+      }
+    }
+  }
+
+  if (NumberOfPages == 0) {
+    return NULL;
+  }
+
+  Address = ALIGN_VALUE (mDmaPoolNext, (UINT64)Alignment);
+  if (  (Address >= mDmaPoolEnd)
+     || (mDmaPoolEnd - Address < EFI_PAGES_TO_SIZE (NumberOfPages))
+     || (Address + EFI_PAGES_TO_SIZE (NumberOfPages) - 1 > MaxAddress))
+  {
+    return NULL;
+  }
+
+  mDmaPoolNext = Address + EFI_PAGES_TO_SIZE (NumberOfPages);
+  return (VOID *)(UINTN)Address;
+}
+
+/**
+  Return whether the table pages of an IOMMU are served by the table-page pool.
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @retval  TRUE   The IOMMU has no proximity domain, or shares that of the pool.
+  @retval  FALSE  The IOMMU's table pages are allocated from its own memory.
+
+**/
+BOOLEAN
+IoMmuUsesSharedPools (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  UINT32  ProximityDomain;
+  UINT32  PoolDomain;
+
+  if (!GetLocalDomain (IoMmu, &ProximityDomain)) {
+    return TRUE;
+  }
+
+  return GetLocalDomain (NULL, &PoolDomain) && (PoolDomain == ProximityDomain);
+}
+
+/**
+  Allocate a zeroed table page from the memory local to an IOMMU that doesn't use the table-page pool.
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @return  The page, to be freed with FreePages(), or NULL if there is no free local memory.
+
+**/
+VOID *
+IoMmuAllocateLocalTablePage (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  VOID  *Page;
+
+  if (IoMmu->LocalTablePagesLeft == 0) {
+    IoMmu->LocalTablePages = IoMmuAllocateLocalPages (IoMmu, LOCAL_TABLE_PAGE_CHUNK_PAGES, EFI_PAGE_SIZE, MAX_ADDRESS);
+    if (IoMmu->LocalTablePages == NULL) {
+      return NULL;
+    }
+
+    IoMmu->LocalTablePagesLeft = LOCAL_TABLE_PAGE_CHUNK_PAGES;
+  }
+
+  //
+  // Each page of the chunk is freed on its own.
+  //
+  Page                   = IoMmu->LocalTablePages;
+  IoMmu->LocalTablePages = (UINT8 *)IoMmu->LocalTablePages + EFI_PAGE_SIZE;
+  IoMmu->LocalTablePagesLeft--;
+  ZeroMem (Page, EFI_PAGE_SIZE);
+  return Page;
+}
@@ -0,0 +1,555 @@
+/** @file
+  RISC-V IOMMU register access accounting.
+
+  Uncached accesses to the registers of an IOMMU cost more than most of the
+  work of an operation. With PcdRiscVIoMmuMmioAccounting, the register helpers
+  count their reads and writes, and the polls and time of their waits, for the
+  operation that the driver is in: initialising the IOMMUs, mapping, unmapping,
+  or draining the queues of their interrupts. The protocol services are wrapped
+  before the protocols are installed, so that their accesses are attributed to
+  them, and the counts are reported by RISCV_IOMMU_DIAGNOSTICS_PROTOCOL.
+  Without the PCD, nothing is counted and the services are left unwrapped.
+
+  The operation is the driver's, not a hart's, so the accesses that other harts
+  make on behalf of an operation are attributed to it. An operation that starts
+  while another is running, such as a fault drain in the timer, is attributed
+  on its own, and a call of an operation within the same operation, such as
+  the Map() of MapMultiple(), counts only once.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/PcdLib.h>
+#include <Library/TimerLib.h>
+#include "RiscVIoMmu.h"
+
+STATIC RISCV_IOMMU_MMIO_OPERATION   mMmioOperation = RiscVIoMmuMmioOther;
+STATIC RISCV_IOMMU_MMIO_STATISTICS  mMmioStatistics[RiscVIoMmuMmioOperationMax];
+
+//
+// The services that the accounted services call, which may themselves be traced.
+//
+STATIC EDKII_IOMMU_PROTOCOL        mAccountedServices;
+STATIC EDKII_IOMMU_BATCH_PROTOCOL  mAccountedBatchServices;
+
+/**
+  Attribute the register accesses from now on to an operation, until IoMmuEndMmioOperation().
+
+  @param[in]  Operation  The operation.
+
+  @return  The operation that the accesses were attributed to, to pass to IoMmuEndMmioOperation().
+
+**/
+RISCV_IOMMU_MMIO_OPERATION
+IoMmuBeginMmioOperation (
+  IN RISCV_IOMMU_MMIO_OPERATION  Operation
+  )
+{
+  RISCV_IOMMU_MMIO_OPERATION  Previous;
+
+  if (!FeaturePcdGet (PcdRiscVIoMmuMmioAccounting)) {
+    return RiscVIoMmuMmioOther;
+  }
+
+  Previous = mMmioOperation;
+  if (Previous != Operation) {
+    IoMmuAddToCount (&mMmioStatistics[Operation].Calls, 1);
+    mMmioOperation = Operation;
+  }
+
+  return Previous;
+}
+
+/**
+  Attribute the register accesses from now on to the operation that IoMmuBeginMmioOperation()
+  returned again.
+
+  @param[in]  Previous  The operation that IoMmuBeginMmioOperation() returned.
+
+**/
+VOID
+IoMmuEndMmioOperation (
+  IN RISCV_IOMMU_MMIO_OPERATION  Previous
+  )
+{
+  if (FeaturePcdGet (PcdRiscVIoMmuMmioAccounting)) {
+    mMmioOperation = Previous;
+  }
+}
+
+/**
+  Count register accesses for the current operation.
+
+  @param[in]  Reads   The registers read.
+  @param[in]  Writes  The registers written.
+
+**/
+VOID
+IoMmuCountMmioAccesses (
+  IN UINTN  Reads,
+  IN UINTN  Writes
+  )
+{
+  if (Reads != 0) {
+    IoMmuAddToCount (&mMmioStatistics[mMmioOperation].Reads, Reads);
+  }
+
+  if (Writes != 0) {
+    IoMmuAddToCount (&mMmioStatistics[mMmioOperation].Writes, Writes);
+  }
+}
+
+/**
+  Count a wait on a register for the current operation. Its reads are counted by the reads themselves.
+
+  @param[in]  Polls      The reads of the register while it was waited on.
+  @param[in]  StartTime  The performance counter when the wait started.
+
+**/
+VOID
+IoMmuCountMmioWait (
+  IN UINTN   Polls,
+  IN UINT64  StartTime
+  )
+{
+  IoMmuAddToCount (&mMmioStatistics[mMmioOperation].PollIterations, Polls);
+  IoMmuAddToCount (&mMmioStatistics[mMmioOperation].WaitTime, GetTimeInNanoSecond (GetPerformanceCounter () - StartTime));
+}
+
+/**
+  Report the register accesses of an operation.
+
+  @param[in]   Operation   The operation.
+  @param[out]  Statistics  The accesses.
+
+  @retval  EFI_SUCCESS            Statistics is filled in.
+  @retval  EFI_INVALID_PARAMETER  Operation is unknown.
+  @retval  EFI_UNSUPPORTED        PcdRiscVIoMmuMmioAccounting doesn't enable the accounting.
+
+**/
+EFI_STATUS
+IoMmuGetMmioStatistics (
+  IN  RISCV_IOMMU_MMIO_OPERATION   Operation,
+  OUT RISCV_IOMMU_MMIO_STATISTICS  *Statistics
+  )
+{
+  if (!FeaturePcdGet (PcdRiscVIoMmuMmioAccounting)) {
+    return EFI_UNSUPPORTED;
+  }
+
+  if ((UINTN)Operation >= RiscVIoMmuMmioOperationMax) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  *Statistics = mMmioStatistics[Operation];
+  return EFI_SUCCESS;
+}
+
+/**
+  Account SetAttribute() as a map when it grants access, and as an unmap when it revokes it.
+
+  @param[in]  This          The protocol instance pointer.
+  @param[in]  DeviceHandle  The device that is doing the DMA.
+  @param[in]  Mapping       The mapping value returned from Map().
+  @param[in]  IoMmuAccess   The IOMMU access.
+
+  @return  What the wrapped SetAttribute() returned.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+AccountedSetAttribute (
+  IN EDKII_IOMMU_PROTOCOL  *This,
+  IN EFI_HANDLE            DeviceHandle,
+  IN VOID                  *Mapping,
+  IN UINT64                IoMmuAccess
+  )
+{
+  RISCV_IOMMU_MMIO_OPERATION  Previous;
+  EFI_STATUS                  Status;
+
+  Previous = IoMmuBeginMmioOperation ((IoMmuAccess != 0) ? RiscVIoMmuMmioMap : RiscVIoMmuMmioUnmap);
+  Status   = mAccountedServices.SetAttribute (This, DeviceHandle, Mapping, IoMmuAccess);
+  IoMmuEndMmioOperation (Previous);
+
+  return Status;
+}
+
+/**
+  Account Map() as a map.
+
+  @param[in]      This           The protocol instance pointer.
+  @param[in]      Operation      The type of the bus master operation.
+  @param[in]      HostAddress    The system memory address to map.
+  @param[in, out] NumberOfBytes  The number of bytes to map, and the number mapped.
+  @param[out]     DeviceAddress  The address the device uses for the buffer.
+  @param[out]     Mapping        The mapping value to pass to Unmap().
+
+  @return  What the wrapped Map() returned.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+AccountedMap (
+  IN     EDKII_IOMMU_PROTOCOL   *This,
+  IN     EDKII_IOMMU_OPERATION  Operation,
+  IN     VOID                   *HostAddress,
+  IN OUT UINTN                  *NumberOfBytes,
+  OUT    EFI_PHYSICAL_ADDRESS   *DeviceAddress,
+  OUT    VOID                   **Mapping
+  )
+{
+  RISCV_IOMMU_MMIO_OPERATION  Previous;
+  EFI_STATUS                  Status;
+
+  Previous = IoMmuBeginMmioOperation (RiscVIoMmuMmioMap);
+  Status   = mAccountedServices.Map (This, Operation, HostAddress, NumberOfBytes, DeviceAddress, Mapping);
+  IoMmuEndMmioOperation (Previous);
+
+  return Status;
+}
+
+/**
+  Account Unmap() as an unmap.
+
+  @param[in]  This     The protocol instance pointer.
+  @param[in]  Mapping  The mapping value returned from Map().
+
+  @return  What the wrapped Unmap() returned.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+AccountedUnmap (
+  IN  EDKII_IOMMU_PROTOCOL  *This,
+  IN  VOID                  *Mapping
+  )
+{
+  RISCV_IOMMU_MMIO_OPERATION  Previous;
+  EFI_STATUS                  Status;
+
+  Previous = IoMmuBeginMmioOperation (RiscVIoMmuMmioUnmap);
+  Status   = mAccountedServices.Unmap (This, Mapping);
+  IoMmuEndMmioOperation (Previous);
+
+  return Status;
+}
+
+/**
+  Account AllocateBuffer() as a map.
+
+  @param[in]      This         The protocol instance pointer.
+  @param[in]      Type         This parameter is not used and must be ignored.
+  @param[in]      MemoryType   The type of memory to allocate.
+  @param[in]      Pages        The number of pages to allocate.
+  @param[in, out] HostAddress  The base system memory address of the allocated range.
+  @param[in]      Attributes   The requested bit mask of attributes for the allocated range.
+
+  @return  What the wrapped AllocateBuffer() returned.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+AccountedAllocateBuffer (
+  IN     EDKII_IOMMU_PROTOCOL  *This,
+  IN     EFI_ALLOCATE_TYPE     Type,
+  IN     EFI_MEMORY_TYPE       MemoryType,
+  IN     UINTN                 Pages,
+  IN OUT VOID                  **HostAddress,
+  IN     UINT64                Attributes
+  )
+{
+  RISCV_IOMMU_MMIO_OPERATION  Previous;
+  EFI_STATUS                  Status;
+
+  Previous = IoMmuBeginMmioOperation (RiscVIoMmuMmioMap);
+  Status   = mAccountedServices.AllocateBuffer (This, Type, MemoryType, Pages, HostAddress, Attributes);
+  IoMmuEndMmioOperation (Previous);
+
+  return Status;
+}
+
+/**
+  Account FreeBuffer() as an unmap.
+
+  @param[in]  This         The protocol instance pointer.
+  @param[in]  Pages        The number of pages to free.
+  @param[in]  HostAddress  The base system memory address of the allocated range.
+
+  @return  What the wrapped FreeBuffer() returned.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+AccountedFreeBuffer (
+  IN  EDKII_IOMMU_PROTOCOL  *This,
+  IN  UINTN                 Pages,
+  IN  VOID                  *HostAddress
+  )
+{
+  RISCV_IOMMU_MMIO_OPERATION  Previous;
+  EFI_STATUS                  Status;
+
+  Previous = IoMmuBeginMmioOperation (RiscVIoMmuMmioUnmap);
+  Status   = mAccountedServices.FreeBuffer (This, Pages, HostAddress);
+  IoMmuEndMmioOperation (Previous);
+
+  return Status;
+}
+
+/**
+  Account MapMultiple() as a map.
+
+  @param[in]      This             The protocol instance pointer.
+  @param[in]      DeviceHandle     The device that does the DMA.
+  @param[in]      Operation        Indicates if the bus master is going to read or write to system memory.
+  @param[in]      IoMmuAccess      The IOMMU access to grant to every buffer.
+  @param[in]      NumberOfEntries  The number of buffers of the list.
+  @param[in, out] Entries          The buffers of the list.
+
+  @return  What the wrapped MapMultiple() returned.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+AccountedMapMultiple (
+  IN     EDKII_IOMMU_BATCH_PROTOCOL  *This,
+  IN     EFI_HANDLE                  DeviceHandle,
+  IN     EDKII_IOMMU_OPERATION       Operation,
+  IN     UINT64                      IoMmuAccess,
+  IN     UINTN                       NumberOfEntries,
+  IN OUT EDKII_IOMMU_BATCH_ENTRY     *Entries
+  )
+{
+  RISCV_IOMMU_MMIO_OPERATION  Previous;
+  EFI_STATUS                  Status;
+
+  Previous = IoMmuBeginMmioOperation (RiscVIoMmuMmioMap);
+  Status   = mAccountedBatchServices.MapMultiple (This, DeviceHandle, Operation, IoMmuAccess, NumberOfEntries, Entries);
+  IoMmuEndMmioOperation (Previous);
+
+  return Status;
+}
+
+/**
+  Account UnmapMultiple() as an unmap.
+
+  @param[in]  This             The protocol instance pointer.
+  @param[in]  DeviceHandle     The device that did the DMA.
+  @param[in]  NumberOfEntries  The number of buffers of the list.
+  @param[in]  Entries          The buffers of the list, as returned by MapMultiple().
+
+  @return  What the wrapped UnmapMultiple() returned.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+AccountedUnmapMultiple (
+  IN EDKII_IOMMU_BATCH_PROTOCOL  *This,
+  IN EFI_HANDLE                  DeviceHandle,
+  IN UINTN                       NumberOfEntries,
+  IN EDKII_IOMMU_BATCH_ENTRY     *Entries
+  )
+{
+  RISCV_IOMMU_MMIO_OPERATION  Previous;
+  EFI_STATUS                  Status;
+
+  Previous = IoMmuBeginMmioOperation (RiscVIoMmuMmioUnmap);
+  Status   = mAccountedBatchServices.UnmapMultiple (This, DeviceHandle, NumberOfEntries, Entries);
+  IoMmuEndMmioOperation (Previous);
+
+  return Status;
+}
+
+/**
+  Account MapContiguous() as a map.
+
+  @param[in]      This             The protocol instance pointer.
+  @param[in]      DeviceHandle     The device that does the DMA.
+  @param[in]      Operation        Indicates if the bus master is going to read or write to system memory.
+  @param[in]      IoMmuAccess      The IOMMU access to grant to the range.
+  @param[in]      NumberOfEntries  The number of buffers of the list.
+  @param[in, out] Entries          The buffers of the list.
+  @param[out]     DeviceAddress    The device address of the first byte of the first buffer.
+  @param[out]     Mapping          A resulting value to pass to UnmapContiguous().
+
+  @return  What the wrapped MapContiguous() returned.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+AccountedMapContiguous (
+  IN     EDKII_IOMMU_BATCH_PROTOCOL  *This,
+  IN     EFI_HANDLE                  DeviceHandle,
+  IN     EDKII_IOMMU_OPERATION       Operation,
+  IN     UINT64                      IoMmuAccess,
+  IN     UINTN                       NumberOfEntries,
+  IN OUT EDKII_IOMMU_BATCH_ENTRY     *Entries,
+  OUT    EFI_PHYSICAL_ADDRESS        *DeviceAddress,
+  OUT    VOID                        **Mapping
+  )
+{
+  RISCV_IOMMU_MMIO_OPERATION  Previous;
+  EFI_STATUS                  Status;
+
+  Previous = IoMmuBeginMmioOperation (RiscVIoMmuMmioMap);
+  Status   = mAccountedBatchServices.MapContiguous (
+                                       This,
+                                       DeviceHandle,
+                                       Operation,
+                                       IoMmuAccess,
+                                       NumberOfEntries,
+                                       Entries,
+                                       DeviceAddress,
+                                       Mapping
+                                       );
+  IoMmuEndMmioOperation (Previous);
+
+  return Status;
+}
+
+/**
+  Account UnmapContiguous() as an unmap.
+
+  @param[in]  This     The protocol instance pointer.
+  @param[in]  Mapping  The mapping value returned from MapContiguous().
+
+  @return  What the wrapped UnmapContiguous() returned.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+AccountedUnmapContiguous (
+  IN EDKII_IOMMU_BATCH_PROTOCOL  *This,
+  IN VOID                        *Mapping
+  )
+{
+  RISCV_IOMMU_MMIO_OPERATION  Previous;
+  EFI_STATUS                  Status;
+
+  Previous = IoMmuBeginMmioOperation (RiscVIoMmuMmioUnmap);
+  Status   = mAccountedBatchServices.UnmapContiguous (This, Mapping);
+  IoMmuEndMmioOperation (Previous);
+
+  return Status;
+}
+
+/**
+  Account MapMultipleAsync() as a map. The completion is polled for by a timer,
+  without register accesses.
+
+  @param[in]      This             The protocol instance pointer.
+  @param[in]      DeviceHandle     The device that does the DMA.
+  @param[in]      Operation        Indicates if the bus master is going to read or write to system memory.
+  @param[in]      IoMmuAccess      The IOMMU access to grant to every buffer.
+  @param[in]      NumberOfEntries  The number of buffers of the list.
+  @param[in, out] Entries          The buffers of the list.
+  @param[in, out] Token            The token to signal once the buffers may be accessed.
+
+  @return  What the wrapped MapMultipleAsync() returned.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+AccountedMapMultipleAsync (
+  IN     EDKII_IOMMU_BATCH_PROTOCOL  *This,
+  IN     EFI_HANDLE                  DeviceHandle,
+  IN     EDKII_IOMMU_OPERATION       Operation,
+  IN     UINT64                      IoMmuAccess,
+  IN     UINTN                       NumberOfEntries,
+  IN OUT EDKII_IOMMU_BATCH_ENTRY     *Entries,
+  IN OUT EDKII_IOMMU_BATCH_TOKEN     *Token
+  )
+{
+  RISCV_IOMMU_MMIO_OPERATION  Previous;
+  EFI_STATUS                  Status;
+
+  Previous = IoMmuBeginMmioOperation (RiscVIoMmuMmioMap);
+  Status   = mAccountedBatchServices.MapMultipleAsync (This, DeviceHandle, Operation, IoMmuAccess, NumberOfEntries, Entries, Token);
+  IoMmuEndMmioOperation (Previous);
+
+  return Status;
+}
+
+/**
+  Account UnmapMultipleAsync() as an unmap. The buffers that the timer releases
+  later are unmapped through Unmap(), which is accounted on its own.
+
+  @param[in]      This             The protocol instance pointer.
+  @param[in]      DeviceHandle     The device that did the DMA.
+  @param[in]      NumberOfEntries  The number of buffers of the list.
+  @param[in]      Entries          The buffers of the list.
+  @param[in, out] Token            The token to signal once the buffers are unmapped.
+
+  @return  What the wrapped UnmapMultipleAsync() returned.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+AccountedUnmapMultipleAsync (
+  IN     EDKII_IOMMU_BATCH_PROTOCOL  *This,
+  IN     EFI_HANDLE                  DeviceHandle,
+  IN     UINTN                       NumberOfEntries,
+  IN     EDKII_IOMMU_BATCH_ENTRY     *Entries,
+  IN OUT EDKII_IOMMU_BATCH_TOKEN     *Token
+  )
+{
+  RISCV_IOMMU_MMIO_OPERATION  Previous;
+  EFI_STATUS                  Status;
+
+  Previous = IoMmuBeginMmioOperation (RiscVIoMmuMmioUnmap);
+  Status   = mAccountedBatchServices.UnmapMultipleAsync (This, DeviceHandle, NumberOfEntries, Entries, Token);
+  IoMmuEndMmioOperation (Previous);
+
+  return Status;
+}
+
+/**
+  Wrap the IOMMU and batch protocol services, so that their register accesses are
+  attributed to them, if PcdRiscVIoMmuMmioAccounting enables the accounting.
+
+  Must be called before the protocols are installed, and after the services are traced.
+
+**/
+VOID
+IoMmuInitialiseMmioAccounting (
+  VOID
+  )
+{
+  if (!FeaturePcdGet (PcdRiscVIoMmuMmioAccounting)) {
+    return;
+  }
+
+  mAccountedServices                 = mRiscVIoMmuProtocol;
+  mRiscVIoMmuProtocol.SetAttribute   = AccountedSetAttribute;
+  mRiscVIoMmuProtocol.Map            = AccountedMap;
+  mRiscVIoMmuProtocol.Unmap          = AccountedUnmap;
+  mRiscVIoMmuProtocol.AllocateBuffer = AccountedAllocateBuffer;
+  mRiscVIoMmuProtocol.FreeBuffer     = AccountedFreeBuffer;
+
+  mAccountedBatchServices                     = mRiscVIoMmuBatchProtocol;
+  mRiscVIoMmuBatchProtocol.MapMultiple        = AccountedMapMultiple;
+  mRiscVIoMmuBatchProtocol.UnmapMultiple      = AccountedUnmapMultiple;
+  mRiscVIoMmuBatchProtocol.MapContiguous      = AccountedMapContiguous;
+  mRiscVIoMmuBatchProtocol.UnmapContiguous    = AccountedUnmapContiguous;
+  mRiscVIoMmuBatchProtocol.MapMultipleAsync   = AccountedMapMultipleAsync;
+  mRiscVIoMmuBatchProtocol.UnmapMultipleAsync = AccountedUnmapMultipleAsync;
+
+  DEBUG ((RISCV_IOMMU_DEBUG_LEVEL, "%a: Counting the register accesses of each operation\n", __func__));
+}
@@ -0,0 +1,454 @@
+/** @file
+  RISC-V IOMMU MSI translation.
+
+  With MSI_FLAT, the extended device contexts point at an MSI page table
+  in flat mode. Each IOMMU has one, shared by all of its domains, which maps
+  the S-level interrupt file of every hart in basic translate mode. Device
+  MSIs then reach the IMSICs while translation is on, and writes to any other
+  page of the IMSIC window, such as M-level or guest interrupt files, fault.
+
+  The IMSIC window is taken from the MADT, or else from the devicetree. The
+  window is also mapped at its own address into the domains' IO page tables,
+  since first-stage translation precedes the MSI address check.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/FdtLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+#include <Guid/Fdt.h>
+#include <Guid/PlatformHasDeviceTree.h>
+#include <IndustryStandard/Acpi66.h>
+#include <Register/RiscV64/RiscVEncoding.h>
+#include "RiscVIoMmu.h"
+
+//
+// Flat MSI page tables of up to 4096 entries are built, 64 KiB at most.
+//
+#define MSI_MAX_INDEX_BITS  12
+
+typedef struct {
+  // Whether the devicetree was searched, and whether an S-level IMSIC window was found.
+  BOOLEAN                 Searched;
+  BOOLEAN                 Found;
+  EFI_PHYSICAL_ADDRESS    Base;
+  // The interrupt file number is the page index in the window, of IndexBits,
+  // whose low GuestIndexBits select the guest. Guest 0 is the S-level file.
+  UINT8                   IndexBits;
+  UINT8                   GuestIndexBits;
+  UINT32                  NumberOfHarts;
+} IMSIC_WINDOW;
+
+STATIC IMSIC_WINDOW  mImsic;
+
+/**
+  Read an optional single-cell property of a devicetree node.
+
+  @param[in]  Fdt      The devicetree.
+  @param[in]  Node     The node.
+  @param[in]  Name     The name of the property.
+  @param[in]  Default  The value of an absent property.
+
+  @return  The value of the property.
+
+**/
+STATIC
+UINT32
+GetCellProperty (
+  IN CONST VOID   *Fdt,
+  IN INT32        Node,
+  IN CONST CHAR8  *Name,
+  IN UINT32       Default
+  )
+{
+  CONST UINT32  *Data32;
+  INT32         TempLen;
+
+  Data32 = (CONST UINT32 *)FdtGetProp (Fdt, Node, Name, &TempLen);
+  if ((Data32 == NULL) || (TempLen < (INT32)sizeof (UINT32))) {
+    return Default;
+  }
+
+  return Fdt32ToCpu (ReadUnaligned32 (Data32));
+}
+
+/**
+  Get the number of hart index bits that the interrupt files of all harts need.
+
+  @param[in]  NumberOfHarts  The number of harts.
+
+  @return  The number of hart index bits.
+
+**/
+STATIC
+UINT32
+GetDefaultHartIndexBits (
+  IN UINT32  NumberOfHarts
+  )
+{
+  return (NumberOfHarts > 1) ? (UINT32)HighBitSet32 (NumberOfHarts - 1) + 1 : 0;
+}
+
+/**
+  Find the S-level IMSIC window in the MADT, if there is one.
+
+  The IMSIC structure describes the layout of the window, and the RINTC structure
+  of each enabled hart the address of its S-level interrupt file. The files must
+  fill the window from its base, one hart after another.
+
+  @param[out]  HartIndexBits  The number of hart index bits.
+
+  @retval  TRUE   mImsic describes the window, but for its index bits.
+  @retval  FALSE  The MADT describes no window that the MSI page table can map.
+
+**/
+STATIC
+BOOLEAN
+FindAcpiSupervisorImsic (
+  OUT UINT32  *HartIndexBits
+  )
+{
+  EFI_ACPI_DESCRIPTION_HEADER   *Madt;
+  UINT8                         *Entry;
+  UINT8                         *End;
+  EFI_ACPI_6_6_IMSIC_STRUCTURE  *Imsic;
+  EFI_ACPI_6_6_RINTC_STRUCTURE  *Rintc;
+  EFI_PHYSICAL_ADDRESS          Top;
+
+  Madt = (VOID *)EfiLocateFirstAcpiTable (EFI_ACPI_6_6_MULTIPLE_APIC_DESCRIPTION_TABLE_SIGNATURE);
+  if (Madt == NULL) {
+    return FALSE;
+  }
+
+  Imsic                = NULL;
+  mImsic.Base          = MAX_UINT64;
+  mImsic.NumberOfHarts = 0;
+  Top                  = 0;
+  End                  = (UINT8 *)Madt + Madt->Length;
+  for (Entry = (UINT8 *)Madt + sizeof (EFI_ACPI_6_6_MULTIPLE_APIC_DESCRIPTION_TABLE_HEADER)
+       ; (Entry + 2 <= End) && (Entry[1] >= 2) && (Entry + Entry[1] <= End)
+       ; Entry += Entry[1]
+       ) {
+    if ((Entry[0] == EFI_ACPI_6_6_IMSIC) && (Entry[1] >= sizeof (*Imsic))) {
+      Imsic = (EFI_ACPI_6_6_IMSIC_STRUCTURE *)Entry;
+      continue;
+    }
+
+    Rintc = (EFI_ACPI_6_6_RINTC_STRUCTURE *)Entry;
+    if ((Entry[0] != EFI_ACPI_6_6_RINTC) || (Rintc->Length < sizeof (*Rintc)) ||
+        ((Rintc->Flags & EFI_ACPI_6_6_RINTC_FLAG_ENABLE) == 0) || (Rintc->ImsicAddr == 0))
+    {
+      continue;
+    }
+
+    mImsic.Base = MIN (mImsic.Base, Rintc->ImsicAddr);
+    Top         = MAX (Top, Rintc->ImsicAddr);
+    mImsic.NumberOfHarts++;
+  }
+
+  if ((Imsic == NULL) || (mImsic.NumberOfHarts == 0)) {
+    return FALSE;
+  }
+
+  if (Imsic->GroupIndexBits != 0) {
+    DEBUG ((DEBUG_WARN, "%a: IMSIC groups aren't supported, so MSIs aren't translated\n", __func__));
+    return FALSE;
+  }
+
+  mImsic.GuestIndexBits = Imsic->GuestIndexBits;
+  *HartIndexBits        = (Imsic->HartIndexBits != 0) ? Imsic->HartIndexBits : GetDefaultHartIndexBits (mImsic.NumberOfHarts);
+
+  //
+  // The interrupt file of the last hart must be the last of the window.
+  //
+  if (Top - mImsic.Base != LShiftU64 (mImsic.NumberOfHarts - 1, EFI_PAGE_SHIFT + mImsic.GuestIndexBits)) {
+    DEBUG ((DEBUG_WARN, "%a: The harts' IMSICs don't fill a window, so MSIs aren't translated\n", __func__));
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/**
+  Find the S-level IMSIC window in the devicetree, if there is one.
+
+  @param[out]  HartIndexBits  The number of hart index bits.
+
+  @retval  TRUE   mImsic describes the window, but for its index bits.
+  @retval  FALSE  The devicetree describes no window that the MSI page table can map.
+
+**/
+STATIC
+BOOLEAN
+FindDeviceTreeSupervisorImsic (
+  OUT UINT32  *HartIndexBits
+  )
+{
+  VOID          *Fdt;
+  VOID          *Registration;
+  INT32         Node;
+  INT32         TempLen;
+  CONST UINT32  *Data32;
+  CONST UINT64  *Data64;
+  EFI_STATUS    Status;
+
+  Status = gBS->LocateProtocol (&gEdkiiPlatformHasDeviceTreeGuid, NULL, (VOID **)&Registration);
+  if (!EFI_ERROR (Status)) {
+    Status = EfiGetSystemConfigurationTable (&gFdtTableGuid, &Fdt);
+  }
+
+  if (EFI_ERROR (Status)) {
+    return FALSE;
+  }
+
+  //
+  // The S-level IMSICs are those targeting the supervisor external interrupt of each hart.
+  //
+  for (Node = FdtNodeOffsetByCompatible (Fdt, -1, "riscv,imsics")
+       ; Node >= 0
+       ; Node = FdtNodeOffsetByCompatible (Fdt, Node, "riscv,imsics")
+       ) {
+    Data32 = (CONST UINT32 *)FdtGetProp (Fdt, Node, "interrupts-extended", &TempLen);
+    if ((Data32 != NULL) && (TempLen >= (INT32)(2 * sizeof (UINT32))) &&
+        (Fdt32ToCpu (ReadUnaligned32 (Data32 + 1)) == IRQ_S_EXT))
+    {
+      break;
+    }
+  }
+
+  if (Node < 0) {
+    return FALSE;
+  }
+
+  mImsic.NumberOfHarts = (UINT32)TempLen / (2 * sizeof (UINT32));
+
+  Data64 = (CONST UINT64 *)FdtGetProp (Fdt, Node, "reg", &TempLen);
+  if ((Data64 == NULL) || (TempLen != 2 * sizeof (UINT64)) ||
+      (GetCellProperty (Fdt, Node, "riscv,group-index-bits", 0) != 0))
+  {
+    DEBUG ((DEBUG_WARN, "%a: IMSIC groups aren't supported, so MSIs aren't translated\n", __func__));
+    return FALSE;
+  }
+
+  *HartIndexBits        = GetCellProperty (Fdt, Node, "riscv,hart-index-bits", GetDefaultHartIndexBits (mImsic.NumberOfHarts));
+  mImsic.GuestIndexBits = (UINT8)GetCellProperty (Fdt, Node, "riscv,guest-index-bits", 0);
+  mImsic.Base           = Fdt64ToCpu (ReadUnaligned64 (Data64));
+  return TRUE;
+}
+
+/**
+  Find the S-level IMSIC window, once. The MADT is searched first, then the devicetree.
+
+  Only a window of one group in one region is supported, as a single MSI address
+  mask and pattern can't describe the interrupt files of several.
+
+  @retval  TRUE   mImsic describes the window.
+  @retval  FALSE  There is no window that the MSI page table can map.
+
+**/
+STATIC
+BOOLEAN
+FindSupervisorImsic (
+  VOID
+  )
+{
+  UINT32  HartIndexBits;
+  UINT64  IndexMask;
+
+  if (mImsic.Searched) {
+    return mImsic.Found;
+  }
+
+  mImsic.Searched = TRUE;
+
+  if (!FindAcpiSupervisorImsic (&HartIndexBits) &&
+      !FindDeviceTreeSupervisorImsic (&HartIndexBits))
+  {
+    DEBUG ((DEBUG_INFO, "%a: No S-level IMSIC, so MSIs aren't translated\n", __func__));
+    return FALSE;
+  }
+
+  if ((HartIndexBits + mImsic.GuestIndexBits > MSI_MAX_INDEX_BITS) ||
+      (mImsic.NumberOfHarts > LShiftU64 (1, HartIndexBits)))
+  {
+    DEBUG ((DEBUG_WARN, "%a: 0x%x harts don't fit an MSI page table\n", __func__, mImsic.NumberOfHarts));
+    return FALSE;
+  }
+
+  mImsic.IndexBits = (UINT8)(HartIndexBits + mImsic.GuestIndexBits);
+
+  //
+  // The bits outside of the mask are matched against the pattern, so the window must be aligned to its size.
+  //
+  IndexMask = LShiftU64 (1, mImsic.IndexBits) - 1;
+  if ((RShiftU64 (mImsic.Base, EFI_PAGE_SHIFT) & IndexMask) != 0) {
+    DEBUG ((DEBUG_WARN, "%a: IMSIC window at 0x%lx is misaligned\n", __func__, mImsic.Base));
+    return FALSE;
+  }
+
+  DEBUG ((
+    RISCV_IOMMU_DEBUG_LEVEL,
+    "%a: S-level IMSIC window at 0x%lx, 0x%x harts, %u index bits\n",
+    __func__,
+    mImsic.Base,
+    mImsic.NumberOfHarts,
+    mImsic.IndexBits
+    ));
+  mImsic.Found = TRUE;
+  return TRUE;
+}
+
+/**
+  Build the MSI page table of an IOMMU that supports flat MSI translation,
+  if the platform has an S-level IMSIC window.
+
+  @param[in]  IoMmu  The IOMMU, whose device contexts are extended.
+
+  @retval  EFI_SUCCESS           The MSI page table is built.
+  @retval  EFI_UNSUPPORTED       The IOMMU or the platform doesn't support MSI translation.
+  @retval  EFI_OUT_OF_RESOURCES  The table could not be allocated.
+
+**/
+EFI_STATUS
+IoMmuInitialiseMsiTranslation (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  RISCV_IOMMU_CAPABILITIES  Capabilities;
+  RISCV_IOMMU_MSI_PTE       *Pte;
+  UINTN                     TableSize;
+  UINT32                    Hart;
+
+  IoMmu->MsiPageTable = NULL;
+
+  Capabilities.Uint64 = IoMmu->Capabilities;
+  if (!Capabilities.Bits.MSI_FLAT || !IoMmu->DeviceContext.ContextStructIsExtended || !FindSupervisorImsic ()) {
+    return EFI_UNSUPPORTED;
+  }
+
+  //
+  // The table is aligned to its size, and takes a page at least.
+  //
+  TableSize = (UINTN)LShiftU64 (RISCV_IOMMU_MSI_PTE_SIZE, mImsic.IndexBits);
+  if (TableSize <= EFI_PAGE_SIZE) {
+    IoMmu->MsiPageTable = IoMmuAllocateTablePage (IoMmu, RiscVIoMmuFootprintDirectory);
+  } else {
+    IoMmu->MsiPageTable = IoMmuAllocateLocalPages (IoMmu, EFI_SIZE_TO_PAGES (TableSize), TableSize, MAX_ADDRESS);
+    if (IoMmu->MsiPageTable == NULL) {
+      IoMmu->MsiPageTable = AllocateAlignedPages (EFI_SIZE_TO_PAGES (TableSize), TableSize);
+    }
+
+    if (IoMmu->MsiPageTable != NULL) {
+      ZeroMem (IoMmu->MsiPageTable, TableSize);
+      IoMmuChargeFootprint (RiscVIoMmuFootprintDirectory, TableSize);
+    }
+  }
+
+  if (IoMmu->MsiPageTable == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  //
+  // Only the S-level file of each hart is valid, at guest index 0.
+  //
+  for (Hart = 0; Hart < mImsic.NumberOfHarts; Hart++) {
+    Pte = (RISCV_IOMMU_MSI_PTE *)((UINT8 *)IoMmu->MsiPageTable +
+                                  LShiftU64 (Hart, mImsic.GuestIndexBits) * RISCV_IOMMU_MSI_PTE_SIZE);
+    Pte->Bits.PPN = RShiftU64 (mImsic.Base, EFI_PAGE_SHIFT) + LShiftU64 (Hart, mImsic.GuestIndexBits);
+    Pte->Bits.M   = V_RISCV_IOMMU_MSI_PTE_MODE_BASIC;
+    Pte->Bits.V   = 1;
+  }
+
+  IoMmuQueueCacheClean (IoMmu, IoMmu->MsiPageTable, TableSize);
+  IoMmuFlushCacheCleans (IoMmu);
+  MemoryFence ();
+  return EFI_SUCCESS;
+}
+
+/**
+  Point an extended device context at the MSI page table of its IOMMU.
+
+  Must be called before the context becomes valid. Without an MSI page table,
+  MSI translation stays off.
+
+  @param[in]  IoMmu          The IOMMU.
+  @param[in]  DeviceContext  The extended device context.
+
+**/
+VOID
+IoMmuSetDeviceContextMsiTranslation (
+  IN RISCV_IOMMU_INSTANCE                 *IoMmu,
+  IN RISCV_IOMMU_EXTENDED_DEVICE_CONTEXT  *DeviceContext
+  )
+{
+  RISCV_IOMMU_DC_MSIPTP  MsiPtp;
+  UINT64                 IndexMask;
+
+  if (IoMmu->MsiPageTable == NULL) {
+    return;
+  }
+
+  IndexMask        = LShiftU64 (1, mImsic.IndexBits) - 1;
+  MsiPtp.Uint64    = 0;
+  MsiPtp.Bits.PPN  = RShiftU64 ((UINTN)IoMmu->MsiPageTable, EFI_PAGE_SHIFT);
+  MsiPtp.Bits.MODE = V_RISCV_IOMMU_MSIPTP_MODE_FLAT;
+
+  DeviceContext->MsiPtp         = MsiPtp.Uint64;
+  DeviceContext->MsiAddrMask    = IndexMask;
+  DeviceContext->MsiAddrPattern = RShiftU64 (mImsic.Base, EFI_PAGE_SHIFT) & ~IndexMask;
+
+  IoMmuQueueCacheClean (IoMmu, &DeviceContext->MsiPtp, 3 * sizeof (UINT64));
+}
+
+/**
+  Map the IMSIC window at its own address into the IO page table of a domain,
+  so that the device's MSIs reach the MSI address check.
+
+  @param[in]  IoMmu   The IOMMU.
+  @param[in]  Domain  The domain, with a page table.
+
+  @retval  EFI_SUCCESS  The window is mapped, or the IOMMU doesn't translate MSIs.
+  @retval  Others       The page table could not be updated.
+
+**/
+EFI_STATUS
+IoMmuMapMsiWindow (
+  IN RISCV_IOMMU_INSTANCE       *IoMmu,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain
+  )
+{
+  RISCV_IOMMU_CAPABILITIES  Capabilities;
+  UINT64                    Access;
+
+  if ((IoMmu->MsiPageTable == NULL) || (Domain->RootPageTable == NULL)) {
+    return EFI_SUCCESS;
+  }
+
+  //
+  // Write-only leaves are reserved, so the window is readable too.
+  //
+  Capabilities.Uint64 = IoMmu->Capabilities;
+  Access              = EDKII_IOMMU_ACCESS_READ | EDKII_IOMMU_ACCESS_WRITE;
+  if (Capabilities.Bits.Svpbmt) {
+    Access |= RISCV_IOMMU_ACCESS_DEVICE_MEMORY;
+  }
+
+  return IoMmuUpdatePageTable (
+           IoMmu,
+           Domain->RootPageTable,
+           Domain->Pscid,
+           mImsic.Base,
+           mImsic.Base,
+           EFI_PAGES_TO_SIZE ((UINTN)LShiftU64 (1, mImsic.IndexBits)),
+           Access,
+           FALSE
+           );
+}
@@ -0,0 +1,295 @@
+/** @file
+  RISC-V IOMMU hand-off to the OS.
+
+  Once boot services exit, the OS would otherwise bring the IOMMUs back to
+  reset and rebuild their tables, leaving DMA unprotected (or stalled) in
+  between. Instead, the live state is published as a configuration table:
+  the registers of every initialised IOMMU, and the domain of each device,
+  so that a cooperating OS driver can adopt the tables as they are.
+
+  The table is allocated at ReadyToBoot, with room for domains still to be
+  created, and is refilled in place by the teardown at ExitBootServices(),
+  when no memory may be allocated any more. It is only published when
+  PcdRiscVIoMmuExitBootServicesState keeps the IOMMUs running.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Guid/RiscVIoMmuHandOff.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/PcdLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+#include "RiscVIoMmu.h"
+
+//
+// The domains that may still be created between ReadyToBoot and the exit of boot services.
+//
+#define RISCV_IOMMU_HAND_OFF_SPARE_DOMAINS  64
+
+STATIC RISCV_IOMMU_HAND_OFF_TABLE  *mHandOffTable   = NULL;
+STATIC UINT32                      mIoMmuCapacity  = 0;
+STATIC UINT32                      mDomainCapacity = 0;
+
+/**
+  Count the initialised IOMMUs, and their domains.
+
+  @param[out]  NumberOfIoMmus   The initialised IOMMUs.
+  @param[out]  NumberOfDomains  The domains of those IOMMUs.
+
+**/
+STATIC
+VOID
+CountHandOffEntries (
+  OUT UINT32  *NumberOfIoMmus,
+  OUT UINT32  *NumberOfDomains
+  )
+{
+  LIST_ENTRY            *InstanceLink;
+  LIST_ENTRY            *Link;
+  RISCV_IOMMU_INSTANCE  *IoMmu;
+
+  *NumberOfIoMmus  = 0;
+  *NumberOfDomains = 0;
+
+  for (InstanceLink = GetFirstNode (&mRiscVIoMmuGlobalDriverContext.InstanceList)
+       ; !IsNull (&mRiscVIoMmuGlobalDriverContext.InstanceList, InstanceLink)
+       ; InstanceLink = GetNextNode (&mRiscVIoMmuGlobalDriverContext.InstanceList, InstanceLink)
+       ) {
+    IoMmu = RISCV_IOMMU_INSTANCE_FROM_LINK (InstanceLink);
+    if (IoMmu->State != STATE_INITIALISED) {
+      continue;
+    }
+
+    (*NumberOfIoMmus)++;
+    for (Link = GetFirstNode (&IoMmu->DomainList)
+         ; !IsNull (&IoMmu->DomainList, Link)
+         ; Link = GetNextNode (&IoMmu->DomainList, Link)
+         ) {
+      (*NumberOfDomains)++;
+    }
+  }
+}
+
+/**
+  Fill the hand-off table with the current state of the IOMMUs, without allocating memory.
+
+  Domains beyond the capacity of the table are left out, and the table is marked incomplete.
+
+**/
+STATIC
+VOID
+FillHandOffTable (
+  VOID
+  )
+{
+  RISCV_IOMMU_HAND_OFF_IOMMU   *IoMmuEntries;
+  RISCV_IOMMU_HAND_OFF_DOMAIN  *DomainEntries;
+  RISCV_IOMMU_HAND_OFF_IOMMU   *IoMmuEntry;
+  RISCV_IOMMU_HAND_OFF_DOMAIN  *DomainEntry;
+  LIST_ENTRY                   *InstanceLink;
+  LIST_ENTRY                   *Link;
+  RISCV_IOMMU_INSTANCE         *IoMmu;
+  RISCV_IOMMU_DEVICE_DOMAIN    *Domain;
+  EFI_PHYSICAL_ADDRESS         PoolBase;
+  UINTN                        PoolPages;
+
+  IoMmuEntries  = (RISCV_IOMMU_HAND_OFF_IOMMU *)((UINT8 *)mHandOffTable + mHandOffTable->IoMmuOffset);
+  DomainEntries = (RISCV_IOMMU_HAND_OFF_DOMAIN *)((UINT8 *)mHandOffTable + mHandOffTable->DomainOffset);
+
+  mHandOffTable->Flags           = 0;
+  mHandOffTable->NumberOfIoMmus  = 0;
+  mHandOffTable->NumberOfDomains = 0;
+
+  IoMmuGetTablePagePoolRange (&PoolBase, &PoolPages);
+  mHandOffTable->TablePageRegionBase = PoolBase;
+  mHandOffTable->TablePageRegionSize = EFI_PAGES_TO_SIZE (PoolPages);
+
+  for (InstanceLink = GetFirstNode (&mRiscVIoMmuGlobalDriverContext.InstanceList)
+       ; !IsNull (&mRiscVIoMmuGlobalDriverContext.InstanceList, InstanceLink)
+       ; InstanceLink = GetNextNode (&mRiscVIoMmuGlobalDriverContext.InstanceList, InstanceLink)
+       ) {
+    IoMmu = RISCV_IOMMU_INSTANCE_FROM_LINK (InstanceLink);
+    if (IoMmu->State != STATE_INITIALISED) {
+      continue;
+    }
+
+    //
+    // IOMMUs initialised after ReadyToBoot don't fit; the OS must not trust what it can't see.
+    //
+    if (mHandOffTable->NumberOfIoMmus == mIoMmuCapacity) {
+      mHandOffTable->Flags |= RISCV_IOMMU_HAND_OFF_INCOMPLETE;
+      break;
+    }
+
+    IoMmuEntry = &IoMmuEntries[mHandOffTable->NumberOfIoMmus++];
+    ZeroMem (IoMmuEntry, sizeof (*IoMmuEntry));
+    IoMmuEntry->Address                = IoMmu->Address;
+    IoMmuEntry->PciSegment             = IoMmu->PciSegment;
+    IoMmuEntry->PciBdf                 = IoMmu->PciBdf;
+    IoMmuEntry->Capabilities           = IoMmu->Capabilities;
+    IoMmuEntry->FeatureControl         = IoMmu->FeatureControl;
+    IoMmuEntry->IoSatpMode             = IoMmu->IoSatpMode;
+    IoMmuEntry->DeviceDirectoryPointer = IoMmuRead64 (IoMmu, R_RISCV_IOMMU_DDTP);
+    IoMmuEntry->CommandQueueBase       = IoMmuRead64 (IoMmu, R_RISCV_IOMMU_CQB);
+    IoMmuEntry->FaultQueueBase         = IoMmuRead64 (IoMmu, R_RISCV_IOMMU_FQB);
+    IoMmuEntry->PageRequestQueueBase   = IoMmuRead64 (IoMmu, R_RISCV_IOMMU_PQB);
+    IoMmuEntry->FirstDomain            = mHandOffTable->NumberOfDomains;
+    if (IoMmu->IoMmuIsPciDevice) {
+      IoMmuEntry->Flags |= RISCV_IOMMU_HAND_OFF_IOMMU_PCI;
+    }
+
+    if (IoMmu->DeviceContext.ContextStructIsExtended) {
+      IoMmuEntry->Flags |= RISCV_IOMMU_HAND_OFF_IOMMU_EXTENDED_CONTEXT;
+    }
+
+    for (Link = GetFirstNode (&IoMmu->DomainList)
+         ; !IsNull (&IoMmu->DomainList, Link)
+         ; Link = GetNextNode (&IoMmu->DomainList, Link)
+         ) {
+      if (mHandOffTable->NumberOfDomains == mDomainCapacity) {
+        mHandOffTable->Flags |= RISCV_IOMMU_HAND_OFF_INCOMPLETE;
+        break;
+      }
+
+      Domain      = RISCV_IOMMU_DEVICE_DOMAIN_FROM_LINK (Link);
+      DomainEntry = &DomainEntries[mHandOffTable->NumberOfDomains++];
+      ZeroMem (DomainEntry, sizeof (*DomainEntry));
+      DomainEntry->DeviceId      = Domain->DeviceId.Uint32;
+      DomainEntry->Mode          = Domain->Mode;
+      DomainEntry->Pscid         = Domain->Pscid;
+      DomainEntry->RootPageTable = (UINT64)(UINTN)Domain->RootPageTable;
+
+      //
+      // A quarantined device translates through the empty table, which the OS inherits.
+      //
+      if (Domain->Quarantined) {
+        DomainEntry->Pscid         = IoMmu->BlockingPscid;
+        DomainEntry->RootPageTable = (UINT64)(UINTN)IoMmu->BlockingRootPageTable;
+      }
+
+      IoMmuEntry->NumberOfDomains++;
+    }
+  }
+}
+
+/**
+  Refill the hand-off table with the state the OS inherits, as the IOMMUs are kept running
+  at ExitBootServices().
+
+**/
+VOID
+IoMmuRefreshOsHandOff (
+  VOID
+  )
+{
+  if (mHandOffTable == NULL) {
+    return;
+  }
+
+  FillHandOffTable ();
+  mHandOffTable->Flags |= RISCV_IOMMU_HAND_OFF_EXIT_BOOT_SERVICES;
+
+  DEBUG ((
+    RISCV_IOMMU_DEBUG_LEVEL,
+    "%a: Handing off 0x%x IOMMUs with 0x%x domains%a\n",
+    __func__,
+    mHandOffTable->NumberOfIoMmus,
+    mHandOffTable->NumberOfDomains,
+    ((mHandOffTable->Flags & RISCV_IOMMU_HAND_OFF_INCOMPLETE) != 0) ? ", incompletely" : ""
+    ));
+}
+
+/**
+  Allocate the hand-off table, sized for the IOMMUs and domains so far, and publish it.
+
+  @param[in]  Event    The event.
+  @param[in]  Context  Unused.
+
+**/
+STATIC
+VOID
+EFIAPI
+OnReadyToBoot (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  UINT32      NumberOfIoMmus;
+  UINT32      NumberOfDomains;
+  UINTN       Size;
+  VOID        *Table;
+  EFI_STATUS  Status;
+
+  //
+  // ReadyToBoot is signalled again by each boot option that returns.
+  //
+  gBS->CloseEvent (Event);
+
+  CountHandOffEntries (&NumberOfIoMmus, &NumberOfDomains);
+  if (NumberOfIoMmus == 0) {
+    return;
+  }
+
+  mIoMmuCapacity  = NumberOfIoMmus;
+  mDomainCapacity = NumberOfDomains + RISCV_IOMMU_HAND_OFF_SPARE_DOMAINS;
+  Size            = sizeof (RISCV_IOMMU_HAND_OFF_TABLE) +
+                    mIoMmuCapacity * sizeof (RISCV_IOMMU_HAND_OFF_IOMMU) +
+                    mDomainCapacity * sizeof (RISCV_IOMMU_HAND_OFF_DOMAIN);
+
+  Status = gBS->AllocatePool (EfiACPIReclaimMemory, Size, &Table);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_WARN, "%a: Failed to allocate the hand-off table: %r\n", __func__, Status));
+    return;
+  }
+
+  ZeroMem (Table, Size);
+  mHandOffTable                  = Table;
+  mHandOffTable->Signature       = RISCV_IOMMU_HAND_OFF_TABLE_SIGNATURE;
+  mHandOffTable->Revision        = RISCV_IOMMU_HAND_OFF_TABLE_REVISION;
+  mHandOffTable->HeaderSize      = sizeof (*mHandOffTable);
+  mHandOffTable->IoMmuOffset     = sizeof (*mHandOffTable);
+  mHandOffTable->IoMmuEntrySize  = sizeof (RISCV_IOMMU_HAND_OFF_IOMMU);
+  mHandOffTable->DomainOffset    = mHandOffTable->IoMmuOffset + mIoMmuCapacity * sizeof (RISCV_IOMMU_HAND_OFF_IOMMU);
+  mHandOffTable->DomainEntrySize = sizeof (RISCV_IOMMU_HAND_OFF_DOMAIN);
+  FillHandOffTable ();
+
+  Status = gBS->InstallConfigurationTable (&gRiscVIoMmuHandOffTableGuid, mHandOffTable);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_WARN, "%a: Failed to publish the hand-off table: %r\n", __func__, Status));
+    gBS->FreePool (mHandOffTable);
+    mHandOffTable = NULL;
+  }
+}
+
+/**
+  Publish the state of the IOMMUs to the OS at ReadyToBoot, if PcdRiscVIoMmuExitBootServicesState
+  keeps them running. The teardown at ExitBootServices() refreshes it, so it needs that to be registered.
+
+  @retval  EFI_SUCCESS      The event is registered, or the IOMMUs are not kept running.
+  @retval  EFI_UNSUPPORTED  The teardown isn't registered. Nothing is handed off.
+  @retval  Others           The event could not be created. Nothing is handed off.
+
+**/
+EFI_STATUS
+IoMmuInitialiseOsHandOff (
+  VOID
+  )
+{
+  EFI_EVENT  ReadyToBootEvent;
+
+  if (FixedPcdGet8 (PcdRiscVIoMmuExitBootServicesState) != RISCV_IOMMU_EXIT_STATE_KEEP) {
+    return EFI_SUCCESS;
+  }
+
+  if (!mRiscVIoMmuGlobalDriverContext.TeardownAtExit) {
+    return EFI_UNSUPPORTED;
+  }
+
+  return EfiCreateEventReadyToBootEx (TPL_CALLBACK, OnReadyToBoot, NULL, &ReadyToBootEvent);
+}
@@ -0,0 +1,412 @@
+/** @file
+  RISC-V IOMMU pool of zeroed table pages.
+
+  Device-directory and IO page-table pages are served from a contiguous
+  region that is reserved and zeroed in bulk when the driver initialises,
+  with cbo.zero where every hart implements Zicboz, in chunks that are spread
+  over all harts by RiscVTaskPoolLib. A page is handed out by
+  bumping the watermark, or from the free list of returned pages, which are
+  zeroed again before they are linked through their first word. Only once
+  the pool is exhausted are pages allocated from the DXE core. The pool is
+  taken from the platform's DMA pool, if it has room, and otherwise is local
+  to the IOMMUs' proximity domain, if they share one.
+
+  An IO page-table page that unmaps emptied is unhooked, but the IOMMU may
+  still walk it until its cached non-leaf entries are invalidated. It is
+  retired with the sequence number of the next IOFENCE.C, which follows
+  that invalidation, and only freed once that fence completes, so that
+  reclaiming it costs no fence of its own.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
+#include <Library/RiscVIsaLib.h>
+#include <Library/RiscVTaskPoolLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include "RiscVIoMmu.h"
+
+//
+// The pages that one task of the pool's bulk zeroing covers.
+//
+#define TABLE_PAGE_POOL_ZERO_CHUNK  32
+
+typedef struct _TABLE_PAGE TABLE_PAGE;
+struct _TABLE_PAGE {
+  TABLE_PAGE  *NextFree;
+};
+
+typedef struct {
+  EFI_PHYSICAL_ADDRESS  Base;
+  UINTN                 NumberOfPages;
+  // The number of pages that were ever handed out, from the base.
+  UINTN                 Watermark;
+  TABLE_PAGE            *FreeList;
+  UINTN                 PagesInUse;
+  UINTN                 HighWater;
+  // The cbo.zero block size, or 0 without Zicboz.
+  UINTN                 ZeroBlockSize;
+} TABLE_PAGE_POOL;
+
+STATIC TABLE_PAGE_POOL  mTablePagePool;
+
+/**
+  Zero whole pages, with cbo.zero if possible.
+
+  @param[in]  Pages          The first page.
+  @param[in]  NumberOfPages  The number of pages.
+
+**/
+STATIC
+VOID
+ZeroTablePages (
+  IN VOID   *Pages,
+  IN UINTN  NumberOfPages
+  )
+{
+  UINTN  Address;
+  UINTN  End;
+
+  if (mTablePagePool.ZeroBlockSize == 0) {
+    ZeroMem (Pages, EFI_PAGES_TO_SIZE (NumberOfPages));
+    return;
+  }
+
+  End = (UINTN)Pages + EFI_PAGES_TO_SIZE (NumberOfPages);
+  for (Address = (UINTN)Pages; Address < End; Address += mTablePagePool.ZeroBlockSize) {
+    RiscVCacheBlockZero (Address);
+  }
+}
+
+/**
+  Zero one chunk of the table-page pool, as a task of RiscVTaskPoolRun().
+
+  @param[in]  Context  The pool.
+  @param[in]  Index    The number of the chunk.
+
+**/
+STATIC
+VOID
+EFIAPI
+ZeroTablePageChunk (
+  IN VOID   *Context,
+  IN UINTN  Index
+  )
+{
+  TABLE_PAGE_POOL  *Pool;
+  UINTN            FirstPage;
+
+  Pool      = Context;
+  FirstPage = Index * TABLE_PAGE_POOL_ZERO_CHUNK;
+  ZeroTablePages (
+    (VOID *)(UINTN)(Pool->Base + EFI_PAGES_TO_SIZE (FirstPage)),
+    MIN (TABLE_PAGE_POOL_ZERO_CHUNK, Pool->NumberOfPages - FirstPage)
+    );
+}
+
+/**
+  Reserve and zero the table-page pool, as sized by PcdRiscVIoMmuTablePagePoolSize.
+
+  @retval  EFI_SUCCESS           The pool is reserved, or is disabled.
+  @retval  EFI_OUT_OF_RESOURCES  The pool could not be reserved.
+
+**/
+EFI_STATUS
+IoMmuInitialiseTablePagePool (
+  VOID
+  )
+{
+  UINTN                 NumberOfPages;
+  EFI_PHYSICAL_ADDRESS  Base;
+  EFI_STATUS            Status;
+
+  if (mTablePagePool.NumberOfPages != 0) {
+    return EFI_SUCCESS;
+  }
+
+  NumberOfPages = EFI_SIZE_TO_PAGES (PcdGet32 (PcdRiscVIoMmuTablePagePoolSize));
+  if (NumberOfPages == 0) {
+    return EFI_SUCCESS;
+  }
+
+  //
+  // The pool comes from the platform's DMA pool, or else is local to the IOMMUs,
+  // if they share a proximity domain.
+  //
+  Base = (EFI_PHYSICAL_ADDRESS)(UINTN)IoMmuAllocateDmaPoolPages (NumberOfPages, EFI_PAGE_SIZE, MAX_ADDRESS);
+  if (Base == 0) {
+    Base = (EFI_PHYSICAL_ADDRESS)(UINTN)IoMmuAllocateLocalPages (NULL, NumberOfPages, EFI_PAGE_SIZE, MAX_ADDRESS);
+  }
+
+  if (Base == 0) {
+    Status = gBS->AllocatePages (AllocateAnyPages, EfiBootServicesData, NumberOfPages, &Base);
+    if (EFI_ERROR (Status)) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+  }
+
+  mTablePagePool.ZeroBlockSize = RiscVIsaGetCbozBlockSize ();
+  mTablePagePool.Base          = Base;
+  mTablePagePool.NumberOfPages = NumberOfPages;
+  Status                       = RiscVTaskPoolRun (
+                                   ZeroTablePageChunk,
+                                   &mTablePagePool,
+                                   (NumberOfPages + TABLE_PAGE_POOL_ZERO_CHUNK - 1) / TABLE_PAGE_POOL_ZERO_CHUNK
+                                   );
+  ASSERT_EFI_ERROR (Status);
+
+  //
+  // The zeroes must be observable before any page is linked into a table.
+  //
+  MemoryFence ();
+
+  mTablePagePool.Watermark  = 0;
+  mTablePagePool.FreeList   = NULL;
+  mTablePagePool.PagesInUse = 0;
+  mTablePagePool.HighWater  = 0;
+
+  DEBUG ((
+    RISCV_IOMMU_DEBUG_LEVEL,
+    "%a: Reserved %u table pages at 0x%lx, zeroed with %a\n",
+    __func__,
+    NumberOfPages,
+    Base,
+    (mTablePagePool.ZeroBlockSize != 0) ? "cbo.zero" : "stores"
+    ));
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Return the table-page pool in one piece, if none of its pages are in use.
+
+**/
+VOID
+IoMmuFreeTablePagePool (
+  VOID
+  )
+{
+  if ((mTablePagePool.NumberOfPages == 0) || (mTablePagePool.PagesInUse != 0)) {
+    return;
+  }
+
+  gBS->FreePages (mTablePagePool.Base, mTablePagePool.NumberOfPages);
+  ZeroMem (&mTablePagePool, sizeof (mTablePagePool));
+}
+
+/**
+  Allocate a zeroed page for a device-directory or IO page table.
+
+  An IOMMU outside the pool's proximity domain takes pages from its own memory.
+
+  @param[in]  IoMmu      The IOMMU that walks the table.
+  @param[in]  Footprint  What the page is accounted as.
+
+  @return  The page, or NULL if it could not be allocated, or PcdRiscVIoMmuMetadataLimit is reached.
+
+**/
+VOID *
+IoMmuAllocateTablePage (
+  IN RISCV_IOMMU_INSTANCE   *IoMmu,
+  IN RISCV_IOMMU_FOOTPRINT  Footprint
+  )
+{
+  TABLE_PAGE  *Page;
+  EFI_TPL     OriginalTpl;
+
+  if (!IoMmuChargeFootprint (Footprint, EFI_PAGE_SIZE)) {
+    return NULL;
+  }
+
+  if (!IoMmuUsesSharedPools (IoMmu)) {
+    OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+    Page        = IoMmuAllocateLocalTablePage (IoMmu);
+    gBS->RestoreTPL (OriginalTpl);
+    if (Page != NULL) {
+      IoMmuCleanTablePage (Page);
+      return Page;
+    }
+  }
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  Page        = mTablePagePool.FreeList;
+  if (Page != NULL) {
+    mTablePagePool.FreeList = Page->NextFree;
+    Page->NextFree          = NULL;
+  } else if (mTablePagePool.Watermark < mTablePagePool.NumberOfPages) {
+    Page = (TABLE_PAGE *)(UINTN)(mTablePagePool.Base + EFI_PAGES_TO_SIZE (mTablePagePool.Watermark));
+    mTablePagePool.Watermark++;
+  }
+
+  if (Page != NULL) {
+    mTablePagePool.PagesInUse++;
+    mTablePagePool.HighWater = MAX (mTablePagePool.HighWater, mTablePagePool.PagesInUse);
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+
+  if (Page == NULL) {
+    if (mTablePagePool.NumberOfPages != 0) {
+      DEBUG ((DEBUG_WARN, "%a: All %u pooled table pages are in use\n", __func__, mTablePagePool.HighWater));
+    }
+
+    Page = AllocatePages (1);
+    if (Page != NULL) {
+      ZeroMem (Page, EFI_PAGE_SIZE);
+    }
+  }
+
+  if (Page != NULL) {
+    IoMmuCleanTablePage (Page);
+  } else {
+    IoMmuReleaseFootprint (Footprint, EFI_PAGE_SIZE);
+  }
+
+  return Page;
+}
+
+/**
+  Free a page of a device-directory or IO page table.
+
+  @param[in]  Page       The page, from IoMmuAllocateTablePage().
+  @param[in]  Footprint  What the page was accounted as.
+
+**/
+VOID
+IoMmuFreeTablePage (
+  IN VOID                   *Page,
+  IN RISCV_IOMMU_FOOTPRINT  Footprint
+  )
+{
+  EFI_TPL  OriginalTpl;
+
+  IoMmuReleaseFootprint (Footprint, EFI_PAGE_SIZE);
+  if (((EFI_PHYSICAL_ADDRESS)(UINTN)Page < mTablePagePool.Base) ||
+      ((EFI_PHYSICAL_ADDRESS)(UINTN)Page >= mTablePagePool.Base + EFI_PAGES_TO_SIZE (mTablePagePool.NumberOfPages)))
+  {
+    FreePages (Page, 1);
+    return;
+  }
+
+  ZeroTablePages (Page, 1);
+
+  OriginalTpl                    = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  ((TABLE_PAGE *)Page)->NextFree = mTablePagePool.FreeList;
+  mTablePagePool.FreeList        = Page;
+  mTablePagePool.PagesInUse--;
+  gBS->RestoreTPL (OriginalTpl);
+}
+
+/**
+  Retire an IO page-table page that is about to be unhooked, to be freed once the
+  next IOFENCE.C of the IOMMU completes.
+
+  @param[in]  IoMmu  The IOMMU that walks the page.
+  @param[in]  Page   The page, from IoMmuAllocateTablePage().
+
+  @retval  TRUE   The page is retired, and must be unhooked before the next fence.
+  @retval  FALSE  Too many pages wait for a fence, so the page must stay hooked.
+
+**/
+BOOLEAN
+IoMmuRetireTablePage (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN VOID                  *Page
+  )
+{
+  RETIRED_TABLE_PAGE  *Retired;
+  EFI_TPL             OriginalTpl;
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  if (IoMmu->NumberOfRetiredTablePages == RISCV_IOMMU_RETIRED_TABLE_PAGES) {
+    gBS->RestoreTPL (OriginalTpl);
+    return FALSE;
+  }
+
+  Retired        = &IoMmu->RetiredTablePages[IoMmu->NumberOfRetiredTablePages++];
+  Retired->Page  = Page;
+  Retired->Epoch = IoMmu->FenceSequence + 1;
+  IoMmu->TablePagesRetired++;
+  gBS->RestoreTPL (OriginalTpl);
+  return TRUE;
+}
+
+/**
+  Free the retired IO page-table pages that a completed IOFENCE.C covers.
+
+  @param[in]  IoMmu     The IOMMU.
+  @param[in]  Sequence  The sequence number of the completed fence.
+
+**/
+VOID
+IoMmuReclaimTablePages (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT32                Sequence
+  )
+{
+  RETIRED_TABLE_PAGE  *Retired;
+  UINTN               Index;
+  UINTN               Kept;
+  EFI_TPL             OriginalTpl;
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  for (Index = 0, Kept = 0; Index < IoMmu->NumberOfRetiredTablePages; Index++) {
+    Retired = &IoMmu->RetiredTablePages[Index];
+
+    //
+    // Sequence numbers wrap around, so they are compared by their distance.
+    //
+    if ((INT32)(Sequence - Retired->Epoch) >= 0) {
+      IoMmuFreeTablePage (Retired->Page, RiscVIoMmuFootprintPageTable);
+    } else {
+      IoMmu->RetiredTablePages[Kept++] = *Retired;
+    }
+  }
+
+  IoMmu->NumberOfRetiredTablePages = Kept;
+  gBS->RestoreTPL (OriginalTpl);
+}
+
+/**
+  Report the size of the table-page pool, and how much of it is in use.
+
+  @param[out]  NumberOfPages  The pages of the pool.
+  @param[out]  PagesInUse     The pages handed out and not freed.
+  @param[out]  HighWater      The most pages that were in use at once.
+
+**/
+VOID
+IoMmuGetTablePagePoolUsage (
+  OUT UINTN  *NumberOfPages,
+  OUT UINTN  *PagesInUse,
+  OUT UINTN  *HighWater
+  )
+{
+  *NumberOfPages = mTablePagePool.NumberOfPages;
+  *PagesInUse    = mTablePagePool.PagesInUse;
+  *HighWater     = mTablePagePool.HighWater;
+}
+
+/**
+  Report the region that the table-page pool was reserved at.
+
+  @param[out]  Base           The base of the pool, or 0 if there is none.
+  @param[out]  NumberOfPages  The pages of the pool.
+
+**/
+VOID
+IoMmuGetTablePagePoolRange (
+  OUT EFI_PHYSICAL_ADDRESS  *Base,
+  OUT UINTN                 *NumberOfPages
+  )
+{
+  *Base          = mTablePagePool.Base;
+  *NumberOfPages = mTablePagePool.NumberOfPages;
+}
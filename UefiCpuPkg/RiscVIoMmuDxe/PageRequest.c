@@ -0,0 +1,343 @@
+/** @file
+  RISC-V IOMMU demand mapping through the PCIe Page Request Interface.
+
+  A large buffer granted to a function with PRI is not mapped up front.
+  Its range is only recorded, and when the function's ATC misses in it,
+  the function sends page requests, which the IOMMU writes to its page-
+  request queue. Each requested page is mapped into the function's domain,
+  and once the last request of a group is handled, the group is answered
+  with a PRG Response through ATS.PRGR. System memory is always resident
+  in firmware, so mapping the page is all a request needs.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include "RiscVIoMmu.h"
+
+#define DEMAND_RANGE_SIGNATURE  SIGNATURE_32 ('R', 'V', 'D', 'R')
+
+//
+// A range of a domain that is mapped as its pages are requested.
+//
+typedef struct {
+  UINT32                  Signature;
+  LIST_ENTRY              Link;
+  MAP_INFO                *MapInfo;
+  UINT64                  Start;
+  UINT64                  End;
+  EFI_PHYSICAL_ADDRESS    PhysicalBase;
+  UINT64                  IoMmuAccess;
+} DEMAND_RANGE;
+
+#define DEMAND_RANGE_FROM_LINK(a) \
+  CR (a, DEMAND_RANGE, Link, DEMAND_RANGE_SIGNATURE)
+
+/**
+  Leave a granted range unmapped, to be mapped by the page requests of its function.
+
+  Only ranges of at least PcdRiscVIoMmuDemandMapThreshold bytes, that are not
+  persistent, are mapped on demand, and only in domains with PRI enabled.
+
+  @param[in]  MapInfo           The mapping the range belongs to.
+  @param[in]  Domain            The domain access is granted to, which becomes the owner.
+  @param[in]  IoVirtualAddress  The first IO virtual address of the range.
+  @param[in]  PhysicalAddress   The physical address that IoVirtualAddress maps to.
+  @param[in]  Length            The length of the range.
+  @param[in]  IoMmuAccess       The access granted.
+
+  @retval  TRUE   The range is recorded, and must not be mapped by the caller.
+  @retval  FALSE  The caller must map the range.
+
+**/
+BOOLEAN
+IoMmuDeferDemandMapping (
+  IN MAP_INFO                   *MapInfo,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain,
+  IN UINT64                     IoVirtualAddress,
+  IN EFI_PHYSICAL_ADDRESS       PhysicalAddress,
+  IN UINT64                     Length,
+  IN UINT64                     IoMmuAccess
+  )
+{
+  DEMAND_RANGE  *Range;
+  EFI_TPL       OriginalTpl;
+
+  //
+  // The rings and descriptors of common buffers are reached at once, so gain nothing.
+  // The other functions of a group would find no translation, and their requests no range.
+  //
+  if (!Domain->PriEnabled || (Domain->Group != NULL) || (IoMmuAccess == 0) || MapInfo->Persistent ||
+      (Length < PcdGet32 (PcdRiscVIoMmuDemandMapThreshold)))
+  {
+    return FALSE;
+  }
+
+  Range = AllocatePool (sizeof (DEMAND_RANGE));
+  if (Range == NULL) {
+    return FALSE;
+  }
+
+  Range->Signature    = DEMAND_RANGE_SIGNATURE;
+  Range->MapInfo      = MapInfo;
+  Range->Start        = IoVirtualAddress;
+  Range->End          = IoVirtualAddress + Length;
+  Range->PhysicalBase = PhysicalAddress;
+  Range->IoMmuAccess  = IoMmuAccess;
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  InsertTailList (&Domain->DemandRanges, &Range->Link);
+  MapInfo->DemandMapped = TRUE;
+  gBS->RestoreTPL (OriginalTpl);
+
+  return TRUE;
+}
+
+/**
+  Stop mapping the range of a mapping on demand, before it is unmapped or mapped in full.
+
+  Pages that were already requested stay mapped until the caller unmaps the range.
+
+  @param[in]  MapInfo  The mapping, whose owner's domain holds the range.
+
+**/
+VOID
+IoMmuForgetDemandMapping (
+  IN MAP_INFO  *MapInfo
+  )
+{
+  RISCV_IOMMU_DEVICE_DOMAIN  *Domain;
+  LIST_ENTRY                 *Link;
+  DEMAND_RANGE               *Range;
+  EFI_TPL                    OriginalTpl;
+
+  if (!MapInfo->DemandMapped) {
+    return;
+  }
+
+  Domain = MapInfo->OwnerDomain;
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  for (Link = GetFirstNode (&Domain->DemandRanges)
+       ; !IsNull (&Domain->DemandRanges, Link)
+       ; Link = GetNextNode (&Domain->DemandRanges, Link)
+       ) {
+    Range = DEMAND_RANGE_FROM_LINK (Link);
+    if (Range->MapInfo == MapInfo) {
+      RemoveEntryList (Link);
+      break;
+    }
+  }
+
+  MapInfo->DemandMapped = FALSE;
+  gBS->RestoreTPL (OriginalTpl);
+
+  if (!IsNull (&Domain->DemandRanges, Link)) {
+    FreePool (Range);
+  }
+}
+
+/**
+  Map the page of a page request, if a demand range of its domain grants the access.
+
+  @param[in]  IoMmu    The IOMMU.
+  @param[in]  Domain   The domain of the requesting function.
+  @param[in]  Request  The page request.
+
+  @retval  TRUE   The page is mapped.
+  @retval  FALSE  The request is invalid.
+
+**/
+STATIC
+BOOLEAN
+MapRequestedPage (
+  IN RISCV_IOMMU_INSTANCE             *IoMmu,
+  IN RISCV_IOMMU_DEVICE_DOMAIN        *Domain,
+  IN RISCV_IOMMU_PAGE_REQUEST_RECORD  *Request
+  )
+{
+  LIST_ENTRY    *Link;
+  DEMAND_RANGE  *Range;
+  UINT64        Page;
+  UINT64        Access;
+
+  Page   = LShiftU64 (Request->Bits.ADDR, RISCV_MMU_PAGE_SHIFT);
+  Access = (Request->Bits.R || Request->Bits.EXEC) ? EDKII_IOMMU_ACCESS_READ : 0;
+  Access = Request->Bits.W ? (Access | EDKII_IOMMU_ACCESS_WRITE) : Access;
+
+  for (Link = GetFirstNode (&Domain->DemandRanges)
+       ; !IsNull (&Domain->DemandRanges, Link)
+       ; Link = GetNextNode (&Domain->DemandRanges, Link)
+       ) {
+    Range = DEMAND_RANGE_FROM_LINK (Link);
+    if ((Page < Range->Start) || (Page >= Range->End)) {
+      continue;
+    }
+
+    if ((Access & ~Range->IoMmuAccess) != 0) {
+      return FALSE;
+    }
+
+    return !EFI_ERROR (
+              IoMmuUpdateDomainPageTable (
+                IoMmu,
+                Domain,
+                Page,
+                Range->PhysicalBase + (Page - Range->Start),
+                EFI_PAGE_SIZE,
+                Range->IoMmuAccess,
+                FALSE
+                )
+              );
+  }
+
+  return FALSE;
+}
+
+/**
+  Handle a page-request record, answering its group if it is the last request.
+
+  @param[in]  IoMmu    The IOMMU.
+  @param[in]  Request  The page-request record.
+
+**/
+STATIC
+VOID
+HandlePageRequest (
+  IN RISCV_IOMMU_INSTANCE             *IoMmu,
+  IN RISCV_IOMMU_PAGE_REQUEST_RECORD  *Request
+  )
+{
+  RISCV_IOMMU_DEVICE_DOMAIN  *Domain;
+  UINT16                     Group;
+  UINT64                     GroupBit;
+  UINT8                      ResponseCode;
+
+  //
+  // A stop marker only tells that a PASID's requests are complete, and isn't answered.
+  //
+  if (!Request->Bits.R && !Request->Bits.W && Request->Bits.L) {
+    return;
+  }
+
+  //
+  // Responses are routed to the function by the RID its domain was resolved with.
+  //
+  Domain = IoMmuFindDeviceDomain (IoMmu, (UINT32)Request->Bits.DID);
+  if ((Domain == NULL) || !Domain->PriEnabled) {
+    DEBUG ((DEBUG_WARN, "RISC-V IOMMU 0x%lx: Page request of device_id 0x%x without PRI\n", IoMmu->Address, (UINT32)Request->Bits.DID));
+    return;
+  }
+
+  Group    = (UINT16)Request->Bits.PRGI;
+  GroupBit = LShiftU64 (1, Group % 64);
+
+  //
+  // PASIDs are never enabled, so their requests are invalid.
+  //
+  if (Request->Bits.PV || !MapRequestedPage (IoMmu, Domain, Request)) {
+    DEBUG ((
+      DEBUG_WARN,
+      "RISC-V IOMMU 0x%lx: Invalid page request for 0x%lx by device_id 0x%x\n",
+      IoMmu->Address,
+      LShiftU64 (Request->Bits.ADDR, RISCV_MMU_PAGE_SHIFT),
+      Domain->DeviceId.Uint32
+      ));
+    Domain->FailedPageRequestGroups[Group / 64] |= GroupBit;
+  }
+
+  if (!Request->Bits.L) {
+    return;
+  }
+
+  ResponseCode = ((Domain->FailedPageRequestGroups[Group / 64] & GroupBit) != 0) ?
+                 V_RISCV_IOMMU_PRGR_INVALID_REQUEST : V_RISCV_IOMMU_PRGR_SUCCESS;
+  Domain->FailedPageRequestGroups[Group / 64] &= ~GroupBit;
+
+  IoMmuQueuePageRequestResponse (IoMmu, Domain->PciSegment, Domain->PciRequesterId, Group, ResponseCode);
+}
+
+/**
+  Service every record in the page-request queue of an IOMMU.
+
+  The pages of all records are mapped, and the groups answered, with a single IOFENCE.C.
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @return  The number of records consumed.
+
+**/
+UINTN
+IoMmuDrainPageRequestQueue (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  QUEUE_WRAPPER                           *Queue;
+  RISCV_IOMMU_HARDWARE_REQUEST_QUEUE_CSR  PageRequestQueueCsr;
+  RISCV_IOMMU_PAGE_REQUEST_RECORD         *Records;
+  UINT32                                  Tail;
+  UINTN                                   Consumed;
+  EFI_TPL                                 OriginalTpl;
+
+  Queue = &IoMmu->PageRequestQueue;
+  if ((IoMmu->State != STATE_INITIALISED) || (Queue->Buffer == NULL)) {
+    return 0;
+  }
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+
+  //
+  // Records are complete once the tail covers them.
+  //
+  Tail = IoMmuReadAcquire32 (IoMmu, R_RISCV_IOMMU_PQT) & Queue->Mask;
+
+  Records  = Queue->Buffer;
+  Consumed = 0;
+  IoMmuBeginCommandBatch (IoMmu);
+  while (Queue->Head != Tail) {
+    if (!Queue->Uncached) {
+      IoMmuInvalidateCacheRange (IoMmu, &Records[Queue->Head], sizeof (*Records));
+    }
+
+    HandlePageRequest (IoMmu, &Records[Queue->Head]);
+    Queue->Head = (Queue->Head + 1) & Queue->Mask;
+    Consumed++;
+  }
+
+  IoMmuEndCommandBatch (IoMmu);
+
+  if (Consumed != 0) {
+    //
+    // The records must be read before their slots are handed back.
+    //
+    IoMmuWriteRelease32 (IoMmu, R_RISCV_IOMMU_PQH, Queue->Head);
+  }
+
+  //
+  // Recording stops on an overflow or memory fault, until the flag is cleared.
+  //
+  PageRequestQueueCsr.Uint32 = IoMmuRead32 (IoMmu, R_RISCV_IOMMU_PQCSR);
+  if (PageRequestQueueCsr.Bits.qof || PageRequestQueueCsr.Bits.qmf) {
+    IoMmuWrite32 (IoMmu, R_RISCV_IOMMU_PQCSR, PageRequestQueueCsr.Uint32);
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+
+  if (PageRequestQueueCsr.Bits.qof || PageRequestQueueCsr.Bits.qmf) {
+    DEBUG ((
+      DEBUG_WARN,
+      "RISC-V IOMMU 0x%lx: Page-request queue %a\n",
+      IoMmu->Address,
+      PageRequestQueueCsr.Bits.qof ? "overflowed" : "access failed"
+      ));
+  }
+
+  return Consumed;
+}
@@ -0,0 +1,461 @@
+/** @file
+  RISC-V IOMMU hardware performance monitor.
+
+  The IOHPM has a cycle counter and up to 31 event counters, which count
+  translation events such as IOTLB misses and table walks. The counters are
+  inhibited when an IOMMU is initialised, and are started and read through
+  RISCV_IOMMU_HPM_PROTOCOL. A counter sets its overflow bit when it wraps
+  around, which is folded into a software extension of the counter, on reads
+  and whenever the overflow interrupt is pending.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Protocol/RiscVIoMmuHpm.h>
+#include "RiscVIoMmu.h"
+
+#define HPM_EVENT_REGISTER(Counter)    (R_RISCV_IOMMU_IOHPMEVT_1_31 + ((Counter) - 1) * sizeof (UINT64))
+#define HPM_COUNTER_REGISTER(Counter)  (R_RISCV_IOMMU_IOHPMCTR_1_31 + ((Counter) - 1) * sizeof (UINT64))
+
+STATIC
+EFI_STATUS
+EFIAPI
+HpmGetInfo (
+  IN  RISCV_IOMMU_HPM_PROTOCOL  *This,
+  IN  UINTN                     IoMmuIndex,
+  OUT RISCV_IOMMU_HPM_INFO      *Info
+  );
+
+STATIC
+EFI_STATUS
+EFIAPI
+HpmStartCounter (
+  IN  RISCV_IOMMU_HPM_PROTOCOL      *This,
+  IN  UINTN                         IoMmuIndex,
+  IN  RISCV_IOMMU_HPM_EVENT         Event,
+  IN  CONST RISCV_IOMMU_HPM_FILTER  *Filter OPTIONAL,
+  OUT UINT32                        *Counter
+  );
+
+STATIC
+EFI_STATUS
+EFIAPI
+HpmReadCounter (
+  IN  RISCV_IOMMU_HPM_PROTOCOL  *This,
+  IN  UINTN                     IoMmuIndex,
+  IN  UINT32                    Counter,
+  OUT UINT64                    *Value
+  );
+
+STATIC
+EFI_STATUS
+EFIAPI
+HpmStopCounter (
+  IN  RISCV_IOMMU_HPM_PROTOCOL  *This,
+  IN  UINTN                     IoMmuIndex,
+  IN  UINT32                    Counter
+  );
+
+RISCV_IOMMU_HPM_PROTOCOL  mRiscVIoMmuHpmProtocol = {
+  RISCV_IOMMU_HPM_PROTOCOL_REVISION,
+  HpmGetInfo,
+  HpmStartCounter,
+  HpmReadCounter,
+  HpmStopCounter,
+};
+
+/**
+  Inhibit every counter of an IOMMU, and find the implemented event counters.
+
+  Unimplemented counters are read-only zero, and implemented ones may be
+  narrower than 64 bits, so both are probed by writing all ones.
+
+  @param[in]  IoMmu  The IOMMU, with its performance monitor in reset state.
+
+**/
+VOID
+IoMmuResetPerformanceMonitor (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  RISCV_IOMMU_CAPABILITIES  Capabilities;
+  UINT64                    Probe;
+  UINT32                    Counter;
+
+  IoMmu->NumberOfHpmCounters = 0;
+  IoMmu->HpmCountersInUse    = 0;
+
+  Capabilities.Uint64 = IoMmu->Capabilities;
+  IoMmu->HasHpm       = (BOOLEAN)Capabilities.Bits.HPM;
+  if (!IoMmu->HasHpm) {
+    return;
+  }
+
+  IoMmuWrite32 (IoMmu, R_RISCV_IOMMU_IOCNTINH, MAX_UINT32);
+
+  IoMmuWrite64 (IoMmu, R_RISCV_IOMMU_IOHPMCYCLES, ~B_RISCV_IOMMU_IOHPMCYCLES_OF);
+  Probe                 = IoMmuRead64 (IoMmu, R_RISCV_IOMMU_IOHPMCYCLES) & ~B_RISCV_IOMMU_IOHPMCYCLES_OF;
+  IoMmu->HpmCyclesWidth = (Probe == 0) ? 0 : (UINT8)(HighBitSet64 (Probe) + 1);
+  IoMmuWrite64 (IoMmu, R_RISCV_IOMMU_IOHPMCYCLES, 0);
+
+  IoMmu->HpmCounterWidth = 0;
+  for (Counter = 1; Counter <= RISCV_IOMMU_HPM_COUNTERS; Counter++) {
+    IoMmuWrite64 (IoMmu, HPM_EVENT_REGISTER (Counter), 0);
+    IoMmuWrite64 (IoMmu, HPM_COUNTER_REGISTER (Counter), MAX_UINT64);
+    Probe = IoMmuRead64 (IoMmu, HPM_COUNTER_REGISTER (Counter));
+    IoMmuWrite64 (IoMmu, HPM_COUNTER_REGISTER (Counter), 0);
+    if (Probe == 0) {
+      break;
+    }
+
+    IoMmu->NumberOfHpmCounters = (UINT8)Counter;
+    IoMmu->HpmCounterWidth     = (UINT8)(HighBitSet64 (Probe) + 1);
+  }
+
+  DEBUG ((
+    RISCV_IOMMU_DEBUG_LEVEL,
+    "%a: %u event counters of %u bits, and a cycle counter of %u bits\n",
+    __func__,
+    IoMmu->NumberOfHpmCounters,
+    IoMmu->HpmCounterWidth,
+    IoMmu->HpmCyclesWidth
+    ));
+}
+
+/**
+  Fold the pending overflows of the started counters of an IOMMU into their extensions.
+
+  Clearing the overflow bit of a counter clears its bit in IOCNTOVF.
+
+  @param[in]  IoMmu  The IOMMU.
+
+**/
+VOID
+IoMmuAccumulateHpmOverflows (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  UINT32                Overflows;
+  UINT32                Counter;
+  RISCV_IOMMU_IOHPMEVT  EventSelector;
+  UINT64                Cycles;
+  EFI_TPL               OriginalTpl;
+
+  if (!IoMmu->HasHpm || (IoMmu->HpmCountersInUse == 0)) {
+    return;
+  }
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+
+  Overflows = IoMmuRead32 (IoMmu, R_RISCV_IOMMU_IOCNTOVF) & IoMmu->HpmCountersInUse;
+  for (Counter = 0; Overflows != 0; Counter++, Overflows >>= 1) {
+    if ((Overflows & BIT0) == 0) {
+      continue;
+    }
+
+    //
+    // The cycle counter keeps counting while its overflow bit is cleared, so a few cycles are lost.
+    //
+    if (Counter == 0) {
+      Cycles = IoMmuRead64 (IoMmu, R_RISCV_IOMMU_IOHPMCYCLES);
+      IoMmuWrite64 (IoMmu, R_RISCV_IOMMU_IOHPMCYCLES, Cycles & ~B_RISCV_IOMMU_IOHPMCYCLES_OF);
+    } else {
+      EventSelector.Uint64  = IoMmuRead64 (IoMmu, HPM_EVENT_REGISTER (Counter));
+      EventSelector.Bits.OF = 0;
+      IoMmuWrite64 (IoMmu, HPM_EVENT_REGISTER (Counter), EventSelector.Uint64);
+    }
+
+    IoMmu->HpmWrapCounts[Counter]++;
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+}
+
+/**
+  Find an initialised IOMMU by its index, and check that it has a performance monitor.
+
+  @param[in]   IoMmuIndex  The index of the IOMMU, from 0.
+  @param[out]  IoMmu       The IOMMU.
+
+  @retval  EFI_SUCCESS      The IOMMU has a performance monitor.
+  @retval  EFI_NOT_FOUND    There is no such IOMMU.
+  @retval  EFI_UNSUPPORTED  The IOMMU has no performance monitor.
+
+**/
+STATIC
+EFI_STATUS
+FindHpmInstance (
+  IN  UINTN                 IoMmuIndex,
+  OUT RISCV_IOMMU_INSTANCE  **IoMmu
+  )
+{
+  *IoMmu = IoMmuGetInstance (IoMmuIndex);
+  if (*IoMmu == NULL) {
+    return EFI_NOT_FOUND;
+  }
+
+  return (*IoMmu)->HasHpm ? EFI_SUCCESS : EFI_UNSUPPORTED;
+}
+
+/**
+  Describe the performance monitor of an IOMMU.
+
+  @param[in]   This        The protocol instance.
+  @param[in]   IoMmuIndex  The index of the IOMMU, from 0.
+  @param[out]  Info        The description of its performance monitor.
+
+  @retval  EFI_SUCCESS            Info is filled in.
+  @retval  EFI_INVALID_PARAMETER  Info is NULL.
+  @retval  EFI_NOT_FOUND          There are no more IOMMUs.
+  @retval  EFI_UNSUPPORTED        The IOMMU has no performance monitor.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+HpmGetInfo (
+  IN  RISCV_IOMMU_HPM_PROTOCOL  *This,
+  IN  UINTN                     IoMmuIndex,
+  OUT RISCV_IOMMU_HPM_INFO      *Info
+  )
+{
+  RISCV_IOMMU_INSTANCE  *IoMmu;
+  EFI_STATUS            Status;
+
+  if (Info == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Status = FindHpmInstance (IoMmuIndex, &IoMmu);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Info->Address          = IoMmu->Address;
+  Info->NumberOfCounters = IoMmu->NumberOfHpmCounters;
+  Info->CounterWidth     = IoMmu->HpmCounterWidth;
+  return EFI_SUCCESS;
+}
+
+/**
+  Start counting an event, from 0.
+
+  @param[in]   This        The protocol instance.
+  @param[in]   IoMmuIndex  The index of the IOMMU, from 0.
+  @param[in]   Event       The event to count.
+  @param[in]   Filter      The requests to count, or NULL to count all of them.
+  @param[out]  Counter     The counter that counts the event: 0 for cycles, from 1 otherwise.
+
+  @retval  EFI_SUCCESS            The counter is counting.
+  @retval  EFI_INVALID_PARAMETER  Counter is NULL, or Event or Filter are invalid.
+  @retval  EFI_NOT_FOUND          There is no such IOMMU.
+  @retval  EFI_UNSUPPORTED        The IOMMU has no performance monitor.
+  @retval  EFI_OUT_OF_RESOURCES   Every event counter is in use.
+  @retval  EFI_ALREADY_STARTED    The cycle counter is already counting.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+HpmStartCounter (
+  IN  RISCV_IOMMU_HPM_PROTOCOL      *This,
+  IN  UINTN                         IoMmuIndex,
+  IN  RISCV_IOMMU_HPM_EVENT         Event,
+  IN  CONST RISCV_IOMMU_HPM_FILTER  *Filter OPTIONAL,
+  OUT UINT32                        *Counter
+  )
+{
+  RISCV_IOMMU_INSTANCE  *IoMmu;
+  RISCV_IOMMU_IOHPMEVT  EventSelector;
+  UINT32                Free;
+  EFI_TPL               OriginalTpl;
+  EFI_STATUS            Status;
+
+  if ((Counter == NULL) || ((UINT32)Event >= RiscVIoMmuHpmEventMax) ||
+      ((Filter != NULL) && ((UINT32)Filter->Type >= RiscVIoMmuHpmFilterMax)))
+  {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  //
+  // A device_id has 24 bits and a PSCID 20, and cycles are counted for all requests.
+  //
+  EventSelector.Uint64       = 0;
+  EventSelector.Bits.eventID = Event;
+  if ((Filter != NULL) && (Filter->Type == RiscVIoMmuHpmFilterDeviceId)) {
+    if ((Filter->Id > MAX_UINT32 >> 8) || (Event == RiscVIoMmuHpmEventCycles)) {
+      return EFI_INVALID_PARAMETER;
+    }
+
+    EventSelector.Bits.DID_GSCID = Filter->Id;
+    EventSelector.Bits.DV_GSCV   = 1;
+  } else if ((Filter != NULL) && (Filter->Type == RiscVIoMmuHpmFilterPscid)) {
+    if ((Filter->Id > MAX_UINT32 >> 12) || (Event == RiscVIoMmuHpmEventCycles)) {
+      return EFI_INVALID_PARAMETER;
+    }
+
+    EventSelector.Bits.PID_PSCID = Filter->Id;
+    EventSelector.Bits.PV_PSCV   = 1;
+    EventSelector.Bits.IDT       = 1;
+  }
+
+  Status = FindHpmInstance (IoMmuIndex, &IoMmu);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+
+  if (Event == RiscVIoMmuHpmEventCycles) {
+    if ((IoMmu->HpmCountersInUse & BIT0) != 0) {
+      gBS->RestoreTPL (OriginalTpl);
+      return EFI_ALREADY_STARTED;
+    }
+
+    *Counter = 0;
+    IoMmuWrite64 (IoMmu, R_RISCV_IOMMU_IOHPMCYCLES, 0);
+  } else {
+    Free = ~IoMmu->HpmCountersInUse & (UINT32)(LShiftU64 (BIT1, IoMmu->NumberOfHpmCounters) - 2);
+    if (Free == 0) {
+      gBS->RestoreTPL (OriginalTpl);
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    *Counter = (UINT32)LowBitSet32 (Free);
+    IoMmuWrite64 (IoMmu, HPM_EVENT_REGISTER (*Counter), EventSelector.Uint64);
+    IoMmuWrite64 (IoMmu, HPM_COUNTER_REGISTER (*Counter), 0);
+  }
+
+  //
+  // The counter was inhibited while it was reset.
+  //
+  IoMmu->HpmWrapCounts[*Counter] = 0;
+  IoMmu->HpmCountersInUse       |= 1U << *Counter;
+  IoMmuWrite32 (IoMmu, R_RISCV_IOMMU_IOCNTINH, ~IoMmu->HpmCountersInUse);
+
+  gBS->RestoreTPL (OriginalTpl);
+  return EFI_SUCCESS;
+}
+
+/**
+  Read a counter, including the wrap-arounds since it was started.
+
+  @param[in]   This        The protocol instance.
+  @param[in]   IoMmuIndex  The index of the IOMMU, from 0.
+  @param[in]   Counter     The counter.
+  @param[out]  Value       The events counted.
+
+  @retval  EFI_SUCCESS            Value is read.
+  @retval  EFI_INVALID_PARAMETER  Value is NULL.
+  @retval  EFI_NOT_FOUND          There is no such IOMMU, or the counter isn't started.
+  @retval  EFI_UNSUPPORTED        The IOMMU has no performance monitor.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+HpmReadCounter (
+  IN  RISCV_IOMMU_HPM_PROTOCOL  *This,
+  IN  UINTN                     IoMmuIndex,
+  IN  UINT32                    Counter,
+  OUT UINT64                    *Value
+  )
+{
+  RISCV_IOMMU_INSTANCE  *IoMmu;
+  UINT64                Count;
+  UINT8                 Width;
+  EFI_TPL               OriginalTpl;
+  EFI_STATUS            Status;
+
+  if (Value == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Status = FindHpmInstance (IoMmuIndex, &IoMmu);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  if ((Counter > RISCV_IOMMU_HPM_COUNTERS) || ((IoMmu->HpmCountersInUse & (1U << Counter)) == 0)) {
+    return EFI_NOT_FOUND;
+  }
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+
+  //
+  // A counter that wraps around after its overflows were folded in is read again.
+  //
+  do {
+    IoMmuAccumulateHpmOverflows (IoMmu);
+    if (Counter == 0) {
+      Count = IoMmuRead64 (IoMmu, R_RISCV_IOMMU_IOHPMCYCLES) & ~B_RISCV_IOMMU_IOHPMCYCLES_OF;
+      Width = IoMmu->HpmCyclesWidth;
+    } else {
+      Count = IoMmuRead64 (IoMmu, HPM_COUNTER_REGISTER (Counter));
+      Width = IoMmu->HpmCounterWidth;
+    }
+  } while ((IoMmuRead32 (IoMmu, R_RISCV_IOMMU_IOCNTOVF) & (1U << Counter)) != 0);
+
+  //
+  // A 64-bit counter doesn't wrap around within boot services.
+  //
+  *Value = Count;
+  if (Width < 64) {
+    *Value += LShiftU64 (IoMmu->HpmWrapCounts[Counter], Width);
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+  return EFI_SUCCESS;
+}
+
+/**
+  Stop a counter, and release it.
+
+  @param[in]  This        The protocol instance.
+  @param[in]  IoMmuIndex  The index of the IOMMU, from 0.
+  @param[in]  Counter     The counter.
+
+  @retval  EFI_SUCCESS      The counter is stopped.
+  @retval  EFI_NOT_FOUND    There is no such IOMMU, or the counter isn't started.
+  @retval  EFI_UNSUPPORTED  The IOMMU has no performance monitor.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+HpmStopCounter (
+  IN  RISCV_IOMMU_HPM_PROTOCOL  *This,
+  IN  UINTN                     IoMmuIndex,
+  IN  UINT32                    Counter
+  )
+{
+  RISCV_IOMMU_INSTANCE  *IoMmu;
+  EFI_TPL               OriginalTpl;
+  EFI_STATUS            Status;
+
+  Status = FindHpmInstance (IoMmuIndex, &IoMmu);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  if ((Counter > RISCV_IOMMU_HPM_COUNTERS) || ((IoMmu->HpmCountersInUse & (1U << Counter)) == 0)) {
+    return EFI_NOT_FOUND;
+  }
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+
+  IoMmu->HpmCountersInUse &= ~(1U << Counter);
+  IoMmuWrite32 (IoMmu, R_RISCV_IOMMU_IOCNTINH, ~IoMmu->HpmCountersInUse);
+  if (Counter != 0) {
+    IoMmuWrite64 (IoMmu, HPM_EVENT_REGISTER (Counter), 0);
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+  return EFI_SUCCESS;
+}
@@ -0,0 +1,409 @@
+/** @file
+  RISC-V IOMMU permissive identity mode.
+
+  Strict translation writes and invalidates page tables for every buffer
+  that is mapped. Devices in permissive mode instead share one identity page
+  table per IOMMU, built once, which maps the memory of the UEFI memory map
+  at its own address with the largest leaves that fit, and leaves out the
+  regions whose corruption matters: firmware code, runtime services and
+  reserved memory, ACPI NVS, and the IOMMU's own tables and queues. Map()
+  and SetAttribute() then do no work for buffers outside those holes.
+
+  The holes are a snapshot of the memory map when the table is first
+  needed. Table pages allocated beyond the table-page pool afterwards are
+  not left out, so the pool should be sized to hold them.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+#include "RiscVIoMmu.h"
+
+typedef struct {
+  EFI_PHYSICAL_ADDRESS  Start;
+  EFI_PHYSICAL_ADDRESS  End;
+} PERMISSIVE_HOLE;
+
+//
+// The holes are shared by the tables of every IOMMU. They don't overlap each other.
+//
+STATIC PERMISSIVE_HOLE  *mHoles        = NULL;
+STATIC UINTN            mNumberOfHoles = 0;
+STATIC UINTN            mHoleCapacity  = 0;
+
+/**
+  Determine whether the memory of a type is left out of the permissive table.
+
+  @param[in]  Type  The memory type of a descriptor of the memory map.
+
+  @retval  TRUE   Devices in permissive mode must not reach the memory.
+  @retval  FALSE  The memory is identity-mapped.
+
+**/
+STATIC
+BOOLEAN
+IsProtectedMemoryType (
+  IN UINT32  Type
+  )
+{
+  switch (Type) {
+    case EfiLoaderData:
+    case EfiBootServicesData:
+    case EfiConventionalMemory:
+    case EfiACPIReclaimMemory:
+    case EfiPersistentMemory:
+      return FALSE;
+    default:
+      return TRUE;
+  }
+}
+
+/**
+  Record a hole, merging it with the last one if they are adjacent.
+
+  @param[in]  Start  The first address of the hole.
+  @param[in]  End    The address after the hole.
+
+**/
+STATIC
+VOID
+AddHole (
+  IN EFI_PHYSICAL_ADDRESS  Start,
+  IN EFI_PHYSICAL_ADDRESS  End
+  )
+{
+  if (Start >= End) {
+    return;
+  }
+
+  if ((mNumberOfHoles != 0) && (mHoles[mNumberOfHoles - 1].End == Start)) {
+    mHoles[mNumberOfHoles - 1].End = End;
+    return;
+  }
+
+  ASSERT (mNumberOfHoles < mHoleCapacity);
+  mHoles[mNumberOfHoles].Start = Start;
+  mHoles[mNumberOfHoles].End   = End;
+  mNumberOfHoles++;
+}
+
+/**
+  Record a queue of an IOMMU as a hole.
+
+  @param[in]  Queue  The queue.
+
+**/
+STATIC
+VOID
+AddQueueHole (
+  IN QUEUE_WRAPPER  *Queue
+  )
+{
+  EFI_PHYSICAL_ADDRESS  Start;
+
+  if (Queue->Buffer != NULL) {
+    Start = (EFI_PHYSICAL_ADDRESS)(UINTN)Queue->Buffer;
+    AddHole (Start, Start + ALIGN_VALUE ((UINT64)(Queue->Mask + 1) * Queue->EntrySize, EFI_PAGE_SIZE));
+  }
+}
+
+/**
+  Read the memory map.
+
+  @param[out]  MemoryMapSize   The size of the map, in bytes.
+  @param[out]  DescriptorSize  The size of a descriptor of the map.
+
+  @return  The memory map, to be freed with FreePool(), or NULL if it could not be read.
+
+**/
+EFI_MEMORY_DESCRIPTOR *
+IoMmuReadMemoryMap (
+  OUT UINTN  *MemoryMapSize,
+  OUT UINTN  *DescriptorSize
+  )
+{
+  EFI_MEMORY_DESCRIPTOR  *MemoryMap;
+  UINTN                  MapKey;
+  UINT32                 DescriptorVersion;
+  EFI_STATUS             Status;
+
+  *MemoryMapSize = 0;
+  Status         = gBS->GetMemoryMap (MemoryMapSize, NULL, &MapKey, DescriptorSize, &DescriptorVersion);
+  while (Status == EFI_BUFFER_TOO_SMALL) {
+    //
+    // The allocation itself may split a descriptor.
+    //
+    *MemoryMapSize += 4 * *DescriptorSize;
+    MemoryMap       = AllocatePool (*MemoryMapSize);
+    if (MemoryMap == NULL) {
+      return NULL;
+    }
+
+    Status = gBS->GetMemoryMap (MemoryMapSize, MemoryMap, &MapKey, DescriptorSize, &DescriptorVersion);
+    if (!EFI_ERROR (Status)) {
+      return MemoryMap;
+    }
+
+    FreePool (MemoryMap);
+  }
+
+  return NULL;
+}
+
+/**
+  Record the holes of every permissive table, once: the protected memory of the memory map,
+  the table-page pool, and the queues of the initialised IOMMUs.
+
+  @param[in]  MemoryMap       The memory map.
+  @param[in]  MemoryMapSize   The size of the map, in bytes.
+  @param[in]  DescriptorSize  The size of a descriptor of the map.
+
+  @retval  EFI_SUCCESS           The holes are recorded.
+  @retval  EFI_OUT_OF_RESOURCES  The holes could not be recorded.
+
+**/
+STATIC
+EFI_STATUS
+RecordHoles (
+  IN EFI_MEMORY_DESCRIPTOR  *MemoryMap,
+  IN UINTN                  MemoryMapSize,
+  IN UINTN                  DescriptorSize
+  )
+{
+  EFI_MEMORY_DESCRIPTOR  *Descriptor;
+  LIST_ENTRY             *Link;
+  RISCV_IOMMU_INSTANCE   *IoMmu;
+  EFI_PHYSICAL_ADDRESS   PoolBase;
+  UINTN                  PoolPages;
+
+  if (mHoles != NULL) {
+    return EFI_SUCCESS;
+  }
+
+  mHoleCapacity = MemoryMapSize / DescriptorSize + 1 +
+                  (QUEUE_PAGE_REQUEST + 2) * mRiscVIoMmuGlobalDriverContext.NumberOfInstances;
+  mHoles        = AllocatePool (mHoleCapacity * sizeof (*mHoles));
+  if (mHoles == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  for (Descriptor = MemoryMap
+       ; (UINT8 *)Descriptor < (UINT8 *)MemoryMap + MemoryMapSize
+       ; Descriptor = NEXT_MEMORY_DESCRIPTOR (Descriptor, DescriptorSize)
+       ) {
+    if (IsProtectedMemoryType (Descriptor->Type)) {
+      AddHole (Descriptor->PhysicalStart, Descriptor->PhysicalStart + EFI_PAGES_TO_SIZE (Descriptor->NumberOfPages));
+    }
+  }
+
+  IoMmuGetTablePagePoolRange (&PoolBase, &PoolPages);
+  AddHole (PoolBase, PoolBase + EFI_PAGES_TO_SIZE (PoolPages));
+
+  for (Link = GetFirstNode (&mRiscVIoMmuGlobalDriverContext.InstanceList)
+       ; !IsNull (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ; Link = GetNextNode (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ) {
+    IoMmu = RISCV_IOMMU_INSTANCE_FROM_LINK (Link);
+    if (IoMmu->State != STATE_INITIALISED) {
+      continue;
+    }
+
+    AddQueueHole (&IoMmu->CommandQueue);
+    AddQueueHole (&IoMmu->FaultQueue);
+    AddQueueHole (&IoMmu->PageRequestQueue);
+    if (IoMmu->FenceCompletion != NULL) {
+      AddHole (
+        (UINTN)IoMmu->FenceCompletion & ~(UINTN)EFI_PAGE_MASK,
+        ((UINTN)IoMmu->FenceCompletion & ~(UINTN)EFI_PAGE_MASK) + EFI_PAGE_SIZE
+        );
+    }
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Build the permissive table of an IOMMU: identity-map the unprotected memory of the memory
+  map, up to what devices behind every IOMMU can address, then punch out the other holes.
+
+  @param[in]  IoMmu           The IOMMU.
+  @param[in]  RootPageTable   The root of the empty page table.
+  @param[in]  MemoryMap       The memory map.
+  @param[in]  MemoryMapSize   The size of the map, in bytes.
+  @param[in]  DescriptorSize  The size of a descriptor of the map.
+
+  @retval  EFI_SUCCESS           The table is built.
+  @retval  EFI_OUT_OF_RESOURCES  There were not enough resources to build the table.
+
+**/
+STATIC
+EFI_STATUS
+BuildPermissiveTable (
+  IN RISCV_IOMMU_INSTANCE   *IoMmu,
+  IN UINT64                 *RootPageTable,
+  IN EFI_MEMORY_DESCRIPTOR  *MemoryMap,
+  IN UINTN                  MemoryMapSize,
+  IN UINTN                  DescriptorSize
+  )
+{
+  EFI_MEMORY_DESCRIPTOR  *Descriptor;
+  UINT64                 Limit;
+  UINT64                 Start;
+  UINT64                 End;
+  UINTN                  Index;
+  EFI_STATUS             Status;
+
+  Limit = MIN (IoMmuGetIoVirtualAddressLimit (IoMmu), mRiscVIoMmuGlobalDriverContext.DmaMemoryTop);
+
+  //
+  // Nothing of the new table can be cached yet, so nothing is invalidated.
+  //
+  for (Descriptor = MemoryMap
+       ; (UINT8 *)Descriptor < (UINT8 *)MemoryMap + MemoryMapSize
+       ; Descriptor = NEXT_MEMORY_DESCRIPTOR (Descriptor, DescriptorSize)
+       ) {
+    Start = Descriptor->PhysicalStart;
+    End   = MIN (Limit, Start + EFI_PAGES_TO_SIZE (Descriptor->NumberOfPages));
+    if (IsProtectedMemoryType (Descriptor->Type) || (Start >= End)) {
+      continue;
+    }
+
+    Status = IoMmuUpdatePageTable (
+               IoMmu,
+               RootPageTable,
+               0,
+               Start,
+               Start,
+               End - Start,
+               EDKII_IOMMU_ACCESS_READ | EDKII_IOMMU_ACCESS_WRITE,
+               TRUE
+               );
+    if (EFI_ERROR (Status)) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+  }
+
+  //
+  // The holes of the memory map were never mapped; those inside mapped memory are unmapped.
+  //
+  for (Index = 0; Index < mNumberOfHoles; Index++) {
+    Start = mHoles[Index].Start;
+    End   = MIN (Limit, mHoles[Index].End);
+    if (Start >= End) {
+      continue;
+    }
+
+    Status = IoMmuUpdatePageTable (IoMmu, RootPageTable, 0, Start, Start, End - Start, 0, TRUE);
+    if (EFI_ERROR (Status)) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Find the permissive table of an IOMMU, building it on first use.
+
+  @param[in]   IoMmu          The IOMMU.
+  @param[out]  RootPageTable  The root of the table.
+  @param[out]  Pscid          The PSCID that tags its translations.
+
+  @retval  EFI_SUCCESS           The table was found or built.
+  @retval  EFI_OUT_OF_RESOURCES  There were not enough resources to build the table.
+
+**/
+EFI_STATUS
+IoMmuGetPermissivePageTable (
+  IN  RISCV_IOMMU_INSTANCE  *IoMmu,
+  OUT UINT64                **RootPageTable,
+  OUT UINT32                *Pscid
+  )
+{
+  EFI_MEMORY_DESCRIPTOR  *MemoryMap;
+  UINTN                  MemoryMapSize;
+  UINTN                  DescriptorSize;
+  UINT64                 *NewRoot;
+  EFI_STATUS             Status;
+
+  if (IoMmu->PermissiveRootPageTable != NULL) {
+    *RootPageTable = IoMmu->PermissiveRootPageTable;
+    *Pscid         = IoMmu->PermissivePscid;
+    return EFI_SUCCESS;
+  }
+
+  if (IoMmu->NextPscid > RISCV_IOMMU_MAX_PSCID) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  MemoryMap = IoMmuReadMemoryMap (&MemoryMapSize, &DescriptorSize);
+  if (MemoryMap == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  NewRoot = IoMmuAllocatePageTable (IoMmu);
+  Status  = (NewRoot != NULL) ? RecordHoles (MemoryMap, MemoryMapSize, DescriptorSize) : EFI_OUT_OF_RESOURCES;
+  if (!EFI_ERROR (Status)) {
+    Status = BuildPermissiveTable (IoMmu, NewRoot, MemoryMap, MemoryMapSize, DescriptorSize);
+  }
+
+  FreePool (MemoryMap);
+  if (EFI_ERROR (Status)) {
+    if (NewRoot != NULL) {
+      IoMmuFreePageTable (IoMmu, NewRoot);
+    }
+
+    return Status;
+  }
+
+  IoMmu->PermissiveRootPageTable = NewRoot;
+  IoMmu->PermissivePscid         = IoMmu->NextPscid++;
+
+  DEBUG ((
+    RISCV_IOMMU_DEBUG_LEVEL,
+    "%a: Permissive table at 0x%p, with 0x%x holes, tagged with PSCID 0x%x\n",
+    __func__,
+    NewRoot,
+    mNumberOfHoles,
+    IoMmu->PermissivePscid
+    ));
+
+  *RootPageTable = IoMmu->PermissiveRootPageTable;
+  *Pscid         = IoMmu->PermissivePscid;
+  return EFI_SUCCESS;
+}
+
+/**
+  Determine how much of a range of host memory falls into the holes of the permissive tables.
+
+  @param[in]  Start  The first address of the range.
+  @param[in]  End    The address after the range.
+
+  @return  The number of bytes of the range in holes.
+
+**/
+UINT64
+IoMmuGetPermissiveHoleOverlap (
+  IN EFI_PHYSICAL_ADDRESS  Start,
+  IN EFI_PHYSICAL_ADDRESS  End
+  )
+{
+  UINTN   Index;
+  UINT64  Overlap;
+
+  Overlap = 0;
+  for (Index = 0; Index < mNumberOfHoles; Index++) {
+    if ((mHoles[Index].Start < End) && (Start < mHoles[Index].End)) {
+      Overlap += MIN (End, mHoles[Index].End) - MAX (Start, mHoles[Index].Start);
+    }
+  }
+
+  return Overlap;
+}
@@ -0,0 +1,181 @@
+/** @file
+  RISC-V IOMMU poll scheduler.
+
+  All periodic upkeep of the driver runs from a single timer event: draining
+  the fault and page-request queues, flushing the flush queue and completing
+  asynchronous fences. Each kind of upkeep is a client that asks to be polled
+  at its own period, or not at all, and the timer is armed as a one-shot for
+  the earliest client due. So an active queue is polled at its fast period,
+  and an idle driver only wakes at the slow period of fault reporting, which
+  lets the tickless timer sleep in between.
+
+  The scheduler keeps its own time, which advances by the interval each
+  one-shot was armed for. Rearming earlier for a client that became active
+  only delays the others, never runs them early.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include "RiscVIoMmu.h"
+
+typedef struct {
+  RISCV_IOMMU_POLL_FUNCTION    Function;
+  // In units of 100 ns, or 0 while the client isn't polled.
+  UINT64                       Period;
+  // The scheduler time the client is next polled at.
+  UINT64                       Due;
+} POLL_CLIENT;
+
+STATIC POLL_CLIENT  mPollClients[RiscVIoMmuPollMax];
+STATIC EFI_EVENT    mPollTimer = NULL;
+
+//
+// The scheduler time the timer was last armed at, the interval it was armed for, or 0 if it isn't.
+//
+STATIC UINT64   mPollTime     = 0;
+STATIC UINT64   mPollInterval = 0;
+STATIC BOOLEAN  mPolling      = FALSE;
+
+/**
+  Arm the timer for the earliest client due, or cancel it if no client is polled.
+
+**/
+STATIC
+VOID
+ArmPollTimer (
+  VOID
+  )
+{
+  UINT64  Due;
+  UINTN   Index;
+
+  Due = MAX_UINT64;
+  for (Index = 0; Index < RiscVIoMmuPollMax; Index++) {
+    if ((mPollClients[Index].Period != 0) && (mPollClients[Index].Due < Due)) {
+      Due = mPollClients[Index].Due;
+    }
+  }
+
+  if (Due == MAX_UINT64) {
+    mPollInterval = 0;
+    gBS->SetTimer (mPollTimer, TimerCancel, 0);
+    return;
+  }
+
+  mPollInterval = MAX (Due, mPollTime + 1) - mPollTime;
+  gBS->SetTimer (mPollTimer, TimerRelative, mPollInterval);
+}
+
+/**
+  Poll the clients that are due, and arm the timer for the next one.
+
+  @param[in]  Event    The timer event.
+  @param[in]  Context  Unused.
+
+**/
+STATIC
+VOID
+EFIAPI
+OnPollTimer (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  UINTN  Index;
+
+  mPollTime += mPollInterval;
+  mPolling   = TRUE;
+
+  //
+  // A client is rescheduled before it runs, so that it can change its own period.
+  //
+  for (Index = 0; Index < RiscVIoMmuPollMax; Index++) {
+    if ((mPollClients[Index].Period != 0) && (mPollClients[Index].Due <= mPollTime)) {
+      mPollClients[Index].Due = mPollTime + mPollClients[Index].Period;
+      mPollClients[Index].Function ();
+    }
+  }
+
+  mPolling = FALSE;
+  ArmPollTimer ();
+}
+
+/**
+  Poll a client periodically, change its period, or stop polling it.
+
+  A client that becomes polled, or whose period shortens, is first polled one
+  period from now. Otherwise its next poll is kept.
+
+  @param[in]  Client    The client.
+  @param[in]  Function  Called at RISCV_IOMMU_TPL_LEVEL each time the client is polled.
+  @param[in]  Period    The period, in units of 100 ns, or 0 to stop polling the client.
+
+  @retval  EFI_SUCCESS  The client is polled at the period, or not polled.
+  @retval  Others       The timer could not be created. The client is not polled.
+
+**/
+EFI_STATUS
+IoMmuSchedulePoll (
+  IN RISCV_IOMMU_POLL_CLIENT    Client,
+  IN RISCV_IOMMU_POLL_FUNCTION  Function,
+  IN UINT64                     Period
+  )
+{
+  EFI_TPL      OriginalTpl;
+  POLL_CLIENT  *PollClient;
+  UINT64       Due;
+  EFI_STATUS   Status;
+
+  ASSERT (Client < RiscVIoMmuPollMax);
+
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+
+  if (mPollTimer == NULL) {
+    Status = gBS->CreateEvent (
+                    EVT_TIMER | EVT_NOTIFY_SIGNAL,
+                    RISCV_IOMMU_TPL_LEVEL,
+                    OnPollTimer,
+                    NULL,
+                    &mPollTimer
+                    );
+    if (EFI_ERROR (Status)) {
+      mPollTimer = NULL;
+      gBS->RestoreTPL (OriginalTpl);
+      return Status;
+    }
+  }
+
+  PollClient = &mPollClients[Client];
+  if (Period == 0) {
+    //
+    // A timer armed for this client only fires once more, and finds nothing due.
+    //
+    PollClient->Period = 0;
+    gBS->RestoreTPL (OriginalTpl);
+    return EFI_SUCCESS;
+  }
+
+  Due = mPollTime + Period;
+  if ((PollClient->Period == 0) || (Due < PollClient->Due)) {
+    PollClient->Due = Due;
+  }
+
+  PollClient->Function = Function;
+  PollClient->Period   = Period;
+
+  //
+  // Polling rearms the timer once the clients ran.
+  //
+  if (!mPolling && ((mPollInterval == 0) || (PollClient->Due < mPollTime + mPollInterval))) {
+    ArmPollTimer ();
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+  return EFI_SUCCESS;
+}
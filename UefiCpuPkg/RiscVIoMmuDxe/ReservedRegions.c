@@ -0,0 +1,230 @@
+/** @file
+  RISC-V IOMMU reserved regions.
+
+  Some devices keep DMAing into memory that an earlier stage set up for
+  them, such as the framebuffer of a previous loader, a mailbox shared with
+  a BMC, or rings owned by firmware, before their UEFI driver maps anything.
+  Discovery records these regions per IOMMU and device_id, from the
+  `memory-region` of the devicetree nodes that name an IOMMU, and platforms
+  without such a description list them for PCI functions in
+  PcdRiscVIoMmuReservedRegions.
+
+  When the strict domain of such a device is created, or attached again, its
+  regions are mapped at their own address with the largest leaves that fit,
+  so the device runs under protection from its first DMA, without bouncing.
+  The mappings persist: they are not buffers of Map(), and stay for as long
+  as the domain is attached. The other modes already reach the regions, or,
+  in permissive mode, leave reserved memory out on purpose.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
+#include "RiscVIoMmu.h"
+
+#define RESERVED_REGION_TABLE_INITIAL_SIZE  8
+
+//
+// A region that a device reaches at its own address.
+//
+typedef struct {
+  RISCV_IOMMU_INSTANCE    *IoMmu;
+  UINT32                  DeviceId;
+  UINT64                  Base;
+  UINT64                  Size;
+} RESERVED_REGION;
+
+#pragma pack(1)
+//
+// The layout of an entry of PcdRiscVIoMmuReservedRegions.
+//
+typedef struct {
+  UINT16    PciSegment;
+  UINT16    RequesterId;
+  UINT8     Reserved[4];
+  UINT64    Base;
+  UINT64    Size;
+} RESERVED_REGION_ENTRY;
+#pragma pack()
+
+STATIC RESERVED_REGION  *mReservedRegions        = NULL;
+STATIC UINTN            mNumberOfReservedRegions = 0;
+STATIC UINTN            mReservedRegionTableSize = 0;
+
+/**
+  Record that a device keeps DMAing into a region that an earlier stage set up for it.
+
+  @param[in]  IoMmu     The IOMMU that translates the device.
+  @param[in]  DeviceId  The device_id of the device.
+  @param[in]  Base      The first address of the region.
+  @param[in]  Size      The size of the region.
+
+  @retval  EFI_SUCCESS           The region was recorded.
+  @retval  EFI_OUT_OF_RESOURCES  The region table could not be grown.
+
+**/
+EFI_STATUS
+IoMmuAddReservedRegion (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT32                DeviceId,
+  IN UINT64                Base,
+  IN UINT64                Size
+  )
+{
+  RESERVED_REGION  *NewRegions;
+  UINTN            NewSize;
+
+  if (Size == 0) {
+    return EFI_SUCCESS;
+  }
+
+  if (mNumberOfReservedRegions == mReservedRegionTableSize) {
+    NewSize    = MAX (RESERVED_REGION_TABLE_INITIAL_SIZE, mReservedRegionTableSize * 2);
+    NewRegions = ReallocatePool (
+                   mReservedRegionTableSize * sizeof (RESERVED_REGION),
+                   NewSize * sizeof (RESERVED_REGION),
+                   mReservedRegions
+                   );
+    if (NewRegions == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    mReservedRegions         = NewRegions;
+    mReservedRegionTableSize = NewSize;
+  }
+
+  mReservedRegions[mNumberOfReservedRegions].IoMmu    = IoMmu;
+  mReservedRegions[mNumberOfReservedRegions].DeviceId = DeviceId;
+  mReservedRegions[mNumberOfReservedRegions].Base     = Base;
+  mReservedRegions[mNumberOfReservedRegions].Size     = Size;
+  mNumberOfReservedRegions++;
+
+  DEBUG ((
+    RISCV_IOMMU_DEBUG_LEVEL,
+    "%a: device_id 0x%x of the IOMMU at 0x%lx reaches 0x%lx-0x%lx\n",
+    __func__,
+    DeviceId,
+    IoMmu->Address,
+    Base,
+    Base + Size - 1
+    ));
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Map a reserved region at its own address into the page table of a domain.
+
+  A region that doesn't start or end at a page boundary exposes the rest of its pages too.
+
+  @param[in]  IoMmu   The IOMMU.
+  @param[in]  Domain  The domain.
+  @param[in]  Base    The first address of the region.
+  @param[in]  Size    The size of the region.
+
+  @retval  EFI_SUCCESS  The region is mapped.
+  @retval  Others       The page table could not be updated.
+
+**/
+STATIC
+EFI_STATUS
+MapReservedRegion (
+  IN RISCV_IOMMU_INSTANCE       *IoMmu,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain,
+  IN UINT64                     Base,
+  IN UINT64                     Size
+  )
+{
+  UINT64      Start;
+  UINT64      End;
+  EFI_STATUS  Status;
+
+  Start  = Base & ~(UINT64)EFI_PAGE_MASK;
+  End    = ALIGN_VALUE (Base + Size, EFI_PAGE_SIZE);
+  Status = IoMmuUpdatePageTable (
+             IoMmu,
+             Domain->RootPageTable,
+             Domain->Pscid,
+             Start,
+             Start,
+             End - Start,
+             EDKII_IOMMU_ACCESS_READ | EDKII_IOMMU_ACCESS_WRITE,
+             FALSE
+             );
+
+  DEBUG ((
+    EFI_ERROR (Status) ? DEBUG_ERROR : RISCV_IOMMU_DEBUG_LEVEL,
+    "%a: device_id 0x%x reaches the reserved region 0x%lx-0x%lx at its own address: %r\n",
+    __func__,
+    Domain->DeviceId.Uint32,
+    Start,
+    End - 1,
+    Status
+    ));
+  return Status;
+}
+
+/**
+  Map the reserved regions of a device into its strict domain, at their own address.
+
+  @param[in]  IoMmu   The IOMMU.
+  @param[in]  Domain  The domain of the device.
+
+  @retval  EFI_SUCCESS  The regions are mapped, or the domain isn't strict.
+  @retval  Others       The page table could not be updated.
+
+**/
+EFI_STATUS
+IoMmuMapReservedRegions (
+  IN RISCV_IOMMU_INSTANCE       *IoMmu,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain
+  )
+{
+  CONST RESERVED_REGION_ENTRY  *Entry;
+  UINTN                        NumberOfEntries;
+  UINTN                        Index;
+  RISCV_IOMMU_DEVICE_ID        DeviceId;
+  EFI_STATUS                   Status;
+
+  if ((Domain->Mode != RISCV_IOMMU_DEVICE_MODE_STRICT) || (Domain->RootPageTable == NULL)) {
+    return EFI_SUCCESS;
+  }
+
+  for (Index = 0; Index < mNumberOfReservedRegions; Index++) {
+    if ((mReservedRegions[Index].IoMmu != IoMmu) || (mReservedRegions[Index].DeviceId != Domain->DeviceId.Uint32)) {
+      continue;
+    }
+
+    Status = MapReservedRegion (IoMmu, Domain, mReservedRegions[Index].Base, mReservedRegions[Index].Size);
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+  }
+
+  //
+  // The entries name PCI functions, which are routed once the routes are known.
+  //
+  Entry           = PcdGetPtr (PcdRiscVIoMmuReservedRegions);
+  NumberOfEntries = PcdGetSize (PcdRiscVIoMmuReservedRegions) / sizeof (RESERVED_REGION_ENTRY);
+  for (Index = 0; Index < NumberOfEntries; Index++, Entry++) {
+    if ((Entry->Size == 0) ||
+        (IoMmuRouteDevice (RISCV_IOMMU_PCI_ROUTING_DOMAIN (Entry->PciSegment), Entry->RequesterId, &DeviceId, NULL) != IoMmu) ||
+        (DeviceId.Uint32 != Domain->DeviceId.Uint32))
+    {
+      continue;
+    }
+
+    Status = MapReservedRegion (IoMmu, Domain, Entry->Base, Entry->Size);
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+  }
+
+  return EFI_SUCCESS;
+}
@@ -11,6 +11,11 @@
 
 #include <PiDxe.h>
 #include <Protocol/IoMmu.h>
+#include <Protocol/IoMmuBatch.h>
+#include <Protocol/IoMmuDeviceHint.h>
+#include <Protocol/PciIo.h>
+#include <Protocol/RiscVIoMmuDiagnostics.h>
+#include <Protocol/RiscVIoMmuHpm.h>
 #include "RiscVIoMmuRegisters.h"
 
 enum {
@@ -22,12 +27,89 @@ enum {
 
 #define RISCV_IOMMU_DEBUG_LEVEL  DEBUG_INFO
 
+//
+// How the DMA of a device is translated, as selected by PcdRiscVIoMmuDefaultDeviceMode
+// and PcdRiscVIoMmuDeviceModes.
+//
+#define RISCV_IOMMU_DEVICE_MODE_STRICT      0
+#define RISCV_IOMMU_DEVICE_MODE_IDENTITY    1
+#define RISCV_IOMMU_DEVICE_MODE_BYPASS      2
+#define RISCV_IOMMU_DEVICE_MODE_PERMISSIVE  3
+#define RISCV_IOMMU_DEVICE_MODE_CPU_MIRROR  4
+
+//
+// The kinds of memory that the driver's own metadata is accounted in.
+//
+typedef enum {
+  // Device-directory pages, and the MSI page tables.
+  RiscVIoMmuFootprintDirectory,
+  // IO page-table pages.
+  RiscVIoMmuFootprintPageTable,
+  RiscVIoMmuFootprintQueue,
+  // MAP_INFO slabs, and the slots of the mapping database.
+  RiscVIoMmuFootprintMapInfo,
+  // The bounce-buffer pool, reserved whole.
+  RiscVIoMmuFootprintBouncePool,
+  // Bounce buffers allocated beyond the pool.
+  RiscVIoMmuFootprintBounce,
+  RiscVIoMmuFootprintDomain,
+  RiscVIoMmuFootprintMax
+} RISCV_IOMMU_FOOTPRINT;
+
+//
+// The periodic upkeep that the poll scheduler runs from its single timer.
+//
+typedef enum {
+  // The interrupts of the IOMMUs, so their fault and page-request queues.
+  RiscVIoMmuPollInterrupts,
+  RiscVIoMmuPollFlushQueue,
+  RiscVIoMmuPollAsyncFences,
+  RiscVIoMmuPollMax
+} RISCV_IOMMU_POLL_CLIENT;
+
+/**
+  Run the periodic upkeep of a poll scheduler client.
+
+**/
+typedef
+VOID
+(*RISCV_IOMMU_POLL_FUNCTION)(
+  VOID
+  );
+
+//
+// What the IOMMUs are left doing once boot services exit, as selected by PcdRiscVIoMmuExitBootServicesState.
+//
+#define RISCV_IOMMU_EXIT_STATE_KEEP      0
+#define RISCV_IOMMU_EXIT_STATE_BLOCK     1
+#define RISCV_IOMMU_EXIT_STATE_IDENTITY  2
+
+//
+// An IoMmuAccess flag of the page-table builder: writable leaves are created clean,
+// for an IOMMU with hardware A/D updates to mark the ones written to.
+//
+#define RISCV_IOMMU_ACCESS_TRACK_DIRTY  BIT63
+
+//
+// An IoMmuAccess flag of the page-table builder: the leaves map device memory, with the
+// IO memory type of Svpbmt. Only set for an IOMMU that implements Svpbmt.
+//
+#define RISCV_IOMMU_ACCESS_DEVICE_MEMORY  BIT62
+
 #define RISCV_MMU_PAGE_SHIFT  12
 
+//
+// Driver state shared with the protocol services is updated at this TPL.
+//
+#define RISCV_IOMMU_TPL_LEVEL  TPL_NOTIFY
+
 typedef struct {
   BOOLEAN  ContextStructIsExtended;
   UINT8    Levels;
   VOID     *Buffer;
+  // The highest device_id known to be routed to the IOMMU, or 0 if unknown.
+  UINT32   MaxDeviceId;
+  UINTN    NumberOfPages;
 } CONTEXT_WRAPPER;
 
 enum {
@@ -36,49 +118,2827 @@ enum {
   QUEUE_PAGE_REQUEST,
 };
 
-#define QUEUE_NUMBER_OF_ENTRIES  128
+//
+// Faults are counted by cause: 32 standard causes, 32 IOMMU causes from 256, and all others.
+//
+#define RISCV_IOMMU_FAULT_CAUSE_STANDARD_SLOTS  32
+#define RISCV_IOMMU_FAULT_CAUSE_SLOTS           (2 * RISCV_IOMMU_FAULT_CAUSE_STANDARD_SLOTS + 1)
+
+//
+// Waits on the IOMMU spin briefly, then back off exponentially until a hard timeout.
+//
+#define RISCV_IOMMU_WAIT_SPIN_COUNT      64
+#define RISCV_IOMMU_WAIT_MAX_BACKOFF_US  128
+#define RISCV_IOMMU_WAIT_TIMEOUT_US      100000
+
+//
+// How often a command that timed out or faulted is retried, before it is skipped or the queue is reset.
+//
+#define RISCV_IOMMU_COMMAND_RETRIES  3
+
+typedef struct {
+  UINTN   Spins;
+  UINTN   Backoff;
+  UINTN   Elapsed;
+  // The performance counter when the condition was first found unmet, or 0.
+  UINT64  StartTime;
+} RISCV_IOMMU_WAIT;
+
+//
+// Address invalidations are coalesced into ranges of leaves of the same size and PSCID,
+// until the commands are submitted.
+//
+#define RISCV_IOMMU_PENDING_INVALIDATIONS  16
+
+//
+// The LeafShift of a range that stands for all translations of its PSCID.
+//
+#define RISCV_IOMMU_INVALIDATE_WHOLE_PSCID  MAX_UINT8
+
+typedef struct {
+  UINT32  Pscid;
+  UINT8   LeafShift;
+  UINT64  Start;
+  UINT64  End;
+} RISCV_IOMMU_INVALIDATION_RANGE;
+
+typedef struct {
+  RISCV_IOMMU_INVALIDATION_RANGE  Ranges[RISCV_IOMMU_PENDING_INVALIDATIONS];
+  UINTN                           NumberOfRanges;
+} IOTLB_BATCH;
+
+//
+// The device contexts whose cached DDT entries are invalidated with the next command,
+// each once. AllDevices stands for a single invalidation of the whole directory.
+//
+#define RISCV_IOMMU_PENDING_DEVICE_CONTEXTS  16
+
+typedef struct {
+  RISCV_IOMMU_DEVICE_ID  DeviceIds[RISCV_IOMMU_PENDING_DEVICE_CONTEXTS];
+  UINTN                  NumberOfDeviceIds;
+  BOOLEAN                AllDevices;
+} DDT_BATCH;
+
+//
+// IO page-table pages that unmaps emptied and unhooked, which the IOMMU may still walk
+// until the IOFENCE.C with the sequence number Epoch completes.
+//
+#define RISCV_IOMMU_RETIRED_TABLE_PAGES  32
+
+typedef struct {
+  VOID    *Page;
+  UINT32  Epoch;
+} RETIRED_TABLE_PAGE;
+
+/**
+  Called once the IOFENCE.C an asynchronous caller waits for has completed.
+
+  @param[in]  Context  The context of the caller.
+  @param[in]  Status   EFI_SUCCESS, or EFI_DEVICE_ERROR if the fence failed or timed out.
+
+**/
+typedef
+VOID
+(*RISCV_IOMMU_FENCE_CALLBACK)(
+  IN VOID        *Context,
+  IN EFI_STATUS  Status
+  );
+
+//
+// The fences that asynchronous callers wait for. A fence completes once the IOFENCE.C
+// with the sequence number Sequence does, which is only known once the fence is Written,
+// as the batch may be nested in an open one. The poll scheduler polls for them every 1 ms, in
+// units of 100 ns, and gives up on them after a second without progress.
+//
+#define RISCV_IOMMU_ASYNC_FENCES           16
+#define RISCV_IOMMU_ASYNC_FENCE_PERIOD     10000
+#define RISCV_IOMMU_ASYNC_FENCE_MAX_TICKS  1000
+
+typedef struct {
+  UINT32                        Sequence;
+  BOOLEAN                       Written;
+  RISCV_IOMMU_FENCE_CALLBACK    Callback;
+  VOID                          *Context;
+} ASYNC_FENCE;
+
+//
+// Harts other than the boot hart stage up to RISCV_IOMMU_STAGED_COMMANDS commands, and
+// publish each batch into the command queue with a single reservation of its entries.
+// RISCV_IOMMU_STAGING_HARTS harts get a staging buffer, the others publish each command.
+//
+#define RISCV_IOMMU_STAGED_COMMANDS  32
+#define RISCV_IOMMU_STAGING_HARTS    16
+
+//
+// The writes an IOMMU without coherent memory accesses must see are batched as ranges of
+// whole cache blocks, until they are cleaned before the next fence. The boot hart adds to
+// the batch, and whichever hart rings the doorbell cleans it, under the lock.
+//
+#define RISCV_IOMMU_PENDING_CLEANS  16
+
+typedef struct {
+  UINTN  Start;
+  UINTN  End;
+} CACHE_CLEAN_RANGE;
+
+typedef struct {
+  CACHE_CLEAN_RANGE  Ranges[RISCV_IOMMU_PENDING_CLEANS];
+  UINTN              NumberOfRanges;
+  volatile UINT32    Lock;
+} CLEAN_BATCH;
 
 typedef struct {
-  UINT8  Type;
-  UINTN  EntrySize;
-  VOID   *Buffer;
+  UINT8            Type;
+  UINTN            EntrySize;
+  VOID             *Buffer;
+  UINT32           Mask;
+  // The last known head, and the tail up to which entries were written.
+  UINT32           Head;
+  UINT32           Tail;
+  // The tail up to which entries were reserved. Only the command queue has several
+  // producers, whose entries lie between Tail and Reserved while they are written.
+  volatile UINT32  Reserved;
+  // Whether the buffer was allocated by the driver, rather than adopted.
+  BOOLEAN          Allocated;
+  // Whether the buffer is mapped non-cacheable, so that it needs no cache maintenance.
+  BOOLEAN          Uncached;
 } QUEUE_WRAPPER;
 
+typedef struct _RISCV_IOMMU_INSTANCE       RISCV_IOMMU_INSTANCE;
+typedef struct _RISCV_IOMMU_DEVICE_DOMAIN  RISCV_IOMMU_DEVICE_DOMAIN;
+
+#define MAP_INFO_SIGNATURE  SIGNATURE_32 ('D', 'M', 'A', 'P')
+
+//
+// A live mapping created by Map(). Its address is the Mapping cookie.
+//
+typedef struct _MAP_INFO MAP_INFO;
+struct _MAP_INFO {
+  UINT32                     Signature;
+#if 0
+  LIST_ENTRY                 HandleList;
+#endif
+  EDKII_IOMMU_OPERATION      Operation;
+  EFI_PHYSICAL_ADDRESS       HostAddress;
+  UINTN                      NumberOfBytes;
+  EFI_PHYSICAL_ADDRESS       DeviceAddress;
+  // The memory DeviceAddress translates to: HostAddress, or a bounce buffer.
+  EFI_PHYSICAL_ADDRESS       BufferAddress;
+  // Of a split mapping, mapped in place at an IOVA: the bounce pages that stand in for
+  // the partial first and last pages of the buffer, or 0.
+  EFI_PHYSICAL_ADDRESS       HeadBounce;
+  EFI_PHYSICAL_ADDRESS       TailBounce;
+  // The last access granted by SetAttribute(), which stale translations may still allow.
+  UINT64                     IoMmuAccess;
+  // With lazy invalidation: unmapped, but possibly still cached by the IOMMU.
+  BOOLEAN                    InvalidationPending;
+  // With lazy invalidation: released by Unmap(), to be freed once invalidated.
+  BOOLEAN                    ReleasePending;
+  // Created by AllocateBuffer(), and returned by its common-buffer Map()s until FreeBuffer().
+  BOOLEAN                    Persistent;
+  // Of a persistent mapping: the memory type of the buffer, whether it was freed into the
+  // buffer cache, and whether it was reallocated from the cache with its old translation.
+  EFI_MEMORY_TYPE            MemoryType;
+  BOOLEAN                    Cached;
+  BOOLEAN                    Recycled;
+  // The number of Map()s of the same host range and operation that share the mapping.
+  UINTN                      ReferenceCount;
+  // The domain that first granted access, its IOMMU, and the SetAttribute() grants it holds.
+  // The translation of a shared mapping is kept until the last grant is revoked,
+  // and that of a persistent mapping until FreeBuffer().
+  RISCV_IOMMU_INSTANCE       *OwnerIoMmu;
+  RISCV_IOMMU_DEVICE_DOMAIN  *OwnerDomain;
+  UINT64                     OwnerAccess;
+  UINTN                      OwnerGrants;
+  // Granted, but left to be mapped by the page requests of the owner's function.
+  BOOLEAN                    DemandMapped;
+  // Of a bounced BusMasterWrite mapping that only its owner translates, with hardware D-bit updates:
+  // a bit per bounce page that the owner wrote to, sampled before its leaves are replaced.
+  // NULL if the whole buffer is copied back.
+  UINT64                     *DirtyPages;
+  // A device behind an IOMMU without coherent memory accesses was granted access,
+  // so the buffer is invalidated before the hart reads what was written.
+  BOOLEAN                    NonCoherent;
+  // The host range is the MMIO of another device, which is never bounced.
+  BOOLEAN                    PeerToPeer;
+  // Of a persistent mapping: made write-combining by AllocateBuffer(), and the GCD
+  // attributes that FreeBuffer() restores.
+  BOOLEAN                    WriteCombining;
+  UINT64                     OriginalAttributes;
+  // Why Map() bounced the buffer, or RiscVIoMmuBounceReasonMax, the bytes it bounced, and how
+  // long it took, in nanoseconds. Counted for the owner when it is first granted access.
+  UINT8                      BounceReason;
+  UINT64                     BouncedBytes;
+  UINT64                     MapTime;
+  // Only valid while the record is on the free list, or its buffer is cached.
+  MAP_INFO                   *NextFree;
+};
+
+//
+// PSCID 0 tags the translations of the scratch device context, and is never given to a domain.
+//
+#define RISCV_IOMMU_SCRATCH_PSCID  0
+#define RISCV_IOMMU_MAX_PSCID      (BIT20 - 1)
+
+#define RISCV_IOMMU_DEVICE_DOMAIN_SIGNATURE  SIGNATURE_32 ('R', 'V', 'D', 'D')
+
+//
+// The translation state of a single device_id.
+//
+struct _RISCV_IOMMU_DEVICE_DOMAIN {
+  UINT32                         Signature;
+  LIST_ENTRY                     Link;
+  RISCV_IOMMU_DEVICE_ID          DeviceId;
+  UINT8                          Mode;
+  VOID                           *DeviceContext;
+  // NULL in bypass mode.
+  UINT64                         *RootPageTable;
+  // The translations of the page table are tagged with the PSCID, so that they are invalidated
+  // without evicting those of other domains. 0 in bypass mode.
+  UINT32                         Pscid;
+  // The strict domains of functions that can't be isolated from each other translate through the
+  // page table and PSCID of the first of them, which Group points to, also from itself. NULL if the
+  // domain isn't grouped. GroupKey is as returned by IoMmuGetDeviceGroup().
+  RISCV_IOMMU_DEVICE_DOMAIN      *Group;
+  UINT64                         GroupKey;
+  // The RCID and MCID that tag the device's requests, in the layout of RISCV_IOMMU_QOSID.
+  UINT32                         QosId;
+  // The highest device address that the IOMMU translates, or passes through, for the device.
+  UINT64                         DmaAddressLimit;
+  // The faults the IOMMU reported for the device, and those since FaultWindowStart, in nanoseconds.
+  UINT32                         FaultCount;
+  UINT64                         FaultWindowStart;
+  UINT32                         FaultsInWindow;
+  // The device faulted faster than PcdRiscVIoMmuFaultStormThreshold allows, so its device
+  // context blocks all of its DMA, without reporting the faults, until it is detached.
+  BOOLEAN                        Quarantined;
+  // The bytes of partly mapped pages, outside the buffers granted, that the device could reach.
+  UINT64                         ExposedBytes;
+  // The pages of the page table below its root, which PcdRiscVIoMmuDomainTablePageLimit caps.
+  UINTN                          TablePages;
+  // Once ATS is enabled, the function caches the translations in its ATC,
+  // which is invalidated by its segment and RID.
+  BOOLEAN                        AtsChecked;
+  BOOLEAN                        AtsEnabled;
+  EFI_PCI_IO_PROTOCOL            *AtsPciIo;
+  UINT16                         AtsCapabilityOffset;
+  UINT16                         PciSegment;
+  UINT16                         PciRequesterId;
+  // With PRI, large ranges are only mapped once the function requests their pages.
+  // A page request group fails if any of its requests does, which is only answered
+  // by its last request.
+  BOOLEAN                        PriEnabled;
+  UINT16                         PriCapabilityOffset;
+  LIST_ENTRY                     DemandRanges;
+  UINT64                         FailedPageRequestGroups[512 / 64];
+  // The function was hot-removed: the device context is invalid and the page table empty,
+  // until a function at the same device_id attaches to the domain again.
+  BOOLEAN                        Detached;
+  // How the device's buffers were mapped, for the diagnostics protocol.
+  RISCV_IOMMU_DEVICE_STATISTICS  Statistics;
+};
+
+#define RISCV_IOMMU_DEVICE_DOMAIN_FROM_LINK(a) \
+  CR (a, RISCV_IOMMU_DEVICE_DOMAIN, Link, RISCV_IOMMU_DEVICE_DOMAIN_SIGNATURE)
+
+#define RISCV_IOMMU_INSTANCE_SIGNATURE  SIGNATURE_32 ('R', 'V', 'I', 'O')
+
+//
+// The state of a single IOMMU, each with its own queues and device-directory table.
+//
+struct _RISCV_IOMMU_INSTANCE {
+  UINT32           Signature;
+  LIST_ENTRY       Link;
+  UINT8            State;
+
+  BOOLEAN          IoMmuIsPciDevice;
+  UINT64           Address;
+  // The capabilities register, and the feature control register as programmed, once initialised.
+  UINT64           Capabilities;
+  UINT32           FeatureControl;
+  // The location of a PCI IOMMU, used to find its function once enumeration completes.
+  UINT16           PciSegment;
+  UINT16           PciBdf;
+  // The phandle that devicetree nodes reference the IOMMU by, or 0.
+  UINT32           DeviceTreePhandle;
+  // The interrupt wires the platform connected, and whether it described an MSI controller.
+  UINT8            NumberOfInterruptWires;
+  BOOLEAN          HasMsiParent;
+  // The vectors the interrupt causes are spread over, and whether they are wired.
+  UINT8            NumberOfInterruptVectors;
+  BOOLEAN          InterruptsAreWired;
+  // Whether the IOMMU's memory accesses don't snoop the harts' caches, as the platform described.
+  BOOLEAN          NonCoherent;
+  // The RCID and MCID bits of iommu_qosid that the IOMMU implements. 0 without QoS IDs.
+  UINT32           QosIdMask;
+  // The proximity domain of the IOMMU, if the platform described one, and what is left
+  // of the chunk of local memory that its table pages come from, outside the pools' domain.
+  BOOLEAN          HasProximityDomain;
+  UINT32           ProximityDomain;
+  VOID             *LocalTablePages;
+  UINTN            LocalTablePagesLeft;
+  // The flat MSI page table shared by the extended device contexts, or NULL without MSI translation.
+  VOID             *MsiPageTable;
+
+  CONTEXT_WRAPPER  DeviceContext;
+  // Whether DDTP was written during initialisation, and is yet to be accepted.
+  BOOLEAN          DdtpPending;
+  // Whether the registers were written by initialisation, which is yet to complete.
+  BOOLEAN          Starting;
+
+  UINT8            IoSatpMode;
+  UINT8            IoPageTableLevels;
+  LIST_ENTRY       DomainList;
+  // The PSCID of the next domain. Domains are never destroyed, so PSCIDs are never reused.
+  UINT32           NextPscid;
+  // The identity table that the domains in permissive mode share, once built, and its PSCID.
+  UINT64           *PermissiveRootPageTable;
+  UINT32           PermissivePscid;
+  // The empty table that quarantined devices translate through, once allocated, and its PSCID.
+  UINT64           *BlockingRootPageTable;
+  UINT32           BlockingPscid;
+
+  QUEUE_WRAPPER    CommandQueue;
+  QUEUE_WRAPPER    FaultQueue;
+  QUEUE_WRAPPER    PageRequestQueue;
+
+  // The faults reported by cause, and those of device_ids without a domain.
+  UINT32           FaultCounts[RISCV_IOMMU_FAULT_CAUSE_SLOTS];
+  UINT32           UnknownDeviceFaults;
+  // A device passed the fault storm threshold during a drain, and is yet to be quarantined.
+  BOOLEAN          FaultStormPending;
+
+  // Commands written since the last IOFENCE.C, and nesting of open command batches.
+  UINTN            CommandsPending;
+  UINTN            CommandBatchDepth;
+  // The entries the command queue may grow to, and whether it filled since the last submission.
+  UINT32           CommandQueueLimit;
+  BOOLEAN          CommandQueueFilled;
+  // The command the IOMMU last stopped at, and how often it was retried.
+  UINT32           CommandRecoveryHead;
+  UINT8            CommandRecoveries;
+  // Set while a hart writes CQT, so that CQT never moves back.
+  volatile UINT32  CommandDoorbellLock;
+
+  // Address invalidations not yet written as commands.
+  IOTLB_BATCH      PendingInvalidations;
+  // Device context invalidations not yet written as commands.
+  DDT_BATCH        PendingDeviceContexts;
+
+  // Without coherence: the table and command writes not yet cleaned to memory.
+  CLEAN_BATCH      PendingCleans;
+
+  // IOFENCE.C writes its sequence number here on completion.
+  volatile UINT32  *FenceCompletion;
+  UINT32           FenceSequence;
+  // The sequence number of the last fence the boot hart wrote. Only its fences follow
+  // the pending invalidations, so only they may release retired table pages.
+  UINT32           BootFenceSequence;
+
+  // Emptied page-table pages that wait for a fence before they are freed, and how
+  // many pages were ever retired.
+  RETIRED_TABLE_PAGE  RetiredTablePages[RISCV_IOMMU_RETIRED_TABLE_PAGES];
+  UINTN               NumberOfRetiredTablePages;
+  UINTN               TablePagesRetired;
+
+  // The fences that asynchronous callers wait for, and the timer that polls for them.
+  ASYNC_FENCE         AsyncFences[RISCV_IOMMU_ASYNC_FENCES];
+  UINTN               NumberOfAsyncFences;
+  UINTN               AsyncFenceTicks;
+
+  // The performance monitor: the widths of its counters, the event counters implemented
+  // from 1, and the started counters, by their bits in IOCNTINH. Each started counter
+  // is extended by the times it wrapped around. Counter 0 counts cycles.
+  BOOLEAN          HasHpm;
+  UINT8            HpmCyclesWidth;
+  UINT8            HpmCounterWidth;
+  UINT8            NumberOfHpmCounters;
+  UINT32           HpmCountersInUse;
+  UINT64           HpmWrapCounts[RISCV_IOMMU_HPM_COUNTERS + 1];
+};
+
+#define RISCV_IOMMU_INSTANCE_FROM_LINK(a) \
+  CR (a, RISCV_IOMMU_INSTANCE, Link, RISCV_IOMMU_INSTANCE_SIGNATURE)
+
+//
+// Routing domains, in which source IDs are unique: a PCI segment of requester IDs,
+// or a platform device, by the offset of its RIMT or devicetree node.
+//
+#define RISCV_IOMMU_PCI_ROUTING_DOMAIN(Segment)   ((UINT32)(Segment))
+#define RISCV_IOMMU_PLATFORM_ROUTING_DOMAIN(Node)  (BIT31 | (UINT32)(Node))
+
+//
+// The root complex of the routed functions supports ATS, and page requests.
+//
+#define RISCV_IOMMU_ROUTE_ATS_SUPPORTED  BIT0
+#define RISCV_IOMMU_ROUTE_PRI_SUPPORTED  BIT1
+
 typedef struct {
-  UINT8            DriverState;
+  UINT8         DriverState;
+
+  LIST_ENTRY    InstanceList;
+  UINTN         NumberOfInstances;
+
+  // Whether every initialised IOMMU translates through first-stage page tables.
+  BOOLEAN       TranslationEnabled;
+  // Whether the protocol was installed before any IOMMU was initialised. Until one is,
+  // buffers are mapped at their own address, and SetAttribute() only records its grants.
+  BOOLEAN       Deferred;
+  // The top of the memory that devices behind every initialised IOMMU can address.
+  UINT64        DmaMemoryTop;
+  // Whether the teardown runs before boot services exit, so that state which
+  // must not outlive the firmware may be kept until then.
+  BOOLEAN       TeardownAtExit;
+} RISCV_IOMMU_GLOBAL_DRIVER_CONTEXT;
+
+extern RISCV_IOMMU_GLOBAL_DRIVER_CONTEXT  mRiscVIoMmuGlobalDriverContext;
+extern EDKII_IOMMU_PROTOCOL               mRiscVIoMmuProtocol;
+extern EDKII_IOMMU_BATCH_PROTOCOL         mRiscVIoMmuBatchProtocol;
+extern EDKII_IOMMU_DEVICE_HINT_PROTOCOL   mRiscVIoMmuDeviceHintProtocol;
+extern RISCV_IOMMU_HPM_PROTOCOL           mRiscVIoMmuHpmProtocol;
+extern RISCV_IOMMU_DIAGNOSTICS_PROTOCOL   mRiscVIoMmuDiagnosticsProtocol;
+
+/**
+  Detect the RISC-V IOMMU devices.
+
+  Every IOMMU that the firmware tables describe gets its own instance.
+
+**/
+VOID
+DetectRiscVIoMmus (
+  VOID
+  );
+
+/**
+  Create the instance of a discovered IOMMU, and add it to the driver context.
+
+  @param[in]  IoMmuIsPciDevice  Whether the IOMMU is a PCI function.
+  @param[in]  Address           The base address of the registers, or 0 if not known yet.
+  @param[in]  State             The detection state of the IOMMU.
+
+  @return  The instance, or NULL if it could not be allocated.
+
+**/
+RISCV_IOMMU_INSTANCE *
+IoMmuCreateInstance (
+  IN BOOLEAN  IoMmuIsPciDevice,
+  IN UINT64   Address,
+  IN UINT8    State
+  );
+
+/**
+  Find an initialised IOMMU by its index, in the order the IOMMUs were discovered.
+
+  @param[in]  Index  The index of the IOMMU among the initialised ones, from 0.
+
+  @return  The IOMMU, or NULL if there are fewer initialised IOMMUs.
+
+**/
+RISCV_IOMMU_INSTANCE *
+IoMmuGetInstance (
+  IN UINTN  Index
+  );
+
+/**
+  Adopt the queues and device directory of an IOMMU that an earlier boot stage left running.
+
+  Nothing is changed unless the whole configuration is adopted.
+  The directory that the PEIM hands off is not adopted, and leaves DeviceContext.Buffer NULL.
+
+  @param[in]  IoMmu          The IOMMU, whose capabilities are known.
+  @param[in]  NeedBigEndian  Whether implicit accesses must be big-endian, as the harts are.
+  @param[in]  NeedGxl        Whether the IOMMU must be in the 32-bit group of paging modes.
+
+  @retval  TRUE   The configuration is adopted.
+  @retval  FALSE  The configuration is not usable, and must be quiesced.
+
+**/
+BOOLEAN
+IoMmuAdoptConfiguration (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN BOOLEAN               NeedBigEndian,
+  IN BOOLEAN               NeedGxl
+  );
+
+/**
+  Stop an IOMMU that an earlier boot stage left running, so that it is initialised from reset.
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @retval  EFI_SUCCESS      The IOMMU is in its reset state.
+  @retval  EFI_UNSUPPORTED  The IOMMU could not be quiesced.
+
+**/
+EFI_STATUS
+IoMmuQuiesce (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  );
+
+/**
+  Initialisation worker function.
+
+  Initialises every IOMMU that became available, and the first time
+  any is initialised, the shared state and the protocol. While
+  initialisation is deferred, only starts them, and leaves the rest
+  to a timer.
+
+  @retval  EFI_SUCCESS      The available IOMMUs are initialised, or being initialised.
+  @retval  EFI_UNSUPPORTED  No available IOMMU could be initialised.
+
+**/
+EFI_STATUS
+IoMmuCommonInitialise (
+  VOID
+  );
+
+/**
+  Return whether the IOMMUs that IoMmuCommonInitialise() started accepted their
+  queues and device directories, without waiting for them.
+
+  @retval  TRUE   IoMmuCompleteInitialisation() won't wait.
+  @retval  FALSE  An IOMMU is still turning on a queue, or its DDTP is busy.
+
+**/
+BOOLEAN
+IoMmuStartedInstancesReady (
+  VOID
+  );
+
+/**
+  Complete the initialisation of the IOMMUs that IoMmuCommonInitialise() started,
+  and the first time any is initialised, the shared state and the protocols.
+
+  @retval  EFI_SUCCESS      The started IOMMUs are initialised.
+  @retval  EFI_UNSUPPORTED  No started IOMMU could be initialised.
+
+**/
+EFI_STATUS
+IoMmuCompleteInitialisation (
+  VOID
+  );
+
+/**
+  Install EDKII_IOMMU_PROTOCOL before any IOMMU is initialised, if
+  PcdRiscVIoMmuDeferredInitialisation selects it.
+
+  Until an IOMMU is, Map() serves buffers at their own address, and SetAttribute()
+  records its grants, for IoMmuCompleteInitialisation() to apply.
+
+  @retval  EFI_SUCCESS      The protocol is installed.
+  @retval  EFI_UNSUPPORTED  Initialisation isn't deferred.
+  @retval  Others           The protocol could not be installed.
+
+**/
+EFI_STATUS
+IoMmuInstallDeferredProtocol (
+  VOID
+  );
+
+/**
+  Poll the IOMMUs that IoMmuCommonInitialise() started from a timer, and
+  complete their initialisation once they are ready.
+
+**/
+VOID
+IoMmuScheduleDeferredCompletion (
+  VOID
+  );
+
+/**
+  Record the access that SetAttribute() grants a device to a mapping, while
+  initialisation is deferred.
+
+  @param[in]   MapInfo       The mapping.
+  @param[in]   DeviceHandle  The device.
+  @param[in]   IoMmuAccess   The access, or 0 to revoke it.
+  @param[out]  Status        The status for SetAttribute() to return, if it was recorded.
+
+  @retval  TRUE   The grant was recorded, and applies once an IOMMU is initialised.
+  @retval  FALSE  Initialisation isn't deferred, so the grant is to be applied now.
+
+**/
+BOOLEAN
+IoMmuRecordDeferredGrant (
+  IN  MAP_INFO    *MapInfo,
+  IN  EFI_HANDLE  DeviceHandle,
+  IN  UINT64      IoMmuAccess,
+  OUT EFI_STATUS  *Status
+  );
+
+/**
+  Forget the grants recorded for a mapping that is released.
+
+  @param[in]  MapInfo  The mapping.
+
+**/
+VOID
+IoMmuForgetDeferredGrants (
+  IN MAP_INFO  *MapInfo
+  );
+
+/**
+  Prepare the device contexts of all PCI functions, and handle their removal,
+  if PCI enumeration already completed.
+
+  Called once an IOMMU is initialised after enumeration.
+
+**/
+VOID
+IoMmuPreparePciDevices (
+  VOID
+  );
+
+/**
+  Record that a range of source IDs is mapped to an IOMMU.
+
+  @param[in]  IoMmu         The IOMMU.
+  @param[in]  Domain        The routing domain of the source IDs, from RISCV_IOMMU_PCI_ROUTING_DOMAIN()
+                            or RISCV_IOMMU_PLATFORM_ROUTING_DOMAIN().
+  @param[in]  SourceIdBase  The first source ID of the range.
+  @param[in]  NumberOfIds   The number of source IDs in the range.
+  @param[in]  DeviceIdBase  The device_id that SourceIdBase maps to.
+  @param[in]  SourceIdMask  The mask applied to source IDs of the domain before they are
+                            looked up, such as from `iommu-map-mask`, or MAX_UINT32.
+  @param[in]  Flags         The RISCV_IOMMU_ROUTE_* attributes of the range.
+
+  @retval  EFI_SUCCESS           The range was recorded.
+  @retval  EFI_OUT_OF_RESOURCES  The route table could not be grown.
+
+**/
+EFI_STATUS
+IoMmuAddRoute (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT32                Domain,
+  IN UINT32                SourceIdBase,
+  IN UINT32                NumberOfIds,
+  IN UINT32                DeviceIdBase,
+  IN UINT32                SourceIdMask,
+  IN UINT32                Flags
+  );
+
+/**
+  Sort the recorded routes into the interval index, once discovery completes.
+
+  Overlapping ranges are reported, and the later-starting range takes precedence.
+
+**/
+VOID
+IoMmuBuildRouteIndex (
+  VOID
+  );
+
+/**
+  Find the IOMMU that a device is routed to, and the device_id it is known by.
+
+  Without any routes, as on platforms with a single IOMMU, that IOMMU owns
+  every PCI function, by the device_id formed from its segment and RID.
+
+  @param[in]   Domain    The routing domain of the device.
+  @param[in]   SourceId  The source ID of the device, such as a PCI RID.
+  @param[out]  DeviceId  The device_id of the device at the IOMMU.
+  @param[out]  Flags     The RISCV_IOMMU_ROUTE_* attributes of the route, if not NULL.
+
+  @return  The IOMMU, or NULL if the device isn't routed to any IOMMU.
+
+**/
+RISCV_IOMMU_INSTANCE *
+IoMmuRouteDevice (
+  IN  UINT32                 Domain,
+  IN  UINT32                 SourceId,
+  OUT RISCV_IOMMU_DEVICE_ID  *DeviceId,
+  OUT UINT32                 *Flags OPTIONAL
+  );
+
+/**
+  Record the routing domain of a platform device, by its MMIO base.
+
+  @param[in]  BaseAddress  The base of the first MMIO region of the device.
+  @param[in]  Domain       The routing domain of the device, from RISCV_IOMMU_PLATFORM_ROUTING_DOMAIN().
+
+  @retval  EFI_SUCCESS           The device was recorded.
+  @retval  EFI_OUT_OF_RESOURCES  The platform device table could not be grown.
+
+**/
+EFI_STATUS
+IoMmuAddPlatformDevice (
+  IN UINT64  BaseAddress,
+  IN UINT32  Domain
+  );
+
+/**
+  Find the routing domain of a platform device, by its MMIO base.
+
+  @param[in]   BaseAddress  The base of the first MMIO region of the device.
+  @param[out]  Domain       The routing domain of the device.
+
+  @retval  TRUE   The device is known, and Domain is set.
+  @retval  FALSE  No devicetree node with an IOMMU has this base.
+
+**/
+BOOLEAN
+IoMmuFindPlatformDevice (
+  IN  UINT64  BaseAddress,
+  OUT UINT32  *Domain
+  );
+
+/**
+  Record that a device keeps DMAing into a region that an earlier stage set up for it.
+
+  @param[in]  IoMmu     The IOMMU that translates the device.
+  @param[in]  DeviceId  The device_id of the device.
+  @param[in]  Base      The first address of the region.
+  @param[in]  Size      The size of the region.
+
+  @retval  EFI_SUCCESS           The region was recorded.
+  @retval  EFI_OUT_OF_RESOURCES  The region table could not be grown.
+
+**/
+EFI_STATUS
+IoMmuAddReservedRegion (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT32                DeviceId,
+  IN UINT64                Base,
+  IN UINT64                Size
+  );
+
+/**
+  Map the reserved regions of a device into its strict domain, at their own address.
+
+  @param[in]  IoMmu   The IOMMU.
+  @param[in]  Domain  The domain of the device.
+
+  @retval  EFI_SUCCESS  The regions are mapped, or the domain isn't strict.
+  @retval  Others       The page table could not be updated.
+
+**/
+EFI_STATUS
+IoMmuMapReservedRegions (
+  IN RISCV_IOMMU_INSTANCE       *IoMmu,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain
+  );
+
+/**
+  Determine the number of device-directory levels needed to index a device_id.
+
+  @param[in]  IoMmu          The IOMMU.
+  @param[in]  DeviceIdWidth  The width of the device_id in bits.
+
+  @return  The number of levels, from 1 to 3.
+
+**/
+UINT8
+IoMmuGetDeviceDirectoryLevels (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT8                 DeviceIdWidth
+  );
+
+/**
+  Find the domain of a device_id, without creating it.
+
+  @param[in]  IoMmu     The IOMMU.
+  @param[in]  DeviceId  The device_id.
+
+  @return  The domain, or NULL if the device has none.
+
+**/
+RISCV_IOMMU_DEVICE_DOMAIN *
+IoMmuFindDeviceDomain (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT32                DeviceId
+  );
+
+/**
+  Return whether two domains translate through the same page table, as one domain or one group.
+
+  @param[in]  Domain  A domain, or NULL.
+  @param[in]  Other   Another domain, or NULL.
+
+  @retval  TRUE   A mapping in the page table of one is also a mapping of the other.
+  @retval  FALSE  The domains have page tables of their own, or one is NULL.
+
+**/
+BOOLEAN
+IoMmuSharesTranslation (
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain OPTIONAL,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Other OPTIONAL
+  );
+
+/**
+  Find the translation domain of a device, creating it and programming
+  its device context on first use.
+
+  A strict domain that is created with the GroupKey of another strict domain
+  joins its group.
+
+  @param[in]   IoMmu     The IOMMU.
+  @param[in]   DeviceId  The device_id to find the domain of.
+  @param[in]   Mode      The RISCV_IOMMU_DEVICE_MODE_* of a created domain.
+  @param[in]   QosId     The QoS IDs of a created domain, as RISCV_IOMMU_QOSID.
+  @param[in]   GroupKey  The group of a created domain, as returned by IoMmuGetDeviceGroup().
+  @param[out]  Domain    The domain of the device.
+
+  @retval  EFI_SUCCESS           The domain was found or created.
+  @retval  EFI_UNSUPPORTED       The device_id cannot be translated by the IOMMU.
+  @retval  EFI_OUT_OF_RESOURCES  There were not enough resources to create the domain.
+
+**/
+EFI_STATUS
+IoMmuGetDeviceDomain (
+  IN  RISCV_IOMMU_INSTANCE       *IoMmu,
+  IN  RISCV_IOMMU_DEVICE_ID      DeviceId,
+  IN  UINT8                      Mode,
+  IN  UINT32                     QosId,
+  IN  UINT64                     GroupKey,
+  OUT RISCV_IOMMU_DEVICE_DOMAIN  **Domain
+  );
+
+/**
+  Detach a domain from its hot-removed function.
+
+  @param[in]  IoMmu   The IOMMU.
+  @param[in]  Domain  The domain of the function.
+
+  @retval  EFI_SUCCESS       The domain is detached.
+  @retval  EFI_DEVICE_ERROR  The IOMMU failed to invalidate the device context. The page table is kept.
+
+**/
+EFI_STATUS
+IoMmuDetachDeviceDomain (
+  IN RISCV_IOMMU_INSTANCE       *IoMmu,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain
+  );
+
+/**
+  Let a strict domain whose page table outgrew its budget translate as an identity domain.
+
+  @param[in]  IoMmu   The IOMMU.
+  @param[in]  Domain  The domain.
+
+  @retval  EFI_SUCCESS  The domain reaches all system memory at its own address.
+  @retval  Others       The identity leaves could not be built, or invalidated. The domain stays strict.
+
+**/
+EFI_STATUS
+IoMmuFallBackToIdentity (
+  IN RISCV_IOMMU_INSTANCE       *IoMmu,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain
+  );
+
+/**
+  Block all DMA of a device that faults in a storm, without reporting its faults.
+
+  @param[in]  IoMmu   The IOMMU.
+  @param[in]  Domain  The domain of the device.
+
+  @retval  EFI_SUCCESS           The device context blocks the device.
+  @retval  EFI_OUT_OF_RESOURCES  There is no PSCID or page for the blocking table.
+  @retval  EFI_DEVICE_ERROR      The IOMMU failed to invalidate the device context.
+
+**/
+EFI_STATUS
+IoMmuQuarantineDeviceDomain (
+  IN RISCV_IOMMU_INSTANCE       *IoMmu,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain
+  );
+
+/**
+  Copy the device context of a device_id, if the device directory has an entry for it.
+
+  @param[in]      IoMmu       The IOMMU.
+  @param[in]      DeviceId    The device_id.
+  @param[out]     Buffer      The device context.
+  @param[in,out]  BufferSize  On input, the size of Buffer. On output, the size of the context.
+
+  @retval  EFI_SUCCESS           The context is copied.
+  @retval  EFI_NOT_FOUND         The directory has no entry for the device_id.
+  @retval  EFI_BUFFER_TOO_SMALL  Buffer is too small. BufferSize is updated.
+
+**/
+EFI_STATUS
+IoMmuReadDeviceContext (
+  IN     RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN     UINT32                DeviceId,
+  OUT    VOID                  *Buffer,
+  IN OUT UINTN                 *BufferSize
+  );
+
+/**
+  Point the device context of an unused device_id at a page table, or invalidate it again.
+
+  The context serves translation requests through the debug interface. Its device_id is
+  the last one the device directory indexes already, so the directory doesn't grow, and
+  its faults are only reported in the responses. Its translations are tagged with
+  RISCV_IOMMU_SCRATCH_PSCID, which are invalidated either way.
+
+  @param[in]   IoMmu          The IOMMU.
+  @param[in]   IoSatpMode     The mode the page table is walked in.
+  @param[in]   RootPageTable  The root of the page table, or NULL to invalidate the context.
+  @param[out]  DeviceId       The device_id of the context.
+
+  @retval  EFI_SUCCESS       The context was programmed or invalidated.
+  @retval  EFI_NOT_FOUND     A domain uses the device_id.
+  @retval  EFI_UNSUPPORTED   There is no device context for the device_id.
+  @retval  EFI_DEVICE_ERROR  The IOMMU failed to invalidate its caches.
+
+**/
+EFI_STATUS
+IoMmuSetScratchDeviceContext (
+  IN  RISCV_IOMMU_INSTANCE   *IoMmu,
+  IN  UINT8                  IoSatpMode,
+  IN  UINT64                 *RootPageTable OPTIONAL,
+  OUT RISCV_IOMMU_DEVICE_ID  *DeviceId
+  );
+
+/**
+  Determine the translation mode of a PCI function, from PcdRiscVIoMmuDeviceModes
+  and PcdRiscVIoMmuDefaultDeviceMode.
+
+  A platform device, without a PCI I/O instance, takes the default mode.
+
+  @param[in]  PciIo  The PCI I/O instance of the function, or NULL for a platform device.
+
+  @return  The RISCV_IOMMU_DEVICE_MODE_* of the function.
+
+**/
+UINT8
+IoMmuGetDeviceMode (
+  IN EFI_PCI_IO_PROTOCOL  *PciIo OPTIONAL
+  );
+
+/**
+  Determine the QoS IDs that tag the DMA of a PCI function, from the class code
+  entries of PcdRiscVIoMmuDeviceQosIds.
+
+  @param[in]  PciIo  The PCI I/O instance of the function, or NULL for a platform device.
+
+  @return  The RCID and MCID of the function, as RISCV_IOMMU_QOSID. 0 if no entry matches,
+           or for a platform device.
+
+**/
+UINT32
+IoMmuGetDeviceQosId (
+  IN EFI_PCI_IO_PROTOCOL  *PciIo OPTIONAL
+  );
+
+/**
+  Determine the group of PCI functions that a function's domain shares its page table with,
+  from PcdRiscVIoMmuDeviceGroups, or else, with PcdRiscVIoMmuGroupByTopology, from
+  whether the functions of its multi-function device are isolated by ACS.
+
+  @param[in]  PciIo     The PCI I/O instance of the function, or NULL for a platform device.
+  @param[in]  Segment   The PCI segment of the function.
+  @param[in]  Bus       The bus number of the function.
+  @param[in]  Device    The device number of the function.
+  @param[in]  Function  The function number of the function.
+
+  @return  A key that is equal for the functions of a group, or 0 if the function isn't grouped.
+
+**/
+UINT64
+IoMmuGetDeviceGroup (
+  IN EFI_PCI_IO_PROTOCOL  *PciIo OPTIONAL,
+  IN UINTN                Segment,
+  IN UINTN                Bus,
+  IN UINTN                Device,
+  IN UINTN                Function
+  );
+
+/**
+  Reserve and zero the table-page pool, as sized by PcdRiscVIoMmuTablePagePoolSize.
+
+  @retval  EFI_SUCCESS           The pool is reserved, or is disabled.
+  @retval  EFI_OUT_OF_RESOURCES  The pool could not be reserved.
+
+**/
+EFI_STATUS
+IoMmuInitialiseTablePagePool (
+  VOID
+  );
+
+/**
+  Return the table-page pool in one piece, if none of its pages are in use.
+
+**/
+VOID
+IoMmuFreeTablePagePool (
+  VOID
+  );
+
+/**
+  Allocate pages from the memory local to an IOMMU, or to the IOMMUs that share the pools.
+
+  @param[in]  IoMmu          The IOMMU, or NULL for the pools shared by all IOMMUs.
+  @param[in]  NumberOfPages  The number of pages.
+  @param[in]  Alignment      The alignment of the pages, a power of two of at least a page.
+  @param[in]  MaxAddress     The highest address the pages may end at.
+
+  @return  The pages, to be freed with FreePages(), or NULL if there is no free local memory to allocate
+           them from. The caller then allocates them elsewhere.
+
+**/
+VOID *
+IoMmuAllocateLocalPages (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu  OPTIONAL,
+  IN UINTN                 NumberOfPages,
+  IN UINTN                 Alignment,
+  IN EFI_PHYSICAL_ADDRESS  MaxAddress
+  );
+
+/**
+  Take pages from the DMA pool that the platform reserved below 4 GiB, past what the PEIM took.
+
+  @param[in]  NumberOfPages  The number of pages.
+  @param[in]  Alignment      The alignment of the pages, a power of two of at least a page.
+  @param[in]  MaxAddress     The highest address the pages may end at.
+
+  @return  The pages, to be freed with FreePages(), or NULL if there is no pool or it has no room.
+           The caller then allocates them elsewhere.
+
+**/
+VOID *
+IoMmuAllocateDmaPoolPages (
+  IN UINTN                 NumberOfPages,
+  IN UINTN                 Alignment,
+  IN EFI_PHYSICAL_ADDRESS  MaxAddress
+  );
+
+/**
+  Return whether the table pages of an IOMMU are served by the table-page pool.
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @retval  TRUE   The IOMMU has no proximity domain, or shares that of the pool.
+  @retval  FALSE  The IOMMU's table pages are allocated from its own memory.
+
+**/
+BOOLEAN
+IoMmuUsesSharedPools (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  );
+
+/**
+  Allocate a zeroed table page from the memory local to an IOMMU that doesn't use the table-page pool.
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @return  The page, to be freed with FreePages(), or NULL if there is no free local memory.
+
+**/
+VOID *
+IoMmuAllocateLocalTablePage (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  );
+
+/**
+  Read the memory map.
+
+  @param[out]  MemoryMapSize   The size of the map, in bytes.
+  @param[out]  DescriptorSize  The size of a descriptor of the map.
+
+  @return  The memory map, to be freed with FreePool(), or NULL if it could not be read.
+
+**/
+EFI_MEMORY_DESCRIPTOR *
+IoMmuReadMemoryMap (
+  OUT UINTN  *MemoryMapSize,
+  OUT UINTN  *DescriptorSize
+  );
+
+/**
+  Allocate a zeroed page for a device-directory or IO page table.
+
+  @param[in]  IoMmu      The IOMMU that walks the table.
+  @param[in]  Footprint  What the page is accounted as.
+
+  @return  The page, or NULL if it could not be allocated, or PcdRiscVIoMmuMetadataLimit is reached.
+
+**/
+VOID *
+IoMmuAllocateTablePage (
+  IN RISCV_IOMMU_INSTANCE   *IoMmu,
+  IN RISCV_IOMMU_FOOTPRINT  Footprint
+  );
+
+/**
+  Free a page of a device-directory or IO page table.
+
+  @param[in]  Page       The page, from IoMmuAllocateTablePage().
+  @param[in]  Footprint  What the page was accounted as.
+
+**/
+VOID
+IoMmuFreeTablePage (
+  IN VOID                   *Page,
+  IN RISCV_IOMMU_FOOTPRINT  Footprint
+  );
+
+/**
+  Account memory allocated for the driver's metadata.
+
+  IO page tables, mapping records and bounce buffers grow with the mappings of device
+  drivers, and together are capped by PcdRiscVIoMmuMetadataLimit.
+
+  @param[in]  Footprint  What the memory is accounted as.
+  @param[in]  Bytes      The size of the memory.
+
+  @retval  TRUE   The memory is accounted.
+  @retval  FALSE  The memory would exceed PcdRiscVIoMmuMetadataLimit, and must not be allocated.
+
+**/
+BOOLEAN
+IoMmuChargeFootprint (
+  IN RISCV_IOMMU_FOOTPRINT  Footprint,
+  IN UINTN                  Bytes
+  );
+
+/**
+  Account memory of the driver's metadata that is freed.
+
+  @param[in]  Footprint  What the memory was accounted as.
+  @param[in]  Bytes      The size of the memory.
+
+**/
+VOID
+IoMmuReleaseFootprint (
+  IN RISCV_IOMMU_FOOTPRINT  Footprint,
+  IN UINTN                  Bytes
+  );
+
+/**
+  Report the memory of the driver's metadata that is accounted as one kind.
+
+  @param[in]  Footprint  The kind.
+
+  @return  The bytes currently accounted.
+
+**/
+UINT64
+IoMmuGetFootprint (
+  IN RISCV_IOMMU_FOOTPRINT  Footprint
+  );
+
+/**
+  Log the current and peak footprint of the driver's metadata at ReadyToBoot.
+
+  @retval  EFI_SUCCESS  The event is registered.
+  @retval  Others       The event could not be created. Nothing is logged.
+
+**/
+EFI_STATUS
+IoMmuInitialiseFootprint (
+  VOID
+  );
+
+/**
+  Account the time that a wait for the IOMMUs was blocked.
+
+  @param[in]  Ticks  The time, in ticks of the performance counter.
+
+**/
+VOID
+IoMmuCountWaitTime (
+  IN UINT64  Ticks
+  );
+
+/**
+  Account the invalidation and fence commands among commands issued to an IOMMU.
+
+  @param[in]  Commands          The commands.
+  @param[in]  NumberOfCommands  The number of commands.
+
+**/
+VOID
+IoMmuCountCommands (
+  IN CONST RISCV_IOMMU_COMMAND  *Commands,
+  IN UINTN                      NumberOfCommands
+  );
+
+/**
+  Time the IOMMU protocol services, and print and publish the cost of DMA protection
+  during boot at ReadyToBoot.
+
+  Must be called before the protocol is installed, after its services are wrapped otherwise.
+
+  @retval  EFI_SUCCESS  The event is registered.
+  @retval  Others       The event could not be created. The services are timed, but nothing is reported.
+
+**/
+EFI_STATUS
+IoMmuInitialiseBootCost (
+  VOID
+  );
+
+/**
+  Retire an IO page-table page that is about to be unhooked, to be freed once the
+  next IOFENCE.C of the IOMMU completes.
+
+  @param[in]  IoMmu  The IOMMU that walks the page.
+  @param[in]  Page   The page, from IoMmuAllocateTablePage().
+
+  @retval  TRUE   The page is retired, and must be unhooked before the next fence.
+  @retval  FALSE  Too many pages wait for a fence, so the page must stay hooked.
+
+**/
+BOOLEAN
+IoMmuRetireTablePage (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN VOID                  *Page
+  );
+
+/**
+  Free the retired IO page-table pages that a completed IOFENCE.C covers.
+
+  @param[in]  IoMmu     The IOMMU.
+  @param[in]  Sequence  The sequence number of the completed fence.
+
+**/
+VOID
+IoMmuReclaimTablePages (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT32                Sequence
+  );
+
+/**
+  Report the size of the table-page pool, and how much of it is in use.
+
+  @param[out]  NumberOfPages  The pages of the pool.
+  @param[out]  PagesInUse     The pages handed out and not freed.
+  @param[out]  HighWater      The most pages that were in use at once.
+
+**/
+VOID
+IoMmuGetTablePagePoolUsage (
+  OUT UINTN  *NumberOfPages,
+  OUT UINTN  *PagesInUse,
+  OUT UINTN  *HighWater
+  );
+
+/**
+  Report the region that the table-page pool was reserved at.
+
+  @param[out]  Base           The base of the pool, or 0 if there is none.
+  @param[out]  NumberOfPages  The pages of the pool.
+
+**/
+VOID
+IoMmuGetTablePagePoolRange (
+  OUT EFI_PHYSICAL_ADDRESS  *Base,
+  OUT UINTN                 *NumberOfPages
+  );
+
+/**
+  Prepare the cache maintenance of an IOMMU, if its memory accesses are not coherent.
+
+  @param[in]  IoMmu  The IOMMU, before any of its tables are written.
+
+  @retval  EFI_SUCCESS      The IOMMU is coherent, or its tables can be cleaned.
+  @retval  EFI_UNSUPPORTED  The IOMMU is not coherent, and not every hart implements Zicbom.
+
+**/
+EFI_STATUS
+IoMmuInitialiseCacheMaintenance (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  );
+
+/**
+  Record that a range of a table or queue was written, for the IOMMU to read once it
+  is cleaned by IoMmuFlushCacheCleans(). Adjacent ranges coalesce, and a full batch
+  is cleaned early.
+
+  @param[in]  IoMmu    The IOMMU that reads the range.
+  @param[in]  Address  The first byte written.
+  @param[in]  Length   The number of bytes written.
+
+**/
+VOID
+IoMmuQueueCacheClean (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN CONST VOID            *Address,
+  IN UINTN                 Length
+  );
+
+/**
+  Clean the ranges recorded by IoMmuQueueCacheClean(). The caller's fence orders
+  the cleans before the IOMMU is told to read the ranges.
+
+  @param[in]  IoMmu  The IOMMU.
+
+**/
+VOID
+IoMmuFlushCacheCleans (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  );
+
+/**
+  Clean the ranges recorded by IoMmuQueueCacheClean() on a hart other than the boot
+  hart, which can't raise the TPL. The caller's fence orders the cleans before the
+  IOMMU is told to read the ranges.
+
+  @param[in]  IoMmu  The IOMMU.
+
+**/
+VOID
+IoMmuFlushCacheCleansFromAp (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  );
+
+/**
+  Clean a newly zeroed table page, if any IOMMU walks tables without snooping.
+
+  @param[in]  Page  The page.
+
+**/
+VOID
+IoMmuCleanTablePage (
+  IN VOID  *Page
+  );
+
+/**
+  Discard the hart's copies of a range that the IOMMU wrote, before it is read.
+  The range must not share a cache block with memory the hart writes.
+
+  @param[in]  IoMmu    The IOMMU that wrote the range.
+  @param[in]  Address  The first byte.
+  @param[in]  Length   The number of bytes.
+
+**/
+VOID
+IoMmuInvalidateCacheRange (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN CONST VOID            *Address,
+  IN UINTN                 Length
+  );
+
+/**
+  Prepare the cache for a device without coherent DMA to transfer a buffer.
+
+  @param[in]  Operation  The operation the buffer was mapped for.
+  @param[in]  Address    The buffer the device accesses.
+  @param[in]  Length     The length of the buffer.
+
+**/
+VOID
+IoMmuPrepareDmaBuffer (
+  IN EDKII_IOMMU_OPERATION  Operation,
+  IN EFI_PHYSICAL_ADDRESS   Address,
+  IN UINTN                  Length
+  );
+
+/**
+  Discard the hart's stale copies of a buffer that a device without coherent DMA wrote,
+  before it is read.
+
+  @param[in]  Operation  The operation the buffer was mapped for.
+  @param[in]  Address    The buffer the device accessed.
+  @param[in]  Length     The length of the buffer.
+
+**/
+VOID
+IoMmuCompleteDmaBuffer (
+  IN EDKII_IOMMU_OPERATION  Operation,
+  IN EFI_PHYSICAL_ADDRESS   Address,
+  IN UINTN                  Length
+  );
+
+/**
+  Write back and discard the hart's copies of a range, before it is mapped with another
+  memory type.
+
+  @param[in]  Address  The first byte.
+  @param[in]  Length   The number of bytes.
+
+  @retval  TRUE   The range was flushed.
+  @retval  FALSE  Not every hart implements Zicbom, so the range could not be flushed.
+
+**/
+BOOLEAN
+IoMmuFlushCacheRange (
+  IN EFI_PHYSICAL_ADDRESS  Address,
+  IN UINTN                 Length
+  );
+
+/**
+  Map the newly allocated buffer of a queue of an IOMMU without coherence non-cacheable,
+  with Svpbmt, if every hart implements it. Otherwise, the queue stays write-back, and
+  its entries are cleaned and invalidated one by one.
+
+  @param[in]  IoMmu        The IOMMU.
+  @param[in]  QueueStruct  The queue, whose buffer the IOMMU doesn't use yet.
+
+**/
+VOID
+IoMmuMapQueueUncached (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN QUEUE_WRAPPER         *QueueStruct
+  );
+
+/**
+  Map the buffer of a queue write-back again, before it is freed.
+
+  @param[in]  Buffer  The buffer, which IoMmuMapQueueUncached() mapped non-cacheable.
+  @param[in]  Size    The size of the buffer.
+
+**/
+VOID
+IoMmuMapQueueCached (
+  IN VOID   *Buffer,
+  IN UINTN  Size
+  );
+
+/**
+  Allocate an empty IO page table.
+
+  @param[in]  IoMmu  The IOMMU that walks the table.
+
+  @return  The page table, or NULL if it could not be allocated.
+
+**/
+UINT64 *
+IoMmuAllocatePageTable (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  );
+
+/**
+  Free a page table that no device context references, with all its levels.
+
+  @param[in]  IoMmu          The IOMMU.
+  @param[in]  RootPageTable  The root of the page table.
+
+**/
+VOID
+IoMmuFreePageTable (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT64                *RootPageTable
+  );
+
+/**
+  Release every level of a page table that no device context references, in bulk,
+  and leave its root empty.
+
+  @param[in]  IoMmu          The IOMMU.
+  @param[in]  RootPageTable  The root of the page table.
+
+**/
+VOID
+IoMmuClearPageTable (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT64                *RootPageTable
+  );
+
+/**
+  Map or unmap a range of IO virtual addresses in a first-stage page table.
+
+  @param[in]  IoMmu             The IOMMU.
+  @param[in]  RootPageTable     The root of the page table.
+  @param[in]  Pscid             The PSCID that the translations of the page table are tagged with.
+  @param[in]  IoVirtualAddress  The first IO virtual address of the range.
+  @param[in]  PhysicalAddress   The physical address that IoVirtualAddress maps to.
+  @param[in]  Length            The length of the range.
+  @param[in]  IoMmuAccess       The IOMMU access, or 0 to unmap.
+  @param[in]  Lazy              Whether invalidating replaced translations is left to the caller,
+                                which must flush the IOTLB before the range is reused.
+
+  @retval  EFI_SUCCESS            The range was updated.
+  @retval  EFI_INVALID_PARAMETER  The addresses or length are not page-aligned.
+  @retval  EFI_OUT_OF_RESOURCES   There were not enough resources to update the range.
+  @retval  EFI_DEVICE_ERROR       The IOMMU failed to invalidate replaced translations.
+
+**/
+EFI_STATUS
+IoMmuUpdatePageTable (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT64                *RootPageTable,
+  IN UINT32                Pscid,
+  IN UINT64                IoVirtualAddress,
+  IN UINT64                PhysicalAddress,
+  IN UINT64                Length,
+  IN UINT64                IoMmuAccess,
+  IN BOOLEAN               Lazy
+  );
+
+/**
+  Map or unmap a range of IO virtual addresses in the page table of a domain, whose new
+  table pages are counted against PcdRiscVIoMmuDomainTablePageLimit.
+
+  @param[in]  IoMmu             The IOMMU.
+  @param[in]  Domain            The domain.
+  @param[in]  IoVirtualAddress  The first IO virtual address of the range.
+  @param[in]  PhysicalAddress   The physical address that IoVirtualAddress maps to.
+  @param[in]  Length            The length of the range.
+  @param[in]  IoMmuAccess       The IOMMU access, or 0 to unmap.
+  @param[in]  Lazy              Whether invalidating replaced translations is left to the caller.
+
+  @return  The status of the update, as for IoMmuUpdatePageTable().
+
+**/
+EFI_STATUS
+IoMmuUpdateDomainPageTable (
+  IN RISCV_IOMMU_INSTANCE       *IoMmu,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain,
+  IN UINT64                     IoVirtualAddress,
+  IN UINT64                     PhysicalAddress,
+  IN UINT64                     Length,
+  IN UINT64                     IoMmuAccess,
+  IN BOOLEAN                    Lazy
+  );
+
+/**
+  Determine the IO virtual addresses that the first-stage page tables of an IOMMU can map.
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @return  The IO virtual address after the mappable ones, or 0 without IO page tables.
+
+**/
+UINT64
+IoMmuGetIoVirtualAddressLimit (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  );
+
+/**
+  Select the shallowest first-stage mode of an IOMMU that maps all system memory.
+
+  @param[in]  IoMmu         The IOMMU.
+  @param[in]  Capabilities  The capabilities of the IOMMU.
+
+**/
+VOID
+IoMmuSelectIoPagingMode (
+  IN RISCV_IOMMU_INSTANCE      *IoMmu,
+  IN RISCV_IOMMU_CAPABILITIES  Capabilities
+  );
+
+/**
+  Map all system memory at its own address in a first-stage page table.
+
+  Each 1 GiB block that holds system memory is mapped by one leaf, where the table is empty.
+
+  @param[in]  IoMmu          The IOMMU.
+  @param[in]  RootPageTable  The root of the page table.
+
+  @retval  EFI_SUCCESS           The memory was mapped.
+  @retval  EFI_OUT_OF_RESOURCES  There were not enough resources to map the memory.
+
+**/
+EFI_STATUS
+IoMmuIdentityMapSystemMemory (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT64                *RootPageTable
+  );
+
+/**
+  Find the permissive table of an IOMMU, building it on first use.
+
+  @param[in]   IoMmu          The IOMMU.
+  @param[out]  RootPageTable  The root of the table.
+  @param[out]  Pscid          The PSCID that tags its translations.
+
+  @retval  EFI_SUCCESS           The table was found or built.
+  @retval  EFI_OUT_OF_RESOURCES  There were not enough resources to build the table.
+
+**/
+EFI_STATUS
+IoMmuGetPermissivePageTable (
+  IN  RISCV_IOMMU_INSTANCE  *IoMmu,
+  OUT UINT64                **RootPageTable,
+  OUT UINT32                *Pscid
+  );
+
+/**
+  Determine how much of a range of host memory falls into the holes of the permissive tables.
+
+  @param[in]  Start  The first address of the range.
+  @param[in]  End    The address after the range.
+
+  @return  The number of bytes of the range in holes.
+
+**/
+UINT64
+IoMmuGetPermissiveHoleOverlap (
+  IN EFI_PHYSICAL_ADDRESS  Start,
+  IN EFI_PHYSICAL_ADDRESS  End
+  );
+
+/**
+  Mirror the hart's page table into a first-stage page table, over a range of addresses.
+
+  Readable and writable leaves of the hart are mapped readable and writable at their own
+  address, and the IOVA window is left to Map().
+
+  @param[in]  IoMmu          The IOMMU.
+  @param[in]  RootPageTable  The root of the page table.
+  @param[in]  Pscid          The PSCID that the translations of the page table are tagged with.
+  @param[in]  Start          The first address of the range, page-aligned.
+  @param[in]  End            The address after the range, page-aligned.
+  @param[in]  Refresh        Whether the page table already mirrors the hart's, so that the
+                             addresses it no longer maps are unmapped, and replaced translations
+                             are invalidated. The invalidations are submitted with the current
+                             command batch.
+
+  @retval  EFI_SUCCESS      The range is mirrored.
+  @retval  EFI_UNSUPPORTED  The hart doesn't translate with Sv39, Sv48 or Sv57.
+  @retval  Others           The page table could not be updated.
+
+**/
+EFI_STATUS
+IoMmuMirrorCpuPageTable (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT64                *RootPageTable,
+  IN UINT32                Pscid,
+  IN UINT64                Start,
+  IN UINT64                End,
+  IN BOOLEAN               Refresh
+  );
+
+/**
+  Refresh the CPU mirror domains whenever the hart's page table changes, from the first call on.
+
+  The CPU architectural protocol and the memory attribute protocol are wrapped, as both
+  update the hart's page table.
+
+**/
+VOID
+IoMmuTrackCpuPageTable (
+  VOID
+  );
+
+/**
+  Walk a first-stage page table for an IO virtual address, without changing it.
+
+  @param[in]   IoMmu             The IOMMU.
+  @param[in]   RootPageTable     The root of the page table.
+  @param[in]   IoVirtualAddress  The IO virtual address.
+  @param[out]  Entries           The entries walked, from the root, until a leaf or an invalid entry.
+
+  @return  The number of entries walked.
+
+**/
+UINTN
+IoMmuWalkPageTable (
+  IN  RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN  UINT64                *RootPageTable,
+  IN  UINT64                IoVirtualAddress,
+  OUT UINT64                *Entries
+  );
+
+/**
+  Determine whether the IOMMU marked the leaf that maps an IO virtual address as dirty.
+
+  @param[in]  IoMmu             The IOMMU.
+  @param[in]  RootPageTable     The root of the page table.
+  @param[in]  IoVirtualAddress  The IO virtual address.
+
+  @retval  TRUE   The leaf is dirty.
+  @retval  FALSE  The leaf is clean, or the address isn't mapped.
+
+**/
+BOOLEAN
+IoMmuIsPageDirty (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT64                *RootPageTable,
+  IN UINT64                IoVirtualAddress
+  );
+
+/**
+  Allocate a queue of up to a number of entries, and enable it.
+
+  @param[in]  IoMmu            The IOMMU, whose queue is off.
+  @param[in]  QueueStruct      Pointer to this queue's wrapping struct.
+  @param[in]  NumberOfEntries  The number of entries to allocate, rounded down to a power of two.
+
+  @retval  EFI_SUCCESS           The queue is enabled.
+  @retval  EFI_OUT_OF_RESOURCES  The queue has no buffer, and none could be allocated.
+  @retval  EFI_TIMEOUT           The queue did not turn on in time.
+
+**/
+EFI_STATUS
+IoMmuAllocateQueue (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN QUEUE_WRAPPER         *QueueStruct,
+  IN UINT32                NumberOfEntries
+  );
+
+/**
+  Remember the hart-local storage of the boot hart, so that the commands of other
+  harts are staged. Called on the boot hart.
+
+**/
+VOID
+IoMmuInitialiseCommandStaging (
+  VOID
+  );
+
+/**
+  Check the command queue for errors, and recover from them.
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @retval  EFI_SUCCESS       The command queue is operational, or was made to resume.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error, and was reset.
+
+**/
+EFI_STATUS
+IoMmuCheckCommandQueue (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  );
+
+/**
+  Write a command into the command queue, without notifying the IOMMU.
+
+  If the queue is full, the IOMMU is notified of the queued commands and
+  this waits until there is space.
+
+  @param[in]  IoMmu    The IOMMU.
+  @param[in]  Command  The command to write.
+
+  @retval  EFI_SUCCESS       The command was queued.
+  @retval  EFI_NOT_READY     The command queue is not enabled.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error.
+
+**/
+EFI_STATUS
+IoMmuQueueCommand (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN RISCV_IOMMU_COMMAND   *Command
+  );
+
+/**
+  Queue an IOTINVAL.VMA command.
+
+  @param[in]  IoMmu         The IOMMU.
+  @param[in]  PscidValid    Whether to only invalidate the translations tagged with Pscid.
+  @param[in]  Pscid         The process soft-context ID of a domain.
+  @param[in]  AddressValid  Whether to only invalidate the translations of Address.
+  @param[in]  Address       The IO virtual address to invalidate.
+
+  @retval  EFI_SUCCESS       The command was queued.
+  @retval  EFI_NOT_READY     The command queue is not enabled.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error.
+
+**/
+EFI_STATUS
+IoMmuQueueIoTlbInvalidation (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN BOOLEAN               PscidValid,
+  IN UINT32                Pscid,
+  IN BOOLEAN               AddressValid,
+  IN UINT64                Address
+  );
+
+/**
+  Queue the invalidation of the translations of a range of IO virtual addresses.
+
+  The range is only written as IOTINVAL.VMA commands once the commands are submitted,
+  coalesced with the adjacent ranges of the same PSCID and leaf size. Once more leaves
+  of a PSCID than PcdRiscVIoMmuInvalidationThreshold are pending, its ranges are traded
+  for a single command that invalidates the whole PSCID.
+
+  @param[in]  IoMmu      The IOMMU.
+  @param[in]  Pscid      The PSCID that the translations are tagged with.
+  @param[in]  Start      The first IO virtual address of the range, aligned to the leaf size.
+  @param[in]  End        The IO virtual address after the range, aligned to the leaf size.
+  @param[in]  LeafShift  The log2 of the size of the leaves that mapped the range.
+
+  @retval  EFI_SUCCESS       The invalidation was queued.
+  @retval  EFI_NOT_READY     The command queue is not enabled.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error.
+
+**/
+EFI_STATUS
+IoMmuQueueIoTlbRangeInvalidation (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT32                Pscid,
+  IN UINT64                Start,
+  IN UINT64                End,
+  IN UINT8                 LeafShift
+  );
+
+/**
+  Queue the invalidation of cached device contexts, as IODIR.INVAL_DDT.
+
+  A device_id that is already pending, or covered by a pending invalidation of the
+  whole directory, is not invalidated twice.
+
+  @param[in]  IoMmu          The IOMMU.
+  @param[in]  DeviceIdValid  Whether to only invalidate the context of DeviceId.
+  @param[in]  DeviceId       The device_id to invalidate.
+
+  @retval  EFI_SUCCESS       The invalidation was queued.
+  @retval  EFI_NOT_READY     The command queue is not enabled.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error.
+
+**/
+EFI_STATUS
+IoMmuQueueDeviceContextInvalidation (
+  IN RISCV_IOMMU_INSTANCE   *IoMmu,
+  IN BOOLEAN                DeviceIdValid,
+  IN RISCV_IOMMU_DEVICE_ID  DeviceId
+  );
+
+/**
+  Queue an ATS.INVAL command, invalidating a range in the ATC of a PCI function.
+
+  The range is widened to the naturally aligned power of two that covers it,
+  which is what an Invalidation Request message can encode.
+
+  @param[in]  IoMmu        The IOMMU.
+  @param[in]  Segment      The PCI segment of the function.
+  @param[in]  RequesterId  The RID of the function.
+  @param[in]  Address      The first IO virtual address to invalidate.
+  @param[in]  Length       The length of the range, or 0 to invalidate every translation.
+
+  @retval  EFI_SUCCESS       The command was queued.
+  @retval  EFI_NOT_READY     The command queue is not enabled.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error.
+
+**/
+EFI_STATUS
+IoMmuQueueAtsInvalidation (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT16                Segment,
+  IN UINT16                RequesterId,
+  IN UINT64                Address,
+  IN UINT64                Length
+  );
+
+/**
+  Queue an ATS.PRGR command, answering a page request group of a PCI function.
+
+  @param[in]  IoMmu         The IOMMU.
+  @param[in]  Segment       The PCI segment of the function.
+  @param[in]  RequesterId   The RID of the function.
+  @param[in]  PrgIndex      The index of the page request group.
+  @param[in]  ResponseCode  The V_RISCV_IOMMU_PRGR_* response code.
+
+  @retval  EFI_SUCCESS       The command was queued.
+  @retval  EFI_NOT_READY     The command queue is not enabled.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error.
+
+**/
+EFI_STATUS
+IoMmuQueuePageRequestResponse (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT16                Segment,
+  IN UINT16                RequesterId,
+  IN UINT16                PrgIndex,
+  IN UINT8                 ResponseCode
+  );
+
+/**
+  Complete all queued commands, with a single IOFENCE.C and doorbell write.
+
+  Inside a command batch, the commands are completed when the outermost
+  batch ends instead.
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @retval  EFI_SUCCESS       The commands completed, or were deferred to the end of the batch.
+  @retval  EFI_NOT_READY     The command queue is not enabled.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error.
+
+**/
+EFI_STATUS
+IoMmuSubmitCommands (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  );
+
+/**
+  Complete all queued commands now, even inside a command batch.
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @retval  EFI_SUCCESS       The commands completed.
+  @retval  EFI_NOT_READY     The command queue is not enabled.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error.
+
+**/
+EFI_STATUS
+IoMmuFenceCommands (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  );
+
+/**
+  Begin a batch of commands, so that they share one IOFENCE.C.
+
+  @param[in]  IoMmu  The IOMMU.
+
+**/
+VOID
+IoMmuBeginCommandBatch (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  );
+
+/**
+  End a batch of commands. The outermost batch submits the queued commands.
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @retval  EFI_SUCCESS       The commands completed.
+  @retval  EFI_NOT_READY     The command queue is not enabled.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error.
+
+**/
+EFI_STATUS
+IoMmuEndCommandBatch (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  );
+
+/**
+  End a batch of commands without waiting for them. The outermost batch writes
+  the IOFENCE.C and notifies the IOMMU, and the callback is called once it completes.
+
+  @param[in]  IoMmu     The IOMMU.
+  @param[in]  Callback  Called once the commands completed, at RISCV_IOMMU_TPL_LEVEL,
+                        or before this returns, if none were queued.
+  @param[in]  Context   Passed to the callback.
+
+  @retval  EFI_SUCCESS       The callback will be called.
+  @retval  EFI_NOT_READY     The command queue is not enabled. The callback won't be called.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error. The callback won't be called.
+
+**/
+EFI_STATUS
+IoMmuEndCommandBatchAsync (
+  IN RISCV_IOMMU_INSTANCE        *IoMmu,
+  IN RISCV_IOMMU_FENCE_CALLBACK  Callback,
+  IN VOID                        *Context
+  );
+
+/**
+  Record a live mapping.
+
+  @param[in]  MapInfo  The mapping.
+
+  @retval  EFI_SUCCESS           The mapping was recorded.
+  @retval  EFI_OUT_OF_RESOURCES  The database could not be grown.
+
+**/
+EFI_STATUS
+IoMmuInsertMapping (
+  IN MAP_INFO  *MapInfo
+  );
+
+/**
+  Look up a live mapping by its cookie.
+
+  @param[in]  Mapping  The mapping value returned from Map().
+
+  @return  The mapping, or NULL if Mapping is not a live mapping.
+
+**/
+MAP_INFO *
+IoMmuFindMapping (
+  IN VOID  *Mapping
+  );
+
+/**
+  Look up a live mapping by its device address.
+
+  If several mappings share the device address, any of them is returned.
+
+  @param[in]  DeviceAddress  The device address of the mapping.
+
+  @return  The mapping, or NULL if no live mapping has the device address.
+
+**/
+MAP_INFO *
+IoMmuFindMappingByDeviceAddress (
+  IN EFI_PHYSICAL_ADDRESS  DeviceAddress
+  );
+
+/**
+  Look up a live mapping of exactly a host range, for the same operation.
+
+  @param[in]  Operation      The operation of the mapping.
+  @param[in]  HostAddress    The host address of the mapping.
+  @param[in]  NumberOfBytes  The number of bytes of the mapping.
+
+  @return  The mapping, or NULL if no live mapping matches.
+
+**/
+MAP_INFO *
+IoMmuFindMappingByHostRange (
+  IN EDKII_IOMMU_OPERATION  Operation,
+  IN EFI_PHYSICAL_ADDRESS   HostAddress,
+  IN UINTN                  NumberOfBytes
+  );
+
+/**
+  Remove a live mapping from the database.
+
+  @param[in]  Mapping  The mapping value returned from Map().
+
+  @return  The removed mapping, or NULL if Mapping is not a live mapping.
+
+**/
+MAP_INFO *
+IoMmuRemoveMapping (
+  IN VOID  *Mapping
+  );
+
+/**
+  Count a mapping in the statistics of the device it is first granted to.
+
+  Called at RISCV_IOMMU_TPL_LEVEL.
+
+  @param[in]  Domain   The domain of the device.
+  @param[in]  MapInfo  The mapping.
+
+**/
+VOID
+IoMmuCountMapping (
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain,
+  IN CONST MAP_INFO             *MapInfo
+  );
+
+/**
+  Count an Unmap() in the statistics of the device that owned the mapping.
+
+  @param[in]  Domain     The domain of the device.
+  @param[in]  StartTime  The performance counter when Unmap() was called.
+
+**/
+VOID
+IoMmuCountUnmapping (
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain,
+  IN UINT64                     StartTime
+  );
+
+/**
+  Return the number of live mappings.
+
+  @return  The number of mappings in the database.
+
+**/
+UINTN
+IoMmuGetNumberOfMappings (
+  VOID
+  );
+
+/**
+  Claim the IOVA window, below 4 GiB and sized by PcdRiscVIoMmuIovaWindowSize.
+
+  @retval  EFI_SUCCESS           The window is claimed, or is disabled.
+  @retval  EFI_OUT_OF_RESOURCES  The window could not be claimed.
+
+**/
+EFI_STATUS
+IoMmuInitialiseIovaSpace (
+  VOID
+  );
+
+/**
+  Allocate a range of IOVA pages below 4 GiB.
+
+  A range of a superpage or more is placed congruently to its physical address
+  where the window allows, so that it can be mapped with superpage leaves.
+
+  @param[in]  NumberOfPages    The number of pages.
+  @param[in]  PhysicalAddress  The physical address that the range maps to.
+
+  @return  The IOVA of the range, or 0 if no range is free.
+
+**/
+EFI_PHYSICAL_ADDRESS
+IoMmuAllocateIova (
+  IN UINTN                 NumberOfPages,
+  IN EFI_PHYSICAL_ADDRESS  PhysicalAddress
+  );
+
+/**
+  Free a range of IOVA pages.
+
+  The device's translations of the range must be invalidated before it is freed.
+
+  @param[in]  Iova           The IOVA of the range, as returned by IoMmuAllocateIova().
+  @param[in]  NumberOfPages  The number of pages.
+
+**/
+VOID
+IoMmuFreeIova (
+  IN EFI_PHYSICAL_ADDRESS  Iova,
+  IN UINTN                 NumberOfPages
+  );
+
+/**
+  Return whether an address is in the IOVA window.
+
+  @param[in]  Address  The device address.
+
+  @retval  TRUE   The address is an IOVA.
+  @retval  FALSE  The address is not an IOVA.
+
+**/
+BOOLEAN
+IoMmuIsIova (
+  IN EFI_PHYSICAL_ADDRESS  Address
+  );
+
+/**
+  Release the buffers of a mapping, and return its MAP_INFO record to the slab.
+
+  @param[in]  MapInfo  The mapping.
+
+**/
+VOID
+IoMmuReleaseMapping (
+  IN MAP_INFO  *MapInfo
+  );
+
+/**
+  Unmap a persistent mapping from its owner, remove it, and release it.
+
+  @param[in]  MapInfo  The persistent mapping.
+
+  @retval  EFI_SUCCESS       The mapping is released, so no device can reach its buffer.
+  @retval  EFI_DEVICE_ERROR  The owner's translation could not be revoked. The mapping is kept.
+
+**/
+EFI_STATUS
+IoMmuDestroyPersistentMapping (
+  IN MAP_INFO  *MapInfo
+  );
+
+/**
+  Start caching freed buffers, if PcdRiscVIoMmuBufferCacheSize enables the cache.
+
+  The cache is flushed by the teardown at ExitBootServices(), so it needs that to be registered.
+
+  @retval  EFI_SUCCESS      The cache is ready, or is disabled.
+  @retval  EFI_UNSUPPORTED  The teardown isn't registered. Nothing is cached.
+
+**/
+EFI_STATUS
+IoMmuInitialiseBufferCache (
+  VOID
+  );
+
+/**
+  Keep a buffer that is being freed, with its persistent mapping and translation.
+
+  @param[in]  MapInfo     The persistent mapping of the buffer.
+  @param[in]  MemoryType  The memory type the buffer was allocated as.
+
+  @retval  TRUE   The buffer is cached, so the caller must not free it.
+  @retval  FALSE  The buffer isn't cacheable, or the cache is full.
+
+**/
+BOOLEAN
+IoMmuCacheBuffer (
+  IN MAP_INFO         *MapInfo,
+  IN EFI_MEMORY_TYPE  MemoryType
+  );
+
+/**
+  Take a cached buffer for an allocation.
+
+  @param[in]  MemoryType  The memory type of the allocation.
+  @param[in]  Pages       The number of pages of the allocation.
+  @param[in]  Limit       The highest address the buffer may reach.
+
+  @return  The persistent mapping of the buffer, or NULL if none matches.
+
+**/
+MAP_INFO *
+IoMmuTakeCachedBuffer (
+  IN EFI_MEMORY_TYPE       MemoryType,
+  IN UINTN                 Pages,
+  IN EFI_PHYSICAL_ADDRESS  Limit
+  );
+
+/**
+  Free every cached buffer, and revoke the translations that kept them warm.
+
+  The buffers that cannot be unmapped are leaked.
+
+**/
+VOID
+IoMmuFlushBufferCache (
+  VOID
+  );
+
+/**
+  Consume every record in the fault queue of an IOMMU.
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @return  The number of records consumed.
+
+**/
+UINTN
+IoMmuDrainFaultQueue (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  );
+
+/**
+  Consume every record in the fault queues of all initialised IOMMUs.
+
+  @return  The number of records consumed.
+
+**/
+UINTN
+IoMmuDrainFaultQueues (
+  VOID
+  );
+
+/**
+  Find an extended capability of a PCI function.
+
+  @param[in]  PciIo         The PCI I/O instance of the function.
+  @param[in]  CapabilityId  The ID of the capability.
+
+  @return  The offset of the capability, or 0 if the function has none.
+
+**/
+UINT16
+IoMmuFindExtendedCapability (
+  IN EFI_PCI_IO_PROTOCOL  *PciIo,
+  IN UINT16               CapabilityId
+  );
+
+/**
+  Enable ATS for a PCI function, if the IOMMU, its root complex and the function support it.
+
+  This is only attempted once per domain.
+
+  @param[in]  IoMmu        The IOMMU.
+  @param[in]  Domain       The domain of the function.
+  @param[in]  PciIo        The PCI I/O instance of the function.
+  @param[in]  Segment      The PCI segment of the function.
+  @param[in]  RequesterId  The RID of the function.
+  @param[in]  RouteFlags   The RISCV_IOMMU_ROUTE_* attributes of the function's route.
+
+**/
+VOID
+IoMmuEnableDeviceAts (
+  IN RISCV_IOMMU_INSTANCE       *IoMmu,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain,
+  IN EFI_PCI_IO_PROTOCOL        *PciIo,
+  IN UINT16                     Segment,
+  IN UINT16                     RequesterId,
+  IN UINT32                     RouteFlags
+  );
+
+/**
+  Invalidate a range in the ATC of a domain's function, after its IOTLB entries were invalidated.
+
+  The ATCs of the other functions of a group are invalidated as well.
+
+  @param[in]  IoMmu    The IOMMU.
+  @param[in]  Domain   The domain.
+  @param[in]  Address  The first IO virtual address to invalidate.
+  @param[in]  Length   The length of the range.
+
+  @retval  EFI_SUCCESS       The range is invalidated, or the function has no ATC.
+  @retval  EFI_DEVICE_ERROR  The IOMMU failed to invalidate the range.
+
+**/
+EFI_STATUS
+IoMmuInvalidateDeviceAts (
+  IN RISCV_IOMMU_INSTANCE       *IoMmu,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain,
+  IN UINT64                     Address,
+  IN UINT64                     Length
+  );
+
+/**
+  Queue the invalidation of every translation in the ATCs of an IOMMU's functions.
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @retval  EFI_SUCCESS       The invalidations were queued.
+  @retval  EFI_NOT_READY     The command queue is not enabled.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error.
+
+**/
+EFI_STATUS
+IoMmuQueueAllDeviceAtsInvalidations (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  );
+
+/**
+  Allow ATS in functions that support it. The teardown at ExitBootServices() disables it again,
+  so no ATC outlives the firmware's translations.
+
+  @retval  EFI_SUCCESS      ATS is allowed.
+  @retval  EFI_UNSUPPORTED  The teardown isn't registered. ATS stays disabled.
+
+**/
+EFI_STATUS
+IoMmuInitialiseDeviceAts (
+  VOID
+  );
+
+/**
+  Flush the ATCs and disable PRI and ATS, before boot services exit.
+
+  Within a command batch, the ATC invalidations complete with the batch.
+
+**/
+VOID
+IoMmuDisableDeviceAts (
+  VOID
+  );
+
+/**
+  Leave a granted range unmapped, to be mapped by the page requests of its function.
+
+  Only ranges of at least PcdRiscVIoMmuDemandMapThreshold bytes, that are not
+  persistent, are mapped on demand, and only in domains with PRI enabled.
+
+  @param[in]  MapInfo           The mapping the range belongs to.
+  @param[in]  Domain            The domain access is granted to, which becomes the owner.
+  @param[in]  IoVirtualAddress  The first IO virtual address of the range.
+  @param[in]  PhysicalAddress   The physical address that IoVirtualAddress maps to.
+  @param[in]  Length            The length of the range.
+  @param[in]  IoMmuAccess       The access granted.
+
+  @retval  TRUE   The range is recorded, and must not be mapped by the caller.
+  @retval  FALSE  The caller must map the range.
+
+**/
+BOOLEAN
+IoMmuDeferDemandMapping (
+  IN MAP_INFO                   *MapInfo,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain,
+  IN UINT64                     IoVirtualAddress,
+  IN EFI_PHYSICAL_ADDRESS       PhysicalAddress,
+  IN UINT64                     Length,
+  IN UINT64                     IoMmuAccess
+  );
+
+/**
+  Stop mapping the range of a mapping on demand, before it is unmapped or mapped in full.
+
+  Pages that were already requested stay mapped until the caller unmaps the range.
+
+  @param[in]  MapInfo  The mapping, whose owner's domain holds the range.
+
+**/
+VOID
+IoMmuForgetDemandMapping (
+  IN MAP_INFO  *MapInfo
+  );
+
+/**
+  Service every record in the page-request queue of an IOMMU.
+
+  The pages of all records are mapped, and the groups answered, with a single IOFENCE.C.
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @return  The number of records consumed.
+
+**/
+UINTN
+IoMmuDrainPageRequestQueue (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  );
+
+/**
+  Inhibit every counter of an IOMMU, and find the implemented event counters.
+
+  Unimplemented counters are read-only zero, and implemented ones may be
+  narrower than 64 bits, so both are probed by writing all ones.
+
+  @param[in]  IoMmu  The IOMMU, with its performance monitor in reset state.
+
+**/
+VOID
+IoMmuResetPerformanceMonitor (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  );
+
+/**
+  Verify that an IOMMU translates freshly programmed mappings, through its debug interface,
+  and measure its translation latencies, as PcdRiscVIoMmuTranslationTest asks for.
+
+  Nothing is tested without the debug interface or first-stage page tables.
+
+  @param[in]  IoMmu  The IOMMU, initialised but without domains.
+
+  @retval  EFI_SUCCESS           The translations are correct, or weren't tested.
+  @retval  EFI_DEVICE_ERROR      A translation is wrong, or the interface didn't respond.
+  @retval  EFI_OUT_OF_RESOURCES  The test mappings could not be built.
+
+**/
+EFI_STATUS
+IoMmuTestTranslation (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  );
+
+/**
+  Fold the pending overflows of the started counters of an IOMMU into their extensions.
+
+  Clearing the overflow bit of a counter clears its bit in IOCNTOVF.
+
+  @param[in]  IoMmu  The IOMMU.
+
+**/
+VOID
+IoMmuAccumulateHpmOverflows (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  );
+
+/**
+  Service the pending interrupts of an IOMMU, draining its fault queue if it has records,
+  and its page-request queue.
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @return  The number of fault records consumed.
+
+**/
+UINTN
+IoMmuServiceInterrupts (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  );
+
+/**
+  Poll a client periodically, change its period, or stop polling it.
+
+  A client that becomes polled, or whose period shortens, is first polled one
+  period from now. Otherwise its next poll is kept.
+
+  @param[in]  Client    The client.
+  @param[in]  Function  Called at RISCV_IOMMU_TPL_LEVEL each time the client is polled.
+  @param[in]  Period    The period, in units of 100 ns, or 0 to stop polling the client.
+
+  @retval  EFI_SUCCESS  The client is polled at the period, or not polled.
+  @retval  Others       The timer could not be created. The client is not polled.
+
+**/
+EFI_STATUS
+IoMmuSchedulePoll (
+  IN RISCV_IOMMU_POLL_CLIENT    Client,
+  IN RISCV_IOMMU_POLL_FUNCTION  Function,
+  IN UINT64                     Period
+  );
+
+/**
+  Start servicing the interrupts of the IOMMUs periodically.
+
+  @retval  EFI_SUCCESS  The interrupts are polled.
+  @retval  Others       The poll timer could not be created. Faults are only drained on demand.
+
+**/
+EFI_STATUS
+IoMmuInitialiseFaultReporting (
+  VOID
+  );
+
+/**
+  Service the interrupts of the IOMMUs more often, once a function waits on page requests.
+
+**/
+VOID
+IoMmuPollInterruptsFrequently (
+  VOID
+  );
+
+/**
+  Start the flush queue, if PcdRiscVIoMmuLazyInvalidation selects lazy invalidation.
+
+  @retval  EFI_SUCCESS  The flush queue is started, or invalidation is strict.
+  @retval  Others       The poll timer could not be created. Invalidation is strict.
+
+**/
+EFI_STATUS
+IoMmuInitialiseFlushQueue (
+  VOID
+  );
+
+/**
+  Return whether unmapped translations are invalidated lazily.
+
+  @retval  TRUE   Invalidations are deferred to the flush queue.
+  @retval  FALSE  Invalidations complete before SetAttribute() returns.
+
+**/
+BOOLEAN
+IoMmuInvalidatesLazily (
+  VOID
+  );
+
+/**
+  Park an unmapped mapping in the flush queue, until its translations are invalidated.
+
+  @param[in]  MapInfo  The mapping, whose leaves were cleared without invalidation.
+
+  @retval  EFI_SUCCESS       The mapping is parked, or the queue was flushed.
+  @retval  EFI_DEVICE_ERROR  A full queue could not be flushed.
+
+**/
+EFI_STATUS
+IoMmuDeferInvalidation (
+  IN MAP_INFO  *MapInfo
+  );
+
+/**
+  Defer releasing a mapping until its translations are invalidated.
+
+  @param[in]  MapInfo  The mapping, which was removed from the database.
+
+  @retval  TRUE   The flush queue releases the mapping.
+  @retval  FALSE  The mapping isn't parked, so the caller releases it.
+
+**/
+BOOLEAN
+IoMmuDeferRelease (
+  IN MAP_INFO  *MapInfo
+  );
+
+/**
+  Flush the parked mappings, if one overlaps a range that gains access.
+
+  A stale translation that already allows the new access is harmless.
+
+  @param[in]  DeviceAddress  The first device address of the range.
+  @param[in]  Length         The length of the range.
+  @param[in]  IoMmuAccess    The new access.
+
+  @retval  EFI_SUCCESS       No stale translation conflicts with the new access.
+  @retval  EFI_NOT_READY     A command batch is open, so the queue could not be flushed.
+  @retval  EFI_DEVICE_ERROR  The queue could not be flushed.
+
+**/
+EFI_STATUS
+IoMmuFlushOverlappingInvalidations (
+  IN EFI_PHYSICAL_ADDRESS  DeviceAddress,
+  IN UINT64                Length,
+  IN UINT64                IoMmuAccess
+  );
+
+/**
+  Invalidate the translations of all parked mappings, and release those that were unmapped.
+
+  @retval  EFI_SUCCESS       The queue is empty.
+  @retval  EFI_NOT_READY     A command batch is open, so the queue was not flushed.
+  @retval  EFI_DEVICE_ERROR  The IOMMU failed to invalidate the translations.
+
+**/
+EFI_STATUS
+IoMmuFlushDeferredInvalidations (
+  VOID
+  );
+
+/**
+  Start tracking PCI I/O installations, which invalidate cached devices.
+
+  @retval  EFI_SUCCESS           The cache is ready.
+  @retval  EFI_OUT_OF_RESOURCES  The notify event could not be created. Nothing is cached.
+
+**/
+EFI_STATUS
+IoMmuInitialiseDeviceCache (
+  VOID
+  );
+
+/**
+  Look up the IOMMU and domain that a device handle was resolved to.
+
+  @param[in]   DeviceHandle  The device handle.
+  @param[out]  IoMmu         The IOMMU that translates the device.
+
+  @return  The domain of the device, or NULL if the handle isn't cached.
+
+**/
+RISCV_IOMMU_DEVICE_DOMAIN *
+IoMmuLookupDeviceCache (
+  IN  EFI_HANDLE            DeviceHandle,
+  OUT RISCV_IOMMU_INSTANCE  **IoMmu
+  );
+
+/**
+  Remember the IOMMU and domain that a device handle was resolved to.
+
+  The entry replaces any other handle cached in its slot.
+
+  @param[in]  DeviceHandle  The device handle.
+  @param[in]  IoMmu         The IOMMU that translates the device.
+  @param[in]  Domain        The domain of the device.
+
+**/
+VOID
+IoMmuInsertDeviceCache (
+  IN EFI_HANDLE                 DeviceHandle,
+  IN RISCV_IOMMU_INSTANCE       *IoMmu,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain
+  );
+
+/**
+  Allocate the trace ring, publish it, and wrap the IOMMU protocol services,
+  if PcdRiscVIoMmuTraceEntries enables tracing.
+
+  Must be called before the protocol is installed.
+
+  @retval  EFI_SUCCESS           The services are traced, or tracing is disabled.
+  @retval  EFI_OUT_OF_RESOURCES  The ring could not be allocated. Nothing is traced.
+  @retval  Others                The ring could not be published. Nothing is traced.
+
+**/
+EFI_STATUS
+IoMmuInitialiseTrace (
+  VOID
+  );
+
+/**
+  Wrap the IOMMU and batch protocol services, so that their register accesses are
+  attributed to them, if PcdRiscVIoMmuMmioAccounting enables the accounting.
+
+  Must be called before the protocols are installed, and after the services are traced.
+
+**/
+VOID
+IoMmuInitialiseMmioAccounting (
+  VOID
+  );
+
+/**
+  Attribute the register accesses from now on to an operation, until IoMmuEndMmioOperation().
+
+  @param[in]  Operation  The operation.
+
+  @return  The operation that the accesses were attributed to, to pass to IoMmuEndMmioOperation().
+
+**/
+RISCV_IOMMU_MMIO_OPERATION
+IoMmuBeginMmioOperation (
+  IN RISCV_IOMMU_MMIO_OPERATION  Operation
+  );
+
+/**
+  Attribute the register accesses from now on to the operation that IoMmuBeginMmioOperation()
+  returned again.
+
+  @param[in]  Previous  The operation that IoMmuBeginMmioOperation() returned.
+
+**/
+VOID
+IoMmuEndMmioOperation (
+  IN RISCV_IOMMU_MMIO_OPERATION  Previous
+  );
+
+/**
+  Count register accesses for the current operation.
+
+  @param[in]  Reads   The registers read.
+  @param[in]  Writes  The registers written.
+
+**/
+VOID
+IoMmuCountMmioAccesses (
+  IN UINTN  Reads,
+  IN UINTN  Writes
+  );
+
+/**
+  Count a wait on a register for the current operation. Its reads are counted by the reads themselves.
+
+  @param[in]  Polls      The reads of the register while it was waited on.
+  @param[in]  StartTime  The performance counter when the wait started.
+
+**/
+VOID
+IoMmuCountMmioWait (
+  IN UINTN   Polls,
+  IN UINT64  StartTime
+  );
+
+/**
+  Report the register accesses of an operation.
+
+  @param[in]   Operation   The operation.
+  @param[out]  Statistics  The accesses.
+
+  @retval  EFI_SUCCESS            Statistics is filled in.
+  @retval  EFI_INVALID_PARAMETER  Operation is unknown.
+  @retval  EFI_UNSUPPORTED        PcdRiscVIoMmuMmioAccounting doesn't enable the accounting.
+
+**/
+EFI_STATUS
+IoMmuGetMmioStatistics (
+  IN  RISCV_IOMMU_MMIO_OPERATION   Operation,
+  OUT RISCV_IOMMU_MMIO_STATISTICS  *Statistics
+  );
+
+/**
+  Publish the state of the IOMMUs as a configuration table at ReadyToBoot, for an OS
+  driver to adopt, if PcdRiscVIoMmuExitBootServicesState keeps them running. The
+  teardown at ExitBootServices() refreshes it, so it needs that to be registered.
+
+  @retval  EFI_SUCCESS      The event is registered, or the IOMMUs are not kept running.
+  @retval  EFI_UNSUPPORTED  The teardown isn't registered. Nothing is handed off.
+  @retval  Others           The event could not be created. Nothing is handed off.
+
+**/
+EFI_STATUS
+IoMmuInitialiseOsHandOff (
+  VOID
+  );
+
+/**
+  Refill the hand-off table with the state the OS inherits, as the IOMMUs are kept running
+  at ExitBootServices().
+
+**/
+VOID
+IoMmuRefreshOsHandOff (
+  VOID
+  );
+
+/**
+  Register the teardown that runs before boot services exit. It leaves every IOMMU in
+  the state that PcdRiscVIoMmuExitBootServicesState selects, in one step per IOMMU.
+
+  Must be called before the subsystems whose state it tears down are initialised.
+
+  @retval  EFI_SUCCESS  The exit event is registered.
+  @retval  Others       The exit event could not be created. The IOMMUs are left as they are.
+
+**/
+EFI_STATUS
+IoMmuInitialiseExitBootServices (
+  VOID
+  );
+
+/**
+  Recompute the top of IOMMU addressable memory based on
+  the IOMMUs' IO paging modes and GXL bits, once IOMMUs are initialised.
+
+  Buffers may be used by devices behind any IOMMU, so one initialised
+  IOMMU with GXL set limits all of them to 4 GiB.
+
+**/
+VOID
+IoMmuUpdateDmaMemoryTop (
+  VOID
+  );
+
+/**
+  Returns the top of IOMMU addressable memory, as last computed
+  by IoMmuUpdateDmaMemoryTop().
+
+**/
+UINT64
+RiscVGetIoMmuMemoryTop (
+  VOID
+  );
+
+/**
+  Reserve the bounce-buffer pool, below the top of IOMMU-addressable memory and 4 GiB.
+
+  The pool is sized by PcdRiscVIoMmuBouncePoolSize, and split evenly between the classes.
+
+  @retval  EFI_SUCCESS           The pool is reserved, or is disabled.
+  @retval  EFI_OUT_OF_RESOURCES  The pool could not be reserved.
+
+**/
+EFI_STATUS
+IoMmuInitialiseBouncePool (
+  VOID
+  );
 
-  BOOLEAN          IoMmuIsPciDevice;
-  UINT64           Address;
+/**
+  Take a bounce buffer from the pool.
 
-  CONTEXT_WRAPPER  DeviceContext;
+  @param[in]  NumberOfPages  The number of pages needed.
+  @param[in]  MaxAddress     The highest address the buffer may end at.
 
-  QUEUE_WRAPPER    CommandQueue;
-  QUEUE_WRAPPER    FaultQueue;
-  QUEUE_WRAPPER    PageRequestQueue;
-} RISCV_IOMMU_GLOBAL_DRIVER_CONTEXT;
+  @return  The address of the buffer, or 0 if the pool cannot serve the request.
 
-extern RISCV_IOMMU_GLOBAL_DRIVER_CONTEXT  mRiscVIoMmuGlobalDriverContext;
-extern EDKII_IOMMU_PROTOCOL               mRiscVIoMmuProtocol;
+**/
+EFI_PHYSICAL_ADDRESS
+IoMmuAllocateBounceBuffer (
+  IN UINTN                 NumberOfPages,
+  IN EFI_PHYSICAL_ADDRESS  MaxAddress
+  );
 
 /**
-  Detect a RISC-V IOMMU device.
+  Return a bounce buffer to the pool.
 
-  @retval  EFI_SUCCESS    An IOMMU was detected.
-  @retval  EFI_NOT_FOUND  No IOMMU could be detected.
+  @param[in]  Address  The address of the buffer.
+
+  @retval  TRUE   The buffer was returned to the pool.
+  @retval  FALSE  The buffer is not part of the pool.
 
 **/
-VOID
-DetectRiscVIoMmus (
-  VOID
+BOOLEAN
+IoMmuFreeBounceBuffer (
+  IN EFI_PHYSICAL_ADDRESS  Address
   );
 
 /**
-  Initialisation worker function.
+  Report the size of the bounce-buffer pool, and how much of it is free.
+
+  @param[out]  NumberOfPages  The pages of the pool.
+  @param[out]  FreePages      The pages of the free buffers.
 
 **/
-EFI_STATUS
-IoMmuCommonInitialise (
-  VOID
+VOID
+IoMmuGetBouncePoolUsage (
+  OUT UINTN  *NumberOfPages,
+  OUT UINTN  *FreePages
   );
 
 /**
@@ -127,6 +2987,42 @@ IoMmuSetAttribute (
   IN UINT64                IoMmuAccess
   );
 
+/**
+  Find the IOMMU that translates a device, and its domain, resolving and caching them on first use.
+
+  @param[in]   DeviceHandle  The device handle.
+  @param[out]  IoMmu         The IOMMU that translates the device.
+  @param[out]  Domain        The domain of the device.
+
+  @retval  EFI_SUCCESS            The device is translated by the IOMMU.
+  @retval  EFI_INVALID_PARAMETER  DeviceHandle has no device path.
+  @retval  EFI_UNSUPPORTED        The device isn't a platform device or PCI function routed to an initialised IOMMU.
+  @retval  Others                 The device context could not be created.
+
+**/
+EFI_STATUS
+IoMmuResolveDevice (
+  IN  EFI_HANDLE                 DeviceHandle,
+  OUT RISCV_IOMMU_INSTANCE       **IoMmu,
+  OUT RISCV_IOMMU_DEVICE_DOMAIN  **Domain
+  );
+
+/**
+  Determine the highest device address that a device can reach, from the window of its
+  domain and from whether its driver enabled dual address cycles.
+
+  @param[in]  DeviceHandle  The device handle.
+  @param[in]  Domain        The domain of the device.
+
+  @return  The highest device address that the device can reach.
+
+**/
+UINT64
+IoMmuGetDeviceDmaLimit (
+  IN EFI_HANDLE                 DeviceHandle,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain
+  );
+
 /**
   Provides the controller-specific addresses required to access system memory from a
   DMA bus master.
@@ -226,88 +3122,444 @@ IoMmuFreeBuffer (
   IN  VOID                                     *HostAddress
   );
 
+/**
+  Map every buffer of a scatter-gather list for a device, and grant the device access to them,
+  as Map() and SetAttribute() of the IOMMU protocol do for each.
+
+  The list is mapped as a whole: if a buffer cannot be mapped, the ones before it are
+  unmapped again, and no entry holds a mapping on return.
+
+  @param[in]      This             The protocol instance pointer.
+  @param[in]      DeviceHandle     The device that does the DMA.
+  @param[in]      Operation        Indicates if the bus master is going to read or write to system memory.
+  @param[in]      IoMmuAccess      The IOMMU access to grant to every buffer.
+  @param[in]      NumberOfEntries  The number of buffers of the list.
+  @param[in, out] Entries          The buffers of the list.
+
+  @retval EFI_SUCCESS            Every buffer was mapped for its returned NumberOfBytes.
+  @retval EFI_INVALID_PARAMETER  One or more parameters are invalid.
+  @retval EFI_UNSUPPORTED        DeviceHandle is unknown by the IOMMU, or a buffer cannot be mapped.
+  @retval EFI_OUT_OF_RESOURCES   The request could not be completed due to a lack of resources.
+  @retval EFI_DEVICE_ERROR       The IOMMU device reported an error while attempting the operation.
+
+**/
+EFI_STATUS
+EFIAPI
+IoMmuMapMultiple (
+  IN     EDKII_IOMMU_BATCH_PROTOCOL  *This,
+  IN     EFI_HANDLE                  DeviceHandle,
+  IN     EDKII_IOMMU_OPERATION       Operation,
+  IN     UINT64                      IoMmuAccess,
+  IN     UINTN                       NumberOfEntries,
+  IN OUT EDKII_IOMMU_BATCH_ENTRY     *Entries
+  );
+
+/**
+  Revoke the access of a device to every buffer of a scatter-gather list, and unmap them,
+  as SetAttribute() with no access and Unmap() of the IOMMU protocol do for each.
+
+  Every entry is unmapped, even if one fails.
+
+  @param[in]  This             The protocol instance pointer.
+  @param[in]  DeviceHandle     The device that did the DMA.
+  @param[in]  NumberOfEntries  The number of buffers of the list.
+  @param[in]  Entries          The buffers of the list, as returned by MapMultiple().
+
+  @retval EFI_SUCCESS            Every buffer was unmapped.
+  @retval EFI_INVALID_PARAMETER  One or more parameters are invalid.
+  @retval EFI_DEVICE_ERROR       The IOMMU device reported an error while attempting the operation.
+
+**/
+EFI_STATUS
+EFIAPI
+IoMmuUnmapMultiple (
+  IN EDKII_IOMMU_BATCH_PROTOCOL  *This,
+  IN EFI_HANDLE                  DeviceHandle,
+  IN UINTN                       NumberOfEntries,
+  IN EDKII_IOMMU_BATCH_ENTRY     *Entries
+  );
+
+/**
+  Map the buffers of a scatter-gather list for a device at one contiguous range of
+  device addresses, in the order of the list, and grant the device access to it.
+
+  The buffers are mapped in place. Since the device sees them page by page, every buffer
+  but the first must start on a page boundary, and every buffer but the last must end on one.
+  The device address of each buffer within the range is returned in its entry.
+
+  @param[in]      This             The protocol instance pointer.
+  @param[in]      DeviceHandle     The device that does the DMA.
+  @param[in]      Operation        Indicates if the bus master is going to read or write to system memory.
+  @param[in]      IoMmuAccess      The IOMMU access to grant to the range.
+  @param[in]      NumberOfEntries  The number of buffers of the list.
+  @param[in, out] Entries          The buffers of the list.
+  @param[out]     DeviceAddress    The device address of the first byte of the first buffer.
+  @param[out]     Mapping          A resulting value to pass to UnmapContiguous().
+
+  @retval EFI_SUCCESS            The list was mapped at one contiguous range.
+  @retval EFI_INVALID_PARAMETER  One or more parameters are invalid, or a buffer is not page-aligned
+                                 where the range continues.
+  @retval EFI_UNSUPPORTED        DeviceHandle is unknown by the IOMMU, or its DMA is not translated.
+  @retval EFI_OUT_OF_RESOURCES   No contiguous range of device addresses is free.
+  @retval EFI_DEVICE_ERROR       The IOMMU device reported an error while attempting the operation.
+
+**/
+EFI_STATUS
+EFIAPI
+IoMmuMapContiguous (
+  IN     EDKII_IOMMU_BATCH_PROTOCOL  *This,
+  IN     EFI_HANDLE                  DeviceHandle,
+  IN     EDKII_IOMMU_OPERATION       Operation,
+  IN     UINT64                      IoMmuAccess,
+  IN     UINTN                       NumberOfEntries,
+  IN OUT EDKII_IOMMU_BATCH_ENTRY     *Entries,
+  OUT    EFI_PHYSICAL_ADDRESS        *DeviceAddress,
+  OUT    VOID                        **Mapping
+  );
+
+/**
+  Revoke the access of the device to a range mapped by MapContiguous(), and unmap it.
+
+  @param[in]  This     The protocol instance pointer.
+  @param[in]  Mapping  The mapping value returned from MapContiguous().
+
+  @retval EFI_SUCCESS            The range was unmapped.
+  @retval EFI_INVALID_PARAMETER  Mapping is not a value that was returned by MapContiguous().
+  @retval EFI_DEVICE_ERROR       The IOMMU device reported an error while attempting the operation.
+                                 The range is still mapped.
+
+**/
+EFI_STATUS
+EFIAPI
+IoMmuUnmapContiguous (
+  IN EDKII_IOMMU_BATCH_PROTOCOL  *This,
+  IN VOID                        *Mapping
+  );
+
+/**
+  Map every buffer of a scatter-gather list for a device, and grant the device access to them,
+  as MapMultiple() does, but return without waiting for the IOMMU to complete the change.
+
+  @param[in]      This             The protocol instance pointer.
+  @param[in]      DeviceHandle     The device that does the DMA.
+  @param[in]      Operation        Indicates if the bus master is going to read or write to system memory.
+  @param[in]      IoMmuAccess      The IOMMU access to grant to every buffer.
+  @param[in]      NumberOfEntries  The number of buffers of the list.
+  @param[in, out] Entries          The buffers of the list.
+  @param[in, out] Token            The token to signal once the buffers may be accessed.
+
+  @retval EFI_SUCCESS            Every buffer was mapped, and the token will be signalled.
+  @retval EFI_INVALID_PARAMETER  One or more parameters are invalid.
+  @retval EFI_UNSUPPORTED        DeviceHandle is unknown by the IOMMU, or a buffer cannot be mapped.
+  @retval EFI_OUT_OF_RESOURCES   The request could not be completed due to a lack of resources.
+  @retval EFI_DEVICE_ERROR       The IOMMU device reported an error while attempting the operation.
+
+**/
+EFI_STATUS
+EFIAPI
+IoMmuMapMultipleAsync (
+  IN     EDKII_IOMMU_BATCH_PROTOCOL  *This,
+  IN     EFI_HANDLE                  DeviceHandle,
+  IN     EDKII_IOMMU_OPERATION       Operation,
+  IN     UINT64                      IoMmuAccess,
+  IN     UINTN                       NumberOfEntries,
+  IN OUT EDKII_IOMMU_BATCH_ENTRY     *Entries,
+  IN OUT EDKII_IOMMU_BATCH_TOKEN     *Token
+  );
+
+/**
+  Revoke the access of a device to every buffer of a scatter-gather list, and unmap them,
+  as UnmapMultiple() does, but return without waiting for the IOMMU to complete the change.
+
+  @param[in]      This             The protocol instance pointer.
+  @param[in]      DeviceHandle     The device that did the DMA.
+  @param[in]      NumberOfEntries  The number of buffers of the list.
+  @param[in]      Entries          The buffers of the list.
+  @param[in, out] Token            The token to signal once the buffers are unmapped.
+
+  @retval EFI_SUCCESS            The buffers will be unmapped, and the token will be signalled.
+  @retval EFI_INVALID_PARAMETER  One or more parameters are invalid.
+  @retval EFI_OUT_OF_RESOURCES   The request could not be queued. Nothing was unmapped.
+  @retval EFI_DEVICE_ERROR       The IOMMU device reported an error while attempting the operation.
+                                 The buffers were unmapped, and the token is not signalled.
+
+**/
+EFI_STATUS
+EFIAPI
+IoMmuUnmapMultipleAsync (
+  IN     EDKII_IOMMU_BATCH_PROTOCOL  *This,
+  IN     EFI_HANDLE                  DeviceHandle,
+  IN     UINTN                       NumberOfEntries,
+  IN     EDKII_IOMMU_BATCH_ENTRY     *Entries,
+  IN OUT EDKII_IOMMU_BATCH_TOKEN     *Token
+  );
+
 /**
   Read a 32-bit IOMMU register.
 
+  @param[in]  IoMmu   The IOMMU.
   @param[in]  Offset  The register offset to read.
   @ret        The value read from the register.
 
 **/
 UINT32
 IoMmuRead32 (
-  IN UINTN  Offset
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINTN                 Offset
   );
 
 /**
   Write a 32-bit IOMMU register.
 
+  @param[in]  IoMmu   The IOMMU.
   @param[in]  Offset  The register offset to write.
   @param[in]  Value   The value to write to the register.
 
 **/
 VOID
 IoMmuWrite32 (
-  IN UINTN   Offset,
-  IN UINT32  Value
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINTN                 Offset,
+  IN UINT32                Value
+  );
+
+/**
+  Read a 32-bit IOMMU register, ordered before the later memory accesses of the hart.
+
+  @param[in]  IoMmu   The IOMMU.
+  @param[in]  Offset  The register offset to read.
+  @ret        The value read from the register.
+
+**/
+UINT32
+IoMmuReadAcquire32 (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINTN                 Offset
+  );
+
+/**
+  Write a 32-bit IOMMU register, ordered after the earlier memory accesses of the hart.
+
+  @param[in]  IoMmu   The IOMMU.
+  @param[in]  Offset  The register offset to write.
+  @param[in]  Value   The value to write to the register.
+
+**/
+VOID
+IoMmuWriteRelease32 (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINTN                 Offset,
+  IN UINT32                Value
+  );
+
+/**
+  Start waiting on the IOMMU.
+
+  @param[out]  Wait  The state of the wait.
+
+**/
+VOID
+IoMmuStartWait (
+  OUT RISCV_IOMMU_WAIT  *Wait
+  );
+
+/**
+  Continue waiting on the IOMMU, after a condition was checked and not met.
+
+  The first calls only spin, later calls delay for exponentially longer.
+
+  @param[in, out]  Wait  The state of the wait.
+
+  @retval  EFI_SUCCESS  The condition may be checked again.
+  @retval  EFI_TIMEOUT  The wait has timed out.
+
+**/
+EFI_STATUS
+IoMmuContinueWait (
+  IN OUT RISCV_IOMMU_WAIT  *Wait
+  );
+
+/**
+  Finish waiting on the IOMMU, whether its condition was met or the wait timed out,
+  and account the time it was blocked.
+
+  @param[in]  Wait  The state of the wait.
+
+**/
+VOID
+IoMmuEndWait (
+  IN RISCV_IOMMU_WAIT  *Wait
+  );
+
+/**
+  Add to a count, which harts may add to at once.
+
+  @param[in, out]  Count  The count.
+  @param[in]       Value  What to add.
+
+**/
+VOID
+IoMmuAddToCount (
+  IN OUT UINT64  *Count,
+  IN     UINT64  Value
   );
 
 /**
   Write a 32-bit IOMMU register and wait for a mask to be set/unset.
 
+  @param[in]  IoMmu   The IOMMU.
   @param[in]  Offset  The register offset to write.
   @param[in]  Value   The value to write to the register.
   @param[in]  Mask    The bitmask to wait for.
   @param[in]  Set     Whether the mask should be set or unset.
 
+  @retval  EFI_SUCCESS  The mask reached the expected state.
+  @retval  EFI_TIMEOUT  The mask did not reach the expected state in time.
+
 **/
-VOID
+EFI_STATUS
 IoMmuWriteAndWait32 (
-  IN UINTN    Offset,
-  IN UINT32   Value,
-  IN UINT32   Mask,
-  IN BOOLEAN  Set
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINTN                 Offset,
+  IN UINT32                Value,
+  IN UINT32                Mask,
+  IN BOOLEAN               Set
+  );
+
+/**
+  Wait for a mask of a 32-bit IOMMU register to be set/unset, after it was written.
+
+  @param[in]  IoMmu   The IOMMU.
+  @param[in]  Offset  The register offset to poll.
+  @param[in]  Mask    The bitmask to wait for.
+  @param[in]  Set     Whether the mask should be set or unset.
+
+  @retval  EFI_SUCCESS  The mask reached the expected state.
+  @retval  EFI_TIMEOUT  The mask did not reach the expected state in time.
+
+**/
+EFI_STATUS
+IoMmuWait32 (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINTN                 Offset,
+  IN UINT32                Mask,
+  IN BOOLEAN               Set
   );
 
 /**
   Read a 64-bit IOMMU register.
 
+  @param[in]  IoMmu   The IOMMU.
   @param[in]  Offset  The register offset to read.
   @ret        The value read from the register.
 
 **/
 UINT64
 IoMmuRead64 (
-  IN UINTN  Offset
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINTN                 Offset
   );
 
 /**
   Write a 64-bit IOMMU register.
 
+  @param[in]  IoMmu   The IOMMU.
   @param[in]  Offset  The register offset to write.
   @param[in]  Value   The value to write to the register.
 
 **/
 VOID
 IoMmuWrite64 (
-  IN UINTN   Offset,
-  IN UINT64  Value
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINTN                 Offset,
+  IN UINT64                Value
   );
 
 /**
   Write a 64-bit IOMMU register and wait for a mask to be set/unset.
 
+  @param[in]  IoMmu   The IOMMU.
   @param[in]  Offset  The register offset to write.
   @param[in]  Value   The value to write to the register.
   @param[in]  Mask    The bitmask to wait for.
   @param[in]  Set     Whether the mask should be set or unset.
 
+  @retval  EFI_SUCCESS  The mask reached the expected state.
+  @retval  EFI_TIMEOUT  The mask did not reach the expected state in time.
+
 **/
-VOID
+EFI_STATUS
 IoMmuWriteAndWait64 (
-  IN UINTN    Offset,
-  IN UINT64   Value,
-  IN UINT64   Mask,
-  IN BOOLEAN  Set
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINTN                 Offset,
+  IN UINT64                Value,
+  IN UINT64                Mask,
+  IN BOOLEAN               Set
+  );
+
+/**
+  Wait for a mask of a 64-bit IOMMU register to be set/unset, after it was written.
+
+  @param[in]  IoMmu   The IOMMU.
+  @param[in]  Offset  The register offset to poll.
+  @param[in]  Mask    The bitmask to wait for.
+  @param[in]  Set     Whether the mask should be set or unset.
+
+  @retval  EFI_SUCCESS  The mask reached the expected state.
+  @retval  EFI_TIMEOUT  The mask did not reach the expected state in time.
+
+**/
+EFI_STATUS
+IoMmuWait64 (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINTN                 Offset,
+  IN UINT64                Mask,
+  IN BOOLEAN               Set
+  );
+
+/**
+  Build the MSI page table of an IOMMU that supports flat MSI translation,
+  if the platform has an S-level IMSIC window.
+
+  @param[in]  IoMmu  The IOMMU, whose device contexts are extended.
+
+  @retval  EFI_SUCCESS           The MSI page table is built.
+  @retval  EFI_UNSUPPORTED       The IOMMU or the platform doesn't support MSI translation.
+  @retval  EFI_OUT_OF_RESOURCES  The table could not be allocated.
+
+**/
+EFI_STATUS
+IoMmuInitialiseMsiTranslation (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  );
+
+/**
+  Point an extended device context at the MSI page table of its IOMMU.
+
+  @param[in]  IoMmu          The IOMMU.
+  @param[in]  DeviceContext  The extended device context.
+
+**/
+VOID
+IoMmuSetDeviceContextMsiTranslation (
+  IN RISCV_IOMMU_INSTANCE                 *IoMmu,
+  IN RISCV_IOMMU_EXTENDED_DEVICE_CONTEXT  *DeviceContext
+  );
+
+/**
+  Map the IMSIC window at its own address into the IO page table of a domain.
+
+  @param[in]  IoMmu   The IOMMU.
+  @param[in]  Domain  The domain, with a page table.
+
+  @retval  EFI_SUCCESS  The window is mapped, or the IOMMU doesn't translate MSIs.
+  @retval  Others       The page table could not be updated.
+
+**/
+EFI_STATUS
+IoMmuMapMsiWindow (
+  IN RISCV_IOMMU_INSTANCE       *IoMmu,
+  IN RISCV_IOMMU_DEVICE_DOMAIN  *Domain
   );
 
 UINT64
@@ -315,4 +3567,92 @@ RiscVGetSupervisorStatusRegister (
   VOID
   );
 
+#if !defined (MDE_CPU_RISCV64)
+
+//
+// BaseLib only declares the hart routines for RISC-V. Host-based tests take them from the IOMMU model.
+//
+UINT64
+RiscVGetSupervisorAddressTranslationRegister (
+  VOID
+  );
+
+UINT64
+RiscVReadTimer (
+  VOID
+  );
+
+VOID
+EFIAPI
+RiscVCpuCacheFlushCmoAsm (
+  IN UINTN
+  );
+
+VOID
+EFIAPI
+RiscVCpuCacheCleanCmoAsm (
+  IN UINTN
+  );
+
+VOID
+EFIAPI
+RiscVCpuCacheInvalCmoAsm (
+  IN UINTN
+  );
+
+#endif
+
+/**
+  Zero the cache block at an address with cbo.zero. The hart must implement Zicboz.
+
+  @param[in]  Address  The address of the block.
+
+**/
+VOID
+RiscVCacheBlockZero (
+  IN UINTN  Address
+  );
+
+/**
+  Wait with wrs.sto until the 32-bit word at an address may no longer hold a value,
+  or for a short while. The hart must implement Zawrs.
+
+  @param[in]  Address  The address of the word.
+  @param[in]  Value    The value the word held.
+
+**/
+VOID
+RiscVWaitOnWord (
+  IN volatile UINT32  *Address,
+  IN UINT32           Value
+  );
+
+/**
+  Read a 32-bit MMIO register, followed by fence i,rw, so that the later memory
+  accesses of the hart are ordered after it.
+
+  @param[in]  Address  The address of the register.
+
+  @return  The value read.
+
+**/
+UINT32
+RiscVMmioReadAcquire32 (
+  IN UINTN  Address
+  );
+
+/**
+  Write a 32-bit MMIO register, preceded by fence rw,o, so that it is ordered
+  after the earlier memory accesses and cache-block operations of the hart.
+
+  @param[in]  Address  The address of the register.
+  @param[in]  Value    The value to write.
+
+**/
+VOID
+RiscVMmioWriteRelease32 (
+  IN UINTN   Address,
+  IN UINT32  Value
+  );
+
 #endif
@@ -12,6 +12,8 @@
 #include <Library/DebugLib.h>
 #include <Library/FdtLib.h>
 #include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
+#include <Library/PerformanceLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Protocol/Cpu.h>
 #include <Register/RiscV64/RiscVImpl.h>
@@ -20,26 +22,92 @@
 RISCV_IOMMU_GLOBAL_DRIVER_CONTEXT  mRiscVIoMmuGlobalDriverContext = {
   .DriverState = STATE_INIT,
 
-  .CommandQueue = {
-    .Type      = QUEUE_COMMAND,
-    .EntrySize = COMMAND_QUEUE_ENTRY_SIZE,
-    .Buffer    = NULL,
-  },
-  .FaultQueue = {
-    .Type      = QUEUE_FAULT,
-    .EntrySize = FAULT_QUEUE_ENTRY_SIZE,
-    .Buffer    = NULL,
-  },
-  .PageRequestQueue = {
-    .Type      = QUEUE_PAGE_REQUEST,
-    .EntrySize = PAGE_REQUEST_QUEUE_ENTRY_SIZE,
-    .Buffer    = NULL,
-  },
+  .InstanceList       = INITIALIZE_LIST_HEAD_VARIABLE (mRiscVIoMmuGlobalDriverContext.InstanceList),
+  .TranslationEnabled = TRUE,
 };
 
+/**
+  Create the instance of a discovered IOMMU, and add it to the driver context.
+
+  @param[in]  IoMmuIsPciDevice  Whether the IOMMU is a PCI function.
+  @param[in]  Address           The base address of the registers, or 0 if not known yet.
+  @param[in]  State             The detection state of the IOMMU.
+
+  @return  The instance, or NULL if it could not be allocated.
+
+**/
+RISCV_IOMMU_INSTANCE *
+IoMmuCreateInstance (
+  IN BOOLEAN  IoMmuIsPciDevice,
+  IN UINT64   Address,
+  IN UINT8    State
+  )
+{
+  RISCV_IOMMU_INSTANCE  *IoMmu;
+
+  IoMmu = AllocateZeroPool (sizeof (RISCV_IOMMU_INSTANCE));
+  if (IoMmu == NULL) {
+    return NULL;
+  }
+
+  IoMmu->Signature        = RISCV_IOMMU_INSTANCE_SIGNATURE;
+  IoMmu->State            = State;
+  IoMmu->IoMmuIsPciDevice = IoMmuIsPciDevice;
+  IoMmu->Address          = Address;
+
+  IoMmu->CommandQueue.Type          = QUEUE_COMMAND;
+  IoMmu->CommandQueue.EntrySize     = COMMAND_QUEUE_ENTRY_SIZE;
+  IoMmu->FaultQueue.Type            = QUEUE_FAULT;
+  IoMmu->FaultQueue.EntrySize       = FAULT_QUEUE_ENTRY_SIZE;
+  IoMmu->PageRequestQueue.Type      = QUEUE_PAGE_REQUEST;
+  IoMmu->PageRequestQueue.EntrySize = PAGE_REQUEST_QUEUE_ENTRY_SIZE;
+
+  InitializeListHead (&IoMmu->DomainList);
+  IoMmu->NextPscid = RISCV_IOMMU_SCRATCH_PSCID + 1;
+
+  InsertTailList (&mRiscVIoMmuGlobalDriverContext.InstanceList, &IoMmu->Link);
+  mRiscVIoMmuGlobalDriverContext.NumberOfInstances++;
+  if (State > mRiscVIoMmuGlobalDriverContext.DriverState) {
+    mRiscVIoMmuGlobalDriverContext.DriverState = State;
+  }
+
+  return IoMmu;
+}
+
+/**
+  Find an initialised IOMMU by its index, in the order the IOMMUs were discovered.
+
+  @param[in]  Index  The index of the IOMMU among the initialised ones, from 0.
+
+  @return  The IOMMU, or NULL if there are fewer initialised IOMMUs.
+
+**/
+RISCV_IOMMU_INSTANCE *
+IoMmuGetInstance (
+  IN UINTN  Index
+  )
+{
+  LIST_ENTRY            *Link;
+  RISCV_IOMMU_INSTANCE  *IoMmu;
+
+  for (Link = GetFirstNode (&mRiscVIoMmuGlobalDriverContext.InstanceList)
+       ; !IsNull (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ; Link = GetNextNode (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ) {
+    IoMmu = RISCV_IOMMU_INSTANCE_FROM_LINK (Link);
+    if ((IoMmu->State == STATE_INITIALISED) && (Index-- == 0)) {
+      return IoMmu;
+    }
+  }
+
+  return NULL;
+}
+
 /**
   Determine if the IOMMU is in a reset state.
 
+  @param[in]  IoMmu  The IOMMU.
+
   @retval TRUE   The IOMMU is reset.
   @retval FALSE  The IOMMU is active.
 
@@ -47,41 +115,51 @@ RISCV_IOMMU_GLOBAL_DRIVER_CONTEXT  mRiscVIoMmuGlobalDriverContext = {
 STATIC
 BOOLEAN
 IoMmuIsReset (
-  VOID
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
   )
 {
   RISCV_IOMMU_SOFTWARE_REQUEST_QUEUE_CSR  SoftwareReqQueueCsr;
   RISCV_IOMMU_HARDWARE_REQUEST_QUEUE_CSR  HardwareReqQueueCsr;
+  RISCV_IOMMU_CAPABILITIES                Capabilities;
+  RISCV_IOMMU_TR_REQ_CTL                  TranslationReqCtl;
   RISCV_IOMMU_DDTP                        Ddtp;
   RISCV_IOMMU_IPSR                        Ipsr;
 
-  SoftwareReqQueueCsr.Uint32 = IoMmuRead32 (R_RISCV_IOMMU_CQCSR);
+  SoftwareReqQueueCsr.Uint32 = IoMmuRead32 (IoMmu, R_RISCV_IOMMU_CQCSR);
   if (SoftwareReqQueueCsr.Bits.qen || SoftwareReqQueueCsr.Bits.ie || SoftwareReqQueueCsr.Bits.qon ||
       SoftwareReqQueueCsr.Bits.busy) {
     return FALSE;
   }
 
-  HardwareReqQueueCsr.Uint32 = IoMmuRead32 (R_RISCV_IOMMU_FQCSR);
+  HardwareReqQueueCsr.Uint32 = IoMmuRead32 (IoMmu, R_RISCV_IOMMU_FQCSR);
   if (HardwareReqQueueCsr.Bits.qen || HardwareReqQueueCsr.Bits.ie || HardwareReqQueueCsr.Bits.qon ||
       HardwareReqQueueCsr.Bits.busy) {
     return FALSE;
   }
 
-  HardwareReqQueueCsr.Uint32 = IoMmuRead32 (R_RISCV_IOMMU_PQCSR);
+  HardwareReqQueueCsr.Uint32 = IoMmuRead32 (IoMmu, R_RISCV_IOMMU_PQCSR);
   if (HardwareReqQueueCsr.Bits.qen || HardwareReqQueueCsr.Bits.ie || HardwareReqQueueCsr.Bits.qon ||
       HardwareReqQueueCsr.Bits.busy) {
     return FALSE;
   }
 
   //
-  // Translation request is a debug feature, and might not be present. Skipping.
+  // Translation request is a debug feature, and might not be present.
   //
-  Ddtp.Uint64 = IoMmuRead64 (R_RISCV_IOMMU_DDTP);
+  Capabilities.Uint64 = IoMmuRead64 (IoMmu, R_RISCV_IOMMU_CAPABILITIES);
+  if (Capabilities.Bits.DBG) {
+    TranslationReqCtl.Uint64 = IoMmuRead64 (IoMmu, R_RISCV_IOMMU_TR_REQ_CTL);
+    if (TranslationReqCtl.Bits.Go_Busy) {
+      return FALSE;
+    }
+  }
+
+  Ddtp.Uint64 = IoMmuRead64 (IoMmu, R_RISCV_IOMMU_DDTP);
   if (Ddtp.Bits.busy) {
     return FALSE;
   }
 
-  Ipsr.Uint32 = IoMmuRead32 (R_RISCV_IOMMU_IPSR);
+  Ipsr.Uint32 = IoMmuRead32 (IoMmu, R_RISCV_IOMMU_IPSR);
   if (Ipsr.Uint32) {
     return FALSE;
   }
@@ -99,22 +177,60 @@ IoMmuIsReset (
 }
 
 /**
-  Allocate a queue.
+  Get the CSR of a queue.
 
-  @param[in]  QueueStruct   Pointer to this queue's wrapping struct.
+  @param[in]  QueueStruct  Pointer to the queue's wrapping struct.
+
+  @return  The offset of the queue's CSR.
 
 **/
 STATIC
-VOID
-AllocateQueue (
+UINTN
+GetQueueCsr (
   IN QUEUE_WRAPPER  *QueueStruct
   )
+{
+  switch (QueueStruct->Type) {
+    case QUEUE_COMMAND:
+      return R_RISCV_IOMMU_CQCSR;
+    case QUEUE_FAULT:
+      return R_RISCV_IOMMU_FQCSR;
+    default:
+      return R_RISCV_IOMMU_PQCSR;
+  }
+}
+
+/**
+  Allocate a queue of up to a number of entries, and request that it is enabled,
+  without waiting for the IOMMU to turn it on.
+
+  The size is bounded by what the IOMMU implements of the WARL queue-size
+  field. When the queue already has a buffer, which the IOMMU no longer
+  uses, a new one is only allocated if it is larger. Otherwise, the
+  current buffer is programmed again, empty.
+
+  @param[in]  IoMmu            The IOMMU, whose queue is off.
+  @param[in]  QueueStruct      Pointer to this queue's wrapping struct.
+  @param[in]  NumberOfEntries  The number of entries to allocate, rounded down to a power of two.
+
+  @retval  EFI_SUCCESS           The queue is being enabled.
+  @retval  EFI_OUT_OF_RESOURCES  The queue has no buffer, and none could be allocated.
+
+**/
+STATIC
+EFI_STATUS
+StartQueue (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN QUEUE_WRAPPER         *QueueStruct,
+  IN UINT32                NumberOfEntries
+  )
 {
   UINTN                                   QueueBaseReg;
   UINTN                                   QueueHeadTailReg;
   UINTN                                   QueueCsrReg;
   UINTN                                   Log2Size;
-  UINTN                                   NumberOfPages;
+  UINTN                                   Size;
+  VOID                                    *Buffer;
   RISCV_IOMMU_QUEUE_BASE                  QueueBase;
   RISCV_IOMMU_HARDWARE_REQUEST_QUEUE_CSR  HardwareReqQueueCsr;
   RISCV_IOMMU_SOFTWARE_REQUEST_QUEUE_CSR  SoftwareReqQueueCsr;
@@ -138,255 +254,643 @@ AllocateQueue (
       break;
     default:
       ASSERT (FALSE);
-      return;
+      return EFI_INVALID_PARAMETER;
   }
 
   //
-  // The specification defines that the 'buffer size' register is `LOG2SZ-1`.
+  // The specification defines that the 'buffer size' register is `LOG2SZ-1`. Queues have two entries at least,
+  // and the IOMMU may implement fewer sizes, so the largest is read back.
   //
-  ASSERT ((QUEUE_NUMBER_OF_ENTRIES != 0) && (QUEUE_NUMBER_OF_ENTRIES % 2 == 0));
-  Log2Size = HighBitSet32 (QUEUE_NUMBER_OF_ENTRIES);
-  ASSERT (Log2Size - 1 < QUEUE_MAX_LOG_SIZE);
+  Log2Size                = MIN ((UINTN)HighBitSet32 (MAX (NumberOfEntries, 2)), QUEUE_MAX_LOG_SIZE);
+  QueueBase.Uint64        = 0;
+  QueueBase.Bits.LOG2SZ_1 = Log2Size - 1;
+  IoMmuWrite64 (IoMmu, QueueBaseReg, QueueBase.Uint64);
+  QueueBase.Uint64 = IoMmuRead64 (IoMmu, QueueBaseReg);
+  Log2Size         = MIN (Log2Size, QueueBase.Bits.LOG2SZ_1 + 1);
 
   //
-  // Align the buffer to the specification's requirement.
+  // The buffer is aligned to its size, or to 4 KiB if it is smaller, and local to the IOMMU if possible.
   //
-  NumberOfPages       = EFI_SIZE_TO_PAGES (QUEUE_NUMBER_OF_ENTRIES * QueueStruct->EntrySize);
-  QueueStruct->Buffer = AllocateAlignedPages (NumberOfPages, MAX (SIZE_4KB, EFI_PAGES_TO_SIZE (NumberOfPages)));
-  ASSERT (QueueStruct->Buffer != NULL);
+  Size   = (UINTN)LShiftU64 (QueueStruct->EntrySize, Log2Size);
+  Buffer = QueueStruct->Buffer;
+  if ((Buffer == NULL) || (Size > (QueueStruct->Mask + 1) * QueueStruct->EntrySize)) {
+    Buffer = IoMmuAllocateLocalPages (IoMmu, EFI_SIZE_TO_PAGES (Size), MAX (EFI_PAGE_SIZE, Size), MAX_ADDRESS);
+    if (Buffer == NULL) {
+      Buffer = AllocateAlignedPages (EFI_SIZE_TO_PAGES (Size), MAX (EFI_PAGE_SIZE, Size));
+    }
+
+    if (Buffer != NULL) {
+      IoMmuChargeFootprint (RiscVIoMmuFootprintQueue, EFI_PAGES_TO_SIZE (EFI_SIZE_TO_PAGES (Size)));
+      QueueStruct->Buffer    = Buffer;
+      QueueStruct->Mask      = (UINT32)LShiftU64 (1, Log2Size) - 1;
+      QueueStruct->Allocated = TRUE;
+      IoMmuMapQueueUncached (IoMmu, QueueStruct);
+    } else if (QueueStruct->Buffer == NULL) {
+      DEBUG ((DEBUG_ERROR, "%a: Failed to allocate 0x%x bytes for queue %u\n", __func__, Size, QueueStruct->Type));
+      return EFI_OUT_OF_RESOURCES;
+    }
+  }
+
+  QueueStruct->Head     = 0;
+  QueueStruct->Tail     = 0;
+  QueueStruct->Reserved = 0;
 
+  QueueBase.Uint64        = 0;
   QueueBase.Bits.PPN      = ((UINT64)QueueStruct->Buffer) >> RISCV_MMU_PAGE_SHIFT;
-  QueueBase.Bits.LOG2SZ_1 = Log2Size - 1;
-  IoMmuWrite64 (QueueBaseReg, QueueBase.Uint64);
-  IoMmuWrite32 (QueueHeadTailReg, 0);
+  QueueBase.Bits.LOG2SZ_1 = HighBitSet32 (QueueStruct->Mask + 1) - 1;
+  IoMmuWrite64 (IoMmu, QueueBaseReg, QueueBase.Uint64);
+  IoMmuWrite32 (IoMmu, QueueHeadTailReg, 0);
 
   //
-  // Enable the queue.
+  // Enable the queue, and its interrupt, which sets the pending bit even if it isn't delivered.
   //
   if (QueueStruct->Type == QUEUE_COMMAND) {
+    SoftwareReqQueueCsr.Uint32   = 0;
     SoftwareReqQueueCsr.Bits.qen = 1;
-    IoMmuWriteAndWait32 (QueueCsrReg, SoftwareReqQueueCsr.Uint32, 1 << N_RISCV_IOMMU_QUEUE_CSR_QON, TRUE);
+    SoftwareReqQueueCsr.Bits.ie  = 1;
+    IoMmuWrite32 (IoMmu, QueueCsrReg, SoftwareReqQueueCsr.Uint32);
   } else {
+    HardwareReqQueueCsr.Uint32   = 0;
     HardwareReqQueueCsr.Bits.qen = 1;
-    IoMmuWriteAndWait32 (QueueCsrReg, HardwareReqQueueCsr.Uint32, 1 << N_RISCV_IOMMU_QUEUE_CSR_QON, TRUE);
+    HardwareReqQueueCsr.Bits.ie  = 1;
+    IoMmuWrite32 (IoMmu, QueueCsrReg, HardwareReqQueueCsr.Uint32);
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Allocate a queue of up to a number of entries, and enable it.
+
+  @param[in]  IoMmu            The IOMMU, whose queue is off.
+  @param[in]  QueueStruct      Pointer to this queue's wrapping struct.
+  @param[in]  NumberOfEntries  The number of entries to allocate, rounded down to a power of two.
+
+  @retval  EFI_SUCCESS           The queue is enabled.
+  @retval  EFI_OUT_OF_RESOURCES  The queue has no buffer, and none could be allocated.
+  @retval  EFI_TIMEOUT           The queue did not turn on in time.
+
+**/
+EFI_STATUS
+IoMmuAllocateQueue (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN QUEUE_WRAPPER         *QueueStruct,
+  IN UINT32                NumberOfEntries
+  )
+{
+  EFI_STATUS  Status;
+
+  Status = StartQueue (IoMmu, QueueStruct, NumberOfEntries);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  return IoMmuWait32 (IoMmu, GetQueueCsr (QueueStruct), 1 << N_RISCV_IOMMU_QUEUE_CSR_QON, TRUE);
+}
+
+/**
+  Map the interrupt causes of an IOMMU to its vectors.
+
+  The vectors are discovered from the WARL fields of ICVEC, and bounded by
+  the wires the platform connected. No interrupt controller is managed by
+  firmware, so the causes are serviced by polling the pending bits, and MSI
+  vectors stay masked: the IOMMU must not write to an unprogrammed address.
+
+  @param[in]  IoMmu  The IOMMU.
+
+**/
+STATIC
+VOID
+ProgramInterruptVectors (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  RISCV_IOMMU_ICVEC  InterruptVectors;
+  UINTN              NumberOfVectors;
+  UINTN              Index;
+  UINTN              Entry;
+
+  //
+  // Each field holds at most the highest vector that is supported.
+  //
+  InterruptVectors.Uint64    = 0;
+  InterruptVectors.Bits.civ  = 0xF;
+  InterruptVectors.Bits.fiv  = 0xF;
+  InterruptVectors.Bits.pmiv = 0xF;
+  InterruptVectors.Bits.piv  = 0xF;
+  IoMmuWrite64 (IoMmu, R_RISCV_IOMMU_ICVEC, InterruptVectors.Uint64);
+
+  InterruptVectors.Uint64 = IoMmuRead64 (IoMmu, R_RISCV_IOMMU_ICVEC);
+  NumberOfVectors         = MAX (
+                              MAX (InterruptVectors.Bits.civ, InterruptVectors.Bits.fiv),
+                              MAX (InterruptVectors.Bits.pmiv, InterruptVectors.Bits.piv)
+                              ) + 1;
+  if (IoMmu->InterruptsAreWired && (IoMmu->NumberOfInterruptWires != 0)) {
+    NumberOfVectors = MIN (NumberOfVectors, IoMmu->NumberOfInterruptWires);
+  }
+
+  //
+  // Spread the causes over the vectors, in order of their urgency.
+  //
+  InterruptVectors.Uint64    = 0;
+  InterruptVectors.Bits.civ  = 0 % NumberOfVectors;
+  InterruptVectors.Bits.fiv  = 1 % NumberOfVectors;
+  InterruptVectors.Bits.piv  = 2 % NumberOfVectors;
+  InterruptVectors.Bits.pmiv = 3 % NumberOfVectors;
+  IoMmuWrite64 (IoMmu, R_RISCV_IOMMU_ICVEC, InterruptVectors.Uint64);
+
+  IoMmu->NumberOfInterruptVectors = (UINT8)NumberOfVectors;
+
+  if (!IoMmu->InterruptsAreWired) {
+    for (Index = 0; Index < NumberOfVectors; Index++) {
+      Entry = R_RISCV_IOMMU_MSI_CFG_TBL + Index * sizeof (RISCV_IOMMU_MSI_CFG_TBL_ENTRY);
+      IoMmuWrite32 (
+        IoMmu,
+        Entry + OFFSET_OF (RISCV_IOMMU_MSI_CFG_TBL_ENTRY, msi_vec_ctl),
+        B_RISCV_IOMMU_MSI_VEC_CTL_M
+        );
+    }
   }
+
+  DEBUG ((
+    RISCV_IOMMU_DEBUG_LEVEL,
+    "%a: %u %a vectors, serviced by polling\n",
+    __func__,
+    NumberOfVectors,
+    IoMmu->InterruptsAreWired ? "wired" : "MSI"
+    ));
 }
 
 /**
-  Program the root of a context table into the IOMMU.
+  Write the root of a context table into the IOMMU, without waiting for the IOMMU
+  to accept it. CheckContextRoot() completes the programming.
+
+  The directory is sized for the device_ids known to be routed to the IOMMU,
+  and grows when a wider device_id first needs a context.
 
+  @param[in]  IoMmu          The IOMMU, which is not busy with DDTP.
   @param[in]  ContextStruct  Pointer to a context table's wrapping struct.
 
 **/
 STATIC
-BOOLEAN
+VOID
 ProgramContextRoot (
-  IN CONTEXT_WRAPPER  *ContextStruct
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN CONTEXT_WRAPPER       *ContextStruct
   )
 {
-  UINT8                     DeviceIdSupportedWidth;
+  UINT8                     DeviceIdWidth;
   RISCV_IOMMU_CAPABILITIES  Capabilities;
   UINT8                     IoMmuMode;
   RISCV_IOMMU_DDTP          Ddtp;
-  UINT8                     OneLevelMaxWidth;
-  UINT8                     TwoLevelMaxWidth;
-
-  //
-  // Initialise the variable to silence a warning.
-  //
-  IoMmuMode = V_RISCV_IOMMU_DDTP_IOMMU_MODE_BARE;
 
   //
-  // Determine the supported device_id width.
-  // - FIXME: Do they mean *needed* width? Probably not (ours here it's the PCI routing ID with one bus). Consider it?
+  // Determine the needed device_id width. Without discovered routing, assume one PCI segment.
   //
-  DeviceIdSupportedWidth = 16;
+  if (ContextStruct->MaxDeviceId != 0) {
+    DeviceIdWidth = (UINT8)HighBitSet32 (ContextStruct->MaxDeviceId) + 1;
+  } else {
+    DeviceIdWidth = 16;
+  }
 
   //
-  // Determine the format of the context struct.
+  // Determine the format of the context struct. The hardware fixes it: the 64-byte
+  // extended format is walked whenever MSI_FLAT is supported, even with MSI translation
+  // off, so the 32-byte base format can't be chosen for those IOMMUs.
   //
-  Capabilities.Uint64 = IoMmuRead64 (R_RISCV_IOMMU_CAPABILITIES);
+  Capabilities.Uint64                    = IoMmu->Capabilities;
   ContextStruct->ContextStructIsExtended = Capabilities.Bits.MSI_FLAT;
 
   //
-  // Allocate the root of the context table.
+  // Allocate the root of the context table. The other levels are allocated on demand.
   //
-  ContextStruct->Buffer = AllocatePages (1);
+  ContextStruct->Buffer = IoMmuAllocateTablePage (IoMmu, RiscVIoMmuFootprintDirectory);
   ASSERT (ContextStruct->Buffer != NULL);
 
-  ZeroMem (ContextStruct->Buffer, SIZE_4KB);
+  ContextStruct->NumberOfPages = 1;
 
   //
   // Determine the needed IOMMU mode.
   //
-  OneLevelMaxWidth = ContextStruct->ContextStructIsExtended ? N_RISCV_IOMMU_DEVICE_ID_EXTENDED_I1 : N_RISCV_IOMMU_DEVICE_ID_BASE_I1;
-  TwoLevelMaxWidth = ContextStruct->ContextStructIsExtended ? N_RISCV_IOMMU_DEVICE_ID_EXTENDED_I2 : N_RISCV_IOMMU_DEVICE_ID_BASE_I2;
-
-  if (DeviceIdSupportedWidth <= OneLevelMaxWidth) {
-    IoMmuMode = V_RISCV_IOMMU_DDTP_IOMMU_MODE_1LVL;
-  } else if (DeviceIdSupportedWidth <= TwoLevelMaxWidth) {
-    IoMmuMode = V_RISCV_IOMMU_DDTP_IOMMU_MODE_2LVL;
-  } else if (DeviceIdSupportedWidth <= 24) {
-    IoMmuMode = V_RISCV_IOMMU_DDTP_IOMMU_MODE_3LVL;
-  }
+  IoMmuMode = V_RISCV_IOMMU_DDTP_IOMMU_MODE_BARE + IoMmuGetDeviceDirectoryLevels (IoMmu, DeviceIdWidth);
 
   //
   // Attempt to set the needed mode. NOTE: Could we attempt to upgrade if this mode fails?
   //
-  Ddtp.Bits.iommu_mode = IoMmuMode;
-  IoMmuWriteAndWait64 (R_RISCV_IOMMU_DDTP, Ddtp.Uint64, 1 << N_RISCV_IOMMU_DDTP_BUSY, FALSE);
-
-  Ddtp.Uint64 = IoMmuRead64 (R_RISCV_IOMMU_DDTP);
-  if (Ddtp.Bits.iommu_mode != IoMmuMode) {
-    DEBUG ((DEBUG_ERROR, "Needed IOMMU mode 0x%x is not supported!\n", IoMmuMode));
-    return FALSE;
-  }
-
+  Ddtp.Uint64          = 0;
   Ddtp.Bits.iommu_mode = IoMmuMode;
   Ddtp.Bits.PPN        = ((UINT64)ContextStruct->Buffer) >> RISCV_MMU_PAGE_SHIFT;
-  IoMmuWriteAndWait64 (R_RISCV_IOMMU_DDTP, Ddtp.Uint64, 1 << N_RISCV_IOMMU_DDTP_BUSY, FALSE);
+  IoMmuWrite64 (IoMmu, R_RISCV_IOMMU_DDTP, Ddtp.Uint64);
+
+  ContextStruct->Levels = IoMmuMode - V_RISCV_IOMMU_DDTP_IOMMU_MODE_BARE;
 
   DEBUG ((
     RISCV_IOMMU_DEBUG_LEVEL,
-    "%a: Configured a %d level device table at 0x%x\n",
+    "%a: Requested a %d level device table for %d-bit device_ids at 0x%x\n",
     __func__,
-    IoMmuMode - V_RISCV_IOMMU_DDTP_IOMMU_MODE_BARE,
+    ContextStruct->Levels,
+    DeviceIdWidth,
     ContextStruct->Buffer
     ));
+}
+
+/**
+  Wait for the IOMMU to accept the root of a context table written by ProgramContextRoot(),
+  and check that it supports the requested mode.
+
+  @param[in]  IoMmu          The IOMMU.
+  @param[in]  ContextStruct  Pointer to a context table's wrapping struct.
+
+  @retval  TRUE   The context table is in use.
+  @retval  FALSE  The mode is not supported, and the root was freed.
+
+**/
+STATIC
+BOOLEAN
+CheckContextRoot (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN CONTEXT_WRAPPER       *ContextStruct
+  )
+{
+  UINT8             IoMmuMode;
+  RISCV_IOMMU_DDTP  Ddtp;
+  EFI_STATUS        Status;
+
+  IoMmuMode = V_RISCV_IOMMU_DDTP_IOMMU_MODE_BARE + ContextStruct->Levels;
+  Status    = IoMmuWait64 (IoMmu, R_RISCV_IOMMU_DDTP, 1 << N_RISCV_IOMMU_DDTP_BUSY, FALSE);
+
+  Ddtp.Uint64 = IoMmuRead64 (IoMmu, R_RISCV_IOMMU_DDTP);
+  if (EFI_ERROR (Status) || (Ddtp.Bits.iommu_mode != IoMmuMode)) {
+    DEBUG ((DEBUG_ERROR, "Needed IOMMU mode 0x%x is not supported!\n", IoMmuMode));
+    IoMmuFreeTablePage (ContextStruct->Buffer, RiscVIoMmuFootprintDirectory);
+    ContextStruct->Buffer        = NULL;
+    ContextStruct->NumberOfPages = 0;
+    ContextStruct->Levels        = 0;
+    return FALSE;
+  }
 
   return TRUE;
 }
 
 /**
-  Initialise the IOMMU hardware.
+  Discover the QoS IDs that an IOMMU implements, and tag its own memory accesses with
+  PcdRiscVIoMmuQosId.
 
-  @retval  EFI_SUCCESS      The hardware is initialised.
+  @param[in]  IoMmu         The IOMMU.
+  @param[in]  Capabilities  The capabilities of the IOMMU.
+
+**/
+STATIC
+VOID
+ProgramQosIds (
+  IN RISCV_IOMMU_INSTANCE      *IoMmu,
+  IN RISCV_IOMMU_CAPABILITIES  Capabilities
+  )
+{
+  RISCV_IOMMU_QOSID  QosId;
+
+  IoMmu->QosIdMask = 0;
+  if (!Capabilities.Bits.QOSID) {
+    return;
+  }
+
+  //
+  // The fields are WARL, so the bits that stick are those implemented.
+  //
+  QosId.Uint32    = 0;
+  QosId.Bits.RCID = 0xFFF;
+  QosId.Bits.MCID = 0xFFF;
+  IoMmuWrite32 (IoMmu, R_RISCV_IOMMU_QOSID, QosId.Uint32);
+  IoMmu->QosIdMask = IoMmuRead32 (IoMmu, R_RISCV_IOMMU_QOSID) & QosId.Uint32;
+
+  QosId.Uint32 = PcdGet32 (PcdRiscVIoMmuQosId);
+  if ((QosId.Uint32 & ~IoMmu->QosIdMask) != 0) {
+    DEBUG ((DEBUG_WARN, "%a: QoS IDs 0x%x aren't implemented by the IOMMU\n", __func__, QosId.Uint32));
+    QosId.Uint32 = 0;
+  }
+
+  IoMmuWrite32 (IoMmu, R_RISCV_IOMMU_QOSID, QosId.Uint32);
+  DEBUG ((RISCV_IOMMU_DEBUG_LEVEL, "%a: QoS ID mask 0x%x, IOMMU QoS IDs 0x%x\n", __func__, IoMmu->QosIdMask, QosId.Uint32));
+}
+
+/**
+  Start initialising the IOMMU hardware, up to the writes that the IOMMU acknowledges
+  asynchronously. CompleteRiscVIoMmu() waits for those, so that the waits of several
+  IOMMUs overlap.
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @retval  EFI_SUCCESS      The hardware is being initialised.
   @retval  EFI_UNSUPPORTED  The detected IOMMU is not supported by this driver.
 
 **/
 STATIC
 EFI_STATUS
 InitialiseRiscVIoMmu (
-  VOID
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
   )
 {
   RISCV_IOMMU_CAPABILITIES  Capabilities;
   BOOLEAN                   HartIsBigEndian;
   RISCV_IOMMU_FCTL          FeatureControl;
   UINTN                     HartSatpMode;
-
-  // TODO: Handle this instead.
-  ASSERT (IoMmuIsReset ());
+  EFI_STATUS                Status;
+  BOOLEAN                   Adopted;
 
   //
   // 1. Discover the capabilities of the IOMMU, and:
   // 2. Ensure its architectural version is supported.
   //
-  Capabilities.Uint64 = IoMmuRead64 (R_RISCV_IOMMU_CAPABILITIES);
+  Capabilities.Uint64 = IoMmuRead64 (IoMmu, R_RISCV_IOMMU_CAPABILITIES);
+  IoMmu->Capabilities = Capabilities.Uint64;
   if (Capabilities.Bits.version != V_RISCV_IOMMU_CAPABILITIES_VERSION_1_0) {
     DEBUG ((DEBUG_ERROR, "IOMMU version 0x%x is not supported by this driver!\n", Capabilities.Bits.version));
     return EFI_UNSUPPORTED;
   }
 
+  //
+  // Without coherent memory accesses, every table written from here on is cleaned for the IOMMU.
+  //
+  Status = IoMmuInitialiseCacheMaintenance (IoMmu);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
   // It'd be preferable to read MSTATUS_SBE, but this isn't present in the SSTATUS_CSR.
   HartIsBigEndian = (RiscVGetSupervisorStatusRegister () & MSTATUS_UBE) != 0;
+  HartSatpMode    = (RiscVGetSupervisorAddressTranslationRegister () & SATP64_MODE) >> SATP64_MODE_SHIFT;
+
+  //
+  // An earlier boot stage may have left the IOMMU running. Its queues and device directory
+  // are adopted if they suit this driver, and the IOMMU is quiesced to its reset state otherwise.
+  //
+  Adopted = FALSE;
+  if (!IoMmuIsReset (IoMmu)) {
+    Adopted = IoMmuAdoptConfiguration (IoMmu, HartIsBigEndian, HartSatpMode == SATP_MODE_SV32);
+    if (!Adopted) {
+      Status = IoMmuQuiesce (IoMmu);
+      if (EFI_ERROR (Status) || !IoMmuIsReset (IoMmu)) {
+        return EFI_UNSUPPORTED;
+      }
+    }
+  }
 
   //
   // 3. Read the feature control register, and:
   // 4. If changing the IOMMU's endianness is required, ensure that it's possible.
   //
-  FeatureControl.Uint32 = IoMmuRead32 (R_RISCV_IOMMU_FCTL);
+  FeatureControl.Uint32 = IoMmuRead32 (IoMmu, R_RISCV_IOMMU_FCTL);
   if (HartIsBigEndian && !FeatureControl.Bits.BE && !Capabilities.Bits.END) {
     DEBUG ((DEBUG_ERROR, "HART is big-endian, which is not supported by the IOMMU!\n"));
     return EFI_UNSUPPORTED;
   }
 
   //
-  // 5. If required, change the IOMMU's endianness.
+  // 5. If required, change the IOMMU's endianness. An adopted configuration already matches,
+  //    and its feature control isn't changed while the IOMMU is running.
   //
-  if (HartIsBigEndian && !FeatureControl.Bits.BE && Capabilities.Bits.END) {
+  if (!Adopted && HartIsBigEndian && !FeatureControl.Bits.BE && Capabilities.Bits.END) {
     FeatureControl.Bits.BE = 1;
-    IoMmuWrite32 (R_RISCV_IOMMU_FCTL, FeatureControl.Uint32);
+    IoMmuWrite32 (IoMmu, R_RISCV_IOMMU_FCTL, FeatureControl.Uint32);
   }
 
   //
-  // 6-7. Firmware is largely synchronous, so skip WSI enablement.
+  // 6-7. Signal interrupts by wire if both the IOMMU and the platform support it, otherwise by MSI.
   //
+  if (!Adopted) {
+    IoMmu->InterruptsAreWired = (Capabilities.Bits.IGS == V_RISCV_IOMMU_CAPABILITIES_IGS_WSI) ||
+                                ((Capabilities.Bits.IGS == V_RISCV_IOMMU_CAPABILITIES_IGS_BOTH) &&
+                                 ((IoMmu->NumberOfInterruptWires != 0) || !IoMmu->HasMsiParent));
+  }
+
+  if (!Adopted && IoMmu->InterruptsAreWired) {
+    FeatureControl.Bits.WSI = 1;
+    IoMmuWrite32 (IoMmu, R_RISCV_IOMMU_FCTL, FeatureControl.Uint32);
+  }
 
   //
   // 8. Ensure other required capabilities (e.g. virtual-addressing modes, MSI translation, etc.) are supported.
-  // - MSI translation is a virtualisation-specific feature.
-  //
-  HartSatpMode = (RiscVGetSupervisorAddressTranslationRegister () & SATP64_MODE) >> SATP64_MODE_SHIFT;
-  if ((HartSatpMode == SATP_MODE_SV64) ||
-      ((HartSatpMode == SATP_MODE_SV57) && !Capabilities.Bits.Sv57) ||
-      ((HartSatpMode == SATP_MODE_SV48) && !Capabilities.Bits.Sv48) ||
-      ((HartSatpMode == SATP_MODE_SV39) && !Capabilities.Bits.Sv39) ||
-      ((HartSatpMode == SATP_MODE_SV32) && !Capabilities.Bits.Sv32)) {
+  // - MSI translation is set up with the device directory, where the platform has an S-level IMSIC.
+  //
+  if ((HartSatpMode == SATP_MODE_SV32) && !Capabilities.Bits.Sv32) {
     DEBUG ((DEBUG_ERROR, "HART virtual-addressing mode (SATP: 0x%x) is not supported by the IOMMU!\n", HartSatpMode));
     return EFI_UNSUPPORTED;
   }
 
   // Attempt to enable the needed group of paging modes.
-  FeatureControl.Bits.GXL = HartSatpMode == SATP_MODE_SV32;
-  IoMmuWrite32 (R_RISCV_IOMMU_FCTL, FeatureControl.Uint32);
+  if (!Adopted) {
+    FeatureControl.Bits.GXL = HartSatpMode == SATP_MODE_SV32;
+    IoMmuWrite32 (IoMmu, R_RISCV_IOMMU_FCTL, FeatureControl.Uint32);
+  }
+
+  //
+  // The fields may be read-only, so the hot paths use what the IOMMU accepted.
+  //
+  FeatureControl.Uint32 = IoMmuRead32 (IoMmu, R_RISCV_IOMMU_FCTL);
+  IoMmu->FeatureControl = FeatureControl.Uint32;
+
+  //
+  // Device page tables use the shallowest mode that maps all memory, whatever the HART's paging mode.
+  // Sv32 tables are not built by this driver.
+  //
+  if (FeatureControl.Bits.GXL) {
+    IoMmu->IoSatpMode        = V_RISCV_IOMMU_IOSATP_MODE_BARE;
+    IoMmu->IoPageTableLevels = 0;
+    DEBUG ((DEBUG_WARN, "%a: No IO page tables for SATP mode 0x%x\n", __func__, HartSatpMode));
+  } else {
+    IoMmuSelectIoPagingMode (IoMmu, Capabilities);
+  }
 
   //
-  // 9-11. Firmware is largely synchronous, so skip mapping interrupt causes to vectors.
+  // Tag the IOMMU's own table walks and queue accesses with the platform's QoS IDs.
   //
+  ProgramQosIds (IoMmu, Capabilities);
 
   //
-  // 12-14. Program the three queues.
+  // 9-11. Map interrupt causes to vectors.
+  //
+  ProgramInterruptVectors (IoMmu);
+
   //
-  AllocateQueue (&mRiscVIoMmuGlobalDriverContext.CommandQueue);
-  AllocateQueue (&mRiscVIoMmuGlobalDriverContext.FaultQueue);
+  // 12-14. Program the three queues. Command completion is signalled through memory, not polled registers.
+  //
+  // Without coherence, the completion word is invalidated while polled, so it gets a cache block of its own.
+  //
+  if (IoMmu->NonCoherent) {
+    IoMmu->FenceCompletion = AllocatePages (1);
+    if (IoMmu->FenceCompletion != NULL) {
+      *IoMmu->FenceCompletion = 0;
+      IoMmuQueueCacheClean (IoMmu, (VOID *)IoMmu->FenceCompletion, sizeof (UINT32));
+      IoMmuFlushCacheCleans (IoMmu);
+      MemoryFence ();
+    }
+  } else {
+    IoMmu->FenceCompletion = AllocateZeroPool (sizeof (UINT32));
+  }
+
+  if (IoMmu->FenceCompletion == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  IoMmu->FenceSequence = 0;
+
+  //
+  // The command queue may grow later, when it fills. The queues are only requested to turn on here,
+  // and one that fails to is fatal.
+  //
+  IoMmu->CommandQueueLimit = GetPowerOfTwo32 (MAX (PcdGet32 (PcdRiscVIoMmuMaxCommandQueueEntries), PcdGet32 (PcdRiscVIoMmuCommandQueueEntries)));
+  Status                   = EFI_SUCCESS;
+  if (!Adopted) {
+    Status = StartQueue (IoMmu, &IoMmu->CommandQueue, PcdGet32 (PcdRiscVIoMmuCommandQueueEntries));
+    if (!EFI_ERROR (Status)) {
+      Status = StartQueue (IoMmu, &IoMmu->FaultQueue, PcdGet32 (PcdRiscVIoMmuFaultQueueEntries));
+    }
+  }
+
   // TODO: Unlike on an OS kernel, device-driven operation is not expected (such as to VRAM).
-  if (Capabilities.Bits.ATS) {
-    AllocateQueue (&mRiscVIoMmuGlobalDriverContext.PageRequestQueue);
+  if (!EFI_ERROR (Status) && Capabilities.Bits.ATS && (IoMmu->PageRequestQueue.Buffer == NULL) && (PcdGet32 (PcdRiscVIoMmuPageRequestQueueEntries) != 0)) {
+    Status = StartQueue (IoMmu, &IoMmu->PageRequestQueue, PcdGet32 (PcdRiscVIoMmuPageRequestQueueEntries));
+  }
+
+  if (EFI_ERROR (Status)) {
+    return Status;
   }
 
   //
-  // 15. Program the DDT pointer.
+  // 15. Write the DDT pointer, unless the adopted directory stays in place. That of the PEIM is
+  //     replaced, and the invalidations below drop what the IOMMU cached of it.
   //
-  if (!ProgramContextRoot (&mRiscVIoMmuGlobalDriverContext.DeviceContext)) {
-    DEBUG ((DEBUG_ERROR, "Failed to program the DDT root pointer!\n"));
-    return EFI_UNSUPPORTED;
+  IoMmu->DdtpPending = !Adopted || (IoMmu->DeviceContext.Buffer == NULL);
+  if (IoMmu->DdtpPending) {
+    ProgramContextRoot (IoMmu, &IoMmu->DeviceContext);
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Complete the initialisation of the IOMMU hardware, once the queues and DDT pointer
+  that InitialiseRiscVIoMmu() wrote are accepted.
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @retval  EFI_SUCCESS      The hardware is initialised.
+  @retval  EFI_UNSUPPORTED  The detected IOMMU is not supported by this driver.
+  @retval  EFI_TIMEOUT      A queue did not turn on in time.
+
+**/
+STATIC
+EFI_STATUS
+CompleteRiscVIoMmu (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  QUEUE_WRAPPER          *Queues[3];
+  UINTN                  Index;
+  RISCV_IOMMU_DEVICE_ID  DeviceId;
+  EFI_STATUS             Status;
+  BOOLEAN                Programmed;
+
+  //
+  // Queues that were adopted are already on.
+  //
+  Queues[0] = &IoMmu->CommandQueue;
+  Queues[1] = &IoMmu->FaultQueue;
+  Queues[2] = &IoMmu->PageRequestQueue;
+  PERF_INMODULE_BEGIN ("RiscVIoMmuQueues");
+  Status = EFI_SUCCESS;
+  for (Index = 0; (Index < ARRAY_SIZE (Queues)) && !EFI_ERROR (Status); Index++) {
+    if (Queues[Index]->Buffer != NULL) {
+      Status = IoMmuWait32 (IoMmu, GetQueueCsr (Queues[Index]), 1 << N_RISCV_IOMMU_QUEUE_CSR_QON, TRUE);
+    }
+  }
+
+  PERF_INMODULE_END ("RiscVIoMmuQueues");
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  if (IoMmu->DdtpPending) {
+    IoMmu->DdtpPending = FALSE;
+    PERF_INMODULE_BEGIN ("RiscVIoMmuDdtp");
+    Programmed = CheckContextRoot (IoMmu, &IoMmu->DeviceContext);
+    PERF_INMODULE_END ("RiscVIoMmuDdtp");
+    if (!Programmed) {
+      DEBUG ((DEBUG_ERROR, "Failed to program the DDT root pointer!\n"));
+      return EFI_UNSUPPORTED;
+    }
+  }
+
+  //
+  // Device contexts programmed from here on translate MSIs, if the IOMMU can.
+  //
+  Status = IoMmuInitialiseMsiTranslation (IoMmu);
+  if (EFI_ERROR (Status) && (Status != EFI_UNSUPPORTED)) {
+    DEBUG ((DEBUG_WARN, "%a: MSIs aren't translated - %r\n", __func__, Status));
+  }
+
+  //
+  // 16. Invalidate all cached device contexts and translations.
+  //
+  ZeroMem (&DeviceId, sizeof (DeviceId));
+  IoMmuQueueDeviceContextInvalidation (IoMmu, FALSE, DeviceId);
+  IoMmuQueueIoTlbInvalidation (IoMmu, FALSE, 0, FALSE, 0);
+  PERF_INMODULE_BEGIN ("RiscVIoMmuInvalidateAll");
+  Status = IoMmuSubmitCommands (IoMmu);
+  PERF_INMODULE_END ("RiscVIoMmuInvalidateAll");
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed to invalidate the IOMMU caches!\n"));
+    return Status;
+  }
+
+  //
+  // 17. Inhibit the performance counters, until they are started through the HPM protocol.
+  //
+  IoMmuResetPerformanceMonitor (IoMmu);
+
+  //
+  // 18. Check that translations work, with the debug interface.
+  //
+  PERF_INMODULE_BEGIN ("RiscVIoMmuTestTranslation");
+  Status = IoMmuTestTranslation (IoMmu);
+  PERF_INMODULE_END ("RiscVIoMmuTestTranslation");
+  if (EFI_ERROR (Status)) {
+    return Status;
   }
 
   DEBUG ((
     DEBUG_INFO,
     "Initialised the RISC-V IOMMU %a device at 0x%lx\n",
-    mRiscVIoMmuGlobalDriverContext.IoMmuIsPciDevice ? "PCI" : "system",
-    mRiscVIoMmuGlobalDriverContext.Address
+    IoMmu->IoMmuIsPciDevice ? "PCI" : "system",
+    IoMmu->Address
     ));
 
   return EFI_SUCCESS;
 }
 
 /**
-  Initialisation worker function.
+  Start initialising the hardware of a single IOMMU. IoMmuCompleteInstance() completes it.
+
+  @param[in]  IoMmu  The IOMMU, whose registers are known.
+
+  @retval  EFI_SUCCESS      The hardware is being initialised.
+  @retval  EFI_UNSUPPORTED  The detected IOMMU is not supported by this driver.
 
 **/
+STATIC
 EFI_STATUS
-IoMmuCommonInitialise (
-  VOID
+IoMmuInitialiseInstance (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
   )
 {
   EFI_CPU_ARCH_PROTOCOL  *CpuArch;
   EFI_STATUS             Status;
-  EFI_HANDLE             Handle;
-
-  if (mRiscVIoMmuGlobalDriverContext.DriverState >= STATE_INITIALISED) {
-    return EFI_SUCCESS;
-  }
-
-  mRiscVIoMmuGlobalDriverContext.DriverState = STATE_INITIALISED;
 
   DEBUG ((
     DEBUG_INFO,
     "Detected a RISC-V IOMMU %a device at 0x%lx\n",
-    mRiscVIoMmuGlobalDriverContext.IoMmuIsPciDevice ? "PCI" : "system",
-    mRiscVIoMmuGlobalDriverContext.Address
+    IoMmu->IoMmuIsPciDevice ? "PCI" : "system",
+    IoMmu->Address
     ));
 
   //
@@ -395,20 +899,346 @@ IoMmuCommonInitialise (
   Status = gBS->LocateProtocol (&gEfiCpuArchProtocolGuid, NULL, (VOID **)&CpuArch);
   ASSERT_EFI_ERROR (Status);
 
+  PERF_INMODULE_BEGIN ("RiscVIoMmuMapRegisters");
   Status = CpuArch->SetMemoryAttributes (
                       CpuArch,
-                      mRiscVIoMmuGlobalDriverContext.Address,
+                      IoMmu->Address,
                       SIZE_4KB,
                       EFI_MEMORY_UC | EFI_MEMORY_XP
                       );
+  PERF_INMODULE_END ("RiscVIoMmuMapRegisters");
   ASSERT_EFI_ERROR (Status);
 
   //
   // Now, run the initialisation worker.
   //
-  Status = InitialiseRiscVIoMmu ();
+  PERF_INMODULE_BEGIN ("RiscVIoMmuInitialise");
+  Status = InitialiseRiscVIoMmu (IoMmu);
+  PERF_INMODULE_END ("RiscVIoMmuInitialise");
   if (EFI_ERROR (Status)) {
-    DEBUG ((DEBUG_ERROR, "Failed to initialise the IOMMU\n"));
+    DEBUG ((DEBUG_ERROR, "Failed to initialise the IOMMU at 0x%lx\n", IoMmu->Address));
+  }
+
+  return Status;
+}
+
+/**
+  Complete the initialisation of a single IOMMU, started by IoMmuInitialiseInstance().
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @retval  EFI_SUCCESS      The hardware is initialised.
+  @retval  EFI_UNSUPPORTED  The detected IOMMU is not supported by this driver.
+
+**/
+STATIC
+EFI_STATUS
+IoMmuCompleteInstance (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  EFI_STATUS  Status;
+
+  PERF_INMODULE_BEGIN ("RiscVIoMmuComplete");
+  Status = CompleteRiscVIoMmu (IoMmu);
+  PERF_INMODULE_END ("RiscVIoMmuComplete");
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed to initialise the IOMMU at 0x%lx\n", IoMmu->Address));
+  }
+
+  return Status;
+}
+
+/**
+  Start initialising every IOMMU that became available.
+
+  The registers that the IOMMUs acknowledge asynchronously are written for every IOMMU
+  first, and only then waited for, so initialisation waits about as long as the slowest
+  IOMMU, instead of all of them in turn. A failed IOMMU stays detected, so it is never retried.
+
+**/
+STATIC
+VOID
+IoMmuStartInitialisation (
+  VOID
+  )
+{
+  LIST_ENTRY            *Link;
+  RISCV_IOMMU_INSTANCE  *IoMmu;
+
+  //
+  // Without the pool, table pages come from the DXE core one at a time.
+  //
+  if ((mRiscVIoMmuGlobalDriverContext.DriverState < STATE_INITIALISED) && EFI_ERROR (IoMmuInitialiseTablePagePool ())) {
+    DEBUG ((DEBUG_WARN, "Failed to reserve the table-page pool\n"));
+  }
+
+  for (Link = GetFirstNode (&mRiscVIoMmuGlobalDriverContext.InstanceList)
+       ; !IsNull (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ; Link = GetNextNode (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ) {
+    IoMmu = RISCV_IOMMU_INSTANCE_FROM_LINK (Link);
+    if ((IoMmu->State != STATE_AVAILABLE) || IoMmu->Starting) {
+      continue;
+    }
+
+    if (EFI_ERROR (IoMmuInitialiseInstance (IoMmu))) {
+      IoMmu->State = STATE_DETECTED;
+    } else {
+      IoMmu->Starting = TRUE;
+    }
+  }
+}
+
+/**
+  Return whether the IOMMUs that IoMmuCommonInitialise() started accepted their
+  queues and device directories, without waiting for them.
+
+  @retval  TRUE   IoMmuCompleteInitialisation() won't wait.
+  @retval  FALSE  An IOMMU is still turning on a queue, or its DDTP is busy.
+
+**/
+BOOLEAN
+IoMmuStartedInstancesReady (
+  VOID
+  )
+{
+  LIST_ENTRY            *Link;
+  RISCV_IOMMU_INSTANCE  *IoMmu;
+  QUEUE_WRAPPER         *Queues[3];
+  UINTN                 Index;
+
+  for (Link = GetFirstNode (&mRiscVIoMmuGlobalDriverContext.InstanceList)
+       ; !IsNull (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ; Link = GetNextNode (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ) {
+    IoMmu = RISCV_IOMMU_INSTANCE_FROM_LINK (Link);
+    if (!IoMmu->Starting) {
+      continue;
+    }
+
+    Queues[0] = &IoMmu->CommandQueue;
+    Queues[1] = &IoMmu->FaultQueue;
+    Queues[2] = &IoMmu->PageRequestQueue;
+    for (Index = 0; Index < ARRAY_SIZE (Queues); Index++) {
+      if ((Queues[Index]->Buffer != NULL) &&
+          ((IoMmuRead32 (IoMmu, GetQueueCsr (Queues[Index])) & (1 << N_RISCV_IOMMU_QUEUE_CSR_QON)) == 0))
+      {
+        return FALSE;
+      }
+    }
+
+    if (IoMmu->DdtpPending && ((IoMmuRead64 (IoMmu, R_RISCV_IOMMU_DDTP) & (1 << N_RISCV_IOMMU_DDTP_BUSY)) != 0)) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+/**
+  Complete the initialisation of the IOMMUs that IoMmuStartInitialisation() started,
+  and the first time any is initialised, the shared state and the protocols.
+
+  @retval  EFI_SUCCESS      The started IOMMUs are initialised.
+  @retval  EFI_UNSUPPORTED  No started IOMMU could be initialised.
+
+**/
+STATIC
+EFI_STATUS
+IoMmuCompleteInitialisationWorker (
+  VOID
+  )
+{
+  LIST_ENTRY            *Link;
+  RISCV_IOMMU_INSTANCE  *IoMmu;
+  BOOLEAN               FirstInitialisation;
+  BOOLEAN               Initialised;
+  EFI_STATUS            Status;
+  EFI_HANDLE            Handle;
+
+  FirstInitialisation = (mRiscVIoMmuGlobalDriverContext.DriverState < STATE_INITIALISED);
+  Initialised         = FALSE;
+
+  //
+  // Deferred initialisation served Map() without IOVAs until now.
+  //
+  if (FirstInitialisation) {
+    mRiscVIoMmuGlobalDriverContext.TranslationEnabled = TRUE;
+  }
+
+  for (Link = GetFirstNode (&mRiscVIoMmuGlobalDriverContext.InstanceList)
+       ; !IsNull (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ; Link = GetNextNode (&mRiscVIoMmuGlobalDriverContext.InstanceList, Link)
+       ) {
+    IoMmu = RISCV_IOMMU_INSTANCE_FROM_LINK (Link);
+    if ((IoMmu->State != STATE_AVAILABLE) || !IoMmu->Starting) {
+      continue;
+    }
+
+    IoMmu->Starting = FALSE;
+    Status          = IoMmuCompleteInstance (IoMmu);
+    if (EFI_ERROR (Status)) {
+      IoMmu->State = STATE_DETECTED;
+      continue;
+    }
+
+    IoMmu->State = STATE_INITIALISED;
+    Initialised  = TRUE;
+
+    //
+    // Without first-stage tables on every IOMMU, IOVAs aren't usable by all devices.
+    //
+    if (IoMmu->IoPageTableLevels == 0) {
+      mRiscVIoMmuGlobalDriverContext.TranslationEnabled = FALSE;
+    }
+  }
+
+  if (!Initialised) {
+    if (FirstInitialisation) {
+      IoMmuFreeTablePagePool ();
+      mRiscVIoMmuGlobalDriverContext.TranslationEnabled = !mRiscVIoMmuGlobalDriverContext.Deferred;
+    }
+
+    return EFI_UNSUPPORTED;
+  }
+
+  //
+  // Map() and AllocateBuffer() check buffers against the limit, without reading any registers.
+  //
+  IoMmuUpdateDmaMemoryTop ();
+
+  //
+  // IOMMUs initialised after the protocol is installed are simply routed to.
+  //
+  if (!FirstInitialisation) {
+    return EFI_SUCCESS;
+  }
+
+  mRiscVIoMmuGlobalDriverContext.DriverState = STATE_INITIALISED;
+
+  //
+  // Bounced transfers are served from the pool, but an exhausted pool isn't fatal.
+  //
+  Status = IoMmuInitialiseBouncePool ();
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_WARN, "Failed to reserve the bounce-buffer pool\n"));
+  }
+
+  //
+  // Without the IOVA window, high buffers of 32-bit operations are bounced.
+  //
+  if (mRiscVIoMmuGlobalDriverContext.TranslationEnabled) {
+    Status = IoMmuInitialiseIovaSpace ();
+    if (EFI_ERROR (Status)) {
+      DEBUG ((DEBUG_WARN, "Failed to claim the IOVA window\n"));
+    }
+  }
+
+  //
+  // Without the poll timer, unmapped translations are invalidated strictly.
+  //
+  Status = IoMmuInitialiseFlushQueue ();
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_WARN, "Failed to start the flush queue\n"));
+  }
+
+  //
+  // Without the timer, faults are only reported when a command fails.
+  //
+  Status = IoMmuInitialiseFaultReporting ();
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_WARN, "Failed to start fault reporting\n"));
+  }
+
+  //
+  // Without the teardown, nothing that must not outlive boot services is kept, and the IOMMUs
+  // translate with boot-services tables once they are gone.
+  //
+  Status = IoMmuInitialiseExitBootServices ();
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_WARN, "Failed to register the teardown at ExitBootServices\n"));
+  }
+
+  //
+  // Without the buffer cache, FreeBuffer() frees at once.
+  //
+  Status = IoMmuInitialiseBufferCache ();
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_WARN, "Failed to set up the buffer cache\n"));
+  }
+
+  //
+  // Without the exit event, no function may cache its translations.
+  //
+  Status = IoMmuInitialiseDeviceAts ();
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_WARN, "Failed to set up ATS, so it stays disabled\n"));
+  }
+
+  //
+  // Without the cache, every SetAttribute() resolves its device afresh.
+  //
+  Status = IoMmuInitialiseDeviceCache ();
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_WARN, "Failed to set up the device cache\n"));
+  }
+
+  //
+  // Without the ring, the services are only logged.
+  //
+  Status = IoMmuInitialiseTrace ();
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_WARN, "Failed to set up the trace ring\n"));
+  }
+
+  //
+  // Without PcdRiscVIoMmuMmioAccounting, the register accesses aren't counted.
+  //
+  IoMmuInitialiseMmioAccounting ();
+
+  //
+  // Without the event, the services are still timed, only the cost isn't reported.
+  //
+  Status = IoMmuInitialiseBootCost ();
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_WARN, "Failed to set up the boot cost summary\n"));
+  }
+
+  //
+  // Without the hand-off table, the OS has to rebuild the IOMMUs from reset.
+  //
+  Status = IoMmuInitialiseOsHandOff ();
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_WARN, "Failed to set up the hand-off to the OS\n"));
+  }
+
+  //
+  // Without the event, the footprint is still accounted and capped, only not logged.
+  //
+  Status = IoMmuInitialiseFootprint ();
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_WARN, "Failed to set up the footprint report\n"));
+  }
+
+  //
+  // A deferred EDKII_IOMMU_PROTOCOL is already installed, and only the others are added.
+  //
+  if (mRiscVIoMmuGlobalDriverContext.Deferred) {
+    Handle = NULL;
+    Status = gBS->InstallMultipleProtocolInterfaces (
+                    &Handle,
+                    &gEdkiiIoMmuBatchProtocolGuid,
+                    &mRiscVIoMmuBatchProtocol,
+                    &gEdkiiIoMmuDeviceHintProtocolGuid,
+                    &mRiscVIoMmuDeviceHintProtocol,
+                    &gRiscVIoMmuHpmProtocolGuid,
+                    &mRiscVIoMmuHpmProtocol,
+                    &gRiscVIoMmuDiagnosticsProtocolGuid,
+                    &mRiscVIoMmuDiagnosticsProtocol,
+                    NULL
+                    );
+    ASSERT_EFI_ERROR (Status);
     return Status;
   }
 
@@ -418,6 +1248,14 @@ IoMmuCommonInitialise (
                   &Handle,
                   &gEdkiiIoMmuProtocolGuid,
                   &mRiscVIoMmuProtocol,
+                  &gEdkiiIoMmuBatchProtocolGuid,
+                  &mRiscVIoMmuBatchProtocol,
+                  &gEdkiiIoMmuDeviceHintProtocolGuid,
+                  &mRiscVIoMmuDeviceHintProtocol,
+                  &gRiscVIoMmuHpmProtocolGuid,
+                  &mRiscVIoMmuHpmProtocol,
+                  &gRiscVIoMmuDiagnosticsProtocolGuid,
+                  &mRiscVIoMmuDiagnosticsProtocol,
                   NULL
                   );
   ASSERT_EFI_ERROR (Status);
@@ -425,6 +1263,70 @@ IoMmuCommonInitialise (
   return Status;
 }
 
+/**
+  Complete the initialisation of the IOMMUs that IoMmuCommonInitialise() started,
+  and the first time any is initialised, the shared state and the protocols.
+
+  @retval  EFI_SUCCESS      The started IOMMUs are initialised.
+  @retval  EFI_UNSUPPORTED  No started IOMMU could be initialised.
+
+**/
+EFI_STATUS
+IoMmuCompleteInitialisation (
+  VOID
+  )
+{
+  EFI_STATUS                  Status;
+  RISCV_IOMMU_MMIO_OPERATION  Previous;
+
+  PERF_INMODULE_BEGIN ("RiscVIoMmuCompleteInitialisation");
+  Previous = IoMmuBeginMmioOperation (RiscVIoMmuMmioInitialise);
+  Status   = IoMmuCompleteInitialisationWorker ();
+  IoMmuEndMmioOperation (Previous);
+  PERF_INMODULE_END ("RiscVIoMmuCompleteInitialisation");
+
+  return Status;
+}
+
+/**
+  Initialisation worker function.
+
+  Initialises every IOMMU that became available, and the first time
+  any is initialised, the shared state and the protocol. The time it
+  takes is recorded for FPDT, whether at the driver's entry or once
+  PCI enumeration has found a PCI IOMMU.
+
+  While initialisation is deferred, the IOMMUs are only started, and
+  a timer completes them once they accepted their registers.
+
+  @retval  EFI_SUCCESS      The available IOMMUs are initialised, or being initialised.
+  @retval  EFI_UNSUPPORTED  No available IOMMU could be initialised.
+
+**/
+EFI_STATUS
+IoMmuCommonInitialise (
+  VOID
+  )
+{
+  EFI_STATUS                  Status;
+  RISCV_IOMMU_MMIO_OPERATION  Previous;
+
+  PERF_INMODULE_BEGIN ("RiscVIoMmuCommonInitialise");
+  Previous = IoMmuBeginMmioOperation (RiscVIoMmuMmioInitialise);
+  IoMmuStartInitialisation ();
+  if (mRiscVIoMmuGlobalDriverContext.Deferred) {
+    IoMmuScheduleDeferredCompletion ();
+    Status = EFI_SUCCESS;
+  } else {
+    Status = IoMmuCompleteInitialisationWorker ();
+  }
+
+  IoMmuEndMmioOperation (Previous);
+  PERF_INMODULE_END ("RiscVIoMmuCommonInitialise");
+
+  return Status;
+}
+
 /**
   Initialise the RISC-V IOMMU driver.
 
@@ -442,8 +1344,16 @@ RiscVIoMmuDxeEntryPoint (
   IN EFI_SYSTEM_TABLE  *SystemTable
   )
 {
+  IoMmuInitialiseCommandStaging ();
   DetectRiscVIoMmus ();
 
+  //
+  // Drivers that start before the hardware is ready are served without translation.
+  //
+  if (mRiscVIoMmuGlobalDriverContext.NumberOfInstances != 0) {
+    IoMmuInstallDeferredProtocol ();
+  }
+
   if (mRiscVIoMmuGlobalDriverContext.DriverState < STATE_AVAILABLE) {
     DEBUG ((DEBUG_ERROR, "Failed to detect a (usable) RISC-V IOMMU at this time\n"));
     return EFI_SUCCESS;
@@ -52,7 +52,10 @@ typedef union {
     UINT64  PD8       : 1;
     UINT64  PD17      : 1;
     UINT64  PD20      : 1;
-    UINT64  Reserved2 : 8;
+    UINT64  QOSID     : 1;
+    UINT64  NL        : 1;
+    UINT64  S         : 1;
+    UINT64  Reserved2 : 12;
     UINT64  Custom    : 8;
   } Bits;
   UINT64  Uint64;
@@ -95,6 +98,144 @@ typedef union {
   UINT64  Uint64;
 } RISCV_IOMMU_DDTP;
 
+//
+// The device_id is partitioned into device-directory indices (DDI), with
+// widths depending on the format of the device context.
+//
+#define N_RISCV_IOMMU_DEVICE_ID_BASE_I1      7
+#define N_RISCV_IOMMU_DEVICE_ID_BASE_I2      16
+#define N_RISCV_IOMMU_DEVICE_ID_EXTENDED_I1  6
+#define N_RISCV_IOMMU_DEVICE_ID_EXTENDED_I2  15
+#define N_RISCV_IOMMU_DEVICE_ID_MAX          24
+
+#define RISCV_IOMMU_DDT_NON_LEAF_INDEX_WIDTH  9
+
+typedef union {
+  struct {
+    UINT32  Function : 3;
+    UINT32  Device   : 5;
+    UINT32  Bus      : 8;
+    UINT32  Segment  : 8;
+    UINT32  Reserved : 8;
+  } PciBdf;
+  UINT32  Uint32;
+} RISCV_IOMMU_DEVICE_ID;
+
+typedef union {
+  struct {
+    UINT64  V         : 1;
+    UINT64  Reserved0 : 9;
+    UINT64  PPN       : 44;
+    UINT64  Reserved1 : 10;
+  } Bits;
+  UINT64  Uint64;
+} RISCV_IOMMU_DDT_NON_LEAF_ENTRY;
+
+typedef union {
+  struct {
+    UINT64  V         : 1;
+    UINT64  EN_ATS    : 1;
+    UINT64  EN_PRI    : 1;
+    UINT64  T2GPA     : 1;
+    UINT64  DTF       : 1;
+    UINT64  PDTV      : 1;
+    UINT64  PRPR      : 1;
+    UINT64  GADE      : 1;
+    UINT64  SADE      : 1;
+    UINT64  DPE       : 1;
+    UINT64  SBE       : 1;
+    UINT64  SXL       : 1;
+    UINT64  Reserved0 : 12;
+    UINT64  Custom    : 8;
+    UINT64  Reserved1 : 32;
+  } Bits;
+  UINT64  Uint64;
+} RISCV_IOMMU_DC_TRANSLATION_CONTROL;
+
+#define V_RISCV_IOMMU_IOHGATP_MODE_BARE  0
+
+typedef union {
+  struct {
+    UINT64  PPN   : 44;
+    UINT64  GSCID : 16;
+    UINT64  MODE  : 4;
+  } Bits;
+  UINT64  Uint64;
+} RISCV_IOMMU_DC_IOHGATP;
+
+typedef union {
+  struct {
+    UINT64  Reserved0 : 12;
+    UINT64  PSCID     : 20;
+    UINT64  Reserved1 : 8;
+    UINT64  RCID      : 12;
+    UINT64  MCID      : 12;
+  } Bits;
+  UINT64  Uint64;
+} RISCV_IOMMU_DC_TRANSLATION_ATTRIBUTES;
+
+// When PDTV is 0, the FSC field holds the `iosatp`. Modes match SATP's encoding.
+#define V_RISCV_IOMMU_IOSATP_MODE_BARE  0
+#define V_RISCV_IOMMU_IOSATP_MODE_SV39  8
+#define V_RISCV_IOMMU_IOSATP_MODE_SV48  9
+#define V_RISCV_IOMMU_IOSATP_MODE_SV57  10
+
+typedef union {
+  struct {
+    UINT64  PPN      : 44;
+    UINT64  Reserved : 16;
+    UINT64  MODE     : 4;
+  } Bits;
+  UINT64  Uint64;
+} RISCV_IOMMU_DC_FIRST_STAGE_CONTEXT;
+
+typedef struct {
+  RISCV_IOMMU_DC_TRANSLATION_CONTROL     TranslationControl;
+  RISCV_IOMMU_DC_IOHGATP                 IoHgatp;
+  RISCV_IOMMU_DC_TRANSLATION_ATTRIBUTES  TranslationAttributes;
+  RISCV_IOMMU_DC_FIRST_STAGE_CONTEXT     FirstStageContext;
+} RISCV_IOMMU_BASE_DEVICE_CONTEXT;
+
+#define V_RISCV_IOMMU_MSIPTP_MODE_OFF   0
+#define V_RISCV_IOMMU_MSIPTP_MODE_FLAT  1
+
+typedef union {
+  struct {
+    UINT64  PPN      : 44;
+    UINT64  Reserved : 16;
+    UINT64  MODE     : 4;
+  } Bits;
+  UINT64  Uint64;
+} RISCV_IOMMU_DC_MSIPTP;
+
+// An MSI PTE in basic translate mode. Its second doubleword is reserved.
+#define V_RISCV_IOMMU_MSI_PTE_MODE_BASIC  3
+
+typedef union {
+  struct {
+    UINT64  V         : 1;
+    UINT64  M         : 2;
+    UINT64  Reserved0 : 7;
+    UINT64  PPN       : 44;
+    UINT64  Reserved1 : 9;
+    UINT64  C         : 1;
+  } Bits;
+  UINT64  Uint64;
+} RISCV_IOMMU_MSI_PTE;
+
+#define RISCV_IOMMU_MSI_PTE_SIZE  16
+
+typedef struct {
+  RISCV_IOMMU_DC_TRANSLATION_CONTROL     TranslationControl;
+  RISCV_IOMMU_DC_IOHGATP                 IoHgatp;
+  RISCV_IOMMU_DC_TRANSLATION_ATTRIBUTES  TranslationAttributes;
+  RISCV_IOMMU_DC_FIRST_STAGE_CONTEXT     FirstStageContext;
+  UINT64                                 MsiPtp;
+  UINT64                                 MsiAddrMask;
+  UINT64                                 MsiAddrPattern;
+  UINT64                                 Reserved;
+} RISCV_IOMMU_EXTENDED_DEVICE_CONTEXT;
+
 #define QUEUE_MAX_LOG_SIZE           16
 
 #define R_RISCV_IOMMU_CQB            0x18
@@ -105,6 +246,72 @@ typedef union {
 
 #define FAULT_QUEUE_ENTRY_SIZE         32
 
+//
+// Fault queue records.
+//
+typedef union {
+  struct {
+    UINT64  CAUSE    : 12;
+    UINT64  PID      : 20;
+    UINT64  PV       : 1;
+    UINT64  PRIV     : 1;
+    UINT64  TTYP     : 6;
+    UINT64  DID      : 24;
+    UINT64  Custom   : 32;
+    UINT64  Reserved : 32;
+    UINT64  iotval   : 64;
+    UINT64  iotval2  : 64;
+  } Bits;
+  UINT64  Uint64[4];
+} RISCV_IOMMU_FAULT_RECORD;
+
+#define V_RISCV_IOMMU_FAULT_TTYP_NONE                  0
+#define V_RISCV_IOMMU_FAULT_TTYP_UNTRANSLATED_EXECUTE  1
+#define V_RISCV_IOMMU_FAULT_TTYP_UNTRANSLATED_READ     2
+#define V_RISCV_IOMMU_FAULT_TTYP_UNTRANSLATED_WRITE    3
+#define V_RISCV_IOMMU_FAULT_TTYP_TRANSLATED_EXECUTE    5
+#define V_RISCV_IOMMU_FAULT_TTYP_TRANSLATED_READ       6
+#define V_RISCV_IOMMU_FAULT_TTYP_TRANSLATED_WRITE      7
+#define V_RISCV_IOMMU_FAULT_TTYP_ATS_REQUEST           9
+#define V_RISCV_IOMMU_FAULT_TTYP_MESSAGE_REQUEST       10
+
+//
+// Causes up to 31 are those of the privileged architecture, and IOMMU-specific causes start at 256.
+//
+#define V_RISCV_IOMMU_FAULT_CAUSE_IOMMU_BASE  256
+
+//
+// Page-request queue records. The payload is that of the PCIe Page Request message.
+//
+typedef union {
+  struct {
+    UINT64  Reserved0 : 12;
+    UINT64  PID       : 20;
+    UINT64  PV        : 1;
+    UINT64  PRIV      : 1;
+    UINT64  EXEC      : 1;
+    UINT64  Reserved1 : 5;
+    UINT64  DID       : 24;
+    UINT64  R         : 1;
+    UINT64  W         : 1;
+    UINT64  L         : 1;
+    UINT64  PRGI      : 9;
+    UINT64  ADDR      : 52;
+  } Bits;
+  UINT64  Uint64[2];
+} RISCV_IOMMU_PAGE_REQUEST_RECORD;
+
+//
+// The payload of ATS.PRGR, that of the PCIe PRG Response message.
+//
+#define N_RISCV_IOMMU_PRGR_PRG_INDEX      32
+#define N_RISCV_IOMMU_PRGR_RESPONSE_CODE  44
+#define N_RISCV_IOMMU_PRGR_DESTINATION    48
+
+#define V_RISCV_IOMMU_PRGR_SUCCESS          0x0
+#define V_RISCV_IOMMU_PRGR_INVALID_REQUEST  0x1
+#define V_RISCV_IOMMU_PRGR_FAILURE          0xF
+
 #define R_RISCV_IOMMU_PQB            0x38
 
 #define PAGE_REQUEST_QUEUE_ENTRY_SIZE  16
@@ -119,6 +326,83 @@ typedef union {
   UINT64  Uint64;
 } RISCV_IOMMU_QUEUE_BASE;
 
+//
+// Command queue entries.
+//
+#define V_RISCV_IOMMU_COMMAND_OPCODE_IOTINVAL  1
+#define V_RISCV_IOMMU_COMMAND_OPCODE_IOFENCE   2
+#define V_RISCV_IOMMU_COMMAND_OPCODE_IODIR     3
+#define V_RISCV_IOMMU_COMMAND_OPCODE_ATS       4
+
+#define V_RISCV_IOMMU_COMMAND_FUNC3_IOTINVAL_VMA    0
+#define V_RISCV_IOMMU_COMMAND_FUNC3_IOTINVAL_GVMA   1
+#define V_RISCV_IOMMU_COMMAND_FUNC3_IOFENCE_C       0
+#define V_RISCV_IOMMU_COMMAND_FUNC3_IODIR_INVAL_DDT  0
+#define V_RISCV_IOMMU_COMMAND_FUNC3_IODIR_INVAL_PDT  1
+#define V_RISCV_IOMMU_COMMAND_FUNC3_ATS_INVAL        0
+#define V_RISCV_IOMMU_COMMAND_FUNC3_ATS_PRGR         1
+
+typedef union {
+  struct {
+    UINT64  Opcode    : 7;
+    UINT64  Func3     : 3;
+    UINT64  Reserved0 : 54;
+    UINT64  Reserved1 : 64;
+  } Common;
+  struct {
+    UINT64  Opcode    : 7;
+    UINT64  Func3     : 3;
+    UINT64  AV        : 1;
+    UINT64  Reserved0 : 1;
+    UINT64  PSCID     : 20;
+    UINT64  PSCV      : 1;
+    UINT64  GV        : 1;
+    UINT64  Reserved1 : 10;
+    UINT64  GSCID     : 16;
+    UINT64  Reserved2 : 4;
+    UINT64  Reserved3 : 10;
+    UINT64  ADDR      : 52;
+    UINT64  Reserved4 : 2;
+  } IoTinval;
+  struct {
+    UINT64  Opcode    : 7;
+    UINT64  Func3     : 3;
+    UINT64  AV        : 1;
+    UINT64  WSI       : 1;
+    UINT64  PR        : 1;
+    UINT64  PW        : 1;
+    UINT64  Reserved0 : 18;
+    UINT64  DATA      : 32;
+    UINT64  ADDR      : 62;
+    UINT64  Reserved1 : 2;
+  } IoFence;
+  struct {
+    UINT64  Opcode    : 7;
+    UINT64  Func3     : 3;
+    UINT64  Reserved0 : 2;
+    UINT64  PID       : 20;
+    UINT64  Reserved1 : 1;
+    UINT64  DV        : 1;
+    UINT64  Reserved2 : 6;
+    UINT64  DID       : 24;
+    UINT64  Reserved3 : 64;
+  } IoDir;
+  struct {
+    UINT64  Opcode    : 7;
+    UINT64  Func3     : 3;
+    UINT64  Reserved0 : 2;
+    UINT64  PID       : 20;
+    UINT64  PV        : 1;
+    UINT64  DSV       : 1;
+    UINT64  Reserved1 : 6;
+    UINT64  RID       : 16;
+    UINT64  DSEG      : 8;
+    // The body of the PCIe Invalidation Request message.
+    UINT64  PAYLOAD   : 64;
+  } Ats;
+  UINT64  Uint64[2];
+} RISCV_IOMMU_COMMAND;
+
 #define R_RISCV_IOMMU_CQH            0x20
 #define R_RISCV_IOMMU_CQT            0x24
 
@@ -192,18 +476,41 @@ typedef union {
   UINT32  Uint32;
 } RISCV_IOMMU_IPSR;
 
-/* TODO: Performance monitoring registers */
-
+//
+// Performance monitoring registers. Bit 0 of IOCNTOVF and IOCNTINH is the cycle
+// counter, and bits 1-31 the event counters.
+//
 #define R_RISCV_IOMMU_IOCNTOVF       0x58
 
 #define R_RISCV_IOMMU_IOCNTINH       0x5c
 
 #define R_RISCV_IOMMU_IOHPMCYCLES    0x60
 
+//
+// Bit 63 of IOHPMCYCLES is its overflow bit, and the others the counter.
+//
+#define B_RISCV_IOMMU_IOHPMCYCLES_OF  BIT63
+
 #define R_RISCV_IOMMU_IOHPMCTR_1_31  0x68
 
 #define R_RISCV_IOMMU_IOHPMEVT_1_31  0x160
 
+#define RISCV_IOMMU_HPM_COUNTERS  31
+
+typedef union {
+  struct {
+    UINT64  eventID   : 15;
+    UINT64  DMASK     : 1;
+    UINT64  PID_PSCID : 20;
+    UINT64  DID_GSCID : 24;
+    UINT64  PV_PSCV   : 1;
+    UINT64  DV_GSCV   : 1;
+    UINT64  IDT       : 1;
+    UINT64  OF        : 1;
+  } Bits;
+  UINT64  Uint64;
+} RISCV_IOMMU_IOHPMEVT;
+
 #define R_RISCV_IOMMU_TR_REQ_IOVA    0x258
 
 typedef union {
@@ -246,10 +553,21 @@ typedef union {
   UINT64  Uint64;
 } RISCV_IOMMU_TR_RESPONSE;
 
-// TODO: IOMMU QoS ID
-
 #define R_RISCV_IOMMU_QOSID          0x270
 
+//
+// The layout of iommu_qosid, and of the QoS IDs of DC.ta. The fields are WARL.
+//
+typedef union {
+  struct {
+    UINT32  RCID      : 12;
+    UINT32  Reserved0 : 4;
+    UINT32  MCID      : 12;
+    UINT32  Reserved1 : 4;
+  } Bits;
+  UINT32  Uint32;
+} RISCV_IOMMU_QOSID;
+
 #define R_RISCV_IOMMU_RESERVED_1     0x274
 
 #define R_RISCV_IOMMU_CUSTOM_2       0x2b0
@@ -268,10 +586,19 @@ typedef union {
   UINT64  Uint64;
 } RISCV_IOMMU_ICVEC;
 
-// TODO: MSI config table register
-
 #define R_RISCV_IOMMU_MSI_CFG_TBL    0x300
 
+#define RISCV_IOMMU_MSI_CFG_TBL_ENTRIES  16
+
+typedef struct {
+  UINT64  msi_addr;
+  UINT32  msi_data;
+  // Bit 0 masks the vector.
+  UINT32  msi_vec_ctl;
+} RISCV_IOMMU_MSI_CFG_TBL_ENTRY;
+
+#define B_RISCV_IOMMU_MSI_VEC_CTL_M  BIT0
+
 #define R_RISCV_IOMMU_RESERVED_2     0x400
 
 #endif
@@ -0,0 +1,361 @@
+/** @file
+  RISC-V IOMMU trace ring.
+
+  Logging every call of the IOMMU protocol services costs more than the
+  calls themselves once the log goes out through the SBI debug console. With
+  PcdRiscVIoMmuTraceEntries, the services are instead wrapped before the
+  protocol is installed, and each call is recorded as a fixed-size binary
+  entry in a ring. The ring is published as a configuration table, for the
+  "iommu" shell command and other tools. Without the PCD, the services are
+  left unwrapped and the ring is compiled out.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Guid/RiscVIoMmuTrace.h>
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
+#include <Library/TimerLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include "RiscVIoMmu.h"
+
+STATIC RISCV_IOMMU_TRACE_TABLE  *mTraceTable = NULL;
+STATIC RISCV_IOMMU_TRACE_ENTRY  *mTraceRing  = NULL;
+
+/**
+  Record a call into the ring, over the oldest entry once it is full.
+
+  @param[in]  Event          The service called.
+  @param[in]  StartTime      The time of the call.
+  @param[in]  Domain         The domain of the device, or NULL if it isn't known.
+  @param[in]  DeviceAddress  The IO virtual address of the buffer.
+  @param[in]  Length         The length of the buffer.
+  @param[in]  Status         What the service returned.
+  @param[in]  Key            What relates the calls of the buffer.
+  @param[in]  HostAddress    The host address of the buffer of Map(), or 0.
+  @param[in]  Argument       The operation, access or attributes of the call.
+
+**/
+STATIC
+VOID
+RecordTraceEntry (
+  IN RISCV_IOMMU_TRACE_EVENT          Event,
+  IN UINT64                           StartTime,
+  IN CONST RISCV_IOMMU_DEVICE_DOMAIN  *Domain OPTIONAL,
+  IN UINT64                           DeviceAddress,
+  IN UINT64                           Length,
+  IN EFI_STATUS                       Status,
+  IN UINT64                           Key,
+  IN UINT64                           HostAddress,
+  IN UINT64                           Argument
+  )
+{
+  RISCV_IOMMU_TRACE_ENTRY  *Entry;
+  UINT64                   EndTime;
+  EFI_TPL                  OriginalTpl;
+
+  EndTime     = GetPerformanceCounter ();
+  OriginalTpl = gBS->RaiseTPL (RISCV_IOMMU_TPL_LEVEL);
+  Entry       = &mTraceRing[mTraceTable->NextEntry & (mTraceTable->NumberOfEntries - 1)];
+  mTraceTable->NextEntry++;
+
+  Entry->Timestamp     = StartTime;
+  Entry->Latency       = EndTime - StartTime;
+  Entry->DeviceAddress = DeviceAddress;
+  Entry->Length        = Length;
+  Entry->Status        = (UINT64)Status;
+  Entry->DeviceId      = (Domain != NULL) ? Domain->DeviceId.Uint32 : RISCV_IOMMU_TRACE_NO_DEVICE_ID;
+  Entry->Event         = Event;
+  Entry->Key           = Key;
+  Entry->HostAddress   = HostAddress;
+  Entry->Argument      = Argument;
+  gBS->RestoreTPL (OriginalTpl);
+}
+
+/**
+  Trace SetAttribute(), with the device it resolved.
+
+  @param[in]  This          The protocol instance pointer.
+  @param[in]  DeviceHandle  The device that is doing the DMA.
+  @param[in]  Mapping       The mapping value returned from Map().
+  @param[in]  IoMmuAccess   The IOMMU access.
+
+  @return  What IoMmuSetAttribute() returned.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+TracedSetAttribute (
+  IN EDKII_IOMMU_PROTOCOL  *This,
+  IN EFI_HANDLE            DeviceHandle,
+  IN VOID                  *Mapping,
+  IN UINT64                IoMmuAccess
+  )
+{
+  UINT64                     StartTime;
+  EFI_STATUS                 Status;
+  MAP_INFO                   *MapInfo;
+  RISCV_IOMMU_INSTANCE       *IoMmu;
+  RISCV_IOMMU_DEVICE_DOMAIN  *Domain;
+
+  StartTime = GetPerformanceCounter ();
+  Status    = IoMmuSetAttribute (This, DeviceHandle, Mapping, IoMmuAccess);
+  MapInfo   = IoMmuFindMapping (Mapping);
+  Domain    = IoMmuLookupDeviceCache (DeviceHandle, &IoMmu);
+  RecordTraceEntry (
+    RiscVIoMmuTraceSetAttribute,
+    StartTime,
+    Domain,
+    (MapInfo != NULL) ? MapInfo->DeviceAddress : 0,
+    (MapInfo != NULL) ? MapInfo->NumberOfBytes : 0,
+    Status,
+    (UINT64)(UINTN)Mapping,
+    0,
+    IoMmuAccess
+    );
+
+  return Status;
+}
+
+/**
+  Trace Map(). The device isn't known until SetAttribute().
+
+  @param[in]      This           The protocol instance pointer.
+  @param[in]      Operation      The type of the bus master operation.
+  @param[in]      HostAddress    The system memory address to map.
+  @param[in, out] NumberOfBytes  The number of bytes to map, and the number mapped.
+  @param[out]     DeviceAddress  The address the device uses for the buffer.
+  @param[out]     Mapping        The mapping value to pass to Unmap().
+
+  @return  What IoMmuMap() returned.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+TracedMap (
+  IN     EDKII_IOMMU_PROTOCOL   *This,
+  IN     EDKII_IOMMU_OPERATION  Operation,
+  IN     VOID                   *HostAddress,
+  IN OUT UINTN                  *NumberOfBytes,
+  OUT    EFI_PHYSICAL_ADDRESS   *DeviceAddress,
+  OUT    VOID                   **Mapping
+  )
+{
+  UINT64      StartTime;
+  EFI_STATUS  Status;
+
+  StartTime = GetPerformanceCounter ();
+  Status    = IoMmuMap (This, Operation, HostAddress, NumberOfBytes, DeviceAddress, Mapping);
+  RecordTraceEntry (
+    RiscVIoMmuTraceMap,
+    StartTime,
+    NULL,
+    !EFI_ERROR (Status) ? *DeviceAddress : 0,
+    (NumberOfBytes != NULL) ? *NumberOfBytes : 0,
+    Status,
+    (!EFI_ERROR (Status) && (Mapping != NULL)) ? (UINT64)(UINTN)*Mapping : 0,
+    (UINT64)(UINTN)HostAddress,
+    Operation
+    );
+
+  return Status;
+}
+
+/**
+  Trace Unmap(), with the device that owns the translation.
+
+  @param[in]  This     The protocol instance pointer.
+  @param[in]  Mapping  The mapping value returned from Map().
+
+  @return  What IoMmuUnmap() returned.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+TracedUnmap (
+  IN  EDKII_IOMMU_PROTOCOL  *This,
+  IN  VOID                  *Mapping
+  )
+{
+  UINT64                     StartTime;
+  EFI_STATUS                 Status;
+  MAP_INFO                   *MapInfo;
+  RISCV_IOMMU_DEVICE_DOMAIN  *Domain;
+  UINT64                     DeviceAddress;
+  UINT64                     Length;
+
+  //
+  // The record may be released by the call.
+  //
+  StartTime     = GetPerformanceCounter ();
+  MapInfo       = IoMmuFindMapping (Mapping);
+  Domain        = (MapInfo != NULL) ? MapInfo->OwnerDomain : NULL;
+  DeviceAddress = (MapInfo != NULL) ? MapInfo->DeviceAddress : 0;
+  Length        = (MapInfo != NULL) ? MapInfo->NumberOfBytes : 0;
+  Status        = IoMmuUnmap (This, Mapping);
+  RecordTraceEntry (RiscVIoMmuTraceUnmap, StartTime, Domain, DeviceAddress, Length, Status, (UINT64)(UINTN)Mapping, 0, 0);
+
+  return Status;
+}
+
+/**
+  Trace AllocateBuffer(). Its buffer is mapped at its host address.
+
+  @param[in]      This         The protocol instance pointer.
+  @param[in]      Type         This parameter is not used and must be ignored.
+  @param[in]      MemoryType   The type of memory to allocate.
+  @param[in]      Pages        The number of pages to allocate.
+  @param[in, out] HostAddress  The base system memory address of the allocated range.
+  @param[in]      Attributes   The requested bit mask of attributes for the allocated range.
+
+  @return  What IoMmuAllocateBuffer() returned.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+TracedAllocateBuffer (
+  IN     EDKII_IOMMU_PROTOCOL  *This,
+  IN     EFI_ALLOCATE_TYPE     Type,
+  IN     EFI_MEMORY_TYPE       MemoryType,
+  IN     UINTN                 Pages,
+  IN OUT VOID                  **HostAddress,
+  IN     UINT64                Attributes
+  )
+{
+  UINT64      StartTime;
+  EFI_STATUS  Status;
+
+  StartTime = GetPerformanceCounter ();
+  Status    = IoMmuAllocateBuffer (This, Type, MemoryType, Pages, HostAddress, Attributes);
+  RecordTraceEntry (
+    RiscVIoMmuTraceAllocateBuffer,
+    StartTime,
+    NULL,
+    !EFI_ERROR (Status) ? (UINT64)(UINTN)*HostAddress : 0,
+    EFI_PAGES_TO_SIZE (Pages),
+    Status,
+    !EFI_ERROR (Status) ? (UINT64)(UINTN)*HostAddress : 0,
+    0,
+    Attributes
+    );
+
+  return Status;
+}
+
+/**
+  Trace FreeBuffer(), with the device that owns the translation.
+
+  @param[in]  This         The protocol instance pointer.
+  @param[in]  Pages        The number of pages to free.
+  @param[in]  HostAddress  The base system memory address of the allocated range.
+
+  @return  What IoMmuFreeBuffer() returned.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+TracedFreeBuffer (
+  IN  EDKII_IOMMU_PROTOCOL  *This,
+  IN  UINTN                 Pages,
+  IN  VOID                  *HostAddress
+  )
+{
+  UINT64                     StartTime;
+  EFI_STATUS                 Status;
+  MAP_INFO                   *MapInfo;
+  RISCV_IOMMU_DEVICE_DOMAIN  *Domain;
+
+  StartTime = GetPerformanceCounter ();
+  MapInfo   = IoMmuFindMappingByDeviceAddress ((EFI_PHYSICAL_ADDRESS)(UINTN)HostAddress);
+  Domain    = (MapInfo != NULL) ? MapInfo->OwnerDomain : NULL;
+  Status    = IoMmuFreeBuffer (This, Pages, HostAddress);
+  RecordTraceEntry (
+    RiscVIoMmuTraceFreeBuffer,
+    StartTime,
+    Domain,
+    (UINT64)(UINTN)HostAddress,
+    EFI_PAGES_TO_SIZE (Pages),
+    Status,
+    (UINT64)(UINTN)HostAddress,
+    0,
+    0
+    );
+
+  return Status;
+}
+
+/**
+  Allocate the trace ring, publish it, and wrap the IOMMU protocol services,
+  if PcdRiscVIoMmuTraceEntries enables tracing.
+
+  Must be called before the protocol is installed.
+
+  @retval  EFI_SUCCESS           The services are traced, or tracing is disabled.
+  @retval  EFI_OUT_OF_RESOURCES  The ring could not be allocated. Nothing is traced.
+  @retval  Others                The ring could not be published. Nothing is traced.
+
+**/
+EFI_STATUS
+IoMmuInitialiseTrace (
+  VOID
+  )
+{
+  UINT32      NumberOfEntries;
+  UINT64      TimerFrequency;
+  EFI_STATUS  Status;
+
+  if (FixedPcdGet32 (PcdRiscVIoMmuTraceEntries) == 0) {
+    return EFI_SUCCESS;
+  }
+
+  NumberOfEntries = GetPowerOfTwo32 (FixedPcdGet32 (PcdRiscVIoMmuTraceEntries));
+  TimerFrequency  = GetPerformanceCounterProperties (NULL, NULL);
+
+  mTraceTable = AllocateZeroPool (sizeof (*mTraceTable) + NumberOfEntries * sizeof (*mTraceRing));
+  if (mTraceTable == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  mTraceTable->Signature       = RISCV_IOMMU_TRACE_TABLE_SIGNATURE;
+  mTraceTable->Revision        = RISCV_IOMMU_TRACE_TABLE_REVISION;
+  mTraceTable->HeaderSize      = sizeof (*mTraceTable);
+  mTraceTable->EntrySize       = sizeof (*mTraceRing);
+  mTraceTable->NumberOfEntries = NumberOfEntries;
+  mTraceTable->TimerFrequency  = TimerFrequency;
+  mTraceRing                   = (RISCV_IOMMU_TRACE_ENTRY *)(mTraceTable + 1);
+
+  Status = gBS->InstallConfigurationTable (&gRiscVIoMmuTraceTableGuid, mTraceTable);
+  if (EFI_ERROR (Status)) {
+    FreePool (mTraceTable);
+    mTraceTable = NULL;
+    mTraceRing  = NULL;
+    return Status;
+  }
+
+  mRiscVIoMmuProtocol.SetAttribute   = TracedSetAttribute;
+  mRiscVIoMmuProtocol.Map            = TracedMap;
+  mRiscVIoMmuProtocol.Unmap          = TracedUnmap;
+  mRiscVIoMmuProtocol.AllocateBuffer = TracedAllocateBuffer;
+  mRiscVIoMmuProtocol.FreeBuffer     = TracedFreeBuffer;
+
+  DEBUG ((
+    RISCV_IOMMU_DEBUG_LEVEL,
+    "%a: Tracing into 0x%x entries at 0x%p, with a %ld Hz timer\n",
+    __func__,
+    NumberOfEntries,
+    mTraceTable,
+    TimerFrequency
+    ));
+
+  return EFI_SUCCESS;
+}
@@ -0,0 +1,446 @@
+/** @file
+  RISC-V IOMMU translation self-test and latency benchmark.
+
+  The debug interface (TR_REQ_IOVA, TR_REQ_CTL and TR_RESPONSE) asks the
+  IOMMU to translate an IO virtual address as a device would, and reports
+  the result. When the IOMMU is initialised, a scratch device context is
+  pointed at a page table built by the ordinary builder, and every mapping
+  of it is checked, along with the faults of a read-only page and of a hole.
+
+  The benchmark repeats the requests for 4 KiB, 2 MiB and 1 GiB leaves in
+  each first-stage mode the IOMMU implements, with the IOTLB flushed, and
+  with the translation cached.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/PcdLib.h>
+#include <Library/TimerLib.h>
+#include "RiscVIoMmu.h"
+
+//
+// The values of PcdRiscVIoMmuTranslationTest.
+//
+#define TRANSLATION_TEST_DISABLED   0
+#define TRANSLATION_TEST_VERIFY     1
+#define TRANSLATION_TEST_BENCHMARK  2
+
+//
+// The test mappings translate each IO virtual address to this much above it.
+// Translation requests don't access the memory, so it needn't exist.
+//
+#define TRANSLATION_TEST_OFFSET  SIZE_1GB
+
+#define TRANSLATION_BENCHMARK_ITERATIONS  32
+
+typedef struct {
+  UINT64    IoVirtualAddress;
+  UINT64    Length;
+  UINT64    IoMmuAccess;
+} TRANSLATION_TEST_MAPPING;
+
+typedef struct {
+  UINT64     IoVirtualAddress;
+  BOOLEAN    Write;
+  BOOLEAN    Fault;
+} TRANSLATION_TEST_PROBE;
+
+//
+// A 4 KiB page of each access, a 2 MiB megapage and a 1 GiB gigapage, all in the Sv39 range.
+//
+STATIC CONST TRANSLATION_TEST_MAPPING  mTestMappings[] = {
+  { 0x40001000, SIZE_4KB, EDKII_IOMMU_ACCESS_READ | EDKII_IOMMU_ACCESS_WRITE },
+  { 0x40002000, SIZE_4KB, EDKII_IOMMU_ACCESS_READ                            },
+  { 0x40200000, SIZE_2MB, EDKII_IOMMU_ACCESS_READ                            },
+  { 0x80000000, SIZE_1GB, EDKII_IOMMU_ACCESS_READ | EDKII_IOMMU_ACCESS_WRITE }
+};
+
+STATIC CONST TRANSLATION_TEST_PROBE  mTestProbes[] = {
+  { 0x40001000, FALSE, FALSE },
+  { 0x40001000, TRUE,  FALSE },
+  { 0x40002000, FALSE, FALSE },
+  { 0x40002000, TRUE,  TRUE  },
+  { 0x40003000, FALSE, TRUE  },
+  { 0x40205000, FALSE, FALSE },
+  { 0x40205000, TRUE,  TRUE  },
+  { 0x80123000, TRUE,  FALSE }
+};
+
+//
+// The probes of the benchmark, one in each leaf size.
+//
+STATIC CONST UINT64  mBenchmarkAddresses[] = { 0x40001000, 0x40205000, 0x80123000 };
+STATIC CONST CHAR8   *mBenchmarkLeafNames[] = { "4K", "2M", "1G" };
+
+/**
+  Translate an IO virtual address through the debug interface.
+
+  @param[in]   IoMmu             The IOMMU.
+  @param[in]   DeviceId          The device_id that requests the translation.
+  @param[in]   IoVirtualAddress  The IO virtual address.
+  @param[in]   Write             Whether write access is requested, rather than read access.
+  @param[out]  Response          The response of the IOMMU.
+
+  @retval  EFI_SUCCESS  Response is valid.
+  @retval  EFI_TIMEOUT  The IOMMU didn't respond.
+
+**/
+STATIC
+EFI_STATUS
+RequestTranslation (
+  IN  RISCV_IOMMU_INSTANCE     *IoMmu,
+  IN  RISCV_IOMMU_DEVICE_ID    DeviceId,
+  IN  UINT64                   IoVirtualAddress,
+  IN  BOOLEAN                  Write,
+  OUT RISCV_IOMMU_TR_RESPONSE  *Response
+  )
+{
+  RISCV_IOMMU_TR_REQ_CTL  Control;
+  EFI_STATUS              Status;
+
+  //
+  // Without a process_id, the request is treated as U-mode without execute access.
+  //
+  IoMmuWrite64 (IoMmu, R_RISCV_IOMMU_TR_REQ_IOVA, IoVirtualAddress & ~(UINT64)EFI_PAGE_MASK);
+  Control.Uint64       = 0;
+  Control.Bits.DID     = DeviceId.Uint32;
+  Control.Bits.NW      = Write ? 0 : 1;
+  Control.Bits.Go_Busy = 1;
+  Status               = IoMmuWriteAndWait64 (IoMmu, R_RISCV_IOMMU_TR_REQ_CTL, Control.Uint64, BIT0, FALSE);
+  Response->Uint64     = IoMmuRead64 (IoMmu, R_RISCV_IOMMU_TR_RESPONSE);
+
+  return Status;
+}
+
+/**
+  Decode the physical address that a response translates an IO virtual address to.
+
+  A response with S set covers a range larger than a page, whose size is encoded in
+  the trailing ones of its PPN, as in PCIe ATS.
+
+  @param[in]   Response          The response, without a fault.
+  @param[in]   IoVirtualAddress  The IO virtual address.
+  @param[out]  Size              The size of the translated range.
+
+  @return  The physical address.
+
+**/
+STATIC
+UINT64
+DecodeTranslation (
+  IN  RISCV_IOMMU_TR_RESPONSE  Response,
+  IN  UINT64                   IoVirtualAddress,
+  OUT UINT64                   *Size
+  )
+{
+  UINT64  Ppn;
+  UINTN   SizeShift;
+
+  Ppn       = Response.Bits.PPN;
+  SizeShift = 0;
+  if (Response.Bits.S) {
+    SizeShift = (UINTN)LowBitSet64 (~Ppn) + 1;
+  }
+
+  *Size = LShiftU64 (SIZE_4KB, SizeShift);
+  return LShiftU64 (Ppn & ~(LShiftU64 (1, SizeShift) - 1), RISCV_MMU_PAGE_SHIFT) |
+         (IoVirtualAddress & (*Size - 1));
+}
+
+/**
+  Build the test mappings in a new page table, and point the scratch device context at it.
+
+  @param[in]   IoMmu          The IOMMU, with the depth of the page table selected.
+  @param[out]  RootPageTable  The root of the page table.
+  @param[out]  DeviceId       The device_id of the scratch device context.
+
+  @retval  EFI_SUCCESS  The scratch device context translates through the mappings.
+  @retval  Others       The mappings or the context could not be set up.
+
+**/
+STATIC
+EFI_STATUS
+SetUpTestMappings (
+  IN  RISCV_IOMMU_INSTANCE   *IoMmu,
+  OUT UINT64                 **RootPageTable,
+  OUT RISCV_IOMMU_DEVICE_ID  *DeviceId
+  )
+{
+  UINTN       Index;
+  EFI_STATUS  Status;
+
+  *RootPageTable = IoMmuAllocatePageTable (IoMmu);
+  if (*RootPageTable == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  //
+  // The scratch context flushes the IOTLB, so the updates may be lazy.
+  //
+  Status = EFI_SUCCESS;
+  for (Index = 0; (Index < ARRAY_SIZE (mTestMappings)) && !EFI_ERROR (Status); Index++) {
+    Status = IoMmuUpdatePageTable (
+               IoMmu,
+               *RootPageTable,
+               RISCV_IOMMU_SCRATCH_PSCID,
+               mTestMappings[Index].IoVirtualAddress,
+               mTestMappings[Index].IoVirtualAddress + TRANSLATION_TEST_OFFSET,
+               mTestMappings[Index].Length,
+               mTestMappings[Index].IoMmuAccess,
+               TRUE
+               );
+  }
+
+  if (!EFI_ERROR (Status)) {
+    Status = IoMmuSetScratchDeviceContext (IoMmu, IoMmu->IoSatpMode, *RootPageTable, DeviceId);
+  }
+
+  if (EFI_ERROR (Status)) {
+    IoMmuFreePageTable (IoMmu, *RootPageTable);
+  }
+
+  return Status;
+}
+
+/**
+  Invalidate the scratch device context, and free its page table.
+
+  @param[in]  IoMmu          The IOMMU, with the depth of the page table selected.
+  @param[in]  RootPageTable  The root of the page table.
+
+**/
+STATIC
+VOID
+TearDownTestMappings (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINT64                *RootPageTable
+  )
+{
+  RISCV_IOMMU_DEVICE_ID  DeviceId;
+
+  //
+  // The IOMMU may still walk the table until the context is invalidated.
+  //
+  if (EFI_ERROR (IoMmuSetScratchDeviceContext (IoMmu, IoMmu->IoSatpMode, NULL, &DeviceId))) {
+    DEBUG ((DEBUG_ERROR, "%a: Failed to invalidate the scratch device context, leaking its page table\n", __func__));
+    return;
+  }
+
+  IoMmuFreePageTable (IoMmu, RootPageTable);
+}
+
+/**
+  Check each probe against the test mappings.
+
+  @param[in]  IoMmu     The IOMMU.
+  @param[in]  DeviceId  The device_id of the scratch device context.
+
+  @retval  EFI_SUCCESS       Every probe translated as mapped.
+  @retval  EFI_DEVICE_ERROR  A probe translated wrongly, or the interface didn't respond.
+
+**/
+STATIC
+EFI_STATUS
+VerifyTestMappings (
+  IN RISCV_IOMMU_INSTANCE   *IoMmu,
+  IN RISCV_IOMMU_DEVICE_ID  DeviceId
+  )
+{
+  CONST TRANSLATION_TEST_PROBE  *Probe;
+  RISCV_IOMMU_TR_RESPONSE       Response;
+  UINT64                        PhysicalAddress;
+  UINT64                        Size;
+  UINTN                         Index;
+  UINTN                         Failures;
+
+  Failures = 0;
+  for (Index = 0; Index < ARRAY_SIZE (mTestProbes); Index++) {
+    Probe = &mTestProbes[Index];
+    if (EFI_ERROR (RequestTranslation (IoMmu, DeviceId, Probe->IoVirtualAddress, Probe->Write, &Response))) {
+      DEBUG ((DEBUG_ERROR, "%a: The IOMMU at 0x%lx didn't respond to a translation request\n", __func__, IoMmu->Address));
+      return EFI_DEVICE_ERROR;
+    }
+
+    if (Response.Bits.fault != Probe->Fault) {
+      DEBUG ((
+        DEBUG_ERROR,
+        "%a: %a of IOVA 0x%lx %a, but shouldn't have\n",
+        __func__,
+        Probe->Write ? "Write" : "Read",
+        Probe->IoVirtualAddress,
+        Response.Bits.fault ? "faulted" : "translated"
+        ));
+      Failures++;
+      continue;
+    }
+
+    if (Probe->Fault) {
+      continue;
+    }
+
+    PhysicalAddress = DecodeTranslation (Response, Probe->IoVirtualAddress, &Size);
+    if (PhysicalAddress != Probe->IoVirtualAddress + TRANSLATION_TEST_OFFSET) {
+      DEBUG ((
+        DEBUG_ERROR,
+        "%a: IOVA 0x%lx translated to 0x%lx instead of 0x%lx\n",
+        __func__,
+        Probe->IoVirtualAddress,
+        PhysicalAddress,
+        Probe->IoVirtualAddress + TRANSLATION_TEST_OFFSET
+        ));
+      Failures++;
+    }
+  }
+
+  return (Failures == 0) ? EFI_SUCCESS : EFI_DEVICE_ERROR;
+}
+
+/**
+  Measure how long the IOMMU takes to translate each leaf size, with the IOTLB
+  flushed before each request, and with the translation cached.
+
+  The times include the accesses to the registers of the debug interface.
+
+  @param[in]  IoMmu     The IOMMU, with the depth of the page table selected.
+  @param[in]  DeviceId  The device_id of the scratch device context.
+
+**/
+STATIC
+VOID
+BenchmarkTestMappings (
+  IN RISCV_IOMMU_INSTANCE   *IoMmu,
+  IN RISCV_IOMMU_DEVICE_ID  DeviceId
+  )
+{
+  RISCV_IOMMU_TR_RESPONSE  Response;
+  UINT64                   Frequency;
+  UINT64                   StartTime;
+  UINT64                   WalkTicks;
+  UINT64                   HitTicks;
+  UINTN                    Leaf;
+  UINTN                    Iteration;
+
+  Frequency = GetPerformanceCounterProperties (NULL, NULL);
+  for (Leaf = 0; Leaf < ARRAY_SIZE (mBenchmarkAddresses); Leaf++) {
+    WalkTicks = 0;
+    HitTicks  = 0;
+    for (Iteration = 0; Iteration < TRANSLATION_BENCHMARK_ITERATIONS; Iteration++) {
+      IoMmuQueueIoTlbInvalidation (IoMmu, TRUE, RISCV_IOMMU_SCRATCH_PSCID, FALSE, 0);
+      if (EFI_ERROR (IoMmuSubmitCommands (IoMmu))) {
+        return;
+      }
+
+      StartTime = RiscVReadTimer ();
+      if (EFI_ERROR (RequestTranslation (IoMmu, DeviceId, mBenchmarkAddresses[Leaf], FALSE, &Response))) {
+        return;
+      }
+
+      WalkTicks += RiscVReadTimer () - StartTime;
+
+      StartTime = RiscVReadTimer ();
+      if (EFI_ERROR (RequestTranslation (IoMmu, DeviceId, mBenchmarkAddresses[Leaf], FALSE, &Response))) {
+        return;
+      }
+
+      HitTicks += RiscVReadTimer () - StartTime;
+    }
+
+    DEBUG ((
+      DEBUG_INFO,
+      "%a: Sv%u %a leaf: %lu ns walked, %lu ns cached\n",
+      __func__,
+      IoMmu->IoPageTableLevels * 9 + RISCV_MMU_PAGE_SHIFT,
+      mBenchmarkLeafNames[Leaf],
+      DivU64x64Remainder (MultU64x32 (WalkTicks, 1000000000), Frequency * TRANSLATION_BENCHMARK_ITERATIONS, NULL),
+      DivU64x64Remainder (MultU64x32 (HitTicks, 1000000000), Frequency * TRANSLATION_BENCHMARK_ITERATIONS, NULL)
+      ));
+  }
+}
+
+/**
+  Verify that an IOMMU translates freshly programmed mappings, through its debug interface,
+  and measure its translation latencies, as PcdRiscVIoMmuTranslationTest asks for.
+
+  Nothing is tested without the debug interface or first-stage page tables.
+
+  @param[in]  IoMmu  The IOMMU, initialised but without domains.
+
+  @retval  EFI_SUCCESS           The translations are correct, or weren't tested.
+  @retval  EFI_DEVICE_ERROR      A translation is wrong, or the interface didn't respond.
+  @retval  EFI_OUT_OF_RESOURCES  The test mappings could not be built.
+
+**/
+EFI_STATUS
+IoMmuTestTranslation (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu
+  )
+{
+  RISCV_IOMMU_CAPABILITIES  Capabilities;
+  RISCV_IOMMU_DEVICE_ID     DeviceId;
+  UINT64                    *RootPageTable;
+  UINT8                     IoSatpMode;
+  UINT8                     IoPageTableLevels;
+  UINT8                     Levels;
+  BOOLEAN                   Supported;
+  EFI_STATUS                Status;
+
+  if (PcdGet8 (PcdRiscVIoMmuTranslationTest) == TRANSLATION_TEST_DISABLED) {
+    return EFI_SUCCESS;
+  }
+
+  Capabilities.Uint64 = IoMmu->Capabilities;
+  if (!Capabilities.Bits.DBG || (IoMmu->IoPageTableLevels == 0)) {
+    DEBUG ((DEBUG_WARN, "%a: The IOMMU at 0x%lx can't be tested\n", __func__, IoMmu->Address));
+    return EFI_SUCCESS;
+  }
+
+  Status = SetUpTestMappings (IoMmu, &RootPageTable, &DeviceId);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "%a: Failed to set up the test mappings: %r\n", __func__, Status));
+    return Status;
+  }
+
+  Status = VerifyTestMappings (IoMmu, DeviceId);
+  TearDownTestMappings (IoMmu, RootPageTable);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "%a: The IOMMU at 0x%lx translates wrongly!\n", __func__, IoMmu->Address));
+    return Status;
+  }
+
+  DEBUG ((DEBUG_INFO, "%a: The IOMMU at 0x%lx translates correctly\n", __func__, IoMmu->Address));
+  if (PcdGet8 (PcdRiscVIoMmuTranslationTest) < TRANSLATION_TEST_BENCHMARK) {
+    return EFI_SUCCESS;
+  }
+
+  //
+  // No domain exists yet, so the IOMMU's own depth can be switched while the
+  // ordinary builder builds the tables of each depth.
+  //
+  IoSatpMode        = IoMmu->IoSatpMode;
+  IoPageTableLevels = IoMmu->IoPageTableLevels;
+  for (Levels = 3; Levels <= 5; Levels++) {
+    Supported = ((Levels == 3) && Capabilities.Bits.Sv39) ||
+                ((Levels == 4) && Capabilities.Bits.Sv48) ||
+                ((Levels == 5) && Capabilities.Bits.Sv57);
+    if (!Supported) {
+      continue;
+    }
+
+    IoMmu->IoSatpMode        = V_RISCV_IOMMU_IOSATP_MODE_SV39 + Levels - 3;
+    IoMmu->IoPageTableLevels = Levels;
+    if (!EFI_ERROR (SetUpTestMappings (IoMmu, &RootPageTable, &DeviceId))) {
+      BenchmarkTestMappings (IoMmu, DeviceId);
+      TearDownTestMappings (IoMmu, RootPageTable);
+    }
+  }
+
+  IoMmu->IoSatpMode        = IoSatpMode;
+  IoMmu->IoPageTableLevels = IoPageTableLevels;
+
+  return EFI_SUCCESS;
+}
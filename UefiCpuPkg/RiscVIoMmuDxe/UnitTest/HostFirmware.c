@@ -0,0 +1,962 @@
+/** @file
+  The firmware that the RISC-V IOMMU driver runs on in host-based tests.
+
+  The boot services of UnitTestUefiBootServicesTableLib are completed with page
+  allocations, which are counted, with events, whose timers run on the virtual clock
+  of the IOMMU model, and with LocateProtocol(). The DXE services describe all of the user address space
+  of the host as system memory, so that the driver identity-maps any host buffer.
+  Files of the host, such as saved traces, are read with the C library.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Uefi.h>
+#include <Pi/PiDxeCis.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/DevicePathLib.h>
+#include <Library/DxeServicesTableLib.h>
+#include <Library/HobLib.h>
+#include <Library/HostMemoryAllocationBelowAddressLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Protocol/Cpu.h>
+#include <stdio.h>
+#include "RiscVIoMmuBenchmark.h"
+#include "RiscVIoMmuModel.h"
+
+//
+// The user address space of the host, which Sv48 covers.
+//
+#define HOST_MEMORY_TOP  SIZE_128TB
+
+#define HOST_EVENT_SIGNATURE  SIGNATURE_32 ('h', 'e', 'v', 't')
+
+typedef struct {
+  UINT32              Signature;
+  LIST_ENTRY          Link;
+  UINT32              Type;
+  EFI_EVENT_NOTIFY    NotifyFunction;
+  VOID                *NotifyContext;
+  // The period of a periodic timer, in nanoseconds, or 0.
+  UINT64              TimerPeriod;
+  // The time that the timer is due, or 0 if it isn't set.
+  UINT64              TimerDue;
+} HOST_EVENT;
+
+typedef struct {
+  LIST_ENTRY              Link;
+  EFI_PHYSICAL_ADDRESS    Base;
+  UINTN                   NumberOfPages;
+  // Whether the pages were allocated below an address, and are freed as such.
+  BOOLEAN                 BelowAddress;
+} HOST_PAGE_ALLOCATION;
+
+STATIC LIST_ENTRY  mEvents          = INITIALIZE_LIST_HEAD_VARIABLE (mEvents);
+STATIC LIST_ENTRY  mPageAllocations = INITIALIZE_LIST_HEAD_VARIABLE (mPageAllocations);
+STATIC UINTN       mAllocatedPages;
+
+STATIC EFI_LOCATE_HANDLE      mUnitTestLocateHandle;
+STATIC EFI_SYSTEM_TABLE       mSystemTable;
+STATIC EFI_DXE_SERVICES       mDxeServices;
+STATIC EFI_CPU_ARCH_PROTOCOL  mCpuArch;
+
+EFI_DXE_SERVICES  *gDS = &mDxeServices;
+
+/**
+  Allocate pages, below an address or anywhere.
+
+  @param[in]      Type        The type of allocation.
+  @param[in]      MemoryType  The type of memory, which is ignored.
+  @param[in]      Pages       The number of pages.
+  @param[in, out] Memory      The maximum address, and the base of the pages.
+
+  @retval  EFI_SUCCESS            The pages are allocated.
+  @retval  EFI_INVALID_PARAMETER  Memory is NULL, or Pages is 0.
+  @retval  EFI_NOT_FOUND          Pages at a fixed address can't be allocated.
+  @retval  EFI_OUT_OF_RESOURCES   The pages could not be allocated.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+HostAllocatePages (
+  IN     EFI_ALLOCATE_TYPE     Type,
+  IN     EFI_MEMORY_TYPE       MemoryType,
+  IN     UINTN                 Pages,
+  IN OUT EFI_PHYSICAL_ADDRESS  *Memory
+  )
+{
+  HOST_PAGE_ALLOCATION  *Allocation;
+  VOID                  *Buffer;
+  BOOLEAN               BelowAddress;
+
+  if ((Memory == NULL) || (Pages == 0)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  //
+  // Host memory can't be claimed at an address.
+  //
+  if (Type == AllocateAddress) {
+    return EFI_NOT_FOUND;
+  }
+
+  Allocation = AllocatePool (sizeof (HOST_PAGE_ALLOCATION));
+  if (Allocation == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  BelowAddress = (Type == AllocateMaxAddress) && (*Memory < HOST_MEMORY_TOP - 1);
+  if (BelowAddress) {
+    Buffer = HostAllocateAlignedPagesBelowAddress (*Memory + 1, Pages, EFI_PAGE_SIZE);
+  } else {
+    Buffer = AllocateAlignedPages (Pages, EFI_PAGE_SIZE);
+  }
+
+  if (Buffer == NULL) {
+    FreePool (Allocation);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Allocation->Base          = (EFI_PHYSICAL_ADDRESS)(UINTN)Buffer;
+  Allocation->NumberOfPages = Pages;
+  Allocation->BelowAddress  = BelowAddress;
+  InsertTailList (&mPageAllocations, &Allocation->Link);
+  mAllocatedPages += Pages;
+
+  *Memory = Allocation->Base;
+  return EFI_SUCCESS;
+}
+
+/**
+  Free pages that HostAllocatePages() allocated.
+
+  @param[in]  Memory  The base of the pages.
+  @param[in]  Pages   The number of pages.
+
+  @retval  EFI_SUCCESS            The pages are freed.
+  @retval  EFI_NOT_FOUND          The pages weren't allocated.
+  @retval  EFI_INVALID_PARAMETER  The number of pages doesn't match the allocation.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+HostFreePages (
+  IN EFI_PHYSICAL_ADDRESS  Memory,
+  IN UINTN                 Pages
+  )
+{
+  LIST_ENTRY            *Link;
+  HOST_PAGE_ALLOCATION  *Allocation;
+
+  for (Link = GetFirstNode (&mPageAllocations)
+       ; !IsNull (&mPageAllocations, Link)
+       ; Link = GetNextNode (&mPageAllocations, Link)
+       ) {
+    Allocation = BASE_CR (Link, HOST_PAGE_ALLOCATION, Link);
+    if (Allocation->Base != Memory) {
+      continue;
+    }
+
+    if (Allocation->NumberOfPages != Pages) {
+      return EFI_INVALID_PARAMETER;
+    }
+
+    if (Allocation->BelowAddress) {
+      HostFreeAlignedPagesBelowAddress ((VOID *)(UINTN)Memory, Pages);
+    } else {
+      FreeAlignedPages ((VOID *)(UINTN)Memory, Pages);
+    }
+
+    RemoveEntryList (&Allocation->Link);
+    FreePool (Allocation);
+    mAllocatedPages -= Pages;
+    return EFI_SUCCESS;
+  }
+
+  return EFI_NOT_FOUND;
+}
+
+/**
+  Create an event.
+
+  @param[in]   Type            The type of event.
+  @param[in]   NotifyTpl       The task priority level of the notifications, which is ignored.
+  @param[in]   NotifyFunction  The notification function.
+  @param[in]   NotifyContext   The context of the notification function.
+  @param[out]  Event           The event.
+
+  @retval  EFI_SUCCESS           The event is created.
+  @retval  EFI_OUT_OF_RESOURCES  The event could not be allocated.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+HostCreateEvent (
+  IN  UINT32            Type,
+  IN  EFI_TPL           NotifyTpl,
+  IN  EFI_EVENT_NOTIFY  NotifyFunction OPTIONAL,
+  IN  VOID              *NotifyContext OPTIONAL,
+  OUT EFI_EVENT         *Event
+  )
+{
+  HOST_EVENT  *HostEvent;
+
+  if (Event == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  HostEvent = AllocateZeroPool (sizeof (HOST_EVENT));
+  if (HostEvent == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  HostEvent->Signature      = HOST_EVENT_SIGNATURE;
+  HostEvent->Type           = Type;
+  HostEvent->NotifyFunction = NotifyFunction;
+  HostEvent->NotifyContext  = NotifyContext;
+  InsertTailList (&mEvents, &HostEvent->Link);
+
+  *Event = HostEvent;
+  return EFI_SUCCESS;
+}
+
+/**
+  Create an event in a group. Groups are never signalled, as the boot never proceeds.
+
+  @param[in]   Type            The type of event.
+  @param[in]   NotifyTpl       The task priority level of the notifications, which is ignored.
+  @param[in]   NotifyFunction  The notification function.
+  @param[in]   NotifyContext   The context of the notification function.
+  @param[in]   EventGroup      The group of the event, which is ignored.
+  @param[out]  Event           The event.
+
+  @retval  EFI_SUCCESS           The event is created.
+  @retval  EFI_OUT_OF_RESOURCES  The event could not be allocated.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+HostCreateEventEx (
+  IN  UINT32            Type,
+  IN  EFI_TPL           NotifyTpl,
+  IN  EFI_EVENT_NOTIFY  NotifyFunction OPTIONAL,
+  IN  CONST VOID        *NotifyContext OPTIONAL,
+  IN  CONST EFI_GUID    *EventGroup OPTIONAL,
+  OUT EFI_EVENT         *Event
+  )
+{
+  return HostCreateEvent (Type, NotifyTpl, NotifyFunction, (VOID *)NotifyContext, Event);
+}
+
+/**
+  Set, or cancel, the timer of an event, on the virtual clock.
+
+  @param[in]  Event        The event.
+  @param[in]  Type         The type of timer.
+  @param[in]  TriggerTime  The time of the timer, in 100ns units.
+
+  @retval  EFI_SUCCESS            The timer is set.
+  @retval  EFI_INVALID_PARAMETER  The event isn't a timer event.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+HostSetTimer (
+  IN EFI_EVENT        Event,
+  IN EFI_TIMER_DELAY  Type,
+  IN UINT64           TriggerTime
+  )
+{
+  HOST_EVENT  *HostEvent;
+  UINT64      Time;
+
+  HostEvent = Event;
+  if ((HostEvent == NULL) || (HostEvent->Signature != HOST_EVENT_SIGNATURE) || ((HostEvent->Type & EVT_TIMER) == 0)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  //
+  // A period of 0 signals the event on every tick.
+  //
+  Time = MultU64x32 (MAX (TriggerTime, 1), 100);
+  switch (Type) {
+    case TimerCancel:
+      HostEvent->TimerPeriod = 0;
+      HostEvent->TimerDue    = 0;
+      break;
+    case TimerPeriodic:
+      HostEvent->TimerPeriod = Time;
+      HostEvent->TimerDue    = RiscVIoMmuModelGetTime () + Time;
+      break;
+    case TimerRelative:
+      HostEvent->TimerPeriod = 0;
+      HostEvent->TimerDue    = RiscVIoMmuModelGetTime () + Time;
+      break;
+    default:
+      return EFI_INVALID_PARAMETER;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Signal an event, whose notification function runs at once.
+
+  @param[in]  Event  The event.
+
+  @retval  EFI_SUCCESS            The event is signalled.
+  @retval  EFI_INVALID_PARAMETER  Event isn't an event.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+HostSignalEvent (
+  IN EFI_EVENT  Event
+  )
+{
+  HOST_EVENT  *HostEvent;
+
+  HostEvent = Event;
+  if ((HostEvent == NULL) || (HostEvent->Signature != HOST_EVENT_SIGNATURE)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (((HostEvent->Type & EVT_NOTIFY_SIGNAL) != 0) && (HostEvent->NotifyFunction != NULL)) {
+    HostEvent->NotifyFunction (HostEvent, HostEvent->NotifyContext);
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Close an event, cancelling its timer.
+
+  @param[in]  Event  The event.
+
+  @retval  EFI_SUCCESS            The event is closed.
+  @retval  EFI_INVALID_PARAMETER  Event isn't an event.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+HostCloseEvent (
+  IN EFI_EVENT  Event
+  )
+{
+  HOST_EVENT  *HostEvent;
+
+  HostEvent = Event;
+  if ((HostEvent == NULL) || (HostEvent->Signature != HOST_EVENT_SIGNATURE)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  RemoveEntryList (&HostEvent->Link);
+  HostEvent->Signature = 0;
+  FreePool (HostEvent);
+  return EFI_SUCCESS;
+}
+
+/**
+  Register for the installation of a protocol. No protocol that the driver waits for
+  is ever installed, so the registration is only the event.
+
+  @param[in]   Protocol      The protocol.
+  @param[in]   Event         The event to signal.
+  @param[out]  Registration  The registration.
+
+  @retval  EFI_SUCCESS  The registration is returned.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+HostRegisterProtocolNotify (
+  IN  EFI_GUID   *Protocol,
+  IN  EFI_EVENT  Event,
+  OUT VOID       **Registration
+  )
+{
+  *Registration = Event;
+  return EFI_SUCCESS;
+}
+
+/**
+  Locate handles, where no handle was installed since any registration.
+
+  @param[in]      SearchType  The type of search.
+  @param[in]      Protocol    The protocol to search for.
+  @param[in]      SearchKey   The registration, for ByRegisterNotify.
+  @param[in, out] BufferSize  The size of Buffer, and of the handles returned.
+  @param[out]     Buffer      The handles.
+
+  @retval  EFI_NOT_FOUND  No handle matches.
+  @retval  Others         As returned by the protocol database.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+HostLocateHandle (
+  IN     EFI_LOCATE_SEARCH_TYPE  SearchType,
+  IN     EFI_GUID                *Protocol OPTIONAL,
+  IN     VOID                    *SearchKey OPTIONAL,
+  IN OUT UINTN                   *BufferSize,
+  OUT    EFI_HANDLE              *Buffer
+  )
+{
+  if (SearchType == ByRegisterNotify) {
+    return EFI_NOT_FOUND;
+  }
+
+  return mUnitTestLocateHandle (SearchType, Protocol, SearchKey, BufferSize, Buffer);
+}
+
+/**
+  Locate the first interface of a protocol, in the protocol database.
+
+  @param[in]   Protocol      The protocol.
+  @param[in]   Registration  The registration, after which no interface was installed.
+  @param[out]  Interface     The interface.
+
+  @retval  EFI_SUCCESS    The interface is returned.
+  @retval  EFI_NOT_FOUND  No handle has the protocol.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+HostLocateProtocol (
+  IN  EFI_GUID  *Protocol,
+  IN  VOID      *Registration OPTIONAL,
+  OUT VOID      **Interface
+  )
+{
+  EFI_HANDLE  *Handles;
+  UINTN       NumberOfHandles;
+  EFI_STATUS  Status;
+
+  *Interface = NULL;
+  if (Registration != NULL) {
+    return EFI_NOT_FOUND;
+  }
+
+  Status = gBS->LocateHandleBuffer (ByProtocol, Protocol, NULL, &NumberOfHandles, &Handles);
+  if (EFI_ERROR (Status)) {
+    return EFI_NOT_FOUND;
+  }
+
+  Status = gBS->HandleProtocol (Handles[0], Protocol, Interface);
+  FreePool (Handles);
+  return Status;
+}
+
+/**
+  Get the memory space map, which is a single range of system memory.
+
+  @param[out]  NumberOfDescriptors  The number of descriptors.
+  @param[out]  MemorySpaceMap       The map, which the caller frees.
+
+  @retval  EFI_SUCCESS           The map is returned.
+  @retval  EFI_OUT_OF_RESOURCES  The map could not be allocated.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+HostGetMemorySpaceMap (
+  OUT UINTN                            *NumberOfDescriptors,
+  OUT EFI_GCD_MEMORY_SPACE_DESCRIPTOR  **MemorySpaceMap
+  )
+{
+  *MemorySpaceMap = AllocateZeroPool (sizeof (EFI_GCD_MEMORY_SPACE_DESCRIPTOR));
+  if (*MemorySpaceMap == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  (*MemorySpaceMap)->BaseAddress   = 0;
+  (*MemorySpaceMap)->Length        = HOST_MEMORY_TOP;
+  (*MemorySpaceMap)->Capabilities  = EFI_MEMORY_WB;
+  (*MemorySpaceMap)->Attributes    = EFI_MEMORY_WB;
+  (*MemorySpaceMap)->GcdMemoryType = EfiGcdMemoryTypeSystemMemory;
+  *NumberOfDescriptors             = 1;
+  return EFI_SUCCESS;
+}
+
+/**
+  Get the descriptor of the memory space at an address.
+
+  @param[in]   BaseAddress  The address.
+  @param[out]  Descriptor   The descriptor.
+
+  @retval  EFI_SUCCESS    The descriptor is returned.
+  @retval  EFI_NOT_FOUND  The address is beyond the user address space of the host.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+HostGetMemorySpaceDescriptor (
+  IN  EFI_PHYSICAL_ADDRESS             BaseAddress,
+  OUT EFI_GCD_MEMORY_SPACE_DESCRIPTOR  *Descriptor
+  )
+{
+  if (BaseAddress >= HOST_MEMORY_TOP) {
+    return EFI_NOT_FOUND;
+  }
+
+  ZeroMem (Descriptor, sizeof (*Descriptor));
+  Descriptor->BaseAddress   = 0;
+  Descriptor->Length        = HOST_MEMORY_TOP;
+  Descriptor->Capabilities  = EFI_MEMORY_WB;
+  Descriptor->Attributes    = EFI_MEMORY_WB;
+  Descriptor->GcdMemoryType = EfiGcdMemoryTypeSystemMemory;
+  return EFI_SUCCESS;
+}
+
+/**
+  Claim address space below an address. The host pages are reserved, so that no
+  buffer that the driver identity-maps ever collides with the space.
+
+  @param[in]      GcdAllocateType  The type of allocation, only below an address.
+  @param[in]      GcdMemoryType    The type of memory space, which is ignored.
+  @param[in]      Alignment        The alignment of the space, as log2.
+  @param[in]      Length           The size of the space.
+  @param[in, out] BaseAddress      The maximum address, and the base of the space.
+  @param[in]      ImageHandle      The owner of the space, which is ignored.
+  @param[in]      DeviceHandle     The device of the space, which is ignored.
+
+  @retval  EFI_SUCCESS           The space is claimed.
+  @retval  EFI_UNSUPPORTED       The type of allocation isn't supported.
+  @retval  EFI_OUT_OF_RESOURCES  No space could be claimed.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+HostAllocateMemorySpace (
+  IN     EFI_GCD_ALLOCATE_TYPE  GcdAllocateType,
+  IN     EFI_GCD_MEMORY_TYPE    GcdMemoryType,
+  IN     UINTN                  Alignment,
+  IN     UINT64                 Length,
+  IN OUT EFI_PHYSICAL_ADDRESS   *BaseAddress,
+  IN     EFI_HANDLE             ImageHandle,
+  IN     EFI_HANDLE             DeviceHandle OPTIONAL
+  )
+{
+  VOID  *Buffer;
+
+  if ((GcdAllocateType != EfiGcdAllocateMaxAddressSearchTopDown) &&
+      (GcdAllocateType != EfiGcdAllocateMaxAddressSearchBottomUp))
+  {
+    return EFI_UNSUPPORTED;
+  }
+
+  Buffer = HostAllocateAlignedPagesBelowAddress (
+             MIN (*BaseAddress, HOST_MEMORY_TOP - 1) + 1,
+             EFI_SIZE_TO_PAGES (Length),
+             LShiftU64 (1, Alignment)
+             );
+  if (Buffer == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  *BaseAddress = (EFI_PHYSICAL_ADDRESS)(UINTN)Buffer;
+  return EFI_SUCCESS;
+}
+
+/**
+  Set the attributes of a range of memory, which the host hart always accesses.
+
+  @param[in]  This         The CPU architectural protocol.
+  @param[in]  BaseAddress  The base of the range.
+  @param[in]  Length       The size of the range.
+  @param[in]  Attributes   The attributes.
+
+  @retval  EFI_SUCCESS  The attributes are set.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+HostSetMemoryAttributes (
+  IN EFI_CPU_ARCH_PROTOCOL  *This,
+  IN EFI_PHYSICAL_ADDRESS   BaseAddress,
+  IN UINT64                 Length,
+  IN UINT64                 Attributes
+  )
+{
+  return EFI_SUCCESS;
+}
+
+/**
+  Find the first HOB of a GUID. No PEIM ran before the driver, so there are none.
+
+  @param[in]  Guid  The GUID of the HOB.
+
+  @return  NULL.
+
+**/
+VOID *
+EFIAPI
+GetFirstGuidHob (
+  IN CONST EFI_GUID  *Guid
+  )
+{
+  return NULL;
+}
+
+/**
+  Find the next HOB of a GUID. No PEIM ran before the driver, so there are none.
+
+  @param[in]  Guid      The GUID of the HOB.
+  @param[in]  HobStart  The HOB to start from.
+
+  @return  NULL.
+
+**/
+VOID *
+EFIAPI
+GetNextGuidHob (
+  IN CONST EFI_GUID  *Guid,
+  IN CONST VOID      *HobStart
+  )
+{
+  return NULL;
+}
+
+/**
+  Get the location of a PCI function.
+
+  @param[in]   This            The PCI I/O instance of the function.
+  @param[out]  SegmentNumber   The segment.
+  @param[out]  BusNumber       The bus.
+  @param[out]  DeviceNumber    The device.
+  @param[out]  FunctionNumber  The function.
+
+  @retval  EFI_SUCCESS  The location is returned.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+HostPciIoGetLocation (
+  IN  EFI_PCI_IO_PROTOCOL  *This,
+  OUT UINTN                *SegmentNumber,
+  OUT UINTN                *BusNumber,
+  OUT UINTN                *DeviceNumber,
+  OUT UINTN                *FunctionNumber
+  )
+{
+  HOST_PCI_FUNCTION  *Function;
+
+  Function        = BASE_CR (This, HOST_PCI_FUNCTION, PciIo);
+  *SegmentNumber  = 0;
+  *BusNumber      = Function->Bus;
+  *DeviceNumber   = Function->Device;
+  *FunctionNumber = Function->Function;
+  return EFI_SUCCESS;
+}
+
+/**
+  Get the attributes of a PCI function. They can't be changed.
+
+  @param[in]   This        The PCI I/O instance of the function.
+  @param[in]   Operation   The operation.
+  @param[in]   Attributes  The attributes to change, which is ignored.
+  @param[out]  Result      The attributes of the function.
+
+  @retval  EFI_SUCCESS      The attributes are returned.
+  @retval  EFI_UNSUPPORTED  The operation isn't EfiPciIoAttributeOperationGet.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+HostPciIoAttributes (
+  IN  EFI_PCI_IO_PROTOCOL                      *This,
+  IN  EFI_PCI_IO_PROTOCOL_ATTRIBUTE_OPERATION  Operation,
+  IN  UINT64                                   Attributes,
+  OUT UINT64                                   *Result OPTIONAL
+  )
+{
+  HOST_PCI_FUNCTION  *Function;
+
+  if ((Operation != EfiPciIoAttributeOperationGet) || (Result == NULL)) {
+    return EFI_UNSUPPORTED;
+  }
+
+  Function = BASE_CR (This, HOST_PCI_FUNCTION, PciIo);
+  *Result  = Function->Attributes;
+  return EFI_SUCCESS;
+}
+
+/**
+  Read the configuration space of a PCI function.
+
+  @param[in]   This    The PCI I/O instance of the function.
+  @param[in]   Width   The width of each access.
+  @param[in]   Offset  The offset of the first access.
+  @param[in]   Count   The number of accesses.
+  @param[out]  Buffer  The data read.
+
+  @retval  EFI_SUCCESS            The data is read.
+  @retval  EFI_INVALID_PARAMETER  The width isn't supported.
+  @retval  EFI_UNSUPPORTED        The accesses are beyond the configuration space.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+HostPciIoConfigRead (
+  IN  EFI_PCI_IO_PROTOCOL        *This,
+  IN  EFI_PCI_IO_PROTOCOL_WIDTH  Width,
+  IN  UINT32                     Offset,
+  IN  UINTN                      Count,
+  OUT VOID                       *Buffer
+  )
+{
+  HOST_PCI_FUNCTION  *Function;
+  UINTN              Length;
+
+  if (Width > EfiPciIoWidthUint64) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Length = Count << Width;
+  if ((Offset > sizeof (Function->Config)) || (Length > sizeof (Function->Config) - Offset)) {
+    return EFI_UNSUPPORTED;
+  }
+
+  Function = BASE_CR (This, HOST_PCI_FUNCTION, PciIo);
+  CopyMem (Buffer, &Function->Config[Offset], Length);
+  return EFI_SUCCESS;
+}
+
+/**
+  Create a PCI function, with its PCI I/O and device path on a new handle.
+
+  @param[in]  Bus          The bus number.
+  @param[in]  Device       The device number.
+  @param[in]  Function     The function number.
+  @param[in]  ClassCode    The class code, as base class, sub-class and programming interface.
+  @param[in]  DualAddress  Whether the function's driver enabled dual address cycles.
+
+  @return  The function, or NULL if it could not be created.
+
+**/
+HOST_PCI_FUNCTION *
+HostCreatePciFunction (
+  IN UINT8    Bus,
+  IN UINT8    Device,
+  IN UINT8    Function,
+  IN UINT32   ClassCode,
+  IN BOOLEAN  DualAddress
+  )
+{
+  HOST_PCI_FUNCTION  *PciFunction;
+  PCI_TYPE00         *Header;
+  EFI_STATUS         Status;
+
+  PciFunction = AllocateZeroPool (sizeof (HOST_PCI_FUNCTION));
+  if (PciFunction == NULL) {
+    return NULL;
+  }
+
+  PciFunction->Bus               = Bus;
+  PciFunction->Device            = Device;
+  PciFunction->Function          = Function;
+  PciFunction->Attributes        = EFI_PCI_IO_ATTRIBUTE_BUS_MASTER;
+  PciFunction->PciIo.GetLocation = HostPciIoGetLocation;
+  PciFunction->PciIo.Attributes  = HostPciIoAttributes;
+  PciFunction->PciIo.Pci.Read    = HostPciIoConfigRead;
+  if (DualAddress) {
+    PciFunction->Attributes |= EFI_PCI_IO_ATTRIBUTE_DUAL_ADDRESS_CYCLE;
+  }
+
+  //
+  // A QEMU function, without capabilities.
+  //
+  Header                   = (PCI_TYPE00 *)PciFunction->Config;
+  Header->Hdr.VendorId     = 0x1B36;
+  Header->Hdr.DeviceId     = 0x0010;
+  Header->Hdr.ClassCode[0] = (UINT8)ClassCode;
+  Header->Hdr.ClassCode[1] = (UINT8)(ClassCode >> 8);
+  Header->Hdr.ClassCode[2] = (UINT8)(ClassCode >> 16);
+
+  PciFunction->DevicePath.Pci.Header.Type    = HARDWARE_DEVICE_PATH;
+  PciFunction->DevicePath.Pci.Header.SubType = HW_PCI_DP;
+  SetDevicePathNodeLength (&PciFunction->DevicePath.Pci.Header, sizeof (PCI_DEVICE_PATH));
+  PciFunction->DevicePath.Pci.Device   = Device;
+  PciFunction->DevicePath.Pci.Function = Function;
+  SetDevicePathEndNode (&PciFunction->DevicePath.End);
+
+  Status = gBS->InstallMultipleProtocolInterfaces (
+                  &PciFunction->Handle,
+                  &gEfiPciIoProtocolGuid,
+                  &PciFunction->PciIo,
+                  &gEfiDevicePathProtocolGuid,
+                  &PciFunction->DevicePath,
+                  NULL
+                  );
+  if (EFI_ERROR (Status)) {
+    FreePool (PciFunction);
+    return NULL;
+  }
+
+  return PciFunction;
+}
+
+/**
+  Signal the timer events that are due by the time of the virtual clock.
+
+**/
+VOID
+HostFirmwareRunTimers (
+  VOID
+  )
+{
+  LIST_ENTRY  *Link;
+  LIST_ENTRY  *NextLink;
+  HOST_EVENT  *HostEvent;
+  UINT64      Time;
+
+  Time = RiscVIoMmuModelGetTime ();
+  for (Link = GetFirstNode (&mEvents); !IsNull (&mEvents, Link); Link = NextLink) {
+    //
+    // The notification may close its own event.
+    //
+    NextLink  = GetNextNode (&mEvents, Link);
+    HostEvent = BASE_CR (Link, HOST_EVENT, Link);
+    if ((HostEvent->TimerDue == 0) || (HostEvent->TimerDue > Time)) {
+      continue;
+    }
+
+    HostEvent->TimerDue = (HostEvent->TimerPeriod != 0) ? Time + HostEvent->TimerPeriod : 0;
+    HostSignalEvent (HostEvent);
+  }
+}
+
+/**
+  Get the number of pages that the driver holds from the boot services.
+
+  @return  The number of pages.
+
+**/
+UINTN
+HostFirmwareGetAllocatedPages (
+  VOID
+  )
+{
+  return mAllocatedPages;
+}
+
+/**
+  Install the boot and DXE services that the driver runs on: page allocations that are
+  counted, events whose timers run on the virtual clock, a system memory map covering the
+  user address space of the host, and the CPU architectural protocol.
+
+  @retval  EFI_SUCCESS  The services are installed.
+  @retval  Others       The CPU architectural protocol could not be installed.
+
+**/
+EFI_STATUS
+HostFirmwareInitialise (
+  VOID
+  )
+{
+  EFI_HANDLE  Handle;
+
+  gBS->AllocatePages          = HostAllocatePages;
+  gBS->FreePages              = HostFreePages;
+  gBS->CreateEvent            = HostCreateEvent;
+  gBS->CreateEventEx          = HostCreateEventEx;
+  gBS->SetTimer               = HostSetTimer;
+  gBS->SignalEvent            = HostSignalEvent;
+  gBS->CloseEvent             = HostCloseEvent;
+  gBS->RegisterProtocolNotify = HostRegisterProtocolNotify;
+  mUnitTestLocateHandle       = gBS->LocateHandle;
+  gBS->LocateHandle           = HostLocateHandle;
+  gBS->LocateProtocol         = HostLocateProtocol;
+
+  //
+  // No configuration tables are installed, so there is no device tree and no ACPI.
+  //
+  mSystemTable.Hdr.Signature = EFI_SYSTEM_TABLE_SIGNATURE;
+  mSystemTable.BootServices  = gBS;
+  gST                        = &mSystemTable;
+
+  mDxeServices.Hdr.Signature            = DXE_SERVICES_SIGNATURE;
+  mDxeServices.GetMemorySpaceMap        = HostGetMemorySpaceMap;
+  mDxeServices.GetMemorySpaceDescriptor = HostGetMemorySpaceDescriptor;
+  mDxeServices.AllocateMemorySpace      = HostAllocateMemorySpace;
+
+  mCpuArch.SetMemoryAttributes = HostSetMemoryAttributes;
+  mCpuArch.DmaBufferAlignment  = 64;
+
+  Handle = NULL;
+  return gBS->InstallProtocolInterface (&Handle, &gEfiCpuArchProtocolGuid, EFI_NATIVE_INTERFACE, &mCpuArch);
+}
+
+/**
+  Read a file of the host into a pool buffer.
+
+  @param[in]   Path    The path of the file.
+  @param[out]  Buffer  The contents, which the caller frees.
+  @param[out]  Size    The size of the contents.
+
+  @retval  EFI_SUCCESS           The file is read.
+  @retval  EFI_NOT_FOUND         The file could not be opened.
+  @retval  EFI_DEVICE_ERROR      The file could not be read.
+  @retval  EFI_OUT_OF_RESOURCES  The buffer could not be allocated.
+
+**/
+EFI_STATUS
+HostReadFile (
+  IN  CONST CHAR8  *Path,
+  OUT VOID         **Buffer,
+  OUT UINTN        *Size
+  )
+{
+  FILE        *File;
+  long        Length;
+  EFI_STATUS  Status;
+
+  File = fopen (Path, "rb");
+  if (File == NULL) {
+    return EFI_NOT_FOUND;
+  }
+
+  Status = EFI_DEVICE_ERROR;
+  if ((fseek (File, 0, SEEK_END) != 0) || ((Length = ftell (File)) < 0) || (fseek (File, 0, SEEK_SET) != 0)) {
+    goto Done;
+  }
+
+  *Buffer = AllocatePool (MAX ((UINTN)Length, 1));
+  if (*Buffer == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto Done;
+  }
+
+  if (fread (*Buffer, 1, (size_t)Length, File) != (size_t)Length) {
+    FreePool (*Buffer);
+    goto Done;
+  }
+
+  *Size  = (UINTN)Length;
+  Status = EFI_SUCCESS;
+
+Done:
+  fclose (File);
+  return Status;
+}
@@ -0,0 +1,1108 @@
+/** @file
+  Map/Unmap throughput benchmark of the RISC-V IOMMU driver, on the host model of the IOMMU.
+
+  Each workload maps buffers of a PCI function, grants the function access, lets it DMA
+  through the model now and then to check the translation, revokes the access and unmaps.
+  The throughput is measured on the virtual clock, which includes the latencies of the
+  commands that the driver waits for and of the table walks, and is reported along with
+  the commands issued per operation and the memory that the driver holds.
+
+  Each argument is a trace saved by "iommu -r -f" on a real boot, whose calls are replayed
+  against the driver in order, on stand-in buffers at the same page offsets, so that a
+  change to the driver is measured on the DMA of a real board. The policies that are
+  build-time PCDs, such as PcdRiscVIoMmuLazyInvalidation, the bounce pool size and the
+  IOVA window, are compared by building the benchmark with --pcd overrides and replaying
+  the same trace.
+
+  With --non-coherent as the first argument, the model IOMMU and the buffers of its devices
+  don't snoop the hart's cache, so the workloads check that the driver cleans everything
+  the IOMMU reads, and report the cache-block operations that Map() and Unmap() issue.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UnitTestLib.h>
+#include <Guid/RiscVIoMmuTrace.h>
+#include <Protocol/IoMmu.h>
+
+#include "../RiscVIoMmu.h"
+#include "RiscVIoMmuBenchmark.h"
+#include "RiscVIoMmuModel.h"
+
+#define UNIT_TEST_NAME     "RISC-V IOMMU Map/Unmap Benchmark"
+#define UNIT_TEST_VERSION  "1.0"
+
+//
+// The latencies of a modest implementation, with the tables in DRAM.
+//
+#define BENCHMARK_COMMAND_LATENCY  1000
+#define BENCHMARK_WALK_LATENCY     100
+
+//
+// Every so many operations, the function DMAs through the mapping.
+//
+#define BENCHMARK_VERIFY_INTERVAL  64
+
+typedef struct {
+  CONST CHAR8              *Name;
+  UINT8                    Device;
+  UINT32                   ClassCode;
+  BOOLEAN                  DualAddress;
+  EDKII_IOMMU_OPERATION    Operation;
+  // The size of each buffer, and its offset into its slot of the region.
+  UINTN                    BufferSize;
+  UINTN                    BufferOffset;
+  // The size of the region that the buffers are taken from, in slots of BufferSize.
+  UINTN                    NumberOfSlots;
+  BOOLEAN                  Random;
+  UINTN                    Iterations;
+} BENCHMARK_WORKLOAD;
+
+STATIC BENCHMARK_WORKLOAD  mWorkloads[] = {
+  //
+  // Single-page reads of a disk, scattered over 1 MiB, which the firmware already owns.
+  //
+  {
+    "NVMe-like 4K random", 1, 0x010802, TRUE, EdkiiIoMmuOperationBusMasterWrite64,
+    SIZE_4KB, 0, 256, TRUE, 16384
+  },
+  //
+  // Megabyte writes to a controller, one after the other.
+  //
+  {
+    "Large sequential", 2, 0x020000, TRUE, EdkiiIoMmuOperationBusMasterRead64,
+    SIZE_1MB, 0, 16, FALSE, 512
+  },
+  //
+  // Small, unaligned transfers of a 32-bit USB controller, which are all bounced.
+  //
+  {
+    "Bounce-heavy 32-bit", 3, 0x0C0320, FALSE, EdkiiIoMmuOperationBusMasterWrite,
+    512, 0x40, 64, TRUE, 16384
+  },
+};
+
+//
+// The devices that a replayed trace is attributed to.
+//
+#define REPLAY_MAX_DEVICES  64
+
+//
+// A buffer of a replayed trace, which is live from its Map() or AllocateBuffer() to its
+// Unmap() or FreeBuffer().
+//
+typedef struct {
+  UINT64                   Key;
+  BOOLEAN                  Live;
+  BOOLEAN                  Allocated;
+  EDKII_IOMMU_OPERATION    Operation;
+  // The Mapping of Map(), and the pages that stand in for its buffer.
+  VOID                     *Mapping;
+  VOID                     *Region;
+  // The pages of Region, or of the buffer of AllocateBuffer().
+  UINTN                    Pages;
+  VOID                     *HostAddress;
+} REPLAY_BUFFER;
+
+typedef struct {
+  UINT32               DeviceId;
+  HOST_PCI_FUNCTION    *Function;
+} REPLAY_DEVICE;
+
+STATIC RISCV_IOMMU_MODEL     *mModel;
+STATIC EDKII_IOMMU_PROTOCOL  *mIoMmu;
+STATIC UINT32                mRandomState = 1;
+STATIC BOOLEAN               mNonCoherent;
+
+/**
+  Get the next number of a fixed pseudo-random sequence, so that every run maps the same buffers.
+
+  @return  The number.
+
+**/
+STATIC
+UINT32
+GetRandom (
+  VOID
+  )
+{
+  mRandomState = mRandomState * 1103515245 + 12345;
+  return mRandomState >> 8;
+}
+
+/**
+  The device_id of a PCI function at an IOMMU without routing tables, which is its RID.
+
+  @param[in]  Function  The function.
+
+  @return  The device_id.
+
+**/
+STATIC
+UINT32
+GetDeviceId (
+  IN HOST_PCI_FUNCTION  *Function
+  )
+{
+  return ((UINT32)Function->Bus << 8) | ((UINT32)Function->Device << 3) | Function->Function;
+}
+
+/**
+  Get the access that a function needs for an operation.
+
+  @param[in]  Operation  The operation.
+
+  @return  The EDKII_IOMMU_ACCESS_* flags.
+
+**/
+STATIC
+UINT64
+GetOperationAccess (
+  IN EDKII_IOMMU_OPERATION  Operation
+  )
+{
+  switch (Operation) {
+    case EdkiiIoMmuOperationBusMasterRead:
+    case EdkiiIoMmuOperationBusMasterRead64:
+      return EDKII_IOMMU_ACCESS_READ;
+    case EdkiiIoMmuOperationBusMasterWrite:
+    case EdkiiIoMmuOperationBusMasterWrite64:
+      return EDKII_IOMMU_ACCESS_WRITE;
+    default:
+      return EDKII_IOMMU_ACCESS_READ | EDKII_IOMMU_ACCESS_WRITE;
+  }
+}
+
+/**
+  Print a count per operation, with two decimals.
+
+  @param[in]  Name        The name of the count.
+  @param[in]  Count       The count.
+  @param[in]  Operations  The number of operations.
+
+**/
+STATIC
+VOID
+PrintPerOperation (
+  IN CONST CHAR8  *Name,
+  IN UINT64       Count,
+  IN UINT64       Operations
+  )
+{
+  UINT64  Hundredths;
+
+  Hundredths = DivU64x64Remainder (MultU64x32 (Count, 100), Operations, NULL);
+  DEBUG ((
+    DEBUG_INFO,
+    "  %-22a %lu.%02lu\n",
+    Name,
+    DivU64x32 (Hundredths, 100),
+    ModU64x32 (Hundredths, 100)
+    ));
+}
+
+/**
+  Get the cache-block operations of the hart that the model counted.
+
+  @return  The number of cbo.clean, cbo.flush and cbo.inval.
+
+**/
+STATIC
+UINT64
+GetCacheOperations (
+  VOID
+  )
+{
+  RISCV_IOMMU_MODEL_STATISTICS  Statistics;
+
+  RiscVIoMmuModelGetStatistics (mModel, &Statistics);
+  return Statistics.CacheCleans + Statistics.CacheFlushes + Statistics.CacheInvalidates;
+}
+
+/**
+  Print the cache-block operations per operation, and the stale reads, of a non-coherent model.
+
+  @param[in]  Statistics  The statistics of the model.
+  @param[in]  Operations  The number of operations.
+
+**/
+STATIC
+VOID
+PrintCacheOperations (
+  IN CONST RISCV_IOMMU_MODEL_STATISTICS  *Statistics,
+  IN UINT64                              Operations
+  )
+{
+  PrintPerOperation ("cbo.clean/op", Statistics->CacheCleans, Operations);
+  PrintPerOperation ("cbo.flush/op", Statistics->CacheFlushes, Operations);
+  PrintPerOperation ("cbo.inval/op", Statistics->CacheInvalidates, Operations);
+  DEBUG ((DEBUG_INFO, "  %-22a %lu\n", "Stale reads", Statistics->StaleReads));
+}
+
+/**
+  Print the register accesses of an operation of the driver per operation of a workload,
+  if the driver counts them.
+
+  @param[in]  Name        The name of the count.
+  @param[in]  Operation   The operation of the driver.
+  @param[in]  Before      The accesses of the operation before the workload.
+  @param[in]  Operations  The number of operations of the workload.
+
+**/
+STATIC
+VOID
+PrintMmioPerOperation (
+  IN CONST CHAR8                        *Name,
+  IN RISCV_IOMMU_MMIO_OPERATION         Operation,
+  IN CONST RISCV_IOMMU_MMIO_STATISTICS  *Before,
+  IN UINT64                             Operations
+  )
+{
+  RISCV_IOMMU_MMIO_STATISTICS  After;
+
+  if (EFI_ERROR (mRiscVIoMmuDiagnosticsProtocol.GetMmioStatistics (&mRiscVIoMmuDiagnosticsProtocol, Operation, &After))) {
+    return;
+  }
+
+  PrintPerOperation (Name, (After.Reads - Before->Reads) + (After.Writes - Before->Writes), Operations);
+}
+
+/**
+  Run a workload against the driver, and report its throughput, commands and footprint.
+
+  @param[in]  Context  The BENCHMARK_WORKLOAD.
+
+  @retval  UNIT_TEST_PASSED             Every operation succeeded, and every DMA saw the data of its buffer.
+  @retval  UNIT_TEST_ERROR_TEST_FAILED  An operation failed, a DMA went astray, or the IOMMU read
+                                        memory that the driver didn't clean.
+
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+RunWorkload (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  BENCHMARK_WORKLOAD            *Workload;
+  HOST_PCI_FUNCTION             *Function;
+  UINT8                         *Region;
+  UINT8                         *Buffer;
+  UINT8                         *DeviceData;
+  UINT64                        Access;
+  UINTN                         Index;
+  UINTN                         Slot;
+  UINTN                         NumberOfBytes;
+  EFI_PHYSICAL_ADDRESS          DeviceAddress;
+  VOID                          *Mapping;
+  BOOLEAN                       Verify;
+  BOOLEAN                       DeviceWrites;
+  UINTN                         PagesBefore;
+  UINT64                        StartTime;
+  UINT64                        Elapsed;
+  UINT64                        MapCacheOperations;
+  UINT64                        UnmapCacheOperations;
+  RISCV_IOMMU_MODEL_STATISTICS  Statistics;
+  RISCV_IOMMU_MMIO_STATISTICS   MapMmio;
+  RISCV_IOMMU_MMIO_STATISTICS   UnmapMmio;
+  EFI_STATUS                    Status;
+
+  Workload = Context;
+  Function = HostCreatePciFunction (0, Workload->Device, 0, Workload->ClassCode, Workload->DualAddress);
+  UT_ASSERT_NOT_NULL (Function);
+
+  Region     = AllocateAlignedPages (EFI_SIZE_TO_PAGES (Workload->BufferSize * Workload->NumberOfSlots), EFI_PAGE_SIZE);
+  DeviceData = AllocatePool (Workload->BufferSize);
+  UT_ASSERT_NOT_NULL (Region);
+  UT_ASSERT_NOT_NULL (DeviceData);
+
+  Access       = GetOperationAccess (Workload->Operation);
+  DeviceWrites = ((Access & EDKII_IOMMU_ACCESS_WRITE) != 0);
+
+  //
+  // The first operation of the function also creates its device context.
+  //
+  RiscVIoMmuModelResetStatistics (mModel);
+  ZeroMem (&MapMmio, sizeof (MapMmio));
+  ZeroMem (&UnmapMmio, sizeof (UnmapMmio));
+  mRiscVIoMmuDiagnosticsProtocol.GetMmioStatistics (&mRiscVIoMmuDiagnosticsProtocol, RiscVIoMmuMmioMap, &MapMmio);
+  mRiscVIoMmuDiagnosticsProtocol.GetMmioStatistics (&mRiscVIoMmuDiagnosticsProtocol, RiscVIoMmuMmioUnmap, &UnmapMmio);
+  PagesBefore          = HostFirmwareGetAllocatedPages ();
+  MapCacheOperations   = 0;
+  UnmapCacheOperations = 0;
+  StartTime            = RiscVIoMmuModelGetTime ();
+
+  for (Index = 0; Index < Workload->Iterations; Index++) {
+    Slot   = Workload->Random ? (GetRandom () % Workload->NumberOfSlots) : (Index % Workload->NumberOfSlots);
+    Buffer = Region + Slot * Workload->BufferSize + Workload->BufferOffset;
+    Verify = ((Index % BENCHMARK_VERIFY_INTERVAL) == 0);
+
+    //
+    // The data that the function reads, or is expected to write.
+    //
+    if (Verify) {
+      SetMem (DeviceData, Workload->BufferSize, (UINT8)(Index / BENCHMARK_VERIFY_INTERVAL + 1));
+      if (!DeviceWrites) {
+        CopyMem (Buffer, DeviceData, Workload->BufferSize);
+      }
+    }
+
+    NumberOfBytes       = Workload->BufferSize;
+    MapCacheOperations -= GetCacheOperations ();
+    Status              = mIoMmu->Map (mIoMmu, Workload->Operation, Buffer, &NumberOfBytes, &DeviceAddress, &Mapping);
+    MapCacheOperations += GetCacheOperations ();
+    UT_ASSERT_NOT_EFI_ERROR (Status);
+    UT_ASSERT_EQUAL (NumberOfBytes, Workload->BufferSize);
+
+    Status = mIoMmu->SetAttribute (mIoMmu, Function->Handle, Mapping, Access);
+    UT_ASSERT_NOT_EFI_ERROR (Status);
+
+    if (Verify) {
+      if (DeviceWrites) {
+        Status = RiscVIoMmuModelDma (mModel, GetDeviceId (Function), DeviceAddress, DeviceData, Workload->BufferSize, TRUE);
+        UT_ASSERT_NOT_EFI_ERROR (Status);
+      } else {
+        ZeroMem (DeviceData, Workload->BufferSize);
+        Status = RiscVIoMmuModelDma (mModel, GetDeviceId (Function), DeviceAddress, DeviceData, Workload->BufferSize, FALSE);
+        UT_ASSERT_NOT_EFI_ERROR (Status);
+        UT_ASSERT_MEM_EQUAL (DeviceData, Buffer, Workload->BufferSize);
+      }
+    }
+
+    Status = mIoMmu->SetAttribute (mIoMmu, Function->Handle, Mapping, 0);
+    UT_ASSERT_NOT_EFI_ERROR (Status);
+
+    UnmapCacheOperations -= GetCacheOperations ();
+    Status                = mIoMmu->Unmap (mIoMmu, Mapping);
+    UnmapCacheOperations += GetCacheOperations ();
+    UT_ASSERT_NOT_EFI_ERROR (Status);
+
+    //
+    // A bounced write is only copied to the buffer by Unmap().
+    //
+    if (Verify && DeviceWrites) {
+      UT_ASSERT_MEM_EQUAL (Buffer, DeviceData, Workload->BufferSize);
+    }
+
+    HostFirmwareRunTimers ();
+  }
+
+  Elapsed = RiscVIoMmuModelGetTime () - StartTime;
+  RiscVIoMmuModelGetStatistics (mModel, &Statistics);
+  UT_ASSERT_EQUAL (Statistics.Faults, 0);
+  UT_ASSERT_EQUAL (Statistics.StaleReads, 0);
+
+  DEBUG ((
+    DEBUG_INFO,
+    "%a: %lu operations of 0x%lx bytes in %lu us\n",
+    Workload->Name,
+    (UINT64)Workload->Iterations,
+    (UINT64)Workload->BufferSize,
+    DivU64x32 (Elapsed, 1000)
+    ));
+  DEBUG ((
+    DEBUG_INFO,
+    "  %-22a %lu\n",
+    "Operations/s",
+    DivU64x64Remainder (MultU64x32 (Workload->Iterations, 1000000000), MAX (Elapsed, 1), NULL)
+    ));
+  PrintPerOperation ("IOTINVAL/op", Statistics.Commands[V_RISCV_IOMMU_COMMAND_OPCODE_IOTINVAL], Workload->Iterations);
+  PrintPerOperation ("IOFENCE/op", Statistics.Commands[V_RISCV_IOMMU_COMMAND_OPCODE_IOFENCE], Workload->Iterations);
+  PrintPerOperation ("IODIR/op", Statistics.Commands[V_RISCV_IOMMU_COMMAND_OPCODE_IODIR], Workload->Iterations);
+  PrintPerOperation ("Doorbells/op", Statistics.CommandQueueDoorbells, Workload->Iterations);
+  PrintPerOperation ("Register accesses/op", Statistics.RegisterReads + Statistics.RegisterWrites, Workload->Iterations);
+  PrintMmioPerOperation ("Map registers/op", RiscVIoMmuMmioMap, &MapMmio, Workload->Iterations);
+  PrintMmioPerOperation ("Unmap registers/op", RiscVIoMmuMmioUnmap, &UnmapMmio, Workload->Iterations);
+  if (mNonCoherent) {
+    PrintPerOperation ("Map CMOs/op", MapCacheOperations, Workload->Iterations);
+    PrintPerOperation ("Unmap CMOs/op", UnmapCacheOperations, Workload->Iterations);
+    PrintCacheOperations (&Statistics, Workload->Iterations);
+  }
+
+  DEBUG ((DEBUG_INFO, "  %-22a %lu\n", "Table pages", (UINT64)RiscVIoMmuModelCountTablePages (mModel)));
+  DEBUG ((
+    DEBUG_INFO,
+    "  %-22a %lu (%ld during the run)\n",
+    "Pages held",
+    (UINT64)HostFirmwareGetAllocatedPages (),
+    (INT64)(HostFirmwareGetAllocatedPages () - PagesBefore)
+    ));
+
+  FreePool (DeviceData);
+  FreeAlignedPages (Region, EFI_SIZE_TO_PAGES (Workload->BufferSize * Workload->NumberOfSlots));
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Find the live buffer of a replayed trace that a call relates to.
+
+  @param[in]  Buffers          The buffers of the trace.
+  @param[in]  NumberOfBuffers  The number of buffers.
+  @param[in]  Key              The Key of the call.
+
+  @return  The buffer, or NULL if it was mapped before the trace starts.
+
+**/
+STATIC
+REPLAY_BUFFER *
+FindReplayBuffer (
+  IN REPLAY_BUFFER  *Buffers,
+  IN UINTN          NumberOfBuffers,
+  IN UINT64         Key
+  )
+{
+  UINTN  Index;
+
+  for (Index = NumberOfBuffers; Index > 0; Index--) {
+    if (Buffers[Index - 1].Live && (Buffers[Index - 1].Key == Key)) {
+      return &Buffers[Index - 1];
+    }
+  }
+
+  return NULL;
+}
+
+/**
+  Get the PCI function that stands in for a device of a replayed trace, creating it on
+  first use at the RID of the device_id.
+
+  @param[in, out]  Devices          The devices of the trace.
+  @param[in, out]  NumberOfDevices  The number of devices.
+  @param[in]       DeviceId         The device_id.
+  @param[in]       DualAddress      Whether the device maps buffers above 4 GiB.
+
+  @return  The function, or NULL if it could not be created.
+
+**/
+STATIC
+HOST_PCI_FUNCTION *
+GetReplayDevice (
+  IN OUT REPLAY_DEVICE  *Devices,
+  IN OUT UINTN          *NumberOfDevices,
+  IN     UINT32         DeviceId,
+  IN     BOOLEAN        DualAddress
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < *NumberOfDevices; Index++) {
+    if (Devices[Index].DeviceId == DeviceId) {
+      return Devices[Index].Function;
+    }
+  }
+
+  if (*NumberOfDevices == REPLAY_MAX_DEVICES) {
+    return NULL;
+  }
+
+  Devices[Index].DeviceId = DeviceId;
+  Devices[Index].Function = HostCreatePciFunction (
+                              (UINT8)(DeviceId >> 8),
+                              (UINT8)((DeviceId >> 3) & 0x1F),
+                              (UINT8)(DeviceId & 0x7),
+                              0,
+                              DualAddress
+                              );
+  if (Devices[Index].Function == NULL) {
+    return NULL;
+  }
+
+  (*NumberOfDevices)++;
+  return Devices[Index].Function;
+}
+
+/**
+  Replay a trace saved by "iommu -r -f" against the driver, and report its throughput,
+  commands and footprint.
+
+  Only the calls that succeeded are replayed. The calls on buffers that were mapped before
+  the oldest entry of the trace, or on devices that it doesn't name, are skipped, and the
+  buffers that are still mapped at its end are released once the replay is measured.
+
+  @param[in]  Context  The path of the trace.
+
+  @retval  UNIT_TEST_PASSED             Every call that the driver made succeeded again.
+  @retval  UNIT_TEST_ERROR_TEST_FAILED  The trace is unusable, or a call failed.
+
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+ReplayTrace (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  RISCV_IOMMU_TRACE_TABLE        *Table;
+  CONST RISCV_IOMMU_TRACE_ENTRY  *Entry;
+  UINTN                          Size;
+  UINT64                         Index;
+  REPLAY_BUFFER                  *Buffers;
+  REPLAY_BUFFER                  *Buffer;
+  UINTN                          NumberOfBuffers;
+  REPLAY_DEVICE                  Devices[REPLAY_MAX_DEVICES];
+  UINTN                          NumberOfDevices;
+  HOST_PCI_FUNCTION              *Function;
+  UINTN                          Offset;
+  UINTN                          NumberOfBytes;
+  EFI_PHYSICAL_ADDRESS           DeviceAddress;
+  UINT64                         Calls;
+  UINT64                         Skipped;
+  UINT64                         TracedTicks;
+  UINTN                          PagesBefore;
+  UINT64                         StartTime;
+  UINT64                         Elapsed;
+  RISCV_IOMMU_MODEL_STATISTICS   Statistics;
+  EFI_STATUS                     Status;
+
+  Status = HostReadFile (Context, (VOID **)&Table, &Size);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+
+  //
+  // The entries of revision 0x00010000 don't carry the arguments of the calls.
+  //
+  UT_ASSERT_TRUE (Size >= sizeof (RISCV_IOMMU_TRACE_TABLE));
+  UT_ASSERT_EQUAL (Table->Signature, RISCV_IOMMU_TRACE_TABLE_SIGNATURE);
+  UT_ASSERT_TRUE (Table->Revision >= 0x00010001);
+  UT_ASSERT_TRUE (Table->HeaderSize >= sizeof (RISCV_IOMMU_TRACE_TABLE));
+  UT_ASSERT_TRUE (Table->EntrySize >= sizeof (RISCV_IOMMU_TRACE_ENTRY));
+  UT_ASSERT_TRUE (Size >= Table->HeaderSize);
+  UT_ASSERT_TRUE (Table->NextEntry <= DivU64x32 (Size - Table->HeaderSize, Table->EntrySize));
+
+  Buffers = AllocateZeroPool (MAX ((UINTN)Table->NextEntry, 1) * sizeof (REPLAY_BUFFER));
+  UT_ASSERT_NOT_NULL (Buffers);
+
+  NumberOfBuffers = 0;
+  NumberOfDevices = 0;
+  Calls           = 0;
+  Skipped         = 0;
+  TracedTicks     = 0;
+
+  RiscVIoMmuModelResetStatistics (mModel);
+  PagesBefore = HostFirmwareGetAllocatedPages ();
+  StartTime   = RiscVIoMmuModelGetTime ();
+
+  for (Index = 0; Index < Table->NextEntry; Index++) {
+    Entry = (CONST RISCV_IOMMU_TRACE_ENTRY *)((UINT8 *)Table + Table->HeaderSize + (UINTN)Index * Table->EntrySize);
+    if (Entry->Status != EFI_SUCCESS) {
+      continue;
+    }
+
+    Buffer = FindReplayBuffer (Buffers, NumberOfBuffers, Entry->Key);
+    switch (Entry->Event) {
+      case RiscVIoMmuTraceMap:
+        //
+        // The stand-in keeps the page offset of the buffer, which decides what is bounced.
+        //
+        Buffer            = &Buffers[NumberOfBuffers++];
+        Offset            = (UINTN)(Entry->HostAddress & EFI_PAGE_MASK);
+        Buffer->Key       = Entry->Key;
+        Buffer->Operation = (EDKII_IOMMU_OPERATION)Entry->Argument;
+        Buffer->Pages     = EFI_SIZE_TO_PAGES (Offset + (UINTN)Entry->Length);
+        Buffer->Region    = AllocateAlignedPages (Buffer->Pages, EFI_PAGE_SIZE);
+        UT_ASSERT_NOT_NULL (Buffer->Region);
+
+        NumberOfBytes = (UINTN)Entry->Length;
+        Status        = mIoMmu->Map (
+                                  mIoMmu,
+                                  Buffer->Operation,
+                                  (UINT8 *)Buffer->Region + Offset,
+                                  &NumberOfBytes,
+                                  &DeviceAddress,
+                                  &Buffer->Mapping
+                                  );
+        UT_ASSERT_NOT_EFI_ERROR (Status);
+        Buffer->Live = TRUE;
+        break;
+
+      case RiscVIoMmuTraceSetAttribute:
+        if ((Buffer == NULL) || Buffer->Allocated || (Entry->DeviceId == RISCV_IOMMU_TRACE_NO_DEVICE_ID)) {
+          Skipped++;
+          continue;
+        }
+
+        Function = GetReplayDevice (
+                     Devices,
+                     &NumberOfDevices,
+                     Entry->DeviceId,
+                     (BOOLEAN)(Buffer->Operation >= EdkiiIoMmuOperationBusMasterRead64)
+                     );
+        UT_ASSERT_NOT_NULL (Function);
+
+        Status = mIoMmu->SetAttribute (mIoMmu, Function->Handle, Buffer->Mapping, Entry->Argument);
+        UT_ASSERT_NOT_EFI_ERROR (Status);
+        break;
+
+      case RiscVIoMmuTraceUnmap:
+        if ((Buffer == NULL) || Buffer->Allocated) {
+          Skipped++;
+          continue;
+        }
+
+        Status = mIoMmu->Unmap (mIoMmu, Buffer->Mapping);
+        UT_ASSERT_NOT_EFI_ERROR (Status);
+        FreeAlignedPages (Buffer->Region, Buffer->Pages);
+        Buffer->Live = FALSE;
+        break;
+
+      case RiscVIoMmuTraceAllocateBuffer:
+        Buffer            = &Buffers[NumberOfBuffers++];
+        Buffer->Key       = Entry->Key;
+        Buffer->Allocated = TRUE;
+        Buffer->Pages     = EFI_SIZE_TO_PAGES ((UINTN)Entry->Length);
+
+        Status = mIoMmu->AllocateBuffer (
+                           mIoMmu,
+                           AllocateAnyPages,
+                           EfiBootServicesData,
+                           Buffer->Pages,
+                           &Buffer->HostAddress,
+                           Entry->Argument
+                           );
+        UT_ASSERT_NOT_EFI_ERROR (Status);
+        Buffer->Live = TRUE;
+        break;
+
+      case RiscVIoMmuTraceFreeBuffer:
+        if ((Buffer == NULL) || !Buffer->Allocated) {
+          Skipped++;
+          continue;
+        }
+
+        Status = mIoMmu->FreeBuffer (mIoMmu, Buffer->Pages, Buffer->HostAddress);
+        UT_ASSERT_NOT_EFI_ERROR (Status);
+        Buffer->Live = FALSE;
+        break;
+
+      default:
+        Skipped++;
+        continue;
+    }
+
+    Calls++;
+    TracedTicks += Entry->Latency;
+    HostFirmwareRunTimers ();
+  }
+
+  Elapsed = RiscVIoMmuModelGetTime () - StartTime;
+  RiscVIoMmuModelGetStatistics (mModel, &Statistics);
+  UT_ASSERT_TRUE (Calls > 0);
+  UT_ASSERT_EQUAL (Statistics.StaleReads, 0);
+
+  DEBUG ((
+    DEBUG_INFO,
+    "%a: %lu calls replayed in %lu us, %lu us on the board, %lu skipped\n",
+    (CONST CHAR8 *)Context,
+    Calls,
+    DivU64x32 (Elapsed, 1000),
+    (Table->TimerFrequency != 0) ? DivU64x64Remainder (MultU64x32 (TracedTicks, 1000000), Table->TimerFrequency, NULL) : 0,
+    Skipped
+    ));
+  DEBUG ((
+    DEBUG_INFO,
+    "  %-22a %lu\n",
+    "Calls/s",
+    DivU64x64Remainder (MultU64x32 (Calls, 1000000000), MAX (Elapsed, 1), NULL)
+    ));
+  PrintPerOperation ("IOTINVAL/call", Statistics.Commands[V_RISCV_IOMMU_COMMAND_OPCODE_IOTINVAL], Calls);
+  PrintPerOperation ("IOFENCE/call", Statistics.Commands[V_RISCV_IOMMU_COMMAND_OPCODE_IOFENCE], Calls);
+  PrintPerOperation ("IODIR/call", Statistics.Commands[V_RISCV_IOMMU_COMMAND_OPCODE_IODIR], Calls);
+  PrintPerOperation ("Register accesses/call", Statistics.RegisterReads + Statistics.RegisterWrites, Calls);
+  if (mNonCoherent) {
+    PrintCacheOperations (&Statistics, Calls);
+  }
+
+  DEBUG ((DEBUG_INFO, "  %-22a %lu\n", "Table pages", (UINT64)RiscVIoMmuModelCountTablePages (mModel)));
+  DEBUG ((
+    DEBUG_INFO,
+    "  %-22a %lu (%ld during the run)\n",
+    "Pages held",
+    (UINT64)HostFirmwareGetAllocatedPages (),
+    (INT64)(HostFirmwareGetAllocatedPages () - PagesBefore)
+    ));
+
+  //
+  // Release what the boot would have kept, so that the next replay starts clean.
+  //
+  for (Index = 0; Index < NumberOfBuffers; Index++) {
+    Buffer = &Buffers[Index];
+    if (!Buffer->Live) {
+      continue;
+    }
+
+    if (Buffer->Allocated) {
+      mIoMmu->FreeBuffer (mIoMmu, Buffer->Pages, Buffer->HostAddress);
+    } else {
+      mIoMmu->Unmap (mIoMmu, Buffer->Mapping);
+      FreeAlignedPages (Buffer->Region, Buffer->Pages);
+    }
+  }
+
+  FreePool (Buffers);
+  FreePool (Table);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Check that the function is denied the access it wasn't granted, and any access once unmapped.
+
+  @param[in]  Context  Unused.
+
+  @retval  UNIT_TEST_PASSED             Every DMA outside the grant faulted.
+  @retval  UNIT_TEST_ERROR_TEST_FAILED  A DMA outside the grant reached memory.
+
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+CheckProtection (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  HOST_PCI_FUNCTION             *Function;
+  UINT8                         *Buffer;
+  UINT8                         Data[64];
+  UINTN                         NumberOfBytes;
+  EFI_PHYSICAL_ADDRESS          DeviceAddress;
+  VOID                          *Mapping;
+  RISCV_IOMMU_MODEL_STATISTICS  Statistics;
+  EFI_STATUS                    Status;
+
+  Function = HostCreatePciFunction (0, 4, 0, 0x010802, TRUE);
+  Buffer   = AllocateAlignedPages (1, EFI_PAGE_SIZE);
+  UT_ASSERT_NOT_NULL (Function);
+  UT_ASSERT_NOT_NULL (Buffer);
+
+  RiscVIoMmuModelResetStatistics (mModel);
+  SetMem (Buffer, EFI_PAGE_SIZE, 0x5A);
+  SetMem (Data, sizeof (Data), 0xA5);
+
+  NumberOfBytes = EFI_PAGE_SIZE;
+  Status        = mIoMmu->Map (mIoMmu, EdkiiIoMmuOperationBusMasterRead64, Buffer, &NumberOfBytes, &DeviceAddress, &Mapping);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+
+  Status = mIoMmu->SetAttribute (mIoMmu, Function->Handle, Mapping, EDKII_IOMMU_ACCESS_READ);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+
+  //
+  // The function may read the buffer, but not write it.
+  //
+  Status = RiscVIoMmuModelDma (mModel, GetDeviceId (Function), DeviceAddress, Data, sizeof (Data), FALSE);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  UT_ASSERT_EQUAL (Data[0], 0x5A);
+
+  SetMem (Data, sizeof (Data), 0xA5);
+  Status = RiscVIoMmuModelDma (mModel, GetDeviceId (Function), DeviceAddress, Data, sizeof (Data), TRUE);
+  UT_ASSERT_STATUS_EQUAL (Status, EFI_ACCESS_DENIED);
+  UT_ASSERT_EQUAL (Buffer[0], 0x5A);
+
+  Status = mIoMmu->SetAttribute (mIoMmu, Function->Handle, Mapping, 0);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+
+  Status = mIoMmu->Unmap (mIoMmu, Mapping);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+
+  //
+  // Once unmapped, not even a cached translation lets it read.
+  //
+  Status = RiscVIoMmuModelDma (mModel, GetDeviceId (Function), DeviceAddress, Data, sizeof (Data), FALSE);
+  UT_ASSERT_STATUS_EQUAL (Status, EFI_ACCESS_DENIED);
+
+  RiscVIoMmuModelGetStatistics (mModel, &Statistics);
+  UT_ASSERT_EQUAL (Statistics.Faults, 2);
+
+  FreeAlignedPages (Buffer, 1);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Check that a function faulting in a storm is quarantined: once its faults are drained,
+  all of its DMA is blocked, even to the buffers it was granted, without more fault records.
+
+  @param[in]  Context  Unused.
+
+  @retval  UNIT_TEST_PASSED             The function was blocked after the storm, silently.
+  @retval  UNIT_TEST_ERROR_TEST_FAILED  Its DMA still reached memory, or kept recording faults.
+
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+CheckFaultStorm (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  HOST_PCI_FUNCTION             *Function;
+  UINT8                         *Buffer;
+  UINT8                         Data[64];
+  UINTN                         NumberOfBytes;
+  EFI_PHYSICAL_ADDRESS          DeviceAddress;
+  VOID                          *Mapping;
+  UINT32                        Storm;
+  UINT32                        Index;
+  RISCV_IOMMU_MODEL_STATISTICS  Statistics;
+  EFI_STATUS                    Status;
+
+  if (PcdGet32 (PcdRiscVIoMmuFaultStormThreshold) == 0) {
+    return UNIT_TEST_SKIPPED;
+  }
+
+  Function = HostCreatePciFunction (0, 5, 0, 0x020000, TRUE);
+  Buffer   = AllocateAlignedPages (1, EFI_PAGE_SIZE);
+  UT_ASSERT_NOT_NULL (Function);
+  UT_ASSERT_NOT_NULL (Buffer);
+
+  NumberOfBytes = EFI_PAGE_SIZE;
+  Status        = mIoMmu->Map (mIoMmu, EdkiiIoMmuOperationBusMasterRead64, Buffer, &NumberOfBytes, &DeviceAddress, &Mapping);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+
+  Status = mIoMmu->SetAttribute (mIoMmu, Function->Handle, Mapping, EDKII_IOMMU_ACCESS_READ);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+
+  Status = RiscVIoMmuModelDma (mModel, GetDeviceId (Function), DeviceAddress, Data, sizeof (Data), FALSE);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+
+  //
+  // The function writes outside its mapping, past the threshold, before the fault timer drains.
+  //
+  RiscVIoMmuModelResetStatistics (mModel);
+  Storm = PcdGet32 (PcdRiscVIoMmuFaultStormThreshold) + 1;
+  for (Index = 0; Index < Storm; Index++) {
+    Status = RiscVIoMmuModelDma (mModel, GetDeviceId (Function), DeviceAddress, Data, sizeof (Data), TRUE);
+    UT_ASSERT_STATUS_EQUAL (Status, EFI_ACCESS_DENIED);
+  }
+
+  RiscVIoMmuModelAdvanceTime (200000000);
+  HostFirmwareRunTimers ();
+
+  //
+  // Even the read it was granted is now blocked, and nothing more is recorded.
+  //
+  Status = RiscVIoMmuModelDma (mModel, GetDeviceId (Function), DeviceAddress, Data, sizeof (Data), FALSE);
+  UT_ASSERT_STATUS_EQUAL (Status, EFI_ACCESS_DENIED);
+  for (Index = 0; Index < Storm; Index++) {
+    Status = RiscVIoMmuModelDma (mModel, GetDeviceId (Function), DeviceAddress, Data, sizeof (Data), TRUE);
+    UT_ASSERT_STATUS_EQUAL (Status, EFI_ACCESS_DENIED);
+  }
+
+  RiscVIoMmuModelGetStatistics (mModel, &Statistics);
+  UT_ASSERT_EQUAL (Statistics.Faults, Storm);
+
+  //
+  // Its driver may still release what it mapped.
+  //
+  Status = mIoMmu->SetAttribute (mIoMmu, Function->Handle, Mapping, 0);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+
+  Status = mIoMmu->Unmap (mIoMmu, Mapping);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+
+  FreeAlignedPages (Buffer, 1);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Bring up the driver on a model IOMMU, as detection would have found it.
+
+  @retval  EFI_SUCCESS  The driver produces the IOMMU protocol.
+  @retval  Others       The model or the driver could not be initialised.
+
+**/
+STATIC
+EFI_STATUS
+InitialiseDriver (
+  VOID
+  )
+{
+  RISCV_IOMMU_MODEL_CONFIG  Config;
+  RISCV_IOMMU_INSTANCE      *IoMmu;
+  EFI_STATUS                Status;
+
+  ZeroMem (&Config, sizeof (Config));
+  Config.CommandLatency   = BENCHMARK_COMMAND_LATENCY;
+  Config.WalkLatency      = BENCHMARK_WALK_LATENCY;
+  Config.MaxQueueLog2Size = 12;
+  Config.IoTlbEntries     = 256;
+  Config.NonCoherent      = mNonCoherent;
+
+  mModel = RiscVIoMmuModelCreate (&Config);
+  if (mModel == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Status = HostFirmwareInitialise ();
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  IoMmu = IoMmuCreateInstance (FALSE, RiscVIoMmuModelGetBase (mModel), STATE_AVAILABLE);
+  if (IoMmu == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  //
+  // As the devicetree's dma-noncoherent would have it.
+  //
+  IoMmu->NonCoherent = mNonCoherent;
+
+  Status = IoMmuCommonInitialise ();
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  return gBS->LocateProtocol (&gEdkiiIoMmuProtocolGuid, NULL, (VOID **)&mIoMmu);
+}
+
+/**
+  Bring up the driver on the model, and run the workloads and the replays of the traces.
+
+  @param[in]  NumberOfTraces  The number of traces.
+  @param[in]  Traces          The paths of the traces.
+
+  @retval  EFI_SUCCESS  The benchmark ran.
+  @retval  Others       The driver or the framework could not be initialised.
+
+**/
+EFI_STATUS
+EFIAPI
+RiscVIoMmuBenchmarkEntry (
+  IN UINTN  NumberOfTraces,
+  IN CHAR8  **Traces
+  )
+{
+  EFI_STATUS                  Status;
+  UNIT_TEST_FRAMEWORK_HANDLE  Framework;
+  UNIT_TEST_SUITE_HANDLE      WorkloadSuite;
+  UNIT_TEST_SUITE_HANDLE      ProtectionSuite;
+  UNIT_TEST_SUITE_HANDLE      ReplaySuite;
+  UINTN                       Index;
+
+  Framework = NULL;
+
+  DEBUG ((DEBUG_INFO, "%a v%a\n", UNIT_TEST_NAME, UNIT_TEST_VERSION));
+
+  Status = InitialiseDriver ();
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed to bring up the driver on the model. Status = %r\n", Status));
+    return Status;
+  }
+
+  Status = InitUnitTestFramework (&Framework, UNIT_TEST_NAME, gEfiCallerBaseName, UNIT_TEST_VERSION);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed in InitUnitTestFramework. Status = %r\n", Status));
+    goto EXIT;
+  }
+
+  Status = CreateUnitTestSuite (&WorkloadSuite, Framework, "Map/Unmap Workloads", "RiscVIoMmu.Benchmark", NULL, NULL);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed in CreateUnitTestSuite for WorkloadSuite. Status = %r\n", Status));
+    goto EXIT;
+  }
+
+  for (Index = 0; Index < ARRAY_SIZE (mWorkloads); Index++) {
+    AddTestCase (
+      WorkloadSuite,                   // Test Suite Handle
+      (CHAR8 *)mWorkloads[Index].Name, // Test Description
+      "Workload",                      // Test Class
+      RunWorkload,                     // UNIT_TEST_FUNCTION()
+      NULL,                            // (Optional) UNIT_TEST_PREREQUISITE()
+      NULL,                            // (Optional) UNIT_TEST_CLEANUP()
+      &mWorkloads[Index]               // (Optional) UNIT_TEST_CONTEXT
+      );
+  }
+
+  Status = CreateUnitTestSuite (&ProtectionSuite, Framework, "DMA Protection", "RiscVIoMmu.Protection", NULL, NULL);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed in CreateUnitTestSuite for ProtectionSuite. Status = %r\n", Status));
+    goto EXIT;
+  }
+
+  AddTestCase (
+    ProtectionSuite,                         // Test Suite Handle
+    "Ungranted and unmapped accesses fault", // Test Description
+    "Protection",                            // Test Class
+    CheckProtection,                         // UNIT_TEST_FUNCTION()
+    NULL,                                    // (Optional) UNIT_TEST_PREREQUISITE()
+    NULL,                                    // (Optional) UNIT_TEST_CLEANUP()
+    NULL                                     // (Optional) UNIT_TEST_CONTEXT
+    );
+
+  AddTestCase (
+    ProtectionSuite,                         // Test Suite Handle
+    "A fault storm quarantines the device",  // Test Description
+    "Protection",                            // Test Class
+    CheckFaultStorm,                         // UNIT_TEST_FUNCTION()
+    NULL,                                    // (Optional) UNIT_TEST_PREREQUISITE()
+    NULL,                                    // (Optional) UNIT_TEST_CLEANUP()
+    NULL                                     // (Optional) UNIT_TEST_CONTEXT
+    );
+
+  if (NumberOfTraces > 0) {
+    Status = CreateUnitTestSuite (&ReplaySuite, Framework, "Trace Replay", "RiscVIoMmu.Replay", NULL, NULL);
+    if (EFI_ERROR (Status)) {
+      DEBUG ((DEBUG_ERROR, "Failed in CreateUnitTestSuite for ReplaySuite. Status = %r\n", Status));
+      goto EXIT;
+    }
+
+    for (Index = 0; Index < NumberOfTraces; Index++) {
+      AddTestCase (
+        ReplaySuite,    // Test Suite Handle
+        Traces[Index],  // Test Description
+        "Replay",       // Test Class
+        ReplayTrace,    // UNIT_TEST_FUNCTION()
+        NULL,           // (Optional) UNIT_TEST_PREREQUISITE()
+        NULL,           // (Optional) UNIT_TEST_CLEANUP()
+        Traces[Index]   // (Optional) UNIT_TEST_CONTEXT
+        );
+    }
+  }
+
+  Status = RunAllTestSuites (Framework);
+
+EXIT:
+  if (Framework != NULL) {
+    FreeUnitTestFramework (Framework);
+  }
+
+  return Status;
+}
+
+///
+/// Avoid ECC error for function name that starts with lower case letter
+///
+#define RiscVIoMmuBenchmarkMain  main
+
+/**
+  Standard POSIX C entry point for host based unit test execution.
+
+  @param[in] Argc  Number of arguments
+  @param[in] Argv  Array of pointers to arguments, --non-coherent for a non-coherent IOMMU,
+                   then the paths of traces to replay
+
+  @retval 0      Success
+  @retval other  Error
+**/
+INT32
+RiscVIoMmuBenchmarkMain (
+  IN INT32  Argc,
+  IN CHAR8  *Argv[]
+  )
+{
+  Argc--;
+  Argv++;
+  if ((Argc > 0) && (AsciiStrCmp (Argv[0], "--non-coherent") == 0)) {
+    mNonCoherent = TRUE;
+    Argc--;
+    Argv++;
+  }
+
+  return RiscVIoMmuBenchmarkEntry ((UINTN)Argc, Argv);
+}
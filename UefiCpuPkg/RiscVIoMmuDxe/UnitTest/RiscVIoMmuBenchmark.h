@@ -0,0 +1,109 @@
+/** @file
+  Definitions shared by the RISC-V IOMMU driver benchmark and its host firmware.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef _RISC_V_IO_MMU_BENCHMARK_
+#define _RISC_V_IO_MMU_BENCHMARK_
+
+#include <Uefi.h>
+#include <IndustryStandard/Pci.h>
+#include <Protocol/DevicePath.h>
+#include <Protocol/PciIo.h>
+
+//
+// A PCI function that DMAs through the IOMMU, with a handle in the protocol database.
+//
+typedef struct {
+  EFI_HANDLE                  Handle;
+  EFI_PCI_IO_PROTOCOL         PciIo;
+  UINT8                       Bus;
+  UINT8                       Device;
+  UINT8                       Function;
+  UINT64                      Attributes;
+  UINT8                       Config[PCI_EXP_MAX_CONFIG_OFFSET];
+  struct {
+    PCI_DEVICE_PATH             Pci;
+    EFI_DEVICE_PATH_PROTOCOL    End;
+  } DevicePath;
+} HOST_PCI_FUNCTION;
+
+/**
+  Install the boot and DXE services that the driver runs on: page allocations that are
+  counted, events whose timers run on the virtual clock, a system memory map covering the
+  user address space of the host, and the CPU architectural protocol.
+
+  @retval  EFI_SUCCESS  The services are installed.
+  @retval  Others       The CPU architectural protocol could not be installed.
+
+**/
+EFI_STATUS
+HostFirmwareInitialise (
+  VOID
+  );
+
+/**
+  Signal the timer events that are due by the time of the virtual clock.
+
+**/
+VOID
+HostFirmwareRunTimers (
+  VOID
+  );
+
+/**
+  Get the number of pages that the driver holds from the boot services.
+
+  @return  The number of pages.
+
+**/
+UINTN
+HostFirmwareGetAllocatedPages (
+  VOID
+  );
+
+/**
+  Create a PCI function, with its PCI I/O and device path on a new handle.
+
+  @param[in]  Bus          The bus number.
+  @param[in]  Device       The device number.
+  @param[in]  Function     The function number.
+  @param[in]  ClassCode    The class code, as base class, sub-class and programming interface.
+  @param[in]  DualAddress  Whether the function's driver enabled dual address cycles.
+
+  @return  The function, or NULL if it could not be created.
+
+**/
+HOST_PCI_FUNCTION *
+HostCreatePciFunction (
+  IN UINT8    Bus,
+  IN UINT8    Device,
+  IN UINT8    Function,
+  IN UINT32   ClassCode,
+  IN BOOLEAN  DualAddress
+  );
+
+/**
+  Read a file of the host into a pool buffer.
+
+  @param[in]   Path    The path of the file.
+  @param[out]  Buffer  The contents, which the caller frees.
+  @param[out]  Size    The size of the contents.
+
+  @retval  EFI_SUCCESS           The file is read.
+  @retval  EFI_NOT_FOUND         The file could not be opened.
+  @retval  EFI_DEVICE_ERROR      The file could not be read.
+  @retval  EFI_OUT_OF_RESOURCES  The buffer could not be allocated.
+
+**/
+EFI_STATUS
+HostReadFile (
+  IN  CONST CHAR8  *Path,
+  OUT VOID         **Buffer,
+  OUT UINTN        *Size
+  );
+
+#endif
@@ -0,0 +1,202 @@
+/** @file
+  Register-level software model of a RISC-V IOMMU, for host-based tests of the driver.
+
+  The model implements the register file, the command and fault queues, the device
+  directory and the first-stage page-table walker, with an IOTLB and a device-context
+  cache that are only coherent through the invalidation commands. Commands complete
+  and table walks take a configurable time, on a virtual clock that the TimerLib of
+  the model also runs on, so that the driver's waits see the latencies.
+
+  A model can be made non-coherent, so that it reads the tables, the command queue and
+  the buffers of its devices from memory, which only holds what the hart's cache-block
+  operations wrote back. Host memory stands for the hart's cache. A model reads a block
+  that was never written back as zeroes, and counts every read that found memory
+  differing from the hart's copy, so a missing clean shows up as a stale read, and
+  usually as a fault or corrupt DMA, rather than going unnoticed.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef _RISC_V_IO_MMU_MODEL_
+#define _RISC_V_IO_MMU_MODEL_
+
+#include <Uefi.h>
+
+typedef struct _RISCV_IOMMU_MODEL RISCV_IOMMU_MODEL;
+
+typedef struct {
+  // The capabilities register, or 0 for version 1.0 with Sv39/48/57 and wired interrupts.
+  UINT64    Capabilities;
+  // The time that each command takes to complete, in nanoseconds.
+  UINT32    CommandLatency;
+  // The time that each memory access of a table walk takes, in nanoseconds.
+  UINT32    WalkLatency;
+  // The largest number of queue entries, as log2, that the WARL queue-size fields accept.
+  UINT8     MaxQueueLog2Size;
+  // The number of IOTLB entries, a power of two.
+  UINT32    IoTlbEntries;
+  // Whether the memory accesses of the model bypass the hart's caches.
+  BOOLEAN   NonCoherent;
+} RISCV_IOMMU_MODEL_CONFIG;
+
+typedef struct {
+  // Commands executed, indexed by opcode. Index 0 counts the illegal ones.
+  UINT64    Commands[5];
+  UINT64    CommandQueueDoorbells;
+  UINT64    RegisterReads;
+  UINT64    RegisterWrites;
+  UINT64    Translations;
+  UINT64    IoTlbMisses;
+  UINT64    DeviceContextMisses;
+  UINT64    WalkAccesses;
+  UINT64    Faults;
+  // The cache-block operations of the hart, cbo.clean, cbo.flush and cbo.inval.
+  UINT64    CacheCleans;
+  UINT64    CacheFlushes;
+  UINT64    CacheInvalidates;
+  // Reads of a non-coherent model that found memory differing from the hart's copy.
+  UINT64    StaleReads;
+} RISCV_IOMMU_MODEL_STATISTICS;
+
+/**
+  Create a model IOMMU, in its reset state, with its registers in a page of host memory.
+
+  @param[in]  Config  The configuration of the model.
+
+  @return  The model, or NULL if it could not be allocated.
+
+**/
+RISCV_IOMMU_MODEL *
+RiscVIoMmuModelCreate (
+  IN CONST RISCV_IOMMU_MODEL_CONFIG  *Config
+  );
+
+/**
+  Destroy a model IOMMU. Its register page is no longer decoded.
+
+  @param[in]  Model  The model.
+
+**/
+VOID
+RiscVIoMmuModelDestroy (
+  IN RISCV_IOMMU_MODEL  *Model
+  );
+
+/**
+  Get the address of the register page of a model, for the driver's instance.
+
+  @param[in]  Model  The model.
+
+  @return  The base address of the registers.
+
+**/
+UINT64
+RiscVIoMmuModelGetBase (
+  IN RISCV_IOMMU_MODEL  *Model
+  );
+
+/**
+  Change the command and table-walk latencies of a model.
+
+  @param[in]  Model           The model.
+  @param[in]  CommandLatency  The time that each command takes to complete, in nanoseconds.
+  @param[in]  WalkLatency     The time that each memory access of a table walk takes, in nanoseconds.
+
+**/
+VOID
+RiscVIoMmuModelSetLatencies (
+  IN RISCV_IOMMU_MODEL  *Model,
+  IN UINT32             CommandLatency,
+  IN UINT32             WalkLatency
+  );
+
+/**
+  Perform an untranslated DMA of a device through a model, page by page, as the IOMMU
+  translates it. A faulting page stops the transfer and is recorded in the fault queue.
+
+  @param[in]      Model      The model.
+  @param[in]      DeviceId   The device_id of the requester.
+  @param[in]      Address    The device address of the transfer.
+  @param[in, out] Buffer     The data written to memory, or the buffer for the data read.
+  @param[in]      Length     The number of bytes to transfer.
+  @param[in]      IsWrite    Whether the device writes to memory.
+
+  @retval  EFI_SUCCESS        The whole transfer was translated and performed.
+  @retval  EFI_ACCESS_DENIED  A page of the transfer faulted.
+
+**/
+EFI_STATUS
+RiscVIoMmuModelDma (
+  IN     RISCV_IOMMU_MODEL  *Model,
+  IN     UINT32             DeviceId,
+  IN     UINT64             Address,
+  IN OUT VOID               *Buffer,
+  IN     UINTN              Length,
+  IN     BOOLEAN            IsWrite
+  );
+
+/**
+  Count the pages of the device directory and of the page tables that a model can reach
+  from its DDTP, each page table shared by several devices counted once.
+
+  @param[in]  Model  The model.
+
+  @return  The number of table pages.
+
+**/
+UINTN
+RiscVIoMmuModelCountTablePages (
+  IN RISCV_IOMMU_MODEL  *Model
+  );
+
+/**
+  Get the statistics that a model gathered since it was created or they were reset.
+
+  @param[in]   Model       The model.
+  @param[out]  Statistics  The statistics.
+
+**/
+VOID
+RiscVIoMmuModelGetStatistics (
+  IN  RISCV_IOMMU_MODEL             *Model,
+  OUT RISCV_IOMMU_MODEL_STATISTICS  *Statistics
+  );
+
+/**
+  Reset the statistics of a model.
+
+  @param[in]  Model  The model.
+
+**/
+VOID
+RiscVIoMmuModelResetStatistics (
+  IN RISCV_IOMMU_MODEL  *Model
+  );
+
+/**
+  Get the time of the virtual clock, which is the time of the host plus every
+  latency that the models injected.
+
+  @return  The time, in nanoseconds.
+
+**/
+UINT64
+RiscVIoMmuModelGetTime (
+  VOID
+  );
+
+/**
+  Let the virtual clock pass a time without the host spending it, and complete the
+  commands of every model that are due by then.
+
+  @param[in]  Nanoseconds  The time to pass.
+
+**/
+VOID
+RiscVIoMmuModelAdvanceTime (
+  IN UINT64  Nanoseconds
+  );
+
+#endif
@@ -0,0 +1,708 @@
+/** @file
+  The platform that the RISC-V IOMMU driver runs on in host-based tests: MMIO accessors
+  that decode the register pages of the models, a TimerLib on the virtual clock, the
+  hart routines of BaseLib that only exist for RISC-V, a RiscVIsaLib for a hart
+  with Zicbom only while a model is non-coherent, a RiscVHartLocalLib for a hart without hart-local
+  storage, which the driver takes for the boot hart, and a RiscVTaskPoolLib that
+  runs every task on the one host thread.
+
+  The virtual clock runs with the host, plus every latency that was injected. Delays
+  don't sleep, but let the clock pass, so that a wait for a slow command costs the host
+  nothing.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <time.h>
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/IoLib.h>
+#include <Library/RiscVHartLocalLib.h>
+#include <Library/RiscVIsaLib.h>
+#include <Library/RiscVTaskPoolLib.h>
+#include <Library/TimerLib.h>
+#include <Register/RiscV64/RiscVEncoding.h>
+#include "RiscVIoMmuModelInternal.h"
+
+//
+// The model hart runs Sv48, little-endian, with the cache blocks of the models.
+//
+#define HOST_HART_SATP_MODE  SATP_MODE_SV48
+
+STATIC UINT64  mHostStartTime;
+STATIC UINT64  mInjectedTime;
+
+/**
+  Get the time of the host.
+
+  @return  The time, in nanoseconds.
+
+**/
+STATIC
+UINT64
+GetHostTime (
+  VOID
+  )
+{
+  struct timespec  Time;
+
+  if (timespec_get (&Time, TIME_UTC) == 0) {
+    return 0;
+  }
+
+  return MultU64x32 ((UINT64)Time.tv_sec, 1000000000) + (UINT64)Time.tv_nsec;
+}
+
+/**
+  Get the time of the virtual clock, which is the time of the host plus every
+  latency that the models injected.
+
+  @return  The time, in nanoseconds.
+
+**/
+UINT64
+RiscVIoMmuModelGetTime (
+  VOID
+  )
+{
+  UINT64  HostTime;
+
+  HostTime = GetHostTime ();
+  if (mHostStartTime == 0) {
+    mHostStartTime = HostTime;
+  }
+
+  //
+  // The clock starts at 1, so that 0 never reads as a deadline.
+  //
+  return HostTime - mHostStartTime + mInjectedTime + 1;
+}
+
+/**
+  Let the virtual clock pass a time, without completing any commands.
+
+  @param[in]  Nanoseconds  The time to pass.
+
+**/
+VOID
+RiscVIoMmuModelInjectTime (
+  IN UINT64  Nanoseconds
+  )
+{
+  mInjectedTime += Nanoseconds;
+}
+
+/**
+  Let the virtual clock pass a time without the host spending it, and complete the
+  commands of every model that are due by then.
+
+  @param[in]  Nanoseconds  The time to pass.
+
+**/
+VOID
+RiscVIoMmuModelAdvanceTime (
+  IN UINT64  Nanoseconds
+  )
+{
+  RiscVIoMmuModelInjectTime (Nanoseconds);
+  RiscVIoMmuModelProcessAll ();
+}
+
+/**
+  Reads a 32-bit MMIO register, of a model or of plain memory.
+
+  @param  Address The MMIO register to read.
+
+  @return The value read.
+
+**/
+UINT32
+EFIAPI
+MmioRead32 (
+  IN      UINTN  Address
+  )
+{
+  RISCV_IOMMU_MODEL  *Model;
+  UINTN              Offset;
+
+  ASSERT ((Address & 3) == 0);
+
+  Model = RiscVIoMmuModelDecode (Address, &Offset);
+  if (Model != NULL) {
+    return (UINT32)RiscVIoMmuModelReadRegister (Model, Offset, sizeof (UINT32));
+  }
+
+  return *(volatile UINT32 *)Address;
+}
+
+/**
+  Writes a 32-bit MMIO register, of a model or of plain memory.
+
+  @param  Address The MMIO register to write.
+  @param  Value   The value to write to the MMIO register.
+
+  @return Value.
+
+**/
+UINT32
+EFIAPI
+MmioWrite32 (
+  IN      UINTN   Address,
+  IN      UINT32  Value
+  )
+{
+  RISCV_IOMMU_MODEL  *Model;
+  UINTN              Offset;
+
+  ASSERT ((Address & 3) == 0);
+
+  Model = RiscVIoMmuModelDecode (Address, &Offset);
+  if (Model != NULL) {
+    RiscVIoMmuModelWriteRegister (Model, Offset, sizeof (UINT32), Value);
+  } else {
+    *(volatile UINT32 *)Address = Value;
+  }
+
+  return Value;
+}
+
+/**
+  Reads a 64-bit MMIO register, of a model or of plain memory.
+
+  @param  Address The MMIO register to read.
+
+  @return The value read.
+
+**/
+UINT64
+EFIAPI
+MmioRead64 (
+  IN      UINTN  Address
+  )
+{
+  RISCV_IOMMU_MODEL  *Model;
+  UINTN              Offset;
+
+  ASSERT ((Address & 7) == 0);
+
+  Model = RiscVIoMmuModelDecode (Address, &Offset);
+  if (Model != NULL) {
+    return RiscVIoMmuModelReadRegister (Model, Offset, sizeof (UINT64));
+  }
+
+  return *(volatile UINT64 *)Address;
+}
+
+/**
+  Writes a 64-bit MMIO register, of a model or of plain memory.
+
+  @param  Address The MMIO register to write.
+  @param  Value   The value to write to the MMIO register.
+
+  @return Value.
+
+**/
+UINT64
+EFIAPI
+MmioWrite64 (
+  IN      UINTN   Address,
+  IN      UINT64  Value
+  )
+{
+  RISCV_IOMMU_MODEL  *Model;
+  UINTN              Offset;
+
+  ASSERT ((Address & 7) == 0);
+
+  Model = RiscVIoMmuModelDecode (Address, &Offset);
+  if (Model != NULL) {
+    RiscVIoMmuModelWriteRegister (Model, Offset, sizeof (UINT64), Value);
+  } else {
+    *(volatile UINT64 *)Address = Value;
+  }
+
+  return Value;
+}
+
+/**
+  Stalls the CPU for at least the given number of microseconds, on the virtual clock.
+
+  @param  MicroSeconds  The minimum number of microseconds to delay.
+
+  @return MicroSeconds
+
+**/
+UINTN
+EFIAPI
+MicroSecondDelay (
+  IN      UINTN  MicroSeconds
+  )
+{
+  RiscVIoMmuModelAdvanceTime (MultU64x32 (MicroSeconds, 1000));
+  return MicroSeconds;
+}
+
+/**
+  Stalls the CPU for at least the given number of nanoseconds, on the virtual clock.
+
+  @param  NanoSeconds The minimum number of nanoseconds to delay.
+
+  @return NanoSeconds
+
+**/
+UINTN
+EFIAPI
+NanoSecondDelay (
+  IN      UINTN  NanoSeconds
+  )
+{
+  RiscVIoMmuModelAdvanceTime (NanoSeconds);
+  return NanoSeconds;
+}
+
+/**
+  Retrieves the current value of the virtual clock, which counts nanoseconds.
+
+  @return The current value of the free running performance counter.
+
+**/
+UINT64
+EFIAPI
+GetPerformanceCounter (
+  VOID
+  )
+{
+  return RiscVIoMmuModelGetTime ();
+}
+
+/**
+  Retrieves the 64-bit frequency in Hz and the range of performance counter
+  values.
+
+  @param  StartValue  The value the performance counter starts with when it
+                      rolls over.
+  @param  EndValue    The value that the performance counter ends with before
+                      it rolls over.
+
+  @return The frequency in Hz.
+
+**/
+UINT64
+EFIAPI
+GetPerformanceCounterProperties (
+  OUT      UINT64  *StartValue   OPTIONAL,
+  OUT      UINT64  *EndValue     OPTIONAL
+  )
+{
+  if (StartValue != NULL) {
+    *StartValue = 0;
+  }
+
+  if (EndValue != NULL) {
+    *EndValue = MAX_UINT64;
+  }
+
+  return 1000000000;
+}
+
+/**
+  Converts elapsed ticks of performance counter to time in nanoseconds.
+
+  @param  Ticks     The number of elapsed ticks of running performance counter.
+
+  @return The elapsed time in nanoseconds.
+
+**/
+UINT64
+EFIAPI
+GetTimeInNanoSecond (
+  IN      UINT64  Ticks
+  )
+{
+  return Ticks;
+}
+
+/**
+  Read the time CSR, which the host hart ticks with the virtual clock.
+
+  @return  The time, in nanoseconds.
+
+**/
+UINT64
+RiscVReadTimer (
+  VOID
+  )
+{
+  return RiscVIoMmuModelGetTime ();
+}
+
+/**
+  Read the SATP of the host hart.
+
+  @return  The SATP, with only the paging mode set.
+
+**/
+UINT64
+RiscVGetSupervisorAddressTranslationRegister (
+  VOID
+  )
+{
+  return LShiftU64 (HOST_HART_SATP_MODE, SATP64_MODE_SHIFT);
+}
+
+/**
+  Read the SSTATUS of the host hart, which is little-endian.
+
+  @return  The SSTATUS.
+
+**/
+UINT64
+RiscVGetSupervisorStatusRegister (
+  VOID
+  )
+{
+  return 0;
+}
+
+/**
+  Zero the cache block at an address.
+
+  @param[in]  Address  The address of the block.
+
+**/
+VOID
+RiscVCacheBlockZero (
+  IN UINTN  Address
+  )
+{
+  ZeroMem ((VOID *)(Address & ~(UINTN)(RISCV_IOMMU_MODEL_CACHE_BLOCK_SIZE - 1)), RISCV_IOMMU_MODEL_CACHE_BLOCK_SIZE);
+}
+
+/**
+  Wait on a word. The host has no reservations, so this returns at once.
+
+  @param[in]  Address  The address of the word.
+  @param[in]  Value    The value the word held.
+
+**/
+VOID
+RiscVWaitOnWord (
+  IN volatile UINT32  *Address,
+  IN UINT32           Value
+  )
+{
+}
+
+/**
+  Read a 32-bit MMIO register with acquire ordering, of a model or of plain memory.
+
+  @param[in]  Address  The address of the register.
+
+  @return  The value read.
+
+**/
+UINT32
+RiscVMmioReadAcquire32 (
+  IN UINTN  Address
+  )
+{
+  return MmioRead32 (Address);
+}
+
+/**
+  Write a 32-bit MMIO register with release ordering, of a model or of plain memory.
+
+  @param[in]  Address  The address of the register.
+  @param[in]  Value    The value to write.
+
+**/
+VOID
+RiscVMmioWriteRelease32 (
+  IN UINTN   Address,
+  IN UINT32  Value
+  )
+{
+  MmioWrite32 (Address, Value);
+}
+
+/**
+  Flush a cache block, to the memory that non-coherent models see.
+
+  @param  Address  The address of the block.
+
+**/
+VOID
+EFIAPI
+RiscVCpuCacheFlushCmoAsm (
+  IN UINTN  Address
+  )
+{
+  RiscVIoMmuModelCacheOperation (Address, RiscVIoMmuModelCacheFlush);
+}
+
+/**
+  Clean a cache block, to the memory that non-coherent models see.
+
+  @param  Address  The address of the block.
+
+**/
+VOID
+EFIAPI
+RiscVCpuCacheCleanCmoAsm (
+  IN UINTN  Address
+  )
+{
+  RiscVIoMmuModelCacheOperation (Address, RiscVIoMmuModelCacheClean);
+}
+
+/**
+  Invalidate a cache block, so that the hart reads what non-coherent models wrote.
+
+  @param  Address  The address of the block.
+
+**/
+VOID
+EFIAPI
+RiscVCpuCacheInvalCmoAsm (
+  IN UINTN  Address
+  )
+{
+  RiscVIoMmuModelCacheOperation (Address, RiscVIoMmuModelCacheInvalidate);
+}
+
+/**
+  Discover the ISA extensions of a devicetree. The host has none.
+
+  @param[in]   Fdt   The devicetree.
+  @param[out]  Info  The extensions.
+
+  @retval  EFI_NOT_FOUND  The devicetree has no CPU nodes.
+
+**/
+EFI_STATUS
+EFIAPI
+RiscVIsaParseFdt (
+  IN  CONST VOID      *Fdt,
+  OUT RISCV_ISA_INFO  *Info
+  )
+{
+  return EFI_NOT_FOUND;
+}
+
+/**
+  Get the ISA extensions that every hart implements. The model hart implements Zicbom
+  while a model is non-coherent, and nothing else, so the driver takes its paths
+  without Zawrs, Svpbmt and Zicboz, and only maintains caches for such a model.
+
+  @return  RISCV_ISA_FEATURE_ZICBOM while a model is non-coherent, or 0.
+
+**/
+UINT64
+EFIAPI
+RiscVIsaGetFeatures (
+  VOID
+  )
+{
+  return RiscVIoMmuModelHasNonCoherent () ? RISCV_ISA_FEATURE_ZICBOM : 0;
+}
+
+/**
+  Get the block size of the Zicbom cache-block management operations.
+
+  @return  The block size while a model is non-coherent, or 0, as the model hart lacks Zicbom.
+
+**/
+UINT32
+EFIAPI
+RiscVIsaGetCbomBlockSize (
+  VOID
+  )
+{
+  return RiscVIoMmuModelHasNonCoherent () ? RISCV_IOMMU_MODEL_CACHE_BLOCK_SIZE : 0;
+}
+
+/**
+  Get the block size of the Zicboz cbo.zero operation.
+
+  @return  0, as the model hart lacks Zicboz.
+
+**/
+UINT32
+EFIAPI
+RiscVIsaGetCbozBlockSize (
+  VOID
+  )
+{
+  return 0;
+}
+
+/**
+  Get the hart-local storage of the hart this runs on.
+
+  @return  NULL, as the model hart has none.
+
+**/
+RISCV_HART_LOCAL *
+EFIAPI
+RiscVHartLocalGet (
+  VOID
+  )
+{
+  return NULL;
+}
+
+/**
+  Initialize a block of hart-local storage, without attaching it.
+
+  @param[out]  HartLocal       The block.
+  @param[in]   HartId          The hart that the block belongs to.
+  @param[in]   ProcessorIndex  The index of the hart in the MP services protocol.
+
+**/
+VOID
+EFIAPI
+RiscVHartLocalInitialize (
+  OUT RISCV_HART_LOCAL  *HartLocal,
+  IN  UINTN             HartId,
+  IN  UINTN             ProcessorIndex
+  )
+{
+  ZeroMem (HartLocal, sizeof (*HartLocal));
+  HartLocal->Signature      = RISCV_HART_LOCAL_SIGNATURE;
+  HartLocal->HartId         = HartId;
+  HartLocal->ProcessorIndex = ProcessorIndex;
+}
+
+/**
+  Attach a block of hart-local storage to the hart this runs on. The model hart
+  has no tp, so the block is ignored.
+
+  @param[in]  HartLocal  The block.
+
+**/
+VOID
+EFIAPI
+RiscVHartLocalAttach (
+  IN RISCV_HART_LOCAL  *HartLocal
+  )
+{
+}
+
+/**
+  Push an entry onto a free list of the hart this runs on.
+
+  @param[in]  Slot   The user of the list.
+  @param[in]  Entry  The entry.
+
+  @return  FALSE, as the model hart has no hart-local storage.
+
+**/
+BOOLEAN
+EFIAPI
+RiscVHartLocalPush (
+  IN RISCV_HART_LOCAL_SLOT  Slot,
+  IN VOID                   *Entry
+  )
+{
+  return FALSE;
+}
+
+/**
+  Pop an entry from a free list of the hart this runs on.
+
+  @param[in]  Slot  The user of the list.
+
+  @return  NULL, as the model hart has no hart-local storage.
+
+**/
+VOID *
+EFIAPI
+RiscVHartLocalPop (
+  IN RISCV_HART_LOCAL_SLOT  Slot
+  )
+{
+  return NULL;
+}
+
+/**
+  Allocate from the scratch arena of the hart this runs on.
+
+  @param[in]  Size  The size.
+
+  @return  NULL, as the model hart has no hart-local storage.
+
+**/
+VOID *
+EFIAPI
+RiscVHartLocalScratchAllocate (
+  IN UINTN  Size
+  )
+{
+  return NULL;
+}
+
+/**
+  Get a mark of the scratch arena.
+
+  @return  0.
+
+**/
+UINTN
+EFIAPI
+RiscVHartLocalScratchMark (
+  VOID
+  )
+{
+  return 0;
+}
+
+/**
+  Release the scratch memory allocated since a mark.
+
+  @param[in]  Mark  The mark.
+
+**/
+VOID
+EFIAPI
+RiscVHartLocalScratchRelease (
+  IN UINTN  Mark
+  )
+{
+}
+
+/**
+  Run a number of tasks, in order, on the host thread.
+
+  @param[in]  Procedure      The task.
+  @param[in]  Context        The context passed to each task.
+  @param[in]  NumberOfTasks  The number of tasks.
+
+  @retval  EFI_SUCCESS            Every task has run.
+  @retval  EFI_INVALID_PARAMETER  Procedure is NULL, or NumberOfTasks exceeds MAX_UINT32.
+
+**/
+EFI_STATUS
+EFIAPI
+RiscVTaskPoolRun (
+  IN RISCV_TASK_PROCEDURE  Procedure,
+  IN VOID                  *Context,
+  IN UINTN                 NumberOfTasks
+  )
+{
+  UINTN  Index;
+
+  if ((Procedure == NULL) || (NumberOfTasks > MAX_UINT32)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  for (Index = 0; Index < NumberOfTasks; Index++) {
+    Procedure (Context, Index);
+  }
+
+  return EFI_SUCCESS;
+}
@@ -0,0 +1,314 @@
+/** @file
+  The memory that non-coherent models of a RISC-V IOMMU see.
+
+  Host memory stands for the hart's cache, so memory itself is kept apart: the
+  blocks that the hart wrote back or a model wrote, in an open-addressed table
+  that grows as blocks are added. A block that is in neither reads as zeroes,
+  not as whatever the host happens to hold, so that a table which is zeroed and
+  linked in without being cleaned reads differently from the hart's copy.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include "RiscVIoMmuModelInternal.h"
+
+#define MODEL_MEMORY_MIN_SLOT_BITS  12
+#define MODEL_MEMORY_HASH           0x9E3779B97F4A7C15ULL
+
+typedef struct {
+  // The address of the block, or 0 if the slot is free.
+  UINTN    Address;
+  UINT8    Data[RISCV_IOMMU_MODEL_CACHE_BLOCK_SIZE];
+} MODEL_MEMORY_BLOCK;
+
+STATIC MODEL_MEMORY_BLOCK  *mMemoryBlocks;
+
+//
+// The number of slots, a power of two, and of the blocks in them.
+//
+STATIC UINTN  mMemorySlotBits;
+STATIC UINTN  mMemorySlots;
+STATIC UINTN  mMemoryBlockCount;
+
+/**
+  Get the slot that the probe for a block starts at.
+
+  @param[in]  Address  The address of the block.
+
+  @return  The slot.
+
+**/
+STATIC
+UINTN
+GetMemorySlot (
+  IN UINTN  Address
+  )
+{
+  //
+  // The top bits of the product, so that blocks a page apart spread over the table too.
+  //
+  return (UINTN)RShiftU64 (
+                  MultU64x64 (Address / RISCV_IOMMU_MODEL_CACHE_BLOCK_SIZE, MODEL_MEMORY_HASH),
+                  64 - mMemorySlotBits
+                  );
+}
+
+/**
+  Allocate the table of blocks, or double it.
+
+  @retval  TRUE   The table has room for another block.
+  @retval  FALSE  The table could not be allocated.
+
+**/
+STATIC
+BOOLEAN
+GrowMemory (
+  VOID
+  )
+{
+  MODEL_MEMORY_BLOCK  *OldBlocks;
+  UINTN               OldSlots;
+  UINTN               Index;
+  UINTN               Slot;
+  UINTN               SlotBits;
+
+  SlotBits  = (mMemoryBlocks == NULL) ? MODEL_MEMORY_MIN_SLOT_BITS : mMemorySlotBits + 1;
+  OldBlocks = mMemoryBlocks;
+  OldSlots  = mMemorySlots;
+
+  mMemoryBlocks = AllocateZeroPool (LShiftU64 (1, SlotBits) * sizeof (MODEL_MEMORY_BLOCK));
+  if (mMemoryBlocks == NULL) {
+    DEBUG ((DEBUG_ERROR, "%a: Out of memory for %lu blocks\n", __func__, (UINT64)mMemoryBlockCount + 1));
+    mMemoryBlocks = OldBlocks;
+    return FALSE;
+  }
+
+  mMemorySlotBits = SlotBits;
+  mMemorySlots    = (UINTN)LShiftU64 (1, SlotBits);
+
+  for (Index = 0; Index < OldSlots; Index++) {
+    if (OldBlocks[Index].Address == 0) {
+      continue;
+    }
+
+    for (Slot = GetMemorySlot (OldBlocks[Index].Address); mMemoryBlocks[Slot].Address != 0; Slot = (Slot + 1) & (mMemorySlots - 1)) {
+    }
+
+    CopyMem (&mMemoryBlocks[Slot], &OldBlocks[Index], sizeof (MODEL_MEMORY_BLOCK));
+  }
+
+  if (OldBlocks != NULL) {
+    FreePool (OldBlocks);
+  }
+
+  return TRUE;
+}
+
+/**
+  Find a block of memory.
+
+  @param[in]  Address  The address of the block.
+  @param[in]  Create   Whether a block that memory doesn't hold yet is added, as zeroes.
+
+  @return  The block, or NULL if memory doesn't hold it and it wasn't added.
+
+**/
+STATIC
+MODEL_MEMORY_BLOCK *
+FindBlock (
+  IN UINTN    Address,
+  IN BOOLEAN  Create
+  )
+{
+  MODEL_MEMORY_BLOCK  *Block;
+  UINTN               Slot;
+
+  if (mMemoryBlocks == NULL) {
+    if (!Create || !GrowMemory ()) {
+      return NULL;
+    }
+  }
+
+  for (Slot = GetMemorySlot (Address); ; Slot = (Slot + 1) & (mMemorySlots - 1)) {
+    Block = &mMemoryBlocks[Slot];
+    if (Block->Address == Address) {
+      return Block;
+    }
+
+    if (Block->Address == 0) {
+      break;
+    }
+  }
+
+  if (!Create) {
+    return NULL;
+  }
+
+  //
+  // The table is kept at most half full, so that probes stay short.
+  //
+  if ((mMemoryBlockCount + 1) * 2 > mMemorySlots) {
+    if (!GrowMemory ()) {
+      return NULL;
+    }
+
+    return FindBlock (Address, TRUE);
+  }
+
+  Block->Address = Address;
+  mMemoryBlockCount++;
+  return Block;
+}
+
+/**
+  Read memory as a non-coherent model sees it, bypassing the hart's cache.
+
+  @param[in]   Address  The first byte.
+  @param[out]  Buffer   The bytes read.
+  @param[in]   Length   The number of bytes.
+
+  @retval  TRUE   Memory differs from the hart's copy of the bytes.
+  @retval  FALSE  Memory holds the hart's copy.
+
+**/
+BOOLEAN
+RiscVIoMmuModelReadMemory (
+  IN  UINTN  Address,
+  OUT VOID   *Buffer,
+  IN  UINTN  Length
+  )
+{
+  MODEL_MEMORY_BLOCK  *Block;
+  UINT8               *Bytes;
+  UINTN               Offset;
+  UINTN               Chunk;
+  BOOLEAN             Stale;
+
+  Bytes = Buffer;
+  Stale = FALSE;
+  while (Length > 0) {
+    Offset = Address & (RISCV_IOMMU_MODEL_CACHE_BLOCK_SIZE - 1);
+    Chunk  = MIN (Length, RISCV_IOMMU_MODEL_CACHE_BLOCK_SIZE - Offset);
+    Block  = FindBlock (Address - Offset, FALSE);
+    if (Block != NULL) {
+      CopyMem (Bytes, &Block->Data[Offset], Chunk);
+    } else {
+      ZeroMem (Bytes, Chunk);
+    }
+
+    if (CompareMem (Bytes, (VOID *)Address, Chunk) != 0) {
+      Stale = TRUE;
+    }
+
+    Bytes   += Chunk;
+    Address += Chunk;
+    Length  -= Chunk;
+  }
+
+  return Stale;
+}
+
+/**
+  Write memory as a non-coherent model does. The hart's copy is updated too, as if
+  the hart had invalidated it before reading the bytes.
+
+  @param[in]  Address  The first byte.
+  @param[in]  Buffer   The bytes written.
+  @param[in]  Length   The number of bytes.
+
+**/
+VOID
+RiscVIoMmuModelWriteMemory (
+  IN UINTN       Address,
+  IN CONST VOID  *Buffer,
+  IN UINTN       Length
+  )
+{
+  MODEL_MEMORY_BLOCK  *Block;
+  CONST UINT8         *Bytes;
+  UINTN               Start;
+  UINTN               Offset;
+  UINTN               Chunk;
+  UINTN               Remaining;
+
+  CopyMem ((VOID *)Address, Buffer, Length);
+
+  Bytes     = Buffer;
+  Start     = Address;
+  Remaining = Length;
+  while (Remaining > 0) {
+    Offset = Start & (RISCV_IOMMU_MODEL_CACHE_BLOCK_SIZE - 1);
+    Chunk  = MIN (Remaining, RISCV_IOMMU_MODEL_CACHE_BLOCK_SIZE - Offset);
+    Block  = FindBlock (Start - Offset, TRUE);
+    if (Block != NULL) {
+      CopyMem (&Block->Data[Offset], Bytes, Chunk);
+    }
+
+    Bytes     += Chunk;
+    Start     += Chunk;
+    Remaining -= Chunk;
+  }
+}
+
+/**
+  Apply a cache-block operation of the hart to the memory that non-coherent models see.
+  A clean or flush writes the block back, and an invalidation replaces the hart's copy
+  with memory, if memory holds the block.
+
+  @param[in]  Address    The address of the block.
+  @param[in]  Operation  The operation.
+
+**/
+VOID
+RiscVIoMmuModelMaintainMemory (
+  IN UINTN                              Address,
+  IN RISCV_IOMMU_MODEL_CACHE_OPERATION  Operation
+  )
+{
+  MODEL_MEMORY_BLOCK  *Block;
+
+  Address &= ~(UINTN)(RISCV_IOMMU_MODEL_CACHE_BLOCK_SIZE - 1);
+
+  //
+  // Whatever the hart wrote to a block since it was last written back is lost.
+  //
+  if (Operation == RiscVIoMmuModelCacheInvalidate) {
+    Block = FindBlock (Address, FALSE);
+    if (Block != NULL) {
+      CopyMem ((VOID *)Address, Block->Data, RISCV_IOMMU_MODEL_CACHE_BLOCK_SIZE);
+    }
+
+    return;
+  }
+
+  Block = FindBlock (Address, TRUE);
+  if (Block != NULL) {
+    CopyMem (Block->Data, (VOID *)Address, RISCV_IOMMU_MODEL_CACHE_BLOCK_SIZE);
+  }
+}
+
+/**
+  Forget the memory of non-coherent models, once the last of them is destroyed.
+
+**/
+VOID
+RiscVIoMmuModelFreeMemory (
+  VOID
+  )
+{
+  if (mMemoryBlocks != NULL) {
+    FreePool (mMemoryBlocks);
+  }
+
+  mMemoryBlocks     = NULL;
+  mMemorySlotBits   = 0;
+  mMemorySlots      = 0;
+  mMemoryBlockCount = 0;
+}
@@ -0,0 +1,1775 @@
+/** @file
+  Register-level software model of a RISC-V IOMMU.
+
+  The model follows version 1.0 of the RISC-V IOMMU specification closely enough for
+  the driver to run unmodified against it: WARL fields only hold what is implemented,
+  the queues turn on and off through qen and qon, and commands are read from memory
+  and complete a latency after the doorbell. Translations are cached in an IOTLB and
+  a device-context cache, which go stale until the driver invalidates them, so missing
+  invalidations show up as wrong or faulting DMA. A non-coherent model reads and writes
+  memory past the hart's cache, so that missing cleans show up the same way.
+
+  Not modelled: second-stage translation, process directories, MSI translation,
+  performance counting, and big-endian accesses.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include "../../RiscVIoMmuRegisters.h"
+#include "RiscVIoMmuModelInternal.h"
+
+#define MODEL_MAX_INSTANCES       4
+#define MODEL_INTERRUPT_VECTORS   4
+#define MODEL_CONTEXT_CACHE_SIZE  64
+#define MODEL_DEFAULT_IOTLB_SIZE  512
+
+//
+// The architectural bits of a first-stage PTE.
+//
+#define MODEL_PTE_V     BIT0
+#define MODEL_PTE_R     BIT1
+#define MODEL_PTE_W     BIT2
+#define MODEL_PTE_X     BIT3
+#define MODEL_PTE_U     BIT4
+#define MODEL_PTE_A     BIT6
+#define MODEL_PTE_D     BIT7
+#define MODEL_PTE_PBMT  (3ULL << 61)
+#define MODEL_PTE_N     BIT63
+
+#define MODEL_PTE_RESERVED  (0x7FULL << 54)
+
+#define MODEL_PTE_PPN(Pte)  (RShiftU64 ((Pte), 10) & (BIT44 - 1))
+
+//
+// Fault causes of the specification.
+//
+#define MODEL_CAUSE_LOAD_PAGE_FAULT         13
+#define MODEL_CAUSE_STORE_PAGE_FAULT        15
+#define MODEL_CAUSE_ALL_DISALLOWED          256
+#define MODEL_CAUSE_DDT_NOT_VALID           258
+#define MODEL_CAUSE_DDT_MISCONFIGURED       259
+#define MODEL_CAUSE_TRANSACTION_DISALLOWED  260
+
+typedef struct {
+  BOOLEAN    Valid;
+  BOOLEAN    Writable;
+  UINT32     ProcessSoftContextId;
+  // The 4 KiB page of the IOVA, and the pages of the leaf that maps it.
+  UINT64     VirtualPage;
+  UINT64     LeafPageMask;
+  UINT64     PhysicalPage;
+} MODEL_IOTLB_ENTRY;
+
+typedef struct {
+  BOOLEAN                            Valid;
+  UINT32                             DeviceId;
+  RISCV_IOMMU_BASE_DEVICE_CONTEXT    Context;
+} MODEL_CONTEXT_CACHE_ENTRY;
+
+struct _RISCV_IOMMU_MODEL {
+  UINT8                           *Registers;
+  RISCV_IOMMU_MODEL_CONFIG        Config;
+  RISCV_IOMMU_MODEL_STATISTICS    Statistics;
+  // When the command at CQH completes, or 0 if the queue is idle.
+  UINT64                          CommandDueTime;
+  MODEL_IOTLB_ENTRY               *IoTlb;
+  MODEL_CONTEXT_CACHE_ENTRY       ContextCache[MODEL_CONTEXT_CACHE_SIZE];
+};
+
+STATIC RISCV_IOMMU_MODEL  *mModels[MODEL_MAX_INSTANCES];
+
+/**
+  Read memory, as a model sees it. A non-coherent model counts a read that finds
+  memory differing from the hart's copy.
+
+  @param[in]   Model    The model.
+  @param[in]   Address  The first byte.
+  @param[out]  Buffer   The bytes read.
+  @param[in]   Length   The number of bytes.
+
+**/
+STATIC
+VOID
+ReadMemory (
+  IN  RISCV_IOMMU_MODEL  *Model,
+  IN  UINT64             Address,
+  OUT VOID               *Buffer,
+  IN  UINTN              Length
+  )
+{
+  if (!Model->Config.NonCoherent) {
+    CopyMem (Buffer, (VOID *)(UINTN)Address, Length);
+    return;
+  }
+
+  if (RiscVIoMmuModelReadMemory ((UINTN)Address, Buffer, Length)) {
+    Model->Statistics.StaleReads++;
+  }
+}
+
+/**
+  Write memory, as a model does.
+
+  @param[in]  Model    The model.
+  @param[in]  Address  The first byte.
+  @param[in]  Buffer   The bytes written.
+  @param[in]  Length   The number of bytes.
+
+**/
+STATIC
+VOID
+WriteMemory (
+  IN RISCV_IOMMU_MODEL  *Model,
+  IN UINT64             Address,
+  IN CONST VOID         *Buffer,
+  IN UINTN              Length
+  )
+{
+  if (!Model->Config.NonCoherent) {
+    CopyMem ((VOID *)(UINTN)Address, Buffer, Length);
+    return;
+  }
+
+  RiscVIoMmuModelWriteMemory ((UINTN)Address, Buffer, Length);
+}
+
+/**
+  Get a 32-bit register of a model, as stored.
+
+  @param[in]  Model   The model.
+  @param[in]  Offset  The offset of the register.
+
+  @return  The value of the register.
+
+**/
+STATIC
+UINT32
+GetRegister32 (
+  IN RISCV_IOMMU_MODEL  *Model,
+  IN UINTN              Offset
+  )
+{
+  return *(UINT32 *)(Model->Registers + Offset);
+}
+
+/**
+  Get a 64-bit register of a model, as stored.
+
+  @param[in]  Model   The model.
+  @param[in]  Offset  The offset of the register.
+
+  @return  The value of the register.
+
+**/
+STATIC
+UINT64
+GetRegister64 (
+  IN RISCV_IOMMU_MODEL  *Model,
+  IN UINTN              Offset
+  )
+{
+  return *(UINT64 *)(Model->Registers + Offset);
+}
+
+/**
+  Set a 32-bit register of a model.
+
+  @param[in]  Model   The model.
+  @param[in]  Offset  The offset of the register.
+  @param[in]  Value   The new value.
+
+**/
+STATIC
+VOID
+SetRegister32 (
+  IN RISCV_IOMMU_MODEL  *Model,
+  IN UINTN              Offset,
+  IN UINT32             Value
+  )
+{
+  *(UINT32 *)(Model->Registers + Offset) = Value;
+}
+
+/**
+  Set a 64-bit register of a model.
+
+  @param[in]  Model   The model.
+  @param[in]  Offset  The offset of the register.
+  @param[in]  Value   The new value.
+
+**/
+STATIC
+VOID
+SetRegister64 (
+  IN RISCV_IOMMU_MODEL  *Model,
+  IN UINTN              Offset,
+  IN UINT64             Value
+  )
+{
+  *(UINT64 *)(Model->Registers + Offset) = Value;
+}
+
+/**
+  Determine if a register is 64 bits wide, so that 32-bit accesses to its halves merge.
+
+  @param[in]  Offset  The offset of the register, aligned to 8 bytes.
+
+  @retval TRUE   The register is 64 bits wide.
+  @retval FALSE  The register is 32 bits wide, or two of them share the doubleword.
+
+**/
+STATIC
+BOOLEAN
+IsRegister64 (
+  IN UINTN  Offset
+  )
+{
+  switch (Offset) {
+    case R_RISCV_IOMMU_CAPABILITIES:
+    case R_RISCV_IOMMU_DDTP:
+    case R_RISCV_IOMMU_CQB:
+    case R_RISCV_IOMMU_FQB:
+    case R_RISCV_IOMMU_PQB:
+    case R_RISCV_IOMMU_IOHPMCYCLES:
+    case R_RISCV_IOMMU_TR_REQ_IOVA:
+    case R_RISCV_IOMMU_TR_REQ_CTL:
+    case R_RISCV_IOMMU_TR_RESPONSE:
+    case R_RISCV_IOMMU_ICVEC:
+      return TRUE;
+    default:
+      break;
+  }
+
+  if ((Offset >= R_RISCV_IOMMU_IOHPMCTR_1_31) && (Offset < R_RISCV_IOMMU_TR_REQ_IOVA)) {
+    return TRUE;
+  }
+
+  //
+  // Each entry of the MSI configuration table starts with its 64-bit address.
+  //
+  return (Offset >= R_RISCV_IOMMU_MSI_CFG_TBL) && (Offset < R_RISCV_IOMMU_RESERVED_2) &&
+         ((Offset - R_RISCV_IOMMU_MSI_CFG_TBL) % sizeof (RISCV_IOMMU_MSI_CFG_TBL_ENTRY) == 0);
+}
+
+/**
+  Get the index mask of a queue, from the size field of its base register.
+
+  @param[in]  Model         The model.
+  @param[in]  QueueBaseReg  The offset of the base register of the queue.
+
+  @return  The number of entries of the queue, minus one.
+
+**/
+STATIC
+UINT32
+GetQueueMask (
+  IN RISCV_IOMMU_MODEL  *Model,
+  IN UINTN              QueueBaseReg
+  )
+{
+  RISCV_IOMMU_QUEUE_BASE  QueueBase;
+
+  QueueBase.Uint64 = GetRegister64 (Model, QueueBaseReg);
+  return (UINT32)LShiftU64 (1, QueueBase.Bits.LOG2SZ_1 + 1) - 1;
+}
+
+/**
+  Get the address of an entry of a queue.
+
+  @param[in]  Model         The model.
+  @param[in]  QueueBaseReg  The offset of the base register of the queue.
+  @param[in]  Index         The index of the entry.
+  @param[in]  EntrySize     The size of each entry.
+
+  @return  The address of the entry.
+
+**/
+STATIC
+VOID *
+GetQueueEntry (
+  IN RISCV_IOMMU_MODEL  *Model,
+  IN UINTN              QueueBaseReg,
+  IN UINT32             Index,
+  IN UINTN              EntrySize
+  )
+{
+  RISCV_IOMMU_QUEUE_BASE  QueueBase;
+
+  QueueBase.Uint64 = GetRegister64 (Model, QueueBaseReg);
+  return (VOID *)(UINTN)(LShiftU64 (QueueBase.Bits.PPN, EFI_PAGE_SHIFT) + Index * EntrySize);
+}
+
+/**
+  Set an interrupt-pending bit, if the interrupt of its queue is enabled.
+
+  @param[in]  Model        The model.
+  @param[in]  QueueCsrReg  The offset of the CSR of the queue.
+  @param[in]  PendingBit   The bit in IPSR.
+
+**/
+STATIC
+VOID
+RaiseInterrupt (
+  IN RISCV_IOMMU_MODEL  *Model,
+  IN UINTN              QueueCsrReg,
+  IN UINT32             PendingBit
+  )
+{
+  RISCV_IOMMU_HARDWARE_REQUEST_QUEUE_CSR  QueueCsr;
+
+  QueueCsr.Uint32 = GetRegister32 (Model, QueueCsrReg);
+  if (QueueCsr.Bits.ie) {
+    SetRegister32 (Model, R_RISCV_IOMMU_IPSR, GetRegister32 (Model, R_RISCV_IOMMU_IPSR) | PendingBit);
+  }
+}
+
+/**
+  Record a fault in the fault queue, unless the queue is off or has overflowed.
+
+  @param[in]  Model     The model.
+  @param[in]  Cause     The cause of the fault.
+  @param[in]  Type      The transaction type.
+  @param[in]  DeviceId  The device_id of the requester.
+  @param[in]  Address   The IOVA of the faulting access.
+
+**/
+STATIC
+VOID
+RecordFault (
+  IN RISCV_IOMMU_MODEL  *Model,
+  IN UINT32             Cause,
+  IN UINT32             Type,
+  IN UINT32             DeviceId,
+  IN UINT64             Address
+  )
+{
+  RISCV_IOMMU_HARDWARE_REQUEST_QUEUE_CSR  QueueCsr;
+  RISCV_IOMMU_FAULT_RECORD                Record;
+  UINT32                                  Head;
+  UINT32                                  Tail;
+  UINT32                                  Mask;
+
+  Model->Statistics.Faults++;
+
+  QueueCsr.Uint32 = GetRegister32 (Model, R_RISCV_IOMMU_FQCSR);
+  if (!QueueCsr.Bits.qon || QueueCsr.Bits.qof || QueueCsr.Bits.qmf) {
+    return;
+  }
+
+  Mask = GetQueueMask (Model, R_RISCV_IOMMU_FQB);
+  Head = GetRegister32 (Model, R_RISCV_IOMMU_FQH) & Mask;
+  Tail = GetRegister32 (Model, R_RISCV_IOMMU_FQT) & Mask;
+  if (((Tail + 1) & Mask) == Head) {
+    QueueCsr.Bits.qof = 1;
+    SetRegister32 (Model, R_RISCV_IOMMU_FQCSR, QueueCsr.Uint32);
+    RaiseInterrupt (Model, R_RISCV_IOMMU_FQCSR, BIT1);
+    return;
+  }
+
+  ZeroMem (&Record, sizeof (Record));
+  Record.Bits.CAUSE  = Cause;
+  Record.Bits.TTYP   = Type;
+  Record.Bits.DID    = DeviceId;
+  Record.Bits.iotval = Address;
+  WriteMemory (Model, (UINTN)GetQueueEntry (Model, R_RISCV_IOMMU_FQB, Tail, FAULT_QUEUE_ENTRY_SIZE), &Record, sizeof (Record));
+
+  SetRegister32 (Model, R_RISCV_IOMMU_FQT, (Tail + 1) & Mask);
+  RaiseInterrupt (Model, R_RISCV_IOMMU_FQCSR, BIT1);
+}
+
+/**
+  Invalidate the IOTLB entries that match an IOTINVAL.VMA command.
+
+  @param[in]  Model    The model.
+  @param[in]  Command  The command.
+
+**/
+STATIC
+VOID
+InvalidateIoTlb (
+  IN RISCV_IOMMU_MODEL          *Model,
+  IN CONST RISCV_IOMMU_COMMAND  *Command
+  )
+{
+  UINT32             Index;
+  MODEL_IOTLB_ENTRY  *Entry;
+  UINT64             VirtualPage;
+
+  VirtualPage = Command->IoTinval.ADDR;
+  for (Index = 0; Index < Model->Config.IoTlbEntries; Index++) {
+    Entry = &Model->IoTlb[Index];
+    if (!Entry->Valid) {
+      continue;
+    }
+
+    if (Command->IoTinval.PSCV && (Entry->ProcessSoftContextId != Command->IoTinval.PSCID)) {
+      continue;
+    }
+
+    //
+    // An address invalidates the whole leaf that maps it.
+    //
+    if (Command->IoTinval.AV && (((Entry->VirtualPage ^ VirtualPage) & ~Entry->LeafPageMask) != 0)) {
+      continue;
+    }
+
+    Entry->Valid = FALSE;
+  }
+}
+
+/**
+  Execute a command of the command queue.
+
+  @param[in]  Model    The model.
+  @param[in]  Command  The command.
+
+  @retval TRUE   The command completed.
+  @retval FALSE  The command is illegal.
+
+**/
+STATIC
+BOOLEAN
+ExecuteCommand (
+  IN RISCV_IOMMU_MODEL          *Model,
+  IN CONST RISCV_IOMMU_COMMAND  *Command
+  )
+{
+  RISCV_IOMMU_CAPABILITIES  Capabilities;
+  UINTN                     Index;
+  UINT32                    Data;
+
+  Capabilities.Uint64 = Model->Config.Capabilities;
+
+  switch (Command->Common.Opcode) {
+    case V_RISCV_IOMMU_COMMAND_OPCODE_IOTINVAL:
+      if (Command->IoTinval.Func3 == V_RISCV_IOMMU_COMMAND_FUNC3_IOTINVAL_VMA) {
+        //
+        // Without second-stage translation, only the entries of unvirtualised contexts exist.
+        //
+        if (!Command->IoTinval.GV) {
+          InvalidateIoTlb (Model, Command);
+        }
+      } else if ((Command->IoTinval.Func3 != V_RISCV_IOMMU_COMMAND_FUNC3_IOTINVAL_GVMA) || Command->IoTinval.PSCV) {
+        return FALSE;
+      }
+
+      break;
+
+    case V_RISCV_IOMMU_COMMAND_OPCODE_IOFENCE:
+      if (Command->IoFence.Func3 != V_RISCV_IOMMU_COMMAND_FUNC3_IOFENCE_C) {
+        return FALSE;
+      }
+
+      if (Command->IoFence.AV) {
+        Data = (UINT32)Command->IoFence.DATA;
+        WriteMemory (Model, LShiftU64 (Command->IoFence.ADDR, 2), &Data, sizeof (Data));
+      }
+
+      if (Command->IoFence.WSI) {
+        RaiseInterrupt (Model, R_RISCV_IOMMU_CQCSR, BIT0);
+      }
+
+      break;
+
+    case V_RISCV_IOMMU_COMMAND_OPCODE_IODIR:
+      if (Command->IoDir.Func3 == V_RISCV_IOMMU_COMMAND_FUNC3_IODIR_INVAL_DDT) {
+        for (Index = 0; Index < MODEL_CONTEXT_CACHE_SIZE; Index++) {
+          if (!Command->IoDir.DV || (Model->ContextCache[Index].DeviceId == Command->IoDir.DID)) {
+            Model->ContextCache[Index].Valid = FALSE;
+          }
+        }
+      } else if ((Command->IoDir.Func3 != V_RISCV_IOMMU_COMMAND_FUNC3_IODIR_INVAL_PDT) || !Command->IoDir.DV) {
+        return FALSE;
+      }
+
+      break;
+
+    case V_RISCV_IOMMU_COMMAND_OPCODE_ATS:
+      if (!Capabilities.Bits.ATS || (Command->Ats.Func3 > V_RISCV_IOMMU_COMMAND_FUNC3_ATS_PRGR)) {
+        return FALSE;
+      }
+
+      break;
+
+    default:
+      return FALSE;
+  }
+
+  Model->Statistics.Commands[Command->Common.Opcode]++;
+  return TRUE;
+}
+
+/**
+  Complete the commands of a model that are due, in order. An illegal command stops
+  the queue at its own index, with cmd_ill set.
+
+  @param[in]  Model  The model.
+
+**/
+STATIC
+VOID
+ProcessCommands (
+  IN RISCV_IOMMU_MODEL  *Model
+  )
+{
+  RISCV_IOMMU_SOFTWARE_REQUEST_QUEUE_CSR  QueueCsr;
+  RISCV_IOMMU_COMMAND                     Command;
+  UINT32                                  Head;
+  UINT32                                  Tail;
+  UINT32                                  Mask;
+  UINT64                                  Now;
+
+  Now = RiscVIoMmuModelGetTime ();
+  while (TRUE) {
+    QueueCsr.Uint32 = GetRegister32 (Model, R_RISCV_IOMMU_CQCSR);
+    Mask            = GetQueueMask (Model, R_RISCV_IOMMU_CQB);
+    Head            = GetRegister32 (Model, R_RISCV_IOMMU_CQH);
+    Tail            = GetRegister32 (Model, R_RISCV_IOMMU_CQT) & Mask;
+    if (!QueueCsr.Bits.qon || QueueCsr.Bits.cmd_ill || QueueCsr.Bits.cmd_to || QueueCsr.Bits.qmf || (Head == Tail)) {
+      Model->CommandDueTime = 0;
+      return;
+    }
+
+    if (Model->CommandDueTime == 0) {
+      Model->CommandDueTime = Now + Model->Config.CommandLatency;
+    }
+
+    if (Now < Model->CommandDueTime) {
+      return;
+    }
+
+    ReadMemory (Model, (UINTN)GetQueueEntry (Model, R_RISCV_IOMMU_CQB, Head, COMMAND_QUEUE_ENTRY_SIZE), &Command, sizeof (Command));
+    if (!ExecuteCommand (Model, &Command)) {
+      Model->Statistics.Commands[0]++;
+      QueueCsr.Bits.cmd_ill = 1;
+      SetRegister32 (Model, R_RISCV_IOMMU_CQCSR, QueueCsr.Uint32);
+      RaiseInterrupt (Model, R_RISCV_IOMMU_CQCSR, BIT0);
+      Model->CommandDueTime = 0;
+      return;
+    }
+
+    SetRegister32 (Model, R_RISCV_IOMMU_CQH, (Head + 1) & Mask);
+
+    //
+    // The next command starts when this one completed, however late it was noticed.
+    //
+    Model->CommandDueTime += Model->Config.CommandLatency;
+  }
+}
+
+/**
+  Determine the width of the device_ids that the current DDTP mode of a model walks.
+
+  @param[in]  Model   The model.
+  @param[in]  Levels  The number of directory levels.
+
+  @return  The width of the device_ids, in bits.
+
+**/
+STATIC
+UINT8
+GetDeviceIdWidth (
+  IN RISCV_IOMMU_MODEL  *Model,
+  IN UINT8              Levels
+  )
+{
+  RISCV_IOMMU_CAPABILITIES  Capabilities;
+  UINT8                     LeafWidth;
+
+  Capabilities.Uint64 = Model->Config.Capabilities;
+  LeafWidth           = Capabilities.Bits.MSI_FLAT ? N_RISCV_IOMMU_DEVICE_ID_EXTENDED_I1 : N_RISCV_IOMMU_DEVICE_ID_BASE_I1;
+  return MIN (LeafWidth + (Levels - 1) * RISCV_IOMMU_DDT_NON_LEAF_INDEX_WIDTH, N_RISCV_IOMMU_DEVICE_ID_MAX);
+}
+
+/**
+  Find the device context of a device, in the cache or by walking the device directory.
+
+  @param[in]   Model     The model.
+  @param[in]   DeviceId  The device_id.
+  @param[out]  Context   The device context.
+
+  @return  0 if the context was found and is valid, or the cause of the fault otherwise.
+
+**/
+STATIC
+UINT32
+LocateDeviceContext (
+  IN  RISCV_IOMMU_MODEL                *Model,
+  IN  UINT32                           DeviceId,
+  OUT RISCV_IOMMU_BASE_DEVICE_CONTEXT  *Context
+  )
+{
+  RISCV_IOMMU_CAPABILITIES        Capabilities;
+  RISCV_IOMMU_DDTP                Ddtp;
+  RISCV_IOMMU_DDT_NON_LEAF_ENTRY  Entry;
+  MODEL_CONTEXT_CACHE_ENTRY       *Cached;
+  UINT8                           Levels;
+  UINT8                           Level;
+  UINT8                           LeafWidth;
+  UINT64                          Table;
+  UINTN                           Index;
+  UINTN                           ContextSize;
+  UINTN                           Accesses;
+
+  Cached = &Model->ContextCache[DeviceId % MODEL_CONTEXT_CACHE_SIZE];
+  if (Cached->Valid && (Cached->DeviceId == DeviceId)) {
+    CopyMem (Context, &Cached->Context, sizeof (*Context));
+    return 0;
+  }
+
+  Model->Statistics.DeviceContextMisses++;
+
+  Capabilities.Uint64 = Model->Config.Capabilities;
+  Ddtp.Uint64         = GetRegister64 (Model, R_RISCV_IOMMU_DDTP);
+  Levels              = (UINT8)(Ddtp.Bits.iommu_mode - V_RISCV_IOMMU_DDTP_IOMMU_MODE_BARE);
+  if (RShiftU64 (DeviceId, GetDeviceIdWidth (Model, Levels)) != 0) {
+    return MODEL_CAUSE_TRANSACTION_DISALLOWED;
+  }
+
+  LeafWidth   = Capabilities.Bits.MSI_FLAT ? N_RISCV_IOMMU_DEVICE_ID_EXTENDED_I1 : N_RISCV_IOMMU_DEVICE_ID_BASE_I1;
+  ContextSize = Capabilities.Bits.MSI_FLAT ? sizeof (RISCV_IOMMU_EXTENDED_DEVICE_CONTEXT) : sizeof (RISCV_IOMMU_BASE_DEVICE_CONTEXT);
+  Table       = LShiftU64 (Ddtp.Bits.PPN, EFI_PAGE_SHIFT);
+  Accesses    = 0;
+
+  for (Level = Levels - 1; Level > 0; Level--) {
+    Index        = (UINTN)RShiftU64 (DeviceId, LeafWidth + (Level - 1) * RISCV_IOMMU_DDT_NON_LEAF_INDEX_WIDTH) & 0x1FF;
+    ReadMemory (Model, Table + Index * sizeof (UINT64), &Entry.Uint64, sizeof (UINT64));
+    Accesses++;
+    if (!Entry.Bits.V) {
+      RiscVIoMmuModelInjectTime (Accesses * Model->Config.WalkLatency);
+      Model->Statistics.WalkAccesses += Accesses;
+      return MODEL_CAUSE_DDT_NOT_VALID;
+    }
+
+    Table = LShiftU64 (Entry.Bits.PPN, EFI_PAGE_SHIFT);
+  }
+
+  Index = DeviceId & ((1U << LeafWidth) - 1);
+  ReadMemory (Model, Table + Index * ContextSize, Context, sizeof (*Context));
+  Accesses++;
+
+  RiscVIoMmuModelInjectTime (Accesses * Model->Config.WalkLatency);
+  Model->Statistics.WalkAccesses += Accesses;
+
+  if (!Context->TranslationControl.Bits.V) {
+    return MODEL_CAUSE_DDT_NOT_VALID;
+  }
+
+  //
+  // Only what the model implements may be enabled.
+  //
+  if ((Context->IoHgatp.Bits.MODE != V_RISCV_IOMMU_IOHGATP_MODE_BARE) ||
+      Context->TranslationControl.Bits.PDTV ||
+      (Context->TranslationControl.Bits.EN_ATS && !Capabilities.Bits.ATS) ||
+      (Context->TranslationControl.Bits.SADE && !Capabilities.Bits.AMO_HWAD) ||
+      (Context->TranslationControl.Bits.SBE && !Capabilities.Bits.END))
+  {
+    return MODEL_CAUSE_DDT_MISCONFIGURED;
+  }
+
+  switch (Context->FirstStageContext.Bits.MODE) {
+    case V_RISCV_IOMMU_IOSATP_MODE_BARE:
+      break;
+    case V_RISCV_IOMMU_IOSATP_MODE_SV39:
+      if (!Capabilities.Bits.Sv39) {
+        return MODEL_CAUSE_DDT_MISCONFIGURED;
+      }
+
+      break;
+    case V_RISCV_IOMMU_IOSATP_MODE_SV48:
+      if (!Capabilities.Bits.Sv48) {
+        return MODEL_CAUSE_DDT_MISCONFIGURED;
+      }
+
+      break;
+    case V_RISCV_IOMMU_IOSATP_MODE_SV57:
+      if (!Capabilities.Bits.Sv57) {
+        return MODEL_CAUSE_DDT_MISCONFIGURED;
+      }
+
+      break;
+    default:
+      return MODEL_CAUSE_DDT_MISCONFIGURED;
+  }
+
+  Cached->Valid    = TRUE;
+  Cached->DeviceId = DeviceId;
+  CopyMem (&Cached->Context, Context, sizeof (*Context));
+  return 0;
+}
+
+/**
+  Walk the first-stage page table of a device context for an IOVA.
+
+  @param[in]   Model    The model.
+  @param[in]   Context  The device context.
+  @param[in]   Address  The IOVA.
+  @param[in]   IsWrite  Whether the access writes.
+  @param[out]  Entry    The IOTLB entry of the translation.
+
+  @retval TRUE   The IOVA translates.
+  @retval FALSE  The walk faulted.
+
+**/
+STATIC
+BOOLEAN
+WalkPageTable (
+  IN  RISCV_IOMMU_MODEL                      *Model,
+  IN  CONST RISCV_IOMMU_BASE_DEVICE_CONTEXT  *Context,
+  IN  UINT64                                 Address,
+  IN  BOOLEAN                                IsWrite,
+  OUT MODEL_IOTLB_ENTRY                      *Entry
+  )
+{
+  RISCV_IOMMU_CAPABILITIES  Capabilities;
+  UINT8                     Levels;
+  INT8                      Level;
+  UINT64                    Table;
+  UINT64                    Pte;
+  UINT64                    Value;
+  UINT64                    Ppn;
+  UINT64                    LeafPageMask;
+  UINTN                     Accesses;
+  BOOLEAN                   Translated;
+  INT64                     SignExtended;
+
+  Capabilities.Uint64 = Model->Config.Capabilities;
+  Levels              = (UINT8)(Context->FirstStageContext.Bits.MODE - V_RISCV_IOMMU_IOSATP_MODE_SV39 + 3);
+
+  //
+  // The untranslated bits above the IOVA width must all equal its top bit.
+  //
+  SignExtended = (INT64)LShiftU64 (Address, 64 - (Levels * 9 + EFI_PAGE_SHIFT));
+  if ((UINT64)(SignExtended >> (64 - (Levels * 9 + EFI_PAGE_SHIFT))) != Address) {
+    return FALSE;
+  }
+
+  Table      = LShiftU64 (Context->FirstStageContext.Bits.PPN, EFI_PAGE_SHIFT);
+  Accesses   = 0;
+  Translated = FALSE;
+
+  for (Level = Levels - 1; Level >= 0; Level--) {
+    Pte = Table + (RShiftU64 (Address, EFI_PAGE_SHIFT + Level * 9) & 0x1FF) * sizeof (UINT64);
+    ReadMemory (Model, Pte, &Value, sizeof (Value));
+    Accesses++;
+
+    if (((Value & MODEL_PTE_V) == 0) || ((Value & (MODEL_PTE_R | MODEL_PTE_W)) == MODEL_PTE_W) ||
+        ((Value & (MODEL_PTE_RESERVED | MODEL_PTE_N)) != 0))
+    {
+      break;
+    }
+
+    Ppn = MODEL_PTE_PPN (Value);
+    if ((Value & (MODEL_PTE_R | MODEL_PTE_X)) == 0) {
+      //
+      // A pointer to the next level, whose leaf-only bits must be clear.
+      //
+      if ((Level == 0) || ((Value & (MODEL_PTE_D | MODEL_PTE_A | MODEL_PTE_U | MODEL_PTE_PBMT)) != 0)) {
+        break;
+      }
+
+      Table = LShiftU64 (Ppn, EFI_PAGE_SHIFT);
+      continue;
+    }
+
+    LeafPageMask = LShiftU64 (1, Level * 9) - 1;
+    if (((Ppn & LeafPageMask) != 0) || ((Value & MODEL_PTE_U) == 0) ||
+        (!Capabilities.Bits.Svpbmt && ((Value & MODEL_PTE_PBMT) != 0)) ||
+        (IsWrite && ((Value & MODEL_PTE_W) == 0)) || (!IsWrite && ((Value & MODEL_PTE_R) == 0)))
+    {
+      break;
+    }
+
+    //
+    // The A and D bits are only updated by hardware when the context enables it.
+    //
+    if (((Value & MODEL_PTE_A) == 0) || (IsWrite && ((Value & MODEL_PTE_D) == 0))) {
+      if (!Context->TranslationControl.Bits.SADE) {
+        break;
+      }
+
+      Value |= MODEL_PTE_A | (IsWrite ? MODEL_PTE_D : 0);
+      WriteMemory (Model, Pte, &Value, sizeof (Value));
+      Accesses++;
+    }
+
+    Entry->Valid                = TRUE;
+    Entry->Writable             = (Value & (MODEL_PTE_W | MODEL_PTE_D)) == (MODEL_PTE_W | MODEL_PTE_D);
+    Entry->ProcessSoftContextId = (UINT32)Context->TranslationAttributes.Bits.PSCID;
+    Entry->VirtualPage          = RShiftU64 (Address, EFI_PAGE_SHIFT);
+    Entry->LeafPageMask         = LeafPageMask;
+    Entry->PhysicalPage         = Ppn + (Entry->VirtualPage & LeafPageMask);
+    Translated                  = TRUE;
+    break;
+  }
+
+  RiscVIoMmuModelInjectTime (Accesses * Model->Config.WalkLatency);
+  Model->Statistics.WalkAccesses += Accesses;
+  return Translated;
+}
+
+/**
+  Translate an untranslated request of a device, as the IOMMU does.
+
+  @param[in]   Model     The model.
+  @param[in]   DeviceId  The device_id of the requester.
+  @param[in]   Address   The IOVA.
+  @param[in]   IsWrite   Whether the access writes.
+  @param[in]   Report    Whether a fault is recorded in the fault queue.
+  @param[out]  Physical  The physical address.
+
+  @retval TRUE   The request is translated.
+  @retval FALSE  The request faulted.
+
+**/
+STATIC
+BOOLEAN
+Translate (
+  IN  RISCV_IOMMU_MODEL  *Model,
+  IN  UINT32             DeviceId,
+  IN  UINT64             Address,
+  IN  BOOLEAN            IsWrite,
+  IN  BOOLEAN            Report,
+  OUT UINT64             *Physical
+  )
+{
+  RISCV_IOMMU_DDTP                 Ddtp;
+  RISCV_IOMMU_BASE_DEVICE_CONTEXT  Context;
+  MODEL_IOTLB_ENTRY                *Entry;
+  MODEL_IOTLB_ENTRY                Walked;
+  UINT32                           Cause;
+  UINT32                           Type;
+  UINT32                           ProcessSoftContextId;
+  UINT64                           VirtualPage;
+
+  Model->Statistics.Translations++;
+  Type = IsWrite ? V_RISCV_IOMMU_FAULT_TTYP_UNTRANSLATED_WRITE : V_RISCV_IOMMU_FAULT_TTYP_UNTRANSLATED_READ;
+
+  Ddtp.Uint64 = GetRegister64 (Model, R_RISCV_IOMMU_DDTP);
+  if (Ddtp.Bits.iommu_mode == V_RISCV_IOMMU_DDTP_IOMMU_MODE_OFF) {
+    if (Report) {
+      RecordFault (Model, MODEL_CAUSE_ALL_DISALLOWED, Type, DeviceId, Address);
+    }
+
+    return FALSE;
+  }
+
+  if (Ddtp.Bits.iommu_mode == V_RISCV_IOMMU_DDTP_IOMMU_MODE_BARE) {
+    *Physical = Address;
+    return TRUE;
+  }
+
+  Cause = LocateDeviceContext (Model, DeviceId, &Context);
+  if (Cause != 0) {
+    if (Report) {
+      RecordFault (Model, Cause, Type, DeviceId, Address);
+    }
+
+    return FALSE;
+  }
+
+  if (Context.FirstStageContext.Bits.MODE == V_RISCV_IOMMU_IOSATP_MODE_BARE) {
+    *Physical = Address;
+    return TRUE;
+  }
+
+  VirtualPage          = RShiftU64 (Address, EFI_PAGE_SHIFT);
+  ProcessSoftContextId = (UINT32)Context.TranslationAttributes.Bits.PSCID;
+  Entry                = &Model->IoTlb[(VirtualPage ^ MultU64x32 (ProcessSoftContextId, 0x9E37)) & (Model->Config.IoTlbEntries - 1)];
+  if (!Entry->Valid || (Entry->VirtualPage != VirtualPage) || (Entry->ProcessSoftContextId != ProcessSoftContextId) ||
+      (IsWrite && !Entry->Writable))
+  {
+    Model->Statistics.IoTlbMisses++;
+    if (!WalkPageTable (Model, &Context, Address, IsWrite, &Walked)) {
+      //
+      // A context may disable the reporting of its translation faults.
+      //
+      if (Report && !Context.TranslationControl.Bits.DTF) {
+        RecordFault (Model, IsWrite ? MODEL_CAUSE_STORE_PAGE_FAULT : MODEL_CAUSE_LOAD_PAGE_FAULT, Type, DeviceId, Address);
+      }
+
+      return FALSE;
+    }
+
+    CopyMem (Entry, &Walked, sizeof (*Entry));
+  }
+
+  *Physical = LShiftU64 (Entry->PhysicalPage, EFI_PAGE_SHIFT) + (Address & EFI_PAGE_MASK);
+  return TRUE;
+}
+
+/**
+  Perform the translation request of the debug interface, without recording a fault.
+
+  @param[in]  Model  The model.
+
+**/
+STATIC
+VOID
+ServeTranslationRequest (
+  IN RISCV_IOMMU_MODEL  *Model
+  )
+{
+  RISCV_IOMMU_TR_REQ_CTL   Control;
+  RISCV_IOMMU_TR_RESPONSE  Response;
+  UINT64                   Physical;
+
+  Control.Uint64  = GetRegister64 (Model, R_RISCV_IOMMU_TR_REQ_CTL);
+  Response.Uint64 = 0;
+  if (Control.Bits.PV || Control.Bits.Exe || Control.Bits.Priv ||
+      !Translate (Model, (UINT32)Control.Bits.DID, GetRegister64 (Model, R_RISCV_IOMMU_TR_REQ_IOVA), !Control.Bits.NW, FALSE, &Physical))
+  {
+    Response.Bits.fault = 1;
+  } else {
+    Response.Bits.PPN = RShiftU64 (Physical, EFI_PAGE_SHIFT);
+  }
+
+  SetRegister64 (Model, R_RISCV_IOMMU_TR_RESPONSE, Response.Uint64);
+  Control.Bits.Go_Busy = 0;
+  SetRegister64 (Model, R_RISCV_IOMMU_TR_REQ_CTL, Control.Uint64);
+}
+
+/**
+  Update a queue CSR for a write, turning the queue on or off.
+
+  @param[in]  Model        The model.
+  @param[in]  QueueCsrReg  The offset of the CSR.
+  @param[in]  Value        The value written.
+
+**/
+STATIC
+VOID
+WriteQueueCsr (
+  IN RISCV_IOMMU_MODEL  *Model,
+  IN UINTN              QueueCsrReg,
+  IN UINT32             Value
+  )
+{
+  RISCV_IOMMU_SOFTWARE_REQUEST_QUEUE_CSR  Old;
+  RISCV_IOMMU_SOFTWARE_REQUEST_QUEUE_CSR  Written;
+  RISCV_IOMMU_SOFTWARE_REQUEST_QUEUE_CSR  New;
+  UINT32                                  ErrorBits;
+
+  //
+  // The command queue has four error bits, the others only qmf and qof, at the same positions.
+  //
+  ErrorBits      = (QueueCsrReg == R_RISCV_IOMMU_CQCSR) ? (BIT8 | BIT9 | BIT10 | BIT11) : (BIT8 | BIT9);
+  Old.Uint32     = GetRegister32 (Model, QueueCsrReg);
+  Written.Uint32 = Value;
+  New.Uint32     = Old.Uint32 & ~(Value & ErrorBits);
+  New.Bits.ie    = Written.Bits.ie;
+  New.Bits.qen   = Written.Bits.qen;
+
+  if (Written.Bits.qen && !Old.Bits.qen) {
+    New.Uint32  &= ~ErrorBits;
+    New.Bits.qon = 1;
+    switch (QueueCsrReg) {
+      case R_RISCV_IOMMU_CQCSR:
+        SetRegister32 (Model, R_RISCV_IOMMU_CQH, 0);
+        break;
+      case R_RISCV_IOMMU_FQCSR:
+        SetRegister32 (Model, R_RISCV_IOMMU_FQT, 0);
+        break;
+      default:
+        SetRegister32 (Model, R_RISCV_IOMMU_PQT, 0);
+        break;
+    }
+  } else if (!Written.Bits.qen) {
+    New.Bits.qon = 0;
+  }
+
+  SetRegister32 (Model, QueueCsrReg, New.Uint32);
+}
+
+/**
+  Update a 32-bit register for a write.
+
+  @param[in]  Model   The model.
+  @param[in]  Offset  The offset of the register.
+  @param[in]  Value   The value written.
+
+**/
+STATIC
+VOID
+WriteRegister32 (
+  IN RISCV_IOMMU_MODEL  *Model,
+  IN UINTN              Offset,
+  IN UINT32             Value
+  )
+{
+  RISCV_IOMMU_CAPABILITIES  Capabilities;
+  RISCV_IOMMU_FCTL          FeatureControl;
+  RISCV_IOMMU_FCTL          Written;
+
+  Capabilities.Uint64 = Model->Config.Capabilities;
+
+  switch (Offset) {
+    case R_RISCV_IOMMU_FCTL:
+      FeatureControl.Uint32 = GetRegister32 (Model, Offset);
+      Written.Uint32        = Value;
+      if (Capabilities.Bits.END) {
+        FeatureControl.Bits.BE = Written.Bits.BE;
+      }
+
+      if (Capabilities.Bits.IGS == V_RISCV_IOMMU_CAPABILITIES_IGS_BOTH) {
+        FeatureControl.Bits.WSI = Written.Bits.WSI;
+      }
+
+      if (Capabilities.Bits.Sv32) {
+        FeatureControl.Bits.GXL = Written.Bits.GXL;
+      }
+
+      SetRegister32 (Model, Offset, FeatureControl.Uint32);
+      break;
+
+    case R_RISCV_IOMMU_CQT:
+      SetRegister32 (Model, Offset, Value & GetQueueMask (Model, R_RISCV_IOMMU_CQB));
+      Model->Statistics.CommandQueueDoorbells++;
+      break;
+
+    case R_RISCV_IOMMU_FQH:
+      SetRegister32 (Model, Offset, Value & GetQueueMask (Model, R_RISCV_IOMMU_FQB));
+      break;
+
+    case R_RISCV_IOMMU_PQH:
+      SetRegister32 (Model, Offset, Value & GetQueueMask (Model, R_RISCV_IOMMU_PQB));
+      break;
+
+    case R_RISCV_IOMMU_CQCSR:
+    case R_RISCV_IOMMU_FQCSR:
+      WriteQueueCsr (Model, Offset, Value);
+      break;
+
+    case R_RISCV_IOMMU_PQCSR:
+      if (Capabilities.Bits.ATS) {
+        WriteQueueCsr (Model, Offset, Value);
+      }
+
+      break;
+
+    case R_RISCV_IOMMU_IPSR:
+      SetRegister32 (Model, Offset, GetRegister32 (Model, Offset) & ~(Value & (BIT0 | BIT1 | BIT2 | BIT3)));
+      break;
+
+    case R_RISCV_IOMMU_IOCNTINH:
+      if (Capabilities.Bits.HPM) {
+        SetRegister32 (Model, Offset, Value);
+      }
+
+      break;
+
+    case R_RISCV_IOMMU_QOSID:
+      if (Capabilities.Bits.QOSID) {
+        SetRegister32 (Model, Offset, Value & 0x003F003F);
+      }
+
+      break;
+
+    default:
+      //
+      // The data and control words of the MSI configuration table, and nothing else, are writable.
+      //
+      if ((Offset >= R_RISCV_IOMMU_MSI_CFG_TBL) && (Offset < R_RISCV_IOMMU_RESERVED_2)) {
+        SetRegister32 (Model, Offset, Value);
+      }
+
+      break;
+  }
+}
+
+/**
+  Update a 64-bit register for a write.
+
+  @param[in]  Model   The model.
+  @param[in]  Offset  The offset of the register.
+  @param[in]  Value   The value written.
+
+**/
+STATIC
+VOID
+WriteRegister64 (
+  IN RISCV_IOMMU_MODEL  *Model,
+  IN UINTN              Offset,
+  IN UINT64             Value
+  )
+{
+  RISCV_IOMMU_CAPABILITIES                Capabilities;
+  RISCV_IOMMU_DDTP                        Ddtp;
+  RISCV_IOMMU_QUEUE_BASE                  QueueBase;
+  RISCV_IOMMU_HARDWARE_REQUEST_QUEUE_CSR  QueueCsr;
+  RISCV_IOMMU_ICVEC                       Vectors;
+  RISCV_IOMMU_TR_REQ_CTL                  Control;
+  UINT64                                  PhysicalMask;
+
+  Capabilities.Uint64 = Model->Config.Capabilities;
+  PhysicalMask        = RShiftU64 (LShiftU64 (1, Capabilities.Bits.PAS) - 1, EFI_PAGE_SHIFT);
+
+  switch (Offset) {
+    case R_RISCV_IOMMU_DDTP:
+      //
+      // A write of an unsupported mode is ignored. The model switches at once, so busy stays clear.
+      //
+      Ddtp.Uint64 = Value;
+      if (Ddtp.Bits.iommu_mode > V_RISCV_IOMMU_DDTP_IOMMU_MODE_3LVL) {
+        break;
+      }
+
+      Ddtp.Bits.busy      = 0;
+      Ddtp.Bits.Reserved0 = 0;
+      Ddtp.Bits.Reserved1 = 0;
+      Ddtp.Bits.PPN      &= PhysicalMask;
+      SetRegister64 (Model, Offset, Ddtp.Uint64);
+      break;
+
+    case R_RISCV_IOMMU_CQB:
+    case R_RISCV_IOMMU_FQB:
+    case R_RISCV_IOMMU_PQB:
+      if ((Offset == R_RISCV_IOMMU_PQB) && !Capabilities.Bits.ATS) {
+        break;
+      }
+
+      //
+      // The base is only writable while the queue is off.
+      //
+      QueueCsr.Uint32 = GetRegister32 (Model, R_RISCV_IOMMU_CQCSR + (Offset - R_RISCV_IOMMU_CQB) / 4);
+      if (QueueCsr.Bits.qon) {
+        break;
+      }
+
+      QueueBase.Uint64         = Value;
+      QueueBase.Bits.LOG2SZ_1  = MIN (QueueBase.Bits.LOG2SZ_1, Model->Config.MaxQueueLog2Size - 1);
+      QueueBase.Bits.PPN      &= PhysicalMask;
+      QueueBase.Bits.Reserved0 = 0;
+      QueueBase.Bits.Reserved1 = 0;
+      SetRegister64 (Model, Offset, QueueBase.Uint64);
+      break;
+
+    case R_RISCV_IOMMU_ICVEC:
+      Vectors.Uint64        = Value;
+      Vectors.Bits.civ      = MIN (Vectors.Bits.civ, MODEL_INTERRUPT_VECTORS - 1);
+      Vectors.Bits.fiv      = MIN (Vectors.Bits.fiv, MODEL_INTERRUPT_VECTORS - 1);
+      Vectors.Bits.pmiv     = MIN (Vectors.Bits.pmiv, MODEL_INTERRUPT_VECTORS - 1);
+      Vectors.Bits.piv      = MIN (Vectors.Bits.piv, MODEL_INTERRUPT_VECTORS - 1);
+      Vectors.Bits.Reserved = 0;
+      Vectors.Bits.Custom   = 0;
+      SetRegister64 (Model, Offset, Vectors.Uint64);
+      break;
+
+    case R_RISCV_IOMMU_TR_REQ_IOVA:
+      if (Capabilities.Bits.DBG) {
+        SetRegister64 (Model, Offset, Value & ~(UINT64)EFI_PAGE_MASK);
+      }
+
+      break;
+
+    case R_RISCV_IOMMU_TR_REQ_CTL:
+      if (Capabilities.Bits.DBG) {
+        SetRegister64 (Model, Offset, Value);
+        Control.Uint64 = Value;
+        if (Control.Bits.Go_Busy) {
+          ServeTranslationRequest (Model);
+        }
+      }
+
+      break;
+
+    default:
+      if ((Offset >= R_RISCV_IOMMU_IOHPMCYCLES) && (Offset < R_RISCV_IOMMU_TR_REQ_IOVA)) {
+        //
+        // The counters exist, but the model doesn't count.
+        //
+        if (Capabilities.Bits.HPM) {
+          SetRegister64 (Model, Offset, Value);
+        }
+      } else if ((Offset >= R_RISCV_IOMMU_MSI_CFG_TBL) && (Offset < R_RISCV_IOMMU_RESERVED_2)) {
+        SetRegister64 (Model, Offset, Value & ~(UINT64)(BIT0 | BIT1) & (LShiftU64 (1, Capabilities.Bits.PAS) - 1));
+      }
+
+      break;
+  }
+}
+
+/**
+  Find the model whose register page decodes an address.
+
+  @param[in]   Address  The address of an MMIO access.
+  @param[out]  Offset   The offset of the access into the register page.
+
+  @return  The model, or NULL if the address is plain memory.
+
+**/
+RISCV_IOMMU_MODEL *
+RiscVIoMmuModelDecode (
+  IN  UINTN  Address,
+  OUT UINTN  *Offset
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < MODEL_MAX_INSTANCES; Index++) {
+    if ((mModels[Index] != NULL) &&
+        (Address >= (UINTN)mModels[Index]->Registers) &&
+        (Address - (UINTN)mModels[Index]->Registers < EFI_PAGE_SIZE))
+    {
+      *Offset = Address - (UINTN)mModels[Index]->Registers;
+      return mModels[Index];
+    }
+  }
+
+  return NULL;
+}
+
+/**
+  Read a register of a model, once the commands that are due have completed.
+
+  @param[in]  Model   The model.
+  @param[in]  Offset  The offset of the access, aligned to its width.
+  @param[in]  Width   The width of the access, 4 or 8 bytes.
+
+  @return  The value read.
+
+**/
+UINT64
+RiscVIoMmuModelReadRegister (
+  IN RISCV_IOMMU_MODEL  *Model,
+  IN UINTN              Offset,
+  IN UINTN              Width
+  )
+{
+  Model->Statistics.RegisterReads++;
+  ProcessCommands (Model);
+
+  if (Width == sizeof (UINT64)) {
+    return GetRegister64 (Model, Offset);
+  }
+
+  return GetRegister32 (Model, Offset);
+}
+
+/**
+  Write a register of a model. The fields are updated as the hardware would, and
+  the commands that are due complete afterwards.
+
+  @param[in]  Model   The model.
+  @param[in]  Offset  The offset of the access, aligned to its width.
+  @param[in]  Width   The width of the access, 4 or 8 bytes.
+  @param[in]  Value   The value written.
+
+**/
+VOID
+RiscVIoMmuModelWriteRegister (
+  IN RISCV_IOMMU_MODEL  *Model,
+  IN UINTN              Offset,
+  IN UINTN              Width,
+  IN UINT64             Value
+  )
+{
+  UINTN   Register;
+  UINT64  Merged;
+
+  Model->Statistics.RegisterWrites++;
+  ProcessCommands (Model);
+
+  //
+  // A 32-bit access to half of a 64-bit register writes the whole register, with the other half as it was.
+  //
+  Register = Offset & ~(UINTN)(sizeof (UINT64) - 1);
+  if (IsRegister64 (Register)) {
+    Merged = GetRegister64 (Model, Register);
+    if (Width == sizeof (UINT64)) {
+      Merged = Value;
+    } else if (Offset == Register) {
+      Merged = (Merged & ~(UINT64)MAX_UINT32) | (UINT32)Value;
+    } else {
+      Merged = (Merged & MAX_UINT32) | LShiftU64 ((UINT32)Value, 32);
+    }
+
+    WriteRegister64 (Model, Register, Merged);
+  } else if (Width == sizeof (UINT64)) {
+    WriteRegister32 (Model, Offset, (UINT32)Value);
+    WriteRegister32 (Model, Offset + sizeof (UINT32), (UINT32)RShiftU64 (Value, 32));
+  } else {
+    WriteRegister32 (Model, Offset, (UINT32)Value);
+  }
+
+  ProcessCommands (Model);
+}
+
+/**
+  Complete the commands of every model that are due by the time of the virtual clock.
+
+**/
+VOID
+RiscVIoMmuModelProcessAll (
+  VOID
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < MODEL_MAX_INSTANCES; Index++) {
+    if (mModels[Index] != NULL) {
+      ProcessCommands (mModels[Index]);
+    }
+  }
+}
+
+/**
+  Check whether any model is non-coherent, so that the hart implements Zicbom for it.
+
+  @retval  TRUE   A model is non-coherent.
+  @retval  FALSE  Every model is coherent, or there are none.
+
+**/
+BOOLEAN
+RiscVIoMmuModelHasNonCoherent (
+  VOID
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < MODEL_MAX_INSTANCES; Index++) {
+    if ((mModels[Index] != NULL) && mModels[Index]->Config.NonCoherent) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/**
+  Perform a cache-block operation of the hart, counted by every model, on the memory
+  that non-coherent models see.
+
+  @param[in]  Address    An address in the block.
+  @param[in]  Operation  The operation.
+
+**/
+VOID
+RiscVIoMmuModelCacheOperation (
+  IN UINTN                              Address,
+  IN RISCV_IOMMU_MODEL_CACHE_OPERATION  Operation
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < MODEL_MAX_INSTANCES; Index++) {
+    if (mModels[Index] == NULL) {
+      continue;
+    }
+
+    switch (Operation) {
+      case RiscVIoMmuModelCacheClean:
+        mModels[Index]->Statistics.CacheCleans++;
+        break;
+      case RiscVIoMmuModelCacheFlush:
+        mModels[Index]->Statistics.CacheFlushes++;
+        break;
+      default:
+        mModels[Index]->Statistics.CacheInvalidates++;
+        break;
+    }
+  }
+
+  if (RiscVIoMmuModelHasNonCoherent ()) {
+    RiscVIoMmuModelMaintainMemory (Address, Operation);
+  }
+}
+
+/**
+  Create a model IOMMU, in its reset state, with its registers in a page of host memory.
+
+  @param[in]  Config  The configuration of the model.
+
+  @return  The model, or NULL if it could not be allocated.
+
+**/
+RISCV_IOMMU_MODEL *
+RiscVIoMmuModelCreate (
+  IN CONST RISCV_IOMMU_MODEL_CONFIG  *Config
+  )
+{
+  RISCV_IOMMU_MODEL         *Model;
+  RISCV_IOMMU_CAPABILITIES  Capabilities;
+  RISCV_IOMMU_FCTL          FeatureControl;
+  UINTN                     Index;
+
+  for (Index = 0; Index < MODEL_MAX_INSTANCES; Index++) {
+    if (mModels[Index] == NULL) {
+      break;
+    }
+  }
+
+  if (Index == MODEL_MAX_INSTANCES) {
+    return NULL;
+  }
+
+  Model = AllocateZeroPool (sizeof (*Model));
+  if (Model == NULL) {
+    return NULL;
+  }
+
+  CopyMem (&Model->Config, Config, sizeof (Model->Config));
+  if (Model->Config.Capabilities == 0) {
+    Capabilities.Uint64        = 0;
+    Capabilities.Bits.version  = V_RISCV_IOMMU_CAPABILITIES_VERSION_1_0;
+    Capabilities.Bits.Sv39     = 1;
+    Capabilities.Bits.Sv48     = 1;
+    Capabilities.Bits.Sv57     = 1;
+    Capabilities.Bits.IGS      = V_RISCV_IOMMU_CAPABILITIES_IGS_WSI;
+    Capabilities.Bits.PAS      = 56;
+    Model->Config.Capabilities = Capabilities.Uint64;
+  }
+
+  if ((Model->Config.MaxQueueLog2Size == 0) || (Model->Config.MaxQueueLog2Size > QUEUE_MAX_LOG_SIZE)) {
+    Model->Config.MaxQueueLog2Size = QUEUE_MAX_LOG_SIZE;
+  }
+
+  if ((Model->Config.IoTlbEntries == 0) || ((Model->Config.IoTlbEntries & (Model->Config.IoTlbEntries - 1)) != 0)) {
+    Model->Config.IoTlbEntries = MODEL_DEFAULT_IOTLB_SIZE;
+  }
+
+  //
+  // The driver programs the register page by its base, which must be aligned.
+  //
+  Model->Registers = AllocateAlignedPages (1, EFI_PAGE_SIZE);
+  Model->IoTlb     = AllocateZeroPool (Model->Config.IoTlbEntries * sizeof (MODEL_IOTLB_ENTRY));
+  if ((Model->Registers == NULL) || (Model->IoTlb == NULL)) {
+    RiscVIoMmuModelDestroy (Model);
+    return NULL;
+  }
+
+  ZeroMem (Model->Registers, EFI_PAGE_SIZE);
+
+  //
+  // The reset state: every queue off, the IOMMU off, and wires signalled if that's all there is.
+  //
+  Capabilities.Uint64 = Model->Config.Capabilities;
+  SetRegister64 (Model, R_RISCV_IOMMU_CAPABILITIES, Capabilities.Uint64);
+  FeatureControl.Uint32   = 0;
+  FeatureControl.Bits.WSI = Capabilities.Bits.IGS == V_RISCV_IOMMU_CAPABILITIES_IGS_WSI;
+  SetRegister32 (Model, R_RISCV_IOMMU_FCTL, FeatureControl.Uint32);
+
+  mModels[Index] = Model;
+  return Model;
+}
+
+/**
+  Destroy a model IOMMU. Its register page is no longer decoded.
+
+  @param[in]  Model  The model.
+
+**/
+VOID
+RiscVIoMmuModelDestroy (
+  IN RISCV_IOMMU_MODEL  *Model
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < MODEL_MAX_INSTANCES; Index++) {
+    if (mModels[Index] == Model) {
+      mModels[Index] = NULL;
+    }
+  }
+
+  if (Model->Config.NonCoherent && !RiscVIoMmuModelHasNonCoherent ()) {
+    RiscVIoMmuModelFreeMemory ();
+  }
+
+  if (Model->Registers != NULL) {
+    FreeAlignedPages (Model->Registers, 1);
+  }
+
+  if (Model->IoTlb != NULL) {
+    FreePool (Model->IoTlb);
+  }
+
+  FreePool (Model);
+}
+
+/**
+  Get the address of the register page of a model, for the driver's instance.
+
+  @param[in]  Model  The model.
+
+  @return  The base address of the registers.
+
+**/
+UINT64
+RiscVIoMmuModelGetBase (
+  IN RISCV_IOMMU_MODEL  *Model
+  )
+{
+  return (UINT64)(UINTN)Model->Registers;
+}
+
+/**
+  Change the command and table-walk latencies of a model.
+
+  @param[in]  Model           The model.
+  @param[in]  CommandLatency  The time that each command takes to complete, in nanoseconds.
+  @param[in]  WalkLatency     The time that each memory access of a table walk takes, in nanoseconds.
+
+**/
+VOID
+RiscVIoMmuModelSetLatencies (
+  IN RISCV_IOMMU_MODEL  *Model,
+  IN UINT32             CommandLatency,
+  IN UINT32             WalkLatency
+  )
+{
+  Model->Config.CommandLatency = CommandLatency;
+  Model->Config.WalkLatency    = WalkLatency;
+}
+
+/**
+  Perform an untranslated DMA of a device through a model, page by page, as the IOMMU
+  translates it. A faulting page stops the transfer and is recorded in the fault queue.
+
+  @param[in]      Model      The model.
+  @param[in]      DeviceId   The device_id of the requester.
+  @param[in]      Address    The device address of the transfer.
+  @param[in, out] Buffer     The data written to memory, or the buffer for the data read.
+  @param[in]      Length     The number of bytes to transfer.
+  @param[in]      IsWrite    Whether the device writes to memory.
+
+  @retval  EFI_SUCCESS        The whole transfer was translated and performed.
+  @retval  EFI_ACCESS_DENIED  A page of the transfer faulted.
+
+**/
+EFI_STATUS
+RiscVIoMmuModelDma (
+  IN     RISCV_IOMMU_MODEL  *Model,
+  IN     UINT32             DeviceId,
+  IN     UINT64             Address,
+  IN OUT VOID               *Buffer,
+  IN     UINTN              Length,
+  IN     BOOLEAN            IsWrite
+  )
+{
+  UINT8   *Data;
+  UINTN   Chunk;
+  UINT64  Physical;
+
+  //
+  // The transfer happens after every command that completed by now.
+  //
+  ProcessCommands (Model);
+
+  Data = Buffer;
+  while (Length > 0) {
+    Chunk = MIN (Length, EFI_PAGE_SIZE - (UINTN)(Address & EFI_PAGE_MASK));
+    if (!Translate (Model, DeviceId, Address, IsWrite, TRUE, &Physical)) {
+      return EFI_ACCESS_DENIED;
+    }
+
+    if (IsWrite) {
+      WriteMemory (Model, Physical, Data, Chunk);
+    } else {
+      ReadMemory (Model, Physical, Data, Chunk);
+    }
+
+    Data    += Chunk;
+    Address += Chunk;
+    Length  -= Chunk;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Count the pages of a page table, below one of its tables.
+
+  @param[in]  Table  The address of the table.
+  @param[in]  Level  The level of the table, 0 for the leaf tables.
+
+  @return  The number of pages, including the table.
+
+**/
+STATIC
+UINTN
+CountPageTablePages (
+  IN UINT64  Table,
+  IN INT8    Level
+  )
+{
+  UINT64  *Entries;
+  UINTN   Index;
+  UINTN   Pages;
+
+  Pages = 1;
+  if (Level == 0) {
+    return Pages;
+  }
+
+  Entries = (UINT64 *)(UINTN)Table;
+  for (Index = 0; Index < EFI_PAGE_SIZE / sizeof (UINT64); Index++) {
+    if (((Entries[Index] & MODEL_PTE_V) != 0) && ((Entries[Index] & (MODEL_PTE_R | MODEL_PTE_W | MODEL_PTE_X)) == 0)) {
+      Pages += CountPageTablePages (LShiftU64 (MODEL_PTE_PPN (Entries[Index]), EFI_PAGE_SHIFT), Level - 1);
+    }
+  }
+
+  return Pages;
+}
+
+/**
+  Count the pages of the device directory below one of its tables, and of the page
+  tables of the contexts that it holds.
+
+  @param[in]      Model      The model.
+  @param[in]      Table      The address of the table.
+  @param[in]      Level      The level of the table, 0 for the leaf tables.
+  @param[in, out] Roots      The page-table roots counted so far.
+  @param[in, out] RootCount  The number of roots counted so far.
+
+  @return  The number of pages, including the table.
+
+**/
+STATIC
+UINTN
+CountDirectoryPages (
+  IN     RISCV_IOMMU_MODEL  *Model,
+  IN     UINT64             Table,
+  IN     UINT8              Level,
+  IN OUT UINT64             **Roots,
+  IN OUT UINTN              *RootCount
+  )
+{
+  RISCV_IOMMU_CAPABILITIES         Capabilities;
+  RISCV_IOMMU_BASE_DEVICE_CONTEXT  *Context;
+  RISCV_IOMMU_DDT_NON_LEAF_ENTRY   *Entries;
+  UINTN                            ContextSize;
+  UINTN                            Index;
+  UINTN                            Root;
+  UINTN                            Pages;
+  UINT64                           RootTable;
+
+  Pages = 1;
+  if (Level > 0) {
+    Entries = (RISCV_IOMMU_DDT_NON_LEAF_ENTRY *)(UINTN)Table;
+    for (Index = 0; Index < EFI_PAGE_SIZE / sizeof (UINT64); Index++) {
+      if (Entries[Index].Bits.V) {
+        Pages += CountDirectoryPages (Model, LShiftU64 (Entries[Index].Bits.PPN, EFI_PAGE_SHIFT), Level - 1, Roots, RootCount);
+      }
+    }
+
+    return Pages;
+  }
+
+  Capabilities.Uint64 = Model->Config.Capabilities;
+  ContextSize         = Capabilities.Bits.MSI_FLAT ? sizeof (RISCV_IOMMU_EXTENDED_DEVICE_CONTEXT) : sizeof (RISCV_IOMMU_BASE_DEVICE_CONTEXT);
+  for (Index = 0; Index < EFI_PAGE_SIZE / ContextSize; Index++) {
+    Context = (RISCV_IOMMU_BASE_DEVICE_CONTEXT *)(UINTN)(Table + Index * ContextSize);
+    if (!Context->TranslationControl.Bits.V ||
+        (Context->FirstStageContext.Bits.MODE < V_RISCV_IOMMU_IOSATP_MODE_SV39) ||
+        (Context->FirstStageContext.Bits.MODE > V_RISCV_IOMMU_IOSATP_MODE_SV57))
+    {
+      continue;
+    }
+
+    //
+    // Devices that share a domain share its page table.
+    //
+    RootTable = LShiftU64 (Context->FirstStageContext.Bits.PPN, EFI_PAGE_SHIFT);
+    for (Root = 0; Root < *RootCount; Root++) {
+      if ((*Roots)[Root] == RootTable) {
+        break;
+      }
+    }
+
+    if (Root < *RootCount) {
+      continue;
+    }
+
+    *Roots = ReallocatePool (*RootCount * sizeof (UINT64), (*RootCount + 1) * sizeof (UINT64), *Roots);
+    if (*Roots == NULL) {
+      *RootCount = 0;
+      continue;
+    }
+
+    (*Roots)[(*RootCount)++] = RootTable;
+    Pages                   += CountPageTablePages (
+                                 RootTable,
+                                 (INT8)(Context->FirstStageContext.Bits.MODE - V_RISCV_IOMMU_IOSATP_MODE_SV39 + 2)
+                                 );
+  }
+
+  return Pages;
+}
+
+/**
+  Count the pages of the device directory and of the page tables that a model can reach
+  from its DDTP, each page table shared by several devices counted once.
+
+  @param[in]  Model  The model.
+
+  @return  The number of table pages.
+
+**/
+UINTN
+RiscVIoMmuModelCountTablePages (
+  IN RISCV_IOMMU_MODEL  *Model
+  )
+{
+  RISCV_IOMMU_DDTP  Ddtp;
+  UINT64            *Roots;
+  UINTN             RootCount;
+  UINTN             Pages;
+
+  Ddtp.Uint64 = GetRegister64 (Model, R_RISCV_IOMMU_DDTP);
+  if (Ddtp.Bits.iommu_mode < V_RISCV_IOMMU_DDTP_IOMMU_MODE_1LVL) {
+    return 0;
+  }
+
+  Roots     = NULL;
+  RootCount = 0;
+  Pages     = CountDirectoryPages (
+                Model,
+                LShiftU64 (Ddtp.Bits.PPN, EFI_PAGE_SHIFT),
+                (UINT8)(Ddtp.Bits.iommu_mode - V_RISCV_IOMMU_DDTP_IOMMU_MODE_1LVL),
+                &Roots,
+                &RootCount
+                );
+  if (Roots != NULL) {
+    FreePool (Roots);
+  }
+
+  return Pages;
+}
+
+/**
+  Get the statistics that a model gathered since it was created or they were reset.
+
+  @param[in]   Model       The model.
+  @param[out]  Statistics  The statistics.
+
+**/
+VOID
+RiscVIoMmuModelGetStatistics (
+  IN  RISCV_IOMMU_MODEL             *Model,
+  OUT RISCV_IOMMU_MODEL_STATISTICS  *Statistics
+  )
+{
+  CopyMem (Statistics, &Model->Statistics, sizeof (*Statistics));
+}
+
+/**
+  Reset the statistics of a model.
+
+  @param[in]  Model  The model.
+
+**/
+VOID
+RiscVIoMmuModelResetStatistics (
+  IN RISCV_IOMMU_MODEL  *Model
+  )
+{
+  ZeroMem (&Model->Statistics, sizeof (Model->Statistics));
+}
@@ -0,0 +1,179 @@
+/** @file
+  Internal definitions of the RISC-V IOMMU model.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef _RISC_V_IO_MMU_MODEL_INTERNAL_
+#define _RISC_V_IO_MMU_MODEL_INTERNAL_
+
+#include "../RiscVIoMmuModel.h"
+
+//
+// The size of the hart's cache blocks, which is also what the memory of non-coherent models tracks.
+//
+#define RISCV_IOMMU_MODEL_CACHE_BLOCK_SIZE  64
+
+typedef enum {
+  RiscVIoMmuModelCacheClean,
+  RiscVIoMmuModelCacheFlush,
+  RiscVIoMmuModelCacheInvalidate
+} RISCV_IOMMU_MODEL_CACHE_OPERATION;
+
+/**
+  Find the model whose register page decodes an address.
+
+  @param[in]   Address  The address of an MMIO access.
+  @param[out]  Offset   The offset of the access into the register page.
+
+  @return  The model, or NULL if the address is plain memory.
+
+**/
+RISCV_IOMMU_MODEL *
+RiscVIoMmuModelDecode (
+  IN  UINTN  Address,
+  OUT UINTN  *Offset
+  );
+
+/**
+  Read a register of a model, once the commands that are due have completed.
+
+  @param[in]  Model   The model.
+  @param[in]  Offset  The offset of the access, aligned to its width.
+  @param[in]  Width   The width of the access, 4 or 8 bytes.
+
+  @return  The value read.
+
+**/
+UINT64
+RiscVIoMmuModelReadRegister (
+  IN RISCV_IOMMU_MODEL  *Model,
+  IN UINTN              Offset,
+  IN UINTN              Width
+  );
+
+/**
+  Write a register of a model. The fields are updated as the hardware would, and
+  the commands that are due complete afterwards.
+
+  @param[in]  Model   The model.
+  @param[in]  Offset  The offset of the access, aligned to its width.
+  @param[in]  Width   The width of the access, 4 or 8 bytes.
+  @param[in]  Value   The value written.
+
+**/
+VOID
+RiscVIoMmuModelWriteRegister (
+  IN RISCV_IOMMU_MODEL  *Model,
+  IN UINTN              Offset,
+  IN UINTN              Width,
+  IN UINT64             Value
+  );
+
+/**
+  Complete the commands of every model that are due by the time of the virtual clock.
+
+**/
+VOID
+RiscVIoMmuModelProcessAll (
+  VOID
+  );
+
+/**
+  Check whether any model is non-coherent, so that the hart implements Zicbom for it.
+
+  @retval  TRUE   A model is non-coherent.
+  @retval  FALSE  Every model is coherent, or there are none.
+
+**/
+BOOLEAN
+RiscVIoMmuModelHasNonCoherent (
+  VOID
+  );
+
+/**
+  Perform a cache-block operation of the hart, counted by every model, on the memory
+  that non-coherent models see.
+
+  @param[in]  Address    An address in the block.
+  @param[in]  Operation  The operation.
+
+**/
+VOID
+RiscVIoMmuModelCacheOperation (
+  IN UINTN                              Address,
+  IN RISCV_IOMMU_MODEL_CACHE_OPERATION  Operation
+  );
+
+/**
+  Read memory as a non-coherent model sees it, bypassing the hart's cache.
+
+  @param[in]   Address  The first byte.
+  @param[out]  Buffer   The bytes read.
+  @param[in]   Length   The number of bytes.
+
+  @retval  TRUE   Memory differs from the hart's copy of the bytes.
+  @retval  FALSE  Memory holds the hart's copy.
+
+**/
+BOOLEAN
+RiscVIoMmuModelReadMemory (
+  IN  UINTN  Address,
+  OUT VOID   *Buffer,
+  IN  UINTN  Length
+  );
+
+/**
+  Write memory as a non-coherent model does. The hart's copy is updated too, as if
+  the hart had invalidated it before reading the bytes.
+
+  @param[in]  Address  The first byte.
+  @param[in]  Buffer   The bytes written.
+  @param[in]  Length   The number of bytes.
+
+**/
+VOID
+RiscVIoMmuModelWriteMemory (
+  IN UINTN       Address,
+  IN CONST VOID  *Buffer,
+  IN UINTN       Length
+  );
+
+/**
+  Apply a cache-block operation of the hart to the memory that non-coherent models see.
+  A clean or flush writes the block back, and an invalidation replaces the hart's copy
+  with memory, if memory holds the block.
+
+  @param[in]  Address    The address of the block.
+  @param[in]  Operation  The operation.
+
+**/
+VOID
+RiscVIoMmuModelMaintainMemory (
+  IN UINTN                              Address,
+  IN RISCV_IOMMU_MODEL_CACHE_OPERATION  Operation
+  );
+
+/**
+  Forget the memory of non-coherent models, once the last of them is destroyed.
+
+**/
+VOID
+RiscVIoMmuModelFreeMemory (
+  VOID
+  );
+
+/**
+  Let the virtual clock pass a time, without completing any commands.
+
+  @param[in]  Nanoseconds  The time to pass.
+
+**/
+VOID
+RiscVIoMmuModelInjectTime (
+  IN UINT64  Nanoseconds
+  );
+
+#endif
@@ -7,124 +7,452 @@
 **/
 
 #include <PiDxe.h>
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
 #include <Library/IoLib.h>
+#include <Library/PcdLib.h>
+#include <Library/SynchronizationLib.h>
 #include <Library/TimerLib.h>
 #include "RiscVIoMmu.h"
 
 /**
   Read a 32-bit IOMMU register.
 
+  @param[in]  IoMmu   The IOMMU.
   @param[in]  Offset  The register offset to read.
   @ret        The value read from the register.
 
 **/
 UINT32
 IoMmuRead32 (
-  IN UINTN  Offset
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINTN                 Offset
   )
 {
-  return MmioRead32 (mRiscVIoMmuGlobalDriverContext.Address + Offset);
+  if (FeaturePcdGet (PcdRiscVIoMmuMmioAccounting)) {
+    IoMmuCountMmioAccesses (1, 0);
+  }
+
+  return MmioRead32 (IoMmu->Address + Offset);
 }
 
 /**
   Write a 32-bit IOMMU register.
 
+  @param[in]  IoMmu   The IOMMU.
   @param[in]  Offset  The register offset to write.
   @param[in]  Value   The value to write to the register.
 
 **/
 VOID
 IoMmuWrite32 (
-  IN UINTN   Offset,
-  IN UINT32  Value
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINTN                 Offset,
+  IN UINT32                Value
+  )
+{
+  if (FeaturePcdGet (PcdRiscVIoMmuMmioAccounting)) {
+    IoMmuCountMmioAccesses (0, 1);
+  }
+
+  MmioWrite32 (IoMmu->Address + Offset, Value);
+}
+
+/**
+  Read a 32-bit IOMMU register, ordered before the later memory accesses of the hart.
+
+  A queue index needs only this one fence, where MmioRead32() fences on both sides
+  and calls the register filter.
+
+  @param[in]  IoMmu   The IOMMU.
+  @param[in]  Offset  The register offset to read.
+  @ret        The value read from the register.
+
+**/
+UINT32
+IoMmuReadAcquire32 (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINTN                 Offset
+  )
+{
+  if (FeaturePcdGet (PcdRiscVIoMmuMmioAccounting)) {
+    IoMmuCountMmioAccesses (1, 0);
+  }
+
+  return RiscVMmioReadAcquire32 (IoMmu->Address + Offset);
+}
+
+/**
+  Write a 32-bit IOMMU register, ordered after the earlier memory accesses of the hart.
+
+  A doorbell needs only this one fence, where MmioWrite32() fences on both sides
+  and calls the register filter.
+
+  @param[in]  IoMmu   The IOMMU.
+  @param[in]  Offset  The register offset to write.
+  @param[in]  Value   The value to write to the register.
+
+**/
+VOID
+IoMmuWriteRelease32 (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINTN                 Offset,
+  IN UINT32                Value
+  )
+{
+  if (FeaturePcdGet (PcdRiscVIoMmuMmioAccounting)) {
+    IoMmuCountMmioAccesses (0, 1);
+  }
+
+  RiscVMmioWriteRelease32 (IoMmu->Address + Offset, Value);
+}
+
+/**
+  Add to a count, which harts may add to at once.
+
+  @param[in, out]  Count  The count.
+  @param[in]       Value  What to add.
+
+**/
+VOID
+IoMmuAddToCount (
+  IN OUT UINT64  *Count,
+  IN     UINT64  Value
+  )
+{
+  UINT64  Original;
+
+  do {
+    Original = *(volatile UINT64 *)Count;
+  } while (InterlockedCompareExchange64 (Count, Original, Original + Value) != Original);
+}
+
+/**
+  Start waiting on the IOMMU.
+
+  @param[out]  Wait  The state of the wait.
+
+**/
+VOID
+IoMmuStartWait (
+  OUT RISCV_IOMMU_WAIT  *Wait
+  )
+{
+  Wait->Spins     = 0;
+  Wait->Backoff   = 1;
+  Wait->Elapsed   = 0;
+  Wait->StartTime = 0;
+}
+
+/**
+  Continue waiting on the IOMMU, after a condition was checked and not met.
+
+  The first calls only spin, later calls delay for exponentially longer.
+
+  @param[in, out]  Wait  The state of the wait.
+
+  @retval  EFI_SUCCESS  The condition may be checked again.
+  @retval  EFI_TIMEOUT  The wait has timed out.
+
+**/
+EFI_STATUS
+IoMmuContinueWait (
+  IN OUT RISCV_IOMMU_WAIT  *Wait
+  )
+{
+  //
+  // Only a wait that didn't complete at once is timed.
+  //
+  if (Wait->StartTime == 0) {
+    Wait->StartTime = GetPerformanceCounter ();
+  }
+
+  //
+  // Most operations complete within a few register reads, so don't delay those.
+  //
+  if (Wait->Spins < RISCV_IOMMU_WAIT_SPIN_COUNT) {
+    Wait->Spins++;
+    CpuPause ();
+    return EFI_SUCCESS;
+  }
+
+  if (Wait->Elapsed >= RISCV_IOMMU_WAIT_TIMEOUT_US) {
+    return EFI_TIMEOUT;
+  }
+
+  MicroSecondDelay (Wait->Backoff);
+  Wait->Elapsed += Wait->Backoff;
+  Wait->Backoff  = MIN (Wait->Backoff * 2, RISCV_IOMMU_WAIT_MAX_BACKOFF_US);
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Finish waiting on the IOMMU, whether its condition was met or the wait timed out,
+  and account the time it was blocked.
+
+  @param[in]  Wait  The state of the wait.
+
+**/
+VOID
+IoMmuEndWait (
+  IN RISCV_IOMMU_WAIT  *Wait
   )
 {
-  MmioWrite32 (mRiscVIoMmuGlobalDriverContext.Address + Offset, Value);
+  if (Wait->StartTime != 0) {
+    IoMmuCountWaitTime (GetPerformanceCounter () - Wait->StartTime);
+  }
 }
 
 /**
   Write a 32-bit IOMMU register and wait for a mask to be set/unset.
 
+  @param[in]  IoMmu   The IOMMU.
   @param[in]  Offset  The register offset to write.
   @param[in]  Value   The value to write to the register.
   @param[in]  Mask    The bitmask to wait for.
   @param[in]  Set     Whether the mask should be set or unset.
 
+  @retval  EFI_SUCCESS  The mask reached the expected state.
+  @retval  EFI_TIMEOUT  The mask did not reach the expected state in time.
+
 **/
-VOID
+EFI_STATUS
 IoMmuWriteAndWait32 (
-  IN UINTN    Offset,
-  IN UINT32   Value,
-  IN UINT32   Mask,
-  IN BOOLEAN  Set
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINTN                 Offset,
+  IN UINT32                Value,
+  IN UINT32                Mask,
+  IN BOOLEAN               Set
+  )
+{
+  UINT32            RegValue;
+  RISCV_IOMMU_WAIT  Wait;
+  UINTN             Polls;
+  UINT64            StartTime;
+  EFI_STATUS        Status;
+
+  RegValue  = Value;
+  Polls     = 0;
+  StartTime = FeaturePcdGet (PcdRiscVIoMmuMmioAccounting) ? GetPerformanceCounter () : 0;
+  Status    = EFI_SUCCESS;
+
+  IoMmuWrite32 (IoMmu, Offset, RegValue);
+  IoMmuStartWait (&Wait);
+  while ((Set && !(RegValue & Mask)) || (!Set && (RegValue & Mask))) {
+    if (EFI_ERROR (IoMmuContinueWait (&Wait))) {
+      DEBUG ((DEBUG_ERROR, "%a: Timed out on register 0x%x (0x%x)\n", __func__, Offset, RegValue));
+      Status = EFI_TIMEOUT;
+      break;
+    }
+
+    RegValue = IoMmuRead32 (IoMmu, Offset);
+    Polls++;
+  }
+
+  IoMmuEndWait (&Wait);
+  if (FeaturePcdGet (PcdRiscVIoMmuMmioAccounting) && (Polls != 0)) {
+    IoMmuCountMmioWait (Polls, StartTime);
+  }
+
+  return Status;
+}
+
+/**
+  Wait for a mask of a 32-bit IOMMU register to be set/unset, after it was written.
+
+  @param[in]  IoMmu   The IOMMU.
+  @param[in]  Offset  The register offset to poll.
+  @param[in]  Mask    The bitmask to wait for.
+  @param[in]  Set     Whether the mask should be set or unset.
+
+  @retval  EFI_SUCCESS  The mask reached the expected state.
+  @retval  EFI_TIMEOUT  The mask did not reach the expected state in time.
+
+**/
+EFI_STATUS
+IoMmuWait32 (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINTN                 Offset,
+  IN UINT32                Mask,
+  IN BOOLEAN               Set
   )
 {
-  UINT32  RegValue;
+  UINT32            RegValue;
+  RISCV_IOMMU_WAIT  Wait;
+  UINTN             Polls;
+  UINT64            StartTime;
+  EFI_STATUS        Status;
 
-  RegValue = Value;
+  Polls     = 1;
+  StartTime = FeaturePcdGet (PcdRiscVIoMmuMmioAccounting) ? GetPerformanceCounter () : 0;
+  Status    = EFI_SUCCESS;
 
-  MmioWrite32 (mRiscVIoMmuGlobalDriverContext.Address + Offset, RegValue);
+  IoMmuStartWait (&Wait);
+  RegValue = IoMmuRead32 (IoMmu, Offset);
   while ((Set && !(RegValue & Mask)) || (!Set && (RegValue & Mask))) {
-    MicroSecondDelay (5000);
-    RegValue = MmioRead32 (mRiscVIoMmuGlobalDriverContext.Address + Offset);
+    if (EFI_ERROR (IoMmuContinueWait (&Wait))) {
+      DEBUG ((DEBUG_ERROR, "%a: Timed out on register 0x%x (0x%lx)\n", __func__, Offset, (UINT64)RegValue));
+      Status = EFI_TIMEOUT;
+      break;
+    }
+
+    RegValue = IoMmuRead32 (IoMmu, Offset);
+    Polls++;
+  }
+
+  IoMmuEndWait (&Wait);
+  if (FeaturePcdGet (PcdRiscVIoMmuMmioAccounting)) {
+    IoMmuCountMmioWait (Polls, StartTime);
   }
+
+  return Status;
 }
 
 /**
   Read a 64-bit IOMMU register.
 
+  @param[in]  IoMmu   The IOMMU.
   @param[in]  Offset  The register offset to read.
   @ret        The value read from the register.
 
 **/
 UINT64
 IoMmuRead64 (
-  IN UINTN  Offset
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINTN                 Offset
   )
 {
-  return MmioRead64 (mRiscVIoMmuGlobalDriverContext.Address + Offset);
+  if (FeaturePcdGet (PcdRiscVIoMmuMmioAccounting)) {
+    IoMmuCountMmioAccesses (1, 0);
+  }
+
+  return MmioRead64 (IoMmu->Address + Offset);
 }
 
 /**
   Write a 64-bit IOMMU register.
 
+  @param[in]  IoMmu   The IOMMU.
   @param[in]  Offset  The register offset to write.
   @param[in]  Value   The value to write to the register.
 
 **/
 VOID
 IoMmuWrite64 (
-  IN UINTN   Offset,
-  IN UINT64  Value
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINTN                 Offset,
+  IN UINT64                Value
   )
 {
-  MmioWrite64 (mRiscVIoMmuGlobalDriverContext.Address + Offset, Value);
+  if (FeaturePcdGet (PcdRiscVIoMmuMmioAccounting)) {
+    IoMmuCountMmioAccesses (0, 1);
+  }
+
+  MmioWrite64 (IoMmu->Address + Offset, Value);
 }
 
 /**
   Write a 64-bit IOMMU register and wait for a mask to be set/unset.
 
+  @param[in]  IoMmu   The IOMMU.
   @param[in]  Offset  The register offset to write.
   @param[in]  Value   The value to write to the register.
   @param[in]  Mask    The bitmask to wait for.
   @param[in]  Set     Whether the mask should be set or unset.
 
+  @retval  EFI_SUCCESS  The mask reached the expected state.
+  @retval  EFI_TIMEOUT  The mask did not reach the expected state in time.
+
 **/
-VOID
+EFI_STATUS
 IoMmuWriteAndWait64 (
-  IN UINTN    Offset,
-  IN UINT64   Value,
-  IN UINT64   Mask,
-  IN BOOLEAN  Set
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINTN                 Offset,
+  IN UINT64                Value,
+  IN UINT64                Mask,
+  IN BOOLEAN               Set
   )
 {
-  UINT64  RegValue;
+  UINT64            RegValue;
+  RISCV_IOMMU_WAIT  Wait;
+  UINTN             Polls;
+  UINT64            StartTime;
+  EFI_STATUS        Status;
 
-  RegValue = Value;
+  RegValue  = Value;
+  Polls     = 0;
+  StartTime = FeaturePcdGet (PcdRiscVIoMmuMmioAccounting) ? GetPerformanceCounter () : 0;
+  Status    = EFI_SUCCESS;
 
-  MmioWrite64 (mRiscVIoMmuGlobalDriverContext.Address + Offset, RegValue);
+  IoMmuWrite64 (IoMmu, Offset, RegValue);
+  IoMmuStartWait (&Wait);
   while ((Set && !(RegValue & Mask)) || (!Set && (RegValue & Mask))) {
-    MicroSecondDelay (5000);
-    RegValue = MmioRead64 (mRiscVIoMmuGlobalDriverContext.Address + Offset);
+    if (EFI_ERROR (IoMmuContinueWait (&Wait))) {
+      DEBUG ((DEBUG_ERROR, "%a: Timed out on register 0x%x (0x%lx)\n", __func__, Offset, RegValue));
+      Status = EFI_TIMEOUT;
+      break;
+    }
+
+    RegValue = IoMmuRead64 (IoMmu, Offset);
+    Polls++;
+  }
+
+  IoMmuEndWait (&Wait);
+  if (FeaturePcdGet (PcdRiscVIoMmuMmioAccounting) && (Polls != 0)) {
+    IoMmuCountMmioWait (Polls, StartTime);
   }
+
+  return Status;
+}
+
+/**
+  Wait for a mask of a 64-bit IOMMU register to be set/unset, after it was written.
+
+  @param[in]  IoMmu   The IOMMU.
+  @param[in]  Offset  The register offset to poll.
+  @param[in]  Mask    The bitmask to wait for.
+  @param[in]  Set     Whether the mask should be set or unset.
+
+  @retval  EFI_SUCCESS  The mask reached the expected state.
+  @retval  EFI_TIMEOUT  The mask did not reach the expected state in time.
+
+**/
+EFI_STATUS
+IoMmuWait64 (
+  IN RISCV_IOMMU_INSTANCE  *IoMmu,
+  IN UINTN                 Offset,
+  IN UINT64                Mask,
+  IN BOOLEAN               Set
+  )
+{
+  UINT64            RegValue;
+  RISCV_IOMMU_WAIT  Wait;
+  UINTN             Polls;
+  UINT64            StartTime;
+  EFI_STATUS        Status;
+
+  Polls     = 1;
+  StartTime = FeaturePcdGet (PcdRiscVIoMmuMmioAccounting) ? GetPerformanceCounter () : 0;
+  Status    = EFI_SUCCESS;
+
+  IoMmuStartWait (&Wait);
+  RegValue = IoMmuRead64 (IoMmu, Offset);
+  while ((Set && !(RegValue & Mask)) || (!Set && (RegValue & Mask))) {
+    if (EFI_ERROR (IoMmuContinueWait (&Wait))) {
+      DEBUG ((DEBUG_ERROR, "%a: Timed out on register 0x%x (0x%lx)\n", __func__, Offset, (UINT64)RegValue));
+      Status = EFI_TIMEOUT;
+      break;
+    }
+
+    RegValue = IoMmuRead64 (IoMmu, Offset);
+    Polls++;
+  }
+
+  IoMmuEndWait (&Wait);
+  if (FeaturePcdGet (PcdRiscVIoMmuMmioAccounting)) {
+    IoMmuCountMmioWait (Polls, StartTime);
+  }
+
+  return Status;
 }
@@ -0,0 +1,406 @@
+/** @file
+  RISC-V IOMMU PPI for PEI.
+
+  Devices reach the DMA window, and nothing else. Common buffers are allocated
+  from it, and other buffers are used in place if they lie within it, or are
+  bounced through its pages otherwise. Every device shares the window, so
+  SetAttribute() has no translation to change.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiPei.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include "RiscVIoMmuPei.h"
+
+/**
+  Allocate pages of the window, first-fit.
+
+  @param[in]  Private  The PEIM's state.
+  @param[in]  Pages    The number of pages.
+
+  @return  The address of the pages, or 0 if the window has no room for them.
+
+**/
+STATIC
+EFI_PHYSICAL_ADDRESS
+AllocateWindowPages (
+  IN RISCV_IOMMU_PEI_PRIVATE  *Private,
+  IN UINTN                    Pages
+  )
+{
+  UINTN  Start;
+  UINTN  Index;
+
+  if ((Pages == 0) || (Pages > Private->WindowPages)) {
+    return 0;
+  }
+
+  for (Start = 0; Start + Pages <= Private->WindowPages; Start = Index + 1) {
+    for (Index = Start; Index < Start + Pages; Index++) {
+      if ((Private->WindowBitmap[Index / 64] & LShiftU64 (1, Index % 64)) != 0) {
+        break;
+      }
+    }
+
+    if (Index == Start + Pages) {
+      for (Index = Start; Index < Start + Pages; Index++) {
+        Private->WindowBitmap[Index / 64] |= LShiftU64 (1, Index % 64);
+      }
+
+      return Private->WindowBase + EFI_PAGES_TO_SIZE (Start);
+    }
+  }
+
+  return 0;
+}
+
+/**
+  Free pages of the window.
+
+  @param[in]  Private  The PEIM's state.
+  @param[in]  Address  The address of the pages.
+  @param[in]  Pages    The number of pages.
+
+  @retval  EFI_SUCCESS            The pages were freed.
+  @retval  EFI_INVALID_PARAMETER  The pages are not all allocated pages of the window.
+
+**/
+STATIC
+EFI_STATUS
+FreeWindowPages (
+  IN RISCV_IOMMU_PEI_PRIVATE  *Private,
+  IN EFI_PHYSICAL_ADDRESS     Address,
+  IN UINTN                    Pages
+  )
+{
+  UINTN  Start;
+  UINTN  Index;
+
+  if ((Address < Private->WindowBase) || ((Address & EFI_PAGE_MASK) != 0) || (Pages == 0)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Start = (UINTN)EFI_SIZE_TO_PAGES (Address - Private->WindowBase);
+  if ((Start >= Private->WindowPages) || (Pages > Private->WindowPages - Start)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  for (Index = Start; Index < Start + Pages; Index++) {
+    if ((Private->WindowBitmap[Index / 64] & LShiftU64 (1, Index % 64)) == 0) {
+      return EFI_INVALID_PARAMETER;
+    }
+  }
+
+  for (Index = Start; Index < Start + Pages; Index++) {
+    Private->WindowBitmap[Index / 64] &= ~LShiftU64 (1, Index % 64);
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Determine whether a range lies within the window.
+
+  @param[in]  Private  The PEIM's state.
+  @param[in]  Address  The start of the range.
+  @param[in]  Length   The length of the range.
+
+  @retval  TRUE   Devices reach the whole range.
+  @retval  FALSE  Some of the range is outside the window.
+
+**/
+STATIC
+BOOLEAN
+IsInWindow (
+  IN RISCV_IOMMU_PEI_PRIVATE  *Private,
+  IN EFI_PHYSICAL_ADDRESS     Address,
+  IN UINTN                    Length
+  )
+{
+  return (Address >= Private->WindowBase) &&
+         (Length <= EFI_PAGES_TO_SIZE (Private->WindowPages)) &&
+         (Address - Private->WindowBase <= EFI_PAGES_TO_SIZE (Private->WindowPages) - Length);
+}
+
+/**
+  Find the record of a mapping.
+
+  @param[in]  Private  The PEIM's state.
+  @param[in]  Mapping  The mapping value returned from Map().
+
+  @return  The record, or NULL if Mapping was not returned by Map().
+
+**/
+STATIC
+RISCV_IOMMU_PEI_MAPPING *
+GetMapping (
+  IN RISCV_IOMMU_PEI_PRIVATE  *Private,
+  IN VOID                     *Mapping
+  )
+{
+  RISCV_IOMMU_PEI_MAPPING  *MapInfo;
+
+  MapInfo = Mapping;
+  if ((MapInfo < &Private->Mappings[0]) || (MapInfo >= &Private->Mappings[RISCV_IOMMU_PEI_MAX_MAPPINGS]) ||
+      ((UINTN)((UINT8 *)MapInfo - (UINT8 *)&Private->Mappings[0]) % sizeof (*MapInfo) != 0) ||
+      !MapInfo->InUse)
+  {
+    return NULL;
+  }
+
+  return MapInfo;
+}
+
+/**
+  Set IOMMU attribute for a system memory.
+
+  Every device reaches the whole window, so only the arguments are checked.
+
+  @param[in]  This         The PPI instance pointer.
+  @param[in]  Mapping      The mapping value returned from Map().
+  @param[in]  IoMmuAccess  The IOMMU access.
+
+  @retval  EFI_SUCCESS            The IoMmuAccess is set for the memory range specified by DeviceAddress and Length.
+  @retval  EFI_INVALID_PARAMETER  Mapping is not a value that was returned by Map(), or IoMmuAccess is invalid.
+
+**/
+EFI_STATUS
+EFIAPI
+IoMmuPeiSetAttribute (
+  IN EDKII_IOMMU_PPI  *This,
+  IN VOID             *Mapping,
+  IN UINT64           IoMmuAccess
+  )
+{
+  RISCV_IOMMU_PEI_PRIVATE  *Private;
+
+  Private = RISCV_IOMMU_PEI_PRIVATE_FROM_PPI (This);
+  if ((GetMapping (Private, Mapping) == NULL) ||
+      ((IoMmuAccess & ~(UINT64)(EDKII_IOMMU_ACCESS_READ | EDKII_IOMMU_ACCESS_WRITE)) != 0))
+  {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Provides the controller-specific addresses required to access system memory from a
+  DMA bus master.
+
+  @param[in]      This           The PPI instance pointer.
+  @param[in]      Operation      Indicates if the bus master is going to read or write to system memory.
+  @param[in]      HostAddress    The system memory address to map to the PCI controller.
+  @param[in, out] NumberOfBytes  On input the number of bytes to map. On output the number of bytes that were mapped.
+  @param[out]     DeviceAddress  The resulting map address for the bus master PCI controller to use to
+                                 access the hosts HostAddress.
+  @param[out]     Mapping        A resulting value to pass to Unmap().
+
+  @retval  EFI_SUCCESS            The range was mapped for the returned NumberOfBytes.
+  @retval  EFI_UNSUPPORTED        The HostAddress cannot be mapped as a common buffer.
+  @retval  EFI_INVALID_PARAMETER  One or more parameters are invalid.
+  @retval  EFI_OUT_OF_RESOURCES   The request could not be completed due to a lack of resources.
+
+**/
+EFI_STATUS
+EFIAPI
+IoMmuPeiMap (
+  IN     EDKII_IOMMU_PPI        *This,
+  IN     EDKII_IOMMU_OPERATION  Operation,
+  IN     VOID                   *HostAddress,
+  IN OUT UINTN                  *NumberOfBytes,
+  OUT    EFI_PHYSICAL_ADDRESS   *DeviceAddress,
+  OUT    VOID                   **Mapping
+  )
+{
+  RISCV_IOMMU_PEI_PRIVATE  *Private;
+  RISCV_IOMMU_PEI_MAPPING  *MapInfo;
+  EFI_PHYSICAL_ADDRESS     Address;
+  UINTN                    Index;
+
+  if ((HostAddress == NULL) || (NumberOfBytes == NULL) || (*NumberOfBytes == 0) ||
+      (DeviceAddress == NULL) || (Mapping == NULL) || ((UINT32)Operation >= EdkiiIoMmuOperationMaximum))
+  {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Private = RISCV_IOMMU_PEI_PRIVATE_FROM_PPI (This);
+  for (Index = 0; Index < RISCV_IOMMU_PEI_MAX_MAPPINGS; Index++) {
+    if (!Private->Mappings[Index].InUse) {
+      break;
+    }
+  }
+
+  if (Index == RISCV_IOMMU_PEI_MAX_MAPPINGS) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  MapInfo                      = &Private->Mappings[Index];
+  MapInfo->Operation           = Operation;
+  MapInfo->HostAddress         = (EFI_PHYSICAL_ADDRESS)(UINTN)HostAddress;
+  MapInfo->NumberOfBytes       = *NumberOfBytes;
+  MapInfo->NumberOfBouncePages = 0;
+
+  //
+  // A common buffer is shared with the device, so it must be the window's own.
+  //
+  if (IsInWindow (Private, MapInfo->HostAddress, MapInfo->NumberOfBytes)) {
+    Address = MapInfo->HostAddress;
+  } else if ((Operation == EdkiiIoMmuOperationBusMasterCommonBuffer) ||
+             (Operation == EdkiiIoMmuOperationBusMasterCommonBuffer64))
+  {
+    return EFI_UNSUPPORTED;
+  } else {
+    MapInfo->NumberOfBouncePages = EFI_SIZE_TO_PAGES (MapInfo->NumberOfBytes);
+    Address                      = AllocateWindowPages (Private, MapInfo->NumberOfBouncePages);
+    if (Address == 0) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    if ((Operation == EdkiiIoMmuOperationBusMasterRead) || (Operation == EdkiiIoMmuOperationBusMasterRead64)) {
+      CopyMem ((VOID *)(UINTN)Address, HostAddress, MapInfo->NumberOfBytes);
+    }
+  }
+
+  //
+  // The 32-bit operations must be given a 32-bit DeviceAddress.
+  //
+  if (((Operation == EdkiiIoMmuOperationBusMasterRead) ||
+       (Operation == EdkiiIoMmuOperationBusMasterWrite) ||
+       (Operation == EdkiiIoMmuOperationBusMasterCommonBuffer)) &&
+      (Address + MapInfo->NumberOfBytes > SIZE_4GB))
+  {
+    if (MapInfo->NumberOfBouncePages != 0) {
+      FreeWindowPages (Private, Address, MapInfo->NumberOfBouncePages);
+    }
+
+    return EFI_UNSUPPORTED;
+  }
+
+  MapInfo->DeviceAddress = Address;
+  MapInfo->InUse         = TRUE;
+  *DeviceAddress         = Address;
+  *Mapping               = MapInfo;
+  return EFI_SUCCESS;
+}
+
+/**
+  Completes the Map() operation and releases any corresponding resources.
+
+  @param[in]  This     The PPI instance pointer.
+  @param[in]  Mapping  The mapping value returned from Map().
+
+  @retval  EFI_SUCCESS            The range was unmapped.
+  @retval  EFI_INVALID_PARAMETER  Mapping is not a value that was returned by Map().
+
+**/
+EFI_STATUS
+EFIAPI
+IoMmuPeiUnmap (
+  IN EDKII_IOMMU_PPI  *This,
+  IN VOID             *Mapping
+  )
+{
+  RISCV_IOMMU_PEI_PRIVATE  *Private;
+  RISCV_IOMMU_PEI_MAPPING  *MapInfo;
+
+  Private = RISCV_IOMMU_PEI_PRIVATE_FROM_PPI (This);
+  MapInfo = GetMapping (Private, Mapping);
+  if (MapInfo == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (MapInfo->NumberOfBouncePages != 0) {
+    if ((MapInfo->Operation == EdkiiIoMmuOperationBusMasterWrite) ||
+        (MapInfo->Operation == EdkiiIoMmuOperationBusMasterWrite64))
+    {
+      CopyMem ((VOID *)(UINTN)MapInfo->HostAddress, (VOID *)(UINTN)MapInfo->DeviceAddress, MapInfo->NumberOfBytes);
+    }
+
+    FreeWindowPages (Private, MapInfo->DeviceAddress, MapInfo->NumberOfBouncePages);
+  }
+
+  MapInfo->InUse = FALSE;
+  return EFI_SUCCESS;
+}
+
+/**
+  Allocates pages of the DMA window that are suitable for a common buffer mapping.
+
+  @param[in]      This         The PPI instance pointer.
+  @param[in]      MemoryType   The type of memory to allocate.
+  @param[in]      Pages        The number of pages to allocate.
+  @param[in, out] HostAddress  A pointer to store the base system memory address of the allocated range.
+  @param[in]      Attributes   The requested bit mask of attributes for the allocated range.
+
+  @retval  EFI_SUCCESS            The requested memory pages were allocated.
+  @retval  EFI_UNSUPPORTED        Attributes is unsupported.
+  @retval  EFI_INVALID_PARAMETER  One or more parameters are invalid.
+  @retval  EFI_OUT_OF_RESOURCES   The window has no room for the pages.
+
+**/
+EFI_STATUS
+EFIAPI
+IoMmuPeiAllocateBuffer (
+  IN     EDKII_IOMMU_PPI  *This,
+  IN     EFI_MEMORY_TYPE  MemoryType,
+  IN     UINTN            Pages,
+  IN OUT VOID             **HostAddress,
+  IN     UINT64           Attributes
+  )
+{
+  RISCV_IOMMU_PEI_PRIVATE  *Private;
+  EFI_PHYSICAL_ADDRESS     Address;
+
+  if ((HostAddress == NULL) || (Pages == 0)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if ((Attributes & EDKII_IOMMU_ATTRIBUTE_INVALID_FOR_ALLOCATE_BUFFER) != 0) {
+    return EFI_UNSUPPORTED;
+  }
+
+  //
+  // The window's memory is boot-services data, whichever type is asked for.
+  //
+  Private = RISCV_IOMMU_PEI_PRIVATE_FROM_PPI (This);
+  Address = AllocateWindowPages (Private, Pages);
+  if (Address == 0) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  if (((Attributes & EDKII_IOMMU_ATTRIBUTE_DUAL_ADDRESS_CYCLE) == 0) && (Address + EFI_PAGES_TO_SIZE (Pages) > SIZE_4GB)) {
+    FreeWindowPages (Private, Address, Pages);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  *HostAddress = (VOID *)(UINTN)Address;
+  return EFI_SUCCESS;
+}
+
+/**
+  Frees memory that was allocated with AllocateBuffer().
+
+  @param[in]  This         The PPI instance pointer.
+  @param[in]  Pages        The number of pages to free.
+  @param[in]  HostAddress  The base system memory address of the allocated range.
+
+  @retval  EFI_SUCCESS            The requested memory pages were freed.
+  @retval  EFI_INVALID_PARAMETER  The memory range was not allocated with AllocateBuffer().
+
+**/
+EFI_STATUS
+EFIAPI
+IoMmuPeiFreeBuffer (
+  IN EDKII_IOMMU_PPI  *This,
+  IN UINTN            Pages,
+  IN VOID             *HostAddress
+  )
+{
+  return FreeWindowPages (RISCV_IOMMU_PEI_PRIVATE_FROM_PPI (This), (EFI_PHYSICAL_ADDRESS)(UINTN)HostAddress, Pages);
+}
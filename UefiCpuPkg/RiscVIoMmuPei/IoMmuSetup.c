@@ -0,0 +1,546 @@
+/** @file
+  RISC-V IOMMU programming for PEI.
+
+  Every device_id of an IOMMU selects the same device context, since each
+  level of the device directory is a single page, whose entries all point to
+  the page of the next level. The context's first-stage page table maps the
+  DMA window at its own address with 2 MiB leaves, so a device reaches the
+  window and nothing else, and the directory is three pages whatever the
+  device_id width.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiPei.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/HobLib.h>
+#include <Library/IoLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/TimerLib.h>
+#include "RiscVIoMmuPei.h"
+
+/**
+  Allocate a zeroed page for a table or queue, from the platform's DMA pool if it has room.
+
+  @return  The page, or NULL if it could not be allocated.
+
+**/
+STATIC
+VOID *
+AllocateZeroedPage (
+  VOID
+  )
+{
+  VOID  *Page;
+
+  Page = IoMmuPeiAllocateDmaPoolPages (1, EFI_PAGE_SIZE);
+  if (Page == NULL) {
+    Page = AllocatePages (1);
+  }
+
+  if (Page != NULL) {
+    ZeroMem (Page, EFI_PAGE_SIZE);
+  }
+
+  return Page;
+}
+
+/**
+  Build the first-stage page table that identity-maps the DMA window.
+
+  The shallowest paging mode that reaches the end of the window is used, as
+  by the DXE driver, so that IOVAs never need sign-extension.
+
+  @param[in]  Private       The PEIM's state, whose window is allocated.
+  @param[in]  Capabilities  The paging modes that every IOMMU supports.
+
+  @retval  EFI_SUCCESS           The page table is built.
+  @retval  EFI_UNSUPPORTED       No supported paging mode reaches the window.
+  @retval  EFI_OUT_OF_RESOURCES  The page table could not be allocated.
+
+**/
+EFI_STATUS
+IoMmuPeiBuildWindowPageTable (
+  IN RISCV_IOMMU_PEI_PRIVATE   *Private,
+  IN RISCV_IOMMU_CAPABILITIES  Capabilities
+  )
+{
+  UINT64                WindowEnd;
+  UINT8                 Levels;
+  BOOLEAN               Supported;
+  EFI_PHYSICAL_ADDRESS  Address;
+  UINT64                *Table;
+  UINT64                *NextTable;
+  UINTN                 Index;
+  INTN                  Level;
+
+  WindowEnd = Private->WindowBase + EFI_PAGES_TO_SIZE (Private->WindowPages);
+  for (Levels = 3; Levels <= 5; Levels++) {
+    Supported = ((Levels == 3) && Capabilities.Bits.Sv39) ||
+                ((Levels == 4) && Capabilities.Bits.Sv48) ||
+                ((Levels == 5) && Capabilities.Bits.Sv57);
+    if (Supported && (WindowEnd <= LShiftU64 (1, Levels * RISCV_IOMMU_PTE_BITS_PER_LEVEL + RISCV_MMU_PAGE_SHIFT - 1))) {
+      break;
+    }
+  }
+
+  if (Levels > 5) {
+    DEBUG ((DEBUG_ERROR, "%a: No IO paging mode maps the window up to 0x%lx\n", __func__, WindowEnd));
+    return EFI_UNSUPPORTED;
+  }
+
+  Private->IoSatpMode      = V_RISCV_IOMMU_IOSATP_MODE_SV39 + Levels - 3;
+  Private->WindowPageTable = AllocateZeroedPage ();
+  if (Private->WindowPageTable == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  //
+  // Each leaf is reached through the tables above it, which neighbouring leaves share.
+  //
+  for (Address = Private->WindowBase; Address < WindowEnd; Address += RISCV_IOMMU_WINDOW_LEAF_SIZE) {
+    Table = Private->WindowPageTable;
+    for (Level = Levels - 1; Level > RISCV_IOMMU_WINDOW_LEAF_LEVEL; Level--) {
+      Index = (UINTN)RShiftU64 (Address, Level * RISCV_IOMMU_PTE_BITS_PER_LEVEL + RISCV_MMU_PAGE_SHIFT) &
+              ((1 << RISCV_IOMMU_PTE_BITS_PER_LEVEL) - 1);
+      if ((Table[Index] & RISCV_IOMMU_PTE_V) == 0) {
+        NextTable = AllocateZeroedPage ();
+        if (NextTable == NULL) {
+          return EFI_OUT_OF_RESOURCES;
+        }
+
+        Table[Index] = (((UINT64)(UINTN)NextTable >> RISCV_MMU_PAGE_SHIFT) << RISCV_IOMMU_PTE_PPN_SHIFT) | RISCV_IOMMU_PTE_V;
+      }
+
+      Table = (UINT64 *)(UINTN)((Table[Index] >> RISCV_IOMMU_PTE_PPN_SHIFT) << RISCV_MMU_PAGE_SHIFT);
+    }
+
+    //
+    // The leaves are created accessed and dirty, so the IOMMU never updates them.
+    //
+    Index        = (UINTN)RShiftU64 (Address, RISCV_IOMMU_WINDOW_LEAF_LEVEL * RISCV_IOMMU_PTE_BITS_PER_LEVEL + RISCV_MMU_PAGE_SHIFT) &
+                   ((1 << RISCV_IOMMU_PTE_BITS_PER_LEVEL) - 1);
+    Table[Index] = ((Address >> RISCV_MMU_PAGE_SHIFT) << RISCV_IOMMU_PTE_PPN_SHIFT) |
+                   RISCV_IOMMU_PTE_V | RISCV_IOMMU_PTE_U | RISCV_IOMMU_PTE_A |
+                   RISCV_IOMMU_PTE_R | RISCV_IOMMU_PTE_W | RISCV_IOMMU_PTE_D;
+  }
+
+  DEBUG ((
+    DEBUG_INFO,
+    "%a: Window at 0x%lx-0x%lx, devices translate in Sv%u\n",
+    __func__,
+    Private->WindowBase,
+    WindowEnd - 1,
+    Levels * RISCV_IOMMU_PTE_BITS_PER_LEVEL + RISCV_MMU_PAGE_SHIFT
+    ));
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Write a 32-bit register, then wait until a bit reads as set or clear.
+
+  @param[in]  Address  The register base of the IOMMU.
+  @param[in]  Offset   The register offset.
+  @param[in]  Value    The value to write.
+  @param[in]  Mask     The bit to wait on.
+  @param[in]  Set      Whether to wait for the bit to be set, rather than clear.
+
+  @retval  EFI_SUCCESS  The bit reached the state.
+  @retval  EFI_TIMEOUT  The bit did not reach the state in time.
+
+**/
+STATIC
+EFI_STATUS
+WriteAndWait32 (
+  IN UINT64   Address,
+  IN UINTN    Offset,
+  IN UINT32   Value,
+  IN UINT32   Mask,
+  IN BOOLEAN  Set
+  )
+{
+  UINTN  Delay;
+
+  MmioWrite32 (Address + Offset, Value);
+  for (Delay = 0; ((MmioRead32 (Address + Offset) & Mask) != 0) != Set; Delay++) {
+    if (Delay == RISCV_IOMMU_PEI_COMMAND_TIMEOUT) {
+      DEBUG ((DEBUG_ERROR, "%a: Timed out on register 0x%x\n", __func__, Offset));
+      return EFI_TIMEOUT;
+    }
+
+    MicroSecondDelay (1);
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Write the device-directory table pointer, and wait until the IOMMU has switched.
+
+  @param[in]  Address  The register base of the IOMMU.
+  @param[in]  Mode     The IOMMU mode.
+  @param[in]  Root     The root of the directory.
+
+  @retval  TRUE   The IOMMU accepted the mode.
+  @retval  FALSE  The mode is not supported.
+
+**/
+STATIC
+BOOLEAN
+WriteDeviceDirectoryPointer (
+  IN UINT64  Address,
+  IN UINT8   Mode,
+  IN VOID    *Root
+  )
+{
+  RISCV_IOMMU_DDTP  Ddtp;
+  UINTN             Delay;
+
+  Ddtp.Uint64          = 0;
+  Ddtp.Bits.iommu_mode = Mode;
+  Ddtp.Bits.PPN        = (UINT64)(UINTN)Root >> RISCV_MMU_PAGE_SHIFT;
+  MmioWrite64 (Address + R_RISCV_IOMMU_DDTP, Ddtp.Uint64);
+
+  for (Delay = 0; ; Delay++) {
+    Ddtp.Uint64 = MmioRead64 (Address + R_RISCV_IOMMU_DDTP);
+    if (!Ddtp.Bits.busy || (Delay == RISCV_IOMMU_PEI_COMMAND_TIMEOUT)) {
+      break;
+    }
+
+    MicroSecondDelay (1);
+  }
+
+  return !Ddtp.Bits.busy && (Ddtp.Bits.iommu_mode == Mode);
+}
+
+/**
+  Enable a queue of one page, with its interrupt left disabled.
+
+  @param[in]  Address          The register base of the IOMMU.
+  @param[in]  BaseRegister     The offset of the queue's base register.
+  @param[in]  PointerRegister  The offset of the pointer that software writes.
+  @param[in]  CsrRegister      The offset of the queue's control and status register.
+  @param[in]  Buffer           The page of the queue.
+  @param[in]  EntrySize        The size of an entry.
+
+  @retval  EFI_SUCCESS  The queue is on.
+  @retval  EFI_TIMEOUT  The queue did not turn on in time.
+
+**/
+STATIC
+EFI_STATUS
+EnableQueue (
+  IN UINT64  Address,
+  IN UINTN   BaseRegister,
+  IN UINTN   PointerRegister,
+  IN UINTN   CsrRegister,
+  IN VOID    *Buffer,
+  IN UINTN   EntrySize
+  )
+{
+  RISCV_IOMMU_QUEUE_BASE                  QueueBase;
+  RISCV_IOMMU_HARDWARE_REQUEST_QUEUE_CSR  QueueCsr;
+
+  //
+  // The specification defines that the 'buffer size' register is `LOG2SZ-1`.
+  //
+  QueueBase.Uint64        = 0;
+  QueueBase.Bits.PPN      = (UINT64)(UINTN)Buffer >> RISCV_MMU_PAGE_SHIFT;
+  QueueBase.Bits.LOG2SZ_1 = HighBitSet32 ((UINT32)(EFI_PAGE_SIZE / EntrySize)) - 1;
+  MmioWrite64 (Address + BaseRegister, QueueBase.Uint64);
+  MmioWrite32 (Address + PointerRegister, 0);
+
+  //
+  // The command queue's enable bit is at the same position.
+  //
+  QueueCsr.Uint32   = 0;
+  QueueCsr.Bits.qen = 1;
+  return WriteAndWait32 (Address, CsrRegister, QueueCsr.Uint32, 1 << N_RISCV_IOMMU_QUEUE_CSR_QON, TRUE);
+}
+
+/**
+  Write a command into the command queue, to be submitted by SubmitCommands().
+
+  @param[in]  IoMmu    The IOMMU.
+  @param[in]  Command  The command.
+
+**/
+STATIC
+VOID
+QueueCommand (
+  IN RISCV_IOMMU_PEI_INSTANCE  *IoMmu,
+  IN RISCV_IOMMU_COMMAND       *Command
+  )
+{
+  CopyMem (
+    (UINT8 *)IoMmu->CommandQueue + IoMmu->CommandQueueTail * COMMAND_QUEUE_ENTRY_SIZE,
+    Command,
+    COMMAND_QUEUE_ENTRY_SIZE
+    );
+  IoMmu->CommandQueueTail = (IoMmu->CommandQueueTail + 1) & IoMmu->CommandQueueMask;
+}
+
+/**
+  Submit the queued commands, followed by an IOFENCE.C, and wait for it to complete.
+
+  @param[in]  IoMmu  The IOMMU.
+
+  @retval  EFI_SUCCESS       The commands completed.
+  @retval  EFI_DEVICE_ERROR  The command queue reported an error.
+  @retval  EFI_TIMEOUT       The fence did not complete in time.
+
+**/
+STATIC
+EFI_STATUS
+SubmitCommands (
+  IN RISCV_IOMMU_PEI_INSTANCE  *IoMmu
+  )
+{
+  RISCV_IOMMU_COMMAND                     Command;
+  RISCV_IOMMU_SOFTWARE_REQUEST_QUEUE_CSR  CommandQueueCsr;
+  UINT32                                  Sequence;
+  UINTN                                   Delay;
+
+  Sequence = ++IoMmu->FenceSequence;
+  ZeroMem (&Command, sizeof (Command));
+  Command.IoFence.Opcode = V_RISCV_IOMMU_COMMAND_OPCODE_IOFENCE;
+  Command.IoFence.Func3  = V_RISCV_IOMMU_COMMAND_FUNC3_IOFENCE_C;
+  Command.IoFence.AV     = 1;
+  Command.IoFence.PR     = 1;
+  Command.IoFence.PW     = 1;
+  Command.IoFence.DATA   = Sequence;
+  Command.IoFence.ADDR   = (UINT64)(UINTN)IoMmu->FenceCompletion >> 2;
+  QueueCommand (IoMmu, &Command);
+
+  //
+  // The entries must be observable before the doorbell.
+  //
+  MemoryFence ();
+  MmioWrite32 (IoMmu->Address + R_RISCV_IOMMU_CQT, IoMmu->CommandQueueTail);
+
+  for (Delay = 0; *(volatile UINT32 *)IoMmu->FenceCompletion != Sequence; Delay++) {
+    CommandQueueCsr.Uint32 = MmioRead32 (IoMmu->Address + R_RISCV_IOMMU_CQCSR);
+    if (CommandQueueCsr.Bits.cmd_ill || CommandQueueCsr.Bits.cmd_to || CommandQueueCsr.Bits.qmf) {
+      DEBUG ((DEBUG_ERROR, "%a: Command queue error (CQCSR: 0x%x)\n", __func__, CommandQueueCsr.Uint32));
+      return EFI_DEVICE_ERROR;
+    }
+
+    if (Delay == RISCV_IOMMU_PEI_COMMAND_TIMEOUT) {
+      DEBUG ((DEBUG_ERROR, "%a: Timed out waiting for fence 0x%x\n", __func__, Sequence));
+      return EFI_TIMEOUT;
+    }
+
+    MicroSecondDelay (1);
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Determine if an IOMMU is in its reset state, as the DXE driver requires before programming it.
+
+  @param[in]  Address  The register base of the IOMMU.
+
+  @retval  TRUE   The IOMMU is off, with its queues disabled.
+  @retval  FALSE  The IOMMU is active.
+
+**/
+STATIC
+BOOLEAN
+IsReset (
+  IN UINT64  Address
+  )
+{
+  RISCV_IOMMU_HARDWARE_REQUEST_QUEUE_CSR  QueueCsr;
+  RISCV_IOMMU_DDTP                        Ddtp;
+  UINTN                                   Index;
+  STATIC CONST UINTN                      CsrRegisters[] = {
+    R_RISCV_IOMMU_CQCSR, R_RISCV_IOMMU_FQCSR, R_RISCV_IOMMU_PQCSR
+  };
+
+  //
+  // The command queue's enable and status bits are at the same positions.
+  //
+  for (Index = 0; Index < ARRAY_SIZE (CsrRegisters); Index++) {
+    QueueCsr.Uint32 = MmioRead32 (Address + CsrRegisters[Index]);
+    if (QueueCsr.Bits.qen || QueueCsr.Bits.ie || QueueCsr.Bits.qon || QueueCsr.Bits.busy) {
+      return FALSE;
+    }
+  }
+
+  Ddtp.Uint64 = MmioRead64 (Address + R_RISCV_IOMMU_DDTP);
+  return !Ddtp.Bits.busy && (Ddtp.Bits.iommu_mode == V_RISCV_IOMMU_DDTP_IOMMU_MODE_OFF);
+}
+
+/**
+  Bring a system IOMMU out of reset, with every device_id translated through the window,
+  and record it for the DXE driver.
+
+  The feature control register keeps its reset value: little-endian, and the 64-bit
+  paging modes. Interrupts are signalled by wire where that is the only choice, and
+  stay disabled, as completions are polled.
+
+  @param[in]  Private  The PEIM's state, whose window page table is built.
+  @param[in]  Address  The register base of the IOMMU.
+
+  @retval  EFI_SUCCESS           The IOMMU translates through the window.
+  @retval  EFI_UNSUPPORTED       The IOMMU is not in its reset state, or lacks a needed mode.
+  @retval  EFI_OUT_OF_RESOURCES  The tables or queues could not be allocated.
+  @retval  EFI_TIMEOUT           The IOMMU did not complete its invalidations in time.
+
+**/
+EFI_STATUS
+IoMmuPeiProgramIoMmu (
+  IN RISCV_IOMMU_PEI_PRIVATE  *Private,
+  IN UINT64                   Address
+  )
+{
+  RISCV_IOMMU_PEI_INSTANCE         *IoMmu;
+  RISCV_IOMMU_CAPABILITIES         Capabilities;
+  RISCV_IOMMU_FCTL                 FeatureControl;
+  RISCV_IOMMU_BASE_DEVICE_CONTEXT  *DeviceContext;
+  RISCV_IOMMU_DDT_NON_LEAF_ENTRY   *NonLeafEntries;
+  RISCV_IOMMU_COMMAND              Command;
+  RISCV_IOMMU_PEI_HAND_OFF         HandOff;
+  VOID                             *Tables[3];
+  VOID                             *FaultQueue;
+  UINTN                            ContextSize;
+  UINTN                            Index;
+  UINT8                            Levels;
+  EFI_STATUS                       Status;
+
+  if (Private->NumberOfIoMmus == RISCV_IOMMU_PEI_MAX_IOMMUS) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Capabilities.Uint64 = MmioRead64 (Address + R_RISCV_IOMMU_CAPABILITIES);
+  if ((Capabilities.Bits.version != V_RISCV_IOMMU_CAPABILITIES_VERSION_1_0) || !IsReset (Address)) {
+    DEBUG ((DEBUG_WARN, "%a: IOMMU at 0x%lx is not in a reset state of a supported version\n", __func__, Address));
+    return EFI_UNSUPPORTED;
+  }
+
+  if (Capabilities.Bits.IGS == V_RISCV_IOMMU_CAPABILITIES_IGS_WSI) {
+    FeatureControl.Uint32   = MmioRead32 (Address + R_RISCV_IOMMU_FCTL);
+    FeatureControl.Bits.WSI = 1;
+    MmioWrite32 (Address + R_RISCV_IOMMU_FCTL, FeatureControl.Uint32);
+  }
+
+  IoMmu                          = &Private->IoMmus[Private->NumberOfIoMmus];
+  IoMmu->Address                 = Address;
+  IoMmu->ContextStructIsExtended = Capabilities.Bits.MSI_FLAT;
+  IoMmu->CommandQueue            = AllocateZeroedPage ();
+  FaultQueue                     = AllocateZeroedPage ();
+  IoMmu->FenceCompletion         = AllocateZeroPool (sizeof (UINT32));
+  for (Index = 0; Index < ARRAY_SIZE (Tables); Index++) {
+    Tables[Index] = AllocateZeroedPage ();
+    if (Tables[Index] == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+  }
+
+  if ((IoMmu->CommandQueue == NULL) || (FaultQueue == NULL) || (IoMmu->FenceCompletion == NULL)) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  IoMmu->CommandQueueMask = EFI_PAGE_SIZE / COMMAND_QUEUE_ENTRY_SIZE - 1;
+  IoMmu->CommandQueueTail = 0;
+  IoMmu->FenceSequence    = 0;
+
+  //
+  // The leaf page holds identical contexts, and each non-leaf page points all of its entries
+  // at the page below. The format of the context is fixed by MSI_FLAT.
+  //
+  ContextSize = IoMmu->ContextStructIsExtended ? sizeof (RISCV_IOMMU_EXTENDED_DEVICE_CONTEXT) : sizeof (RISCV_IOMMU_BASE_DEVICE_CONTEXT);
+  for (Index = 0; Index < EFI_PAGE_SIZE / ContextSize; Index++) {
+    DeviceContext                                   = (VOID *)((UINT8 *)Tables[0] + Index * ContextSize);
+    DeviceContext->TranslationAttributes.Bits.PSCID = RISCV_IOMMU_PEI_WINDOW_PSCID;
+    DeviceContext->FirstStageContext.Bits.MODE      = Private->IoSatpMode;
+    DeviceContext->FirstStageContext.Bits.PPN       = (UINT64)(UINTN)Private->WindowPageTable >> RISCV_MMU_PAGE_SHIFT;
+    DeviceContext->TranslationControl.Bits.V        = 1;
+  }
+
+  for (Levels = 1; Levels < ARRAY_SIZE (Tables); Levels++) {
+    NonLeafEntries = Tables[Levels];
+    for (Index = 0; Index < EFI_PAGE_SIZE / sizeof (*NonLeafEntries); Index++) {
+      NonLeafEntries[Index].Bits.PPN = (UINT64)(UINTN)Tables[Levels - 1] >> RISCV_MMU_PAGE_SHIFT;
+      NonLeafEntries[Index].Bits.V   = 1;
+    }
+  }
+
+  MemoryFence ();
+
+  Status = EnableQueue (Address, R_RISCV_IOMMU_CQB, R_RISCV_IOMMU_CQT, R_RISCV_IOMMU_CQCSR, IoMmu->CommandQueue, COMMAND_QUEUE_ENTRY_SIZE);
+  if (!EFI_ERROR (Status)) {
+    Status = EnableQueue (Address, R_RISCV_IOMMU_FQB, R_RISCV_IOMMU_FQH, R_RISCV_IOMMU_FQCSR, FaultQueue, FAULT_QUEUE_ENTRY_SIZE);
+  }
+
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  //
+  // Use the deepest directory the IOMMU supports, so that every device_id selects the context.
+  // A shallower one still translates those that fit it, and faults the others.
+  //
+  for (Levels = ARRAY_SIZE (Tables); Levels > 0; Levels--) {
+    if (WriteDeviceDirectoryPointer (Address, V_RISCV_IOMMU_DDTP_IOMMU_MODE_BARE + Levels, Tables[Levels - 1])) {
+      break;
+    }
+  }
+
+  if (Levels == 0) {
+    DEBUG ((DEBUG_ERROR, "%a: IOMMU at 0x%lx supports no device directory\n", __func__, Address));
+    return EFI_UNSUPPORTED;
+  }
+
+  //
+  // Invalidate all cached device contexts and translations.
+  //
+  ZeroMem (&Command, sizeof (Command));
+  Command.IoDir.Opcode = V_RISCV_IOMMU_COMMAND_OPCODE_IODIR;
+  Command.IoDir.Func3  = V_RISCV_IOMMU_COMMAND_FUNC3_IODIR_INVAL_DDT;
+  QueueCommand (IoMmu, &Command);
+
+  ZeroMem (&Command, sizeof (Command));
+  Command.IoTinval.Opcode = V_RISCV_IOMMU_COMMAND_OPCODE_IOTINVAL;
+  Command.IoTinval.Func3  = V_RISCV_IOMMU_COMMAND_FUNC3_IOTINVAL_VMA;
+  QueueCommand (IoMmu, &Command);
+
+  Status = SubmitCommands (IoMmu);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Private->NumberOfIoMmus++;
+
+  //
+  // Hand the IOMMU to the DXE driver.
+  //
+  ZeroMem (&HandOff, sizeof (HandOff));
+  HandOff.Signature              = RISCV_IOMMU_PEI_HAND_OFF_SIGNATURE;
+  HandOff.Revision               = RISCV_IOMMU_PEI_HAND_OFF_REVISION;
+  HandOff.IoMmuAddress           = Address;
+  HandOff.DeviceDirectoryPointer = MmioRead64 (Address + R_RISCV_IOMMU_DDTP);
+  HandOff.CommandQueueBase       = MmioRead64 (Address + R_RISCV_IOMMU_CQB);
+  HandOff.FaultQueueBase         = MmioRead64 (Address + R_RISCV_IOMMU_FQB);
+  HandOff.DmaWindowBase          = Private->WindowBase;
+  HandOff.DmaWindowSize          = EFI_PAGES_TO_SIZE (Private->WindowPages);
+  HandOff.WindowPageTable        = (UINT64)(UINTN)Private->WindowPageTable;
+  HandOff.WindowPscid            = RISCV_IOMMU_PEI_WINDOW_PSCID;
+  BuildGuidDataHob (&gRiscVIoMmuPeiHandOffGuid, &HandOff, sizeof (HandOff));
+
+  DEBUG ((
+    DEBUG_INFO,
+    "%a: IOMMU at 0x%lx translates through the window, with a %d level device table\n",
+    __func__,
+    Address,
+    Levels
+    ));
+
+  return EFI_SUCCESS;
+}
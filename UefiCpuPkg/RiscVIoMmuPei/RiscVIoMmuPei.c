@@ -0,0 +1,244 @@
+/** @file
+  RISC-V IOMMU PEIM.
+
+  Protects DMA before the DXE driver starts: the system IOMMUs of the
+  devicetree are brought out of reset with every device confined to a window
+  of memory, reserved here, and the IOMMU PPI hands out its pages for PEI
+  drivers' DMA. PCI IOMMUs are only found once PCI is enumerated, and are
+  left to the DXE driver.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiPei.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/FdtLib.h>
+#include <Library/HobLib.h>
+#include <Library/IoLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
+#include <Library/PeiServicesLib.h>
+#include "RiscVIoMmuPei.h"
+
+/**
+  Determine whether an IOMMU's memory accesses are not coherent with the harts' caches,
+  as the DXE driver does. The PEIM doesn't maintain the caches, so those IOMMUs are skipped.
+
+  @param[in]  Fdt   The devicetree.
+  @param[in]  Node  The node of the IOMMU.
+
+  @retval  TRUE   The IOMMU doesn't snoop the caches.
+  @retval  FALSE  The IOMMU is coherent.
+
+**/
+STATIC
+BOOLEAN
+IsNonCoherent (
+  IN VOID   *Fdt,
+  IN INT32  Node
+  )
+{
+  for ( ; Node >= 0; Node = FdtParentOffset (Fdt, Node)) {
+    if (FdtGetProp (Fdt, Node, "dma-noncoherent", NULL) != NULL) {
+      return TRUE;
+    }
+
+    if (FdtGetProp (Fdt, Node, "dma-coherent", NULL) != NULL) {
+      return FALSE;
+    }
+  }
+
+  return FALSE;
+}
+
+/**
+  Find the register bases of the coherent system IOMMUs in the devicetree.
+
+  @param[out]  Addresses       The register bases.
+  @param[out]  NumberOfIoMmus  The number of IOMMUs found.
+
+**/
+STATIC
+VOID
+FindSystemIoMmus (
+  OUT UINT64  Addresses[RISCV_IOMMU_PEI_MAX_IOMMUS],
+  OUT UINTN   *NumberOfIoMmus
+  )
+{
+  VOID          *Hob;
+  VOID          *Fdt;
+  INT32         Node;
+  INT32         TempLen;
+  CONST UINT64  *Data64;
+  CONST CHAR8   *Status;
+
+  *NumberOfIoMmus = 0;
+
+  Hob = GetFirstGuidHob (&gFdtHobGuid);
+  if (Hob == NULL) {
+    return;
+  }
+
+  Fdt = (VOID *)(UINTN)*(UINT64 *)GET_GUID_HOB_DATA (Hob);
+  if ((Fdt == NULL) || (FdtCheckHeader (Fdt) != 0)) {
+    return;
+  }
+
+  for (Node = FdtNodeOffsetByCompatible (Fdt, -1, "riscv,iommu")
+       ; (Node >= 0) && (*NumberOfIoMmus < RISCV_IOMMU_PEI_MAX_IOMMUS)
+       ; Node = FdtNodeOffsetByCompatible (Fdt, Node, "riscv,iommu")
+       ) {
+    Status = FdtGetProp (Fdt, Node, "status", &TempLen);
+    if ((Status != NULL) && (AsciiStrCmp (Status, "okay") != 0) && (AsciiStrCmp (Status, "ok") != 0)) {
+      continue;
+    }
+
+    Data64 = FdtGetProp (Fdt, Node, "reg", &TempLen);
+    if ((Data64 == NULL) || (TempLen < 2 * sizeof (UINT64))) {
+      continue;
+    }
+
+    if (IsNonCoherent (Fdt, Node)) {
+      DEBUG ((DEBUG_WARN, "%a: Skipping the non-coherent IOMMU at 0x%lx\n", __func__, Fdt64ToCpu (ReadUnaligned64 (Data64))));
+      continue;
+    }
+
+    Addresses[(*NumberOfIoMmus)++] = Fdt64ToCpu (ReadUnaligned64 (Data64));
+  }
+}
+
+/**
+  Take pages from the front of the DMA pool that the platform reserved, if any.
+
+  The pool's HOB records how much of it is taken, for the DXE driver to start past.
+
+  @param[in]  Pages      The number of pages.
+  @param[in]  Alignment  The alignment of the pages, a power of two of at least a page.
+
+  @return  The pages, or NULL if there is no pool or it has no room.
+
+**/
+VOID *
+IoMmuPeiAllocateDmaPoolPages (
+  IN UINTN  Pages,
+  IN UINTN  Alignment
+  )
+{
+  VOID                  *Hob;
+  RISCV_IOMMU_DMA_POOL  *Pool;
+  UINT64                Address;
+
+  Hob = GetFirstGuidHob (&gRiscVIoMmuDmaPoolHobGuid);
+  if (Hob == NULL) {
+    return NULL;
+  }
+
+  Pool = GET_GUID_HOB_DATA (Hob);
+  if ((Pool->Signature != RISCV_IOMMU_DMA_POOL_SIGNATURE) || (Pool->Used > Pool->Size)) {
+    return NULL;
+  }
+
+  Address = ALIGN_VALUE (Pool->Base + Pool->Used, (UINT64)Alignment);
+  if ((Address > Pool->Base + Pool->Size) || (Pool->Base + Pool->Size - Address < EFI_PAGES_TO_SIZE (Pages))) {
+    return NULL;
+  }
+
+  Pool->Used = Address + EFI_PAGES_TO_SIZE (Pages) - Pool->Base;
+  return (VOID *)(UINTN)Address;
+}
+
+/**
+  Entry point of the RISC-V IOMMU PEIM.
+
+  @param[in]  FileHandle   Handle of the file being invoked.
+  @param[in]  PeiServices  Describes the list of possible PEI Services.
+
+  @retval  EFI_SUCCESS      The IOMMU PPI is installed.
+  @retval  EFI_UNSUPPORTED  No IOMMU was programmed.
+
+**/
+EFI_STATUS
+EFIAPI
+RiscVIoMmuPeiEntryPoint (
+  IN       EFI_PEI_FILE_HANDLE  FileHandle,
+  IN CONST EFI_PEI_SERVICES     **PeiServices
+  )
+{
+  RISCV_IOMMU_PEI_PRIVATE   *Private;
+  RISCV_IOMMU_CAPABILITIES  Capabilities;
+  UINT64                    Addresses[RISCV_IOMMU_PEI_MAX_IOMMUS];
+  UINTN                     NumberOfIoMmus;
+  UINTN                     WindowSize;
+  UINTN                     Index;
+  EFI_STATUS                Status;
+
+  WindowSize = ALIGN_VALUE (PcdGet32 (PcdRiscVIoMmuPeiDmaWindowSize), RISCV_IOMMU_WINDOW_LEAF_SIZE);
+  if (WindowSize == 0) {
+    return EFI_UNSUPPORTED;
+  }
+
+  FindSystemIoMmus (Addresses, &NumberOfIoMmus);
+  if (NumberOfIoMmus == 0) {
+    return EFI_UNSUPPORTED;
+  }
+
+  //
+  // The page table is shared, so its mode must be one that every IOMMU supports.
+  //
+  Capabilities.Uint64 = MAX_UINT64;
+  for (Index = 0; Index < NumberOfIoMmus; Index++) {
+    Capabilities.Uint64 &= MmioRead64 (Addresses[Index] + R_RISCV_IOMMU_CAPABILITIES);
+  }
+
+  Private = AllocateZeroPool (sizeof (*Private));
+  if (Private == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Private->Signature    = RISCV_IOMMU_PEI_PRIVATE_SIGNATURE;
+  Private->WindowPages  = EFI_SIZE_TO_PAGES (WindowSize);
+  Private->WindowBase   = (EFI_PHYSICAL_ADDRESS)(UINTN)IoMmuPeiAllocateDmaPoolPages (Private->WindowPages, RISCV_IOMMU_WINDOW_LEAF_SIZE);
+  if (Private->WindowBase == 0) {
+    Private->WindowBase = (EFI_PHYSICAL_ADDRESS)(UINTN)AllocateAlignedPages (Private->WindowPages, RISCV_IOMMU_WINDOW_LEAF_SIZE);
+  }
+
+  Private->WindowBitmap = AllocatePages (EFI_SIZE_TO_PAGES (ALIGN_VALUE (Private->WindowPages, 64) / 8));
+  if ((Private->WindowBase == 0) || (Private->WindowBitmap == NULL)) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  ZeroMem (Private->WindowBitmap, ALIGN_VALUE (Private->WindowPages, 64) / 8);
+
+  Status = IoMmuPeiBuildWindowPageTable (Private, Capabilities);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  for (Index = 0; Index < NumberOfIoMmus; Index++) {
+    Status = IoMmuPeiProgramIoMmu (Private, Addresses[Index]);
+    if (EFI_ERROR (Status)) {
+      DEBUG ((DEBUG_ERROR, "%a: IOMMU at 0x%lx not programmed: %r\n", __func__, Addresses[Index], Status));
+    }
+  }
+
+  if (Private->NumberOfIoMmus == 0) {
+    return EFI_UNSUPPORTED;
+  }
+
+  Private->IoMmuPpi.Revision       = EDKII_IOMMU_PPI_REVISION;
+  Private->IoMmuPpi.SetAttribute   = IoMmuPeiSetAttribute;
+  Private->IoMmuPpi.Map            = IoMmuPeiMap;
+  Private->IoMmuPpi.Unmap          = IoMmuPeiUnmap;
+  Private->IoMmuPpi.AllocateBuffer = IoMmuPeiAllocateBuffer;
+  Private->IoMmuPpi.FreeBuffer     = IoMmuPeiFreeBuffer;
+
+  Private->PpiDescriptor.Flags = EFI_PEI_PPI_DESCRIPTOR_PPI | EFI_PEI_PPI_DESCRIPTOR_TERMINATE_LIST;
+  Private->PpiDescriptor.Guid  = &gEdkiiIoMmuPpiGuid;
+  Private->PpiDescriptor.Ppi   = &Private->IoMmuPpi;
+
+  return PeiServicesInstallPpi (&Private->PpiDescriptor);
+}
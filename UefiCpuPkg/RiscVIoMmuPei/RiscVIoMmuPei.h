@@ -0,0 +1,262 @@
+/** @file
+  RISC-V IOMMU PEIM.
+
+  Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef _RISC_V_IO_MMU_PEI_
+#define _RISC_V_IO_MMU_PEI_
+
+#include <PiPei.h>
+#include <Ppi/IoMmu.h>
+#include <Guid/RiscVIoMmuDmaPool.h>
+#include <Guid/RiscVIoMmuPeiHandOff.h>
+#include "../RiscVIoMmuDxe/RiscVIoMmuRegisters.h"
+
+#define RISCV_MMU_PAGE_SHIFT  12
+
+//
+// The window is mapped by 2 MiB leaves, at the second level of the page table.
+//
+#define RISCV_IOMMU_PTE_BITS_PER_LEVEL  9
+#define RISCV_IOMMU_PTE_PPN_SHIFT       10
+#define RISCV_IOMMU_WINDOW_LEAF_SIZE    SIZE_2MB
+#define RISCV_IOMMU_WINDOW_LEAF_LEVEL   1
+
+#define RISCV_IOMMU_PTE_V  BIT0
+#define RISCV_IOMMU_PTE_R  BIT1
+#define RISCV_IOMMU_PTE_W  BIT2
+#define RISCV_IOMMU_PTE_U  BIT4
+#define RISCV_IOMMU_PTE_A  BIT6
+#define RISCV_IOMMU_PTE_D  BIT7
+
+//
+// The translations of the shared device context. PSCID 0 is left for the DXE driver's scratch context.
+//
+#define RISCV_IOMMU_PEI_WINDOW_PSCID  1
+
+//
+// The system IOMMUs programmed, and the concurrent mappings of the PPI.
+//
+#define RISCV_IOMMU_PEI_MAX_IOMMUS    4
+#define RISCV_IOMMU_PEI_MAX_MAPPINGS  64
+
+//
+// The command timeout, in microseconds.
+//
+#define RISCV_IOMMU_PEI_COMMAND_TIMEOUT  1000000
+
+//
+// A live mapping created by Map().
+//
+typedef struct {
+  BOOLEAN                  InUse;
+  EDKII_IOMMU_OPERATION    Operation;
+  EFI_PHYSICAL_ADDRESS     HostAddress;
+  UINTN                    NumberOfBytes;
+  // HostAddress, or the bounce pages in the window.
+  EFI_PHYSICAL_ADDRESS     DeviceAddress;
+  UINTN                    NumberOfBouncePages;
+} RISCV_IOMMU_PEI_MAPPING;
+
+//
+// The state of one system IOMMU, as handed to the DXE driver.
+//
+typedef struct {
+  UINT64     Address;
+  UINT64     *CommandQueue;
+  UINT32     CommandQueueMask;
+  UINT32     CommandQueueTail;
+  // The IOFENCE.C completion word.
+  UINT32     *FenceCompletion;
+  UINT32     FenceSequence;
+  BOOLEAN    ContextStructIsExtended;
+} RISCV_IOMMU_PEI_INSTANCE;
+
+#define RISCV_IOMMU_PEI_PRIVATE_SIGNATURE  SIGNATURE_32 ('R', 'V', 'P', 'I')
+
+//
+// PEIM globals aren't writable, so the state hangs off the PPI.
+//
+typedef struct {
+  UINT32                      Signature;
+  EDKII_IOMMU_PPI             IoMmuPpi;
+  EFI_PEI_PPI_DESCRIPTOR      PpiDescriptor;
+  // The identity-mapped window, and a bit per page of it that is allocated.
+  EFI_PHYSICAL_ADDRESS        WindowBase;
+  UINTN                       WindowPages;
+  UINT64                      *WindowBitmap;
+  // The first-stage page table that maps the window, shared by every IOMMU.
+  UINT64                      *WindowPageTable;
+  UINT8                       IoSatpMode;
+  UINTN                       NumberOfIoMmus;
+  RISCV_IOMMU_PEI_INSTANCE    IoMmus[RISCV_IOMMU_PEI_MAX_IOMMUS];
+  RISCV_IOMMU_PEI_MAPPING     Mappings[RISCV_IOMMU_PEI_MAX_MAPPINGS];
+} RISCV_IOMMU_PEI_PRIVATE;
+
+#define RISCV_IOMMU_PEI_PRIVATE_FROM_PPI(a) \
+  CR (a, RISCV_IOMMU_PEI_PRIVATE, IoMmuPpi, RISCV_IOMMU_PEI_PRIVATE_SIGNATURE)
+
+/**
+  Take pages from the front of the DMA pool that the platform reserved, if any.
+
+  @param[in]  Pages      The number of pages.
+  @param[in]  Alignment  The alignment of the pages, a power of two of at least a page.
+
+  @return  The pages, or NULL if there is no pool or it has no room.
+
+**/
+VOID *
+IoMmuPeiAllocateDmaPoolPages (
+  IN UINTN  Pages,
+  IN UINTN  Alignment
+  );
+
+/**
+  Build the first-stage page table that identity-maps the DMA window.
+
+  @param[in]  Private       The PEIM's state, whose window is allocated.
+  @param[in]  Capabilities  The paging modes that every IOMMU supports.
+
+  @retval  EFI_SUCCESS           The page table is built.
+  @retval  EFI_UNSUPPORTED       No supported paging mode reaches the window.
+  @retval  EFI_OUT_OF_RESOURCES  The page table could not be allocated.
+
+**/
+EFI_STATUS
+IoMmuPeiBuildWindowPageTable (
+  IN RISCV_IOMMU_PEI_PRIVATE   *Private,
+  IN RISCV_IOMMU_CAPABILITIES  Capabilities
+  );
+
+/**
+  Bring a system IOMMU out of reset, with every device_id translated through the window,
+  and record it for the DXE driver.
+
+  @param[in]  Private  The PEIM's state, whose window page table is built.
+  @param[in]  Address  The register base of the IOMMU.
+
+  @retval  EFI_SUCCESS           The IOMMU translates through the window.
+  @retval  EFI_UNSUPPORTED       The IOMMU is not in its reset state, or lacks a needed mode.
+  @retval  EFI_OUT_OF_RESOURCES  The tables or queues could not be allocated.
+  @retval  EFI_TIMEOUT           The IOMMU did not complete its invalidations in time.
+
+**/
+EFI_STATUS
+IoMmuPeiProgramIoMmu (
+  IN RISCV_IOMMU_PEI_PRIVATE  *Private,
+  IN UINT64                   Address
+  );
+
+/**
+  Set IOMMU attribute for a system memory.
+
+  @param[in]  This         The PPI instance pointer.
+  @param[in]  Mapping      The mapping value returned from Map().
+  @param[in]  IoMmuAccess  The IOMMU access.
+
+  @retval  EFI_SUCCESS            The IoMmuAccess is set for the memory range specified by DeviceAddress and Length.
+  @retval  EFI_INVALID_PARAMETER  Mapping is not a value that was returned by Map(), or IoMmuAccess is invalid.
+
+**/
+EFI_STATUS
+EFIAPI
+IoMmuPeiSetAttribute (
+  IN EDKII_IOMMU_PPI  *This,
+  IN VOID             *Mapping,
+  IN UINT64           IoMmuAccess
+  );
+
+/**
+  Provides the controller-specific addresses required to access system memory from a
+  DMA bus master.
+
+  @param[in]      This           The PPI instance pointer.
+  @param[in]      Operation      Indicates if the bus master is going to read or write to system memory.
+  @param[in]      HostAddress    The system memory address to map to the PCI controller.
+  @param[in, out] NumberOfBytes  On input the number of bytes to map. On output the number of bytes that were mapped.
+  @param[out]     DeviceAddress  The resulting map address for the bus master PCI controller to use to
+                                 access the hosts HostAddress.
+  @param[out]     Mapping        A resulting value to pass to Unmap().
+
+  @retval  EFI_SUCCESS            The range was mapped for the returned NumberOfBytes.
+  @retval  EFI_UNSUPPORTED        The HostAddress cannot be mapped as a common buffer.
+  @retval  EFI_INVALID_PARAMETER  One or more parameters are invalid.
+  @retval  EFI_OUT_OF_RESOURCES   The request could not be completed due to a lack of resources.
+
+**/
+EFI_STATUS
+EFIAPI
+IoMmuPeiMap (
+  IN     EDKII_IOMMU_PPI        *This,
+  IN     EDKII_IOMMU_OPERATION  Operation,
+  IN     VOID                   *HostAddress,
+  IN OUT UINTN                  *NumberOfBytes,
+  OUT    EFI_PHYSICAL_ADDRESS   *DeviceAddress,
+  OUT    VOID                   **Mapping
+  );
+
+/**
+  Completes the Map() operation and releases any corresponding resources.
+
+  @param[in]  This     The PPI instance pointer.
+  @param[in]  Mapping  The mapping value returned from Map().
+
+  @retval  EFI_SUCCESS            The range was unmapped.
+  @retval  EFI_INVALID_PARAMETER  Mapping is not a value that was returned by Map().
+
+**/
+EFI_STATUS
+EFIAPI
+IoMmuPeiUnmap (
+  IN EDKII_IOMMU_PPI  *This,
+  IN VOID             *Mapping
+  );
+
+/**
+  Allocates pages of the DMA window that are suitable for a common buffer mapping.
+
+  @param[in]      This         The PPI instance pointer.
+  @param[in]      MemoryType   The type of memory to allocate.
+  @param[in]      Pages        The number of pages to allocate.
+  @param[in, out] HostAddress  A pointer to store the base system memory address of the allocated range.
+  @param[in]      Attributes   The requested bit mask of attributes for the allocated range.
+
+  @retval  EFI_SUCCESS            The requested memory pages were allocated.
+  @retval  EFI_UNSUPPORTED        Attributes is unsupported.
+  @retval  EFI_INVALID_PARAMETER  One or more parameters are invalid.
+  @retval  EFI_OUT_OF_RESOURCES   The window has no room for the pages.
+
+**/
+EFI_STATUS
+EFIAPI
+IoMmuPeiAllocateBuffer (
+  IN     EDKII_IOMMU_PPI  *This,
+  IN     EFI_MEMORY_TYPE  MemoryType,
+  IN     UINTN            Pages,
+  IN OUT VOID             **HostAddress,
+  IN     UINT64           Attributes
+  );
+
+/**
+  Frees memory that was allocated with AllocateBuffer().
+
+  @param[in]  This         The PPI instance pointer.
+  @param[in]  Pages        The number of pages to free.
+  @param[in]  HostAddress  The base system memory address of the allocated range.
+
+  @retval  EFI_SUCCESS            The requested memory pages were freed.
+  @retval  EFI_INVALID_PARAMETER  The memory range was not allocated with AllocateBuffer().
+
+**/
+EFI_STATUS
+EFIAPI
+IoMmuPeiFreeBuffer (
+  IN EDKII_IOMMU_PPI  *This,
+  IN UINTN            Pages,
+  IN VOID             *HostAddress
+  );
+
+#endif
@@ -0,0 +1,169 @@
+/** @file
+
+  Copyright (c) 2022, Qualcomm Innovation Center, Inc. All rights reserved.<BR>
+  Copyright (c) 2006 - 2011, Intel Corporation. All rights reserved.<BR>
+  Portions copyright (c) 2011, Apple Inc. All rights reserved.
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef MP_SERVICES_INTERNAL_H_
+#define MP_SERVICES_INTERNAL_H_
+
+#include <Protocol/Cpu.h>
+#include <Protocol/MpService.h>
+
+#include <Library/BaseLib.h>
+#include <Library/UefiLib.h>
+
+//
+// How long DispatchCpu waits for an AP that has finished its procedure to
+// complete its own HSM hart_stop call.
+//
+#define HART_STOP_TIMEOUT_US  1000
+
+//
+// The interrupt identity that wakes a parked AP, enabled in the AP's own S-level
+// IMSIC interrupt file, whose other identities stay disabled. The boot hart
+// sends it by writing it to the seteipnum_le register of the file.
+//
+#define MP_IPI_ID           1
+#define IMSIC_SETEIPNUM_LE  0x0
+
+//
+// Internal Data Structures
+//
+
+//
+// AP state
+//
+// The state transitions for an AP when it processes a procedure are:
+//  Idle ----> Ready ----> Busy ----> Finished ----> Idle
+//       [BSP]       [BSP]      [AP]           [BSP]
+//
+// An AP with an IMSIC parks in a wfi loop when it is finished, rather than
+// stopping with hart_stop, and is dispatched again by an MSI.
+//
+typedef enum {
+  CpuStateIdle,
+  CpuStateReady,
+  CpuStateBlocked,
+  CpuStateBusy,
+  CpuStateFinished,
+  CpuStateDisabled
+} CPU_STATE;
+
+//
+// Define Individual Processor Data block.
+//
+typedef struct {
+  EFI_PROCESSOR_INFORMATION    Info;
+  EFI_AP_PROCEDURE             Procedure;
+  VOID                         *Parameter;
+  volatile CPU_STATE           State;
+  EFI_EVENT                    CheckThisAPEvent;
+  EFI_EVENT                    WaitEvent;
+  UINTN                        Timeout;
+  UINTN                        TimeTaken;
+  BOOLEAN                      TimeoutActive;
+  BOOLEAN                      *SingleApFinished;
+  //
+  // The S-level interrupt file of the AP's IMSIC, or 0 if the AP stops with
+  // hart_stop between procedures.
+  //
+  EFI_PHYSICAL_ADDRESS         ImsicFile;
+  //
+  // Set by the AP once it parks, and cleared by the BSP when it dispatches it.
+  //
+  volatile BOOLEAN             Parked;
+  volatile BOOLEAN             StopRequested;
+  //
+  // A parked AP flushes its TLB and acknowledges each shootdown request.
+  //
+  volatile UINTN               ShootdownRequest;
+  volatile UINTN               ShootdownDone;
+} CPU_AP_DATA;
+
+//
+// Define MP data block which consumes individual processor block.
+//
+typedef struct {
+  UINTN               NumberOfProcessors;
+  UINTN               NumberOfEnabledProcessors;
+  UINTN               BspIndex;
+  EFI_EVENT           CheckAllAPsEvent;
+  EFI_EVENT           AllWaitEvent;
+  UINTN               FinishCount;
+  UINTN               StartCount;
+  EFI_AP_PROCEDURE    Procedure;
+  VOID                *ProcedureArgument;
+  BOOLEAN             SingleThread;
+  CPU_AP_DATA         *CpuData;
+  UINTN               *FailedList;
+  UINTN               FailedListIndex;
+  UINTN               AllTimeout;
+  UINTN               AllTimeTaken;
+  BOOLEAN             AllTimeoutActive;
+} CPU_MP_DATA;
+
+/** Secondary hart entry point.
+
+  Entered from the SBI implementation with the MMU off, a0 holding the hart ID
+  and a1 holding the processor index passed to hart_start.
+
+**/
+VOID
+ApEntryPoint (
+  VOID
+  );
+
+/** Enable the AP's S-level IMSIC interrupt file, with only one identity
+    enabled, and the supervisor external interrupt in sie, so that the identity
+    wakes the AP from wfi. Interrupts stay disabled in sstatus, so none is taken.
+
+    @param Id The identity, below 64.
+
+**/
+VOID
+ApImsicEnable (
+  IN UINTN  Id
+  );
+
+/** Disable the AP's S-level IMSIC interrupt file, and claim what is pending.
+
+**/
+VOID
+ApImsicDisable (
+  VOID
+  );
+
+/** Wait for an interrupt, and claim every identity that is pending in the AP's
+    S-level IMSIC interrupt file.
+
+**/
+VOID
+ApWaitForIpi (
+  VOID
+  );
+
+/** Flush the whole TLB of the hart.
+
+**/
+VOID
+ApLocalTlbFlushAll (
+  VOID
+  );
+
+/** C entry-point for the AP.
+    This function gets called from the assembly function ApEntryPoint.
+
+   @param ProcessorIndex The index of the processor that is starting.
+
+**/
+VOID
+ApProcedure (
+  IN UINTN  ProcessorIndex
+  );
+
+#endif /* MP_SERVICES_INTERNAL_H_ */
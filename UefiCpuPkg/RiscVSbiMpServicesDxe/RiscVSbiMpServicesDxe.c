@@ -0,0 +1,2197 @@
+/** @file
+  Construct MP Services Protocol on RISC-V using the SBI Hart State
+  Management (HSM) extension.
+
+  The harts other than the boot hart stay stopped in the SBI implementation
+  until a procedure is dispatched to them. Dispatching starts the hart with
+  the HSM hart_start call at ApEntryPoint, which switches to the page tables
+  of the BSP, runs the procedure on a per-hart stack and stops the hart again
+  with hart_stop. The BSP polls the per-hart state to find out when a
+  procedure has finished.
+
+  SBI calls trap through M-mode, on the receiving hart as well. An AP that has
+  an S-level IMSIC interrupt file therefore parks in a wfi loop once its first
+  procedure is finished, and is dispatched again, and has its TLB shot down,
+  with an MSI written straight to its interrupt file. The TLB shootdown
+  protocol is produced for CpuDxe to use in place of the SBI remote
+  sfence.vma. Parked APs are stopped with hart_stop at ExitBootServices, as
+  the OS expects to start them itself.
+
+  The Protocol is available only during boot time.
+
+  Copyright (c) 2022, Qualcomm Innovation Center, Inc. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+
+#include <Guid/FdtHob.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/BaseRiscVSbiLib.h>
+#include <Library/CpuExceptionHandlerLib.h>
+#include <Library/DebugLib.h>
+#include <Library/FdtLib.h>
+#include <Library/DxeServicesTableLib.h>
+#include <Library/HobLib.h>
+#include <Library/IoLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
+#include <Library/RiscVHartLocalLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+#include <Protocol/RiscVBootProtocol.h>
+#include <Protocol/RiscVTlbShootdown.h>
+#include <Register/RiscV64/RiscVEncoding.h>
+
+#include "MpServicesInternal.h"
+
+#define POLL_INTERVAL_US  50000
+
+STATIC CPU_MP_DATA       mCpuMpData;
+STATIC BOOLEAN           mNonBlockingModeAllowed;
+STATIC RISCV_HART_LOCAL  *mHartLocal;
+
+//
+// Set at ExitBootServices, after which APs stop rather than park.
+//
+STATIC volatile BOOLEAN  mApParkingDisabled;
+STATIC UINTN             mShootdownGeneration;
+
+//
+// The lowest hart ID of the APs, which bit 0 of an SBI hart mask stands for.
+//
+STATIC UINTN  mApHartMaskBase;
+
+//
+// Read by ApEntryPoint with the MMU off.
+//
+VOID   *gApStacksBase;
+UINTN  gApStackSize;
+UINTN  gSatp;
+
+/** Returns whether the specified processor is the BSP.
+
+  @param[in] ProcessorIndex The index the processor to check.
+
+  @return TRUE if the processor is the BSP, FALSE otherwise.
+**/
+STATIC
+BOOLEAN
+IsProcessorBSP (
+  UINTN  ProcessorIndex
+  )
+{
+  EFI_PROCESSOR_INFORMATION  *CpuInfo;
+
+  CpuInfo = &mCpuMpData.CpuData[ProcessorIndex].Info;
+
+  return (CpuInfo->StatusFlag & PROCESSOR_AS_BSP_BIT) != 0;
+}
+
+/** Returns whether the specified processor is enabled.
+
+   @param[in] ProcessorIndex The index of the processor to check.
+
+   @return TRUE if the processor is enabled, FALSE otherwise.
+**/
+STATIC
+BOOLEAN
+IsProcessorEnabled (
+  UINTN  ProcessorIndex
+  )
+{
+  EFI_PROCESSOR_INFORMATION  *CpuInfo;
+
+  CpuInfo = &mCpuMpData.CpuData[ProcessorIndex].Info;
+
+  return (CpuInfo->StatusFlag & PROCESSOR_ENABLED_BIT) != 0;
+}
+
+/** Returns the index of the processor executing this function.
+
+  S-mode software cannot read its own hart ID, so the index is taken from the
+  hart-local storage. Without it, an AP is recognised by the stack it runs on:
+  ApEntryPoint places each AP on its own slot of gApStacksBase. Anything else
+  is the BSP.
+
+  @return The index of the current processor.
+**/
+STATIC
+UINTN
+GetCurrentProcessorIndex (
+  VOID
+  )
+{
+  RISCV_HART_LOCAL  *HartLocal;
+  UINTN             StackAddress;
+  UINTN             StacksBase;
+
+  HartLocal = RiscVHartLocalGet ();
+  if (HartLocal != NULL) {
+    return HartLocal->ProcessorIndex;
+  }
+
+  StackAddress = (UINTN)&StackAddress;
+  StacksBase   = (UINTN)gApStacksBase;
+
+  if ((StackAddress >= StacksBase) &&
+      (StackAddress < StacksBase + mCpuMpData.NumberOfProcessors * gApStackSize))
+  {
+    return (StackAddress - StacksBase) / gApStackSize;
+  }
+
+  return mCpuMpData.BspIndex;
+}
+
+/** Returns whether the processor executing this function is the BSP.
+
+    @return Whether the current processor is the BSP.
+**/
+STATIC
+BOOLEAN
+IsCurrentProcessorBSP (
+  VOID
+  )
+{
+  return IsProcessorBSP (GetCurrentProcessorIndex ());
+}
+
+/** Waits for a hart to reach the HSM STOPPED state.
+
+    An AP marks its procedure finished before it calls hart_stop, so the BSP
+    can observe CpuStateFinished while the hart is still running.
+
+    @param HartId The hart to wait for.
+
+    @retval EFI_SUCCESS  The hart is stopped.
+    @retval EFI_TIMEOUT  The hart did not stop within HART_STOP_TIMEOUT_US.
+    @retval Others       The hart state could not be read.
+
+**/
+STATIC
+EFI_STATUS
+WaitForHartStopped (
+  IN UINTN  HartId
+  )
+{
+  EFI_STATUS  Status;
+  UINTN       HartState;
+  UINTN       Timeout;
+
+  for (Timeout = HART_STOP_TIMEOUT_US; ; Timeout--) {
+    Status = SbiHartGetStatus (HartId, &HartState);
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+
+    if (HartState == SBI_HSM_STATE_STOPPED) {
+      return EFI_SUCCESS;
+    }
+
+    if (Timeout == 0) {
+      return EFI_TIMEOUT;
+    }
+
+    gBS->Stall (1);
+  }
+}
+
+/** Wakes a parked AP with an MSI to its S-level interrupt file.
+
+    @param CpuData The AP.
+
+**/
+STATIC
+VOID
+SendIpi (
+  IN CPU_AP_DATA  *CpuData
+  )
+{
+  //
+  // The mailbox of the AP must be written before the MSI can wake it.
+  //
+  MemoryFence ();
+  MmioWrite32 ((UINTN)CpuData->ImsicFile + IMSIC_SETEIPNUM_LE, MP_IPI_ID);
+}
+
+/** Starts the specified hart using SBI HSM and executes the user-supplied
+    function that's been configured via a previous call to SetApProcedure.
+
+    A parked hart is woken with an MSI instead.
+
+    @param ProcessorIndex The index of the hart to start.
+
+    @retval EFI_SUCCESS      Success.
+    @retval EFI_NOT_READY    The hart is still running.
+    @retval EFI_DEVICE_ERROR The hart could not be started.
+
+**/
+STATIC
+EFI_STATUS
+DispatchCpu (
+  IN UINTN  ProcessorIndex
+  )
+{
+  EFI_STATUS   Status;
+  UINTN        HartId;
+  CPU_AP_DATA  *CpuData;
+
+  CpuData = &mCpuMpData.CpuData[ProcessorIndex];
+  HartId  = CpuData->Info.ProcessorId;
+
+  if (CpuData->Parked) {
+    CpuData->Parked = FALSE;
+    CpuData->State  = CpuStateBusy;
+    SendIpi (CpuData);
+    return EFI_SUCCESS;
+  }
+
+  Status = WaitForHartStopped (HartId);
+  if (EFI_ERROR (Status)) {
+    return EFI_NOT_READY;
+  }
+
+  CpuData->State = CpuStateBusy;
+  MemoryFence ();
+
+  Status = SbiHartStart (HartId, (UINTN)ApEntryPoint, ProcessorIndex);
+  if (Status == EFI_ALREADY_STARTED) {
+    Status = EFI_NOT_READY;
+  } else if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "%a: hart_start of hart %lu failed: %r\n", __func__, HartId, Status));
+    Status = EFI_DEVICE_ERROR;
+  }
+
+  return Status;
+}
+
+/** Get the Application Processors state.
+
+  @param[in]  CpuData    The pointer to CPU_AP_DATA of specified AP.
+
+  @return The AP status.
+**/
+STATIC
+CPU_STATE
+GetApState (
+  IN  CPU_AP_DATA  *CpuData
+  )
+{
+  return CpuData->State;
+}
+
+/** Configures the processor context with the user-supplied procedure and
+    argument.
+
+   @param CpuData           The processor context.
+   @param Procedure         The user-supplied procedure.
+   @param ProcedureArgument The user-supplied procedure argument.
+
+**/
+STATIC
+VOID
+SetApProcedure (
+  IN   CPU_AP_DATA       *CpuData,
+  IN   EFI_AP_PROCEDURE  Procedure,
+  IN   VOID              *ProcedureArgument
+  )
+{
+  ASSERT (CpuData != NULL);
+  ASSERT (Procedure != NULL);
+
+  CpuData->Parameter = ProcedureArgument;
+  CpuData->Procedure = Procedure;
+}
+
+/** Returns the index of the next processor that is blocked.
+
+   @param[out] NextNumber The index of the next blocked processor.
+
+   @retval EFI_SUCCESS   Successfully found the next blocked processor.
+   @retval EFI_NOT_FOUND There are no blocked processors.
+
+**/
+STATIC
+EFI_STATUS
+GetNextBlockedNumber (
+  OUT UINTN  *NextNumber
+  )
+{
+  UINTN        Index;
+  CPU_AP_DATA  *CpuData;
+
+  for (Index = 0; Index < mCpuMpData.NumberOfProcessors; Index++) {
+    CpuData = &mCpuMpData.CpuData[Index];
+    if (IsProcessorBSP (Index)) {
+      // Skip BSP
+      continue;
+    }
+
+    if (GetApState (CpuData) == CpuStateBlocked) {
+      *NextNumber = Index;
+      return EFI_SUCCESS;
+    }
+  }
+
+  return EFI_NOT_FOUND;
+}
+
+/** Stalls the BSP for the minimum of POLL_INTERVAL_US and Timeout.
+
+   @param[in]  Timeout    The time limit in microseconds remaining for
+                          APs to return from Procedure.
+
+   @retval     StallTime  Time of execution stall.
+**/
+STATIC
+UINTN
+CalculateAndStallInterval (
+  IN UINTN  Timeout
+  )
+{
+  UINTN  StallTime;
+
+  if ((Timeout < POLL_INTERVAL_US) && (Timeout != 0)) {
+    StallTime = Timeout;
+  } else {
+    StallTime = POLL_INTERVAL_US;
+  }
+
+  gBS->Stall (StallTime);
+
+  return StallTime;
+}
+
+/** Adds the specified processor the list of failed processors.
+
+   @param ProcessorIndex The processor index to add.
+   @param ApState        Processor state.
+
+**/
+STATIC
+VOID
+AddProcessorToFailedList (
+  UINTN      ProcessorIndex,
+  CPU_STATE  ApState
+  )
+{
+  UINTN    Index;
+  BOOLEAN  Found;
+
+  Found = FALSE;
+
+  if ((mCpuMpData.FailedList == NULL) ||
+      (ApState == CpuStateIdle) ||
+      (ApState == CpuStateFinished) ||
+      IsProcessorBSP (ProcessorIndex))
+  {
+    return;
+  }
+
+  // If we are retrying make sure we don't double count
+  for (Index = 0; Index < mCpuMpData.FailedListIndex; Index++) {
+    if (mCpuMpData.FailedList[Index] == ProcessorIndex) {
+      Found = TRUE;
+      break;
+    }
+  }
+
+  /* If the CPU isn't already in the FailedList, add it */
+  if (!Found) {
+    mCpuMpData.FailedList[mCpuMpData.FailedListIndex++] = ProcessorIndex;
+  }
+}
+
+/** Sets up the state for the StartupAllAPs function.
+
+   @param SingleThread Whether the APs will execute sequentially.
+
+**/
+STATIC
+VOID
+StartupAllAPsPrepareState (
+  IN BOOLEAN  SingleThread
+  )
+{
+  UINTN        Index;
+  CPU_STATE    APInitialState;
+  CPU_AP_DATA  *CpuData;
+
+  mCpuMpData.FinishCount  = 0;
+  mCpuMpData.StartCount   = 0;
+  mCpuMpData.SingleThread = SingleThread;
+
+  APInitialState = CpuStateReady;
+
+  for (Index = 0; Index < mCpuMpData.NumberOfProcessors; Index++) {
+    CpuData = &mCpuMpData.CpuData[Index];
+
+    //
+    // Get APs prepared, and put failing APs into FailedCpuList.
+    // If "SingleThread", only 1 AP will put into ready state, other AP will be
+    // put into ready state 1 by 1, until the previous 1 finished its task.
+    // If not "SingleThread", all APs are put into ready state from the
+    // beginning
+    //
+
+    if (IsProcessorBSP (Index)) {
+      // Skip BSP
+      continue;
+    }
+
+    if (!IsProcessorEnabled (Index)) {
+      // Skip Disabled processors
+      if (mCpuMpData.FailedList != NULL) {
+        mCpuMpData.FailedList[mCpuMpData.FailedListIndex++] = Index;
+      }
+
+      continue;
+    }
+
+    // If any APs finished after timing out, reset state to Idle
+    if (GetApState (CpuData) == CpuStateFinished) {
+      CpuData->State = CpuStateIdle;
+    }
+
+    if (GetApState (CpuData) != CpuStateIdle) {
+      // Skip busy processors
+      if (mCpuMpData.FailedList != NULL) {
+        mCpuMpData.FailedList[mCpuMpData.FailedListIndex++] = Index;
+      }
+
+      continue;
+    }
+
+    CpuData->State = APInitialState;
+
+    mCpuMpData.StartCount++;
+    if (SingleThread) {
+      APInitialState = CpuStateBlocked;
+    }
+  }
+}
+
+/** Handles execution of StartupAllAPs when a WaitEvent has been specified.
+
+  @param Procedure             The user-supplied procedure.
+  @param ProcedureArgument     The user-supplied procedure argument.
+  @param WaitEvent             The wait event to be signaled when the work is
+                               complete or a timeout has occurred.
+  @param TimeoutInMicroseconds The timeout for the work to be completed. Zero
+                               indicates an infinite timeout.
+  @param SingleThread          Whether the APs will execute sequentially.
+
+  @return EFI_SUCCESS on success.
+**/
+STATIC
+EFI_STATUS
+StartupAllAPsWithWaitEvent (
+  IN EFI_AP_PROCEDURE  Procedure,
+  IN VOID              *ProcedureArgument,
+  IN EFI_EVENT         WaitEvent,
+  IN UINTN             TimeoutInMicroseconds,
+  IN BOOLEAN           SingleThread
+  )
+{
+  EFI_STATUS   Status;
+  UINTN        Index;
+  CPU_AP_DATA  *CpuData;
+
+  Status = EFI_SUCCESS;
+
+  for (Index = 0; Index < mCpuMpData.NumberOfProcessors; Index++) {
+    CpuData = &mCpuMpData.CpuData[Index];
+    if (IsProcessorBSP (Index)) {
+      // Skip BSP
+      continue;
+    }
+
+    if (!IsProcessorEnabled (Index)) {
+      // Skip Disabled processors
+      continue;
+    }
+
+    if (GetApState (CpuData) == CpuStateReady) {
+      SetApProcedure (CpuData, Procedure, ProcedureArgument);
+      Status = DispatchCpu (Index);
+      if (EFI_ERROR (Status)) {
+        AddProcessorToFailedList (Index, CpuData->State);
+        CpuData->State = CpuStateIdle;
+        break;
+      }
+
+      if (SingleThread) {
+        break;
+      }
+    }
+  }
+
+  if (EFI_ERROR (Status)) {
+    return EFI_NOT_READY;
+  }
+
+  //
+  // Save data into private data structure, and create timer to poll AP state
+  // before exiting
+  //
+  mCpuMpData.Procedure         = Procedure;
+  mCpuMpData.ProcedureArgument = ProcedureArgument;
+  mCpuMpData.AllWaitEvent      = WaitEvent;
+  mCpuMpData.AllTimeout        = TimeoutInMicroseconds;
+  mCpuMpData.AllTimeTaken      = 0;
+  mCpuMpData.AllTimeoutActive  = (BOOLEAN)(TimeoutInMicroseconds != 0);
+  Status                       = gBS->SetTimer (
+                                        mCpuMpData.CheckAllAPsEvent,
+                                        TimerPeriodic,
+                                        POLL_INTERVAL_US
+                                        );
+
+  return Status;
+}
+
+/** Handles execution of StartupAllAPs when no wait event has been specified.
+
+  @param Procedure             The user-supplied procedure.
+  @param ProcedureArgument     The user-supplied procedure argument.
+  @param TimeoutInMicroseconds The timeout for the work to be completed. Zero
+                               indicates an infinite timeout.
+  @param SingleThread          Whether the APs will execute sequentially.
+  @param FailedCpuList         User-supplied pointer for list of failed CPUs.
+
+  @return EFI_SUCCESS on success.
+**/
+STATIC
+EFI_STATUS
+StartupAllAPsNoWaitEvent (
+  IN EFI_AP_PROCEDURE  Procedure,
+  IN VOID              *ProcedureArgument,
+  IN UINTN             TimeoutInMicroseconds,
+  IN BOOLEAN           SingleThread,
+  IN UINTN             **FailedCpuList
+  )
+{
+  EFI_STATUS   Status;
+  UINTN        Index;
+  UINTN        NextIndex;
+  UINTN        Timeout;
+  CPU_AP_DATA  *CpuData;
+  BOOLEAN      DispatchError;
+
+  Timeout       = TimeoutInMicroseconds;
+  DispatchError = FALSE;
+
+  while (TRUE) {
+    for (Index = 0; Index < mCpuMpData.NumberOfProcessors; Index++) {
+      CpuData = &mCpuMpData.CpuData[Index];
+      if (IsProcessorBSP (Index)) {
+        // Skip BSP
+        continue;
+      }
+
+      if (!IsProcessorEnabled (Index)) {
+        // Skip Disabled processors
+        continue;
+      }
+
+      switch (GetApState (CpuData)) {
+        case CpuStateReady:
+          SetApProcedure (CpuData, Procedure, ProcedureArgument);
+          Status = DispatchCpu (Index);
+          if (EFI_ERROR (Status)) {
+            AddProcessorToFailedList (Index, CpuData->State);
+            CpuData->State = CpuStateIdle;
+            mCpuMpData.StartCount--;
+            DispatchError = TRUE;
+
+            if (SingleThread) {
+              // Dispatch the next available AP
+              Status = GetNextBlockedNumber (&NextIndex);
+              if (!EFI_ERROR (Status)) {
+                mCpuMpData.CpuData[NextIndex].State = CpuStateReady;
+              }
+            }
+          }
+
+          break;
+
+        case CpuStateFinished:
+          mCpuMpData.FinishCount++;
+          if (SingleThread) {
+            Status = GetNextBlockedNumber (&NextIndex);
+            if (!EFI_ERROR (Status)) {
+              mCpuMpData.CpuData[NextIndex].State = CpuStateReady;
+            }
+          }
+
+          CpuData->State = CpuStateIdle;
+          break;
+
+        default:
+          break;
+      }
+    }
+
+    if (mCpuMpData.FinishCount == mCpuMpData.StartCount) {
+      Status = EFI_SUCCESS;
+      break;
+    }
+
+    if ((TimeoutInMicroseconds != 0) && (Timeout == 0)) {
+      Status = EFI_TIMEOUT;
+      break;
+    }
+
+    Timeout -= CalculateAndStallInterval (Timeout);
+  }
+
+  if (Status == EFI_TIMEOUT) {
+    // Add any remaining CPUs to the FailedCpuList
+    if (FailedCpuList != NULL) {
+      for (Index = 0; Index < mCpuMpData.NumberOfProcessors; Index++) {
+        AddProcessorToFailedList (Index, mCpuMpData.CpuData[Index].State);
+      }
+    }
+  }
+
+  if (DispatchError) {
+    Status = EFI_NOT_READY;
+  }
+
+  return Status;
+}
+
+/**
+  This service retrieves the number of logical processor in the platform
+  and the number of those logical processors that are enabled on this boot.
+  This service may only be called from the BSP.
+
+  @param[in]  This                        A pointer to the
+                                          EFI_MP_SERVICES_PROTOCOL instance.
+  @param[out] NumberOfProcessors          Pointer to the total number of logical
+                                          processors in the system, including
+                                          the BSP and disabled APs.
+  @param[out] NumberOfEnabledProcessors   Pointer to the number of enabled
+                                          logical processors that exist in the
+                                          system, including the BSP.
+
+  @retval EFI_SUCCESS             The number of logical processors and enabled
+                                  logical processors was retrieved.
+  @retval EFI_DEVICE_ERROR        The calling processor is an AP.
+  @retval EFI_INVALID_PARAMETER   NumberOfProcessors is NULL.
+  @retval EFI_INVALID_PARAMETER   NumberOfEnabledProcessors is NULL.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+GetNumberOfProcessors (
+  IN  EFI_MP_SERVICES_PROTOCOL  *This,
+  OUT UINTN                     *NumberOfProcessors,
+  OUT UINTN                     *NumberOfEnabledProcessors
+  )
+{
+  if ((NumberOfProcessors == NULL) || (NumberOfEnabledProcessors == NULL)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (!IsCurrentProcessorBSP ()) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  *NumberOfProcessors        = mCpuMpData.NumberOfProcessors;
+  *NumberOfEnabledProcessors = mCpuMpData.NumberOfEnabledProcessors;
+  return EFI_SUCCESS;
+}
+
+/**
+  Gets detailed MP-related information on the requested processor at the
+  instant this call is made. This service may only be called from the BSP.
+
+  The ProcessorId of a RISC-V processor is its hart ID.
+
+  @param[in]  This                  A pointer to the EFI_MP_SERVICES_PROTOCOL
+                                    instance.
+  @param[in]  ProcessorIndex        The index of the processor.
+  @param[out] ProcessorInfoBuffer   A pointer to the buffer where information
+                                    for the requested processor is deposited.
+
+  @retval EFI_SUCCESS             Processor information was returned.
+  @retval EFI_DEVICE_ERROR        The calling processor is an AP.
+  @retval EFI_INVALID_PARAMETER   ProcessorInfoBuffer is NULL.
+  @retval EFI_NOT_FOUND           The processor with the handle specified by
+                                  ProcessorNumber does not exist in the platform.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+GetProcessorInfo (
+  IN  EFI_MP_SERVICES_PROTOCOL   *This,
+  IN  UINTN                      ProcessorIndex,
+  OUT EFI_PROCESSOR_INFORMATION  *ProcessorInfoBuffer
+  )
+{
+  if (ProcessorInfoBuffer == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (!IsCurrentProcessorBSP ()) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  ProcessorIndex &= ~CPU_V2_EXTENDED_TOPOLOGY;
+
+  if (ProcessorIndex >= mCpuMpData.NumberOfProcessors) {
+    return EFI_NOT_FOUND;
+  }
+
+  CopyMem (
+    ProcessorInfoBuffer,
+    &mCpuMpData.CpuData[ProcessorIndex].Info,
+    sizeof (EFI_PROCESSOR_INFORMATION)
+    );
+  return EFI_SUCCESS;
+}
+
+/**
+  This service executes a caller provided function on all enabled APs. APs can
+  run either simultaneously or one at a time in sequence. This service supports
+  both blocking and non-blocking requests. The non-blocking requests use EFI
+  events so the BSP can detect when the APs have finished. This service may only
+  be called from the BSP.
+
+  An AP cannot be stopped from another hart with SBI HSM, so an AP whose
+  procedure times out keeps running it; it is reported in FailedCpuList and
+  stays busy until the procedure returns.
+
+  @param[in]  This                    A pointer to the EFI_MP_SERVICES_PROTOCOL
+                                      instance.
+  @param[in]  Procedure               A pointer to the function to be run on
+                                      enabled APs of the system.
+  @param[in]  SingleThread            If TRUE, then all the enabled APs execute
+                                      the function specified by Procedure one by
+                                      one, in ascending order of processor
+                                      handle number. If FALSE, then all the
+                                      enabled APs execute the function specified
+                                      by Procedure simultaneously.
+  @param[in]  WaitEvent               The event created by the caller with
+                                      CreateEvent() service. If it is NULL,
+                                      then execute in blocking mode. Otherwise
+                                      it is signaled when all APs return from
+                                      Procedure or TimeoutInMicroseconds
+                                      expires.
+  @param[in]  TimeoutInMicroseconds   Indicates the time limit in microseconds
+                                      for APs to return from Procedure, either
+                                      for blocking or non-blocking mode. Zero
+                                      means infinity.
+  @param[in]  ProcedureArgument       The parameter passed into Procedure for
+                                      all APs.
+  @param[out] FailedCpuList           If NULL, this parameter is ignored.
+                                      Otherwise, if all APs finish successfully,
+                                      then its content is set to NULL. If not
+                                      all APs finish before timeout expires,
+                                      then its content is set to address of the
+                                      buffer holding handle numbers of the
+                                      failed APs, terminated by END_OF_CPU_LIST.
+                                      The caller frees the buffer with
+                                      FreePool().
+
+  @retval EFI_SUCCESS             In blocking mode, all APs have finished before
+                                  the timeout expired.
+  @retval EFI_SUCCESS             In non-blocking mode, function has been
+                                  dispatched to all enabled APs.
+  @retval EFI_UNSUPPORTED         A non-blocking mode request was made after the
+                                  UEFI event EFI_EVENT_GROUP_READY_TO_BOOT was
+                                  signaled.
+  @retval EFI_DEVICE_ERROR        Caller processor is AP.
+  @retval EFI_NOT_STARTED         No enabled APs exist in the system.
+  @retval EFI_NOT_READY           Any enabled APs are busy.
+  @retval EFI_TIMEOUT             In blocking mode, the timeout expired before
+                                  all enabled APs have finished.
+  @retval EFI_INVALID_PARAMETER   Procedure is NULL.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+StartupAllAPs (
+  IN  EFI_MP_SERVICES_PROTOCOL  *This,
+  IN  EFI_AP_PROCEDURE          Procedure,
+  IN  BOOLEAN                   SingleThread,
+  IN  EFI_EVENT                 WaitEvent               OPTIONAL,
+  IN  UINTN                     TimeoutInMicroseconds,
+  IN  VOID                      *ProcedureArgument      OPTIONAL,
+  OUT UINTN                     **FailedCpuList         OPTIONAL
+  )
+{
+  EFI_STATUS  Status;
+  UINTN       Index;
+
+  if (!IsCurrentProcessorBSP ()) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  if ((mCpuMpData.NumberOfProcessors == 1) || (mCpuMpData.NumberOfEnabledProcessors == 1)) {
+    return EFI_NOT_STARTED;
+  }
+
+  if (Procedure == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if ((WaitEvent != NULL) && !mNonBlockingModeAllowed) {
+    return EFI_UNSUPPORTED;
+  }
+
+  mCpuMpData.FailedList = NULL;
+  if (FailedCpuList != NULL) {
+    mCpuMpData.FailedList = AllocateZeroPool (
+                              (mCpuMpData.NumberOfProcessors + 1) *
+                              sizeof (UINTN)
+                              );
+    if (mCpuMpData.FailedList == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    SetMemN (
+      mCpuMpData.FailedList,
+      (mCpuMpData.NumberOfProcessors + 1) *
+      sizeof (UINTN),
+      END_OF_CPU_LIST
+      );
+    mCpuMpData.FailedListIndex = 0;
+    *FailedCpuList             = mCpuMpData.FailedList;
+  }
+
+  StartupAllAPsPrepareState (SingleThread);
+
+  // If any enabled APs are busy (ignoring the BSP), return EFI_NOT_READY
+  if (mCpuMpData.StartCount != (mCpuMpData.NumberOfEnabledProcessors - 1)) {
+    // Nothing was dispatched, release the APs that were prepared
+    for (Index = 0; Index < mCpuMpData.NumberOfProcessors; Index++) {
+      if ((GetApState (&mCpuMpData.CpuData[Index]) == CpuStateReady) ||
+          (GetApState (&mCpuMpData.CpuData[Index]) == CpuStateBlocked))
+      {
+        mCpuMpData.CpuData[Index].State = CpuStateIdle;
+      }
+    }
+
+    Status = EFI_NOT_READY;
+  } else if (WaitEvent != NULL) {
+    Status = StartupAllAPsWithWaitEvent (
+               Procedure,
+               ProcedureArgument,
+               WaitEvent,
+               TimeoutInMicroseconds,
+               SingleThread
+               );
+  } else {
+    Status = StartupAllAPsNoWaitEvent (
+               Procedure,
+               ProcedureArgument,
+               TimeoutInMicroseconds,
+               SingleThread,
+               FailedCpuList
+               );
+  }
+
+  //
+  // In non-blocking mode the list is completed by CheckAllAPsStatus, so it
+  // can only be released here if nothing was dispatched.
+  //
+  if ((FailedCpuList != NULL) &&
+      ((WaitEvent == NULL) || EFI_ERROR (Status)) &&
+      (mCpuMpData.FailedListIndex == 0))
+  {
+    FreePool (*FailedCpuList);
+    *FailedCpuList        = NULL;
+    mCpuMpData.FailedList = NULL;
+  }
+
+  return Status;
+}
+
+/**
+  This service lets the caller get one enabled AP to execute a caller-provided
+  function. The caller can request the BSP to either wait for the completion
+  of the AP or just proceed with the next task by using the EFI event mechanism.
+  See EFI_MP_SERVICES_PROTOCOL.StartupAllAPs() for more details on non-blocking
+  execution support. This service may only be called from the BSP.
+
+  @param[in]  This                    A pointer to the EFI_MP_SERVICES_PROTOCOL
+                                      instance.
+  @param[in]  Procedure               A pointer to the function to be run on
+                                      the AP.
+  @param[in]  ProcessorNumber         The handle number of the AP.
+  @param[in]  WaitEvent               The event created by the caller with
+                                      CreateEvent() service. If it is NULL,
+                                      then execute in blocking mode. Otherwise
+                                      it is signaled when the AP returns from
+                                      Procedure or TimeoutInMicroseconds
+                                      expires.
+  @param[in]  TimeoutInMicroseconds   Indicates the time limit in microseconds
+                                      for the AP to return from Procedure.
+                                      Zero means infinity.
+  @param[in]  ProcedureArgument       The parameter passed into Procedure.
+  @param[out] Finished                If NULL, this parameter is ignored. In
+                                      non-blocking mode, it is set to TRUE when
+                                      the AP returns from Procedure before the
+                                      timeout expires.
+
+  @retval EFI_SUCCESS             In blocking mode, specified AP finished before
+                                  the timeout expires.
+  @retval EFI_SUCCESS             In non-blocking mode, the function has been
+                                  dispatched to specified AP.
+  @retval EFI_UNSUPPORTED         A non-blocking mode request was made after the
+                                  UEFI event EFI_EVENT_GROUP_READY_TO_BOOT was
+                                  signaled.
+  @retval EFI_DEVICE_ERROR        The calling processor is an AP.
+  @retval EFI_TIMEOUT             In blocking mode, the timeout expired before
+                                  the specified AP has finished.
+  @retval EFI_NOT_READY           The specified AP is busy.
+  @retval EFI_NOT_FOUND           The processor with the handle specified by
+                                  ProcessorNumber does not exist.
+  @retval EFI_INVALID_PARAMETER   ProcessorNumber specifies the BSP or disabled AP.
+  @retval EFI_INVALID_PARAMETER   Procedure is NULL.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+StartupThisAP (
+  IN  EFI_MP_SERVICES_PROTOCOL  *This,
+  IN  EFI_AP_PROCEDURE          Procedure,
+  IN  UINTN                     ProcessorNumber,
+  IN  EFI_EVENT                 WaitEvent               OPTIONAL,
+  IN  UINTN                     TimeoutInMicroseconds,
+  IN  VOID                      *ProcedureArgument      OPTIONAL,
+  OUT BOOLEAN                   *Finished               OPTIONAL
+  )
+{
+  EFI_STATUS   Status;
+  UINTN        Timeout;
+  CPU_AP_DATA  *CpuData;
+
+  if (!IsCurrentProcessorBSP ()) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  if (Procedure == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (ProcessorNumber >= mCpuMpData.NumberOfProcessors) {
+    return EFI_NOT_FOUND;
+  }
+
+  CpuData = &mCpuMpData.CpuData[ProcessorNumber];
+
+  if (IsProcessorBSP (ProcessorNumber)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (!IsProcessorEnabled (ProcessorNumber)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if ((GetApState (CpuData) != CpuStateIdle) &&
+      (GetApState (CpuData) != CpuStateFinished))
+  {
+    return EFI_NOT_READY;
+  }
+
+  if ((WaitEvent != NULL) && !mNonBlockingModeAllowed) {
+    return EFI_UNSUPPORTED;
+  }
+
+  Timeout = TimeoutInMicroseconds;
+
+  CpuData->Timeout          = TimeoutInMicroseconds;
+  CpuData->TimeTaken        = 0;
+  CpuData->TimeoutActive    = (BOOLEAN)(TimeoutInMicroseconds != 0);
+  CpuData->SingleApFinished = NULL;
+
+  SetApProcedure (
+    CpuData,
+    Procedure,
+    ProcedureArgument
+    );
+
+  Status = DispatchCpu (ProcessorNumber);
+  if (EFI_ERROR (Status)) {
+    CpuData->State = CpuStateIdle;
+    return EFI_NOT_READY;
+  }
+
+  if (WaitEvent != NULL) {
+    // Non Blocking
+    if (Finished != NULL) {
+      CpuData->SingleApFinished = Finished;
+      *Finished                 = FALSE;
+    }
+
+    CpuData->WaitEvent = WaitEvent;
+    return gBS->SetTimer (
+                  CpuData->CheckThisAPEvent,
+                  TimerPeriodic,
+                  POLL_INTERVAL_US
+                  );
+  }
+
+  // Blocking
+  while (TRUE) {
+    if (GetApState (CpuData) == CpuStateFinished) {
+      CpuData->State = CpuStateIdle;
+      break;
+    }
+
+    if ((TimeoutInMicroseconds != 0) && (Timeout == 0)) {
+      return EFI_TIMEOUT;
+    }
+
+    Timeout -= CalculateAndStallInterval (Timeout);
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  This service switches the requested AP to be the BSP from that point onward.
+  Switching the BSP is not supported.
+
+  @param[in] This              A pointer to the EFI_MP_SERVICES_PROTOCOL instance.
+  @param[in] ProcessorNumber   The handle number of AP that is to become the new
+                               BSP.
+  @param[in] EnableOldBSP      If TRUE, then the old BSP will be listed as an
+                               enabled AP. Otherwise, it will be disabled.
+
+  @retval EFI_UNSUPPORTED         Switching the BSP is not supported.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+SwitchBSP (
+  IN EFI_MP_SERVICES_PROTOCOL  *This,
+  IN  UINTN                    ProcessorNumber,
+  IN  BOOLEAN                  EnableOldBSP
+  )
+{
+  return EFI_UNSUPPORTED;
+}
+
+/**
+  This service lets the caller enable or disable an AP from this point onward.
+  This service may only be called from the BSP.
+
+  @param[in] This              A pointer to the EFI_MP_SERVICES_PROTOCOL instance.
+  @param[in] ProcessorNumber   The handle number of the AP.
+  @param[in] EnableAP          Specifies the new state for the processor for
+                               enabled, FALSE for disabled.
+  @param[in] HealthFlag        If not NULL, a pointer to a value that specifies
+                               the new health status of the AP. Only the
+                               PROCESSOR_HEALTH_STATUS_BIT is used.
+
+  @retval EFI_SUCCESS             The specified AP was enabled or disabled successfully.
+  @retval EFI_UNSUPPORTED         The AP is busy.
+  @retval EFI_DEVICE_ERROR        The calling processor is an AP.
+  @retval EFI_NOT_FOUND           Processor with the handle specified by ProcessorNumber
+                                  does not exist.
+  @retval EFI_INVALID_PARAMETER   ProcessorNumber specifies the BSP.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+EnableDisableAP (
+  IN  EFI_MP_SERVICES_PROTOCOL  *This,
+  IN  UINTN                     ProcessorNumber,
+  IN  BOOLEAN                   EnableAP,
+  IN  UINT32                    *HealthFlag OPTIONAL
+  )
+{
+  UINTN        StatusFlag;
+  CPU_AP_DATA  *CpuData;
+
+  if (!IsCurrentProcessorBSP ()) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  if (ProcessorNumber >= mCpuMpData.NumberOfProcessors) {
+    return EFI_NOT_FOUND;
+  }
+
+  if (IsProcessorBSP (ProcessorNumber)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  CpuData    = &mCpuMpData.CpuData[ProcessorNumber];
+  StatusFlag = CpuData->Info.StatusFlag;
+
+  if ((GetApState (CpuData) != CpuStateIdle) &&
+      (GetApState (CpuData) != CpuStateFinished))
+  {
+    return EFI_UNSUPPORTED;
+  }
+
+  if (EnableAP) {
+    if (!IsProcessorEnabled (ProcessorNumber)) {
+      mCpuMpData.NumberOfEnabledProcessors++;
+    }
+
+    StatusFlag |= PROCESSOR_ENABLED_BIT;
+  } else {
+    if (IsProcessorEnabled (ProcessorNumber)) {
+      mCpuMpData.NumberOfEnabledProcessors--;
+    }
+
+    StatusFlag &= ~PROCESSOR_ENABLED_BIT;
+  }
+
+  if (HealthFlag != NULL) {
+    StatusFlag &= ~PROCESSOR_HEALTH_STATUS_BIT;
+    StatusFlag |= (*HealthFlag & PROCESSOR_HEALTH_STATUS_BIT);
+  }
+
+  CpuData->Info.StatusFlag = (UINT32)StatusFlag;
+  return EFI_SUCCESS;
+}
+
+/**
+  This return the handle number for the calling processor. This service may be
+  called from the BSP and APs.
+
+  @param[in] This              A pointer to the EFI_MP_SERVICES_PROTOCOL instance.
+  @param[out] ProcessorNumber  The handle number of the calling processor.
+
+  @retval EFI_SUCCESS             The current processor handle number was returned
+                                  in ProcessorNumber.
+  @retval EFI_INVALID_PARAMETER   ProcessorNumber is NULL.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+WhoAmI (
+  IN EFI_MP_SERVICES_PROTOCOL  *This,
+  OUT UINTN                    *ProcessorNumber
+  )
+{
+  if (ProcessorNumber == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  *ProcessorNumber = GetCurrentProcessorIndex ();
+  return EFI_SUCCESS;
+}
+
+STATIC EFI_MP_SERVICES_PROTOCOL  mMpServicesProtocol = {
+  GetNumberOfProcessors,
+  GetProcessorInfo,
+  StartupAllAPs,
+  StartupThisAP,
+  SwitchBSP,
+  EnableDisableAP,
+  WhoAmI
+};
+
+/**
+  Flush the translations of a range on every hart but the boot hart, and
+  return once they are flushed.
+
+  Parked APs are sent an MSI and acknowledge the flush. The APs that may be
+  running firmware code are flushed with one SBI remote sfence.vma. An idle AP
+  that isn't parked is stopped in the SBI implementation, and flushes its TLB
+  when it is started.
+
+  @param[in]  This          The protocol instance.
+  @param[in]  StartAddress  The start of the range.
+  @param[in]  Size          The size of the range, or 0 with a StartAddress of 0
+                            for all addresses.
+
+  @retval  EFI_SUCCESS       The translations are flushed.
+  @retval  EFI_DEVICE_ERROR  The SBI implementation failed to flush some harts.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+TlbShootdown (
+  IN RISCV_TLB_SHOOTDOWN_PROTOCOL  *This,
+  IN UINT64                        StartAddress,
+  IN UINT64                        Size
+  )
+{
+  EFI_STATUS   Status;
+  UINTN        Index;
+  CPU_AP_DATA  *CpuData;
+  UINTN        HartOffset;
+  UINTN        HartMask;
+  UINTN        HartMaskBase;
+  BOOLEAN      RemoteFence;
+
+  mShootdownGeneration++;
+  HartMask     = 0;
+  HartMaskBase = mApHartMaskBase;
+  RemoteFence  = FALSE;
+
+  //
+  // Only the BSP clears Parked, so a parked AP stays parked until it acknowledges.
+  // An AP that parks after it is read isn't idle, and is flushed through SBI.
+  //
+  for (Index = 0; Index < mCpuMpData.NumberOfProcessors; Index++) {
+    if (IsProcessorBSP (Index)) {
+      continue;
+    }
+
+    CpuData = &mCpuMpData.CpuData[Index];
+    if (CpuData->Parked) {
+      CpuData->ShootdownRequest = mShootdownGeneration;
+      SendIpi (CpuData);
+      continue;
+    }
+
+    if (IsProcessorEnabled (Index) && (GetApState (CpuData) == CpuStateIdle)) {
+      continue;
+    }
+
+    RemoteFence = TRUE;
+    HartOffset  = (UINTN)CpuData->Info.ProcessorId - mApHartMaskBase;
+    if (HartOffset >= sizeof (UINTN) * 8) {
+      HartMaskBase = SBI_HART_MASK_BASE_ALL;
+    } else {
+      HartMask |= LShiftU64 (1, HartOffset);
+    }
+  }
+
+  Status = EFI_SUCCESS;
+  if (RemoteFence) {
+    if (HartMaskBase == SBI_HART_MASK_BASE_ALL) {
+      HartMask = 0;
+    }
+
+    Status = SbiRemoteSfenceVma (HartMask, HartMaskBase, (UINTN)StartAddress, (UINTN)Size);
+    if (EFI_ERROR (Status)) {
+      Status = EFI_DEVICE_ERROR;
+    }
+  }
+
+  for (Index = 0; Index < mCpuMpData.NumberOfProcessors; Index++) {
+    CpuData = &mCpuMpData.CpuData[Index];
+    if (CpuData->ShootdownRequest != mShootdownGeneration) {
+      continue;
+    }
+
+    while (CpuData->ShootdownDone != mShootdownGeneration) {
+      CpuPause ();
+    }
+  }
+
+  return Status;
+}
+
+STATIC RISCV_TLB_SHOOTDOWN_PROTOCOL  mTlbShootdownProtocol = {
+  RISCV_TLB_SHOOTDOWN_PROTOCOL_REVISION,
+  TlbShootdown
+};
+
+/** Handles the StartupAllAPs case where the timeout has occurred.
+
+**/
+STATIC
+VOID
+ProcessStartupAllAPsTimeout (
+  VOID
+  )
+{
+  UINTN  Index;
+
+  if (mCpuMpData.FailedList == NULL) {
+    return;
+  }
+
+  for (Index = 0; Index < mCpuMpData.NumberOfProcessors; Index++) {
+    if (IsProcessorBSP (Index)) {
+      // Skip BSP
+      continue;
+    }
+
+    if (!IsProcessorEnabled (Index)) {
+      // Skip Disabled processors
+      continue;
+    }
+
+    AddProcessorToFailedList (Index, GetApState (&mCpuMpData.CpuData[Index]));
+  }
+}
+
+/** Updates the status of the APs.
+
+   @param[in] ProcessorIndex The index of the AP to update.
+**/
+STATIC
+VOID
+UpdateApStatus (
+  IN UINTN  ProcessorIndex
+  )
+{
+  EFI_STATUS   Status;
+  CPU_AP_DATA  *CpuData;
+  CPU_AP_DATA  *NextCpuData;
+  UINTN        NextNumber;
+
+  CpuData = &mCpuMpData.CpuData[ProcessorIndex];
+
+  if (IsProcessorBSP (ProcessorIndex)) {
+    // Skip BSP
+    return;
+  }
+
+  if (!IsProcessorEnabled (ProcessorIndex)) {
+    // Skip Disabled processors
+    return;
+  }
+
+  if (GetApState (CpuData) != CpuStateFinished) {
+    return;
+  }
+
+  //
+  // Hand the procedure to the next blocked AP, skipping any that cannot be
+  // started so the remaining ones still run.
+  //
+  while (mCpuMpData.SingleThread && !EFI_ERROR (GetNextBlockedNumber (&NextNumber))) {
+    NextCpuData = &mCpuMpData.CpuData[NextNumber];
+
+    NextCpuData->State = CpuStateReady;
+
+    SetApProcedure (
+      NextCpuData,
+      mCpuMpData.Procedure,
+      mCpuMpData.ProcedureArgument
+      );
+
+    Status = DispatchCpu (NextNumber);
+    if (!EFI_ERROR (Status)) {
+      break;
+    }
+
+    AddProcessorToFailedList (NextNumber, NextCpuData->State);
+    NextCpuData->State = CpuStateIdle;
+    mCpuMpData.StartCount--;
+  }
+
+  CpuData->State = CpuStateIdle;
+  mCpuMpData.FinishCount++;
+}
+
+/**
+  If a WaitEvent is specified in StartupAllAPs(), a timer is set, which invokes
+  this procedure periodically to check whether all APs have finished.
+
+  @param[in] Event   The event supplied by the timer expiration.
+  @param[in] Context The event context.
+**/
+STATIC
+VOID
+EFIAPI
+CheckAllAPsStatus (
+  IN  EFI_EVENT  Event,
+  IN  VOID       *Context
+  )
+{
+  EFI_STATUS  Status;
+  UINTN       Index;
+
+  mCpuMpData.AllTimeTaken += POLL_INTERVAL_US;
+
+  for (Index = 0; Index < mCpuMpData.NumberOfProcessors; Index++) {
+    UpdateApStatus (Index);
+  }
+
+  if (mCpuMpData.AllTimeoutActive && (mCpuMpData.AllTimeTaken > mCpuMpData.AllTimeout)) {
+    ProcessStartupAllAPsTimeout ();
+
+    // Force terminal exit
+    mCpuMpData.FinishCount = mCpuMpData.StartCount;
+  }
+
+  if (mCpuMpData.FinishCount != mCpuMpData.StartCount) {
+    return;
+  }
+
+  gBS->SetTimer (
+         mCpuMpData.CheckAllAPsEvent,
+         TimerCancel,
+         0
+         );
+
+  Status = gBS->SignalEvent (mCpuMpData.AllWaitEvent);
+  ASSERT_EFI_ERROR (Status);
+  mCpuMpData.AllWaitEvent = NULL;
+}
+
+/** Invoked periodically via a timer to check the state of the processor.
+
+   @param Event   The event supplied by the timer expiration.
+   @param Context The processor context.
+
+**/
+STATIC
+VOID
+EFIAPI
+CheckThisAPStatus (
+  IN  EFI_EVENT  Event,
+  IN  VOID       *Context
+  )
+{
+  EFI_STATUS   Status;
+  CPU_AP_DATA  *CpuData;
+
+  CpuData = Context;
+
+  CpuData->TimeTaken += POLL_INTERVAL_US;
+
+  if (GetApState (CpuData) == CpuStateFinished) {
+    Status = gBS->SetTimer (CpuData->CheckThisAPEvent, TimerCancel, 0);
+    ASSERT_EFI_ERROR (Status);
+
+    if (CpuData->SingleApFinished != NULL) {
+      *(CpuData->SingleApFinished) = TRUE;
+    }
+
+    if (CpuData->WaitEvent != NULL) {
+      Status = gBS->SignalEvent (CpuData->WaitEvent);
+      ASSERT_EFI_ERROR (Status);
+      CpuData->WaitEvent = NULL;
+    }
+
+    CpuData->State = CpuStateIdle;
+    return;
+  }
+
+  if (CpuData->TimeoutActive && (CpuData->TimeTaken > CpuData->Timeout)) {
+    Status = gBS->SetTimer (CpuData->CheckThisAPEvent, TimerCancel, 0);
+    if (CpuData->WaitEvent != NULL) {
+      Status = gBS->SignalEvent (CpuData->WaitEvent);
+      ASSERT_EFI_ERROR (Status);
+      CpuData->WaitEvent = NULL;
+    }
+  }
+}
+
+/**
+  Fills in the MP related data of a processor.
+
+  @param BSP            TRUE if the processor is the BSP.
+  @param HartId         The hart ID of the processor.
+  @param ProcessorIndex The index of the processor.
+
+**/
+STATIC
+VOID
+FillInProcessorInformation (
+  IN BOOLEAN  BSP,
+  IN UINTN    HartId,
+  IN UINTN    ProcessorIndex
+  )
+{
+  EFI_PROCESSOR_INFORMATION  *CpuInfo;
+
+  CpuInfo = &mCpuMpData.CpuData[ProcessorIndex].Info;
+
+  //
+  // Harts are not grouped into packages or cores here, the FDT cpu-map is
+  // not consulted.
+  //
+  CpuInfo->ProcessorId     = HartId;
+  CpuInfo->StatusFlag      = PROCESSOR_ENABLED_BIT | PROCESSOR_HEALTH_STATUS_BIT;
+  CpuInfo->Location.Core   = (UINT32)HartId;
+  CpuInfo->Location.Thread = 0;
+
+  CpuInfo->ExtendedInformation.Location2.Core = (UINT32)HartId;
+
+  if (BSP) {
+    CpuInfo->StatusFlag |= PROCESSOR_AS_BSP_BIT;
+  }
+
+  mCpuMpData.CpuData[ProcessorIndex].State = BSP ? CpuStateBusy : CpuStateIdle;
+
+  mCpuMpData.CpuData[ProcessorIndex].Procedure = NULL;
+  mCpuMpData.CpuData[ProcessorIndex].Parameter = NULL;
+}
+
+/** AP exception handler.
+
+  Registered in this driver's own copy of the exception handler tables, which
+  only the APs use: the BSP traps into CpuDxe.
+
+  @param InterruptType The RISC-V exception type.
+  @param SystemContext System context.
+
+**/
+STATIC
+VOID
+EFIAPI
+ApExceptionHandler (
+  IN CONST EFI_EXCEPTION_TYPE  InterruptType,
+  IN CONST EFI_SYSTEM_CONTEXT  SystemContext
+  )
+{
+  UINTN  ProcessorIndex;
+
+  ProcessorIndex = GetCurrentProcessorIndex ();
+
+  DEBUG ((
+    DEBUG_ERROR,
+    "%a: exception %lu on hart %lu, stopping it\n",
+    __func__,
+    InterruptType,
+    mCpuMpData.CpuData[ProcessorIndex].Info.ProcessorId
+    ));
+
+  mCpuMpData.CpuData[ProcessorIndex].State = CpuStateFinished;
+  MemoryFence ();
+
+  SbiHartStop ();
+
+  /* Should never be reached */
+  ASSERT (FALSE);
+  CpuDeadLoop ();
+}
+
+/**
+  Event notification function called when the EFI_EVENT_GROUP_READY_TO_BOOT is
+  signaled. After this point, non-blocking mode is no longer allowed.
+
+  @param  Event     Event whose notification function is being invoked.
+  @param  Context   The pointer to the notification function's context,
+                    which is implementation-dependent.
+
+**/
+STATIC
+VOID
+EFIAPI
+ReadyToBootSignaled (
+  IN  EFI_EVENT  Event,
+  IN  VOID       *Context
+  )
+{
+  mNonBlockingModeAllowed = FALSE;
+}
+
+/** Initializes the MP Services system data
+
+   @param NumberOfProcessors The number of processors, both BSP and AP.
+   @param HartIds            The hart ID of each processor.
+   @param BootHartId         The hart ID of the BSP.
+
+   @retval EFI_SUCCESS           The data was initialized.
+   @retval EFI_OUT_OF_RESOURCES  Memory could not be allocated.
+
+**/
+STATIC
+EFI_STATUS
+MpServicesInitialize (
+  IN UINTN        NumberOfProcessors,
+  IN CONST UINTN  *HartIds,
+  IN UINTN        BootHartId
+  )
+{
+  EFI_STATUS          Status;
+  UINTN               Index;
+  UINTN               HartState;
+  EFI_EVENT           ReadyToBootEvent;
+  EFI_EXCEPTION_TYPE  ExceptionType;
+
+  //
+  // Clear the data structure area first.
+  //
+  ZeroMem (&mCpuMpData, sizeof (CPU_MP_DATA));
+  //
+  // First BSP fills and inits all known values, including its own records.
+  //
+  mCpuMpData.NumberOfProcessors        = NumberOfProcessors;
+  mCpuMpData.NumberOfEnabledProcessors = NumberOfProcessors;
+
+  mCpuMpData.CpuData = AllocateZeroPool (
+                         mCpuMpData.NumberOfProcessors * sizeof (CPU_AP_DATA)
+                         );
+  if (mCpuMpData.CpuData == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  //
+  // Each processor has a stack slot at the offset of its index, so the BSP
+  // slot is unused; keeping it makes an AP's index follow from its stack.
+  //
+  gApStackSize  = PcdGet32 (PcdCpuApStackSize);
+  gApStacksBase = AllocatePages (
+                    EFI_SIZE_TO_PAGES (
+                      mCpuMpData.NumberOfProcessors *
+                      gApStackSize
+                      )
+                    );
+  if (gApStacksBase == NULL) {
+    FreePool (mCpuMpData.CpuData);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  //
+  // The BSP keeps the hart-local storage that CpuDxe attached, if any.
+  //
+  mHartLocal = AllocatePool (mCpuMpData.NumberOfProcessors * sizeof (RISCV_HART_LOCAL));
+  if (mHartLocal == NULL) {
+    FreePages (gApStacksBase, EFI_SIZE_TO_PAGES (mCpuMpData.NumberOfProcessors * gApStackSize));
+    FreePool (mCpuMpData.CpuData);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Status = gBS->CreateEvent (
+                  EVT_TIMER | EVT_NOTIFY_SIGNAL,
+                  TPL_CALLBACK,
+                  CheckAllAPsStatus,
+                  NULL,
+                  &mCpuMpData.CheckAllAPsEvent
+                  );
+  ASSERT_EFI_ERROR (Status);
+
+  mApHartMaskBase = MAX_UINTN;
+  for (Index = 0; Index < mCpuMpData.NumberOfProcessors; Index++) {
+    FillInProcessorInformation (HartIds[Index] == BootHartId, HartIds[Index], Index);
+    if (HartIds[Index] != BootHartId) {
+      mApHartMaskBase = MIN (mApHartMaskBase, HartIds[Index]);
+    }
+
+    RiscVHartLocalInitialize (&mHartLocal[Index], HartIds[Index], Index);
+
+    if (HartIds[Index] == BootHartId) {
+      mCpuMpData.BspIndex = Index;
+      if (RiscVHartLocalGet () != NULL) {
+        RiscVHartLocalGet ()->ProcessorIndex = Index;
+      } else {
+        RiscVHartLocalAttach (&mHartLocal[Index]);
+      }
+    } else {
+      //
+      // Only harts parked in the SBI implementation can be started.
+      //
+      Status = SbiHartGetStatus (HartIds[Index], &HartState);
+      if (EFI_ERROR (Status) || (HartState != SBI_HSM_STATE_STOPPED)) {
+        DEBUG ((DEBUG_WARN, "%a: hart %lu is not stopped, disabling it\n", __func__, HartIds[Index]));
+        mCpuMpData.CpuData[Index].Info.StatusFlag &= ~(PROCESSOR_ENABLED_BIT | PROCESSOR_HEALTH_STATUS_BIT);
+        mCpuMpData.NumberOfEnabledProcessors--;
+      }
+    }
+
+    Status = gBS->CreateEvent (
+                    EVT_TIMER | EVT_NOTIFY_SIGNAL,
+                    TPL_CALLBACK,
+                    CheckThisAPStatus,
+                    (VOID *)&mCpuMpData.CpuData[Index],
+                    &mCpuMpData.CpuData[Index].CheckThisAPEvent
+                    );
+    ASSERT_EFI_ERROR (Status);
+  }
+
+  //
+  // The APs start with the MMU off and switch to the page tables of the BSP.
+  //
+  gSatp = RiscVGetSupervisorAddressTranslationRegister ();
+
+  for (ExceptionType = 0; ExceptionType <= EXCEPT_RISCV_MAX_EXCEPTIONS; ExceptionType++) {
+    RegisterCpuInterruptHandler (ExceptionType, ApExceptionHandler);
+  }
+
+  mNonBlockingModeAllowed = TRUE;
+
+  Status = EfiCreateEventReadyToBootEx (
+             TPL_CALLBACK,
+             ReadyToBootSignaled,
+             NULL,
+             &ReadyToBootEvent
+             );
+  ASSERT_EFI_ERROR (Status);
+
+  return EFI_SUCCESS;
+}
+
+/** Stops the parked APs with hart_stop, as the OS expects to start the APs
+    itself. APs that are still busy stop once their procedure returns.
+
+  @param[in]  Event    The ExitBootServices event.
+  @param[in]  Context  Unused.
+
+**/
+STATIC
+VOID
+EFIAPI
+StopParkedAps (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  UINTN        Index;
+  CPU_AP_DATA  *CpuData;
+
+  mApParkingDisabled = TRUE;
+  MemoryFence ();
+
+  for (Index = 0; Index < mCpuMpData.NumberOfProcessors; Index++) {
+    CpuData = &mCpuMpData.CpuData[Index];
+    if (!IsProcessorBSP (Index) && CpuData->Parked) {
+      CpuData->StopRequested = TRUE;
+      SendIpi (CpuData);
+    }
+  }
+
+  for (Index = 0; Index < mCpuMpData.NumberOfProcessors; Index++) {
+    CpuData = &mCpuMpData.CpuData[Index];
+    if (CpuData->StopRequested &&
+        EFI_ERROR (WaitForHartStopped (CpuData->Info.ProcessorId)))
+    {
+      DEBUG ((DEBUG_ERROR, "%a: hart %lu did not stop\n", __func__, CpuData->Info.ProcessorId));
+    }
+  }
+}
+
+/** Maps the page of an S-level IMSIC interrupt file as MMIO.
+
+   @param[in] File The address of the file.
+
+   @retval TRUE  The file is mapped.
+   @retval FALSE The file could not be mapped.
+
+**/
+STATIC
+BOOLEAN
+MapImsicFile (
+  IN EFI_PHYSICAL_ADDRESS  File
+  )
+{
+  EFI_STATUS                       Status;
+  EFI_GCD_MEMORY_SPACE_DESCRIPTOR  Descriptor;
+
+  Status = gDS->AddMemorySpace (
+                  EfiGcdMemoryTypeMemoryMappedIo,
+                  File,
+                  EFI_PAGE_SIZE,
+                  EFI_MEMORY_UC
+                  );
+  if (!EFI_ERROR (Status)) {
+    Status = gDS->SetMemorySpaceAttributes (File, EFI_PAGE_SIZE, EFI_MEMORY_UC);
+    return !EFI_ERROR (Status);
+  }
+
+  //
+  // MMIO that is already in the GCD map is mapped already.
+  //
+  Status = gDS->GetMemorySpaceDescriptor (File, &Descriptor);
+  return !EFI_ERROR (Status) && (Descriptor.GcdMemoryType == EfiGcdMemoryTypeMemoryMappedIo);
+}
+
+/** Finds the S-level IMSIC interrupt file of each AP in the device tree, and
+    maps it, so that the AP can park between procedures.
+
+    Only IMSICs of one group are supported, where the interrupt files of hart
+    index N are at page N << guest-index-bits of the first register region.
+
+   @return The number of APs that can park.
+
+**/
+STATIC
+UINTN
+FindImsicFiles (
+  VOID
+  )
+{
+  VOID                  *Hob;
+  VOID                  *Fdt;
+  INT32                 Node;
+  CONST UINT32          *Data32;
+  CONST UINT32          *Reg;
+  INT32                 TempLen;
+  INT32                 RegLen;
+  INT32                 AddressCells;
+  UINT32                Entry;
+  INT32                 CpuNode;
+  UINT64                HartId;
+  UINT32                GuestIndexBits;
+  EFI_PHYSICAL_ADDRESS  Base;
+  EFI_PHYSICAL_ADDRESS  File;
+  UINTN                 Index;
+  UINTN                 Count;
+
+  Hob = GetFirstGuidHob (&gFdtHobGuid);
+  if (Hob == NULL) {
+    return 0;
+  }
+
+  Fdt = (VOID *)(UINTN)*(UINT64 *)GET_GUID_HOB_DATA (Hob);
+  if ((Fdt == NULL) || (FdtCheckHeader (Fdt) != 0)) {
+    return 0;
+  }
+
+  Count = 0;
+  for (Node = FdtNodeOffsetByCompatible (Fdt, -1, "riscv,imsics")
+       ; Node >= 0
+       ; Node = FdtNodeOffsetByCompatible (Fdt, Node, "riscv,imsics")
+       ) {
+    AddressCells = FdtAddressCells (Fdt, FdtParentOffset (Fdt, Node));
+    Reg          = (CONST UINT32 *)FdtGetProp (Fdt, Node, "reg", &RegLen);
+    Data32       = (CONST UINT32 *)FdtGetProp (Fdt, Node, "interrupts-extended", &TempLen);
+    if ((Reg == NULL) || (Data32 == NULL) || (AddressCells < 1) || (AddressCells > 2) ||
+        (RegLen < AddressCells * (INT32)sizeof (UINT32)))
+    {
+      continue;
+    }
+
+    Base = (AddressCells == 2) ? Fdt64ToCpu (ReadUnaligned64 ((CONST UINT64 *)Reg))
+                               : Fdt32ToCpu (ReadUnaligned32 (Reg));
+
+    GuestIndexBits = 0;
+    Reg            = (CONST UINT32 *)FdtGetProp (Fdt, Node, "riscv,guest-index-bits", &RegLen);
+    if ((Reg != NULL) && (RegLen == sizeof (UINT32))) {
+      GuestIndexBits = Fdt32ToCpu (ReadUnaligned32 (Reg));
+    }
+
+    //
+    // The position of a hart's supervisor external interrupt in
+    // interrupts-extended is its hart index in the IMSIC. The M-level IMSIC
+    // targets the machine external interrupts, and is skipped.
+    //
+    for (Entry = 0; Entry < (UINT32)TempLen / (2 * sizeof (UINT32)); Entry++) {
+      if (Fdt32ToCpu (ReadUnaligned32 (Data32 + 2 * Entry + 1)) != IRQ_S_EXT) {
+        continue;
+      }
+
+      CpuNode = FdtNodeOffsetByPhandle (Fdt, Fdt32ToCpu (ReadUnaligned32 (Data32 + 2 * Entry)));
+      if (CpuNode < 0) {
+        continue;
+      }
+
+      CpuNode = FdtParentOffset (Fdt, CpuNode);
+      Reg     = (CONST UINT32 *)FdtGetProp (Fdt, CpuNode, "reg", &RegLen);
+      if ((Reg != NULL) && (RegLen == sizeof (UINT32))) {
+        HartId = Fdt32ToCpu (ReadUnaligned32 (Reg));
+      } else if ((Reg != NULL) && (RegLen == sizeof (UINT64))) {
+        HartId = Fdt64ToCpu (ReadUnaligned64 ((CONST UINT64 *)Reg));
+      } else {
+        continue;
+      }
+
+      for (Index = 0; Index < mCpuMpData.NumberOfProcessors; Index++) {
+        if ((mCpuMpData.CpuData[Index].Info.ProcessorId == HartId) &&
+            !IsProcessorBSP (Index) &&
+            (mCpuMpData.CpuData[Index].ImsicFile == 0))
+        {
+          File = Base + LShiftU64 (Entry, GuestIndexBits + EFI_PAGE_SHIFT);
+          if (MapImsicFile (File)) {
+            mCpuMpData.CpuData[Index].ImsicFile = File;
+            Count++;
+          }
+
+          break;
+        }
+      }
+    }
+  }
+
+  return Count;
+}
+
+/** Collects the hart IDs of the enabled cpu nodes of the device tree.
+
+   @param[out] HartIds       The hart IDs, allocated with AllocatePool().
+   @param[out] NumberOfHarts The number of entries in HartIds.
+
+   @retval EFI_SUCCESS           The hart IDs were collected.
+   @retval EFI_NOT_FOUND         There is no valid device tree.
+   @retval EFI_OUT_OF_RESOURCES  Memory could not be allocated.
+
+**/
+STATIC
+EFI_STATUS
+GetHartIds (
+  OUT UINTN  **HartIds,
+  OUT UINTN  *NumberOfHarts
+  )
+{
+  VOID         *Hob;
+  VOID         *Fdt;
+  INT32        Node;
+  INT32        TempLen;
+  CONST CHAR8  *CpuStatus;
+  CONST VOID   *Reg;
+  UINTN        Count;
+  UINTN        *Ids;
+
+  Hob = GetFirstGuidHob (&gFdtHobGuid);
+  if (Hob == NULL) {
+    return EFI_NOT_FOUND;
+  }
+
+  Fdt = (VOID *)(UINTN)*(UINT64 *)GET_GUID_HOB_DATA (Hob);
+  if ((Fdt == NULL) || (FdtCheckHeader (Fdt) != 0)) {
+    return EFI_NOT_FOUND;
+  }
+
+  Count = 0;
+  for (Node = FdtNodeOffsetByPropValue (Fdt, -1, "device_type", "cpu", sizeof ("cpu"))
+       ; Node >= 0
+       ; Node = FdtNodeOffsetByPropValue (Fdt, Node, "device_type", "cpu", sizeof ("cpu"))
+       ) {
+    Count++;
+  }
+
+  if (Count == 0) {
+    return EFI_NOT_FOUND;
+  }
+
+  Ids = AllocatePool (Count * sizeof (UINTN));
+  if (Ids == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Count = 0;
+  for (Node = FdtNodeOffsetByPropValue (Fdt, -1, "device_type", "cpu", sizeof ("cpu"))
+       ; Node >= 0
+       ; Node = FdtNodeOffsetByPropValue (Fdt, Node, "device_type", "cpu", sizeof ("cpu"))
+       ) {
+    CpuStatus = FdtGetProp (Fdt, Node, "status", &TempLen);
+    if ((CpuStatus != NULL) && (AsciiStrCmp (CpuStatus, "okay") != 0) && (AsciiStrCmp (CpuStatus, "ok") != 0)) {
+      continue;
+    }
+
+    Reg = FdtGetProp (Fdt, Node, "reg", &TempLen);
+    if ((Reg != NULL) && (TempLen == sizeof (UINT32))) {
+      Ids[Count++] = Fdt32ToCpu (ReadUnaligned32 ((CONST UINT32 *)Reg));
+    } else if ((Reg != NULL) && (TempLen == sizeof (UINT64))) {
+      Ids[Count++] = (UINTN)Fdt64ToCpu (ReadUnaligned64 ((CONST UINT64 *)Reg));
+    }
+  }
+
+  *HartIds       = Ids;
+  *NumberOfHarts = Count;
+  return EFI_SUCCESS;
+}
+
+/** Initialize multi-processor support.
+
+  @param ImageHandle  Image handle.
+  @param SystemTable  System table.
+
+  @return EFI_SUCCESS on success, or an error code.
+
+**/
+EFI_STATUS
+EFIAPI
+RiscVSbiMpServicesDxeInitialize (
+  IN EFI_HANDLE        ImageHandle,
+  IN EFI_SYSTEM_TABLE  *SystemTable
+  )
+{
+  EFI_STATUS               Status;
+  EFI_HANDLE               Handle;
+  RISCV_EFI_BOOT_PROTOCOL  *RiscVBootProtocol;
+  SBI_RET                  Ret;
+  UINTN                    BootHartId;
+  UINTN                    *HartIds;
+  UINTN                    NumberOfHarts;
+  UINTN                    Index;
+  EFI_EVENT                ExitBootServicesEvent;
+  UINTN                    ParkableAps;
+
+  Ret = SbiCall (SBI_EXT_BASE, SBI_EXT_BASE_PROBE_EXT, 1, SBI_EXT_HSM);
+  if ((Ret.Error != SBI_SUCCESS) || (Ret.Value == 0)) {
+    DEBUG ((DEBUG_WARN, "%a: SBI HSM extension not available\n", __func__));
+    return EFI_UNSUPPORTED;
+  }
+
+  Status = gBS->LocateProtocol (
+                  &gRiscVEfiBootProtocolGuid,
+                  NULL,
+                  (VOID **)&RiscVBootProtocol
+                  );
+  ASSERT_EFI_ERROR (Status);
+
+  Status = RiscVBootProtocol->GetBootHartId (RiscVBootProtocol, &BootHartId);
+  ASSERT_EFI_ERROR (Status);
+
+  Status = GetHartIds (&HartIds, &NumberOfHarts);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "%a: failed to find the harts: %r\n", __func__, Status));
+    return Status;
+  }
+
+  for (Index = 0; Index < NumberOfHarts; Index++) {
+    if (HartIds[Index] == BootHartId) {
+      break;
+    }
+  }
+
+  if (Index == NumberOfHarts) {
+    DEBUG ((DEBUG_ERROR, "%a: boot hart %lu is not in the device tree\n", __func__, BootHartId));
+    FreePool (HartIds);
+    return EFI_NOT_FOUND;
+  }
+
+  if (NumberOfHarts == 1) {
+    DEBUG ((DEBUG_WARN, "Trying to use EFI_MP_SERVICES_PROTOCOL on a UP system\n"));
+    // We are not MP so nothing to do
+    FreePool (HartIds);
+    return EFI_NOT_FOUND;
+  }
+
+  Status = MpServicesInitialize (NumberOfHarts, HartIds, BootHartId);
+  FreePool (HartIds);
+  if (Status != EFI_SUCCESS) {
+    ASSERT_EFI_ERROR (Status);
+    return Status;
+  }
+
+  //
+  // The TLB shootdown protocol must be there for CpuDxe to find when it is
+  // notified of the MP services protocol.
+  //
+  Handle      = NULL;
+  ParkableAps = FindImsicFiles ();
+  if (ParkableAps != 0) {
+    Status = gBS->CreateEvent (
+                    EVT_SIGNAL_EXIT_BOOT_SERVICES,
+                    TPL_NOTIFY,
+                    StopParkedAps,
+                    NULL,
+                    &ExitBootServicesEvent
+                    );
+    if (!EFI_ERROR (Status)) {
+      Status = gBS->InstallMultipleProtocolInterfaces (
+                      &Handle,
+                      &gRiscVTlbShootdownProtocolGuid,
+                      &mTlbShootdownProtocol,
+                      NULL
+                      );
+      ASSERT_EFI_ERROR (Status);
+      DEBUG ((DEBUG_INFO, "%a: %u APs park between procedures\n", __func__, ParkableAps));
+    } else {
+      //
+      // Without the event, parked APs couldn't be stopped for the OS.
+      //
+      for (Index = 0; Index < NumberOfHarts; Index++) {
+        mCpuMpData.CpuData[Index].ImsicFile = 0;
+      }
+    }
+  }
+
+  //
+  // Now install the MP services protocol.
+  //
+  Status = gBS->InstallMultipleProtocolInterfaces (
+                  &Handle,
+                  &gEfiMpServiceProtocolGuid,
+                  &mMpServicesProtocol,
+                  NULL
+                  );
+  ASSERT_EFI_ERROR (Status);
+
+  return Status;
+}
+
+/** Parks an AP whose procedure is finished, until it is dispatched again.
+
+   While parked, the AP flushes its TLB for each shootdown request.
+
+   @param CpuData The AP.
+
+   @retval TRUE  The AP is dispatched another procedure.
+   @retval FALSE The AP has no IMSIC, or must stop for ExitBootServices.
+
+**/
+STATIC
+BOOLEAN
+ApPark (
+  IN CPU_AP_DATA  *CpuData
+  )
+{
+  UINTN  Request;
+
+  if (CpuData->ImsicFile == 0) {
+    return FALSE;
+  }
+
+  //
+  // Either the AP sees that parking is disabled, or the BSP sees it parked and
+  // asks it to stop.
+  //
+  CpuData->Parked = TRUE;
+  MemoryFence ();
+  if (mApParkingDisabled) {
+    return FALSE;
+  }
+
+  CpuData->State = CpuStateFinished;
+
+  while (TRUE) {
+    ApWaitForIpi ();
+
+    Request = CpuData->ShootdownRequest;
+    if (CpuData->ShootdownDone != Request) {
+      ApLocalTlbFlushAll ();
+      MemoryFence ();
+      CpuData->ShootdownDone = Request;
+    }
+
+    if (CpuData->StopRequested) {
+      return FALSE;
+    }
+
+    if (GetApState (CpuData) == CpuStateBusy) {
+      return TRUE;
+    }
+  }
+}
+
+/** C entry-point for the AP.
+    This function gets called from the assembly function ApEntryPoint.
+
+   @param ProcessorIndex The index of the processor that is starting.
+
+**/
+VOID
+ApProcedure (
+  IN UINTN  ProcessorIndex
+  )
+{
+  CPU_AP_DATA  *CpuData;
+
+  CpuData = &mCpuMpData.CpuData[ProcessorIndex];
+
+  //
+  // The block outlives the procedure, so per-hart caches persist across dispatches.
+  //
+  RiscVHartLocalAttach (&mHartLocal[ProcessorIndex]);
+  InitializeCpuExceptionHandlers (NULL);
+
+  if (CpuData->ImsicFile != 0) {
+    ApImsicEnable (MP_IPI_ID);
+  }
+
+  do {
+    CpuData->Procedure (CpuData->Parameter);
+  } while (ApPark (CpuData));
+
+  if (CpuData->ImsicFile != 0) {
+    ApImsicDisable ();
+  }
+
+  MemoryFence ();
+  CpuData->State = CpuStateFinished;
+
+  /* Since we're finished with this AP, stop it */
+  SbiHartStop ();
+
+  /* Should never be reached */
+  ASSERT (FALSE);
+  CpuDeadLoop ();
+}
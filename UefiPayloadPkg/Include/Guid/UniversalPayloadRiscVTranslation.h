@@ -0,0 +1,60 @@
+/** @file
+  Universal Payload RISC-V address translation definitions.
+
+  A bootloader that already enabled the harts' MMU, or left RISC-V IOMMUs
+  translating, describes the live structures in this HOB, so that the payload
+  takes them over instead of building its own tables and waiting for the
+  hardware again. The structures must not overlap memory that the bootloader
+  reports as free; the payload reserves them as boot-services data.
+
+Copyright (c) 2025, 9elements GmbH. All rights reserved.<BR>
+SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef UNIVERSAL_PAYLOAD_RISCV_TRANSLATION_H_
+#define UNIVERSAL_PAYLOAD_RISCV_TRANSLATION_H_
+
+#include <UniversalPayload/UniversalPayload.h>
+
+extern GUID  gUniversalPayloadRiscVTranslationGuid;
+
+#pragma pack(1)
+
+//
+// An IOMMU that the bootloader left running, with its queues on and its device directory walked.
+//
+typedef struct {
+  // The register base of the IOMMU.
+  UINT64    RegisterBase;
+  // The DDTP, CQB and FQB registers as programmed, and PQB, or 0 without a page-request queue.
+  // An IOMMU whose registers read otherwise was changed since, and isn't taken over.
+  UINT64    DeviceDirectoryPointer;
+  UINT64    CommandQueueBase;
+  UINT64    FaultQueueBase;
+  UINT64    PageRequestQueueBase;
+  // The range that holds the directory, queues and page tables of the IOMMU.
+  UINT64    StructureBase;
+  UINT64    StructureSize;
+} UNIVERSAL_PAYLOAD_RISCV_IOMMU;
+
+typedef struct {
+  UNIVERSAL_PAYLOAD_GENERIC_HEADER    Header;
+  // The satp value that enabled the harts' identity map, or 0 if the MMU is off.
+  UINT64                              Satp;
+  // The pages that hold the map's tables, the root first.
+  UINT64                              TableBase;
+  UINT64                              NumberOfTablePages;
+  // The end of the range identity-mapped from 0, with every permission.
+  UINT64                              MappedEnd;
+  // The IOMMUs that follow.
+  UINT32                              Count;
+  UINT32                              Reserved;
+  UNIVERSAL_PAYLOAD_RISCV_IOMMU       IoMmu[0];
+} UNIVERSAL_PAYLOAD_RISCV_TRANSLATION;
+
+#pragma pack()
+
+#define UNIVERSAL_PAYLOAD_RISCV_TRANSLATION_REVISION  1
+
+#endif // UNIVERSAL_PAYLOAD_RISCV_TRANSLATION_H_
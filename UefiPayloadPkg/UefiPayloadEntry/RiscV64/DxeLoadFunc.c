@@ -14,10 +14,126 @@
 #include <Library/MemoryAllocationLib.h>
 #include <Library/PcdLib.h>
 #include <Library/HobLib.h>
+#include <Guid/RiscVMmuHandOff.h>
+#include <Guid/UniversalPayloadRiscVTranslation.h>
 #include "UefiPayloadEntry.h"
 
 #define STACK_SIZE  0x20000
 
+//
+// The device-directory table pointer and queue base registers of a RISC-V IOMMU.
+//
+#define RISCV_IOMMU_DDTP_OFFSET  0x10
+#define RISCV_IOMMU_CQB_OFFSET   0x18
+#define RISCV_IOMMU_FQB_OFFSET   0x28
+#define RISCV_IOMMU_PQB_OFFSET   0x38
+
+/**
+  Check that an IOMMU still runs with the structures the bootloader described.
+
+  @param[in]  IoMmu  The IOMMU, as the bootloader described it.
+
+  @retval  TRUE   The DDTP, CQB, FQB and, with a page-request queue, PQB read as described.
+  @retval  FALSE  The IOMMU was changed since, or the description is unusable.
+
+**/
+STATIC
+BOOLEAN
+IsRiscVIoMmuUnchanged (
+  IN UNIVERSAL_PAYLOAD_RISCV_IOMMU  *IoMmu
+  )
+{
+  UINTN  Base;
+
+  if ((IoMmu->RegisterBase == 0) || (IoMmu->StructureSize == 0) ||
+      ((IoMmu->StructureBase & EFI_PAGE_MASK) != 0))
+  {
+    return FALSE;
+  }
+
+  Base = (UINTN)IoMmu->RegisterBase;
+  return (BOOLEAN)((MmioRead64 (Base + RISCV_IOMMU_DDTP_OFFSET) == IoMmu->DeviceDirectoryPointer) &&
+                   (MmioRead64 (Base + RISCV_IOMMU_CQB_OFFSET) == IoMmu->CommandQueueBase) &&
+                   (MmioRead64 (Base + RISCV_IOMMU_FQB_OFFSET) == IoMmu->FaultQueueBase) &&
+                   ((IoMmu->PageRequestQueueBase == 0) ||
+                    (MmioRead64 (Base + RISCV_IOMMU_PQB_OFFSET) == IoMmu->PageRequestQueueBase)));
+}
+
+/**
+  Take over the translation structures that the bootloader left live.
+
+  The harts' identity map is handed to the RISC-V MMU library as if SEC had built it,
+  so that DXE refines it instead of building its own with the MMU off. The structures
+  of each IOMMU that still uses them are reserved, so that the RISC-V IOMMU driver can
+  adopt the running IOMMU, rather than quiescing it and initialising it from reset.
+
+**/
+STATIC
+VOID
+BuildRiscVTranslationHobs (
+  VOID
+  )
+{
+  UINT8                                *GuidHob;
+  UNIVERSAL_PAYLOAD_RISCV_TRANSLATION  *Translation;
+  UNIVERSAL_PAYLOAD_RISCV_IOMMU        *IoMmu;
+  RISCV_MMU_HAND_OFF                   HandOff;
+  UINTN                                Index;
+
+  GuidHob = GetFirstGuidHob (&gUniversalPayloadRiscVTranslationGuid);
+  if (GuidHob == NULL) {
+    return;
+  }
+
+  Translation = (UNIVERSAL_PAYLOAD_RISCV_TRANSLATION *)GET_GUID_HOB_DATA (GuidHob);
+  if ((Translation->Header.Revision != UNIVERSAL_PAYLOAD_RISCV_TRANSLATION_REVISION) ||
+      (GET_GUID_HOB_DATA_SIZE (GuidHob) < sizeof (*Translation)) ||
+      (GET_GUID_HOB_DATA_SIZE (GuidHob) < sizeof (*Translation) + Translation->Count * sizeof (Translation->IoMmu[0])))
+  {
+    DEBUG ((DEBUG_ERROR, "%a: The RISC-V translation HOB is malformed\n", __func__));
+    return;
+  }
+
+  //
+  // A satp that reads otherwise was changed since, and the tables aren't the bootloader's.
+  //
+  if ((Translation->Satp != 0) &&
+      (Translation->Satp == RiscVGetSupervisorAddressTranslationRegister ()) &&
+      (Translation->NumberOfTablePages != 0) &&
+      (GetFirstGuidHob (&gRiscVMmuHandOffHobGuid) == NULL))
+  {
+    BuildMemoryAllocationHob (Translation->TableBase, EFI_PAGES_TO_SIZE (Translation->NumberOfTablePages), EfiBootServicesData);
+
+    HandOff.Signature          = RISCV_MMU_HAND_OFF_SIGNATURE;
+    HandOff.Revision           = RISCV_MMU_HAND_OFF_REVISION;
+    HandOff.Satp               = Translation->Satp;
+    HandOff.TableBase          = Translation->TableBase;
+    HandOff.NumberOfTablePages = Translation->NumberOfTablePages;
+    HandOff.MappedEnd          = Translation->MappedEnd;
+    BuildGuidDataHob (&gRiscVMmuHandOffHobGuid, &HandOff, sizeof (HandOff));
+
+    DEBUG ((DEBUG_INFO, "%a: Handing the bootloader's map of 0x%lx bytes to DXE\n", __func__, HandOff.MappedEnd));
+  }
+
+  for (Index = 0; Index < Translation->Count; Index++) {
+    IoMmu = &Translation->IoMmu[Index];
+    if (!IsRiscVIoMmuUnchanged (IoMmu)) {
+      continue;
+    }
+
+    BuildMemoryAllocationHob (IoMmu->StructureBase, ALIGN_VALUE (IoMmu->StructureSize, EFI_PAGE_SIZE), EfiBootServicesData);
+
+    DEBUG ((
+      DEBUG_INFO,
+      "%a: Reserved 0x%lx-0x%lx for the running IOMMU at 0x%lx\n",
+      __func__,
+      IoMmu->StructureBase,
+      IoMmu->StructureBase + IoMmu->StructureSize - 1,
+      IoMmu->RegisterBase
+      ));
+  }
+}
+
 /**
    Transfers control to DxeCore.
 
@@ -60,6 +176,8 @@ HandOffToDxeCore (
   //
   UpdateStackHob ((EFI_PHYSICAL_ADDRESS)(UINTN)BaseOfStack, STACK_SIZE);
 
+  BuildRiscVTranslationHobs ();
+
   DEBUG ((DEBUG_INFO, "DXE Core new stack at %llx, stack pointer at %llx\n", BaseOfStack, TopOfStack));
 
   //